@@ -23,6 +23,7 @@
 #include <brpc/server.h>
 #include <brpc/controller.h>
 #include <brpc/channel.h>
+#include <brpc/serialized_field.h>
 #include <json2pb/pb_to_json.h>
 
 DEFINE_int32(port, 8000, "TCP Port of this server");
@@ -71,9 +72,19 @@ public:
             return;
         }
 
+        // Fields for routing can be found without parsing the whole
+        // request, say `message' (number 1) of EchoRequest.
+        brpc::SerializedField message_field(1);
+        if (brpc::FindSerializedFields(request->serialized_data(),
+                                       &message_field, 1) != 0) {
+            cntl->SetFailed(brpc::EREQUEST, "Fail to parse request");
+            return;
+        }
+
         LOG(INFO) << "Received request[log_id=" << cntl->log_id()
                   << "] from " << cntl->remote_side()
                   << " to " << cntl->local_side()
+                  << ", message=" << message_field.bytes
                   << ", serialized request size=" << request->serialized_data().size()
                   << ", request compress type=" << cntl->request_compress_type()
                   << " (attached=" << cntl->request_attachment() << ")";
@@ -0,0 +1,426 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Client of the performance suite. Runs every combination of the listed
+// protocols, connection types, transports, message sizes and concurrencies
+// against server.cpp and writes throughput, latency percentiles and CPU
+// time per request of each combination as JSON.
+
+#include <sys/resource.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <gflags/gflags.h>
+#include <json2pb/rapidjson.h>
+#include "butil/logging.h"
+#include "butil/strings/string_split.h"
+#include "butil/strings/string_number_conversions.h"
+#include "butil/time.h"
+#include "bthread/bthread.h"
+#include "brpc/channel.h"
+#include "brpc/redis.h"
+#include "brpc/rdma/rdma_helper.h"
+#include "perf.pb.h"
+
+DEFINE_string(server, "0.0.0.0:8002", "Address of the server, or a naming "
+              "service url like list://host1:8002,host2:8002");
+DEFINE_string(load_balancer, "rr", "The algorithm for load balancing when "
+              "-server is a naming service url");
+DEFINE_string(protocols, "baidu_std", "Comma-separated protocols, "
+              "available values: baidu_std, h2, grpc, redis");
+DEFINE_string(connection_types, "single", "Comma-separated connection "
+              "types, available values: single, pooled, short");
+DEFINE_string(transports, "tcp", "Comma-separated transports, available "
+              "values: tcp, ssl, rdma");
+DEFINE_string(message_sizes, "16,1024,65536", "Comma-separated bytes of "
+              "payload in each request and response");
+DEFINE_string(concurrencies, "1,16,128", "Comma-separated numbers of "
+              "bthreads sending requests synchronously");
+DEFINE_int32(warmup_s, 2, "Seconds to send requests before measuring in "
+             "each combination");
+DEFINE_int32(duration_s, 10, "Seconds to measure in each combination");
+DEFINE_int32(timeout_ms, 1000, "RPC timeout in milliseconds");
+DEFINE_string(label, "", "Put into results to tell runs apart, e.g. name "
+              "of the hardware");
+DEFINE_string(output, "", "Write results into this file, stdout if empty");
+
+struct Scenario {
+    std::string protocol;
+    std::string connection_type;
+    std::string transport;
+    int message_size;
+    int concurrency;
+};
+
+struct Result {
+    Result() : nrequest(0), nerror(0), elapsed_us(0), client_cpu_us(0)
+             , server_cpu_us(-1), server_nrequest(0) {}
+    std::string error;   // non-empty if the scenario cannot run.
+    std::string first_call_error;
+    int64_t nrequest;
+    int64_t nerror;
+    int64_t elapsed_us;
+    std::vector<int64_t> latencies_us;
+    int64_t client_cpu_us;
+    int64_t server_cpu_us;     // -1 if unknown.
+    int64_t server_nrequest;
+};
+
+static int64_t ProcessCpuTimeUs() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000L +
+        usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// Modified by the main thread only.
+static volatile bool g_recording = false;
+static volatile bool g_stop = false;
+
+struct Sender {
+    Sender() : channel(NULL), message_size(0), redis(false)
+             , nrequest(0), nerror(0), tid(INVALID_BTHREAD) {}
+    brpc::Channel* channel;
+    int message_size;
+    bool redis;
+    int64_t nrequest;
+    int64_t nerror;
+    std::string first_error;
+    std::vector<int64_t> latencies_us;
+    bthread_t tid;
+};
+
+static bool CallOnce(Sender* s, const std::string& payload,
+                     brpc::Controller* cntl) {
+    if (s->redis) {
+        brpc::RedisRequest request;
+        brpc::RedisResponse response;
+        const butil::StringPiece components[] = { "echo", payload };
+        request.AddCommandByComponents(components, 2);
+        s->channel->CallMethod(NULL, cntl, &request, &response, NULL);
+        if (!cntl->Failed() && response.reply(0).is_error()) {
+            cntl->SetFailed(brpc::ERESPONSE, "%s", response.reply(0).error_message());
+        }
+    } else {
+        perf::EchoRequest request;
+        perf::EchoResponse response;
+        request.set_payload(payload);
+        perf::PerfService_Stub stub(s->channel);
+        stub.Echo(cntl, &request, &response, NULL);
+    }
+    return !cntl->Failed();
+}
+
+static void* SendRequests(void* arg) {
+    Sender* s = static_cast<Sender*>(arg);
+    const std::string payload(s->message_size, 'x');
+    while (!g_stop) {
+        brpc::Controller cntl;
+        const bool ok = CallOnce(s, payload, &cntl);
+        if (!g_recording) {
+            continue;
+        }
+        if (ok) {
+            ++s->nrequest;
+            s->latencies_us.push_back(cntl.latency_us());
+        } else {
+            if (s->nerror++ == 0) {
+                s->first_error = cntl.ErrorText();
+            }
+            // Don't spin on a dead server.
+            bthread_usleep(1000);
+        }
+    }
+    return NULL;
+}
+
+static int GetServerStats(brpc::Channel* stats_channel,
+                          perf::StatsResponse* stats) {
+    brpc::Controller cntl;
+    perf::StatsRequest request;
+    perf::PerfService_Stub stub(stats_channel);
+    stub.Stats(&cntl, &request, stats, NULL);
+    if (cntl.Failed()) {
+        LOG(WARNING) << "Fail to get stats of server: " << cntl.ErrorText();
+        return -1;
+    }
+    return 0;
+}
+
+static int InitChannel(const Scenario& sc, brpc::Channel* channel,
+                       std::string* error) {
+    brpc::ChannelOptions options;
+    options.protocol = (sc.protocol == "grpc" ? "h2:grpc" : sc.protocol);
+    options.connection_type = sc.connection_type;
+    options.timeout_ms = FLAGS_timeout_ms;
+    options.max_retry = 0;
+    if (sc.transport == "ssl") {
+        options.mutable_ssl_options();
+    } else if (sc.transport == "rdma") {
+#ifdef BRPC_WITH_RDMA
+        options.use_rdma = true;
+#else
+        *error = "brpc is not compiled with rdma";
+        return -1;
+#endif
+    } else if (sc.transport != "tcp") {
+        *error = "Unknown transport";
+        return -1;
+    }
+    if (channel->Init(FLAGS_server.c_str(), FLAGS_load_balancer.c_str(),
+                      &options) != 0) {
+        *error = "Fail to initialize channel";
+        return -1;
+    }
+    return 0;
+}
+
+static void Run(const Scenario& sc, brpc::Channel* stats_channel,
+                Result* result) {
+    brpc::Channel channel;
+    if (InitChannel(sc, &channel, &result->error) != 0) {
+        return;
+    }
+    std::vector<Sender> senders(sc.concurrency);
+    for (size_t i = 0; i < senders.size(); ++i) {
+        Sender& s = senders[i];
+        s.channel = &channel;
+        s.message_size = sc.message_size;
+        s.redis = (sc.protocol == "redis");
+        // Fail fast on combinations not supported by the server.
+        if (i == 0) {
+            brpc::Controller cntl;
+            if (!CallOnce(&s, std::string(sc.message_size, 'x'), &cntl)) {
+                result->error = cntl.ErrorText();
+                return;
+            }
+        }
+    }
+    g_recording = false;
+    g_stop = false;
+    for (size_t i = 0; i < senders.size(); ++i) {
+        if (bthread_start_background(&senders[i].tid, NULL,
+                                     SendRequests, &senders[i]) != 0) {
+            result->error = "Fail to start bthread";
+            g_stop = true;
+            break;
+        }
+    }
+    if (!g_stop) {
+        sleep(FLAGS_warmup_s);
+        perf::StatsResponse stats0;
+        const bool has_stats0 = (GetServerStats(stats_channel, &stats0) == 0);
+        const int64_t start_cpu_us = ProcessCpuTimeUs();
+        const int64_t start_us = butil::monotonic_time_us();
+        g_recording = true;
+        sleep(FLAGS_duration_s);
+        g_recording = false;
+        result->elapsed_us = butil::monotonic_time_us() - start_us;
+        result->client_cpu_us = ProcessCpuTimeUs() - start_cpu_us;
+        perf::StatsResponse stats1;
+        if (has_stats0 && GetServerStats(stats_channel, &stats1) == 0) {
+            result->server_cpu_us = stats1.cpu_time_us() - stats0.cpu_time_us();
+            result->server_nrequest = stats1.nrequest() - stats0.nrequest();
+        }
+        g_stop = true;
+    }
+    for (size_t i = 0; i < senders.size(); ++i) {
+        if (senders[i].tid != INVALID_BTHREAD) {
+            bthread_join(senders[i].tid, NULL);
+        }
+        result->nrequest += senders[i].nrequest;
+        result->nerror += senders[i].nerror;
+        if (result->first_call_error.empty()) {
+            result->first_call_error = senders[i].first_error;
+        }
+        result->latencies_us.insert(result->latencies_us.end(),
+                                    senders[i].latencies_us.begin(),
+                                    senders[i].latencies_us.end());
+    }
+}
+
+static int64_t Percentile(const std::vector<int64_t>& sorted, double ratio) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    const size_t index = (size_t)(ratio * sorted.size());
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+typedef BUTIL_RAPIDJSON_NAMESPACE::PrettyWriter<
+    BUTIL_RAPIDJSON_NAMESPACE::StringBuffer> JsonWriter;
+
+static void WriteResult(const Scenario& sc, Result* r, JsonWriter* w) {
+    w->StartObject();
+    w->Key("label"); w->String(FLAGS_label.c_str());
+    w->Key("server"); w->String(FLAGS_server.c_str());
+    w->Key("protocol"); w->String(sc.protocol.c_str());
+    w->Key("connection_type"); w->String(sc.connection_type.c_str());
+    w->Key("transport"); w->String(sc.transport.c_str());
+    w->Key("message_size"); w->AddInt(sc.message_size);
+    w->Key("concurrency"); w->AddInt(sc.concurrency);
+    if (!r->error.empty()) {
+        w->Key("error"); w->String(r->error.c_str());
+        w->EndObject();
+        return;
+    }
+    const double seconds = r->elapsed_us / 1000000.0;
+    w->Key("duration_s"); w->Double(seconds);
+    w->Key("requests"); w->AddInt64(r->nrequest);
+    w->Key("errors"); w->AddInt64(r->nerror);
+    if (!r->first_call_error.empty()) {
+        w->Key("first_error"); w->String(r->first_call_error.c_str());
+    }
+    w->Key("qps"); w->Double(r->nrequest / seconds);
+    // Payloads of both directions.
+    w->Key("throughput_MBps");
+    w->Double(2.0 * r->nrequest * sc.message_size / seconds / 1048576);
+
+    std::vector<int64_t>& lat = r->latencies_us;
+    std::sort(lat.begin(), lat.end());
+    int64_t sum = 0;
+    for (size_t i = 0; i < lat.size(); ++i) {
+        sum += lat[i];
+    }
+    w->Key("latency_us");
+    w->StartObject();
+    w->Key("avg"); w->Double(lat.empty() ? 0 : (double)sum / lat.size());
+    w->Key("p50"); w->AddInt64(Percentile(lat, 0.5));
+    w->Key("p90"); w->AddInt64(Percentile(lat, 0.9));
+    w->Key("p99"); w->AddInt64(Percentile(lat, 0.99));
+    w->Key("p999"); w->AddInt64(Percentile(lat, 0.999));
+    w->Key("max"); w->AddInt64(lat.empty() ? 0 : lat.back());
+    w->EndObject();
+
+    w->Key("client_cpu_us_per_request");
+    w->Double(r->nrequest ? (double)r->client_cpu_us / r->nrequest : 0);
+    if (r->server_cpu_us >= 0) {
+        // Counted by the server, including requests from other clients.
+        w->Key("server_cpu_us_per_request");
+        w->Double(r->server_nrequest ?
+                  (double)r->server_cpu_us / r->server_nrequest : 0);
+        w->Key("server_qps"); w->Double(r->server_nrequest / seconds);
+    }
+    w->EndObject();
+}
+
+static bool SplitList(const std::string& flag_name, const std::string& value,
+                      std::vector<std::string>* out) {
+    butil::SplitString(value, ',', out);
+    out->erase(std::remove(out->begin(), out->end(), std::string()), out->end());
+    if (out->empty()) {
+        LOG(ERROR) << "-" << flag_name << " is empty";
+        return false;
+    }
+    return true;
+}
+
+static bool SplitIntList(const std::string& flag_name, const std::string& value,
+                         std::vector<int>* out) {
+    std::vector<std::string> items;
+    if (!SplitList(flag_name, value, &items)) {
+        return false;
+    }
+    for (size_t i = 0; i < items.size(); ++i) {
+        int v = 0;
+        if (!butil::StringToInt(items[i], &v) || v < 0) {
+            LOG(ERROR) << "Invalid `" << items[i] << "' in -" << flag_name;
+            return false;
+        }
+        out->push_back(v);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+
+    std::vector<std::string> protocols;
+    std::vector<std::string> connection_types;
+    std::vector<std::string> transports;
+    std::vector<int> message_sizes;
+    std::vector<int> concurrencies;
+    if (!SplitList("protocols", FLAGS_protocols, &protocols) ||
+        !SplitList("connection_types", FLAGS_connection_types, &connection_types) ||
+        !SplitList("transports", FLAGS_transports, &transports) ||
+        !SplitIntList("message_sizes", FLAGS_message_sizes, &message_sizes) ||
+        !SplitIntList("concurrencies", FLAGS_concurrencies, &concurrencies)) {
+        return -1;
+    }
+#ifdef BRPC_WITH_RDMA
+    if (std::find(transports.begin(), transports.end(), "rdma") !=
+        transports.end()) {
+        brpc::rdma::GlobalRdmaInitializeOrDie();
+    }
+#endif
+
+    // Stats of the server are always fetched over baidu_std and TCP.
+    brpc::Channel stats_channel;
+    brpc::ChannelOptions stats_options;
+    stats_options.timeout_ms = FLAGS_timeout_ms;
+    if (stats_channel.Init(FLAGS_server.c_str(), FLAGS_load_balancer.c_str(),
+                           &stats_options) != 0) {
+        LOG(ERROR) << "Fail to initialize channel to " << FLAGS_server;
+        return -1;
+    }
+
+    BUTIL_RAPIDJSON_NAMESPACE::StringBuffer buffer;
+    JsonWriter writer(buffer);
+    writer.StartArray();
+    for (size_t p = 0; p < protocols.size(); ++p)
+    for (size_t c = 0; c < connection_types.size(); ++c)
+    for (size_t t = 0; t < transports.size(); ++t)
+    for (size_t m = 0; m < message_sizes.size(); ++m)
+    for (size_t n = 0; n < concurrencies.size(); ++n) {
+        Scenario sc;
+        sc.protocol = protocols[p];
+        sc.connection_type = connection_types[c];
+        sc.transport = transports[t];
+        sc.message_size = message_sizes[m];
+        sc.concurrency = concurrencies[n];
+        Result result;
+        Run(sc, &stats_channel, &result);
+        LOG(INFO) << "protocol=" << sc.protocol
+                  << " connection_type=" << sc.connection_type
+                  << " transport=" << sc.transport
+                  << " message_size=" << sc.message_size
+                  << " concurrency=" << sc.concurrency
+                  << (result.error.empty() ? "" : " error=") << result.error
+                  << " qps=" << (result.elapsed_us ?
+                                 result.nrequest * 1000000 / result.elapsed_us : 0);
+        WriteResult(sc, &result, &writer);
+    }
+    writer.EndArray();
+
+    FILE* fp = stdout;
+    if (!FLAGS_output.empty()) {
+        fp = fopen(FLAGS_output.c_str(), "w");
+        if (fp == NULL) {
+            PLOG(ERROR) << "Fail to open " << FLAGS_output;
+            return -1;
+        }
+    }
+    fprintf(fp, "%s\n", buffer.GetString());
+    if (fp != stdout) {
+        fclose(fp);
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Server of the performance suite, serving echo over baidu_std, h2, grpc
+// and redis on one port, with optional SSL and RDMA. Run client.cpp
+// against it.
+
+#include <sys/resource.h>
+#include <gflags/gflags.h>
+#include "butil/atomicops.h"
+#include "butil/logging.h"
+#include "brpc/server.h"
+#include "brpc/redis.h"
+#include "brpc/rdma/rdma_helper.h"
+#include "perf.pb.h"
+
+DEFINE_int32(port, 8002, "TCP Port of this server");
+DEFINE_string(ssl_cert, "", "Certificate file to accept SSL connections, "
+              "e.g. ../multi_threaded_echo_c++/cert.pem");
+DEFINE_string(ssl_key, "", "Private key file of -ssl_cert");
+DEFINE_bool(use_rdma, false, "Accept RDMA connections as well");
+DEFINE_int32(max_concurrency, 0, "Limit of request processing in parallel");
+
+static butil::atomic<int64_t> g_nrequest(0);
+
+static int64_t ProcessCpuTimeUs() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000L +
+        usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+namespace perf {
+class PerfServiceImpl : public PerfService {
+public:
+    void Echo(google::protobuf::RpcController* cntl_base,
+              const EchoRequest* request,
+              EchoResponse* response,
+              google::protobuf::Closure* done) override {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        g_nrequest.fetch_add(1, butil::memory_order_relaxed);
+        response->set_payload(request->payload());
+        cntl->response_attachment().swap(cntl->request_attachment());
+    }
+
+    void Stats(google::protobuf::RpcController*,
+               const StatsRequest*,
+               StatsResponse* response,
+               google::protobuf::Closure* done) override {
+        brpc::ClosureGuard done_guard(done);
+        response->set_cpu_time_us(ProcessCpuTimeUs());
+        response->set_nrequest(g_nrequest.load(butil::memory_order_relaxed));
+    }
+};
+}  // namespace perf
+
+class EchoCommandHandler : public brpc::RedisCommandHandler {
+public:
+    brpc::RedisCommandHandlerResult Run(
+        const std::vector<butil::StringPiece>& args,
+        brpc::RedisReply* output, bool /*flush_batched*/) override {
+        if (args.size() != 2) {
+            output->SetError("ERR wrong number of arguments for 'echo' command");
+            return brpc::REDIS_CMD_HANDLED;
+        }
+        g_nrequest.fetch_add(1, butil::memory_order_relaxed);
+        output->SetString(args[1]);
+        return brpc::REDIS_CMD_HANDLED;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+
+    brpc::Server server;
+    perf::PerfServiceImpl perf_service_impl;
+    if (server.AddService(&perf_service_impl,
+                          brpc::SERVER_DOESNT_OWN_SERVICE) != 0) {
+        LOG(ERROR) << "Fail to add service";
+        return -1;
+    }
+
+    brpc::ServerOptions options;
+    brpc::RedisService* redis_service = new brpc::RedisService;
+    redis_service->AddCommandHandler("echo", new EchoCommandHandler);
+    // Owned by server.
+    options.redis_service = redis_service;
+    options.max_concurrency = FLAGS_max_concurrency;
+    if (!FLAGS_ssl_cert.empty()) {
+        // Connections without SSL are still accepted.
+        options.mutable_ssl_options()->default_cert.certificate = FLAGS_ssl_cert;
+        options.mutable_ssl_options()->default_cert.private_key = FLAGS_ssl_key;
+    }
+    if (FLAGS_use_rdma) {
+#ifdef BRPC_WITH_RDMA
+        brpc::rdma::GlobalRdmaInitializeOrDie();
+        options.use_rdma = true;
+#else
+        LOG(ERROR) << "brpc is not compiled with rdma";
+        return -1;
+#endif
+    }
+    if (server.Start(FLAGS_port, &options) != 0) {
+        LOG(ERROR) << "Fail to start PerfServer";
+        return -1;
+    }
+
+    server.RunUntilAskedToQuit();
+    return 0;
+}
@@ -17,11 +17,13 @@
 
 
 #include <inttypes.h>
+#include <algorithm>
 #include <gflags/gflags.h>
 #include "butil/fd_guard.h"                 // fd_guard 
 #include "butil/fd_utility.h"               // make_close_on_exec
 #include "butil/time.h"                     // gettimeofday_us
 #include "brpc/rdma/rdma_endpoint.h"
+#include "brpc/shm/shm_endpoint.h"
 #include "brpc/acceptor.h"
 
 
@@ -36,11 +38,12 @@ Acceptor::Acceptor(bthread_keytable_pool_t* pool)
     , _idle_timeout_sec(-1)
     , _close_idle_tid(INVALID_BTHREAD)
     , _listened_fd(-1)
-    , _acception_id(0)
+    , _nlistening(0)
     , _empty_cond(&_map_mutex)
     , _force_ssl(false)
     , _ssl_ctx(NULL) 
     , _use_rdma(false)
+    , _shm_listened_fd(-1)
     , _bthread_tag(BTHREAD_TAG_DEFAULT) {
 }
 
@@ -52,10 +55,41 @@ Acceptor::~Acceptor() {
 int Acceptor::StartAccept(int listened_fd, int idle_timeout_sec,
                           const std::shared_ptr<SocketSSLContext>& ssl_ctx,
                           bool force_ssl) {
-    if (listened_fd < 0) {
-        LOG(FATAL) << "Invalid listened_fd=" << listened_fd;
+    size_t nconsumed = 0;
+    return DoStartAccept(std::vector<int>(1, listened_fd), idle_timeout_sec,
+                         ssl_ctx, force_ssl, &nconsumed);
+}
+
+int Acceptor::StartAccept(const std::vector<int>& listened_fds,
+                          int idle_timeout_sec,
+                          const std::shared_ptr<SocketSSLContext>& ssl_ctx,
+                          bool force_ssl) {
+    size_t nconsumed = 0;
+    const int rc = DoStartAccept(listened_fds, idle_timeout_sec,
+                                 ssl_ctx, force_ssl, &nconsumed);
+    // Close fds which are not owned by acception sockets.
+    for (size_t i = nconsumed; i < listened_fds.size(); ++i) {
+        if (listened_fds[i] >= 0) {
+            close(listened_fds[i]);
+        }
+    }
+    return rc;
+}
+
+int Acceptor::DoStartAccept(const std::vector<int>& listened_fds,
+                            int idle_timeout_sec,
+                            const std::shared_ptr<SocketSSLContext>& ssl_ctx,
+                            bool force_ssl, size_t* nconsumed) {
+    if (listened_fds.empty()) {
+        LOG(FATAL) << "No listened_fd to accept";
         return -1;
     }
+    for (size_t i = 0; i < listened_fds.size(); ++i) {
+        if (listened_fds[i] < 0) {
+            LOG(FATAL) << "Invalid listened_fd=" << listened_fds[i];
+            return -1;
+        }
+    }
 
     if (!ssl_ctx && force_ssl) {
         LOG(ERROR) << "Fail to force SSL for all connections "
@@ -63,7 +97,7 @@ int Acceptor::StartAccept(int listened_fd, int idle_timeout_sec,
         return -1;
     }
     
-    BAIDU_SCOPED_LOCK(_map_mutex);
+    std::unique_lock<butil::Mutex> mu(_map_mutex);
     if (_status == UNINITIALIZED) {
         if (Initialize() != 0) {
             LOG(FATAL) << "Fail to initialize Acceptor";
@@ -87,21 +121,44 @@ int Acceptor::StartAccept(int listened_fd, int idle_timeout_sec,
     _force_ssl = force_ssl;
     _ssl_ctx = ssl_ctx;
     
-    // Creation of _acception_id is inside lock so that OnNewConnections
+    // Creation of _acception_ids is inside lock so that OnNewConnections
     // (which may run immediately) should see sane fields set below.
-    SocketOptions options;
-    options.fd = listened_fd;
-    options.user = this;
-    options.bthread_tag = _bthread_tag;
-    options.on_edge_triggered_events = OnNewConnections;
-    if (Socket::Create(options, &_acception_id) != 0) {
-        // Close-idle-socket thread will be stopped inside destructor
-        LOG(FATAL) << "Fail to create _acception_id";
+    _acception_ids.clear();
+    _nlistening = 0;
+    for (size_t i = 0; i < listened_fds.size(); ++i) {
+        SocketOptions options;
+        options.fd = listened_fds[i];
+        options.user = this;
+        options.bthread_tag = _bthread_tag;
+        if (listened_fds.size() > 1) {
+            options.event_dispatcher_index = i;
+        }
+        options.on_edge_triggered_events = OnNewConnections;
+        SocketId acception_id;
+        if (Socket::Create(options, &acception_id) != 0) {
+            // Close-idle-socket thread will be stopped inside destructor
+            LOG(FATAL) << "Fail to create acception socket of fd="
+                       << listened_fds[i];
+            break;
+        }
+        _acception_ids.push_back(acception_id);
+        ++_nlistening;
+        *nconsumed = i + 1;
+    }
+    if (_acception_ids.empty()) {
         return -1;
     }
-    
-    _listened_fd = listened_fd;
+
+    _listened_fd = listened_fds[0];
     _status = RUNNING;
+    if (*nconsumed != listened_fds.size()) {
+        // Stop the listeners created so far. Close-idle-socket thread is
+        // stopped inside Join() as well.
+        mu.unlock();
+        StopAccept(0);
+        Join();
+        return -1;
+    }
     return 0;
 }
 
@@ -135,8 +192,10 @@ void Acceptor::StopAccept(int /*closewait_ms*/) {
         _status = STOPPING;
     }
 
-    // Don't set _acception_id to 0 because BeforeRecycle needs it.
-    Socket::SetFailed(_acception_id);
+    // Don't clear _acception_ids because BeforeRecycle needs them.
+    for (size_t i = 0; i < _acception_ids.size(); ++i) {
+        Socket::SetFailed(_acception_ids[i]);
+    }
 
     // SetFailed all existing connections. Connections added after this piece
     // of code will be SetFailed directly in OnNewConnectionsUntilEAGAIN
@@ -177,8 +236,8 @@ void Acceptor::Join() {
     if (_status != STOPPING && _status != RUNNING) {  // no need to join.
         return;
     }
-    // `_listened_fd' will be set to -1 once it has been recycled
-    while (_listened_fd > 0 || !_socket_map.empty()) {
+    // `_nlistening' will be 0 once all acception sockets have been recycled
+    while (_nlistening > 0 || !_socket_map.empty()) {
         _empty_cond.Wait();
     }
     const int saved_idle_timeout_sec = _idle_timeout_sec;
@@ -293,7 +352,18 @@ void Acceptor::OnNewConnectionsUntilEAGAIN(Socket* acception) {
             options.on_edge_triggered_events = InputMessenger::OnNewMessages;
         }
         options.use_rdma = am->_use_rdma;
+        if (acception->fd() == am->_shm_listened_fd) {
+            // Data is not sent through the unix socket, SSL is useless.
+            options.on_edge_triggered_events =
+                shm::ShmEndpoint::OnNewDataFromUnix;
+            options.use_rdma = false;
+            options.force_ssl = false;
+            options.initial_ssl_ctx = NULL;
+        }
         options.bthread_tag = am->_bthread_tag;
+        // Stay on the dispatcher of the listener.
+        options.event_dispatcher_index =
+            acception->_io_event.event_dispatcher_index();
         if (Socket::Create(options, &socket_id) != 0) {
             LOG(ERROR) << "Fail to create Socket";
             continue;
@@ -345,12 +415,15 @@ void Acceptor::OnNewConnections(Socket* acception) {
 
 void Acceptor::BeforeRecycle(Socket* sock) {
     BAIDU_SCOPED_LOCK(_map_mutex);
-    if (sock->id() == _acception_id) {
-        // Set _listened_fd to -1 when acception socket has been recycled
-        // so that we are ensured no more events will arrive (and `Join'
-        // will return to its caller)
-        _listened_fd = -1;
-        _empty_cond.Broadcast();
+    if (std::find(_acception_ids.begin(), _acception_ids.end(),
+                  sock->id()) != _acception_ids.end()) {
+        // Set _listened_fd to -1 when all acception sockets have been
+        // recycled so that we are ensured no more events will arrive (and
+        // `Join' will return to its caller)
+        if (--_nlistening == 0) {
+            _listened_fd = -1;
+            _empty_cond.Broadcast();
+        }
         return;
     }
     // If a Socket could not be addressed shortly after its creation, it
@@ -58,6 +58,18 @@ public:
                     const std::shared_ptr<SocketSSLContext>& ssl_ctx,
                     bool force_ssl);
 
+    // [thread-safe] Accept connections from all `listened_fds', which are
+    // generally bound to the same port with SO_REUSEPORT so that the kernel
+    // spreads incoming connections over them. Events of the i-th listener
+    // and of all connections accepted from it are handled by the i-th
+    // EventDispatcher of the bthread tag of this Acceptor. Ownership of
+    // `listened_fds' is transferred to `Acceptor' even if this function
+    // fails, in which case they're closed. Other semantics are same with
+    // the one above.
+    int StartAccept(const std::vector<int>& listened_fds, int idle_timeout_sec,
+                    const std::shared_ptr<SocketSSLContext>& ssl_ctx,
+                    bool force_ssl);
+
     // [thread-safe] Stop accepting connections.
     // `closewait_ms' is not used anymore.
     void StopAccept(int /*closewait_ms*/);
@@ -65,9 +77,13 @@ public:
     // Wait until all existing Sockets(defined in socket.h) are recycled.
     void Join();
 
-    // The parameter to StartAccept. Negative when acceptor is stopped.
+    // The parameter to StartAccept (the first one if there're multiple
+    // listeners). Negative when acceptor is stopped.
     int listened_fd() const { return _listened_fd; }
 
+    // Number of listened fds given to last StartAccept.
+    size_t listener_count() const { return _acception_ids.size(); }
+
     // Get number of existing connections.
     size_t ConnectionCount() const;
 
@@ -86,6 +102,13 @@ private:
 
     static void* CloseIdleConnections(void* arg);
     
+    // Implementation of StartAccept. `nconsumed' is set to the number of
+    // fds in `listened_fds' owned by acception sockets, even on failure.
+    int DoStartAccept(const std::vector<int>& listened_fds,
+                      int idle_timeout_sec,
+                      const std::shared_ptr<SocketSSLContext>& ssl_ctx,
+                      bool force_ssl, size_t* nconsumed);
+
     // Initialize internal structure. 
     int Initialize();
 
@@ -98,8 +121,10 @@ private:
     bthread_t _close_idle_tid;
 
     int _listened_fd;
-    // The Socket tso accept connections.
-    SocketId _acception_id;
+    // The Sockets to accept connections, one for each listened fd.
+    std::vector<SocketId> _acception_ids;
+    // Number of Sockets in `_acception_ids' that are not recycled yet.
+    size_t _nlistening;
 
     butil::Mutex _map_mutex;
     butil::ConditionVariable _empty_cond;
@@ -113,6 +138,10 @@ private:
     // Whether to use rdma or not
     bool _use_rdma;
 
+    // Connections accepted from this listened fd use the shared-memory
+    // transport, see brpc/shm/shm_endpoint.h. -1 if there's none.
+    int _shm_listened_fd;
+
     // Acceptor belongs to this tag
     bthread_tag_t _bthread_tag;
 };
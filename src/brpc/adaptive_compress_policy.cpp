@@ -0,0 +1,158 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <unistd.h>
+#include <algorithm>
+#include <sys/resource.h>
+#include "butil/time.h"
+#include "brpc/adaptive_compress_policy.h"
+
+namespace brpc {
+
+AdaptiveCompressOptions::AdaptiveCompressOptions()
+    : min_size(1024)
+    , max_ratio(0.9)
+    , cpu_busy_utilization(0.7)
+    , cpu_overload_utilization(0.9)
+    , explore_interval(64) {
+}
+
+AdaptiveCompressPolicy::AdaptiveCompressPolicy(
+    const AdaptiveCompressOptions& options)
+    : _options(options)
+    , _nselect(0) {
+}
+
+// Shared by all policies, the first caller after every 100ms refreshes it.
+static double ProcessCpuUtilization() {
+    static const int64_t REFRESH_INTERVAL_US = 100000;
+    static const long ncpu = std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+    static butil::atomic<int64_t> s_last_us(0);
+    static butil::atomic<int64_t> s_last_cpu_us(0);
+    static butil::atomic<double> s_utilization(0);
+    const int64_t now_us = butil::monotonic_time_us();
+    int64_t last_us = s_last_us.load(butil::memory_order_relaxed);
+    if (now_us - last_us >= REFRESH_INTERVAL_US &&
+        s_last_us.compare_exchange_strong(last_us, now_us)) {
+        struct rusage ru;
+        if (getrusage(RUSAGE_SELF, &ru) == 0) {
+            const int64_t cpu_us = butil::timeval_to_microseconds(ru.ru_utime) +
+                butil::timeval_to_microseconds(ru.ru_stime);
+            const int64_t last_cpu_us = s_last_cpu_us.exchange(cpu_us);
+            if (last_us != 0) {
+                s_utilization.store(
+                    (double)(cpu_us - last_cpu_us) / (now_us - last_us) / ncpu,
+                    butil::memory_order_relaxed);
+            }
+        }
+    }
+    return s_utilization.load(butil::memory_order_relaxed);
+}
+
+double AdaptiveCompressPolicy::CpuUtilization() const {
+    return ProcessCpuUtilization();
+}
+
+CompressType AdaptiveCompressPolicy::Select(size_t raw_size,
+                                            CompressType preferred) {
+    if (raw_size < _options.min_size) {
+        return COMPRESS_TYPE_NONE;
+    }
+    const CompressType* candidates = &preferred;
+    size_t ncandidate = (preferred != COMPRESS_TYPE_NONE);
+    if (!_options.candidates.empty()) {
+        candidates = &_options.candidates[0];
+        ncandidate = _options.candidates.size();
+    }
+    if (ncandidate == 0) {
+        return COMPRESS_TYPE_NONE;
+    }
+    const double cpu = CpuUtilization();
+    if (cpu >= _options.cpu_overload_utilization) {
+        return COMPRESS_TYPE_NONE;
+    }
+    if (_options.explore_interval > 0) {
+        const uint64_t n = _nselect.fetch_add(1, butil::memory_order_relaxed);
+        if (n % _options.explore_interval == 0) {
+            const CompressType type =
+                candidates[(n / _options.explore_interval) % ncandidate];
+            if (FindCompressHandler(type) != NULL) {
+                return type;
+            }
+        }
+    }
+    const bool busy = (cpu >= _options.cpu_busy_utilization);
+    CompressType best = COMPRESS_TYPE_NONE;
+    double best_score = 0;
+    for (size_t i = 0; i < ncandidate; ++i) {
+        const CompressType type = candidates[i];
+        if (type == COMPRESS_TYPE_NONE || FindCompressHandler(type) == NULL) {
+            continue;
+        }
+        const double ratio = RatioOf(type);
+        if (ratio == 0) {
+            // Never tried, and types beyond MAX_TRACKED_TYPE.
+            return type;
+        }
+        if (ratio > _options.max_ratio) {
+            continue;
+        }
+        const double score = (busy ? CostOf(type) : ratio);
+        if (best == COMPRESS_TYPE_NONE || score < best_score) {
+            best = type;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+static void UpdateAverage(butil::atomic<double>* avg, double sample) {
+    // Races between updaters lose a few samples, which is acceptable.
+    const double old = avg->load(butil::memory_order_relaxed);
+    avg->store(old == 0 ? sample : old + (sample - old) / 8,
+               butil::memory_order_relaxed);
+}
+
+void AdaptiveCompressPolicy::OnCompressed(CompressType type, size_t raw_size,
+                                          size_t compressed_size,
+                                          int64_t cost_us) {
+    if (type <= COMPRESS_TYPE_NONE || type >= MAX_TRACKED_TYPE ||
+        raw_size == 0) {
+        return;
+    }
+    Stat& s = _stats[type];
+    // Avoid 0 which means unknown.
+    UpdateAverage(&s.ratio, std::max((double)compressed_size / raw_size, 1e-6));
+    UpdateAverage(&s.ns_per_byte,
+                  std::max(cost_us * 1000.0 / raw_size, 1e-6));
+}
+
+double AdaptiveCompressPolicy::RatioOf(CompressType type) const {
+    if (type <= COMPRESS_TYPE_NONE || type >= MAX_TRACKED_TYPE) {
+        return 0;
+    }
+    return _stats[type].ratio.load(butil::memory_order_relaxed);
+}
+
+double AdaptiveCompressPolicy::CostOf(CompressType type) const {
+    if (type <= COMPRESS_TYPE_NONE || type >= MAX_TRACKED_TYPE) {
+        return 0;
+    }
+    return _stats[type].ns_per_byte.load(butil::memory_order_relaxed);
+}
+
+} // namespace brpc
@@ -0,0 +1,109 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#ifndef BRPC_ADAPTIVE_COMPRESS_POLICY_H
+#define BRPC_ADAPTIVE_COMPRESS_POLICY_H
+
+// To brpc developers: This is a header included by user, don't depend
+// on internal structures, use opaque pointers instead.
+
+#include <vector>
+#include "butil/atomicops.h"
+#include "brpc/compress.h"
+
+namespace brpc {
+
+struct AdaptiveCompressOptions {
+    AdaptiveCompressOptions();
+
+    // Messages smaller than this are not compressed.
+    // Default: 1024
+    size_t min_size;
+
+    // Compress types to choose from, ordered by preference. Types without
+    // registered handlers are skipped. If this is empty, the CompressType
+    // set in the controller is the only candidate.
+    // Default: empty
+    std::vector<CompressType> candidates;
+
+    // A candidate is not used when its measured compressed_size/raw_size
+    // is above this value, since bytes saved do not pay for the CPU.
+    // Default: 0.9
+    double max_ratio;
+
+    // When CPU utilization of the process(used cores / all cores) is above
+    // this value, the candidate costing least CPU per byte is chosen instead
+    // of the one compressing best.
+    // Default: 0.7
+    double cpu_busy_utilization;
+
+    // When CPU utilization of the process is above this value, messages are
+    // not compressed at all.
+    // Default: 0.9
+    double cpu_overload_utilization;
+
+    // One in every `explore_interval' selections picks candidates in turn
+    // regardless of their stats to keep the stats up-to-date. <= 0 disables.
+    // Default: 64
+    int explore_interval;
+};
+
+// Skip compression for small messages and pick the algorithm by measured
+// compression ratio, compression time and CPU utilization of the process.
+// Example:
+//   brpc::AdaptiveCompressOptions options;
+//   options.candidates.push_back(brpc::COMPRESS_TYPE_ZSTD);
+//   options.candidates.push_back(brpc::COMPRESS_TYPE_SNAPPY);
+//   server.SetCompressPolicyOf("example.EchoService.Echo",
+//                              new brpc::AdaptiveCompressPolicy(options));
+class AdaptiveCompressPolicy : public CompressPolicy {
+public:
+    explicit AdaptiveCompressPolicy(
+        const AdaptiveCompressOptions& options = AdaptiveCompressOptions());
+
+    CompressType Select(size_t raw_size, CompressType preferred) override;
+    void OnCompressed(CompressType type, size_t raw_size,
+                      size_t compressed_size, int64_t cost_us) override;
+
+    // Moving average of compressed_size/raw_size of `type', 0 if unknown.
+    double RatioOf(CompressType type) const;
+
+    // Moving average of nanoseconds spent on compressing one byte with
+    // `type', 0 if unknown.
+    double CostOf(CompressType type) const;
+
+protected:
+    // Used cores / all cores of the process, refreshed every 100ms.
+    // Overridable for testing.
+    virtual double CpuUtilization() const;
+
+private:
+    struct Stat {
+        Stat() : ratio(0), ns_per_byte(0) {}
+        butil::atomic<double> ratio;
+        butil::atomic<double> ns_per_byte;
+    };
+    // Stats of compress types beyond this are not tracked.
+    static const int MAX_TRACKED_TYPE = 32;
+
+    const AdaptiveCompressOptions _options;
+    butil::atomic<uint64_t> _nselect;
+    Stat _stats[MAX_TRACKED_TYPE];
+};
+
+} // namespace brpc
+
+#endif  // BRPC_ADAPTIVE_COMPRESS_POLICY_H
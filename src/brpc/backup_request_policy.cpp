@@ -0,0 +1,90 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/time.h"
+#include "brpc/backup_request_policy.h"
+
+
+namespace brpc {
+
+// Percentiles are not trusted before so many RPCs.
+static const int64_t MIN_SAMPLES = 100;
+// The percentile is recomputed at most once in so many microseconds.
+static const int64_t UPDATE_INTERVAL_US = 100000;
+// At most so many backup requests can be sent in a burst.
+static const int64_t MAX_TOKENS = 10 * 1000;
+
+AdaptiveBackupRequestPolicy::AdaptiveBackupRequestPolicy(
+    double percentile, double max_backup_ratio,
+    int32_t default_backup_request_ms)
+    : _percentile(percentile)
+    , _tokens_per_rpc((int64_t)(max_backup_ratio * 1000))
+    , _default_backup_request_ms(default_backup_request_ms)
+    , _backup_request_ms(default_backup_request_ms)
+    , _last_update_us(0)
+    , _tokens(MAX_TOKENS) {
+    LOG_IF(ERROR, percentile <= 0 || percentile >= 1)
+        << "percentile=" << percentile << " should be in (0, 1)";
+    LOG_IF(ERROR, max_backup_ratio < 0 || max_backup_ratio > 1)
+        << "max_backup_ratio=" << max_backup_ratio << " should be in [0, 1]";
+}
+
+int32_t AdaptiveBackupRequestPolicy::GetBackupRequestMs(
+    const Controller*) const {
+    const int64_t now_us = butil::gettimeofday_us();
+    int64_t last_us = _last_update_us.load(butil::memory_order_relaxed);
+    if (now_us - last_us < UPDATE_INTERVAL_US ||
+        !_last_update_us.compare_exchange_strong(
+            last_us, now_us, butil::memory_order_relaxed)) {
+        return _backup_request_ms.load(butil::memory_order_relaxed);
+    }
+    int32_t backup_request_ms = _default_backup_request_ms;
+    if (_latency.count() >= MIN_SAMPLES) {
+        const int64_t latency_us = _latency.latency_percentile(_percentile);
+        if (latency_us > 0) {
+            // Round up, a backup request after 0ms makes no sense.
+            backup_request_ms = (int32_t)std::min<int64_t>(
+                (latency_us + 999) / 1000, 0x7fffffff);
+        }
+    }
+    _backup_request_ms.store(backup_request_ms, butil::memory_order_relaxed);
+    return backup_request_ms;
+}
+
+bool AdaptiveBackupRequestPolicy::DoBackup(const Controller*) const {
+    int64_t tokens = _tokens.load(butil::memory_order_relaxed);
+    while (tokens >= 1000) {
+        if (_tokens.compare_exchange_weak(tokens, tokens - 1000,
+                                          butil::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void AdaptiveBackupRequestPolicy::OnRPCEnd(const Controller* controller) {
+    if (_tokens.fetch_add(_tokens_per_rpc, butil::memory_order_relaxed)
+        + _tokens_per_rpc > MAX_TOKENS) {
+        _tokens.store(MAX_TOKENS, butil::memory_order_relaxed);
+    }
+    if (!controller->Failed()) {
+        _latency << controller->latency_us();
+    }
+}
+
+} // namespace brpc
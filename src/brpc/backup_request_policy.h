@@ -19,6 +19,8 @@
 #ifndef BRPC_BACKUP_REQUEST_POLICY_H
 #define BRPC_BACKUP_REQUEST_POLICY_H
 
+#include "butil/atomicops.h"
+#include "bvar/latency_recorder.h"
 #include "brpc/controller.h"
 
 namespace brpc {
@@ -38,6 +40,36 @@ public:
     virtual void OnRPCEnd(const Controller* controller) = 0;
 };
 
+// Send backup requests after the `percentile' (e.g. 0.99) latency of recent
+// successful RPCs using this policy, rather than a fixed backup_request_ms.
+// Backup requests are limited to `max_backup_ratio' (e.g. 0.05) of all RPCs
+// by a token bucket, so that they don't amplify load when all servers slow
+// down. `default_backup_request_ms' is used before enough RPCs finished.
+// One instance can be shared by channels to the same kind of servers.
+// Example:
+//   brpc::AdaptiveBackupRequestPolicy policy(0.99, 0.05, 100);
+//   options.backup_request_policy = &policy;
+class AdaptiveBackupRequestPolicy : public BackupRequestPolicy {
+public:
+    AdaptiveBackupRequestPolicy(double percentile, double max_backup_ratio,
+                                int32_t default_backup_request_ms);
+
+    int32_t GetBackupRequestMs(const Controller* controller) const override;
+    bool DoBackup(const Controller* controller) const override;
+    void OnRPCEnd(const Controller* controller) override;
+
+private:
+    double _percentile;
+    // Tokens earned by every RPC, in thousandths.
+    int64_t _tokens_per_rpc;
+    int32_t _default_backup_request_ms;
+    bvar::LatencyRecorder _latency;
+    // Computing percentiles is not cheap, cache the result.
+    mutable butil::atomic<int32_t> _backup_request_ms;
+    mutable butil::atomic<int64_t> _last_update_us;
+    mutable butil::atomic<int64_t> _tokens;
+};
+
 }
 
 #endif // BRPC_BACKUP_REQUEST_POLICY_H
@@ -0,0 +1,255 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/logging.h"
+#include "butil/time.h"
+#include "butil/synchronization/lock.h"
+#include "bthread/bthread.h"
+#include "bthread/unstable.h"              // bthread_timer_add
+#include "bvar/bvar.h"
+#include "brpc/controller.h"
+#include "brpc/batched_method.h"
+
+namespace brpc {
+
+BatchedMethodOptions::BatchedMethodOptions()
+    : max_batch_size(32)
+    , max_delay_us(1000) {}
+
+class BatchedMethod::Impl : public std::enable_shared_from_this<Impl> {
+public:
+    Impl(const butil::StringPiece& name, const Handler& handler,
+         const BatchedMethodOptions& options);
+
+    void Add(const Call& call);
+    void Flush();
+
+private:
+    struct TimerArg {
+        std::shared_ptr<Impl> impl;
+        uint64_t version;
+    };
+
+    // Move pending calls into `batch' and cancel the timer.
+    // Called with _mutex held.
+    void TakeBatch(std::vector<Call>* batch);
+    void RunBatch(std::vector<Call>* batch);
+
+    static void OnTimer(void* arg);
+    static void* RunTimer(void* arg);
+
+    static int64_t GetBatchSize50(void* arg);
+    static int64_t GetBatchSize90(void* arg);
+    static int64_t GetBatchSize99(void* arg);
+
+    const Handler _handler;
+    const BatchedMethodOptions _options;
+
+    butil::Mutex _mutex;
+    std::vector<Call> _pending;
+    // Increased whenever a batch is taken, timers of older versions do
+    // nothing.
+    uint64_t _version;
+    bthread_timer_t _timer;
+    // Argument of the timer for current batch, NULL if no timer.
+    TimerArg* _timer_arg;
+
+    bvar::Adder<int64_t> _nbatch;
+    bvar::detail::Percentile _batch_size;
+    bvar::Window<bvar::detail::Percentile, bvar::SERIES_IN_SECOND>
+    _batch_size_window;
+    bvar::PassiveStatus<int64_t> _batch_size_50;
+    bvar::PassiveStatus<int64_t> _batch_size_90;
+    bvar::PassiveStatus<int64_t> _batch_size_99;
+};
+
+BatchedMethod::Impl::Impl(const butil::StringPiece& name,
+                          const Handler& handler,
+                          const BatchedMethodOptions& options)
+    : _handler(handler)
+    , _options(options)
+    , _version(0)
+    , _timer(0)
+    , _timer_arg(NULL)
+    , _batch_size_window(&_batch_size, -1)
+    , _batch_size_50(GetBatchSize50, this)
+    , _batch_size_90(GetBatchSize90, this)
+    , _batch_size_99(GetBatchSize99, this) {
+    if (!name.empty()) {
+        _nbatch.expose_as(name, "batch_count");
+        _batch_size_50.expose_as(name, "batch_size_50");
+        _batch_size_90.expose_as(name, "batch_size_90");
+        _batch_size_99.expose_as(name, "batch_size_99");
+    }
+}
+
+int64_t BatchedMethod::Impl::GetBatchSize50(void* arg) {
+    return static_cast<Impl*>(arg)->_batch_size_window.get_value().get_number(0.5);
+}
+
+int64_t BatchedMethod::Impl::GetBatchSize90(void* arg) {
+    return static_cast<Impl*>(arg)->_batch_size_window.get_value().get_number(0.9);
+}
+
+int64_t BatchedMethod::Impl::GetBatchSize99(void* arg) {
+    return static_cast<Impl*>(arg)->_batch_size_window.get_value().get_number(0.99);
+}
+
+void BatchedMethod::Impl::TakeBatch(std::vector<Call>* batch) {
+    batch->swap(_pending);
+    ++_version;
+    if (_timer_arg != NULL) {
+        // The timer is running or ran if it can't be deleted, it owns the
+        // argument then and does nothing for the stale version.
+        if (bthread_timer_del(_timer) == 0) {
+            delete _timer_arg;
+        }
+        _timer_arg = NULL;
+    }
+}
+
+void BatchedMethod::Impl::Add(const Call& call) {
+    std::vector<Call> batch;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        _pending.push_back(call);
+        if (_pending.size() < (size_t)_options.max_batch_size) {
+            if (_pending.size() > 1) {
+                return;
+            }
+            // The first call of a batch starts the timer.
+            TimerArg* arg = new TimerArg;
+            arg->impl = shared_from_this();
+            arg->version = _version;
+            if (bthread_timer_add(
+                    &_timer, butil::microseconds_from_now(_options.max_delay_us),
+                    OnTimer, arg) == 0) {
+                _timer_arg = arg;
+                return;
+            }
+            LOG(ERROR) << "Fail to add timer, run the batch directly";
+            delete arg;
+        }
+        TakeBatch(&batch);
+    }
+    RunBatch(&batch);
+}
+
+void BatchedMethod::Impl::Flush() {
+    std::vector<Call> batch;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_pending.empty()) {
+            return;
+        }
+        TakeBatch(&batch);
+    }
+    RunBatch(&batch);
+}
+
+void BatchedMethod::Impl::RunBatch(std::vector<Call>* batch) {
+    _nbatch << 1;
+    _batch_size << (int64_t)batch->size();
+    _handler(batch);
+}
+
+void BatchedMethod::Impl::OnTimer(void* arg) {
+    // Don't run user code in the TimerThread.
+    bthread_t tid;
+    if (bthread_start_background(&tid, NULL, RunTimer, arg) != 0) {
+        LOG(ERROR) << "Fail to start bthread";
+        RunTimer(arg);
+    }
+}
+
+void* BatchedMethod::Impl::RunTimer(void* void_arg) {
+    std::unique_ptr<TimerArg> arg(static_cast<TimerArg*>(void_arg));
+    Impl* impl = arg->impl.get();
+    std::vector<Call> batch;
+    {
+        BAIDU_SCOPED_LOCK(impl->_mutex);
+        if (impl->_timer_arg == arg.get()) {
+            impl->_timer_arg = NULL;
+        }
+        if (arg->version != impl->_version || impl->_pending.empty()) {
+            return NULL;
+        }
+        impl->TakeBatch(&batch);
+    }
+    impl->RunBatch(&batch);
+    return NULL;
+}
+
+BatchedMethod::BatchedMethod() {}
+
+BatchedMethod::~BatchedMethod() {
+    if (_impl) {
+        _impl->Flush();
+    }
+}
+
+int BatchedMethod::Init(const butil::StringPiece& name, const Handler& handler,
+                        const BatchedMethodOptions* options) {
+    if (_impl) {
+        LOG(ERROR) << "Already initialized";
+        return -1;
+    }
+    if (!handler) {
+        LOG(ERROR) << "Param[handler] is empty";
+        return -1;
+    }
+    BatchedMethodOptions opt;
+    if (options) {
+        opt = *options;
+    }
+    if (opt.max_batch_size <= 0) {
+        LOG(ERROR) << "Invalid max_batch_size=" << opt.max_batch_size;
+        return -1;
+    }
+    if (opt.max_delay_us < 0) {
+        LOG(ERROR) << "Invalid max_delay_us=" << opt.max_delay_us;
+        return -1;
+    }
+    _impl = std::make_shared<Impl>(name, handler, opt);
+    return 0;
+}
+
+void BatchedMethod::Add(google::protobuf::RpcController* cntl,
+                        const google::protobuf::Message* request,
+                        google::protobuf::Message* response,
+                        google::protobuf::Closure* done) {
+    if (!_impl) {
+        cntl->SetFailed("BatchedMethod is not initialized");
+        done->Run();
+        return;
+    }
+    Call call;
+    call.cntl = static_cast<Controller*>(cntl);
+    call.request = request;
+    call.response = response;
+    call.done = done;
+    _impl->Add(call);
+}
+
+void BatchedMethod::Flush() {
+    if (_impl) {
+        _impl->Flush();
+    }
+}
+
+} // namespace brpc
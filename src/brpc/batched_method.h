@@ -0,0 +1,120 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_BATCHED_METHOD_H
+#define BRPC_BATCHED_METHOD_H
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <google/protobuf/message.h>
+#include <google/protobuf/service.h>
+#include "butil/macros.h"
+#include "butil/strings/string_piece.h"
+
+namespace brpc {
+
+class Controller;
+
+struct BatchedMethodOptions {
+    // Constructed with default options.
+    BatchedMethodOptions();
+
+    // A batch is run as soon as it has so many calls.
+    // Default: 32
+    int max_batch_size;
+
+    // A batch is run when its first call waited for so long, even if it's
+    // not full.
+    // Default: 1000
+    int64_t max_delay_us;
+};
+
+// Gather concurrent calls to a method into batches, e.g. to run inference
+// of a model on GPU for many requests at once.
+//
+// Example:
+//   class MyService : public InferService {
+//   public:
+//       MyService() {
+//           _batcher.Init("infer_predict", [](std::vector<brpc::BatchedMethod::Call>* b) {
+//               ... fill (*b)[i].response ...
+//               for (size_t i = 0; i < b->size(); ++i) {
+//                   (*b)[i].done->Run();
+//               }
+//           }, NULL);
+//       }
+//       void Predict(google::protobuf::RpcController* cntl,
+//                    const PredictRequest* req, PredictResponse* res,
+//                    google::protobuf::Closure* done) override {
+//           _batcher.Add(cntl, req, res, done);
+//       }
+//   private:
+//       brpc::BatchedMethod _batcher;
+//   };
+//
+// Following bvars are exposed with the name given to Init():
+//   <name>_batch_count            number of batches run
+//   <name>_batch_size_{50,90,99}  percentiles of batch sizes in recent
+//                                 -bvar_dump_interval seconds
+class BatchedMethod {
+public:
+    struct Call {
+        Controller* cntl;
+        const google::protobuf::Message* request;
+        google::protobuf::Message* response;
+        google::protobuf::Closure* done;
+    };
+
+    // Called with a batch of calls. The handler must Run() `done' of every
+    // call, either before returning or later, the batch can be swapped out.
+    typedef std::function<void(std::vector<Call>*)> Handler;
+
+    BatchedMethod();
+    // Pending calls are run before destruction. Destroy after the server
+    // calling Add() is stopped.
+    ~BatchedMethod();
+
+    // Run batches with `handler'. `options' is default when it's NULL.
+    // Returns 0 on success, -1 otherwise.
+    int Init(const butil::StringPiece& name, const Handler& handler,
+             const BatchedMethodOptions* options);
+
+    // Put a call into the current batch. The batch is run in this bthread
+    // if it becomes full, otherwise the call returns immediately.
+    void Add(google::protobuf::RpcController* cntl,
+             const google::protobuf::Message* request,
+             google::protobuf::Message* response,
+             google::protobuf::Closure* done);
+
+    // Run the current batch now if it's not empty.
+    void Flush();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(BatchedMethod);
+
+    class Impl;
+    // Shared with pending timers which may outlive this object.
+    std::shared_ptr<Impl> _impl;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_BATCHED_METHOD_H
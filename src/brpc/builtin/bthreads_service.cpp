@@ -26,6 +26,9 @@ namespace bthread {
 extern void print_task(std::ostream& os, bthread_t tid, bool enable_trace,
                        bool ignore_not_matched = false);
 extern void print_living_tasks(std::ostream& os, bool enable_trace);
+extern void print_parking_stats(std::ostream& os);
+extern void print_long_running_tasks(std::ostream& os, int64_t threshold_ms,
+                                     bool enable_trace);
 }
 
 
@@ -48,6 +51,9 @@ void BthreadsService::default_method(::google::protobuf::RpcController* cntl_bas
         os << "Use /bthreads/<bthread_id>\n";
         os << "To check all living bthread, use /bthreads/all\n";
 #endif // BRPC_BTHREAD_TRACER
+        os << "To check bthreads running for N ms without yielding, use /bthreads/long?ms=N\n";
+        os << '\n';
+        ::bthread::print_parking_stats(os);
     } else {
         bool enable_trace = false;
 #ifdef BRPC_BTHREAD_TRACER
@@ -61,6 +67,14 @@ void BthreadsService::default_method(::google::protobuf::RpcController* cntl_bas
         if (*endptr == '\0' || *endptr == '/' || *endptr == '?') {
             ::bthread::print_task(os, tid, enable_trace);
         }
+        else if (constraint == "long") {
+            int64_t threshold_ms = 100;
+            const std::string* ms = cntl->http_request().uri().GetQuery("ms");
+            if (NULL != ms) {
+                threshold_ms = strtoll(ms->c_str(), NULL, 10);
+            }
+            ::bthread::print_long_running_tasks(os, threshold_ms, enable_trace);
+        }
         else if (constraint != "all" && constraint != "all?st=1") {
             cntl->SetFailed(ENOMETHOD, "path=%s is not a bthread id or all, or all?st=1\n",
                             constraint.c_str());
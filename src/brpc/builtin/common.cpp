@@ -309,6 +309,7 @@ const char* ProfilingType2String(ProfilingType t) {
     case PROFILING_GROWTH: return "growth";
     case PROFILING_CONTENTION: return "contention";
     case PROFILING_IOBUF: return "iobuf";
+    case PROFILING_WAIT: return "wait";
     }
     return "unknown";
 }
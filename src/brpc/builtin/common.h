@@ -53,6 +53,7 @@ enum ProfilingType {
     PROFILING_GROWTH = 2,
     PROFILING_CONTENTION = 3,
     PROFILING_IOBUF = 4,
+    PROFILING_WAIT = 5,
 };
 
 DECLARE_string(rpc_profiling_dir);
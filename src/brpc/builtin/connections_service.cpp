@@ -108,6 +108,34 @@ static std::string BriefName(const std::string& cname) {
     return tmp;
 }
 
+// Sort `conns' descendingly by `key' which is "latency", "p99" or "inflight".
+static void SortConnections(std::vector<SocketId>* conns,
+                            const std::string& key) {
+    std::vector<std::pair<int64_t, SocketId> > keyed;
+    keyed.reserve(conns->size());
+    for (size_t i = 0; i < conns->size(); ++i) {
+        SocketUniquePtr ptr;
+        SocketCallStat stat;
+        memset(&stat, 0, sizeof(stat));
+        if (Socket::AddressFailedAsWell((*conns)[i], &ptr) >= 0) {
+            ptr->GetCallStat(&stat);
+        }
+        int64_t v = 0;
+        if (key == "latency") {
+            v = stat.ewma_latency_us;
+        } else if (key == "p99") {
+            v = stat.latency_percentile_us(0.99);
+        } else if (key == "inflight") {
+            v = stat.ninflight;
+        }
+        keyed.push_back(std::make_pair(-v, (*conns)[i]));
+    }
+    std::stable_sort(keyed.begin(), keyed.end());
+    for (size_t i = 0; i < keyed.size(); ++i) {
+        (*conns)[i] = keyed[i].second;
+    }
+}
+
 void ConnectionsService::PrintConnections(
     std::ostream& os, const std::vector<SocketId>& conns,
     bool use_html, const Server* server, bool is_channel_conn) const {
@@ -121,7 +149,10 @@ void ConnectionsService::PrintConnections(
         if (is_channel_conn) {
             os << "<th>Local</th>"
                 "<th>RecentErr</th>"
-                "<th>nbreak</th>";
+                "<th>nbreak</th>"
+                "<th>Inflight</th>"
+                "<th>Latency(ms)</th>"
+                "<th>P99(ms)</th>";
         }
         os << "<th>SSL</th>"
             "<th>Protocol</th>"
@@ -140,7 +171,7 @@ void ConnectionsService::PrintConnections(
     } else {
         os << "CreatedTime               |RemoteSide         |";
         if (is_channel_conn) {
-            os << "Local|RecentErr|nbreak|";
+            os << "Local|RecentErr|nbreak|Inflight|Latency(ms)|P99(ms)|";
         }
         os << "SSL|Protocol    |fd   |"
             "InBytes/s|In/s  |InBytes/m |In/m    |"
@@ -178,7 +209,10 @@ void ConnectionsService::PrintConnections(
             if (is_channel_conn) {
                 os << min_width(ptr->local_side().port, 5) << bar
                    << min_width(ptr->recent_error_count(), 10) << bar
-                   << min_width(ptr->isolated_times(), 7) << bar;
+                   << min_width(ptr->isolated_times(), 7) << bar
+                   << min_width("-", 8) << bar
+                   << min_width("-", 11) << bar
+                   << min_width("-", 7) << bar;
             }
             os << min_width("-", 3) << bar
                << min_width("-", 12) << bar
@@ -285,6 +319,26 @@ void ConnectionsService::PrintConnections(
                 }
                 os << min_width(ptr->recent_error_count(), 10) << bar
                    << min_width(ptr->isolated_times(), 7) << bar;
+                SocketCallStat call_stat;
+                ptr->GetCallStat(&call_stat);
+                os << min_width(call_stat.ninflight, 8) << bar;
+                char latency[32];
+                snprintf(latency, sizeof(latency), "%.1f",
+                         call_stat.ewma_latency_us / 1000.0);
+                os << min_width(latency, 11) << bar;
+                // Latencies are bucketed, show the upper bound.
+                const int64_t p99_us = call_stat.latency_percentile_us(0.99);
+                char p99[16];
+                if (p99_us < 0) {
+                    strcpy(p99, "-");
+                } else if (p99_us == SocketCallStat::BUCKET_UPPER_US[
+                               SocketCallStat::NBUCKET - 1]) {
+                    strcpy(p99, ">1000");
+                } else {
+                    snprintf(p99, sizeof(p99), "<%lld",
+                             (long long)p99_us / 1000);
+                }
+                os << min_width(p99, 7) << bar;
             }
             os << SSLStateToYesNo(ptr->ssl_state(), use_html) << bar;
             char protname[32];
@@ -390,6 +444,10 @@ void ConnectionsService::default_method(
     }
 
     SocketMapList(&conns);
+    const std::string* sort_key = cntl->http_request().uri().GetQuery("sort");
+    if (sort_key) {
+        SortConnections(&conns, *sort_key);
+    }
     os << (use_html ? "<br>\n" : "\n")
        << "channel_connection_count: " << GetChannelConnectionCount() << '\n';
     PrintConnections(os, conns, use_html, server, true/*is_channel_conn*/);
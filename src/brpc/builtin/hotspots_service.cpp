@@ -31,6 +31,7 @@
 #include "brpc/builtin/pprof_perl.h"
 #include "brpc/builtin/hotspots_service.h"
 #include "brpc/details/tcmalloc_extension.h"
+#include "brpc/details/continuous_profiler.h"
 
 extern "C" {
 int BAIDU_WEAK ProfilerStart(const char* fname);
@@ -40,6 +41,8 @@ void BAIDU_WEAK ProfilerStop();
 namespace bthread {
 bool ContentionProfilerStart(const char* filename);
 void ContentionProfilerStop();
+bool WaitProfilerStart(const char* filename);
+void WaitProfilerStop();
 }
 
 namespace brpc {
@@ -154,7 +157,8 @@ struct ProfilingEnvironment {
 };
 
 // Different ProfilingType have different env.
-static ProfilingEnvironment g_env[5] = {
+static ProfilingEnvironment g_env[6] = {
+    { PTHREAD_MUTEX_INITIALIZER, 0, NULL, NULL, NULL },
     { PTHREAD_MUTEX_INITIALIZER, 0, NULL, NULL, NULL },
     { PTHREAD_MUTEX_INITIALIZER, 0, NULL, NULL, NULL },
     { PTHREAD_MUTEX_INITIALIZER, 0, NULL, NULL, NULL },
@@ -217,6 +221,12 @@ static bool WriteSmallFile(const char* filepath_in,
     return true;
 }
 
+// Profilers sampling for some seconds.
+static bool IsTimedProfiling(ProfilingType type) {
+    return type == PROFILING_CPU || type == PROFILING_CONTENTION ||
+        type == PROFILING_WAIT;
+}
+
 static int ReadSeconds(const Controller* cntl) {
     int seconds = DEFAULT_PROFILING_SECONDS;
     const std::string* param =
@@ -644,7 +654,7 @@ static void DoProfiling(ProfilingType type,
     }
 
     const int seconds = ReadSeconds(cntl);
-    if ((type == PROFILING_CPU || type == PROFILING_CONTENTION)) {
+    if (IsTimedProfiling(type)) {
         if (seconds < 0) {
             os << "Invalid seconds" << (use_html ? "</body></html>" : "\n");
             os.move_to(cntl->response_attachment());
@@ -662,7 +672,7 @@ static void DoProfiling(ProfilingType type,
         client_info << "(no auth)";
     }
     client_info << " requests for profiling " << ProfilingType2String(type);
-    if (type == PROFILING_CPU || type == PROFILING_CONTENTION) {
+    if (IsTimedProfiling(type)) {
         LOG(INFO) << client_info.str() << " for " << seconds << " seconds";
     } else {
         LOG(INFO) << client_info.str();
@@ -776,6 +786,18 @@ static void DoProfiling(ProfilingType type,
             PLOG(WARNING) << "Profiling has been interrupted";
         }
         bthread::ContentionProfilerStop();
+    } else if (type == PROFILING_WAIT) {
+        if (!bthread::WaitProfilerStart(prof_name)) {
+            os << "Another profiler (not via /hotspots/wait) is running, "
+                "try again later" << (use_html ? "</body></html>" : "\n");
+            os.move_to(resp);
+            cntl->http_response().set_status_code(HTTP_STATUS_SERVICE_UNAVAILABLE);
+            return NotifyWaiters(type, cntl, view);
+        }
+        if (bthread_usleep(seconds * 1000000L) != 0) {
+            PLOG(WARNING) << "Profiling has been interrupted";
+        }
+        bthread::WaitProfilerStop();
     } else if (type == PROFILING_IOBUF) {
         if (!butil::IsIOBufProfilerEnabled()) {
             os << "IOBuf profiler is not enabled"
@@ -858,7 +880,7 @@ static void StartProfiling(ProfilingType type,
     const char* extra_desc = "";
     if (type == PROFILING_CPU) {
         enabled = cpu_profiler_enabled;
-    } else if (type == PROFILING_CONTENTION) {
+    } else if (type == PROFILING_CONTENTION || type == PROFILING_WAIT) {
         enabled = true;
     } else if (type == PROFILING_IOBUF) {
         enabled = butil::IsIOBufProfilerEnabled();
@@ -944,7 +966,7 @@ static void StartProfiling(ProfilingType type,
           "  var base_prof_el = document.getElementById('base_prof');\n"
           "  var base_prof = base_prof_el != null ? base_prof_el.value : '';\n"
         "  var display_type = document.getElementById('display_type').value;\n";
-    if (type == PROFILING_CONTENTION) {
+    if (type == PROFILING_CONTENTION || type == PROFILING_WAIT) {
         os << "  var show_ccount = document.getElementById('ccount_cb').checked;\n";
     }
     os << "  var targetURL = '/hotspots/" << type_str << "';\n"
@@ -955,7 +977,7 @@ static void StartProfiling(ProfilingType type,
         "  if (base_prof != '') {\n"
         "    targetURL += '&base=' + base_prof;\n"
         "  }\n";
-    if (type == PROFILING_CONTENTION) {
+    if (type == PROFILING_CONTENTION || type == PROFILING_WAIT) {
         os <<
         "  if (show_ccount) {\n"
         "    targetURL += '&ccount';\n"
@@ -1008,7 +1030,7 @@ static void StartProfiling(ProfilingType type,
         "  }\n"
         "  $.ajax({\n"
         "    url: \"/hotspots/" << type_str << "_non_responsive?console=1";
-    if (type == PROFILING_CPU || type == PROFILING_CONTENTION) {
+    if (IsTimedProfiling(type)) {
         os << "&seconds=" << seconds;
     }
     if (profiling_client.id != 0) {
@@ -1103,7 +1125,7 @@ static void StartProfiling(ProfilingType type,
         "<option value=flame" << (display_type == DisplayType::kFlameGraph ? " selected" : "") << ">flame</option>"
 #endif
         "<option value=text" << (display_type == DisplayType::kText ? " selected" : "") << ">text</option></select>";
-    if (type == PROFILING_CONTENTION) {
+    if (type == PROFILING_CONTENTION || type == PROFILING_WAIT) {
         os << "&nbsp;&nbsp;&nbsp;<label for='ccount_cb'>"
             "<input id='ccount_cb' type='checkbox'"
            << (show_ccount ? " checked=''" : "") <<
@@ -1135,7 +1157,7 @@ static void StartProfiling(ProfilingType type,
         return;
     }
 
-    if ((type == PROFILING_CPU || type == PROFILING_CONTENTION) && view == NULL) {
+    if (IsTimedProfiling(type) && view == NULL) {
         if (seconds < 0) {
             os << "Invalid seconds</body></html>";
             os.move_to(cntl->response_attachment());
@@ -1159,11 +1181,11 @@ static void StartProfiling(ProfilingType type,
                       / 1000000.0);
         os << "Your request is merged with the request from "
            << profiling_client.point;
-        if (type == PROFILING_CPU || type == PROFILING_CONTENTION) {
+        if (IsTimedProfiling(type)) {
             os << ", showing in about " << wait_seconds << " seconds ...";
         }
     } else {
-        if ((type == PROFILING_CPU || type == PROFILING_CONTENTION) && view == NULL) {
+        if (IsTimedProfiling(type) && view == NULL) {
             os << "Profiling " << ProfilingType2String(type) << " for "
                << seconds << " seconds ...";
         } else {
@@ -1213,6 +1235,14 @@ void HotspotsService::contention(
     return StartProfiling(PROFILING_CONTENTION, cntl_base, done);
 }
 
+void HotspotsService::wait(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::HotspotsRequest*,
+    ::brpc::HotspotsResponse*,
+    ::google::protobuf::Closure* done) {
+    return StartProfiling(PROFILING_WAIT, cntl_base, done);
+}
+
 void HotspotsService::iobuf(::google::protobuf::RpcController* cntl_base,
     const ::brpc::HotspotsRequest* request,
     ::brpc::HotspotsResponse* response,
@@ -1253,6 +1283,14 @@ void HotspotsService::contention_non_responsive(
     return DoProfiling(PROFILING_CONTENTION, cntl_base, done);
 }
 
+void HotspotsService::wait_non_responsive(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::HotspotsRequest*,
+    ::brpc::HotspotsResponse*,
+    ::google::protobuf::Closure* done) {
+    return DoProfiling(PROFILING_WAIT, cntl_base, done);
+}
+
 void HotspotsService::iobuf_non_responsive(::google::protobuf::RpcController* cntl_base,
     const ::brpc::HotspotsRequest* request,
     ::brpc::HotspotsResponse* response,
@@ -1260,6 +1298,56 @@ void HotspotsService::iobuf_non_responsive(::google::protobuf::RpcController* cn
     return DoProfiling(PROFILING_IOBUF, cntl_base, done);
 }
 
+static bool ReadInt64Query(const Controller* cntl, const char* key,
+                           int64_t* value) {
+    const std::string* param = cntl->http_request().uri().GetQuery(key);
+    if (param == NULL) {
+        return true;
+    }
+    char* endptr = NULL;
+    const long long v = strtoll(param->c_str(), &endptr, 10);
+    if (param->empty() || endptr != param->c_str() + param->length()) {
+        return false;
+    }
+    *value = v;
+    return true;
+}
+
+void HotspotsService::continuous(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::HotspotsRequest*,
+    ::brpc::HotspotsResponse*,
+    ::google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller* cntl = static_cast<Controller*>(cntl_base);
+    if (!IsContinuousProfilerRunning()) {
+        cntl->http_response().set_status_code(HTTP_STATUS_FORBIDDEN);
+        return cntl->SetFailed(EPERM, "Continuous profiler is not enabled, "
+                               "set -continuous_profiling_hz to 19~99");
+    }
+    // Stacks sampled in the last `seconds' before `end' (seconds since
+    // epoch, default to now).
+    int64_t end_s = butil::gettimeofday_s();
+    int64_t seconds = FLAGS_continuous_profiling_window_s;
+    if (!ReadInt64Query(cntl, "end", &end_s) ||
+        !ReadInt64Query(cntl, "seconds", &seconds) || seconds <= 0) {
+        return cntl->SetFailed(EINVAL, "Invalid query `end' or `seconds'");
+    }
+    bool pprof = false;
+    const std::string* format = cntl->http_request().uri().GetQuery("format");
+    if (format != NULL) {
+        if (*format == "pprof") {
+            pprof = true;
+        } else if (*format != "folded") {
+            return cntl->SetFailed(EINVAL, "Invalid format=%s", format->c_str());
+        }
+    }
+    cntl->http_response().set_content_type(
+        pprof ? "application/octet-stream" : "text/plain");
+    DumpContinuousProfile(end_s - seconds, end_s, pprof,
+                          &cntl->response_attachment());
+}
+
 void HotspotsService::GetTabInfo(TabInfoList* info_list) const {
     TabInfo* info = info_list->add();
     info->path = "/hotspots/cpu";
@@ -1277,6 +1365,10 @@ void HotspotsService::GetTabInfo(TabInfoList* info_list) const {
     info->path = "/hotspots/contention";
     info->tab_name = "contention";
 
+    info = info_list->add();
+    info->path = "/hotspots/wait";
+    info->tab_name = "wait";
+
     info = info_list->add();
     info->path = "/hotspots/iobuf";
     info->tab_name = "iobuf";
@@ -50,6 +50,11 @@ public:
                     ::brpc::HotspotsResponse* response,
                     ::google::protobuf::Closure* done);
 
+    void wait(::google::protobuf::RpcController* cntl_base,
+              const ::brpc::HotspotsRequest* request,
+              ::brpc::HotspotsResponse* response,
+              ::google::protobuf::Closure* done);
+
     void iobuf(::google::protobuf::RpcController* cntl_base,
                const ::brpc::HotspotsRequest* request,
                ::brpc::HotspotsResponse* response,
@@ -75,11 +80,22 @@ public:
                                    ::brpc::HotspotsResponse* response,
                                    ::google::protobuf::Closure* done);
 
+    void wait_non_responsive(::google::protobuf::RpcController* cntl_base,
+                             const ::brpc::HotspotsRequest* request,
+                             ::brpc::HotspotsResponse* response,
+                             ::google::protobuf::Closure* done);
+
     void iobuf_non_responsive(::google::protobuf::RpcController* cntl_base,
                               const ::brpc::HotspotsRequest* request,
                               ::brpc::HotspotsResponse* response,
                               ::google::protobuf::Closure* done);
 
+    // Stacks sampled by the continuous profiler in a recent time range.
+    void continuous(::google::protobuf::RpcController* cntl_base,
+                    const ::brpc::HotspotsRequest* request,
+                    ::brpc::HotspotsResponse* response,
+                    ::google::protobuf::Closure* done);
+
     void GetTabInfo(brpc::TabInfoList*) const;
 };
 
@@ -77,6 +77,12 @@ void MemoryService::default_method(::google::protobuf::RpcController* cntl_base,
     cntl->http_response().set_content_type("text/plain");
     butil::IOBuf& resp = cntl->response_attachment();
 
+    if (cntl->http_request().unresolved_path() == "growth") {
+        // Growth of live memory in pprof format, support
+        // ip:port/memory/growth?seconds=600
+        JeHeapGrowth(cntl);
+        return;
+    }
     if (IsTCMallocEnabled()) {
         butil::IOBufBuilder os;
         get_tcmalloc_memory_info(resp);
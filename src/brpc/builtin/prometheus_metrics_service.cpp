@@ -22,8 +22,10 @@
 #include "brpc/controller.h"                // Controller
 #include "brpc/server.h"                    // Server
 #include "brpc/closure_guard.h"             // ClosureGuard
+#include "brpc/progressive_attachment.h"    // ProgressiveAttachment
 #include "brpc/builtin/prometheus_metrics_service.h"
 #include "brpc/builtin/common.h"
+#include "butil/string_splitter.h"          // StringSplitter
 #include "bvar/bvar.h"
 
 namespace bvar {
@@ -35,28 +37,54 @@ DECLARE_int32(bvar_max_dump_multi_dimension_metric_number);
 
 namespace brpc {
 
+DEFINE_int32(prometheus_metrics_chunk_size, 256 * 1024,
+             "/brpc_metrics writes the output in chunks of about so many bytes "
+             "to HTTP/1.x clients instead of building it in memory, "
+             "<= 0 disables chunking");
+
+DEFINE_bool(prometheus_metrics_exemplars, false,
+            "Dump the slowest traced request of each LatencyRecorder as "
+            "<name>_latency_exemplar{trace_id=\"<rpcz trace>\"} <latency>. "
+            "Every new trace id is a new series in Prometheus");
+
 // Defined in server.cpp
 extern const char* const g_server_info_prefix;
 
 // This is a class that convert bvar result to prometheus output.
-// Currently the output only includes gauge and summary for two
-// reasons:
+// Currently the output includes gauge and summary for two reasons:
 // 1) We cannot tell gauge and counter just from name and what's
 // more counter is just another gauge.
 // 2) Histogram and summary is equivalent except that histogram
 // calculates quantiles in the server side.
+// Histograms are output only for buckets exposed by LatencyRecorder
+// with -bvar_latency_histogram.
 class PrometheusMetricsDumper : public bvar::Dumper {
 public:
+    // If `pa' is not NULL, output is written into `pa' whenever more than
+    // `chunk_size' bytes are buffered in `os'.
     explicit PrometheusMetricsDumper(butil::IOBufBuilder* os,
-                                     const std::string& server_prefix)
+                                     const std::string& server_prefix,
+                                     ProgressiveAttachment* pa = NULL,
+                                     size_t chunk_size = 0)
         : _os(os)
-        , _server_prefix(server_prefix) {
+        , _server_prefix(server_prefix)
+        , _pa(pa)
+        , _chunk_size(chunk_size)
+        , _write_errno(0) {
     }
 
     bool dump(const std::string& name, const butil::StringPiece& desc) override;
     bool dump_mvar(const std::string& name, const butil::StringPiece& desc) override;
     bool dump_comment(const std::string& name, const std::string& type) override;
 
+    // Write buffered output into the attachment if there's enough.
+    // Returns false if the attachment is broken.
+    bool MaybeFlush();
+
+    // Errno of the failed write into the attachment, 0 if none failed.
+    // MVariableBase::dump_exposed() doesn't report failures of dumpers.
+    int write_errno() const { return _write_errno; }
+
 private:
     DISALLOW_COPY_AND_ASSIGN(PrometheusMetricsDumper);
 
@@ -64,6 +92,17 @@ private:
     bool DumpLatencyRecorderSuffix(const butil::StringPiece& name,
                                    const butil::StringPiece& desc);
 
+    // Return true iff name ends with "_latency_histogram" exposed by
+    // LatencyRecorder, which is output as a Histogram.
+    bool DumpLatencyHistogram(const butil::StringPiece& name,
+                              const butil::StringPiece& desc);
+
+    // Return true iff name ends with "_latency_exemplar" exposed by
+    // LatencyRecorder, which is output as a gauge labeled with the trace
+    // id when -prometheus_metrics_exemplars is on.
+    bool DumpLatencyExemplar(const butil::StringPiece& name,
+                             const butil::StringPiece& desc);
+
     // 6 is the number of bvars in LatencyRecorder that indicating percentiles
     static const int NPERCENTILES = 6;
 
@@ -81,6 +120,9 @@ private:
 private:
     butil::IOBufBuilder* _os;
     const std::string _server_prefix;
+    ProgressiveAttachment* _pa;
+    size_t _chunk_size;
+    int _write_errno;
     std::map<std::string, SummaryItems> _m;
 };
 
@@ -90,16 +132,41 @@ butil::StringPiece GetMetricsName(const std::string& name) {
     return butil::StringPiece(name.data(), size);
 }
 
+bool PrometheusMetricsDumper::MaybeFlush() {
+    if (_pa == NULL || _chunk_size == 0) {
+        return true;
+    }
+    if (_write_errno != 0) {
+        return false;
+    }
+    butil::IOBuf& buf = _os->buf();
+    if (buf.size() < _chunk_size) {
+        return true;
+    }
+    if (_pa->Write(buf) != 0) {
+        _write_errno = errno ? errno : EINTERNAL;
+        return false;
+    }
+    buf.clear();
+    return true;
+}
+
 bool PrometheusMetricsDumper::dump(const std::string& name,
                                    const butil::StringPiece& desc) {
+    if (DumpLatencyExemplar(name, desc)) {
+        return MaybeFlush();
+    }
     if (!desc.empty() && desc[0] == '"') {
         // there is no necessary to monitor string in prometheus
         return true;
     }
+    if (DumpLatencyHistogram(name, desc)) {
+        return MaybeFlush();
+    }
     if (DumpLatencyRecorderSuffix(name, desc)) {
         // Has encountered name with suffix exposed by LatencyRecorder,
         // Leave it to DumpLatencyRecorderSuffix to output Summary.
-        return true;
+        return MaybeFlush();
     }
 
     auto metrics_name = GetMetricsName(name);
@@ -107,7 +174,7 @@ bool PrometheusMetricsDumper::dump(const std::string& name,
     *_os << "# HELP " << metrics_name << '\n'
          << "# TYPE " << metrics_name << " gauge" << '\n'
          << name << " " << desc << '\n';
-    return true;
+    return MaybeFlush();
 }
 
 bool PrometheusMetricsDumper::dump_mvar(const std::string& name, const butil::StringPiece& desc) {
@@ -116,13 +183,13 @@ bool PrometheusMetricsDumper::dump_mvar(const std::string& name, const butil::St
         return true;
     }
     *_os << name << " " << desc << "\n";
-    return true;
+    return MaybeFlush();
 }
 
 bool PrometheusMetricsDumper::dump_comment(const std::string& name, const std::string& type) {
     *_os << "# HELP " << name << '\n'
          << "# TYPE " << name << " " << type << '\n';
-    return true;
+    return MaybeFlush();
 }
 
 const PrometheusMetricsDumper::SummaryItems*
@@ -208,37 +275,179 @@ bool PrometheusMetricsDumper::DumpLatencyRecorderSuffix(
     return true;
 }
 
-void PrometheusMetricsService::default_method(::google::protobuf::RpcController* cntl_base,
-                                              const ::brpc::MetricsRequest*,
-                                              ::brpc::MetricsResponse*,
-                                              ::google::protobuf::Closure* done) {
-    ClosureGuard done_guard(done);
-    Controller *cntl = static_cast<Controller*>(cntl_base);
-    cntl->http_response().set_content_type("text/plain");
-    if (DumpPrometheusMetricsToIOBuf(&cntl->response_attachment()) != 0) {
-        cntl->SetFailed("Fail to dump metrics");
-        return;
+bool PrometheusMetricsDumper::DumpLatencyHistogram(
+    const butil::StringPiece& name,
+    const butil::StringPiece& desc) {
+    if (!name.ends_with("_latency_histogram")) {
+        return false;
     }
+    // desc is "<upper>:<cumulative_count> ... sum:<sum>", see
+    // bvar::detail::LatencyBuckets::describe().
+    *_os << "# HELP " << name << '\n'
+         << "# TYPE " << name << " histogram\n";
+    butil::StringPiece count("0");
+    butil::StringPiece sum("0");
+    for (butil::StringSplitter sp(desc, ' '); sp; ++sp) {
+        const butil::StringPiece field(sp.field(), sp.length());
+        const size_t colon = field.find(':');
+        if (colon == butil::StringPiece::npos) {
+            continue;
+        }
+        const butil::StringPiece key = field.substr(0, colon);
+        const butil::StringPiece value = field.substr(colon + 1);
+        if (key == "sum") {
+            sum = value;
+            continue;
+        }
+        *_os << name << "_bucket{le=\"" << key << "\"} " << value << '\n';
+        count = value;
+    }
+    *_os << name << "_bucket{le=\"+Inf\"} " << count << '\n'
+         << name << "_sum " << sum << '\n'
+         << name << "_count " << count << '\n';
+    return true;
 }
 
-int DumpPrometheusMetricsToIOBuf(butil::IOBuf* output) {
+bool PrometheusMetricsDumper::DumpLatencyExemplar(
+    const butil::StringPiece& name,
+    const butil::StringPiece& desc) {
+    if (!name.ends_with("_latency_exemplar")) {
+        return false;
+    }
+    if (!FLAGS_prometheus_metrics_exemplars) {
+        return true;
+    }
+    // desc is "<latency> trace=<hex>" or "0" quoted, see
+    // bvar::detail::LatencyExemplar.
+    butil::StringPiece value = desc;
+    if (value.size() >= 2 && value[0] == '"') {
+        value = value.substr(1, value.size() - 2);
+    }
+    const size_t pos = value.find(" trace=");
+    if (pos == butil::StringPiece::npos) {
+        // No traced request in the window.
+        return true;
+    }
+    *_os << "# HELP " << name << '\n'
+         << "# TYPE " << name << " gauge\n"
+         << name << "{trace_id=\"" << value.substr(pos + 7) << "\"} "
+         << value.substr(0, pos) << '\n';
+    return true;
+}
+
+// Move `buf' into `pa' if `pa' is not NULL.
+static int FlushToAttachment(butil::IOBuf* buf, ProgressiveAttachment* pa) {
+    if (pa == NULL || buf->empty()) {
+        return 0;
+    }
+    if (pa->Write(*buf) != 0) {
+        return -1;
+    }
+    buf->clear();
+    return 0;
+}
+
+// Dump metrics into `output', or into `pa' in chunks if it's not NULL.
+// `name_filter' is wildcards of names of the variables to dump, empty means
+// all.
+static int DumpPrometheusMetrics(butil::IOBuf* output,
+                                 ProgressiveAttachment* pa,
+                                 const std::string& name_filter) {
+    const size_t chunk_size = (pa && FLAGS_prometheus_metrics_chunk_size > 0)
+        ? FLAGS_prometheus_metrics_chunk_size : 0;
+    bvar::DumpOptions opt;
+    opt.white_wildcards = name_filter;
     butil::IOBufBuilder os;
-    PrometheusMetricsDumper dumper(&os, g_server_info_prefix);
-    const int ndump = bvar::Variable::dump_exposed(&dumper, NULL);
+    PrometheusMetricsDumper dumper(&os, g_server_info_prefix, pa, chunk_size);
+    const int ndump = bvar::Variable::dump_exposed(&dumper, &opt);
+    if (dumper.write_errno() != 0) {
+        errno = dumper.write_errno();
+        return -1;
+    }
     if (ndump < 0) {
         return -1;
     }
     os.move_to(*output);
+    // Write the rest before mvars to keep the order.
+    if (FlushToAttachment(output, pa) != 0) {
+        return -1;
+    }
 
     if (bvar::FLAGS_bvar_max_dump_multi_dimension_metric_number > 0) {
-        PrometheusMetricsDumper dumper_md(&os, g_server_info_prefix);
-        const int ndump_md = bvar::MVariableBase::dump_exposed(&dumper_md, NULL);
+        PrometheusMetricsDumper dumper_md(&os, g_server_info_prefix, pa, chunk_size);
+        const int ndump_md = bvar::MVariableBase::dump_exposed(&dumper_md, &opt);
+        if (dumper_md.write_errno() != 0) {
+            errno = dumper_md.write_errno();
+            return -1;
+        }
         if (ndump_md < 0) {
             return -1;
         }
         output->append(butil::IOBuf::Movable(os.buf()));
     }
-    return 0;
+    return FlushToAttachment(output, pa);
+}
+
+// Turn "a,b" into "a*,b*".
+static std::string PrefixesToWildcards(const std::string& prefixes) {
+    std::string wildcards;
+    for (butil::StringSplitter sp(prefixes.c_str(), ','); sp; ++sp) {
+        if (sp.length() == 0) {
+            continue;
+        }
+        if (!wildcards.empty()) {
+            wildcards.push_back(',');
+        }
+        wildcards.append(sp.field(), sp.length());
+        wildcards.push_back('*');
+    }
+    return wildcards;
+}
+
+void PrometheusMetricsService::default_method(::google::protobuf::RpcController* cntl_base,
+                                              const ::brpc::MetricsRequest*,
+                                              ::brpc::MetricsResponse*,
+                                              ::google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller *cntl = static_cast<Controller*>(cntl_base);
+    cntl->http_response().set_content_type("text/plain");
+    // ?name_prefix=p1,p2 dumps variables whose names start with p1 or p2
+    // only, other variables are not even described.
+    std::string name_filter;
+    const std::string* prefixes =
+        cntl->http_request().uri().GetQuery("name_prefix");
+    if (prefixes != NULL) {
+        name_filter = PrefixesToWildcards(*prefixes);
+    }
+    butil::intrusive_ptr<ProgressiveAttachment> pa;
+    if (FLAGS_prometheus_metrics_chunk_size > 0 &&
+        cntl->request_protocol() == PROTOCOL_HTTP) {
+        pa = cntl->CreateProgressiveAttachment();
+    }
+    if (pa == NULL) {
+        if (DumpPrometheusMetrics(&cntl->response_attachment(),
+                                  NULL, name_filter) != 0) {
+            cntl->SetFailed("Fail to dump metrics");
+        }
+        return;
+    }
+    // Send the header first, then write the body chunk by chunk, so that
+    // the whole output is never in memory. Errors can't be reported after
+    // the header is sent, close the connection without the last chunk to
+    // make the truncated response visibly broken. Slow readers hitting
+    // EOVERCROWDED(-socket_max_unwritten_bytes) are treated the same.
+    done_guard.reset(NULL);
+    butil::IOBuf buf;
+    if (DumpPrometheusMetrics(&buf, pa.get(), name_filter) != 0) {
+        const int saved_errno = errno;
+        LOG(WARNING) << "Fail to write metrics to " << pa->remote_side()
+                     << ": " << berror(saved_errno);
+        pa->Abort(saved_errno ? saved_errno : EINTERNAL);
+    }
+}
+
+int DumpPrometheusMetricsToIOBuf(butil::IOBuf* output) {
+    return DumpPrometheusMetrics(output, NULL, std::string());
 }
 
 } // namespace brpc
@@ -30,12 +30,18 @@
 #include "brpc/global.h"
 #include "brpc/span.h"
 #include "brpc/details/load_balancer_with_naming.h"
+#include "brpc/details/call_coalescer.h"
+#include "brpc/details/adaptive_throttler.h"
+#include "brpc/details/outlier_detector.h"
+#include "brpc/details/serialized_request_cache.h"
+#include "brpc/details/dns_cache.h"
 #include "brpc/controller.h"
 #include "brpc/channel.h"
 #include "brpc/serialized_request.h"
 #include "brpc/serialized_response.h"
 #include "brpc/details/usercode_backup_pool.h"       // TooManyUserCode
 #include "brpc/rdma/rdma_helper.h"
+#include "brpc/shm/shm_endpoint.h"
 #include "brpc/policy/esp_authenticator.h"
 
 namespace brpc {
@@ -49,6 +55,11 @@ DEFINE_string(health_check_path, "", "Http path of health check call."
     "sure the server functions well).");
 DEFINE_int32(health_check_timeout_ms, 500, "The timeout for both establishing "
     "the connection and the http call to -health_check_path over the connection");
+DEFINE_bool(share_lb_among_channels, false, "Channels initialized with the "
+    "same naming service url, load balancer, ns_filter, subset and options "
+    "affecting connections share one load balancer, so that memory and cost "
+    "of updating servers do not grow with number of channels. Notice that "
+    "states of the load balancer (e.g. latencies in `la') are shared as well");
 
 ChannelOptions::ChannelOptions()
     : connect_timeout_ms(200)
@@ -56,15 +67,24 @@ ChannelOptions::ChannelOptions()
     , backup_request_ms(-1)
     , max_retry(3)
     , enable_circuit_breaker(false)
+    , enable_outlier_detection(false)
     , protocol(PROTOCOL_BAIDU_STD)
     , connection_type(CONNECTION_TYPE_UNKNOWN)
     , succeed_without_server(true)
     , log_succeed_without_server(true)
     , use_rdma(false)
+    , use_shm(false)
     , auth(NULL)
     , backup_request_policy(NULL)
     , retry_policy(NULL)
+    , retry_budget_ratio(-1)
+    , retry_budget_min_per_second(10)
+    , adaptive_throttling_k(0)
     , ns_filter(NULL)
+    , min_pooled_connections(0)
+    , max_pooled_connections(0)
+    , coalesce_identical_calls(false)
+    , subset_size(0)
 {}
 
 ChannelSSLOptions* ChannelOptions::mutable_ssl_options() {
@@ -74,11 +94,17 @@ ChannelSSLOptions* ChannelOptions::mutable_ssl_options() {
     return _ssl_options.get();
 }
 
+static bool HasSocketPoolOptions(const ChannelOptions& opt) {
+    return opt.connection_type == CONNECTION_TYPE_POOLED &&
+        (opt.min_pooled_connections > 0 || opt.max_pooled_connections > 0);
+}
+
 static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt) {
     if (opt.auth == NULL &&
         !opt.has_ssl_options() &&
         opt.connection_group.empty() &&
-        opt.hc_option.health_check_path.empty()) {
+        opt.hc_option.health_check_path.empty() &&
+        !HasSocketPoolOptions(opt)) {
         // Returning zeroized result by default is more intuitive for users.
         return ChannelSignature();
     }
@@ -123,6 +149,17 @@ static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt) {
         if (opt.use_rdma) {
             buf.append("|rdma");
         }
+        if (opt.use_shm) {
+            buf.append("|shm");
+        }
+        if (HasSocketPoolOptions(opt)) {
+            // Pools are owned by main sockets, separate them for channels
+            // with different pool settings.
+            buf.append("|pool=");
+            buf.append(std::to_string(opt.min_pooled_connections));
+            buf.push_back(',');
+            buf.append(std::to_string(std::max(opt.max_pooled_connections, 0)));
+        }
         butil::MurmurHash3_x64_128_Update(&mm_ctx, buf.data(), buf.size());
         buf.clear();
     
@@ -206,9 +243,36 @@ int Channel::InitChannelOptions(const ChannelOptions* options) {
 #endif
     }
 
+    if (_options.use_shm && (_options.has_ssl_options() || _options.use_rdma)) {
+        LOG(ERROR) << "Cannot use shm with SSL or RDMA";
+        return -1;
+    }
+
     _serialize_request = protocol->serialize_request;
     _pack_request = protocol->pack_request;
     _get_method_name = protocol->get_method_name;
+    if (_options.coalesce_identical_calls) {
+        _coalescer = std::make_shared<CallCoalescer>();
+    } else {
+        _coalescer.reset();
+    }
+    if (_options.retry_budget_ratio >= 0) {
+        _retry_budget = std::make_shared<RetryBudget>(
+            _options.retry_budget_ratio, _options.retry_budget_min_per_second);
+    } else {
+        _retry_budget.reset();
+    }
+    if (_options.adaptive_throttling_k > 0) {
+        _throttler = std::make_shared<AdaptiveThrottler>(
+            _options.adaptive_throttling_k);
+    } else {
+        _throttler.reset();
+    }
+    if (_options.enable_outlier_detection) {
+        _outlier_detector = std::make_shared<OutlierDetector>();
+    } else {
+        _outlier_detector.reset();
+    }
 
     // Check connection_type
     if (_options.connection_type == CONNECTION_TYPE_UNKNOWN) {
@@ -274,7 +338,7 @@ int Channel::Init(const char* server_addr_and_port,
         }
     } else {
         if (str2endpoint(server_addr_and_port, &point) != 0 &&
-            hostname2endpoint(server_addr_and_port, &point) != 0) {
+            CachedHostname2Endpoint(server_addr_and_port, &point) != 0) {
             // Many users called the wrong Init(). Print some log to save
             // our troubleshooting time.
             if (strstr(server_addr_and_port, "://")) {
@@ -308,7 +372,7 @@ int Channel::Init(const char* server_addr, int port,
         point.port = port;
     } else {
         if (str2endpoint(server_addr, port, &point) != 0 &&
-            hostname2endpoint(server_addr, port, &point) != 0) {
+            CachedHostname2Endpoint(server_addr, port, &point) != 0) {
             LOG(ERROR) << "Invalid address=`" << server_addr << '\'';
             return -1;
         }
@@ -363,16 +427,32 @@ int Channel::InitSingle(const butil::EndPoint& server_addr_and_port,
         return -1;
     }
     _server_address = server_addr_and_port;
+    if (_options.use_shm &&
+        shm::ToShmEndPoint(server_addr_and_port, &_server_address) != 0) {
+        LOG(WARNING) << server_addr_and_port << " is not on this host, "
+                     "use tcp rather than shm";
+        _options.use_shm = false;
+        _server_address = server_addr_and_port;
+    }
     const ChannelSignature sig = ComputeChannelSignature(_options);
     std::shared_ptr<SocketSSLContext> ssl_ctx;
     if (CreateSocketSSLContext(_options, &ssl_ctx) != 0) {
         return -1;
     }
-    if (SocketMapInsert(SocketMapKey(server_addr_and_port, sig),
-                        &_server_id, ssl_ctx, _options.use_rdma, _options.hc_option) != 0) {
+    if (SocketMapInsert(SocketMapKey(_server_address, sig),
+                        &_server_id, ssl_ctx, _options.use_rdma, _options.hc_option,
+                        _options.use_shm) != 0) {
         LOG(ERROR) << "Fail to insert into SocketMap";
         return -1;
     }
+    if (HasSocketPoolOptions(_options)) {
+        SocketUniquePtr ptr;
+        if (Socket::AddressFailedAsWell(_server_id, &ptr) >= 0) {
+            ptr->SetupSocketPool(_options.min_pooled_connections,
+                                 _options.max_pooled_connections,
+                                 _options.connect_timeout_ms);
+        }
+    }
     return 0;
 }
 
@@ -397,11 +477,10 @@ int Channel::Init(const char* ns_url,
             _options.mutable_ssl_options()->sni_name = _service_name;
         }
     }
-    std::unique_ptr<LoadBalancerWithNaming> lb(new (std::nothrow)
-                                                   LoadBalancerWithNaming);
-    if (NULL == lb) {
-        LOG(FATAL) << "Fail to new LoadBalancerWithNaming";
-        return -1;        
+    if (_options.use_shm) {
+        LOG(WARNING) << "ChannelOptions.use_shm is ignored by channels "
+                        "with naming services";
+        _options.use_shm = false;
     }
     GetNamingServiceThreadOptions ns_opt;
     ns_opt.succeed_without_server = _options.succeed_without_server;
@@ -409,9 +488,35 @@ int Channel::Init(const char* ns_url,
     ns_opt.use_rdma = _options.use_rdma;
     ns_opt.channel_signature = ComputeChannelSignature(_options);
     ns_opt.hc_option =  _options.hc_option;
+    if (HasSocketPoolOptions(_options)) {
+        ns_opt.min_pooled_connections = _options.min_pooled_connections;
+        ns_opt.max_pooled_connections = _options.max_pooled_connections;
+        ns_opt.connect_timeout_ms = _options.connect_timeout_ms;
+    }
     if (CreateSocketSSLContext(_options, &ns_opt.ssl_ctx) != 0) {
         return -1;
     }
+    if (FLAGS_share_lb_among_channels) {
+        butil::intrusive_ptr<LoadBalancerWithNaming> shared_lb;
+        if (GetSharedLoadBalancerWithNaming(
+                &shared_lb, ns_url, lb_name, _options.ns_filter, &ns_opt,
+                std::max(_options.subset_size, 0),
+                _options.subset_client_id) != 0) {
+            LOG(ERROR) << "Fail to get shared LoadBalancerWithNaming";
+            return -1;
+        }
+        _lb.reset(shared_lb.get());
+        return 0;
+    }
+    std::unique_ptr<LoadBalancerWithNaming> lb(new (std::nothrow)
+                                                   LoadBalancerWithNaming);
+    if (NULL == lb) {
+        LOG(FATAL) << "Fail to new LoadBalancerWithNaming";
+        return -1;        
+    }
+    if (_options.subset_size > 0) {
+        lb->SetSubset(_options.subset_size, _options.subset_client_id);
+    }
     if (lb->Init(ns_url, lb_name, _options.ns_filter, &ns_opt) != 0) {
         LOG(ERROR) << "Fail to initialize LoadBalancerWithNaming";
         return -1;
@@ -430,6 +535,19 @@ static void HandleBackupRequest(void* arg) {
     bthread_id_error(correlation_id, EBACKUPREQUEST);
 }
 
+bool Channel::IsSerializedRequestShareable(const Controller* cntl) const {
+    // Serialization of these protocols depends on nothing but the request
+    // and the types below, checksums are saved in the controller.
+    switch (_options.protocol) {
+    case PROTOCOL_BAIDU_STD:
+    case PROTOCOL_HULU_PBRPC:
+    case PROTOCOL_SOFA_PBRPC:
+        return cntl->request_checksum_type() == CHECKSUM_TYPE_NONE;
+    default:
+        return false;
+    }
+}
+
 void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
                          google::protobuf::RpcController* controller_base,
                          const google::protobuf::Message* request,
@@ -461,6 +579,10 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     }
     cntl->_preferred_index = _preferred_index;
     cntl->_retry_policy = _options.retry_policy;
+    if (_retry_budget) {
+        _retry_budget->OnRequest();
+        cntl->_retry_budget = _retry_budget;
+    }
     if (_options.enable_circuit_breaker) {
         cntl->add_flag(Controller::FLAGS_ENABLED_CIRCUIT_BREAKER);
     }
@@ -513,6 +635,19 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     if (cntl->timeout_ms() == UNSET_MAGIC_NUM) {
         cntl->set_timeout_ms(_options.timeout_ms);
     }
+    // Calls created from inheritable() of a served request do not outlive
+    // the deadline of that request.
+    const int64_t inherited_deadline_us = cntl->_inheritable.deadline_us;
+    if (inherited_deadline_us >= 0) {
+        const int64_t left_ms = (inherited_deadline_us - start_send_real_us) / 1000;
+        if (left_ms <= 0) {
+            cntl->SetFailed(ERPCTIMEDOUT, "Inherited deadline has passed");
+            return cntl->HandleSendFailed();
+        }
+        if (cntl->timeout_ms() < 0 || cntl->timeout_ms() > left_ms) {
+            cntl->set_timeout_ms(left_ms);
+        }
+    }
     // Since connection is shared extensively amongst channels and RPC,
     // overriding connect_timeout_ms does not make sense, just use the
     // one in ChannelOptions
@@ -538,11 +673,29 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
 
     // Share the lb with controller.
     cntl->_lb = _lb;
+    if (!SingleServer()) {
+        cntl->_outlier_detector = _outlier_detector;
+    }
 
     // Ensure that serialize_request is done before pack_request in all
     // possible executions, including:
     //   HandleSendFailed => OnVersionedRPCReturned => IssueRPC(pack_request)
-    _serialize_request(&cntl->_request_buf, cntl, request);
+    {
+        butil::IOBufOwnerScope owner_scope(butil::IOBuf::OWNER_PROTOCOL);
+        SerializedRequestCache* cache = cntl->_request_cache;
+        if (cache != NULL && !IsSerializedRequestShareable(cntl)) {
+            cache = NULL;
+        }
+        const SerializedRequestCache::Key key = {
+            request, _serialize_request, cntl->request_compress_type(),
+            cntl->request_content_type() };
+        if (cache == NULL || !cache->Get(key, &cntl->_request_buf)) {
+            _serialize_request(&cntl->_request_buf, cntl, request);
+            if (cache != NULL && !cntl->FailedInline()) {
+                cache->Put(key, cntl->_request_buf);
+            }
+        }
+    }
     if (cntl->FailedInline()) {
         // Handle failures caused by serialize_request, and these error_codes
         // should be excluded from the retry_policy.
@@ -555,6 +708,15 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
                         "-usercode_in_pthread is on");
         return cntl->HandleSendFailed();
     }
+    if (_throttler) {
+        if (_throttler->OnRequest()) {
+            // Retrying makes no sense, the servers are overloaded.
+            cntl->set_max_retry(0);
+            cntl->SetFailed(ELIMIT, "Rejected by adaptive throttling");
+            return cntl->HandleSendFailed();
+        }
+        cntl->_throttler = _throttler;
+    }
 
     if (!cntl->_request_streams.empty()) {
         // Currently we cannot handle retry and backup request correctly
@@ -563,6 +725,17 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
         cntl->_backup_request_policy = NULL;
     }
 
+    bool coalesced = false;
+    if (_coalescer && CallCoalescer::IsCoalescable(cntl)) {
+        coalesced = _coalescer->FollowOrLead(cntl);
+        if (coalesced) {
+            // Completed by the leader, only the timeout applies.
+            cntl->set_max_retry(0);
+            cntl->set_backup_request_ms(-1);
+            cntl->_backup_request_policy = NULL;
+        }
+    }
+
     if (cntl->backup_request_ms() >= 0 &&
         (cntl->backup_request_ms() < cntl->timeout_ms() ||
          cntl->timeout_ms() < 0)) {
@@ -602,7 +775,11 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
         cntl->_deadline_us = -1;
     }
 
-    cntl->IssueRPC(start_send_real_us);
+    if (coalesced) {
+        CHECK_EQ(0, bthread_id_unlock(correlation_id));
+    } else {
+        cntl->IssueRPC(start_send_real_us);
+    }
     if (done == NULL) {
         // MUST wait for response when sending synchronous RPC. It will
         // be woken up by callback when RPC finishes (succeeds or still
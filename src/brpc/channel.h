@@ -23,6 +23,7 @@
 // on internal structures, use opaque pointers instead.
 
 #include <ostream>                          // std::ostream
+#include <memory>                           // std::shared_ptr
 #include "bthread/errno.h"                  // Redefine errno
 #include "butil/intrusive_ptr.hpp"          // butil::intrusive_ptr
 #include "butil/ptr_container.h"
@@ -40,6 +41,8 @@
 
 namespace brpc {
 
+class CallCoalescer;
+
 struct ChannelOptions {
     // Constructed with default options.
     ChannelOptions();
@@ -79,6 +82,17 @@ struct ChannelOptions {
     // Default: false
     bool enable_circuit_breaker;
 
+    // Eject a server from selections of a method for a while when the
+    // success rate or latency of the method on the server is an outlier
+    // among servers of this channel (more than -outlier_detection_stdev_factor
+    // standard deviations from the mean). Unlike `enable_circuit_breaker',
+    // the ejection is local to the channel and the method, the connection to
+    // the server keeps serving other methods and channels. Also works for
+    // SelectiveChannel where sub channels are treated as servers.
+    // Ignored by channels to a single server.
+    // Default: false
+    bool enable_outlier_detection;
+
     // Serialization protocol, defined in src/brpc/options.proto
     // NOTE: You can assign name of the protocol to this field as well, for
     // Example: options.protocol = "baidu_std";
@@ -109,6 +123,13 @@ struct ChannelOptions {
     // Default: false
     bool use_rdma;
 
+    // Talk with a server on the same host (which must enable
+    // ServerOptions.use_shm) through shared memory rather than loopback tcp.
+    // Only for channels to a single loopback or local address, ignored
+    // otherwise.
+    // Default: false
+    bool use_shm;
+
     // Turn on authentication for this channel if `auth' is not NULL.
     // Note `auth' will not be deleted by channel and must remain valid when
     // the channel is being used.
@@ -130,6 +151,26 @@ struct ChannelOptions {
     // Default: NULL
     const RetryPolicy* retry_policy;
 
+    // Limit retries of RPCs over this channel to `retry_budget_ratio' of
+    // the RPCs plus `retry_budget_min_per_second', so that clients don't
+    // multiply load on degraded servers by retrying. Retries over the budget
+    // are not sent and counted in bvar rpc_client_retry_budget_exhausted_count.
+    // Backup requests are not limited. Negative ratio disables the budget.
+    // Default: -1 (disabled)
+    double retry_budget_ratio;
+    // Default: 10
+    int retry_budget_min_per_second;
+
+    // Throttle RPCs adaptively on the client side: RPCs are failed locally
+    // with ELIMIT before being sent with probability
+    //   max(0, (requests - k * accepts) / (requests + 1))
+    // where requests and accepts are numbers of RPCs in the last two minutes
+    // and the ones not rejected by servers with ELIMIT or EOVERCROWDED.
+    // Throttled RPCs are counted in bvar rpc_client_throttled_count.
+    // Non-positive value disables the throttling, 2 is a good start.
+    // Default: 0 (disabled)
+    double adaptive_throttling_k;
+
     // Filter ServerNodes (i.e. based on `tag' field of `ServerNode')
     // which are generated by NamingService. The interface is defined
     // in src/brpc/naming_service_filter.h
@@ -138,12 +179,50 @@ struct ChannelOptions {
     // Default: NULL
     const NamingServiceFilter* ns_filter;
 
+    // Number of pooled connections to each server that are connected in
+    // background when the channel is initialized or servers are added by
+    // the naming service, so that the first requests do not pay for
+    // handshakes. These connections are not closed for being idle.
+    // Values larger than max_pooled_connections are treated as
+    // max_pooled_connections. Only for CONNECTION_TYPE_POOLED.
+    // Default: 0
+    int min_pooled_connections;
+
+    // Max number of idle pooled connections to each server. Non-positive
+    // values mean -max_connection_pool_size. Only for CONNECTION_TYPE_POOLED.
+    // Default: 0
+    int max_pooled_connections;
+
     // Channels with same connection_group share connections.
     // In other words, set to a different value to stop sharing connections.
     // Case-sensitive, leading and trailing spaces are ignored.
     // Default: ""
     std::string connection_group;
 
+    // Coalesce concurrent calls to the same method with the same serialized
+    // request: only the first one is sent, others wait for and copy its
+    // response (or error) without retrying, each still limited by its own
+    // timeout. If the first one times out or is canceled, a waiting call is
+    // sent instead. Only for idempotent methods. Calls with attachments, streams,
+    // http headers or progressive reading are not coalesced.
+    // Number of coalesced calls is in bvar rpc_client_coalesced_call_count.
+    // Default: false
+    bool coalesce_identical_calls;
+
+    // Use a deterministic subset of at most so many servers from the naming
+    // service rather than all of them, to bound connections and health
+    // checks on servers of very large clusters which have a lot of clients.
+    // Subsets of different clients are spread over servers and stay mostly
+    // unchanged when servers are added or removed. Failed servers are not
+    // replaced, size the subset with some redundancy. <= 0 means all servers.
+    // Default: 0
+    int subset_size;
+
+    // Which subset this channel takes when subset_size is positive. Give
+    // clients different ids (e.g. instance names) to spread them evenly.
+    // Default: "" (address and pid of this process)
+    std::string subset_client_id;
+
     // Set the health check param according to the channel granularity. 
     // Its priority is higher than FLAGS_health_check_path and FLAGS_health_check_timeout_ms.
     // When it is not set, FLAGS_health_check_path and FLAGS_health_check_timeout_ms will take effect.
@@ -194,6 +273,7 @@ public:
     //   wrr                          # weighted round robin
     //   la                           # locality aware
     //   c_murmurhash/c_md5           # consistent hashing with murmurhash3/md5
+    //   c_xxh3                       # consistent hashing with xxh3
     //   "" or NULL                   # treat `naming_service_url' as `server_addr_and_port'
     //                                # Init(xxx, "", options) and Init(xxx, NULL, options)
     //                                # are exactly same with Init(xxx, options)
@@ -225,6 +305,10 @@ public:
 protected:
     bool SingleServer() const { return _lb.get() == NULL; }
 
+    // Whether the serialized request of `cntl' could be shared with other
+    // calls sending the same request.
+    bool IsSerializedRequestShareable(const Controller* cntl) const;
+
     // Pick a server using `lb' and then send RPC. Wait for response when 
     // sending synchronous RPC.
     // NOTE: DO NOT directly use `controller' after this call when
@@ -253,6 +337,14 @@ protected:
     butil::intrusive_ptr<SharedLoadBalancer> _lb;
     ChannelOptions _options;
     int _preferred_index;
+    // Shared with leading calls, non-NULL if coalesce_identical_calls is on.
+    std::shared_ptr<CallCoalescer> _coalescer;
+    // Shared with controllers, non-NULL if retry_budget_ratio is not negative.
+    std::shared_ptr<RetryBudget> _retry_budget;
+    // Shared with controllers, non-NULL if adaptive_throttling_k is positive.
+    std::shared_ptr<AdaptiveThrottler> _throttler;
+    // Shared with controllers, non-NULL if enable_outlier_detection is on.
+    std::shared_ptr<OutlierDetector> _outlier_detector;
 };
 
 enum ChannelOwnership {
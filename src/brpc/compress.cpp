@@ -17,6 +17,8 @@
 
 
 #include "butil/logging.h"
+#include "butil/time.h"
+#include "bvar/bvar.h"
 #include "json2pb/json_to_pb.h"
 #include "brpc/compress.h"
 #include "brpc/protocol.h"
@@ -27,6 +29,42 @@ namespace brpc {
 static const int MAX_HANDLER_SIZE = 1024;
 static CompressHandler s_handler_map[MAX_HANDLER_SIZE] = { { NULL, NULL, NULL } };
 
+// Time and bytes spent by a compress algorithm, exposed as
+// rpc_compress_<name>_xxx and rpc_decompress_<name>_xxx
+struct CompressStats {
+    explicit CompressStats(const std::string& name)
+        : compress_latency("rpc_compress_" + name)
+        , decompress_latency("rpc_decompress_" + name)
+        , raw_bytes_window(&raw_bytes, -1)
+        , compressed_bytes_window(&compressed_bytes, -1)
+        , ratio("rpc_compress_" + name + "_ratio", GetRatio, this) {}
+
+    void OnDone(bvar::LatencyRecorder& latency, int64_t begin_us,
+                size_t raw_size, size_t compressed_size) {
+        latency << butil::cpuwide_time_us() - begin_us;
+        raw_bytes << raw_size;
+        compressed_bytes << compressed_size;
+    }
+
+    // Bytes before compression / bytes after compression in recent
+    // -bvar_dump_interval seconds, counting both directions.
+    static double GetRatio(void* arg) {
+        CompressStats* s = static_cast<CompressStats*>(arg);
+        const int64_t compressed = s->compressed_bytes_window.get_value();
+        return compressed > 0 ?
+            (double)s->raw_bytes_window.get_value() / compressed : 0;
+    }
+
+    bvar::LatencyRecorder compress_latency;
+    bvar::LatencyRecorder decompress_latency;
+    bvar::Adder<int64_t> raw_bytes;
+    bvar::Adder<int64_t> compressed_bytes;
+    bvar::Window<bvar::Adder<int64_t> > raw_bytes_window;
+    bvar::Window<bvar::Adder<int64_t> > compressed_bytes_window;
+    bvar::PassiveStatus<double> ratio;
+};
+static CompressStats* s_stats_map[MAX_HANDLER_SIZE] = { NULL };
+
 int RegisterCompressHandler(CompressType type, 
                             CompressHandler handler) {
     if (NULL == handler.Compress || NULL == handler.Decompress) {
@@ -43,6 +81,8 @@ int RegisterCompressHandler(CompressType type,
         return -1;
     }
     s_handler_map[index] = handler;
+    s_stats_map[index] = new CompressStats(
+        handler.name ? handler.name : std::to_string(index));
     return 0;
 }
 
@@ -88,10 +128,19 @@ bool ParseFromCompressedData(const butil::IOBuf& data,
         return false;
     }
 
-    Deserializer deserializer([msg](google::protobuf::io::ZeroCopyInputStream* input) {
-        return msg->ParseFromZeroCopyStream(input);
+    size_t raw_size = 0;
+    Deserializer deserializer([msg, &raw_size](google::protobuf::io::ZeroCopyInputStream* input) {
+        const bool ok = msg->ParseFromZeroCopyStream(input);
+        raw_size = input->ByteCount();
+        return ok;
     });
-    return handler->Decompress(data, &deserializer);
+    const int64_t begin_us = butil::cpuwide_time_us();
+    if (!handler->Decompress(data, &deserializer)) {
+        return false;
+    }
+    CompressStats* stats = s_stats_map[compress_type];
+    stats->OnDone(stats->decompress_latency, begin_us, raw_size, data.size());
+    return true;
 }
 
 bool SerializeAsCompressedData(const google::protobuf::Message& msg,
@@ -100,15 +149,41 @@ bool SerializeAsCompressedData(const google::protobuf::Message& msg,
         butil::IOBufAsZeroCopyOutputStream wrapper(buf);
         return msg.SerializeToZeroCopyStream(&wrapper);
     }
+    Serializer serializer([&msg](google::protobuf::io::ZeroCopyOutputStream* output) {
+        return msg.SerializeToZeroCopyStream(output);
+    });
+    serializer.set_message_descriptor(msg.GetDescriptor());
+    return SerializeAsCompressedData(serializer, buf, compress_type, NULL);
+}
+
+bool SerializeAsCompressedData(const Serializer& serializer,
+                               butil::IOBuf* buf, CompressType compress_type,
+                               CompressPolicy* policy) {
     const CompressHandler* handler = FindCompressHandler(compress_type);
     if (NULL == handler) {
         return false;
     }
-
-    Serializer serializer([&msg](google::protobuf::io::ZeroCopyOutputStream* output) {
-        return msg.SerializeToZeroCopyStream(output);
-    });
-    return handler->Compress(serializer, buf);
+    size_t raw_size = 0;
+    Serializer counting_serializer(
+        [&serializer, &raw_size](google::protobuf::io::ZeroCopyOutputStream* output) {
+            const bool ok = serializer.SerializeTo(output);
+            raw_size = output->ByteCount();
+            return ok;
+        });
+    counting_serializer.set_message_descriptor(serializer.message_descriptor());
+    const size_t old_size = buf->size();
+    const int64_t begin_us = butil::cpuwide_time_us();
+    if (!handler->Compress(counting_serializer, buf)) {
+        return false;
+    }
+    const size_t compressed_size = buf->size() - old_size;
+    CompressStats* stats = s_stats_map[compress_type];
+    stats->OnDone(stats->compress_latency, begin_us, raw_size, compressed_size);
+    if (policy != NULL) {
+        policy->OnCompressed(compress_type, raw_size, compressed_size,
+                             butil::cpuwide_time_us() - begin_us);
+    }
+    return true;
 }
 
 ::google::protobuf::Metadata Serializer::GetMetadata() const {
@@ -36,7 +36,7 @@ public:
     Serializer() :Serializer(NULL) {}
 
     explicit Serializer(Callback callback)
-        :_callback(std::move(callback)) {
+        :_callback(std::move(callback)), _message_descriptor(NULL) {
         SharedCtor();
     }
 
@@ -45,7 +45,7 @@ public:
     }
 
     Serializer(const Serializer& from)
-        : NonreflectableMessage(from) {
+        : NonreflectableMessage(from), _message_descriptor(NULL) {
         SharedCtor();
         MergeFrom(from);
     }
@@ -86,11 +86,19 @@ public:
         _callback = std::move(callback);
     }
 
+    // Type of the message serialized by the callback, NULL if unknown.
+    // Compressors may choose settings(e.g. dictionaries) by it.
+    const google::protobuf::Descriptor* message_descriptor() const
+    { return _message_descriptor; }
+    void set_message_descriptor(const google::protobuf::Descriptor* d)
+    { _message_descriptor = d; }
+
 private:
     void SharedCtor() {}
     void SharedDtor() {}
 
     Callback _callback;
+    const google::protobuf::Descriptor* _message_descriptor;
 };
 
 // Deserializer can be used to implement custom deserialization
@@ -171,6 +179,22 @@ struct CompressHandler {
     const char* name;
 };
 
+// Chooses CompressType of messages dynamically, e.g. by sizes of messages
+// and results of previous compressions. Methods must be thread-safe.
+class CompressPolicy {
+public:
+    virtual ~CompressPolicy() {}
+
+    // Returns the CompressType to compress a message whose serialized size
+    // is `raw_size'. `preferred' is the CompressType set by user, which
+    // may be COMPRESS_TYPE_NONE.
+    virtual CompressType Select(size_t raw_size, CompressType preferred) = 0;
+
+    // Called after a message was compressed with `type' successfully.
+    virtual void OnCompressed(CompressType type, size_t raw_size,
+                              size_t compressed_size, int64_t cost_us) {}
+};
+
 // [NOT thread-safe] Register `handler' using key=`type'
 // Returns 0 on success, -1 otherwise
 int RegisterCompressHandler(CompressType type, CompressHandler handler);
@@ -196,6 +220,15 @@ bool SerializeAsCompressedData(const google::protobuf::Message& msg,
                                butil::IOBuf* buf,
                                CompressType compress_type);
 
+// Compress data produced by `serializer' into `buf' using the registered
+// `compress_type' which must not be COMPRESS_TYPE_NONE. The result is fed
+// to `policy' if it's not NULL.
+// Returns true on success, false otherwise
+bool SerializeAsCompressedData(const Serializer& serializer,
+                               butil::IOBuf* buf,
+                               CompressType compress_type,
+                               CompressPolicy* policy);
+
 } // namespace brpc
 
 
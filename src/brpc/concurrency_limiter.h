@@ -53,6 +53,13 @@ public:
     // Create an instance from the amc
     // Caller is responsible for delete the instance after usage.
     virtual ConcurrencyLimiter* New(const AdaptiveMaxConcurrency& amc) const = 0;
+
+    // Expose internal vars of the limiter with names prefixed by `prefix'.
+    // Returns 0 on success, -1 otherwise.
+    virtual int Expose(const butil::StringPiece& /*prefix*/) { return 0; }
+
+    // Describe internal states of the limiter, shown in /status.
+    virtual void Describe(std::ostream& /*os*/, const DescribeOptions&) {}
 };
 
 inline Extension<const ConcurrencyLimiter>* ConcurrencyLimiterExtension() {
@@ -17,6 +17,7 @@
 
 
 #include <signal.h>
+#include <type_traits>                     // std::aligned_storage
 #include <openssl/md5.h>
 #include <google/protobuf/descriptor.h>
 #include <gflags/gflags.h>
@@ -25,6 +26,7 @@
 #include "butil/string_printf.h"
 #include "butil/logging.h"
 #include "butil/time.h"
+#include "butil/object_pool.h"
 #include "bthread/bthread.h"
 #include "bthread/unstable.h"
 #include "bvar/bvar.h"
@@ -34,6 +36,9 @@
 #include "brpc/load_balancer.h"
 #include "brpc/closure_guard.h"
 #include "brpc/details/controller_private_accessor.h"
+#include "brpc/details/call_coalescer.h"
+#include "brpc/details/adaptive_throttler.h"
+#include "brpc/details/outlier_detector.h"
 #include "brpc/controller.h"
 #include "brpc/span.h"
 #include "brpc/server.h"   // Server::_session_local_data_pool
@@ -136,6 +141,38 @@ static void CreateVars() {
     g_ncontroller = new bvar::Adder<int64_t>("rpc_controller_count");
 }
 
+namespace {
+// Raw memory of a Controller recycled by ObjectPool.
+struct ControllerStorage {
+    std::aligned_storage<sizeof(Controller), alignof(Controller)>::type data;
+};
+}
+
+void* Controller::operator new(size_t size) {
+    void* p = operator new(size, std::nothrow);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* Controller::operator new(size_t size, const std::nothrow_t&) throw() {
+    if (size != sizeof(Controller)) {
+        return ::operator new(size, std::nothrow);
+    }
+    return butil::get_object<ControllerStorage>();
+}
+
+void Controller::operator delete(void* ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (size != sizeof(Controller)) {
+        return ::operator delete(ptr);
+    }
+    butil::return_object(static_cast<ControllerStorage*>(ptr));
+}
+
 Controller::Controller() {
     CHECK_EQ(0, pthread_once(&s_create_vars_once, CreateVars));
     *g_ncontroller << 1;
@@ -206,13 +243,18 @@ void Controller::ResetNonPods() {
     }
     delete _sender;
     _lb.reset(NULL);
+    _retry_budget.reset();
+    _throttler.reset();
+    _outlier_detector.reset();
     _current_call.Reset();
     ExcludedServers::Destroy(_accessed);
     _request_buf.clear();
+    _response_cache_key.clear();
     delete _http_request;
     delete _http_response;
     delete _request_user_fields;
     delete _response_user_fields;
+    delete _aliased_request_fields;
     _request_attachment.clear();
     _response_attachment.clear();
     if (_wpa) {
@@ -283,15 +325,19 @@ void Controller::ResetPods() {
     _unfinished_call = NULL;
     _stream_creator = NULL;
     _accessed = NULL;
+    _coalesced_flight = NULL;
     _pack_request = NULL;
     _method = NULL;
     _auth = NULL;
+    _request_cache = NULL;
     _idl_names = idl_single_req_single_res;
     _idl_result = IDL_VOID_RESULT;
     _http_request = NULL;
     _http_response = NULL;
     _request_user_fields = NULL;
     _response_user_fields = NULL;
+    _aliased_request_fields = NULL;
+    _response_cache = NULL;
     _request_content_type = CONTENT_TYPE_PB;
     _response_content_type = CONTENT_TYPE_PB;
     _request_streams.clear();
@@ -299,6 +345,8 @@ void Controller::ResetPods() {
     _remote_stream_settings = NULL;
     _auth_flags = 0;
     _rpc_received_us = 0;
+    _phase_timer.Reset();
+    _server_load = -1;
 }
 
 Controller::Call::Call(Controller::Call* rhs)
@@ -515,8 +563,8 @@ void Controller::CloseConnection(const char* reason_fmt, ...) {
 }
 
 bool Controller::IsCanceled() const {
-    SocketUniquePtr sock;
-    return (Socket::Address(_current_call.peer_id, &sock) != 0);
+    SocketBorrowedPtr sock;
+    return (Socket::Borrow(_current_call.peer_id, &sock) != 0);
 }
 
 class RunOnCancelThread {
@@ -664,7 +712,8 @@ void Controller::OnVersionedRPCReturned(const CompletionInfo& info,
         return IssueRPC(butil::gettimeofday_us());
     } else {
         auto retry_policy = _retry_policy ? _retry_policy : DefaultRetryPolicy();
-        if (retry_policy->DoRetry(this)) {
+        if (retry_policy->DoRetry(this) &&
+            (_retry_budget == NULL || _retry_budget->TryRetry())) {
             // The error must come from _current_call because:
             //  * we intercepted error from _unfinished_call in OnVersionedRPCReturned
             //  * ERPCTIMEDOUT/ECANCELED are not retrying error by default.
@@ -788,12 +837,25 @@ void Controller::Call::OnComplete(
         if (error_code != 0) {
             sending_sock->AddRecentError();
         }
+        // Timed-out calls are counted as well so that slow peers stand out.
+        sending_sock->OnCallEnd(
+            (responded || error_code == ERPCTIMEDOUT) ?
+            butil::gettimeofday_us() - begin_time_us : -1);
 
         if (enable_circuit_breaker) {
             sending_sock->FeedbackCircuitBreaker(error_code,
                 butil::gettimeofday_us() - begin_time_us);
         }
     }
+    // Canceled calls say nothing about the server. peer_id of calls to
+    // SelectiveChannel is the sub channel.
+    if (c->_outlier_detector != NULL && peer_id != INVALID_SOCKET_ID &&
+        error_code != ECANCELED && error_code != EBACKUPREQUEST) {
+        c->_outlier_detector->OnCallEnd(
+            peer_id, c->_method, error_code,
+            (responded || error_code == ERPCTIMEDOUT) ?
+            butil::gettimeofday_us() - begin_time_us : -1);
+    }
 
     switch (c->connection_type()) {
     case CONNECTION_TYPE_UNKNOWN:
@@ -943,6 +1005,15 @@ void Controller::EndRPC(const CompletionInfo& info) {
     }
     // RPC finished, now it's safe to release `LoadBalancerWithNaming'
     _lb.reset();
+    _retry_budget.reset();
+    _outlier_detector.reset();
+    if (_throttler) {
+        _throttler->OnResponse(_error_code);
+        _throttler.reset();
+    }
+    if (_coalesced_flight) {
+        CallCoalescer::OnLeaderEnd(this);
+    }
     if (_span) {
         _span->set_ending_cid(info.id);
         _span->set_async(_done);
@@ -1091,11 +1162,22 @@ void Controller::IssueRPC(int64_t start_realtime_us) {
         }
         _current_call.peer_id = _single_server_id;
     } else {
+        // Avoid servers ejected for the method as well, unless all servers
+        // are excluded.
+        ExcludedServers* ejected = NULL;
+        if (_outlier_detector != NULL) {
+            ejected = _outlier_detector->ExcludeEjected(_method, _accessed);
+        }
         LoadBalancer::SelectIn sel_in =
-            { start_realtime_us, true,
-              has_request_code(), _request_code, _accessed };
+            { start_realtime_us, true, has_request_code(), _request_code,
+              ejected != NULL ? ejected : _accessed };
         LoadBalancer::SelectOut sel_out(&tmp_sock);
-        const int rc = _lb->SelectServer(sel_in, &sel_out);
+        int rc = _lb->SelectServer(sel_in, &sel_out);
+        if (rc != 0 && ejected != NULL) {
+            sel_in.excluded = _accessed;
+            rc = _lb->SelectServer(sel_in, &sel_out);
+        }
+        ExcludedServers::Destroy(ejected);
         if (rc != 0) {
             std::ostringstream os;
             DescribeOptions opt;
@@ -1172,6 +1254,8 @@ void Controller::IssueRPC(int64_t start_realtime_us) {
         }
         tmp_sock.reset();
     }
+    // Balanced by OnCallEnd() in Call::OnComplete().
+    _current_call.sending_sock->OnCallBegin();
     if (_tos > 0) {
         _current_call.sending_sock->set_type_of_service(_tos);
     }
@@ -1199,8 +1283,11 @@ void Controller::IssueRPC(int64_t start_realtime_us) {
     // Make request
     butil::IOBuf packet;
     SocketMessage* user_packet = NULL;
-    _pack_request(&packet, &user_packet, cid.value, _method, this,
-                  _request_buf, using_auth);
+    {
+        butil::IOBufOwnerScope owner_scope(butil::IOBuf::OWNER_PROTOCOL);
+        _pack_request(&packet, &user_packet, cid.value, _method, this,
+                      _request_buf, using_auth);
+    }
     // TODO: PackRequest may accept SocketMessagePtr<>?
     SocketMessagePtr<> user_packet_guard(user_packet);
     if (FailedInline()) {
@@ -1409,6 +1496,15 @@ void Controller::HandleStreamConnection(Socket *host_socket) {
         CHECK(!has_remote_stream());
         return;
     }
+    if (request_protocol() == PROTOCOL_H2) {
+        // gRPC streams were bound to the http2 stream when the request was
+        // sent, and closed along with the http2 stream.
+        if (FailedInline()) {
+            Stream::SetFailed(_request_streams, _error_code,
+                              "%s", _error_text.c_str());
+        }
+        return;
+    }
     size_t stream_num = _request_streams.size();
     std::vector<SocketUniquePtr> ptrs(stream_num);
     if (!FailedInline()) {
@@ -1652,6 +1748,18 @@ google::protobuf::Closure* DoNothing() {
     return butil::get_leaky_singleton<DoNothingClosure>();
 }
 
+const butil::IOBuf* Controller::aliased_request_field(int field_number) const {
+    if (_aliased_request_fields == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < _aliased_request_fields->size(); ++i) {
+        if ((*_aliased_request_fields)[i].first == field_number) {
+            return &(*_aliased_request_fields)[i].second;
+        }
+    }
+    return NULL;
+}
+
 KVMap& Controller::SessionKV() {
     if (_session_kv == nullptr) {
         _session_kv.reset(new KVMap);
@@ -23,6 +23,7 @@
 // on internal structures, use opaque pointers instead.
 
 #include <functional>                          // std::function
+#include <new>                                 // std::nothrow_t
 #include <gflags/gflags.h>                     // Users often need gflags
 #include <string>
 #include "butil/intrusive_ptr.hpp"             // butil::intrusive_ptr
@@ -47,6 +48,7 @@
 #include "brpc/grpc.h"
 #include "brpc/kvmap.h"
 #include "brpc/rpc_dump.h"
+#include "brpc/details/server_phase.h"         // ServerPhaseTimer
 
 // EAUTH is defined in MAC
 #ifndef EAUTH
@@ -71,9 +73,16 @@ class RPCSender;
 class StreamSettings;
 class MongoContext;
 class RetryPolicy;
+class RetryBudget;
+class AdaptiveThrottler;
+class OutlierDetector;
 class BackupRequestPolicy;
 class InputMessageBase;
 class ThriftStub;
+class CallCoalescer;
+class CoalescedFlight;
+class SerializedRequestCache;
+class ResponseCache;
 namespace policy {
 class OnServerStreamCreated;
 void ProcessMongoRequest(InputMessageBase*);
@@ -90,6 +99,17 @@ struct IdlNames {
     const char* response_name; // must be string-constant
 };
 
+// Priorities of requests from the least important to the most important.
+// When the server sheds load by priorities (ServerOptions.
+// shed_load_by_priority), requests of lower priorities are rejected first.
+enum RequestPriority {
+    REQUEST_PRIORITY_SHEDDABLE = 0,         // e.g. batch jobs
+    REQUEST_PRIORITY_DEFAULT = 1,
+    REQUEST_PRIORITY_CRITICAL = 2,          // e.g. traffic of VIP users
+    REQUEST_PRIORITY_CRITICAL_PLUS = 3,     // e.g. health checks
+};
+static const int REQUEST_PRIORITY_NUM = 4;
+
 extern const IdlNames idl_single_req_single_res;
 extern const IdlNames idl_single_req_multi_res;
 extern const IdlNames idl_multi_req_single_res;
@@ -119,6 +139,7 @@ friend class ControllerPrivateAccessor;
 friend class ServerPrivateAccessor;
 friend class SelectiveChannel;
 friend class ThriftStub;
+friend class CallCoalescer;
 friend class schan::Sender;
 friend class schan::SubDone;
 friend class policy::OnServerStreamCreated;
@@ -154,20 +175,38 @@ friend void policy::ProcessThriftRequest(InputMessageBase*);
 
 public:
     struct Inheritable {
-        Inheritable() : log_id(0) {}
+        Inheritable()
+            : log_id(0), deadline_us(-1), priority(REQUEST_PRIORITY_DEFAULT) {}
         void Reset() {
             log_id = 0;
             request_id.clear();
+            deadline_us = -1;
+            priority = REQUEST_PRIORITY_DEFAULT;
         }
 
         uint64_t log_id;
         std::string request_id;
+        // Deadline of the served request, timeouts of RPCs issued with
+        // controllers inheriting it are truncated to the remaining time.
+        int64_t deadline_us;
+        // Priority of the served request, RPCs issued with controllers
+        // inheriting it have the same priority.
+        RequestPriority priority;
     };
 
 public:
     Controller();
     Controller(const Inheritable& parent_ctx);
     ~Controller();
+
+    // Controllers are large and created for every RPC on server side, their
+    // memory is recycled in a thread-local-cached pool instead of going
+    // through malloc each time. Subclasses are allocated by malloc as usual.
+    static void* operator new(size_t size);
+    static void* operator new(size_t size, const std::nothrow_t&) throw();
+    static void* operator new(size_t, void* ptr) throw() { return ptr; }
+    static void operator delete(void* ptr, size_t size);
+    static void operator delete(void*, void*) throw() {}
     
     // ------------------------------------------------------------------
     //                      Client-side methods
@@ -227,6 +266,12 @@ public:
 
     void set_request_id(std::string request_id) { _inheritable.request_id = request_id; }
 
+    // Set priority of the request, which is sent to the server along with
+    // the request by baidu_std and http.
+    // Default: REQUEST_PRIORITY_DEFAULT
+    void set_request_priority(RequestPriority priority)
+    { _inheritable.priority = priority; }
+
     // Set type of service: http://en.wikipedia.org/wiki/Type_of_service
     // Current implementation has limits: If the connection is already
     // established, this setting has no effect until the connection is broken
@@ -556,6 +601,7 @@ public:
     bool has_log_id() const { return has_flag(FLAGS_LOG_ID); }
     uint64_t log_id() const { return _inheritable.log_id; }
     const std::string& request_id() const { return _inheritable.request_id; }
+    RequestPriority request_priority() const { return _inheritable.priority; }
     CompressType request_compress_type() const { return _request_compress_type; }
     CompressType response_compress_type() const { return _response_compress_type; }
     ChecksumType request_checksum_type() const { return _request_checksum_type; }
@@ -569,6 +615,12 @@ public:
     const butil::IOBuf& request_attachment() const { return _request_attachment; }
     const butil::IOBuf& response_attachment() const { return _response_attachment; }
 
+    // [Server-side] Value of the request field set by
+    // Server::AliasRequestFieldsOf(), which references blocks of the received
+    // buffer rather than being copied into the request.
+    // Returns NULL if the field is not aliased or not present.
+    const butil::IOBuf* aliased_request_field(int field_number) const;
+
     // Get the object to write key/value which will be flushed into
     // LOG(INFO) when this controller is deleted.
     KVMap& SessionKV();
@@ -649,6 +701,12 @@ public:
     // the received time of RPC is not recorded in the controller.
     int64_t get_rpc_received_us() const { return _rpc_received_us; }
 
+    // [Client side] Load reported by the server in the response, which is
+    // its concurrency in permille of max_concurrency of the method (or the
+    // server). -1 means not reported, see -report_server_load of the server.
+    int server_load() const { return _server_load; }
+    void set_server_load(int load) { _server_load = load; }
+
 private:
     struct CompletionInfo {
         CallId id;           // call_id of the corresponding request
@@ -822,6 +880,13 @@ private:
     // after CallMethod.
     int _max_retry;
     const RetryPolicy* _retry_policy;
+    // Retries are limited by the budget of the channel if it's not NULL.
+    std::shared_ptr<RetryBudget> _retry_budget;
+    // Result of the RPC is reported to the throttler if it's not NULL.
+    std::shared_ptr<AdaptiveThrottler> _throttler;
+    // Calls are reported to the detector and servers ejected by it are
+    // avoided if it's not NULL.
+    std::shared_ptr<OutlierDetector> _outlier_detector;
     // Synchronization object for one RPC call. It remains unchanged even
     // when retry happens. Synchronous RPC will wait on this id.
     CallId _correlation_id;
@@ -872,6 +937,8 @@ private:
     Call _current_call;
     Call* _unfinished_call;
     ExcludedServers* _accessed;
+    // Set when this RPC leads identical calls of a coalescing channel.
+    CoalescedFlight* _coalesced_flight;
     
     StreamCreator* _stream_creator;
 
@@ -880,6 +947,9 @@ private:
     const google::protobuf::MethodDescriptor* _method;
     const Authenticator* _auth;
     butil::IOBuf _request_buf;
+    // Set by parallel/selective channels to share serialized requests
+    // between sub calls.
+    SerializedRequestCache* _request_cache;
     IdlNames _idl_names;
     int64_t _idl_result;
 
@@ -890,6 +960,14 @@ private:
     UserFieldsMap* _request_user_fields;
     UserFieldsMap* _response_user_fields;
 
+    // Request fields cut out of the received buffer without copying.
+    AliasedPbFields* _aliased_request_fields;
+
+    // Set on server side if the response should be put into the cache of
+    // the method with key `_response_cache_key'.
+    ResponseCache* _response_cache;
+    butil::IOBuf _response_cache_key;
+
     std::unique_ptr<KVMap> _session_kv;
 
     // Fields with large size but low access frequency 
@@ -923,6 +1001,10 @@ private:
 
     // The point in time when the rpc is read from the socket
     int64_t _rpc_received_us;
+    // Durations of phases of processing the request at server-side.
+    ServerPhaseTimer _phase_timer;
+
+    int _server_load;
 };
 
 // Advises the RPC system that the caller desires that the RPC call be
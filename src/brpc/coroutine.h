@@ -26,6 +26,8 @@
 #include <functional>
 #include <atomic>
 #include "brpc/callback.h"
+#include "bthread/mutex.h"
+#include "bthread/countdown_event.h"
 
 namespace brpc {
 namespace experimental {
@@ -113,6 +115,10 @@ private:
 //  Coroutine coro(func(1.0), true);
 // 4. To sleep in a coroutine:
 //  co_await Coroutine::usleep(100);
+// 5. To lock a bthread::Mutex or wait for a CountdownEvent in a coroutine:
+//  co_await Coroutine::lock(mutex);
+//  mutex.unlock();
+//  co_await Coroutine::wait(event);
 // 
 // NOTE: Inside coroutine function, DO NOT call pthread-blocking or 
 // bthread-blocking functions (eg. bthread_join(), bthread_usleep(), syncronized RPC),
@@ -132,6 +138,19 @@ public:
 
     static Awaitable<int> usleep(int sleep_us);
 
+    // Wait on |butex| like bthread::butex_wait() without timeout.
+    // Returns 0 when woken up, error code otherwise.
+    static Awaitable<int> butex_wait(void* butex, int expected_value);
+
+    // Returns 0 with the mutex held, error code otherwise.
+    static Awaitable<int> lock(bthread_mutex_t* mutex);
+    static Awaitable<int> lock(bthread::Mutex& mutex) {
+        return lock(mutex.native_handler());
+    }
+
+    // Returns 0 when the counter of |event| reaches 0, error code otherwise.
+    static Awaitable<int> wait(bthread::CountdownEvent& event);
+
 private:
     detail::AwaitablePromiseBase* _promise{nullptr};
     bool _waited{false};
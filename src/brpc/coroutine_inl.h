@@ -306,6 +306,53 @@ inline Awaitable<int> Coroutine::usleep(int sleep_us) {
     return Awaitable<int>(promise);
 }
 
+namespace detail {
+inline void on_awaitable_int_done(void* p) {
+    auto promise = static_cast<AwaitablePromise<int>*>(p);
+    promise->set_value(0);
+    promise->on_done();
+}
+} // namespace detail
+
+// NOTE: the caller is resumed in the thread which calls butex_wake*() on
+// |butex|, no bthread is created for the waiting.
+inline Awaitable<int> Coroutine::butex_wait(void* butex, int expected_value) {
+    auto promise = new detail::AwaitablePromise<int>();
+    promise->set_needs_suspend();
+    if (bthread::butex_wait_async(butex, expected_value,
+                                  detail::on_awaitable_int_done, promise) != 0) {
+        promise->set_value(errno);
+        promise->on_done();
+    }
+    return Awaitable<int>(promise);
+}
+
+// NOTE: the caller is resumed in the thread which unlocks the mutex if the
+// mutex is contended.
+inline Awaitable<int> Coroutine::lock(bthread_mutex_t* mutex) {
+    auto promise = new detail::AwaitablePromise<int>();
+    promise->set_needs_suspend();
+    const int rc = bthread::mutex_lock_async(
+        mutex, detail::on_awaitable_int_done, promise);
+    if (rc != 0) {
+        promise->set_value(rc);
+        promise->on_done();
+    }
+    return Awaitable<int>(promise);
+}
+
+// NOTE: the caller is resumed in the thread which calls the last signal().
+inline Awaitable<int> Coroutine::wait(bthread::CountdownEvent& event) {
+    auto promise = new detail::AwaitablePromise<int>();
+    promise->set_needs_suspend();
+    const int rc = event.wait_async(detail::on_awaitable_int_done, promise);
+    if (rc != 0) {
+        promise->set_value(rc);
+        promise->on_done();
+    }
+    return Awaitable<int>(promise);
+}
+
 } // namespace experimental
 } // namespace brpc
 
@@ -0,0 +1,95 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/fast_rand.h"
+#include "butil/time.h"
+#include "bvar/bvar.h"
+#include "brpc/errno.pb.h"
+#include "brpc/details/adaptive_throttler.h"
+
+namespace brpc {
+
+static bvar::Adder<int64_t>* g_throttled_calls = NULL;
+static pthread_once_t g_throttled_calls_once = PTHREAD_ONCE_INIT;
+
+static void CreateThrottledCalls() {
+    g_throttled_calls =
+        new bvar::Adder<int64_t>("rpc_client_throttled_count");
+}
+
+// Requests are counted in buckets of so many seconds each.
+static const int64_t BUCKET_SECONDS = 10;
+
+AdaptiveThrottler::AdaptiveThrottler(double k) : _k(k) {
+    for (int i = 0; i < BUCKET_NUM; ++i) {
+        _buckets[i].epoch.store(0, butil::memory_order_relaxed);
+        _buckets[i].requests.store(0, butil::memory_order_relaxed);
+        _buckets[i].accepts.store(0, butil::memory_order_relaxed);
+    }
+    pthread_once(&g_throttled_calls_once, CreateThrottledCalls);
+}
+
+AdaptiveThrottler::Bucket* AdaptiveThrottler::CurrentBucket() {
+    const int64_t epoch = butil::monotonic_time_s() / BUCKET_SECONDS + 1;
+    Bucket* b = &_buckets[epoch % BUCKET_NUM];
+    int64_t old_epoch = b->epoch.load(butil::memory_order_relaxed);
+    if (old_epoch != epoch &&
+        b->epoch.compare_exchange_strong(old_epoch, epoch,
+                                         butil::memory_order_relaxed)) {
+        // Counts racing with the reset may be lost, which is fine.
+        b->requests.store(0, butil::memory_order_relaxed);
+        b->accepts.store(0, butil::memory_order_relaxed);
+    }
+    return b;
+}
+
+double AdaptiveThrottler::RejectProbability() {
+    const int64_t epoch = butil::monotonic_time_s() / BUCKET_SECONDS + 1;
+    int64_t requests = 0;
+    int64_t accepts = 0;
+    for (int i = 0; i < BUCKET_NUM; ++i) {
+        const Bucket& b = _buckets[i];
+        if (epoch - b.epoch.load(butil::memory_order_relaxed) < BUCKET_NUM) {
+            requests += b.requests.load(butil::memory_order_relaxed);
+            accepts += b.accepts.load(butil::memory_order_relaxed);
+        }
+    }
+    const double p = (requests - _k * accepts) / (requests + 1);
+    return p > 0 ? p : 0;
+}
+
+bool AdaptiveThrottler::OnRequest() {
+    const double p = RejectProbability();
+    CurrentBucket()->requests.fetch_add(1, butil::memory_order_relaxed);
+    if (p > 0 && butil::fast_rand_double() < p) {
+        *g_throttled_calls << 1;
+        return true;
+    }
+    return false;
+}
+
+void AdaptiveThrottler::OnResponse(int error_code) {
+    // Requests rejected by overloaded servers are not accepted, other
+    // errors are not caused by the overload and don't throttle requests.
+    if (error_code == ELIMIT || error_code == EOVERCROWDED) {
+        return;
+    }
+    CurrentBucket()->accepts.fetch_add(1, butil::memory_order_relaxed);
+}
+
+} // namespace brpc
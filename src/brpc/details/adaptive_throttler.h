@@ -0,0 +1,67 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_ADAPTIVE_THROTTLER_H
+#define BRPC_DETAILS_ADAPTIVE_THROTTLER_H
+
+#include <stdint.h>
+#include "butil/atomicops.h"
+#include "butil/macros.h"
+
+namespace brpc {
+
+// Client-side adaptive throttling described in "Handling Overload" of the
+// Google SRE book. Requests of a channel and the ones accepted by servers
+// in the last two minutes are counted, and new requests are rejected
+// locally with probability max(0, (requests - k * accepts) / (requests + 1)),
+// so that overloaded servers don't waste resources on rejecting requests.
+class AdaptiveThrottler {
+public:
+    // `k' > 1, smaller values throttle more aggressively.
+    explicit AdaptiveThrottler(double k);
+
+    // Called before sending a request. Returns true if the request should
+    // be rejected locally, in which case OnResponse() must not be called.
+    bool OnRequest();
+
+    // Called when a request not rejected by OnRequest() ends with
+    // `error_code'.
+    void OnResponse(int error_code);
+
+    // Probability of rejecting a request currently.
+    double RejectProbability();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(AdaptiveThrottler);
+
+    static const int BUCKET_NUM = 12;
+    struct Bucket {
+        butil::atomic<int64_t> epoch;
+        butil::atomic<int64_t> requests;
+        butil::atomic<int64_t> accepts;
+    };
+    Bucket* CurrentBucket();
+
+    const double _k;
+    Bucket _buckets[BUCKET_NUM];
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_DETAILS_ADAPTIVE_THROTTLER_H
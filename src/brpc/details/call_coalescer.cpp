@@ -0,0 +1,167 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <vector>
+#include <google/protobuf/descriptor.h>
+#include "butil/crc32c.h"
+#include "butil/iobuf.h"
+#include "bvar/bvar.h"
+#include "brpc/controller.h"
+#include "brpc/errno.pb.h"
+#include "brpc/details/call_coalescer.h"
+
+namespace brpc {
+
+class CoalescedFlight {
+public:
+    std::shared_ptr<CallCoalescer> owner;
+    uint32_t hash;
+    const google::protobuf::MethodDescriptor* method;
+    // Shares blocks with the request of the leader.
+    butil::IOBuf request;
+    std::vector<CallId> followers;
+};
+
+static bvar::Adder<int64_t>* g_coalesced_calls = NULL;
+static pthread_once_t g_coalesced_calls_once = PTHREAD_ONCE_INIT;
+
+static void CreateCoalescedCalls() {
+    g_coalesced_calls =
+        new bvar::Adder<int64_t>("rpc_client_coalesced_call_count");
+}
+
+bool CallCoalescer::IsCoalescable(const Controller* cntl) {
+    return cntl->_method != NULL &&
+        cntl->_response != NULL &&
+        cntl->_sender == NULL &&
+        // Headers and attachments are parts of requests as well.
+        !cntl->has_http_request() &&
+        cntl->request_attachment().empty() &&
+        cntl->_request_streams.empty() &&
+        !cntl->is_response_read_progressively();
+}
+
+bool CallCoalescer::FollowOrLead(Controller* cntl) {
+    const butil::IOBuf& request = cntl->_request_buf;
+    const std::string& method_name = cntl->_method->full_name();
+    const uint32_t hash = butil::crc32c::Extend(
+        butil::crc32c::Value(method_name.data(), method_name.size()), request);
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        auto range = _flights.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            CoalescedFlight* f = it->second;
+            if (f->method == cntl->_method && f->request.equals(request)) {
+                f->followers.push_back(cntl->call_id());
+                return true;
+            }
+        }
+        CoalescedFlight* f = new CoalescedFlight;
+        f->owner = shared_from_this();
+        f->hash = hash;
+        f->method = cntl->_method;
+        f->request = request;
+        _flights.insert(std::make_pair(hash, f));
+        cntl->_coalesced_flight = f;
+    }
+    return false;
+}
+
+// Errors which are caused by the leader itself rather than the server or
+// the connection, e.g. the leader is canceled or reaches its own deadline
+// which may be shorter than deadlines of followers. They're not results of
+// the request and not shared with followers.
+static bool IsLeaderOnlyError(int error_code) {
+    return error_code == ERPCTIMEDOUT ||
+        error_code == ECANCELED ||
+        error_code == EBACKUPREQUEST;
+}
+
+void CallCoalescer::OnLeaderEnd(Controller* leader) {
+    std::unique_ptr<CoalescedFlight> f(leader->_coalesced_flight);
+    leader->_coalesced_flight = NULL;
+    CallCoalescer* c = f->owner.get();
+    {
+        BAIDU_SCOPED_LOCK(c->_mutex);
+        auto range = c->_flights.equal_range(f->hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == f.get()) {
+                c->_flights.erase(it);
+                break;
+            }
+        }
+    }
+    // No more followers after the flight is removed.
+    if (f->followers.empty()) {
+        return;
+    }
+    if (leader->Failed() && IsLeaderOnlyError(leader->ErrorCode())) {
+        // Promote the first follower still waiting to be the new leader and
+        // send its request. Remaining followers and later identical calls
+        // follow it.
+        for (size_t i = 0; i < f->followers.size(); ++i) {
+            void* data = NULL;
+            if (bthread_id_lock(f->followers[i], &data) != 0) {
+                // Ended already, e.g. timedout or canceled.
+                continue;
+            }
+            Controller* cntl = static_cast<Controller*>(data);
+            f->followers.erase(f->followers.begin(), f->followers.begin() + i + 1);
+            CoalescedFlight* nf = f.release();
+            {
+                BAIDU_SCOPED_LOCK(c->_mutex);
+                c->_flights.insert(std::make_pair(nf->hash, nf));
+            }
+            cntl->_coalesced_flight = nf;
+            // Unlocks the call id.
+            cntl->IssueRPC(butil::gettimeofday_us());
+            return;
+        }
+        return;
+    }
+    pthread_once(&g_coalesced_calls_once, CreateCoalescedCalls);
+    *g_coalesced_calls << (int64_t)f->followers.size();
+    for (size_t i = 0; i < f->followers.size(); ++i) {
+        void* data = NULL;
+        if (bthread_id_lock(f->followers[i], &data) != 0) {
+            // Ended already, e.g. timedout or canceled.
+            continue;
+        }
+        Controller* cntl = static_cast<Controller*>(data);
+        cntl->_remote_side = leader->_remote_side;
+        if (leader->Failed()) {
+            cntl->SetFailed(leader->ErrorCode(), "%s",
+                            leader->ErrorText().c_str());
+        } else {
+            if (cntl->_response->GetDescriptor() ==
+                leader->_response->GetDescriptor()) {
+                cntl->_response->CopyFrom(*leader->_response);
+            } else {
+                cntl->_response->ParseFromString(
+                    leader->_response->SerializeAsString());
+            }
+            // Shares blocks instead of copying bytes.
+            cntl->_response_attachment = leader->_response_attachment;
+        }
+        // Run done of followers concurrently in new bthreads.
+        const Controller::CompletionInfo info = { cntl->current_id(), true };
+        cntl->OnVersionedRPCReturned(info, true, 0);
+    }
+}
+
+} // namespace brpc
@@ -0,0 +1,68 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_CALL_COALESCER_H
+#define BRPC_DETAILS_CALL_COALESCER_H
+
+#include <stdint.h>
+#include <memory>
+#include <unordered_map>
+#include "butil/macros.h"
+#include "butil/synchronization/lock.h"
+
+namespace brpc {
+
+class Controller;
+class CoalescedFlight;
+
+// Calls of a channel to the same method with the same serialized request
+// are coalesced: while the first one (the leader) is in flight, later ones
+// (the followers) are not sent but wait for the result of the leader. Each
+// follower still ends at its own deadline.
+class CallCoalescer : public std::enable_shared_from_this<CallCoalescer> {
+public:
+    CallCoalescer() {}
+
+    // Called after the request of `cntl' is serialized, with the call id of
+    // `cntl' locked. Returns true if `cntl' follows an in-flight call and
+    // must not be sent, it's completed when the leader ends. Otherwise
+    // `cntl' leads calls identical to it until it ends.
+    bool FollowOrLead(Controller* cntl);
+
+    // Called when the RPC of `leader' ends, before running its done.
+    // Complete all followers with the response or error of `leader'. If
+    // `leader' failed for reasons of its own (timedout or canceled), the
+    // first follower still waiting is sent as the new leader instead.
+    static void OnLeaderEnd(Controller* leader);
+
+    // Whether the RPC of `cntl' could be coalesced, i.e. the request is
+    // fully determined by the method and the serialized message.
+    static bool IsCoalescable(const Controller* cntl);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(CallCoalescer);
+
+    butil::Mutex _mutex;
+    // Hash of the request => in-flight calls.
+    std::unordered_multimap<uint32_t, CoalescedFlight*> _flights;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_DETAILS_CALL_COALESCER_H
@@ -0,0 +1,66 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <limits>
+#include "butil/time.h"
+#include "bvar/bvar.h"
+#include "brpc/details/codel_admission.h"
+
+namespace brpc {
+
+static bvar::Adder<int64_t>* g_codel_dropped = NULL;
+static pthread_once_t g_codel_dropped_once = PTHREAD_ONCE_INIT;
+
+static void CreateCodelDropped() {
+    g_codel_dropped = new bvar::Adder<int64_t>("rpc_server_codel_dropped_count");
+}
+
+CodelAdmission::CodelAdmission(int64_t target_us, int64_t interval_us)
+    : _target_us(target_us)
+    , _interval_us(interval_us)
+    , _interval_end_us(0)
+    , _min_sojourn_us(std::numeric_limits<int64_t>::max())
+    , _overloaded(false) {
+    pthread_once(&g_codel_dropped_once, CreateCodelDropped);
+}
+
+bool CodelAdmission::Admit(int64_t sojourn_us) {
+    const int64_t now_us = butil::cpuwide_time_us();
+    int64_t end_us = _interval_end_us.load(butil::memory_order_relaxed);
+    if (now_us >= end_us &&
+        _interval_end_us.compare_exchange_strong(
+            end_us, now_us + _interval_us, butil::memory_order_relaxed)) {
+        // No request in the last interval means no queueing at all.
+        const int64_t min_us = _min_sojourn_us.exchange(
+            std::numeric_limits<int64_t>::max(), butil::memory_order_relaxed);
+        _overloaded.store(min_us != std::numeric_limits<int64_t>::max() &&
+                          min_us > _target_us, butil::memory_order_relaxed);
+    }
+    int64_t min_us = _min_sojourn_us.load(butil::memory_order_relaxed);
+    while (sojourn_us < min_us &&
+           !_min_sojourn_us.compare_exchange_weak(
+               min_us, sojourn_us, butil::memory_order_relaxed)) {}
+    const int64_t timeout_us = (overloaded() ? _target_us : _interval_us);
+    if (sojourn_us > timeout_us) {
+        *g_codel_dropped << 1;
+        return false;
+    }
+    return true;
+}
+
+} // namespace brpc
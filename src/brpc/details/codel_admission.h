@@ -0,0 +1,61 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_CODEL_ADMISSION_H
+#define BRPC_DETAILS_CODEL_ADMISSION_H
+
+#include <stdint.h>
+#include "butil/atomicops.h"
+#include "butil/macros.h"
+
+namespace brpc {
+
+// Admission of queued requests by the adaptive CoDel (Controlled Delay)
+// described in "Fail at Scale" of Facebook. Sojourn time of a request is
+// the time from being read from the socket to being processed. When the
+// minimum sojourn time in the last interval is above `target', requests are
+// queued persistently (instead of bursts being absorbed) and requests queued
+// longer than `target' are dropped, otherwise the ones queued longer than
+// `interval' are dropped.
+class CodelAdmission {
+public:
+    CodelAdmission(int64_t target_us, int64_t interval_us);
+
+    // Called before processing a request queued for `sojourn_us'.
+    // Returns false if the request should be dropped.
+    bool Admit(int64_t sojourn_us);
+
+    // Whether the queue was overloaded in the last interval.
+    bool overloaded() const {
+        return _overloaded.load(butil::memory_order_relaxed);
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(CodelAdmission);
+
+    const int64_t _target_us;
+    const int64_t _interval_us;
+    butil::atomic<int64_t> _interval_end_us;
+    butil::atomic<int64_t> _min_sojourn_us;
+    butil::atomic<bool> _overloaded;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_DETAILS_CODEL_ADMISSION_H
@@ -0,0 +1,426 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gflags/gflags.h>
+#include "butil/build_config.h"
+#include "brpc/details/continuous_profiler.h"
+
+#if defined(OS_LINUX)
+#include <errno.h>
+#include <string.h>
+#include <dlfcn.h>                           // dladdr
+#include <execinfo.h>                        // backtrace
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>                          // strtol
+#include <time.h>                            // timer_create
+#include <cxxabi.h>                          // abi::__cxa_demangle
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include "butil/atomicops.h"
+#include "butil/fd_guard.h"
+#include "butil/files/dir_reader_posix.h"
+#include "butil/fast_rand.h"
+#include "butil/logging.h"
+#include "butil/time.h"
+#include "butil/synchronization/lock.h"
+#include "bvar/passive_status.h"
+#if defined(USE_SYMBOLIZE)
+#include "butil/third_party/symbolize/symbolize.h"
+#endif
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif  // OS_LINUX
+#include "brpc/reloadable_flags.h"
+
+namespace brpc {
+
+DEFINE_int32(continuous_profiling_hz, 0,
+             "Sample stacks of running threads so many times per cpu-second "
+             "continuously, 19~99 is recommended, 0 disables the continuous "
+             "profiler");
+BRPC_VALIDATE_GFLAG(continuous_profiling_hz, NonNegativeInteger);
+
+DEFINE_int32(continuous_profiling_window_s, 600,
+             "Keep stacks sampled by the continuous profiler in so many "
+             "seconds");
+BRPC_VALIDATE_GFLAG(continuous_profiling_window_s, PositiveInteger);
+
+#if defined(OS_LINUX)
+
+// Samples are aggregated into buckets of so many seconds.
+static const int64_t BUCKET_SECONDS = 10;
+static const int MAX_FRAMES = 32;
+// Frames of the signal handler and the signal trampoline.
+static const int SKIPPED_FRAMES = 2;
+static const size_t RING_SIZE = 8192;
+
+enum SampleState {
+    SAMPLE_FREE = 0,
+    SAMPLE_WRITING,
+    SAMPLE_READY,
+};
+
+struct Sample {
+    butil::atomic<int> state;
+    int nframes;
+    void* stack[MAX_FRAMES];
+};
+
+struct Bucket {
+    int64_t start_s;
+    // Raw bytes of stack => number of samples.
+    std::unordered_map<std::string, int64_t> stacks;
+};
+
+static Sample* g_ring = NULL;
+static butil::atomic<uint64_t> g_ring_index(0);
+static butil::atomic<int64_t> g_dropped_samples(0);
+static butil::atomic<int> g_sampling_hz(0);
+// Thread => timer of cpu time of the thread. Only accessed in
+// UpdateContinuousProfiler().
+static std::map<pid_t, timer_t>* g_thread_timers = NULL;
+
+static butil::Mutex g_window_mutex;
+static std::deque<Bucket>* g_window = NULL;
+
+static butil::Mutex g_symbol_mutex;
+static std::map<void*, std::string>* g_symbols = NULL;
+
+// Reserve a real-time signal, SIGPROF is used by gperftools.
+static int ProfilingSignal() {
+    return SIGRTMAX - 1;
+}
+
+static void SampleHandler(int, siginfo_t*, void*) {
+    const int saved_errno = errno;
+    Sample& s = g_ring[g_ring_index.fetch_add(1, butil::memory_order_relaxed)
+                       % RING_SIZE];
+    int expected = SAMPLE_FREE;
+    if (s.state.compare_exchange_strong(expected, SAMPLE_WRITING,
+                                        butil::memory_order_acquire)) {
+        void* stack[MAX_FRAMES + SKIPPED_FRAMES];
+        const int n = backtrace(stack, MAX_FRAMES + SKIPPED_FRAMES);
+        s.nframes = std::max(n - SKIPPED_FRAMES, 0);
+        for (int i = 0; i < s.nframes; ++i) {
+            s.stack[i] = stack[i + SKIPPED_FRAMES];
+        }
+        s.state.store(SAMPLE_READY, butil::memory_order_release);
+    } else {
+        // The collector falls behind.
+        g_dropped_samples.fetch_add(1, butil::memory_order_relaxed);
+    }
+    errno = saved_errno;
+}
+
+static int64_t GetDroppedSamples(void*) {
+    return g_dropped_samples.load(butil::memory_order_relaxed);
+}
+
+static int InitOnce() {
+    g_ring = new (std::nothrow) Sample[RING_SIZE];
+    if (g_ring == NULL) {
+        LOG(ERROR) << "Fail to allocate ring of continuous profiler";
+        return -1;
+    }
+    for (size_t i = 0; i < RING_SIZE; ++i) {
+        g_ring[i].state.store(SAMPLE_FREE, butil::memory_order_relaxed);
+        g_ring[i].nframes = 0;
+    }
+    g_window = new std::deque<Bucket>;
+    g_symbols = new std::map<void*, std::string>;
+    new bvar::PassiveStatus<int64_t>("continuous_profiling_dropped_samples",
+                                     GetDroppedSamples, NULL);
+    // backtrace() loads libgcc at the first call, which is not allowed
+    // in signal handlers.
+    void* dummy[4];
+    backtrace(dummy, 4);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = SampleHandler;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(ProfilingSignal(), &sa, NULL) != 0) {
+        PLOG(ERROR) << "Fail to install handler of continuous profiler";
+        return -1;
+    }
+    g_thread_timers = new std::map<pid_t, timer_t>;
+    return 0;
+}
+
+// Cpu clock of thread `tid' of this process, see MAKE_THREAD_CPUCLOCK in
+// linux/posix-timers.h. pthread_getcpuclockid() does the same but only
+// accepts pthread_t.
+static clockid_t ThreadCpuClock(pid_t tid) {
+    const unsigned CPUCLOCK_PERTHREAD_MASK = 4;
+    const unsigned CPUCLOCK_SCHED = 2;
+    return (clockid_t)((~(unsigned)tid << 3) |
+                       CPUCLOCK_PERTHREAD_MASK | CPUCLOCK_SCHED);
+}
+
+static void ArmTimer(timer_t timer, int hz) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_nsec = std::max(1000000000L / hz, 1L);
+    // Threads scanned at the same time do not fire together.
+    its.it_value.tv_nsec = butil::fast_rand_in(1L, its.it_interval.tv_nsec);
+    if (timer_settime(timer, 0, &its, NULL) != 0) {
+        PLOG(ERROR) << "Fail to set timer of continuous profiler";
+    }
+}
+
+// Whether the thread which `timer' measures exited. Timers of exited
+// threads are disarmed, even if the tid is reused by a new thread.
+static bool IsTimerDead(timer_t timer) {
+    struct itimerspec its;
+    return timer_gettime(timer, &its) != 0 ||
+        (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0);
+}
+
+// Every thread gets a timer of its own cpu time which signals the thread
+// itself, so that threads are sampled in proportion to their cpu time. A
+// timer of the process cpu time signals an arbitrary thread, which is not
+// necessarily the one consuming cpu. Threads are scanned once a second,
+// threads living shorter are not sampled.
+static void UpdateThreadTimers(int hz, bool hz_changed) {
+    std::vector<pid_t> tids;
+    if (hz > 0) {
+        butil::DirReaderPosix dr("/proc/self/task");
+        if (!dr.IsValid()) {
+            PLOG(ERROR) << "Fail to open /proc/self/task";
+            return;
+        }
+        while (dr.Next()) {
+            char* endptr = NULL;
+            const long tid = strtol(dr.name(), &endptr, 10);
+            if (*endptr == '\0' && tid > 0) {  // skip . and ..
+                tids.push_back((pid_t)tid);
+            }
+        }
+        std::sort(tids.begin(), tids.end());
+    }
+    for (std::map<pid_t, timer_t>::iterator it = g_thread_timers->begin();
+         it != g_thread_timers->end();) {
+        if (!std::binary_search(tids.begin(), tids.end(), it->first) ||
+            IsTimerDead(it->second)) {
+            timer_delete(it->second);
+            g_thread_timers->erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    for (size_t i = 0; i < tids.size(); ++i) {
+        std::map<pid_t, timer_t>::iterator it = g_thread_timers->find(tids[i]);
+        if (it != g_thread_timers->end()) {
+            if (hz_changed) {
+                ArmTimer(it->second, hz);
+            }
+            continue;
+        }
+        struct sigevent sev;
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev.sigev_signo = ProfilingSignal();
+        sev.sigev_notify_thread_id = tids[i];
+        timer_t timer;
+        if (timer_create(ThreadCpuClock(tids[i]), &sev, &timer) != 0) {
+            // The thread exited after scanning.
+            continue;
+        }
+        ArmTimer(timer, hz);
+        (*g_thread_timers)[tids[i]] = timer;
+    }
+}
+
+void UpdateContinuousProfiler() {
+    static int init_rc = 1;
+    const int hz = FLAGS_continuous_profiling_hz;
+    if (init_rc > 0) {
+        if (hz <= 0) {
+            return;
+        }
+        init_rc = InitOnce();
+    }
+    if (init_rc != 0) {
+        return;
+    }
+    const bool hz_changed = (hz != g_sampling_hz.load(butil::memory_order_relaxed));
+    UpdateThreadTimers(hz, hz_changed);
+    g_sampling_hz.store(hz, butil::memory_order_relaxed);
+
+    const int64_t now_s = butil::gettimeofday_s();
+    const int64_t start_s = now_s / BUCKET_SECONDS * BUCKET_SECONDS;
+    const int64_t expire_s = now_s - FLAGS_continuous_profiling_window_s;
+    BAIDU_SCOPED_LOCK(g_window_mutex);
+    while (!g_window->empty() &&
+           g_window->front().start_s + BUCKET_SECONDS <= expire_s) {
+        g_window->pop_front();
+    }
+    Bucket* bucket = NULL;
+    for (size_t i = 0; i < RING_SIZE; ++i) {
+        Sample& s = g_ring[i];
+        if (s.state.load(butil::memory_order_acquire) != SAMPLE_READY) {
+            continue;
+        }
+        if (bucket == NULL) {
+            if (g_window->empty() || g_window->back().start_s != start_s) {
+                g_window->push_back(Bucket());
+                g_window->back().start_s = start_s;
+            }
+            bucket = &g_window->back();
+        }
+        if (s.nframes > 0) {
+            ++bucket->stacks[std::string((const char*)s.stack,
+                                         s.nframes * sizeof(void*))];
+        }
+        s.state.store(SAMPLE_FREE, butil::memory_order_release);
+    }
+}
+
+bool IsContinuousProfilerRunning() {
+    return g_sampling_hz.load(butil::memory_order_relaxed) > 0;
+}
+
+static const std::string& Symbolize(void* addr) {
+    std::string& name = (*g_symbols)[addr];
+    if (!name.empty()) {
+        return name;
+    }
+#if defined(USE_SYMBOLIZE)
+    char buf[1024];
+    if (google::Symbolize(addr, buf, sizeof(buf))) {
+        name = buf;
+        return name;
+    }
+#endif
+    Dl_info info;
+    if (dladdr(addr, &info) != 0 && info.dli_sname != NULL) {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, NULL, 0, &status);
+        name = (status == 0 && demangled ? demangled : info.dli_sname);
+        free(demangled);
+    } else {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%p", addr);
+        name = buf;
+    }
+    // ';' separates frames in folded stacks.
+    for (size_t i = 0; i < name.size(); ++i) {
+        if (name[i] == ';') {
+            name[i] = ',';
+        }
+    }
+    return name;
+}
+
+int64_t DumpContinuousProfile(int64_t begin_s, int64_t end_s,
+                              bool pprof, butil::IOBuf* out) {
+    if (g_window == NULL) {
+        return 0;
+    }
+    std::unordered_map<std::string, int64_t> stacks;
+    {
+        BAIDU_SCOPED_LOCK(g_window_mutex);
+        for (size_t i = 0; i < g_window->size(); ++i) {
+            const Bucket& b = (*g_window)[i];
+            if (b.start_s + BUCKET_SECONDS <= begin_s || b.start_s >= end_s) {
+                continue;
+            }
+            for (auto it = b.stacks.begin(); it != b.stacks.end(); ++it) {
+                stacks[it->first] += it->second;
+            }
+        }
+    }
+    int64_t nsample = 0;
+    butil::IOBufBuilder os;
+    if (pprof) {
+        // Header of the legacy cpu profile of gperftools.
+        const int hz = std::max(
+            g_sampling_hz.load(butil::memory_order_relaxed), 1);
+        const uintptr_t header[] = { 0, 3, 0, (uintptr_t)(1000000 / hz), 0 };
+        os.write((const char*)header, sizeof(header));
+        for (auto it = stacks.begin(); it != stacks.end(); ++it) {
+            const uintptr_t record[] = {
+                (uintptr_t)it->second, it->first.size() / sizeof(void*) };
+            os.write((const char*)record, sizeof(record));
+            os.write(it->first.data(), it->first.size());
+            nsample += it->second;
+        }
+        const uintptr_t trailer[] = { 0, 1, 0 };
+        os.write((const char*)trailer, sizeof(trailer));
+        os.move_to(*out);
+        // Required by pprof to interpret addresses.
+        butil::IOPortal mem_maps;
+        const butil::fd_guard fd(open("/proc/self/maps", O_RDONLY));
+        if (fd >= 0) {
+            ssize_t nr = 0;
+            while ((nr = mem_maps.append_from_file_descriptor(fd, 8192)) > 0 ||
+                   (nr < 0 && errno == EINTR)) {}
+            out->append(mem_maps);
+        }
+        return nsample;
+    }
+    // Stacks differing in addresses inside same functions are merged.
+    std::map<std::string, int64_t> folded;
+    {
+        BAIDU_SCOPED_LOCK(g_symbol_mutex);
+        std::string line;
+        for (auto it = stacks.begin(); it != stacks.end(); ++it) {
+            void* const* frames = (void* const*)it->first.data();
+            const int n = it->first.size() / sizeof(void*);
+            line.clear();
+            for (int i = n - 1; i >= 0; --i) {
+                // Callers are return addresses which may belong to the next
+                // function, look up the call instruction instead.
+                void* addr = (i == 0 ? frames[i] : (char*)frames[i] - 1);
+                line.append(Symbolize(addr));
+                if (i != 0) {
+                    line.push_back(';');
+                }
+            }
+            folded[line] += it->second;
+        }
+    }
+    for (auto it = folded.begin(); it != folded.end(); ++it) {
+        os << it->first << ' ' << it->second << '\n';
+        nsample += it->second;
+    }
+    os.move_to(*out);
+    return nsample;
+}
+
+#else  // OS_LINUX
+
+void UpdateContinuousProfiler() {}
+
+bool IsContinuousProfilerRunning() {
+    return false;
+}
+
+int64_t DumpContinuousProfile(int64_t, int64_t, bool, butil::IOBuf*) {
+    return 0;
+}
+
+#endif  // OS_LINUX
+
+}  // namespace brpc
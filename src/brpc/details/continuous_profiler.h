@@ -0,0 +1,62 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BRPC_CONTINUOUS_PROFILER_H
+#define  BRPC_CONTINUOUS_PROFILER_H
+
+#include <stdint.h>
+#include <gflags/gflags_declare.h>
+#include "butil/iobuf.h"
+
+
+namespace brpc {
+
+DECLARE_int32(continuous_profiling_hz);
+DECLARE_int32(continuous_profiling_window_s);
+
+// An always-on sampling cpu profiler at a low rate. Each thread has a timer
+// of its cpu time, which sends a real-time signal to the thread
+// -continuous_profiling_hz times per cpu-second. The handler saves the
+// backtrace of the thread into a lock-free ring. Samples in the ring are aggregated by stack
+// into buckets of a few seconds, which are kept for the last
+// -continuous_profiling_window_s seconds. Addresses are symbolized only when
+// the profile is dumped.
+// Unlike the gperftools-based cpu profiler, this profiler does not use
+// SIGPROF and is able to run along with /hotspots/cpu.
+
+// Arm/disarm timers of threads according to -continuous_profiling_hz,
+// create timers for new threads and delete ones of exited threads, and move
+// samples from the ring into the window. Called every second in
+// GlobalUpdate().
+void UpdateContinuousProfiler();
+
+// Returns true if the profiler is sampling.
+bool IsContinuousProfilerRunning();
+
+// Write stacks sampled within [begin_s, end_s) (in seconds since epoch) into
+// `out'. Stacks are folded into lines of "frame1;frame2;...;leaf count",
+// which are understood by flamegraph.pl and speedscope, or written in the
+// binary format of gperftools cpu profiles when `pprof' is true, which can
+// be analyzed by `pprof <binary> <profile>'.
+// Returns number of samples written.
+int64_t DumpContinuousProfile(int64_t begin_s, int64_t end_s,
+                              bool pprof, butil::IOBuf* out);
+
+}  // namespace brpc
+
+
+#endif  // BRPC_CONTINUOUS_PROFILER_H
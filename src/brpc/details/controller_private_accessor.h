@@ -102,6 +102,8 @@ public:
     
     Span* span() const { return _cntl->_span; }
 
+    ServerPhaseTimer& phase_timer() { return _cntl->_phase_timer; }
+
     uint32_t pipelined_count() const { return _cntl->_pipelined_count; }
     void set_pipelined_count(uint32_t count) {  _cntl->_pipelined_count = count; }
 
@@ -119,6 +121,14 @@ public:
         return _cntl->_remote_stream_settings;
     }
 
+    // Created on demand, destroyed in Controller::Reset()
+    AliasedPbFields* mutable_aliased_request_fields() {
+        if (_cntl->_aliased_request_fields == NULL) {
+            _cntl->_aliased_request_fields = new AliasedPbFields;
+        }
+        return _cntl->_aliased_request_fields;
+    }
+
     StreamIds request_streams() { return _cntl->_request_streams; }
     StreamIds response_streams() { return _cntl->_response_streams; }
 
@@ -128,6 +138,11 @@ public:
     void set_readable_progressive_attachment(ReadableProgressiveAttachment* s)
     { _cntl->_rpa.reset(s); }
 
+    // Chunks of the progressive response are written after responses of
+    // earlier pipelined requests.
+    void set_progressive_response_seq(uint64_t seq)
+    { _cntl->_wpa->_response_seq = seq; }
+
     void set_auth_flags(uint32_t auth_flags) {
         _cntl->_auth_flags = auth_flags;
     }
@@ -139,7 +154,10 @@ public:
 
     // Note: This function can only be called in server side. The deadline of client
     // side is properly set in the RPC sending path.
-    void set_deadline_us(int64_t deadline_us) { _cntl->_deadline_us = deadline_us; }
+    void set_deadline_us(int64_t deadline_us) {
+        _cntl->_deadline_us = deadline_us;
+        _cntl->_inheritable.deadline_us = deadline_us;
+    }
 
     ControllerPrivateAccessor& set_begin_time_us(int64_t begin_time_us) {
         _cntl->_begin_time_us = begin_time_us;
@@ -162,6 +180,15 @@ public:
 
     const std::string& checksum_value() const { return _cntl->_checksum_value; }
 
+    void set_response_cache(ResponseCache* cache, butil::IOBuf* key) {
+        _cntl->_response_cache = cache;
+        _cntl->_response_cache_key.swap(*key);
+    }
+    ResponseCache* response_cache() const { return _cntl->_response_cache; }
+    const butil::IOBuf& response_cache_key() const {
+        return _cntl->_response_cache_key;
+    }
+
 private:
     Controller* _cntl;
 };
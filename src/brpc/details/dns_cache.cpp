@@ -0,0 +1,354 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <ctype.h>
+#include <netdb.h>                              // getaddrinfo
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <gflags/gflags.h>
+#include "butil/logging.h"
+#include "butil/time.h"
+#include "bthread/condition_variable.h"
+#include "bthread/mutex.h"
+#include "bvar/bvar.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/dns_cache.h"
+
+namespace brpc {
+
+DEFINE_bool(dns_cache, true,
+            "Cache resolved addresses of domain names for all channels and "
+            "naming services, and refresh them in background");
+DEFINE_int32(dns_cache_ttl_s, 5,
+             "Cached addresses of a domain name are refreshed in background "
+             "before so many seconds after last resolution");
+DEFINE_int32(dns_cache_negative_ttl_s, 1,
+             "Failed resolutions of a domain name are cached for so many "
+             "seconds");
+DEFINE_int32(dns_cache_idle_s, 300,
+             "Cached domain names not resolved for so many seconds are "
+             "removed");
+BRPC_VALIDATE_GFLAG(dns_cache, PassValidate);
+BRPC_VALIDATE_GFLAG(dns_cache_ttl_s, PositiveInteger);
+BRPC_VALIDATE_GFLAG(dns_cache_negative_ttl_s, NonNegativeInteger);
+BRPC_VALIDATE_GFLAG(dns_cache_idle_s, PositiveInteger);
+
+namespace {
+
+struct SockAddr {
+    sockaddr_storage addr;
+    socklen_t len;
+};
+
+// Blocking resolution by the system resolver.
+int GetAddrInfo(const std::string& host, int family,
+                std::vector<SockAddr>* addrs) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = NULL;
+    const int rc = getaddrinfo(host.c_str(), NULL, &hints, &result);
+    if (rc != 0) {
+        LOG(WARNING) << "Can't resolve `" << host << "': " << gai_strerror(rc);
+        return -1;
+    }
+    addrs->clear();
+    for (struct addrinfo* rp = result; rp != NULL; rp = rp->ai_next) {
+        if (rp->ai_family != family ||
+            rp->ai_addrlen > sizeof(sockaddr_storage)) {
+            continue;
+        }
+        SockAddr a;
+        memset(&a.addr, 0, sizeof(a.addr));
+        memcpy(&a.addr, rp->ai_addr, rp->ai_addrlen);
+        a.len = rp->ai_addrlen;
+        addrs->push_back(a);
+    }
+    freeaddrinfo(result);
+    if (addrs->empty()) {
+        LOG(WARNING) << "No address of family=" << family << " for `"
+                     << host << '\'';
+        return -1;
+    }
+    return 0;
+}
+
+int ToEndPoints(const std::vector<SockAddr>& addrs, int port,
+                std::vector<butil::EndPoint>* out) {
+    out->clear();
+    for (size_t i = 0; i < addrs.size(); ++i) {
+        SockAddr a = addrs[i];
+        if (a.addr.ss_family == AF_INET) {
+            ((sockaddr_in*)&a.addr)->sin_port = htons(port);
+        } else if (a.addr.ss_family == AF_INET6) {
+            ((sockaddr_in6*)&a.addr)->sin6_port = htons(port);
+        }
+        butil::EndPoint point;
+        if (butil::sockaddr2endpoint(&a.addr, a.len, &point) == 0) {
+            out->push_back(point);
+        }
+    }
+    return out->empty() ? -1 : 0;
+}
+
+class DnsCache {
+public:
+    static DnsCache* GetInstance();
+
+    int Resolve(const std::string& host, int family,
+                std::vector<SockAddr>* addrs);
+
+private:
+    DnsCache();
+    DISALLOW_COPY_AND_ASSIGN(DnsCache);
+
+    struct Entry {
+        Entry()
+            : family(AF_INET), resolved(false), ok(false), resolving(false)
+            , refresh_us(0), last_access_us(0) {}
+        std::string host;
+        int family;
+        std::vector<SockAddr> addrs;
+        // Resolved at least once.
+        bool resolved;
+        // Last resolution succeeded, or `addrs' is from an earlier
+        // successful resolution.
+        bool ok;
+        // In `_queue' or being resolved by a resolver.
+        bool resolving;
+        // Resolve again after this time.
+        int64_t refresh_us;
+        int64_t last_access_us;
+    };
+    typedef std::map<std::string, Entry> EntryMap;
+
+    static void* RunResolver(void* arg);
+    // Called with _mutex held.
+    void Schedule(const std::string& key, Entry* e);
+    // Called with _mutex held. Schedule entries to be refreshed and
+    // remove idle ones.
+    void ScanEntries(int64_t now_us);
+
+    bthread::Mutex _mutex;
+    // Signaled when a name is pushed into _queue.
+    bthread::ConditionVariable _queue_cond;
+    // Signaled when a resolution ends.
+    bthread::ConditionVariable _resolved_cond;
+    EntryMap _entries;
+    std::deque<std::string> _queue;
+    int64_t _last_scan_us;
+    bvar::Adder<int64_t> _nhit;
+    bvar::Adder<int64_t> _nmiss;
+};
+
+// Resolvers of the cache, more than one so that one slow name does not
+// delay resolutions of others.
+static const int DNS_RESOLVER_NUM = 2;
+
+DnsCache* DnsCache::GetInstance() {
+    // Never deleted since the resolvers run until the process quits.
+    static DnsCache* cache = new DnsCache;
+    return cache;
+}
+
+DnsCache::DnsCache()
+    : _last_scan_us(0)
+    , _nhit("rpc_dns_cache_hit")
+    , _nmiss("rpc_dns_cache_miss") {
+    for (int i = 0; i < DNS_RESOLVER_NUM; ++i) {
+        pthread_t th;
+        if (pthread_create(&th, NULL, RunResolver, this) != 0) {
+            LOG(FATAL) << "Fail to create dns resolver";
+            continue;
+        }
+        pthread_detach(th);
+    }
+}
+
+void DnsCache::Schedule(const std::string& key, Entry* e) {
+    if (!e->resolving) {
+        e->resolving = true;
+        _queue.push_back(key);
+        _queue_cond.notify_one();
+    }
+}
+
+void DnsCache::ScanEntries(int64_t now_us) {
+    const int64_t idle_us = FLAGS_dns_cache_idle_s * 1000000L;
+    for (EntryMap::iterator it = _entries.begin(); it != _entries.end();) {
+        Entry& e = it->second;
+        if (!e.resolving && now_us - e.last_access_us > idle_us) {
+            _entries.erase(it++);
+            continue;
+        }
+        if (now_us >= e.refresh_us && e.ok) {
+            // Failed names are resolved again on demand only.
+            Schedule(it->first, &e);
+        }
+        ++it;
+    }
+}
+
+void* DnsCache::RunResolver(void* arg) {
+    DnsCache* c = static_cast<DnsCache*>(arg);
+    std::unique_lock<bthread::Mutex> mu(c->_mutex);
+    while (true) {
+        int64_t now_us = butil::monotonic_time_us();
+        if (now_us - c->_last_scan_us >= 1000000L) {
+            c->_last_scan_us = now_us;
+            c->ScanEntries(now_us);
+        }
+        if (c->_queue.empty()) {
+            c->_queue_cond.wait_for(mu, 1000000L);
+            continue;
+        }
+        const std::string key = c->_queue.front();
+        c->_queue.pop_front();
+        EntryMap::iterator it = c->_entries.find(key);
+        if (it == c->_entries.end()) {
+            continue;
+        }
+        const std::string host = it->second.host;
+        const int family = it->second.family;
+        mu.unlock();
+        std::vector<SockAddr> addrs;
+        const int rc = GetAddrInfo(host, family, &addrs);
+        mu.lock();
+        // Entries being resolved are not removed.
+        Entry& e = c->_entries[key];
+        now_us = butil::monotonic_time_us();
+        e.resolved = true;
+        e.resolving = false;
+        if (rc == 0) {
+            e.addrs.swap(addrs);
+            e.ok = true;
+            // Refresh before expiration so that callers always see fresh
+            // addresses.
+            e.refresh_us = now_us + FLAGS_dns_cache_ttl_s * 800000L;
+        } else {
+            // Keep addresses of last successful resolution if any, and
+            // retry after the negative ttl.
+            e.refresh_us = now_us + FLAGS_dns_cache_negative_ttl_s * 1000000L;
+        }
+        c->_resolved_cond.notify_all();
+    }
+    return NULL;
+}
+
+int DnsCache::Resolve(const std::string& host, int family,
+                      std::vector<SockAddr>* addrs) {
+    std::string key;
+    key.reserve(host.size() + 1);
+    key.push_back(family == AF_INET6 ? '6' : '4');
+    key.append(host);
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    Entry& e = _entries[key];
+    if (e.host.empty()) {
+        e.host = host;
+        e.family = family;
+    }
+    const int64_t now_us = butil::monotonic_time_us();
+    e.last_access_us = now_us;
+    if (e.resolved && (e.ok || now_us < e.refresh_us)) {
+        if (now_us >= e.refresh_us && e.ok) {
+            // Missed by the scanning, prefetch now.
+            Schedule(key, &e);
+        }
+        _nhit << 1;
+        if (!e.ok) {
+            return -1;
+        }
+        *addrs = e.addrs;
+        return 0;
+    }
+    _nmiss << 1;
+    // Never resolved or the failure expired, wait for the resolution.
+    Schedule(key, &e);
+    while (e.resolving) {
+        _resolved_cond.wait(mu);
+    }
+    if (!e.ok) {
+        return -1;
+    }
+    *addrs = e.addrs;
+    return 0;
+}
+
+}  // namespace
+
+int ResolveHost(const char* host, int family, int port,
+                std::vector<butil::EndPoint>* addrs) {
+    if (host == NULL || *host == '\0') {
+        return -1;
+    }
+    std::vector<SockAddr> sock_addrs;
+    if (FLAGS_dns_cache) {
+        if (DnsCache::GetInstance()->Resolve(host, family, &sock_addrs) != 0) {
+            return -1;
+        }
+    } else if (GetAddrInfo(host, family, &sock_addrs) != 0) {
+        return -1;
+    }
+    return ToEndPoints(sock_addrs, port, addrs);
+}
+
+int CachedHostname2Endpoint(const char* host_and_port,
+                            butil::EndPoint* point) {
+    // Same limitation as butil::hostname2endpoint().
+    char buf[256];
+    size_t i = 0;
+    for (; i < sizeof(buf) - 1 && host_and_port[i] != '\0' &&
+             host_and_port[i] != ':'; ++i) {
+        buf[i] = host_and_port[i];
+    }
+    if (host_and_port[i] != ':') {
+        return -1;
+    }
+    buf[i] = '\0';
+    const char* port_str = host_and_port + i + 1;
+    char* end = NULL;
+    const long port = strtol(port_str, &end, 10);
+    if (end == port_str) {
+        return -1;
+    }
+    for (; isspace(*end); ++end) {}
+    if (*end != '\0') {
+        return -1;
+    }
+    return CachedHostname2Endpoint(buf, (int)port, point);
+}
+
+int CachedHostname2Endpoint(const char* host, int port,
+                            butil::EndPoint* point) {
+    if (port < 0 || port > 65535) {
+        return -1;
+    }
+    for (; isspace(*host); ++host) {}
+    std::vector<butil::EndPoint> addrs;
+    if (ResolveHost(host, AF_INET, port, &addrs) != 0) {
+        return -1;
+    }
+    *point = addrs[0];
+    return 0;
+}
+
+} // namespace brpc
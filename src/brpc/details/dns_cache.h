@@ -0,0 +1,50 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_DETAILS_DNS_CACHE_H
+#define BRPC_DETAILS_DNS_CACHE_H
+
+#include <vector>
+#include "butil/endpoint.h"
+
+namespace brpc {
+
+// Addresses of domain names are cached and shared by all channels and
+// naming services in the process. Cached addresses are refreshed by
+// background threads before they expire (after -dns_cache_ttl_s), so
+// resolutions rarely block callers except the first one of a name. Failed
+// resolutions are cached for -dns_cache_negative_ttl_s. When a refresh
+// fails, last resolved addresses are kept until the name resolves again.
+// Names not resolved for -dns_cache_idle_s are removed.
+// Callers of the first resolution of a name wait for it in bthread-friendly
+// ways, concurrent resolutions of the same name are merged.
+
+// Put addresses of `host' in `family' (AF_INET or AF_INET6) with port
+// `port' into `addrs'.
+// Returns 0 on success, -1 otherwise.
+int ResolveHost(const char* host, int family, int port,
+                std::vector<butil::EndPoint>* addrs);
+
+// Same as butil::hostname2endpoint() but resolved by ResolveHost().
+int CachedHostname2Endpoint(const char* host_and_port,
+                            butil::EndPoint* point);
+int CachedHostname2Endpoint(const char* host, int port,
+                            butil::EndPoint* point);
+
+} // namespace brpc
+
+#endif  // BRPC_DETAILS_DNS_CACHE_H
@@ -0,0 +1,215 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_FROZEN_NAME_MAP_H
+#define BRPC_DETAILS_FROZEN_NAME_MAP_H
+
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "butil/strings/string_piece.h"
+#include "butil/third_party/murmurhash3/murmurhash3.h"
+
+namespace brpc {
+
+// An immutable map from a fixed set of names (e.g. methods of a started
+// server) to values, indexed by a perfect hash built with CHD
+// (compress, hash and displace): names are hashed into small buckets, each
+// bucket is given a displacement which moves all its names into free slots.
+// A lookup costs one hash, one displacement, one slot and at most one string
+// comparison, without probing or chaining. Building is linear in the
+// number of names.
+template <typename T>
+class FrozenNameMap {
+public:
+    FrozenNameMap() : _mask(0), _bucket_mask(0) {}
+
+    // Replace content with `items'. Names must be distinct.
+    // Returns 0 on success, -1 otherwise.
+    int init(const std::vector<std::pair<std::string, T> >& items);
+
+    void clear() {
+        _slots.clear();
+        _displacements.clear();
+        _mask = 0;
+        _bucket_mask = 0;
+    }
+
+    bool initialized() const { return !_slots.empty(); }
+
+    // Returns address of the value of `name', NULL if not found.
+    const T* seek(const butil::StringPiece& name) const {
+        if (_slots.empty()) {
+            return NULL;
+        }
+        Hash h;
+        hash(name, &h);
+        const Slot& s = _slots[index(h, _displacements[h.bucket & _bucket_mask])];
+        if (s.used && s.hash == h.slot && s.name.size() == name.size() &&
+            memcmp(s.name.data(), name.data(), name.size()) == 0) {
+            return &s.value;
+        }
+        return NULL;
+    }
+
+private:
+    struct Slot {
+        Slot() : used(false), hash(0) {}
+        bool used;
+        uint64_t hash;
+        std::string name;
+        T value;
+    };
+
+    struct Hash {
+        // Selects the bucket.
+        uint64_t bucket;
+        // Selects the slot together with the displacement of the bucket.
+        uint64_t slot;
+    };
+
+    struct Displacement {
+        uint32_t d0;
+        uint32_t d1;
+    };
+
+    static void hash(const butil::StringPiece& name, Hash* h) {
+        uint64_t out[2];
+        butil::MurmurHash3_x64_128(name.data(), name.size(), 0, out);
+        h->bucket = out[0];
+        h->slot = out[1];
+    }
+
+    // (f1 + d0 * f2 + d1) mod #slots. f2 is odd to be coprime with #slots
+    // which is a power of 2, so that different d0 spread names differently.
+    uint32_t index(const Hash& h, const Displacement& d) const {
+        const uint32_t f1 = (uint32_t)h.slot;
+        const uint32_t f2 = (uint32_t)(h.slot >> 32) | 1;
+        return (f1 + d.d0 * f2 + d.d1) & _mask;
+    }
+
+    uint32_t _mask;
+    uint32_t _bucket_mask;
+    std::vector<Slot> _slots;
+    std::vector<Displacement> _displacements;
+};
+
+template <typename T>
+int FrozenNameMap<T>::init(const std::vector<std::pair<std::string, T> >& items) {
+    clear();
+    std::vector<butil::StringPiece> names(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        names[i] = items[i].first;
+    }
+    std::sort(names.begin(), names.end());
+    if (std::adjacent_find(names.begin(), names.end()) != names.end()) {
+        return -1;
+    }
+    std::vector<Hash> hashes(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        hash(items[i].first, &hashes[i]);
+    }
+    // About 4 names per bucket and a load factor below 0.8, a displacement
+    // is found after a few tries for most buckets.
+    size_t nbucket = 1;
+    while (nbucket * 4 < items.size()) {
+        nbucket *= 2;
+    }
+    size_t nslot = 1;
+    while (nslot * 4 < items.size() * 5) {
+        nslot *= 2;
+    }
+    // Group names by bucket and place larger buckets first when there're
+    // more free slots.
+    std::vector<std::vector<size_t> > buckets(nbucket);
+    for (size_t i = 0; i < items.size(); ++i) {
+        buckets[hashes[i].bucket & (nbucket - 1)].push_back(i);
+    }
+    std::vector<size_t> order(nbucket);
+    for (size_t i = 0; i < nbucket; ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    std::vector<bool> taken;
+    std::vector<uint32_t> indexes;
+    // Retry with more slots if the displacements are exhausted, which is
+    // unlikely.
+    for (int ntry = 0; ntry < 4; ++ntry, nslot *= 2) {
+        _mask = nslot - 1;
+        _bucket_mask = nbucket - 1;
+        _displacements.assign(nbucket, Displacement());
+        taken.assign(nslot, false);
+        bool failed = false;
+        for (size_t i = 0; i < nbucket && !failed; ++i) {
+            const std::vector<size_t>& b = buckets[order[i]];
+            if (b.empty()) {
+                break;
+            }
+            const uint64_t max_tries = std::min<uint64_t>(
+                (uint64_t)nslot * nslot, 1000000);
+            uint64_t k = 0;
+            for (; k < max_tries; ++k) {
+                const Displacement d = { (uint32_t)(k / nslot),
+                                         (uint32_t)(k % nslot) };
+                indexes.clear();
+                size_t j = 0;
+                for (; j < b.size(); ++j) {
+                    const uint32_t idx = index(hashes[b[j]], d);
+                    if (taken[idx] ||
+                        std::find(indexes.begin(), indexes.end(), idx) !=
+                        indexes.end()) {
+                        break;
+                    }
+                    indexes.push_back(idx);
+                }
+                if (j == b.size()) {
+                    for (j = 0; j < indexes.size(); ++j) {
+                        taken[indexes[j]] = true;
+                    }
+                    _displacements[order[i]] = d;
+                    break;
+                }
+            }
+            failed = (k == max_tries);
+        }
+        if (failed) {
+            continue;
+        }
+        _slots.resize(nslot);
+        for (size_t i = 0; i < items.size(); ++i) {
+            const Hash& h = hashes[i];
+            Slot& s = _slots[index(h, _displacements[h.bucket & _bucket_mask])];
+            s.used = true;
+            s.hash = h.slot;
+            s.name = items[i].first;
+            s.value = items[i].second;
+        }
+        return 0;
+    }
+    clear();
+    return -1;
+}
+
+} // namespace brpc
+
+
+#endif  // BRPC_DETAILS_FROZEN_NAME_MAP_H
@@ -16,7 +16,12 @@
 // under the License.
 
 
+#include <map>
+#include <gflags/gflags.h>
+#include "butil/fast_rand.h"
+#include "butil/synchronization/lock.h"
 #include "brpc/details/health_check.h"
+#include "brpc/reloadable_flags.h"
 #include "brpc/socket.h"
 #include "brpc/channel.h"
 #include "brpc/controller.h"
@@ -31,6 +36,89 @@ namespace brpc {
 // Declared at socket.cpp
 extern SocketVarsCollector* g_vars;
 
+DEFINE_double(health_check_jitter_ratio, 0.1, "Intervals between health "
+              "checks are randomized within [1-ratio, 1+ratio] times of the "
+              "interval, so that sockets failed together do not check at the "
+              "same time");
+BRPC_VALIDATE_GFLAG(health_check_jitter_ratio, PassValidate);
+
+DEFINE_int32(health_check_max_interval_s, 0, "If this flag is larger than "
+             "the interval of health checking, the interval doubles after "
+             "each failed check until reaching this value");
+BRPC_VALIDATE_GFLAG(health_check_max_interval_s, PassValidate);
+
+DEFINE_int32(health_check_max_concurrency, 0, "Max number of health checks "
+             "running at the same time in the process, checks beyond the "
+             "limit are postponed. Non-positive means unlimited");
+BRPC_VALIDATE_GFLAG(health_check_max_concurrency, PassValidate);
+
+DEFINE_bool(health_check_share_probes, false, "Sockets (of different "
+            "channels) to one endpoint skip checking if another socket "
+            "failed to check the endpoint within the interval");
+BRPC_VALIDATE_GFLAG(health_check_share_probes, PassValidate);
+
+static butil::atomic<int> g_running_health_checks(0);
+
+// The socket which failed to check an endpoint last time and when (in
+// cpuwide_time_us), to let sockets to one endpoint share results of checks.
+struct ProbeRecord {
+    SocketId failed_id;
+    int64_t failed_time_us;
+};
+static pthread_once_t g_probe_board_once = PTHREAD_ONCE_INIT;
+static butil::Mutex* g_probe_board_mutex = NULL;
+static std::map<butil::EndPoint, ProbeRecord>* g_probe_board = NULL;
+
+static void InitProbeBoard() {
+    g_probe_board_mutex = new butil::Mutex;
+    g_probe_board = new std::map<butil::EndPoint, ProbeRecord>;
+}
+
+bool OtherSocketFailedToProbe(const butil::EndPoint& pt, SocketId id,
+                              int64_t within_us) {
+    pthread_once(&g_probe_board_once, InitProbeBoard);
+    BAIDU_SCOPED_LOCK(*g_probe_board_mutex);
+    std::map<butil::EndPoint, ProbeRecord>::const_iterator it =
+        g_probe_board->find(pt);
+    // The socket must not skip because of its own failure, otherwise it
+    // would check only once every two intervals.
+    return it != g_probe_board->end() && it->second.failed_id != id &&
+        butil::cpuwide_time_us() < it->second.failed_time_us + within_us;
+}
+
+void UpdateProbeBoard(const butil::EndPoint& pt, SocketId id, bool succeeded) {
+    pthread_once(&g_probe_board_once, InitProbeBoard);
+    BAIDU_SCOPED_LOCK(*g_probe_board_mutex);
+    if (succeeded) {
+        g_probe_board->erase(pt);
+    } else {
+        ProbeRecord& r = (*g_probe_board)[pt];
+        r.failed_id = id;
+        r.failed_time_us = butil::cpuwide_time_us();
+    }
+}
+
+int64_t HealthCheckJitterDelay(int64_t delay_us) {
+    const double ratio = std::min(FLAGS_health_check_jitter_ratio, 1.0);
+    const int64_t range = (int64_t)(delay_us * ratio);
+    if (range <= 0) {
+        return delay_us;
+    }
+    return delay_us - range + (int64_t)butil::fast_rand_less_than(2 * range + 1);
+}
+
+int64_t NextHealthCheckDelayUs(int interval_s, int hc_count) {
+    int64_t delay_s = interval_s;
+    if (FLAGS_health_check_max_interval_s > interval_s) {
+        for (int i = 1; i < hc_count &&
+                 delay_s < FLAGS_health_check_max_interval_s; ++i) {
+            delay_s *= 2;
+        }
+        delay_s = std::min(delay_s, (int64_t)FLAGS_health_check_max_interval_s);
+    }
+    return HealthCheckJitterDelay(delay_s * 1000000L);
+}
+
 class HealthCheckChannel : public brpc::Channel {
 public:
     HealthCheckChannel() {}
@@ -187,6 +275,26 @@ bool HealthCheckTask::OnTriggeringTask(timespec* next_abstime) {
         }
     }
 
+    const int64_t interval_us = ptr->_health_check_interval_s * 1000000L;
+    const bool share_probe = FLAGS_health_check_share_probes && !ptr->_user;
+    if (share_probe &&
+        OtherSocketFailedToProbe(ptr->remote_side(), _id, interval_us)) {
+        // Another socket to the same endpoint just failed to check it.
+        *next_abstime = butil::microseconds_from_now(
+            HealthCheckJitterDelay(interval_us));
+        return true;
+    }
+    const int max_concurrency = FLAGS_health_check_max_concurrency;
+    if (max_concurrency > 0 &&
+        g_running_health_checks.fetch_add(1, butil::memory_order_relaxed)
+        >= max_concurrency) {
+        g_running_health_checks.fetch_sub(1, butil::memory_order_relaxed);
+        // Retry soon, spread out to avoid checking together again.
+        *next_abstime = butil::microseconds_from_now(
+            std::min(interval_us, butil::fast_rand_in((int64_t)50000, (int64_t)150000)));
+        return true;
+    }
+
     // g_vars must not be NULL because it is newed at the creation of
     // first Socket. When g_vars is used, the socket is at health-checking
     // state, which means the socket must be created and then g_vars can
@@ -198,6 +306,12 @@ bool HealthCheckTask::OnTriggeringTask(timespec* next_abstime) {
     } else {
         hc = ptr->CheckHealth();
     }
+    if (max_concurrency > 0) {
+        g_running_health_checks.fetch_sub(1, butil::memory_order_relaxed);
+    }
+    if (share_probe && hc != ESTOP) {
+        UpdateProbeBoard(ptr->remote_side(), _id, hc == 0);
+    }
     if (hc == 0) {
         if (!ptr->health_check_path().empty()) {
             ptr->_ninflight_app_health_check.fetch_add(
@@ -219,7 +333,8 @@ bool HealthCheckTask::OnTriggeringTask(timespec* next_abstime) {
                  << ": " << berror();
     }
     ++ ptr->_hc_count;
-    *next_abstime = butil::seconds_from_now(ptr->_health_check_interval_s);
+    *next_abstime = butil::microseconds_from_now(
+        NextHealthCheckDelayUs(ptr->_health_check_interval_s, ptr->_hc_count));
     return true;
 }
 
@@ -229,7 +344,7 @@ void HealthCheckTask::OnDestroyingTask() {
 
 void StartHealthCheck(SocketId id, int64_t delay_ms) {
     PeriodicTaskManager::StartTaskAt(new HealthCheckTask(id),
-            butil::milliseconds_from_now(delay_ms));
+            butil::microseconds_from_now(HealthCheckJitterDelay(delay_ms * 1000L)));
 }
 
 } // namespace brpc
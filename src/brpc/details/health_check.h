@@ -31,6 +31,24 @@ namespace brpc {
 // immediately.
 void StartHealthCheck(SocketId id, int64_t delay_ms);
 
+// Following functions are exposed for testing.
+
+// Randomize `delay_us' within [1-r, 1+r] times of it, where r is
+// -health_check_jitter_ratio.
+int64_t HealthCheckJitterDelay(int64_t delay_us);
+
+// Jittered delay before next check after `hc_count' consecutive failures,
+// doubling from `interval_s' up to -health_check_max_interval_s.
+int64_t NextHealthCheckDelayUs(int interval_s, int hc_count);
+
+// Returns true if a socket other than `id' failed to check `pt' within
+// `within_us'.
+bool OtherSocketFailedToProbe(const butil::EndPoint& pt, SocketId id,
+                              int64_t within_us);
+
+// Record result of checking `pt' by socket `id'.
+void UpdateProbeBoard(const butil::EndPoint& pt, SocketId id, bool succeeded);
+
 } // namespace brpc
 
 #endif
@@ -349,43 +349,36 @@ public:
     HuffmanEncoder(butil::IOBufAppender* out, const HuffmanCode* table)
         : _out(out)
         , _table(table)
-        , _partial_byte(0)
-        , _remain_bit(8)
+        , _bits(0)
+        , _nbits(0)
         , _out_bytes(0)
     {}
 
     void Encode(unsigned char byte) {
         const HuffmanCode code = _table[byte];
-        uint16_t bits_left = code.bit_len;
-        while (bits_left) {
-            const uint16_t adding_bits_len = std::min(_remain_bit, bits_left);
-            const uint8_t adding_bits = static_cast<uint8_t>(
-                    (code.code & ((1u << bits_left) - 1))   // clear leading bits
-                            >> (bits_left - adding_bits_len));  // align to LSB
-            _partial_byte |= adding_bits << (_remain_bit - adding_bits_len);
-            _remain_bit -= adding_bits_len;
-            bits_left -= adding_bits_len;
-            if (!_remain_bit) {
-                ++_out_bytes;
-                _out->push_back(_partial_byte);
-                _remain_bit = 8;
-                _partial_byte = 0;
-            }
+        // Codes are at most 30 bits and less than 8 bits are pending, the
+        // low bits of _bits never overflow. High bits already written are
+        // shifted out.
+        _bits = (_bits << code.bit_len) | code.code;
+        _nbits += code.bit_len;
+        while (_nbits >= 8) {
+            _nbits -= 8;
+            _out->push_back(static_cast<uint8_t>(_bits >> _nbits));
+            ++_out_bytes;
         }
     }
 
     void EndStream() {
-        if (_remain_bit == 8u) {
+        if (_nbits == 0) {
             return;
         }
-        DCHECK_LT(_remain_bit, 8u);
+        DCHECK_LT(_nbits, 8u);
         // Add padding `1's to lsb to make _out aligned
-        _partial_byte |= (1 << _remain_bit) - 1;
-        // TODO: push_back is probably costly since it acquires tls everytime it
-        // is invoked.
-        _out->push_back(_partial_byte);
-        _partial_byte = 0;
-        _remain_bit = 0;
+        const uint32_t padding = 8 - _nbits;
+        _out->push_back(static_cast<uint8_t>(
+                (_bits << padding) | ((1u << padding) - 1)));
+        _bits = 0;
+        _nbits = 0;
         _out = NULL;
         ++_out_bytes;
     }
@@ -395,82 +388,155 @@ public:
 private:
     butil::IOBufAppender* _out;
     const HuffmanCode* _table;
-    uint8_t  _partial_byte;
-    uint16_t _remain_bit;
+    uint64_t _bits;
+    uint32_t _nbits;
     uint32_t _out_bytes;
 };
 
+// Decode 4 bits at a time with a state machine (like nghttp2) instead of
+// walking HuffmanTree bit by bit. States are internal nodes of the tree,
+// the shortest code is 5 bits, so at most one symbol is decoded in a step.
+class BAIDU_CACHELINE_ALIGNMENT HuffmanDecodeTable {
+DISALLOW_COPY_AND_ASSIGN(HuffmanDecodeTable);
+public:
+    enum Flag {
+        // `symbol' is decoded in this step.
+        SYMBOL = 1,
+        // Stream is allowed to end at `state', which is the root or reached
+        // from the root with at most 7 `1's (padding, a prefix of EOS).
+        ACCEPTED = 2,
+        // EOS or an invalid code is met.
+        FAIL = 4,
+    };
+    struct Transition {
+        uint8_t state;
+        uint8_t flags;
+        uint8_t symbol;
+    };
+    // A Huffman code for 257 symbols has 256 internal nodes.
+    static const size_t NUM_STATES = 256;
+
+    HuffmanDecodeTable() {}
+
+    void Init(const HuffmanTree& tree);
+
+    const Transition& at(uint8_t state, uint8_t nibble) const {
+        return _transitions[state][nibble];
+    }
+
+private:
+    Transition _transitions[NUM_STATES][16];
+};
+
+void HuffmanDecodeTable::Init(const HuffmanTree& tree) {
+    // Number internal nodes as states, root is state 0.
+    std::vector<int> state_of;
+    std::vector<HuffmanTree::NodeId> node_of;
+    for (HuffmanTree::NodeId id = HuffmanTree::ROOT_NODE; tree.node(id); ++id) {
+        state_of.resize(id + 1, -1);
+        if (tree.node(id)->value == HuffmanTree::INVALID_VALUE) {
+            state_of[id] = node_of.size();
+            node_of.push_back(id);
+        }
+    }
+    CHECK_EQ((size_t)NUM_STATES, node_of.size());
+    std::vector<bool> accepted(NUM_STATES, false);
+    HuffmanTree::NodeId id = HuffmanTree::ROOT_NODE;
+    for (int depth = 0; depth <= 7; ++depth) {
+        accepted[state_of[id]] = true;
+        id = tree.node(id)->right_child;
+    }
+    for (size_t state = 0; state < NUM_STATES; ++state) {
+        for (int nibble = 0; nibble < 16; ++nibble) {
+            Transition& t = _transitions[state][nibble];
+            t.flags = 0;
+            t.symbol = 0;
+            HuffmanTree::NodeId cur = node_of[state];
+            for (int i = 3; i >= 0; --i) {
+                const HuffmanNode* n = tree.node(cur);
+                cur = (nibble & (1 << i)) ? n->right_child : n->left_child;
+                n = tree.node(cur);
+                if (n == NULL || n->value == HPACK_HUFFMAN_EOS) {
+                    t.flags = FAIL;
+                    break;
+                }
+                if (n->value != HuffmanTree::INVALID_VALUE) {
+                    DCHECK(!(t.flags & SYMBOL));
+                    t.flags |= SYMBOL;
+                    t.symbol = static_cast<uint8_t>(n->value);
+                    cur = HuffmanTree::ROOT_NODE;
+                }
+            }
+            if (t.flags & FAIL) {
+                t.state = 0;
+                continue;
+            }
+            t.state = state_of[cur];
+            if (accepted[t.state]) {
+                t.flags |= ACCEPTED;
+            }
+        }
+    }
+}
+
 class HuffmanDecoder {
 DISALLOW_COPY_AND_ASSIGN(HuffmanDecoder);
 public:
-    HuffmanDecoder(std::string* out, const HuffmanTree* tree)
-        // FIXME: resizing of out is costly
+    // `out' must be large enough to hold the decoded string, at most 8/5
+    // of the input.
+    HuffmanDecoder(char* out, const HuffmanDecodeTable* table)
         : _out(out)
-        , _tree(tree)
-        , _cur_node(tree->node(HuffmanTree::ROOT_NODE))
-        , _cur_depth(0)  // Depth of root node is 0
-        , _padding(true)
+        , _table(table)
+        , _state(0)
+        , _accepted(true)
     {}
-    int Decode(uint8_t byte) {
-        for (int i = 7; i >= 0; --i) {
-            if (byte & (1u << i)) {
-                _cur_node = _tree->node(_cur_node->right_child);
-                if (BAIDU_UNLIKELY(!_cur_node)) {
-                    LOG(ERROR) << "Decoder stream reaches NULL_NODE";
-                    return -1;
-                }
-                if (_cur_node->value != HuffmanTree::INVALID_VALUE) {
-                    if (BAIDU_UNLIKELY(_cur_node->value == HPACK_HUFFMAN_EOS)) {
-                        LOG(ERROR) << "Decoder stream reaches EOS";
-                        return -1;
-                    }
-                    _out->push_back(static_cast<uint8_t>(_cur_node->value));
-                    _cur_node = _tree->node(HuffmanTree::ROOT_NODE);
-                    _cur_depth = 0;
-                    _padding = true;
-                    continue;
-                }
-                _padding &= 1;
-            } else {
-                _cur_node = _tree->node(_cur_node->left_child);
-                if (BAIDU_UNLIKELY(!_cur_node)) {
-                    LOG(ERROR) << "Decoder stream reaches NULL_NODE";
-                    return -1;
-                }
-                if (_cur_node->value != HuffmanTree::INVALID_VALUE) {
-                    if (BAIDU_UNLIKELY(_cur_node->value == HPACK_HUFFMAN_EOS)) {
-                        LOG(ERROR) << "Decoder stream reaches EOS";
-                        return -1;
-                    }
-                    _out->push_back(static_cast<uint8_t>(_cur_node->value));
-                    _cur_node = _tree->node(HuffmanTree::ROOT_NODE);
-                    _cur_depth = 0;
-                    _padding = true;
-                    continue;
-                }
-                _padding &= 0;
+
+    int Decode(const uint8_t* data, size_t size) {
+        // Work on locals, stores to _out may alias members otherwise.
+        char* out = _out;
+        uint8_t state = _state;
+        uint8_t flags = _accepted ? HuffmanDecodeTable::ACCEPTED : 0;
+        for (size_t i = 0; i < size; ++i) {
+            const HuffmanDecodeTable::Transition& t1 =
+                _table->at(state, data[i] >> 4);
+            const HuffmanDecodeTable::Transition& t2 =
+                _table->at(t1.state, data[i] & 0xF);
+            if (BAIDU_UNLIKELY((t1.flags | t2.flags) & HuffmanDecodeTable::FAIL)) {
+                LOG(ERROR) << "Decoder stream reaches EOS or NULL_NODE";
+                return -1;
+            }
+            if (t1.flags & HuffmanDecodeTable::SYMBOL) {
+                *out++ = t1.symbol;
             }
-            ++_cur_depth;
+            if (t2.flags & HuffmanDecodeTable::SYMBOL) {
+                *out++ = t2.symbol;
+            }
+            state = t2.state;
+            flags = t2.flags;
         }
+        _out = out;
+        _state = state;
+        _accepted = (flags & HuffmanDecodeTable::ACCEPTED);
         return 0;
     }
+
     int EndStream() {
-        if (_cur_depth == 0) {
-            return 0;
-        }
-        if (_cur_depth <= 7 && _padding) {
+        if (_accepted) {
             return 0;
         }
         // Invalid stream, the padding is not corresponding to MSB of EOS
         // https://tools.ietf.org/html/rfc7541#section-5.2
         return -1;
     }
+
+    // End of the decoded string.
+    char* out() const { return _out; }
+
 private:
-    std::string* _out;
-    const HuffmanTree* _tree;
-    const HuffmanNode* _cur_node;
-    uint16_t _cur_depth;
-    bool _padding;
+    char* _out;
+    const HuffmanDecodeTable* _table;
+    uint8_t _state;
+    bool _accepted;
 };
 
 // Primitive Type Representations
@@ -496,15 +562,17 @@ inline void EncodeInteger(butil::IOBufAppender* out, uint8_t msb,
 }
 
 // Static variables
-static HuffmanTree* s_huffman_tree = NULL;
+static HuffmanDecodeTable* s_huffman_decode_table = NULL;
 static IndexTable* s_static_table = NULL;
 static pthread_once_t s_create_once = PTHREAD_ONCE_INIT;
 
 static void CreateStaticTableOrDie() {
-    s_huffman_tree = new HuffmanTree;
+    HuffmanTree huffman_tree;
     for (size_t i = 0; i < ARRAY_SIZE(s_huffman_table); ++i) {
-        s_huffman_tree->AddLeafNode(i, s_huffman_table[i]);
+        huffman_tree.AddLeafNode(i, s_huffman_table[i]);
     }
+    s_huffman_decode_table = new HuffmanDecodeTable;
+    s_huffman_decode_table->Init(huffman_tree);
     IndexTableOptions options;
     options.max_size = UINT_MAX;
     options.static_table = s_static_headers;
@@ -622,15 +690,27 @@ inline ssize_t DecodeString(butil::IOBufBytesIterator& iter, std::string* out) {
         iter.copy_and_forward(out, length);
         return in_bytes;
     }
-    HuffmanDecoder d(out, s_huffman_tree);
-    for (; iter != NULL && length; ++iter, --length) {
-        if (d.Decode(*iter) != 0) {
+    // Every symbol takes at least 5 bits.
+    out->resize(length * 8 / 5);
+    char* const begin = &(*out)[0];
+    HuffmanDecoder d(begin, s_huffman_decode_table);
+    // Copying in batches is cheaper than dereferencing the iterator.
+    uint8_t batch[256];
+    while (length) {
+        const size_t n = iter.copy_and_forward(
+            batch, std::min(length, (uint32_t)sizeof(batch)));
+        if (n == 0) {
+            break;
+        }
+        if (d.Decode(batch, n) != 0) {
             return -1;
         }
+        length -= n;
     }
     if (d.EndStream() != 0) {
         return -1;
     }
+    out->resize(d.out() - begin);
     return in_bytes;
 }
 
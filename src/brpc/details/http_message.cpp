@@ -17,12 +17,15 @@
 
 #include <string>                               // std::string
 #include <iostream>
+#include <time.h>                               // gmtime_r, strftime
 #include <gflags/gflags.h>
 #include "butil/macros.h"
 #include "butil/logging.h"                       // LOG
 #include "butil/scoped_lock.h"
 #include "butil/endpoint.h"
 #include "butil/base64.h"
+#include "butil/thread_local.h"
+#include "butil/time.h"
 #include "bthread/bthread.h"                    // bthread_usleep
 #include "brpc/log.h"
 #include "brpc/reloadable_flags.h"
@@ -38,6 +41,9 @@ DEFINE_bool(http_verbose, false,
             "[DEBUG] Print EVERY http request/response");
 DEFINE_int32(http_verbose_max_body_length, 512,
              "[DEBUG] Max body length printed when -http_verbose is on");
+DEFINE_bool(http_response_date, false,
+            "Add the Date header to http responses without one");
+BRPC_VALIDATE_GFLAG(http_response_date, PassValidate);
 DECLARE_int64(socket_max_unwritten_bytes);
 
 // Implement callbacks for http parser
@@ -675,6 +681,26 @@ void MakeRawHttpRequest(butil::IOBuf* request,
 //                CRLF
 //                [ message-body ]          ; Section 7.2
 // Status-Line = HTTP-Version SP Status-Code SP Reason-Phrase CRLF
+struct HttpDateCache {
+    int64_t second;
+    size_t length;
+    char value[32];
+};
+static BAIDU_THREAD_LOCAL HttpDateCache tls_http_date = { -1, 0, {} };
+
+butil::StringPiece CachedHttpDate() {
+    HttpDateCache& c = tls_http_date;
+    const time_t now = butil::gettimeofday_s();
+    if (now != c.second) {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        c.length = strftime(c.value, sizeof(c.value),
+                            "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        c.second = now;
+    }
+    return butil::StringPiece(c.value, c.length);
+}
+
 void MakeRawHttpResponse(butil::IOBuf* response,
                          HttpHeader* h,
                          butil::IOBuf* content) {
@@ -724,7 +750,9 @@ void MakeRawHttpResponse(butil::IOBuf* response,
             }
         }
     }
-    if (!is_invalid_content && !h->content_type().empty()) {
+    const HttpHeaderSet* header_set = h->header_set().get();
+    if (!is_invalid_content && !h->content_type().empty() &&
+        !(header_set && header_set->has_content_type())) {
         os << "Content-Type: " << h->content_type()
            << BRPC_CRLF;
     }
@@ -732,8 +760,18 @@ void MakeRawHttpResponse(butil::IOBuf* response,
          it != h->HeaderEnd(); ++it) {
         os << it->first << ": " << it->second << BRPC_CRLF;
     }
-    os << BRPC_CRLF;  // CRLF before content
-    os.move_to(*response);
+    if (FLAGS_http_response_date && h->GetHeader("Date") == NULL) {
+        os << "Date: " << CachedHttpDate() << BRPC_CRLF;
+    }
+    if (header_set) {
+        os.move_to(*response);
+        // Shares blocks of the pre-encoded headers.
+        response->append(header_set->encoded());
+        response->append(BRPC_CRLF);
+    } else {
+        os << BRPC_CRLF;  // CRLF before content
+        os.move_to(*response);
+    }
 
     // https://datatracker.ietf.org/doc/html/rfc7231#section-4.3.2
     // The HEAD method is identical to GET except that the server MUST NOT
@@ -144,6 +144,11 @@ void MakeRawHttpRequest(butil::IOBuf* request,
                         const butil::EndPoint& remote_side,
                         const butil::IOBuf* content);
 
+// Value of the Date header at the current second, e.g.
+// "Sun, 06 Nov 1994 08:49:37 GMT", formatted at most once per second in
+// each thread.
+butil::StringPiece CachedHttpDate();
+
 // Serialize a http response.
 // header: may be modified in some cases
 // content: cleared after usage. could be NULL. 
@@ -28,6 +28,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #ifndef ULLONG_MAX
 # define ULLONG_MAX ((uint64_t) -1) /* 2^64-1 */
@@ -523,6 +526,69 @@ do {                                                                 \
 # define NEW_MESSAGE() start_state
 #endif
 
+/* Fast paths skipping runs of ordinary bytes in one call instead of going
+ * through the state machine byte by byte. They stop at the first byte which
+ * needs attention of the state machine, e.g. CR, LF, ':', or an invalid byte.
+ * Return `end' if all bytes are skipped.
+ */
+
+/* Skip bytes of a header value: not CR, LF or other invalid bytes. */
+static const char* skip_header_value(const char* p, const char* end)
+{
+#if defined(__SSE2__)
+  /* 16 bytes a time, picohttpparser-style */
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i del = _mm_set1_epi8(127);
+  const __m128i max_ctl = _mm_set1_epi8(31);
+  for (; end - p >= 16; p += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)p);
+    /* v <= 31 as unsigned, except tab */
+    __m128i stop = _mm_cmpeq_epi8(_mm_min_epu8(v, max_ctl), v);
+    stop = _mm_andnot_si128(_mm_cmpeq_epi8(v, tab), stop);
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, del));
+    const int mask = _mm_movemask_epi8(stop);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; p != end; ++p) {
+    const unsigned char ch = *p;
+    if ((ch <= 31 && ch != '\t') || ch == 127) {
+      return p;
+    }
+  }
+  return end;
+}
+
+/* Skip bytes of a header field name: tokens except ':'. */
+static const char* skip_header_field(const char* p, const char* end)
+{
+  for (; p != end && TOKEN(*p); ++p) {}
+  return p;
+}
+
+/* Skip bytes staying in s_req_path or s_req_query_string. */
+static const char* skip_url(const char* p, const char* end)
+{
+  for (; p != end && IS_URL_CHAR(*p); ++p) {}
+  return p;
+}
+
+/* Consume bytes after `p' skipped by SKIP as part of headers. `p' is moved
+ * to the last skipped byte, which is advanced by the loop.
+ */
+#define FAST_FORWARD(SKIP)                                           \
+do {                                                                 \
+  const char* skip_end = SKIP(p + 1, data + len);                    \
+  parser->nread += (uint32_t)(skip_end - (p + 1));                   \
+  if (parser->nread > (BRPC_HTTP_MAX_HEADER_SIZE)) {                 \
+    SET_ERRNO(HPE_HEADER_OVERFLOW);                                  \
+    goto error;                                                      \
+  }                                                                  \
+  p = skip_end - 1;                                                  \
+} while (0)
+
 
 /* Map errno values to strings for human-readable output */
 #define HTTP_STRERROR_GEN(n, s) { "HPE_" #n, s },
@@ -1229,6 +1295,9 @@ size_t http_parser_execute (http_parser *parser,
               goto error;
             }
             parser->state = new_state;
+            if (new_state == s_req_path || new_state == s_req_query_string) {
+              FAST_FORWARD(skip_url);
+            }
         }
         break;
       }
@@ -1412,6 +1481,7 @@ size_t http_parser_execute (http_parser *parser,
         if (c) {
           switch (parser->header_state) {
             case h_general:
+              FAST_FORWARD(skip_header_field);
               break;
 
             case h_C:
@@ -1625,6 +1695,7 @@ size_t http_parser_execute (http_parser *parser,
 
         switch (parser->header_state) {
           case h_general:
+            FAST_FORWARD(skip_header_value);
             break;
 
           case h_connection:
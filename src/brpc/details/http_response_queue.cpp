@@ -0,0 +1,109 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <errno.h>
+#include <utility>
+#include <vector>
+#include "brpc/details/http_response_queue.h"
+
+namespace brpc {
+
+HttpResponseQueue::HttpResponseQueue()
+    : _nrequest(0)
+    , _head(1)
+    , _flushing(false) {}
+
+int HttpResponseQueue::Write(Socket* sock, uint64_t seq, butil::IOBuf* data,
+                             const Socket::WriteOptions* options,
+                             bool finished) {
+    std::unique_lock<butil::Mutex> mu(_mutex);
+    uint64_t head = _head.load(butil::memory_order_relaxed);
+    if (seq < head) {
+        // The response was finished (e.g. failed) before.
+        data->clear();
+        return 0;
+    }
+    HeldResponse& r = _held[seq];
+    r.data.append(butil::IOBuf::Movable(*data));
+    if (options != NULL && r.options.id_wait == INVALID_BTHREAD_ID) {
+        r.options = *options;
+    }
+    r.finished = r.finished || finished;
+    if (_flushing || seq != head) {
+        // Written by the thread flushing or the one finishing earlier
+        // responses. Held data can't be given back on EOVERCROWDED.
+        r.options.ignore_eovercrowded = true;
+        return 0;
+    }
+    // Write outside the lock: a failed write may run callbacks writing
+    // into the queue again, and only one thread flushes at any time to
+    // keep the order.
+    _flushing = true;
+    int rc = 0;
+    int error = 0;
+    std::vector<std::pair<uint64_t, HeldResponse> > ready;
+    while (true) {
+        std::map<uint64_t, HeldResponse>::iterator it;
+        while ((it = _held.find(head)) != _held.end()) {
+            const bool done = it->second.finished;
+            ready.push_back(std::make_pair(head, HeldResponse()));
+            ready.back().second.data.swap(it->second.data);
+            ready.back().second.options = it->second.options;
+            _held.erase(it);
+            if (!done) {
+                break;
+            }
+            _head.store(++head, butil::memory_order_relaxed);
+        }
+        if (ready.empty()) {
+            _flushing = false;
+            break;
+        }
+        mu.unlock();
+        for (size_t i = 0; i < ready.size(); ++i) {
+            HeldResponse& r = ready[i].second;
+            if (!r.data.empty() && sock->Write(&r.data, &r.options) != 0 &&
+                ready[i].first == seq) {
+                // Only failures of the caller's response are reported.
+                rc = -1;
+                error = errno;
+            }
+        }
+        ready.clear();
+        mu.lock();
+    }
+    mu.unlock();
+    if (rc != 0) {
+        errno = error;
+    }
+    return rc;
+}
+
+int WriteHttpResponse(Socket* sock, uint64_t seq, butil::IOBuf* data,
+                      const Socket::WriteOptions* options, bool finished) {
+    HttpResponseQueue* q = sock->http_response_queue();
+    if (seq == 0 || q == NULL) {
+        if (data->empty()) {
+            return 0;
+        }
+        return sock->Write(data, options);
+    }
+    return q->Write(sock, seq, data, options, finished);
+}
+
+} // namespace brpc
@@ -0,0 +1,89 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_HTTP_RESPONSE_QUEUE_H
+#define BRPC_DETAILS_HTTP_RESPONSE_QUEUE_H
+
+#include <map>
+#include "butil/atomicops.h"
+#include "butil/iobuf.h"
+#include "butil/synchronization/lock.h"
+#include "brpc/socket.h"
+
+namespace brpc {
+
+// Pipelined HTTP/1.x requests on a server-side connection are processed
+// concurrently, while their responses must be sent in the order of the
+// requests. Requests are numbered from 1 by the parsing thread, data of a
+// response written before all earlier responses are finished is held
+// until its turn.
+class HttpResponseQueue {
+public:
+    HttpResponseQueue();
+
+    // [Called by the parsing thread only]
+    // Returns the sequence number of the next request.
+    uint64_t AddRequest() {
+        const uint64_t seq = _nrequest.load(butil::memory_order_relaxed) + 1;
+        _nrequest.store(seq, butil::memory_order_relaxed);
+        return seq;
+    }
+
+    // Number of requests before request `seq' whose responses are not
+    // finished yet.
+    uint64_t npending_before(uint64_t seq) const {
+        const uint64_t head = _head.load(butil::memory_order_relaxed);
+        return seq > head ? seq - head : 0;
+    }
+
+    // Write `data' as the response of request `seq' or a part of it,
+    // `finished' is true if nothing of the response follows. Every
+    // request must be finished once, otherwise later responses are held
+    // forever. Data written after the response was finished is dropped.
+    // Returns what Socket::Write() returns, held data counts as written.
+    int Write(Socket* sock, uint64_t seq, butil::IOBuf* data,
+              const Socket::WriteOptions* options, bool finished);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(HttpResponseQueue);
+
+    struct HeldResponse {
+        HeldResponse() : finished(false) {}
+        butil::IOBuf data;
+        Socket::WriteOptions options;
+        bool finished;
+    };
+
+    butil::atomic<uint64_t> _nrequest;
+    // Sequence number of the response being sent.
+    butil::atomic<uint64_t> _head;
+    butil::Mutex _mutex;
+    // True if a thread is writing held data, which writes data of others
+    // in order as well.
+    bool _flushing;
+    std::map<uint64_t, HeldResponse> _held;
+};
+
+// Write into `sock' directly if `seq' is 0 (the request is not numbered).
+int WriteHttpResponse(Socket* sock, uint64_t seq, butil::IOBuf* data,
+                      const Socket::WriteOptions* options, bool finished);
+
+} // namespace brpc
+
+
+#endif  // BRPC_DETAILS_HTTP_RESPONSE_QUEUE_H
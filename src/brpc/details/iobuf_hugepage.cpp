@@ -0,0 +1,578 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <pthread.h>
+#include <sched.h>                               // sched_getcpu
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>                         // SYS_mbind
+#include <unistd.h>
+#include <vector>
+#include <gflags/gflags.h>
+#include "butil/iobuf.h"                         // blockmem_allocate
+#include "butil/logging.h"
+#include "butil/scoped_lock.h"
+#include "butil/thread_local.h"                  // thread_atexit
+#include "bvar/bvar.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/iobuf_hugepage.h"
+
+
+namespace brpc {
+
+DEFINE_bool(iobuf_hugepage, false, "Allocate IOBuf blocks of default size "
+            "out of arenas backed by hugepages");
+DEFINE_int32(iobuf_hugepage_arena_size_mb, 2, "Size of each hugepage arena "
+             "in MB, must be a power of 2 and >= 2. 1GB hugepages are used "
+             "when this value is 1024, 2MB hugepages otherwise");
+DEFINE_int32(iobuf_hugepage_max_gb, 64, "Max memory of hugepage arenas in "
+             "GB, so much virtual address space is reserved");
+DEFINE_int32(iobuf_hugepage_idle_arenas, 4, "Keep at most so many hugepage "
+             "arenas without used blocks in each NUMA node, others are returned "
+             "to the kernel");
+BRPC_VALIDATE_GFLAG(iobuf_hugepage_idle_arenas, NonNegativeInteger);
+DEFINE_bool(iobuf_hugepage_numa, false, "Bind hugepage arenas to NUMA nodes "
+            "and allocate blocks from the node of current cpu");
+
+#if defined(OS_LINUX)
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+static const size_t BLOCK_SIZE = butil::IOBuf::DEFAULT_BLOCK_SIZE;
+// Max blocks cached in TLS before returning half of them to arenas.
+static const int MAX_TLS_BLOCKS = 64;
+static const int TLS_BATCH_BLOCKS = MAX_TLS_BLOCKS / 2;
+static const int MAX_NUMA_NODES = 64;
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+struct Arena {
+    char* base;
+    // Blocks returned to this arena.
+    FreeBlock* free_list;
+    // Blocks never allocated start from base + ncarved * BLOCK_SIZE.
+    uint32_t ncarved;
+    // Blocks allocated, including ones cached in TLS.
+    uint32_t nused;
+    // Position in NodeArenas.partial, -1 if the arena is full or unmapped.
+    int partial_pos;
+    bool mapped;
+    bool hugetlb;
+};
+
+// [g_begin, g_end) is the reserved address range of arenas.
+static char* g_begin = NULL;
+static char* g_end = NULL;
+static size_t g_arena_size = 0;
+static int g_huge_flag = 0;
+static uint32_t g_blocks_per_arena = 0;
+
+// The reserved range is evenly divided into nodes, arenas of a node are
+// bound to the node when they're mapped.
+static int g_nnodes = 1;
+static uint32_t g_arenas_per_node = 0;
+// Node of each cpu, empty if arenas are not bound to nodes.
+static std::vector<int>* g_cpu_nodes = NULL;
+
+struct NodeArenas {
+    // Mapped arenas with free blocks.
+    std::vector<uint32_t> partial;
+    std::vector<uint32_t> unmapped;
+    // Mapped arenas without used blocks.
+    int nidle;
+};
+
+// Following fields are protected by g_mutex.
+static butil::Mutex* g_mutex = NULL;
+static std::vector<Arena>* g_arenas = NULL;
+static std::vector<NodeArenas>* g_nodes = NULL;
+
+static void* (*g_prev_allocate)(size_t) = NULL;
+static void (*g_prev_deallocate)(void*) = NULL;
+
+static butil::atomic<int64_t> g_nmapped(0);
+static butil::atomic<int64_t> g_nhugetlb(0);
+static butil::atomic<int64_t> g_nused_blocks(0);
+static bvar::Adder<int64_t>* g_nfallback = NULL;
+static bvar::Adder<int64_t>* g_ncross_node = NULL;
+
+struct TLSBlockCache {
+    // Blocks of `node'.
+    FreeBlock* head;
+    int n;
+    // Blocks of other nodes, returned to arenas in batch.
+    FreeBlock* remote_head;
+    int nremote;
+    // Node of the cpu when the cache was refilled last time, -1 if unknown.
+    int node;
+    bool registered;
+};
+static __thread TLSBlockCache tls_cache = { NULL, 0, NULL, 0, -1, false };
+
+static inline uint32_t ArenaIndex(const void* p) {
+    return ((const char*)p - g_begin) / g_arena_size;
+}
+
+static inline int ArenaNode(uint32_t idx) {
+    return idx / g_arenas_per_node;
+}
+
+static inline int CurrentNode() {
+    if (g_cpu_nodes == NULL) {
+        return 0;
+    }
+    const int cpu = sched_getcpu();
+    if (cpu < 0 || (size_t)cpu >= g_cpu_nodes->size()) {
+        return 0;
+    }
+    return (*g_cpu_nodes)[cpu];
+}
+
+// Parse cpulist like "0-3,8-11" of `node' into `cpu_nodes'.
+// Returns 0 on success, -1 otherwise.
+static int ReadNodeCpus(int node, std::vector<int>* cpu_nodes) {
+    char path[64];
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    int first = 0;
+    int last = 0;
+    int rc = 0;
+    while (true) {
+        const int n = fscanf(fp, "%d", &first);
+        if (n != 1) {
+            break;
+        }
+        last = first;
+        int c = fgetc(fp);
+        if (c == '-') {
+            if (fscanf(fp, "%d", &last) != 1) {
+                rc = -1;
+                break;
+            }
+            c = fgetc(fp);
+        }
+        if (first < 0 || last < first || last >= 65536) {
+            rc = -1;
+            break;
+        }
+        if ((size_t)last >= cpu_nodes->size()) {
+            cpu_nodes->resize(last + 1, 0);
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            (*cpu_nodes)[cpu] = node;
+        }
+        if (c != ',') {
+            break;
+        }
+    }
+    fclose(fp);
+    return rc;
+}
+
+// Returns number of NUMA nodes, node of each cpu is put into `cpu_nodes'.
+static int ReadNumaTopology(std::vector<int>* cpu_nodes) {
+    int nnodes = 0;
+    while (nnodes < MAX_NUMA_NODES && ReadNodeCpus(nnodes, cpu_nodes) == 0) {
+        ++nnodes;
+    }
+    return nnodes;
+}
+
+static void AddPartial(uint32_t idx) {
+    Arena& a = (*g_arenas)[idx];
+    std::vector<uint32_t>& partial = (*g_nodes)[ArenaNode(idx)].partial;
+    a.partial_pos = partial.size();
+    partial.push_back(idx);
+}
+
+static void RemovePartial(uint32_t idx) {
+    Arena& a = (*g_arenas)[idx];
+    if (a.partial_pos < 0) {
+        return;
+    }
+    std::vector<uint32_t>& partial = (*g_nodes)[ArenaNode(idx)].partial;
+    const uint32_t last = partial.back();
+    partial[a.partial_pos] = last;
+    (*g_arenas)[last].partial_pos = a.partial_pos;
+    partial.pop_back();
+    a.partial_pos = -1;
+}
+
+static bool MapArena(uint32_t idx) {
+    Arena& a = (*g_arenas)[idx];
+    char* const addr = g_begin + idx * g_arena_size;
+    void* p = mmap(addr, g_arena_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED |
+                   MAP_HUGETLB | g_huge_flag, -1, 0);
+    a.hugetlb = (p != MAP_FAILED);
+    if (p == MAP_FAILED) {
+        // No reserved hugepages, use transparent ones.
+        p = mmap(addr, g_arena_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        if (p == MAP_FAILED) {
+            PLOG(ERROR) << "Fail to map hugepage arena at " << (void*)addr;
+            return false;
+        }
+#ifdef MADV_HUGEPAGE
+        // OK to fail, THP may be disabled.
+        madvise(p, g_arena_size, MADV_HUGEPAGE);
+#endif
+    }
+    if (g_cpu_nodes != NULL) {
+        // Pages are not touched yet. Prefer rather than bind to the node
+        // so that a node running out of memory does not fail the process.
+        const unsigned long nodemask = 1UL << ArenaNode(idx);
+        if (syscall(SYS_mbind, addr, g_arena_size, MPOL_PREFERRED,
+                    &nodemask, MAX_NUMA_NODES + 1, 0) != 0) {
+            PLOG_EVERY_SECOND(WARNING) << "Fail to bind hugepage arena to node "
+                                       << ArenaNode(idx);
+        }
+    }
+    a.base = addr;
+    a.free_list = NULL;
+    a.ncarved = 0;
+    a.nused = 0;
+    a.mapped = true;
+    AddPartial(idx);
+    ++(*g_nodes)[ArenaNode(idx)].nidle;
+    g_nmapped.fetch_add(1, butil::memory_order_relaxed);
+    if (a.hugetlb) {
+        g_nhugetlb.fetch_add(1, butil::memory_order_relaxed);
+    }
+    return true;
+}
+
+static void UnmapArena(uint32_t idx) {
+    Arena& a = (*g_arenas)[idx];
+    // Replace the mapping with a reserved one to release the memory and
+    // keep the address range.
+    if (mmap(a.base, g_arena_size, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE,
+             -1, 0) == MAP_FAILED) {
+        PLOG(ERROR) << "Fail to unmap hugepage arena at " << (void*)a.base;
+        return;
+    }
+    RemovePartial(idx);
+    a.mapped = false;
+    NodeArenas& node = (*g_nodes)[ArenaNode(idx)];
+    --node.nidle;
+    node.unmapped.push_back(idx);
+    g_nmapped.fetch_sub(1, butil::memory_order_relaxed);
+    if (a.hugetlb) {
+        g_nhugetlb.fetch_sub(1, butil::memory_order_relaxed);
+    }
+}
+
+// Allocate at most `n' blocks from arenas of `node_index' and prepend
+// them to `*head'. Returns number of blocks allocated.
+static int AllocateFromNode(int node_index, FreeBlock** head, int n) {
+    NodeArenas& node = (*g_nodes)[node_index];
+    int got = 0;
+    while (got < n) {
+        if (node.partial.empty()) {
+            if (node.unmapped.empty() || !MapArena(node.unmapped.back())) {
+                break;
+            }
+            node.unmapped.pop_back();
+        }
+        const uint32_t idx = node.partial.back();
+        Arena& a = (*g_arenas)[idx];
+        if (a.nused == 0) {
+            --node.nidle;
+        }
+        while (got < n) {
+            FreeBlock* b = a.free_list;
+            if (b != NULL) {
+                a.free_list = b->next;
+            } else if (a.ncarved < g_blocks_per_arena) {
+                b = (FreeBlock*)(a.base + a.ncarved++ * BLOCK_SIZE);
+            } else {
+                break;
+            }
+            b->next = *head;
+            *head = b;
+            ++a.nused;
+            ++got;
+        }
+        if (a.free_list == NULL && a.ncarved == g_blocks_per_arena) {
+            RemovePartial(idx);
+        }
+    }
+    g_nused_blocks.fetch_add(got, butil::memory_order_relaxed);
+    return got;
+}
+
+// Allocate from `node' at first, then from other nodes. The TLS cache may
+// hold blocks of other nodes in the latter case, which is rare and only
+// affects the performance.
+static int AllocateFromArenas(int node, FreeBlock** head, int n) {
+    int got = AllocateFromNode(node, head, n);
+    for (int i = 1; i < g_nnodes && got == 0; ++i) {
+        got = AllocateFromNode((node + i) % g_nnodes, head, n);
+    }
+    return got;
+}
+
+static void ReturnToArenas(FreeBlock* head) {
+    int n = 0;
+    while (head) {
+        FreeBlock* const next = head->next;
+        const uint32_t idx = ArenaIndex(head);
+        Arena& a = (*g_arenas)[idx];
+        head->next = a.free_list;
+        a.free_list = head;
+        --a.nused;
+        ++n;
+        if (a.partial_pos < 0) {
+            AddPartial(idx);
+        }
+        if (a.nused == 0) {
+            NodeArenas& node = (*g_nodes)[ArenaNode(idx)];
+            if (++node.nidle > FLAGS_iobuf_hugepage_idle_arenas) {
+                UnmapArena(idx);
+            }
+        }
+        head = next;
+    }
+    g_nused_blocks.fetch_sub(n, butil::memory_order_relaxed);
+}
+
+static void FlushTLSBlocks() {
+    TLSBlockCache& c = tls_cache;
+    if (c.head || c.remote_head) {
+        BAIDU_SCOPED_LOCK(*g_mutex);
+        ReturnToArenas(c.head);
+        ReturnToArenas(c.remote_head);
+    }
+    c.head = NULL;
+    c.n = 0;
+    c.remote_head = NULL;
+    c.nremote = 0;
+    // Blocks may be released by other thread-exit functions after this
+    // one, register again to return them.
+    c.registered = false;
+}
+
+static inline void RegisterTLSCacheIfNeeded() {
+    if (!tls_cache.registered) {
+        tls_cache.registered = true;
+        butil::thread_atexit(FlushTLSBlocks);
+    }
+}
+
+void* AllocateHugepageBlock(size_t size) {
+    if (size != BLOCK_SIZE) {
+        return g_prev_allocate(size);
+    }
+    TLSBlockCache& c = tls_cache;
+    if (c.head == NULL) {
+        // The thread may be moved to another node since last refilling.
+        c.node = CurrentNode();
+        {
+            BAIDU_SCOPED_LOCK(*g_mutex);
+            c.n += AllocateFromArenas(c.node, &c.head, TLS_BATCH_BLOCKS);
+        }
+        if (c.head == NULL) {
+            *g_nfallback << 1;
+            return g_prev_allocate(size);
+        }
+        RegisterTLSCacheIfNeeded();
+    }
+    FreeBlock* b = c.head;
+    c.head = b->next;
+    --c.n;
+    return b;
+}
+
+void DeallocateHugepageBlock(void* mem) {
+    if ((char*)mem < g_begin || (char*)mem >= g_end) {
+        return g_prev_deallocate(mem);
+    }
+    TLSBlockCache& c = tls_cache;
+    FreeBlock* b = (FreeBlock*)mem;
+    if (g_nnodes > 1) {
+        if (c.node < 0) {
+            c.node = CurrentNode();
+        }
+        if (ArenaNode(ArenaIndex(mem)) != c.node) {
+            // Don't reuse memory of another node in this thread.
+            *g_ncross_node << 1;
+            b->next = c.remote_head;
+            c.remote_head = b;
+            if (++c.nremote >= TLS_BATCH_BLOCKS) {
+                FreeBlock* const returned = c.remote_head;
+                c.remote_head = NULL;
+                c.nremote = 0;
+                BAIDU_SCOPED_LOCK(*g_mutex);
+                ReturnToArenas(returned);
+            }
+            RegisterTLSCacheIfNeeded();
+            return;
+        }
+    }
+    b->next = c.head;
+    c.head = b;
+    if (++c.n > MAX_TLS_BLOCKS) {
+        // Return blocks after the first TLS_BATCH_BLOCKS ones.
+        FreeBlock* last = c.head;
+        for (int i = 1; i < TLS_BATCH_BLOCKS; ++i) {
+            last = last->next;
+        }
+        FreeBlock* const returned = last->next;
+        last->next = NULL;
+        c.n = TLS_BATCH_BLOCKS;
+        BAIDU_SCOPED_LOCK(*g_mutex);
+        ReturnToArenas(returned);
+    }
+    RegisterTLSCacheIfNeeded();
+}
+
+static int64_t GetArenaMemory(void*) {
+    return g_nmapped.load(butil::memory_order_relaxed) * g_arena_size;
+}
+
+static int64_t GetAtomic(void* arg) {
+    return static_cast<butil::atomic<int64_t>*>(arg)->load(
+        butil::memory_order_relaxed);
+}
+
+static int g_init_rc = -1;
+
+static void DoInitIOBufHugepageAllocator() {
+    const int32_t arena_mb = FLAGS_iobuf_hugepage_arena_size_mb;
+    if (arena_mb < 2 || (arena_mb & (arena_mb - 1)) != 0) {
+        LOG(ERROR) << "Invalid -iobuf_hugepage_arena_size_mb=" << arena_mb;
+        return;
+    }
+    if (FLAGS_iobuf_hugepage_max_gb <= 0) {
+        LOG(ERROR) << "Invalid -iobuf_hugepage_max_gb="
+                   << FLAGS_iobuf_hugepage_max_gb;
+        return;
+    }
+    std::vector<int>* cpu_nodes = NULL;
+    if (FLAGS_iobuf_hugepage_numa) {
+        cpu_nodes = new std::vector<int>;
+        g_nnodes = ReadNumaTopology(cpu_nodes);
+        if (g_nnodes <= 1) {
+            LOG(WARNING) << "Found " << g_nnodes << " NUMA node, "
+                "-iobuf_hugepage_numa is ignored";
+            delete cpu_nodes;
+            cpu_nodes = NULL;
+            g_nnodes = 1;
+        }
+    }
+    g_arena_size = (size_t)arena_mb << 20;
+    g_huge_flag = (arena_mb == 1024 ? 30 : 21) << MAP_HUGE_SHIFT;
+    g_blocks_per_arena = g_arena_size / BLOCK_SIZE;
+    g_arenas_per_node = ((size_t)FLAGS_iobuf_hugepage_max_gb << 30)
+        / g_arena_size / g_nnodes;
+    if (g_arenas_per_node == 0) {
+        LOG(ERROR) << "-iobuf_hugepage_max_gb=" << FLAGS_iobuf_hugepage_max_gb
+                   << " is too small for " << g_nnodes << " nodes";
+        delete cpu_nodes;
+        return;
+    }
+    const size_t narenas = (size_t)g_arenas_per_node * g_nnodes;
+    // Reserve one more arena for aligning.
+    void* p = mmap(NULL, (narenas + 1) * g_arena_size, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        PLOG(ERROR) << "Fail to reserve address space for hugepage arenas";
+        delete cpu_nodes;
+        return;
+    }
+    g_begin = (char*)(((uintptr_t)p + g_arena_size - 1) & ~(g_arena_size - 1));
+    g_end = g_begin + narenas * g_arena_size;
+
+    g_mutex = new butil::Mutex;
+    g_arenas = new std::vector<Arena>(narenas);
+    g_nodes = new std::vector<NodeArenas>(g_nnodes);
+    for (int i = 0; i < g_nnodes; ++i) {
+        (*g_nodes)[i].unmapped.reserve(g_arenas_per_node);
+        (*g_nodes)[i].nidle = 0;
+    }
+    for (size_t i = narenas; i > 0; --i) {
+        Arena& a = (*g_arenas)[i - 1];
+        a.base = g_begin + (i - 1) * g_arena_size;
+        a.free_list = NULL;
+        a.ncarved = 0;
+        a.nused = 0;
+        a.partial_pos = -1;
+        a.mapped = false;
+        a.hugetlb = false;
+        // Lower arenas are mapped first.
+        (*g_nodes)[ArenaNode(i - 1)].unmapped.push_back(i - 1);
+    }
+    g_cpu_nodes = cpu_nodes;
+
+    g_nfallback = new bvar::Adder<int64_t>("iobuf_hugepage_fallback_count");
+    g_ncross_node = new bvar::Adder<int64_t>(
+        "iobuf_hugepage_cross_node_release_count");
+    new bvar::PassiveStatus<int64_t>("iobuf_hugepage_arena_count",
+                                     GetAtomic, &g_nmapped);
+    new bvar::PassiveStatus<int64_t>("iobuf_hugepage_hugetlb_arena_count",
+                                     GetAtomic, &g_nhugetlb);
+    new bvar::PassiveStatus<int64_t>("iobuf_hugepage_arena_memory",
+                                     GetArenaMemory, NULL);
+    new bvar::PassiveStatus<int64_t>("iobuf_hugepage_block_count",
+                                     GetAtomic, &g_nused_blocks);
+
+    // Blocks allocated before are still released with the previous
+    // deallocator since they're not in the reserved range.
+    g_prev_allocate = butil::iobuf::blockmem_allocate;
+    g_prev_deallocate = butil::iobuf::blockmem_deallocate;
+    butil::iobuf::blockmem_allocate = AllocateHugepageBlock;
+    butil::iobuf::blockmem_deallocate = DeallocateHugepageBlock;
+    g_init_rc = 0;
+}
+
+int InitIOBufHugepageAllocator() {
+    static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+    pthread_once(&init_once, DoInitIOBufHugepageAllocator);
+    return g_init_rc;
+}
+
+#else
+
+void* AllocateHugepageBlock(size_t size) {
+    return ::malloc(size);
+}
+
+void DeallocateHugepageBlock(void* mem) {
+    ::free(mem);
+}
+
+int InitIOBufHugepageAllocator() {
+    LOG(ERROR) << "Hugepage arenas of IOBuf are only supported on linux";
+    return -1;
+}
+
+#endif  // OS_LINUX
+
+}  // namespace brpc
@@ -0,0 +1,58 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef  BRPC_IOBUF_HUGEPAGE_H
+#define  BRPC_IOBUF_HUGEPAGE_H
+
+#include <stddef.h>
+#include <gflags/gflags_declare.h>
+
+
+namespace brpc {
+
+DECLARE_bool(iobuf_hugepage);
+DECLARE_int32(iobuf_hugepage_arena_size_mb);
+DECLARE_bool(iobuf_hugepage_numa);
+
+// Carve IOBuf blocks of default size out of arenas backed by hugepages to
+// reduce TLB misses and fragmentation of processes holding lots of network
+// buffers. Arenas are mapped with MAP_HUGETLB, or with madvise(MADV_HUGEPAGE)
+// (transparent hugepages) if no hugepages are reserved, inside a virtual
+// address range reserved at initialization, so that blocks from arenas are
+// identified by comparing addresses. Freed blocks are cached in TLS at first
+// and arenas without any used block are returned to the kernel as a whole
+// when there are more than -iobuf_hugepage_idle_arenas of them.
+// With -iobuf_hugepage_numa, the reserved range is divided among NUMA nodes
+// and blocks are allocated from arenas of the node running current thread.
+// Blocks released by a thread on another node are returned to their arenas
+// instead of being cached, counted by iobuf_hugepage_cross_node_release_count.
+// Blocks of other sizes and blocks requested after the reserved range is
+// used up are allocated with the allocator installed before.
+// Called in GlobalInitializeOrDie() when -iobuf_hugepage is on.
+// Returns 0 on success, -1 otherwise.
+int InitIOBufHugepageAllocator();
+
+// Allocate/deallocate a block, installed as butil::iobuf::blockmem_allocate
+// and butil::iobuf::blockmem_deallocate by InitIOBufHugepageAllocator().
+void* AllocateHugepageBlock(size_t size);
+void DeallocateHugepageBlock(void* mem);
+
+}  // namespace brpc
+
+
+#endif  // BRPC_IOBUF_HUGEPAGE_H
@@ -23,6 +23,10 @@
 #include "butil/files/file_path.h"
 #include "butil/iobuf.h"
 #include "butil/popen.h"
+#include "butil/string_printf.h"
+#include "butil/strings/string_piece.h"
+#include "butil/synchronization/lock.h"
+#include "butil/time.h"
 #include "gflags/gflags.h"
 #include "gflags/gflags_declare.h"
 #include <brpc/details/jemalloc_profiler.h>
@@ -32,6 +36,8 @@
 #include <bthread/bthread.h>
 #include <cerrno>
 #include <cstdlib>
+#include <deque>
+#include <memory>
 
 extern "C" {
 // weak symbol: resolved at runtime by the linker if we are using jemalloc, nullptr otherwise
@@ -47,6 +53,12 @@ DEFINE_bool(je_prof_active, false, "control jemalloc prof.active, jemalloc profi
 DEFINE_int32(je_prof_dump, 0, "control jemalloc prof.dump, change this only dump profile");
 DEFINE_int32(je_prof_reset, 19, "control jemalloc prof.reset, reset all memory profile statistics, "
              "and optionally update the sample rate, default 2^19 B");
+DEFINE_int32(je_growth_interval_s, 0, "Take a heap profile of jemalloc every so many "
+             "seconds in background to serve /memory/growth, 0 disables. "
+             "MALLOC_CONF=prof:true is required");
+DEFINE_int32(je_growth_window_s, 3600, "Keep heap profiles taken within so many seconds "
+             "for /memory/growth");
+BRPC_VALIDATE_GFLAG(je_growth_window_s, PositiveInteger);
 
 DECLARE_int32(max_flame_graph_width);
 
@@ -66,6 +78,26 @@ bool HasJemalloc() {
     return mallctl != nullptr;
 }
 
+// Points to the counter of the thread inside jemalloc, reading it is as
+// cheap as reading a variable.
+static __thread uint64_t* tls_je_allocatedp = nullptr;
+
+uint64_t JeThreadAllocatedBytes() {
+    if (tls_je_allocatedp == nullptr) {
+        if (!HasJemalloc()) {
+            return 0;
+        }
+        uint64_t* p = nullptr;
+        size_t len = sizeof(p);
+        if (mallctl("thread.allocatedp", &p, &len, nullptr, 0) != 0 ||
+            p == nullptr) {
+            return 0;
+        }
+        tls_je_allocatedp = p;
+    }
+    return *tls_je_allocatedp;
+}
+
 // env need MALLOC_CONF="prof:true" before process start
 static bool HasEnableJemallocProfile() {
     bool prof = false;
@@ -113,7 +145,7 @@ static int JeProfileActive(bool active) {
     return 0;
 }
 
-static std::string JeProfileDump() {
+static std::string JeProfileDump(const char* suffix = "") {
     if (!HasJemalloc()) {
         LOG(WARNING) << "no jemalloc";
         return "";
@@ -129,6 +161,8 @@ static std::string JeProfileDump() {
         LOG(WARNING) << "Fail to create .prof file, " << berror();
         return "";
     }
+    const size_t name_len = strlen(prof_name);
+    snprintf(prof_name + name_len, sizeof(prof_name) - name_len, "%s", suffix);
     butil::File::Error error;
     const butil::FilePath dir = butil::FilePath(prof_name).DirName();
     if (!butil::CreateDirectoryAndGetError(dir, &error)) {
@@ -300,6 +334,197 @@ void JeControlProfile(Controller* cntl) {
     }
 }
 
+int ParseJeHeapProfile(const std::string& content, JeHeapProfile* profile) {
+    profile->header.clear();
+    profile->stacks.clear();
+    profile->mapped_libraries.clear();
+    size_t pos = 0;
+    JeHeapProfile::Stat* stat = NULL;
+    while (pos < content.size()) {
+        size_t end = content.find('\n', pos);
+        if (end == std::string::npos) {
+            end = content.size();
+        }
+        const butil::StringPiece line(content.data() + pos, end - pos);
+        if (profile->header.empty()) {
+            if (!line.starts_with("heap_v2/")) {
+                return -1;
+            }
+            line.CopyToString(&profile->header);
+        } else if (line.starts_with("@")) {
+            stat = &profile->stacks[line.as_string()];
+        } else if (line.starts_with("  t*:")) {
+            // Lines of threads ("  t<N>:") are ignored.
+            long long objects = 0;
+            long long bytes = 0;
+            if (stat != NULL &&
+                sscanf(line.as_string().c_str(), "  t*: %lld: %lld",
+                       &objects, &bytes) == 2) {
+                stat->objects += objects;
+                stat->bytes += bytes;
+            }
+            stat = NULL;
+        } else if (line.starts_with("MAPPED_LIBRARIES:")) {
+            profile->mapped_libraries = content.substr(pos);
+            break;
+        }
+        pos = end + 1;
+    }
+    return profile->header.empty() ? -1 : 0;
+}
+
+void DiffJeHeapProfiles(const JeHeapProfile& base, const JeHeapProfile& cur,
+                        std::string* out) {
+    std::string stacks;
+    JeHeapProfile::Stat total;
+    for (std::map<std::string, JeHeapProfile::Stat>::const_iterator
+             it = cur.stacks.begin(); it != cur.stacks.end(); ++it) {
+        JeHeapProfile::Stat grown = it->second;
+        std::map<std::string, JeHeapProfile::Stat>::const_iterator
+            base_it = base.stacks.find(it->first);
+        if (base_it != base.stacks.end()) {
+            grown.objects -= base_it->second.objects;
+            grown.bytes -= base_it->second.bytes;
+        }
+        if (grown.bytes <= 0) {
+            continue;
+        }
+        grown.objects = std::max(grown.objects, (int64_t)0);
+        total.objects += grown.objects;
+        total.bytes += grown.bytes;
+        butil::string_appendf(&stacks, "%s\n  t*: %" PRId64 ": %" PRId64
+                              " [0: 0]\n", it->first.c_str(),
+                              grown.objects, grown.bytes);
+    }
+    out->append(cur.header);
+    butil::string_appendf(out, "\n  t*: %" PRId64 ": %" PRId64 " [0: 0]\n",
+                          total.objects, total.bytes);
+    out->append(stacks);
+    out->append("\n");
+    out->append(cur.mapped_libraries);
+}
+
+struct JeHeapSnapshot {
+    int64_t time_s;
+    JeHeapProfile profile;
+};
+
+static butil::Mutex g_growth_mutex;
+// Ordered by time_s, protected by g_growth_mutex.
+static std::deque<std::shared_ptr<const JeHeapSnapshot> > g_snapshots;
+
+static void TakeHeapSnapshot() {
+    const std::string prof_name = JeProfileDump(".growth");
+    if (prof_name.empty()) {
+        return;
+    }
+    std::string content;
+    const bool read_ok =
+        butil::ReadFileToString(butil::FilePath(prof_name), &content);
+    butil::DeleteFile(butil::FilePath(prof_name), false);
+    std::shared_ptr<JeHeapSnapshot> snapshot(new JeHeapSnapshot);
+    if (!read_ok || ParseJeHeapProfile(content, &snapshot->profile) != 0) {
+        LOG(WARNING) << "Fail to read heap profile from " << prof_name;
+        return;
+    }
+    snapshot->time_s = butil::gettimeofday_s();
+    BAIDU_SCOPED_LOCK(g_growth_mutex);
+    g_snapshots.push_back(snapshot);
+    // Keep one snapshot older than the window as the base of the window.
+    while (g_snapshots.size() > 2 &&
+           g_snapshots[1]->time_s <=
+           snapshot->time_s - FLAGS_je_growth_window_s) {
+        g_snapshots.pop_front();
+    }
+}
+
+static void* RunHeapSnapshots(void*) {
+    int64_t last_s = 0;
+    while (true) {
+        sleep(1);
+        const int interval_s = FLAGS_je_growth_interval_s;
+        const int64_t now_s = butil::monotonic_time_s();
+        if (interval_s > 0 && now_s - last_s >= interval_s) {
+            last_s = now_s;
+            TakeHeapSnapshot();
+        }
+    }
+    return NULL;
+}
+
+static void StartHeapSnapshots() {
+    pthread_t th;
+    if (pthread_create(&th, NULL, RunHeapSnapshots, NULL) != 0) {
+        LOG(ERROR) << "Fail to create thread taking heap snapshots";
+        return;
+    }
+    pthread_detach(th);
+}
+
+void JeHeapGrowth(Controller* cntl) {
+    cntl->http_response().set_content_type("text/plain");
+    if (!HasJemalloc() || !HasEnableJemallocProfile()) {
+        cntl->SetFailed(ENOMETHOD, "Heap profiler of jemalloc is not enabled, "
+                        "(no MALLOC_CONF=prof:true in env)");
+        return;
+    }
+    if (FLAGS_je_growth_interval_s <= 0) {
+        cntl->SetFailed(ENOMETHOD, "Set -je_growth_interval_s to take heap "
+                        "profiles in background");
+        return;
+    }
+    // http:ip:port/memory/growth?seconds=600
+    int64_t seconds = FLAGS_je_growth_window_s;
+    const std::string* seconds_str = cntl->http_request().uri().GetQuery("seconds");
+    if (seconds_str != NULL) {
+        char* endptr = NULL;
+        seconds = strtoll(seconds_str->c_str(), &endptr, 10);
+        if (*endptr != '\0' || seconds <= 0) {
+            cntl->SetFailed(EINVAL, "Invalid seconds=%s", seconds_str->c_str());
+            return;
+        }
+    }
+    std::shared_ptr<const JeHeapSnapshot> base;
+    std::shared_ptr<const JeHeapSnapshot> cur;
+    {
+        BAIDU_SCOPED_LOCK(g_growth_mutex);
+        if (g_snapshots.size() >= 2) {
+            cur = g_snapshots.back();
+            // The latest snapshot taken no later than `seconds' ago, or the
+            // oldest one.
+            base = g_snapshots.front();
+            for (size_t i = 1; i + 1 < g_snapshots.size() &&
+                     g_snapshots[i]->time_s <= cur->time_s - seconds; ++i) {
+                base = g_snapshots[i];
+            }
+        }
+    }
+    if (cur == NULL) {
+        cntl->SetFailed(EAGAIN, "Not enough heap profiles yet, try again "
+                        "after %d seconds", FLAGS_je_growth_interval_s);
+        return;
+    }
+    std::string out;
+    DiffJeHeapProfiles(base->profile, cur->profile, &out);
+    cntl->http_response().SetHeader(
+        "X-Growth-Seconds", butil::string_printf(
+            "%" PRId64, cur->time_s - base->time_s));
+    cntl->response_attachment().append(out);
+}
+
+static bool validate_je_growth_interval_s(const char*, int32_t val) {
+    if (val <= 0 || !HasJemalloc()) {
+        return true;
+    }
+    if (!HasEnableJemallocProfile()) {
+        LOG(WARNING) << "jemalloc have not set opt.prof before start";
+        return false;
+    }
+    static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+    pthread_once(&start_once, StartHeapSnapshots);
+    return true;
+}
+
 static bool validate_je_prof_active(const char*, bool enable) {
     if (!HasJemalloc()) {
         return true;
@@ -353,6 +578,7 @@ static bool validate_je_prof_reset(const char*, int32_t val) {
 BRPC_VALIDATE_GFLAG(je_prof_active, validate_je_prof_active);
 BRPC_VALIDATE_GFLAG(je_prof_dump, validate_je_prof_dump);
 BRPC_VALIDATE_GFLAG(je_prof_reset, validate_je_prof_reset);
+BRPC_VALIDATE_GFLAG(je_growth_interval_s, validate_je_growth_interval_s);
 
 }
 
@@ -18,17 +18,51 @@
 
 #pragma once
 
+#include <map>
+#include <string>
 #include <brpc/controller.h>
 
 namespace brpc {
 
 bool HasJemalloc();
 
+// Bytes allocated by the calling thread, read from "thread.allocatedp" of
+// jemalloc. Returns 0 without jemalloc or its stats.
+uint64_t JeThreadAllocatedBytes();
+
 // opts: Ja
 // more see ref: https://github.com/jemalloc/jemalloc/blob/dev/include/jemalloc/internal/stats.h#L9
 std::string StatsPrint(const std::string& opts);
 
 void JeControlProfile(Controller* cntl);
 
+// Live sampled allocations of each stack in a heap profile of jemalloc in
+// the "heap_v2" format, which is written by prof.dump.
+struct JeHeapProfile {
+    struct Stat {
+        Stat() : objects(0), bytes(0) {}
+        int64_t objects;
+        int64_t bytes;
+    };
+    // "heap_v2/<sample period>"
+    std::string header;
+    // Keyed by the "@ 0x... 0x..." line of the stack.
+    std::map<std::string, Stat> stacks;
+    // Starting from "MAPPED_LIBRARIES:", for symbolizing the stacks.
+    std::string mapped_libraries;
+};
+
+// Returns 0 on success, -1 if `content' is not in "heap_v2" format.
+int ParseJeHeapProfile(const std::string& content, JeHeapProfile* profile);
+
+// Write stacks whose live bytes grew from `base' to `cur' with the grown
+// objects and bytes into `out', in "heap_v2" format readable by jeprof.
+void DiffJeHeapProfiles(const JeHeapProfile& base, const JeHeapProfile& cur,
+                        std::string* out);
+
+// Serve /memory/growth with heap profiles taken every
+// -je_growth_interval_s seconds.
+void JeHeapGrowth(Controller* cntl);
+
 }
 
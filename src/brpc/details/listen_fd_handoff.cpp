@@ -0,0 +1,165 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "butil/fd_guard.h"
+#include "butil/logging.h"
+#include "brpc/details/listen_fd_handoff.h"
+
+namespace brpc {
+
+static const char HANDOFF_MAGIC[4] = { 'H', 'O', 'F', 'F' };
+// Including the internal port.
+static const int MAX_HANDOFF_FDS = 64;
+static const int HANDOFF_TIMEOUT_S = 3;
+
+struct HandoffHeader {
+    int32_t nfd;
+    int32_t has_internal_fd;
+};
+
+static void SetTimeout(int fd) {
+    timeval tv = { HANDOFF_TIMEOUT_S, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+int ReceiveListenFds(const std::string& path, std::vector<int>* fds,
+                     int* internal_fd) {
+    fds->clear();
+    *internal_fd = -1;
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOG(ERROR) << "Too long handoff path=" << path;
+        return -1;
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+    butil::fd_guard sockfd(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (sockfd < 0) {
+        PLOG(ERROR) << "Fail to create unix socket";
+        return -1;
+    }
+    // Not log when no server serves the path, which is normal at the first
+    // start.
+    if (connect(sockfd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        return -1;
+    }
+    SetTimeout(sockfd);
+    if (write(sockfd, HANDOFF_MAGIC, sizeof(HANDOFF_MAGIC)) !=
+        (ssize_t)sizeof(HANDOFF_MAGIC)) {
+        PLOG(WARNING) << "Fail to request listening fds from " << path;
+        return -1;
+    }
+    HandoffHeader header;
+    iovec iov = { &header, sizeof(header) };
+    char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_FDS)];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    const ssize_t nr = recvmsg(sockfd, &msg, 0);
+    if (nr != (ssize_t)sizeof(header)) {
+        PLOG(WARNING) << "Fail to receive listening fds from " << path;
+        return -1;
+    }
+    std::vector<int> received;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            const int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* p = (const int*)CMSG_DATA(cmsg);
+            received.insert(received.end(), p, p + n);
+        }
+    }
+    if ((msg.msg_flags & MSG_CTRUNC) || (int)received.size() != header.nfd ||
+        header.nfd < 1 + !!header.has_internal_fd) {
+        LOG(WARNING) << "Received " << received.size()
+                     << " listening fds from " << path << " while "
+                     << header.nfd << " were sent";
+        for (size_t i = 0; i < received.size(); ++i) {
+            close(received[i]);
+        }
+        return -1;
+    }
+    if (header.has_internal_fd) {
+        *internal_fd = received.back();
+        received.pop_back();
+    }
+    fds->swap(received);
+    return 0;
+}
+
+int SendListenFds(int conn_fd, const std::vector<int>& fds, int internal_fd) {
+    SetTimeout(conn_fd);
+    char magic[sizeof(HANDOFF_MAGIC)];
+    size_t nr = 0;
+    while (nr < sizeof(magic)) {
+        const ssize_t rc = read(conn_fd, magic + nr, sizeof(magic) - nr);
+        if (rc <= 0) {
+            if (rc < 0 && errno == EINTR) {
+                continue;
+            }
+            PLOG(WARNING) << "Fail to read handoff request";
+            return -1;
+        }
+        nr += rc;
+    }
+    if (memcmp(magic, HANDOFF_MAGIC, sizeof(magic)) != 0) {
+        LOG(WARNING) << "Invalid handoff request";
+        return -1;
+    }
+    std::vector<int> all_fds(fds);
+    if (internal_fd >= 0) {
+        all_fds.push_back(internal_fd);
+    }
+    if (all_fds.empty() || all_fds.size() > (size_t)MAX_HANDOFF_FDS) {
+        LOG(WARNING) << "Invalid number of listening fds=" << all_fds.size();
+        return -1;
+    }
+    HandoffHeader header = { (int32_t)all_fds.size(), internal_fd >= 0 };
+    iovec iov = { &header, sizeof(header) };
+    char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_FDS)];
+    memset(control, 0, sizeof(control));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * all_fds.size());
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * all_fds.size());
+    memcpy(CMSG_DATA(cmsg), &all_fds[0], sizeof(int) * all_fds.size());
+    if (sendmsg(conn_fd, &msg, 0) != (ssize_t)sizeof(header)) {
+        PLOG(WARNING) << "Fail to send listening fds";
+        return -1;
+    }
+    return 0;
+}
+
+}  // namespace brpc
@@ -0,0 +1,47 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BRPC_LISTEN_FD_HANDOFF_H
+#define  BRPC_LISTEN_FD_HANDOFF_H
+
+#include <string>
+#include <vector>
+
+
+namespace brpc {
+
+// Listening fds are handed over from a running server to a new server
+// (mostly in a restarted process) through an unix domain socket with
+// SCM_RIGHTS, so that the port keeps accepting during the restart.
+
+// Connect the unix socket at `path' and receive listening fds from the
+// server serving it. The fds of the port are put into `fds' and the fd of
+// the internal port (or -1) into `internal_fd'.
+// Returns 0 on success, -1 otherwise, e.g. no server serves `path'.
+int ReceiveListenFds(const std::string& path, std::vector<int>* fds,
+                     int* internal_fd);
+
+// Wait for a request from `conn_fd' accepted from the handoff socket, and
+// send `fds' and `internal_fd' (ignored if negative) to it. The fds are
+// still owned by the caller.
+// Returns 0 on success, -1 otherwise.
+int SendListenFds(int conn_fd, const std::vector<int>& fds, int internal_fd);
+
+}  // namespace brpc
+
+
+#endif  // BRPC_LISTEN_FD_HANDOFF_H
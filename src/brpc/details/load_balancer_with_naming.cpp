@@ -16,17 +16,105 @@
 // under the License.
 
 
+#include <unistd.h>                                 // getpid
+#include <algorithm>
+#include <functional>
+#include <inttypes.h>                               // PRIu64
+#include <pthread.h>
+#include "butil/endpoint.h"
+#include "butil/containers/flat_map.h"
+#include "butil/string_printf.h"
+#include "butil/third_party/murmurhash3/murmurhash3.h"
+#include "brpc/socket.h"
 #include "brpc/details/load_balancer_with_naming.h"
 
 
 namespace brpc {
 
+typedef butil::FlatMap<std::string, LoadBalancerWithNaming*> SharedLBMap;
+// Construct on demand to make the code work before main()
+static SharedLBMap* g_shared_lb_map = NULL;
+static pthread_mutex_t g_shared_lb_map_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 LoadBalancerWithNaming::~LoadBalancerWithNaming() {
+    if (!_shared_key.empty()) {
+        std::unique_lock<pthread_mutex_t> mu(g_shared_lb_map_mutex);
+        if (g_shared_lb_map != NULL) {
+            LoadBalancerWithNaming** ptr = g_shared_lb_map->seek(_shared_key);
+            if (ptr != NULL && *ptr == this) {
+                g_shared_lb_map->erase(_shared_key);
+            }
+        }
+    }
     if (_nsthread_ptr.get()) {
         _nsthread_ptr->RemoveWatcher(this);
     }
 }
 
+int GetSharedLoadBalancerWithNaming(
+    butil::intrusive_ptr<LoadBalancerWithNaming>* lb_out,
+    const char* ns_url, const char* lb_name,
+    const NamingServiceFilter* filter,
+    const GetNamingServiceThreadOptions* options,
+    size_t subset_size, const std::string& subset_client_id) {
+    const ChannelSignature sig =
+        (options ? options->channel_signature : ChannelSignature());
+    std::string key = butil::string_printf(
+        "%s|%s|%p|%" PRIu64 ",%" PRIu64 "|%zu|", ns_url, lb_name,
+        (const void*)filter, sig.data[0], sig.data[1], subset_size);
+    key.append(subset_client_id);
+    {
+        std::unique_lock<pthread_mutex_t> mu(g_shared_lb_map_mutex);
+        if (g_shared_lb_map != NULL) {
+            LoadBalancerWithNaming** ptr = g_shared_lb_map->seek(key);
+            // AddRefManually() returns 0 when the last reference was just
+            // released and the instance is being destructed.
+            if (ptr != NULL && (*ptr)->AddRefManually() != 0) {
+                lb_out->reset(*ptr, false);
+                return 0;
+            }
+        }
+    }
+    // Initialize outside the lock which may wait for the naming service.
+    butil::intrusive_ptr<LoadBalancerWithNaming> lb(
+        new (std::nothrow) LoadBalancerWithNaming);
+    if (lb == NULL) {
+        LOG(FATAL) << "Fail to new LoadBalancerWithNaming";
+        return -1;
+    }
+    if (subset_size > 0) {
+        lb->SetSubset(subset_size, subset_client_id);
+    }
+    if (lb->Init(ns_url, lb_name, filter, options) != 0) {
+        return -1;
+    }
+    std::unique_lock<pthread_mutex_t> mu(g_shared_lb_map_mutex);
+    if (g_shared_lb_map == NULL) {
+        g_shared_lb_map = new (std::nothrow) SharedLBMap;
+        if (NULL == g_shared_lb_map) {
+            mu.unlock();
+            LOG(ERROR) << "Fail to new g_shared_lb_map";
+            return -1;
+        }
+        if (g_shared_lb_map->init(64) != 0) {
+            LOG(WARNING) << "Fail to init g_shared_lb_map";
+        }
+    }
+    LoadBalancerWithNaming*& ptr = (*g_shared_lb_map)[key];
+    if (ptr != NULL && ptr->AddRefManually() != 0) {
+        // Another channel created the same load balancer concurrently, use
+        // that one and drop ours.
+        lb_out->reset(ptr, false);
+        mu.unlock();
+        return 0;
+    }
+    lb->_shared_key = key;
+    ptr = lb.get();
+    mu.unlock();
+    lb_out->swap(lb);
+    return 0;
+}
+
 int LoadBalancerWithNaming::Init(const char* ns_url, const char* lb_name,
                                  const NamingServiceFilter* filter,
                                  const GetNamingServiceThreadOptions* options) {
@@ -44,14 +132,107 @@ int LoadBalancerWithNaming::Init(const char* ns_url, const char* lb_name,
     return 0;
 }
 
+void LoadBalancerWithNaming::SetSubset(size_t subset_size,
+                                       const std::string& client_id) {
+    _subset_size = subset_size;
+    std::string id = client_id;
+    if (id.empty()) {
+        id = butil::string_printf("%s-%d", butil::my_ip_cstr(), (int)getpid());
+    }
+    uint64_t out[2];
+    butil::MurmurHash3_x64_128(id.data(), id.size(), 0, out);
+    _client_hash = out[0];
+}
+
+LoadBalancerWithNaming::HashedServer
+LoadBalancerWithNaming::HashServer(const ServerId& server) {
+    HashedServer hs = { 0, server };
+    // Hash addresses rather than SocketIds which differ between clients.
+    SocketUniquePtr ptr;
+    std::string key;
+    if (Socket::AddressFailedAsWell(server.id, &ptr) != -1) {
+        key = endpoint2str(ptr->remote_side()).c_str();
+    } else {
+        key = butil::string_printf("%" PRIu64, server.id);
+    }
+    key.push_back('-');
+    key.append(server.tag);
+    uint64_t out[2];
+    butil::MurmurHash3_x64_128(key.data(), key.size(), 0, out);
+    hs.hash = out[0];
+    return hs;
+}
+
+void LoadBalancerWithNaming::UpdateSubset() {
+    // Score of a server is a mix of its hash and the client's, servers with
+    // the highest scores are taken.
+    std::vector<std::pair<uint64_t, ServerId> > scores;
+    scores.reserve(_servers.size());
+    for (size_t i = 0; i < _servers.size(); ++i) {
+        scores.push_back(std::make_pair(
+            butil::fmix64(_servers[i].hash ^ _client_hash),
+            _servers[i].server));
+    }
+    const size_t n = std::min(_subset_size, scores.size());
+    std::nth_element(scores.begin(), scores.begin() + n, scores.end(),
+                     std::greater<std::pair<uint64_t, ServerId> >());
+    std::vector<ServerId> subset;
+    subset.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        subset.push_back(scores[i].second);
+    }
+    std::sort(subset.begin(), subset.end());
+    std::vector<ServerId> removed;
+    std::set_difference(_subset.begin(), _subset.end(),
+                        subset.begin(), subset.end(),
+                        std::back_inserter(removed));
+    std::vector<ServerId> added;
+    std::set_difference(subset.begin(), subset.end(),
+                        _subset.begin(), _subset.end(),
+                        std::back_inserter(added));
+    _subset.swap(subset);
+    // Remove before adding so that the load balancer never holds more
+    // servers than the subset.
+    if (!removed.empty()) {
+        RemoveServersInBatch(removed);
+    }
+    if (!added.empty()) {
+        AddServersInBatch(added);
+    }
+}
+
 void LoadBalancerWithNaming::OnAddedServers(
     const std::vector<ServerId>& servers) {
-    AddServersInBatch(servers);
+    if (_subset_size == 0) {
+        AddServersInBatch(servers);
+        return;
+    }
+    BAIDU_SCOPED_LOCK(_subset_mutex);
+    for (size_t i = 0; i < servers.size(); ++i) {
+        _servers.push_back(HashServer(servers[i]));
+    }
+    UpdateSubset();
 }
 
 void LoadBalancerWithNaming::OnRemovedServers(
     const std::vector<ServerId>& servers) {
-    RemoveServersInBatch(servers);
+    if (_subset_size == 0) {
+        RemoveServersInBatch(servers);
+        return;
+    }
+    BAIDU_SCOPED_LOCK(_subset_mutex);
+    std::vector<ServerId> sorted(servers);
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<HashedServer> rest;
+    rest.reserve(_servers.size());
+    for (size_t i = 0; i < _servers.size(); ++i) {
+        if (!std::binary_search(sorted.begin(), sorted.end(),
+                                _servers[i].server)) {
+            rest.push_back(_servers[i]);
+        }
+    }
+    _servers.swap(rest);
+    UpdateSubset();
 }
 
 void LoadBalancerWithNaming::Describe(std::ostream& os,
@@ -61,6 +242,10 @@ void LoadBalancerWithNaming::Describe(std::ostream& os,
     } else {
         os << "NULL";
     }
+    if (_subset_size != 0) {
+        BAIDU_SCOPED_LOCK(_subset_mutex);
+        os << " subset=" << _subset.size() << '/' << _servers.size();
+    }
     os << " lb=";
     SharedLoadBalancer::Describe(os, options);
 }
@@ -19,7 +19,10 @@
 #ifndef BRPC_LOAD_BALANCER_WITH_NAMING_H
 #define BRPC_LOAD_BALANCER_WITH_NAMING_H
 
+#include <string>
+#include <vector>
 #include "butil/intrusive_ptr.hpp"
+#include "butil/synchronization/lock.h"
 #include "brpc/load_balancer.h"
 #include "brpc/details/naming_service_thread.h"         // NamingServiceWatcher
 
@@ -29,9 +32,19 @@ namespace brpc {
 class LoadBalancerWithNaming : public SharedLoadBalancer,
                                public NamingServiceWatcher {
 public:
-    LoadBalancerWithNaming() {}
+    LoadBalancerWithNaming() : _subset_size(0), _client_hash(0) {}
     ~LoadBalancerWithNaming();
 
+    // Only a deterministic subset of at most `subset_size' servers from the
+    // naming service are added into the load balancer. The subset is chosen
+    // by rendezvous hashing: every server is scored by hashing it with the
+    // client, and the client takes servers with the highest scores, so
+    // subsets of different clients spread evenly over the servers and a
+    // change of one server changes one server of a subset at most. Empty
+    // `client_id' means the address and pid of this process.
+    // Must be called before Init().
+    void SetSubset(size_t subset_size, const std::string& client_id);
+
     int Init(const char* ns_url, const char* lb_name,
              const NamingServiceFilter* filter,
              const GetNamingServiceThreadOptions* options);
@@ -42,9 +55,44 @@ public:
     void Describe(std::ostream& os, const DescribeOptions& options);
 
 private:
+friend int GetSharedLoadBalancerWithNaming(
+    butil::intrusive_ptr<LoadBalancerWithNaming>*, const char*, const char*,
+    const NamingServiceFilter*, const GetNamingServiceThreadOptions*,
+    size_t, const std::string&);
+
+    struct HashedServer {
+        uint64_t hash;
+        ServerId server;
+    };
+    static HashedServer HashServer(const ServerId& server);
+    // Recompute the subset from `_servers' and apply the difference.
+    void UpdateSubset();
+
     butil::intrusive_ptr<NamingServiceThread> _nsthread_ptr;
+    size_t _subset_size;
+    uint64_t _client_hash;
+    butil::Mutex _subset_mutex;
+    // All servers from the naming service.
+    std::vector<HashedServer> _servers;
+    // Servers added into the load balancer, sorted.
+    std::vector<ServerId> _subset;
+    // Non-empty if this instance is shared by channels.
+    std::string _shared_key;
 };
 
+// Get a LoadBalancerWithNaming shared by channels with the same naming
+// service url, load balancer, filter, options and subset, creating and
+// initializing it if it does not exist. Channels created against one cluster
+// with different ChannelOptions (e.g. timeouts, protocols) share one load
+// balancer and one copy of the server list in this way.
+// Returns 0 on success, -1 otherwise.
+int GetSharedLoadBalancerWithNaming(
+    butil::intrusive_ptr<LoadBalancerWithNaming>* lb_out,
+    const char* ns_url, const char* lb_name,
+    const NamingServiceFilter* filter,
+    const GetNamingServiceThreadOptions* options,
+    size_t subset_size, const std::string& subset_client_id);
+
 } // namespace brpc
 
 
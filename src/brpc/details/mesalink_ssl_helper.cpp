@@ -392,6 +392,18 @@ int SSLDHInit() {
     return 0;
 }
 
+int SSLEngineInit() {
+    return 0;
+}
+
+bool SetSSLAsyncMode(SSL*, bool) {
+    return false;
+}
+
+int GetSSLAsyncFd(SSL*) {
+    return -1;
+}
+
 void Print(std::ostream& os, SSL* ssl, const char* sep) {
     os << "cipher=" << SSL_get_cipher_name(ssl) << sep
        << "protocol=" << SSL_get_version(ssl) << sep;
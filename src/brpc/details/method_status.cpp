@@ -17,13 +17,108 @@
 
 
 #include <limits>
+#include <pthread.h>
 #include "butil/macros.h"
+#include "bthread/bthread.h"
+#include "bthread/unstable.h"                     // bthread_set_thread_allocated_bytes_fn
 #include "brpc/controller.h"
+#include "brpc/compress.h"
+#include "brpc/span.h"
+#include "brpc/builtin/common.h"                  // TRACE_ID_STR
 #include "brpc/details/server_private_accessor.h"
+#include "brpc/details/controller_private_accessor.h"
 #include "brpc/details/method_status.h"
+#include "brpc/details/tcmalloc_extension.h"
+#include "brpc/details/jemalloc_profiler.h"
+#include "brpc/reloadable_flags.h"
+
+namespace bthread {
+DECLARE_bool(bthread_enable_cpu_clock_stat);
+}
 
 namespace brpc {
 
+DEFINE_bool(rpc_phase_stats, true, "Record latencies of phases of processing "
+            "requests (read, parse, queue, handler, serialize, write) for "
+            "each method");
+BRPC_VALIDATE_GFLAG(rpc_phase_stats, PassValidate);
+
+static pthread_once_t g_allocated_bytes_once = PTHREAD_ONCE_INIT;
+
+static void SetThreadAllocatedBytesFn() {
+    if (HasJemalloc()) {
+        bthread_set_thread_allocated_bytes_fn(JeThreadAllocatedBytes);
+    } else if (EnableTCMallocThreadAllocatedBytes()) {
+        bthread_set_thread_allocated_bytes_fn(TCMallocThreadAllocatedBytes);
+    }
+}
+
+static bool EnableCostStats(const char*, bool value) {
+    if (value) {
+        // Costs are attributed to bthreads at context switches.
+        bthread::FLAGS_bthread_enable_cpu_clock_stat = true;
+        pthread_once(&g_allocated_bytes_once, SetThreadAllocatedBytesFn);
+    }
+    return true;
+}
+
+DEFINE_bool(rpc_cost_stats, false, "Record CPU time and bytes allocated by "
+            "bthreads running each method, which turns on "
+            "-bthread_enable_cpu_clock_stat as well. Allocated bytes are "
+            "counted with jemalloc or tcmalloc only");
+BRPC_VALIDATE_GFLAG(rpc_cost_stats, EnableCostStats);
+
+const char* ServerPhaseToString(ServerPhase phase) {
+    switch (phase) {
+    case SERVER_PHASE_READ: return "read";
+    case SERVER_PHASE_PARSE: return "parse";
+    case SERVER_PHASE_QUEUE: return "queue";
+    case SERVER_PHASE_HANDLER: return "handler";
+    case SERVER_PHASE_SERIALIZE: return "serialize";
+    case SERVER_PHASE_WRITE: return "write";
+    case SERVER_PHASE_NUM: break;
+    }
+    return "unknown";
+}
+
+struct MethodStatus::PhaseRecorders {
+    bvar::LatencyRecorder rec[SERVER_PHASE_NUM];
+};
+
+static int expose_phases(bvar::LatencyRecorder* rec,
+                         const std::string& prefix) {
+    for (int i = 0; i < SERVER_PHASE_NUM; ++i) {
+        std::string phase_prefix = prefix;
+        phase_prefix.append("_phase_");
+        phase_prefix.append(ServerPhaseToString((ServerPhase)i));
+        if (rec[i].expose(phase_prefix) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+struct MethodStatus::CostRecorders {
+    CostRecorders()
+        : cpu_us_second(&cpu_us)
+        , allocated_bytes_second(&allocated_bytes) {}
+    bvar::Adder<int64_t> cpu_us;
+    bvar::PerSecond<bvar::Adder<int64_t> > cpu_us_second;
+    bvar::Adder<int64_t> allocated_bytes;
+    bvar::PerSecond<bvar::Adder<int64_t> > allocated_bytes_second;
+
+    int expose(const std::string& prefix) {
+        if (cpu_us.expose_as(prefix, "cpu_us") != 0 ||
+            cpu_us_second.expose_as(prefix, "cpu_us_second") != 0 ||
+            allocated_bytes.expose_as(prefix, "allocated_bytes") != 0 ||
+            allocated_bytes_second.expose_as(
+                prefix, "allocated_bytes_second") != 0) {
+            return -1;
+        }
+        return 0;
+    }
+};
+
 static int cast_int(void* arg) {
     return *(int*)arg;
 }
@@ -41,10 +136,14 @@ MethodStatus::MethodStatus()
     , _nconcurrency_bvar(cast_int, &_nconcurrency)
     , _eps_bvar(&_nerror_bvar)
     , _max_concurrency_bvar(cast_cl, &_cl)
+    , _phase_recs(NULL)
+    , _cost_recs(NULL)
 {
 }
 
 MethodStatus::~MethodStatus() {
+    delete _phase_recs.load(butil::memory_order_relaxed);
+    delete _cost_recs.load(butil::memory_order_relaxed);
 }
 
 int MethodStatus::Expose(const butil::StringPiece& prefix) {
@@ -60,10 +159,26 @@ int MethodStatus::Expose(const butil::StringPiece& prefix) {
     if (_latency_rec.expose(prefix) != 0) {
         return -1;
     }
+    {
+        BAIDU_SCOPED_LOCK(_phase_mutex);
+        prefix.CopyToString(&_expose_prefix);
+        PhaseRecorders* recs = _phase_recs.load(butil::memory_order_relaxed);
+        if (recs && expose_phases(recs->rec, _expose_prefix) != 0) {
+            return -1;
+        }
+        CostRecorders* cost_recs =
+            _cost_recs.load(butil::memory_order_relaxed);
+        if (cost_recs && cost_recs->expose(_expose_prefix) != 0) {
+            return -1;
+        }
+    }
     if (_cl) {
         if (_max_concurrency_bvar.expose_as(prefix, "max_concurrency") != 0) {
             return -1;
         }
+        if (_cl->Expose(prefix) != 0) {
+            return -1;
+        }
     }
     return 0;
 }
@@ -135,6 +250,45 @@ void MethodStatus::Describe(
     }
     OutputValue(os, "max_latency: ", _latency_rec.max_latency_name(),
                 _latency_rec.max_latency(), options, false);
+    const bvar::detail::LatencyExemplar exemplar = _latency_rec.latency_exemplar();
+    if (exemplar.trace_id != 0) {
+        if (options.use_html) {
+            os << "<p>slowest_traced: <a href=\"/rpcz?" << TRACE_ID_STR << '='
+               << std::hex << exemplar.trace_id << "\">" << std::dec
+               << exemplar.latency << "</a></p>\n";
+        } else {
+            OutputTextValue(os, "slowest_traced: ", exemplar);
+        }
+    }
+
+    // Phases, shown only when the protocol times them.
+    const PhaseRecorders* recs = _phase_recs.load(butil::memory_order_acquire);
+    if (recs && recs->rec[SERVER_PHASE_HANDLER].count() != 0) {
+        for (int i = 0; i < SERVER_PHASE_NUM; ++i) {
+            const bvar::LatencyRecorder& rec = recs->rec[i];
+            const std::string title =
+                std::string("phase_") + ServerPhaseToString((ServerPhase)i);
+            if (options.use_html) {
+                OutputValue(os, (title + ": ").c_str(), rec.latency_name(),
+                            rec.latency(), options, false);
+            } else {
+                os << title << ": " << rec.latency() << " p99="
+                   << rec.latency_percentile(0.99) << '\n';
+            }
+        }
+    }
+
+    // Costs, shown only when -rpc_cost_stats was ever on.
+    const CostRecorders* cost_recs =
+        _cost_recs.load(butil::memory_order_acquire);
+    if (cost_recs) {
+        OutputValue(os, "cpu_us_second: ", cost_recs->cpu_us_second.name(),
+                    cost_recs->cpu_us_second.get_value(1), options, false);
+        OutputValue(os, "allocated_bytes_second: ",
+                    cost_recs->allocated_bytes_second.name(),
+                    cost_recs->allocated_bytes_second.get_value(1),
+                    options, false);
+    }
 
     // Concurrency
     OutputValue(os, "concurrency: ", _nconcurrency_bvar.name(),
@@ -142,13 +296,66 @@ void MethodStatus::Describe(
     if (_cl) {
         OutputValue(os, "max_concurrency: ", _max_concurrency_bvar.name(),
                     MaxConcurrency(), options, false);
+        _cl->Describe(os, options);
     }
 }
 
+void MethodStatus::OnPhases(const ServerPhaseTimer& timer) {
+    if (!timer.started()) {
+        return;
+    }
+    PhaseRecorders* recs = _phase_recs.load(butil::memory_order_acquire);
+    if (recs == NULL) {
+        recs = CreatePhaseRecorders();
+    }
+    for (int i = 0; i < SERVER_PHASE_NUM; ++i) {
+        recs->rec[i] << timer.duration_us((ServerPhase)i);
+    }
+}
+
+void MethodStatus::OnCost(int64_t cpu_ns, int64_t allocated_bytes) {
+    CostRecorders* recs = _cost_recs.load(butil::memory_order_acquire);
+    if (recs == NULL) {
+        recs = CreateCostRecorders();
+    }
+    recs->cpu_us << cpu_ns / 1000;
+    recs->allocated_bytes << allocated_bytes;
+}
+
+MethodStatus::CostRecorders* MethodStatus::CreateCostRecorders() {
+    BAIDU_SCOPED_LOCK(_phase_mutex);
+    CostRecorders* recs = _cost_recs.load(butil::memory_order_relaxed);
+    if (recs == NULL) {
+        recs = new CostRecorders;
+        if (!_expose_prefix.empty()) {
+            recs->expose(_expose_prefix);
+        }
+        _cost_recs.store(recs, butil::memory_order_release);
+    }
+    return recs;
+}
+
+MethodStatus::PhaseRecorders* MethodStatus::CreatePhaseRecorders() {
+    BAIDU_SCOPED_LOCK(_phase_mutex);
+    PhaseRecorders* recs = _phase_recs.load(butil::memory_order_relaxed);
+    if (recs == NULL) {
+        recs = new PhaseRecorders;
+        if (!_expose_prefix.empty()) {
+            expose_phases(recs->rec, _expose_prefix);
+        }
+        _phase_recs.store(recs, butil::memory_order_release);
+    }
+    return recs;
+}
+
 void MethodStatus::SetConcurrencyLimiter(ConcurrencyLimiter* cl) {
     _cl.reset(cl);
 }
 
+void MethodStatus::SetCompressPolicy(CompressPolicy* policy) {
+    _compress_policy.reset(policy);
+}
+
 int HandleResponseWritten(bthread_id_t id, void* data, int /*error_code*/) {
     auto args = static_cast<ResponseWriteInfo*>(data);
     args->sent_us = butil::cpuwide_time_us();
@@ -156,9 +363,37 @@ int HandleResponseWritten(bthread_id_t id, void* data, int /*error_code*/) {
     return 0;
 }
 
+MethodCostScope::MethodCostScope(MethodStatus* status)
+    : _status(NULL), _begin_cpu_ns(0), _begin_allocated_bytes(0) {
+    if (status != NULL && FLAGS_rpc_cost_stats) {
+        _begin_cpu_ns = bthread_cpu_clock_ns();
+        // 0 until the worker switched bthreads after the clock was on.
+        if (_begin_cpu_ns != 0) {
+            _status = status;
+            _begin_allocated_bytes = bthread_allocated_bytes();
+        }
+    }
+}
+
+MethodCostScope::~MethodCostScope() {
+    if (_status) {
+        _status->OnCost(bthread_cpu_clock_ns() - _begin_cpu_ns,
+                        bthread_allocated_bytes() - _begin_allocated_bytes);
+    }
+}
+
 ConcurrencyRemover::~ConcurrencyRemover() {
     if (_status) {
-        _status->OnResponded(_c->ErrorCode(), butil::cpuwide_time_us() - _received_us);
+        ControllerPrivateAccessor accessor(_c);
+        Span* span = accessor.span();
+        const int64_t now = butil::cpuwide_time_us();
+        if (FLAGS_rpc_phase_stats && _c->ErrorCode() == 0) {
+            ServerPhaseTimer& phase_timer = accessor.phase_timer();
+            phase_timer.Mark(SERVER_PHASE_WRITE, now);
+            _status->OnPhases(phase_timer);
+        }
+        _status->OnResponded(_c->ErrorCode(), now - _received_us,
+                             span ? span->trace_id() : 0);
         _status = NULL;
     }
     ServerPrivateAccessor(_c->server()).RemoveConcurrency(_c);
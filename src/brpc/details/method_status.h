@@ -20,15 +20,18 @@
 #define  BRPC_METHOD_STATUS_H
 
 #include "butil/macros.h"                  // DISALLOW_COPY_AND_ASSIGN
+#include "butil/synchronization/lock.h"   // butil::Mutex
 #include "bvar/bvar.h"                    // vars
 #include "brpc/describable.h"
 #include "brpc/concurrency_limiter.h"
+#include "brpc/details/server_phase.h"
 
 
 namespace brpc {
 
 class Controller;
 class Server;
+class CompressPolicy;
 // Record accessing stats of a method.
 class MethodStatus : public Describable {
 public:
@@ -46,7 +49,19 @@ public:
     // `latency_us' : microseconds taken by a successful call. Latency can
     // be measured in this utility class as well, but the callsite often
     // did the time keeping and the cost is better saved. 
-    void OnResponded(int error_code, int64_t latency_us);
+    // `trace_id' : id of the rpcz trace of the call, 0 if it's not traced.
+    // The slowest traced call is shown as an exemplar of the latency.
+    void OnResponded(int error_code, int64_t latency_us,
+                     uint64_t trace_id = 0);
+
+    // Record durations of phases of a successful call. Protocols not
+    // timing the phases leave `timer' unstarted. Recorders of phases are
+    // created at the first timed call.
+    void OnPhases(const ServerPhaseTimer& timer);
+
+    // Record CPU time and allocated bytes of a call, measured by
+    // MethodCostScope. Recorders of costs are created at the first call.
+    void OnCost(int64_t cpu_ns, int64_t allocated_bytes);
 
     // Expose internal vars.
     // Return 0 on success, -1 otherwise.
@@ -58,6 +73,14 @@ public:
     // Current max_concurrency of the method.
     int MaxConcurrency() const { return _cl ? _cl->MaxConcurrency() : 0; }
 
+    // Current concurrency of the method.
+    int Concurrency() const {
+        return _nconcurrency.load(butil::memory_order_relaxed);
+    }
+
+    // Policy to choose CompressType of responses, NULL if not set.
+    CompressPolicy* compress_policy() const { return _compress_policy.get(); }
+
 private:
 friend class Server;
     DISALLOW_COPY_AND_ASSIGN(MethodStatus);
@@ -66,13 +89,45 @@ friend class Server;
     // before the server is started. 
     void SetConcurrencyLimiter(ConcurrencyLimiter* cl);
 
+    // Note: SetCompressPolicy() is not thread safe and can only be called
+    // before the server is started.
+    void SetCompressPolicy(CompressPolicy* policy);
+
     std::unique_ptr<ConcurrencyLimiter> _cl;
+    std::unique_ptr<CompressPolicy> _compress_policy;
     butil::atomic<int> _nconcurrency;
     bvar::Adder<int64_t>  _nerror_bvar;
     bvar::LatencyRecorder _latency_rec;
     bvar::PassiveStatus<int>  _nconcurrency_bvar;
     bvar::PerSecond<bvar::Adder<int64_t>> _eps_bvar;
     bvar::PassiveStatus<int32_t> _max_concurrency_bvar;
+    // Methods never timing phases (e.g. all builtin ones) don't pay for
+    // recorders of phases which are created on demand.
+    struct PhaseRecorders;
+    PhaseRecorders* CreatePhaseRecorders();
+    butil::atomic<PhaseRecorders*> _phase_recs;
+    // Created on demand as well, when -rpc_cost_stats is on.
+    struct CostRecorders;
+    CostRecorders* CreateCostRecorders();
+    butil::atomic<CostRecorders*> _cost_recs;
+    butil::Mutex _phase_mutex;
+    std::string _expose_prefix;  // protected by _phase_mutex
+};
+
+// Measure CPU time and bytes allocated by the calling bthread in the scope
+// and add them to `status' when -rpc_cost_stats is on. The costs of the
+// method are counted across workers that the bthread ran on, but parts of
+// the method running in other bthreads (e.g. asynchronous handlers) are not.
+class MethodCostScope {
+public:
+    explicit MethodCostScope(MethodStatus* status);
+    ~MethodCostScope();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MethodCostScope);
+    MethodStatus* _status;
+    int64_t _begin_cpu_ns;
+    int64_t _begin_allocated_bytes;
 };
 
 struct ResponseWriteInfo {
@@ -105,10 +160,11 @@ inline bool MethodStatus::OnRequested(int* rejected_cc, Controller* cntl) {
     return false;
 }
 
-inline void MethodStatus::OnResponded(int error_code, int64_t latency) {
+inline void MethodStatus::OnResponded(int error_code, int64_t latency,
+                                      uint64_t trace_id) {
     _nconcurrency.fetch_sub(1, butil::memory_order_relaxed);
     if (0 == error_code) {
-        _latency_rec << latency;
+        _latency_rec.record(latency, trace_id);
     } else {
         _nerror_bvar << 1;
     }
@@ -77,32 +77,76 @@ NamingServiceThread::Actions::~Actions() {
     EndWait(0);
 }
 
+// Sort `nodes' and remove duplicated ones in it.
+static void SortAndDedup(std::vector<ServerNode>* nodes) {
+    std::sort(nodes->begin(), nodes->end());
+    const size_t dedup_size = std::unique(nodes->begin(), nodes->end())
+        - nodes->begin();
+    if (dedup_size != nodes->size()) {
+        LOG(WARNING) << "Removed " << nodes->size() - dedup_size
+                     << " duplicated servers";
+        nodes->resize(dedup_size);
+    }
+}
+
 void NamingServiceThread::Actions::AddServers(
-    const std::vector<ServerNode>&) {
-    // FIXME(gejun)
-    RELEASE_ASSERT_VERBOSE(false, "Not implemented");
+    const std::vector<ServerNode>& servers) {
+    // Cost is proportional to the number of added servers except for the
+    // merging, which is much cheaper than sorting and diffing all servers
+    // in ResetServers().
+    _added.clear();
+    for (size_t i = 0; i < servers.size(); ++i) {
+        if (!std::binary_search(_last_servers.begin(), _last_servers.end(),
+                                servers[i])) {
+            _added.push_back(servers[i]);
+        }
+    }
+    SortAndDedup(&_added);
+    _removed.clear();
+    _servers.resize(_last_servers.size() + _added.size());
+    std::merge(_last_servers.begin(), _last_servers.end(),
+               _added.begin(), _added.end(), _servers.begin());
+    _last_input.clear();
+    ApplyChanges();
+    EndWait(_last_servers.empty() ? ENODATA : 0);
 }
 
 void NamingServiceThread::Actions::RemoveServers(
-    const std::vector<ServerNode>&) {
-    // FIXME(gejun)
-    RELEASE_ASSERT_VERBOSE(false, "Not implemented");
+    const std::vector<ServerNode>& servers) {
+    _removed.clear();
+    for (size_t i = 0; i < servers.size(); ++i) {
+        if (std::binary_search(_last_servers.begin(), _last_servers.end(),
+                               servers[i])) {
+            _removed.push_back(servers[i]);
+        }
+    }
+    SortAndDedup(&_removed);
+    _added.clear();
+    _servers.resize(_last_servers.size());
+    std::vector<ServerNode>::iterator _servers_end =
+        std::set_difference(_last_servers.begin(), _last_servers.end(),
+                            _removed.begin(), _removed.end(),
+                            _servers.begin());
+    _servers.resize(_servers_end - _servers.begin());
+    _last_input.clear();
+    ApplyChanges();
+    EndWait(_last_servers.empty() ? ENODATA : 0);
 }
 
 void NamingServiceThread::Actions::ResetServers(
         const std::vector<ServerNode>& servers) {
+    // Periodic naming services return the same list mostly, skip sorting
+    // and diffing in which case.
+    if (!servers.empty() && servers == _last_input) {
+        EndWait(0);
+        return;
+    }
+    _last_input = servers;
     _servers.assign(servers.begin(), servers.end());
     
     // Diff servers with _last_servers by comparing sorted vectors.
     // Notice that _last_servers is always sorted.
-    std::sort(_servers.begin(), _servers.end());
-    const size_t dedup_size = std::unique(_servers.begin(), _servers.end())
-        - _servers.begin();
-    if (dedup_size != _servers.size()) {
-        LOG(WARNING) << "Removed " << _servers.size() - dedup_size
-                     << " duplicated servers";
-        _servers.resize(dedup_size);
-    }
+    SortAndDedup(&_servers);
     _added.resize(_servers.size());
     std::vector<ServerNode>::iterator _added_end = 
         std::set_difference(_servers.begin(), _servers.end(),
@@ -117,6 +161,11 @@ void NamingServiceThread::Actions::ResetServers(
                             _removed.begin());
     _removed.resize(_removed_end - _removed.begin());
 
+    ApplyChanges();
+    EndWait(servers.empty() ? ENODATA : 0);
+}
+
+void NamingServiceThread::Actions::ApplyChanges() {
     _added_sockets.clear();
     for (size_t i = 0; i < _added.size(); ++i) {
         ServerNodeWithId tagged_id;
@@ -127,6 +176,15 @@ void NamingServiceThread::Actions::ResetServers(
         const SocketMapKey key(_added[i], _owner->_options.channel_signature);
         CHECK_EQ(0, SocketMapInsert(key, &tagged_id.id, _owner->_options.ssl_ctx,
                                     _owner->_options.use_rdma, _owner->_options.hc_option));
+        const GetNamingServiceThreadOptions& opt = _owner->_options;
+        if (opt.min_pooled_connections > 0 || opt.max_pooled_connections > 0) {
+            SocketUniquePtr ptr;
+            if (Socket::AddressFailedAsWell(tagged_id.id, &ptr) >= 0) {
+                ptr->SetupSocketPool(opt.min_pooled_connections,
+                                     opt.max_pooled_connections,
+                                     opt.connect_timeout_ms);
+            }
+        }
         _added_sockets.push_back(tagged_id);
     }
 
@@ -202,8 +260,6 @@ void NamingServiceThread::Actions::ResetServers(
         }
         LOG(INFO) << info.str();
     }
-
-    EndWait(servers.empty() ? ENODATA : 0);
 }
 
 void NamingServiceThread::Actions::EndWait(int error_code) {
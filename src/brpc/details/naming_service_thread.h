@@ -45,11 +45,19 @@ struct GetNamingServiceThreadOptions {
     GetNamingServiceThreadOptions()
         : succeed_without_server(false)
         , log_succeed_without_server(true)
-        , use_rdma(false) {}
+        , use_rdma(false)
+        , min_pooled_connections(0)
+        , max_pooled_connections(0)
+        , connect_timeout_ms(-1) {}
     
     bool succeed_without_server;
     bool log_succeed_without_server;
     bool use_rdma;
+    // Passed to Socket::SetupSocketPool() of added servers if any of them
+    // is positive.
+    int min_pooled_connections;
+    int max_pooled_connections;
+    int connect_timeout_ms;
     HealthCheckOption hc_option;
     ChannelSignature channel_signature;
     std::shared_ptr<SocketSSLContext> ssl_ctx;
@@ -76,10 +84,16 @@ class NamingServiceThread : public SharedObject, public Describable {
         void EndWait(int error_code);
 
     private:
+        // Apply sorted _added and _removed to sockets and watchers, and
+        // replace _last_servers with _servers.
+        void ApplyChanges();
+
         NamingServiceThread* _owner;
         bthread_id_t _wait_id;
         butil::atomic<bool> _has_wait_error;
         int _wait_error;
+        // Unsorted input of last ResetServers().
+        std::vector<ServerNode> _last_input;
         std::vector<ServerNode> _last_servers;
         std::vector<ServerNode> _servers;
         std::vector<ServerNode> _added;
@@ -0,0 +1,297 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <math.h>
+#include <vector>
+#include <gflags/gflags.h>
+#include "butil/time.h"
+#include "bvar/bvar.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/excluded_servers.h"
+#include "brpc/details/outlier_detector.h"
+
+namespace brpc {
+
+DEFINE_int32(outlier_detection_interval_ms, 1000,
+             "Check outliers of each method at most once per so many "
+             "milliseconds");
+DEFINE_int32(outlier_detection_window_size, 100,
+             "Success rate and latency of a (server, method) are averaged "
+             "over roughly so many recent calls");
+DEFINE_int32(outlier_detection_min_calls, 100,
+             "Servers with fewer calls since being added or ejected are not "
+             "checked");
+DEFINE_int32(outlier_detection_min_servers, 5,
+             "Outliers are not checked when fewer servers of a method have "
+             "enough calls");
+DEFINE_double(outlier_detection_stdev_factor, 1.9,
+              "A server is an outlier when its success rate or latency of a "
+              "method differs from the mean of all servers by more than so "
+              "many times of the standard deviation");
+DEFINE_double(outlier_detection_min_latency_ratio, 1.5,
+              "Latency of an outlier must also be so many times of the mean "
+              "latency at least, to tolerate natural jitters");
+DEFINE_int32(outlier_detection_base_ejection_ms, 30000,
+             "A server is ejected for so many milliseconds multiplied by "
+             "number of its recent ejections");
+DEFINE_int32(outlier_detection_max_ejection_ms, 300000,
+             "Max milliseconds that a server is ejected");
+DEFINE_int32(outlier_detection_max_ejection_percent, 10,
+             "At most so many percent of servers of a method are ejected at "
+             "the same time, but one server can always be ejected");
+BRPC_VALIDATE_GFLAG(outlier_detection_interval_ms, NonNegativeInteger);
+BRPC_VALIDATE_GFLAG(outlier_detection_window_size, PositiveInteger);
+BRPC_VALIDATE_GFLAG(outlier_detection_min_calls, NonNegativeInteger);
+BRPC_VALIDATE_GFLAG(outlier_detection_min_servers, PositiveInteger);
+BRPC_VALIDATE_GFLAG(outlier_detection_base_ejection_ms, PositiveInteger);
+BRPC_VALIDATE_GFLAG(outlier_detection_max_ejection_ms, PositiveInteger);
+BRPC_VALIDATE_GFLAG(outlier_detection_max_ejection_percent,
+                    NonNegativeInteger);
+
+static bvar::Adder<int64_t>* g_ejected_servers = NULL;
+static pthread_once_t g_ejected_servers_once = PTHREAD_ONCE_INIT;
+
+static void CreateEjectedServers() {
+    g_ejected_servers =
+        new bvar::Adder<int64_t>("rpc_client_outlier_ejection_count");
+}
+
+// Stats of servers without calls for so long are removed, they're probably
+// removed from the naming service.
+static const int64_t IDLE_SERVER_US = 60 * 1000000L;
+
+OutlierDetector::MethodStat::MethodStat()
+    : last_detect_us(butil::monotonic_time_us())
+    , nejected(0) {
+    CHECK_EQ(0, servers.init(32));
+}
+
+OutlierDetector::OutlierDetector() {
+    pthread_once(&g_ejected_servers_once, CreateEjectedServers);
+}
+
+OutlierDetector::~OutlierDetector() {
+    butil::DoublyBufferedData<MethodMap>::ScopedPtr ptr;
+    if (_methods.Read(&ptr) == 0) {
+        for (MethodMap::const_iterator it = ptr->begin();
+             it != ptr->end(); ++it) {
+            delete it->second;
+        }
+    }
+}
+
+size_t OutlierDetector::AddMethod(
+    MethodMap& m, const google::protobuf::MethodDescriptor* method,
+    MethodStat* stat) {
+    return m.insert(std::make_pair(method, stat)).second ? 1 : 0;
+}
+
+OutlierDetector::MethodStat* OutlierDetector::FindMethod(
+    const google::protobuf::MethodDescriptor* method) {
+    butil::DoublyBufferedData<MethodMap>::ScopedPtr ptr;
+    if (_methods.Read(&ptr) != 0) {
+        return NULL;
+    }
+    MethodMap::const_iterator it = ptr->find(method);
+    return it != ptr->end() ? it->second : NULL;
+}
+
+OutlierDetector::MethodStat* OutlierDetector::FindOrAddMethod(
+    const google::protobuf::MethodDescriptor* method) {
+    MethodStat* ms = FindMethod(method);
+    if (ms != NULL) {
+        return ms;
+    }
+    ms = new MethodStat;
+    if (_methods.Modify(AddMethod, method, ms) == 0) {
+        // Added by another thread.
+        delete ms;
+        ms = FindMethod(method);
+    }
+    return ms;
+}
+
+void OutlierDetector::OnCallEnd(
+    SocketId server, const google::protobuf::MethodDescriptor* method,
+    int error_code, int64_t latency_us) {
+    MethodStat* ms = FindOrAddMethod(method);
+    if (ms == NULL) {
+        return;
+    }
+    const int64_t now_us = butil::monotonic_time_us();
+    const double alpha = 1.0 / FLAGS_outlier_detection_window_size;
+    BAIDU_SCOPED_LOCK(ms->mutex);
+    ServerStat& s = ms->servers[server];
+    if (s.ejected_until_us == 0) {
+        // Calls sent to ejected servers when all servers are excluded
+        // are not counted.
+        const double success = (error_code == 0 ? 1.0 : 0.0);
+        if (s.ncall == 0) {
+            s.success_rate = success;
+            s.latency_us = (latency_us >= 0 ? latency_us : 0);
+        } else {
+            s.success_rate += alpha * (success - s.success_rate);
+            if (latency_us >= 0) {
+                s.latency_us += alpha * (latency_us - s.latency_us);
+            }
+        }
+        ++s.ncall;
+        s.last_call_us = now_us;
+    }
+    if (now_us - ms->last_detect_us >=
+        FLAGS_outlier_detection_interval_ms * 1000L) {
+        ms->last_detect_us = now_us;
+        Detect(ms, now_us);
+    }
+}
+
+static void MeanAndStddev(const std::vector<double>& v,
+                          double* mean, double* stddev) {
+    double sum = 0;
+    for (size_t i = 0; i < v.size(); ++i) {
+        sum += v[i];
+    }
+    *mean = sum / v.size();
+    double var = 0;
+    for (size_t i = 0; i < v.size(); ++i) {
+        var += (v[i] - *mean) * (v[i] - *mean);
+    }
+    *stddev = sqrt(var / v.size());
+}
+
+void OutlierDetector::Detect(MethodStat* ms, int64_t now_us) {
+    std::vector<SocketId> idle_servers;
+    for (butil::FlatMap<SocketId, ServerStat>::const_iterator
+             it = ms->servers.begin(); it != ms->servers.end(); ++it) {
+        if (it->second.ejected_until_us == 0 &&
+            now_us - it->second.last_call_us > IDLE_SERVER_US) {
+            idle_servers.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < idle_servers.size(); ++i) {
+        ms->servers.erase(idle_servers[i]);
+    }
+
+    std::vector<ServerStat*> candidates;
+    std::vector<double> success_rates;
+    std::vector<double> latencies;
+    size_t nserver = 0;
+    size_t nejected = 0;
+    for (butil::FlatMap<SocketId, ServerStat>::iterator
+             it = ms->servers.begin(); it != ms->servers.end(); ++it) {
+        ServerStat& s = it->second;
+        ++nserver;
+        if (s.ejected_until_us != 0) {
+            if (now_us < s.ejected_until_us) {
+                ++nejected;
+                continue;
+            }
+            // Back to selections with a clean history.
+            s.ejected_until_us = 0;
+            s.ncall = 0;
+            s.last_call_us = now_us;
+        } else if (s.ejected_times > 0) {
+            // Forgive ejections gradually when the server behaves.
+            --s.ejected_times;
+        }
+        if (s.ncall >= FLAGS_outlier_detection_min_calls) {
+            candidates.push_back(&s);
+            success_rates.push_back(s.success_rate);
+            latencies.push_back(s.latency_us);
+        }
+    }
+    const size_t max_ejected = std::max(
+        nserver * FLAGS_outlier_detection_max_ejection_percent / 100,
+        (size_t)1);
+    if (!candidates.empty() &&
+        candidates.size() >= (size_t)FLAGS_outlier_detection_min_servers &&
+        nejected < max_ejected) {
+        const double k = FLAGS_outlier_detection_stdev_factor;
+        double sr_mean = 0;
+        double sr_stddev = 0;
+        double lat_mean = 0;
+        double lat_stddev = 0;
+        MeanAndStddev(success_rates, &sr_mean, &sr_stddev);
+        MeanAndStddev(latencies, &lat_mean, &lat_stddev);
+        const double min_sr = sr_mean - k * sr_stddev;
+        const double max_lat = std::max(
+            lat_mean + k * lat_stddev,
+            lat_mean * FLAGS_outlier_detection_min_latency_ratio);
+        for (size_t i = 0; i < candidates.size() && nejected < max_ejected;
+             ++i) {
+            ServerStat& s = *candidates[i];
+            if (s.success_rate >= min_sr && s.latency_us <= max_lat) {
+                continue;
+            }
+            ++s.ejected_times;
+            s.ejected_until_us = now_us + std::min(
+                (int64_t)FLAGS_outlier_detection_base_ejection_ms *
+                s.ejected_times,
+                (int64_t)FLAGS_outlier_detection_max_ejection_ms) * 1000L;
+            ++nejected;
+            *g_ejected_servers << 1;
+        }
+    }
+    ms->nejected.store(nejected, butil::memory_order_relaxed);
+}
+
+bool OutlierDetector::IsEjected(
+    SocketId server, const google::protobuf::MethodDescriptor* method) {
+    MethodStat* ms = FindMethod(method);
+    if (ms == NULL || ms->nejected.load(butil::memory_order_relaxed) == 0) {
+        return false;
+    }
+    BAIDU_SCOPED_LOCK(ms->mutex);
+    const ServerStat* s = ms->servers.seek(server);
+    return s != NULL && butil::monotonic_time_us() < s->ejected_until_us;
+}
+
+ExcludedServers* OutlierDetector::ExcludeEjected(
+    const google::protobuf::MethodDescriptor* method,
+    const ExcludedServers* base) {
+    MethodStat* ms = FindMethod(method);
+    if (ms == NULL || ms->nejected.load(butil::memory_order_relaxed) == 0) {
+        return NULL;
+    }
+    std::vector<SocketId> ejected;
+    {
+        const int64_t now_us = butil::monotonic_time_us();
+        BAIDU_SCOPED_LOCK(ms->mutex);
+        for (butil::FlatMap<SocketId, ServerStat>::const_iterator
+                 it = ms->servers.begin(); it != ms->servers.end(); ++it) {
+            if (now_us < it->second.ejected_until_us) {
+                ejected.push_back(it->first);
+            }
+        }
+    }
+    if (ejected.empty()) {
+        return NULL;
+    }
+    ExcludedServers* s = ExcludedServers::Create(
+        ejected.size() + (base ? base->size() : 0));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->Add(base);
+    for (size_t i = 0; i < ejected.size(); ++i) {
+        s->Add(ejected[i]);
+    }
+    return s;
+}
+
+} // namespace brpc
@@ -0,0 +1,116 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_OUTLIER_DETECTOR_H
+#define BRPC_DETAILS_OUTLIER_DETECTOR_H
+
+#include <stdint.h>
+#include <map>
+#include "butil/atomicops.h"
+#include "butil/macros.h"
+#include "butil/synchronization/lock.h"
+#include "butil/containers/flat_map.h"
+#include "butil/containers/doubly_buffered_data.h"
+#include "brpc/socket_id.h"
+
+namespace google {
+namespace protobuf {
+class MethodDescriptor;
+}  // namespace protobuf
+}  // namespace google
+
+namespace brpc {
+
+class ExcludedServers;
+
+// Eject servers whose calls of a method fail or slow down much more than
+// calls of the same method to other servers of the channel, like outlier
+// detection of Envoy. Unlike CircuitBreaker which sets the socket failed,
+// the ejection only affects selections of the method in the channel, the
+// socket shared by other methods and channels keeps working.
+// Success rate and latency of each (server, method) are smoothed by EMA.
+// Every -outlier_detection_interval_ms, among servers having enough calls,
+// the ones with success rate lower than mean - k * stddev or with latency
+// higher than mean + k * stddev are ejected, where k is
+// -outlier_detection_stdev_factor. Repeated ejections last longer.
+class OutlierDetector {
+public:
+    OutlierDetector();
+    ~OutlierDetector();
+
+    // Called when a call of `method' to `server' ends. `latency_us' is
+    // negative if the server did not respond.
+    void OnCallEnd(SocketId server,
+                   const google::protobuf::MethodDescriptor* method,
+                   int error_code, int64_t latency_us);
+
+    // True if `server' is ejected for `method' currently.
+    bool IsEjected(SocketId server,
+                   const google::protobuf::MethodDescriptor* method);
+
+    // Returns a new ExcludedServers containing servers in `base' (which
+    // may be NULL) and servers ejected for `method', or NULL when no server
+    // is ejected. The result should be destroyed by
+    // ExcludedServers::Destroy().
+    ExcludedServers* ExcludeEjected(
+        const google::protobuf::MethodDescriptor* method,
+        const ExcludedServers* base);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(OutlierDetector);
+
+    struct ServerStat {
+        ServerStat()
+            : ncall(0), success_rate(0), latency_us(0), last_call_us(0)
+            , ejected_until_us(0), ejected_times(0) {}
+        // Calls since the server was added or ejected last time.
+        int64_t ncall;
+        double success_rate;
+        double latency_us;
+        int64_t last_call_us;
+        // 0 if the server is not ejected.
+        int64_t ejected_until_us;
+        int ejected_times;
+    };
+    struct MethodStat {
+        MethodStat();
+        butil::Mutex mutex;
+        butil::FlatMap<SocketId, ServerStat> servers;
+        int64_t last_detect_us;
+        // Checked before locking `mutex' to skip most selections quickly.
+        butil::atomic<int> nejected;
+    };
+    typedef std::map<const google::protobuf::MethodDescriptor*,
+                     MethodStat*> MethodMap;
+
+    static size_t AddMethod(MethodMap& m,
+                            const google::protobuf::MethodDescriptor* method,
+                            MethodStat* stat);
+    MethodStat* FindMethod(const google::protobuf::MethodDescriptor* method);
+    MethodStat* FindOrAddMethod(
+        const google::protobuf::MethodDescriptor* method);
+    // Called with ms->mutex held.
+    void Detect(MethodStat* ms, int64_t now_us);
+
+    butil::DoublyBufferedData<MethodMap> _methods;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_DETAILS_OUTLIER_DETECTOR_H
@@ -0,0 +1,153 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/crc32c.h"
+#include "butil/time.h"
+#include "brpc/controller.h"
+#include "brpc/details/response_cache.h"
+
+namespace brpc {
+
+ResponseCache::ResponseCache(const butil::StringPiece& prefix, int64_t ttl_ms,
+                             int64_t max_bytes,
+                             const std::vector<std::string>& user_fields)
+    : _ttl_us(ttl_ms * 1000L)
+    , _max_bytes(max_bytes)
+    , _user_fields(user_fields)
+    , _nbytes(0)
+    , _nhit_window(&_nhit, -1)
+    , _nmiss_window(&_nmiss, -1)
+    , _hit_ratio(GetHitRatio, this)
+    , _cached_bytes(GetCachedBytes, this) {
+    _nhit.expose_as(prefix, "response_cache_hit");
+    _nmiss.expose_as(prefix, "response_cache_miss");
+    _hit_ratio.expose_as(prefix, "response_cache_hit_ratio");
+    _cached_bytes.expose_as(prefix, "response_cache_bytes");
+}
+
+ResponseCache::~ResponseCache() {
+    _hit_ratio.hide();
+    _cached_bytes.hide();
+}
+
+double ResponseCache::GetHitRatio(void* arg) {
+    ResponseCache* c = static_cast<ResponseCache*>(arg);
+    const int64_t nhit = c->_nhit_window.get_value();
+    const int64_t nmiss = c->_nmiss_window.get_value();
+    if (nhit + nmiss <= 0) {
+        return 0;
+    }
+    return (double)nhit / (nhit + nmiss);
+}
+
+int64_t ResponseCache::GetCachedBytes(void* arg) {
+    ResponseCache* c = static_cast<ResponseCache*>(arg);
+    BAIDU_SCOPED_LOCK(c->_mutex);
+    return c->_nbytes;
+}
+
+bool ResponseCache::MakeKey(Controller* cntl, const butil::IOBuf& req_body,
+                            butil::IOBuf* key) const {
+    if (!cntl->request_attachment().empty() ||
+        cntl->request_checksum_type() != CHECKSUM_TYPE_NONE) {
+        return false;
+    }
+    // Shares blocks with the request.
+    key->append(req_body);
+    const char types[2] = { (char)cntl->request_content_type(),
+                            (char)cntl->request_compress_type() };
+    key->append(types, sizeof(types));
+    for (size_t i = 0; i < _user_fields.size(); ++i) {
+        const std::string* value = NULL;
+        if (cntl->has_request_user_fields()) {
+            value = cntl->request_user_fields()->seek(_user_fields[i]);
+        }
+        // Separate absent fields from empty ones.
+        const uint32_t len = (value ? value->size() + 1 : 0);
+        key->append(&len, sizeof(len));
+        if (value) {
+            key->append(*value);
+        }
+    }
+    return true;
+}
+
+bool ResponseCache::Get(const butil::IOBuf& key, Value* value) {
+    const uint32_t hash = butil::crc32c::Extend(0, key);
+    const int64_t now_us = butil::cpuwide_time_us();
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        auto range = _index.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            EntryList::iterator e = it->second;
+            if (!e->key.equals(key)) {
+                continue;
+            }
+            if (e->expire_us <= now_us) {
+                Erase(e);
+                break;
+            }
+            _entries.splice(_entries.begin(), _entries, e);
+            *value = e->value;
+            _nhit << 1;
+            return true;
+        }
+    }
+    _nmiss << 1;
+    return false;
+}
+
+void ResponseCache::Put(const butil::IOBuf& key, const Value& value) {
+    Entry entry;
+    entry.hash = butil::crc32c::Extend(0, key);
+    entry.key = key;
+    entry.value = value;
+    entry.expire_us = butil::cpuwide_time_us() + _ttl_us;
+    if ((int64_t)entry.size() > _max_bytes) {
+        return;
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    auto range = _index.equal_range(entry.hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->key.equals(key)) {
+            Erase(it->second);
+            break;
+        }
+    }
+    _nbytes += entry.size();
+    // Copying IOBufs shares blocks.
+    _entries.push_front(entry);
+    _index.insert(std::make_pair(entry.hash, _entries.begin()));
+    while (_nbytes > _max_bytes) {
+        Erase(--_entries.end());
+    }
+}
+
+void ResponseCache::Erase(EntryList::iterator e) {
+    auto range = _index.equal_range(e->hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == e) {
+            _index.erase(it);
+            break;
+        }
+    }
+    _nbytes -= e->size();
+    _entries.erase(e);
+}
+
+} // namespace brpc
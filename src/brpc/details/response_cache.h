@@ -0,0 +1,108 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_RESPONSE_CACHE_H
+#define BRPC_DETAILS_RESPONSE_CACHE_H
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "butil/iobuf.h"
+#include "butil/macros.h"
+#include "butil/strings/string_piece.h"
+#include "butil/synchronization/lock.h"
+#include "bvar/bvar.h"
+#include "brpc/options.pb.h"            // CompressType, ContentType
+
+namespace brpc {
+
+class Controller;
+
+// Serialized responses of a method keyed by serialized requests, for methods
+// returning the same response to the same request in a while. Responses are
+// evicted when expired or in LRU order when the cache is full.
+class ResponseCache {
+public:
+    struct Value {
+        butil::IOBuf body;
+        butil::IOBuf attachment;
+        CompressType compress_type;
+        ContentType content_type;
+    };
+
+    // bvars are exposed with `prefix' which is generally the full name of
+    // the method. Values of request user fields in `user_fields' are parts
+    // of keys as well.
+    ResponseCache(const butil::StringPiece& prefix, int64_t ttl_ms,
+                  int64_t max_bytes, const std::vector<std::string>& user_fields);
+    ~ResponseCache();
+
+    // Make the key of the request in `cntl' whose body is `req_body'.
+    // Returns false if the response of the request should not be cached.
+    bool MakeKey(Controller* cntl, const butil::IOBuf& req_body,
+                 butil::IOBuf* key) const;
+
+    // Returns true and fill `value' if `key' was cached and not expired.
+    bool Get(const butil::IOBuf& key, Value* value);
+
+    void Put(const butil::IOBuf& key, const Value& value);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ResponseCache);
+
+    struct Entry {
+        uint32_t hash;
+        butil::IOBuf key;
+        Value value;
+        int64_t expire_us;
+
+        size_t size() const {
+            return key.size() + value.body.size() + value.attachment.size();
+        }
+    };
+    // Most recently used at front.
+    typedef std::list<Entry> EntryList;
+
+    // Called with _mutex held.
+    void Erase(EntryList::iterator it);
+
+    static double GetHitRatio(void* arg);
+    static int64_t GetCachedBytes(void* arg);
+
+    const int64_t _ttl_us;
+    const int64_t _max_bytes;
+    const std::vector<std::string> _user_fields;
+
+    butil::Mutex _mutex;
+    EntryList _entries;
+    std::unordered_multimap<uint32_t, EntryList::iterator> _index;
+    int64_t _nbytes;
+
+    bvar::Adder<int64_t> _nhit;
+    bvar::Adder<int64_t> _nmiss;
+    bvar::Window<bvar::Adder<int64_t> > _nhit_window;
+    bvar::Window<bvar::Adder<int64_t> > _nmiss_window;
+    bvar::PassiveStatus<double> _hit_ratio;
+    bvar::PassiveStatus<int64_t> _cached_bytes;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_DETAILS_RESPONSE_CACHE_H
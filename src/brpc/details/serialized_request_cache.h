@@ -0,0 +1,71 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_SERIALIZED_REQUEST_CACHE_H
+#define BRPC_DETAILS_SERIALIZED_REQUEST_CACHE_H
+
+#include <vector>
+#include "butil/iobuf.h"
+#include "brpc/options.pb.h"        // CompressType, ContentType
+#include "brpc/protocol.h"          // Protocol::SerializeRequest
+
+namespace brpc {
+
+// Sub calls of a ParallelChannel (or retries of a SelectiveChannel) often
+// send the same request object. The first sub call serializing the request
+// puts the result here, later ones sending it in the same way share the
+// blocks instead of serializing again.
+// Not thread-safe, sub calls are issued one by one.
+class SerializedRequestCache {
+public:
+    struct Key {
+        const google::protobuf::Message* request;
+        Protocol::SerializeRequest serialize;
+        CompressType compress_type;
+        ContentType content_type;
+
+        bool operator==(const Key& rhs) const {
+            return request == rhs.request && serialize == rhs.serialize &&
+                compress_type == rhs.compress_type &&
+                content_type == rhs.content_type;
+        }
+    };
+
+    // Append serialized bytes of `key' to `out' and return true if found.
+    bool Get(const Key& key, butil::IOBuf* out) const {
+        for (size_t i = 0; i < _entries.size(); ++i) {
+            if (_entries[i].first == key) {
+                out->append(_entries[i].second);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Put(const Key& key, const butil::IOBuf& buf) {
+        _entries.push_back(std::make_pair(key, buf));
+    }
+
+private:
+    std::vector<std::pair<Key, butil::IOBuf> > _entries;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_DETAILS_SERIALIZED_REQUEST_CACHE_H
@@ -0,0 +1,78 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_SERVER_PHASE_H
+#define BRPC_SERVER_PHASE_H
+
+#include <stdint.h>
+
+namespace brpc {
+
+// Phases of processing a request at server-side.
+enum ServerPhase {
+    SERVER_PHASE_READ = 0,  // reading from the socket
+    SERVER_PHASE_PARSE,     // cutting the message and parsing the request
+    SERVER_PHASE_QUEUE,     // waiting for a bthread to process the message
+    SERVER_PHASE_HANDLER,   // running the method until done is called
+    SERVER_PHASE_SERIALIZE, // serializing the response
+    SERVER_PHASE_WRITE,     // writing the response into the socket
+    SERVER_PHASE_NUM
+};
+
+const char* ServerPhaseToString(ServerPhase phase);
+
+// Accumulate durations of phases by marking ends of phases in order. A
+// phase may be marked more than once, e.g. parsing is done partially before
+// the message is queued.
+// Timestamps are from butil::cpuwide_time_us() which is cheap enough to be
+// taken for every request.
+class ServerPhaseTimer {
+public:
+    ServerPhaseTimer() { Reset(); }
+
+    void Reset() {
+        for (int i = 0; i < SERVER_PHASE_NUM; ++i) {
+            _durations_us[i] = 0;
+        }
+        _last_us = 0;
+    }
+
+    // Start timing at `begin_us', which is when reading of the request began.
+    void Begin(int64_t begin_us) { _last_us = begin_us; }
+
+    bool started() const { return _last_us != 0; }
+
+    // Mark the end of `phase' which started at last marked time.
+    void Mark(ServerPhase phase, int64_t now_us) {
+        if (_last_us != 0 && now_us >= _last_us) {
+            _durations_us[phase] += now_us - _last_us;
+            _last_us = now_us;
+        }
+    }
+
+    int64_t duration_us(ServerPhase phase) const {
+        return _durations_us[phase];
+    }
+
+private:
+    int64_t _durations_us[SERVER_PHASE_NUM];
+    int64_t _last_us;
+};
+
+} // namespace brpc
+
+#endif // BRPC_SERVER_PHASE_H
@@ -22,6 +22,7 @@
 #include "brpc/server.h"
 #include "brpc/acceptor.h"
 #include "brpc/details/method_status.h"
+#include "brpc/details/codel_admission.h"
 #include "brpc/builtin/bad_method_service.h"
 #include "brpc/restful.h"
 
@@ -40,14 +41,25 @@ public:
         _server->_nerror_bvar << 1;
     }
 
-    // Returns true if the `max_concurrency' limit is not reached.
+    // Returns true if the `max_concurrency' limit (for the priority of `c'
+    // when the server sheds load by priorities) is not reached.
     bool AddConcurrency(Controller* c) {
         if (_server->options().max_concurrency <= 0) {
             return true;
         }
         c->add_flag(Controller::FLAGS_ADDED_CONCURRENCY);
-        return (butil::subtle::NoBarrier_AtomicIncrement(&_server->_concurrency, 1)
-                <= _server->options().max_concurrency);
+        const int cc =
+            butil::subtle::NoBarrier_AtomicIncrement(&_server->_concurrency, 1);
+        if (_server->_priority_cl != NULL) {
+            return _server->_priority_cl->OnRequested(cc, c);
+        }
+        return cc <= _server->options().max_concurrency;
+    }
+
+    // Returns false if the request queued for `sojourn_us' should be dropped
+    // by CoDel.
+    bool AdmitByCodel(int64_t sojourn_us) {
+        return _server->_codel == NULL || _server->_codel->Admit(sojourn_us);
     }
 
     void RemoveConcurrency(const Controller* c) {
@@ -75,6 +87,12 @@ public:
         const butil::StringPiece& service_name, int method_index) const {
         return _server->FindMethodPropertyByNameAndIndex(service_name, method_index);
     }
+    const Server::MethodProperty* FindMethodPropertyByIndexHint(
+        const butil::StringPiece& service_name,
+        const butil::StringPiece& method_name, int method_index) const {
+        return _server->FindMethodPropertyByIndexHint(
+            service_name, method_name, method_index);
+    }
 
     const Server::ServiceProperty*
     FindServicePropertyByFullName(const butil::StringPiece& fullname) const {
@@ -0,0 +1,240 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "butil/atomicops.h"
+#include "butil/fd_guard.h"
+#include "butil/logging.h"
+#include "brpc/details/span_ring.h"
+
+namespace brpc {
+
+static const char SPAN_RING_MAGIC[8] = { 'R', 'P', 'C', 'Z', 'R', 'I', 'N', 'G' };
+static const uint64_t NO_RECORD = (uint64_t)-1;
+
+struct BAIDU_CACHELINE_ALIGNMENT SpanRingMeta {
+    char magic[8];
+    uint64_t capacity;
+    // Logical end of written bytes, including the record being written.
+    // Advanced before overwriting so that readers detect overwritten
+    // records.
+    butil::atomic<uint64_t> end;
+    // Logical position of the newest complete record.
+    butil::atomic<uint64_t> last;
+};
+
+struct SpanRecordHeader {
+    uint32_t brief_size;
+    uint32_t span_size;
+    int64_t time_key;
+    uint64_t trace_id;
+    uint64_t span_id;
+    uint64_t prev;
+};
+
+inline size_t RecordSize(size_t brief_size, size_t span_size) {
+    return (sizeof(SpanRecordHeader) + brief_size + span_size + 7) & ~(size_t)7;
+}
+
+// Whether a record with the sizes can be at `pos' of a ring of `capacity'
+// bytes, sizes read from a corrupted file may point anywhere.
+inline bool IsValidRecord(size_t capacity, uint64_t pos,
+                          size_t brief_size, size_t span_size) {
+    const size_t size = RecordSize(brief_size, span_size);
+    // Same limit as Append().
+    return pos % 8 == 0 && size <= capacity / 4 &&
+        pos % capacity + size <= capacity;
+}
+
+// Whether `end' and `last' read from a file are consistent.
+static bool IsValidMeta(const SpanRingMeta* m, const char* data,
+                        size_t capacity) {
+    const uint64_t end = m->end.load(butil::memory_order_relaxed);
+    const uint64_t last = m->last.load(butil::memory_order_relaxed);
+    if (end % 8 != 0) {
+        return false;
+    }
+    if (last == NO_RECORD) {
+        return true;
+    }
+    if (last >= end || end - last > capacity) {
+        return false;
+    }
+    const SpanRecordHeader* h =
+        (const SpanRecordHeader*)(data + last % capacity);
+    return IsValidRecord(capacity, last, h->brief_size, h->span_size) &&
+        last + RecordSize(h->brief_size, h->span_size) <= end;
+}
+
+SpanRing::SpanRing()
+    : _meta(NULL), _data(NULL), _capacity(0), _mapped_size(0) {}
+
+SpanRing::~SpanRing() {
+    if (_meta) {
+        munmap(_meta, _mapped_size);
+    }
+}
+
+SpanRing* SpanRing::Open(size_t capacity, const std::string& path) {
+    capacity &= ~(size_t)7;
+    const size_t mapped_size = sizeof(SpanRingMeta) + capacity;
+    void* mem = MAP_FAILED;
+    bool resized = false;
+    if (path.empty()) {
+        mem = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        butil::fd_guard fd(open(path.c_str(), O_RDWR | O_CREAT, 0644));
+        if (fd < 0) {
+            PLOG(ERROR) << "Fail to open " << path;
+            return NULL;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            PLOG(ERROR) << "Fail to stat " << path;
+            return NULL;
+        }
+        // A file of another size was truncated or made with another
+        // capacity, its records can't be trusted.
+        resized = (st.st_size != (off_t)mapped_size);
+        if (resized && ftruncate(fd, mapped_size) != 0) {
+            PLOG(ERROR) << "Fail to resize " << path;
+            return NULL;
+        }
+        // Shared mapping is written back by the kernel even if the process
+        // crashes.
+        mem = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    }
+    if (mem == MAP_FAILED) {
+        PLOG(ERROR) << "Fail to map " << mapped_size << " bytes for rpcz";
+        return NULL;
+    }
+    SpanRing* ring = new SpanRing;
+    ring->_meta = (SpanRingMeta*)mem;
+    ring->_data = (char*)mem + sizeof(SpanRingMeta);
+    ring->_capacity = capacity;
+    ring->_mapped_size = mapped_size;
+    ring->_path = path;
+
+    SpanRingMeta* m = ring->_meta;
+    if (!resized &&
+        memcmp(m->magic, SPAN_RING_MAGIC, sizeof(m->magic)) == 0 &&
+        m->capacity == capacity && IsValidMeta(m, ring->_data, capacity)) {
+        // Keep `end' as is. A record being written at crash is not linked
+        // from `last', but it may have overwritten older records, which
+        // must stay invisible.
+        LOG(INFO) << "Reuse spans in " << path;
+    } else {
+        if (!path.empty() && !resized) {
+            LOG(WARNING) << "Discard spans in " << path;
+        }
+        memcpy(m->magic, SPAN_RING_MAGIC, sizeof(m->magic));
+        m->capacity = capacity;
+        m->end.store(0, butil::memory_order_relaxed);
+        m->last.store(NO_RECORD, butil::memory_order_relaxed);
+    }
+    return ring;
+}
+
+void SpanRing::Append(int64_t time_key, uint64_t trace_id, uint64_t span_id,
+                      const std::string& brief, const std::string& span) {
+    const size_t size = RecordSize(brief.size(), span.size());
+    if (size > _capacity / 4) {
+        LOG_EVERY_SECOND(WARNING) << "Drop span of " << size
+                                  << " bytes which is too large for rpcz";
+        return;
+    }
+    const uint64_t prev = _meta->last.load(butil::memory_order_relaxed);
+    uint64_t pos = _meta->end.load(butil::memory_order_relaxed);
+    // Records are never split at the end of the ring.
+    if (pos % _capacity + size > _capacity) {
+        pos += _capacity - pos % _capacity;
+    }
+    _meta->end.store(pos + size, butil::memory_order_relaxed);
+    butil::atomic_thread_fence(butil::memory_order_release);
+
+    char* p = _data + pos % _capacity;
+    SpanRecordHeader h;
+    h.brief_size = brief.size();
+    h.span_size = span.size();
+    h.time_key = time_key;
+    h.trace_id = trace_id;
+    h.span_id = span_id;
+    h.prev = prev;
+    memcpy(p, &h, sizeof(h));
+    memcpy(p + sizeof(h), brief.data(), brief.size());
+    memcpy(p + sizeof(h) + brief.size(), span.data(), span.size());
+    _meta->last.store(pos, butil::memory_order_release);
+}
+
+void SpanRing::Traverse(const std::function<bool(const Entry&)>& fn) const {
+    uint64_t pos = _meta->last.load(butil::memory_order_acquire);
+    while (pos != NO_RECORD) {
+        SpanRecordHeader h;
+        memcpy(&h, _data + pos % _capacity, sizeof(h));
+        butil::atomic_thread_fence(butil::memory_order_acquire);
+        if (_meta->end.load(butil::memory_order_relaxed) > pos + _capacity) {
+            return;  // overwritten
+        }
+        if (!IsValidRecord(_capacity, pos, h.brief_size, h.span_size)) {
+            LOG_EVERY_SECOND(ERROR) << "Corrupted span at " << pos;
+            return;
+        }
+        Entry e;
+        e.pos = pos;
+        e.time_key = h.time_key;
+        e.trace_id = h.trace_id;
+        e.span_id = h.span_id;
+        e.brief_size = h.brief_size;
+        e.span_size = h.span_size;
+        if (!fn(e) || h.prev >= pos) {
+            return;
+        }
+        pos = h.prev;
+    }
+}
+
+bool SpanRing::Read(const Entry& e, std::string* brief,
+                    std::string* span) const {
+    if (!IsValidRecord(_capacity, e.pos, e.brief_size, e.span_size)) {
+        return false;
+    }
+    const char* p = _data + e.pos % _capacity + sizeof(SpanRecordHeader);
+    if (brief) {
+        brief->assign(p, e.brief_size);
+    }
+    if (span) {
+        span->assign(p + e.brief_size, e.span_size);
+    }
+    butil::atomic_thread_fence(butil::memory_order_acquire);
+    return _meta->end.load(butil::memory_order_relaxed) <= e.pos + _capacity;
+}
+
+void SpanRing::Describe(std::ostream& os) const {
+    const uint64_t end = _meta->end.load(butil::memory_order_relaxed);
+    os << "[ in-memory ring" << (_path.empty() ? "" : " mapped from ")
+       << _path << " ]\ncapacity: " << _capacity
+       << "\nwritten: " << end << '\n';
+}
+
+}  // namespace brpc
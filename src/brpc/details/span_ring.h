@@ -0,0 +1,86 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BRPC_SPAN_RING_H
+#define  BRPC_SPAN_RING_H
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <functional>
+#include "butil/macros.h"
+
+
+namespace brpc {
+
+struct SpanRingMeta;
+
+// A fixed-size ring of encoded spans, as an alternative to leveldb for
+// storing rpcz. Records are appended by one thread (the dumping thread of
+// bvar::Collector) and read by any thread without locking: a reader copies
+// a record and checks afterwards whether the writer has wrapped around
+// over it, like a seqlock. Each record links to the previous one, so that
+// records are traversed from the newest (latest in time) to the oldest.
+// The ring is mapped from a file when a path is given, in which case
+// records written before a crash are still readable after restarting.
+class SpanRing {
+public:
+    struct Entry {
+        uint64_t pos;       // logical position in the ring
+        int64_t time_key;   // starting real time of the span
+        uint64_t trace_id;
+        uint64_t span_id;
+        uint32_t brief_size;
+        uint32_t span_size;
+    };
+
+    // Create a ring of `capacity' bytes, mapped from `path' if it's not
+    // empty. Records in the file are kept if it was created with the same
+    // capacity. Returns NULL on error.
+    static SpanRing* Open(size_t capacity, const std::string& path);
+    ~SpanRing();
+
+    // Append a record, overwriting oldest records when the ring is full.
+    // Must be called by one thread at the same time.
+    void Append(int64_t time_key, uint64_t trace_id, uint64_t span_id,
+                const std::string& brief, const std::string& span);
+
+    // Call `fn' with records from the newest to the oldest until it returns
+    // false or a record overwritten by the writer is met.
+    void Traverse(const std::function<bool(const Entry&)>& fn) const;
+
+    // Copy payloads of `e' into `brief' and/or `span' (NULL to skip).
+    // Returns false if the record has been overwritten.
+    bool Read(const Entry& e, std::string* brief, std::string* span) const;
+
+    void Describe(std::ostream& os) const;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(SpanRing);
+    SpanRing();
+
+    SpanRingMeta* _meta;
+    char* _data;
+    size_t _capacity;
+    size_t _mapped_size;
+    std::string _path;
+};
+
+}  // namespace brpc
+
+
+#endif  // BRPC_SPAN_RING_H
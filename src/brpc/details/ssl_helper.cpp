@@ -21,19 +21,28 @@
 #ifndef USE_MESALINK
 
 #include <sys/socket.h>                // recv
+#include <gflags/gflags.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
+#ifndef OPENSSL_NO_ENGINE
+#include <openssl/engine.h>
+#endif
 #include "butil/unique_ptr.h"
 #include "butil/logging.h"
 #include "butil/ssl_compat.h"
 #include "butil/string_splitter.h"
 #include "brpc/socket.h"
 #include "brpc/details/ssl_helper.h"
+#include "brpc/details/ssl_session_cache.h"
 
 namespace brpc {
 
+DEFINE_string(ssl_engine, "", "Id of the OpenSSL engine (e.g. qat) which "
+              "does all crypto operations it supports, empty to use "
+              "software implementations");
+
 #ifndef OPENSSL_NO_DH
 static DH* g_dh_1024 = NULL;
 static DH* g_dh_2048 = NULL;
@@ -506,7 +515,7 @@ SSL_CTX* CreateClientSSLContext(const ChannelSSLOptions& options) {
         SSL_CTX_set_alpn_protos(ssl_ctx.get(), alpn_list.data(), alpn_list.size());
     }
 
-    SSL_CTX_set_session_cache_mode(ssl_ctx.get(), SSL_SESS_CACHE_CLIENT);
+    SetupClientSessionCache(ssl_ctx.get());
     return ssl_ctx.release();
 }
 
@@ -546,6 +555,9 @@ SSL_CTX* CreateServerSSLContext(const std::string& certificate,
 
     SSL_CTX_set_timeout(ssl_ctx.get(), options.session_lifetime_s);
     SSL_CTX_sess_set_cache_size(ssl_ctx.get(), options.session_cache_size);
+    if (SetupServerSessionTicket(ssl_ctx.get()) != 0) {
+        return NULL;
+    }
 
 #ifndef OPENSSL_NO_DH
     SSL_CTX_set_tmp_dh_callback(ssl_ctx.get(), SSLGetDHCallback);
@@ -618,6 +630,58 @@ void AddBIOBuffer(SSL* ssl, int fd, int bufsize) {
     SSL_set_bio(ssl, rbio, wbio);
 }
 
+bool EnableKTLS(SSL* ssl) {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+    return true;
+#else
+    (void)ssl;
+    return false;
+#endif
+}
+
+bool IsKTLSSendEnabled(SSL* ssl) {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    return BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+    (void)ssl;
+    return false;
+#endif
+}
+
+bool SetSSLAsyncMode(SSL* ssl, bool on) {
+#ifdef SSL_MODE_ASYNC
+    if (on) {
+        SSL_set_mode(ssl, SSL_MODE_ASYNC);
+    } else {
+        SSL_clear_mode(ssl, SSL_MODE_ASYNC);
+    }
+    return true;
+#else
+    (void)ssl;
+    (void)on;
+    return false;
+#endif
+}
+
+int GetSSLAsyncFd(SSL* ssl) {
+#ifdef SSL_MODE_ASYNC
+    size_t nfd = 0;
+    if (SSL_get_all_async_fds(ssl, NULL, &nfd) != 1 || nfd == 0) {
+        return -1;
+    }
+    // An engine has one fd per SSL in practice.
+    std::vector<OSSL_ASYNC_FD> fds(nfd);
+    if (SSL_get_all_async_fds(ssl, fds.data(), &nfd) != 1) {
+        return -1;
+    }
+    return fds[0];
+#else
+    (void)ssl;
+    return -1;
+#endif
+}
+
 SSLState DetectSSLState(int fd, int* error_code) {
     // Peek the first few bytes inside socket to detect whether
     // it's an SSL connection. If it is, create an SSL session
@@ -825,6 +889,43 @@ int SSLDHInit() {
     return 0;
 }
 
+int SSLEngineInit() {
+    if (FLAGS_ssl_engine.empty()) {
+        return 0;
+    }
+#ifndef OPENSSL_NO_ENGINE
+    ENGINE_load_builtin_engines();
+    ENGINE* e = ENGINE_by_id(FLAGS_ssl_engine.c_str());
+    if (e == NULL) {
+        LOG(ERROR) << "Fail to find SSL engine=" << FLAGS_ssl_engine
+                   << ": " << SSLError(ERR_get_error());
+        return -1;
+    }
+    if (ENGINE_init(e) != 1) {
+        LOG(ERROR) << "Fail to initialize SSL engine=" << FLAGS_ssl_engine
+                   << ": " << SSLError(ERR_get_error());
+        ENGINE_free(e);
+        return -1;
+    }
+    if (ENGINE_set_default(e, ENGINE_METHOD_ALL) != 1) {
+        LOG(ERROR) << "Fail to use SSL engine=" << FLAGS_ssl_engine
+                   << ": " << SSLError(ERR_get_error());
+        ENGINE_finish(e);
+        ENGINE_free(e);
+        return -1;
+    }
+    // The functional reference from ENGINE_init is held until the process
+    // exits.
+    ENGINE_free(e);
+    LOG(INFO) << "Use SSL engine=" << FLAGS_ssl_engine;
+    return 0;
+#else
+    LOG(ERROR) << "-ssl_engine is set but engines are not supported by "
+                  "the SSL library";
+    return -1;
+#endif  // OPENSSL_NO_ENGINE
+}
+
 static std::string GetNextLevelSeparator(const char* sep) {
     if (sep[0] != '\n') {
         return sep;
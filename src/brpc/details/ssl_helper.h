@@ -80,6 +80,11 @@ int SSLThreadInit();
 // Return 0 on success, -1 otherwise
 int SSLDHInit();
 
+// Load the engine of -ssl_engine (e.g. an Intel QAT engine) and make it the
+// default implementation of crypto operations it supports.
+// Return 0 on success or when -ssl_engine is empty, -1 otherwise
+int SSLEngineInit();
+
 // Create a new SSL_CTX in client mode and
 // set the right options according `options'
 SSL_CTX* CreateClientSSLContext(const ChannelSSLOptions& options);
@@ -103,6 +108,23 @@ SSL* CreateSSLSession(SSL_CTX* ctx, SocketId id, int fd, bool server_mode);
 // which can reduce the total number of calls to system read/write
 void AddBIOBuffer(SSL* ssl, int fd, int bufsize);
 
+// Ask OpenSSL to install the negotiated keys into kernel (kTLS) after
+// handshake of `ssl'. Returns false if kTLS is not supported by the library.
+bool EnableKTLS(SSL* ssl);
+
+// Whether encryption of data written into `ssl' is done by kernel, in which
+// case plain data can be written into the fd directly.
+bool IsKTLSSendEnabled(SSL* ssl);
+
+// Turn on/off async mode of `ssl', in which operations return
+// SSL_ERROR_WANT_ASYNC while crypto is in progress inside an async engine.
+// Returns false if async mode is not supported by the library.
+bool SetSSLAsyncMode(SSL* ssl, bool on);
+
+// Get the fd which becomes readable when the paused async operation of
+// `ssl' can be resumed, -1 if there's none.
+int GetSSLAsyncFd(SSL* ssl);
+
 // Judge whether the underlying channel of `fd' is using SSL
 // If the return value is SSL_UNKNOWN, `error_code' will be
 // set to indicate the reason (0 for EOF)
@@ -0,0 +1,377 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <time.h>
+#include <unordered_map>
+#include <gflags/gflags.h>
+#include "butil/logging.h"
+#include "butil/synchronization/lock.h"
+#include "bvar/bvar.h"
+#include "brpc/socket.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/ssl_session_cache.h"
+#ifndef USE_MESALINK
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include "butil/ssl_compat.h"
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(OPENSSL_IS_BORINGSSL)
+#include <openssl/core_names.h>
+#define BRPC_SSL_TICKET_EVP_CB
+#endif
+#endif  // USE_MESALINK
+
+namespace brpc {
+
+DEFINE_int32(ssl_client_session_cache_size, 8192,
+             "Max number of TLS sessions cached by clients for resumption, "
+             "0 to disable the cache");
+BRPC_VALIDATE_GFLAG(ssl_client_session_cache_size, NonNegativeInteger);
+
+DEFINE_int32(ssl_session_ticket_key_rotation_s, 3600,
+             "Generate a new key to encrypt TLS session tickets of servers "
+             "every so many seconds, 0 to use the never-rotated key of "
+             "OpenSSL. Only affects servers started afterwards");
+BRPC_VALIDATE_GFLAG(ssl_session_ticket_key_rotation_s, NonNegativeInteger);
+
+#ifndef USE_MESALINK
+
+static bvar::Adder<int64_t>* g_client_full_handshake = NULL;
+static bvar::Adder<int64_t>* g_client_resumed_handshake = NULL;
+static bvar::Adder<int64_t>* g_server_full_handshake = NULL;
+static bvar::Adder<int64_t>* g_server_resumed_handshake = NULL;
+static pthread_once_t s_create_vars_once = PTHREAD_ONCE_INIT;
+
+static size_t GetClientSessionCacheSizeFn(void*) {
+    return GetClientSessionCacheSize();
+}
+
+static void CreateVars() {
+    g_client_full_handshake =
+        new bvar::Adder<int64_t>("rpc_ssl_client_full_handshake_count");
+    g_client_resumed_handshake =
+        new bvar::Adder<int64_t>("rpc_ssl_client_resumed_handshake_count");
+    g_server_full_handshake =
+        new bvar::Adder<int64_t>("rpc_ssl_server_full_handshake_count");
+    g_server_resumed_handshake =
+        new bvar::Adder<int64_t>("rpc_ssl_server_resumed_handshake_count");
+    new bvar::PassiveStatus<size_t>("rpc_ssl_client_session_cache_size",
+                                    GetClientSessionCacheSizeFn, NULL);
+}
+
+void OnSSLHandshakeDone(SSL* ssl, bool server_mode) {
+    pthread_once(&s_create_vars_once, CreateVars);
+    const bool resumed = SSL_session_reused(ssl);
+    if (server_mode) {
+        *(resumed ? g_server_resumed_handshake : g_server_full_handshake) << 1;
+    } else {
+        *(resumed ? g_client_resumed_handshake : g_client_full_handshake) << 1;
+    }
+}
+
+// ============ Client session cache ============
+
+static const size_t SESSION_CACHE_SHARDS = 32;
+
+struct BAIDU_CACHELINE_ALIGNMENT SessionCacheShard {
+    butil::Mutex mutex;
+    std::unordered_map<std::string, SSL_SESSION*> sessions;
+};
+
+static SessionCacheShard* g_session_shards = NULL;
+static pthread_once_t s_session_shards_once = PTHREAD_ONCE_INIT;
+
+static void CreateSessionShards() {
+    g_session_shards = new SessionCacheShard[SESSION_CACHE_SHARDS];
+}
+
+static SessionCacheShard& GetSessionShard(const std::string& key) {
+    pthread_once(&s_session_shards_once, CreateSessionShards);
+    return g_session_shards[std::hash<std::string>()(key) %
+                            SESSION_CACHE_SHARDS];
+}
+
+static std::string ClientSessionKey(const butil::EndPoint& remote_side,
+                                    const std::string& sni) {
+    std::string key = butil::endpoint2str(remote_side).c_str();
+    key.push_back('/');
+    key.append(sni);
+    return key;
+}
+
+static bool IsSessionExpired(SSL_SESSION* session, int64_t now_s) {
+    return SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session)
+        <= now_s;
+}
+
+// OpenSSL marks the session of a SSL freed without SSL_shutdown (which is
+// how sockets are closed) as not resumable. Connections use copies of the
+// sessions in the cache to keep the latter resumable.
+static SSL_SESSION* CopySession(SSL_SESSION* session) {
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(OPENSSL_IS_BORINGSSL)
+    return SSL_SESSION_dup(session);
+#else
+    SSL_SESSION_up_ref(session);
+    return session;
+#endif
+}
+
+// Called by OpenSSL when a new session is established or a ticket is
+// received. Returns 0 since `new_session' is copied rather than kept.
+static int OnNewClientSession(SSL* ssl, SSL_SESSION* new_session) {
+    const size_t max_size = FLAGS_ssl_client_session_cache_size;
+    if (max_size == 0) {
+        return 0;
+    }
+    SocketUniquePtr s;
+    if (Socket::Address((SocketId)SSL_get_app_data(ssl), &s) != 0) {
+        return 0;
+    }
+    SSL_SESSION* session = CopySession(new_session);
+    if (session == NULL) {
+        return 0;
+    }
+    const char* sni = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    const std::string key =
+        ClientSessionKey(s->remote_side(), sni ? sni : "");
+    SessionCacheShard& shard = GetSessionShard(key);
+    SSL_SESSION* replaced = NULL;
+    {
+        BAIDU_SCOPED_LOCK(shard.mutex);
+        SSL_SESSION*& slot = shard.sessions[key];
+        replaced = slot;
+        slot = session;
+        if (replaced == NULL &&
+            shard.sessions.size() > max_size / SESSION_CACHE_SHARDS + 1) {
+            // Evict another session. Servers behind one shard are hardly
+            // more than the capacity, so which one is evicted matters little.
+            auto it = shard.sessions.begin();
+            if (it->first == key) {
+                ++it;
+            }
+            replaced = it->second;
+            shard.sessions.erase(it);
+        }
+    }
+    if (replaced) {
+        SSL_SESSION_free(replaced);
+    }
+    return 0;
+}
+
+void SetupClientSessionCache(SSL_CTX* ctx) {
+    // Sessions are stored by OnNewClientSession only, the internal cache
+    // of OpenSSL is not shared by SSL_CTX of different channels.
+    SSL_CTX_set_session_cache_mode(
+        ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, OnNewClientSession);
+}
+
+void ApplyCachedClientSession(SSL* ssl, const butil::EndPoint& remote_side,
+                              const std::string& sni) {
+    if (FLAGS_ssl_client_session_cache_size <= 0) {
+        return;
+    }
+    const std::string key = ClientSessionKey(remote_side, sni);
+    SessionCacheShard& shard = GetSessionShard(key);
+    SSL_SESSION* session = NULL;
+    bool expired = false;
+    {
+        BAIDU_SCOPED_LOCK(shard.mutex);
+        auto it = shard.sessions.find(key);
+        if (it == shard.sessions.end()) {
+            return;
+        }
+        session = it->second;
+        if (IsSessionExpired(session, time(NULL))) {
+            shard.sessions.erase(it);
+            expired = true;
+        } else {
+            SSL_SESSION_up_ref(session);
+        }
+    }
+    if (!expired) {
+        SSL_SESSION* copy = CopySession(session);
+        if (copy == NULL || SSL_set_session(ssl, copy) != 1) {
+            LOG(WARNING) << "Fail to set cached session: "
+                         << SSLError(ERR_get_error());
+        }
+        SSL_SESSION_free(copy);
+    }
+    SSL_SESSION_free(session);
+}
+
+void RemoveCachedClientSession(const butil::EndPoint& remote_side,
+                               const std::string& sni) {
+    const std::string key = ClientSessionKey(remote_side, sni);
+    SessionCacheShard& shard = GetSessionShard(key);
+    SSL_SESSION* session = NULL;
+    {
+        BAIDU_SCOPED_LOCK(shard.mutex);
+        auto it = shard.sessions.find(key);
+        if (it == shard.sessions.end()) {
+            return;
+        }
+        session = it->second;
+        shard.sessions.erase(it);
+    }
+    SSL_SESSION_free(session);
+}
+
+size_t GetClientSessionCacheSize() {
+    size_t n = 0;
+    for (size_t i = 0; g_session_shards && i < SESSION_CACHE_SHARDS; ++i) {
+        BAIDU_SCOPED_LOCK(g_session_shards[i].mutex);
+        n += g_session_shards[i].sessions.size();
+    }
+    return n;
+}
+
+// ============ Server session tickets ============
+
+struct TicketKey {
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+    int64_t created_s;
+};
+
+// [0] encrypts new tickets, [1] is the previous key which only decrypts.
+static TicketKey g_ticket_keys[2];
+static int g_nticket_key = 0;
+static butil::Mutex g_ticket_key_mutex;
+
+static int GenerateTicketKey(TicketKey* key, int64_t now_s) {
+    if (RAND_bytes(key->name, sizeof(key->name)) != 1 ||
+        RAND_bytes(key->aes_key, sizeof(key->aes_key)) != 1 ||
+        RAND_bytes(key->hmac_key, sizeof(key->hmac_key)) != 1) {
+        LOG(ERROR) << "Fail to generate ticket key: "
+                   << SSLError(ERR_get_error());
+        return -1;
+    }
+    key->created_s = now_s;
+    return 0;
+}
+
+// Copy the key to encrypt (when `name' is NULL) or the key named `name' into
+// `out'. Returns 0 if the current key is copied, 1 if the previous key is
+// copied, -1 if the key is not found.
+static int GetTicketKey(const unsigned char* name, TicketKey* out) {
+    const int64_t now_s = time(NULL);
+    BAIDU_SCOPED_LOCK(g_ticket_key_mutex);
+    const int64_t rotation_s = FLAGS_ssl_session_ticket_key_rotation_s;
+    if (g_nticket_key == 0 ||
+        (rotation_s > 0 && g_ticket_keys[0].created_s + rotation_s <= now_s)) {
+        TicketKey key;
+        if (GenerateTicketKey(&key, now_s) != 0) {
+            if (g_nticket_key == 0) {
+                return -1;
+            }
+        } else {
+            g_ticket_keys[1] = g_ticket_keys[0];
+            g_ticket_keys[0] = key;
+            g_nticket_key = std::min(g_nticket_key + 1, 2);
+        }
+    }
+    for (int i = 0; i < g_nticket_key; ++i) {
+        if (name == NULL ||
+            memcmp(name, g_ticket_keys[i].name, sizeof(out->name)) == 0) {
+            *out = g_ticket_keys[i];
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns 1 when the ticket is encrypted or decrypted with the current key,
+// 2 when it's decrypted with the previous key so that OpenSSL issues a new
+// ticket, 0 when the key of the ticket is not found, -1 on error.
+#ifdef BRPC_SSL_TICKET_EVP_CB
+static int TicketKeyCallback(SSL*, unsigned char* name, unsigned char* iv,
+                             EVP_CIPHER_CTX* cctx, EVP_MAC_CTX* hctx,
+                             int enc) {
+#else
+static int TicketKeyCallback(SSL*, unsigned char* name, unsigned char* iv,
+                             EVP_CIPHER_CTX* cctx, HMAC_CTX* hctx, int enc) {
+#endif
+    TicketKey key;
+    const int index = GetTicketKey(enc ? NULL : name, &key);
+    if (index < 0) {
+        return enc ? -1 : 0;
+    }
+    if (enc) {
+        memcpy(name, key.name, sizeof(key.name));
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1 ||
+            EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL,
+                               key.aes_key, iv) != 1) {
+            return -1;
+        }
+    } else if (EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL,
+                                  key.aes_key, iv) != 1) {
+        return -1;
+    }
+#ifdef BRPC_SSL_TICKET_EVP_CB
+    char digest[] = "SHA256";
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(
+            OSSL_MAC_PARAM_KEY, key.hmac_key, sizeof(key.hmac_key)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+        OSSL_PARAM_construct_end()
+    };
+    if (EVP_MAC_CTX_set_params(hctx, params) != 1) {
+        return -1;
+    }
+#else
+    if (HMAC_Init_ex(hctx, key.hmac_key, sizeof(key.hmac_key),
+                     EVP_sha256(), NULL) != 1) {
+        return -1;
+    }
+#endif
+    return (enc || index == 0) ? 1 : 2;
+}
+
+int SetupServerSessionTicket(SSL_CTX* ctx) {
+    if (FLAGS_ssl_session_ticket_key_rotation_s <= 0) {
+        return 0;
+    }
+#ifdef BRPC_SSL_TICKET_EVP_CB
+    if (SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, TicketKeyCallback) != 1) {
+#else
+    if (SSL_CTX_set_tlsext_ticket_key_cb(ctx, TicketKeyCallback) != 1) {
+#endif
+        LOG(ERROR) << "Fail to set callback of session ticket keys: "
+                   << SSLError(ERR_get_error());
+        return -1;
+    }
+    return 0;
+}
+
+#else  // USE_MESALINK
+
+void SetupClientSessionCache(SSL_CTX*) {}
+void ApplyCachedClientSession(SSL*, const butil::EndPoint&,
+                              const std::string&) {}
+void RemoveCachedClientSession(const butil::EndPoint&, const std::string&) {}
+size_t GetClientSessionCacheSize() { return 0; }
+int SetupServerSessionTicket(SSL_CTX*) { return 0; }
+void OnSSLHandshakeDone(SSL*, bool) {}
+
+#endif  // USE_MESALINK
+
+} // namespace brpc
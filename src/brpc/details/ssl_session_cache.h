@@ -0,0 +1,68 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_SSL_SESSION_CACHE_H
+#define BRPC_SSL_SESSION_CACHE_H
+
+#include <string>
+#include "butil/endpoint.h"
+#include "brpc/details/ssl_helper.h"
+
+
+namespace brpc {
+
+// Resumption of TLS sessions, which saves the asymmetric cryptography of
+// full handshakes when connections are short or reconnected frequently.
+//
+// At client side, sessions (including TLSv1.3 tickets) are kept in a
+// process-wide cache sharded by the key of remote endpoint and SNI, thus
+// shared by all channels accessing the same server. The cache holds at most
+// -ssl_client_session_cache_size sessions.
+//
+// At server side, session tickets are encrypted with keys shared by all
+// servers in the process. A new key is generated every
+// -ssl_session_ticket_key_rotation_s seconds, tickets encrypted with the
+// previous key are still accepted and renewed.
+
+// Ask `ctx' to put new sessions into the client session cache.
+void SetupClientSessionCache(SSL_CTX* ctx);
+
+// Set the session of `remote_side' and `sni' in the cache into `ssl' before
+// the handshake, if there's an unexpired one.
+void ApplyCachedClientSession(SSL* ssl, const butil::EndPoint& remote_side,
+                              const std::string& sni);
+
+// Remove the session of `remote_side' and `sni', called when a handshake
+// fails to avoid resuming a rejected session again.
+void RemoveCachedClientSession(const butil::EndPoint& remote_side,
+                               const std::string& sni);
+
+// Number of sessions in the client session cache.
+size_t GetClientSessionCacheSize();
+
+// Encrypt and decrypt session tickets of `ctx' with the rotated keys.
+// Returns 0 on success, -1 otherwise.
+int SetupServerSessionTicket(SSL_CTX* ctx);
+
+// Count the completed handshake of `ssl' as a full or a resumed one.
+void OnSSLHandshakeDone(SSL* ssl, bool server_mode);
+
+} // namespace brpc
+
+
+#endif // BRPC_SSL_SESSION_CACHE_H
@@ -0,0 +1,133 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gflags/gflags.h>
+#include "butil/logging.h"
+#include "bthread/bthread.h"
+#include "brpc/socket.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/stream_write_scheduler.h"
+
+namespace brpc {
+
+DEFINE_int32(stream_write_quantum, 0,
+             "When positive, streams on the same connection take turns to "
+             "write at most write_weight * this many bytes, so that bulk "
+             "streams don't starve other streams. 0 disables the scheduling "
+             "for streams created afterwards");
+BRPC_VALIDATE_GFLAG(stream_write_quantum, NonNegativeInteger);
+
+DEFINE_int64(stream_write_max_unwritten_bytes, 1024 * 1024,
+             "Scheduled stream frames are held while the connection has more "
+             "unwritten bytes than this");
+
+struct DrainArg {
+    StreamWriteScheduler* scheduler;
+    Socket* host;   // referenced
+};
+
+void StreamWriteScheduler::Write(Socket* host, StreamId id, int weight,
+                                 butil::IOBuf* frames) {
+    bool start_drain = false;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        Flow& f = _flows[id];
+        if (f.chunks.empty()) {
+            f.deficit = 0;
+            _round.push_back(id);
+        }
+        f.weight = std::max(weight, 1);
+        f.chunks.push_back(butil::IOBuf());
+        f.chunks.back().swap(*frames);
+        if (!_draining) {
+            _draining = true;
+            start_drain = true;
+        }
+    }
+    if (!start_drain) {
+        return;
+    }
+    SocketUniquePtr ptr;
+    host->ReAddress(&ptr);
+    DrainArg* arg = new DrainArg;
+    arg->scheduler = this;
+    arg->host = ptr.release();
+    bthread_t th;
+    if (bthread_start_background(&th, &BTHREAD_ATTR_NORMAL, RunDrain, arg) != 0) {
+        LOG(ERROR) << "Fail to start bthread";
+        RunDrain(arg);
+    }
+}
+
+void* StreamWriteScheduler::RunDrain(void* void_arg) {
+    DrainArg* arg = static_cast<DrainArg*>(void_arg);
+    SocketUniquePtr host(arg->host);
+    StreamWriteScheduler* scheduler = arg->scheduler;
+    delete arg;
+    scheduler->Drain(host.get());
+    return NULL;
+}
+
+void StreamWriteScheduler::Drain(Socket* host) {
+    butil::IOBuf out;
+    while (true) {
+        // Frames written into the connection can't be reordered anymore,
+        // wait for the connection to be less busy.
+        int sleep_time = 50;
+        while (host->_unwritten_bytes.load(butil::memory_order_relaxed) >
+               FLAGS_stream_write_max_unwritten_bytes && !host->Failed()) {
+            bthread_usleep(sleep_time);
+            sleep_time = std::min(sleep_time * 2, 1000);
+        }
+        {
+            BAIDU_SCOPED_LOCK(_mutex);
+            if (_round.empty()) {
+                _draining = false;
+                return;
+            }
+            const StreamId id = _round.front();
+            _round.pop_front();
+            Flow& f = _flows[id];
+            f.deficit += (int64_t)std::max(FLAGS_stream_write_quantum, 1) * f.weight;
+            if (_round.empty()) {
+                // No one else to wait for.
+                f.deficit = std::max(f.deficit, (int64_t)f.chunks.front().size());
+            }
+            while (!f.chunks.empty() &&
+                   (int64_t)f.chunks.front().size() <= f.deficit) {
+                f.deficit -= f.chunks.front().size();
+                out.append(butil::IOBuf::Movable(f.chunks.front()));
+                f.chunks.pop_front();
+            }
+            if (f.chunks.empty()) {
+                _flows.erase(id);
+            } else {
+                _round.push_back(id);
+            }
+        }
+        if (!out.empty()) {
+            Socket::WriteOptions wopt;
+            wopt.ignore_eovercrowded = true;
+            if (host->Write(&out, &wopt) != 0) {
+                out.clear();
+            }
+        }
+    }
+}
+
+} // namespace brpc
@@ -0,0 +1,70 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_STREAM_WRITE_SCHEDULER_H
+#define BRPC_DETAILS_STREAM_WRITE_SCHEDULER_H
+
+#include <deque>
+#include <unordered_map>
+#include "butil/iobuf.h"
+#include "butil/macros.h"
+#include "butil/synchronization/lock.h"
+#include "brpc/stream.h"
+
+namespace brpc {
+
+class Socket;
+
+// Streams sharing a connection take turns to write frames into it with
+// deficit round-robin: in each turn a stream writes at most
+// weight * -stream_write_quantum bytes (plus what it saved from previous
+// turns). Frames are held here while the connection has enough unwritten
+// data, so that a bulk stream can't fill the connection and starve others.
+class StreamWriteScheduler {
+public:
+    StreamWriteScheduler() : _draining(false) {}
+
+    // Queue frames of stream `id' to be written into `host', `frames' is
+    // cleared. Frames of a stream are written in the same order.
+    void Write(Socket* host, StreamId id, int weight, butil::IOBuf* frames);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(StreamWriteScheduler);
+
+    struct Flow {
+        int weight;
+        int64_t deficit;
+        std::deque<butil::IOBuf> chunks;
+    };
+
+    static void* RunDrain(void* arg);
+    void Drain(Socket* host);
+
+    butil::Mutex _mutex;
+    // Streams having frames to write.
+    std::unordered_map<StreamId, Flow> _flows;
+    // Turns of the streams in _flows.
+    std::deque<StreamId> _round;
+    // Whether a bthread is writing queued frames.
+    bool _draining;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_DETAILS_STREAM_WRITE_SCHEDULER_H
@@ -68,3 +68,34 @@ bool has_TCMALLOC_SAMPLE_PARAMETER() {
     static bool val = check_TCMALLOC_SAMPLE_PARAMETER();
     return val;
 }
+
+namespace {
+// Same as MallocHook_NewHook in gperftools/malloc_hook_c.h
+typedef void (*NewHook)(const void* ptr, size_t size);
+typedef int (*AddNewHookFn)(NewHook hook);
+static pthread_once_t g_add_new_hook_once = PTHREAD_ONCE_INIT;
+static bool g_new_hook_added = false;
+static __thread uint64_t tls_allocated_bytes = 0;
+
+static void CountAllocatedBytes(const void*, size_t size) {
+    tls_allocated_bytes += size;
+}
+
+static void AddNewHook() {
+    AddNewHookFn fn = (AddNewHookFn)dlsym(
+        RTLD_DEFAULT, "MallocHook_AddNewHook");
+    g_new_hook_added = (fn != NULL && fn(CountAllocatedBytes));
+}
+} // namespace
+
+bool EnableTCMallocThreadAllocatedBytes() {
+    if (!IsTCMallocEnabled()) {
+        return false;
+    }
+    pthread_once(&g_add_new_hook_once, AddNewHook);
+    return g_new_hook_added;
+}
+
+uint64_t TCMallocThreadAllocatedBytes() {
+    return tls_allocated_bytes;
+}
@@ -319,3 +319,10 @@ bool IsTCMallocEnabled();
 
 // True iff TCMALLOC_SAMPLE_PARAMETER is set in environment.
 bool has_TCMALLOC_SAMPLE_PARAMETER();
+
+// Count bytes allocated by each thread with a new-hook of tcmalloc, which
+// costs a little for every allocation. Returns true on success.
+bool EnableTCMallocThreadAllocatedBytes();
+
+// Bytes allocated by the calling thread since the counting was enabled.
+uint64_t TCMallocThreadAllocatedBytes();
@@ -0,0 +1,299 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <sys/socket.h>
+#include <gflags/gflags.h>
+#include "butil/build_config.h"                  // OS_LINUX
+#include "butil/fd_guard.h"
+#include "butil/thread_local.h"
+#include "butil/time.h"
+#include "bthread/unstable.h"                    // bthread_flush
+#include "brpc/reloadable_flags.h"
+#include "brpc/policy/baidu_rpc_protocol.h"
+#include "brpc/details/udp_listener.h"
+
+
+namespace brpc {
+
+DEFINE_int32(udp_batch_size, 16, "Max number of datagrams received by one"
+             " recvmmsg() or sent by one sendmmsg()");
+BRPC_VALIDATE_GFLAG(udp_batch_size, PositiveInteger);
+
+DEFINE_int32(udp_max_datagram_size, 65507, "Max size of datagrams carrying"
+             " one-way requests, larger datagrams are dropped by servers and"
+             " rejected by UdpChannel");
+BRPC_VALIDATE_GFLAG(udp_max_datagram_size, PositiveInteger);
+
+namespace {
+struct UdpRequest {
+    const Server* server;
+    SocketUniquePtr socket;
+    butil::EndPoint remote_side;
+    butil::IOBuf datagram;
+    int64_t received_us;
+};
+
+// Datagrams are copied out of the buffer before the reading bthread may
+// yield, so a buffer per pthread is enough.
+struct RecvBuffer {
+    char* data;
+    size_t capacity;
+};
+BAIDU_THREAD_LOCAL RecvBuffer* tls_recv_buf = NULL;
+
+void DeleteRecvBuffer(void* arg) {
+    RecvBuffer* buf = static_cast<RecvBuffer*>(arg);
+    free(buf->data);
+    delete buf;
+}
+
+char* GetRecvBuffer(size_t size) {
+    RecvBuffer* buf = tls_recv_buf;
+    if (buf == NULL) {
+        buf = new RecvBuffer{NULL, 0};
+        tls_recv_buf = buf;
+        butil::thread_atexit(DeleteRecvBuffer, buf);
+    }
+    if (buf->capacity < size) {
+        free(buf->data);
+        buf->data = static_cast<char*>(malloc(size));
+        buf->capacity = (buf->data ? size : 0);
+    }
+    return buf->data;
+}
+} // namespace
+
+static void* ProcessUdpRequest(void* arg) {
+    std::unique_ptr<UdpRequest> req(static_cast<UdpRequest*>(arg));
+    policy::ProcessRpcDatagram(req->server, &req->socket, req->remote_side,
+                               &req->datagram, req->received_us);
+    return NULL;
+}
+
+static int udp_bind(const butil::EndPoint& point, bool reuse_port) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = 0;
+    if (butil::endpoint2sockaddr(point, &addr, &addr_len) != 0) {
+        return -1;
+    }
+    butil::fd_guard sockfd(socket(addr.ss_family, SOCK_DGRAM, 0));
+    if (sockfd < 0) {
+        return -1;
+    }
+    if (reuse_port) {
+#if defined(SO_REUSEPORT)
+        const int on = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+            return -1;
+        }
+#else
+        LOG(ERROR) << "SO_REUSEPORT is not supported";
+        return -1;
+#endif
+    }
+    if (bind(sockfd, (struct sockaddr*)&addr, addr_len) != 0) {
+        return -1;
+    }
+    return sockfd.release();
+}
+
+UdpListener::UdpListener(const Server* server)
+    : _server(server)
+    , _bthread_tag(BTHREAD_TAG_DEFAULT)
+    , _cond(&_mutex)
+    , _nalive(0) {}
+
+UdpListener::~UdpListener() {
+    Stop();
+    Join();
+}
+
+int UdpListener::Start(const butil::EndPoint& point, int nsockets,
+                       bool reuse_port, bthread_tag_t tag, int* bound_port) {
+    _bthread_tag = tag;
+    butil::EndPoint bound_point = point;
+    reuse_port = (reuse_port || nsockets > 1);
+    for (int i = 0; i < nsockets; ++i) {
+        butil::fd_guard sockfd(udp_bind(bound_point, reuse_port));
+        if (sockfd < 0) {
+            PLOG(ERROR) << "Fail to bind udp " << bound_point;
+            break;
+        }
+        if (bound_point.port == 0) {
+            butil::EndPoint local_side;
+            if (butil::get_local_side(sockfd, &local_side) != 0) {
+                PLOG(ERROR) << "Fail to get port of udp fd=" << sockfd;
+                break;
+            }
+            // Other sockets share the port of the first one.
+            bound_point.port = local_side.port;
+        }
+        SocketOptions options;
+        // Ownership of the fd is transferred to the socket.
+        options.fd = sockfd.release();
+        options.user = this;
+        options.bthread_tag = tag;
+        if (nsockets > 1) {
+            options.event_dispatcher_index = i;
+        }
+        options.on_edge_triggered_events = OnNewDatagrams;
+        SocketId id;
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (Socket::Create(options, &id) != 0) {
+            LOG(ERROR) << "Fail to create udp socket of fd=" << options.fd;
+            break;
+        }
+        _socket_ids.push_back(id);
+        ++_nalive;
+    }
+    if (_socket_ids.size() != (size_t)nsockets) {
+        Stop();
+        Join();
+        return -1;
+    }
+    if (bound_port) {
+        *bound_port = bound_point.port;
+    }
+    return 0;
+}
+
+void UdpListener::Stop() {
+    std::vector<SocketId> ids;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        ids.swap(_socket_ids);
+    }
+    for (size_t i = 0; i < ids.size(); ++i) {
+        Socket::SetFailed(ids[i]);
+    }
+}
+
+void UdpListener::Join() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    while (_nalive > 0) {
+        _cond.Wait();
+    }
+}
+
+void UdpListener::BeforeRecycle(Socket*) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (--_nalive == 0) {
+        _cond.Broadcast();
+    }
+}
+
+void UdpListener::OnNewDatagramsUntilEAGAIN(Socket* sock) {
+    const size_t max_size = FLAGS_udp_max_datagram_size;
+    const int batch_size = FLAGS_udp_batch_size;
+    // One more byte to detect truncated datagrams on systems without
+    // MSG_TRUNC in msg_flags.
+    const size_t slot_size = max_size + 1;
+    char* buf = GetRecvBuffer(slot_size * batch_size);
+    if (buf == NULL) {
+        LOG(ERROR) << "Fail to allocate buffer for datagrams";
+        return;
+    }
+    std::vector<struct sockaddr_storage> addrs(batch_size);
+    std::vector<struct iovec> iovs(batch_size);
+    std::vector<socklen_t> addr_lens(batch_size);
+    std::vector<size_t> lens(batch_size);
+#if defined(OS_LINUX)
+    std::vector<struct mmsghdr> msgs(batch_size);
+#endif
+    while (true) {
+        int n = 0;
+#if defined(OS_LINUX)
+        for (int i = 0; i < batch_size; ++i) {
+            iovs[i].iov_base = buf + i * slot_size;
+            iovs[i].iov_len = slot_size;
+            struct msghdr& hdr = msgs[i].msg_hdr;
+            hdr.msg_name = &addrs[i];
+            hdr.msg_namelen = sizeof(addrs[i]);
+            hdr.msg_iov = &iovs[i];
+            hdr.msg_iovlen = 1;
+        }
+        n = recvmmsg(sock->fd(), &msgs[0], batch_size, MSG_DONTWAIT, NULL);
+        for (int i = 0; i < n; ++i) {
+            lens[i] = msgs[i].msg_len;
+            addr_lens[i] = msgs[i].msg_hdr.msg_namelen;
+        }
+#else
+        addr_lens[0] = sizeof(addrs[0]);
+        const ssize_t nr = recvfrom(sock->fd(), buf, slot_size, MSG_DONTWAIT,
+                                    (struct sockaddr*)&addrs[0], &addr_lens[0]);
+        if (nr >= 0) {
+            lens[0] = nr;
+            n = 1;
+        } else {
+            n = -1;
+        }
+#endif
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            // Errors of previous sends (e.g. ICMP unreachable) may be
+            // reported here, keep reading.
+            PLOG_EVERY_SECOND(WARNING) << "Fail to receive from udp fd="
+                                       << sock->fd();
+            continue;
+        }
+        const int64_t received_us = butil::cpuwide_time_us();
+        bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+        attr.flags |= BTHREAD_NOSIGNAL;
+        attr.tag = _bthread_tag;
+        for (int i = 0; i < n; ++i) {
+            butil::EndPoint remote_side;
+            butil::sockaddr2endpoint(&addrs[i], addr_lens[i], &remote_side);
+            if (lens[i] > max_size) {
+                LOG_EVERY_SECOND(WARNING)
+                    << "Drop datagram larger than -udp_max_datagram_size="
+                    << max_size << " from " << remote_side;
+                continue;
+            }
+            UdpRequest* req = new UdpRequest;
+            req->server = _server;
+            sock->ReAddress(&req->socket);
+            req->remote_side = remote_side;
+            req->datagram.append(buf + i * slot_size, lens[i]);
+            req->received_us = received_us;
+            bthread_t th;
+            if (bthread_start_background(&th, &attr, ProcessUdpRequest, req) != 0) {
+                LOG(FATAL) << "Fail to start bthread";
+                ProcessUdpRequest(req);
+            }
+        }
+        bthread_flush();
+    }
+}
+
+void UdpListener::OnNewDatagrams(Socket* sock) {
+    UdpListener* listener = static_cast<UdpListener*>(sock->user());
+    int progress = Socket::PROGRESS_INIT;
+    do {
+        listener->OnNewDatagramsUntilEAGAIN(sock);
+        if (sock->Failed()) {
+            return;
+        }
+    } while (sock->MoreReadEvents(&progress));
+}
+
+} // namespace brpc
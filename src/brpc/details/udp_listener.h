@@ -0,0 +1,77 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_UDP_LISTENER_H
+#define BRPC_UDP_LISTENER_H
+
+#include <vector>
+#include "bthread/types.h"                        // bthread_tag_t
+#include "butil/endpoint.h"
+#include "butil/synchronization/condition_variable.h"
+#include "brpc/socket.h"
+
+
+namespace brpc {
+
+class Server;
+
+// Receive one-way baidu_std requests in UDP datagrams for a server
+// (ServerOptions.udp_port). Each UDP socket is added into an EventDispatcher
+// like listened TCP sockets; datagrams are read in batches with recvmmsg
+// until EAGAIN and each of them is processed in a new bthread. When more
+// than one socket is bound with SO_REUSEPORT, the kernel spreads datagrams
+// over the sockets by source address and the i-th socket is handled by the
+// i-th EventDispatcher.
+class UdpListener : public SocketUser {
+public:
+    explicit UdpListener(const Server* server);
+    ~UdpListener();
+
+    // Bind `nsockets' UDP sockets to `point', with SO_REUSEPORT if
+    // `nsockets' > 1 or `reuse_port' is true. A port is chosen by kernel
+    // if point.port is 0, which is stored into `bound_port'.
+    // Returns 0 on success, -1 otherwise.
+    int Start(const butil::EndPoint& point, int nsockets, bool reuse_port,
+              bthread_tag_t tag, int* bound_port);
+
+    // Stop receiving datagrams. Requests being processed are not affected.
+    void Stop();
+
+    // Wait until all sockets are recycled, namely all requests received
+    // from them are done.
+    void Join();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(UdpListener);
+
+    void BeforeRecycle(Socket*) override;
+    static void OnNewDatagrams(Socket* sock);
+    void OnNewDatagramsUntilEAGAIN(Socket* sock);
+
+    const Server* _server;
+    bthread_tag_t _bthread_tag;
+    butil::Mutex _mutex;
+    butil::ConditionVariable _cond;
+    std::vector<SocketId> _socket_ids;
+    int _nalive;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_UDP_LISTENER_H
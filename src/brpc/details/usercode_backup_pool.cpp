@@ -20,7 +20,9 @@
 #include <vector>
 #include <gflags/gflags.h>
 #include "butil/scoped_lock.h"
+#include "butil/time.h"
 #include "butil/threading/platform_thread.h"
+#include "bvar/bvar.h"
 #ifdef BAIDU_INTERNAL
 #include "butil/comlog_sink.h"
 #endif
@@ -39,27 +41,52 @@ DEFINE_int32(usercode_backup_threads, 5, "# of backup threads to run user code"
 DEFINE_int32(max_pending_in_each_backup_thread, 10,
              "Max number of un-run user code in each backup thread, requests"
              " still coming in will be failed");
+DEFINE_int32(usercode_backup_max_threads, 0,
+             "Backup threads grow up to this number when user code waits "
+             "in the queue for more than -usercode_backup_grow_wait_us and "
+             "all backup threads are busy. Threads more than "
+             "-usercode_backup_threads quit after being idle for "
+             "-usercode_backup_idle_s seconds. No growth if this value is not "
+             "larger than -usercode_backup_threads");
+DEFINE_int32(usercode_backup_grow_wait_us, 5000,
+             "Add a backup thread when user code waits for so many "
+             "microseconds in the queue, see -usercode_backup_max_threads");
+DEFINE_int32(usercode_backup_idle_s, 30,
+             "Backup threads added by -usercode_backup_max_threads quit after "
+             "being idle for so many seconds");
 
 // Store pending user code.
 struct UserCode {
     void (*fn)(void*);
     void* arg;
+    int64_t enqueue_us;
 };
 struct UserCodeBackupPool {
     // Run user code when parallelism of user code reaches the threshold
     std::deque<UserCode> queue;
+    // Number of backup threads and the ones waiting for user code.
+    int nthread;
+    int nidle;
     bvar::PassiveStatus<int> inplace_var;
     bvar::PassiveStatus<size_t> queue_size_var;
+    bvar::PassiveStatus<int> nthread_var;
+    bvar::PassiveStatus<int> nidle_var;
     bvar::Adder<size_t> inpool_count;
     bvar::PerSecond<bvar::Adder<size_t> > inpool_per_second;
     // NOTE: we don't use Adder<double> directly which does not compile in gcc 3.4
     bvar::Adder<int64_t> inpool_elapse_us;
     bvar::PassiveStatus<double> inpool_elapse_s;
     bvar::PerSecond<bvar::PassiveStatus<double> > pool_usage;
+    // Time that user code waits in the queue.
+    bvar::LatencyRecorder queue_wait;
 
     UserCodeBackupPool();
     int Init();
     void UserCodeRunningLoop();
+    // Returns true if a thread should be added, in which case `nthread'
+    // is increased already. Called with s_usercode_mutex held.
+    bool ShouldGrow(int64_t now_us);
+    void AddThread();
 };
 
 static pthread_mutex_t s_usercode_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -82,13 +109,32 @@ static double GetInPoolElapseInSecond(void* arg) {
     return static_cast<bvar::Adder<int64_t>*>(arg)->get_value() / 1000000.0;
 }
 
+static int GetUserCodeThreadCount(void* arg) {
+    BAIDU_SCOPED_LOCK(s_usercode_mutex);
+    return *static_cast<int*>(arg);
+}
+
 UserCodeBackupPool::UserCodeBackupPool()
-    : inplace_var("rpc_usercode_inplace", GetUserCodeInPlace, NULL)
+    : nthread(0)
+    , nidle(0)
+    , inplace_var("rpc_usercode_inplace", GetUserCodeInPlace, NULL)
     , queue_size_var("rpc_usercode_queue_size", GetUserCodeQueueSize, NULL)
+    , nthread_var("rpc_usercode_backup_threads", GetUserCodeThreadCount,
+                  &nthread)
+    , nidle_var("rpc_usercode_backup_idle_threads", GetUserCodeThreadCount,
+                &nidle)
     , inpool_count("rpc_usercode_backup_count")
     , inpool_per_second("rpc_usercode_backup_second", &inpool_count)
     , inpool_elapse_s(GetInPoolElapseInSecond, &inpool_elapse_us)
-    , pool_usage("rpc_usercode_backup_usage", &inpool_elapse_s, 1) {
+    , pool_usage("rpc_usercode_backup_usage", &inpool_elapse_s, 1)
+    , queue_wait("rpc_usercode_backup_queue_wait") {
+}
+
+// Max number of pending user code before g_too_many_usercode is set.
+static int MaxPendingUserCode() {
+    return std::max(FLAGS_usercode_backup_threads,
+                    FLAGS_usercode_backup_max_threads) *
+        FLAGS_max_pending_in_each_backup_thread;
 }
 
 static void* UserCodeRunner(void* args) {
@@ -106,10 +152,37 @@ int UserCodeBackupPool::Init() {
             LOG(ERROR) << "Fail to create UserCodeRunner";
             return -1;
         }
+        BAIDU_SCOPED_LOCK(s_usercode_mutex);
+        ++nthread;
     }
     return 0;
 }
 
+bool UserCodeBackupPool::ShouldGrow(int64_t now_us) {
+    if (nidle != 0 || queue.empty() ||
+        nthread >= FLAGS_usercode_backup_max_threads ||
+        now_us - queue.front().enqueue_us < FLAGS_usercode_backup_grow_wait_us) {
+        return false;
+    }
+    ++nthread;
+    return true;
+}
+
+void UserCodeBackupPool::AddThread() {
+    // Threads beyond -usercode_backup_threads may quit, don't join them.
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t th;
+    const int rc = pthread_create(&th, &attr, UserCodeRunner, this);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        LOG(ERROR) << "Fail to create UserCodeRunner: " << berror(rc);
+        BAIDU_SCOPED_LOCK(s_usercode_mutex);
+        --nthread;
+    }
+}
+
 // Entry of backup thread for running user code.
 void UserCodeBackupPool::UserCodeRunningLoop() {
     bthread::run_worker_startfn();
@@ -120,21 +193,45 @@ void UserCodeBackupPool::UserCodeRunningLoop() {
     int64_t last_time = butil::cpuwide_time_us();
     while (true) {
         bool blocked = false;
-        UserCode usercode = { NULL, NULL };
+        bool grow = false;
+        int64_t dequeue_us = 0;
+        UserCode usercode = { NULL, NULL, 0 };
         {
             BAIDU_SCOPED_LOCK(s_usercode_mutex);
             while (queue.empty()) {
-                pthread_cond_wait(&s_usercode_cond, &s_usercode_mutex);
+                ++nidle;
+                const int64_t idle_s = FLAGS_usercode_backup_idle_s;
+                int rc = 0;
+                if (nthread > FLAGS_usercode_backup_threads && idle_s > 0) {
+                    const timespec abstime =
+                        butil::seconds_from_now(idle_s);
+                    rc = pthread_cond_timedwait(
+                        &s_usercode_cond, &s_usercode_mutex, &abstime);
+                } else {
+                    pthread_cond_wait(&s_usercode_cond, &s_usercode_mutex);
+                }
+                --nidle;
                 blocked = true;
+                if (rc == ETIMEDOUT && queue.empty() &&
+                    nthread > FLAGS_usercode_backup_threads) {
+                    --nthread;
+                    return;
+                }
             }
             usercode = queue.front();
             queue.pop_front();
             if (g_too_many_usercode &&
-                (int)queue.size() <= FLAGS_usercode_backup_threads) {
+                (int)queue.size() <= nthread) {
                 g_too_many_usercode = false;
             }
+            dequeue_us = butil::cpuwide_time_us();
+            grow = ShouldGrow(dequeue_us);
+        }
+        if (grow) {
+            AddThread();
         }
-        const int64_t begin_time = (blocked ? butil::cpuwide_time_us() : last_time);
+        queue_wait << (dequeue_us - usercode.enqueue_us);
+        const int64_t begin_time = (blocked ? dequeue_us : last_time);
         usercode.fn(usercode.arg);
         const int64_t end_time = butil::cpuwide_time_us();
         inpool_count << 1;
@@ -166,7 +263,8 @@ void EndRunningUserCodeInPool(void (*fn)(void*), void* arg) {
     // Not enough idle workers, run the code in backup threads to prevent
     // all workers from being blocked and no responses will be processed
     // anymore (deadlocked).
-    const UserCode usercode = { fn, arg };
+    const int64_t now_us = butil::cpuwide_time_us();
+    const UserCode usercode = { fn, arg, now_us };
     pthread_mutex_lock(&s_usercode_mutex);
     s_usercode_pool->queue.push_back(usercode);
     // If the queue has too many items, we can't drop the user code
@@ -174,13 +272,15 @@ void EndRunningUserCodeInPool(void (*fn)(void*), void* arg) {
     // The solution is that we set a mark which is not cleared before
     // queue becomes short again. RPC code checks the mark before
     // submitting tasks that may generate more user code.
-    if ((int)s_usercode_pool->queue.size() >=
-        (FLAGS_usercode_backup_threads *
-         FLAGS_max_pending_in_each_backup_thread)) {
+    if ((int)s_usercode_pool->queue.size() >= MaxPendingUserCode()) {
         g_too_many_usercode = true;
     }
+    const bool grow = s_usercode_pool->ShouldGrow(now_us);
     pthread_mutex_unlock(&s_usercode_mutex);
     pthread_cond_signal(&s_usercode_cond);
+    if (grow) {
+        s_usercode_pool->AddThread();
+    }
 }
 
 } // namespace brpc
@@ -16,12 +16,19 @@
 // under the License.
 
 
+#include <vector>
 #include <gflags/gflags.h>                            // DEFINE_int32
 #include "butil/compat.h"
 #include "butil/fd_utility.h"                         // make_close_on_exec
 #include "butil/logging.h"                            // LOG
+#include "butil/scoped_lock.h"                        // BAIDU_SCOPED_LOCK
+#include "butil/string_printf.h"                      // string_printf
 #include "butil/third_party/murmurhash3/murmurhash3.h"// fmix32
+#include "butil/time.h"                               // cpuwide_time_us
 #include "bvar/latency_recorder.h"                    // bvar::LatencyRecorder
+#include "bvar/reducer.h"                             // bvar::Adder
+#include "bvar/window.h"                              // bvar::Window
+#include "bvar/passive_status.h"                      // bvar::PassiveStatus
 #include "bthread/bthread.h"                          // bthread_start_background
 #include "brpc/event_dispatcher.h"
 
@@ -36,11 +43,79 @@ DEFINE_bool(usercode_in_pthread, false,
 DEFINE_bool(usercode_in_coroutine, false,
             "User's callback are run in coroutine, no bthread or pthread blocking call");
 
+DEFINE_bool(event_dispatcher_load_aware, false,
+            "Add new fds (mostly connections) into the EventDispatcher of the "
+            "same bthread tag handling the fewest events per second instead "
+            "of the one chosen by hashing the fd, so that busy connections "
+            "are not crowded in a few dispatchers. Effective when "
+            "-event_dispatcher_num > 1");
+
 static EventDispatcher* g_edisp = NULL;
 static bvar::LatencyRecorder* g_edisp_read_lantency = NULL;
 static bvar::LatencyRecorder* g_edisp_write_lantency = NULL;
 static pthread_once_t g_edisp_once = PTHREAD_ONCE_INIT;
 
+// Statistics of the busy-poll mode, see -event_dispatcher_busy_poll_us.
+struct BusyPollVars {
+    // Spins ended with events.
+    bvar::Adder<int64_t> spin;
+    // Spins ended without events.
+    bvar::Adder<int64_t> spin_miss;
+    // Waits blocked in the kernel.
+    bvar::Adder<int64_t> park;
+    bvar::Window<bvar::Adder<int64_t> > spin_window;
+    bvar::Window<bvar::Adder<int64_t> > park_window;
+    // Ratio of events caught by spinning in last 10 seconds.
+    bvar::PassiveStatus<double> spin_ratio;
+
+    BusyPollVars()
+        : spin("event_dispatcher_spin_count")
+        , spin_miss("event_dispatcher_spin_miss_count")
+        , park("event_dispatcher_park_count")
+        , spin_window(&spin, 10)
+        , park_window(&park, 10)
+        , spin_ratio("event_dispatcher_spin_ratio", GetSpinRatio, this) {}
+
+    static double GetSpinRatio(void* arg) {
+        BusyPollVars* v = static_cast<BusyPollVars*>(arg);
+        const int64_t nspin = v->spin_window.get_value();
+        const int64_t total = nspin + v->park_window.get_value();
+        return total > 0 ? (double)nspin / total : 0;
+    }
+};
+static BusyPollVars* g_edisp_busy_poll_vars = NULL;
+
+// Load of an EventDispatcher, exposed as event_dispatcher_<i>_event_second
+// and event_dispatcher_<i>_consumer_count where i is the index in g_edisp.
+struct EventDispatcherVars {
+    bvar::PassiveStatus<int64_t> event_count;
+    bvar::PerSecond<bvar::PassiveStatus<int64_t> > event_second;
+    bvar::PassiveStatus<int> consumer_count;
+    // Consumers assigned by PickEventDispatcherIndex() since the last
+    // refresh of g_load_refreshed_us, whose events are not reflected in
+    // `event_second' yet.
+    int recently_picked;
+
+    EventDispatcherVars(EventDispatcher* d, int index)
+        : event_count(GetEventCount, d)
+        , event_second(butil::string_printf(
+              "event_dispatcher_%d_event_second", index), &event_count)
+        , consumer_count(butil::string_printf(
+              "event_dispatcher_%d_consumer_count", index),
+              GetConsumerCount, d)
+        , recently_picked(0) {}
+
+    static int64_t GetEventCount(void* arg) {
+        return static_cast<EventDispatcher*>(arg)->event_count();
+    }
+    static int GetConsumerCount(void* arg) {
+        return static_cast<EventDispatcher*>(arg)->consumer_count();
+    }
+};
+static std::vector<EventDispatcherVars*>* g_edisp_vars = NULL;
+static pthread_mutex_t g_load_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int64_t g_load_refreshed_us = 0;
+
 static void StopAndJoinGlobalDispatchers() {
     for (int i = 0; i < FLAGS_task_group_ntags; ++i) {
         for (int j = 0; j < FLAGS_event_dispatcher_num; ++j) {
@@ -50,11 +125,17 @@ static void StopAndJoinGlobalDispatchers() {
     }
     delete g_edisp_read_lantency;
     delete g_edisp_write_lantency;
+    delete g_edisp_busy_poll_vars;
+    for (size_t i = 0; i < g_edisp_vars->size(); ++i) {
+        delete (*g_edisp_vars)[i];
+    }
+    delete g_edisp_vars;
 }
 
 void InitializeGlobalDispatchers() {
     g_edisp_read_lantency = new bvar::LatencyRecorder("event_dispatcher_read_latency");
     g_edisp_write_lantency = new bvar::LatencyRecorder("event_dispatcher_write_latency");
+    g_edisp_busy_poll_vars = new BusyPollVars;
 
     g_edisp = new EventDispatcher[FLAGS_task_group_ntags * FLAGS_event_dispatcher_num];
     for (int i = 0; i < FLAGS_task_group_ntags; ++i) {
@@ -65,20 +146,74 @@ void InitializeGlobalDispatchers() {
             CHECK_EQ(0, g_edisp[i * FLAGS_event_dispatcher_num + j].Start(&attr));
         }
     }
+    g_edisp_vars = new std::vector<EventDispatcherVars*>;
+    for (int i = 0; i < FLAGS_task_group_ntags * FLAGS_event_dispatcher_num; ++i) {
+        g_edisp_vars->push_back(new EventDispatcherVars(&g_edisp[i], i));
+    }
     // This atexit is will be run before g_task_control.stop() because above
     // Start() initializes g_task_control by creating bthread (to run epoll/kqueue).
     CHECK_EQ(0, atexit(StopAndJoinGlobalDispatchers));
 }
 
-EventDispatcher& GetGlobalEventDispatcher(int fd, bthread_tag_t tag) {
+EventDispatcher& GetGlobalEventDispatcher(int fd, bthread_tag_t tag,
+                                          int index) {
     pthread_once(&g_edisp_once, InitializeGlobalDispatchers);
     if (FLAGS_task_group_ntags == 1 && FLAGS_event_dispatcher_num == 1) {
         return g_edisp[0];
     }
-    int index = butil::fmix32(fd) % FLAGS_event_dispatcher_num;
+    if (index < 0) {
+        index = butil::fmix32(fd) % FLAGS_event_dispatcher_num;
+    } else {
+        index %= FLAGS_event_dispatcher_num;
+    }
     return g_edisp[tag * FLAGS_event_dispatcher_num + index];
 }
 
+int PickEventDispatcherIndex(bthread_tag_t tag) {
+    const int n = FLAGS_event_dispatcher_num;
+    if (!FLAGS_event_dispatcher_load_aware || n <= 1) {
+        return -1;
+    }
+    pthread_once(&g_edisp_once, InitializeGlobalDispatchers);
+    EventDispatcherVars** vars = &(*g_edisp_vars)[tag * n];
+    BAIDU_SCOPED_LOCK(g_load_mutex);
+    const int64_t now_us = butil::cpuwide_time_us();
+    if (now_us - g_load_refreshed_us >= 1000000L) {
+        // event_second has been sampled again.
+        g_load_refreshed_us = now_us;
+        for (int i = 0; i < n; ++i) {
+            vars[i]->recently_picked = 0;
+        }
+    }
+    int64_t total_rate = 0;
+    int64_t total_consumers = 0;
+    for (int i = 0; i < n; ++i) {
+        total_rate += vars[i]->event_second.get_value(1);
+        total_consumers += vars[i]->consumer_count.get_value();
+    }
+    // Consumers picked recently are assumed to be as busy as an average
+    // one, otherwise a burst of new connections would all go to the same
+    // dispatcher before its rate is sampled.
+    const double avg_rate = std::max(
+        (double)total_rate / std::max(total_consumers, (int64_t)1), 1.0);
+    int best = 0;
+    double best_load = 0;
+    int best_consumers = 0;
+    for (int i = 0; i < n; ++i) {
+        const double load = vars[i]->event_second.get_value(1) +
+            vars[i]->recently_picked * avg_rate;
+        const int consumers = vars[i]->consumer_count.get_value();
+        if (i == 0 || load < best_load ||
+            (load == best_load && consumers < best_consumers)) {
+            best = i;
+            best_load = load;
+            best_consumers = consumers;
+        }
+    }
+    ++vars[best]->recently_picked;
+    return best;
+}
+
 int IOEventData::OnCreated(const IOEventDataOptions& options) {
     if (!options.input_cb) {
         LOG(ERROR) << "Invalid input_cb=NULL";
@@ -19,6 +19,7 @@
 #ifndef BRPC_EVENT_DISPATCHER_H
 #define BRPC_EVENT_DISPATCHER_H
 
+#include "butil/atomicops.h"
 #include "butil/macros.h"                     // DISALLOW_COPY_AND_ASSIGN
 #include "bthread/types.h"                   // bthread_t, bthread_attr_t
 #include "brpc/versioned_ref_with_id.h"
@@ -87,6 +88,9 @@ namespace rdma {
 class RdmaEndpoint;
 }
 
+// io_uring backend of EventDispatcher, see event_dispatcher_io_uring.cpp
+class IoUringPoller;
+
 // Dispatch edge-triggered events of file descriptors to consumers
 // running in separate bthreads.
 class EventDispatcher {
@@ -133,6 +137,16 @@ public:
     // Returns 0 on success, -1 otherwise and errno is set
     int UnregisterEvent(IOEventDataId event_data_id, int fd, bool pollin);
 
+    // Number of events returned by epoll/kqueue/io_uring so far.
+    int64_t event_count() const {
+        return _nevents.load(butil::memory_order_relaxed);
+    }
+
+    // Number of fds added by AddConsumer() and not removed yet.
+    int consumer_count() const {
+        return _nconsumers.load(butil::memory_order_relaxed);
+    }
+
 private:
     DISALLOW_COPY_AND_ASSIGN(EventDispatcher);
 
@@ -170,7 +184,7 @@ private:
         return OnEvent<false>(event_data_id, events, thread_attr);
     }
 
-    // The epoll/kqueue fd to watch events.
+    // The epoll/kqueue/io_uring fd to watch events.
     int _event_dispatcher_fd;
 
     // false unless Stop() is called.
@@ -184,9 +198,26 @@ private:
 
     // Pipe fds to wakeup EventDispatcher from `epoll_wait' in order to quit
     int _wakeup_fds[2];
+
+    // Non-NULL iff this dispatcher watches events with io_uring instead of
+    // epoll, decided by -event_dispatcher_io_uring at construction.
+    IoUringPoller* _io_uring;
+
+    // Only modified by the bthread running Run().
+    butil::atomic<int64_t> _nevents;
+    butil::atomic<int> _nconsumers;
 };
 
-EventDispatcher& GetGlobalEventDispatcher(int fd, bthread_tag_t tag);
+// Get the EventDispatcher of `tag' handling `fd'. The dispatcher is chosen
+// by hashing `fd' unless `index' is non-negative, in which case the
+// (index % -event_dispatcher_num)-th dispatcher of `tag' is returned.
+EventDispatcher& GetGlobalEventDispatcher(int fd, bthread_tag_t tag,
+                                          int index = -1);
+
+// Returns index of the EventDispatcher of `tag' handling the fewest events
+// per second, or -1 if -event_dispatcher_load_aware is off, in which case
+// the dispatcher is chosen by hashing the fd.
+int PickEventDispatcherIndex(bthread_tag_t tag);
 
 // IOEvent class manages the IO events of a file descriptor conveniently.
 template <typename T>
@@ -195,7 +226,8 @@ public:
     IOEvent()
         : _init(false)
         , _event_data_id(INVALID_IO_EVENT_DATA_ID)
-        , _bthread_tag(bthread_self_tag()) {}
+        , _bthread_tag(bthread_self_tag())
+        , _event_dispatcher_index(-1) {}
 
     ~IOEvent() { Reset(); }
 
@@ -228,7 +260,12 @@ public:
             LOG(ERROR) << "IOEvent has not been initialized";
             return -1;
         }
-        return GetGlobalEventDispatcher(fd, _bthread_tag)
+        if (_event_dispatcher_index < 0) {
+            // Remembered so that later operations on the fd (and fds reset
+            // later) go to the same dispatcher.
+            _event_dispatcher_index = PickEventDispatcherIndex(_bthread_tag);
+        }
+        return GetGlobalEventDispatcher(fd, _bthread_tag, _event_dispatcher_index)
             .AddConsumer(_event_data_id, fd);
     }
 
@@ -238,7 +275,8 @@ public:
             LOG(ERROR) << "IOEvent has not been initialized";
             return -1;
         }
-        return GetGlobalEventDispatcher(fd, _bthread_tag).RemoveConsumer(fd);
+        return GetGlobalEventDispatcher(fd, _bthread_tag, _event_dispatcher_index)
+            .RemoveConsumer(fd);
     }
 
     // See comments of `EventDispatcher::RegisterEvent'.
@@ -247,7 +285,7 @@ public:
             LOG(ERROR) << "IOEvent has not been initialized";
             return -1;
         }
-        return GetGlobalEventDispatcher(fd, _bthread_tag)
+        return GetGlobalEventDispatcher(fd, _bthread_tag, _event_dispatcher_index)
             .RegisterEvent(_event_data_id, fd, pollin);
     }
 
@@ -257,7 +295,7 @@ public:
             LOG(ERROR) << "IOEvent has not been initialized";
             return -1;
         }
-        return GetGlobalEventDispatcher(fd, _bthread_tag)
+        return GetGlobalEventDispatcher(fd, _bthread_tag, _event_dispatcher_index)
             .UnregisterEvent(_event_data_id, fd, pollin);
     }
 
@@ -268,6 +306,15 @@ public:
         return _bthread_tag;
     }
 
+    // Pin the fd to a specific EventDispatcher of the tag instead of the
+    // one chosen by hashing the fd. Negative to restore the default.
+    void set_event_dispatcher_index(int index) {
+        _event_dispatcher_index = index;
+    }
+    int event_dispatcher_index() const {
+        return _event_dispatcher_index;
+    }
+
 private:
     // Generic callback to handle input event.
     static int OnInputEvent(void* user_data, uint32_t events,
@@ -294,6 +341,7 @@ private:
     bool _init;
     IOEventDataId _event_data_id;
     bthread_tag_t _bthread_tag;
+    int _event_dispatcher_index;
 };
 
 } // namespace brpc
@@ -19,14 +19,35 @@
 #ifdef BRPC_SOCKET_HAS_EOF
 #include "brpc/details/has_epollrdhup.h"
 #endif
+#include "brpc/reloadable_flags.h"
+#include "brpc/event_dispatcher_io_uring.cpp"
 
 namespace brpc {
 
+DEFINE_int32(event_dispatcher_busy_poll_us, 0,
+             "If this flag is positive, EventDispatchers spin on non-blocking "
+             "epoll_wait for at most so many microseconds before blocking, "
+             "which cuts the latency of waking up dispatchers at the cost of "
+             "CPU. The spinning shrinks automatically when there're few "
+             "events. Not effective for -event_dispatcher_io_uring");
+BRPC_VALIDATE_GFLAG(event_dispatcher_busy_poll_us, NonNegativeInteger);
+
 EventDispatcher::EventDispatcher()
     : _event_dispatcher_fd(-1)
     , _stop(false)
     , _tid(0)
-    , _thread_attr(BTHREAD_ATTR_NORMAL) {
+    , _thread_attr(BTHREAD_ATTR_NORMAL)
+    , _io_uring(NULL)
+    , _nevents(0)
+    , _nconsumers(0) {
+    _wakeup_fds[0] = -1;
+    _wakeup_fds[1] = -1;
+    _io_uring = CreateIoUringPoller();
+    if (_io_uring) {
+        // Owned by _io_uring, Stop() wakes up the ring with a NOP.
+        _event_dispatcher_fd = _io_uring->ring_fd();
+        return;
+    }
     _event_dispatcher_fd = epoll_create(1024 * 1024);
     if (_event_dispatcher_fd < 0) {
         PLOG(FATAL) << "Fail to create epoll";
@@ -34,8 +55,6 @@ EventDispatcher::EventDispatcher()
     }
     CHECK_EQ(0, butil::make_close_on_exec(_event_dispatcher_fd));
 
-    _wakeup_fds[0] = -1;
-    _wakeup_fds[1] = -1;
     if (pipe(_wakeup_fds) != 0) {
         PLOG(FATAL) << "Fail to create pipe";
         return;
@@ -45,6 +64,11 @@ EventDispatcher::EventDispatcher()
 EventDispatcher::~EventDispatcher() {
     Stop();
     Join();
+    if (_io_uring) {
+        delete _io_uring;
+        _io_uring = NULL;
+        _event_dispatcher_fd = -1;
+    }
     if (_event_dispatcher_fd >= 0) {
         close(_event_dispatcher_fd);
         _event_dispatcher_fd = -1;
@@ -99,7 +123,9 @@ bool EventDispatcher::Running() const {
 void EventDispatcher::Stop() {
     _stop = true;
 
-    if (_event_dispatcher_fd >= 0) {
+    if (_io_uring) {
+        _io_uring->Wakeup();
+    } else if (_event_dispatcher_fd >= 0) {
         epoll_event evt = { EPOLLOUT,  { NULL } };
         epoll_ctl(_event_dispatcher_fd, EPOLL_CTL_ADD, _wakeup_fds[1], &evt);
     }
@@ -125,6 +151,12 @@ int EventDispatcher::RegisterEvent(IOEventDataId event_data_id,
 #ifdef BRPC_SOCKET_HAS_EOF
     evt.events |= has_epollrdhup;
 #endif
+    if (_io_uring) {
+        const uint32_t events = evt.events & ~EPOLLET;
+        return pollin ?
+            _io_uring->Modify(event_data_id, fd, events | EPOLLIN) :
+            _io_uring->Add(event_data_id, fd, events);
+    }
     if (pollin) {
         evt.events |= EPOLLIN;
         if (epoll_ctl(_event_dispatcher_fd, EPOLL_CTL_MOD, fd, &evt) < 0) {
@@ -149,8 +181,14 @@ int EventDispatcher::UnregisterEvent(IOEventDataId event_data_id,
 #ifdef BRPC_SOCKET_HAS_EOF
         evt.events |= has_epollrdhup;
 #endif
+        if (_io_uring) {
+            return _io_uring->Modify(event_data_id, fd, evt.events & ~EPOLLET);
+        }
         return epoll_ctl(_event_dispatcher_fd, EPOLL_CTL_MOD, fd, &evt);
     } else {
+        if (_io_uring) {
+            return _io_uring->Remove(fd);
+        }
         return epoll_ctl(_event_dispatcher_fd, EPOLL_CTL_DEL, fd, NULL);
     }
     return -1;
@@ -167,7 +205,13 @@ int EventDispatcher::AddConsumer(IOEventDataId event_data_id, int fd) {
 #ifdef BRPC_SOCKET_HAS_EOF
     evt.events |= has_epollrdhup;
 #endif
-    return epoll_ctl(_event_dispatcher_fd, EPOLL_CTL_ADD, fd, &evt);
+    const int rc = (_io_uring ?
+                    _io_uring->Add(event_data_id, fd, evt.events & ~EPOLLET) :
+                    epoll_ctl(_event_dispatcher_fd, EPOLL_CTL_ADD, fd, &evt));
+    if (rc == 0) {
+        _nconsumers.fetch_add(1, butil::memory_order_relaxed);
+    }
+    return rc;
 }
 
 int EventDispatcher::RemoveConsumer(int fd) {
@@ -181,10 +225,17 @@ int EventDispatcher::RemoveConsumer(int fd) {
     // from epoll again! If the fd was level-triggered and there's data left,
     // epoll_wait will keep returning events of the fd continuously, making
     // program abnormal.
-    if (epoll_ctl(_event_dispatcher_fd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+    if (_io_uring) {
+        if (_io_uring->Remove(fd) < 0) {
+            PLOG(WARNING) << "Fail to remove fd=" << fd << " from io_uring="
+                          << _event_dispatcher_fd;
+            return -1;
+        }
+    } else if (epoll_ctl(_event_dispatcher_fd, EPOLL_CTL_DEL, fd, NULL) < 0) {
         PLOG(WARNING) << "Fail to remove fd=" << fd << " from epfd=" << _event_dispatcher_fd;
         return -1;
     }
+    _nconsumers.fetch_sub(1, butil::memory_order_relaxed);
     return 0;
 }
 
@@ -194,17 +245,52 @@ void* EventDispatcher::RunThis(void* arg) {
 }
 
 void EventDispatcher::Run() {
+    // Current spinning budget of busy-poll mode. It's reset to
+    // -event_dispatcher_busy_poll_us when spinning catches events, halved
+    // when spinning catches nothing, and regrows after blocking waits so
+    // that an idle dispatcher stops burning CPU by itself.
+    int spin_us = FLAGS_event_dispatcher_busy_poll_us;
     while (!_stop) {
         epoll_event e[32];
+        int n;
+        const int max_spin_us = FLAGS_event_dispatcher_busy_poll_us;
+        if (_io_uring) {
+            // Completions are converted into epoll_event by the poller.
+            n = _io_uring->Wait(e, ARRAY_SIZE(e));
+        } else if (max_spin_us > 0) {
+            n = 0;
+            spin_us = std::min(spin_us, max_spin_us);
+            if (spin_us > 0) {
+                const int64_t deadline_us = butil::cpuwide_time_us() + spin_us;
+                do {
+                    n = epoll_wait(_event_dispatcher_fd, e, ARRAY_SIZE(e), 0);
+                } while (n == 0 && butil::cpuwide_time_us() < deadline_us);
+                if (n > 0) {
+                    g_edisp_busy_poll_vars->spin << 1;
+                    spin_us = max_spin_us;
+                } else if (n == 0) {
+                    g_edisp_busy_poll_vars->spin_miss << 1;
+                    spin_us /= 2;
+                }
+            }
+            if (n == 0) {
+                n = epoll_wait(_event_dispatcher_fd, e, ARRAY_SIZE(e), -1);
+                g_edisp_busy_poll_vars->park << 1;
+                if (n > 0) {
+                    spin_us = std::min(spin_us * 2 + 1, max_spin_us);
+                }
+            }
+        } else {
 #ifdef BRPC_ADDITIONAL_EPOLL
-        // Performance downgrades in examples.
-        int n = epoll_wait(_event_dispatcher_fd, e, ARRAY_SIZE(e), 0);
-        if (n == 0) {
-            n = epoll_wait(_event_dispatcher_fd, e, ARRAY_SIZE(e), -1);
-        }
+            // Performance downgrades in examples.
+            n = epoll_wait(_event_dispatcher_fd, e, ARRAY_SIZE(e), 0);
+            if (n == 0) {
+                n = epoll_wait(_event_dispatcher_fd, e, ARRAY_SIZE(e), -1);
+            }
 #else
-        const int n = epoll_wait(_event_dispatcher_fd, e, ARRAY_SIZE(e), -1);
+            n = epoll_wait(_event_dispatcher_fd, e, ARRAY_SIZE(e), -1);
 #endif
+        }
         if (_stop) {
             // epoll_ctl/epoll_wait should have some sort of memory fencing
             // guaranteeing that we(after epoll_wait) see _stop set before
@@ -216,9 +302,12 @@ void EventDispatcher::Run() {
                 // We've checked _stop, no wake-up will be missed.
                 continue;
             }
-            PLOG(FATAL) << "Fail to epoll_wait epfd=" << _event_dispatcher_fd;
+            PLOG(FATAL) << "Fail to " << (_io_uring ? "io_uring_enter" : "epoll_wait")
+                        << " fd=" << _event_dispatcher_fd;
             break;
         }
+        _nevents.store(_nevents.load(butil::memory_order_relaxed) + n,
+                       butil::memory_order_relaxed);
         for (int i = 0; i < n; ++i) {
             if (e[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)
 #ifdef BRPC_SOCKET_HAS_EOF
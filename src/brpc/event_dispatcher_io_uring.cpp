@@ -0,0 +1,435 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// io_uring backend of EventDispatcher. Included by event_dispatcher_epoll.cpp
+// and selected at construction time by -event_dispatcher_io_uring.
+//
+// Readiness of each fd is watched by one multishot IORING_OP_POLL_ADD, and
+// completions are converted into epoll_event so that EventDispatcher::Run()
+// dispatches them exactly as epoll results. Reaping completions does not
+// need a syscall when the completion queue is not empty, and a whole batch
+// of completions is harvested by one io_uring_enter() otherwise.
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "butil/atomicops.h"
+#include "butil/containers/flat_map.h"
+#include "butil/synchronization/lock.h"
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#include <linux/io_uring.h>
+#if defined(IORING_POLL_ADD_MULTI)
+#define BRPC_HAS_IO_URING 1
+#endif
+#endif
+
+namespace brpc {
+
+DEFINE_bool(event_dispatcher_io_uring, false,
+            "Use io_uring instead of epoll in EventDispatchers created "
+            "after this flag is set. Falls back to epoll if io_uring is "
+            "not supported by the kernel");
+DEFINE_int32(event_dispatcher_io_uring_entries, 1024,
+             "Number of submission queue entries of each io_uring, the "
+             "completion queue is 4 times larger");
+
+#ifdef BRPC_HAS_IO_URING
+
+class IoUringPoller {
+public:
+    IoUringPoller()
+        : _ring_fd(-1), _sq_ptr(NULL), _sq_size(0), _cq_ptr(NULL)
+        , _cq_size(0), _sqes(NULL), _sqes_size(0), _sq_entries(0)
+        , _sq_head(NULL), _sq_tail(NULL), _sq_mask(NULL), _sq_array(NULL)
+        , _cq_head(NULL), _cq_tail(NULL), _cq_mask(NULL), _cqes(NULL)
+        , _next_gen(1) {}
+
+    ~IoUringPoller() {
+        if (_sqes) {
+            munmap(_sqes, _sqes_size);
+        }
+        if (_cq_ptr && _cq_ptr != _sq_ptr) {
+            munmap(_cq_ptr, _cq_size);
+        }
+        if (_sq_ptr) {
+            munmap(_sq_ptr, _sq_size);
+        }
+        if (_ring_fd >= 0) {
+            close(_ring_fd);
+        }
+    }
+
+    // Returns 0 on success, -1 otherwise and errno is set.
+    int Init(unsigned entries) {
+        if (_fd_map.init(1024) != 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        // Multishot polls of all consumers share the completion queue, make
+        // it large enough to avoid overflowing which terminates multishot.
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 4;
+        _ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+        if (_ring_fd < 0) {
+            return -1;
+        }
+        butil::make_close_on_exec(_ring_fd);
+        _sq_entries = p.sq_entries;
+        _sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        _cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP);
+        if (single_mmap) {
+            _sq_size = std::max(_sq_size, _cq_size);
+            _cq_size = _sq_size;
+        }
+        _sq_ptr = Map(_sq_size, IORING_OFF_SQ_RING);
+        if (_sq_ptr == NULL) {
+            return -1;
+        }
+        if (single_mmap) {
+            _cq_ptr = _sq_ptr;
+        } else {
+            _cq_ptr = Map(_cq_size, IORING_OFF_CQ_RING);
+            if (_cq_ptr == NULL) {
+                return -1;
+            }
+        }
+        _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        _sqes = (io_uring_sqe*)Map(_sqes_size, IORING_OFF_SQES);
+        if (_sqes == NULL) {
+            return -1;
+        }
+        char* sq = (char*)_sq_ptr;
+        _sq_head = (butil::atomic<unsigned>*)(sq + p.sq_off.head);
+        _sq_tail = (butil::atomic<unsigned>*)(sq + p.sq_off.tail);
+        _sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+        _sq_array = (unsigned*)(sq + p.sq_off.array);
+        char* cq = (char*)_cq_ptr;
+        _cq_head = (butil::atomic<unsigned>*)(cq + p.cq_off.head);
+        _cq_tail = (butil::atomic<unsigned>*)(cq + p.cq_off.tail);
+        _cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+        _cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        return ProbeMultishotPoll();
+    }
+
+    int ring_fd() const { return _ring_fd; }
+
+    // Watch `events' of `fd' which is not watched yet. Returns 0 on success,
+    // -1 otherwise and errno is set (EEXIST if `fd' is already watched).
+    int Add(IOEventDataId event_data_id, int fd, uint32_t events) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_fd_map.seek(fd) != NULL) {
+            errno = EEXIST;
+            return -1;
+        }
+        Entry e = { event_data_id, events, NextGen() };
+        _fd_map[fd] = e;
+        PreparePollAdd(fd, e);
+        if (Submit() != 0) {
+            // Nothing was consumed by kernel, drop the entry just prepared
+            // so that it's not submitted along with later ones.
+            const int saved_errno = errno;
+            _sq_tail->store(_sq_tail->load(butil::memory_order_relaxed) - 1,
+                            butil::memory_order_release);
+            _fd_map.erase(fd);
+            errno = saved_errno;
+            return -1;
+        }
+        return 0;
+    }
+
+    // Replace watched events of `fd'. Returns 0 on success, -1 otherwise
+    // and errno is set (ENOENT if `fd' is not watched).
+    int Modify(IOEventDataId event_data_id, int fd, uint32_t events) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        Entry* e = _fd_map.seek(fd);
+        if (e == NULL) {
+            errno = ENOENT;
+            return -1;
+        }
+        // Cancel the old multishot poll and arm a new one in one submission.
+        // Completions of the old poll are filtered by the generation.
+        PreparePollRemove(fd, *e);
+        e->event_data_id = event_data_id;
+        e->events = events;
+        e->gen = NextGen();
+        PreparePollAdd(fd, *e);
+        return Submit();
+    }
+
+    // Stop watching `fd'. Returns 0 on success, -1 otherwise and errno is
+    // set (ENOENT if `fd' is not watched).
+    int Remove(int fd) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        Entry e;
+        if (_fd_map.erase(fd, &e) == 0) {
+            errno = ENOENT;
+            return -1;
+        }
+        PreparePollRemove(fd, e);
+        return Submit();
+    }
+
+    // Make a blocking Wait() return.
+    int Wakeup() {
+        BAIDU_SCOPED_LOCK(_mutex);
+        io_uring_sqe* sqe = GetSqe();
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = WAKEUP_USER_DATA;
+        return Submit();
+    }
+
+    // Block until there's at least one completion, then convert at most
+    // `max_events' completions into `events'. Returns number of converted
+    // events which may be 0 for wakeups, -1 on error and errno is set.
+    int Wait(epoll_event* events, int max_events) {
+        if (_cq_head->load(butil::memory_order_relaxed) ==
+            _cq_tail->load(butil::memory_order_acquire)) {
+            if (syscall(__NR_io_uring_enter, _ring_fd, 0, 1,
+                        IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+                return -1;
+            }
+        }
+        int n = 0;
+        unsigned head = _cq_head->load(butil::memory_order_relaxed);
+        const unsigned tail = _cq_tail->load(butil::memory_order_acquire);
+        BAIDU_SCOPED_LOCK(_mutex);
+        for (; head != tail && n < max_events; ++head) {
+            const io_uring_cqe& cqe = _cqes[head & *_cq_mask];
+            if (cqe.user_data == WAKEUP_USER_DATA ||
+                cqe.user_data == IGNORED_USER_DATA) {
+                continue;
+            }
+            const int fd = (int)(uint32_t)cqe.user_data;
+            const uint32_t gen = (uint32_t)(cqe.user_data >> 32);
+            Entry* e = _fd_map.seek(fd);
+            if (e == NULL || e->gen != gen) {
+                // Stale completion of a removed or replaced poll.
+                continue;
+            }
+            uint32_t revents = 0;
+            if (cqe.res >= 0) {
+                revents = (uint32_t)cqe.res;
+            }
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                // The multishot poll was terminated by kernel (e.g. the
+                // completion queue overflowed), re-arm it and report all
+                // watched events since some of them might be lost, which
+                // is fine for edge-triggered consumers.
+                e->gen = NextGen();
+                PreparePollAdd(fd, *e);
+                Submit();
+                revents |= e->events;
+            }
+            if (revents == 0) {
+                continue;
+            }
+            events[n].events = revents;
+            events[n].data.u64 = e->event_data_id;
+            ++n;
+        }
+        _cq_head->store(head, butil::memory_order_release);
+        return n;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(IoUringPoller);
+
+    struct Entry {
+        IOEventDataId event_data_id;
+        uint32_t events;
+        uint32_t gen;
+    };
+
+    static const uint64_t WAKEUP_USER_DATA = (uint64_t)-1;
+    static const uint64_t IGNORED_USER_DATA = (uint64_t)-2;
+
+    static uint64_t MakeUserData(int fd, uint32_t gen) {
+        return ((uint64_t)gen << 32) | (uint32_t)fd;
+    }
+
+    // Multishot polls are supported since linux 5.13, older kernels reject
+    // them with EINVAL. Check with a readable eventfd. Returns 0 if they're
+    // supported, -1 otherwise and errno is set.
+    int ProbeMultishotPoll() {
+        const int efd = eventfd(1, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (efd < 0) {
+            return -1;
+        }
+        BAIDU_SCOPED_LOCK(_mutex);
+        io_uring_sqe* sqe = GetSqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = efd;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = IGNORED_USER_DATA;
+        int rc = -1;
+        if (syscall(__NR_io_uring_enter, _ring_fd, 1, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0) >= 0) {
+            const unsigned head = _cq_head->load(butil::memory_order_relaxed);
+            if (head != _cq_tail->load(butil::memory_order_acquire)) {
+                const io_uring_cqe& cqe = _cqes[head & *_cq_mask];
+                if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_MORE)) {
+                    rc = 0;
+                } else {
+                    errno = (cqe.res < 0 ? -cqe.res : EINVAL);
+                }
+                _cq_head->store(head + 1, butil::memory_order_release);
+            } else {
+                errno = EINVAL;
+            }
+        }
+        if (rc == 0) {
+            // Remaining completions of the probe are skipped by Wait().
+            sqe = GetSqe();
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = IGNORED_USER_DATA;
+            sqe->user_data = IGNORED_USER_DATA;
+            rc = Submit();
+        }
+        const int saved_errno = errno;
+        close(efd);
+        errno = saved_errno;
+        return rc;
+    }
+
+    void* Map(size_t size, off_t offset) {
+        void* p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, _ring_fd, offset);
+        return p == MAP_FAILED ? NULL : p;
+    }
+
+    // Generations never collide with reserved user_data.
+    uint32_t NextGen() {
+        uint32_t gen = _next_gen++;
+        if (_next_gen >= (uint32_t)-2) {
+            _next_gen = 1;
+        }
+        return gen;
+    }
+
+    // Caller must hold _mutex.
+    io_uring_sqe* GetSqe() {
+        const unsigned tail = _sq_tail->load(butil::memory_order_relaxed);
+        if (tail - _sq_head->load(butil::memory_order_acquire) >= _sq_entries) {
+            // Entries are submitted right after being prepared, the queue
+            // can only be full when the previous submission failed.
+            Submit();
+        }
+        const unsigned index = tail & *_sq_mask;
+        io_uring_sqe* sqe = &_sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        _sq_array[index] = index;
+        _sq_tail->store(tail + 1, butil::memory_order_release);
+        return sqe;
+    }
+
+    void PreparePollAdd(int fd, const Entry& e) {
+        io_uring_sqe* sqe = GetSqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = e.events;
+        sqe->user_data = MakeUserData(fd, e.gen);
+    }
+
+    void PreparePollRemove(int fd, const Entry& e) {
+        io_uring_sqe* sqe = GetSqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = MakeUserData(fd, e.gen);
+        sqe->user_data = IGNORED_USER_DATA;
+    }
+
+    // Submit all prepared entries. Caller must hold _mutex.
+    int Submit() {
+        const unsigned n = _sq_tail->load(butil::memory_order_relaxed) -
+            _sq_head->load(butil::memory_order_acquire);
+        while (true) {
+            const long rc = syscall(__NR_io_uring_enter, _ring_fd, n, 0, 0, NULL, 0);
+            if (rc >= 0) {
+                return 0;
+            }
+            if (errno != EINTR) {
+                return -1;
+            }
+        }
+    }
+
+    int _ring_fd;
+    void* _sq_ptr;
+    size_t _sq_size;
+    void* _cq_ptr;
+    size_t _cq_size;
+    io_uring_sqe* _sqes;
+    size_t _sqes_size;
+    unsigned _sq_entries;
+    butil::atomic<unsigned>* _sq_head;
+    butil::atomic<unsigned>* _sq_tail;
+    unsigned* _sq_mask;
+    unsigned* _sq_array;
+    butil::atomic<unsigned>* _cq_head;
+    butil::atomic<unsigned>* _cq_tail;
+    unsigned* _cq_mask;
+    io_uring_cqe* _cqes;
+
+    // Protects the submission queue and _fd_map.
+    butil::Mutex _mutex;
+    uint32_t _next_gen;
+    butil::FlatMap<int, Entry> _fd_map;
+};
+
+static IoUringPoller* CreateIoUringPoller() {
+    if (!FLAGS_event_dispatcher_io_uring) {
+        return NULL;
+    }
+    IoUringPoller* poller = new IoUringPoller;
+    if (poller->Init(FLAGS_event_dispatcher_io_uring_entries) != 0) {
+        PLOG(WARNING) << "Fail to create io_uring, use epoll instead";
+        delete poller;
+        return NULL;
+    }
+    return poller;
+}
+
+#else
+
+// Placeholder when the kernel headers do not know io_uring.
+class IoUringPoller {
+public:
+    int ring_fd() const { return -1; }
+    int Add(IOEventDataId, int, uint32_t) { return -1; }
+    int Modify(IOEventDataId, int, uint32_t) { return -1; }
+    int Remove(int) { return -1; }
+    int Wakeup() { return -1; }
+    int Wait(epoll_event*, int) { return -1; }
+};
+
+static IoUringPoller* CreateIoUringPoller() {
+    LOG_IF(WARNING, FLAGS_event_dispatcher_io_uring)
+        << "io_uring is not supported on this platform, use epoll instead";
+    return NULL;
+}
+
+#endif // BRPC_HAS_IO_URING
+
+} // namespace brpc
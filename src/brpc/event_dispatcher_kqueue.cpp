@@ -26,7 +26,10 @@ EventDispatcher::EventDispatcher()
     : _event_dispatcher_fd(-1)
     , _stop(false)
     , _tid(0)
-    , _thread_attr(BTHREAD_ATTR_NORMAL) {
+    , _thread_attr(BTHREAD_ATTR_NORMAL)
+    , _io_uring(NULL)
+    , _nevents(0)
+    , _nconsumers(0) {
     _event_dispatcher_fd = kqueue();
     if (_event_dispatcher_fd < 0) {
         PLOG(FATAL) << "Fail to create kqueue";
@@ -162,7 +165,11 @@ int EventDispatcher::AddConsumer(IOEventDataId event_data_id, int fd) {
     struct kevent evt;
     EV_SET(&evt, fd, EVFILT_READ, EV_ADD | EV_ENABLE | EV_CLEAR,
            0, 0, (void*)event_data_id);
-    return kevent(_event_dispatcher_fd, &evt, 1, NULL, 0, NULL);
+    if (kevent(_event_dispatcher_fd, &evt, 1, NULL, 0, NULL) != 0) {
+        return -1;
+    }
+    _nconsumers.fetch_add(1, butil::memory_order_relaxed);
+    return 0;
 }
 
 int EventDispatcher::RemoveConsumer(int fd) {
@@ -181,6 +188,7 @@ int EventDispatcher::RemoveConsumer(int fd) {
     kevent(_event_dispatcher_fd, &evt, 1, NULL, 0, NULL);
     EV_SET(&evt, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
     kevent(_event_dispatcher_fd, &evt, 1, NULL, 0, NULL);
+    _nconsumers.fetch_sub(1, butil::memory_order_relaxed);
     return 0;
 }
 
@@ -207,6 +215,8 @@ void EventDispatcher::Run() {
             PLOG(FATAL) << "Fail to kqueue epfd=" << _event_dispatcher_fd;
             break;
         }
+        _nevents.store(_nevents.load(butil::memory_order_relaxed) + n,
+                       butil::memory_order_relaxed);
         for (int i = 0; i < n; ++i) {
             if ((e[i].flags & EV_ERROR) || e[i].filter == EVFILT_READ) {
                 int64_t start_ns = butil::cpuwide_time_ns();
@@ -39,6 +39,9 @@ public:
     // Add a server. If the internal queue is full, pop one from the queue first.
     void Add(SocketId id);
 
+    // Add all servers in `other' which may be NULL.
+    void Add(const ExcludedServers* other);
+
     // True if the server shall be excluded.
     bool IsExcluded(SocketId id) const;
     static bool IsExcluded(const ExcludedServers* s, SocketId id) {
@@ -86,6 +89,16 @@ inline void ExcludedServers::Add(SocketId id) {
     }
 }
 
+inline void ExcludedServers::Add(const ExcludedServers* other) {
+    if (other == NULL || other == this) {
+        return;
+    }
+    BAIDU_SCOPED_LOCK(other->_mutex);
+    for (size_t i = 0; i < other->_l.size(); ++i) {
+        Add(*other->_l.bottom(i));
+    }
+}
+
 inline bool ExcludedServers::IsExcluded(SocketId id) const {
     BAIDU_SCOPED_LOCK(_mutex);
     for (size_t i = 0; i < _l.size(); ++i) {
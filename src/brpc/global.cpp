@@ -46,7 +46,10 @@
 #include "brpc/policy/randomized_load_balancer.h"
 #include "brpc/policy/weighted_randomized_load_balancer.h"
 #include "brpc/policy/locality_aware_load_balancer.h"
+#include "brpc/policy/p2c_load_balancer.h"
 #include "brpc/policy/consistent_hashing_load_balancer.h"
+#include "brpc/policy/maglev_load_balancer.h"
+#include "brpc/policy/zone_aware_load_balancer.h"
 #include "brpc/policy/hasher.h"
 #include "brpc/policy/dynpart_load_balancer.h"
 
@@ -59,6 +62,8 @@
 #include "brpc/compress.h"
 #include "brpc/policy/gzip_compress.h"
 #include "brpc/policy/snappy_compress.h"
+#include "brpc/policy/zstd_compress.h"
+#include "brpc/policy/lz4_compress.h"
 
 // Checksum handlers
 #include "brpc/checksum.h"
@@ -90,17 +95,26 @@
 #include "brpc/policy/auto_concurrency_limiter.h"
 #include "brpc/policy/constant_concurrency_limiter.h"
 #include "brpc/policy/timeout_concurrency_limiter.h"
+#include "brpc/policy/gradient_concurrency_limiter.h"
 
 #include "brpc/input_messenger.h"     // get_or_new_client_side_messenger
 #include "brpc/socket_map.h"          // SocketMapList
 #include "brpc/server.h"
 #include "brpc/trackme.h"             // TrackMe
+#include "brpc/metrics_pusher.h"      // PushMetrics
 #include "brpc/details/usercode_backup_pool.h"
+#include "brpc/details/iobuf_hugepage.h"
+#include "brpc/details/continuous_profiler.h"
 #if defined(OS_LINUX)
 #include <malloc.h>                   // malloc_trim
 #endif
+#include <algorithm>
+#include <list>
+#include <map>
+#include <set>
 #include "butil/fd_guard.h"
 #include "butil/files/file_watcher.h"
+#include "bvar/multi_dimension.h"
 
 extern "C" {
 // defined in gperftools/malloc_extension_c.h
@@ -116,6 +130,11 @@ DEFINE_int32(free_memory_to_system_interval, 0,
              "values <= 0 disables this feature");
 BRPC_VALIDATE_GFLAG(free_memory_to_system_interval, PassValidate);
 
+DEFINE_int32(max_exposed_slow_peers, 10,
+             "Expose average latencies of calls to so many slowest peers as "
+             "bvar rpc_slow_peer_latency_us, 0 disables this feature");
+BRPC_VALIDATE_GFLAG(max_exposed_slow_peers, NonNegativeInteger);
+
 namespace policy {
 // Defined in http_rpc_protocol.cpp
 void InitCommonStrings();
@@ -132,6 +151,7 @@ struct GlobalExtensions {
         , ch_mh_lb(CONS_HASH_LB_MURMUR3)
         , ch_md5_lb(CONS_HASH_LB_MD5)
         , ch_ketama_lb(CONS_HASH_LB_KETAMA)
+        , ch_xxh3_lb(CONS_HASH_LB_XXH3)
         , constant_cl(0) {
     }
     
@@ -153,19 +173,64 @@ struct GlobalExtensions {
     RandomizedLoadBalancer randomized_lb;
     WeightedRandomizedLoadBalancer wr_lb;
     LocalityAwareLoadBalancer la_lb;
+    P2CLoadBalancer p2c_lb;
     ConsistentHashingLoadBalancer ch_mh_lb;
     ConsistentHashingLoadBalancer ch_md5_lb;
     ConsistentHashingLoadBalancer ch_ketama_lb;
+    ConsistentHashingLoadBalancer ch_xxh3_lb;
+    MaglevLoadBalancer ch_maglev_lb;
+    ZoneAwareLoadBalancer zone_lb;
     DynPartLoadBalancer dynpart_lb;
 
     AutoConcurrencyLimiter auto_cl;
     ConstantConcurrencyLimiter constant_cl;
     TimeoutConcurrencyLimiter timeout_cl;
+    GradientConcurrencyLimiter gradient_cl;
 };
 
 static pthread_once_t register_extensions_once = PTHREAD_ONCE_INIT;
 static GlobalExtensions* g_ext = NULL;
 
+typedef bvar::MultiDimension<bvar::Status<int64_t>,
+                              std::list<std::string>, true> SlowPeerVars;
+
+// Expose the slowest -max_exposed_slow_peers peers in `latencies' (peer ->
+// average latency) and remove peers which are not slow anymore.
+static void ExposeSlowPeers(std::map<std::string, int64_t>* latencies) {
+    static SlowPeerVars* s_vars = NULL;
+    static std::set<std::string>* s_exposed = NULL;
+    if (s_vars == NULL) {
+        if (latencies->empty()) {
+            return;
+        }
+        s_vars = new SlowPeerVars("rpc_slow_peer_latency_us", {"peer"});
+        s_exposed = new std::set<std::string>;
+    }
+    std::vector<std::pair<int64_t, std::string> > sorted;
+    sorted.reserve(latencies->size());
+    for (auto it = latencies->begin(); it != latencies->end(); ++it) {
+        sorted.push_back(std::make_pair(-it->second, it->first));
+    }
+    const size_t n = std::min(sorted.size(),
+                              (size_t)FLAGS_max_exposed_slow_peers);
+    std::partial_sort(sorted.begin(), sorted.begin() + n, sorted.end());
+    std::set<std::string> exposed;
+    for (size_t i = 0; i < n; ++i) {
+        exposed.insert(sorted[i].second);
+        auto var = s_vars->get_stats(std::list<std::string>{sorted[i].second});
+        if (var) {
+            var->set_value(-sorted[i].first);
+        }
+    }
+    for (auto it = s_exposed->begin(); it != s_exposed->end(); ++it) {
+        if (exposed.find(*it) == exposed.end()) {
+            s_vars->delete_stats(std::list<std::string>{*it});
+        }
+    }
+    s_exposed->swap(exposed);
+    latencies->clear();
+}
+
 static long ReadPortOfDummyServer(const char* filename) {
     butil::fd_guard fd(open(filename, O_RDONLY));
     if (fd < 0) {
@@ -205,6 +270,15 @@ static int64_t GetIOBufNewBigViewCount(void*) {
 static int64_t GetIOBufBlockMemory(void*) {
     return butil::IOBuf::block_memory();
 }
+static int64_t GetIOBufClassBlockMemory(void* arg) {
+    return butil::IOBuf::block_memory(
+        (butil::IOBuf::BlockSizeClass)(intptr_t)arg);
+}
+
+static int64_t GetIOBufOwnerBlockMemory(void* arg) {
+    return butil::IOBuf::block_memory_of_owner(
+        (butil::IOBuf::BlockOwner)(intptr_t)arg);
+}
 
 // Defined in server.cpp
 extern butil::static_atomic<int> g_running_server_count;
@@ -226,6 +300,30 @@ static void* GlobalUpdate(void*) {
         "iobuf_newbigview_second", &var_iobuf_new_bigview_count);
     bvar::PassiveStatus<int64_t> var_iobuf_block_memory(
         "iobuf_block_memory", GetIOBufBlockMemory, NULL);
+    bvar::PassiveStatus<int64_t> var_iobuf_small_block_memory(
+        "iobuf_small_block_memory", GetIOBufClassBlockMemory,
+        (void*)(intptr_t)butil::IOBuf::SMALL_BLOCK);
+    bvar::PassiveStatus<int64_t> var_iobuf_default_block_memory(
+        "iobuf_default_block_memory", GetIOBufClassBlockMemory,
+        (void*)(intptr_t)butil::IOBuf::DEFAULT_BLOCK);
+    bvar::PassiveStatus<int64_t> var_iobuf_large_block_memory(
+        "iobuf_large_block_memory", GetIOBufClassBlockMemory,
+        (void*)(intptr_t)butil::IOBuf::LARGE_BLOCK);
+    bvar::PassiveStatus<int64_t> var_iobuf_huge_block_memory(
+        "iobuf_huge_block_memory", GetIOBufClassBlockMemory,
+        (void*)(intptr_t)butil::IOBuf::HUGE_BLOCK);
+    bvar::PassiveStatus<int64_t> var_iobuf_other_block_memory(
+        "iobuf_other_block_memory", GetIOBufOwnerBlockMemory,
+        (void*)(intptr_t)butil::IOBuf::OWNER_OTHER);
+    bvar::PassiveStatus<int64_t> var_iobuf_socket_read_block_memory(
+        "iobuf_socket_read_block_memory", GetIOBufOwnerBlockMemory,
+        (void*)(intptr_t)butil::IOBuf::OWNER_SOCKET_READ);
+    bvar::PassiveStatus<int64_t> var_iobuf_protocol_block_memory(
+        "iobuf_protocol_block_memory", GetIOBufOwnerBlockMemory,
+        (void*)(intptr_t)butil::IOBuf::OWNER_PROTOCOL);
+    bvar::PassiveStatus<int64_t> var_iobuf_user_block_memory(
+        "iobuf_user_block_memory", GetIOBufOwnerBlockMemory,
+        (void*)(intptr_t)butil::IOBuf::OWNER_USER);
     bvar::PassiveStatus<int> var_running_server_count(
         "rpc_server_count", GetRunningServerCount, NULL);
 
@@ -236,6 +334,7 @@ static void* GlobalUpdate(void*) {
     }
 
     std::vector<SocketId> conns;
+    std::map<std::string, int64_t> peer_latencies;
     const int64_t start_time_us = butil::gettimeofday_us();
     const int WARN_NOSLEEP_THRESHOLD = 2;
     int64_t last_time_us = start_time_us;
@@ -259,6 +358,10 @@ static void* GlobalUpdate(void*) {
 
         TrackMe();
 
+        PushMetrics();
+
+        UpdateContinuousProfiler();
+
         if (!IsDummyServerRunning()
             && g_running_server_count.load(butil::memory_order_relaxed) == 0
             && fw.check_and_consume() > 0) {
@@ -274,8 +377,19 @@ static void* GlobalUpdate(void*) {
             SocketUniquePtr ptr;
             if (Socket::Address(conns[i], &ptr) == 0) {
                 ptr->UpdateStatsEverySecond(now_ms);
+                if (FLAGS_max_exposed_slow_peers > 0) {
+                    SocketCallStat stat;
+                    ptr->GetCallStat(&stat);
+                    if (stat.ewma_latency_us > 0) {
+                        // Sockets to a peer may differ in ssl or options.
+                        int64_t& lat = peer_latencies[
+                            butil::endpoint2str(ptr->remote_side()).c_str()];
+                        lat = std::max(lat, stat.ewma_latency_us);
+                    }
+                }
             }
         }
+        ExposeSlowPeers(&peer_latencies);
 
         const int return_mem_interval =
             FLAGS_free_memory_to_system_interval/*reloadable*/;
@@ -353,7 +467,7 @@ static void GlobalInitializeOrDieImpl() {
     SSL_library_init();
     // RPC doesn't require openssl.cnf, users can load it by themselves if needed
     SSL_load_error_strings();
-    if (SSLThreadInit() != 0 || SSLDHInit() != 0) {
+    if (SSLThreadInit() != 0 || SSLDHInit() != 0 || SSLEngineInit() != 0) {
         exit(1);
     }
 
@@ -386,9 +500,13 @@ static void GlobalInitializeOrDieImpl() {
     LoadBalancerExtension()->RegisterOrDie("random", &g_ext->randomized_lb);
     LoadBalancerExtension()->RegisterOrDie("wr", &g_ext->wr_lb);
     LoadBalancerExtension()->RegisterOrDie("la", &g_ext->la_lb);
+    LoadBalancerExtension()->RegisterOrDie("p2c", &g_ext->p2c_lb);
     LoadBalancerExtension()->RegisterOrDie("c_murmurhash", &g_ext->ch_mh_lb);
     LoadBalancerExtension()->RegisterOrDie("c_md5", &g_ext->ch_md5_lb);
     LoadBalancerExtension()->RegisterOrDie("c_ketama", &g_ext->ch_ketama_lb);
+    LoadBalancerExtension()->RegisterOrDie("c_xxh3", &g_ext->ch_xxh3_lb);
+    LoadBalancerExtension()->RegisterOrDie("c_maglev", &g_ext->ch_maglev_lb);
+    LoadBalancerExtension()->RegisterOrDie("zone", &g_ext->zone_lb);
     LoadBalancerExtension()->RegisterOrDie("_dynpart", &g_ext->dynpart_lb);
 
     // Compress Handlers
@@ -404,6 +522,18 @@ static void GlobalInitializeOrDieImpl() {
     if (RegisterCompressHandler(COMPRESS_TYPE_SNAPPY, snappy_compress) != 0) {
         exit(1);
     }
+#if BRPC_WITH_ZSTD
+    CompressHandler zstd_compress = { ZstdCompress, ZstdDecompress, "zstd" };
+    if (RegisterCompressHandler(COMPRESS_TYPE_ZSTD, zstd_compress) != 0) {
+        exit(1);
+    }
+#endif
+#if BRPC_WITH_LZ4
+    CompressHandler lz4_compress = { Lz4Compress, Lz4Decompress, "lz4" };
+    if (RegisterCompressHandler(COMPRESS_TYPE_LZ4, lz4_compress) != 0) {
+        exit(1);
+    }
+#endif
 
     // Checksum Handlers
     const ChecksumHandler crc32c_checksum = {Crc32cCompute, Crc32cVerify,
@@ -511,7 +641,8 @@ static void GlobalInitializeOrDieImpl() {
     Protocol mc_binary_protocol = { ParseMemcacheMessage,
                                     SerializeMemcacheRequest,
                                     PackMemcacheRequest,
-                                    NULL, ProcessMemcacheResponse,
+                                    ProcessMemcacheRequest,
+                                    ProcessMemcacheResponse,
                                     NULL, NULL, GetMemcacheMethodName,
                                     CONNECTION_TYPE_ALL, "memcache" };
     if (RegisterProtocol(PROTOCOL_MEMCACHE, mc_binary_protocol) != 0) {
@@ -624,6 +755,7 @@ static void GlobalInitializeOrDieImpl() {
     ConcurrencyLimiterExtension()->RegisterOrDie("auto", &g_ext->auto_cl);
     ConcurrencyLimiterExtension()->RegisterOrDie("constant", &g_ext->constant_cl);
     ConcurrencyLimiterExtension()->RegisterOrDie("timeout", &g_ext->timeout_cl);
+    ConcurrencyLimiterExtension()->RegisterOrDie("gradient", &g_ext->gradient_cl);
 
     if (FLAGS_usercode_in_pthread) {
         // Optional. If channel/server are initialized before main(), this
@@ -633,6 +765,15 @@ static void GlobalInitializeOrDieImpl() {
         InitUserCodeBackupPoolOnceOrDie();
     }
 
+    if (FLAGS_iobuf_hugepage) {
+        // Like -usercode_in_pthread, blocks are allocated with malloc if
+        // the flag is set after initialization.
+        if (InitIOBufHugepageAllocator() != 0) {
+            LOG(ERROR) << "Fail to init hugepage arenas of IOBuf, "
+                "allocate blocks with malloc";
+        }
+    }
+
     // We never join GlobalUpdate, let it quit with the process.
     bthread_t th;
     CHECK(bthread_start_background(&th, NULL, GlobalUpdate, NULL) == 0)
@@ -16,6 +16,7 @@
 // under the License.
 
 
+#include <strings.h>                   // strcasecmp
 #include "brpc/http_status_code.h"     // HTTP_STATUS_*
 #include "brpc/http_header.h"
 
@@ -26,6 +27,18 @@ const char* HttpHeader::SET_COOKIE = "set-cookie";
 const char* HttpHeader::COOKIE = "cookie";
 const char* HttpHeader::CONTENT_TYPE = "content-type";
 
+void HttpHeaderSet::AddHeader(const std::string& key,
+                              const std::string& value) {
+    _headers.push_back(std::make_pair(key, value));
+    if (strcasecmp(key.c_str(), "Content-Type") == 0) {
+        _has_content_type = true;
+    }
+    _encoded.append(key);
+    _encoded.append(": ", 2);
+    _encoded.append(value);
+    _encoded.append("\r\n", 2);
+}
+
 HttpHeader::HttpHeader() 
     : _status_code(HTTP_STATUS_OK)
     , _method(HTTP_METHOD_GET)
@@ -42,6 +55,7 @@ void HttpHeader::Swap(HttpHeader &rhs) {
     _content_type.swap(rhs._content_type);
     _unresolved_path.swap(rhs._unresolved_path);
     std::swap(_version, rhs._version);
+    _header_set.swap(rhs._header_set);
 }
 
 void HttpHeader::Clear() {
@@ -52,6 +66,7 @@ void HttpHeader::Clear() {
     _content_type.clear();
     _unresolved_path.clear();
     _version = std::make_pair(1, 1);
+    _header_set.reset();
 }
 
 const std::string* HttpHeader::GetHeader(const char* key) const {
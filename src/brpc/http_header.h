@@ -19,7 +19,9 @@
 #ifndef  BRPC_HTTP_HEADER_H
 #define  BRPC_HTTP_HEADER_H
 
+#include <memory>                  // std::shared_ptr
 #include <vector>
+#include "butil/iobuf.h"                 // butil::IOBuf
 #include "butil/strings/string_piece.h"  // StringPiece
 #include "butil/containers/case_ignored_flat_map.h"
 #include "brpc/uri.h"              // URI
@@ -37,6 +39,39 @@ void ProcessHttpRequest(InputMessageBase *msg);
 class H2StreamContext;
 }
 
+// Headers encoded once and attached to many http responses by reference,
+// e.g. Server, CORS and Content-Type headers shared by all responses of an
+// API. Serializing the set into a HTTP/1.x response is appending an IOBuf
+// without formatting or copying.
+// Example:
+//   static std::shared_ptr<const HttpHeaderSet> s_api_headers = [] {
+//       std::shared_ptr<HttpHeaderSet> s = std::make_shared<HttpHeaderSet>();
+//       s->AddHeader("Content-Type", "application/json");
+//       s->AddHeader("Access-Control-Allow-Origin", "*");
+//       return s;
+//   }();
+//   cntl->http_response().set_header_set(s_api_headers);
+class HttpHeaderSet {
+public:
+    typedef std::vector<std::pair<std::string, std::string> > HeaderList;
+
+    HttpHeaderSet() : _has_content_type(false) {}
+
+    // Add a header field. Must not be called after the set is attached.
+    void AddHeader(const std::string& key, const std::string& value);
+
+    const HeaderList& headers() const { return _headers; }
+    bool has_content_type() const { return _has_content_type; }
+
+    // "Key: Value\r\n" of all headers.
+    const butil::IOBuf& encoded() const { return _encoded; }
+
+private:
+    HeaderList _headers;
+    butil::IOBuf _encoded;
+    bool _has_content_type;
+};
+
 // Non-body part of a HTTP message.
 class HttpHeader {
 public:
@@ -122,6 +157,15 @@ public:
     // #headers
     size_t HeaderCount() const { return _headers.size(); }
 
+    // Attach headers in `set' which are written after other headers of a
+    // response. They're invisible to GetHeader() and iterators, don't set
+    // them in this HttpHeader again, except that Content-Type in the set
+    // replaces content_type().
+    void set_header_set(const std::shared_ptr<const HttpHeaderSet>& set)
+    { _header_set = set; }
+    const std::shared_ptr<const HttpHeaderSet>& header_set() const
+    { return _header_set; }
+
     // Get the URI object, check src/brpc/uri.h for details.
     const URI& uri() const { return _uri; }
     URI& uri() { return _uri; }
@@ -203,6 +247,7 @@ friend void policy::ProcessHttpRequest(InputMessageBase *msg);
     std::string _unresolved_path;
     std::pair<int, int> _version;
     std::string* _first_set_cookie;
+    std::shared_ptr<const HttpHeaderSet> _header_set;
 };
 
 const HttpHeader& DefaultHttpHeader();
@@ -47,8 +47,15 @@ public:
     // [Internal]
     int64_t received_us() const { return _received_us; }
     int64_t base_real_us() const { return _base_real_us; }
+    // [Internal] When the message was read from the socket and when it was
+    // cut from the read buffer, in the same clock as received_us().
+    int64_t read_us() const { return _read_us; }
+    int64_t cut_us() const { return _cut_us; }
 
 protected:
+    InputMessageBase()
+        : _received_us(0), _base_real_us(0), _read_us(0), _cut_us(0)
+        , _process(NULL), _arg(NULL) {}
     virtual ~InputMessageBase();
 
 private:
@@ -57,6 +64,8 @@ friend void* ProcessInputMessage(void*);
 friend class Stream;
     int64_t _received_us;
     int64_t _base_real_us;
+    int64_t _read_us;
+    int64_t _cut_us;
     SocketUniquePtr _socket;
     void (*_process)(InputMessageBase* msg);
     const void* _arg;
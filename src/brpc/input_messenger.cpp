@@ -24,10 +24,12 @@
 #include "bthread/bthread.h"                     // bthread_start_background
 #include "bthread/unstable.h"                   // bthread_flush
 #include "bvar/bvar.h"                          // bvar::Adder
+#include "bvar/latency_recorder.h"              // bvar::LatencyRecorder
 #include "brpc/options.pb.h"               // ProtocolType
 #include "brpc/reloadable_flags.h"         // BRPC_VALIDATE_GFLAG
 #include "brpc/protocol.h"                 // ListProtocols
 #include "brpc/rdma/rdma_endpoint.h"
+#include "brpc/shm/shm_endpoint.h"
 #include "brpc/input_messenger.h"
 
 
@@ -81,8 +83,89 @@ const size_t MIN_ONCE_READ = 4096;
 const size_t MAX_ONCE_READ = 524288;
 const size_t PROTO_DUMMY_LEN = 4;
 
+DEFINE_bool(socket_adaptive_read, false,
+            "Size reads of each socket by its recent reads instead of its "
+            "average message size: grow fast when reads fill the buffer and "
+            "shrink after reads keep using less than half of it");
+BRPC_VALIDATE_GFLAG(socket_adaptive_read, PassValidate);
+
+static bool validate_socket_max_once_read(const char*, int32_t val) {
+    return val >= (int32_t)MIN_ONCE_READ;
+}
+DEFINE_int32(socket_max_once_read, 4 * 1024 * 1024,
+             "Max bytes of one read when -socket_adaptive_read is on. Reads "
+             "larger than 512KB use larger blocks");
+BRPC_VALIDATE_GFLAG(socket_max_once_read, validate_socket_max_once_read);
+
+// Times of consecutive small reads before shrinking the read size.
+const uint8_t SHRINK_READ_THRESHOLD = 2;
+
+// Bytes read by each read from sockets.
+static bvar::LatencyRecorder* g_socket_read_size = NULL;
+static pthread_once_t s_create_vars_once = PTHREAD_ONCE_INIT;
+
+static void CreateVars() {
+    g_socket_read_size = new bvar::LatencyRecorder("socket_read_size");
+}
+
+// Similar to AdaptiveRecvByteBufAllocator of netty.
+static size_t GetOnceReadSize(uint32_t read_size_guess, uint32_t avg_msg_size) {
+    if (FLAGS_socket_adaptive_read && read_size_guess != 0) {
+        return std::min((size_t)read_size_guess,
+                        (size_t)FLAGS_socket_max_once_read);
+    }
+    size_t once_read = avg_msg_size * 16;
+    if (once_read < MIN_ONCE_READ) {
+        once_read = MIN_ONCE_READ;
+    } else if (once_read > MAX_ONCE_READ) {
+        once_read = MAX_ONCE_READ;
+    }
+    return once_read;
+}
+
+static void UpdateReadSizeGuess(size_t once_read, size_t nr,
+                                uint32_t* read_size_guess,
+                                uint8_t* shrink_count) {
+    if (!FLAGS_socket_adaptive_read) {
+        return;
+    }
+    size_t guess = once_read;
+    if (nr >= once_read) {
+        // More data are likely pending, quadruple the size.
+        guess = std::min(once_read * 4, (size_t)FLAGS_socket_max_once_read);
+        *shrink_count = 0;
+    } else if (nr <= once_read / 2) {
+        if (++*shrink_count >= SHRINK_READ_THRESHOLD) {
+            guess = std::max(once_read / 2, MIN_ONCE_READ);
+            *shrink_count = 0;
+        }
+    } else {
+        *shrink_count = 0;
+    }
+    *read_size_guess = guess;
+}
+
 ParseResult InputMessenger::CutInputMessage(
         Socket* m, size_t* index, bool read_eof) {
+    const int pinned = _pinned_index;
+    if (pinned >= 0) {
+        // The protocol is fixed by the server, no detection.
+        ParseResult result =
+            _handlers[pinned].parse(&m->_read_buf, m, read_eof, _handlers[pinned].arg);
+        if (result.is_ok() ||
+            result.error() == PARSE_ERROR_NOT_ENOUGH_DATA) {
+            m->set_preferred_index(pinned);
+            *index = pinned;
+        } else {
+            LOG_IF(ERROR, result.error() == PARSE_ERROR_TOO_BIG_DATA)
+                << "A message from " << m->remote_side()
+                << "(protocol=" << _handlers[pinned].name
+                << ") is bigger than " << FLAGS_max_body_size
+                << " bytes, the connection will be closed."
+                " Set max_body_size to allow bigger messages";
+        }
+        return result;
+    }
     const int preferred = m->preferred_index();
     const int max_index = (int)_max_index.load(butil::memory_order_acquire);
     // Try preferred handler first. The preferred_index is set on last
@@ -241,6 +324,7 @@ int InputMessenger::ProcessNewMessage(
         const uint64_t received_us, const uint64_t base_realtime,
         InputMessageClosure& last_msg) {
     m->AddInputBytes(bytes);
+    const int64_t read_us = butil::cpuwide_time_us();
 
     // Avoid this socket to be closed due to idle_timeout_s
     m->_last_readtime_us.store(received_us, butil::memory_order_relaxed);
@@ -298,6 +382,8 @@ int InputMessenger::ProcessNewMessage(
         }
         pr.message()->_received_us = received_us;
         pr.message()->_base_real_us = base_realtime;
+        pr.message()->_read_us = read_us;
+        pr.message()->_cut_us = butil::cpuwide_time_us();
                     
         // This unique_ptr prevents msg to be lost before transfering
         // ownership to last_msg
@@ -381,12 +467,8 @@ void InputMessenger::OnNewMessages(Socket* m) {
         const int64_t base_realtime = butil::gettimeofday_us() - received_us;
 
         // Calculate bytes to be read.
-        size_t once_read = m->_avg_msg_size * 16;
-        if (once_read < MIN_ONCE_READ) {
-            once_read = MIN_ONCE_READ;
-        } else if (once_read > MAX_ONCE_READ) {
-            once_read = MAX_ONCE_READ;
-        }
+        const size_t once_read =
+            GetOnceReadSize(m->_read_size_guess, m->_avg_msg_size);
 
         // Read.
         const ssize_t nr = m->DoRead(once_read);
@@ -411,6 +493,10 @@ void InputMessenger::OnNewMessages(Socket* m) {
             } else { // new events during processing
                 continue;
             }
+        } else {
+            *g_socket_read_size << nr;
+            UpdateReadSizeGuess(once_read, nr, &m->_read_size_guess,
+                                &m->_read_shrink_count);
         }
 
         if (m->_rdma_state == Socket::RDMA_OFF && messenger->ProcessNewMessage(
@@ -428,7 +514,9 @@ InputMessenger::InputMessenger(size_t capacity)
     : _handlers(NULL)
     , _max_index(-1)
     , _non_protocol(false)
-    , _capacity(capacity) {
+    , _capacity(capacity)
+    , _pinned_index(-1) {
+    CHECK_EQ(0, pthread_once(&s_create_vars_once, CreateVars));
 }
 
 InputMessenger::~InputMessenger() {
@@ -542,6 +630,9 @@ int InputMessenger::Create(SocketOptions options, SocketId* id) {
 #endif
         options.on_edge_triggered_events = OnNewMessages;
     }
+    if (options.use_shm) {
+        options.app_connect = std::make_shared<shm::ShmConnect>();
+    }
     // Enable keepalive by options or Gflag.
     // Priority: options > Gflag.
     if (options.keepalive_options || FLAGS_socket_keepalive) {
@@ -586,6 +677,19 @@ int InputMessenger::FindProtocolIndex(ProtocolType type) const {
 
 }
 
+int InputMessenger::PinProtocol(const char* name) {
+    if (name == NULL || *name == '\0') {
+        _pinned_index = -1;
+        return 0;
+    }
+    const int index = FindProtocolIndex(name);
+    if (index < 0) {
+        return -1;
+    }
+    _pinned_index = index;
+    return 0;
+}
+
 const char* InputMessenger::NameOfProtocol(int n) const {
     if (n < 0 || (size_t)n >= _capacity || _handlers[n].parse == NULL) {
         return "unknown";  // use lowercase to be consistent with valid names.
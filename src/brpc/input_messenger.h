@@ -29,6 +29,9 @@ namespace brpc {
 namespace rdma {
 class RdmaEndpoint;
 }
+namespace shm {
+class ShmEndpoint;
+}
 
 struct InputMessageHandler {
     // The callback to cut a message from `source'.
@@ -74,6 +77,7 @@ struct InputMessageHandler {
 // `Message' corresponds to a client's request or a server's response.
 class InputMessenger : public SocketUser {
 friend class rdma::RdmaEndpoint;
+friend class shm::ShmEndpoint;
 public:
     explicit InputMessenger(size_t capacity = 128);
     ~InputMessenger();
@@ -100,6 +104,13 @@ public:
     // Get name of the n-th handler
     const char* NameOfProtocol(int n) const;
 
+    // [Not thread-safe, call before creating sockets]
+    // Parse messages with the handler named `name' only instead of trying
+    // all handlers, messages of other protocols fail the connection
+    // directly. NULL or empty `name' restores protocol detection.
+    // Returns 0 on success, -1 if no handler is named `name'.
+    int PinProtocol(const char* name);
+
     // Add a handler which doesn't belong to any registered protocol.
     // Note: Invoking this method indicates that you are using Socket without
     // Channel nor Server. 
@@ -146,6 +157,8 @@ private:
     butil::atomic<int> _max_index;
     bool _non_protocol;
     size_t _capacity;
+    // Index of the only handler to try, -1 means trying all.
+    int _pinned_index;
 
     butil::Mutex _add_handler_mutex;
 };
@@ -20,6 +20,7 @@
 #include "brpc/reloadable_flags.h"
 #include "brpc/load_balancer.h"
 #include "brpc/socket.h"
+#include "brpc/controller.h"
 
 
 namespace brpc {
@@ -44,6 +45,18 @@ bool LoadBalancer::IsServerAvailable(SocketId id, SocketUniquePtr* out) {
     return res;
 }
 
+int64_t LoadBalancer::AdjustLatencyByServerLoad(int64_t latency_us,
+                                                const Controller* cntl) {
+    if (cntl == NULL || cntl->server_load() <= 500) {
+        return latency_us;
+    }
+    // Queueing delays rise sharply when servers are close to their limits,
+    // roughly 1/(1-load). Start penalizing from half loaded: 2x at 75%,
+    // 5x at 90% and at most 10x.
+    const int64_t headroom = std::max(1000 - cntl->server_load(), 50);
+    return latency_us * 500 / headroom;
+}
+
 void SharedLoadBalancer::DescribeLB(std::ostream& os, void* arg) {
     (static_cast<SharedLoadBalancer*>(arg))->Describe(os, DescribeOptions());
 }
@@ -109,6 +109,13 @@ protected:
     // Returns true and set `out' if the server is available (not failed, not logoff).
     // Otherwise, returns false.
     static bool IsServerAvailable(SocketId id, SocketUniquePtr* out);
+
+    // Enlarge `latency_us' of a call by the load reported by the server in
+    // `cntl', so that servers close to their max_concurrency are avoided
+    // before their latencies rise. Returns `latency_us' unchanged if the
+    // load is not reported.
+    static int64_t AdjustLatencyByServerLoad(int64_t latency_us,
+                                             const Controller* cntl);
 };
 
 DECLARE_bool(show_lb_in_vars);
@@ -802,5 +802,14 @@ bool MemcacheResponse::PopVersion(std::string* version) {
     _err.clear();
     return true;
 }
- 
+
+MemcacheService::Status MemcacheService::Store(
+    StoreMode, const butil::IOBuf&, uint32_t, MemcacheItem*) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
+MemcacheService::Status MemcacheService::Delete(const butil::IOBuf&) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
 } // namespace brpc
@@ -20,6 +20,7 @@
 #define BRPC_MEMCACHE_H
 
 #include <string>
+#include <vector>
 
 #include "butil/iobuf.h"
 #include "butil/strings/string_piece.h"
@@ -218,6 +219,54 @@ private:
     mutable int _cached_size_;
 };
 
+// An item stored in memcache.
+struct MemcacheItem {
+    MemcacheItem() : flags(0), cas_value(0) {}
+
+    butil::IOBuf value;
+    uint32_t flags;
+    uint64_t cas_value;
+};
+
+// Serves memcache binary protocol on server side.
+// Assign an instance to ServerOptions.memcache_service to enable it.
+// Pipelined commands parsed from one read of a connection are handled in
+// order and their responses are sent in one write. Consecutive GET, GETQ,
+// GETK and GETKQ among them are looked up with one MultiGet(). Keys and
+// values of requests reference blocks read from the connection, values of
+// responses are sent without copying.
+class MemcacheService {
+public:
+    typedef MemcacheResponse::Status Status;
+
+    enum StoreMode {
+        STORE_SET,
+        STORE_ADD,      // Fail if the key exists
+        STORE_REPLACE,  // Fail if the key does not exist
+    };
+
+    virtual ~MemcacheService() {}
+
+    // Look up `keys'. Set (*statuses)[i] to STATUS_SUCCESS and fill
+    // (*items)[i] if keys[i] is found, otherwise STATUS_KEY_ENOENT.
+    // `statuses' and `items' are resized to keys.size() before calling.
+    virtual void MultiGet(const std::vector<butil::IOBuf>& keys,
+                          std::vector<Status>* statuses,
+                          std::vector<MemcacheItem>* items) = 0;
+
+    // Store `item' with `key' for SET/ADD/REPLACE and their quiet versions.
+    // If item->cas_value is non-zero, the operation must only succeed when
+    // the version of the stored item is identical. Set item->cas_value to
+    // the new version on success.
+    // Default: STATUS_UNKNOWN_COMMAND
+    virtual Status Store(StoreMode mode, const butil::IOBuf& key,
+                         uint32_t exptime, MemcacheItem* item);
+
+    // Delete `key' for DELETE and DELETEQ.
+    // Default: STATUS_UNKNOWN_COMMAND
+    virtual Status Delete(const butil::IOBuf& key);
+};
+
 } // namespace brpc
 
 #endif  // BRPC_MEMCACHE_H
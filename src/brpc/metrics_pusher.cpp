@@ -0,0 +1,315 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <stdlib.h>
+#include <algorithm>
+#include <unordered_map>
+#include <gflags/gflags.h>
+#include "butil/fast_rand.h"
+#include "butil/time.h"
+#include "butil/string_splitter.h"
+#include "butil/third_party/snappy/snappy.h"
+#include "bvar/bvar.h"
+#include "brpc/log.h"
+#include "brpc/channel.h"
+#include "brpc/prometheus_remote_write.pb.h"
+#include "brpc/metrics_pusher.h"
+
+namespace bvar {
+DECLARE_int32(bvar_max_dump_multi_dimension_metric_number);
+}
+
+namespace brpc {
+
+DEFINE_string(metrics_push_url, "",
+              "Push exposed bvars to this Prometheus remote write endpoint, "
+              "e.g. http://127.0.0.1:9090/api/v1/write. Empty disables pushing");
+DEFINE_int32(metrics_push_interval_s, 10, "Push bvars every so many seconds");
+DEFINE_int32(metrics_push_full_interval_s, 120,
+             "Series unchanged since the last push are not sent again, "
+             "but all series are sent at least once in so many seconds");
+DEFINE_int32(metrics_push_max_series_per_request, 5000,
+             "Max number of series in one remote write request");
+DEFINE_int32(metrics_push_timeout_ms, 3000, "Timeout of pushing requests");
+DEFINE_double(metrics_push_max_cpu_percent, 1,
+              "Collecting and encoding bvars use at most so many percent of "
+              "one cpu, the interval is enlarged otherwise");
+DEFINE_string(metrics_push_labels, "",
+              "Labels added to all pushed series, in form of k1=v1,k2=v2");
+
+// Only accessed by the thread calling PushMetrics().
+static Channel* s_push_chan = NULL;
+static std::string* s_push_url = NULL;
+static int64_t s_next_push_us = 0;
+static int64_t s_next_full_push_us = 0;
+// Values of series in the last push, keyed by bvar names.
+static std::unordered_map<std::string, double>* s_last_values = NULL;
+// Pushing requests not finished yet.
+static butil::atomic<int> s_push_inflight(0);
+
+int ParsePushedSeries(const butil::StringPiece& name,
+                      const butil::StringPiece& desc,
+                      PushedSeries* series) {
+    if (desc.empty()) {
+        return -1;
+    }
+    // desc is not null-terminated.
+    char buf[64];
+    if (desc.size() >= sizeof(buf)) {
+        return -1;
+    }
+    memcpy(buf, desc.data(), desc.size());
+    buf[desc.size()] = '\0';
+    char* endptr = NULL;
+    series->value = strtod(buf, &endptr);
+    if (endptr != buf + desc.size()) {
+        // Strings, vectors and so on.
+        return -1;
+    }
+    series->labels.clear();
+    const size_t brace = name.find('{');
+    if (brace == butil::StringPiece::npos) {
+        series->name.assign(name.data(), name.size());
+        return 0;
+    }
+    series->name.assign(name.data(), brace);
+    // Labels are printed as k1="v1",k2="v2" without escaping, see
+    // MultiDimension::make_labels_kvpair_string().
+    butil::StringPiece rest = name.substr(brace + 1);
+    while (!rest.empty() && rest[0] != '}') {
+        const size_t eq = rest.find("=\"");
+        if (eq == butil::StringPiece::npos) {
+            return -1;
+        }
+        size_t end = rest.find("\",", eq + 2);
+        if (end == butil::StringPiece::npos) {
+            end = rest.find("\"}", eq + 2);
+            if (end == butil::StringPiece::npos) {
+                return -1;
+            }
+        }
+        series->labels.emplace_back(rest.substr(0, eq).as_string(),
+                                    rest.substr(eq + 2, end - eq - 2).as_string());
+        rest.remove_prefix(end + 1);
+        if (!rest.empty() && rest[0] == ',') {
+            rest.remove_prefix(1);
+        }
+    }
+    return rest.empty() ? -1 : 0;
+}
+
+void AppendRemoteWriteSeries(
+    const PushedSeries& series,
+    const std::vector<std::pair<std::string, std::string> >& extra_labels,
+    int64_t timestamp_ms, RemoteWriteRequest* req) {
+    std::vector<std::pair<std::string, std::string> > labels;
+    labels.reserve(series.labels.size() + extra_labels.size() + 1);
+    labels.emplace_back("__name__", series.name);
+    labels.insert(labels.end(), series.labels.begin(), series.labels.end());
+    labels.insert(labels.end(), extra_labels.begin(), extra_labels.end());
+    // Receivers require labels to be sorted by name.
+    std::sort(labels.begin(), labels.end());
+    RemoteWriteTimeSeries* ts = req->add_timeseries();
+    for (size_t i = 0; i < labels.size(); ++i) {
+        RemoteWriteLabel* label = ts->add_labels();
+        label->set_name(labels[i].first);
+        label->set_value(labels[i].second);
+    }
+    RemoteWriteSample* sample = ts->add_samples();
+    sample->set_value(series.value);
+    sample->set_timestamp(timestamp_ms);
+}
+
+// Collect numeric bvars.
+class PushedSeriesDumper : public bvar::Dumper {
+public:
+    explicit PushedSeriesDumper(std::vector<PushedSeries>* out) : _out(out) {}
+
+    bool dump(const std::string& name, const butil::StringPiece& desc) override {
+        Append(name, desc);
+        return true;
+    }
+    bool dump_mvar(const std::string& name, const butil::StringPiece& desc) override {
+        Append(name, desc);
+        return true;
+    }
+    bool dump_comment(const std::string&, const std::string&) override {
+        return true;
+    }
+
+private:
+    void Append(const std::string& name, const butil::StringPiece& desc) {
+        _out->emplace_back();
+        if (ParsePushedSeries(name, desc, &_out->back()) != 0) {
+            _out->pop_back();
+        }
+    }
+
+    std::vector<PushedSeries>* _out;
+};
+
+static void HandlePushResponse(Controller* cntl) {
+    if (cntl->Failed()) {
+        LOG_EVERY_SECOND(WARNING) << "Fail to push metrics to "
+                                  << FLAGS_metrics_push_url << ", "
+                                  << cntl->ErrorText();
+    }
+    delete cntl;
+    s_push_inflight.fetch_sub(1, butil::memory_order_relaxed);
+}
+
+static void SendRemoteWriteRequest(const RemoteWriteRequest& req) {
+    std::string raw;
+    if (!req.SerializeToString(&raw)) {
+        LOG(WARNING) << "Fail to serialize RemoteWriteRequest";
+        return;
+    }
+    std::string compressed;
+    butil::snappy::Compress(raw.data(), raw.size(), &compressed);
+    Controller* cntl = new Controller;
+    cntl->http_request().uri() = *s_push_url;
+    cntl->http_request().set_method(HTTP_METHOD_POST);
+    cntl->http_request().set_content_type("application/x-protobuf");
+    cntl->http_request().SetHeader("Content-Encoding", "snappy");
+    cntl->http_request().SetHeader("X-Prometheus-Remote-Write-Version", "0.1.0");
+    cntl->request_attachment().append(compressed);
+    s_push_inflight.fetch_add(1, butil::memory_order_relaxed);
+    s_push_chan->CallMethod(NULL, cntl, NULL, NULL,
+                            brpc::NewCallback(&HandlePushResponse, cntl));
+}
+
+static void PushMetricsNow(int64_t now_us) {
+    if (s_push_chan == NULL || *s_push_url != FLAGS_metrics_push_url) {
+        Channel* chan = new (std::nothrow) Channel;
+        if (chan == NULL) {
+            LOG(FATAL) << "Fail to new metrics push channel";
+            return;
+        }
+        ChannelOptions opt;
+        opt.protocol = PROTOCOL_HTTP;
+        opt.timeout_ms = FLAGS_metrics_push_timeout_ms;
+        if (chan->Init(FLAGS_metrics_push_url.c_str(), "", &opt) != 0) {
+            LOG(WARNING) << "Fail to connect to " << FLAGS_metrics_push_url;
+            delete chan;
+            return;
+        }
+        // Pending requests may still use the old channel, leak it since
+        // changing the url is rare.
+        s_push_chan = chan;
+        if (s_push_url == NULL) {
+            s_push_url = new std::string;
+            s_last_values = new std::unordered_map<std::string, double>;
+        }
+        *s_push_url = FLAGS_metrics_push_url;
+        s_last_values->clear();
+    }
+    if (s_push_inflight.load(butil::memory_order_relaxed) > 0) {
+        // The receiver is slow, don't pile up requests.
+        LOG_EVERY_SECOND(WARNING) << "Skip pushing metrics because previous"
+                                     " pushes to " << *s_push_url
+                                  << " are not finished";
+        return;
+    }
+
+    std::vector<PushedSeries> series;
+    PushedSeriesDumper dumper(&series);
+    if (bvar::Variable::dump_exposed(&dumper, NULL) < 0) {
+        return;
+    }
+    if (bvar::FLAGS_bvar_max_dump_multi_dimension_metric_number > 0) {
+        bvar::MVariableBase::dump_exposed(&dumper, NULL);
+    }
+    std::vector<std::pair<std::string, std::string> > extra_labels;
+    for (butil::StringSplitter sp(FLAGS_metrics_push_labels.c_str(), ',');
+         sp; ++sp) {
+        const butil::StringPiece kv(sp.field(), sp.length());
+        const size_t eq = kv.find('=');
+        if (eq != butil::StringPiece::npos) {
+            extra_labels.emplace_back(kv.substr(0, eq).as_string(),
+                                      kv.substr(eq + 1).as_string());
+        }
+    }
+
+    // Counters are mostly unchanged between pushes in idle processes, only
+    // send changed series, and resend all periodically so that receivers
+    // don't consider unchanged series as stale.
+    const bool full = (now_us >= s_next_full_push_us);
+    if (full) {
+        s_next_full_push_us =
+            now_us + FLAGS_metrics_push_full_interval_s * 1000000L;
+    }
+    const int64_t timestamp_ms = now_us / 1000L;
+    const int max_series = std::max(FLAGS_metrics_push_max_series_per_request, 1);
+    std::unordered_map<std::string, double> values;
+    values.reserve(series.size());
+    RemoteWriteRequest req;
+    std::string key;
+    for (size_t i = 0; i < series.size(); ++i) {
+        const PushedSeries& s = series[i];
+        key = s.name;
+        for (size_t j = 0; j < s.labels.size(); ++j) {
+            key.push_back('\0');
+            key.append(s.labels[j].second);
+        }
+        values[key] = s.value;
+        if (!full) {
+            auto it = s_last_values->find(key);
+            if (it != s_last_values->end() && it->second == s.value) {
+                continue;
+            }
+        }
+        AppendRemoteWriteSeries(s, extra_labels, timestamp_ms, &req);
+        if (req.timeseries_size() >= max_series) {
+            SendRemoteWriteRequest(req);
+            req.Clear();
+        }
+    }
+    if (req.timeseries_size() > 0) {
+        SendRemoteWriteRequest(req);
+    }
+    s_last_values->swap(values);
+}
+
+// Called in global.cpp
+// [Not thread-safe] supposed to be called by one thread in low frequency.
+void PushMetrics() {
+    if (FLAGS_metrics_push_url.empty()) {
+        return;
+    }
+    const int64_t now_us = butil::gettimeofday_us();
+    if (s_next_push_us == 0) {
+        // Delay the first push randomly, pods started together don't push
+        // at the same time.
+        s_next_push_us = now_us + butil::fast_rand_less_than(
+            std::max(FLAGS_metrics_push_interval_s, 1)) * 1000000L;
+    }
+    if (now_us < s_next_push_us) {
+        return;
+    }
+    const int64_t start_us = butil::cpuwide_time_us();
+    PushMetricsNow(now_us);
+    const int64_t cost_us = butil::cpuwide_time_us() - start_us;
+    int64_t interval_us = FLAGS_metrics_push_interval_s * 1000000L;
+    if (FLAGS_metrics_push_max_cpu_percent > 0) {
+        // Enlarge the interval to keep cost_us/interval_us in budget.
+        interval_us = std::max(interval_us, (int64_t)(
+            cost_us * 100 / FLAGS_metrics_push_max_cpu_percent));
+    }
+    s_next_push_us = now_us + interval_us;
+}
+
+} // namespace brpc
@@ -0,0 +1,60 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_METRICS_PUSHER_H
+#define BRPC_METRICS_PUSHER_H
+
+// [Internal] RPC users are not supposed to call functions below.
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "butil/strings/string_piece.h"
+
+namespace brpc {
+
+class RemoteWriteRequest;
+
+// Call this function every second (or every several seconds) to push
+// exposed bvars to -metrics_push_url every -metrics_push_interval_s seconds.
+void PushMetrics();
+
+// A series parsed from a bvar name.
+struct PushedSeries {
+    std::string name;
+    // Labels of multi-dimensional bvars.
+    std::vector<std::pair<std::string, std::string> > labels;
+    double value;
+};
+
+// Parse `name' like `foo{k1="v1",k2="v2"}' and numeric `desc' into `series'.
+// Returns 0 on success, -1 if `desc' is not a number or `name' is malformed.
+int ParsePushedSeries(const butil::StringPiece& name,
+                      const butil::StringPiece& desc,
+                      PushedSeries* series);
+
+// Append `series' with `extra_labels' to `req' as a sample at `timestamp_ms'.
+void AppendRemoteWriteSeries(
+    const PushedSeries& series,
+    const std::vector<std::pair<std::string, std::string> >& extra_labels,
+    int64_t timestamp_ms, RemoteWriteRequest* req);
+
+} // namespace brpc
+
+
+#endif // BRPC_METRICS_PUSHER_H
@@ -35,6 +35,17 @@ enum MongoOpCode {
     MONGO_OPCODE_GET_MORE      = 2005,
     MONGO_OPCODE_DELETE        = 2006,
     MONGO_OPCODE_KILL_CURSORS  = 2007,
+    MONGO_OPCODE_COMPRESSED    = 2012,
+    MONGO_OPCODE_OP_MSG        = 2013,
+};
+
+// Compressors of OP_COMPRESSED.
+// https://www.mongodb.com/docs/manual/reference/mongodb-wire-protocol/#op_compressed
+enum MongoCompressorId {
+    MONGO_COMPRESSOR_NOOP   = 0,
+    MONGO_COMPRESSOR_SNAPPY = 1,
+    MONGO_COMPRESSOR_ZLIB   = 2,
+    MONGO_COMPRESSOR_ZSTD   = 3,
 };
 
 inline bool is_mongo_opcode(int32_t op_code) {
@@ -47,6 +58,8 @@ inline bool is_mongo_opcode(int32_t op_code) {
     case MONGO_OPCODE_GET_MORE:      return true; 
     case MONGO_OPCODE_DELETE:        return true; 
     case MONGO_OPCODE_KILL_CURSORS : return true;
+    case MONGO_OPCODE_COMPRESSED:    return true;
+    case MONGO_OPCODE_OP_MSG:        return true;
     }
     return false;
 }
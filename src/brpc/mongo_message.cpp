@@ -0,0 +1,120 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/logging.h"
+#include "brpc/mongo_message.h"
+
+
+namespace brpc {
+
+// Sizes of the length prefix and the trailing '\0' of a BSON document.
+static const size_t BSON_MIN_SIZE = 5;
+
+static bool CutInt32(butil::IOBuf* buf, int32_t* v) {
+    return buf->cutn(v, sizeof(*v)) == sizeof(*v);
+}
+
+int CutBsonDocument(butil::IOBuf* docs, butil::IOBuf* doc) {
+    int32_t len = 0;
+    if (docs->copy_to(&len, sizeof(len)) != sizeof(len) ||
+        len < (int32_t)BSON_MIN_SIZE || (size_t)len > docs->size()) {
+        return -1;
+    }
+    doc->clear();
+    docs->cutn(doc, len);
+    return 0;
+}
+
+int ParseMongoMsg(const butil::IOBuf& payload, MongoMsg* msg) {
+    // Sections reference blocks of `buf' which shares blocks with `payload'.
+    butil::IOBuf buf(payload);
+    int32_t flag_bits = 0;
+    if (!CutInt32(&buf, &flag_bits)) {
+        return -1;
+    }
+    msg->flag_bits = (uint32_t)flag_bits;
+    msg->body.clear();
+    msg->sequences.clear();
+    if (msg->flag_bits & MONGO_MSG_CHECKSUM_PRESENT) {
+        if (buf.size() < sizeof(uint32_t)) {
+            return -1;
+        }
+        buf.pop_back(sizeof(uint32_t));
+        msg->flag_bits &= ~(uint32_t)MONGO_MSG_CHECKSUM_PRESENT;
+    }
+    bool has_body = false;
+    while (!buf.empty()) {
+        uint8_t kind = 0;
+        buf.cut1(&kind);
+        if (kind == 0) {
+            if (has_body || CutBsonDocument(&buf, &msg->body) != 0) {
+                LOG(WARNING) << "Invalid body section in OP_MSG";
+                return -1;
+            }
+            has_body = true;
+        } else if (kind == 1) {
+            int32_t size = 0;
+            if (!CutInt32(&buf, &size) || size < (int32_t)sizeof(size) ||
+                (size_t)size - sizeof(size) > buf.size()) {
+                LOG(WARNING) << "Invalid size of document sequence in OP_MSG";
+                return -1;
+            }
+            butil::IOBuf section;
+            buf.cutn(&section, size - sizeof(size));
+            msg->sequences.push_back(MongoDocumentSequence());
+            MongoDocumentSequence& seq = msg->sequences.back();
+            char c = 0;
+            while (section.cut1(&c) && c != '\0') {
+                seq.identifier.push_back(c);
+            }
+            if (c != '\0') {
+                LOG(WARNING) << "Unterminated identifier in OP_MSG";
+                return -1;
+            }
+            seq.documents.swap(section);
+        } else {
+            LOG(WARNING) << "Unknown section kind=" << (int)kind
+                         << " in OP_MSG";
+            return -1;
+        }
+    }
+    if (!has_body) {
+        LOG(WARNING) << "No body section in OP_MSG";
+        return -1;
+    }
+    return 0;
+}
+
+void SerializeMongoMsg(const MongoMsg& msg, butil::IOBuf* out) {
+    const uint32_t flag_bits =
+        msg.flag_bits & ~(uint32_t)MONGO_MSG_CHECKSUM_PRESENT;
+    out->append(&flag_bits, sizeof(flag_bits));
+    out->push_back(0);
+    out->append(msg.body);
+    for (size_t i = 0; i < msg.sequences.size(); ++i) {
+        const MongoDocumentSequence& seq = msg.sequences[i];
+        const int32_t size = sizeof(size) + seq.identifier.size() + 1 +
+            seq.documents.size();
+        out->push_back(1);
+        out->append(&size, sizeof(size));
+        out->append(seq.identifier.c_str(), seq.identifier.size() + 1);
+        out->append(seq.documents);
+    }
+}
+
+} // namespace brpc
@@ -0,0 +1,90 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_MONGO_MESSAGE_H
+#define BRPC_MONGO_MESSAGE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "butil/iobuf.h"
+
+
+namespace brpc {
+
+// Bits of MongoMsg::flag_bits.
+// https://www.mongodb.com/docs/manual/reference/mongodb-wire-protocol/#op_msg
+enum MongoMsgFlag {
+    MONGO_MSG_CHECKSUM_PRESENT = (1 << 0),
+    // The client does not wait for a reply of this message.
+    MONGO_MSG_MORE_TO_COME     = (1 << 1),
+    MONGO_MSG_EXHAUST_ALLOWED  = (1 << 16),
+};
+
+// A section of kind 1 in OP_MSG.
+struct MongoDocumentSequence {
+    std::string identifier;
+    // Concatenated BSON documents, cut them one by one with
+    // CutBsonDocument().
+    butil::IOBuf documents;
+};
+
+// Body of an OP_MSG(opcode 2013) without mongo_head_t. BSON documents are
+// kept as IOBuf referencing the received data instead of being copied,
+// decode them with any BSON library after flattening.
+//
+// In MongoService of a server with mongo_service_adaptor:
+//  - A request in OP_MSG is put in cntl->request_attachment() without
+//    copying and MongoRequest::message is empty, parse it with
+//    ParseMongoMsg().
+//  - To reply OP_MSG, set op_code of the response header to DB_OP_MSG
+//    and put the serialized MongoMsg in cntl->response_attachment(),
+//    message_length is filled by the framework.
+//  - Requests with MONGO_MSG_MORE_TO_COME are not replied.
+//  - Requests in OP_COMPRESSED(snappy, zlib, or zstd when brpc is built
+//    with it) reach the service decompressed, and OP_MSG replies to them
+//    are compressed with the same compressor.
+// Requests pipelined in one connection are processed concurrently and
+// replied in the order of completion, matched by response_to.
+struct MongoMsg {
+    MongoMsg() : flag_bits(0) {}
+
+    uint32_t flag_bits;
+    // The section of kind 0, exactly one BSON document.
+    butil::IOBuf body;
+    // Sections of kind 1.
+    std::vector<MongoDocumentSequence> sequences;
+};
+
+// Parse `payload' which is the OP_MSG after mongo_head_t into `msg'. The
+// trailing checksum (if any) is not verified and
+// MONGO_MSG_CHECKSUM_PRESENT is cleared.
+// Returns 0 on success, -1 when `payload' is malformed.
+int ParseMongoMsg(const butil::IOBuf& payload, MongoMsg* msg);
+
+// Append `msg' as the part of OP_MSG after mongo_head_t to `out'. No
+// checksum is appended, MONGO_MSG_CHECKSUM_PRESENT is ignored.
+void SerializeMongoMsg(const MongoMsg& msg, butil::IOBuf* out);
+
+// Cut the first BSON document of `docs' into `doc'.
+// Returns 0 on success, -1 when `docs' is empty or malformed.
+int CutBsonDocument(butil::IOBuf* docs, butil::IOBuf* doc);
+
+} // namespace brpc
+
+
+#endif // BRPC_MONGO_MESSAGE_H
@@ -36,8 +36,12 @@ namespace brpc {
 class NamingServiceActions {
 public:
     virtual ~NamingServiceActions() {}
+    // Add/remove some servers. Naming services getting changes (rather
+    // than full lists) from the source should call these methods, which
+    // cost much less than ResetServers() when there're lots of servers.
     virtual void AddServers(const std::vector<ServerNode>& servers) = 0;
     virtual void RemoveServers(const std::vector<ServerNode>& servers) = 0;
+    // Replace all servers with `servers'.
     virtual void ResetServers(const std::vector<ServerNode>& servers) = 0;
 };
 
@@ -21,7 +21,9 @@
 #include "butil/atomicops.h"
 #include "butil/time.h"
 #include "butil/macros.h"
+#include "butil/synchronization/lock.h"
 #include "brpc/details/controller_private_accessor.h"
+#include "brpc/details/serialized_request_cache.h"
 #include "brpc/parallel_channel.h"
 
 namespace brpc {
@@ -39,17 +41,20 @@ static __thread Memory tls_cached_pchan_mem = { 0, NULL };
 
 class ParallelChannelDone : public google::protobuf::Closure {
 private:
-    ParallelChannelDone(int fail_limit, int success_limit,
+    ParallelChannelDone(int fail_limit, int success_limit, bool incremental_merge,
                         int ndone, int nchan, int memsize,
                         Controller* cntl, google::protobuf::Closure* user_done)
         : _fail_limit(fail_limit)
         , _success_limit(success_limit)
+        , _incremental_merge(incremental_merge)
         , _ndone(ndone)
         , _nchan(nchan)
         , _memsize(memsize)
         , _current_success(0)
         , _current_fail(0)
         , _current_done(0)
+        , _stopped_early(false)
+        , _fail_all_index(-1)
         , _cntl(cntl)
         , _user_done(user_done)
         , _callmethod_bthread(INVALID_BTHREAD)
@@ -84,7 +89,7 @@ public:
     };
     
     static ParallelChannelDone* Create(
-        int fail_limit, int success_limit,
+        int fail_limit, int success_limit, bool incremental_merge,
         int ndone, const SubCall* aps, int nchan,
         Controller* cntl, google::protobuf::Closure* user_done) {
         // We need to create the object in this way because _sub_done is
@@ -127,7 +132,8 @@ public:
         }
 #endif
         auto d = new (mem) ParallelChannelDone(
-            fail_limit, success_limit, ndone, nchan, memsize, cntl, user_done);
+            fail_limit, success_limit, incremental_merge,
+            ndone, nchan, memsize, cntl, user_done);
 
         // Apply client settings of _cntl to controllers of sub calls, except
         // timeout. If we let sub channel do their timeout separately, when
@@ -219,12 +225,33 @@ public:
             int error_code = fin->cntl.ErrorCode();
             // EPCHANFINISH is not an error of sub calls.
             bool fail = 0 != error_code && EPCHANFINISH != error_code;
+            // Error to stop other sub calls decided by ResponseMerger.
+            int stop_error = 0;
+            if (_incremental_merge) {
+                if (0 == error_code) {
+                    switch (MergeIncrementally(fin)) {
+                    case ResponseMerger::MERGED:
+                        break;
+                    case ResponseMerger::FAIL:
+                        fail = true;
+                        break;
+                    case ResponseMerger::FAIL_ALL:
+                        fail = true;
+                        stop_error = ECANCELED;
+                        break;
+                    case ResponseMerger::FINISH:
+                        stop_error = EPCHANFINISH;
+                        break;
+                    }
+                }
+                ReleaseSubResponse(fin);
+            }
             bool cancel =
                 // Count failed sub calls, if `fail_limit' is reached, cancel others.
                 (fail && _current_fail.fetch_add(1, butil::memory_order_relaxed) + 1
                          == _fail_limit) ||
                 // Count successful sub calls, if `success_limit' is reached, cancel others.
-                (0 == error_code &&
+                (!fail && 0 == error_code &&
                  _current_success.fetch_add(1, butil::memory_order_relaxed) + 1
                  == _success_limit);
 
@@ -238,6 +265,15 @@ public:
                     }
                 }
             }
+            if (stop_error != 0 &&
+                !_stopped_early.exchange(true, butil::memory_order_relaxed)) {
+                for (int i = 0; i < _ndone; ++i) {
+                    SubDone* sd = sub_done(i);
+                    if (fin != sd) {
+                        bthread_id_error(sd->cntl.call_id(), stop_error);
+                    }
+                }
+            }
             // NOTE: Don't access any member after the fetch_add because
             // another thread may already go down and Destroy()-ed this object.
             const uint32_t saved_ndone = _ndone;
@@ -304,6 +340,43 @@ public:
         }
     }
 
+    // Merge response of the successful sub call `sd' into the response to
+    // ParallelChannel. Called when sub calls finish with incremental_merge.
+    ResponseMerger::Result MergeIncrementally(SubDone* sd) {
+        const int index = sd - sub_done(0);
+        google::protobuf::Message* sub_res = sd->cntl._response;
+        BAIDU_SCOPED_LOCK(_merge_mutex);
+        if (_fail_all_index >= 0) {
+            // The RPC is going to fail, no need to merge.
+            return ResponseMerger::FAIL_ALL;
+        }
+        ResponseMerger::Result res = ResponseMerger::MERGED;
+        if (sd->merger == NULL) {
+            try {
+                _cntl->_response->MergeFrom(*sub_res);
+            } catch (const std::exception& e) {
+                _merge_error = e.what();
+                res = ResponseMerger::FAIL_ALL;
+            }
+        } else {
+            res = sd->merger->Merge(_cntl->_response, sub_res);
+        }
+        if (res == ResponseMerger::FAIL_ALL) {
+            _fail_all_index = index;
+        }
+        return res;
+    }
+
+    // Delete response of finished sub call `sd' if it's owned by pchan.
+    static void ReleaseSubResponse(SubDone* sd) {
+        if (sd->ap.flags & DELETE_RESPONSE) {
+            delete sd->ap.response;
+            sd->ap.response = NULL;
+            sd->ap.flags &= ~DELETE_RESPONSE;
+            sd->cntl._response = NULL;
+        }
+    }
+
     void OnComplete() {
         // [ Rendezvous point ]
         // One and only one thread arrives here.
@@ -316,7 +389,19 @@ public:
         // to be failed since the RPC is still considered to be successful if
         // nfailed is less than fail_limit
         int nfailed = _current_fail.load(butil::memory_order_relaxed);
-        if (nfailed < _fail_limit) {
+        if (_incremental_merge) {
+            // Responses were merged in OnSubDoneRun().
+            if (_fail_all_index >= 0) {
+                nfailed = _ndone;
+                if (!_merge_error.empty()) {
+                    _cntl->SetFailed(ERESPONSE, "%s", _merge_error.c_str());
+                } else {
+                    _cntl->SetFailed(
+                        ERESPONSE, "Fail to merge response of channel[%d]",
+                        _fail_all_index);
+                }
+            }
+        } else if (nfailed < _fail_limit) {
             for (int i = 0; i < _ndone; ++i) {
                 SubDone* sd = sub_done(i);
                 google::protobuf::Message* sub_res = sd->cntl._response;
@@ -334,6 +419,7 @@ public:
                             sd->merger->Merge(_cntl->_response, sub_res);
                         switch (res) {
                         case ResponseMerger::MERGED:
+                        case ResponseMerger::FINISH:
                             break;
                         case ResponseMerger::FAIL:
                             ++nfailed;
@@ -399,6 +485,8 @@ public:
         CHECK_EQ(0, bthread_id_unlock_and_destroy(saved_cid));
     }
 
+    SerializedRequestCache* request_cache() { return &_request_cache; }
+
     int sub_done_size() const { return _ndone; }
     SubDone* sub_done(int i) { return &_sub_done[i]; }
     const SubDone* sub_done(int i) const { return &_sub_done[i]; }
@@ -431,6 +519,7 @@ public:
 private:
     int _fail_limit;
     int _success_limit;
+    bool _incremental_merge;
     int _ndone;
     int _nchan;
 #if defined(__clang__)
@@ -441,10 +530,17 @@ private:
     butil::atomic<int> _current_success;
     butil::atomic<int> _current_fail;
     butil::atomic<uint32_t> _current_done;
+    butil::atomic<bool> _stopped_early;
+    // Protecting the response to ParallelChannel from concurrent merging,
+    // and fields below.
+    butil::Mutex _merge_mutex;
+    int _fail_all_index;
+    std::string _merge_error;
     Controller* _cntl;
     google::protobuf::Closure* _user_done;
     bthread_t _callmethod_bthread;
     pthread_t _callmethod_pthread;
+    SerializedRequestCache _request_cache;
     SubDone _sub_done[0];
 };
 
@@ -612,6 +708,7 @@ void ParallelChannel::CallMethod(
     int ndone = nchan;
     int fail_limit = 1;
     int success_limit = 1;
+    int nshared = 0;
     DEFINE_SMALL_ARRAY(SubCall, aps, nchan, 64);
 
     if (cntl->FailedInline()) {
@@ -679,7 +776,8 @@ void ParallelChannel::CallMethod(
     }
 
     d = ParallelChannelDone::Create(
-        fail_limit, success_limit, ndone, aps, nchan, cntl, done);
+        fail_limit, success_limit, _options.incremental_merge,
+        ndone, aps, nchan, cntl, done);
     if (NULL == d) {
         cntl->SetFailed(ENOMEM, "Fail to new ParallelChannelDone");
         goto FAIL;
@@ -692,6 +790,18 @@ void ParallelChannel::CallMethod(
             sd->ap = aps[i];
             sd->shared_data = d;
             sd->merger = sub_chan.merger;
+            if (aps[i].request == request) {
+                ++nshared;
+            }
+        }
+    }
+    if (nshared > 1) {
+        // Sub calls sending the same request serialize it only once.
+        for (int i = 0; i < ndone; ++i) {
+            ParallelChannelDone::SubDone* sd = d->sub_done(i);
+            if (sd->ap.request == request) {
+                sd->cntl._request_cache = d->request_cache();
+            }
         }
     }
     cntl->_response = response;
@@ -137,7 +137,13 @@ public:
         FAIL,
 
         // make the call to ParallelChannel fail.
-        FAIL_ALL
+        FAIL_ALL,
+
+        // the response was merged successfully and is good enough, sub calls
+        // not finished yet are canceled and not counted as failures. Only
+        // effective when ParallelChannelOptions.incremental_merge is true,
+        // same as MERGED otherwise.
+        FINISH
     };
 
     virtual Result Merge(google::protobuf::Message* response,
@@ -172,6 +178,22 @@ struct ParallelChannelOptions {
     // does not return unless all sub RPC succeed.
     // Note: `success_limit' is only valid when `fail_limit' is not set.
     int success_limit{ -1};
+
+    // If true, the response of a successful sub RPC is merged (by
+    // ResponseMerger or MergeFrom) as soon as it comes back rather than
+    // after all sub RPC finish, and is deleted right after the merging if
+    // it's created with DELETE_RESPONSE. Peak memory does not grow with
+    // the number of sub channels, and ResponseMerger can end the RPC early
+    // by returning FINISH.
+    // Notes:
+    //  - Merge() are called one by one in the order sub RPC come back.
+    //  - Responses of sub RPC must not be parts of the response to
+    //    ParallelChannel (e.g. response->add_sub_response() in CallMapper),
+    //    which are written by sub RPC concurrently with the merging.
+    //  - Responses merged before the RPC fails are kept in the response.
+    //  - Controller::sub(i)->response() is NULL for deleted responses.
+    // Default: false
+    bool incremental_merge{false};
 };
 
 // ParallelChannel(aka "pchan") accesses all sub channels simultaneously with
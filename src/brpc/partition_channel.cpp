@@ -17,6 +17,7 @@
 
 
 #include "butil/containers/flat_map.h"
+#include "butil/time.h"
 #include "brpc/log.h"
 #include "brpc/load_balancer.h"
 #include "brpc/details/naming_service_thread.h"
@@ -187,7 +188,7 @@ void PartitionChannelBase::OnRemovedServers(
 // ================= PartitionChannel ====================
 
 PartitionChannelOptions::PartitionChannelOptions()
-    : ChannelOptions(), fail_limit(-1) {
+    : ChannelOptions(), fail_limit(-1), ramp_up_ms(0) {
 }
 
 PartitionChannel::PartitionChannel()
@@ -284,6 +285,41 @@ int PartitionChannel::CheckHealth() {
 
 // ================= DynamicPartitionChannel ====================
 
+// Weight of a partitioning method whose weight without ramping is `w' at
+// `now_us'. `ready_since_us' is when all partitions of the method have
+// servers, 0 for not yet, which is set by the first selection afterwards.
+// Exposed for testing.
+int RampUpPartitionWeight(int w, int64_t ramp_up_us,
+                          butil::atomic<int64_t>* ready_since_us,
+                          int64_t now_us) {
+    if (ramp_up_us <= 0) {
+        return w;
+    }
+    // Scale weights of all partitioning methods so that the ramping
+    // one can have a fraction of its capacity.
+    static const int64_t WEIGHT_SCALE = 256;
+    if (w <= 0) {
+        // Some partitions have no servers, ramp up again when they
+        // come back.
+        if (ready_since_us->load(butil::memory_order_relaxed) != 0) {
+            ready_since_us->store(0, butil::memory_order_relaxed);
+        }
+        return 0;
+    }
+    int64_t since = ready_since_us->load(butil::memory_order_relaxed);
+    if (since == 0) {
+        if (ready_since_us->compare_exchange_strong(
+                since, now_us, butil::memory_order_relaxed)) {
+            since = now_us;
+        }
+    }
+    const int64_t elapsed = now_us - since;
+    if (elapsed >= ramp_up_us) {
+        return w * WEIGHT_SCALE;
+    }
+    return std::max(w * WEIGHT_SCALE * elapsed / ramp_up_us, (int64_t)1);
+}
+
 class DynamicPartitionChannel::Partitioner : public NamingServiceWatcher {
 public:
     void PartitionServersIntoTemps(const std::vector<ServerId>& servers) {
@@ -315,6 +351,7 @@ public:
                     LOG(ERROR) << "Fail to new SubPartitionChannel";
                     continue;
                 }
+                pchan->ramp_up_us = _options.ramp_up_ms * 1000L;
                 if (pchan->Init(part.num_partition_kinds, _parser,
                                 _load_balancer_name.c_str(), &_options) != 0) {
                     LOG(ERROR) << "Fail to init SubPartitionChannel=#"
@@ -405,8 +442,25 @@ public:
 
 private:
     struct SubPartitionChannel : public PartitionChannelBase {
-        SubPartitionChannel() : num_servers(0) {}
+        SubPartitionChannel()
+            : num_servers(0), ramp_up_us(0), ready_since_us(0) {}
+
+        // Called by DynPartLoadBalancer to split traffic between
+        // partitioning methods.
+        int Weight() override {
+            const int w = PartitionChannelBase::Weight();
+            if (ramp_up_us <= 0) {
+                return w;
+            }
+            return RampUpPartitionWeight(w, ramp_up_us, &ready_since_us,
+                                         butil::cpuwide_time_us());
+        }
+
         int num_servers;
+        // Duration of ramping up traffic, 0 for no ramping.
+        int64_t ramp_up_us;
+        // Time when all partitions have servers, 0 for not yet.
+        butil::atomic<int64_t> ready_since_us;
         SelectiveChannel::ChannelHandle handle;  // uninitialized
         std::vector<ServerId> tmp;
     };
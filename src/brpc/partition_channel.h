@@ -67,6 +67,15 @@ struct PartitionChannelOptions : public ChannelOptions {
     // Sub channels in PartitionChannel share the same mapper and merger.
     butil::intrusive_ptr<CallMapper> call_mapper;
     butil::intrusive_ptr<ResponseMerger> response_merger;
+
+    // [DynamicPartitionChannel only] Traffic to a partitioning method that
+    // just became complete (all its partitions have servers) grows linearly
+    // to its full share in this duration rather than jumping to it, so that
+    // resharding (e.g. from 8 partitions to 16) shifts traffic gradually.
+    // All partitioning methods, including the ones found at startup, ramp
+    // from their first selection.
+    // Default: 0 (traffic is shifted at once)
+    int32_t ramp_up_ms;
 };
 
 // PartitionChannel is a specialized ParallelChannel whose sub channels are
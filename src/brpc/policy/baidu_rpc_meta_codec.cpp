@@ -0,0 +1,456 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "brpc/policy/baidu_rpc_meta.pb.h"
+#include "brpc/policy/baidu_rpc_meta_codec.h"
+
+
+namespace brpc {
+namespace policy {
+
+RpcRequestMetaFields::RpcRequestMetaFields()
+    : log_id(0), trace_id(0), span_id(0), parent_span_id(0)
+    , timeout_ms(0), method_index(0), priority(0), sampled(true)
+    , has_service_name(false), has_method_name(false), has_log_id(false)
+    , has_trace_id(false), has_span_id(false), has_parent_span_id(false)
+    , has_request_id(false), has_timeout_ms(false), has_method_index(false)
+    , has_priority(false), has_sampled(false) {}
+
+RpcResponseMetaFields::RpcResponseMetaFields()
+    : error_code(0), server_load(0)
+    , has_error_code(false), has_error_text(false), has_server_load(false) {}
+
+RpcMetaFields::RpcMetaFields()
+    : compress_type(0), correlation_id(0), attachment_size(0)
+    , content_type(0), checksum_type(0)
+    , has_request(false), has_response(false), has_compress_type(false)
+    , has_correlation_id(false), has_attachment_size(false)
+    , has_authentication_data(false), has_content_type(false)
+    , has_checksum_type(false), has_checksum_value(false) {}
+
+namespace {
+
+const int WIRETYPE_VARINT = 0;
+const int WIRETYPE_LENGTH_DELIMITED = 2;
+
+class WireReader {
+public:
+    explicit WireReader(const butil::StringPiece& s)
+        : _p(s.data()), _end(s.data() + s.size()) {}
+
+    bool done() const { return _p == _end; }
+
+    bool ReadVarint(uint64_t* v) {
+        uint64_t result = 0;
+        for (int shift = 0; shift < 64 && _p < _end; shift += 7) {
+            const uint8_t b = *_p++;
+            result |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                *v = result;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool ReadTag(uint32_t* field, int* wire_type) {
+        uint64_t tag = 0;
+        if (!ReadVarint(&tag) || tag > UINT32_MAX) {
+            return false;
+        }
+        *field = tag >> 3;
+        *wire_type = tag & 7;
+        return true;
+    }
+
+    bool ReadBytes(butil::StringPiece* s) {
+        uint64_t len = 0;
+        if (!ReadVarint(&len) || len > (uint64_t)(_end - _p)) {
+            return false;
+        }
+        s->set(_p, len);
+        _p += len;
+        return true;
+    }
+
+private:
+    const char* _p;
+    const char* _end;
+};
+
+bool ParseRequestMeta(const butil::StringPiece& s, RpcRequestMetaFields* f) {
+    WireReader r(s);
+    while (!r.done()) {
+        uint32_t field = 0;
+        int wire_type = 0;
+        if (!r.ReadTag(&field, &wire_type)) {
+            return false;
+        }
+        if (wire_type == WIRETYPE_VARINT) {
+            uint64_t v = 0;
+            if (!r.ReadVarint(&v)) {
+                return false;
+            }
+            switch (field) {
+            case 3: f->log_id = v; f->has_log_id = true; break;
+            case 4: f->trace_id = v; f->has_trace_id = true; break;
+            case 5: f->span_id = v; f->has_span_id = true; break;
+            case 6: f->parent_span_id = v; f->has_parent_span_id = true; break;
+            case 8: f->timeout_ms = (int32_t)v; f->has_timeout_ms = true; break;
+            case 9: f->method_index = (int32_t)v; f->has_method_index = true; break;
+            case 10: f->priority = (int32_t)v; f->has_priority = true; break;
+            case 11: f->sampled = (v != 0); f->has_sampled = true; break;
+            default: return false;
+            }
+        } else if (wire_type == WIRETYPE_LENGTH_DELIMITED) {
+            butil::StringPiece v;
+            if (!r.ReadBytes(&v)) {
+                return false;
+            }
+            switch (field) {
+            case 1: f->service_name = v; f->has_service_name = true; break;
+            case 2: f->method_name = v; f->has_method_name = true; break;
+            case 7: f->request_id = v; f->has_request_id = true; break;
+            default: return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ParseResponseMeta(const butil::StringPiece& s, RpcResponseMetaFields* f) {
+    WireReader r(s);
+    while (!r.done()) {
+        uint32_t field = 0;
+        int wire_type = 0;
+        if (!r.ReadTag(&field, &wire_type)) {
+            return false;
+        }
+        if (wire_type == WIRETYPE_VARINT) {
+            uint64_t v = 0;
+            if (!r.ReadVarint(&v)) {
+                return false;
+            }
+            switch (field) {
+            case 1: f->error_code = (int32_t)v; f->has_error_code = true; break;
+            case 3: f->server_load = (int32_t)v; f->has_server_load = true; break;
+            default: return false;
+            }
+        } else if (wire_type == WIRETYPE_LENGTH_DELIMITED && field == 2) {
+            if (!r.ReadBytes(&f->error_text)) {
+                return false;
+            }
+            f->has_error_text = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// All fields of RpcMeta have numbers less than 16, thus tags are 1 byte.
+inline char MakeTag(int field, int wire_type) {
+    return (char)((field << 3) | wire_type);
+}
+
+inline size_t VarintSize(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        ++n;
+    }
+    return n;
+}
+
+// Negative int32 are sign-extended to 10 bytes as protobuf does.
+inline size_t Int32Size(int32_t v) {
+    return VarintSize((uint64_t)(int64_t)v);
+}
+
+inline size_t BytesSize(const butil::StringPiece& s) {
+    return VarintSize(s.size()) + s.size();
+}
+
+inline char* WriteVarint(uint64_t v, char* p) {
+    while (v >= 0x80) {
+        *p++ = (char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (char)v;
+    return p;
+}
+
+inline char* WriteVarintField(int field, uint64_t v, char* p) {
+    *p++ = MakeTag(field, WIRETYPE_VARINT);
+    return WriteVarint(v, p);
+}
+
+inline char* WriteInt32Field(int field, int32_t v, char* p) {
+    return WriteVarintField(field, (uint64_t)(int64_t)v, p);
+}
+
+inline char* WriteBytesField(int field, const butil::StringPiece& s, char* p) {
+    *p++ = MakeTag(field, WIRETYPE_LENGTH_DELIMITED);
+    p = WriteVarint(s.size(), p);
+    memcpy(p, s.data(), s.size());
+    return p + s.size();
+}
+
+size_t RequestMetaByteSize(const RpcRequestMetaFields& f) {
+    size_t n = 0;
+    if (f.has_service_name) { n += 1 + BytesSize(f.service_name); }
+    if (f.has_method_name) { n += 1 + BytesSize(f.method_name); }
+    if (f.has_log_id) { n += 1 + VarintSize(f.log_id); }
+    if (f.has_trace_id) { n += 1 + VarintSize(f.trace_id); }
+    if (f.has_span_id) { n += 1 + VarintSize(f.span_id); }
+    if (f.has_parent_span_id) { n += 1 + VarintSize(f.parent_span_id); }
+    if (f.has_request_id) { n += 1 + BytesSize(f.request_id); }
+    if (f.has_timeout_ms) { n += 1 + Int32Size(f.timeout_ms); }
+    if (f.has_method_index) { n += 1 + Int32Size(f.method_index); }
+    if (f.has_priority) { n += 1 + Int32Size(f.priority); }
+    if (f.has_sampled) { n += 2; }
+    return n;
+}
+
+size_t ResponseMetaByteSize(const RpcResponseMetaFields& f) {
+    size_t n = 0;
+    if (f.has_error_code) { n += 1 + Int32Size(f.error_code); }
+    if (f.has_error_text) { n += 1 + BytesSize(f.error_text); }
+    if (f.has_server_load) { n += 1 + Int32Size(f.server_load); }
+    return n;
+}
+
+} // namespace
+
+bool ParseRpcMetaFields(const void* data, size_t size, RpcMetaFields* f) {
+    WireReader r(butil::StringPiece((const char*)data, size));
+    while (!r.done()) {
+        uint32_t field = 0;
+        int wire_type = 0;
+        if (!r.ReadTag(&field, &wire_type)) {
+            return false;
+        }
+        if (wire_type == WIRETYPE_VARINT) {
+            uint64_t v = 0;
+            if (!r.ReadVarint(&v)) {
+                return false;
+            }
+            switch (field) {
+            case 3: f->compress_type = (int32_t)v; f->has_compress_type = true; break;
+            case 4: f->correlation_id = v; f->has_correlation_id = true; break;
+            case 5: f->attachment_size = (int32_t)v; f->has_attachment_size = true; break;
+            case 10: f->content_type = (int32_t)v; f->has_content_type = true; break;
+            case 11: f->checksum_type = (int32_t)v; f->has_checksum_type = true; break;
+            default: return false;
+            }
+        } else if (wire_type == WIRETYPE_LENGTH_DELIMITED) {
+            butil::StringPiece v;
+            if (!r.ReadBytes(&v)) {
+                return false;
+            }
+            switch (field) {
+            case 1:
+                // Repeated sub-messages are merged, as protobuf does.
+                if (!ParseRequestMeta(v, &f->request)) {
+                    return false;
+                }
+                f->has_request = true;
+                break;
+            case 2:
+                if (!ParseResponseMeta(v, &f->response)) {
+                    return false;
+                }
+                f->has_response = true;
+                break;
+            case 7: f->authentication_data = v; f->has_authentication_data = true; break;
+            case 12: f->checksum_value = v; f->has_checksum_value = true; break;
+            default: return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    // Values of enums not defined are kept as unknown fields by protobuf.
+    if (f->has_content_type && !ContentType_IsValid(f->content_type)) {
+        return false;
+    }
+    // service_name and method_name are required.
+    return !f->has_request ||
+        (f->request.has_service_name && f->request.has_method_name);
+}
+
+size_t RpcMetaFieldsByteSize(const RpcMetaFields& f) {
+    size_t n = 0;
+    if (f.has_request) {
+        n += 1 + VarintSize(RequestMetaByteSize(f.request)) +
+            RequestMetaByteSize(f.request);
+    }
+    if (f.has_response) {
+        n += 1 + VarintSize(ResponseMetaByteSize(f.response)) +
+            ResponseMetaByteSize(f.response);
+    }
+    if (f.has_compress_type) { n += 1 + Int32Size(f.compress_type); }
+    if (f.has_correlation_id) { n += 1 + VarintSize(f.correlation_id); }
+    if (f.has_attachment_size) { n += 1 + Int32Size(f.attachment_size); }
+    if (f.has_authentication_data) { n += 1 + BytesSize(f.authentication_data); }
+    if (f.has_content_type) { n += 1 + Int32Size(f.content_type); }
+    if (f.has_checksum_type) { n += 1 + Int32Size(f.checksum_type); }
+    if (f.has_checksum_value) { n += 1 + BytesSize(f.checksum_value); }
+    return n;
+}
+
+char* SerializeRpcMetaFieldsToArray(const RpcMetaFields& f, char* p) {
+    if (f.has_request) {
+        const RpcRequestMetaFields& req = f.request;
+        *p++ = MakeTag(1, WIRETYPE_LENGTH_DELIMITED);
+        p = WriteVarint(RequestMetaByteSize(req), p);
+        if (req.has_service_name) { p = WriteBytesField(1, req.service_name, p); }
+        if (req.has_method_name) { p = WriteBytesField(2, req.method_name, p); }
+        if (req.has_log_id) { p = WriteVarintField(3, req.log_id, p); }
+        if (req.has_trace_id) { p = WriteVarintField(4, req.trace_id, p); }
+        if (req.has_span_id) { p = WriteVarintField(5, req.span_id, p); }
+        if (req.has_parent_span_id) { p = WriteVarintField(6, req.parent_span_id, p); }
+        if (req.has_request_id) { p = WriteBytesField(7, req.request_id, p); }
+        if (req.has_timeout_ms) { p = WriteInt32Field(8, req.timeout_ms, p); }
+        if (req.has_method_index) { p = WriteInt32Field(9, req.method_index, p); }
+        if (req.has_priority) { p = WriteInt32Field(10, req.priority, p); }
+        if (req.has_sampled) { p = WriteVarintField(11, req.sampled, p); }
+    }
+    if (f.has_response) {
+        const RpcResponseMetaFields& res = f.response;
+        *p++ = MakeTag(2, WIRETYPE_LENGTH_DELIMITED);
+        p = WriteVarint(ResponseMetaByteSize(res), p);
+        if (res.has_error_code) { p = WriteInt32Field(1, res.error_code, p); }
+        if (res.has_error_text) { p = WriteBytesField(2, res.error_text, p); }
+        if (res.has_server_load) { p = WriteInt32Field(3, res.server_load, p); }
+    }
+    if (f.has_compress_type) { p = WriteInt32Field(3, f.compress_type, p); }
+    if (f.has_correlation_id) { p = WriteVarintField(4, f.correlation_id, p); }
+    if (f.has_attachment_size) { p = WriteInt32Field(5, f.attachment_size, p); }
+    if (f.has_authentication_data) { p = WriteBytesField(7, f.authentication_data, p); }
+    if (f.has_content_type) { p = WriteInt32Field(10, f.content_type, p); }
+    if (f.has_checksum_type) { p = WriteInt32Field(11, f.checksum_type, p); }
+    if (f.has_checksum_value) { p = WriteBytesField(12, f.checksum_value, p); }
+    return p;
+}
+
+void RpcMetaFieldsToPb(const RpcMetaFields& f, RpcMeta* meta) {
+    if (f.has_request) {
+        const RpcRequestMetaFields& req = f.request;
+        RpcRequestMeta* m = meta->mutable_request();
+        if (req.has_service_name) {
+            m->set_service_name(req.service_name.data(), req.service_name.size());
+        }
+        if (req.has_method_name) {
+            m->set_method_name(req.method_name.data(), req.method_name.size());
+        }
+        if (req.has_log_id) { m->set_log_id(req.log_id); }
+        if (req.has_trace_id) { m->set_trace_id(req.trace_id); }
+        if (req.has_span_id) { m->set_span_id(req.span_id); }
+        if (req.has_parent_span_id) { m->set_parent_span_id(req.parent_span_id); }
+        if (req.has_request_id) {
+            m->set_request_id(req.request_id.data(), req.request_id.size());
+        }
+        if (req.has_timeout_ms) { m->set_timeout_ms(req.timeout_ms); }
+        if (req.has_method_index) { m->set_method_index(req.method_index); }
+        if (req.has_priority) { m->set_priority(req.priority); }
+        if (req.has_sampled) { m->set_sampled(req.sampled); }
+    }
+    if (f.has_response) {
+        const RpcResponseMetaFields& res = f.response;
+        RpcResponseMeta* m = meta->mutable_response();
+        if (res.has_error_code) { m->set_error_code(res.error_code); }
+        if (res.has_error_text) {
+            m->set_error_text(res.error_text.data(), res.error_text.size());
+        }
+        if (res.has_server_load) { m->set_server_load(res.server_load); }
+    }
+    if (f.has_compress_type) { meta->set_compress_type(f.compress_type); }
+    if (f.has_correlation_id) { meta->set_correlation_id(f.correlation_id); }
+    if (f.has_attachment_size) { meta->set_attachment_size(f.attachment_size); }
+    if (f.has_authentication_data) {
+        meta->set_authentication_data(f.authentication_data.data(),
+                                      f.authentication_data.size());
+    }
+    if (f.has_content_type) {
+        meta->set_content_type((ContentType)f.content_type);
+    }
+    if (f.has_checksum_type) { meta->set_checksum_type(f.checksum_type); }
+    if (f.has_checksum_value) {
+        meta->set_checksum_value(f.checksum_value.data(), f.checksum_value.size());
+    }
+}
+
+void RpcMetaToFields(const RpcMeta& meta, RpcMetaFields* f) {
+    f->has_request = meta.has_request();
+    if (f->has_request) {
+        const RpcRequestMeta& m = meta.request();
+        RpcRequestMetaFields& req = f->request;
+        req.service_name = m.service_name();
+        req.method_name = m.method_name();
+        req.log_id = m.log_id();
+        req.trace_id = m.trace_id();
+        req.span_id = m.span_id();
+        req.parent_span_id = m.parent_span_id();
+        req.request_id = m.request_id();
+        req.timeout_ms = m.timeout_ms();
+        req.method_index = m.method_index();
+        req.priority = m.priority();
+        req.sampled = m.sampled();
+        req.has_service_name = m.has_service_name();
+        req.has_method_name = m.has_method_name();
+        req.has_log_id = m.has_log_id();
+        req.has_trace_id = m.has_trace_id();
+        req.has_span_id = m.has_span_id();
+        req.has_parent_span_id = m.has_parent_span_id();
+        req.has_request_id = m.has_request_id();
+        req.has_timeout_ms = m.has_timeout_ms();
+        req.has_method_index = m.has_method_index();
+        req.has_priority = m.has_priority();
+        req.has_sampled = m.has_sampled();
+    }
+    f->has_response = meta.has_response();
+    if (f->has_response) {
+        const RpcResponseMeta& m = meta.response();
+        RpcResponseMetaFields& res = f->response;
+        res.error_code = m.error_code();
+        res.error_text = m.error_text();
+        res.server_load = m.server_load();
+        res.has_error_code = m.has_error_code();
+        res.has_error_text = m.has_error_text();
+        res.has_server_load = m.has_server_load();
+    }
+    f->compress_type = meta.compress_type();
+    f->correlation_id = meta.correlation_id();
+    f->attachment_size = meta.attachment_size();
+    f->authentication_data = meta.authentication_data();
+    f->content_type = meta.content_type();
+    f->checksum_type = meta.checksum_type();
+    f->checksum_value = meta.checksum_value();
+    f->has_compress_type = meta.has_compress_type();
+    f->has_correlation_id = meta.has_correlation_id();
+    f->has_attachment_size = meta.has_attachment_size();
+    f->has_authentication_data = meta.has_authentication_data();
+    f->has_content_type = meta.has_content_type();
+    f->has_checksum_type = meta.has_checksum_type();
+    f->has_checksum_value = meta.has_checksum_value();
+}
+
+} // namespace policy
+} // namespace brpc
@@ -0,0 +1,124 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_POLICY_BAIDU_RPC_META_CODEC_H
+#define BRPC_POLICY_BAIDU_RPC_META_CODEC_H
+
+#include <stdint.h>
+#include "butil/strings/string_piece.h"
+
+
+namespace brpc {
+namespace policy {
+
+class RpcMeta;
+
+// Fields of RpcRequestMeta in baidu_rpc_meta.proto.
+struct RpcRequestMetaFields {
+    RpcRequestMetaFields();
+
+    butil::StringPiece service_name;
+    butil::StringPiece method_name;
+    int64_t log_id;
+    int64_t trace_id;
+    int64_t span_id;
+    int64_t parent_span_id;
+    butil::StringPiece request_id;
+    int32_t timeout_ms;
+    int32_t method_index;
+    int32_t priority;
+    bool sampled;
+
+    bool has_service_name;
+    bool has_method_name;
+    bool has_log_id;
+    bool has_trace_id;
+    bool has_span_id;
+    bool has_parent_span_id;
+    bool has_request_id;
+    bool has_timeout_ms;
+    bool has_method_index;
+    bool has_priority;
+    bool has_sampled;
+};
+
+// Fields of RpcResponseMeta in baidu_rpc_meta.proto.
+struct RpcResponseMetaFields {
+    RpcResponseMetaFields();
+
+    int32_t error_code;
+    butil::StringPiece error_text;
+    int32_t server_load;
+
+    bool has_error_code;
+    bool has_error_text;
+    bool has_server_load;
+};
+
+// Fields of RpcMeta except chunk_info, stream_settings and user_fields,
+// which are set in almost every message of baidu_std. They're parsed and
+// serialized without the protobuf runtime so that nothing is allocated.
+// Strings are not owned and reference the parsed buffer or the serialized
+// values.
+struct RpcMetaFields {
+    RpcMetaFields();
+
+    RpcRequestMetaFields request;
+    RpcResponseMetaFields response;
+    int32_t compress_type;
+    int64_t correlation_id;
+    int32_t attachment_size;
+    butil::StringPiece authentication_data;
+    int32_t content_type;
+    int32_t checksum_type;
+    butil::StringPiece checksum_value;
+
+    bool has_request;
+    bool has_response;
+    bool has_compress_type;
+    bool has_correlation_id;
+    bool has_attachment_size;
+    bool has_authentication_data;
+    bool has_content_type;
+    bool has_checksum_type;
+    bool has_checksum_value;
+};
+
+// Parse `size' bytes at `data' serialized as RpcMeta into `fields'.
+// Returns false if the bytes are malformed, miss required fields, or
+// contain fields not in RpcMetaFields (including unknown fields), in which
+// case the caller should parse them as RpcMeta instead.
+bool ParseRpcMetaFields(const void* data, size_t size, RpcMetaFields* fields);
+
+// Number of bytes of `fields' serialized as RpcMeta.
+size_t RpcMetaFieldsByteSize(const RpcMetaFields& fields);
+
+// Serialize `fields' into `out' which must have RpcMetaFieldsByteSize()
+// bytes. Output is same as RpcMeta::SerializeToArray() with same fields.
+// Returns end of the written bytes.
+char* SerializeRpcMetaFieldsToArray(const RpcMetaFields& fields, char* out);
+
+// Convert between RpcMetaFields and RpcMeta. Strings in `fields' reference
+// `meta' after RpcMetaToFields().
+void RpcMetaFieldsToPb(const RpcMetaFields& fields, RpcMeta* meta);
+void RpcMetaToFields(const RpcMeta& meta, RpcMetaFields* fields);
+
+} // namespace policy
+} // namespace brpc
+
+
+#endif // BRPC_POLICY_BAIDU_RPC_META_CODEC_H
@@ -37,15 +37,18 @@
 #include "brpc/rpc_dump.h"                      // SampledRequest
 #include "brpc/rpc_pb_message_factory.h"
 #include "brpc/policy/baidu_rpc_meta.pb.h"      // RpcRequestMeta
+#include "brpc/policy/baidu_rpc_meta_codec.h"   // RpcMetaFields
 #include "brpc/policy/baidu_rpc_protocol.h"
 #include "brpc/policy/most_common_message.h"
 #include "brpc/policy/streaming_rpc_protocol.h"
 #include "brpc/details/usercode_backup_pool.h"
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/details/server_private_accessor.h"
+#include "brpc/details/response_cache.h"
 
 extern "C" {
 void bthread_assign_data(void* data);
+void* bthread_get_assigned_data();
 }
 
 
@@ -59,6 +62,17 @@ DEFINE_bool(baidu_protocol_use_fullname, true,
 DEFINE_bool(baidu_std_protocol_deliver_timeout_ms, false,
             "If this flag is true, baidu_std puts timeout_ms in requests.");
 
+DEFINE_bool(baidu_std_fail_expired_requests, false,
+            "If this flag is true, requests with timeout_ms which have been"
+            " queued longer than timeout_ms fail with ERPCTIMEDOUT without"
+            " running user code, since the clients already gave up.");
+
+DEFINE_bool(report_server_load, false,
+            "If this flag is true, baidu_std puts concurrency of the server in"
+            " permille of max_concurrency of the method (or the server) in"
+            " responses, so that load balancers of clients can avoid servers"
+            " which are about to reject requests.");
+
 DECLARE_bool(pb_enum_as_number);
 
 // Notes:
@@ -99,6 +113,52 @@ static void SerializeRpcHeaderAndMeta(
     }
 }
 
+static void SerializeRpcHeaderAndMeta(
+    butil::IOBuf* out, const RpcMetaFields& meta, int payload_size) {
+    const uint32_t meta_size = RpcMetaFieldsByteSize(meta);
+    if (meta_size <= 244) { // most common cases
+        char header_and_meta[12 + meta_size];
+        PackRpcHeader(header_and_meta, meta_size, payload_size);
+        SerializeRpcMetaFieldsToArray(meta, header_and_meta + 12);
+        CHECK_EQ(0, out->append(header_and_meta, sizeof(header_and_meta)));
+    } else {
+        std::unique_ptr<char[]> header_and_meta(new char[12 + meta_size]);
+        PackRpcHeader(header_and_meta.get(), meta_size, payload_size);
+        SerializeRpcMetaFieldsToArray(meta, header_and_meta.get() + 12);
+        CHECK_EQ(0, out->append(header_and_meta.get(), 12 + meta_size));
+    }
+}
+
+namespace {
+// Meta of a received message. Fields are parsed without protobuf unless
+// the meta is long or has fields not in RpcMetaFields, in which case it's
+// parsed into `full' which is referenced by `fields'.
+struct ParsedRpcMeta {
+    RpcMetaFields fields;
+    std::unique_ptr<RpcMeta> full;
+    // Bytes of the meta if they're not contiguous in the IOBuf.
+    char aux[256];
+};
+} // namespace
+
+// Strings in `meta->fields' may reference `buf' which should not be
+// changed before they're used.
+static bool ParseRpcMeta(const butil::IOBuf& buf, ParsedRpcMeta* meta) {
+    if (buf.size() <= sizeof(meta->aux)) {
+        const void* data = buf.empty() ? NULL : buf.fetch(meta->aux, buf.size());
+        if (ParseRpcMetaFields(data, buf.size(), &meta->fields)) {
+            return true;
+        }
+        meta->fields = RpcMetaFields();
+    }
+    meta->full.reset(new RpcMeta);
+    if (!ParsePbFromIOBuf(meta->full.get(), buf)) {
+        return false;
+    }
+    RpcMetaToFields(*meta->full, &meta->fields);
+    return true;
+}
+
 ParseResult ParseRpcMessage(butil::IOBuf* source, Socket* socket,
                             bool /*read_eof*/, const void*) {
     char header_buf[12];
@@ -142,21 +202,21 @@ ParseResult ParseRpcMessage(butil::IOBuf* source, Socket* socket,
     return MakeMessage(msg);
 }
 
-bool SerializeRpcMessage(const google::protobuf::Message& message,
-                         Controller& cntl, ContentType content_type,
-                         CompressType compress_type, ChecksumType checksum_type,
-                         butil::IOBuf* buf) {
+static bool SerializeRpcMessage(const google::protobuf::Message& message,
+                                Controller& cntl, ContentType content_type,
+                                CompressType compress_type,
+                                ChecksumType checksum_type,
+                                CompressPolicy* compress_policy,
+                                butil::IOBuf* buf) {
     auto serialize = [&](Serializer& serializer) -> bool {
         bool ok;
         if (COMPRESS_TYPE_NONE == compress_type) {
             butil::IOBufAsZeroCopyOutputStream stream(buf);
             ok = serializer.SerializeTo(&stream);
         } else {
-            const CompressHandler* handler = FindCompressHandler(compress_type);
-            if (NULL == handler) {
-                return false;
-            }
-            ok = handler->Compress(serializer, buf);
+            serializer.set_message_descriptor(message.GetDescriptor());
+            ok = SerializeAsCompressedData(serializer, buf, compress_type,
+                                           compress_policy);
         }
         ChecksumIn checksum_in{buf, &cntl};
         ComputeDataChecksum(checksum_in, checksum_type);
@@ -212,8 +272,17 @@ bool SerializeRpcMessage(const google::protobuf::Message& message,
     return false;
 }
 
+bool SerializeRpcMessage(const google::protobuf::Message& message,
+                         Controller& cntl, ContentType content_type,
+                         CompressType compress_type, ChecksumType checksum_type,
+                         butil::IOBuf* buf) {
+    return SerializeRpcMessage(message, cntl, content_type, compress_type,
+                               checksum_type, NULL, buf);
+}
+
 static bool SerializeResponse(const google::protobuf::Message& res,
-                              Controller& cntl, butil::IOBuf& buf) {
+                              Controller& cntl, MethodStatus* method_status,
+                              butil::IOBuf& buf) {
     if (res.GetDescriptor() == SerializedResponse::descriptor()) {
         buf.swap(((SerializedResponse&)res).serialized_data());
         return true;
@@ -228,8 +297,16 @@ static bool SerializeResponse(const google::protobuf::Message& res,
     ContentType content_type = cntl.response_content_type();
     CompressType compress_type = cntl.response_compress_type();
     ChecksumType checksum_type = cntl.response_checksum_type();
+    CompressPolicy* compress_policy =
+        method_status ? method_status->compress_policy() : NULL;
+    if (compress_policy != NULL) {
+        // Also written into meta by the caller.
+        compress_type = compress_policy->Select(
+            GetProtobufByteSize(res), compress_type);
+        cntl.set_response_compress_type(compress_type);
+    }
     if (!SerializeRpcMessage(res, cntl, content_type, compress_type,
-                             checksum_type, &buf)) {
+                             checksum_type, compress_policy, &buf)) {
         cntl.SetFailed(ERESPONSE,
                        "Fail to serialize response=%s, "
                        "ContentType=%s, CompressType=%s, ChecksumType=%s",
@@ -266,14 +343,33 @@ struct BaiduProxyPBMessages : public RpcPBMessages {
 };
 }
 
+// Concurrency of the method or the server in permille of its max_concurrency,
+// -1 if neither of them is limited.
+static int GetServerLoad(const Server* server, const MethodStatus* method_status) {
+    int concurrency = 0;
+    int max_concurrency = 0;
+    if (method_status != NULL && method_status->MaxConcurrency() > 0) {
+        concurrency = method_status->Concurrency();
+        max_concurrency = method_status->MaxConcurrency();
+    } else if (server != NULL && server->options().max_concurrency > 0) {
+        concurrency = server->Concurrency();
+        max_concurrency = server->options().max_concurrency;
+    } else {
+        return -1;
+    }
+    return std::min(concurrency * 1000L / max_concurrency, 1000L);
+}
+
 // Used by UT, can't be static.
 void SendRpcResponse(int64_t correlation_id, Controller* cntl,
                      RpcPBMessages* messages, const Server* server,
                      MethodStatus* method_status, int64_t received_us) {
     ControllerPrivateAccessor accessor(cntl);
     Span* span = accessor.span();
+    const int64_t start_send_us = butil::cpuwide_time_us();
+    accessor.phase_timer().Mark(SERVER_PHASE_HANDLER, start_send_us);
     if (span) {
-        span->set_start_send_us(butil::cpuwide_time_us());
+        span->set_start_send_us(start_send_us);
     }
     Socket* sock = accessor.get_sending_socket();
 
@@ -316,7 +412,8 @@ void SendRpcResponse(int64_t correlation_id, Controller* cntl,
     // If user calls `SetFailed' on Controller, we don't serialize
     // response either
     if (res != NULL && !cntl->Failed()) {
-        append_body = SerializeResponse(*res, *cntl, res_body);
+        butil::IOBufOwnerScope owner_scope(butil::IOBuf::OWNER_PROTOCOL);
+        append_body = SerializeResponse(*res, *cntl, method_status, res_body);
     }
 
     // Don't use res->ByteSize() since it may be compressed
@@ -333,29 +430,47 @@ void SendRpcResponse(int64_t correlation_id, Controller* cntl,
         // distinction between server error and client error
         error_code = EINTERNAL;
     }
-    RpcMeta meta;
-    RpcResponseMeta* response_meta = meta.mutable_response();
-    response_meta->set_error_code(error_code);
-    if (!cntl->ErrorText().empty()) {
-        // Only set error_text when it's not empty since protobuf Message
-        // always new the string no matter if it's empty or not.
-        response_meta->set_error_text(cntl->ErrorText());
-    }
-    meta.set_correlation_id(correlation_id);
-    meta.set_compress_type(cntl->response_compress_type());
-    meta.set_content_type(cntl->response_content_type());
-    meta.set_checksum_type(cntl->response_checksum_type());
-    meta.set_checksum_value(accessor.checksum_value());
+    RpcMetaFields meta;
+    meta.has_response = true;
+    RpcResponseMetaFields& response_meta = meta.response;
+    response_meta.has_error_code = true;
+    response_meta.error_code = error_code;
+    const std::string error_text = cntl->ErrorText();
+    if (!error_text.empty()) {
+        response_meta.has_error_text = true;
+        response_meta.error_text = error_text;
+    }
+    if (FLAGS_report_server_load) {
+        const int load = GetServerLoad(server, method_status);
+        if (load >= 0) {
+            response_meta.has_server_load = true;
+            response_meta.server_load = load;
+        }
+    }
+    meta.has_correlation_id = true;
+    meta.correlation_id = correlation_id;
+    meta.has_compress_type = true;
+    meta.compress_type = cntl->response_compress_type();
+    meta.has_content_type = true;
+    meta.content_type = cntl->response_content_type();
+    meta.has_checksum_type = true;
+    meta.checksum_type = cntl->response_checksum_type();
+    meta.has_checksum_value = true;
+    meta.checksum_value = accessor.checksum_value();
     if (attached_size > 0) {
-        meta.set_attachment_size(attached_size);
+        meta.has_attachment_size = true;
+        meta.attachment_size = attached_size;
     }
+    // Only created for fields not in RpcMetaFields.
+    std::unique_ptr<RpcMeta> full_meta;
     StreamId response_stream_id = INVALID_STREAM_ID;
     SocketUniquePtr stream_ptr;
     if (!response_stream_ids.empty()) {
         response_stream_id = response_stream_ids[0];
         if (Socket::Address(response_stream_id, &stream_ptr) == 0) {
             Stream* s = (Stream *) stream_ptr->conn();
-            StreamSettings *stream_settings = meta.mutable_stream_settings();
+            full_meta.reset(new RpcMeta);
+            StreamSettings *stream_settings = full_meta->mutable_stream_settings();
             s->FillSettings(stream_settings);
             s->SetHostSocket(sock);
             for (size_t i = 1; i < response_stream_ids.size(); ++i) {
@@ -367,17 +482,43 @@ void SendRpcResponse(int64_t correlation_id, Controller* cntl,
         }
     }
 
+    bool has_user_fields = false;
     if (cntl->has_response_user_fields() &&
         !cntl->response_user_fields()->empty()) {
+        if (!full_meta) {
+            full_meta.reset(new RpcMeta);
+        }
         ::google::protobuf::Map<std::string, std::string>& user_fields
-            = *meta.mutable_user_fields();
+            = *full_meta->mutable_user_fields();
         user_fields.insert(cntl->response_user_fields()->begin(),
                            cntl->response_user_fields()->end());
+        has_user_fields = true;
+    }
 
+    ResponseCache* response_cache = accessor.response_cache();
+    if (append_body && response_cache != NULL &&
+        response_stream_ids.empty() &&
+        cntl->response_checksum_type() == CHECKSUM_TYPE_NONE &&
+        !has_user_fields) {
+        ResponseCache::Value value;
+        // Share blocks with the response being sent.
+        value.body = res_body;
+        value.attachment = cntl->response_attachment();
+        value.compress_type = cntl->response_compress_type();
+        value.content_type = cntl->response_content_type();
+        response_cache->Put(accessor.response_cache_key(), value);
     }
 
     butil::IOBuf res_buf;
-    SerializeRpcHeaderAndMeta(&res_buf, meta, res_size + attached_size);
+    {
+        butil::IOBufOwnerScope owner_scope(butil::IOBuf::OWNER_PROTOCOL);
+        if (full_meta) {
+            RpcMetaFieldsToPb(meta, full_meta.get());
+            SerializeRpcHeaderAndMeta(&res_buf, *full_meta, res_size + attached_size);
+        } else {
+            SerializeRpcHeaderAndMeta(&res_buf, meta, res_size + attached_size);
+        }
+    }
     if (append_body) {
         res_buf.append(res_body.movable());
         if (attached_size > 0) {
@@ -391,6 +532,8 @@ void SendRpcResponse(int64_t correlation_id, Controller* cntl,
         span->set_response_size(res_buf.size());
         CHECK_EQ(0, bthread_id_create(&response_id, &args, HandleResponseWritten));
     }
+    // The rest is counted as writing until ConcurrencyRemover is destroyed.
+    accessor.phase_timer().Mark(SERVER_PHASE_SERIALIZE, butil::cpuwide_time_us());
 
     // Send rpc response over stream even if server side failed to create
     // stream for some reason.
@@ -456,6 +599,73 @@ void SendRpcResponse(int64_t correlation_id, Controller* cntl,
     }
 }
 
+// Answer the request of `cntl' with a response cached by ResponseCache
+// without calling the method.
+static void SendCachedRpcResponse(int64_t correlation_id, Controller* cntl,
+                                  const ResponseCache::Value& cached,
+                                  MethodStatus* method_status,
+                                  int64_t received_us) {
+    ControllerPrivateAccessor accessor(cntl);
+    Span* span = accessor.span();
+    const int64_t start_send_us = butil::cpuwide_time_us();
+    // The method is not called.
+    accessor.phase_timer().Mark(SERVER_PHASE_PARSE, start_send_us);
+    if (span) {
+        span->set_start_send_us(start_send_us);
+    }
+    Socket* sock = accessor.get_sending_socket();
+    BRPC_SCOPE_EXIT {
+        {
+            ConcurrencyRemover concurrency_remover(method_status, cntl, received_us);
+        }
+        std::unique_ptr<Controller, LogErrorTextAndDelete> recycle_cntl(cntl);
+    };
+
+    RpcMetaFields meta;
+    meta.has_response = true;
+    meta.response.has_error_code = true;
+    meta.response.error_code = 0;
+    if (FLAGS_report_server_load) {
+        const int load = GetServerLoad(cntl->server(), method_status);
+        if (load >= 0) {
+            meta.response.has_server_load = true;
+            meta.response.server_load = load;
+        }
+    }
+    meta.has_correlation_id = true;
+    meta.correlation_id = correlation_id;
+    meta.has_compress_type = true;
+    meta.compress_type = cached.compress_type;
+    meta.has_content_type = true;
+    meta.content_type = cached.content_type;
+    if (!cached.attachment.empty()) {
+        meta.has_attachment_size = true;
+        meta.attachment_size = cached.attachment.size();
+    }
+    butil::IOBuf res_buf;
+    SerializeRpcHeaderAndMeta(&res_buf, meta,
+                              cached.body.size() + cached.attachment.size());
+    // Cached blocks are referenced rather than copied.
+    res_buf.append(cached.body);
+    res_buf.append(cached.attachment);
+    if (span) {
+        span->set_response_size(res_buf.size());
+    }
+    accessor.phase_timer().Mark(SERVER_PHASE_SERIALIZE, butil::cpuwide_time_us());
+    Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = true;
+    if (sock->Write(&res_buf, &wopt) != 0) {
+        const int errcode = errno;
+        PLOG_IF(WARNING, errcode != EPIPE) << "Fail to write into " << *sock;
+        cntl->SetFailed(errcode, "Fail to write into %s",
+                        sock->description().c_str());
+        return;
+    }
+    if (span) {
+        span->set_sent_us(butil::cpuwide_time_us());
+    }
+}
+
 namespace {
 struct CallMethodInBackupThreadArgs {
     ::google::protobuf::Service* service;
@@ -492,6 +702,53 @@ void EndRunningCallMethodInPool(
     return EndRunningUserCodeInPool(CallMethodInBackupThread, args);
 };
 
+namespace {
+struct CallMethodInBthreadArgs {
+    CallMethodInBackupThreadArgs call;
+    void* assigned_data;
+};
+}
+
+static void* CallMethodInBthread(void* void_args) {
+    CallMethodInBthreadArgs* args = (CallMethodInBthreadArgs*)void_args;
+    bthread_assign_data(args->assigned_data);
+    const CallMethodInBackupThreadArgs& c = args->call;
+    c.service->CallMethod(c.method, c.controller, c.request, c.response, c.done);
+    delete args;
+    return NULL;
+}
+
+// Used by other protocols as well.
+void CallMethodInBthreadTag(
+    bthread_tag_t tag,
+    ::google::protobuf::Service* service,
+    const ::google::protobuf::MethodDescriptor* method,
+    ::google::protobuf::RpcController* controller,
+    const ::google::protobuf::Message* request,
+    ::google::protobuf::Message* response,
+    ::google::protobuf::Closure* done) {
+    if (tag == BTHREAD_TAG_INVALID || tag == bthread_self_tag()) {
+        return service->CallMethod(method, controller, request, response, done);
+    }
+    CallMethodInBthreadArgs* args = new CallMethodInBthreadArgs;
+    args->call.service = service;
+    args->call.method = method;
+    args->call.controller = controller;
+    args->call.request = request;
+    args->call.response = response;
+    args->call.done = done;
+    args->assigned_data = bthread_get_assigned_data();
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+    attr.tag = tag;
+    attr.flags |= BTHREAD_INHERIT_SPAN;
+    bthread_t th;
+    if (bthread_start_background(&th, &attr, CallMethodInBthread, args) != 0) {
+        LOG(WARNING) << "Fail to start bthread of tag=" << tag
+                     << " to call " << method->full_name();
+        CallMethodInBthread(args);
+    }
+}
+
 bool DeserializeRpcMessage(const butil::IOBuf& data, Controller& cntl,
                            ContentType content_type, CompressType compress_type,
                            ChecksumType checksum_type,
@@ -570,23 +827,28 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
     const Server* server = static_cast<const Server*>(msg_base->arg());
     ScopedNonServiceError non_service_error(server);
 
-    RpcMeta meta;
-    if (!ParsePbFromIOBuf(&meta, msg->meta)) {
+    ParsedRpcMeta parsed_meta;
+    if (!ParseRpcMeta(msg->meta, &parsed_meta)) {
         LOG(WARNING) << "Fail to parse RpcMeta from " << *socket;
         socket->SetFailed(EREQUEST, "Fail to parse RpcMeta from %s",
                           socket->description().c_str());
         return;
     }
-    const RpcRequestMeta &request_meta = meta.request();
+    const RpcMetaFields& meta = parsed_meta.fields;
+    const RpcRequestMetaFields& request_meta = meta.request;
 
-    SampledRequest* sample = AskToBeSampled();
+    SampledRequest* sample = AskToBeSampled(request_meta.service_name,
+                                            request_meta.method_name);
     if (sample) {
-        sample->meta.set_service_name(request_meta.service_name());
-        sample->meta.set_method_name(request_meta.method_name());
-        sample->meta.set_compress_type((CompressType)meta.compress_type());
+        sample->meta.set_service_name(request_meta.service_name.data(),
+                                      request_meta.service_name.size());
+        sample->meta.set_method_name(request_meta.method_name.data(),
+                                     request_meta.method_name.size());
+        sample->meta.set_compress_type((CompressType)meta.compress_type);
         sample->meta.set_protocol_type(PROTOCOL_BAIDU_STD);
-        sample->meta.set_attachment_size(meta.attachment_size());
-        sample->meta.set_authentication_data(meta.authentication_data());
+        sample->meta.set_attachment_size(meta.attachment_size);
+        sample->meta.set_authentication_data(meta.authentication_data.data(),
+                                             meta.authentication_data.size());
         sample->request = msg->payload;
         sample->submit(start_parse_us);
     }
@@ -603,20 +865,35 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
     ControllerPrivateAccessor accessor(cntl.get());
     const bool security_mode = server->options().security_mode() &&
                                socket->user() == server_accessor.acceptor();
-    if (request_meta.has_log_id()) {
-        cntl->set_log_id(request_meta.log_id());
+    if (request_meta.has_log_id) {
+        cntl->set_log_id(request_meta.log_id);
     }
-    if (request_meta.has_request_id()) {
-        cntl->set_request_id(request_meta.request_id());
+    if (request_meta.has_request_id) {
+        cntl->set_request_id(request_meta.request_id.as_string());
     }
-    if (request_meta.has_timeout_ms()) {
-        cntl->set_timeout_ms(request_meta.timeout_ms());
+    if (request_meta.has_priority &&
+        request_meta.priority >= 0 &&
+        request_meta.priority < REQUEST_PRIORITY_NUM) {
+        cntl->set_request_priority((RequestPriority)request_meta.priority);
     }
-    cntl->set_request_content_type(meta.content_type());
-    cntl->set_request_compress_type((CompressType)meta.compress_type());
-    cntl->set_request_checksum_type((ChecksumType)meta.checksum_type());
+    if (request_meta.has_timeout_ms) {
+        cntl->set_timeout_ms(request_meta.timeout_ms);
+        if (request_meta.timeout_ms > 0) {
+            accessor.set_deadline_us(msg->base_real_us() + msg->received_us() +
+                                     request_meta.timeout_ms * 1000L);
+        }
+    }
+    cntl->set_request_content_type((ContentType)meta.content_type);
+    cntl->set_request_compress_type((CompressType)meta.compress_type);
+    cntl->set_request_checksum_type((ChecksumType)meta.checksum_type);
     cntl->set_rpc_received_us(msg->received_us());
-    accessor.set_checksum_value(meta.checksum_value());
+    ServerPhaseTimer& phase_timer = accessor.phase_timer();
+    phase_timer.Begin(msg->received_us());
+    phase_timer.Mark(SERVER_PHASE_READ, msg->read_us());
+    phase_timer.Mark(SERVER_PHASE_PARSE, msg->cut_us());
+    phase_timer.Mark(SERVER_PHASE_QUEUE, start_parse_us);
+    accessor.set_checksum_value(meta.checksum_value.data(),
+                                meta.checksum_value.size());
     accessor.set_server(server)
         .set_security_mode(security_mode)
         .set_peer_id(socket->id())
@@ -627,12 +904,13 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         .set_begin_time_us(msg->received_us())
         .move_in_server_receiving_sock(socket_guard);
 
-    if (meta.has_stream_settings()) {
-        accessor.set_remote_stream_settings(meta.release_stream_settings());
+    RpcMeta* full_meta = parsed_meta.full.get();
+    if (full_meta && full_meta->has_stream_settings()) {
+        accessor.set_remote_stream_settings(full_meta->release_stream_settings());
     }
 
-    if (!meta.user_fields().empty()) {
-        for (const auto& it : meta.user_fields()) {
+    if (full_meta && !full_meta->user_fields().empty()) {
+        for (const auto& it : full_meta->user_fields()) {
             (*cntl->request_user_fields())[it.first] = it.second;
         }
     }
@@ -643,12 +921,15 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
     }
 
     Span* span = NULL;
-    if (IsTraceable(request_meta.has_trace_id())) {
+    if (IsTraceable(request_meta.has_trace_id)) {
         span = Span::CreateServerSpan(
-            request_meta.trace_id(), request_meta.span_id(),
-            request_meta.parent_span_id(), msg->base_real_us());
+            request_meta.trace_id, request_meta.span_id,
+            request_meta.parent_span_id, msg->base_real_us());
         accessor.set_span(span);
-        span->set_log_id(request_meta.log_id());
+        if (request_meta.has_trace_id) {
+            span->set_sampled(request_meta.sampled);
+        }
+        span->set_log_id(request_meta.log_id);
         span->set_remote_side(cntl->remote_side());
         span->set_protocol(PROTOCOL_BAIDU_STD);
         span->set_received_us(msg->received_us());
@@ -663,6 +944,20 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             break;
         }
 
+        if (FLAGS_baidu_std_fail_expired_requests && cntl->deadline_us() >= 0 &&
+            butil::gettimeofday_us() >= cntl->deadline_us()) {
+            cntl->SetFailed(ERPCTIMEDOUT, "Request expired after queueing %" PRId64 "us",
+                            butil::cpuwide_time_us() - msg->received_us());
+            break;
+        }
+
+        const int64_t sojourn_us = butil::cpuwide_time_us() - msg->received_us();
+        if (!server_accessor.AdmitByCodel(sojourn_us)) {
+            cntl->SetFailed(ELIMIT, "Dropped by CoDel after queueing %" PRId64 "us",
+                            sojourn_us);
+            break;
+        }
+
         if (!server_accessor.AddConcurrency(cntl.get())) {
             cntl->SetFailed(
                 ELIMIT, "Reached server's max_concurrency=%d",
@@ -677,17 +972,18 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         }
 
         const int req_size = static_cast<int>(msg->payload.size());
-        if (meta.has_attachment_size()) {
-            if (req_size < meta.attachment_size()) {
+        if (meta.has_attachment_size) {
+            if (req_size < meta.attachment_size) {
                 cntl->SetFailed(EREQUEST,
                     "attachment_size=%d is larger than request_size=%d",
-                    meta.attachment_size(), req_size);
+                    meta.attachment_size, req_size);
                 break;
             }
         }
 
         google::protobuf::Service* svc = NULL;
         google::protobuf::MethodDescriptor* method = NULL;
+        bthread_tag_t method_tag = BTHREAD_TAG_INVALID;
         if (NULL != server->options().baidu_master_service) {
           if (socket->is_overcrowded() &&
               !server->options().ignore_eovercrowded &&
@@ -702,8 +998,10 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
                 cntl->SetFailed(ENOMEM, "Fail to get sampled_request");
                 break;
             }
-            sampled_request->meta.set_service_name(request_meta.service_name());
-            sampled_request->meta.set_method_name(request_meta.method_name());
+            sampled_request->meta.set_service_name(
+                request_meta.service_name.data(), request_meta.service_name.size());
+            sampled_request->meta.set_method_name(
+                request_meta.method_name.data(), request_meta.method_name.size());
             cntl->reset_sampled_request(sampled_request);
             // Switch to service-specific error.
             non_service_error.release();
@@ -725,36 +1023,45 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             messages = BaiduProxyPBMessages::Get();
             msg->payload.cutn(
                 &((SerializedRequest*)messages->Request())->serialized_data(),
-                req_size - meta.attachment_size());
+                req_size - meta.attachment_size);
             if (!msg->payload.empty()) {
                 cntl->request_attachment().swap(msg->payload);
             }
         } else {
-            // NOTE(gejun): jprotobuf sends service names without packages. So the
-            // name should be changed to full when it's not.
-            butil::StringPiece svc_name(request_meta.service_name());
-            if (svc_name.find('.') == butil::StringPiece::npos) {
-                const Server::ServiceProperty* sp =
-                    server_accessor.FindServicePropertyByName(svc_name);
-                if (NULL == sp) {
-                    cntl->SetFailed(ENOSERVICE, "Fail to find service=%s",
-                        request_meta.service_name().c_str());
-                    break;
+            const Server::MethodProperty* mp = NULL;
+            if (request_meta.has_method_index) {
+                // Skip building the full name of the method.
+                mp = server_accessor.FindMethodPropertyByIndexHint(
+                    request_meta.service_name, request_meta.method_name,
+                    request_meta.method_index);
+            }
+            if (NULL == mp) {
+                // NOTE(gejun): jprotobuf sends service names without packages. So the
+                // name should be changed to full when it's not.
+                butil::StringPiece svc_name(request_meta.service_name);
+                if (svc_name.find('.') == butil::StringPiece::npos) {
+                    const Server::ServiceProperty* sp =
+                        server_accessor.FindServicePropertyByName(svc_name);
+                    if (NULL == sp) {
+                        cntl->SetFailed(ENOSERVICE, "Fail to find service=%s",
+                            request_meta.service_name.as_string().c_str());
+                        break;
+                    }
+                    svc_name = sp->service->GetDescriptor()->full_name();
                 }
-                svc_name = sp->service->GetDescriptor()->full_name();
+                mp = server_accessor.FindMethodPropertyByFullName(
+                    svc_name, request_meta.method_name);
             }
-            const Server::MethodProperty* mp =
-                server_accessor.FindMethodPropertyByFullName(
-                    svc_name, request_meta.method_name());
             if (NULL == mp) {
                 cntl->SetFailed(ENOMETHOD, "Fail to find method=%s/%s",
-                                request_meta.service_name().c_str(),
-                                request_meta.method_name().c_str());
+                                request_meta.service_name.as_string().c_str(),
+                                request_meta.method_name.as_string().c_str());
                 break;
             } else if (mp->service->GetDescriptor() == BadMethodService::descriptor()) {
                 BadMethodRequest breq;
                 BadMethodResponse bres;
-                breq.set_service_name(request_meta.service_name());
+                breq.set_service_name(request_meta.service_name.data(),
+                                      request_meta.service_name.size());
                 mp->service->CallMethod(mp->method, cntl.get(), &breq, &bres, NULL);
                 break;
             }
@@ -781,6 +1088,7 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             }
             svc = mp->service;
             method = const_cast<google::protobuf::MethodDescriptor*>(mp->method);
+            method_tag = mp->bthread_tag;
             accessor.set_method(method);
 
             if (span) {
@@ -792,22 +1100,47 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             }
 
             butil::IOBuf req_buf;
-            int body_without_attachment_size = req_size - meta.attachment_size();
+            int body_without_attachment_size = req_size - meta.attachment_size;
             msg->payload.cutn(&req_buf, body_without_attachment_size);
-            if (meta.attachment_size() > 0) {
+            if (meta.attachment_size > 0) {
                 cntl->request_attachment().swap(msg->payload);
             }
 
-            ContentType content_type = meta.content_type();
+            if (mp->response_cache != NULL && !cntl->has_remote_stream()) {
+                butil::IOBuf cache_key;
+                if (mp->response_cache->MakeKey(cntl.get(), req_buf, &cache_key)) {
+                    ResponseCache::Value cached;
+                    if (mp->response_cache->Get(cache_key, &cached)) {
+                        return SendCachedRpcResponse(
+                            meta.correlation_id, cntl.release(), cached,
+                            method_status, msg->received_us());
+                    }
+                    accessor.set_response_cache(mp->response_cache, &cache_key);
+                }
+            }
+
+            ContentType content_type = (ContentType)meta.content_type;
             auto compress_type =
-                static_cast<CompressType>(meta.compress_type());
+                static_cast<CompressType>(meta.compress_type);
             auto checksum_type =
-                static_cast<ChecksumType>(meta.checksum_type());
+                static_cast<ChecksumType>(meta.checksum_type);
             messages =
                 server->options().rpc_pb_message_factory->Get(*svc, *method);
-            if (!DeserializeRpcMessage(req_buf, *cntl, content_type,
-                                       compress_type, checksum_type,
-                                       messages->Request())) {
+            bool parsed = false;
+            if (!mp->aliased_request_fields.empty() &&
+                CONTENT_TYPE_PB == content_type &&
+                COMPRESS_TYPE_NONE == compress_type) {
+                ChecksumIn checksum_in{&req_buf, cntl.get()};
+                parsed = VerifyDataChecksum(checksum_in, checksum_type) &&
+                    ParsePbFromIOBufWithAliasing(
+                        messages->Request(), req_buf, mp->aliased_request_fields,
+                        accessor.mutable_aliased_request_fields());
+            } else {
+                parsed = DeserializeRpcMessage(req_buf, *cntl, content_type,
+                                               compress_type, checksum_type,
+                                               messages->Request());
+            }
+            if (!parsed) {
                 cntl->SetFailed(
                     EREQUEST,
                     "Fail to parse request=%s, ContentType=%s, "
@@ -825,20 +1158,23 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         google::protobuf::Closure* done = ::brpc::NewCallback<
             int64_t, Controller*, RpcPBMessages*,
             const Server*, MethodStatus*, int64_t>(
-                &SendRpcResponse, meta.correlation_id(),cntl.get(),
+                &SendRpcResponse, meta.correlation_id,cntl.get(),
                 messages, server, method_status, msg->received_us());
 
         // optional, just release resource ASAP
         msg.reset();
 
+        const int64_t start_callback_us = butil::cpuwide_time_us();
+        phase_timer.Mark(SERVER_PHASE_PARSE, start_callback_us);
         if (span) {
-            span->set_start_callback_us(butil::cpuwide_time_us());
+            span->set_start_callback_us(start_callback_us);
             span->AsParent();
         }
+        MethodCostScope cost_scope(method_status);
         if (!FLAGS_usercode_in_pthread) {
-            return svc->CallMethod(method, cntl.release(), 
-                                   messages->Request(),
-                                   messages->Response(), done);
+            return CallMethodInBthreadTag(method_tag, svc, method,
+                                          cntl.release(), messages->Request(),
+                                          messages->Response(), done);
         }
         if (BeginRunningUserCode()) {
             svc->CallMethod(method, cntl.release(), 
@@ -855,29 +1191,224 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
     
     // `cntl', `req' and `res' will be deleted inside `SendRpcResponse'
     // `socket' will be held until response has been sent
-    SendRpcResponse(meta.correlation_id(),
+    SendRpcResponse(meta.correlation_id,
                     cntl.release(), messages,
                     server, method_status,
                     msg->received_us());
 }
 
+// Recycle resources of a request received in a datagram, no response is sent.
+static void EndRpcDatagram(Controller* cntl, RpcPBMessages* messages,
+                           const Server* server, MethodStatus* method_status,
+                           int64_t received_us) {
+    {
+        ConcurrencyRemover concurrency_remover(method_status, cntl, received_us);
+    }
+    std::unique_ptr<Controller, LogErrorTextAndDelete> recycle_cntl(cntl);
+    if (messages != NULL) {
+        cntl->CallAfterRpcResp(messages->Request(), messages->Response());
+        server->options().rpc_pb_message_factory->Return(messages);
+    }
+}
+
+void ProcessRpcDatagram(const Server* server, SocketUniquePtr* socket,
+                        const butil::EndPoint& remote_side,
+                        butil::IOBuf* datagram, int64_t received_us) {
+    char header_buf[12];
+    uint32_t body_size = 0;
+    uint32_t meta_size = 0;
+    if (datagram->copy_to(header_buf, sizeof(header_buf)) == sizeof(header_buf)) {
+        butil::RawUnpacker(header_buf + 4).unpack32(body_size).unpack32(meta_size);
+    }
+    if (memcmp(header_buf, "PRPC", 4) != 0 ||
+        datagram->size() != sizeof(header_buf) + body_size ||
+        meta_size > body_size) {
+        LOG_EVERY_SECOND(WARNING) << "Drop malformed datagram of "
+                                  << datagram->size() << " bytes from "
+                                  << remote_side;
+        return;
+    }
+    datagram->pop_front(sizeof(header_buf));
+    butil::IOBuf meta_buf;
+    datagram->cutn(&meta_buf, meta_size);
+    butil::IOBuf& payload = *datagram;
+
+    ParsedRpcMeta parsed_meta;
+    if (!ParseRpcMeta(meta_buf, &parsed_meta)) {
+        LOG_EVERY_SECOND(WARNING) << "Fail to parse RpcMeta from " << remote_side;
+        return;
+    }
+    const RpcMetaFields& meta = parsed_meta.fields;
+    const RpcRequestMetaFields& request_meta = meta.request;
+
+    // Datagrams are not associated with connections, verify each of them.
+    // The AuthContext is not kept since there's no connection to own it.
+    const Authenticator* auth = server->options().auth;
+    AuthContext auth_context;
+    if (auth != NULL &&
+        auth->VerifyCredential(meta.authentication_data.as_string(),
+                               remote_side, &auth_context) != 0) {
+        LOG_EVERY_SECOND(WARNING) << "Fail to authenticate datagram from "
+                                  << remote_side;
+        return;
+    }
+
+    ScopedNonServiceError non_service_error(server);
+    std::unique_ptr<Controller> cntl(new (std::nothrow) Controller);
+    if (NULL == cntl.get()) {
+        LOG(WARNING) << "Fail to new Controller";
+        return;
+    }
+    RpcPBMessages* messages = NULL;
+    MethodStatus* method_status = NULL;
+    ServerPrivateAccessor server_accessor(server);
+    ControllerPrivateAccessor accessor(cntl.get());
+    if (request_meta.has_log_id) {
+        cntl->set_log_id(request_meta.log_id);
+    }
+    if (request_meta.has_request_id) {
+        cntl->set_request_id(request_meta.request_id.as_string());
+    }
+    cntl->set_request_compress_type((CompressType)meta.compress_type);
+    cntl->set_request_checksum_type((ChecksumType)meta.checksum_type);
+    cntl->set_rpc_received_us(received_us);
+    accessor.set_checksum_value(meta.checksum_value.data(),
+                                meta.checksum_value.size());
+    accessor.set_server(server)
+        .set_peer_id((*socket)->id())
+        .set_remote_side(remote_side)
+        .set_local_side((*socket)->local_side())
+        .set_request_protocol(PROTOCOL_BAIDU_STD)
+        .set_begin_time_us(received_us)
+        .move_in_server_receiving_sock(*socket);
+    if (parsed_meta.full && !parsed_meta.full->user_fields().empty()) {
+        for (const auto& it : parsed_meta.full->user_fields()) {
+            (*cntl->request_user_fields())[it.first] = it.second;
+        }
+    }
+    if (server->thread_local_options().thread_local_data_factory) {
+        bthread_assign_data((void*)&server->thread_local_options());
+    }
+
+    do {
+        if (!server->IsRunning()) {
+            cntl->SetFailed(ELOGOFF, "Server is stopping");
+            break;
+        }
+        if (!server_accessor.AddConcurrency(cntl.get())) {
+            cntl->SetFailed(ELIMIT, "Reached server's max_concurrency=%d",
+                            server->options().max_concurrency);
+            break;
+        }
+        const int req_size = static_cast<int>(payload.size());
+        if (meta.has_attachment_size && req_size < meta.attachment_size) {
+            cntl->SetFailed(EREQUEST,
+                            "attachment_size=%d is larger than request_size=%d",
+                            meta.attachment_size, req_size);
+            break;
+        }
+        butil::StringPiece svc_name(request_meta.service_name);
+        if (svc_name.find('.') == butil::StringPiece::npos) {
+            const Server::ServiceProperty* sp =
+                server_accessor.FindServicePropertyByName(svc_name);
+            if (NULL == sp) {
+                cntl->SetFailed(ENOSERVICE, "Fail to find service=%s",
+                                request_meta.service_name.as_string().c_str());
+                break;
+            }
+            svc_name = sp->service->GetDescriptor()->full_name();
+        }
+        const Server::MethodProperty* mp =
+            server_accessor.FindMethodPropertyByFullName(
+                svc_name, request_meta.method_name);
+        if (NULL == mp ||
+            mp->service->GetDescriptor() == BadMethodService::descriptor()) {
+            cntl->SetFailed(ENOMETHOD, "Fail to find method=%s/%s",
+                            request_meta.service_name.as_string().c_str(),
+                            request_meta.method_name.as_string().c_str());
+            break;
+        }
+        non_service_error.release();
+        method_status = mp->status;
+        if (method_status) {
+            int rejected_cc = 0;
+            if (!method_status->OnRequested(&rejected_cc, cntl.get())) {
+                cntl->SetFailed(
+                    ELIMIT, "Rejected by %s's ConcurrencyLimiter, concurrency=%d",
+                    mp->method->full_name().c_str(), rejected_cc);
+                break;
+            }
+        }
+        google::protobuf::Service* svc = mp->service;
+        const google::protobuf::MethodDescriptor* method = mp->method;
+        accessor.set_method(method);
+        if (!server->AcceptRequest(cntl.get())) {
+            break;
+        }
+        butil::IOBuf req_buf;
+        payload.cutn(&req_buf, req_size - meta.attachment_size);
+        if (meta.attachment_size > 0) {
+            cntl->request_attachment().swap(payload);
+        }
+        const ContentType content_type = (ContentType)meta.content_type;
+        messages = server->options().rpc_pb_message_factory->Get(*svc, *method);
+        if (!DeserializeRpcMessage(req_buf, *cntl, content_type,
+                                   (CompressType)meta.compress_type,
+                                   (ChecksumType)meta.checksum_type,
+                                   messages->Request())) {
+            cntl->SetFailed(
+                EREQUEST, "Fail to parse request=%s, ContentType=%s, "
+                "CompressType=%s, request_size=%d",
+                messages->Request()->GetDescriptor()->full_name().c_str(),
+                ContentTypeToCStr(content_type),
+                CompressTypeToCStr((CompressType)meta.compress_type), req_size);
+            break;
+        }
+        req_buf.clear();
+        meta_buf.clear();
+
+        google::protobuf::Closure* done = ::brpc::NewCallback<
+            Controller*, RpcPBMessages*, const Server*, MethodStatus*, int64_t>(
+                &EndRpcDatagram, cntl.get(), messages, server, method_status,
+                received_us);
+        if (!FLAGS_usercode_in_pthread) {
+            return CallMethodInBthreadTag(mp->bthread_tag, svc, method,
+                                          cntl.release(), messages->Request(),
+                                          messages->Response(), done);
+        }
+        if (BeginRunningUserCode()) {
+            svc->CallMethod(method, cntl.release(), messages->Request(),
+                            messages->Response(), done);
+            return EndRunningUserCodeInPlace();
+        } else {
+            return EndRunningCallMethodInPool(
+                svc, method, cntl.release(), messages->Request(),
+                messages->Response(), done);
+        }
+    } while (false);
+
+    EndRpcDatagram(cntl.release(), messages, server, method_status,
+                   received_us);
+}
+
 bool VerifyRpcRequest(const InputMessageBase* msg_base) {
     const MostCommonMessage* msg =
         static_cast<const MostCommonMessage*>(msg_base);
     const Server* server = static_cast<const Server*>(msg->arg());
     Socket* socket = msg->socket();
     
-    RpcMeta request_meta;
-    if (!ParsePbFromIOBuf(&request_meta, msg->meta)) {
+    ParsedRpcMeta parsed_meta;
+    if (!ParseRpcMeta(msg->meta, &parsed_meta)) {
         LOG(WARNING) << "Fail to parse RpcRequestMeta";
         return false;
     }
+    const RpcMetaFields& request_meta = parsed_meta.fields;
     const Authenticator* auth = server->options().auth;
     if (NULL == auth) {
         // Fast pass (no authentication)
         return true;
     }
-    if (auth->VerifyCredential(request_meta.authentication_data(),
+    if (auth->VerifyCredential(request_meta.authentication_data.as_string(),
                                socket->remote_side(),
                                socket->mutable_auth_context()) == 0) {
         return true;
@@ -885,7 +1416,7 @@ bool VerifyRpcRequest(const InputMessageBase* msg_base) {
 
     // Send `ERPCAUTH' to client.
     RpcMeta response_meta;
-    response_meta.set_correlation_id(request_meta.correlation_id());
+    response_meta.set_correlation_id(request_meta.correlation_id);
     response_meta.mutable_response()->set_error_code(ERPCAUTH);
     response_meta.mutable_response()->set_error_text("Fail to authenticate");
     std::string user_error_text = auth->GetUnauthorizedErrorText();
@@ -907,16 +1438,19 @@ bool VerifyRpcRequest(const InputMessageBase* msg_base) {
 void ProcessRpcResponse(InputMessageBase* msg_base) {
     const int64_t start_parse_us = butil::cpuwide_time_us();
     DestroyingPtr<MostCommonMessage> msg(static_cast<MostCommonMessage*>(msg_base));
-    RpcMeta meta;
-    if (!ParsePbFromIOBuf(&meta, msg->meta)) {
+    ParsedRpcMeta parsed_meta;
+    if (!ParseRpcMeta(msg->meta, &parsed_meta)) {
         LOG(WARNING) << "Fail to parse from response meta";
         return;
     }
+    const RpcMetaFields& meta = parsed_meta.fields;
+    const RpcMeta* full_meta = parsed_meta.full.get();
 
-    const bthread_id_t cid = { static_cast<uint64_t>(meta.correlation_id()) };
+    const bthread_id_t cid = { static_cast<uint64_t>(meta.correlation_id) };
     Controller* cntl = NULL;
 
-    StreamId remote_stream_id = meta.has_stream_settings() ? meta.stream_settings().stream_id(): INVALID_STREAM_ID;
+    StreamId remote_stream_id = (full_meta && full_meta->has_stream_settings()) ?
+        full_meta->stream_settings().stream_id() : INVALID_STREAM_ID;
 
     const int rc = bthread_id_lock(cid, (void**)&cntl);
     if (rc != 0) {
@@ -924,7 +1458,7 @@ void ProcessRpcResponse(InputMessageBase* msg_base) {
             << "Fail to lock correlation_id=" << cid << ": " << berror(rc);
         if (remote_stream_id != INVALID_STREAM_ID) {
             SendStreamRst(msg->socket(), remote_stream_id);
-            const auto & extra_stream_ids = meta.stream_settings().extra_stream_ids();
+            const auto & extra_stream_ids = full_meta->stream_settings().extra_stream_ids();
             for (int i = 0; i < extra_stream_ids.size(); ++i) {
                 policy::SendStreamRst(msg->socket(), extra_stream_ids[i]);
             }
@@ -935,11 +1469,11 @@ void ProcessRpcResponse(InputMessageBase* msg_base) {
     ControllerPrivateAccessor accessor(cntl);
     if (remote_stream_id != INVALID_STREAM_ID) {
         accessor.set_remote_stream_settings(
-                new StreamSettings(meta.stream_settings()));
+                new StreamSettings(full_meta->stream_settings()));
     }
 
-    if (!meta.user_fields().empty()) {
-        for (const auto& it : meta.user_fields()) {
+    if (full_meta && !full_meta->user_fields().empty()) {
+        for (const auto& it : full_meta->user_fields()) {
             (*cntl->response_user_fields())[it.first] = it.second;
         }
     }
@@ -952,39 +1486,44 @@ void ProcessRpcResponse(InputMessageBase* msg_base) {
         span->set_response_size(msg->meta.size() + msg->payload.size() + 12);
         span->set_start_parse_us(start_parse_us);
     }
-    const RpcResponseMeta &response_meta = meta.response();
+    const RpcResponseMetaFields& response_meta = meta.response;
+    if (response_meta.has_server_load) {
+        cntl->set_server_load(response_meta.server_load);
+    }
     const int saved_error = cntl->ErrorCode();
     do {
-        if (response_meta.error_code() != 0) {
+        if (response_meta.error_code != 0) {
             // If error_code is unset, default is 0 = success.
-            cntl->SetFailed(response_meta.error_code(), 
-                                  "%s", response_meta.error_text().c_str());
+            cntl->SetFailed(response_meta.error_code, "%.*s",
+                            (int)response_meta.error_text.size(),
+                            response_meta.error_text.data());
             break;
         } 
         // Parse response message iff error code from meta is 0
         butil::IOBuf res_buf;
         const int res_size = msg->payload.length();
         butil::IOBuf* res_buf_ptr = &msg->payload;
-        if (meta.has_attachment_size()) {
-            if (meta.attachment_size() > res_size) {
+        if (meta.has_attachment_size) {
+            if (meta.attachment_size > res_size) {
                 cntl->SetFailed(
                     ERESPONSE, "attachment_size=%d is larger than response_size=%d",
-                    meta.attachment_size(), res_size);
+                    meta.attachment_size, res_size);
                 break;
             }
-            int body_without_attachment_size = res_size - meta.attachment_size();
+            int body_without_attachment_size = res_size - meta.attachment_size;
             msg->payload.cutn(&res_buf, body_without_attachment_size);
             res_buf_ptr = &res_buf;
             cntl->response_attachment().swap(msg->payload);
         }
 
-        ContentType content_type = meta.content_type();
-        auto compress_type = (CompressType)meta.compress_type();
-        auto checksum_type = (ChecksumType)meta.checksum_type();
+        ContentType content_type = (ContentType)meta.content_type;
+        auto compress_type = (CompressType)meta.compress_type;
+        auto checksum_type = (ChecksumType)meta.checksum_type;
         cntl->set_response_content_type(content_type);
         cntl->set_response_compress_type(compress_type);
         cntl->set_response_checksum_type(checksum_type);
-        accessor.set_checksum_value(meta.checksum_value());
+        accessor.set_checksum_value(meta.checksum_value.data(),
+                                    meta.checksum_value.size());
         if (cntl->response()) {
             if (cntl->response()->GetDescriptor() == SerializedResponse::descriptor()) {
                 ((SerializedResponse*)cntl->response())->
@@ -1046,42 +1585,66 @@ void PackRpcRequest(butil::IOBuf* req_buf,
                     Controller* cntl,
                     const butil::IOBuf& request_body,
                     const Authenticator* auth) {
-    RpcMeta meta;
-    if (auth && auth->GenerateCredential(
-            meta.mutable_authentication_data()) != 0) {
-        return cntl->SetFailed(EREQUEST, "Fail to generate credential");
+    RpcMetaFields meta;
+    std::string auth_data;
+    if (auth) {
+        if (auth->GenerateCredential(&auth_data) != 0) {
+            return cntl->SetFailed(EREQUEST, "Fail to generate credential");
+        }
+        meta.has_authentication_data = true;
+        meta.authentication_data = auth_data;
     }
 
     ControllerPrivateAccessor accessor(cntl);
-    RpcRequestMeta* request_meta = meta.mutable_request();
+    meta.has_request = true;
+    RpcRequestMetaFields& request_meta = meta.request;
+    request_meta.has_service_name = true;
+    request_meta.has_method_name = true;
     if (method) {
-        request_meta->set_service_name(FLAGS_baidu_protocol_use_fullname ?
-                                       method->service()->full_name() :
-                                       method->service()->name());
-        request_meta->set_method_name(method->name());
-        meta.set_compress_type(cntl->request_compress_type());
-        meta.set_checksum_type(cntl->request_checksum_type());
-        meta.set_checksum_value(accessor.checksum_value());
+        request_meta.service_name = FLAGS_baidu_protocol_use_fullname ?
+                                    method->service()->full_name() :
+                                    method->service()->name();
+        request_meta.method_name = method->name();
+        request_meta.has_method_index = true;
+        request_meta.method_index = method->index();
+        meta.has_compress_type = true;
+        meta.compress_type = cntl->request_compress_type();
+        meta.has_checksum_type = true;
+        meta.checksum_type = cntl->request_checksum_type();
+        meta.has_checksum_value = true;
+        meta.checksum_value = accessor.checksum_value();
     } else if (NULL != cntl->sampled_request()) {
         // Replaying. Keep service-name as the one seen by server.
-        request_meta->set_service_name(cntl->sampled_request()->meta.service_name());
-        request_meta->set_method_name(cntl->sampled_request()->meta.method_name());
-        meta.set_compress_type(cntl->sampled_request()->meta.has_compress_type() ?
-                               cntl->sampled_request()->meta.compress_type() :
-                               cntl->request_compress_type());
+        const RpcDumpMeta& sampled_meta = cntl->sampled_request()->meta;
+        request_meta.service_name = sampled_meta.service_name();
+        request_meta.method_name = sampled_meta.method_name();
+        meta.has_compress_type = true;
+        meta.compress_type = sampled_meta.has_compress_type() ?
+                             sampled_meta.compress_type() :
+                             cntl->request_compress_type();
     } else {
         return cntl->SetFailed(ENOMETHOD, "%s.method is NULL", __func__ );
     }
     if (cntl->has_log_id()) {
-        request_meta->set_log_id(cntl->log_id());
+        request_meta.has_log_id = true;
+        request_meta.log_id = cntl->log_id();
     }
     if (!cntl->request_id().empty()) {
-        request_meta->set_request_id(cntl->request_id());
+        request_meta.has_request_id = true;
+        request_meta.request_id = cntl->request_id();
     }
-    meta.set_correlation_id(correlation_id);
+    if (cntl->request_priority() != REQUEST_PRIORITY_DEFAULT) {
+        request_meta.has_priority = true;
+        request_meta.priority = cntl->request_priority();
+    }
+    meta.has_correlation_id = true;
+    meta.correlation_id = correlation_id;
+    // Only created for fields not in RpcMetaFields.
+    std::unique_ptr<RpcMeta> full_meta;
     StreamIds request_stream_ids = accessor.request_streams();
     if (!request_stream_ids.empty()) {
-        StreamSettings* stream_settings = meta.mutable_stream_settings();
+        full_meta.reset(new RpcMeta);
+        StreamSettings* stream_settings = full_meta->mutable_stream_settings();
         StreamId request_stream_id = request_stream_ids[0];
         SocketUniquePtr ptr;
         if (Socket::Address(request_stream_id, &ptr) != 0) {
@@ -1096,8 +1659,11 @@ void PackRpcRequest(butil::IOBuf* req_buf,
     }
 
     if (cntl->has_request_user_fields() && !cntl->request_user_fields()->empty()) {
+        if (!full_meta) {
+            full_meta.reset(new RpcMeta);
+        }
         ::google::protobuf::Map<std::string, std::string>& user_fields
-            = *meta.mutable_user_fields();
+            = *full_meta->mutable_user_fields();
         user_fields.insert(cntl->request_user_fields()->begin(),
                            cntl->request_user_fields()->end());
     }
@@ -1106,24 +1672,39 @@ void PackRpcRequest(butil::IOBuf* req_buf,
     const size_t req_size = request_body.length(); 
     const size_t attached_size = cntl->request_attachment().length();
     if (attached_size) {
-        meta.set_attachment_size(attached_size);
+        meta.has_attachment_size = true;
+        meta.attachment_size = attached_size;
     }
 
     if (FLAGS_baidu_std_protocol_deliver_timeout_ms) {
         if (accessor.real_timeout_ms() > 0) {
-            request_meta->set_timeout_ms(accessor.real_timeout_ms());
+            request_meta.has_timeout_ms = true;
+            request_meta.timeout_ms = accessor.real_timeout_ms();
         }
     }
-    meta.set_content_type(cntl->request_content_type());
+    meta.has_content_type = true;
+    meta.content_type = cntl->request_content_type();
 
     Span* span = accessor.span();
     if (span) {
-        request_meta->set_trace_id(span->trace_id());
-        request_meta->set_span_id(span->span_id());
-        request_meta->set_parent_span_id(span->parent_span_id());
+        request_meta.has_trace_id = true;
+        request_meta.trace_id = span->trace_id();
+        request_meta.has_span_id = true;
+        request_meta.span_id = span->span_id();
+        request_meta.has_parent_span_id = true;
+        request_meta.parent_span_id = span->parent_span_id();
+        if (!span->sampled()) {
+            request_meta.has_sampled = true;
+            request_meta.sampled = false;
+        }
     }
 
-    SerializeRpcHeaderAndMeta(req_buf, meta, req_size + attached_size);
+    if (full_meta) {
+        RpcMetaFieldsToPb(meta, full_meta.get());
+        SerializeRpcHeaderAndMeta(req_buf, *full_meta, req_size + attached_size);
+    } else {
+        SerializeRpcHeaderAndMeta(req_buf, meta, req_size + attached_size);
+    }
     req_buf->append(request_body);
     if (attached_size) {
         req_buf->append(cntl->request_attachment());
@@ -22,6 +22,7 @@
 #include "brpc/protocol.h"
 
 namespace brpc {
+class Server;
 namespace policy {
 
 // Parse binary format of baidu_std
@@ -34,6 +35,13 @@ void ProcessRpcRequest(InputMessageBase* msg);
 // Actions to a (server) response in baidu_std format.
 void ProcessRpcResponse(InputMessageBase* msg);
 
+// Actions to a one-way request in baidu_std format which is received in a
+// datagram from `remote_side' by the UDP socket `socket' of `server'. No
+// response is sent. `socket' is referenced until the request is done.
+void ProcessRpcDatagram(const Server* server, SocketUniquePtr* socket,
+                        const butil::EndPoint& remote_side,
+                        butil::IOBuf* datagram, int64_t received_us);
+
 // Verify authentication information in baidu_std format
 bool VerifyRpcRequest(const InputMessageBase* msg);
 
@@ -145,7 +145,8 @@ void InitReplicaPolicy() {
     g_replica_policy = new std::array<const ReplicaPolicy*, CONS_HASH_LB_LAST>({
         new DefaultReplicaPolicy(MurmurHash32),
         new DefaultReplicaPolicy(MD5Hash32),
-        new KetamaReplicaPolicy
+        new KetamaReplicaPolicy,
+        new DefaultReplicaPolicy(XXH3Hash32)
     });
 }
 
@@ -158,7 +159,8 @@ inline const ReplicaPolicy* GetReplicaPolicy(ConsistentHashingLoadBalancerType t
 
 ConsistentHashingLoadBalancer::ConsistentHashingLoadBalancer(
     ConsistentHashingLoadBalancerType type)
-    : _num_replicas(FLAGS_chash_num_replicas), _type(type) {
+    : _num_replicas(FLAGS_chash_num_replicas), _type(type)
+    , _bounded_load(-1), _total_inflight(0) {
     CHECK(GetReplicaPolicy(_type))
         << "Fail to find replica policy for consistency lb type: '" << _type << '\'';
 }
@@ -242,6 +244,9 @@ bool ConsistentHashingLoadBalancer::AddServer(const ServerId& server) {
     const size_t ret = _db_hash_ring.ModifyWithForeground(
                         AddBatch, add_nodes, &executed);
     CHECK(ret == 0 || ret == _num_replicas) << ret;
+    if (ret != 0) {
+        UpdateInflightMap();
+    }
     return ret != 0;
 }
 
@@ -261,6 +266,9 @@ size_t ConsistentHashingLoadBalancer::AddServersInBatch(
     bool executed = false;
     const size_t ret = _db_hash_ring.ModifyWithForeground(AddBatch, add_nodes, &executed);
     CHECK(ret % _num_replicas == 0);
+    if (ret != 0) {
+        UpdateInflightMap();
+    }
     const size_t n = ret / _num_replicas;
     LOG_IF(ERROR, n != servers.size())
         << "Fail to AddServersInBatch, expected " << servers.size()
@@ -272,6 +280,9 @@ bool ConsistentHashingLoadBalancer::RemoveServer(const ServerId& server) {
     bool executed = false;
     const size_t ret = _db_hash_ring.ModifyWithForeground(Remove, server, &executed);
     CHECK(ret == 0 || ret == _num_replicas);
+    if (ret != 0) {
+        UpdateInflightMap();
+    }
     return ret != 0;
 }
 
@@ -280,6 +291,9 @@ size_t ConsistentHashingLoadBalancer::RemoveServersInBatch(
     bool executed = false;
     const size_t ret = _db_hash_ring.ModifyWithForeground(RemoveBatch, servers, &executed);
     CHECK(ret % _num_replicas == 0);
+    if (ret != 0) {
+        UpdateInflightMap();
+    }
     const size_t n = ret / _num_replicas;
     return n;
 }
@@ -320,10 +334,16 @@ int ConsistentHashingLoadBalancer::SelectServer(
     if (choice == s->end()) {
         choice = s->begin();
     }
+    if (_bounded_load >= 0 && SelectBoundedServer(*s, choice, in, out)) {
+        return 0;
+    }
     for (size_t i = 0; i < s->size(); ++i) {
         if (((i + 1) == s->size() // always take last chance
              || !ExcludedServers::IsExcluded(in.excluded, choice->server_sock.id))
             && IsServerAvailable(choice->server_sock.id, out->ptr)) {
+            if (_bounded_load >= 0) {
+                AddInflight(choice->server_sock.id, out);
+            }
             return 0;
         } else {
             if (++choice == s->end()) {
@@ -334,6 +354,98 @@ int ConsistentHashingLoadBalancer::SelectServer(
     return EHOSTDOWN;
 }
 
+bool ConsistentHashingLoadBalancer::SelectBoundedServer(
+    const std::vector<Node>& ring, std::vector<Node>::const_iterator choice,
+    const SelectIn& in, SelectOut* out) {
+    butil::DoublyBufferedData<InflightMap>::ScopedPtr m;
+    if (_db_inflight.Read(&m) != 0 || m->map.empty()) {
+        return false;
+    }
+    // Capacity of each server counting the call being selected.
+    const int64_t capacity = (int64_t)ceil(
+        (1 + _bounded_load) *
+        (_total_inflight.load(butil::memory_order_relaxed) + 1) / m->map.size());
+    for (size_t i = 0; i < ring.size(); ++i) {
+        const SocketId id = choice->server_sock.id;
+        const std::shared_ptr<butil::atomic<int64_t> >* inflight = m->map.seek(id);
+        if (inflight != NULL &&
+            (*inflight)->load(butil::memory_order_relaxed) < capacity &&
+            !ExcludedServers::IsExcluded(in.excluded, id) &&
+            IsServerAvailable(id, out->ptr)) {
+            (*inflight)->fetch_add(1, butil::memory_order_relaxed);
+            _total_inflight.fetch_add(1, butil::memory_order_relaxed);
+            out->need_feedback = true;
+            return true;
+        }
+        if (++choice == ring.end()) {
+            choice = ring.begin();
+        }
+    }
+    return false;
+}
+
+void ConsistentHashingLoadBalancer::AddInflight(SocketId id, SelectOut* out) {
+    butil::DoublyBufferedData<InflightMap>::ScopedPtr m;
+    if (_db_inflight.Read(&m) != 0) {
+        return;
+    }
+    const std::shared_ptr<butil::atomic<int64_t> >* inflight = m->map.seek(id);
+    if (inflight != NULL) {
+        (*inflight)->fetch_add(1, butil::memory_order_relaxed);
+        _total_inflight.fetch_add(1, butil::memory_order_relaxed);
+        out->need_feedback = true;
+    }
+}
+
+void ConsistentHashingLoadBalancer::Feedback(const CallInfo& info) {
+    // Calls to removed servers are still counted in _total_inflight.
+    _total_inflight.fetch_sub(1, butil::memory_order_relaxed);
+    butil::DoublyBufferedData<InflightMap>::ScopedPtr m;
+    if (_db_inflight.Read(&m) != 0) {
+        return;
+    }
+    const std::shared_ptr<butil::atomic<int64_t> >* inflight =
+        m->map.seek(info.server_id);
+    if (inflight != NULL) {
+        (*inflight)->fetch_sub(1, butil::memory_order_relaxed);
+    }
+}
+
+size_t ConsistentHashingLoadBalancer::SetInflightMap(
+    InflightMap& bg, const InflightMap& m) {
+    bg.map = m.map;
+    return 1;
+}
+
+void ConsistentHashingLoadBalancer::UpdateInflightMap() {
+    if (_bounded_load < 0) {
+        return;
+    }
+    BAIDU_SCOPED_LOCK(_inflight_mutex);
+    InflightMap m;
+    {
+        butil::DoublyBufferedData<std::vector<Node> >::ScopedPtr ring;
+        butil::DoublyBufferedData<InflightMap>::ScopedPtr old;
+        if (_db_hash_ring.Read(&ring) != 0 || _db_inflight.Read(&old) != 0) {
+            return;
+        }
+        for (size_t i = 0; i < ring->size(); ++i) {
+            const SocketId id = (*ring)[i].server_sock.id;
+            if (m.map.seek(id) != NULL) {
+                continue;
+            }
+            // Keep counters of existing servers.
+            const std::shared_ptr<butil::atomic<int64_t> >* p = old->map.seek(id);
+            if (p != NULL) {
+                m.map[id] = *p;
+            } else {
+                m.map[id] = std::make_shared<butil::atomic<int64_t> >(0);
+            }
+        }
+    }
+    _db_inflight.Modify(SetInflightMap, m);
+}
+
 void ConsistentHashingLoadBalancer::Describe(
     std::ostream &os, const DescribeOptions& options) {
     if (!options.verbose) {
@@ -343,6 +455,9 @@ void ConsistentHashingLoadBalancer::Describe(
     os << "ConsistentHashingLoadBalancer {\n"
        << "  hash function: " << GetReplicaPolicy(_type)->name() << '\n'
        << "  replica per host: " << _num_replicas << '\n';
+    if (_bounded_load >= 0) {
+        os << "  bounded load: " << _bounded_load << '\n';
+    }
     std::map<butil::EndPoint, double> load_map;
     GetLoads(&load_map);
     os << "  number of hosts: " << load_map.size() << '\n';
@@ -402,6 +517,14 @@ bool ConsistentHashingLoadBalancer::SetParameters(const butil::StringPiece& para
             }
             continue;
         }
+        if (sp.key() == "bounded_load") {
+            if (!butil::StringToDouble(sp.value().as_string(), &_bounded_load) ||
+                _bounded_load < 0) {
+                LOG(ERROR) << "Invalid bounded_load=" << sp.value();
+                return false;
+            }
+            continue;
+        }
         LOG(ERROR) << "Failed to set this unknown parameters " << sp.key_and_value();
     }
     return true;
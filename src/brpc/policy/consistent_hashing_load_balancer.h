@@ -21,9 +21,13 @@
 
 #include <stdint.h>                                     // uint32_t
 #include <functional>
+#include <memory>                                       // std::shared_ptr
 #include <vector>                                       // std::vector
+#include "butil/atomicops.h"
 #include "butil/endpoint.h"                              // butil::EndPoint
+#include "butil/containers/flat_map.h"
 #include "butil/containers/doubly_buffered_data.h"
+#include "butil/synchronization/lock.h"
 #include "brpc/load_balancer.h"
 
 
@@ -36,9 +40,10 @@ enum ConsistentHashingLoadBalancerType {
     CONS_HASH_LB_MURMUR3 = 0,
     CONS_HASH_LB_MD5 = 1,
     CONS_HASH_LB_KETAMA = 2,
+    CONS_HASH_LB_XXH3 = 3,
 
     // Identify the last one.
-    CONS_HASH_LB_LAST = 3
+    CONS_HASH_LB_LAST = 4
 };
 
 class ConsistentHashingLoadBalancer : public LoadBalancer {
@@ -67,10 +72,32 @@ public:
     LoadBalancer *New(const butil::StringPiece& params) const;
     void Destroy();
     int SelectServer(const SelectIn &in, SelectOut *out);
+    void Feedback(const CallInfo& info);
     void Describe(std::ostream &os, const DescribeOptions& options);
 
 private:
+    // In-flight calls of each server, only maintained with bounded loads.
+    struct InflightMap {
+        butil::FlatMap<SocketId, std::shared_ptr<butil::atomic<int64_t> > > map;
+
+        InflightMap() {
+            if (map.init(64) != 0) {
+                LOG(WARNING) << "Fail to init InflightMap";
+            }
+        }
+    };
+
     bool SetParameters(const butil::StringPiece& params);
+    // Select the first server along the ring from `choice' whose in-flight
+    // calls are below (1 + _bounded_load) * average. Returns false if all
+    // servers are overloaded or unavailable.
+    bool SelectBoundedServer(const std::vector<Node>& ring,
+                             std::vector<Node>::const_iterator choice,
+                             const SelectIn& in, SelectOut* out);
+    void AddInflight(SocketId id, SelectOut* out);
+    // Sync _db_inflight with servers on the ring.
+    void UpdateInflightMap();
+    static size_t SetInflightMap(InflightMap& bg, const InflightMap& m);
     void GetLoads(std::map<butil::EndPoint, double> *load_map);
     static size_t AddBatch(std::vector<Node> &bg, const std::vector<Node> &fg,
                            const std::vector<Node> &servers, bool *executed);
@@ -81,6 +108,12 @@ private:
     size_t _num_replicas;
     ConsistentHashingLoadBalancerType _type;
     butil::DoublyBufferedData<std::vector<Node> > _db_hash_ring;
+    // Negative means loads are not bounded.
+    double _bounded_load;
+    butil::DoublyBufferedData<InflightMap> _db_inflight;
+    // Serializes UpdateInflightMap().
+    butil::Mutex _inflight_mutex;
+    butil::atomic<int64_t> _total_inflight;
 };
 
 }  // namespace policy
@@ -28,13 +28,7 @@ namespace policy {
 void Crc32cCompute(const ChecksumIn& in) {
     auto buf = in.buf;
     auto cntl = in.cntl;
-    butil::IOBufAsZeroCopyInputStream wrapper(*buf);
-    const void* data;
-    int size;
-    uint32_t crc = 0;
-    while (wrapper.Next(&data, &size)) {
-        crc = butil::crc32c::Extend(crc, static_cast<const char*>(data), size);
-    }
+    uint32_t crc = butil::crc32c::Extend(0, *buf);
     RPC_VLOG << "Crc32cCompute crc=" << crc;
     crc = butil::HostToNet32(butil::crc32c::Mask(crc));
     ControllerPrivateAccessor(cntl).set_checksum_value(
@@ -44,13 +38,7 @@ void Crc32cCompute(const ChecksumIn& in) {
 bool Crc32cVerify(const ChecksumIn& in) {
     auto buf = in.buf;
     auto cntl = in.cntl;
-    butil::IOBufAsZeroCopyInputStream wrapper(*buf);
-    const void* data;
-    int size;
-    uint32_t crc = 0;
-    while (wrapper.Next(&data, &size)) {
-        crc = butil::crc32c::Extend(crc, static_cast<const char*>(data), size);
-    }
+    uint32_t crc = butil::crc32c::Extend(0, *buf);
     auto& val = ControllerPrivateAccessor(const_cast<Controller*>(cntl))
                     .checksum_value();
     CHECK_EQ(val.size(), sizeof(crc));
@@ -16,12 +16,12 @@
 // under the License.
 
 #include <gflags/gflags.h>
-#include "butil/build_config.h"                       // OS_MACOSX
-#include <netdb.h>                                    // gethostbyname_r
+#include <sys/socket.h>                               // AF_INET
 #include <stdlib.h>                                   // strtol
 #include <string>                                     // std::string
 #include "bthread/bthread.h"
 #include "brpc/log.h"
+#include "brpc/details/dns_cache.h"
 #include "brpc/policy/domain_naming_service.h"
 
 DEFINE_bool(dns_support_ipv6, false, "Resolve DNS by IPV6 address first");
@@ -30,8 +30,7 @@ namespace brpc {
 namespace policy {
 
 DomainNamingService::DomainNamingService(int default_port)
-    : _aux_buf_len(0)
-    , _default_port(default_port) {}
+    : _default_port(default_port) {}
 
 int DomainNamingService::GetServers(const char* dns_name,
                                     std::vector<ServerNode>* servers) {
@@ -79,89 +78,21 @@ int DomainNamingService::GetServers(const char* dns_name,
         return -1;
     }
 
+    std::vector<butil::EndPoint> addrs;
     if (FLAGS_dns_support_ipv6) {
-        struct addrinfo hints;
-        struct addrinfo* addrResult;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_INET6;
-        hints.ai_socktype = SOCK_DGRAM;
-        char portBuf[16];
-        snprintf(portBuf, arraysize(portBuf), "%d", port);
-        auto ret = getaddrinfo(buf, portBuf, &hints, &addrResult);
-        if (!ret) {
-            for(auto rp = addrResult; rp != NULL; rp = rp->ai_next) {
-                butil::EndPoint point;
-                auto ret = butil::sockaddr2endpoint((struct sockaddr_storage*)rp->ai_addr, rp->ai_addrlen, &point);
-                if(!ret) {
-                    servers->push_back(ServerNode(point, std::string()));
-                }
+        if (ResolveHost(buf, AF_INET6, port, &addrs) == 0) {
+            for (size_t j = 0; j < addrs.size(); ++j) {
+                servers->push_back(ServerNode(addrs[j], std::string()));
             }
-
-            freeaddrinfo(addrResult);
             return 0;
-        } else {
-            LOG(WARNING) << "Can't resolve `" << buf << "for ipv6, fallback to ipv4";
-            // fallback to ipv4
-        }
-        
-    }
-
-#if defined(OS_MACOSX)
-    _aux_buf_len = 0; // suppress unused warning
-    // gethostbyname on MAC is thread-safe (with current usage) since the
-    // returned hostent is TLS. Check following link for the ref:
-    // https://lists.apple.com/archives/darwin-dev/2006/May/msg00008.html
-    struct hostent* result = gethostbyname(buf);
-    if (result == NULL) {
-        LOG(WARNING) << "result of gethostbyname is NULL";
-        return -1;
-    }
-#else
-    if (_aux_buf == NULL) {
-        _aux_buf_len = 1024;
-        _aux_buf.reset(new char[_aux_buf_len]);
-    }
-    int ret = 0;
-    int error = 0;
-    struct hostent ent;
-    struct hostent* result = NULL;
-    do {
-        result = NULL;
-        error = 0;
-        ret = gethostbyname_r(buf, &ent, _aux_buf.get(), _aux_buf_len,
-                              &result, &error);
-        if (ret != ERANGE) { // _aux_buf is not long enough
-            break;
         }
-        _aux_buf_len *= 2;
-        _aux_buf.reset(new char[_aux_buf_len]);
-        RPC_VLOG << "Resized _aux_buf to " << _aux_buf_len
-                 << ", dns_name=" << dns_name;
-    } while (1);
-    if (ret != 0) {
-        // `hstrerror' is thread safe under linux
-        LOG(WARNING) << "Can't resolve `" << buf << "', return=`" << berror(ret)
-                     << "' herror=`" << hstrerror(error) << '\'';
-        return -1;
+        LOG(WARNING) << "Can't resolve `" << buf << "' for ipv6, fallback to ipv4";
     }
-    if (result == NULL) {
-        LOG(WARNING) << "result of gethostbyname_r is NULL";
+    if (ResolveHost(buf, AF_INET, port, &addrs) != 0) {
         return -1;
     }
-#endif
-
-    //TODO add protocols other than IPv4 supports
-    butil::EndPoint point;
-    point.port = port;
-    for (int i = 0; result->h_addr_list[i] != NULL; ++i) {
-        if (result->h_addrtype == AF_INET) {
-            // Only fetch IPv4 addresses
-            bcopy(result->h_addr_list[i], &point.ip, result->h_length);
-            servers->push_back(ServerNode(point, std::string()));
-        } else {
-            LOG(WARNING) << "Found address of unsupported protocol="
-                         << result->h_addrtype;
-        }
+    for (size_t j = 0; j < addrs.size(); ++j) {
+        servers->push_back(ServerNode(addrs[j], std::string()));
     }
     return 0;
 }
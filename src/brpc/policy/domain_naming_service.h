@@ -20,7 +20,6 @@
 #define  BRPC_POLICY_DOMAIN_NAMING_SERVICE_H
 
 #include "brpc/periodic_naming_service.h"
-#include "butil/unique_ptr.h"
 
 
 namespace brpc {
@@ -42,8 +41,6 @@ private:
     void Destroy() override;
 
 private:
-    std::unique_ptr<char[]> _aux_buf;
-    size_t _aux_buf_len;
     int _default_port;
 };
 
@@ -0,0 +1,199 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <cmath>
+#include <gflags/gflags.h>
+#include "brpc/errno.pb.h"
+#include "brpc/policy/gradient_concurrency_limiter.h"
+
+namespace brpc {
+namespace policy {
+
+DEFINE_int32(gradient_cl_initial_max_concurrency, 40,
+             "Initial max concurrency for gradient concurrency limiter");
+DEFINE_int32(gradient_cl_min_max_concurrency, 20,
+             "Max concurrency of gradient concurrency limiter never goes "
+             "below this value");
+DEFINE_int32(gradient_cl_max_max_concurrency, 1000,
+             "Max concurrency of gradient concurrency limiter never goes "
+             "above this value");
+DEFINE_int32(gradient_cl_sample_window_size_ms, 100,
+             "Duration of the sampling window, average latency of which is "
+             "the short-term latency.");
+DEFINE_int32(gradient_cl_min_sample_count, 20,
+             "During the duration of the sampling window, if the number of "
+             "requests collected is less than this value, the sampling window "
+             "will be discarded.");
+DEFINE_double(gradient_cl_sampling_interval_ms, 0.1,
+              "Interval for sampling request in gradient concurrency limiter");
+DEFINE_int32(gradient_cl_long_window_count, 600,
+             "The long-term latency is the exponential moving average of the "
+             "short-term latency over so many sampling windows.");
+DEFINE_double(gradient_cl_rtt_tolerance, 1.5,
+              "Max concurrency is not reduced until the short-term latency is "
+              "larger than the long-term latency multiplied by this value.");
+DEFINE_double(gradient_cl_smoothing, 0.2,
+              "Max concurrency moves towards the new estimation by this ratio "
+              "per sampling window, the value range is (0-1].");
+
+// Average of so many first windows is the long-term latency, to avoid
+// depending on the first window heavily.
+static const int LONG_RTT_WARMUP_COUNT = 10;
+
+GradientConcurrencyLimiter::GradientConcurrencyLimiter()
+    : _limit(FLAGS_gradient_cl_initial_max_concurrency)
+    , _long_rtt_us(0)
+    , _long_rtt_count(0)
+    , _max_concurrency(FLAGS_gradient_cl_initial_max_concurrency)
+    , _last_sampling_time_us(0)
+    , _max_inflight(0) {
+    _limit_bvar.set_value(FLAGS_gradient_cl_initial_max_concurrency);
+}
+
+GradientConcurrencyLimiter* GradientConcurrencyLimiter::New(
+    const AdaptiveMaxConcurrency&) const {
+    return new (std::nothrow) GradientConcurrencyLimiter;
+}
+
+bool GradientConcurrencyLimiter::OnRequested(int current_concurrency,
+                                             Controller*) {
+    const int max_concurrency = _max_concurrency.load(butil::memory_order_relaxed);
+    if (current_concurrency > max_concurrency) {
+        return false;
+    }
+    int max_inflight = _max_inflight.load(butil::memory_order_relaxed);
+    while (current_concurrency > max_inflight &&
+           !_max_inflight.compare_exchange_weak(
+               max_inflight, current_concurrency, butil::memory_order_relaxed)) {}
+    return true;
+}
+
+void GradientConcurrencyLimiter::OnResponded(int error_code, int64_t latency_us) {
+    // Latencies of failed requests say little about the load, e.g. requests
+    // rejected by the limiter end quickly.
+    if (error_code != 0) {
+        return;
+    }
+    const int64_t now_time_us = butil::gettimeofday_us();
+    int64_t last_sampling_time_us =
+        _last_sampling_time_us.load(butil::memory_order_relaxed);
+    if (last_sampling_time_us == 0 ||
+        now_time_us - last_sampling_time_us >=
+            FLAGS_gradient_cl_sampling_interval_ms * 1000) {
+        if (_last_sampling_time_us.compare_exchange_strong(
+                last_sampling_time_us, now_time_us,
+                butil::memory_order_relaxed)) {
+            AddSample(error_code, latency_us, now_time_us);
+        }
+    }
+}
+
+int GradientConcurrencyLimiter::MaxConcurrency() {
+    return _max_concurrency.load(butil::memory_order_relaxed);
+}
+
+int GradientConcurrencyLimiter::ResetMaxConcurrency(const AdaptiveMaxConcurrency&) {
+    return -1;
+}
+
+int GradientConcurrencyLimiter::Expose(const butil::StringPiece& prefix) {
+    if (_limit_bvar.expose_as(prefix, "cl_limit") != 0) {
+        return -1;
+    }
+    if (_short_rtt_bvar.expose_as(prefix, "cl_short_rtt_us") != 0) {
+        return -1;
+    }
+    if (_long_rtt_bvar.expose_as(prefix, "cl_long_rtt_us") != 0) {
+        return -1;
+    }
+    if (_queue_size_bvar.expose_as(prefix, "cl_queue_size") != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+bool GradientConcurrencyLimiter::AddSample(int error_code,
+                                           int64_t latency_us,
+                                           int64_t sampling_time_us) {
+    std::unique_lock<butil::Mutex> lock_guard(_sw_mutex);
+    if (_sw.start_time_us == 0) {
+        _sw.start_time_us = sampling_time_us;
+    }
+    if (error_code == 0) {
+        ++_sw.succ_count;
+        _sw.total_succ_us += latency_us;
+    }
+    if (sampling_time_us - _sw.start_time_us <
+        FLAGS_gradient_cl_sample_window_size_ms * 1000) {
+        return false;
+    }
+    if (_sw.succ_count < FLAGS_gradient_cl_min_sample_count) {
+        // If the sample size is insufficient at the end of the sampling
+        // window, discard the entire sampling window
+        ResetSampleWindow(sampling_time_us);
+        return false;
+    }
+    UpdateMaxConcurrency(_sw.total_succ_us / _sw.succ_count);
+    ResetSampleWindow(sampling_time_us);
+    return true;
+}
+
+void GradientConcurrencyLimiter::ResetSampleWindow(int64_t sampling_time_us) {
+    _max_inflight.store(0, butil::memory_order_relaxed);
+    _sw.start_time_us = sampling_time_us;
+    _sw.succ_count = 0;
+    _sw.total_succ_us = 0;
+}
+
+void GradientConcurrencyLimiter::UpdateMaxConcurrency(int64_t short_rtt_us) {
+    const double short_rtt = std::max(short_rtt_us, (int64_t)1);
+    if (_long_rtt_count < LONG_RTT_WARMUP_COUNT) {
+        ++_long_rtt_count;
+        _long_rtt_us += (short_rtt - _long_rtt_us) / _long_rtt_count;
+    } else {
+        const double factor = 2.0 / (FLAGS_gradient_cl_long_window_count + 1);
+        _long_rtt_us = _long_rtt_us * (1 - factor) + short_rtt * factor;
+    }
+    // The long-term latency drifts slowly after a sustained overload, let it
+    // recover quickly once the short-term latency is back.
+    if (_long_rtt_us > short_rtt * 2) {
+        _long_rtt_us *= 0.95;
+    }
+    _short_rtt_bvar.set_value(short_rtt_us);
+    _long_rtt_bvar.set_value((int64_t)_long_rtt_us);
+
+    const double queue_size = std::sqrt(_limit);
+    _queue_size_bvar.set_value((int64_t)queue_size);
+    // Don't grow the limit when the traffic doesn't reach it, otherwise the
+    // limit may be unbounded and useless when the traffic surges.
+    if (_max_inflight.load(butil::memory_order_relaxed) < _limit / 2) {
+        return;
+    }
+    const double gradient = std::max(0.5, std::min(1.0,
+        FLAGS_gradient_cl_rtt_tolerance * _long_rtt_us / short_rtt));
+    const double smoothing = FLAGS_gradient_cl_smoothing;
+    double limit = _limit * gradient + queue_size;
+    limit = _limit * (1 - smoothing) + limit * smoothing;
+    limit = std::max(limit, (double)FLAGS_gradient_cl_min_max_concurrency);
+    limit = std::min(limit, (double)FLAGS_gradient_cl_max_max_concurrency);
+    _limit = limit;
+    _max_concurrency.store((int)limit, butil::memory_order_relaxed);
+    _limit_bvar.set_value((int64_t)limit);
+}
+
+}  // namespace policy
+}  // namespace brpc
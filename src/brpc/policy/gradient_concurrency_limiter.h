@@ -0,0 +1,94 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_POLICY_GRADIENT_CONCURRENCY_LIMITER_H
+#define BRPC_POLICY_GRADIENT_CONCURRENCY_LIMITER_H
+
+#include "bvar/bvar.h"
+#include "brpc/concurrency_limiter.h"
+
+namespace brpc {
+namespace policy {
+
+// Adjust max_concurrency continuously by the gradient between the long-term
+// and the short-term latency, as Gradient2 of Netflix concurrency-limits:
+//   gradient = clamp(tolerance * long_rtt / short_rtt, 0.5, 1)
+//   limit = limit * (1 - smoothing) +
+//           (limit * gradient + queue_size) * smoothing
+// where short_rtt is the average latency of the last sample window, long_rtt
+// is the exponential moving average of short_rtt over many windows and
+// queue_size is sqrt(limit). Unlike AutoConcurrencyLimiter, there's no
+// periodical remeasurement of the no-load latency which drains the traffic.
+class GradientConcurrencyLimiter : public ConcurrencyLimiter {
+public:
+    GradientConcurrencyLimiter();
+
+    bool OnRequested(int current_concurrency, Controller*) override;
+
+    void OnResponded(int error_code, int64_t latency_us) override;
+
+    int MaxConcurrency() override;
+
+    int ResetMaxConcurrency(const AdaptiveMaxConcurrency&) override;
+
+    GradientConcurrencyLimiter* New(const AdaptiveMaxConcurrency&) const override;
+
+    int Expose(const butil::StringPiece& prefix) override;
+
+private:
+    struct SampleWindow {
+        SampleWindow()
+            : start_time_us(0)
+            , succ_count(0)
+            , total_succ_us(0) {}
+        int64_t start_time_us;
+        int32_t succ_count;
+        int64_t total_succ_us;
+    };
+
+    bool AddSample(int error_code, int64_t latency_us, int64_t sampling_time_us);
+
+    // The following methods are not thread safe and can only be called
+    // in AddSample()
+    void ResetSampleWindow(int64_t sampling_time_us);
+    void UpdateMaxConcurrency(int64_t short_rtt_us);
+
+    // modified per sample-window
+    double _limit;
+    double _long_rtt_us;
+    int _long_rtt_count;
+    butil::atomic<int> _max_concurrency;
+
+    // modified per sample.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<int64_t> _last_sampling_time_us;
+    butil::Mutex _sw_mutex;
+    SampleWindow _sw;
+
+    // modified per request.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<int> _max_inflight;
+
+    bvar::Status<int64_t> _limit_bvar;
+    bvar::Status<int64_t> _short_rtt_bvar;
+    bvar::Status<int64_t> _long_rtt_bvar;
+    bvar::Status<int64_t> _queue_size_bvar;
+};
+
+}  // namespace policy
+}  // namespace brpc
+
+
+#endif // BRPC_POLICY_GRADIENT_CONCURRENCY_LIMITER_H
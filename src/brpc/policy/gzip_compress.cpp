@@ -18,6 +18,14 @@
 
 #include <google/protobuf/io/gzip_stream.h>    // GzipXXXStream
 #include <google/protobuf/text_format.h>
+#if BRPC_WITH_ISAL
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <isa-l/igzip_lib.h>
+#include "butil/macros.h"
+#include "butil/thread_local.h"
+#endif
 #include "butil/logging.h"
 #include "brpc/policy/gzip_compress.h"
 #include "brpc/protocol.h"
@@ -48,6 +56,349 @@ const char* Format2CStr(google::protobuf::io::GzipInputStream::Format format) {
     }
 }
 
+#if BRPC_WITH_ISAL
+
+// Streams and buffers of ISA-L are too large for bthread stacks and costly
+// to initialize, they're reused in each thread.
+struct IsalContext {
+    isal_zstream zs;
+    inflate_state is;
+    uint32_t level_buf_cap;
+    uint8_t* level_buf;
+    // Messages are serialized into this buffer before being deflated.
+    uint8_t in_buf[8192];
+};
+
+BAIDU_VOLATILE_THREAD_LOCAL(IsalContext*, tls_isal_ctx, NULL);
+BAIDU_VOLATILE_THREAD_LOCAL(bool, tls_isal_ctx_atexit, false);
+
+static void FreeIsalContext(IsalContext* ctx) {
+    if (ctx != NULL) {
+        free(ctx->level_buf);
+        free(ctx);
+    }
+}
+
+static void FreeThreadIsalContext() {
+    FreeIsalContext(BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_isal_ctx));
+    BAIDU_SET_VOLATILE_THREAD_LOCAL(tls_isal_ctx, NULL);
+}
+
+// Take the context of this thread until destructed. Serializers are user
+// code which may switch the bthread and start another compression in this
+// thread, so the context must not be shared meanwhile.
+class IsalContextGuard {
+public:
+    IsalContextGuard() : _ctx(BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_isal_ctx)) {
+        if (_ctx != NULL) {
+            BAIDU_SET_VOLATILE_THREAD_LOCAL(tls_isal_ctx, NULL);
+        } else {
+            _ctx = (IsalContext*)calloc(1, sizeof(IsalContext));
+        }
+    }
+    ~IsalContextGuard() {
+        if (_ctx == NULL) {
+            return;
+        }
+        // May be another thread if the bthread was switched.
+        if (BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_isal_ctx) != NULL) {
+            FreeIsalContext(_ctx);
+            return;
+        }
+        if (!BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_isal_ctx_atexit)) {
+            if (butil::thread_atexit(FreeThreadIsalContext) != 0) {
+                FreeIsalContext(_ctx);
+                return;
+            }
+            BAIDU_SET_VOLATILE_THREAD_LOCAL(tls_isal_ctx_atexit, true);
+        }
+        BAIDU_SET_VOLATILE_THREAD_LOCAL(tls_isal_ctx, _ctx);
+    }
+    IsalContext* get() const { return _ctx; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(IsalContextGuard);
+    IsalContext* _ctx;
+};
+
+// ISA-L has 4 levels, the default level of zlib (6) is mapped to level 2
+// which compresses to similar ratios several times faster.
+static int ToIsalLevel(int zlib_level) {
+    int level = 2;
+    if (zlib_level >= 0 && zlib_level <= 1) {
+        level = 0;
+    } else if (zlib_level >= 2 && zlib_level <= 3) {
+        level = 1;
+    } else if (zlib_level >= 7) {
+        level = 3;
+    }
+    return std::min(level, ISAL_DEF_MAX_LEVEL);
+}
+
+static uint32_t IsalLevelBufSize(int level) {
+    switch (level) {
+    case 0:
+        return ISAL_DEF_LVL0_DEFAULT;
+    case 1:
+        return ISAL_DEF_LVL1_DEFAULT;
+#if ISAL_DEF_MAX_LEVEL >= 2
+    case 2:
+        return ISAL_DEF_LVL2_DEFAULT;
+#endif
+#if ISAL_DEF_MAX_LEVEL >= 3
+    case 3:
+        return ISAL_DEF_LVL3_DEFAULT;
+#endif
+    default:
+        return ISAL_DEF_LVL1_DEFAULT;
+    }
+}
+
+static bool IsalDeflateInit(IsalContext* ctx, bool gzip, int zlib_level) {
+    const int level = ToIsalLevel(zlib_level);
+    const uint32_t level_buf_size = IsalLevelBufSize(level);
+    if (ctx->level_buf_cap < level_buf_size) {
+        uint8_t* p = (uint8_t*)realloc(ctx->level_buf, level_buf_size);
+        if (p == NULL) {
+            LOG(WARNING) << "Fail to allocate " << level_buf_size << " bytes";
+            return false;
+        }
+        ctx->level_buf = p;
+        ctx->level_buf_cap = level_buf_size;
+    }
+    isal_zstream* zs = &ctx->zs;
+    isal_deflate_init(zs);
+    zs->level = level;
+    zs->level_buf = ctx->level_buf;
+    zs->level_buf_size = level_buf_size;
+    zs->gzip_flag = (gzip ? IGZIP_GZIP : IGZIP_ZLIB);
+    zs->flush = NO_FLUSH;
+    zs->avail_out = 0;
+    return true;
+}
+
+// Deflate `size' bytes from `data' into blocks of `out' directly, ending
+// the stream if `end' is true. Space left in the last block is kept in
+// `zs', which should be backed up after the stream ends.
+static bool IsalDeflate(isal_zstream* zs, butil::IOBufAsZeroCopyOutputStream* out,
+                        const void* data, size_t size, bool end) {
+    zs->next_in = (uint8_t*)data;
+    zs->avail_in = size;
+    zs->end_of_stream = end;
+    while (zs->avail_in > 0 ||
+           (end && zs->internal_state.state != ZSTATE_END)) {
+        if (zs->avail_out == 0) {
+            void* buf = NULL;
+            int buf_size = 0;
+            if (!out->Next(&buf, &buf_size)) {
+                return false;
+            }
+            zs->next_out = static_cast<uint8_t*>(buf);
+            zs->avail_out = buf_size;
+        }
+        const int rc = isal_deflate(zs);
+        if (rc != COMP_OK) {
+            LOG(WARNING) << "Fail to isal_deflate, format="
+                         << (zs->gzip_flag == IGZIP_GZIP ? "gzip" : "zlib")
+                         << " : " << rc;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Compress blocks of `in' into blocks of `out' directly.
+static bool IsalCompress(const butil::IOBuf& in, butil::IOBuf* out,
+                         bool gzip, int zlib_level) {
+    IsalContextGuard guard;
+    IsalContext* ctx = guard.get();
+    if (ctx == NULL) {
+        LOG(WARNING) << "Fail to create isa-l context";
+        return false;
+    }
+    if (!IsalDeflateInit(ctx, gzip, zlib_level)) {
+        return false;
+    }
+    butil::IOBufAsZeroCopyOutputStream wrapper(out);
+    const size_t nblock = in.backing_block_num();
+    bool ok = true;
+    // Empty input still needs one round to write the header and trailer.
+    for (size_t i = 0; ok && i < std::max(nblock, (size_t)1); ++i) {
+        const butil::StringPiece blk =
+            (i < nblock ? in.backing_block(i) : butil::StringPiece());
+        ok = IsalDeflate(&ctx->zs, &wrapper, blk.data(), blk.size(),
+                         i + 1 >= nblock);
+    }
+    wrapper.BackUp(ctx->zs.avail_out);
+    return ok;
+}
+
+// Deflate what is serialized into this stream into `out', without
+// holding the whole serialized message.
+class IsalDeflateOutputStream : public google::protobuf::io::ZeroCopyOutputStream {
+public:
+    IsalDeflateOutputStream(IsalContext* ctx, butil::IOBuf* out)
+        : _ctx(ctx), _out(out), _size(0), _byte_count(0), _ok(true) {}
+
+    bool Next(void** data, int* size) override {
+        if (!Deflate(false)) {
+            return false;
+        }
+        *data = _ctx->in_buf;
+        *size = sizeof(_ctx->in_buf);
+        _size = *size;
+        _byte_count += *size;
+        return true;
+    }
+    void BackUp(int count) override {
+        _size -= count;
+        _byte_count -= count;
+    }
+    int64_t ByteCount() const override { return _byte_count; }
+
+    // Deflate the remaining data and end the stream.
+    bool Close() {
+        Deflate(true);
+        _out.BackUp(_ctx->zs.avail_out);
+        _ctx->zs.avail_out = 0;
+        return _ok;
+    }
+
+private:
+    bool Deflate(bool end) {
+        if (_ok) {
+            _ok = IsalDeflate(&_ctx->zs, &_out, _ctx->in_buf, _size, end);
+        }
+        _size = 0;
+        return _ok;
+    }
+
+    IsalContext* _ctx;
+    butil::IOBufAsZeroCopyOutputStream _out;
+    int _size;
+    int64_t _byte_count;
+    bool _ok;
+};
+
+// Decompress blocks of `in' into blocks of `out' directly.
+static bool IsalDecompress(const butil::IOBuf& in, butil::IOBuf* out,
+                           bool gzip) {
+    IsalContextGuard guard;
+    IsalContext* ctx = guard.get();
+    if (ctx == NULL) {
+        LOG(WARNING) << "Fail to create isa-l context";
+        return false;
+    }
+    inflate_state* is = &ctx->is;
+    isal_inflate_init(is);
+    is->crc_flag = (gzip ? ISAL_GZIP : ISAL_ZLIB);
+
+    butil::IOBufAsZeroCopyOutputStream wrapper(out);
+    uint8_t* dst = NULL;
+    uint32_t dst_size = 0;
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; i <= nblock; ++i) {
+        const butil::StringPiece blk =
+            (i < nblock ? in.backing_block(i) : butil::StringPiece());
+        is->next_in = (uint8_t*)blk.data();
+        is->avail_in = blk.size();
+        // The extra round with empty input flushes buffered data.
+        while (i < nblock ? is->avail_in > 0
+                          : is->block_state != ISAL_BLOCK_FINISH) {
+            if (is->block_state == ISAL_BLOCK_FINISH) {
+                LOG(WARNING) << "Fail to decompress, format="
+                             << (gzip ? "gzip" : "zlib")
+                             << " : trailing bytes after the stream";
+                wrapper.BackUp(dst_size);
+                return false;
+            }
+            if (dst_size == 0) {
+                void* data = NULL;
+                int size = 0;
+                if (!wrapper.Next(&data, &size)) {
+                    return false;
+                }
+                dst = static_cast<uint8_t*>(data);
+                dst_size = size;
+            }
+            const uint32_t avail_in = is->avail_in;
+            is->next_out = dst;
+            is->avail_out = dst_size;
+            const int rc = isal_inflate(is);
+            const uint32_t nw = dst_size - is->avail_out;
+            dst += nw;
+            dst_size -= nw;
+            if (rc < 0 || rc == ISAL_NEED_DICT) {
+                LOG(WARNING) << "Fail to isal_inflate, format="
+                             << (gzip ? "gzip" : "zlib") << " : " << rc;
+                wrapper.BackUp(dst_size);
+                return false;
+            }
+            if (nw == 0 && is->avail_in == avail_in &&
+                is->block_state != ISAL_BLOCK_FINISH) {
+                LOG(WARNING) << "Fail to decompress truncated "
+                             << (gzip ? "gzip" : "zlib") << " stream";
+                wrapper.BackUp(dst_size);
+                return false;
+            }
+        }
+    }
+    wrapper.BackUp(dst_size);
+    return true;
+}
+
+static bool Compress(const google::protobuf::Message& msg, butil::IOBuf* buf,
+                     google::protobuf::io::GzipOutputStream::Format format) {
+    IsalContextGuard guard;
+    IsalContext* ctx = guard.get();
+    if (ctx == NULL) {
+        LOG(WARNING) << "Fail to create isa-l context";
+        return false;
+    }
+    if (!IsalDeflateInit(ctx,
+                         format == google::protobuf::io::GzipOutputStream::GZIP,
+                         GzipCompressOptions().compression_level)) {
+        return false;
+    }
+    IsalDeflateOutputStream stream(ctx, buf);
+    bool ok;
+    if (msg.GetDescriptor() == Serializer::descriptor()) {
+        ok = ((const Serializer&)msg).SerializeTo(&stream);
+    } else {
+        ok = msg.SerializeToZeroCopyStream(&stream);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to serialize input message="
+                     << msg.GetDescriptor()->full_name()
+                     << ", format=" << Format2CStr(format);
+    }
+    return stream.Close() && ok;
+}
+
+static bool Decompress(const butil::IOBuf& data, google::protobuf::Message* msg,
+                       google::protobuf::io::GzipInputStream::Format format) {
+    butil::IOBuf binary_pb;
+    if (!IsalDecompress(data, &binary_pb,
+                        format == google::protobuf::io::GzipInputStream::GZIP)) {
+        return false;
+    }
+    butil::IOBufAsZeroCopyInputStream stream(binary_pb);
+    bool ok;
+    if (msg->GetDescriptor() == Deserializer::descriptor()) {
+        ok = ((Deserializer*)msg)->DeserializeFrom(&stream);
+    } else {
+        ok = msg->ParseFromZeroCopyStream(&stream);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to deserialize input message="
+                     << msg->GetDescriptor()->full_name()
+                     << ", format=" << Format2CStr(format);
+    }
+    return ok;
+}
+
+#else  // BRPC_WITH_ISAL
+
 static bool Compress(const google::protobuf::Message& msg, butil::IOBuf* buf,
                      google::protobuf::io::GzipOutputStream::Format format) {
     butil::IOBufAsZeroCopyOutputStream wrapper(buf);
@@ -88,6 +439,8 @@ static bool Decompress(const butil::IOBuf& data, google::protobuf::Message* msg,
     return ok;
 }
 
+#endif  // BRPC_WITH_ISAL
+
 bool GzipCompress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
     return Compress(msg, buf, google::protobuf::io::GzipOutputStream::GZIP);
 }
@@ -98,11 +451,16 @@ bool GzipDecompress(const butil::IOBuf& data, google::protobuf::Message* msg) {
 
 bool GzipCompress(const butil::IOBuf& msg, butil::IOBuf* buf,
                   const GzipCompressOptions* options_in) {
-    butil::IOBufAsZeroCopyOutputStream wrapper(buf);
     GzipCompressOptions gzip_opt;
     if (options_in) {
         gzip_opt = *options_in;
     }
+#if BRPC_WITH_ISAL
+    const bool gzip =
+        (gzip_opt.format == google::protobuf::io::GzipOutputStream::GZIP);
+    return IsalCompress(msg, buf, gzip, gzip_opt.compression_level);
+#else
+    butil::IOBufAsZeroCopyOutputStream wrapper(buf);
     google::protobuf::io::GzipOutputStream out(&wrapper, gzip_opt);
     butil::IOBufAsZeroCopyInputStream in(msg);
     const void* data_in = NULL;
@@ -133,11 +491,16 @@ bool GzipCompress(const butil::IOBuf& msg, butil::IOBuf* buf,
         out.BackUp(size_out);
     }
     return out.Close();
+#endif  // BRPC_WITH_ISAL
 }
 
 inline bool GzipDecompressBase(
     const butil::IOBuf& data, butil::IOBuf* msg,
     google::protobuf::io::GzipInputStream::Format format) {
+#if BRPC_WITH_ISAL
+    return IsalDecompress(data, msg,
+                          format == google::protobuf::io::GzipInputStream::GZIP);
+#else
     butil::IOBufAsZeroCopyInputStream wrapper(data);
     google::protobuf::io::GzipInputStream in(&wrapper, format);
     butil::IOBufAsZeroCopyOutputStream out(msg);
@@ -173,6 +536,7 @@ inline bool GzipDecompressBase(
         out.BackUp(size_out);
     }
     return true;
+#endif  // BRPC_WITH_ISAL
 }
 
 bool ZlibCompress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
@@ -19,6 +19,7 @@
 #include <limits.h>
 #include <openssl/md5.h>
 #include "butil/third_party/murmurhash3/murmurhash3.h"
+#include "butil/xxh3.h"
 #include "brpc/policy/hasher.h"
 
 
@@ -73,6 +74,18 @@ uint32_t MurmurHash32V(const butil::StringPiece* keys, size_t num_keys) {
     return hash;
 }
 
+uint32_t XXH3Hash32(const void* key, size_t len) {
+    return (uint32_t)butil::XXH3Hash64(key, len);
+}
+
+uint32_t XXH3Hash32V(const butil::StringPiece* keys, size_t num_keys) {
+    butil::XXH3Stream h;
+    for (size_t i = 0; i < num_keys; ++i) {
+        h.Update(keys[i]);
+    }
+    return (uint32_t)h.Digest();
+}
+
 /* The crc32 functions and data was originally written by Spencer
  * Garrett <srg@quick.com> and was gleaned from the PostgreSQL source
  * tree via the files contrib/ltree/crc32.[ch] and from FreeBSD at
@@ -163,6 +176,9 @@ const char *GetHashName(HashFunc hasher) {
     if (hasher == CRCHash32) {
         return "crc32";
     }
+    if (hasher == XXH3Hash32) {
+        return "xxh3";
+    }
 
     return "user_defined";
 }
@@ -36,6 +36,10 @@ uint32_t MD5Hash32V(const butil::StringPiece* keys, size_t num_keys);
 uint32_t MurmurHash32(const void* key, size_t len);
 uint32_t MurmurHash32V(const butil::StringPiece* keys, size_t num_keys);
 
+// Lower 32 bits of butil::XXH3Hash64, much faster than others on long keys.
+uint32_t XXH3Hash32(const void* key, size_t len);
+uint32_t XXH3Hash32V(const butil::StringPiece* keys, size_t num_keys);
+
 }  // namespace policy
 } // namespace brpc
 
@@ -19,13 +19,18 @@
 #include "brpc/policy/http2_rpc_protocol.h"
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/server.h"
+#include "brpc/stream_impl.h"
 #include "butil/base64.h"
+#include "butil/time.h"
+#include "butil/sys_byteorder.h"
+#include "bvar/bvar.h"
 #include "brpc/log.h"
 
 namespace brpc {
 
 DECLARE_bool(http_verbose);
 DECLARE_int32(http_verbose_max_body_length);
+DECLARE_bool(http_response_date);
 DECLARE_int32(health_check_interval);
 DECLARE_bool(usercode_in_pthread);
 
@@ -47,6 +52,17 @@ DEFINE_bool(h2_hpack_encode_name, false,
 DEFINE_bool(h2_hpack_encode_value, false,
             "Encode value in HTTP2 headers with huffman encoding");
 
+DEFINE_bool(h2_bdp_auto_tuning, false,
+            "Grow local flow-control windows of http2 connections to the "
+            "bandwidth-delay product estimated with PINGs");
+DEFINE_int32(h2_bdp_max_window_size, 16 * 1024 * 1024,
+             "Max size of windows grown by -h2_bdp_auto_tuning");
+DEFINE_int32(h2_bdp_idle_shrink_s, 10,
+             "Windows grown by -h2_bdp_auto_tuning are shrunk to initial sizes "
+             "when the connection receives no DATA for so many seconds");
+BRPC_VALIDATE_GFLAG(h2_bdp_auto_tuning, PassValidate);
+BRPC_VALIDATE_GFLAG(h2_bdp_idle_shrink_s, PositiveInteger);
+
 static bool CheckStreamWindowSize(const char*, int32_t val) {
     return val >= 0;
 }
@@ -56,6 +72,26 @@ static bool CheckConnWindowSize(const char*, int32_t val) {
     return val >= (int32_t)H2Settings::DEFAULT_INITIAL_WINDOW_SIZE;
 }
 BRPC_VALIDATE_GFLAG(h2_client_connection_window_size, CheckConnWindowSize);
+BRPC_VALIDATE_GFLAG(h2_bdp_max_window_size, CheckConnWindowSize);
+
+struct H2BdpBvars {
+    bvar::Adder<int64_t> grow_count;
+    bvar::Adder<int64_t> shrink_count;
+    // Sum of stream windows beyond initial sizes of all connections.
+    bvar::Adder<int64_t> extra_stream_window;
+
+    H2BdpBvars()
+        : grow_count("h2_bdp_window_grow_count")
+        , shrink_count("h2_bdp_window_shrink_count")
+        , extra_stream_window("h2_bdp_extra_stream_window_size") {
+    }
+};
+static H2BdpBvars* get_h2_bdp_bvars() {
+    return butil::get_leaky_singleton<H2BdpBvars>();
+}
+
+// Payload of PINGs sent by -h2_bdp_auto_tuning.
+static const char H2_BDP_PING_DATA[8] = { 'b', 'r', 'p', 'c', 'b', 'd', 'p', 0 };
 
 const char* H2StreamState2Str(H2StreamState s) {
     switch (s) {
@@ -323,6 +359,7 @@ inline H2Context::FrameHandler FindFrameHandler(H2FrameType type) {
 
 H2Context::H2Context(Socket* socket, const Server* server)
     : _socket(socket)
+    , _server(server)
     // Maximize the window size to make sending big request possible before
     // receving the remote settings.
     , _remote_window_left(H2Settings::MAX_WINDOW_SIZE)
@@ -331,7 +368,14 @@ H2Context::H2Context(Socket* socket, const Server* server)
     , _last_sent_stream_id(1)
     , _goaway_stream_id(-1)
     , _remote_settings_received(false)
-    , _deferred_window_update(0) {
+    , _deferred_window_update(0)
+    , _bdp_estimator(0)
+    , _initial_stream_window(0)
+    , _initial_conn_window(0)
+    , _conn_window(0)
+    , _last_data_us(0)
+    , _withheld_window_update(0)
+    , _ngrpc_stream(0) {
     // Stop printing the field which is useless for remote settings.
     _remote_settings.connection_window_size = 0;
     // Maximize the window size to make sending big request possible before
@@ -345,6 +389,13 @@ H2Context::H2Context(Socket* socket, const Server* server)
         _unack_local_settings.max_frame_size = FLAGS_h2_client_max_frame_size;
         _unack_local_settings.connection_window_size = FLAGS_h2_client_connection_window_size;
     }
+    _initial_stream_window = _unack_local_settings.stream_window_size;
+    // Connection windows smaller than the default are not announced.
+    _initial_conn_window = std::max<int64_t>(
+        _unack_local_settings.connection_window_size,
+        (int64_t)H2Settings::DEFAULT_INITIAL_WINDOW_SIZE);
+    _conn_window = _initial_conn_window;
+    _bdp_estimator.Reset(_initial_stream_window);
 #if defined(UNIT_TEST)
     // In ut, we hope _last_sent_stream_id run out quickly to test the correctness
     // of creating new h2 socket. This value is 10,000 less than 0x7FFFFFFF.
@@ -353,6 +404,11 @@ H2Context::H2Context(Socket* socket, const Server* server)
 }
 
 H2Context::~H2Context() {
+    const int64_t extra_stream_window =
+        _unack_local_settings.stream_window_size - _initial_stream_window;
+    if (extra_stream_window > 0) {
+        get_h2_bdp_bvars()->extra_stream_window << -extra_stream_window;
+    }
     for (StreamMap::iterator it = _pending_streams.begin();
          it != _pending_streams.end(); ++it) {
         delete it->second;
@@ -496,6 +552,7 @@ ParseResult H2Context::Consume(
         if (!res.is_ok()) {
             return res;
         }
+        ShrinkWindowsIfIdle();
         H2Context::FrameHandler handler = FindFrameHandler(frame_head.type);
         if (handler == NULL) {
             LOG(ERROR) << "Invalid frame type=" << (int)frame_head.type;
@@ -516,7 +573,7 @@ ParseResult H2Context::Consume(
             }
             H2StreamContext* sctx = RemoveStreamAndDeferWU(h2_res.stream_id());
             if (sctx) {
-                if (is_server_side()) {
+                if (is_server_side() || sctx->_grpc_tail) {
                     delete sctx;
                     return MakeMessage(NULL);
                 } else {
@@ -639,6 +696,7 @@ H2ParseResult H2StreamContext::OnHeaders(
                 << ", stream_id=" << frame_head.stream_id;
             return MakeH2Error(H2_PROTOCOL_ERROR);
         }
+        StartGrpcStreamIfNeeded();
         if (frame_head.flags & H2_FLAGS_END_STREAM) {
             return OnEndStream();
         }
@@ -689,6 +747,7 @@ H2ParseResult H2StreamContext::OnContinuation(
                 << ", stream_id=" << frame_head.stream_id;
             return MakeH2Error(H2_PROTOCOL_ERROR);
         }
+        StartGrpcStreamIfNeeded();
         if (_stream_ended) {
             return OnEndStream();
         }
@@ -709,6 +768,7 @@ H2ParseResult H2Context::OnData(
         return MakeH2Error(H2_FRAME_SIZE_ERROR);
     }
     frag_size -= pad_length;
+    OnBdpData(frame_head.payload_size);
     H2StreamContext* sctx = FindStream(frame_head.stream_id);
     if (sctx == NULL) {
         // If a DATA frame is received whose stream is not in "open" or "half-closed (local)" state,
@@ -728,6 +788,9 @@ H2ParseResult H2Context::OnData(
 H2ParseResult H2StreamContext::OnData(
     butil::IOBufBytesIterator& it, const H2FrameHead& frame_head,
     uint32_t frag_size, uint8_t pad_length) {
+    if (_grpc_tail) {
+        return OnGrpcStreamData(it, frame_head, frag_size, pad_length);
+    }
     _parsed_length += FRAME_HEAD_SIZE + frame_head.payload_size;
     butil::IOBuf data;
     it.append_and_forward(&data, frag_size);
@@ -763,15 +826,30 @@ H2ParseResult H2StreamContext::OnData(
             SaveUint32(p + FRAME_HEAD_SIZE, stream_wu);
             p += FRAME_HEAD_SIZE + 4;
 
-            const int64_t conn_wu = stream_wu + _conn_ctx->ReleaseDeferredWindowUpdate();
-            SerializeFrameHead(p, 4, H2_FRAME_WINDOW_UPDATE, 0, 0);
-            SaveUint32(p + FRAME_HEAD_SIZE, conn_wu);
-            if (WriteAck(_conn_ctx->_socket, winbuf, sizeof(winbuf)) != 0) {
+            const int64_t conn_wu = _conn_ctx->WithholdWindowUpdate(
+                stream_wu + _conn_ctx->ReleaseDeferredWindowUpdate());
+            if (conn_wu > 0) {
+                SerializeFrameHead(p, 4, H2_FRAME_WINDOW_UPDATE, 0, 0);
+                SaveUint32(p + FRAME_HEAD_SIZE, conn_wu);
+                p += FRAME_HEAD_SIZE + 4;
+            }
+            if (WriteAck(_conn_ctx->_socket, winbuf, p - winbuf) != 0) {
                 LOG(WARNING) << "Fail to send WINDOW_UPDATE to " << *_conn_ctx->_socket;
                 return MakeH2Error(H2_INTERNAL_ERROR);
             }
         }
     }
+    if (_grpc != NULL) {
+        H2StreamContext* tail = SplitGrpcStream();
+        if (tail != NULL) {
+            // Following messages and END_STREAM belong to the tail.
+            if (frame_head.flags & H2_FLAGS_END_STREAM) {
+                tail->OnGrpcStreamEnd();
+            }
+            OnMessageComplete();
+            return MakeH2Message(this);
+        }
+    }
     if (frame_head.flags & H2_FLAGS_END_STREAM) {
         return OnEndStream();
     }
@@ -812,6 +890,11 @@ H2ParseResult H2StreamContext::OnResetStream(
         LOG(ERROR) << "Fail to find stream_id=" << stream_id();
         return MakeH2Error(H2_PROTOCOL_ERROR);
     }
+    if (_grpc_tail) {
+        // The RPC was done, only the Stream is failed in the destructor.
+        delete sctx;
+        return MakeH2Message(NULL);
+    }
     if (_conn_ctx->is_client_side()) {
         sctx->header().set_status_code(H2ErrorToStatusCode(h2_error));
         return MakeH2Message(sctx);
@@ -834,6 +917,9 @@ H2ParseResult H2StreamContext::OnEndStream() {
         return MakeH2Error(H2_PROTOCOL_ERROR);
     }
 #endif
+    if (_grpc_tail) {
+        return OnGrpcStreamEnd();
+    }
     H2StreamContext* sctx = _conn_ctx->RemoveStreamAndDeferWU(stream_id());
     if (sctx == NULL) {
         RPC_VLOG << "Fail to find stream_id=" << stream_id();
@@ -862,7 +948,14 @@ H2ParseResult H2Context::OnSettings(
                        << " for settings-ACK";
             return MakeH2Error(H2_PROTOCOL_ERROR);
         }
+        const bool window_shrunk = _unack_local_settings.stream_window_size
+            < _local_settings.stream_window_size;
         _local_settings = _unack_local_settings;
+        if (window_shrunk) {
+            // Streams may have received more than the shrunk window without
+            // updating windows, which stalls them.
+            FlushWindowUpdates();
+        }
         return MakeH2Message(NULL);
     }
     const int64_t old_stream_window_size = _remote_settings.stream_window_size;
@@ -938,9 +1031,14 @@ H2ParseResult H2Context::OnPing(
         return MakeH2Error(H2_PROTOCOL_ERROR);
     }
     if (frame_head.flags & H2_FLAGS_ACK) {
+        char data[8];
+        it.copy_and_forward(data, sizeof(data));
+        if (memcmp(data, H2_BDP_PING_DATA, sizeof(data)) == 0) {
+            OnBdpPingAck();
+        }
         return MakeH2Message(NULL);
     }
-    
+
     char pongbuf[FRAME_HEAD_SIZE + 8];
     SerializeFrameHead(pongbuf, 8, H2_FRAME_PING, H2_FLAGS_ACK, 0);
     it.copy_and_forward(pongbuf + FRAME_HEAD_SIZE, 8);
@@ -982,6 +1080,17 @@ H2ParseResult H2Context::OnGoAway(
 
         std::vector<H2StreamContext*> goaway_streams;
         RemoveGoAwayStreams(last_stream_id, &goaway_streams);
+        // RPC of gRPC streams were done, their Streams are failed in the
+        // destructor.
+        size_t nrpc = 0;
+        for (size_t i = 0; i < goaway_streams.size(); ++i) {
+            if (goaway_streams[i]->_grpc_tail) {
+                delete goaway_streams[i];
+            } else {
+                goaway_streams[nrpc++] = goaway_streams[i];
+            }
+        }
+        goaway_streams.resize(nrpc);
         if (goaway_streams.empty()) {
             return MakeH2Message(NULL);
         }
@@ -1021,6 +1130,9 @@ H2ParseResult H2Context::OnWindowUpdate(
             LOG(ERROR) << "Invalid connection-level window_size_increment=" << inc;
             return MakeH2Error(H2_FLOW_CONTROL_ERROR);
         }
+        if (_ngrpc_stream.load(butil::memory_order_relaxed) > 0) {
+            FlushGrpcStreams(0);
+        }
         return MakeH2Message(NULL);
     } else {
         H2StreamContext* sctx = FindStream(frame_head.stream_id);
@@ -1033,6 +1145,9 @@ H2ParseResult H2Context::OnWindowUpdate(
                 << " to remote_window_left=" << sctx->_remote_window_left.load(butil::memory_order_relaxed);
             return MakeH2Error(H2_FLOW_CONTROL_ERROR);
         }
+        if (sctx->_grpc != NULL) {
+            FlushGrpcStreams(frame_head.stream_id);
+        }
         return MakeH2Message(NULL);
     }
 }
@@ -1051,8 +1166,17 @@ void H2Context::Describe(std::ostream& os, const DescribeOptions& opt) const {
        << _remote_window_left.load(butil::memory_order_relaxed)
        << sep << "remote_settings=" << _remote_settings
        << sep << "remote_settings_received=" << _remote_settings_received
-       << sep << "local_settings=" << _local_settings
-       << sep << "hpacker={";
+       << sep << "local_settings=" << _local_settings;
+    if (FLAGS_h2_bdp_auto_tuning) {
+        os << sep << "bdp=" << _bdp_estimator.bdp()
+           << sep << "bdp_rtt_us=" << _bdp_estimator.rtt_us()
+           << sep << "bdp_max_bandwidth=" << _bdp_estimator.max_bandwidth()
+           << sep << "local_stream_window=" << _unack_local_settings.stream_window_size
+           << sep << "local_conn_window=" << _conn_window
+           << sep << "withheld_window_update="
+           << _withheld_window_update.load(butil::memory_order_relaxed);
+    }
+    os << sep << "hpacker={";
     IndentingOStream os2(os, 2);
     _hpacker.Describe(os2, opt);
     os << '}';
@@ -1082,7 +1206,8 @@ void H2Context::DeferWindowUpdate(int64_t size) {
     const int64_t acc = _deferred_window_update.fetch_add(size, butil::memory_order_relaxed) + size;
     if (acc >= local_settings().stream_window_size / 2) {
         // Rarely happen for small messages.
-        const int64_t conn_wu = _deferred_window_update.exchange(0, butil::memory_order_relaxed);
+        const int64_t conn_wu = WithholdWindowUpdate(
+            _deferred_window_update.exchange(0, butil::memory_order_relaxed));
         if (conn_wu > 0) {
             char winbuf[FRAME_HEAD_SIZE + 4];
             SerializeFrameHead(winbuf, 4, H2_FRAME_WINDOW_UPDATE, 0, 0);
@@ -1094,6 +1219,141 @@ void H2Context::DeferWindowUpdate(int64_t size) {
     }
 }
 
+int64_t H2Context::WithholdWindowUpdate(int64_t conn_wu) {
+    int64_t withheld = _withheld_window_update.load(butil::memory_order_relaxed);
+    while (withheld > 0 && conn_wu > 0) {
+        const int64_t n = std::min(withheld, conn_wu);
+        if (_withheld_window_update.compare_exchange_weak(
+                withheld, withheld - n, butil::memory_order_relaxed)) {
+            return conn_wu - n;
+        }
+    }
+    return conn_wu;
+}
+
+void H2Context::OnBdpData(uint32_t size) {
+    if (!FLAGS_h2_bdp_auto_tuning) {
+        return;
+    }
+    const int64_t now_us = butil::cpuwide_time_us();
+    _last_data_us = now_us;
+    if (!_bdp_estimator.OnData(size, now_us, FLAGS_h2_bdp_max_window_size)) {
+        return;
+    }
+    char pingbuf[FRAME_HEAD_SIZE + 8];
+    SerializeFrameHead(pingbuf, 8, H2_FRAME_PING, 0, 0);
+    memcpy(pingbuf + FRAME_HEAD_SIZE, H2_BDP_PING_DATA, 8);
+    if (WriteAck(_socket, pingbuf, sizeof(pingbuf)) != 0) {
+        LOG(WARNING) << "Fail to send PING to " << *_socket;
+    }
+}
+
+void H2Context::OnBdpPingAck() {
+    const int64_t window = _bdp_estimator.OnPingAck(
+        butil::cpuwide_time_us(), FLAGS_h2_bdp_max_window_size);
+    if (window > 0) {
+        GrowWindows(window);
+    }
+}
+
+void H2Context::GrowWindows(int64_t window) {
+    char buf[FRAME_HEAD_SIZE + 6 + FRAME_HEAD_SIZE + 4];
+    char* p = buf;
+    const int64_t old_stream_window = _unack_local_settings.stream_window_size;
+    if (window > old_stream_window) {
+        SerializeFrameHead(p, 6, H2_FRAME_SETTINGS, 0, 0);
+        SaveUint16(p + FRAME_HEAD_SIZE, H2_SETTINGS_STREAM_WINDOW_SIZE);
+        SaveUint32(p + FRAME_HEAD_SIZE + 2, window);
+        p += FRAME_HEAD_SIZE + 6;
+        // A larger window takes effect at once, the remote side can't
+        // send more before receiving the SETTINGS.
+        _unack_local_settings.stream_window_size = window;
+        _local_settings.stream_window_size = window;
+        get_h2_bdp_bvars()->extra_stream_window << window - old_stream_window;
+    }
+    if (window > _conn_window) {
+        // Pay withheld updates first if the window was shrunk recently.
+        const int64_t conn_wu = WithholdWindowUpdate(window - _conn_window);
+        _conn_window = window;
+        if (conn_wu > 0) {
+            SerializeFrameHead(p, 4, H2_FRAME_WINDOW_UPDATE, 0, 0);
+            SaveUint32(p + FRAME_HEAD_SIZE, conn_wu);
+            p += FRAME_HEAD_SIZE + 4;
+        }
+    }
+    if (p == buf) {
+        return;
+    }
+    if (WriteAck(_socket, buf, p - buf) != 0) {
+        LOG(WARNING) << "Fail to send enlarged windows to " << *_socket;
+        return;
+    }
+    get_h2_bdp_bvars()->grow_count << 1;
+}
+
+void H2Context::ShrinkWindowsIfIdle() {
+    if (_unack_local_settings.stream_window_size <= _initial_stream_window &&
+        _conn_window <= _initial_conn_window) {
+        return;
+    }
+    if (butil::cpuwide_time_us() - _last_data_us <
+        FLAGS_h2_bdp_idle_shrink_s * 1000000L) {
+        return;
+    }
+    const int64_t extra_stream_window =
+        _unack_local_settings.stream_window_size - _initial_stream_window;
+    if (extra_stream_window > 0) {
+        char settingsbuf[FRAME_HEAD_SIZE + 6];
+        SerializeFrameHead(settingsbuf, 6, H2_FRAME_SETTINGS, 0, 0);
+        SaveUint16(settingsbuf + FRAME_HEAD_SIZE, H2_SETTINGS_STREAM_WINDOW_SIZE);
+        SaveUint32(settingsbuf + FRAME_HEAD_SIZE + 2, _initial_stream_window);
+        if (WriteAck(_socket, settingsbuf, sizeof(settingsbuf)) != 0) {
+            LOG(WARNING) << "Fail to send shrunk windows to " << *_socket;
+            return;
+        }
+        // A smaller window takes effect after the SETTINGS is acked, the
+        // remote side may send with the larger window before that.
+        _unack_local_settings.stream_window_size = _initial_stream_window;
+        get_h2_bdp_bvars()->extra_stream_window << -extra_stream_window;
+    }
+    if (_conn_window > _initial_conn_window) {
+        // Connection window can only be shrunk by not updating it.
+        _withheld_window_update.fetch_add(_conn_window - _initial_conn_window,
+                                          butil::memory_order_relaxed);
+        _conn_window = _initial_conn_window;
+    }
+    _bdp_estimator.Reset(_initial_stream_window);
+    get_h2_bdp_bvars()->shrink_count << 1;
+}
+
+void H2Context::FlushWindowUpdates() {
+    std::string buf;
+    char winbuf[FRAME_HEAD_SIZE + 4];
+    int64_t conn_wu = 0;
+    {
+        std::unique_lock<butil::Mutex> mu(_stream_mutex);
+        for (StreamMap::const_iterator it = _pending_streams.begin();
+             it != _pending_streams.end(); ++it) {
+            const int64_t stream_wu = it->second->ReleaseDeferredWindowUpdate();
+            if (stream_wu > 0) {
+                SerializeFrameHead(winbuf, 4, H2_FRAME_WINDOW_UPDATE, 0, it->first);
+                SaveUint32(winbuf + FRAME_HEAD_SIZE, stream_wu);
+                buf.append(winbuf, sizeof(winbuf));
+                conn_wu += stream_wu;
+            }
+        }
+    }
+    conn_wu = WithholdWindowUpdate(conn_wu + ReleaseDeferredWindowUpdate());
+    if (conn_wu > 0) {
+        SerializeFrameHead(winbuf, 4, H2_FRAME_WINDOW_UPDATE, 0, 0);
+        SaveUint32(winbuf + FRAME_HEAD_SIZE, conn_wu);
+        buf.append(winbuf, sizeof(winbuf));
+    }
+    if (!buf.empty() && WriteAck(_socket, buf.data(), buf.size()) != 0) {
+        LOG(WARNING) << "Fail to send WINDOW_UPDATE to " << *_socket;
+    }
+}
+
 #if defined(BRPC_PROFILE_H2)
 bvar::Adder<int64_t> g_parse_time;
 bvar::PerSecond<bvar::Adder<int64_t> > g_parse_time_per_second(
@@ -1166,7 +1426,9 @@ H2StreamContext::H2StreamContext(bool read_body_progressively)
     , _stream_ended(false)
     , _remote_window_left(0)
     , _deferred_window_update(0)
-    , _correlation_id(INVALID_BTHREAD_ID.value) {
+    , _correlation_id(INVALID_BTHREAD_ID.value)
+    , _grpc_split(false)
+    , _grpc_tail(false) {
     header().set_version(2, 0);
 #ifndef NDEBUG
     get_h2_bvars()->h2_stream_context_count << 1;
@@ -1181,6 +1443,13 @@ void H2StreamContext::Init(H2Context* conn_ctx, int stream_id) {
 }
 
 H2StreamContext::~H2StreamContext() {
+    if (_grpc != NULL) {
+        _conn_ctx->_ngrpc_stream.fetch_sub(1, butil::memory_order_relaxed);
+        if (_grpc->stream_id != INVALID_STREAM_ID) {
+            Stream::SetFailed(_grpc->stream_id, ECONNRESET,
+                              "The http2 stream was closed");
+        }
+    }
 #ifndef NDEBUG
     get_h2_bvars()->h2_stream_context_count << -1;
 #endif
@@ -1307,17 +1576,534 @@ int H2StreamContext::ConsumeHeaders(butil::IOBufBytesIterator& it) {
 
 const CommonStrings* get_common_strings();
 
+// Defined in http_rpc_protocol.cpp
+const Server::MethodProperty*
+FindMethodPropertyByURI(const std::string& uri_path, const Server* server,
+                        std::string* unresolved_path);
+
+void H2StreamContext::StartGrpcStreamIfNeeded() {
+    if (_grpc != NULL || _grpc_split || _grpc_tail ||
+        _conn_ctx->_server == NULL || read_body_progressively()) {
+        return;
+    }
+    bool is_grpc_ct = false;
+    ParseContentType(header().content_type(), &is_grpc_ct);
+    if (!is_grpc_ct) {
+        return;
+    }
+    const Server::MethodProperty* mp = FindMethodPropertyByURI(
+        header().uri().path(), _conn_ctx->_server, NULL);
+    if (mp == NULL || mp->method == NULL ||
+        (!mp->method->client_streaming() && !mp->method->server_streaming())) {
+        return;
+    }
+    _grpc.reset(new H2GrpcStream);
+    _conn_ctx->_ngrpc_stream.fetch_add(1, butil::memory_order_relaxed);
+}
+
+H2StreamContext* H2StreamContext::SplitGrpcStream() {
+    butil::IOBuf& buf = body();
+    char prefix[GRPC_MESSAGE_PREFIX_SIZE];
+    if (buf.copy_to(prefix, sizeof(prefix)) != sizeof(prefix)) {
+        return NULL;
+    }
+    const size_t first_size =
+        sizeof(prefix) + butil::NetToHost32(*(uint32_t*)(prefix + 1));
+    if (buf.size() < first_size) {
+        return NULL;
+    }
+    H2StreamContext* tail = new H2StreamContext(false);
+    tail->Init(_conn_ctx, _stream_id);
+    tail->_grpc_tail = true;
+    tail->set_correlation_id(_correlation_id);
+    butil::IOBuf first;
+    buf.cutn(&first, first_size);
+    const int64_t left_size = buf.size();
+    StreamId failed_stream = INVALID_STREAM_ID;
+    {
+        std::unique_lock<butil::Mutex> mu(_conn_ctx->_stream_mutex);
+        H2StreamContext** psctx = _conn_ctx->_pending_streams.seek(_stream_id);
+        CHECK(psctx != NULL && *psctx == this);
+        *psctx = tail;
+        tail->_grpc.swap(_grpc);
+        tail->_grpc->unparsed.swap(buf);
+        tail->_remote_window_left.store(
+            _remote_window_left.load(butil::memory_order_relaxed),
+            butil::memory_order_relaxed);
+        if (tail->DeliverGrpcMessagesLocked() != 0) {
+            failed_stream = tail->_grpc->stream_id;
+        }
+    }
+    buf.swap(first);
+    _grpc_split = true;
+    if (failed_stream != INVALID_STREAM_ID) {
+        Stream::SetFailed(failed_stream, EPROTO,
+                          "Compressed gRPC messages are not supported in streams");
+    }
+    // The window of the first message is returned now, the left bytes are
+    // returned after being consumed from the Stream.
+    const int64_t wu = ReleaseDeferredWindowUpdate();
+    _conn_ctx->DeferWindowUpdate(wu);
+    if (wu > left_size) {
+        ReturnH2GrpcStreamWindow(_conn_ctx->_socket, _stream_id, wu - left_size);
+    }
+    return tail;
+}
+
+int H2StreamContext::DeliverGrpcMessagesLocked() {
+    H2GrpcStream* g = _grpc.get();
+    if (g->stream_id == INVALID_STREAM_ID) {
+        // Delivered after the Stream is bound, or dropped after it's closed.
+        return 0;
+    }
+    char prefix[GRPC_MESSAGE_PREFIX_SIZE];
+    while (g->unparsed.copy_to(prefix, sizeof(prefix)) == sizeof(prefix)) {
+        const size_t size = butil::NetToHost32(*(uint32_t*)(prefix + 1));
+        if (g->unparsed.size() < sizeof(prefix) + size) {
+            break;
+        }
+        if (prefix[0] != 0) {
+            return -1;
+        }
+        g->unparsed.pop_front(sizeof(prefix));
+        butil::IOBuf msg;
+        g->unparsed.cutn(&msg, size);
+        if (Stream::OnH2Message(g->queue, &msg) != 0) {
+            // The Stream was closed.
+            g->unparsed.clear();
+            return 0;
+        }
+    }
+    if (g->remote_closed && !g->remote_close_delivered) {
+        g->remote_close_delivered = true;
+        Stream::OnH2HalfClosed(g->queue);
+    }
+    return 0;
+}
+
+H2ParseResult H2StreamContext::OnGrpcStreamData(
+    butil::IOBufBytesIterator& it, const H2FrameHead& frame_head,
+    uint32_t frag_size, uint8_t pad_length) {
+    _parsed_length += FRAME_HEAD_SIZE + frame_head.payload_size;
+    butil::IOBuf data;
+    it.append_and_forward(&data, frag_size);
+    it.forward(pad_length);
+    // The connection-level window is returned at once while the
+    // stream-level window is returned after messages are consumed, which
+    // slows down the remote side if the Stream is not consumed in time.
+    _conn_ctx->DeferWindowUpdate(frame_head.payload_size);
+    if (frame_head.payload_size > frag_size) {
+        ReturnH2GrpcStreamWindow(_conn_ctx->_socket, _stream_id,
+                                 frame_head.payload_size - frag_size);
+    }
+    StreamId failed_stream = INVALID_STREAM_ID;
+    {
+        std::unique_lock<butil::Mutex> mu(_conn_ctx->_stream_mutex);
+        _grpc->unparsed.append(butil::IOBuf::Movable(data));
+        if (DeliverGrpcMessagesLocked() != 0) {
+            failed_stream = _grpc->stream_id;
+        }
+    }
+    if (failed_stream != INVALID_STREAM_ID) {
+        Stream::SetFailed(failed_stream, EPROTO,
+                          "Compressed gRPC messages are not supported in streams");
+    }
+    if (frame_head.flags & H2_FLAGS_END_STREAM) {
+        return OnGrpcStreamEnd();
+    }
+    return MakeH2Message(NULL);
+}
+
+H2ParseResult H2StreamContext::OnGrpcStreamEnd() {
+    if (_conn_ctx->is_server_side()) {
+        // The client half-closed.
+        bool local_closed = false;
+        {
+            std::unique_lock<butil::Mutex> mu(_conn_ctx->_stream_mutex);
+            _grpc->remote_closed = true;
+            DeliverGrpcMessagesLocked();
+            local_closed = _grpc->local_closed;
+        }
+        if (local_closed) {
+            delete _conn_ctx->RemoveStreamAndDeferWU(_stream_id);
+        }
+        return MakeH2Message(NULL);
+    }
+    // Trailers of the call were received at client-side. After removal,
+    // _grpc is not reachable from other threads.
+    H2StreamContext* sctx = _conn_ctx->RemoveStreamAndDeferWU(_stream_id);
+    if (sctx == NULL) {
+        RPC_VLOG << "Fail to find stream_id=" << _stream_id;
+        return MakeH2Message(NULL);
+    }
+    CHECK_EQ(sctx, this);
+    std::unique_ptr<H2StreamContext> delete_self(sctx);
+    const CommonStrings* common = get_common_strings();
+    int error_code = 0;
+    std::string error_text;
+    const std::string* grpc_status = header().GetHeader(common->GRPC_STATUS);
+    if (grpc_status == NULL) {
+        error_code = ERESPONSE;
+        error_text = "Missing grpc-status in trailers";
+    } else {
+        const GrpcStatus status = (GrpcStatus)strtol(grpc_status->c_str(), NULL, 10);
+        if (status != GRPC_OK) {
+            error_code = GrpcStatusToErrorCode(status);
+            const std::string* grpc_message = header().GetHeader(common->GRPC_MESSAGE);
+            if (grpc_message) {
+                PercentDecode(*grpc_message, &error_text);
+            } else {
+                error_text = GrpcStatusToString(status);
+            }
+        }
+    }
+    if (!_grpc->local_closed) {
+        // The call is over, stop sending.
+        char rstbuf[FRAME_HEAD_SIZE + 4];
+        SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, _stream_id);
+        SaveUint32(rstbuf + FRAME_HEAD_SIZE, H2_NO_ERROR);
+        if (WriteAck(_conn_ctx->_socket, rstbuf, sizeof(rstbuf)) != 0) {
+            LOG(WARNING) << "Fail to send RST_STREAM to " << *_conn_ctx->_socket;
+        }
+    }
+    const StreamId stream_id = _grpc->stream_id;
+    _grpc->stream_id = INVALID_STREAM_ID;
+    if (stream_id != INVALID_STREAM_ID) {
+        Stream::SetFailed(stream_id, error_code, "%s", error_text.c_str());
+    }
+    return MakeH2Message(NULL);
+}
+
+// Trailers ending a streaming gRPC call at server-side, after the unsent
+// DATA frames. HPACK encoding must follow the order of writing, the
+// trailers are encoded in AppendAndDestroySelf() like H2UnsentResponse.
+class H2GrpcTrailers : public SocketMessage {
+public:
+    H2GrpcTrailers(int stream_id, int error_code,
+                   const std::string& error_text, bool reset,
+                   butil::IOBuf* data)
+        : _stream_id(stream_id)
+        , _grpc_status(ErrorCodeToGrpcStatus(error_code))
+        , _reset(reset) {
+        _data.swap(*data);
+        if (error_code != 0) {
+            PercentEncode(error_text, &_grpc_message);
+        }
+    }
+
+    butil::Status AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) override {
+        std::unique_ptr<H2GrpcTrailers> destroy_self(this);
+        if (socket == NULL) {
+            return butil::Status::OK();
+        }
+        H2Context* ctx = static_cast<H2Context*>(socket->parsing_context());
+        out->append(butil::IOBuf::Movable(_data));
+
+        HPacker& hpacker = ctx->hpacker();
+        butil::IOBufAppender appender;
+        HPackOptions options;
+        options.encode_name = FLAGS_h2_hpack_encode_name;
+        options.encode_value = FLAGS_h2_hpack_encode_value;
+        if (ctx->remote_settings().header_table_size == 0) {
+            options.index_policy = HPACK_NEVER_INDEX_HEADER;
+        }
+        HPacker::Header status_header("grpc-status",
+                                      butil::string_printf("%d", _grpc_status));
+        hpacker.Encode(&appender, status_header, options);
+        if (!_grpc_message.empty()) {
+            HPacker::Header msg_header("grpc-message", _grpc_message);
+            hpacker.Encode(&appender, msg_header, options);
+        }
+        butil::IOBuf frag;
+        appender.move_to(frag);
+
+        char headbuf[FRAME_HEAD_SIZE];
+        SerializeFrameHead(headbuf, frag.size(), H2_FRAME_HEADERS,
+                           H2_FLAGS_END_STREAM | H2_FLAGS_END_HEADERS,
+                           _stream_id);
+        out->append(headbuf, sizeof(headbuf));
+        out->append(butil::IOBuf::Movable(frag));
+        if (_reset) {
+            // The client is still sending, tell it to stop.
+            char rstbuf[FRAME_HEAD_SIZE + 4];
+            SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, _stream_id);
+            SaveUint32(rstbuf + FRAME_HEAD_SIZE, H2_NO_ERROR);
+            out->append(rstbuf, sizeof(rstbuf));
+        }
+        return butil::Status::OK();
+    }
+
+    size_t EstimatedByteSize() override {
+        return _data.size() + _grpc_message.size();
+    }
+
+private:
+    int _stream_id;
+    GrpcStatus _grpc_status;
+    bool _reset;
+    std::string _grpc_message;
+    butil::IOBuf _data;
+};
+
+// Bytes of messages sent, without prefixes. Prefixes of messages not sent
+// are subtracted as well, which under-estimates a little until all queued
+// messages were sent.
+static size_t GrpcMessageBytesSent(const H2GrpcStream* g) {
+    const size_t prefix_size = g->nqueued * GRPC_MESSAGE_PREFIX_SIZE;
+    return g->sent > prefix_size ? g->sent - prefix_size : 0;
+}
+
+static void OnGrpcStreamSent(StreamId stream_id, size_t consumed) {
+    if (stream_id == INVALID_STREAM_ID || consumed == 0) {
+        return;
+    }
+    SocketUniquePtr ptr;
+    if (Socket::Address(stream_id, &ptr) == 0) {
+        ((Stream*)ptr->conn())->OnH2Sent(consumed);
+    }
+}
+
+void H2Context::FlushGrpcStreamLocked(H2StreamContext* sctx) {
+    H2GrpcStream* g = sctx->_grpc.get();
+    butil::IOBuf out;
+    char headbuf[FRAME_HEAD_SIZE];
+    while (!g->unsent.empty()) {
+        const int64_t n = std::min(
+            std::min<int64_t>(g->unsent.size(), _remote_settings.max_frame_size),
+            std::min(sctx->_remote_window_left.load(butil::memory_order_relaxed),
+                     _remote_window_left.load(butil::memory_order_relaxed)));
+        // The connection window is shared with other streams.
+        if (n <= 0 || !MinusWindowSize(&_remote_window_left, n)) {
+            break;
+        }
+        sctx->_remote_window_left.fetch_sub(n, butil::memory_order_relaxed);
+        SerializeFrameHead(headbuf, n, H2_FRAME_DATA, 0, sctx->stream_id());
+        out.append(headbuf, sizeof(headbuf));
+        g->unsent.cutn(&out, n);
+        g->sent += n;
+    }
+    Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = true;
+    if (!g->unsent.empty() || !g->local_closing || g->local_closed) {
+        if (!out.empty()) {
+            _socket->Write(&out, &wopt);
+        }
+        return;
+    }
+    g->local_closed = true;
+    if (is_client_side()) {
+        // Half-close the call.
+        SerializeFrameHead(headbuf, 0, H2_FRAME_DATA,
+                           H2_FLAGS_END_STREAM, sctx->stream_id());
+        out.append(headbuf, sizeof(headbuf));
+        _socket->Write(&out, &wopt);
+        return;
+    }
+    SocketMessagePtr<H2GrpcTrailers> trailers(new H2GrpcTrailers(
+        sctx->stream_id(), g->error_code, g->error_text,
+        !g->remote_closed, &out));
+    _socket->Write(trailers, &wopt);
+    // The call is over at server-side.
+    AddAbandonedStream(sctx->stream_id());
+}
+
+void H2Context::FlushGrpcStreams(int stream_id) {
+    std::vector<std::pair<StreamId, size_t> > sent;
+    {
+        std::unique_lock<butil::Mutex> mu(_stream_mutex);
+        for (StreamMap::iterator it = _pending_streams.begin();
+             it != _pending_streams.end(); ++it) {
+            if (stream_id != 0 && it->first != stream_id) {
+                continue;
+            }
+            H2GrpcStream* g = it->second->_grpc.get();
+            if (g != NULL && !g->unsent.empty()) {
+                FlushGrpcStreamLocked(it->second);
+                sent.push_back(std::make_pair(g->stream_id, GrpcMessageBytesSent(g)));
+            }
+        }
+    }
+    for (size_t i = 0; i < sent.size(); ++i) {
+        OnGrpcStreamSent(sent[i].first, sent[i].second);
+    }
+}
+
+ssize_t H2Context::WriteGrpcStream(int stream_id, butil::IOBuf* msgs, size_t nmsg) {
+    StreamId bound = INVALID_STREAM_ID;
+    size_t consumed = 0;
+    {
+        std::unique_lock<butil::Mutex> mu(_stream_mutex);
+        H2StreamContext** psctx = _pending_streams.seek(stream_id);
+        if (psctx == NULL || (*psctx)->_grpc == NULL ||
+            (*psctx)->_grpc->local_closing) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        H2GrpcStream* g = (*psctx)->_grpc.get();
+        g->unsent.append(butil::IOBuf::Movable(*msgs));
+        g->nqueued += nmsg;
+        FlushGrpcStreamLocked(*psctx);
+        bound = g->stream_id;
+        consumed = GrpcMessageBytesSent(g);
+    }
+    OnGrpcStreamSent(bound, consumed);
+    return 0;
+}
+
+void H2Context::CloseGrpcStream(int stream_id, int error_code,
+                                const std::string& error_text) {
+    std::unique_lock<butil::Mutex> mu(_stream_mutex);
+    H2StreamContext** psctx = _pending_streams.seek(stream_id);
+    if (psctx == NULL || (*psctx)->_grpc == NULL ||
+        (*psctx)->_grpc->local_closing) {
+        return;
+    }
+    H2GrpcStream* g = (*psctx)->_grpc.get();
+    g->local_closing = true;
+    // The Stream is being recycled.
+    g->stream_id = INVALID_STREAM_ID;
+    g->error_code = error_code;
+    g->error_text = error_text;
+    if (error_code != 0) {
+        g->unsent.clear();
+        if (is_client_side()) {
+            g->local_closed = true;
+            char rstbuf[FRAME_HEAD_SIZE + 4];
+            SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, stream_id);
+            SaveUint32(rstbuf + FRAME_HEAD_SIZE, H2_CANCEL);
+            if (WriteAck(_socket, rstbuf, sizeof(rstbuf)) != 0) {
+                LOG(WARNING) << "Fail to send RST_STREAM to " << *_socket;
+            }
+            AddAbandonedStream(stream_id);
+            return;
+        }
+    }
+    FlushGrpcStreamLocked(*psctx);
+}
+
+int H2Context::BindGrpcStream(int stream_id, StreamId bound,
+                              bthread::ExecutionQueueId<butil::IOBuf*> queue) {
+    {
+        std::unique_lock<butil::Mutex> mu(_stream_mutex);
+        H2StreamContext** psctx = _pending_streams.seek(stream_id);
+        if (psctx == NULL || (*psctx)->_grpc == NULL ||
+            (*psctx)->_grpc->local_closing) {
+            return -1;
+        }
+        H2GrpcStream* g = (*psctx)->_grpc.get();
+        g->stream_id = bound;
+        g->queue = queue;
+        if ((*psctx)->DeliverGrpcMessagesLocked() == 0) {
+            return 0;
+        }
+    }
+    Stream::SetFailed(bound, EPROTO,
+                      "Compressed gRPC messages are not supported in streams");
+    return 0;
+}
+
+void H2Context::AbandonGrpcStream(int stream_id) {
+    {
+        std::unique_lock<butil::Mutex> mu(_stream_mutex);
+        H2StreamContext** psctx = _pending_streams.seek(stream_id);
+        if (psctx == NULL || (*psctx)->_grpc == NULL) {
+            return;
+        }
+        H2GrpcStream* g = (*psctx)->_grpc.get();
+        g->stream_id = INVALID_STREAM_ID;
+        g->local_closing = true;
+        g->local_closed = true;
+        if (!g->remote_closed) {
+            // Written after the response ending the stream.
+            char rstbuf[FRAME_HEAD_SIZE + 4];
+            SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, stream_id);
+            SaveUint32(rstbuf + FRAME_HEAD_SIZE, H2_NO_ERROR);
+            if (WriteAck(_socket, rstbuf, sizeof(rstbuf)) != 0) {
+                LOG(WARNING) << "Fail to send RST_STREAM to " << *_socket;
+            }
+        }
+    }
+    AddAbandonedStream(stream_id);
+}
+
+ssize_t WriteH2GrpcStream(Socket* sock, int h2_stream_id,
+                          butil::IOBuf* const* data_list, size_t size) {
+    H2Context* ctx = static_cast<H2Context*>(sock->parsing_context());
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    butil::IOBuf msgs;
+    ssize_t len = 0;
+    char prefix[GRPC_MESSAGE_PREFIX_SIZE];
+    prefix[0] = 0;  // not compressed
+    for (size_t i = 0; i < size; ++i) {
+        *(uint32_t*)(prefix + 1) = butil::HostToNet32(data_list[i]->size());
+        msgs.append(prefix, sizeof(prefix));
+        len += data_list[i]->size();
+        msgs.append(butil::IOBuf::Movable(*data_list[i]));
+    }
+    if (ctx->WriteGrpcStream(h2_stream_id, &msgs, size) != 0) {
+        return -1;
+    }
+    return len;
+}
+
+void CloseH2GrpcStream(Socket* sock, int h2_stream_id,
+                       int error_code, const std::string& error_text) {
+    H2Context* ctx = static_cast<H2Context*>(sock->parsing_context());
+    if (ctx != NULL) {
+        ctx->CloseGrpcStream(h2_stream_id, error_code, error_text);
+    }
+}
+
+void ReturnH2GrpcStreamWindow(Socket* sock, int h2_stream_id, int64_t size) {
+    if (size <= 0) {
+        return;
+    }
+    char winbuf[FRAME_HEAD_SIZE + 4];
+    SerializeFrameHead(winbuf, 4, H2_FRAME_WINDOW_UPDATE, 0, h2_stream_id);
+    SaveUint32(winbuf + FRAME_HEAD_SIZE, size);
+    if (WriteAck(sock, winbuf, sizeof(winbuf)) != 0) {
+        LOG(WARNING) << "Fail to send WINDOW_UPDATE to " << *sock;
+    }
+}
+
+int BindH2GrpcStream(Socket* sock, int h2_stream_id, StreamId stream_id) {
+    H2Context* ctx = static_cast<H2Context*>(sock->parsing_context());
+    SocketUniquePtr ptr;
+    if (ctx == NULL || Socket::Address(stream_id, &ptr) != 0) {
+        return -1;
+    }
+    Stream* s = (Stream*)ptr->conn();
+    const bthread::ExecutionQueueId<butil::IOBuf*> queue = s->consumer_queue();
+    s->SetH2Connected(sock, h2_stream_id);
+    // Not holding the Stream which may be recycled and closes the http2
+    // stream with the lock inside.
+    ptr.reset();
+    return ctx->BindGrpcStream(h2_stream_id, stream_id, queue);
+}
+
+void AbandonH2GrpcStream(Socket* sock, int h2_stream_id) {
+    H2Context* ctx = static_cast<H2Context*>(sock->parsing_context());
+    if (ctx != NULL) {
+        ctx->AbandonGrpcStream(h2_stream_id);
+    }
+}
+
+
 static void PackH2Message(butil::IOBuf* out,
                           butil::IOBuf& headers,
                           butil::IOBuf& trailer_headers,
                           const butil::IOBuf& data,
                           int stream_id,
-                          H2Context* conn_ctx) {
+                          H2Context* conn_ctx,
+                          bool end_stream = true) {
     const H2Settings& remote_settings = conn_ctx->remote_settings();
     char headbuf[FRAME_HEAD_SIZE];
     H2FrameHead headers_head = {
         (uint32_t)headers.size(), H2_FRAME_HEADERS, 0, stream_id};
-    if (data.empty() && trailer_headers.empty()) {
+    if (data.empty() && trailer_headers.empty() && end_stream) {
         headers_head.flags |= H2_FLAGS_END_STREAM;
     }
     if (headers_head.payload_size <= remote_settings.max_frame_size) {
@@ -1350,7 +2136,7 @@ static void PackH2Message(butil::IOBuf* out,
         while (it.bytes_left()) {
             if (it.bytes_left() <= remote_settings.max_frame_size) {
                 data_head.payload_size = it.bytes_left();
-                if (trailer_headers.empty()) {
+                if (trailer_headers.empty() && end_stream) {
                     data_head.flags |= H2_FLAGS_END_STREAM;
                 }
             } else {
@@ -1548,6 +2334,27 @@ H2UnsentRequest::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
     }
 
     _sctx->Init(ctx, id);
+    ControllerPrivateAccessor accessor(_cntl);
+    const StreamIds request_streams = accessor.request_streams();
+    SocketUniquePtr stream_ptr;
+    if (!request_streams.empty()) {
+        bool is_grpc_ct = false;
+        ParseContentType(_cntl->http_request().content_type(), &is_grpc_ct);
+        if (!is_grpc_ct || _cntl->is_response_read_progressively()) {
+            return butil::Status(EREQUEST, "Streams over http2 must be gRPC"
+                                 " without progressive reading");
+        }
+        if (request_streams.size() != 1) {
+            return butil::Status(EREQUEST, "gRPC call carries one stream only");
+        }
+        if (Socket::Address(request_streams[0], &stream_ptr) != 0) {
+            return butil::Status(EREQUEST, "The request stream was closed");
+        }
+        _sctx->_grpc.reset(new H2GrpcStream);
+        _sctx->_grpc->stream_id = request_streams[0];
+        _sctx->_grpc->queue = ((Stream*)stream_ptr->conn())->consumer_queue();
+        ctx->_ngrpc_stream.fetch_add(1, butil::memory_order_relaxed);
+    }
     // check flow control restriction
     if (!_cntl->request_attachment().empty()) {
         const int64_t data_size = _cntl->request_attachment().size();
@@ -1589,7 +2396,13 @@ H2UnsentRequest::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
     butil::IOBuf frag;
     appender.move_to(frag);
     butil::IOBuf dummy_buf;
-    PackH2Message(out, frag, dummy_buf, _cntl->request_attachment(), _stream_id, ctx);
+    PackH2Message(out, frag, dummy_buf, _cntl->request_attachment(), _stream_id,
+                  ctx, stream_ptr == NULL);
+    if (stream_ptr != NULL) {
+        // Messages written to the Stream are queued after `out' by the
+        // socket, no matter when they're written.
+        ((Stream*)stream_ptr->conn())->SetH2Connected(socket, _stream_id);
+    }
     return butil::Status::OK();
 }
 
@@ -1637,11 +2450,13 @@ void H2UnsentRequest::Print(std::ostream& os) const {
 
 }
 
-H2UnsentResponse::H2UnsentResponse(Controller* c, int stream_id, bool is_grpc)
+H2UnsentResponse::H2UnsentResponse(Controller* c, int stream_id, bool is_grpc,
+                                   bool end_stream)
     : _size(0)
     , _stream_id(stream_id)
     , _http_response(c->release_http_response())
-    , _is_grpc(is_grpc) {
+    , _is_grpc(is_grpc)
+    , _end_stream(end_stream) {
     _data.swap(c->response_attachment());
     if (is_grpc) {
         _grpc_status = ErrorCodeToGrpcStatus(c->ErrorCode());
@@ -1649,15 +2464,20 @@ H2UnsentResponse::H2UnsentResponse(Controller* c, int stream_id, bool is_grpc)
     }
 }
 
-H2UnsentResponse* H2UnsentResponse::New(Controller* c, int stream_id, bool is_grpc) {
+H2UnsentResponse* H2UnsentResponse::New(Controller* c, int stream_id, bool is_grpc,
+                                         bool end_stream) {
     const HttpHeader* const h = &c->http_response();
     const CommonStrings* const common = get_common_strings();
-    const bool need_content_type = !h->content_type().empty();
+    const bool need_content_type = !h->content_type().empty() &&
+        !(h->header_set() && h->header_set()->has_content_type());
+    const bool need_date = FLAGS_http_response_date && h->GetHeader("Date") == NULL;
     const size_t maxsize = 1
-        + (size_t)need_content_type;
+        + (size_t)need_content_type
+        + (size_t)need_date;
     const size_t memsize = offsetof(H2UnsentResponse, _list) +
         sizeof(HPacker::Header) * maxsize;
-    H2UnsentResponse* msg = new (malloc(memsize)) H2UnsentResponse(c, stream_id, is_grpc);
+    H2UnsentResponse* msg = new (malloc(memsize)) H2UnsentResponse(
+        c, stream_id, is_grpc, end_stream);
     // :status
     if (h->status_code() == 200) {
         msg->push(common->H2_STATUS, common->STATUS_200);
@@ -1668,6 +2488,9 @@ H2UnsentResponse* H2UnsentResponse::New(Controller* c, int stream_id, bool is_gr
     if (need_content_type) {
         msg->push(common->CONTENT_TYPE, h->content_type());
     }
+    if (need_date) {
+        CachedHttpDate().CopyToString(&msg->push("date"));
+    }
     return msg;
 }
 
@@ -1710,6 +2533,15 @@ H2UnsentResponse::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
         out->append(rstbuf, sizeof(rstbuf));
         return butil::Status::OK();
     }
+    if (!_end_stream) {
+        // More gRPC messages follow in the stream, see H2GrpcStream.
+        std::unique_lock<butil::Mutex> mu(ctx->_stream_mutex);
+        H2StreamContext** psctx = ctx->_pending_streams.seek(_stream_id);
+        if (psctx != NULL) {
+            (*psctx)->_remote_window_left.fetch_sub(
+                _data.size(), butil::memory_order_relaxed);
+        }
+    }
 
     HPacker& hpacker = ctx->hpacker();
     butil::IOBufAppender appender;
@@ -1729,12 +2561,18 @@ H2UnsentResponse::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
             HPacker::Header header(it->first, it->second);
             hpacker.Encode(&appender, header, options);
         }
+        if (_http_response->header_set()) {
+            for (const auto& kv : _http_response->header_set()->headers()) {
+                HPacker::Header header(kv.first, kv.second);
+                hpacker.Encode(&appender, header, options);
+            }
+        }
     }
     butil::IOBuf frag;
     appender.move_to(frag);
 
     butil::IOBuf trailer_frag;
-    if (_is_grpc) {
+    if (_is_grpc && _end_stream) {
         HPacker::Header status_header("grpc-status",
                                       butil::string_printf("%d", _grpc_status));
         hpacker.Encode(&appender, status_header, options);
@@ -1745,7 +2583,7 @@ H2UnsentResponse::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
         appender.move_to(trailer_frag);
     }
 
-    PackH2Message(out, frag, trailer_frag, _data, _stream_id, ctx);
+    PackH2Message(out, frag, trailer_frag, _data, _stream_id, ctx, _end_stream);
     return butil::Status::OK();
 }
 
@@ -1759,6 +2597,9 @@ size_t H2UnsentResponse::EstimatedByteSize() {
              it != _http_response->HeaderEnd(); ++it) {
             sz += it->first.size() + it->second.size() + 1;
         }
+        if (_http_response->header_set()) {
+            sz += _http_response->header_set()->encoded().size();
+        }
     }
     sz += _data.size();
     return sz;
@@ -1774,6 +2615,11 @@ void H2UnsentResponse::Print(std::ostream& os) const {
              it != _http_response->HeaderEnd(); ++it) {
             os << "> " << it->first << " = " << it->second << '\n';
         }
+        if (_http_response->header_set()) {
+            for (const auto& kv : _http_response->header_set()->headers()) {
+                os << "> " << kv.first << " = " << kv.second << '\n';
+            }
+        }
     }
     if (!_data.empty()) {
         os << "> \n";
@@ -19,12 +19,15 @@
 #ifndef BAIDU_RPC_POLICY_HTTP2_RPC_PROTOCOL_H
 #define BAIDU_RPC_POLICY_HTTP2_RPC_PROTOCOL_H
 
+#include <algorithm>                         // std::min
 #include "brpc/policy/http_rpc_protocol.h"   // HttpContext
 #include "brpc/input_message_base.h"
 #include "brpc/protocol.h"
 #include "brpc/details/hpack.h"
 #include "brpc/stream_creator.h"
 #include "brpc/controller.h"
+#include "brpc/stream.h"
+#include "bthread/execution_queue.h"
 
 #ifndef NDEBUG
 #include "bvar/bvar.h"
@@ -195,7 +198,10 @@ private:
 
 class H2UnsentResponse : public SocketMessage {
 public:
-    static H2UnsentResponse* New(Controller* c, int stream_id, bool is_grpc);
+    // end_stream: false to leave the stream open for more gRPC messages,
+    // in which case trailers are not sent either.
+    static H2UnsentResponse* New(Controller* c, int stream_id, bool is_grpc,
+                                 bool end_stream = true);
     void Destroy();
     void Print(std::ostream& os) const;
     // @SocketMessage
@@ -209,7 +215,7 @@ private:
     void push(const std::string& name, const std::string& value)
     { new (&_list[_size++]) HPacker::Header(name, value); }
 
-    H2UnsentResponse(Controller* c, int stream_id, bool is_grpc);
+    H2UnsentResponse(Controller* c, int stream_id, bool is_grpc, bool end_stream);
     ~H2UnsentResponse() {}
     H2UnsentResponse(const H2UnsentResponse&);
     void operator=(const H2UnsentResponse&);
@@ -220,11 +226,50 @@ private:
     std::unique_ptr<HttpHeader> _http_response;
     butil::IOBuf _data;
     bool _is_grpc;
+    bool _end_stream;
     GrpcStatus _grpc_status;
     std::string _grpc_message;
     HPacker::Header _list[0];
 };
 
+// Length-prefix of a gRPC message: 1-byte compressed flag + 4-byte length.
+const size_t GRPC_MESSAGE_PREFIX_SIZE = 5;
+
+// State of a gRPC call streaming messages in either direction over one http2
+// stream. The first message of each direction is the request or response
+// of the RPC, following messages are exchanged with a brpc Stream: the
+// server accepts it with StreamAccept(), the client creates it with
+// StreamCreate() before the call.
+// Guarded by H2Context::_stream_mutex.
+struct H2GrpcStream {
+    H2GrpcStream()
+        : stream_id(INVALID_STREAM_ID), queue(), nqueued(0), sent(0)
+        , local_closing(false), local_closed(false), remote_closed(false)
+        , remote_close_delivered(false), error_code(0) {}
+
+    // The brpc Stream bound, INVALID_STREAM_ID if not bound yet or closed.
+    StreamId stream_id;
+    // Consumer queue of the Stream, see Stream::OnH2Message().
+    bthread::ExecutionQueueId<butil::IOBuf*> queue;
+    // Received bytes not delivered to the Stream yet.
+    butil::IOBuf unparsed;
+    // Prefixed messages waiting for windows of the remote side.
+    butil::IOBuf unsent;
+    // Number of messages ever queued into `unsent'.
+    size_t nqueued;
+    // Bytes ever sent from `unsent'.
+    size_t sent;
+    // The Stream was closed, END_STREAM is sent after `unsent' is drained.
+    bool local_closing;
+    bool local_closed;
+    // END_STREAM was received.
+    bool remote_closed;
+    bool remote_close_delivered;
+    // Error closing the Stream, sent as grpc-status in trailers by server.
+    int error_code;
+    std::string error_text;
+};
+
 // Used in http_rpc_protocol.cpp
 class H2StreamContext : public HttpContext {
 public:
@@ -260,6 +305,10 @@ public:
 
     bool ConsumeWindowSize(int64_t size);
 
+    // True if the first message of a streaming gRPC call was split from
+    // following ones which are delivered to a brpc Stream.
+    bool has_grpc_stream() const { return _grpc_split; }
+
 #if defined(BRPC_H2_STREAM_STATE)
     H2StreamState state() const { return _state; }
     void SetState(H2StreamState state);
@@ -276,6 +325,22 @@ friend class H2Context;
     butil::atomic<int64_t> _deferred_window_update;
     uint64_t _correlation_id;
     butil::IOBuf _remaining_header_fragment;
+    // Non-NULL for streaming gRPC calls, moved to the "tail" context which
+    // replaces this one in H2Context after the first message was received.
+    std::unique_ptr<H2GrpcStream> _grpc;
+    bool _grpc_split;
+    bool _grpc_tail;
+
+private:
+    void StartGrpcStreamIfNeeded();
+    H2StreamContext* SplitGrpcStream();
+    H2ParseResult OnGrpcStreamData(butil::IOBufBytesIterator&, const H2FrameHead&,
+                                   uint32_t frag_size, uint8_t pad_length);
+    H2ParseResult OnGrpcStreamEnd();
+    // Push complete messages into the bound Stream, called with
+    // H2Context::_stream_mutex held.
+    // Returns 0 on success, -1 if the messages are not supported.
+    int DeliverGrpcMessagesLocked();
 };
 
 StreamCreator* get_h2_global_stream_creator();
@@ -310,6 +375,106 @@ size_t SerializeH2Settings(const H2Settings& in, void* out);
 
 const size_t FRAME_HEAD_SIZE = 9;
 
+// Called by Stream to carry its messages by gRPC messages of http2 stream
+// `h2_stream_id' on `sock', see H2GrpcStream.
+// Queues and sends messages in `data_list' as far as windows allow.
+// Returns bytes of the messages, -1 if the http2 stream was closed.
+ssize_t WriteH2GrpcStream(Socket* sock, int h2_stream_id,
+                          butil::IOBuf* const* data_list, size_t size);
+// Ends sending after queued messages are sent. Non-zero `error_code'
+// drops queued messages, resets the stream at client-side or fails the
+// call with the error at server-side.
+void CloseH2GrpcStream(Socket* sock, int h2_stream_id,
+                       int error_code, const std::string& error_text);
+// Sends stream-level WINDOW_UPDATE for `size' bytes consumed.
+void ReturnH2GrpcStreamWindow(Socket* sock, int h2_stream_id, int64_t size);
+// Server-side: bind accepted `stream_id' to the call after the response
+// headers and the first message were written.
+// Returns 0 on success, -1 if the http2 stream was closed.
+int BindH2GrpcStream(Socket* sock, int h2_stream_id, StreamId stream_id);
+// Server-side: the call was responded without a Stream, drop the messages
+// from the client.
+void AbandonH2GrpcStream(Socket* sock, int h2_stream_id);
+
+// Estimates the bandwidth-delay product of a connection like gRPC does: a
+// PING is sent along with the first DATA frame of a sample, DATA received
+// until the PING is acked approximates the BDP. When a sample is close to
+// the current estimate and gives the largest bandwidth ever seen, the
+// window is probably limiting the throughput and is doubled.
+// Not thread-safe, used by the parsing thread of a connection only.
+class H2BdpEstimator {
+public:
+    explicit H2BdpEstimator(int64_t bdp)
+        : _bdp(bdp), _sample(0), _sent_us(0), _rtt_us(0)
+        , _sample_count(0), _max_bandwidth(0), _sampling(false) {}
+
+    // Called on receiving `size' bytes of DATA.
+    // Returns true if a PING should be sent to start a new sample.
+    bool OnData(int64_t size, int64_t now_us, int64_t max_window) {
+        if (_sampling) {
+            _sample += size;
+            return false;
+        }
+        if (_bdp >= max_window) {
+            return false;
+        }
+        _sampling = true;
+        _sample = size;
+        _sent_us = now_us;
+        return true;
+    }
+
+    // Called on receiving the ack of the PING.
+    // Returns the enlarged window, or 0 if the window should be unchanged.
+    int64_t OnPingAck(int64_t now_us, int64_t max_window) {
+        if (!_sampling) {
+            return 0;
+        }
+        _sampling = false;
+        const double rtt_sample = std::max<int64_t>(now_us - _sent_us, 1);
+        // Average the first samples, then follow recent samples closely.
+        if (_sample_count < 10) {
+            ++_sample_count;
+            _rtt_us += (rtt_sample - _rtt_us) / _sample_count;
+        } else {
+            _rtt_us += (rtt_sample - _rtt_us) * 0.9;
+        }
+        // The PING is acked after all DATA in the sample were sent, which
+        // takes longer than one rtt, 1.5 is what gRPC uses.
+        const double bandwidth = _sample / (_rtt_us * 1.5);
+        if (bandwidth < _max_bandwidth) {
+            return 0;
+        }
+        _max_bandwidth = bandwidth;
+        if (_sample * 3 < _bdp * 2 || _bdp >= max_window) {
+            return 0;
+        }
+        _bdp = std::min(_sample * 2, max_window);
+        return _bdp;
+    }
+
+    // Forget the estimation and start over from `bdp'.
+    void Reset(int64_t bdp) {
+        _bdp = bdp;
+        _max_bandwidth = 0;
+    }
+
+    int64_t bdp() const { return _bdp; }
+    int64_t rtt_us() const { return (int64_t)_rtt_us; }
+    // In bytes per second.
+    int64_t max_bandwidth() const { return (int64_t)(_max_bandwidth * 1000000); }
+
+private:
+    int64_t _bdp;
+    int64_t _sample;
+    int64_t _sent_us;
+    double _rtt_us;
+    int _sample_count;
+    // In bytes per microsecond.
+    double _max_bandwidth;
+    bool _sampling;
+};
+
 // Contexts of a http2 connection
 class H2Context : public Destroyable, public Describable {
 public:
@@ -351,6 +516,14 @@ public:
     void DeferWindowUpdate(int64_t);
     int64_t ReleaseDeferredWindowUpdate();
 
+    // See comments of the functions with the same names.
+    ssize_t WriteGrpcStream(int stream_id, butil::IOBuf* msgs, size_t nmsg);
+    void CloseGrpcStream(int stream_id, int error_code,
+                         const std::string& error_text);
+    int BindGrpcStream(int stream_id, StreamId bound,
+                       bthread::ExecutionQueueId<butil::IOBuf*> queue);
+    void AbandonGrpcStream(int stream_id);
+
 private:
 friend class H2StreamContext;
 friend class H2UnsentRequest;
@@ -375,9 +548,24 @@ friend void InitFrameHandlers();
 
     H2StreamContext* FindStream(int stream_id);
 
+    // Send unsent gRPC messages of `sctx' as far as windows allow, and end
+    // the stream after all messages were sent if it's closing.
+    // Called with _stream_mutex held.
+    void FlushGrpcStreamLocked(H2StreamContext* sctx);
+    // Flush gRPC stream `stream_id', or all gRPC streams if it's 0.
+    void FlushGrpcStreams(int stream_id);
+
+    void OnBdpData(uint32_t size);
+    void OnBdpPingAck();
+    void GrowWindows(int64_t window);
+    void ShrinkWindowsIfIdle();
+    void FlushWindowUpdates();
+    int64_t WithholdWindowUpdate(int64_t conn_wu);
+
     // True if the connection is established by client, otherwise it's
     // accepted by server.
     Socket* _socket;
+    const Server* _server;
     butil::atomic<int64_t> _remote_window_left;
     H2ConnectionState _conn_state;
     int _last_received_stream_id;
@@ -394,6 +582,19 @@ friend void InitFrameHandlers();
     mutable butil::Mutex _stream_mutex;
     StreamMap _pending_streams;
     butil::atomic<int64_t> _deferred_window_update;
+    // Auto-tuning of local windows (-h2_bdp_auto_tuning), modified by the
+    // parsing thread only.
+    H2BdpEstimator _bdp_estimator;
+    int64_t _initial_stream_window;
+    int64_t _initial_conn_window;
+    int64_t _conn_window;
+    int64_t _last_data_us;
+    // Connection-level WINDOW_UPDATE to withhold for shrinking the
+    // connection window, which can't be shrunk by SETTINGS.
+    butil::atomic<int64_t> _withheld_window_update;
+    // Number of H2GrpcStream alive, connection-level WINDOW_UPDATE looks
+    // for blocked gRPC messages only when it's positive.
+    butil::atomic<int> _ngrpc_stream;
 };
 
 inline int H2Context::AllocateClientStreamId() {
@@ -26,6 +26,8 @@
 #include "butil/string_printf.h"
 #include "butil/time.h"
 #include "butil/sys_byteorder.h"
+#include "butil/object_pool.h"                      // get_object
+#include "butil/memory/aligned_memory.h"            // AlignedMemory
 #include "json2pb/pb_to_json.h"                     // ProtoMessageToJson
 #include "json2pb/json_to_pb.h"                     // JsonToProtoMessage
 #include "brpc/compress.h"
@@ -34,6 +36,7 @@
 #include "brpc/server.h"                            // Server
 #include "brpc/details/server_private_accessor.h"
 #include "brpc/span.h"
+#include "brpc/stream_impl.h"
 #include "brpc/socket.h"                            // Socket
 #include "brpc/rpc_dump.h"                          // SampledRequest
 #include "brpc/http_status_code.h"                  // HTTP_STATUS_*
@@ -42,6 +45,7 @@
 #include "brpc/policy/gzip_compress.h"
 #include "brpc/policy/http2_rpc_protocol.h"
 #include "brpc/details/usercode_backup_pool.h"
+#include "brpc/details/http_response_queue.h"
 #include "brpc/grpc.h"
 
 extern "C" {
@@ -80,6 +84,19 @@ DEFINE_string(request_id_header, "x-request-id", "The http header to mark a sess
 DEFINE_bool(use_http_error_code, false, "Whether set the x-bd-error-code header "
                                         "of http response to brpc error code");
 
+DEFINE_int32(http_max_pipelined_requests, 128, "Max number of pipelined "
+             "http/1.x requests processed concurrently on a connection, "
+             "more requests are rejected with ELIMIT. <=0 means unlimited");
+
+DEFINE_bool(http_deliver_timeout_ms, false,
+            "If this flag is true, http requests other than gRPC carry "
+            "timeout_ms in the header x-bd-timeout-ms.");
+
+DEFINE_bool(http_fail_expired_requests, false,
+            "If this flag is true, http requests with x-bd-timeout-ms which "
+            "have been queued longer than the timeout fail with ERPCTIMEDOUT "
+            "without running user code, since the clients already gave up.");
+
 // Read user address from the header specified by -http_header_of_user_ip
 static bool GetUserAddressFromHeaderImpl(const HttpHeader& headers,
                                          butil::EndPoint* user_addr) {
@@ -154,6 +171,8 @@ CommonStrings::CommonStrings()
     , GRPC_STATUS("grpc-status")
     , GRPC_MESSAGE("grpc-message")
     , GRPC_TIMEOUT("grpc-timeout")
+    , TIMEOUT_MS("x-bd-timeout-ms")
+    , PRIORITY("x-bd-priority")
     , DEFAULT_PATH("/")
 {}
 
@@ -717,6 +736,16 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
         hreq.uri().set_path(path);
     }
 
+    if (FLAGS_http_deliver_timeout_ms && cntl->timeout_ms() >= 0 &&
+        hreq.GetHeader(common->GRPC_TIMEOUT) == NULL) {
+        hreq.SetHeader(common->TIMEOUT_MS,
+                       butil::string_printf("%" PRId64, cntl->timeout_ms()));
+    }
+    if (cntl->request_priority() != REQUEST_PRIORITY_DEFAULT) {
+        hreq.SetHeader(common->PRIORITY,
+                       butil::string_printf("%d", (int)cntl->request_priority()));
+    }
+
     Span* span = accessor.span();
     if (span) {
         hreq.SetHeader("x-bd-trace-id", butil::string_printf(
@@ -725,6 +754,10 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
                            "%llu", (unsigned long long)span->span_id()));
         hreq.SetHeader("x-bd-parent-span-id", butil::string_printf(
                            "%llu", (unsigned long long)span->parent_span_id()));
+        // Let servers outside brpc join the trace.
+        hreq.SetHeader("traceparent", FormatTraceParent(
+                           span->trace_id_high(), span->trace_id(),
+                           span->span_id(), span->sampled()));
     }
 }
 
@@ -779,18 +812,21 @@ public:
         , _messages(NULL)
         , _method_status(NULL)
         , _received_us(0)
-        , _h2_stream_id(-1) {}
+        , _h2_stream_id(-1)
+        , _response_seq(0) {}
 
     HttpResponseSender(HttpResponseSender&& s) noexcept
         : _cntl(std::move(s._cntl))
         , _messages(s._messages)
         , _method_status(s._method_status)
         , _received_us(s._received_us)
-        , _h2_stream_id(s._h2_stream_id) {
+        , _h2_stream_id(s._h2_stream_id)
+        , _response_seq(s._response_seq) {
         s._messages = NULL;
         s._method_status = NULL;
         s._received_us = 0;
         s._h2_stream_id = -1;
+        s._response_seq = 0;
     }
     ~HttpResponseSender();
 
@@ -798,6 +834,7 @@ public:
     void set_method_status(MethodStatus* ms) { _method_status = ms; }
     void set_received_us(int64_t t) { _received_us = t; }
     void set_h2_stream_id(int id) { _h2_stream_id = id; }
+    void set_response_seq(uint64_t seq) { _response_seq = seq; }
 
 private:
     std::unique_ptr<Controller, LogErrorTextAndDelete> _cntl;
@@ -805,6 +842,9 @@ private:
     MethodStatus* _method_status;
     int64_t _received_us;
     int _h2_stream_id;
+    // Non-zero if the response must be written after responses of earlier
+    // pipelined requests.
+    uint64_t _response_seq;
 };
 
 class HttpResponseSenderAsDone : public google::protobuf::Closure {
@@ -834,9 +874,20 @@ HttpResponseSender::~HttpResponseSender() {
         return;
     }
     ControllerPrivateAccessor accessor(cntl);
+    // Responses of following pipelined requests wait for this one, finish
+    // it even if nothing is written.
+    BRPC_SCOPE_EXIT {
+        if (_response_seq != 0) {
+            butil::IOBuf empty;
+            WriteHttpResponse(accessor.get_sending_socket(), _response_seq,
+                              &empty, NULL, true);
+        }
+    };
     Span* span = accessor.span();
+    const int64_t start_send_us = butil::cpuwide_time_us();
+    accessor.phase_timer().Mark(SERVER_PHASE_HANDLER, start_send_us);
     if (span) {
-        span->set_start_send_us(butil::cpuwide_time_us());
+        span->set_start_send_us(start_send_us);
     }
     ConcurrencyRemover concurrency_remover(_method_status, cntl, _received_us);
     Socket* socket = accessor.get_sending_socket();
@@ -877,6 +928,7 @@ HttpResponseSender::~HttpResponseSender() {
         !cntl->Failed()) {
         // ^ pb response in failed RPC is undefined, no need to convert.
         
+        butil::IOBufOwnerScope owner_scope(butil::IOBuf::OWNER_PROTOCOL);
         butil::IOBufAsZeroCopyOutputStream wrapper(&cntl->response_attachment());
         if (content_type == HTTP_CONTENT_PROTO) {
             if (!res->SerializeToZeroCopyStream(&wrapper)) {
@@ -990,6 +1042,8 @@ HttpResponseSender::~HttpResponseSender() {
     }
 
     int rc = -1;
+    // The rest is counted as writing until ConcurrencyRemover is destroyed.
+    accessor.phase_timer().Mark(SERVER_PHASE_SERIALIZE, butil::cpuwide_time_us());
     // Have the risk of unlimited pending responses, in which case, tell
     // users to set max_concurrency.
     ResponseWriteInfo args;
@@ -1006,8 +1060,14 @@ HttpResponseSender::~HttpResponseSender() {
             // Append compressed and length before body
             AddGrpcPrefix(&cntl->response_attachment(), grpc_compressed);
         }
+        // A streaming gRPC call keeps the http2 stream open after the
+        // response, following messages are carried by the accepted Stream.
+        const bool grpc_streaming = is_grpc && cntl->has_remote_stream();
+        const StreamIds response_streams = accessor.response_streams();
+        const bool keep_stream = grpc_streaming && !cntl->Failed() &&
+            !response_streams.empty();
         SocketMessagePtr<H2UnsentResponse> h2_response(
-                H2UnsentResponse::New(cntl, _h2_stream_id, is_grpc));
+            H2UnsentResponse::New(cntl, _h2_stream_id, is_grpc, !keep_stream));
         if (h2_response == NULL) {
             LOG(ERROR) << "Fail to make http2 response";
             errno = EINVAL;
@@ -1021,6 +1081,23 @@ HttpResponseSender::~HttpResponseSender() {
             }
             rc = socket->Write(h2_response, &wopt);
         }
+        if (grpc_streaming) {
+            const int saved_errno = errno;
+            if (keep_stream && rc == 0 &&
+                BindH2GrpcStream(socket, _h2_stream_id, response_streams[0]) == 0) {
+                if (response_streams.size() > 1) {
+                    StreamIds extra_streams(response_streams.begin() + 1,
+                                            response_streams.end());
+                    Stream::SetFailed(extra_streams, EINVAL,
+                                      "gRPC supports only one stream per call");
+                }
+            } else {
+                Stream::SetFailed(response_streams, ECONNRESET,
+                                  "The http2 stream was closed");
+                AbandonH2GrpcStream(socket, _h2_stream_id);
+            }
+            errno = saved_errno;
+        }
     } else {
         butil::IOBuf* content = NULL;
         if (cntl->Failed() || !cntl->has_progressive_writer()) {
@@ -1028,14 +1105,24 @@ HttpResponseSender::~HttpResponseSender() {
         }
         res_header->set_method(req_header->method());
         butil::IOBuf res_buf;
-        MakeRawHttpResponse(&res_buf, res_header, content);
+        {
+            butil::IOBufOwnerScope owner_scope(butil::IOBuf::OWNER_PROTOCOL);
+            MakeRawHttpResponse(&res_buf, res_header, content);
+        }
         if (FLAGS_http_verbose) {
             PrintMessage(res_buf, false, !!content);
         }
         if (span) {
             span->set_response_size(res_buf.size());
         }
-        rc = socket->Write(&res_buf, &wopt);
+        if (content == NULL) {
+            // Chunks and the end of the response are written by the
+            // ProgressiveAttachment.
+            accessor.set_progressive_response_seq(_response_seq);
+        }
+        rc = WriteHttpResponse(socket, _response_seq, &res_buf, &wopt,
+                               content != NULL);
+        _response_seq = 0;
     }
 
     if (rc != 0) {
@@ -1175,6 +1262,45 @@ FindMethodPropertyByURI(const std::string& uri_path, const Server* server,
     return NULL;
 }
 
+// Pipelined requests are processed concurrently, number them to write
+// responses in order.
+static void NumberHttpRequest(HttpContext* http_imsg, Socket* socket) {
+    if (http_imsg->parser().type == HTTP_REQUEST) {
+        http_imsg->set_response_seq(
+            socket->GetOrNewHttpResponseQueue()->AddRequest());
+    }
+}
+
+// Raw memory of a HttpContext, recycled in ObjectPool.
+struct HttpContextStorage {
+    butil::AlignedMemory<sizeof(HttpContext), ALIGNOF(HttpContext)> data;
+};
+
+void* HttpContext::operator new(size_t size) {
+    void* p = operator new(size, std::nothrow);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* HttpContext::operator new(size_t size, const std::nothrow_t&) throw() {
+    if (size != sizeof(HttpContext)) {
+        return ::operator new(size, std::nothrow);
+    }
+    return butil::get_object<HttpContextStorage>();
+}
+
+void HttpContext::operator delete(void* p, size_t size) {
+    if (p == NULL) {
+        return;
+    }
+    if (size != sizeof(HttpContext)) {
+        return ::operator delete(p);
+    }
+    butil::return_object(static_cast<HttpContextStorage*>(p));
+}
+
 ParseResult ParseHttpMessage(butil::IOBuf *source, Socket *socket,
                              bool read_eof, const void* arg) {
     HttpContext* http_imsg = 
@@ -1241,6 +1367,7 @@ ParseResult ParseHttpMessage(butil::IOBuf *source, Socket *socket,
         source->pop_front(rc);
         if (http_imsg->Completed()) {
             CHECK_EQ(http_imsg, socket->release_parsing_context());
+            NumberHttpRequest(http_imsg, socket);
             const ParseResult result = MakeMessage(http_imsg);
             http_imsg->CheckProgressiveRead(arg, socket);
             if (socket->is_read_progressive()) {
@@ -1276,6 +1403,7 @@ ParseResult ParseHttpMessage(butil::IOBuf *source, Socket *socket,
                 // header part of a progressively-read http message is complete,
                 // go on to ProcessHttpXXX w/o waiting for full body.
                 http_imsg->AddOneRefForStage2(); // released when body is fully read
+                NumberHttpRequest(http_imsg, socket);
                 return MakeMessage(http_imsg);
             }
             return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
@@ -1418,6 +1546,16 @@ void EndRunningCallMethodInPool(
     ::google::protobuf::Message* response,
     ::google::protobuf::Closure* done);
 
+// Defined in baidu_rpc_protocol.cpp
+void CallMethodInBthreadTag(
+    bthread_tag_t tag,
+    ::google::protobuf::Service* service,
+    const ::google::protobuf::MethodDescriptor* method,
+    ::google::protobuf::RpcController* controller,
+    const ::google::protobuf::Message* request,
+    ::google::protobuf::Message* response,
+    ::google::protobuf::Closure* done);
+
 void ProcessHttpRequest(InputMessageBase *msg) {
     const int64_t start_parse_us = butil::cpuwide_time_us();
     DestroyingPtr<HttpContext> imsg_guard(static_cast<HttpContext*>(msg));
@@ -1433,6 +1571,7 @@ void ProcessHttpRequest(InputMessageBase *msg) {
     }
     HttpResponseSender resp_sender(cntl);
     resp_sender.set_received_us(msg->received_us());
+    resp_sender.set_response_seq(imsg_guard->response_seq());
 
     const bool is_http2 = imsg_guard->header().is_http2();
     if (is_http2) {
@@ -1441,6 +1580,15 @@ void ProcessHttpRequest(InputMessageBase *msg) {
     }
 
     ControllerPrivateAccessor accessor(cntl);
+    if (is_http2 && static_cast<H2StreamContext*>(msg)->has_grpc_stream()) {
+        // Let the service accept a Stream for following messages.
+        StreamSettings* stream_settings = new StreamSettings;
+        stream_settings->set_stream_id(
+            static_cast<H2StreamContext*>(msg)->stream_id());
+        stream_settings->set_need_feedback(false);
+        stream_settings->set_writable(true);
+        accessor.set_remote_stream_settings(stream_settings);
+    }
     HttpHeader& req_header = cntl->http_request();
     imsg_guard->header().Swap(req_header);
     butil::IOBuf& req_body = imsg_guard->body();
@@ -1460,6 +1608,11 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         .set_request_protocol(is_http2 ? PROTOCOL_H2 : PROTOCOL_HTTP)
         .set_begin_time_us(msg->received_us())
         .move_in_server_receiving_sock(socket_guard);
+    ServerPhaseTimer& phase_timer = accessor.phase_timer();
+    phase_timer.Begin(msg->received_us());
+    phase_timer.Mark(SERVER_PHASE_READ, msg->read_us());
+    phase_timer.Mark(SERVER_PHASE_PARSE, msg->cut_us());
+    phase_timer.Mark(SERVER_PHASE_QUEUE, start_parse_us);
     
     // Read log-id. errno may be set when input to strtoull overflows.
     // atoi/atol/atoll don't support 64-bit integer and can't be used.
@@ -1481,6 +1634,32 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         cntl->set_request_id(*request_id);
     }
 
+    const std::string* timeout_ms_str = req_header.GetHeader(common->TIMEOUT_MS);
+    if (timeout_ms_str) {
+        char* timeout_end = NULL;
+        const int64_t timeout_ms = strtoll(timeout_ms_str->c_str(), &timeout_end, 10);
+        if (*timeout_end || timeout_end == timeout_ms_str->c_str()) {
+            LOG(ERROR) << "Invalid " << common->TIMEOUT_MS << '='
+                       << *timeout_ms_str << " in http request";
+        } else if (timeout_ms > 0) {
+            accessor.set_deadline_us(msg->base_real_us() + msg->received_us() +
+                                     timeout_ms * 1000L);
+        }
+    }
+
+    const std::string* priority_str = req_header.GetHeader(common->PRIORITY);
+    if (priority_str) {
+        char* priority_end = NULL;
+        const long priority = strtol(priority_str->c_str(), &priority_end, 10);
+        if (*priority_end || priority_end == priority_str->c_str() ||
+            priority < 0 || priority >= REQUEST_PRIORITY_NUM) {
+            LOG(ERROR) << "Invalid " << common->PRIORITY << '='
+                       << *priority_str << " in http request";
+        } else {
+            cntl->set_request_priority((RequestPriority)priority);
+        }
+    }
+
     // Tag the bthread with this server's key for
     // thread_local_data().
     if (server->thread_local_options().thread_local_data_factory) {
@@ -1490,7 +1669,14 @@ void ProcessHttpRequest(InputMessageBase *msg) {
     Span* span = NULL;
     const std::string& path = req_header.uri().path();
     const std::string* trace_id_str = req_header.GetHeader("x-bd-trace-id");
-    if (IsTraceable(trace_id_str)) {
+    // W3C trace context is used when headers of brpc are absent.
+    TraceParent tp;
+    bool has_tp = false;
+    if (trace_id_str == NULL) {
+        const std::string* tp_str = req_header.GetHeader("traceparent");
+        has_tp = (tp_str != NULL && ParseTraceParent(*tp_str, &tp) == 0);
+    }
+    if (IsTraceable(trace_id_str != NULL || (has_tp && tp.sampled))) {
         uint64_t trace_id = 0;
         if (trace_id_str) {
             trace_id = strtoull(trace_id_str->c_str(), NULL, 10);
@@ -1506,8 +1692,17 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         if (parent_span_id_str) {
             parent_span_id = strtoull(parent_span_id_str->c_str(), NULL, 10);
         }
+        if (has_tp) {
+            // The span id in traceparent is the id of the caller's span.
+            trace_id = tp.trace_id;
+            parent_span_id = tp.parent_span_id;
+        }
         span = Span::CreateServerSpan(
             path, trace_id, span_id, parent_span_id, msg->base_real_us());
+        if (has_tp) {
+            span->set_trace_id_high(tp.trace_id_high);
+            span->set_sampled(tp.sampled);
+        }
         accessor.set_span(span);
         span->set_log_id(cntl->log_id());
         span->set_remote_side(user_addr);
@@ -1522,6 +1717,22 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         return;
     }
 
+    if (FLAGS_http_fail_expired_requests && cntl->deadline_us() >= 0 &&
+        butil::gettimeofday_us() >= cntl->deadline_us()) {
+        cntl->SetFailed(ERPCTIMEDOUT, "Request expired after queueing %" PRId64 "us",
+                        butil::cpuwide_time_us() - msg->received_us());
+        return;
+    }
+
+    const uint64_t response_seq = imsg_guard->response_seq();
+    if (response_seq != 0 && FLAGS_http_max_pipelined_requests > 0 &&
+        socket->http_response_queue()->npending_before(response_seq) >=
+        (uint64_t)FLAGS_http_max_pipelined_requests) {
+        cntl->SetFailed(ELIMIT, "Reached max_pipelined_requests=%d",
+                        FLAGS_http_max_pipelined_requests);
+        return;
+    }
+
     if (server->options().http_master_service) {
         // If http_master_service is on, just call it.
         google::protobuf::Service* svc = server->options().http_master_service;
@@ -1568,7 +1779,7 @@ void ProcessHttpRequest(InputMessageBase *msg) {
     resp_sender.set_method_status(method_status);
     if (method_status) {
         int rejected_cc = 0;
-        if (!method_status->OnRequested(&rejected_cc)) {
+        if (!method_status->OnRequested(&rejected_cc, cntl)) {
             cntl->SetFailed(ELIMIT, "Rejected by %s's ConcurrencyLimiter, concurrency=%d",
                             mp->method->full_name().c_str(), rejected_cc);
             return;
@@ -1588,6 +1799,12 @@ void ProcessHttpRequest(InputMessageBase *msg) {
                             butil::endpoint2str(socket->remote_side()).c_str());
             return;
         }
+        const int64_t sojourn_us = butil::cpuwide_time_us() - msg->received_us();
+        if (!server_accessor.AdmitByCodel(sojourn_us)) {
+            cntl->SetFailed(ELIMIT, "Dropped by CoDel after queueing %" PRId64 "us",
+                            sojourn_us);
+            return;
+        }
         if (!server_accessor.AddConcurrency(cntl)) {
             cntl->SetFailed(ELIMIT, "Reached server's max_concurrency=%d",
                             server->options().max_concurrency);
@@ -1675,7 +1892,12 @@ void ProcessHttpRequest(InputMessageBase *msg) {
                 req_body.swap(uncompressed);
             }
             if (content_type == HTTP_CONTENT_PROTO) {
-                if (!ParsePbFromIOBuf(req, req_body)) {
+                const bool parsed = mp->aliased_request_fields.empty() ?
+                    ParsePbFromIOBuf(req, req_body) :
+                    ParsePbFromIOBufWithAliasing(
+                        req, req_body, mp->aliased_request_fields,
+                        accessor.mutable_aliased_request_fields());
+                if (!parsed) {
                     cntl->SetFailed(EREQUEST, "Fail to parse http body as %s",
                                     req->GetDescriptor()->full_name().c_str());
                     return;
@@ -1699,7 +1921,8 @@ void ProcessHttpRequest(InputMessageBase *msg) {
             }
         }
         if (!is_http2) {
-            SampledRequest* sample = AskToBeSampled();
+            SampledRequest* sample = AskToBeSampled(
+                mp->method->service()->full_name(), mp->method->name());
             if (sample) {
                 sample->meta.set_compress_type(COMPRESS_TYPE_NONE);
                 sample->meta.set_protocol_type(PROTOCOL_HTTP);
@@ -1722,12 +1945,16 @@ void ProcessHttpRequest(InputMessageBase *msg) {
     google::protobuf::Closure* done = new HttpResponseSenderAsDone(&resp_sender);
     imsg_guard.reset();  // optional, just release resource ASAP
 
+    const int64_t start_callback_us = butil::cpuwide_time_us();
+    phase_timer.Mark(SERVER_PHASE_PARSE, start_callback_us);
     if (span) {
-        span->set_start_callback_us(butil::cpuwide_time_us());
+        span->set_start_callback_us(start_callback_us);
         span->AsParent();
     }
+    MethodCostScope cost_scope(method_status);
     if (!FLAGS_usercode_in_pthread) {
-        return svc->CallMethod(method, cntl, req, res, done);
+        return CallMethodInBthreadTag(mp->bthread_tag, svc, method, cntl,
+                                      req, res, done);
     }
     if (BeginRunningUserCode()) {
         svc->CallMethod(method, cntl, req, res, done);
@@ -76,6 +76,8 @@ struct CommonStrings {
     std::string GRPC_STATUS;
     std::string GRPC_MESSAGE;
     std::string GRPC_TIMEOUT;
+    std::string TIMEOUT_MS;
+    std::string PRIORITY;
 
     std::string DEFAULT_PATH;
 
@@ -91,7 +93,8 @@ public:
                          HttpMethod request_method = HTTP_METHOD_GET)
         : InputMessageBase()
         , HttpMessage(read_body_progressively, request_method)
-        , _is_stage2(false) {
+        , _is_stage2(false)
+        , _response_seq(0) {
         // add one ref for Destroy
         butil::intrusive_ptr<HttpContext>(this).detach();
     }
@@ -120,8 +123,23 @@ public:
 
     void CheckProgressiveRead(const void* arg, Socket *socket);
 
+    // [Server-side http/1.x] Position of the request on the connection,
+    // the response is written after responses of earlier requests.
+    // 0 means the response is not ordered.
+    void set_response_seq(uint64_t seq) { _response_seq = seq; }
+    uint64_t response_seq() const { return _response_seq; }
+
+    // HttpContext is created for every http/1.x message, most of which are
+    // small and short-lived. Memory of HttpContexts is recycled in
+    // ObjectPool to save malloc/free of the large object. Derived classes
+    // with different sizes (H2StreamContext) are allocated normally.
+    static void* operator new(size_t size);
+    static void* operator new(size_t size, const std::nothrow_t&) throw();
+    static void operator delete(void* p, size_t size);
+
 private:
     bool _is_stage2;
+    uint64_t _response_seq;
 };
 
 // Implement functions required in protocol.h
@@ -354,7 +354,7 @@ void ProcessHuluRequest(InputMessageBase* msg_base) {
     }
 
     const CompressType req_cmp_type = Hulu2CompressType((HuluCompressType)meta.compress_type());
-    SampledRequest* sample = AskToBeSampled();
+    SampledRequest* sample = AskToBeSampled(meta.service_name());
     if (sample) {
         sample->meta.set_service_name(meta.service_name());
         sample->meta.set_method_index(meta.method_index());
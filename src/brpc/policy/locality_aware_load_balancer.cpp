@@ -394,7 +394,8 @@ int64_t LocalityAwareLoadBalancer::Weight::Update(
     }
     if (ci.error_code == 0) {
         // Add a new entry
-        TimeInfo tm_info = { latency, end_time_us };
+        TimeInfo tm_info = {
+            AdjustLatencyByServerLoad(latency, ci.controller), end_time_us };
         if (!_time_q.empty()) {
             tm_info.latency_sum += _time_q.bottom()->latency_sum;
         }
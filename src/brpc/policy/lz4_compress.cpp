@@ -0,0 +1,218 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#if BRPC_WITH_LZ4
+
+#include <string.h>
+#include <algorithm>
+#include <lz4frame.h>
+#include "butil/logging.h"
+#include "butil/thread_local.h"
+#include "brpc/policy/lz4_compress.h"
+#include "brpc/protocol.h"
+#include "brpc/compress.h"
+
+namespace brpc {
+namespace policy {
+
+// Input is fed to LZ4F_compressUpdate() in pieces of at most this size.
+static const size_t LZ4_MAX_INPUT_PIECE = 64 * 1024;
+
+// Contexts and the output buffer of compression are reused in each thread.
+struct Lz4Context {
+    LZ4F_cctx* cctx;
+    LZ4F_dctx* dctx;
+    size_t out_cap;
+    char* out;
+};
+
+static __thread Lz4Context* tls_lz4_ctx = NULL;
+
+static void FreeLz4Context(void* arg) {
+    Lz4Context* ctx = static_cast<Lz4Context*>(arg);
+    LZ4F_freeCompressionContext(ctx->cctx);
+    LZ4F_freeDecompressionContext(ctx->dctx);
+    free(ctx->out);
+    delete ctx;
+}
+
+static Lz4Context* GetLz4Context() {
+    if (tls_lz4_ctx == NULL) {
+        Lz4Context* ctx = new Lz4Context;
+        memset(ctx, 0, sizeof(*ctx));
+        if (LZ4F_isError(LZ4F_createCompressionContext(&ctx->cctx, LZ4F_VERSION)) ||
+            LZ4F_isError(LZ4F_createDecompressionContext(&ctx->dctx, LZ4F_VERSION))) {
+            FreeLz4Context(ctx);
+            return NULL;
+        }
+        tls_lz4_ctx = ctx;
+        butil::thread_atexit(FreeLz4Context, ctx);
+    }
+    return tls_lz4_ctx;
+}
+
+bool Lz4Compress(const butil::IOBuf& in, butil::IOBuf* out) {
+    Lz4Context* ctx = GetLz4Context();
+    if (ctx == NULL) {
+        LOG(WARNING) << "Fail to create lz4 contexts";
+        return false;
+    }
+    LZ4F_preferences_t prefs;
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+    prefs.frameInfo.contentSize = in.size();
+    // LZ4F_compressUpdate() requires the output to be large enough for the
+    // worst case, which is generally larger than the spare space of an IOBuf
+    // block. Compress into the thread-local buffer and append.
+    const size_t bound = LZ4F_compressBound(LZ4_MAX_INPUT_PIECE, &prefs);
+    if (ctx->out_cap < bound) {
+        char* p = (char*)realloc(ctx->out, bound);
+        if (p == NULL) {
+            LOG(WARNING) << "Fail to allocate " << bound << " bytes";
+            return false;
+        }
+        ctx->out = p;
+        ctx->out_cap = bound;
+    }
+    size_t rc = LZ4F_compressBegin(ctx->cctx, ctx->out, ctx->out_cap, &prefs);
+    if (LZ4F_isError(rc)) {
+        LOG(WARNING) << "Fail to LZ4F_compressBegin: " << LZ4F_getErrorName(rc);
+        return false;
+    }
+    out->append(ctx->out, rc);
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; i < nblock; ++i) {
+        const butil::StringPiece blk = in.backing_block(i);
+        for (size_t off = 0; off < blk.size(); off += LZ4_MAX_INPUT_PIECE) {
+            const size_t len = std::min(blk.size() - off, LZ4_MAX_INPUT_PIECE);
+            rc = LZ4F_compressUpdate(ctx->cctx, ctx->out, ctx->out_cap,
+                                     blk.data() + off, len, NULL);
+            if (LZ4F_isError(rc)) {
+                LOG(WARNING) << "Fail to LZ4F_compressUpdate: "
+                             << LZ4F_getErrorName(rc);
+                return false;
+            }
+            out->append(ctx->out, rc);
+        }
+    }
+    rc = LZ4F_compressEnd(ctx->cctx, ctx->out, ctx->out_cap, NULL);
+    if (LZ4F_isError(rc)) {
+        LOG(WARNING) << "Fail to LZ4F_compressEnd: " << LZ4F_getErrorName(rc);
+        return false;
+    }
+    out->append(ctx->out, rc);
+    return true;
+}
+
+bool Lz4Decompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    Lz4Context* ctx = GetLz4Context();
+    if (ctx == NULL) {
+        LOG(WARNING) << "Fail to create lz4 contexts";
+        return false;
+    }
+    LZ4F_resetDecompressionContext(ctx->dctx);
+    // Decompress blocks of `in' into blocks of `out' directly.
+    butil::IOBufAsZeroCopyOutputStream wrapper(out);
+    char* dst = NULL;
+    size_t dst_size = 0;
+    // 0 when a frame is completely decoded and flushed.
+    size_t rc = 0;
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; i <= nblock; ++i) {
+        const butil::StringPiece blk =
+            (i < nblock ? in.backing_block(i) : butil::StringPiece());
+        const char* src = blk.data();
+        size_t src_size = blk.size();
+        // The extra round with empty input flushes buffered data.
+        while (i < nblock ? src_size > 0 : rc != 0) {
+            if (dst_size == 0) {
+                void* data = NULL;
+                int size = 0;
+                if (!wrapper.Next(&data, &size)) {
+                    return false;
+                }
+                dst = static_cast<char*>(data);
+                dst_size = size;
+            }
+            size_t nw = dst_size;
+            size_t nr = src_size;
+            rc = LZ4F_decompress(ctx->dctx, dst, &nw, src, &nr, NULL);
+            if (LZ4F_isError(rc)) {
+                LOG(WARNING) << "Fail to LZ4F_decompress: " << LZ4F_getErrorName(rc);
+                wrapper.BackUp(dst_size);
+                return false;
+            }
+            if (nw == 0 && nr == 0) {
+                LOG(WARNING) << "Fail to decompress truncated lz4 frame";
+                wrapper.BackUp(dst_size);
+                return false;
+            }
+            dst += nw;
+            dst_size -= nw;
+            src += nr;
+            src_size -= nr;
+        }
+    }
+    wrapper.BackUp(dst_size);
+    return true;
+}
+
+bool Lz4Compress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
+    butil::IOBuf serialized_pb;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
+    bool ok;
+    if (msg.GetDescriptor() == Serializer::descriptor()) {
+        ok = ((const Serializer&)msg).SerializeTo(&wrapper);
+    } else {
+        ok = msg.SerializeToZeroCopyStream(&wrapper);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to serialize input pb="
+                     << msg.GetDescriptor()->full_name();
+        return false;
+    }
+    ok = Lz4Compress(serialized_pb, buf);
+    if (!ok) {
+        LOG(WARNING) << "Fail to lz4 compress, size=" << serialized_pb.size();
+    }
+    return ok;
+}
+
+bool Lz4Decompress(const butil::IOBuf& data, google::protobuf::Message* msg) {
+    butil::IOBuf binary_pb;
+    if (!Lz4Decompress(data, &binary_pb)) {
+        LOG(WARNING) << "Fail to lz4 decompress, size=" << data.size();
+        return false;
+    }
+    bool ok;
+    butil::IOBufAsZeroCopyInputStream stream(binary_pb);
+    if (msg->GetDescriptor() == Deserializer::descriptor()) {
+        ok = ((Deserializer*)msg)->DeserializeFrom(&stream);
+    } else {
+        ok = msg->ParseFromZeroCopyStream(&stream);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to deserialize input message="
+                     << msg->GetDescriptor()->full_name();
+    }
+    return ok;
+}
+
+}  // namespace policy
+} // namespace brpc
+
+#endif  // BRPC_WITH_LZ4
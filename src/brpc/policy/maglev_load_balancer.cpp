@@ -0,0 +1,287 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <algorithm>
+#include <gflags/gflags.h>
+#include "butil/strings/string_number_conversions.h"
+#include "brpc/socket.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/policy/hasher.h"
+#include "brpc/policy/maglev_load_balancer.h"
+
+namespace brpc {
+namespace policy {
+
+static bool IsPrime(int64_t n) {
+    if (n < 2) {
+        return false;
+    }
+    for (int64_t i = 2; i * i <= n; ++i) {
+        if (n % i == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ValidateMaglevTableSize(const char*, int32_t val) {
+    return IsPrime(val);
+}
+
+DEFINE_int32(maglev_table_size, 65537, "Default size of the lookup table of "
+             "c_maglev, must be a prime much larger than number of servers");
+BRPC_VALIDATE_GFLAG(maglev_table_size, ValidateMaglevTableSize);
+
+// Defined in consistent_hashing_load_balancer.cpp
+DECLARE_bool(consistent_hashing_enable_server_tag);
+
+MaglevLoadBalancer::MaglevLoadBalancer()
+    : _table_size(FLAGS_maglev_table_size) {}
+
+bool MaglevLoadBalancer::BuildNode(const ServerId& server, Node* node) const {
+    SocketUniquePtr ptr;
+    if (Socket::AddressFailedAsWell(server.id, &ptr) == -1) {
+        return false;
+    }
+    node->server_sock = server;
+    node->server_addr = ptr->remote_side();
+    node->key = endpoint2str(ptr->remote_side()).c_str();
+    if (FLAGS_consistent_hashing_enable_server_tag) {
+        node->key.push_back('-');
+        node->key.append(server.tag);
+    }
+    // Two independent hashes decide the permutation. As `_table_size' is
+    // a prime, any skip in [1, M) visits every slot.
+    node->offset = MurmurHash32(node->key.data(), node->key.size()) % _table_size;
+    node->skip = MD5Hash32(node->key.data(), node->key.size())
+        % (_table_size - 1) + 1;
+    return true;
+}
+
+void MaglevLoadBalancer::Populate(Servers& s, size_t table_size) {
+    s.table.clear();
+    const size_t n = s.nodes.size();
+    if (n == 0) {
+        return;
+    }
+    // `n' marks empty slots.
+    s.table.assign(table_size, n);
+    std::vector<uint64_t> next(n, 0);
+    size_t filled = 0;
+    while (true) {
+        for (size_t i = 0; i < n; ++i) {
+            const Node& node = s.nodes[i];
+            size_t slot = 0;
+            do {
+                slot = (node.offset + next[i] * node.skip) % table_size;
+                ++next[i];
+            } while (s.table[slot] != n);
+            s.table[slot] = i;
+            if (++filled == table_size) {
+                return;
+            }
+        }
+    }
+}
+
+// Like ConsistentHashingLoadBalancer, the new table is always built from the
+// foreground, so the second call of DoublyBufferedData does nothing but
+// returns the same value.
+size_t MaglevLoadBalancer::AddBatch(Servers& bg, const Servers& fg,
+                                    const std::vector<Node>& nodes,
+                                    size_t table_size, bool* executed) {
+    if (*executed) {
+        return fg.nodes.size() - bg.nodes.size();
+    }
+    *executed = true;
+    bg.nodes.resize(fg.nodes.size() + nodes.size());
+    bg.nodes.resize(std::set_union(fg.nodes.begin(), fg.nodes.end(),
+                                   nodes.begin(), nodes.end(), bg.nodes.begin())
+                    - bg.nodes.begin());
+    Populate(bg, table_size);
+    return bg.nodes.size() - fg.nodes.size();
+}
+
+size_t MaglevLoadBalancer::RemoveBatch(Servers& bg, const Servers& fg,
+                                       const std::vector<ServerId>& servers,
+                                       size_t table_size, bool* executed) {
+    if (*executed) {
+        return bg.nodes.size() - fg.nodes.size();
+    }
+    *executed = true;
+    bg.nodes.clear();
+    for (size_t i = 0; i < fg.nodes.size(); ++i) {
+        if (!std::binary_search(servers.begin(), servers.end(),
+                                fg.nodes[i].server_sock)) {
+            bg.nodes.push_back(fg.nodes[i]);
+        }
+    }
+    Populate(bg, table_size);
+    return fg.nodes.size() - bg.nodes.size();
+}
+
+bool MaglevLoadBalancer::AddServer(const ServerId& server) {
+    std::vector<Node> nodes(1);
+    if (!BuildNode(server, &nodes[0])) {
+        return false;
+    }
+    bool executed = false;
+    return _db_servers.ModifyWithForeground(
+        AddBatch, nodes, _table_size, &executed) != 0;
+}
+
+size_t MaglevLoadBalancer::AddServersInBatch(
+    const std::vector<ServerId>& servers) {
+    std::vector<Node> nodes;
+    nodes.reserve(servers.size());
+    Node node;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        if (BuildNode(servers[i], &node)) {
+            nodes.push_back(node);
+        }
+    }
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end(),
+                            [](const Node& a, const Node& b) {
+                                return !(a < b) && !(b < a);
+                            }), nodes.end());
+    bool executed = false;
+    const size_t n = _db_servers.ModifyWithForeground(
+        AddBatch, nodes, _table_size, &executed);
+    LOG_IF(ERROR, n != servers.size())
+        << "Fail to AddServersInBatch, expected " << servers.size()
+        << " actually " << n;
+    return n;
+}
+
+bool MaglevLoadBalancer::RemoveServer(const ServerId& server) {
+    std::vector<ServerId> servers(1, server);
+    bool executed = false;
+    return _db_servers.ModifyWithForeground(
+        RemoveBatch, servers, _table_size, &executed) != 0;
+}
+
+size_t MaglevLoadBalancer::RemoveServersInBatch(
+    const std::vector<ServerId>& servers) {
+    std::vector<ServerId> sorted(servers);
+    std::sort(sorted.begin(), sorted.end());
+    bool executed = false;
+    return _db_servers.ModifyWithForeground(
+        RemoveBatch, sorted, _table_size, &executed);
+}
+
+LoadBalancer* MaglevLoadBalancer::New(const butil::StringPiece& params) const {
+    MaglevLoadBalancer* lb = new (std::nothrow) MaglevLoadBalancer;
+    if (lb && !lb->SetParameters(params)) {
+        delete lb;
+        lb = NULL;
+    }
+    return lb;
+}
+
+void MaglevLoadBalancer::Destroy() {
+    delete this;
+}
+
+int MaglevLoadBalancer::SelectServer(const SelectIn& in, SelectOut* out) {
+    if (!in.has_request_code) {
+        LOG(ERROR) << "Controller.set_request_code() is required";
+        return EINVAL;
+    }
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        return ENOMEM;
+    }
+    const size_t n = s->nodes.size();
+    if (n == 0) {
+        return ENODATA;
+    }
+    // The owner of the slot is preferred. When it's unavailable, fall back
+    // to the following servers which are stable for the same request_code.
+    size_t index = s->table[in.request_code % s->table.size()];
+    for (size_t i = 0; i < n; ++i) {
+        const SocketId id = s->nodes[index].server_sock.id;
+        if (((i + 1) == n // always take last chance
+             || !ExcludedServers::IsExcluded(in.excluded, id))
+            && IsServerAvailable(id, out->ptr)) {
+            return 0;
+        }
+        if (++index == n) {
+            index = 0;
+        }
+    }
+    return EHOSTDOWN;
+}
+
+void MaglevLoadBalancer::GetLoads(std::map<butil::EndPoint, double>* load_map) {
+    load_map->clear();
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0 || s->table.empty()) {
+        return;
+    }
+    std::vector<size_t> count(s->nodes.size(), 0);
+    for (size_t i = 0; i < s->table.size(); ++i) {
+        ++count[s->table[i]];
+    }
+    for (size_t i = 0; i < s->nodes.size(); ++i) {
+        (*load_map)[s->nodes[i].server_addr] +=
+            (double)count[i] / s->table.size();
+    }
+}
+
+void MaglevLoadBalancer::Describe(std::ostream& os,
+                                  const DescribeOptions& options) {
+    if (!options.verbose) {
+        os << "c_maglev";
+        return;
+    }
+    os << "MaglevLoadBalancer {\n"
+       << "  table size: " << _table_size << '\n';
+    std::map<butil::EndPoint, double> load_map;
+    GetLoads(&load_map);
+    os << "  number of hosts: " << load_map.size() << '\n';
+    os << "  load of hosts: {\n";
+    for (std::map<butil::EndPoint, double>::iterator
+            it = load_map.begin(); it != load_map.end(); ++it) {
+        os << "    " << it->first << ": " << it->second << '\n';
+    }
+    os << "  }\n}\n";
+}
+
+bool MaglevLoadBalancer::SetParameters(const butil::StringPiece& params) {
+    for (butil::KeyValuePairsSplitter sp(params.begin(), params.end(), ' ', '=');
+            sp; ++sp) {
+        if (sp.value().empty()) {
+            LOG(ERROR) << "Empty value for " << sp.key() << " in lb parameter";
+            return false;
+        }
+        if (sp.key() == "table_size") {
+            if (!butil::StringToSizeT(sp.value(), &_table_size) ||
+                !IsPrime(_table_size)) {
+                LOG(ERROR) << "table_size=" << sp.value() << " is not a prime";
+                return false;
+            }
+            continue;
+        }
+        LOG(ERROR) << "Failed to set this unknown parameters " << sp.key_and_value();
+    }
+    return true;
+}
+
+}  // namespace policy
+} // namespace brpc
@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_POLICY_MAGLEV_LOAD_BALANCER_H
+#define BRPC_POLICY_MAGLEV_LOAD_BALANCER_H
+
+#include <stdint.h>                                     // uint32_t
+#include <map>                                          // std::map
+#include <string>                                       // std::string
+#include <vector>                                       // std::vector
+#include "butil/endpoint.h"                             // butil::EndPoint
+#include "butil/containers/doubly_buffered_data.h"      // DoublyBufferedData
+#include "brpc/load_balancer.h"
+
+namespace brpc {
+namespace policy {
+
+DECLARE_int32(maglev_table_size);
+
+// Consistent hashing described in "Maglev: A Fast and Reliable Software
+// Network Load Balancer". Every server fills slots of a lookup table with
+// a prime size M by its own permutation of [0, M) in turn, so that each
+// server owns nearly M/N slots and only about 1/N of the slots change owner
+// when a server is added or removed. Selection is a single table lookup
+// indexed by request_code % M instead of a binary search on the hash ring.
+// The table is rebuilt when servers change, which is not on the RPC path.
+class MaglevLoadBalancer : public LoadBalancer {
+public:
+    MaglevLoadBalancer();
+    bool AddServer(const ServerId& server) override;
+    bool RemoveServer(const ServerId& server) override;
+    size_t AddServersInBatch(const std::vector<ServerId>& servers) override;
+    size_t RemoveServersInBatch(const std::vector<ServerId>& servers) override;
+    LoadBalancer* New(const butil::StringPiece& params) const override;
+    void Destroy() override;
+    int SelectServer(const SelectIn& in, SelectOut* out) override;
+    void Describe(std::ostream& os, const DescribeOptions& options) override;
+
+    // Fraction of slots owned by each server.
+    void GetLoads(std::map<butil::EndPoint, double>* load_map);
+
+private:
+    struct Node {
+        ServerId server_sock;
+        butil::EndPoint server_addr;
+        // Servers are sorted by `key' so that all clients build the same
+        // table from the same servers.
+        std::string key;
+        // The permutation of the server is offset + j * skip (mod M).
+        uint32_t offset;
+        uint32_t skip;
+
+        bool operator<(const Node& rhs) const {
+            if (key != rhs.key) {
+                return key < rhs.key;
+            }
+            return server_sock < rhs.server_sock;
+        }
+    };
+    struct Servers {
+        std::vector<Node> nodes;
+        // Index of the owner in `nodes' of each slot.
+        std::vector<uint32_t> table;
+    };
+    bool SetParameters(const butil::StringPiece& params);
+    bool BuildNode(const ServerId& server, Node* node) const;
+    static void Populate(Servers& s, size_t table_size);
+    static size_t AddBatch(Servers& bg, const Servers& fg,
+                           const std::vector<Node>& nodes,
+                           size_t table_size, bool* executed);
+    static size_t RemoveBatch(Servers& bg, const Servers& fg,
+                              const std::vector<ServerId>& servers,
+                              size_t table_size, bool* executed);
+
+    size_t _table_size;
+    butil::DoublyBufferedData<Servers> _db_servers;
+};
+
+}  // namespace policy
+} // namespace brpc
+
+
+#endif  // BRPC_POLICY_MAGLEV_LOAD_BALANCER_H
@@ -40,6 +40,7 @@
 namespace brpc {
 
 DECLARE_bool(enable_rpcz);
+DECLARE_uint64(max_body_size);
 
 namespace policy {
 
@@ -73,8 +74,241 @@ inline bool IsSupportedCommand(uint8_t command) {
     return butil::bit_array_get(supported_cmd_map, command);
 }
 
+namespace {
+// A request parsed on server side, the header is in host byte order.
+struct MemcacheCommand {
+    MemcacheRequestHeader header;
+    butil::IOBuf extras;
+    butil::IOBuf key;
+    butil::IOBuf value;
+};
+}  // namespace
+
+static void AppendMemcacheResponse(butil::IOBuf* out,
+                                   const MemcacheRequestHeader& request,
+                                   uint16_t status, uint64_t cas_value,
+                                   const butil::StringPiece& extras,
+                                   const butil::IOBuf* key,
+                                   const butil::IOBuf* value) {
+    const uint16_t key_length = (key ? key->size() : 0);
+    const uint32_t value_length = (value ? value->size() : 0);
+    const MemcacheResponseHeader header = {
+        MC_MAGIC_RESPONSE,
+        request.command,
+        butil::HostToNet16(key_length),
+        (uint8_t)extras.size(),
+        MC_BINARY_RAW_BYTES,
+        butil::HostToNet16(status),
+        butil::HostToNet32(extras.size() + key_length + value_length),
+        butil::HostToNet32(request.opaque),
+        butil::HostToNet64(cas_value)
+    };
+    out->append(&header, sizeof(header));
+    out->append(extras.data(), extras.size());
+    if (key) {
+        out->append(*key);
+    }
+    if (value) {
+        out->append(*value);
+    }
+}
+
+static void AppendMemcacheError(butil::IOBuf* out,
+                                const MemcacheRequestHeader& request,
+                                MemcacheService::Status status) {
+    butil::IOBuf msg;
+    msg.append(MemcacheResponse::status_str(status));
+    AppendMemcacheResponse(out, request, status, 0, butil::StringPiece(),
+                           NULL, &msg);
+}
+
+static bool IsGetCommand(uint8_t command) {
+    return command == MC_BINARY_GET || command == MC_BINARY_GETQ ||
+        command == MC_BINARY_GETK || command == MC_BINARY_GETKQ;
+}
+
+// Look up GETs in [begin, end) of `cmds' together.
+static void RunMemcacheGets(MemcacheService* service,
+                            const std::vector<MemcacheCommand>& cmds,
+                            size_t begin, size_t end, butil::IOBuf* out) {
+    if (begin == end) {
+        return;
+    }
+    std::vector<butil::IOBuf> keys(end - begin);
+    for (size_t i = begin; i < end; ++i) {
+        keys[i - begin] = cmds[i].key;
+    }
+    std::vector<MemcacheService::Status> statuses(
+        keys.size(), MemcacheResponse::STATUS_KEY_ENOENT);
+    std::vector<MemcacheItem> items(keys.size());
+    service->MultiGet(keys, &statuses, &items);
+    for (size_t i = begin; i < end; ++i) {
+        const MemcacheRequestHeader& h = cmds[i].header;
+        const bool with_key =
+            (h.command == MC_BINARY_GETK || h.command == MC_BINARY_GETKQ);
+        const MemcacheItem& item = items[i - begin];
+        if (statuses[i - begin] == MemcacheResponse::STATUS_SUCCESS) {
+            const uint32_t flags = butil::HostToNet32(item.flags);
+            AppendMemcacheResponse(
+                out, h, MemcacheResponse::STATUS_SUCCESS, item.cas_value,
+                butil::StringPiece((const char*)&flags, sizeof(flags)),
+                (with_key ? &cmds[i].key : NULL), &item.value);
+        } else if (h.command == MC_BINARY_GET || h.command == MC_BINARY_GETK) {
+            // Quiet versions don't respond misses.
+            AppendMemcacheError(out, h, statuses[i - begin]);
+        }
+    }
+}
+
+static void RunMemcacheCommand(MemcacheService* service,
+                               const MemcacheCommand& cmd,
+                               butil::IOBuf* out) {
+    const MemcacheRequestHeader& h = cmd.header;
+    MemcacheService::Status status = MemcacheResponse::STATUS_SUCCESS;
+    uint64_t cas_value = 0;
+    bool quiet = false;
+    switch (h.command) {
+    case MC_BINARY_SETQ:
+    case MC_BINARY_ADDQ:
+    case MC_BINARY_REPLACEQ:
+        quiet = true;
+        // fall through
+    case MC_BINARY_SET:
+    case MC_BINARY_ADD:
+    case MC_BINARY_REPLACE: {
+        // extras: flags(4) and exptime(4).
+        uint32_t extras[2];
+        if (cmd.extras.size() != sizeof(extras)) {
+            status = MemcacheResponse::STATUS_EINVAL;
+            break;
+        }
+        cmd.extras.copy_to(extras, sizeof(extras));
+        MemcacheItem item;
+        item.value = cmd.value;
+        item.flags = butil::NetToHost32(extras[0]);
+        item.cas_value = h.cas_value;
+        MemcacheService::StoreMode mode = MemcacheService::STORE_SET;
+        if (h.command == MC_BINARY_ADD || h.command == MC_BINARY_ADDQ) {
+            mode = MemcacheService::STORE_ADD;
+        } else if (h.command == MC_BINARY_REPLACE ||
+                   h.command == MC_BINARY_REPLACEQ) {
+            mode = MemcacheService::STORE_REPLACE;
+        }
+        status = service->Store(mode, cmd.key, butil::NetToHost32(extras[1]),
+                                &item);
+        cas_value = item.cas_value;
+        break;
+    }
+    case MC_BINARY_DELETEQ:
+        quiet = true;
+        // fall through
+    case MC_BINARY_DELETE:
+        status = service->Delete(cmd.key);
+        break;
+    case MC_BINARY_NOOP:
+        break;
+    case MC_BINARY_VERSION: {
+        butil::IOBuf version;
+        version.append("brpc");
+        AppendMemcacheResponse(out, h, status, 0, butil::StringPiece(),
+                               NULL, &version);
+        return;
+    }
+    default:
+        status = MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+        break;
+    }
+    if (status != MemcacheResponse::STATUS_SUCCESS) {
+        AppendMemcacheError(out, h, status);
+    } else if (!quiet) {
+        AppendMemcacheResponse(out, h, status, cas_value, butil::StringPiece(),
+                               NULL, NULL);
+    }
+}
+
+static ParseResult ParseMemcacheRequests(butil::IOBuf* source, Socket* socket,
+                                         MemcacheService* service) {
+    std::vector<MemcacheCommand> cmds;
+    while (true) {
+        const uint8_t* p_mcmagic = (const uint8_t*)source->fetch1();
+        if (NULL == p_mcmagic) {
+            break;
+        }
+        if (*p_mcmagic != (uint8_t)MC_MAGIC_REQUEST) {
+            if (cmds.empty()) {
+                return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+            }
+            // Handle parsed commands first.
+            break;
+        }
+        char buf[24];
+        const MemcacheRequestHeader* header =
+            (const MemcacheRequestHeader*)source->fetch(buf, sizeof(buf));
+        if (NULL == header) {
+            break;
+        }
+        const uint32_t total_body_length =
+            butil::NetToHost32(header->total_body_length);
+        if (total_body_length > FLAGS_max_body_size) {
+            return MakeParseError(PARSE_ERROR_TOO_BIG_DATA);
+        }
+        if (source->size() < sizeof(*header) + total_body_length) {
+            break;
+        }
+        const uint16_t key_length = butil::NetToHost16(header->key_length);
+        if ((uint32_t)header->extras_length + key_length > total_body_length) {
+            LOG(ERROR) << "extras_length=" << (int)header->extras_length
+                       << " + key_length=" << key_length
+                       << " exceeds total_body_length=" << total_body_length;
+            return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
+        }
+        cmds.resize(cmds.size() + 1);
+        MemcacheCommand& cmd = cmds.back();
+        cmd.header = *header;
+        cmd.header.key_length = key_length;
+        cmd.header.vbucket_id = butil::NetToHost16(header->vbucket_id);
+        cmd.header.total_body_length = total_body_length;
+        cmd.header.opaque = butil::NetToHost32(header->opaque);
+        cmd.header.cas_value = butil::NetToHost64(header->cas_value);
+        source->pop_front(sizeof(*header));
+        source->cutn(&cmd.extras, cmd.header.extras_length);
+        source->cutn(&cmd.key, key_length);
+        source->cutn(&cmd.value, total_body_length -
+                     cmd.header.extras_length - key_length);
+    }
+    if (cmds.empty()) {
+        return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+    }
+    butil::IOBuf sendbuf;
+    size_t get_begin = 0;
+    for (size_t i = 0; i < cmds.size(); ++i) {
+        if (IsGetCommand(cmds[i].header.command)) {
+            continue;
+        }
+        RunMemcacheGets(service, cmds, get_begin, i, &sendbuf);
+        get_begin = i + 1;
+        RunMemcacheCommand(service, cmds[i], &sendbuf);
+    }
+    RunMemcacheGets(service, cmds, get_begin, cmds.size(), &sendbuf);
+    if (!sendbuf.empty()) {
+        Socket::WriteOptions wopt;
+        wopt.ignore_eovercrowded = true;
+        LOG_IF(WARNING, socket->Write(&sendbuf, &wopt) != 0)
+            << "Fail to send memcache response";
+    }
+    return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+}
+
 ParseResult ParseMemcacheMessage(butil::IOBuf* source,
-                                 Socket* socket, bool /*read_eof*/, const void */*arg*/) {
+                                 Socket* socket, bool /*read_eof*/, const void* arg) {
+    const Server* server = static_cast<const Server*>(arg);
+    if (server) {
+        MemcacheService* const ms = server->options().memcache_service;
+        if (!ms) {
+            return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+        }
+        return ParseMemcacheRequests(source, socket, ms);
+    }
     while (1) {
         const uint8_t* p_mcmagic = (const uint8_t*)source->fetch1();
         if (NULL == p_mcmagic) {
@@ -191,6 +425,8 @@ void ProcessMemcacheResponse(InputMessageBase* msg_base) {
     accessor.OnResponse(cid, saved_error);
 }
 
+void ProcessMemcacheRequest(InputMessageBase*) { }
+
 void SerializeMemcacheRequest(butil::IOBuf* buf,
                               Controller* cntl,
                               const google::protobuf::Message* request) {
@@ -32,6 +32,12 @@ ParseResult ParseMemcacheMessage(butil::IOBuf* source, Socket *socket, bool read
 // Actions to a memcache response.
 void ProcessMemcacheResponse(InputMessageBase* msg);
 
+// Actions to a memcache request, which is left unimplemented. Requests are
+// processed and responded in the parsing process. This function must be
+// declared since server only enables memcache as a server-side protocol
+// when this function is declared.
+void ProcessMemcacheRequest(InputMessageBase* msg);
+
 // Serialize a memcache request.
 void SerializeMemcacheRequest(butil::IOBuf* buf,
                               Controller* cntl,
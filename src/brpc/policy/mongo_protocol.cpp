@@ -25,12 +25,16 @@
 #include "brpc/server.h"                   // Server
 #include "brpc/span.h"
 #include "brpc/mongo_head.h"
+#include "brpc/mongo_message.h"
 #include "brpc/details/server_private_accessor.h"
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/mongo_service_adaptor.h"
 #include "brpc/policy/most_common_message.h"
 #include "brpc/policy/nshead_protocol.h"
 #include "brpc/policy/mongo.pb.h"
+#include "brpc/policy/gzip_compress.h"
+#include "brpc/policy/snappy_compress.h"
+#include "brpc/policy/zstd_compress.h"
 #include "brpc/details/usercode_backup_pool.h"
 
 extern "C" {
@@ -45,12 +49,18 @@ struct SendMongoResponse : public google::protobuf::Closure {
     SendMongoResponse(const Server *server) :
         status(NULL),
         received_us(0L),
+        compressor_id(-1),
+        more_to_come(false),
         server(server) {}
     ~SendMongoResponse();
     void Run();
 
     MethodStatus* status;
     int64_t received_us;
+    // Compressor of the request in OP_COMPRESSED, -1 if not compressed.
+    int compressor_id;
+    // The request is OP_MSG with MONGO_MSG_MORE_TO_COME.
+    bool more_to_come;
     const Server *server;
     Controller cntl;
     MongoRequest req;
@@ -61,6 +71,112 @@ SendMongoResponse::~SendMongoResponse() {
     LogErrorTextAndDelete(false)(&cntl);
 }
 
+// Size of originalOpcode, uncompressedSize and compressorId in
+// OP_COMPRESSED.
+static const size_t MONGO_COMPRESSED_HEAD_SIZE = 9;
+
+static bool DecompressMongoBody(int compressor_id, const butil::IOBuf& in,
+                                butil::IOBuf* out) {
+    switch (compressor_id) {
+    case MONGO_COMPRESSOR_NOOP:
+        out->append(in);
+        return true;
+    case MONGO_COMPRESSOR_SNAPPY:
+        return SnappyDecompress(in, out);
+    case MONGO_COMPRESSOR_ZLIB:
+        return ZlibDecompress(in, out);
+#if BRPC_WITH_ZSTD
+    case MONGO_COMPRESSOR_ZSTD:
+        return ZstdDecompress(in, out);
+#endif
+    }
+    LOG(WARNING) << "Unsupported mongo compressor=" << compressor_id;
+    return false;
+}
+
+static bool CompressMongoBody(int compressor_id, const butil::IOBuf& in,
+                              butil::IOBuf* out) {
+    switch (compressor_id) {
+    case MONGO_COMPRESSOR_SNAPPY:
+        return SnappyCompress(in, out);
+    case MONGO_COMPRESSOR_ZLIB: {
+        GzipCompressOptions opt;
+        opt.format = google::protobuf::io::GzipOutputStream::ZLIB;
+        return GzipCompress(in, out, &opt);
+    }
+#if BRPC_WITH_ZSTD
+    case MONGO_COMPRESSOR_ZSTD:
+        return ZstdCompress(in, out);
+#endif
+    }
+    return false;
+}
+
+// Replace the OP_COMPRESSED in `header' and `payload' with the original
+// message. Returns 0 on success, -1 otherwise.
+static int DecompressMongoMessage(mongo_head_t* header, butil::IOBuf* payload,
+                                  int* compressor_id) {
+    int32_t original_opcode = 0;
+    int32_t uncompressed_size = 0;
+    uint8_t id = 0;
+    if (payload->cutn(&original_opcode, sizeof(original_opcode)) !=
+            sizeof(original_opcode) ||
+        payload->cutn(&uncompressed_size, sizeof(uncompressed_size)) !=
+            sizeof(uncompressed_size) ||
+        !payload->cut1(&id)) {
+        return -1;
+    }
+    if (uncompressed_size < 0 ||
+        (uint64_t)uncompressed_size + sizeof(mongo_head_t) >
+        FLAGS_max_body_size) {
+        return -1;
+    }
+    butil::IOBuf original;
+    if (!DecompressMongoBody(id, *payload, &original) ||
+        original.size() != (size_t)uncompressed_size) {
+        return -1;
+    }
+    header->op_code = original_opcode;
+    header->message_length = sizeof(mongo_head_t) + original.size();
+    payload->swap(original);
+    *compressor_id = id;
+    return 0;
+}
+
+// Append OP_MSG with `body' to `out', in OP_COMPRESSED with `compressor_id'
+// if it's supported.
+static void AppendOpMsg(const MongoHeader& h, const butil::IOBuf& body,
+                        int compressor_id, butil::IOBuf* out) {
+    butil::IOBuf compressed;
+    if (compressor_id > MONGO_COMPRESSOR_NOOP &&
+        CompressMongoBody(compressor_id, body, &compressed)) {
+        mongo_head_t header = {
+            (int32_t)(sizeof(mongo_head_t) + MONGO_COMPRESSED_HEAD_SIZE +
+                      compressed.size()),
+            h.request_id(),
+            h.response_to(),
+            MONGO_OPCODE_COMPRESSED
+        };
+        const int32_t original_opcode = MONGO_OPCODE_OP_MSG;
+        const int32_t uncompressed_size = body.size();
+        const uint8_t id = compressor_id;
+        out->append(static_cast<const void*>(&header), sizeof(mongo_head_t));
+        out->append(&original_opcode, sizeof(original_opcode));
+        out->append(&uncompressed_size, sizeof(uncompressed_size));
+        out->push_back(id);
+        out->append(butil::IOBuf::Movable(compressed));
+        return;
+    }
+    mongo_head_t header = {
+        (int32_t)(sizeof(mongo_head_t) + body.size()),
+        h.request_id(),
+        h.response_to(),
+        MONGO_OPCODE_OP_MSG
+    };
+    out->append(static_cast<const void*>(&header), sizeof(mongo_head_t));
+    out->append(body);
+}
+
 void SendMongoResponse::Run() {
     std::unique_ptr<SendMongoResponse> delete_self(this);
     ConcurrencyRemover concurrency_remover(status, &cntl, received_us);
@@ -70,12 +186,19 @@ void SendMongoResponse::Run() {
         socket->SetFailed();
         return;
     }
-    
+    if (more_to_come) {
+        // The client does not read replies (even errors) of the request.
+        return;
+    }
+
     const MongoServiceAdaptor* adaptor =
             server->options().mongo_service_adaptor;
     butil::IOBuf res_buf;
     if (cntl.Failed()) {
         adaptor->SerializeError(res.header().response_to(), &res_buf);
+    } else if (res.header().op_code() == DB_OP_MSG) {
+        AppendOpMsg(res.header(), cntl.response_attachment(),
+                    compressor_id, &res_buf);
     } else if (res.has_message()) {
         mongo_head_t header = {
             res.header().message_length(),
@@ -177,9 +300,9 @@ void ProcessMongoRequest(InputMessageBase* msg_base) {
     const Server* server = static_cast<const Server*>(msg_base->arg());
     ScopedNonServiceError non_service_error(server);
 
-    char buf[sizeof(mongo_head_t)];
-    const char *p = (const char *)msg->meta.fetch(buf, sizeof(buf));
-    const mongo_head_t *header = (const mongo_head_t*)p;
+    mongo_head_t header;
+    msg->meta.copy_to(&header, sizeof(header));
+    header.make_host_endian();
 
     const google::protobuf::ServiceDescriptor* srv_des = MongoService::descriptor();
     if (1 != srv_des->method_count()) {
@@ -200,6 +323,16 @@ void ProcessMongoRequest(InputMessageBase* msg_base) {
 
     SendMongoResponse* mongo_done = new SendMongoResponse(server);
     mongo_done->cntl.set_mongo_session_data(context_msg->context());
+    int decompress_rc = 0;
+    if (header.op_code == MONGO_OPCODE_COMPRESSED) {
+        decompress_rc = DecompressMongoMessage(
+            &header, &msg->payload, &mongo_done->compressor_id);
+    }
+    if (header.op_code == MONGO_OPCODE_OP_MSG) {
+        uint32_t flag_bits = 0;
+        msg->payload.copy_to(&flag_bits, sizeof(flag_bits));
+        mongo_done->more_to_come = (flag_bits & MONGO_MSG_MORE_TO_COME);
+    }
 
     ControllerPrivateAccessor accessor(&(mongo_done->cntl));
     accessor.set_server(server)
@@ -218,6 +351,10 @@ void ProcessMongoRequest(InputMessageBase* msg_base) {
         bthread_assign_data((void*)&server->thread_local_options());
     }
     do {
+        if (decompress_rc != 0) {
+            mongo_done->cntl.SetFailed(EREQUEST, "Fail to decompress OP_COMPRESSED");
+            break;
+        }
         if (!server->IsRunning()) {
             mongo_done->cntl.SetFailed(ELOGOFF, "Server is stopping");
             break;
@@ -254,20 +391,26 @@ void ProcessMongoRequest(InputMessageBase* msg_base) {
             }
         }
         
-        if (!MongoOp_IsValid(header->op_code)) {
-            mongo_done->cntl.SetFailed(EREQUEST, "Unknown op_code:%d", header->op_code);
+        if (!MongoOp_IsValid(header.op_code)) {
+            mongo_done->cntl.SetFailed(EREQUEST, "Unknown op_code:%d", header.op_code);
             break;
         }
         
-        mongo_done->cntl.set_log_id(header->request_id);
-        const std::string &body_str = msg->payload.to_string();
-        mongo_done->req.set_message(body_str.c_str(), body_str.size());
-        mongo_done->req.mutable_header()->set_message_length(header->message_length);
-        mongo_done->req.mutable_header()->set_request_id(header->request_id);
-        mongo_done->req.mutable_header()->set_response_to(header->response_to);
+        mongo_done->cntl.set_log_id(header.request_id);
+        if (header.op_code == MONGO_OPCODE_OP_MSG) {
+            // Hand over OP_MSG without copying, see mongo_message.h
+            mongo_done->req.set_message(std::string());
+            mongo_done->cntl.request_attachment().swap(msg->payload);
+        } else {
+            const std::string &body_str = msg->payload.to_string();
+            mongo_done->req.set_message(body_str.c_str(), body_str.size());
+        }
+        mongo_done->req.mutable_header()->set_message_length(header.message_length);
+        mongo_done->req.mutable_header()->set_request_id(header.request_id);
+        mongo_done->req.mutable_header()->set_response_to(header.response_to);
         mongo_done->req.mutable_header()->set_op_code(
-                static_cast<MongoOp>(header->op_code));
-        mongo_done->res.mutable_header()->set_response_to(header->request_id);
+                static_cast<MongoOp>(header.op_code));
+        mongo_done->res.mutable_header()->set_response_to(header.request_id);
         mongo_done->received_us = msg->received_us();
 
         google::protobuf::Service* svc = mp->service;
@@ -0,0 +1,270 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <math.h>
+#include <gflags/gflags.h>
+#include "butil/fast_rand.h"
+#include "butil/time.h"
+#include "bthread/prime_offset.h"
+#include "brpc/socket.h"
+#include "brpc/controller.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/policy/p2c_load_balancer.h"
+
+namespace brpc {
+namespace policy {
+
+DEFINE_int32(p2c_decay_ms, 10000, "Latencies of servers in the p2c load "
+             "balancer are averaged over roughly so many milliseconds, "
+             "latencies of servers without calls decay in the same pace");
+BRPC_VALIDATE_GFLAG(p2c_decay_ms, PositiveInteger);
+
+// Servers being probed (calls in flight but no latency yet) are avoided.
+static const double PROBING_LOAD = 1e300;
+
+double P2CLoadBalancer::Stat::Load(int64_t now_us) const {
+    const int64_t n = inflight.load(butil::memory_order_relaxed);
+    const int64_t latency = latency_us.load(butil::memory_order_relaxed);
+    if (latency == 0) {
+        return n <= 0 ? 0 : PROBING_LOAD + n;
+    }
+    const int64_t elapsed_us =
+        now_us - update_time_us.load(butil::memory_order_relaxed);
+    double decayed = latency;
+    if (elapsed_us > 0) {
+        decayed *= exp(-elapsed_us / (FLAGS_p2c_decay_ms * 1000.0));
+    }
+    return decayed * (n + 1);
+}
+
+bool P2CLoadBalancer::Add(Servers& bg, const Servers& fg, SocketId id) {
+    if (bg.server_list.capacity() < 128) {
+        bg.server_list.reserve(128);
+    }
+    if (bg.server_map.seek(id) != NULL) {
+        return false;
+    }
+    Node node = { id, NULL };
+    const size_t* pindex = fg.server_map.seek(id);
+    if (pindex != NULL) {
+        // Added to the other buffer already, share the statistics.
+        node.stat = fg.server_list[*pindex].stat;
+    } else {
+        node.stat = std::make_shared<Stat>();
+    }
+    bg.server_map[id] = bg.server_list.size();
+    bg.server_list.push_back(node);
+    bg.server_ids.push_back(ServerId(id));
+    return true;
+}
+
+bool P2CLoadBalancer::Remove(Servers& bg, SocketId id) {
+    const size_t* pindex = bg.server_map.seek(id);
+    if (pindex == NULL) {
+        return false;
+    }
+    const size_t index = *pindex;
+    bg.server_list[index] = bg.server_list.back();
+    bg.server_ids[index] = bg.server_ids.back();
+    bg.server_map[bg.server_list[index].id] = index;
+    bg.server_list.pop_back();
+    bg.server_ids.pop_back();
+    bg.server_map.erase(id);
+    return true;
+}
+
+size_t P2CLoadBalancer::BatchAdd(Servers& bg, const Servers& fg,
+                                 const std::vector<SocketId>& servers) {
+    size_t count = 0;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        count += !!Add(bg, fg, servers[i]);
+    }
+    return count;
+}
+
+size_t P2CLoadBalancer::BatchRemove(Servers& bg,
+                                    const std::vector<SocketId>& servers) {
+    size_t count = 0;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        count += !!Remove(bg, servers[i]);
+    }
+    return count;
+}
+
+bool P2CLoadBalancer::AddServer(const ServerId& id) {
+    if (_id_mapper.AddServer(id)) {
+        return _db_servers.ModifyWithForeground(Add, id.id);
+    }
+    return true;
+}
+
+bool P2CLoadBalancer::RemoveServer(const ServerId& id) {
+    if (_id_mapper.RemoveServer(id)) {
+        return _db_servers.Modify(Remove, id.id);
+    }
+    return true;
+}
+
+size_t P2CLoadBalancer::AddServersInBatch(const std::vector<ServerId>& servers) {
+    std::vector<SocketId>& ids = _id_mapper.AddServers(servers);
+    _db_servers.ModifyWithForeground(BatchAdd, ids);
+    return servers.size();
+}
+
+size_t P2CLoadBalancer::RemoveServersInBatch(
+    const std::vector<ServerId>& servers) {
+    std::vector<SocketId>& ids = _id_mapper.RemoveServers(servers);
+    return _db_servers.Modify(BatchRemove, ids);
+}
+
+int P2CLoadBalancer::SelectServer(const SelectIn& in, SelectOut* out) {
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        return ENOMEM;
+    }
+    const size_t n = s->server_list.size();
+    if (n == 0) {
+        return ENODATA;
+    }
+    if (_cluster_recover_policy && _cluster_recover_policy->StopRecoverIfNecessary()) {
+        if (_cluster_recover_policy->DoReject(s->server_ids)) {
+            return EREJECT;
+        }
+    }
+    // Sample two distinct servers and try the less loaded one first.
+    size_t first = butil::fast_rand_less_than(n);
+    if (n > 1) {
+        size_t second = (first + 1 + butil::fast_rand_less_than(n - 1)) % n;
+        const int64_t now_us = butil::gettimeofday_us();
+        if (s->server_list[second].stat->Load(now_us) <
+            s->server_list[first].stat->Load(now_us)) {
+            std::swap(first, second);
+        }
+        const Node& chosen = s->server_list[first];
+        if (!ExcludedServers::IsExcluded(in.excluded, chosen.id) &&
+            IsServerAvailable(chosen.id, out->ptr)) {
+            chosen.stat->inflight.fetch_add(1, butil::memory_order_relaxed);
+            out->need_feedback = true;
+            return 0;
+        }
+        first = second;
+    }
+    // Unavailable, probe other servers like RandomizedLoadBalancer.
+    uint32_t stride = 0;
+    size_t offset = first;
+    for (size_t i = 0; i < n; ++i) {
+        const Node& node = s->server_list[offset];
+        if (((i + 1) == n  // always take last chance
+             || !ExcludedServers::IsExcluded(in.excluded, node.id))
+            && IsServerAvailable(node.id, out->ptr)) {
+            node.stat->inflight.fetch_add(1, butil::memory_order_relaxed);
+            out->need_feedback = true;
+            return 0;
+        }
+        if (stride == 0) {
+            stride = bthread::prime_offset();
+        }
+        offset = (offset + stride) % n;
+    }
+    if (_cluster_recover_policy) {
+        _cluster_recover_policy->StartRecover();
+    }
+    return EHOSTDOWN;
+}
+
+void P2CLoadBalancer::Feedback(const CallInfo& info) {
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        return;
+    }
+    const size_t* pindex = s->server_map.seek(info.server_id);
+    if (NULL == pindex) {
+        return;
+    }
+    Stat* stat = s->server_list[*pindex].stat.get();
+    stat->inflight.fetch_sub(1, butil::memory_order_relaxed);
+
+    const int64_t now_us = butil::gettimeofday_us();
+    int64_t sample = now_us - info.begin_time_us;
+    if (sample <= 0) {
+        // time skews, ignore the sample.
+        return;
+    }
+    if (info.error_code != 0 && info.controller->timeout_ms() > 0) {
+        // Errors are punished as timeouts.
+        sample = std::max(sample, info.controller->timeout_ms() * 1000L);
+    } else if (info.error_code == 0) {
+        sample = AdjustLatencyByServerLoad(sample, info.controller);
+    }
+    // Racing updates may lose samples, which is fine for estimating loads.
+    const int64_t old = stat->latency_us.load(butil::memory_order_relaxed);
+    int64_t latency = sample;
+    if (old != 0 && sample < old) {
+        // Rise to peaks at once and fall smoothly.
+        const int64_t elapsed_us = now_us -
+            stat->update_time_us.load(butil::memory_order_relaxed);
+        const double w = (elapsed_us <= 0 ? 1.0 :
+                          exp(-elapsed_us / (FLAGS_p2c_decay_ms * 1000.0)));
+        latency = (int64_t)(old * w + sample * (1 - w));
+    }
+    stat->latency_us.store(std::max(latency, (int64_t)1),
+                           butil::memory_order_relaxed);
+    stat->update_time_us.store(now_us, butil::memory_order_relaxed);
+}
+
+P2CLoadBalancer* P2CLoadBalancer::New(const butil::StringPiece& params) const {
+    P2CLoadBalancer* lb = new (std::nothrow) P2CLoadBalancer;
+    if (lb && !lb->SetParameters(params)) {
+        delete lb;
+        lb = NULL;
+    }
+    return lb;
+}
+
+void P2CLoadBalancer::Destroy() {
+    delete this;
+}
+
+void P2CLoadBalancer::Describe(std::ostream& os, const DescribeOptions& options) {
+    if (!options.verbose) {
+        os << "p2c";
+        return;
+    }
+    os << "P2C{";
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        os << "fail to read _db_servers";
+    } else {
+        const int64_t now_us = butil::gettimeofday_us();
+        os << "n=" << s->server_list.size() << ':';
+        for (size_t i = 0; i < s->server_list.size(); ++i) {
+            const Node& node = s->server_list[i];
+            os << ' ' << node.id << "(inflight="
+               << node.stat->inflight.load(butil::memory_order_relaxed)
+               << " load=" << node.stat->Load(now_us) << ')';
+        }
+    }
+    os << '}';
+}
+
+bool P2CLoadBalancer::SetParameters(const butil::StringPiece& params) {
+    return GetRecoverPolicyByParams(params, &_cluster_recover_policy);
+}
+
+}  // namespace policy
+} // namespace brpc
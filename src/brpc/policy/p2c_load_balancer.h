@@ -0,0 +1,96 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_POLICY_P2C_LOAD_BALANCER_H
+#define BRPC_POLICY_P2C_LOAD_BALANCER_H
+
+#include <vector>                                      // std::vector
+#include <memory>                                      // std::shared_ptr
+#include "butil/atomicops.h"
+#include "butil/containers/flat_map.h"                  // FlatMap
+#include "butil/containers/doubly_buffered_data.h"      // DoublyBufferedData
+#include "brpc/load_balancer.h"
+#include "brpc/cluster_recover_policy.h"
+
+namespace brpc {
+namespace policy {
+
+DECLARE_int32(p2c_decay_ms);
+
+// "Power of two choices": sample two servers randomly and select the one with
+// lower load, which is estimated by (in-flight calls + 1) * latency, where
+// latency is a moving average decaying over time so that servers not
+// selected for a while get chances again. Selection is O(1) and statistics
+// of servers are updated by atomics independently, unlike the weight tree of
+// LocalityAwareLoadBalancer updated on every feedback.
+class P2CLoadBalancer : public LoadBalancer {
+public:
+    bool AddServer(const ServerId& id) override;
+    bool RemoveServer(const ServerId& id) override;
+    size_t AddServersInBatch(const std::vector<ServerId>& servers) override;
+    size_t RemoveServersInBatch(const std::vector<ServerId>& servers) override;
+    int SelectServer(const SelectIn& in, SelectOut* out) override;
+    void Feedback(const CallInfo& info) override;
+    P2CLoadBalancer* New(const butil::StringPiece&) const override;
+    void Destroy() override;
+    void Describe(std::ostream& os, const DescribeOptions&) override;
+
+private:
+    struct Stat {
+        Stat() : inflight(0), latency_us(0), update_time_us(0) {}
+        // Load of the server at `now_us'.
+        double Load(int64_t now_us) const;
+
+        butil::atomic<int64_t> inflight;
+        // 0 means no sample yet.
+        butil::atomic<int64_t> latency_us;
+        butil::atomic<int64_t> update_time_us;
+    };
+    struct Node {
+        SocketId id;
+        // Shared by both buffers of _db_servers.
+        std::shared_ptr<Stat> stat;
+    };
+    struct Servers {
+        std::vector<Node> server_list;
+        // Same servers as `server_list', for ClusterRecoverPolicy.
+        std::vector<ServerId> server_ids;
+        butil::FlatMap<SocketId, size_t> server_map;
+
+        Servers() {
+            if (server_map.init(1024, 70) != 0) {
+                LOG(WARNING) << "Fail to init server_map";
+            }
+        }
+    };
+    bool SetParameters(const butil::StringPiece& params);
+    static bool Add(Servers& bg, const Servers& fg, SocketId id);
+    static bool Remove(Servers& bg, SocketId id);
+    static size_t BatchAdd(Servers& bg, const Servers& fg,
+                           const std::vector<SocketId>& servers);
+    static size_t BatchRemove(Servers& bg, const std::vector<SocketId>& servers);
+
+    butil::DoublyBufferedData<Servers> _db_servers;
+    ServerId2SocketIdMapper _id_mapper;
+    std::shared_ptr<ClusterRecoverPolicy> _cluster_recover_policy;
+};
+
+}  // namespace policy
+} // namespace brpc
+
+
+#endif  // BRPC_POLICY_P2C_LOAD_BALANCER_H
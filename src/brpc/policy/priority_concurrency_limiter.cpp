@@ -0,0 +1,142 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gflags/gflags.h>
+#include "brpc/reloadable_flags.h"
+#include "brpc/policy/priority_concurrency_limiter.h"
+
+namespace brpc {
+namespace policy {
+
+static bool ValidateReservedRatio(const char*, double val) {
+    return val >= 0 && val * (REQUEST_PRIORITY_NUM - 1) < 1;
+}
+
+DEFINE_double(priority_cl_reserved_ratio, 0.1,
+              "Ratio of max_concurrency reserved by each request priority for "
+              "higher priorities when the server sheds load by priorities");
+BRPC_VALIDATE_GFLAG(priority_cl_reserved_ratio, ValidateReservedRatio);
+
+static const char* const s_priority_names[REQUEST_PRIORITY_NUM] = {
+    "sheddable", "default", "critical", "critical_plus"
+};
+
+PriorityConcurrencyLimiter::PriorityConcurrencyLimiter(ConcurrencyLimiter* inner)
+    : _inner(inner) {}
+
+PriorityConcurrencyLimiter::PriorityConcurrencyLimiter(
+    ConcurrencyLimiter* inner, const std::vector<double>& max_ratios)
+    : _inner(inner)
+    , _max_ratios(max_ratios) {}
+
+bool PriorityConcurrencyLimiter::ValidateMaxRatios(
+    const std::vector<double>& max_ratios) {
+    if (max_ratios.empty()) {
+        return true;
+    }
+    if (max_ratios.size() != (size_t)REQUEST_PRIORITY_NUM) {
+        return false;
+    }
+    for (int i = 0; i < REQUEST_PRIORITY_NUM; ++i) {
+        if (!(max_ratios[i] > 0 && max_ratios[i] <= 1)) {
+            return false;
+        }
+        if (i > 0 && max_ratios[i] < max_ratios[i - 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PriorityConcurrencyLimiter::OnRequested(int current_concurrency,
+                                             Controller* cntl) {
+    const int priority =
+        (cntl ? cntl->request_priority() : REQUEST_PRIORITY_DEFAULT);
+    const double max_ratio = (!_max_ratios.empty() ? _max_ratios[priority] :
+        1 - (REQUEST_PRIORITY_NUM - 1 - priority) *
+        FLAGS_priority_cl_reserved_ratio);
+    if (max_ratio < 1) {
+        const int max_concurrency = _inner->MaxConcurrency();
+        if (max_concurrency > 0 &&
+            current_concurrency > max_concurrency * max_ratio) {
+            _rejected[priority] << 1;
+            return false;
+        }
+    }
+    if (!_inner->OnRequested(current_concurrency, cntl)) {
+        _rejected[priority] << 1;
+        return false;
+    }
+    _accepted[priority] << 1;
+    return true;
+}
+
+void PriorityConcurrencyLimiter::OnResponded(int error_code, int64_t latency_us) {
+    _inner->OnResponded(error_code, latency_us);
+}
+
+int PriorityConcurrencyLimiter::MaxConcurrency() {
+    return _inner->MaxConcurrency();
+}
+
+int PriorityConcurrencyLimiter::ResetMaxConcurrency(
+    const AdaptiveMaxConcurrency& amc) {
+    return _inner->ResetMaxConcurrency(amc);
+}
+
+PriorityConcurrencyLimiter* PriorityConcurrencyLimiter::New(
+    const AdaptiveMaxConcurrency& amc) const {
+    ConcurrencyLimiter* inner = _inner->New(amc);
+    if (inner == NULL) {
+        return NULL;
+    }
+    return new (std::nothrow) PriorityConcurrencyLimiter(inner, _max_ratios);
+}
+
+int PriorityConcurrencyLimiter::Expose(const butil::StringPiece& prefix) {
+    if (_inner->Expose(prefix) != 0) {
+        return -1;
+    }
+    std::string name;
+    for (int i = 0; i < REQUEST_PRIORITY_NUM; ++i) {
+        name = "priority_";
+        name.append(s_priority_names[i]);
+        if (_accepted[i].expose_as(prefix, name + "_accepted") != 0) {
+            return -1;
+        }
+        if (_rejected[i].expose_as(prefix, name + "_rejected") != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void PriorityConcurrencyLimiter::Describe(std::ostream& os,
+                                          const DescribeOptions& options) {
+    for (int i = 0; i < REQUEST_PRIORITY_NUM; ++i) {
+        if (options.use_html) {
+            os << "<p>";
+        }
+        os << "priority_" << s_priority_names[i] << ": accepted="
+           << _accepted[i].get_value() << " rejected="
+           << _rejected[i].get_value();
+        os << (options.use_html ? "</p>\n" : "\n");
+    }
+}
+
+}  // namespace policy
+}  // namespace brpc
@@ -0,0 +1,76 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_POLICY_PRIORITY_CONCURRENCY_LIMITER_H
+#define BRPC_POLICY_PRIORITY_CONCURRENCY_LIMITER_H
+
+#include <memory>
+#include <vector>
+#include "bvar/bvar.h"
+#include "brpc/concurrency_limiter.h"
+
+namespace brpc {
+namespace policy {
+
+DECLARE_double(priority_cl_reserved_ratio);
+
+// Wrap another limiter to shed requests by Controller.request_priority().
+// Requests of priority p are rejected when the concurrency exceeds
+//   max_concurrency * max_ratios[p]
+// so that the capacity left is reserved for requests of higher priorities,
+// which are still limited by the wrapped limiter. Without `max_ratios',
+// max_ratios[p] is 1 - (REQUEST_PRIORITY_NUM - 1 - p) * reserved_ratio.
+class PriorityConcurrencyLimiter : public ConcurrencyLimiter {
+public:
+    // Takes ownership of `inner'.
+    explicit PriorityConcurrencyLimiter(ConcurrencyLimiter* inner);
+
+    // `max_ratios' are indexed by RequestPriority and must be valid, see
+    // ValidateMaxRatios(). Empty means -priority_cl_reserved_ratio.
+    PriorityConcurrencyLimiter(ConcurrencyLimiter* inner,
+                               const std::vector<double>& max_ratios);
+
+    // Returns true if `max_ratios' is empty, or has a ratio in (0, 1] for
+    // each priority and no ratio is larger than the one of a higher priority.
+    static bool ValidateMaxRatios(const std::vector<double>& max_ratios);
+
+    bool OnRequested(int current_concurrency, Controller* cntl) override;
+
+    void OnResponded(int error_code, int64_t latency_us) override;
+
+    int MaxConcurrency() override;
+
+    int ResetMaxConcurrency(const AdaptiveMaxConcurrency& amc) override;
+
+    PriorityConcurrencyLimiter* New(const AdaptiveMaxConcurrency& amc) const override;
+
+    int Expose(const butil::StringPiece& prefix) override;
+
+    void Describe(std::ostream& os, const DescribeOptions& options) override;
+
+private:
+    std::unique_ptr<ConcurrencyLimiter> _inner;
+    std::vector<double> _max_ratios;
+    bvar::Adder<int64_t> _accepted[REQUEST_PRIORITY_NUM];
+    bvar::Adder<int64_t> _rejected[REQUEST_PRIORITY_NUM];
+};
+
+}  // namespace policy
+}  // namespace brpc
+
+
+#endif // BRPC_POLICY_PRIORITY_CONCURRENCY_LIMITER_H
@@ -130,28 +130,54 @@ ParseResult ParseRedisMessage(butil::IOBuf* source, Socket* socket,
             ctx = new RedisConnContext(rs);
             socket->reset_parsing_context(ctx);
         }
-        std::vector<butil::StringPiece> current_args;
+        butil::IOBuf* arg_blocks = (rs->zero_copy_args() ? &ctx->arg_blocks : NULL);
         butil::IOBufAppender appender;
         ParseError err = PARSE_OK;
 
-        err = ctx->parser.Consume(*source, &current_args, &ctx->arena);
-        if (err != PARSE_OK) {
-            return MakeParseError(err);
-        }
-        while (true) {
-            std::vector<butil::StringPiece> next_args;
-            err = ctx->parser.Consume(*source, &next_args, &ctx->arena);
+        RedisBatchCommandHandler* bh = rs->batch_command_handler();
+        if (bh != NULL) {
+            // Run all commands parsed from the read together.
+            std::vector<std::vector<butil::StringPiece> > commands(1);
+            err = ctx->parser.Consume(*source, &commands[0], &ctx->arena, arg_blocks);
             if (err != PARSE_OK) {
-                break;
+                return MakeParseError(err);
+            }
+            while (true) {
+                std::vector<butil::StringPiece> next_args;
+                err = ctx->parser.Consume(*source, &next_args, &ctx->arena, arg_blocks);
+                if (err != PARSE_OK) {
+                    break;
+                }
+                commands.push_back(std::vector<butil::StringPiece>());
+                commands.back().swap(next_args);
             }
-            if (ConsumeCommand(ctx, current_args, false, &appender) != 0) {
+            RedisReply output(&ctx->arena);
+            output.SetArray(commands.size());
+            bh->Run(ctx, commands, &output);
+            for (size_t i = 0; i < commands.size(); ++i) {
+                output[i].SerializeTo(&appender);
+            }
+        } else {
+            std::vector<butil::StringPiece> current_args;
+            err = ctx->parser.Consume(*source, &current_args, &ctx->arena, arg_blocks);
+            if (err != PARSE_OK) {
+                return MakeParseError(err);
+            }
+            while (true) {
+                std::vector<butil::StringPiece> next_args;
+                err = ctx->parser.Consume(*source, &next_args, &ctx->arena, arg_blocks);
+                if (err != PARSE_OK) {
+                    break;
+                }
+                if (ConsumeCommand(ctx, current_args, false, &appender) != 0) {
+                    return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
+                }
+                current_args.swap(next_args);
+            }
+            if (ConsumeCommand(ctx, current_args,
+                        true /*must be the last message*/, &appender) != 0) {
                 return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
             }
-            current_args.swap(next_args);
-        }
-        if (ConsumeCommand(ctx, current_args,
-                    true /*must be the last message*/, &appender) != 0) {
-            return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
         }
         butil::IOBuf sendbuf;
         appender.move_to(sendbuf);
@@ -161,7 +187,8 @@ ParseResult ParseRedisMessage(butil::IOBuf* source, Socket* socket,
         LOG_IF(WARNING, socket->Write(&sendbuf, &wopt) != 0)
             << "Fail to send redis reply";
         if(ctx->parser.ParsedArgsSize() == 0) {
-            ctx->arena.clear();
+            ctx->arena.reset();
+            ctx->arg_blocks.clear();
         }
         return MakeParseError(err);
     } else {
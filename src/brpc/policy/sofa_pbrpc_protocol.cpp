@@ -332,7 +332,7 @@ void ProcessSofaRequest(InputMessageBase* msg_base) {
     }
     const CompressType req_cmp_type = Sofa2CompressType(meta.compress_type());
 
-    SampledRequest* sample = AskToBeSampled();
+    SampledRequest* sample = AskToBeSampled(butil::StringPiece(), meta.method());
     if (sample) {
         sample->meta.set_method_name(meta.method());
         sample->meta.set_compress_type(req_cmp_type);
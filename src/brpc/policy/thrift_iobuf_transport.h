@@ -0,0 +1,121 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_POLICY_THRIFT_IOBUF_TRANSPORT_H
+#define BRPC_POLICY_THRIFT_IOBUF_TRANSPORT_H
+
+#include <arpa/inet.h>                          // htonl
+#include <thrift/transport/TTransportException.h>
+#include <thrift/transport/TVirtualTransport.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include "butil/iobuf.h"
+
+// _THRIFT_STDCXX_H_ is defined by thrift/stdcxx.h which was added since thrift 0.11.0
+// but deprecated after thrift 0.13.0
+#include <thrift/TProcessor.h> // to include stdcxx.h if present
+#ifndef THRIFT_STDCXX
+ #if defined(_THRIFT_STDCXX_H_)
+ # define THRIFT_STDCXX apache::thrift::stdcxx
+ #elif defined(_THRIFT_VERSION_LOWER_THAN_0_11_0_)
+ # define THRIFT_STDCXX boost
+ # include <boost/make_shared.hpp>
+ #else
+ # define THRIFT_STDCXX std
+ #endif
+#endif
+
+namespace brpc {
+namespace policy {
+
+// Reads thrift data from an IOBuf directly. Compared to TMemoryBuffer, the
+// IOBuf is not flattened and strings fitting in one block are borrowed.
+// TBinaryProtocolT calls these methods without virtual dispatch.
+class ThriftIOBufInputTransport
+    : public apache::thrift::transport::TVirtualTransport<ThriftIOBufInputTransport> {
+public:
+    // Share blocks of `buf' rather than copying the bytes.
+    explicit ThriftIOBufInputTransport(const butil::IOBuf& buf) : _buf(buf) {}
+
+    bool isOpen() const { return true; }
+
+    uint32_t read(uint8_t* buf, uint32_t len) {
+        return _buf.cutn(buf, len);
+    }
+
+    uint32_t readAll(uint8_t* buf, uint32_t len) {
+        if (_buf.cutn(buf, len) != len) {
+            throw apache::thrift::transport::TTransportException(
+                apache::thrift::transport::TTransportException::END_OF_FILE,
+                "No more data to read");
+        }
+        return len;
+    }
+
+    const uint8_t* borrow(uint8_t* /*buf*/, uint32_t* len) {
+        if (_buf.empty()) {
+            return NULL;
+        }
+        const butil::StringPiece front = _buf.backing_block(0);
+        if (front.size() < *len) {
+            return NULL;
+        }
+        *len = front.size();
+        return (const uint8_t*)front.data();
+    }
+
+    void consume(uint32_t len) {
+        _buf.pop_front(len);
+    }
+
+private:
+    butil::IOBuf _buf;
+};
+
+// Writes thrift data into IOBuf blocks directly, which are appended to the
+// packet without copying.
+class ThriftIOBufOutputTransport
+    : public apache::thrift::transport::TVirtualTransport<ThriftIOBufOutputTransport> {
+public:
+    bool isOpen() const { return true; }
+
+    void write(const uint8_t* buf, uint32_t len) {
+        _appender.append(buf, len);
+    }
+
+    // Append the written data to `out' as a framed message.
+    void AppendFramedTo(butil::IOBuf* out) {
+        butil::IOBuf body;
+        _appender.move_to(body);
+        const uint32_t body_len = htonl(body.size());
+        out->append(&body_len, sizeof(body_len));
+        out->append(body.movable());
+    }
+
+private:
+    butil::IOBufAppender _appender;
+};
+
+typedef apache::thrift::protocol::TBinaryProtocolT<ThriftIOBufInputTransport>
+ThriftIOBufInputProtocol;
+typedef apache::thrift::protocol::TBinaryProtocolT<ThriftIOBufOutputTransport>
+ThriftIOBufOutputProtocol;
+
+} // namespace policy
+} // namespace brpc
+
+#endif // BRPC_POLICY_THRIFT_IOBUF_TRANSPORT_H
@@ -32,27 +32,13 @@
 #include "brpc/thrift_service.h"
 #include "brpc/policy/most_common_message.h"
 #include "brpc/policy/thrift_protocol.h"
+#include "brpc/policy/thrift_iobuf_transport.h"
 #include "brpc/details/usercode_backup_pool.h"
 
 #include <thrift/Thrift.h>
-#include <thrift/transport/TBufferTransports.h>
 #include <thrift/protocol/TBinaryProtocol.h>
 #include <thrift/TApplicationException.h>
 
-// _THRIFT_STDCXX_H_ is defined by thrift/stdcxx.h which was added since thrift 0.11.0
-// but deprecated after thrift 0.13.0
-#include <thrift/TProcessor.h> // to include stdcxx.h if present
-#ifndef THRIFT_STDCXX
- #if defined(_THRIFT_STDCXX_H_)
- # define THRIFT_STDCXX apache::thrift::stdcxx
- #elif defined(_THRIFT_VERSION_LOWER_THAN_0_11_0_)
- # define THRIFT_STDCXX boost
- # include <boost/make_shared.hpp>
- #else
- # define THRIFT_STDCXX std
- #endif
-#endif
-
 extern "C" {
 void bthread_assign_data(void* data);
 }
@@ -126,14 +112,8 @@ WriteThriftMessageBegin(char* buf,
 bool ReadThriftStruct(const butil::IOBuf& body,
                       ThriftMessageBase* raw_msg,
                       int16_t expected_fid) {
-    const size_t body_len  = body.size();
-    uint8_t* thrift_buffer = (uint8_t*)malloc(body_len);
-    body.copy_to(thrift_buffer, body_len);
-    auto in_buffer =
-        THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>(
-            thrift_buffer, body_len,
-            ::apache::thrift::transport::TMemoryBuffer::TAKE_OWNERSHIP);
-    apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> iprot(in_buffer);
+    ThriftIOBufInputProtocol iprot(
+        THRIFT_STDCXX::make_shared<ThriftIOBufInputTransport>(body));
 
     bool success = false;
     try {
@@ -175,14 +155,8 @@ bool ReadThriftStruct(const butil::IOBuf& body,
 
 void ReadThriftException(const butil::IOBuf& body,
                          ::apache::thrift::TApplicationException* x) {
-    size_t body_len  = body.size();
-    uint8_t* thrift_buffer = (uint8_t*)malloc(body_len);
-    body.copy_to(thrift_buffer, body_len);
-    auto in_buffer =
-        THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>(
-            thrift_buffer, body_len,
-            ::apache::thrift::transport::TMemoryBuffer::TAKE_OWNERSHIP);
-    apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> iprot(in_buffer);
+    ThriftIOBufInputProtocol iprot(
+        THRIFT_STDCXX::make_shared<ThriftIOBufInputTransport>(body));
 
     x->read(&iprot);
     iprot.readMessageEnd();
@@ -289,9 +263,8 @@ void ThriftClosure::DoRun() {
 
     // The following code was taken and modified from thrift auto generated code
     if (_controller.Failed()) {
-        auto out_buffer =
-            THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>();
-        apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> oprot(out_buffer);
+        auto out_buffer = THRIFT_STDCXX::make_shared<ThriftIOBufOutputTransport>();
+        ThriftIOBufOutputProtocol oprot(out_buffer);
         ::apache::thrift::TApplicationException x(_controller.ErrorText());
         oprot.writeMessageBegin(
             method_name, ::apache::thrift::protocol::T_EXCEPTION, seq_id);
@@ -300,16 +273,10 @@ void ThriftClosure::DoRun() {
         oprot.getTransport()->writeEnd();
         oprot.getTransport()->flush();
 
-        uint8_t* buf;
-        uint32_t sz;
-        out_buffer->getBuffer(&buf, &sz);
-        const thrift_head_t head = { htonl(sz) };
-        write_buf.append(&head, sizeof(head));
-        write_buf.append(buf, sz);
+        out_buffer->AppendFramedTo(&write_buf);
     } else if (_response.raw_instance()) {
-        auto out_buffer =
-            THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>();
-        apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> oprot(out_buffer);
+        auto out_buffer = THRIFT_STDCXX::make_shared<ThriftIOBufOutputTransport>();
+        ThriftIOBufOutputProtocol oprot(out_buffer);
         oprot.writeMessageBegin(
             method_name, ::apache::thrift::protocol::T_REPLY, seq_id);
 
@@ -328,12 +295,7 @@ void ThriftClosure::DoRun() {
         oprot.getTransport()->writeEnd();
         oprot.getTransport()->flush();
 
-        uint8_t* buf;
-        uint32_t sz;
-        out_buffer->getBuffer(&buf, &sz);
-        const thrift_head_t head = { htonl(sz) };
-        write_buf.append(&head, sizeof(head));
-        write_buf.append(buf, sz);
+        out_buffer->AppendFramedTo(&write_buf);
     } else {
         const size_t mb_size = ThriftMessageBeginSize(method_name);
         char buf[sizeof(thrift_head_t) + mb_size];
@@ -682,9 +644,8 @@ void SerializeThriftRequest(butil::IOBuf* request_buf, Controller* cntl,
 
     // xxx_pargs write
     if (req->raw_instance()) {
-        auto out_buffer =
-            THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>();
-        apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> oprot(out_buffer);
+        auto out_buffer = THRIFT_STDCXX::make_shared<ThriftIOBufOutputTransport>();
+        ThriftIOBufOutputProtocol oprot(out_buffer);
 
         oprot.writeMessageBegin(
             method_name, ::apache::thrift::protocol::T_CALL, 0/*seq_id*/);
@@ -715,13 +676,7 @@ void SerializeThriftRequest(butil::IOBuf* request_buf, Controller* cntl,
         oprot.getTransport()->writeEnd();
         oprot.getTransport()->flush();
 
-        uint8_t* buf;
-        uint32_t sz;
-        out_buffer->getBuffer(&buf, &sz);
-
-        const thrift_head_t head = { htonl(sz) };
-        request_buf->append(&head, sizeof(head));
-        request_buf->append(buf, sz);
+        out_buffer->AppendFramedTo(request_buf);
     } else {
         const size_t mb_size = ThriftMessageBeginSize(method_name);
         char buf[sizeof(thrift_head_t) + mb_size];
@@ -0,0 +1,279 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gflags/gflags.h>
+#include "butil/fast_rand.h"
+#include "butil/time.h"
+#include "butil/strings/string_number_conversions.h"
+#include "brpc/socket.h"
+#include "brpc/extension.h"
+#include "brpc/policy/zone_aware_load_balancer.h"
+
+namespace brpc {
+namespace policy {
+
+DEFINE_string(local_zone, "", "Zone of this process, servers tagged with "
+              "the zone are preferred by the zone-aware load balancer");
+
+// Health of local servers is checked at most once in so many microseconds.
+static const int64_t HEALTH_CHECK_INTERVAL_US = 100000;
+static const int FULL_SHARE = 10000;
+
+ZoneAwareLoadBalancer::ZoneAwareLoadBalancer()
+    : _inner_name("rr")
+    , _min_healthy_ratio(0.8)
+    , _local(NULL)
+    , _remote(NULL)
+    , _local_share(FULL_SHARE)
+    , _last_update_us(0) {}
+
+ZoneAwareLoadBalancer::~ZoneAwareLoadBalancer() {
+    if (_local) {
+        _local->Destroy();
+        _local = NULL;
+    }
+    if (_remote) {
+        _remote->Destroy();
+        _remote = NULL;
+    }
+}
+
+size_t ZoneAwareLoadBalancer::AddLocal(LocalServers& bg,
+                                       const std::vector<SocketId>& ids) {
+    for (size_t i = 0; i < ids.size(); ++i) {
+        bg.ids.insert(ids[i]);
+    }
+    return ids.size();
+}
+
+size_t ZoneAwareLoadBalancer::RemoveLocal(LocalServers& bg,
+                                          const std::vector<SocketId>& ids) {
+    for (size_t i = 0; i < ids.size(); ++i) {
+        bg.ids.erase(ids[i]);
+    }
+    return ids.size();
+}
+
+bool ZoneAwareLoadBalancer::AddServer(const ServerId& id) {
+    if (!IsLocal(id)) {
+        return _remote->AddServer(id);
+    }
+    if (!_local->AddServer(id)) {
+        return false;
+    }
+    _db_local.Modify(AddLocal, std::vector<SocketId>(1, id.id));
+    // Check health of local servers again in next selection.
+    _last_update_us.store(0, butil::memory_order_relaxed);
+    return true;
+}
+
+bool ZoneAwareLoadBalancer::RemoveServer(const ServerId& id) {
+    if (!IsLocal(id)) {
+        return _remote->RemoveServer(id);
+    }
+    if (!_local->RemoveServer(id)) {
+        return false;
+    }
+    _db_local.Modify(RemoveLocal, std::vector<SocketId>(1, id.id));
+    _last_update_us.store(0, butil::memory_order_relaxed);
+    return true;
+}
+
+size_t ZoneAwareLoadBalancer::AddServersInBatch(
+    const std::vector<ServerId>& servers) {
+    std::vector<ServerId> local;
+    std::vector<ServerId> remote;
+    std::vector<SocketId> local_ids;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        if (IsLocal(servers[i])) {
+            local.push_back(servers[i]);
+            local_ids.push_back(servers[i].id);
+        } else {
+            remote.push_back(servers[i]);
+        }
+    }
+    size_t n = _remote->AddServersInBatch(remote);
+    if (!local.empty()) {
+        n += _local->AddServersInBatch(local);
+        _db_local.Modify(AddLocal, local_ids);
+        _last_update_us.store(0, butil::memory_order_relaxed);
+    }
+    return n;
+}
+
+size_t ZoneAwareLoadBalancer::RemoveServersInBatch(
+    const std::vector<ServerId>& servers) {
+    std::vector<ServerId> local;
+    std::vector<ServerId> remote;
+    std::vector<SocketId> local_ids;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        if (IsLocal(servers[i])) {
+            local.push_back(servers[i]);
+            local_ids.push_back(servers[i].id);
+        } else {
+            remote.push_back(servers[i]);
+        }
+    }
+    size_t n = _remote->RemoveServersInBatch(remote);
+    if (!local.empty()) {
+        n += _local->RemoveServersInBatch(local);
+        _db_local.Modify(RemoveLocal, local_ids);
+        _last_update_us.store(0, butil::memory_order_relaxed);
+    }
+    return n;
+}
+
+int ZoneAwareLoadBalancer::LocalShare() {
+    const int64_t now_us = butil::gettimeofday_us();
+    int64_t last_us = _last_update_us.load(butil::memory_order_relaxed);
+    if (now_us - last_us < HEALTH_CHECK_INTERVAL_US ||
+        !_last_update_us.compare_exchange_strong(
+            last_us, now_us, butil::memory_order_relaxed)) {
+        return _local_share.load(butil::memory_order_relaxed);
+    }
+    // Only one thread reaches here in each interval.
+    size_t total = 0;
+    size_t healthy = 0;
+    {
+        butil::DoublyBufferedData<LocalServers>::ScopedPtr s;
+        if (_db_local.Read(&s) != 0) {
+            return _local_share.load(butil::memory_order_relaxed);
+        }
+        for (butil::FlatSet<SocketId>::const_iterator
+                 it = s->ids.begin(); it != s->ids.end(); ++it) {
+            SocketUniquePtr ptr;
+            ++total;
+            healthy += IsServerAvailable(*it, &ptr);
+        }
+    }
+    int share = 0;
+    if (total != 0) {
+        const double ratio = (double)healthy / total / _min_healthy_ratio;
+        share = (ratio >= 1 ? FULL_SHARE : (int)(ratio * FULL_SHARE));
+    }
+    _local_share.store(share, butil::memory_order_relaxed);
+    return share;
+}
+
+int ZoneAwareLoadBalancer::SelectServer(const SelectIn& in, SelectOut* out) {
+    const int share = LocalShare();
+    const bool local_first = (share >= FULL_SHARE ||
+        (int)butil::fast_rand_less_than(FULL_SHARE) < share);
+    LoadBalancer* first = (local_first ? _local : _remote);
+    LoadBalancer* second = (local_first ? _remote : _local);
+    const int rc = first->SelectServer(in, out);
+    if (rc == 0) {
+        return 0;
+    }
+    const int rc2 = second->SelectServer(in, out);
+    if (rc2 == 0) {
+        return 0;
+    }
+    // Errors of the local zone make more sense to users.
+    return local_first ? rc : rc2;
+}
+
+void ZoneAwareLoadBalancer::Feedback(const CallInfo& info) {
+    bool local = false;
+    {
+        butil::DoublyBufferedData<LocalServers>::ScopedPtr s;
+        if (_db_local.Read(&s) != 0) {
+            return;
+        }
+        local = (s->ids.seek(info.server_id) != NULL);
+    }
+    if (local) {
+        _local->Feedback(info);
+    } else {
+        _remote->Feedback(info);
+    }
+}
+
+ZoneAwareLoadBalancer* ZoneAwareLoadBalancer::New(
+    const butil::StringPiece& params) const {
+    ZoneAwareLoadBalancer* lb = new (std::nothrow) ZoneAwareLoadBalancer;
+    if (lb && !lb->SetParameters(params)) {
+        delete lb;
+        lb = NULL;
+    }
+    return lb;
+}
+
+void ZoneAwareLoadBalancer::Destroy() {
+    delete this;
+}
+
+void ZoneAwareLoadBalancer::Describe(std::ostream& os,
+                                     const DescribeOptions& options) {
+    if (!options.verbose) {
+        os << "zone";
+        return;
+    }
+    os << "ZoneAware{local_zone=" << _local_zone
+       << " local_share=" << _local_share.load(butil::memory_order_relaxed)
+        / (FULL_SHARE / 100) << '%';
+    if (_local) {
+        os << " local=";
+        _local->Describe(os, options);
+    }
+    if (_remote) {
+        os << " remote=";
+        _remote->Describe(os, options);
+    }
+    os << '}';
+}
+
+bool ZoneAwareLoadBalancer::SetParameters(const butil::StringPiece& params) {
+    _local_zone = FLAGS_local_zone;
+    for (butil::KeyValuePairsSplitter sp(params.begin(), params.end(), ' ', '=');
+            sp; ++sp) {
+        if (sp.value().empty()) {
+            LOG(ERROR) << "Empty value for " << sp.key() << " in lb parameter";
+            return false;
+        }
+        if (sp.key() == "lb") {
+            _inner_name = sp.value().as_string();
+            continue;
+        }
+        if (sp.key() == "local_zone") {
+            _local_zone = sp.value().as_string();
+            continue;
+        }
+        if (sp.key() == "min_healthy_ratio") {
+            if (!butil::StringToDouble(sp.value().as_string(),
+                                       &_min_healthy_ratio) ||
+                _min_healthy_ratio <= 0 || _min_healthy_ratio > 1) {
+                LOG(ERROR) << "Invalid min_healthy_ratio=" << sp.value();
+                return false;
+            }
+            continue;
+        }
+        LOG(ERROR) << "Failed to set this unknown parameters " << sp.key_and_value();
+    }
+    const LoadBalancer* inner = LoadBalancerExtension()->Find(_inner_name.c_str());
+    if (inner == NULL || _inner_name == "zone") {
+        LOG(ERROR) << "Invalid inner load balancer `" << _inner_name << '\'';
+        return false;
+    }
+    _local = inner->New(butil::StringPiece());
+    _remote = inner->New(butil::StringPiece());
+    return _local != NULL && _remote != NULL;
+}
+
+}  // namespace policy
+} // namespace brpc
@@ -0,0 +1,88 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_POLICY_ZONE_AWARE_LOAD_BALANCER_H
+#define BRPC_POLICY_ZONE_AWARE_LOAD_BALANCER_H
+
+#include <string>                                       // std::string
+#include <vector>                                       // std::vector
+#include "butil/atomicops.h"
+#include "butil/containers/flat_map.h"                  // FlatSet
+#include "butil/containers/doubly_buffered_data.h"      // DoublyBufferedData
+#include "brpc/load_balancer.h"
+
+namespace brpc {
+namespace policy {
+
+DECLARE_string(local_zone);
+
+// Prefer servers in the same zone as this process. Tag of a server (e.g.
+// "10.0.0.1:8000 zone1" in list://) is its zone. Servers in the local zone
+// and in other zones are balanced by two instances of an inner load balancer
+// (e.g. la, rr, c_murmurhash) respectively. All traffic goes to the local
+// zone while at least `min_healthy_ratio' of local servers are healthy,
+// below which the traffic spills over to other zones proportionally, e.g.
+// half of the traffic spills over when half of `min_healthy_ratio' of local
+// servers are healthy. Calls failing to select a local server spill over
+// as well.
+class ZoneAwareLoadBalancer : public LoadBalancer {
+public:
+    ZoneAwareLoadBalancer();
+    ~ZoneAwareLoadBalancer();
+    bool AddServer(const ServerId& id) override;
+    bool RemoveServer(const ServerId& id) override;
+    size_t AddServersInBatch(const std::vector<ServerId>& servers) override;
+    size_t RemoveServersInBatch(const std::vector<ServerId>& servers) override;
+    int SelectServer(const SelectIn& in, SelectOut* out) override;
+    void Feedback(const CallInfo& info) override;
+    ZoneAwareLoadBalancer* New(const butil::StringPiece& params) const override;
+    void Destroy() override;
+    void Describe(std::ostream& os, const DescribeOptions&) override;
+
+private:
+    struct LocalServers {
+        butil::FlatSet<SocketId> ids;
+
+        LocalServers() {
+            if (ids.init(64) != 0) {
+                LOG(WARNING) << "Fail to init ids";
+            }
+        }
+    };
+    bool SetParameters(const butil::StringPiece& params);
+    bool IsLocal(const ServerId& id) const { return id.tag == _local_zone; }
+    // Permyriad of traffic to the local zone.
+    int LocalShare();
+    static size_t AddLocal(LocalServers& bg, const std::vector<SocketId>& ids);
+    static size_t RemoveLocal(LocalServers& bg,
+                              const std::vector<SocketId>& ids);
+
+    std::string _inner_name;
+    std::string _local_zone;
+    double _min_healthy_ratio;
+    LoadBalancer* _local;
+    LoadBalancer* _remote;
+    butil::DoublyBufferedData<LocalServers> _db_local;
+    butil::atomic<int> _local_share;
+    butil::atomic<int64_t> _last_update_us;
+};
+
+}  // namespace policy
+} // namespace brpc
+
+
+#endif  // BRPC_POLICY_ZONE_AWARE_LOAD_BALANCER_H
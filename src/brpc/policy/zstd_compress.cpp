@@ -0,0 +1,295 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#if BRPC_WITH_ZSTD
+
+#include <map>
+#include <gflags/gflags.h>
+#include <zstd.h>
+#include "butil/logging.h"
+#include "butil/thread_local.h"
+#include "brpc/policy/zstd_compress.h"
+#include "brpc/protocol.h"
+#include "brpc/compress.h"
+#include "brpc/reloadable_flags.h"
+
+namespace brpc {
+namespace policy {
+
+DEFINE_int32(zstd_compression_level, 3, "Compression level of zstd, "
+             "negative values are faster, 19 compresses best");
+BRPC_VALIDATE_GFLAG(zstd_compression_level, PassValidate);
+
+struct ZstdDictionary {
+    unsigned id;
+    std::string content;
+    ZSTD_CDict* cdict;
+    ZSTD_DDict* ddict;
+};
+
+// Registered before any RPC and never destroyed.
+static std::map<std::string, ZstdDictionary*>* s_dict_by_name = NULL;
+static std::map<unsigned, ZstdDictionary*>* s_dict_by_id = NULL;
+
+int RegisterZstdDictionary(const std::string& message_full_name,
+                           const std::string& dict) {
+    const unsigned id = ZSTD_getDictID_fromDict(dict.data(), dict.size());
+    if (id == 0) {
+        LOG(ERROR) << "Dictionary for " << message_full_name
+                   << " is not in zstd format";
+        return -1;
+    }
+    if (s_dict_by_name == NULL) {
+        s_dict_by_name = new std::map<std::string, ZstdDictionary*>;
+        s_dict_by_id = new std::map<unsigned, ZstdDictionary*>;
+    }
+    if (s_dict_by_name->count(message_full_name)) {
+        LOG(ERROR) << "Dictionary for " << message_full_name
+                   << " was registered";
+        return -1;
+    }
+    ZstdDictionary*& d = (*s_dict_by_id)[id];
+    if (d == NULL) {
+        ZSTD_CDict* cdict = ZSTD_createCDict(
+            dict.data(), dict.size(), FLAGS_zstd_compression_level);
+        ZSTD_DDict* ddict = ZSTD_createDDict(dict.data(), dict.size());
+        if (cdict == NULL || ddict == NULL) {
+            LOG(ERROR) << "Fail to load dictionary for " << message_full_name;
+            ZSTD_freeCDict(cdict);
+            ZSTD_freeDDict(ddict);
+            s_dict_by_id->erase(id);
+            return -1;
+        }
+        d = new ZstdDictionary{ id, dict, cdict, ddict };
+    } else if (d->content != dict) {
+        LOG(ERROR) << "Another dictionary with id=" << id
+                   << " was registered";
+        return -1;
+    }
+    (*s_dict_by_name)[message_full_name] = d;
+    return 0;
+}
+
+static const ZstdDictionary* FindDictionaryByName(const std::string& name) {
+    if (s_dict_by_name == NULL || name.empty()) {
+        return NULL;
+    }
+    std::map<std::string, ZstdDictionary*>::const_iterator
+        it = s_dict_by_name->find(name);
+    return it != s_dict_by_name->end() ? it->second : NULL;
+}
+
+// Contexts are expensive to create, reuse them in each thread.
+static __thread ZSTD_CCtx* tls_cctx = NULL;
+static __thread ZSTD_DCtx* tls_dctx = NULL;
+
+static void FreeCCtx(void* cctx) { ZSTD_freeCCtx((ZSTD_CCtx*)cctx); }
+static void FreeDCtx(void* dctx) { ZSTD_freeDCtx((ZSTD_DCtx*)dctx); }
+
+static ZSTD_CCtx* GetCCtx() {
+    if (tls_cctx == NULL) {
+        tls_cctx = ZSTD_createCCtx();
+        if (tls_cctx != NULL) {
+            butil::thread_atexit(FreeCCtx, tls_cctx);
+        }
+    }
+    return tls_cctx;
+}
+
+static ZSTD_DCtx* GetDCtx() {
+    if (tls_dctx == NULL) {
+        tls_dctx = ZSTD_createDCtx();
+        if (tls_dctx != NULL) {
+            butil::thread_atexit(FreeDCtx, tls_dctx);
+        }
+    }
+    return tls_dctx;
+}
+
+static bool NextOutput(butil::IOBufAsZeroCopyOutputStream* wrapper,
+                       ZSTD_outBuffer* output) {
+    if (output->pos < output->size) {
+        return true;
+    }
+    void* data = NULL;
+    int size = 0;
+    if (!wrapper->Next(&data, &size)) {
+        return false;
+    }
+    output->dst = data;
+    output->size = size;
+    output->pos = 0;
+    return true;
+}
+
+bool ZstdCompress(const butil::IOBuf& in, butil::IOBuf* out,
+                  const std::string& dict_name) {
+    ZSTD_CCtx* cctx = GetCCtx();
+    if (cctx == NULL) {
+        LOG(WARNING) << "Fail to create ZSTD_CCtx";
+        return false;
+    }
+    ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+    const ZstdDictionary* dict = FindDictionaryByName(dict_name);
+    if (dict != NULL) {
+        ZSTD_CCtx_refCDict(cctx, dict->cdict);
+    } else {
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                               FLAGS_zstd_compression_level);
+    }
+    ZSTD_CCtx_setPledgedSrcSize(cctx, in.size());
+
+    // Feed blocks of `in' one by one and compress into blocks of `out'
+    // directly, an extra round with empty input ends the frame.
+    butil::IOBufAsZeroCopyOutputStream wrapper(out);
+    ZSTD_outBuffer output = { NULL, 0, 0 };
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; i <= nblock; ++i) {
+        const butil::StringPiece blk =
+            (i < nblock ? in.backing_block(i) : butil::StringPiece());
+        const ZSTD_EndDirective mode = (i < nblock ? ZSTD_e_continue : ZSTD_e_end);
+        ZSTD_inBuffer input = { blk.data(), blk.size(), 0 };
+        while (true) {
+            if (!NextOutput(&wrapper, &output)) {
+                return false;
+            }
+            const size_t rc = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(rc)) {
+                LOG(WARNING) << "Fail to ZSTD_compressStream2: "
+                             << ZSTD_getErrorName(rc);
+                wrapper.BackUp(output.size - output.pos);
+                return false;
+            }
+            if (mode == ZSTD_e_end ? rc == 0 : input.pos == input.size) {
+                break;
+            }
+        }
+    }
+    wrapper.BackUp(output.size - output.pos);
+    return true;
+}
+
+bool ZstdDecompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    ZSTD_DCtx* dctx = GetDCtx();
+    if (dctx == NULL) {
+        LOG(WARNING) << "Fail to create ZSTD_DCtx";
+        return false;
+    }
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters);
+    // Size of the largest frame header, ZSTD_FRAMEHEADERSIZE_MAX is not
+    // exposed without ZSTD_STATIC_LINKING_ONLY.
+    char header[18];
+    const size_t header_size = in.copy_to(header, sizeof(header));
+    const unsigned dict_id = ZSTD_getDictID_fromFrame(header, header_size);
+    if (dict_id != 0) {
+        std::map<unsigned, ZstdDictionary*>::const_iterator it;
+        if (s_dict_by_id == NULL ||
+            (it = s_dict_by_id->find(dict_id)) == s_dict_by_id->end()) {
+            LOG(WARNING) << "Unknown zstd dictionary id=" << dict_id;
+            return false;
+        }
+        ZSTD_DCtx_refDDict(dctx, it->second->ddict);
+    }
+
+    butil::IOBufAsZeroCopyOutputStream wrapper(out);
+    ZSTD_outBuffer output = { NULL, 0, 0 };
+    // 0 when a frame is completely decoded and flushed.
+    size_t rc = 0;
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; i < nblock; ++i) {
+        const butil::StringPiece blk = in.backing_block(i);
+        ZSTD_inBuffer input = { blk.data(), blk.size(), 0 };
+        while (input.pos < input.size) {
+            if (!NextOutput(&wrapper, &output)) {
+                return false;
+            }
+            rc = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(rc)) {
+                LOG(WARNING) << "Fail to ZSTD_decompressStream: "
+                             << ZSTD_getErrorName(rc);
+                wrapper.BackUp(output.size - output.pos);
+                return false;
+            }
+        }
+    }
+    // Flush data buffered inside zstd due to lack of output space.
+    while (rc != 0) {
+        if (!NextOutput(&wrapper, &output)) {
+            return false;
+        }
+        const size_t old_pos = output.pos;
+        ZSTD_inBuffer input = { NULL, 0, 0 };
+        rc = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(rc) || (rc != 0 && output.pos == old_pos)) {
+            LOG(WARNING) << "Fail to decompress truncated zstd frame";
+            wrapper.BackUp(output.size - output.pos);
+            return false;
+        }
+    }
+    wrapper.BackUp(output.size - output.pos);
+    return true;
+}
+
+bool ZstdCompress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
+    const google::protobuf::Descriptor* type = msg.GetDescriptor();
+    butil::IOBuf serialized_pb;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
+    bool ok;
+    if (type == Serializer::descriptor()) {
+        const Serializer& serializer = (const Serializer&)msg;
+        type = serializer.message_descriptor();
+        ok = serializer.SerializeTo(&wrapper);
+    } else {
+        ok = msg.SerializeToZeroCopyStream(&wrapper);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to serialize input pb="
+                     << msg.GetDescriptor()->full_name();
+        return false;
+    }
+    ok = ZstdCompress(serialized_pb, buf,
+                      type ? type->full_name() : std::string());
+    if (!ok) {
+        LOG(WARNING) << "Fail to zstd compress, size=" << serialized_pb.size();
+    }
+    return ok;
+}
+
+bool ZstdDecompress(const butil::IOBuf& data, google::protobuf::Message* msg) {
+    butil::IOBuf binary_pb;
+    if (!ZstdDecompress(data, &binary_pb)) {
+        LOG(WARNING) << "Fail to zstd decompress, size=" << data.size();
+        return false;
+    }
+    bool ok;
+    butil::IOBufAsZeroCopyInputStream stream(binary_pb);
+    if (msg->GetDescriptor() == Deserializer::descriptor()) {
+        ok = ((Deserializer*)msg)->DeserializeFrom(&stream);
+    } else {
+        ok = msg->ParseFromZeroCopyStream(&stream);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to deserialize input message="
+                     << msg->GetDescriptor()->full_name();
+    }
+    return ok;
+}
+
+}  // namespace policy
+} // namespace brpc
+
+#endif  // BRPC_WITH_ZSTD
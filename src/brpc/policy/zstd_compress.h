@@ -0,0 +1,64 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_POLICY_ZSTD_COMPRESS_H
+#define BRPC_POLICY_ZSTD_COMPRESS_H
+
+#if BRPC_WITH_ZSTD
+
+#include <string>
+#include <google/protobuf/message.h>          // Message
+#include "butil/iobuf.h"                       // IOBuf
+
+
+namespace brpc {
+namespace policy {
+
+// Compress serialized `msg' into `buf'. If a dictionary was registered for
+// the type of `msg', it's used.
+bool ZstdCompress(const google::protobuf::Message& msg, butil::IOBuf* buf);
+
+// Parse `msg' from decompressed `buf'
+bool ZstdDecompress(const butil::IOBuf& data, google::protobuf::Message* msg);
+
+// Put compressed `in' into `out' with the dictionary registered for
+// `dict_name', or without any dictionary if `dict_name' is empty.
+bool ZstdCompress(const butil::IOBuf& in, butil::IOBuf* out,
+                  const std::string& dict_name = std::string());
+
+// Put decompressed `in' into `out'. The dictionary used by the compressing
+// side is found by the dictionary id in the frame header.
+bool ZstdDecompress(const butil::IOBuf& in, butil::IOBuf* out);
+
+// Register a dictionary in zstd format(generated by `zstd --train' or
+// ZDICT_trainFromBuffer()) for messages whose type is `message_full_name',
+// e.g. "example.EchoRequest". As request and response types are generally
+// specific to methods, this gives per-method dictionaries. Both sides of
+// the connection should register the same dictionaries because messages are
+// decompressed with the dictionary matching the id in zstd frames.
+// `dict' is compressed with -zstd_compression_level at registration.
+// [NOT thread-safe] Call this before any RPC using COMPRESS_TYPE_ZSTD.
+// Returns 0 on success, -1 otherwise.
+int RegisterZstdDictionary(const std::string& message_full_name,
+                           const std::string& dict);
+
+}  // namespace policy
+} // namespace brpc
+
+#endif  // BRPC_WITH_ZSTD
+
+#endif // BRPC_POLICY_ZSTD_COMPRESS_H
@@ -20,6 +20,7 @@
 #include "bthread/bthread.h"   // INVALID_BTHREAD_ID before bthread r32748
 #include "brpc/progressive_attachment.h"
 #include "brpc/socket.h"
+#include "brpc/details/http_response_queue.h"
 #include "brpc/errno.pb.h"
 
 
@@ -37,7 +38,8 @@ ProgressiveAttachment::ProgressiveAttachment(SocketUniquePtr& movable_httpsock,
     : _before_http_1_1(before_http_1_1)
     , _pause_from_mark_rpc_as_done(false)
     , _rpc_state(RPC_RUNNING)
-    , _notify_id(INVALID_BTHREAD_ID) {
+    , _notify_id(INVALID_BTHREAD_ID)
+    , _response_seq(0) {
     _httpsock.swap(movable_httpsock);
 }
 
@@ -45,16 +47,16 @@ ProgressiveAttachment::~ProgressiveAttachment() {
     if (_httpsock) {
         CHECK(_rpc_state.load(butil::memory_order_relaxed) != RPC_RUNNING);
         CHECK(_saved_buf.empty());
-        if (!_before_http_1_1) {
-            // note: _httpsock may already be failed.
-            if (_rpc_state.load(butil::memory_order_relaxed) == RPC_SUCCEED) {
-                butil::IOBuf tmpbuf;
-                tmpbuf.append("0\r\n\r\n", 5);
-                Socket::WriteOptions wopt;
-                wopt.ignore_eovercrowded = true;
-                _httpsock->Write(&tmpbuf, &wopt);
-            }
-        } else {
+        butil::IOBuf tmpbuf;
+        if (!_before_http_1_1 &&
+            _rpc_state.load(butil::memory_order_relaxed) == RPC_SUCCEED) {
+            tmpbuf.append("0\r\n\r\n", 5);
+        }
+        // note: _httpsock may already be failed.
+        // Finish the response even if nothing is written, otherwise
+        // responses of following pipelined requests are never written.
+        WriteToSocket(&tmpbuf, true, true);
+        if (_before_http_1_1) {
             // Close _httpsock to notify the client that all the content has
             // been transferred.
             // Note: invoke ReleaseAdditionalReference instead of SetFailed to
@@ -142,7 +144,7 @@ int ProgressiveAttachment::Write(const butil::IOBuf& data) {
     if (rpc_state == RPC_SUCCEED) {
         butil::IOBuf tmpbuf;
         AppendAsChunk(&tmpbuf, data, _before_http_1_1);
-        return _httpsock->Write(&tmpbuf);
+        return WriteToSocket(&tmpbuf, false, false);
     } else {
         errno = ECANCELED;
         return -1;
@@ -175,7 +177,7 @@ int ProgressiveAttachment::Write(const void* data, size_t n) {
     if (rpc_state == RPC_SUCCEED) {
         butil::IOBuf tmpbuf;
         AppendAsChunk(&tmpbuf, data, n, _before_http_1_1);
-        return _httpsock->Write(&tmpbuf);
+        return WriteToSocket(&tmpbuf, false, false);
     } else {
         errno = ECANCELED;
         return -1;
@@ -216,14 +218,28 @@ void ProgressiveAttachment::MarkRPCAsDone(bool rpc_failed) {
         butil::IOBuf copied;
         copied.swap(_saved_buf);
         mu.unlock();
-        Socket::WriteOptions wopt;
-        wopt.ignore_eovercrowded = true;
-        if (_httpsock->Write(&copied, &wopt) != 0) {
+        if (WriteToSocket(&copied, true, false) != 0) {
             permanent_error = true;
         }
     } while (true);
 }
 
+int ProgressiveAttachment::WriteToSocket(butil::IOBuf* data,
+                                         bool ignore_eovercrowded,
+                                         bool finished) {
+    Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = ignore_eovercrowded;
+    return WriteHttpResponse(_httpsock.get(), _response_seq, data,
+                             &wopt, finished);
+}
+
+void ProgressiveAttachment::Abort(int error_code) {
+    if (_httpsock) {
+        _httpsock->SetFailed(error_code, "Abort progressive attachment to %s",
+                             butil::endpoint2str(remote_side()).c_str());
+    }
+}
+
 butil::EndPoint ProgressiveAttachment::remote_side() const {
     return _httpsock ? _httpsock->remote_side() : butil::EndPoint();
 }
@@ -31,6 +31,7 @@ namespace brpc {
 
 class ProgressiveAttachment : public SharedObject {
 friend class Controller;
+friend class ControllerPrivateAccessor;
 public:
     // [Thread-safe]
     // Write `data' as one HTTP chunk to peer ASAP.
@@ -39,6 +40,13 @@ public:
     int Write(const butil::IOBuf& data);
     int Write(const void* data, size_t n);
 
+    // [Thread-safe]
+    // Close the connection without ending the attachment, so that the peer
+    // sees an incomplete response instead of a short but complete one.
+    // Following Write() fail. Note that responses before HTTP/1.1 end by
+    // closing the connection as well, they can't be told from complete ones.
+    void Abort(int error_code);
+
     // Get ip/port of peer/self.
     butil::EndPoint remote_side() const;
     butil::EndPoint local_side() const;
@@ -62,6 +70,10 @@ protected:
 
     // Called by controller only.
     void MarkRPCAsDone(bool rpc_failed);
+
+    // Write into _httpsock after responses of earlier pipelined requests.
+    int WriteToSocket(butil::IOBuf* data, bool ignore_eovercrowded,
+                      bool finished);
     
     bool _before_http_1_1;
     bool _pause_from_mark_rpc_as_done;
@@ -70,6 +82,8 @@ protected:
     SocketUniquePtr _httpsock;
     butil::IOBuf _saved_buf;
     bthread_id_t _notify_id;
+    // Position of the request on the connection, see HttpResponseQueue.
+    uint64_t _response_seq;
 
 private:
     static const int RPC_RUNNING;
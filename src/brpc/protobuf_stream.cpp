@@ -0,0 +1,131 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <google/protobuf/io/coded_stream.h>
+#include <gflags/gflags.h>
+#include "bthread/bthread.h"
+#include "brpc/errno.pb.h"
+#include "brpc/protocol.h"              // ParsePbFromIOBuf
+#include "brpc/protobuf_stream.h"
+
+namespace brpc {
+
+DECLARE_uint64(max_body_size);
+
+ProtobufStreamWriter::ProtobufStreamWriter(StreamId stream_id)
+    : _stream_id(stream_id) {}
+
+ProtobufStreamWriter::ProtobufStreamWriter(
+    const butil::intrusive_ptr<ProgressiveAttachment>& pa)
+    : _stream_id(INVALID_STREAM_ID)
+    , _pa(pa) {}
+
+int ProtobufStreamWriter::Write(const google::protobuf::Message& msg) {
+    butil::IOBuf buf;
+    if (_pa == NULL) {
+        butil::IOBufAsZeroCopyOutputStream wrapper(&buf);
+        if (!msg.SerializeToZeroCopyStream(&wrapper)) {
+            return EINVAL;
+        }
+        while (true) {
+            const int rc = StreamWrite(_stream_id, buf);
+            if (rc != EAGAIN) {
+                return rc;
+            }
+            const int rc2 = StreamWait(_stream_id, NULL);
+            if (rc2 != 0) {
+                return rc2;
+            }
+        }
+    }
+    {
+        butil::IOBufAsZeroCopyOutputStream wrapper(&buf);
+        google::protobuf::io::CodedOutputStream coded(&wrapper);
+        coded.WriteVarint32(msg.ByteSizeLong());
+        msg.SerializeWithCachedSizes(&coded);
+        if (coded.HadError()) {
+            return EINVAL;
+        }
+    }
+    while (_pa->Write(buf) != 0) {
+        if (errno != EOVERCROWDED) {
+            return errno;
+        }
+        // Wait for the connection to drain.
+        bthread_usleep(1000);
+    }
+    return 0;
+}
+
+// Decode varint32 at the front of `buf'.
+// Returns number of bytes of the varint, 0 if more bytes are needed, -1
+// if the varint is malformed.
+static int DecodeVarint32(const butil::IOBuf& buf, uint32_t* value) {
+    uint8_t bytes[5];
+    const size_t n = buf.copy_to(bytes, sizeof(bytes));
+    uint32_t v = 0;
+    for (size_t i = 0; i < n; ++i) {
+        v |= (uint32_t)(bytes[i] & 0x7F) << (7 * i);
+        if (!(bytes[i] & 0x80)) {
+            *value = v;
+            return i + 1;
+        }
+    }
+    return n < sizeof(bytes) ? 0 : -1;
+}
+
+butil::Status ProtobufProgressiveReaderBase::OnReadOnePart(
+    const void* data, size_t length) {
+    _buf.append(data, length);
+    while (!_buf.empty()) {
+        uint32_t size = 0;
+        const int nheader = DecodeVarint32(_buf, &size);
+        if (nheader == 0) {
+            break;
+        }
+        if (nheader < 0 || size > FLAGS_max_body_size) {
+            return butil::Status(EREQUEST, "Bad message size");
+        }
+        if (_buf.size() < nheader + size) {
+            break;
+        }
+        _buf.pop_front(nheader);
+        butil::IOBuf msg_buf;
+        _buf.cutn(&msg_buf, size);
+        if (!ParsePbFromIOBuf(mutable_message(), msg_buf)) {
+            return butil::Status(ERESPONSE, "Fail to parse message");
+        }
+        butil::Status st = OnMessageParsed();
+        if (!st.ok()) {
+            return st;
+        }
+    }
+    return butil::Status::OK();
+}
+
+void ProtobufProgressiveReaderBase::OnEndOfMessage(
+    const butil::Status& status) {
+    if (status.ok() && !_buf.empty()) {
+        _buf.clear();
+        return OnEnd(butil::Status(ERESPONSE, "Truncated message"));
+    }
+    _buf.clear();
+    return OnEnd(status);
+}
+
+} // namespace brpc
@@ -0,0 +1,156 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_PROTOBUF_STREAM_H
+#define BRPC_PROTOBUF_STREAM_H
+
+#include <google/protobuf/message.h>
+#include "butil/iobuf.h"
+#include "butil/intrusive_ptr.hpp"
+#include "butil/status.h"
+#include "brpc/stream.h"
+#include "brpc/progressive_attachment.h"
+#include "brpc/progressive_reader.h"
+
+namespace brpc {
+
+// Send a huge response as a sequence of protobuf messages (e.g. elements of
+// a repeated field) instead of one message, so that neither side builds or
+// buffers all of them at once.
+//
+// Over a Stream (baidu_std or gRPC streaming), every message is written as
+// one stream message, the writer waits when the remote side has not
+// consumed StreamOptions.max_buf_size bytes yet.
+//   Server:
+//     brpc::StreamId sd;
+//     brpc::StreamAccept(&sd, *cntl, NULL);
+//     done->Run();
+//     brpc::ProtobufStreamWriter w(sd);
+//     for (...) { w.Write(element); }
+//     brpc::StreamClose(sd);
+//   Client:
+//     class MyHandler : public brpc::ProtobufStreamHandler<Element> {
+//         int OnMessage(brpc::StreamId id, const Element& e) { ... }
+//         void on_idle_timeout(brpc::StreamId id) {}
+//         void on_closed(brpc::StreamId id) { ... }
+//     };
+//     stream_options.handler = &my_handler;
+//     brpc::StreamCreate(&sd, cntl, &stream_options);
+//
+// Over a ProgressiveAttachment (http), messages are written as
+// varint32-length-delimited bytes, which can be read progressively by
+// ProtobufProgressiveReader at the client side.
+class ProtobufStreamWriter {
+public:
+    explicit ProtobufStreamWriter(StreamId stream_id);
+    explicit ProtobufStreamWriter(
+        const butil::intrusive_ptr<ProgressiveAttachment>& pa);
+
+    // Serialize `msg' and write it. Block until the remote side has room
+    // for it.
+    // Returns 0 on success, error code otherwise.
+    int Write(const google::protobuf::Message& msg);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ProtobufStreamWriter);
+
+    StreamId _stream_id;
+    butil::intrusive_ptr<ProgressiveAttachment> _pa;
+};
+
+// Parse stream messages written by ProtobufStreamWriter. The message
+// passed to OnMessage() is reused and only valid during the call.
+template <typename T>
+class ProtobufStreamHandler : public StreamInputHandler {
+public:
+    // Called for each message in order.
+    // Non-zero return value closes the stream.
+    virtual int OnMessage(StreamId id, const T& msg) = 0;
+
+    // Called when a message can't be parsed, the stream is closed after.
+    virtual void OnParseError(StreamId id) {}
+
+    int on_received_messages(StreamId id, butil::IOBuf* const messages[],
+                             size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            _msg.Clear();
+            butil::IOBufAsZeroCopyInputStream wrapper(*messages[i]);
+            if (!_msg.ParseFromZeroCopyStream(&wrapper)) {
+                OnParseError(id);
+                StreamClose(id);
+                return -1;
+            }
+            if (OnMessage(id, _msg) != 0) {
+                StreamClose(id);
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+private:
+    T _msg;
+};
+
+// Base of ProtobufProgressiveReader<T>.
+class ProtobufProgressiveReaderBase : public ProgressiveReader {
+public:
+    butil::Status OnReadOnePart(const void* data, size_t length);
+    void OnEndOfMessage(const butil::Status& status);
+
+    // Called once when there's nothing to read anymore, `status' is OK iff
+    // all bytes were read and parsed. User can delete this object inside.
+    virtual void OnEnd(const butil::Status& status) = 0;
+
+protected:
+    // Parse the message into the one returned by mutable_message().
+    virtual google::protobuf::Message* mutable_message() = 0;
+    // Called for each message parsed. Non-OK status stops reading.
+    virtual butil::Status OnMessageParsed() = 0;
+
+    // Unparsed bytes.
+    butil::IOBuf _buf;
+};
+
+// Read length-delimited messages written by ProtobufStreamWriter from a
+// progressive attachment. Memory is bounded by the largest message.
+//   cntl.response_will_be_read_progressively();
+//   channel.CallMethod(..., &cntl, ...);
+//   cntl.ReadProgressiveAttachmentBy(new MyReader);
+// where MyReader implements OnMessage() and OnEnd().
+template <typename T>
+class ProtobufProgressiveReader : public ProtobufProgressiveReaderBase {
+public:
+    // Called for each message in order, the message is reused and only
+    // valid during the call. Non-OK status stops reading.
+    virtual butil::Status OnMessage(const T& msg) = 0;
+
+protected:
+    google::protobuf::Message* mutable_message() {
+        _msg.Clear();
+        return &_msg;
+    }
+    butil::Status OnMessageParsed() { return OnMessage(_msg); }
+
+private:
+    T _msg;
+};
+
+} // namespace brpc
+
+#endif  // BRPC_PROTOBUF_STREAM_H
@@ -34,8 +34,11 @@ const uint64_t PB_TOTAL_BYETS_LIMITS =
     PB_TOTAL_BYETS_LIMITS_RAW < 0 ? (uint64_t)-1LL : PB_TOTAL_BYETS_LIMITS_RAW;
 #endif
 
+#include <algorithm>
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include <google/protobuf/text_format.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/wire_format_lite.h>
 #include <gflags/gflags.h>
 #include "butil/logging.h"
 #include "butil/memory/singleton_on_pthread_once.h"
@@ -238,6 +241,170 @@ bool ParsePbFromIOBuf(google::protobuf::Message* msg, const butil::IOBuf& buf) {
     return ParsePbFromZeroCopyStreamInlined(msg, &stream);
 }
 
+static bool CutVarint64(butil::IOBufCutter* cutter, uint64_t* value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte;
+        if (!cutter->cut1(&byte)) {
+            return false;
+        }
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace {
+// A range of serialized pb which goes to the remaining message (index < 0)
+// or to the aliased field at `index'.
+struct PbSegment {
+    size_t offset;
+    size_t size;
+    int index;
+};
+}
+
+bool ParsePbFromIOBufWithAliasing(google::protobuf::Message* msg,
+                                  const butil::IOBuf& buf,
+                                  const std::vector<int>& field_numbers,
+                                  AliasedPbFields* aliased) {
+    typedef google::protobuf::internal::WireFormatLite WFL;
+    aliased->clear();
+    if (field_numbers.empty()) {
+        return ParsePbFromIOBuf(msg, buf);
+    }
+    // Find out ranges of fields by walking through tags and lengths only.
+    std::vector<PbSegment> segments;
+    {
+        butil::IOBuf data(buf);
+        butil::IOBufCutter cutter(&data);
+        while (cutter.remaining_bytes() > 0) {
+            const size_t field_begin = buf.size() - cutter.remaining_bytes();
+            uint64_t tag = 0;
+            if (!CutVarint64(&cutter, &tag) || tag > UINT32_MAX) {
+                return false;
+            }
+            const int number = WFL::GetTagFieldNumber((uint32_t)tag);
+            uint64_t value_size = 0;
+            int index = -1;
+            switch (WFL::GetTagWireType((uint32_t)tag)) {
+            case WFL::WIRETYPE_VARINT:
+                if (!CutVarint64(&cutter, &value_size)) {
+                    return false;
+                }
+                value_size = 0;
+                break;
+            case WFL::WIRETYPE_FIXED64:
+                value_size = 8;
+                break;
+            case WFL::WIRETYPE_FIXED32:
+                value_size = 4;
+                break;
+            case WFL::WIRETYPE_LENGTH_DELIMITED:
+                if (!CutVarint64(&cutter, &value_size)) {
+                    return false;
+                }
+                if (std::find(field_numbers.begin(), field_numbers.end(),
+                              number) != field_numbers.end()) {
+                    for (size_t i = 0; i < aliased->size(); ++i) {
+                        if ((*aliased)[i].first == number) {
+                            index = i;
+                            break;
+                        }
+                    }
+                    if (index < 0) {
+                        index = aliased->size();
+                        aliased->push_back(std::make_pair(number, butil::IOBuf()));
+                    }
+                }
+                break;
+            default:
+                // Groups are rare and deprecated, just parse normally.
+                aliased->clear();
+                return ParsePbFromIOBuf(msg, buf);
+            }
+            if (value_size > cutter.remaining_bytes()) {
+                return false;
+            }
+            const size_t value_begin = buf.size() - cutter.remaining_bytes();
+            cutter.pop_front(value_size);
+            PbSegment seg;
+            if (index >= 0) {
+                seg.offset = value_begin;
+                seg.size = value_size;
+            } else {
+                seg.offset = field_begin;
+                seg.size = value_begin + value_size - field_begin;
+            }
+            seg.index = index;
+            if (index < 0 && !segments.empty() && segments.back().index < 0 &&
+                segments.back().offset + segments.back().size == seg.offset) {
+                segments.back().size += seg.size;
+            } else {
+                segments.push_back(seg);
+            }
+        }
+    }
+    // Cut the ranges by reference.
+    butil::IOBuf rest;
+    butil::IOBuf data(buf);
+    butil::IOBufCutter cutter(&data);
+    size_t pos = 0;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const PbSegment& seg = segments[i];
+        cutter.pop_front(seg.offset - pos);
+        if (seg.index < 0) {
+            cutter.cutn(&rest, seg.size);
+        } else {
+            // The last one wins, same as protobuf.
+            butil::IOBuf* value = &(*aliased)[seg.index].second;
+            value->clear();
+            cutter.cutn(value, seg.size);
+        }
+        pos = seg.offset + seg.size;
+    }
+
+    butil::IOBufAsZeroCopyInputStream stream(rest);
+    google::protobuf::io::CodedInputStream decoder(&stream);
+    if (PB_TOTAL_BYETS_LIMITS < FLAGS_max_body_size) {
+#if GOOGLE_PROTOBUF_VERSION >= 3006000
+        decoder.SetTotalBytesLimit(INT_MAX);
+#else
+        decoder.SetTotalBytesLimit(INT_MAX, -1);
+#endif
+    }
+    if (!msg->ParsePartialFromCodedStream(&decoder) ||
+        !decoder.ConsumedEntireMessage()) {
+        return false;
+    }
+    if (msg->IsInitialized()) {
+        return true;
+    }
+    const google::protobuf::Descriptor* desc = msg->GetDescriptor();
+    std::vector<std::string> errors;
+    msg->FindInitializationErrors(&errors);
+    for (size_t i = 0; i < errors.size(); ++i) {
+        const google::protobuf::FieldDescriptor* field =
+            desc->FindFieldByName(errors[i]);
+        bool found = false;
+        for (size_t j = 0; field != NULL && j < aliased->size(); ++j) {
+            if ((*aliased)[j].first == field->number()) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            LOG(WARNING) << "Fail to parse " << desc->full_name()
+                         << ", missing required field `" << errors[i] << '\'';
+            return false;
+        }
+    }
+    return true;
+}
+
 bool ParsePbFromArray(google::protobuf::Message* msg,
                       const void* data, size_t size) {
     google::protobuf::io::ArrayInputStream stream(data, size);
@@ -209,6 +209,19 @@ bool ParsePbTextFromIOBuf(google::protobuf::Message* msg, const butil::IOBuf& bu
 bool ParsePbFromArray(google::protobuf::Message* msg, const void* data, size_t size);
 bool ParsePbFromString(google::protobuf::Message* msg, const std::string& str);
 
+// (field_number, value) of length-delimited fields cut out of serialized pb.
+typedef std::vector<std::pair<int, butil::IOBuf> > AliasedPbFields;
+
+// Parse `msg' from `buf' like ParsePbFromIOBuf() except that top-level
+// length-delimited fields numbered in `field_numbers' are not copied into
+// `msg'. Values of them are appended into `aliased' instead, referencing
+// blocks of `buf' without copying. The last value wins if a field appears
+// more than once. Missing required fields are not errors if they are aliased.
+bool ParsePbFromIOBufWithAliasing(google::protobuf::Message* msg,
+                                  const butil::IOBuf& buf,
+                                  const std::vector<int>& field_numbers,
+                                  AliasedPbFields* aliased);
+
 // Deleter for unique_ptr to print error_text of the controller when
 // -log_error_text is on, then delete the controller if `delete_cntl' is true
 class LogErrorTextAndDelete {
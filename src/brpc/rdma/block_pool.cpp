@@ -19,6 +19,7 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <vector>
 #include <gflags/gflags.h>
 #include "butil/fast_rand.h"
@@ -42,17 +43,27 @@ DEFINE_int32(rdma_memory_pool_tls_cache_num, 128, "Number of cached block in tls
 DEFINE_bool(rdma_memory_pool_user_specified_memory, false,
             "If true, the user must call UserExtendBlockPool() to extend "
             "memory. bRPC will not handle memory extension.");
+DEFINE_bool(rdma_memory_pool_use_hugepage, false,
+            "Back the regions extended by bRPC with 2MB hugepages, which "
+            "need to be reserved in advance (vm.nr_hugepages). Fall back to "
+            "normal pages if hugepages are not available");
 
 static RegisterCallback g_cb = NULL;
 
 // Number of bytes in 1MB
 static const size_t BYTES_IN_MB = 1048576;
 
+static const size_t HUGEPAGE_SIZE = 2 * BYTES_IN_MB;
+
 static const int BLOCK_DEFAULT = 0; // 8KB
 // static const int BLOCK_LARGE = 1;  // 64KB
 // static const int BLOCK_HUGE = 2;  // 2MB
-static const int BLOCK_SIZE_COUNT = 3;
-static size_t g_block_size[BLOCK_SIZE_COUNT] = { 8192, 65536, 2 * BYTES_IN_MB };
+// static const int BLOCK_MEDIUM = 3;  // 512KB
+// BLOCK_MEDIUM is appended after BLOCK_HUGE to keep the existing types
+// unchanged, so g_block_size is not sorted.
+static const int BLOCK_SIZE_COUNT = 4;
+static size_t g_block_size[BLOCK_SIZE_COUNT] =
+    { 8192, 65536, 2 * BYTES_IN_MB, 512 * 1024 };
 
 struct IdleNode {
     void* start;
@@ -61,15 +72,16 @@ struct IdleNode {
 };
 
 struct Region {
-    Region() { start = 0; }
+    Region() { start = 0; hugepage = false; }
     uintptr_t start;
     size_t size;
     uint32_t block_type;
     uint32_t id;  // lkey
+    bool hugepage;  // mmap-ed with MAP_HUGETLB
 };
 
 static const int32_t RDMA_MEMORY_POOL_MIN_REGIONS = 1;
-static const int32_t RDMA_MEMORY_POOL_MAX_REGIONS = 16;
+static const int32_t RDMA_MEMORY_POOL_MAX_REGIONS = 64;
 static Region g_regions[RDMA_MEMORY_POOL_MAX_REGIONS];
 static int g_region_num = 0;
 
@@ -83,14 +95,22 @@ static size_t g_buckets = 1;
 static bool g_dump_enable = false;
 static butil::Mutex* g_dump_mutex = NULL;
 
-// Only for default block size
-static __thread IdleNode* tls_idle_list = NULL;
-static __thread size_t tls_idle_num = 0;
+// Cached blocks of each block size in tls
+static __thread IdleNode* tls_idle_list[BLOCK_SIZE_COUNT] = { NULL };
+static __thread size_t tls_idle_num[BLOCK_SIZE_COUNT] = { 0 };
 static __thread bool tls_inited = false;
 static butil::Mutex* g_tls_info_mutex = NULL;
 static size_t g_tls_info_cnt = 0;
 static size_t* g_tls_info[1024];
 
+// rdma_memory_pool_tls_cache_num is the number of cached default blocks.
+// Larger blocks are cached with the same total bytes, so that 2MB blocks
+// are not cached by default.
+static inline size_t TlsCacheNum(int block_type) {
+    return (size_t)FLAGS_rdma_memory_pool_tls_cache_num *
+        g_block_size[BLOCK_DEFAULT] / g_block_size[block_type];
+}
+
 // For each block size, there are some buckets of idle list to reduce race.
 struct GlobalInfo {
     std::vector<IdleNode*> idle_list[BLOCK_SIZE_COUNT];
@@ -141,24 +161,37 @@ static bool CanExtendBlockRuntime(int block_type) {
            g_info->region_num[block_type] < 1;
 }
 
+static inline size_t HugepageAlign(size_t size) {
+    return (size + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+}
+
+static void FreeRegionMemory(void* region_base, size_t region_size,
+                             bool hugepage) {
+    if (hugepage) {
+        munmap(region_base, HugepageAlign(region_size));
+    } else {
+        free(region_base);
+    }
+}
+
 static void* ExtendBlockPoolImpl(void* region_base, size_t region_size,
-                                 int block_type) {
+                                 int block_type, bool hugepage) {
     if (CanExtendBlockRuntime(block_type) == false) {
         LOG(INFO) << "Runtime extend memory only support one bucket or region "
                      "num is zero for per block_type";
-        free(region_base);
+        FreeRegionMemory(region_base, region_size, hugepage);
         errno = ENOMEM;
         return NULL;
     }
     if (g_region_num == FLAGS_rdma_memory_pool_max_regions) {
         LOG(INFO) << "Memory pool reaches max regions";
-        free(region_base);
+        FreeRegionMemory(region_base, region_size, hugepage);
         errno = ENOMEM;
         return NULL;
     }
     uint32_t id = g_cb(region_base, region_size);
     if (id == 0) {
-        free(region_base);
+        FreeRegionMemory(region_base, region_size, hugepage);
         return NULL;
     }
 
@@ -170,7 +203,7 @@ static void* ExtendBlockPoolImpl(void* region_base, size_t region_size,
             for (size_t j = 0; j < i; ++j) {
                 butil::return_object<IdleNode>(node[j]);
             }
-            free(region_base);
+            FreeRegionMemory(region_base, region_size, hugepage);
             return NULL;
         }
     }
@@ -180,6 +213,7 @@ static void* ExtendBlockPoolImpl(void* region_base, size_t region_size,
     region->size = region_size;
     region->id = id;
     region->block_type = block_type;
+    region->hugepage = hugepage;
 
     for (size_t i = 0; i < g_buckets; ++i) {
         node[i]->start = (void*)(region->start + i * (region_size / g_buckets));
@@ -214,12 +248,25 @@ static void* ExtendBlockPool(size_t region_size, int block_type) {
     LOG(INFO) << "Start extend rdma memory " << region_size / BYTES_IN_MB << "MB";
 
     void* region_base = NULL;
-    if (posix_memalign(&region_base, 4096, region_size) != 0) {
+    bool hugepage = false;
+    if (FLAGS_rdma_memory_pool_use_hugepage) {
+        region_base = mmap(NULL, HugepageAlign(region_size),
+                           PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (region_base == MAP_FAILED) {
+            PLOG(WARNING) << "Fail to mmap hugepages, use normal pages instead";
+            region_base = NULL;
+        } else {
+            hugepage = true;
+        }
+    }
+    if (!region_base &&
+        posix_memalign(&region_base, 4096, region_size) != 0) {
         PLOG_EVERY_SECOND(ERROR) << "Memory not enough";
         return NULL;
     }
 
-    return ExtendBlockPoolImpl(region_base, region_size, block_type);
+    return ExtendBlockPoolImpl(region_base, region_size, block_type, hugepage);
 }
 
 void* ExtendBlockPoolByUser(void* region_base, size_t region_size,
@@ -240,7 +287,7 @@ void* ExtendBlockPoolByUser(void* region_base, size_t region_size,
         region_size * BYTES_IN_MB / g_block_size[block_type] / g_buckets;
     region_size *= g_block_size[block_type] * g_buckets;
 
-    return ExtendBlockPoolImpl(region_base, region_size, block_type);
+    return ExtendBlockPoolImpl(region_base, region_size, block_type, false);
 }
 
 bool InitBlockPool(RegisterCallback cb) {
@@ -339,13 +386,13 @@ static void* AllocBlockFrom(int block_type) {
         locked = true;
     }
     void* ptr = NULL;
-    if (block_type == 0 && tls_idle_list != NULL){
-        CHECK(tls_idle_num > 0);
-        IdleNode* n = tls_idle_list;
-        tls_idle_list = n->next;
+    if (tls_idle_list[block_type] != NULL) {
+        CHECK(tls_idle_num[block_type] > 0);
+        IdleNode* n = tls_idle_list[block_type];
+        tls_idle_list[block_type] = n->next;
         ptr = n->start;
         butil::return_object<IdleNode>(n);
-        tls_idle_num--;
+        tls_idle_num[block_type]--;
         if (locked) {
             g_dump_mutex->unlock();
         }
@@ -394,23 +441,25 @@ static void* AllocBlockFrom(int block_type) {
     }
 
     // Move more blocks from global list to tls list
-    if (block_type == 0) {
-        node = g_info->idle_list[0][index];
-        tls_idle_list = node;
+    const size_t cache_num = TlsCacheNum(block_type);
+    if (cache_num > 0) {
+        node = g_info->idle_list[block_type][index];
+        tls_idle_list[block_type] = node;
         IdleNode* last_node = NULL;
         while (node) {
-            if (tls_idle_num > (uint32_t)FLAGS_rdma_memory_pool_tls_cache_num / 2
-                    || node->len > g_block_size[0]) {
+            if (tls_idle_num[block_type] > cache_num / 2
+                    || node->len > g_block_size[block_type]) {
                 break;
             }
-            tls_idle_num++;
+            tls_idle_num[block_type]++;
+            g_info->idle_size[block_type][index] -= node->len;
             last_node = node;
             node = node->next;
         }
-        if (tls_idle_num == 0) {
-            tls_idle_list = NULL;
+        if (tls_idle_num[block_type] == 0) {
+            tls_idle_list[block_type] = NULL;
         } else {
-            g_info->idle_list[0][index] = node;
+            g_info->idle_list[block_type][index] = node;
         }
         if (last_node) {
             last_node->next = NULL;
@@ -424,33 +473,39 @@ static void* AllocBlockFrom(int block_type) {
 }
 
 void* AllocBlock(size_t size) {
-    if (size == 0 || size > g_block_size[BLOCK_SIZE_COUNT - 1]) {
-        errno = EINVAL;
-        return NULL;
-    }
+    // Use the smallest block which is large enough
+    int block_type = -1;
     for (int i = 0; i < BLOCK_SIZE_COUNT; ++i) {
-        if (size <= g_block_size[i]) {
-            return AllocBlockFrom(i);;
+        if (size <= g_block_size[i] &&
+            (block_type < 0 || g_block_size[i] < g_block_size[block_type])) {
+            block_type = i;
         }
     }
-    return NULL;
+    if (size == 0 || block_type < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return AllocBlockFrom(block_type);
 }
 
 void RecycleAll() {
-    // Only block_type == 0 needs recycle
-    while (tls_idle_list) {
-        IdleNode* node = tls_idle_list;
-        tls_idle_list = node->next;
-        Region* r = GetRegion(node->start);
-        if (!r) {
-            continue;
+    for (int t = 0; t < BLOCK_SIZE_COUNT; ++t) {
+        while (tls_idle_list[t]) {
+            IdleNode* node = tls_idle_list[t];
+            tls_idle_list[t] = node->next;
+            Region* r = GetRegion(node->start);
+            if (!r) {
+                continue;
+            }
+            uint64_t index =
+                ((uintptr_t)node->start - r->start) * g_buckets / r->size;
+            BAIDU_SCOPED_LOCK(*g_info->lock[t][index]);
+            node->next = g_info->idle_list[t][index];
+            g_info->idle_list[t][index] = node;
+            g_info->idle_size[t][index] += node->len;
         }
-        uint64_t index = ((uintptr_t)node->start - r->start) * g_buckets / r->size;
-        BAIDU_SCOPED_LOCK(*g_info->lock[0][index]);
-        node->next = g_info->idle_list[0][index];
-        g_info->idle_list[0][index] = node;
+        tls_idle_num[t] = 0;
     }
-    tls_idle_num = 0;
 }
 
 int DeallocBlock(void* buf) {
@@ -482,50 +537,41 @@ int DeallocBlock(void* buf) {
         g_dump_mutex->lock();
         locked = true;
     }
-    if (block_type == 0 && tls_idle_num < (uint32_t)FLAGS_rdma_memory_pool_tls_cache_num) {
+    const size_t cache_num = TlsCacheNum(block_type);
+    if (tls_idle_num[block_type] < cache_num) {
         if (!tls_inited) {
             tls_inited = true;
             butil::thread_atexit(RecycleAll);
             BAIDU_SCOPED_LOCK(*g_tls_info_mutex);
             if (g_tls_info_cnt < 1024) {
-                g_tls_info[g_tls_info_cnt++] = &tls_idle_num;
+                g_tls_info[g_tls_info_cnt++] = tls_idle_num;
             }
         }
-        tls_idle_num++;
-        node->next = tls_idle_list;
-        tls_idle_list = node;
+        tls_idle_num[block_type]++;
+        node->next = tls_idle_list[block_type];
+        tls_idle_list[block_type] = node;
         if (locked) {
             g_dump_mutex->unlock();
         }
         return 0;
     }
 
+    // Recycle this block together with half the cached blocks in tls
     uint64_t index = ((uintptr_t)buf - r->start) * g_buckets / r->size;
-    if (block_type == 0) {
-        size_t len = 0;
-        // Recycle half the cached blocks in tls for default block size
-        int num = FLAGS_rdma_memory_pool_tls_cache_num / 2;
-        IdleNode* new_head = tls_idle_list;
-        IdleNode* recycle_tail = NULL;
-        for (int i = 0; i < num; ++i) {
-            recycle_tail = new_head;
-            len += recycle_tail->len;
-            new_head = new_head->next;
-        }
-        if (recycle_tail) {
-            BAIDU_SCOPED_LOCK(*g_info->lock[0][index]);
-            recycle_tail->next = node;
-            node->next = g_info->idle_list[0][index];
-            g_info->idle_list[0][index] = tls_idle_list;
-            g_info->idle_size[0][index] += len;
-        }
-        tls_idle_list = new_head;
-        tls_idle_num -= num;
-    } else {
+    node->next = tls_idle_list[block_type];
+    IdleNode* recycle_tail = node;
+    size_t len = node->len;
+    for (size_t i = 0; i < cache_num / 2; ++i) {
+        recycle_tail = recycle_tail->next;
+        len += recycle_tail->len;
+    }
+    tls_idle_list[block_type] = recycle_tail->next;
+    tls_idle_num[block_type] -= cache_num / 2;
+    {
         BAIDU_SCOPED_LOCK(*g_info->lock[block_type][index]);
-        node->next = g_info->idle_list[block_type][index];
+        recycle_tail->next = g_info->idle_list[block_type][index];
         g_info->idle_list[block_type][index] = node;
-        g_info->idle_size[block_type][index] += node->len;
+        g_info->idle_size[block_type][index] += len;
     }
     if (locked) {
         g_dump_mutex->unlock();
@@ -562,7 +608,11 @@ void DumpMemoryPoolInfo(std::ostream& os) {
     }
     os << "Thread Local Cache Info:\n";
     for (size_t i = 0; i < g_tls_info_cnt; ++i) {
-        os << "\tThread " << i << ": " << *g_tls_info[i] * 8192 << "\n";
+        size_t len = 0;
+        for (int j = 0; j < BLOCK_SIZE_COUNT; ++j) {
+            len += g_tls_info[i][j] * GetBlockSize(j);
+        }
+        os << "\tThread " << i << ": " << len << "\n";
     }
     os << "******************************************************************\n";
     g_dump_enable = false;
@@ -588,7 +638,8 @@ void DestroyBlockPool() {
         if (g_regions[i].start == 0) {
             break;
         }
-        free((void*)g_regions[i].start);
+        FreeRegionMemory((void*)g_regions[i].start, g_regions[i].size,
+                         g_regions[i].hugepage);
         g_regions[i].start = 0;
     }
     g_region_num = 0;
@@ -46,13 +46,18 @@ namespace rdma {
 // to get the LKey of the region from the pool, which we call it region ID.
 //
 // Since IOBuf supports different block size, the block_pool also supports
-// several block sizes: 8KB(default), 64KB and 2MB. The block allocated to
-// the caller is the block with minimum size which is larger than the
-// applied size. For example, if the caller needs a buffer with a size of
-// 9KB, block_pool will allocate a 64KB-block for it. Please remember that
-// different-size blocks are in different regions.
+// several block sizes: 8KB(default), 64KB, 512KB and 2MB. The block
+// allocated to the caller is the block with minimum size which is larger
+// than the applied size. For example, if the caller needs a buffer with a
+// size of 9KB, block_pool will allocate a 64KB-block for it. Please remember
+// that different-size blocks are in different regions. Each thread caches
+// some idle blocks of every size except 2MB.
 //
-// Currently, the block_pool supports 16 regions at most. If there is more than
+// Regions extended by bRPC can be backed by 2MB hugepages if
+// rdma_memory_pool_use_hugepage is set, which reduces TLB misses of the
+// NIC and the CPU on large pools.
+//
+// Currently, the block_pool supports 64 regions at most. If there is more than
 // one region, the complexity of finding which region an address belongs to
 // is O(n). Here n is the number of regions. In order to avoid race conditions
 // among threads, we do not use more efficient search data structure.
@@ -17,11 +17,14 @@
 
 #if BRPC_WITH_RDMA
 
+#include <map>
 #include <gflags/gflags.h>
 #include "butil/fd_utility.h"
 #include "butil/logging.h"                   // CHECK, LOG
 #include "butil/sys_byteorder.h"             // HostToNet,NetToHost
+#include "butil/containers/doubly_buffered_data.h"
 #include "bthread/bthread.h"
+#include "bthread/unstable.h"                // bthread_set_worker_idlefn
 #include "brpc/errno.pb.h"
 #include "brpc/event_dispatcher.h"
 #include "brpc/input_messenger.h"
@@ -46,6 +49,8 @@ extern ibv_qp* (*IbvCreateQp)(ibv_pd*, ibv_qp_init_attr*);
 extern int (*IbvModifyQp)(ibv_qp*, ibv_qp_attr*, ibv_qp_attr_mask);
 extern int (*IbvQueryQp)(ibv_qp*, ibv_qp_attr*, ibv_qp_attr_mask, ibv_qp_init_attr*);
 extern int (*IbvDestroyQp)(ibv_qp*);
+extern ibv_srq* (*IbvCreateSrq)(ibv_pd*, ibv_srq_init_attr*);
+extern int (*IbvDestroySrq)(ibv_srq*);
 extern bool g_skip_rdma_init;
 
 DEFINE_int32(rdma_sq_size, 128, "SQ size for RDMA");
@@ -53,7 +58,8 @@ DEFINE_int32(rdma_rq_size, 128, "RQ size for RDMA");
 DEFINE_bool(rdma_recv_zerocopy, true, "Enable zerocopy for receive side");
 DEFINE_int32(rdma_zerocopy_min_size, 512, "The minimal size for receive zerocopy");
 DEFINE_string(rdma_recv_block_type, "default", "Default size type for recv WR: "
-              "default(8KB - 32B)/large(64KB - 32B)/huge(2MB - 32B)");
+              "default(8KB - 32B)/large(64KB - 32B)/medium(512KB - 32B)/"
+              "huge(2MB - 32B)");
 DEFINE_int32(rdma_cqe_poll_once, 32, "The maximum of cqe number polled once.");
 DEFINE_int32(rdma_prepared_qp_size, 128, "SQ and RQ size for prepared QP.");
 DEFINE_int32(rdma_prepared_qp_cnt, 1024, "Initial count of prepared QP.");
@@ -64,6 +70,30 @@ DEFINE_int32(rdma_poller_num, 1, "Poller number in RDMA polling mode.");
 DEFINE_bool(rdma_poller_yield, false, "Yield thread in RDMA polling mode.");
 DEFINE_bool(rdma_edisp_unsched, false, "Disable event dispatcher schedule");
 DEFINE_bool(rdma_disable_bthread, false, "Disable bthread in RDMA");
+DEFINE_bool(rdma_use_srq, false, "Share a Receive Queue among all QPs in a "
+            "poller group instead of posting rdma_rq_size recv WRs for each "
+            "QP. Only valid in polling mode, implies rdma_share_cq");
+DEFINE_int32(rdma_srq_size, 4096, "Number of recv WRs in the shared Receive "
+             "Queue of each poller group");
+DEFINE_bool(rdma_share_cq, false, "Share a CQ among all QPs of a poller "
+            "instead of creating a CQ for each QP. Only valid in polling mode");
+DEFINE_int32(rdma_shared_cq_size, 65536, "Size of the CQ shared by QPs of a "
+             "poller, which should hold all outstanding WRs of these QPs");
+DEFINE_int32(rdma_max_inline_data, 64, "Messages not larger than this many "
+             "bytes are copied into the send WR (IBV_SEND_INLINE), capped by "
+             "the device. 0 means disabled");
+DEFINE_int32(rdma_rendezvous_threshold, 0, "Messages not smaller than this "
+             "many bytes are read by the remote side with RDMA READ instead "
+             "of being sent in recv blocks, 0 means disabled. It must be "
+             "enabled at both sides");
+DEFINE_int32(rdma_worker_poll_us, 0, "In event mode, idle bthread workers "
+             "poll CQs which got completions within so many microseconds "
+             "before sleeping, instead of waiting for the comp channels. "
+             "<= 0 disables");
+DEFINE_int32(rdma_tcp_peer_cache_s, 0, "Clients skip the RDMA handshake to "
+             "servers which negotiated to use TCP within so many seconds, "
+             "which saves a roundtrip and QP allocation when reconnecting. "
+             "<= 0 disables");
 
 static const size_t IOBUF_BLOCK_HEADER_LEN = 32; // implementation-dependent
 
@@ -71,6 +101,18 @@ static const size_t IOBUF_BLOCK_HEADER_LEN = 32; // implementation-dependent
 // This is the number of reserved WRs in SQ/RQ for pure ACK.
 static const size_t RESERVED_WR_NUM = 3;
 
+// imm_data of a WR carrying a rendezvous descriptor has this bit set, other
+// bits are the ACK number as usual.
+static const uint32_t IMM_RENDEZVOUS = 0x80000000;
+// Extra SQ entries for RDMA READ WRs of rendezvous, which is also the maximum
+// number of outstanding RDMA READs of a QP.
+static const uint32_t RENDEZVOUS_READ_WR_NUM = 16;
+// Rendezvous descriptor:
+// segment number (4B)
+// for each segment: address (8B), length (4B), rkey (4B)
+static const size_t RENDEZVOUS_HEADER_LEN = 4;
+static const size_t RENDEZVOUS_SEGMENT_LEN = 16;
+
 // magic string RDMA (4B)
 // message length (2B)
 // hello version (2B)
@@ -90,7 +132,6 @@ static uint16_t g_rdma_hello_version = 2;
 static uint16_t g_rdma_impl_version = 1;
 static uint32_t g_rdma_recv_block_size = 0;
 
-// static const uint32_t MAX_INLINE_DATA = 64;
 static const uint8_t MAX_HOP_LIMIT = 16;
 static const uint8_t TIMEOUT = 14;
 static const uint8_t RETRY_CNT = 7;
@@ -98,10 +139,73 @@ static const uint16_t MIN_QP_SIZE = 16;
 static const uint16_t MAX_QP_SIZE = 4096;
 static const uint16_t MIN_BLOCK_SIZE = 1024;
 static const uint32_t ACK_MSG_RDMA_OK = 0x1;
+// The maximum number of send WRs posted with one doorbell
+static const int MAX_POST_WR_NUM = 16;
 
 static butil::Mutex* g_rdma_resource_mutex = NULL;
 static RdmaResource* g_rdma_resource_list = NULL;
 
+// Ids of sockets wrapping comp channels of CQs, polled by idle bthread
+// workers if -rdma_worker_poll_us > 0.
+typedef butil::DoublyBufferedData<std::vector<SocketId> > CqSidList;
+static CqSidList* g_worker_poll_cqs = NULL;
+
+// Servers which negotiated to use TCP recently, mapped to the time until
+// which clients connect to them with TCP directly.
+static butil::Mutex* g_tcp_peers_mutex = NULL;
+static std::map<butil::EndPoint, int64_t>* g_tcp_peers = NULL;
+
+static bool IsRecentTcpPeer(const butil::EndPoint& peer) {
+    if (!g_tcp_peers) {
+        return false;
+    }
+    BAIDU_SCOPED_LOCK(*g_tcp_peers_mutex);
+    std::map<butil::EndPoint, int64_t>::iterator it = g_tcp_peers->find(peer);
+    if (it == g_tcp_peers->end()) {
+        return false;
+    }
+    if (it->second < butil::gettimeofday_us()) {
+        // Try RDMA again in case that the server is upgraded
+        g_tcp_peers->erase(it);
+        return false;
+    }
+    return true;
+}
+
+static void AddTcpPeer(const butil::EndPoint& peer) {
+    if (!g_tcp_peers) {
+        return;
+    }
+    BAIDU_SCOPED_LOCK(*g_tcp_peers_mutex);
+    (*g_tcp_peers)[peer] = butil::gettimeofday_us() +
+        FLAGS_rdma_tcp_peer_cache_s * 1000000L;
+}
+
+static size_t AddCqSid(std::vector<SocketId>& bg, SocketId id) {
+    bg.push_back(id);
+    return 1;
+}
+
+static size_t RemoveCqSid(std::vector<SocketId>& bg, SocketId id) {
+    for (size_t i = 0; i < bg.size(); ++i) {
+        if (bg[i] == id) {
+            bg[i] = bg.back();
+            bg.pop_back();
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Completions of QPs are polled from CQs of pollers instead of their own CQs.
+static bool UseSharedCq() {
+    return FLAGS_rdma_use_polling && (FLAGS_rdma_share_cq || FLAGS_rdma_use_srq);
+}
+
+static bool UseSrq() {
+    return FLAGS_rdma_use_polling && FLAGS_rdma_use_srq;
+}
+
 struct HelloMessage {
     void Serialize(void* data) const;
     void Deserialize(void* data);
@@ -151,6 +255,7 @@ RdmaResource::RdmaResource()
     : qp(NULL)
     , cq(NULL)
     , comp_channel(NULL)
+    , max_inline_data(0)
     , next(NULL) { }
 
 RdmaResource::~RdmaResource() {
@@ -168,12 +273,109 @@ RdmaResource::~RdmaResource() {
     }
 }
 
+struct RdmaRendezvousRead {
+    struct Segment {
+        uint64_t addr;
+        uint32_t len;
+        uint32_t rkey;
+    };
+    // Blocks of the remote side
+    std::vector<Segment> remote;
+    size_t remote_index;
+    uint32_t remote_offset;
+    // Local blocks receiving the data
+    butil::IOBuf buf;
+    std::vector<ibv_sge> local;
+    size_t local_index;
+    uint32_t local_offset;
+    // Total bytes to read
+    size_t len;
+    // The number of outstanding RDMA READ WRs
+    uint32_t reads;
+};
+
+RdmaSharedRecvQueue::RdmaSharedRecvQueue() : srq(NULL) { }
+
+RdmaSharedRecvQueue::~RdmaSharedRecvQueue() {
+    if (srq) {
+        int err = IbvDestroySrq(srq);
+        if (err != 0) {
+            LOG(WARNING) << "Fail to destroy SRQ: " << berror(err);
+        }
+        srq = NULL;
+    }
+}
+
+// Post the recv WR of the index-th buffer to the SRQ.
+// If zerocopy is true, reallocate block.
+// Return 0 if success, -1 if failed and errno set
+static int PostSrqRecv(RdmaSharedRecvQueue* q, size_t index, bool zerocopy) {
+    if (zerocopy) {
+        q->bufs[index].clear();
+        butil::IOBufAsZeroCopyOutputStream os(&q->bufs[index],
+                g_rdma_recv_block_size + IOBUF_BLOCK_HEADER_LEN);
+        int size = 0;
+        if (!os.Next(&q->bufs_data[index], &size)) {
+            // Memory is not enough for preparing a block
+            PLOG(WARNING) << "Fail to allocate rbuf";
+            return -1;
+        } else {
+            CHECK(static_cast<uint32_t>(size) == g_rdma_recv_block_size) << size;
+        }
+    }
+
+    ibv_recv_wr wr;
+    memset(&wr, 0, sizeof(wr));
+    ibv_sge sge;
+    sge.addr = (uint64_t)q->bufs_data[index];
+    sge.length = g_rdma_recv_block_size;
+    sge.lkey = GetRegionId(q->bufs_data[index]);
+    wr.wr_id = index + 1;
+    wr.num_sge = 1;
+    wr.sg_list = &sge;
+
+    ibv_recv_wr* bad = NULL;
+    int err = ibv_post_srq_recv(q->srq, &wr, &bad);
+    if (err != 0) {
+        q->bufs[index].clear();
+        LOG(WARNING) << "Fail to ibv_post_srq_recv: " << berror(err);
+        return -1;
+    }
+    return 0;
+}
+
+static RdmaSharedRecvQueue* CreateSharedRecvQueue() {
+    std::unique_ptr<RdmaSharedRecvQueue> q(
+        new (std::nothrow) RdmaSharedRecvQueue);
+    if (!q) {
+        return NULL;
+    }
+    ibv_srq_init_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.attr.max_wr = FLAGS_rdma_srq_size;
+    attr.attr.max_sge = 1;
+    q->srq = IbvCreateSrq(GetRdmaPd(), &attr);
+    if (!q->srq) {
+        PLOG(WARNING) << "Fail to create SRQ";
+        return NULL;
+    }
+    q->bufs.resize(FLAGS_rdma_srq_size);
+    q->bufs_data.resize(FLAGS_rdma_srq_size, NULL);
+    for (size_t i = 0; i < q->bufs.size(); ++i) {
+        if (PostSrqRecv(q.get(), i, true) < 0) {
+            return NULL;
+        }
+    }
+    return q.release();
+}
+
 RdmaEndpoint::RdmaEndpoint(Socket* s)
     : _socket(s)
     , _state(UNINIT)
     , _resource(NULL)
     , _cq_events(0)
     , _cq_sid(INVALID_SOCKET_ID)
+    , _srq(NULL)
     , _sq_size(FLAGS_rdma_sq_size)
     , _rq_size(FLAGS_rdma_rq_size)
     , _sbuf()
@@ -191,6 +393,10 @@ RdmaEndpoint::RdmaEndpoint(Socket* s)
     , _remote_window_capacity(0)
     , _window_size(0)
     , _new_rq_wrs(0)
+    , _rdv_read(NULL)
+    , _rdv_pending(false)
+    , _rdv_slot(0)
+    , _last_cqe_us(0)
 {
     if (_sq_size < MIN_QP_SIZE) {
         _sq_size = MIN_QP_SIZE;
@@ -231,6 +437,10 @@ void RdmaEndpoint::Reset() {
     _new_rq_wrs = 0;
     _sq_sent = 0;
     _rq_received = 0;
+    delete _rdv_read;
+    _rdv_read = NULL;
+    _rdv_pending.store(false, butil::memory_order_relaxed);
+    _rdv_slot = 0;
 }
 
 void RdmaConnect::StartConnect(const Socket* socket,
@@ -241,7 +451,7 @@ void RdmaConnect::StartConnect(const Socket* socket,
     if (Socket::Address(socket->id(), &s) != 0) {
         return;
     }
-    if (!IsRdmaAvailable()) {
+    if (!IsRdmaAvailable() || IsRecentTcpPeer(socket->remote_side())) {
         socket->_rdma_ep->_state = RdmaEndpoint::FALLBACK_TCP;
         s->_rdma_state = Socket::RDMA_OFF;
         done(0, data);
@@ -507,6 +717,7 @@ void* RdmaEndpoint::ProcessHandshakeAtClient(void* arg) {
         LOG(WARNING) << "Fail to negotiate with server, fallback to tcp:"
                      << s->description();
         s->_rdma_state = Socket::RDMA_OFF;
+        AddTcpPeer(s->remote_side());
     } else {
         ep->_remote_recv_block_size = remote_msg.block_size;
         ep->_local_window_capacity = 
@@ -716,7 +927,8 @@ bool RdmaEndpoint::IsWritable() const {
         return false;
     }
 
-    return _window_size.load(butil::memory_order_relaxed) > 0;
+    return _window_size.load(butil::memory_order_relaxed) > 0 &&
+        !_rdv_pending.load(butil::memory_order_acquire);
 }
 
 // RdmaIOBuf inherits from IOBuf to provide a new function.
@@ -725,10 +937,11 @@ class RdmaIOBuf : public butil::IOBuf {
 friend class RdmaEndpoint;
 private:
     // Cut the current IOBuf to ibv_sge list and `to' for at most first max_sge
-    // blocks or first max_len bytes.
+    // blocks or first max_len bytes. `device' is set if any block is in
+    // device memory.
     // Return: the bytes included in the sglist, or -1 if failed
     ssize_t cut_into_sglist_and_iobuf(ibv_sge* sglist, size_t* sge_index,
-            butil::IOBuf* to, size_t max_sge, size_t max_len) {
+            butil::IOBuf* to, size_t max_sge, size_t max_len, bool* device) {
         size_t len = 0;
         while (*sge_index < max_sge) {
             if (len == max_len || _ref_num() == 0) {
@@ -742,6 +955,9 @@ private:
                 uint64_t meta = get_first_data_meta();
                 if (meta <= UINT_MAX) {
                     lkey = (uint32_t)meta;
+                } else if (meta & DEVICE_MEMORY_META) {
+                    lkey = (uint32_t)meta;
+                    *device = true;
                 }
             }
             if (BAIDU_UNLIKELY(lkey == 0)) {  // only happens when meta is not specified
@@ -787,12 +1003,14 @@ ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
     size_t total_len = 0;
     size_t current = 0;
     uint32_t window = 0;
-    ibv_send_wr wr;
     int max_sge = GetRdmaMaxSge();
-    ibv_sge sglist[max_sge];
+    // WRs are linked and posted together to ring the doorbell once
+    ibv_send_wr wrs[MAX_POST_WR_NUM];
+    ibv_sge sglists[MAX_POST_WR_NUM * max_sge];
+    int nwr = 0;
     while (current < ndata) {
         window = _window_size.load(butil::memory_order_relaxed);
-        if (window == 0) {
+        if (window == 0 || _rdv_pending.load(butil::memory_order_acquire)) {
             if (total_len > 0) {
                 break;
             } else {
@@ -800,6 +1018,14 @@ ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
                 return -1;
             }
         }
+        if (nwr == MAX_POST_WR_NUM) {
+            if (PostSendWrs(wrs) < 0) {
+                return -1;
+            }
+            nwr = 0;
+        }
+        ibv_send_wr& wr = wrs[nwr];
+        ibv_sge* sglist = sglists + nwr * max_sge;
         butil::IOBuf* to = &_sbuf[_sq_current];
         size_t this_len = 0;
 
@@ -809,7 +1035,21 @@ ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
 
         RdmaIOBuf* data = (RdmaIOBuf*)from[current];
         size_t sge_index = 0;
-        while (sge_index < (uint32_t)max_sge &&
+        bool rendezvous = false;
+        bool device = false;
+        if (FLAGS_rdma_rendezvous_threshold > 0 &&
+            data->size() >= (size_t)FLAGS_rdma_rendezvous_threshold) {
+            ssize_t len = CutRendezvous(data, to, sglist, &sge_index);
+            if (len < 0) {
+                return -1;
+            }
+            if (len > 0) {
+                rendezvous = true;
+                this_len = len;
+                total_len += len;
+            }
+        }
+        while (!rendezvous && sge_index < (uint32_t)max_sge &&
                 this_len < _remote_recv_block_size) {
             if (data->size() == 0) {
                 // The current IOBuf is empty, find next one
@@ -823,7 +1063,7 @@ ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
 
             ssize_t len = data->cut_into_sglist_and_iobuf(
                     sglist, &sge_index, to, max_sge,
-                    _remote_recv_block_size - this_len);
+                    _remote_recv_block_size - this_len, &device);
             if (len < 0) {
                 return -1;
             }
@@ -836,12 +1076,18 @@ ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
         }
 
         wr.num_sge = sge_index;
+        if (this_len <= _resource->max_inline_data && !rendezvous && !device) {
+            // The data is copied by the CPU when posting, which saves
+            // a DMA read of the blocks. Device memory is not accessible
+            // to the CPU.
+            wr.send_flags |= IBV_SEND_INLINE;
+        }
 
         uint32_t imm = _new_rq_wrs.exchange(0, butil::memory_order_relaxed);
-        wr.imm_data = butil::HostToNet32(imm);
+        wr.imm_data = butil::HostToNet32(rendezvous ? (imm | IMM_RENDEZVOUS) : imm);
         // Avoid too much recv completion event to reduce the cpu overhead
         bool solicited = false;
-        if (window == 1 || current + 1 >= ndata) {
+        if (window == 1 || current + 1 >= ndata || rendezvous) {
             // Only last message in the write queue or last message in the
             // current window will be flagged as solicited.
             solicited = true;
@@ -877,18 +1123,19 @@ ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
             _sq_unsignaled = 0;
         }
 
-        ibv_send_wr* bad = NULL;
-        int err = ibv_post_send(_resource->qp, &wr, &bad);
-        if (err != 0) {
-            // We use other way to guarantee the Send Queue is not full.
-            // So we just consider this error as an unrecoverable error.
-            LOG(WARNING) << "Fail to ibv_post_send: " << berror(err)
-                         << ", window=" << window
-                         << ", sq_current=" << _sq_current;
-            errno = err;
-            return -1;
+        if (rendezvous) {
+            // Nothing is sent after the rendezvous until the remote side
+            // reads the data and acks the WR, so that the data is received
+            // in order and the blocks being read are held by _sbuf.
+            _rdv_slot = _sq_current;
+            _rdv_pending.store(true, butil::memory_order_release);
         }
 
+        if (nwr > 0) {
+            wrs[nwr - 1].next = &wr;
+        }
+        ++nwr;
+
         ++_sq_current;
         if (_sq_current == _sq_size - RESERVED_WR_NUM) {
             _sq_current = 0;
@@ -901,9 +1148,27 @@ ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
         _window_size.fetch_sub(1, butil::memory_order_relaxed);
     }
 
+    if (nwr > 0 && PostSendWrs(wrs) < 0) {
+        return -1;
+    }
     return total_len;
 }
 
+int RdmaEndpoint::PostSendWrs(ibv_send_wr* wr) {
+    ibv_send_wr* bad = NULL;
+    int err = ibv_post_send(_resource->qp, wr, &bad);
+    if (err != 0) {
+        // We use other way to guarantee the Send Queue is not full.
+        // So we just consider this error as an unrecoverable error.
+        LOG(WARNING) << "Fail to ibv_post_send: " << berror(err)
+                     << ", window=" << _window_size.load(butil::memory_order_relaxed)
+                     << ", sq_current=" << _sq_current;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
 int RdmaEndpoint::SendAck(int num) {
     if (_new_rq_wrs.fetch_add(num, butil::memory_order_relaxed) > _remote_window_capacity / 2) {
         return SendImm(_new_rq_wrs.exchange(0, butil::memory_order_relaxed));
@@ -941,27 +1206,73 @@ ssize_t RdmaEndpoint::HandleCompletion(ibv_wc& wc) {
         // Do nothing
         break;
     }
+    case IBV_WC_RDMA_READ: {  // rendezvous read completion
+        CHECK(_rdv_read != NULL);
+        --_rdv_read->reads;
+        if (PostRendezvousReads() < 0) {
+            return -1;
+        }
+        if (_rdv_read->reads > 0) {
+            break;
+        }
+        const size_t len = _rdv_read->len;
+        _rdv_read->buf.cutn(&_socket->_read_buf, len);
+        delete _rdv_read;
+        _rdv_read = NULL;
+        // Ack the WR of the descriptor right now, the remote side does not
+        // send anything before getting it.
+        _new_rq_wrs.fetch_add(1, butil::memory_order_relaxed);
+        if (SendImm(_new_rq_wrs.exchange(0, butil::memory_order_relaxed)) < 0) {
+            return -1;
+        }
+        return len;
+    }
     case IBV_WC_RECV: {  // recv completion
+        const uint32_t imm = butil::NetToHost32(wc.imm_data);
+        const bool rendezvous = (imm & IMM_RENDEZVOUS);
         // Please note that only the first wc.byte_len bytes is valid
-        if (wc.byte_len > 0) {
+        if (rendezvous) {
+            void* desc = _srq ? _srq->bufs_data[wc.wr_id - 1]
+                              : _rbuf_data[_rq_received];
+            if (StartRendezvousRead(desc, wc.byte_len) < 0) {
+                return -1;
+            }
+            // The block is reused
+            zerocopy = false;
+        } else if (wc.byte_len > 0) {
             if (wc.byte_len < (uint32_t)FLAGS_rdma_zerocopy_min_size) {
                 zerocopy = false;
             }
             CHECK(_state != FALLBACK_TCP);
+            butil::IOBuf* buf = NULL;
+            void* buf_data = NULL;
+            if (_srq) {
+                buf = &_srq->bufs[wc.wr_id - 1];
+                buf_data = _srq->bufs_data[wc.wr_id - 1];
+            } else {
+                buf = &_rbuf[_rq_received];
+                buf_data = _rbuf_data[_rq_received];
+            }
             if (zerocopy) {
                 butil::IOBuf tmp;
-                _rbuf[_rq_received].cutn(&tmp, wc.byte_len);
+                buf->cutn(&tmp, wc.byte_len);
                 _socket->_read_buf.append(tmp);
             } else {
                 // Copy data when the receive data is really small
-                _socket->_read_buf.append(_rbuf_data[_rq_received], wc.byte_len);
+                _socket->_read_buf.append(buf_data, wc.byte_len);
             }
         }
-        if (wc.imm_data > 0) {
+        const uint32_t acks = (imm & ~IMM_RENDEZVOUS);
+        if (acks > 0) {
             // Clear sbuf here because we ignore event wakeup for send completions
-            uint32_t acks = butil::NetToHost32(wc.imm_data);
+            const bool rendezvous_pending =
+                _rdv_pending.load(butil::memory_order_acquire);
+            bool rendezvous_read = false;
             uint32_t num = acks;
             while (num > 0) {
+                if (rendezvous_pending && _sq_sent == _rdv_slot) {
+                    rendezvous_read = true;
+                }
                 _sbuf[_sq_sent++].clear();
                 if (_sq_sent == _sq_size - RESERVED_WR_NUM) {
                     _sq_sent = 0;
@@ -969,20 +1280,31 @@ ssize_t RdmaEndpoint::HandleCompletion(ibv_wc& wc) {
                 --num;
             }
             butil::subtle::MemoryBarrier();
+            if (rendezvous_read) {
+                _rdv_pending.store(false, butil::memory_order_release);
+            }
 
             // Update window
             uint32_t wnd_thresh = _local_window_capacity / 8;
             if (_window_size.fetch_add(acks, butil::memory_order_relaxed) >= wnd_thresh
-                    || acks >= wnd_thresh) {
+                    || acks >= wnd_thresh || rendezvous_read) {
                 // Do not wake up writing thread right after _window_size > 0.
                 // Otherwise the writing thread may switch to background too quickly.
                 _socket->WakeAsEpollOut();
             }
         }
         // We must re-post recv WR
-        if (PostRecv(1, zerocopy) < 0) {
+        if (_srq) {
+            if (PostSrqRecv(_srq, wc.wr_id - 1, zerocopy) < 0) {
+                return -1;
+            }
+        } else if (PostRecv(1, zerocopy) < 0) {
             return -1;
         }
+        if (rendezvous) {
+            // Acked after the data is read
+            return 0;
+        }
         if (wc.byte_len > 0) {
             SendAck(1);
         }
@@ -998,6 +1320,176 @@ ssize_t RdmaEndpoint::HandleCompletion(ibv_wc& wc) {
     return 0;
 }
 
+ssize_t RdmaEndpoint::CutRendezvous(butil::IOBuf* data, butil::IOBuf* to,
+                                    ibv_sge* sglist, size_t* sge_index) {
+    butil::IOBuf desc;
+    butil::IOBufAsZeroCopyOutputStream os(&desc,
+            g_rdma_recv_block_size + IOBUF_BLOCK_HEADER_LEN);
+    void* block = NULL;
+    int size = 0;
+    if (!os.Next(&block, &size)) {
+        PLOG(WARNING) << "Fail to allocate block for rendezvous";
+        return -1;
+    }
+    const size_t max_segments = (std::min((uint32_t)size, _remote_recv_block_size)
+            - RENDEZVOUS_HEADER_LEN) / RENDEZVOUS_SEGMENT_LEN;
+    char* p = (char*)block + RENDEZVOUS_HEADER_LEN;
+    uint32_t nseg = 0;
+    size_t len = 0;
+    for (; nseg < max_segments && nseg < data->backing_block_num(); ++nseg) {
+        butil::StringPiece seg = data->backing_block(nseg);
+        const uint32_t rkey = GetRKey(seg.data());
+        if (rkey == 0) {
+            // Not in the memory pool, e.g. user data
+            break;
+        }
+        const uint64_t addr = butil::HostToNet64((uint64_t)seg.data());
+        const uint32_t seg_len = butil::HostToNet32(seg.size());
+        const uint32_t seg_rkey = butil::HostToNet32(rkey);
+        memcpy(p, &addr, 8);
+        memcpy(p + 8, &seg_len, 4);
+        memcpy(p + 12, &seg_rkey, 4);
+        p += RENDEZVOUS_SEGMENT_LEN;
+        len += seg.size();
+    }
+    if (len < (size_t)FLAGS_rdma_rendezvous_threshold) {
+        return 0;
+    }
+    const uint32_t nseg_n = butil::HostToNet32(nseg);
+    memcpy(block, &nseg_n, 4);
+    const size_t desc_len = p - (char*)block;
+    os.BackUp(size - desc_len);
+
+    // `to' holds the blocks being read until the descriptor is acked.
+    data->cutn(to, len);
+    sglist[*sge_index].addr = (uint64_t)block;
+    sglist[*sge_index].length = desc_len;
+    sglist[*sge_index].lkey = GetRegionId(block);
+    ++*sge_index;
+    to->append(desc);
+    return len;
+}
+
+int RdmaEndpoint::StartRendezvousRead(const void* desc, uint32_t len) {
+    if (FLAGS_rdma_rendezvous_threshold <= 0) {
+        LOG(WARNING) << "Got a rendezvous while rdma_rendezvous_threshold is "
+                     << "disabled";
+        errno = EPROTO;
+        return -1;
+    }
+    CHECK(_rdv_read == NULL);
+    uint32_t nseg = 0;
+    if (len < RENDEZVOUS_HEADER_LEN) {
+        errno = EPROTO;
+        return -1;
+    }
+    memcpy(&nseg, desc, 4);
+    nseg = butil::NetToHost32(nseg);
+    if (nseg == 0 ||
+        len != RENDEZVOUS_HEADER_LEN + nseg * RENDEZVOUS_SEGMENT_LEN) {
+        LOG(WARNING) << "Invalid rendezvous descriptor";
+        errno = EPROTO;
+        return -1;
+    }
+
+    std::unique_ptr<RdmaRendezvousRead> r(new (std::nothrow) RdmaRendezvousRead);
+    if (!r) {
+        errno = ENOMEM;
+        return -1;
+    }
+    r->remote.resize(nseg);
+    r->len = 0;
+    const char* p = (const char*)desc + RENDEZVOUS_HEADER_LEN;
+    for (uint32_t i = 0; i < nseg; ++i) {
+        RdmaRendezvousRead::Segment& seg = r->remote[i];
+        memcpy(&seg.addr, p, 8);
+        memcpy(&seg.len, p + 8, 4);
+        memcpy(&seg.rkey, p + 12, 4);
+        seg.addr = butil::NetToHost64(seg.addr);
+        seg.len = butil::NetToHost32(seg.len);
+        seg.rkey = butil::NetToHost32(seg.rkey);
+        p += RENDEZVOUS_SEGMENT_LEN;
+        r->len += seg.len;
+    }
+
+    // Prepare local blocks as receiving a large message in recv blocks
+    butil::IOBufAsZeroCopyOutputStream os(&r->buf,
+            g_rdma_recv_block_size + IOBUF_BLOCK_HEADER_LEN);
+    size_t allocated = 0;
+    while (allocated < r->len) {
+        void* block = NULL;
+        int size = 0;
+        if (!os.Next(&block, &size)) {
+            PLOG(WARNING) << "Fail to allocate blocks for rendezvous";
+            return -1;
+        }
+        ibv_sge sge;
+        sge.addr = (uint64_t)block;
+        sge.length = size;
+        sge.lkey = GetRegionId(block);
+        r->local.push_back(sge);
+        allocated += size;
+    }
+    r->remote_index = 0;
+    r->remote_offset = 0;
+    r->local_index = 0;
+    r->local_offset = 0;
+    r->reads = 0;
+    _rdv_read = r.release();
+    return PostRendezvousReads();
+}
+
+int RdmaEndpoint::PostRendezvousReads() {
+    RdmaRendezvousRead* r = _rdv_read;
+    const int max_sge = GetRdmaMaxSge();
+    ibv_sge sglist[max_sge];
+    while (r->reads < RENDEZVOUS_READ_WR_NUM &&
+           r->remote_index < r->remote.size()) {
+        const RdmaRendezvousRead::Segment& seg = r->remote[r->remote_index];
+        // Read the remote segment into at most max_sge local blocks
+        uint32_t len = 0;
+        int sge_index = 0;
+        while (sge_index < max_sge && r->remote_offset + len < seg.len) {
+            const ibv_sge& local = r->local[r->local_index];
+            const uint32_t n = std::min(local.length - r->local_offset,
+                                        seg.len - r->remote_offset - len);
+            sglist[sge_index].addr = local.addr + r->local_offset;
+            sglist[sge_index].length = n;
+            sglist[sge_index].lkey = local.lkey;
+            ++sge_index;
+            len += n;
+            r->local_offset += n;
+            if (r->local_offset == local.length) {
+                ++r->local_index;
+                r->local_offset = 0;
+            }
+        }
+
+        ibv_send_wr wr;
+        memset(&wr, 0, sizeof(wr));
+        wr.opcode = IBV_WR_RDMA_READ;
+        wr.send_flags = IBV_SEND_SIGNALED;
+        wr.sg_list = sglist;
+        wr.num_sge = sge_index;
+        wr.wr.rdma.remote_addr = seg.addr + r->remote_offset;
+        wr.wr.rdma.rkey = seg.rkey;
+        ibv_send_wr* bad = NULL;
+        int err = ibv_post_send(_resource->qp, &wr, &bad);
+        if (err != 0) {
+            LOG(WARNING) << "Fail to post RDMA READ: " << berror(err);
+            errno = err;
+            return -1;
+        }
+        ++r->reads;
+        r->remote_offset += len;
+        if (r->remote_offset == seg.len) {
+            ++r->remote_index;
+            r->remote_offset = 0;
+        }
+    }
+    return 0;
+}
+
 int RdmaEndpoint::DoPostRecv(void* block, size_t block_size) {
     ibv_recv_wr wr;
     memset(&wr, 0, sizeof(wr));
@@ -1046,13 +1538,17 @@ int RdmaEndpoint::PostRecv(uint32_t num, bool zerocopy) {
     return 0;
 }
 
-static RdmaResource* AllocateQpCq(uint16_t sq_size, uint16_t rq_size) {
+// `shared_cq' is used by the QP if it's not NULL, so is `srq'
+static RdmaResource* AllocateQpCq(uint16_t sq_size, uint16_t rq_size,
+                                  ibv_cq* shared_cq, ibv_srq* srq) {
     RdmaResource* res = new (std::nothrow) RdmaResource;
     if (!res) {
         return NULL;
     }
 
-    if (!FLAGS_rdma_use_polling) {
+    if (shared_cq) {
+        // Owned by the poller
+    } else if (!FLAGS_rdma_use_polling) {
         res->comp_channel = IbvCreateCompChannel(GetRdmaContext());
         if (!res->comp_channel) {
             PLOG(WARNING) << "Fail to create comp channel for CQ";
@@ -1086,8 +1582,9 @@ static RdmaResource* AllocateQpCq(uint16_t sq_size, uint16_t rq_size) {
 
     ibv_qp_init_attr attr;
     memset(&attr, 0, sizeof(attr));
-    attr.send_cq = res->cq;
-    attr.recv_cq = res->cq;
+    attr.send_cq = shared_cq ? shared_cq : res->cq;
+    attr.recv_cq = shared_cq ? shared_cq : res->cq;
+    attr.srq = srq;
     // NOTE: Since we hope to reduce send completion events, we set signaled
     // send_wr every 1/4 of the total wnd. The wnd will increase when the ack
     // is received, which means the receive side has already received the data
@@ -1099,16 +1596,27 @@ static RdmaResource* AllocateQpCq(uint16_t sq_size, uint16_t rq_size) {
     // problem, we enlarge the size of SQ to contain redundant 1/4 of the wnd,
     // which is the maximum number of unsignaled send_wrs.
     attr.cap.max_send_wr = sq_size * 5 / 4; /*NOTE*/
-    attr.cap.max_recv_wr = rq_size;
+    if (FLAGS_rdma_rendezvous_threshold > 0) {
+        attr.cap.max_send_wr += RENDEZVOUS_READ_WR_NUM;
+    }
+    attr.cap.max_recv_wr = srq ? 0 : rq_size;
     attr.cap.max_send_sge = GetRdmaMaxSge();
-    attr.cap.max_recv_sge = 1;
+    attr.cap.max_recv_sge = srq ? 0 : 1;
+    attr.cap.max_inline_data = std::max(FLAGS_rdma_max_inline_data, 0);
     attr.qp_type = IBV_QPT_RC;
     res->qp = IbvCreateQp(GetRdmaPd(), &attr);
+    if (!res->qp && attr.cap.max_inline_data > 0) {
+        // The device may not support inline data of this size
+        attr.cap.max_inline_data = 0;
+        res->qp = IbvCreateQp(GetRdmaPd(), &attr);
+    }
     if (!res->qp) {
         PLOG(WARNING) << "Fail to create QP";
         delete res;
         return NULL;
     }
+    // The actual value supported by the device
+    res->max_inline_data = attr.cap.max_inline_data;
 
     return res;
 }
@@ -1121,54 +1629,80 @@ int RdmaEndpoint::AllocateResources() {
 
     CHECK(_resource == NULL);
 
-    if (_sq_size <= FLAGS_rdma_prepared_qp_size &&
-        _rq_size <= FLAGS_rdma_prepared_qp_size) {
-        BAIDU_SCOPED_LOCK(*g_rdma_resource_mutex);
-        if (g_rdma_resource_list) {
-            _resource = g_rdma_resource_list;
-            g_rdma_resource_list = g_rdma_resource_list->next;
-        }
-    }
-    if (!_resource) {
-        _resource = AllocateQpCq(_sq_size, _rq_size);
-    } else {
-        _resource->next = NULL;
-    }
-    if (!_resource) {
-        return -1;
-    }
-
-    if (!FLAGS_rdma_use_polling) {
-        SocketOptions options;
-        options.user = this;
-        options.keytable_pool = _socket->_keytable_pool;
-        options.fd = _resource->comp_channel->fd;
-        options.on_edge_triggered_events = PollCq;
-        if (Socket::Create(options, &_cq_sid) < 0) {
-            PLOG(WARNING) << "Fail to create socket for cq";
+    if (UseSharedCq()) {
+        // QPs sharing CQs are never prepared since the CQs belong to pollers.
+        auto& group = _poller_groups[bthread_self_tag()];
+        auto& poller = group.pollers[
+            butil::fmix32(_socket->id()) % FLAGS_rdma_poller_num];
+        if (!poller.cq || (UseSrq() && !group.srq)) {
+            LOG(WARNING) << "Polling mode is not initialized";
+            errno = EINVAL;
             return -1;
         }
-
-        int err = ibv_req_notify_cq(_resource->cq, 1);
-        if (err != 0) {
-            LOG(WARNING) << "Fail to arm CQ comp channel: " << berror(err);
+        _srq = UseSrq() ? group.srq : NULL;
+        _resource = AllocateQpCq(_sq_size, _rq_size, poller.cq,
+                                 _srq ? _srq->srq : NULL);
+        if (!_resource) {
             return -1;
         }
+        PollerAddQp();
     } else {
-        SocketOptions options;
-        options.user = this;
-        options.keytable_pool = _socket->_keytable_pool;
-        if (Socket::Create(options, &_cq_sid) < 0) {
-            PLOG(WARNING) << "Fail to create socket for cq";
+        if (_sq_size <= FLAGS_rdma_prepared_qp_size &&
+            _rq_size <= FLAGS_rdma_prepared_qp_size) {
+            BAIDU_SCOPED_LOCK(*g_rdma_resource_mutex);
+            if (g_rdma_resource_list) {
+                _resource = g_rdma_resource_list;
+                g_rdma_resource_list = g_rdma_resource_list->next;
+            }
+        }
+        if (!_resource) {
+            _resource = AllocateQpCq(_sq_size, _rq_size, NULL, NULL);
+        } else {
+            _resource->next = NULL;
+        }
+        if (!_resource) {
             return -1;
         }
-        PollerAddCqSid();
+
+        if (!FLAGS_rdma_use_polling) {
+            SocketOptions options;
+            options.user = this;
+            options.keytable_pool = _socket->_keytable_pool;
+            options.fd = _resource->comp_channel->fd;
+            options.on_edge_triggered_events = PollCq;
+            if (Socket::Create(options, &_cq_sid) < 0) {
+                PLOG(WARNING) << "Fail to create socket for cq";
+                return -1;
+            }
+
+            int err = ibv_req_notify_cq(_resource->cq, 1);
+            if (err != 0) {
+                LOG(WARNING) << "Fail to arm CQ comp channel: " << berror(err);
+                return -1;
+            }
+            if (g_worker_poll_cqs) {
+                g_worker_poll_cqs->Modify(AddCqSid, _cq_sid);
+            }
+        } else {
+            SocketOptions options;
+            options.user = this;
+            options.keytable_pool = _socket->_keytable_pool;
+            if (Socket::Create(options, &_cq_sid) < 0) {
+                PLOG(WARNING) << "Fail to create socket for cq";
+                return -1;
+            }
+            PollerAddCqSid();
+        }
     }
 
     _sbuf.resize(_sq_size - RESERVED_WR_NUM);
     if (_sbuf.size() != _sq_size - RESERVED_WR_NUM) {
         return -1;
     }
+    if (_srq) {
+        // Recv WRs are posted to the SRQ
+        return 0;
+    }
     _rbuf.resize(_rq_size);
     if (_rbuf.size() != _rq_size) {
         return -1;
@@ -1193,6 +1727,9 @@ int RdmaEndpoint::BringUpQp(uint16_t lid, ibv_gid gid, uint32_t qp_num) {
     attr.pkey_index = 0;  // TODO: support more pkey use in future
     attr.port_num = GetRdmaPortNum();
     attr.qp_access_flags = IBV_ACCESS_REMOTE_WRITE;
+    if (FLAGS_rdma_rendezvous_threshold > 0) {
+        attr.qp_access_flags |= IBV_ACCESS_REMOTE_READ;
+    }
     int err = IbvModifyQp(_resource->qp, &attr, (ibv_qp_attr_mask)(
                 IBV_QP_STATE |
                 IBV_QP_PKEY_INDEX |
@@ -1203,7 +1740,7 @@ int RdmaEndpoint::BringUpQp(uint16_t lid, ibv_gid gid, uint32_t qp_num) {
         return -1;
     }
 
-    if (PostRecv(_rq_size, true) < 0) {
+    if (!_srq && PostRecv(_rq_size, true) < 0) {
         PLOG(WARNING) << "Fail to post recv wr";
         return -1;
     }
@@ -1223,8 +1760,11 @@ int RdmaEndpoint::BringUpQp(uint16_t lid, ibv_gid gid, uint32_t qp_num) {
     attr.ah_attr.port_num = GetRdmaPortNum();
     attr.dest_qp_num = qp_num;
     attr.rq_psn = 0;
-    attr.max_dest_rd_atomic = 0;
-    attr.min_rnr_timer = 0;  // We do not allow rnr error
+    attr.max_dest_rd_atomic =
+        FLAGS_rdma_rendezvous_threshold > 0 ? RENDEZVOUS_READ_WR_NUM : 0;
+    // We do not allow rnr error unless the SRQ is used, which may run out
+    // of recv WRs temporarily since the windows of QPs are oversubscribed.
+    attr.min_rnr_timer = _srq ? 1 : 0;
     err = IbvModifyQp(_resource->qp, &attr, (ibv_qp_attr_mask)(
                 IBV_QP_STATE |
                 IBV_QP_PATH_MTU |
@@ -1241,9 +1781,10 @@ int RdmaEndpoint::BringUpQp(uint16_t lid, ibv_gid gid, uint32_t qp_num) {
     attr.qp_state = IBV_QPS_RTS;
     attr.timeout = TIMEOUT;
     attr.retry_cnt = RETRY_CNT;
-    attr.rnr_retry = 0;  // We do not allow rnr error
+    attr.rnr_retry = _srq ? 7 : 0;  // 7 means retrying infinitely
     attr.sq_psn = 0;
-    attr.max_rd_atomic = 0;
+    attr.max_rd_atomic =
+        FLAGS_rdma_rendezvous_threshold > 0 ? RENDEZVOUS_READ_WR_NUM : 0;
     err = IbvModifyQp(_resource->qp, &attr, (ibv_qp_attr_mask)(
                 IBV_QP_STATE |
                 IBV_QP_RNR_RETRY |
@@ -1263,6 +1804,16 @@ void RdmaEndpoint::DeallocateResources() {
     if (!_resource) {
         return;
     }
+    if (_resource->cq == NULL) {
+        // The CQ is shared. Completions left in the CQ are dropped by the
+        // poller after the QP is removed, and their SRQ buffers are posted
+        // again.
+        PollerRemoveQp();
+        delete _resource;
+        _resource = NULL;
+        _srq = NULL;
+        return;
+    }
     if (FLAGS_rdma_use_polling) {
         PollerRemoveCqSid();
     }
@@ -1314,6 +1865,9 @@ void RdmaEndpoint::DeallocateResources() {
 
     SocketUniquePtr s;
     if (_cq_sid != INVALID_SOCKET_ID) {
+        if (g_worker_poll_cqs) {
+            g_worker_poll_cqs->Modify(RemoveCqSid, _cq_sid);
+        }
         if (Socket::Address(_cq_sid, &s) == 0) {
             s->_user = NULL;  // do not release user (this RdmaEndpoint)
             if (fd >= 0) {
@@ -1459,6 +2013,7 @@ void RdmaEndpoint::PollCq(Socket* m) {
         // Otherwise it may call too many bthread_flush to affect performance.
         const int64_t received_us = butil::cpuwide_time_us();
         const int64_t base_realtime = butil::gettimeofday_us() - received_us;
+        ep->_last_cqe_us.store(received_us, butil::memory_order_relaxed);
         InputMessenger* messenger = static_cast<InputMessenger*>(s->user());
         if (messenger->ProcessNewMessage(
                     s.get(), bytes, false, received_us, base_realtime, last_msg) < 0) {
@@ -1467,6 +2022,115 @@ void RdmaEndpoint::PollCq(Socket* m) {
     }
 }
 
+bool RdmaEndpoint::WorkerPollCqs() {
+    CqSidList::ScopedPtr cqs;
+    if (g_worker_poll_cqs->Read(&cqs) != 0) {
+        return false;
+    }
+    const int64_t now_us = butil::cpuwide_time_us();
+    bool started = false;
+    for (size_t i = 0; i < cqs->size(); ++i) {
+        SocketUniquePtr s;
+        if (Socket::Address((*cqs)[i], &s) < 0) {
+            continue;
+        }
+        RdmaEndpoint* ep = static_cast<RdmaEndpoint*>(s->user());
+        if (!ep || now_us - ep->_last_cqe_us.load(butil::memory_order_relaxed)
+                > FLAGS_rdma_worker_poll_us) {
+            // The CQ is quiet, leave it to the comp channel
+            continue;
+        }
+        // Act as if the comp channel is readable. Skip the CQ if its handler
+        // is running, which polls the CQ anyway.
+        int expected = 0;
+        if (!s->_nevent.compare_exchange_strong(
+                expected, 1, butil::memory_order_acq_rel)) {
+            continue;
+        }
+        bthread_t tid;
+        Socket* const p = s.release();
+        bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+        attr.keytable_pool = p->_keytable_pool;
+        attr.tag = bthread_self_tag();
+        // Not bthread_start_urgent, which can't be called by the worker
+        // itself when it is idle
+        if (bthread_start_background(&tid, &attr, Socket::ProcessEvent, p) != 0) {
+            LOG(FATAL) << "Fail to start ProcessEvent";
+            Socket::ProcessEvent(p);
+        }
+        started = true;
+    }
+    return started;
+}
+
+void RdmaEndpoint::PollSharedCq(
+        ibv_cq* cq, RdmaSharedRecvQueue* srq,
+        const std::unordered_map<uint32_t, SocketId>& qps) {
+    ibv_wc wc[FLAGS_rdma_cqe_poll_once];
+    int cnt = ibv_poll_cq(cq, FLAGS_rdma_cqe_poll_once, wc);
+    if (cnt < 0) {
+        PLOG(WARNING) << "Fail to poll shared cq";
+        return;
+    }
+
+    SocketUniquePtr s;
+    uint32_t qp_num = 0;
+    ssize_t bytes = 0;
+    // Completions of a QP are usually adjacent, call ProcessNewMessage once
+    // for each run of them.
+    auto process = [&s, &bytes]() {
+        if (s == NULL) {
+            return;
+        }
+        const int64_t received_us = butil::cpuwide_time_us();
+        const int64_t base_realtime = butil::gettimeofday_us() - received_us;
+        InputMessenger::InputMessageClosure last_msg;
+        InputMessenger* messenger = static_cast<InputMessenger*>(s->user());
+        messenger->ProcessNewMessage(
+            s.get(), bytes, false, received_us, base_realtime, last_msg);
+        s.reset();
+        bytes = 0;
+    };
+    for (int i = 0; i < cnt; ++i) {
+        if (s == NULL || wc[i].qp_num != qp_num) {
+            process();
+            auto it = qps.find(wc[i].qp_num);
+            if (it == qps.end() || Socket::Address(it->second, &s) < 0) {
+                // The QP was removed
+                if (srq && wc[i].wr_id != 0) {
+                    PostSrqRecv(srq, wc[i].wr_id - 1, false);
+                }
+                continue;
+            }
+            qp_num = wc[i].qp_num;
+        }
+
+        if (s->Failed() || wc[i].status != IBV_WC_SUCCESS) {
+            if (!s->Failed()) {
+                PLOG(WARNING) << "Fail to handle RDMA completion, error status("
+                              << wc[i].status << "): " << s->description();
+                s->SetFailed(ERDMA, "RDMA completion error(%d) from %s: %s",
+                             wc[i].status, s->description().c_str(), berror(ERDMA));
+            }
+            if (srq && wc[i].wr_id != 0) {
+                PostSrqRecv(srq, wc[i].wr_id - 1, false);
+            }
+            continue;
+        }
+
+        ssize_t nr = s->_rdma_ep->HandleCompletion(wc[i]);
+        if (nr < 0) {
+            const int saved_errno = errno;
+            PLOG(WARNING) << "Fail to handle RDMA completion: " << s->description();
+            s->SetFailed(saved_errno, "Fail to handle rdma completion from %s: %s",
+                    s->description().c_str(), berror(saved_errno));
+        } else if (nr > 0) {
+            bytes += nr;
+        }
+    }
+    process();
+}
+
 std::string RdmaEndpoint::GetStateStr() const {
     switch (_state) {
     case UNINIT: return "UNINIT";
@@ -1508,6 +2172,8 @@ int RdmaEndpoint::GlobalInitialize() {
         g_rdma_recv_block_size = GetBlockSize(0) - IOBUF_BLOCK_HEADER_LEN;
     } else if (FLAGS_rdma_recv_block_type == "large") {
         g_rdma_recv_block_size = GetBlockSize(1) - IOBUF_BLOCK_HEADER_LEN;
+    } else if (FLAGS_rdma_recv_block_type == "medium") {
+        g_rdma_recv_block_size = GetBlockSize(3) - IOBUF_BLOCK_HEADER_LEN;
     } else if (FLAGS_rdma_recv_block_type == "huge") {
         g_rdma_recv_block_size = GetBlockSize(2) - IOBUF_BLOCK_HEADER_LEN;
     } else {
@@ -1515,10 +2181,19 @@ int RdmaEndpoint::GlobalInitialize() {
         return -1;
     }
 
+    LOG_IF(WARNING, !FLAGS_rdma_use_polling &&
+           (FLAGS_rdma_use_srq || FLAGS_rdma_share_cq))
+        << "rdma_use_srq and rdma_share_cq are ignored without rdma_use_polling";
+
     g_rdma_resource_mutex = new butil::Mutex;
-    for (int i = 0; i < FLAGS_rdma_prepared_qp_cnt; ++i) {
+    if (FLAGS_rdma_tcp_peer_cache_s > 0) {
+        g_tcp_peers_mutex = new butil::Mutex;
+        g_tcp_peers = new std::map<butil::EndPoint, int64_t>;
+    }
+    for (int i = 0; !UseSharedCq() && i < FLAGS_rdma_prepared_qp_cnt; ++i) {
         RdmaResource* res = AllocateQpCq(FLAGS_rdma_prepared_qp_size,
-                                         FLAGS_rdma_prepared_qp_size);
+                                         FLAGS_rdma_prepared_qp_size,
+                                         NULL, NULL);
         if (!res) {
             return -1;
         }
@@ -1528,6 +2203,9 @@ int RdmaEndpoint::GlobalInitialize() {
 
     if (FLAGS_rdma_use_polling) {
         _poller_groups = std::vector<PollerGroup>(FLAGS_task_group_ntags);
+    } else if (FLAGS_rdma_worker_poll_us > 0) {
+        g_worker_poll_cqs = new CqSidList;
+        bthread_set_worker_idlefn(WorkerPollCqs);
     }
 
     return 0;
@@ -1567,8 +2245,28 @@ int RdmaEndpoint::PollingModeInitialize(bthread_tag_t tag,
     if (!running.compare_exchange_strong(expected, true)) {
         return 0;
     }
+    if (UseSrq() && !group.srq) {
+        group.srq = CreateSharedRecvQueue();
+        if (!group.srq) {
+            LOG(ERROR) << "Fail to create rdma shared receive queue";
+            running.store(false, std::memory_order_relaxed);
+            return -1;
+        }
+    }
+    for (int i = 0; UseSharedCq() && i < FLAGS_rdma_poller_num; ++i) {
+        if (!pollers[i].cq) {
+            pollers[i].cq = IbvCreateCq(GetRdmaContext(),
+                                        FLAGS_rdma_shared_cq_size, NULL, NULL, 0);
+            if (!pollers[i].cq) {
+                PLOG(ERROR) << "Fail to create rdma shared CQ";
+                running.store(false, std::memory_order_relaxed);
+                return -1;
+            }
+        }
+    }
     struct FnArgs {
         Poller* poller;
+        RdmaSharedRecvQueue* srq;
         std::atomic<bool>* running;
     };
     auto fn = [](void* p) -> void* {
@@ -1576,6 +2274,8 @@ int RdmaEndpoint::PollingModeInitialize(bthread_tag_t tag,
         auto poller = args->poller;
         auto running = args->running;
         std::unordered_set<SocketId> cq_sids;
+        // QPs sharing the CQ of this poller
+        std::unordered_map<uint32_t, SocketId> qps;
         CqSidOp op;
 
         if (poller->init_fn) {
@@ -1588,8 +2288,15 @@ int RdmaEndpoint::PollingModeInitialize(bthread_tag_t tag,
                     cq_sids.emplace(op.sid);
                 } else if (op.type == CqSidOp::REMOVE) {
                     cq_sids.erase(op.sid);
+                } else if (op.type == CqSidOp::ADD_QP) {
+                    qps[op.qp_num] = op.sid;
+                } else if (op.type == CqSidOp::REMOVE_QP) {
+                    qps.erase(op.qp_num);
                 }
             }
+            if (poller->cq) {
+                PollSharedCq(poller->cq, args->srq, qps);
+            }
             for (auto sid : cq_sids) {
                 SocketUniquePtr s;
                 if (Socket::Address(sid, &s) < 0) {
@@ -1612,7 +2319,7 @@ int RdmaEndpoint::PollingModeInitialize(bthread_tag_t tag,
         return nullptr;
     };
     for (int i = 0; i < FLAGS_rdma_poller_num; ++i) {
-        auto args = new FnArgs{&pollers[i], &running};
+        auto args = new FnArgs{&pollers[i], group.srq, &running};
         auto attr = FLAGS_rdma_disable_bthread ? BTHREAD_ATTR_PTHREAD
                                                : BTHREAD_ATTR_NORMAL;
         attr.tag = tag;
@@ -1638,7 +2345,16 @@ void RdmaEndpoint::PollingModeRelease(bthread_tag_t tag) {
     running.store(false, std::memory_order_relaxed);
     for (int i = 0; i < FLAGS_rdma_poller_num; ++i) {
         bthread_join(pollers[i].tid, nullptr);
+        if (pollers[i].cq) {
+            int err = IbvDestroyCq(pollers[i].cq);
+            if (err != 0) {
+                LOG(WARNING) << "Fail to destroy shared CQ: " << berror(err);
+            }
+            pollers[i].cq = NULL;
+        }
     }
+    delete group.srq;
+    group.srq = NULL;
 }
 
 void RdmaEndpoint::PollerAddCqSid() {
@@ -1661,6 +2377,22 @@ void RdmaEndpoint::PollerRemoveCqSid() {
     }
 }
 
+void RdmaEndpoint::PollerAddQp() {
+    auto index = butil::fmix32(_socket->id()) % FLAGS_rdma_poller_num;
+    auto& group = _poller_groups[bthread_self_tag()];
+    auto& poller = group.pollers[index];
+    poller.op_queue.Enqueue(
+        CqSidOp{_socket->id(), CqSidOp::ADD_QP, _resource->qp->qp_num});
+}
+
+void RdmaEndpoint::PollerRemoveQp() {
+    auto index = butil::fmix32(_socket->id()) % FLAGS_rdma_poller_num;
+    auto& group = _poller_groups[bthread_self_tag()];
+    auto& poller = group.pollers[index];
+    poller.op_queue.Enqueue(
+        CqSidOp{_socket->id(), CqSidOp::REMOVE_QP, _resource->qp->qp_num});
+}
+
 }  // namespace rdma
 }  // namespace brpc
 
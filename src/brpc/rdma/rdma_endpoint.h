@@ -24,6 +24,7 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <unordered_map>
 #include <infiniband/verbs.h>
 #include "butil/atomicops.h"
 #include "butil/iobuf.h"
@@ -40,6 +41,10 @@ DECLARE_bool(rdma_use_polling);
 DECLARE_int32(rdma_poller_num);
 DECLARE_bool(rdma_edisp_unsched);
 DECLARE_bool(rdma_disable_bthread);
+DECLARE_bool(rdma_use_srq);
+DECLARE_bool(rdma_share_cq);
+DECLARE_int32(rdma_rendezvous_threshold);
+DECLARE_int32(rdma_worker_poll_us);
 
 class RdmaConnect : public AppConnect {
 public:
@@ -60,14 +65,33 @@ private:
 
 struct RdmaResource {
     ibv_qp* qp;
+    // NULL if the QP uses the CQ shared by its poller
     ibv_cq* cq;
     ibv_comp_channel* comp_channel;
+    // Maximum bytes of a send WR with IBV_SEND_INLINE
+    uint32_t max_inline_data;
     RdmaResource* next;
     RdmaResource();
     ~RdmaResource();
     DISALLOW_COPY_AND_ASSIGN(RdmaResource);
 };
 
+// Receive Queue shared by all QPs in a poller group. wr_id of a recv WR
+// posted to the SRQ is the index of its buffer plus 1, so that it can be
+// told apart from send WRs whose wr_id is 0.
+struct RdmaSharedRecvQueue {
+    ibv_srq* srq;
+    std::vector<butil::IOBuf> bufs;
+    // Data address of bufs
+    std::vector<void*> bufs_data;
+    RdmaSharedRecvQueue();
+    ~RdmaSharedRecvQueue();
+    DISALLOW_COPY_AND_ASSIGN(RdmaSharedRecvQueue);
+};
+
+// A rendezvous being read from the remote side
+struct RdmaRendezvousRead;
+
 class BAIDU_CACHELINE_ALIGNMENT RdmaEndpoint : public SocketUser {
 friend class RdmaConnect;
 friend class brpc::Socket;
@@ -136,6 +160,10 @@ private:
     // Release resources
     void DeallocateResources();
 
+    // Post the linked send WRs starting from `wr' with one doorbell
+    // Return 0 if success, -1 if failed and errno set
+    int PostSendWrs(ibv_send_wr* wr);
+
     // Send Imm data to the remote side
     // Arguments:
     //     imm: imm data in the WR
@@ -159,6 +187,22 @@ private:
     //     return bytes appended if success, -1 if failed and errno set
     ssize_t HandleCompletion(ibv_wc& wc);
 
+    // Send a descriptor of the leading blocks of `data' instead of the
+    // blocks themselves, which are cut into `to' and read by the remote side
+    // with RDMA READ. The descriptor is cut into `sglist'.
+    // Return bytes of data described, 0 if the blocks are not readable by
+    // the remote side, -1 if failed and errno set
+    ssize_t CutRendezvous(butil::IOBuf* data, butil::IOBuf* to,
+                          ibv_sge* sglist, size_t* sge_index);
+
+    // Start reading the rendezvous described in the received block
+    // Return 0 if success, -1 if failed and errno set
+    int StartRendezvousRead(const void* desc, uint32_t len);
+
+    // Post RDMA READ WRs of _rdv_read as many as possible
+    // Return 0 if success, -1 if failed and errno set
+    int PostRendezvousReads();
+
     // Post a given number of WRs to Recv Queue
     // If zerocopy is true, reallocate block.
     // Return 0 if success, -1 if failed and errno set
@@ -200,6 +244,16 @@ private:
     // Poll CQ and get the work completion
     static void PollCq(Socket* m);
 
+    // Run by idle bthread workers before sleeping. Trigger handlers of CQs
+    // which got completions within -rdma_worker_poll_us to poll the CQs
+    // again. Return true if any handler is started.
+    static bool WorkerPollCqs();
+
+    // Poll the CQ shared by QPs of a poller and dispatch the work completions
+    // to the endpoints by QP numbers
+    static void PollSharedCq(ibv_cq* cq, RdmaSharedRecvQueue* srq,
+                             const std::unordered_map<uint32_t, SocketId>& qps);
+
     // Get the description of current handshake state
     std::string GetStateStr() const;
 
@@ -212,6 +266,12 @@ private:
     // Remove cq socket id to poller
     void PollerRemoveCqSid();
 
+    // Add the QP to the poller sharing its CQ
+    void PollerAddQp();
+
+    // Remove the QP from the poller sharing its CQ
+    void PollerRemoveQp();
+
     // Not owner
     Socket* _socket;
 
@@ -227,6 +287,10 @@ private:
     // the SocketId which wrap the comp channel of CQ
     SocketId _cq_sid;
 
+    // The SRQ of the poller group if -rdma_use_srq is on, recv WRs are
+    // posted to it instead of _rbuf
+    RdmaSharedRecvQueue* _srq;
+
     // Capacity of local Send Queue and local Recv Queue
     uint16_t _sq_size;
     uint16_t _rq_size;
@@ -262,6 +326,16 @@ private:
     // The number of new WRs posted in the local Recv Queue
     butil::atomic<uint16_t> _new_rq_wrs;
 
+    // The rendezvous being read, only accessed in HandleCompletion
+    RdmaRendezvousRead* _rdv_read;
+    // A rendezvous sent is not read by the remote side yet, no more data is
+    // sent until the WR in _sbuf[_rdv_slot] is acked
+    butil::atomic<bool> _rdv_pending;
+    uint16_t _rdv_slot;
+
+    // The time of the last completion polled from the CQ in event mode
+    butil::atomic<int64_t> _last_cqe_us;
+
     // butex for inform read events on TCP fd during handshake
     butil::atomic<int> *_read_butex;
 
@@ -272,9 +346,13 @@ private:
         enum OpType {
             ADD,
             REMOVE,
+            // Dispatch completions of `qp_num' in the shared CQ to `sid'
+            ADD_QP,
+            REMOVE_QP,
         };
         SocketId sid;
         OpType type;
+        uint32_t qp_num;
     };
     // Poller instance
     struct BAIDU_CACHELINE_ALIGNMENT Poller {
@@ -285,12 +363,16 @@ private:
         // Init and Destory function
         std::function<void(void)> init_fn;
         std::function<void(void)> release_fn;
+        // CQ shared by the QPs polled by this poller, see -rdma_share_cq
+        ibv_cq* cq{NULL};
     };
     // Poller group
     struct BAIDU_CACHELINE_ALIGNMENT PollerGroup {
         PollerGroup() : pollers(FLAGS_rdma_poller_num), running(false) {}
         std::vector<Poller> pollers;
         std::atomic<bool> running;
+        // see -rdma_use_srq
+        RdmaSharedRecvQueue* srq{NULL};
     };
     static std::vector<PollerGroup> _poller_groups;
 };
@@ -63,10 +63,14 @@ ibv_qp* (*IbvCreateQp)(ibv_pd*, ibv_qp_init_attr*) = NULL;
 int (*IbvModifyQp)(ibv_qp*, ibv_qp_attr*, ibv_qp_attr_mask) = NULL;
 int (*IbvQueryQp)(ibv_qp*, ibv_qp_attr*, ibv_qp_attr_mask, ibv_qp_init_attr*) = NULL;
 int (*IbvDestroyQp)(ibv_qp*) = NULL;
+ibv_srq* (*IbvCreateSrq)(ibv_pd*, ibv_srq_init_attr*) = NULL;
+int (*IbvDestroySrq)(ibv_srq*) = NULL;
 ibv_comp_channel* (*IbvCreateCompChannel)(ibv_context*) = NULL;
 int (*IbvDestroyCompChannel)(ibv_comp_channel*) = NULL;
 ibv_mr* (*IbvRegMr)(ibv_pd*, void*, size_t, ibv_access_flags) = NULL;
 int (*IbvDeregMr)(ibv_mr*) = NULL;
+// Optional, NULL if libibverbs does not support dmabuf
+ibv_mr* (*IbvRegDmabufMr)(ibv_pd*, uint64_t, size_t, uint64_t, int, int) = NULL;
 int (*IbvGetCqEvent)(ibv_comp_channel*, ibv_cq**, void**) = NULL;
 void (*IbvAckCqEvents)(ibv_cq*, unsigned int) = NULL;
 int (*IbvGetAsyncEvent)(ibv_context*, ibv_async_event*) = NULL;
@@ -100,10 +104,25 @@ static ibv_context* g_context = NULL;
 static SocketId g_async_socket;
 static ibv_pd* g_pd = NULL;
 static std::vector<ibv_mr*>* g_mrs = NULL; // mr registered by brpc
+// Regions of the memory pool with their rkeys, appended by
+// RdmaRegisterMemory and read by GetRKey without locking.
+struct PoolRegion {
+    uintptr_t start;
+    size_t size;
+    uint32_t rkey;
+};
+static const int MAX_POOL_REGIONS = 64;
+static PoolRegion g_pool_regions[MAX_POOL_REGIONS];
+static butil::atomic<int> g_pool_region_num(0);
 
 static butil::FlatMap<void*, ibv_mr*>* g_user_mrs;  // mr registered by user
 static butil::Mutex* g_user_mrs_lock = NULL;
 
+// Set when any device memory is registered, so that sockets without RDMA
+// do not look for device memory otherwise
+static butil::atomic<bool> g_device_memory_used(false);
+static std::function<int(void*, const void*, size_t)> g_device_memory_copier;
+
 // Store the original IOBuf memalloc and memdealloc functions
 static void* (*g_mem_alloc)(size_t) = NULL;
 static void (*g_mem_dealloc)(void*) = NULL;
@@ -151,6 +170,7 @@ static void GlobalRelease() {
         delete g_mrs;
         g_mrs = NULL;
     }
+    g_pool_region_num.store(0, butil::memory_order_relaxed);
 
     if (g_pd) {
         IbvDeallocPd(g_pd);
@@ -176,15 +196,42 @@ void* UserExtendBlockPool(void* region_base, size_t region_size,
 uint32_t RdmaRegisterMemory(void* buf, size_t size) {
     // Register the memory as callback in block_pool
     // The thread-safety should be guaranteed by the caller
-    ibv_mr* mr = IbvRegMr(g_pd, buf, size, IBV_ACCESS_LOCAL_WRITE);
+    int access = IBV_ACCESS_LOCAL_WRITE;
+    if (FLAGS_rdma_rendezvous_threshold > 0) {
+        // Remote side reads the blocks directly in rendezvous
+        access |= IBV_ACCESS_REMOTE_READ;
+    }
+    ibv_mr* mr = IbvRegMr(g_pd, buf, size, (ibv_access_flags)access);
     if (!mr) {
         PLOG(ERROR) << "Fail to register memory";
         return 0;
     }
     g_mrs->push_back(mr);
+    const int n = g_pool_region_num.load(butil::memory_order_relaxed);
+    if (n < MAX_POOL_REGIONS) {
+        g_pool_regions[n].start = (uintptr_t)buf;
+        g_pool_regions[n].size = size;
+        g_pool_regions[n].rkey = mr->rkey;
+        g_pool_region_num.store(n + 1, butil::memory_order_release);
+    }
     return mr->lkey;
 }
 
+uint32_t GetRKey(const void* buf) {
+    if (FLAGS_rdma_rendezvous_threshold <= 0) {
+        return 0;
+    }
+    const uintptr_t addr = (uintptr_t)buf;
+    const int n = g_pool_region_num.load(butil::memory_order_acquire);
+    for (int i = 0; i < n; ++i) {
+        if (addr >= g_pool_regions[i].start &&
+            addr < g_pool_regions[i].start + g_pool_regions[i].size) {
+            return g_pool_regions[i].rkey;
+        }
+    }
+    return 0;
+}
+
 static void* BlockAllocate(size_t len) {
     if (len == 0) {
         errno = EINVAL;
@@ -377,10 +424,13 @@ static int ReadRdmaDynamicLib() {
     LoadSymbol(g_handle_ibverbs, IbvModifyQp, "ibv_modify_qp");
     LoadSymbol(g_handle_ibverbs, IbvQueryQp, "ibv_query_qp");
     LoadSymbol(g_handle_ibverbs, IbvDestroyQp, "ibv_destroy_qp");
+    LoadSymbol(g_handle_ibverbs, IbvCreateSrq, "ibv_create_srq");
+    LoadSymbol(g_handle_ibverbs, IbvDestroySrq, "ibv_destroy_srq");
     LoadSymbol(g_handle_ibverbs, IbvCreateCompChannel, "ibv_create_comp_channel");
     LoadSymbol(g_handle_ibverbs, IbvDestroyCompChannel, "ibv_destroy_comp_channel");
     LoadSymbol(g_handle_ibverbs, IbvRegMr, "ibv_reg_mr");
     LoadSymbol(g_handle_ibverbs, IbvDeregMr, "ibv_dereg_mr");
+    *(void**)(&IbvRegDmabufMr) = dlsym(g_handle_ibverbs, "ibv_reg_dmabuf_mr");
     LoadSymbol(g_handle_ibverbs, IbvGetCqEvent, "ibv_get_cq_event");
     LoadSymbol(g_handle_ibverbs, IbvAckCqEvents, "ibv_ack_cq_events");
     LoadSymbol(g_handle_ibverbs, IbvGetAsyncEvent, "ibv_get_async_event");
@@ -554,7 +604,7 @@ static void GlobalRdmaInitializeOrDieImpl() {
 
     if (RdmaEndpoint::GlobalInitialize() < 0) {
         LOG(ERROR) << "rdma_recv_block_type incorrect "
-                   << "(valid value: default/large/huge)";
+                   << "(valid value: default/large/medium/huge)";
         ExitWithError();
     }
 
@@ -590,12 +640,8 @@ void GlobalRdmaInitializeOrDie() {
     }
 }
 
-uint32_t RegisterMemoryForRdma(void* buf, size_t len) {
-    ibv_mr* mr = IbvRegMr(g_pd, buf, len, IBV_ACCESS_LOCAL_WRITE);
-    if (!mr) {
-        PLOG(ERROR) << "Fail to register memory";
-        return 0;
-    }
+// Add `mr' of `buf' to the user mr maps, deregister it when fails
+static uint32_t AddUserMr(void* buf, ibv_mr* mr) {
     {
         BAIDU_SCOPED_LOCK(*g_user_mrs_lock);
         if (!g_user_mrs->insert(buf, mr)) {
@@ -611,6 +657,85 @@ uint32_t RegisterMemoryForRdma(void* buf, size_t len) {
     return 0;
 }
 
+uint32_t RegisterMemoryForRdma(void* buf, size_t len) {
+    ibv_mr* mr = IbvRegMr(g_pd, buf, len, IBV_ACCESS_LOCAL_WRITE);
+    if (!mr) {
+        PLOG(ERROR) << "Fail to register memory";
+        return 0;
+    }
+    return AddUserMr(buf, mr);
+}
+
+uint32_t RegisterDeviceMemoryForRdma(void* buf, size_t len,
+                                     int dmabuf_fd, uint64_t dmabuf_offset) {
+    ibv_mr* mr = NULL;
+    if (dmabuf_fd >= 0) {
+        if (!IbvRegDmabufMr) {
+            LOG(ERROR) << "ibv_reg_dmabuf_mr is not supported by libibverbs";
+            return 0;
+        }
+        mr = IbvRegDmabufMr(g_pd, dmabuf_offset, len, (uint64_t)buf,
+                            dmabuf_fd, IBV_ACCESS_LOCAL_WRITE);
+    } else {
+        mr = IbvRegMr(g_pd, buf, len, IBV_ACCESS_LOCAL_WRITE);
+    }
+    if (!mr) {
+        PLOG(ERROR) << "Fail to register device memory";
+        return 0;
+    }
+    g_device_memory_used.store(true, butil::memory_order_relaxed);
+    return AddUserMr(buf, mr);
+}
+
+int AppendDeviceMemory(butil::IOBuf* buf, void* data, size_t size,
+                       std::function<void(void*)> deleter, uint32_t lkey) {
+    return buf->append_user_data_with_meta(data, size, deleter,
+                                           DEVICE_MEMORY_META | lkey);
+}
+
+void SetDeviceMemoryCopier(
+    std::function<int(void* dst, const void* src, size_t len)> copier) {
+    g_device_memory_copier = copier;
+}
+
+int StageDeviceMemory(butil::IOBuf* buf) {
+    if (!g_device_memory_used.load(butil::memory_order_relaxed)) {
+        return 0;
+    }
+    butil::IOBuf staged;
+    while (!buf->empty()) {
+        const butil::StringPiece block = buf->backing_block(0);
+        if (!(buf->get_first_data_meta() & DEVICE_MEMORY_META)) {
+            buf->cutn(&staged, block.size());
+            continue;
+        }
+        void* host = NULL;
+        if (!g_device_memory_copier) {
+            LOG_EVERY_SECOND(ERROR) << "Fail to write device memory without "
+                                       "RDMA, call SetDeviceMemoryCopier first";
+            errno = EINVAL;
+        } else if ((host = malloc(block.size())) == NULL) {
+            errno = ENOMEM;
+        } else if (g_device_memory_copier(host, block.data(),
+                                          block.size()) != 0) {
+            LOG_EVERY_SECOND(ERROR) << "Fail to copy device memory";
+            free(host);
+            host = NULL;
+            errno = EIO;
+        }
+        if (!host) {
+            // Keep `buf' unchanged
+            staged.append(*buf);
+            buf->swap(staged);
+            return -1;
+        }
+        staged.append_user_data(host, block.size(), free);
+        buf->pop_front(block.size());
+    }
+    buf->swap(staged);
+    return 0;
+}
+
 void DeregisterMemoryForRdma(void* buf) {
     ibv_mr* mr = NULL;
     {
@@ -23,6 +23,7 @@
 #include <infiniband/verbs.h>
 #include <string>
 #include <functional>
+#include "butil/iobuf.h"
 #include "bthread/types.h"
 
 
@@ -50,6 +51,38 @@ uint32_t RegisterMemoryForRdma(void* buf, size_t len);
 // Deregister the given memory
 void DeregisterMemoryForRdma(void* buf);
 
+// Data meta of device memory appended by AppendDeviceMemory, the lower 32
+// bits of which is the lkey
+static const uint64_t DEVICE_MEMORY_META = 1ULL << 32;
+
+// Register the given device (e.g. GPU) memory so that RDMA sends it without
+// copying to host memory. If `dmabuf_fd' is not negative, the memory is
+// registered by ibv_reg_dmabuf_mr with the dmabuf exported by the device
+// driver, `buf' is the device address of `dmabuf_offset' in the dmabuf.
+// Otherwise `buf' is registered by ibv_reg_mr, which requires a peer memory
+// client of the device (e.g. nvidia-peermem).
+// Return the memory lkey, Return 0 when fails
+// Deregister the memory with DeregisterMemoryForRdma
+uint32_t RegisterDeviceMemoryForRdma(void* buf, size_t len,
+                                     int dmabuf_fd = -1,
+                                     uint64_t dmabuf_offset = 0);
+
+// Append the registered device memory to `buf' WITHOUT copying. RDMA sends
+// it directly from the device, while other sockets copy it to host memory
+// by the function set by SetDeviceMemoryCopier before writing.
+// Returns 0 on success, -1 otherwise.
+int AppendDeviceMemory(butil::IOBuf* buf, void* data, size_t size,
+                       std::function<void(void*)> deleter, uint32_t lkey);
+
+// Set the function copying `len' bytes of device memory at `src' to host
+// memory at `dst' (e.g. by cudaMemcpy), which returns 0 on success.
+void SetDeviceMemoryCopier(
+    std::function<int(void* dst, const void* src, size_t len)> copier);
+
+// Replace device memory appended by AppendDeviceMemory in `buf' with copies
+// in host memory. Returns 0 on success, -1 otherwise.
+int StageDeviceMemory(butil::IOBuf* buf);
+
 // Get global RDMA context
 ibv_context* GetRdmaContext();
 
@@ -59,6 +92,10 @@ ibv_pd* GetRdmaPd();
 // Return lkey of the given address
 uint32_t GetLKey(void* buf);
 
+// Return rkey of the given address in the memory pool, 0 if the address is
+// not in the pool or the pool is not readable by the remote side
+uint32_t GetRKey(const void* buf);
+
 // Return GID Index
 uint8_t GetRdmaGidIndex();
 
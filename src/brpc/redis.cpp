@@ -226,7 +226,7 @@ void RedisResponse::SetCachedSize(int size) const {
 void RedisResponse::Clear() {
     _first_reply.Reset();
     _other_replies = NULL;
-    _arena.clear();
+    _arena.reset();
     _nreply = 0;
     _cached_size_ = 0;
 }
@@ -365,6 +365,15 @@ RedisCommandHandler* RedisService::FindCommandHandler(const butil::StringPiece&
     return NULL;
 }
 
+bool RedisService::SetBatchCommandHandler(RedisBatchCommandHandler* handler) {
+    if (_batch_handler != NULL) {
+        LOG(ERROR) << "redis batch command handler exists";
+        return false;
+    }
+    _batch_handler = handler;
+    return true;
+}
+
 RedisCommandHandler* RedisCommandHandler::NewTransactionHandler() {
     LOG(ERROR) << "NewTransactionHandler is not implemented";
     return NULL;
@@ -188,11 +188,13 @@ std::ostream& operator<<(std::ostream& os, const RedisRequest&);
 std::ostream& operator<<(std::ostream& os, const RedisResponse&);
 
 class RedisCommandHandler;
+class RedisBatchCommandHandler;
 
 // Container of CommandHandlers.
 // Assign an instance to ServerOption.redis_service to enable redis support. 
 class RedisService {
 public:
+    RedisService() : _batch_handler(NULL), _zero_copy_args(false) {}
     virtual ~RedisService() {}
     
     // Call this function to register `handler` that can handle command `name`.
@@ -201,9 +203,25 @@ public:
     // This function should not be touched by user and used by brpc deverloper only.
     RedisCommandHandler* FindCommandHandler(const butil::StringPiece& name) const;
 
+    // Register `handler' to run all commands parsed from one read of a
+    // connection together. Handlers added by AddCommandHandler are not used
+    // any more. Returns false if a batch handler was set.
+    bool SetBatchCommandHandler(RedisBatchCommandHandler* handler);
+    RedisBatchCommandHandler* batch_command_handler() const
+    { return _batch_handler; }
+
+    // If true, bulk strings in commands(except the command name) are not
+    // copied unless they span multiple blocks, the args reference blocks
+    // read from the connection instead and are not ended with '\0'.
+    // Default: false
+    void set_zero_copy_args(bool zero_copy) { _zero_copy_args = zero_copy; }
+    bool zero_copy_args() const { return _zero_copy_args; }
+
 private:
     typedef std::unordered_map<std::string, RedisCommandHandler*> CommandMap;
     CommandMap _command_map;
+    RedisBatchCommandHandler* _batch_handler;
+    bool _zero_copy_args;
 };
 
 enum RedisCommandHandlerResult {
@@ -238,6 +256,9 @@ public:
 
     RedisCommandParser parser;
     butil::Arena arena;
+    // Blocks referenced by args when RedisService::zero_copy_args() is
+    // true, released along with `arena'.
+    butil::IOBuf arg_blocks;
 
 private:
     // If user is authenticated, session is set.
@@ -296,6 +317,21 @@ public:
     virtual RedisCommandHandler* NewTransactionHandler();
 };
 
+// The handler of all pipelined commands parsed from one read of a connection,
+// e.g. to execute GETs of a storage engine as a multi-get.
+class RedisBatchCommandHandler {
+public:
+    virtual ~RedisBatchCommandHandler() {}
+
+    // `commands[i]' is the i-th command in the same format as `args' of
+    // RedisCommandHandler::Run(). `output' is an array of commands.size()
+    // replies, set output[i] to the result of commands[i]. All replies are
+    // sent to client side in one write after this method returns.
+    virtual void Run(RedisConnContext* ctx,
+                     const std::vector<std::vector<butil::StringPiece> >& commands,
+                     brpc::RedisReply* output) = 0;
+};
+
 } // namespace brpc
 
 #endif  // BRPC_REDIS_H
@@ -56,9 +56,11 @@ public:
 
     // Parse raw message from `buf'. Return PARSE_OK and set the parsed command
     // to `args' and length to `len' if successful. Memory of args are allocated 
-    // in `arena'.
+    // in `arena'. If `arg_blocks' is not NULL, bulk strings except the command
+    // name that fit in one block are not copied, the args reference the
+    // blocks which are moved from `buf' into `arg_blocks'.
     ParseError Consume(butil::IOBuf& buf, std::vector<butil::StringPiece>* args,
-                       butil::Arena* arena);
+                       butil::Arena* arena, butil::IOBuf* arg_blocks = NULL);
     size_t ParsedArgsSize();
 
 private:
@@ -71,6 +73,7 @@ private:
     // Return CONSUME_STATE_ERROR if the parser meets an error.
     RedisCommandConsumeState ConsumeImpl(butil::IOBuf& buf,
                                          butil::Arena* arena,
+                                         butil::IOBuf* arg_blocks,
                                          ParseError* err);
 
     bool _parsing_array;            // if the parser has met array indicator '*'
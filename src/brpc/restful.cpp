@@ -301,7 +301,7 @@ bool RestfulMap::AddMethod(const RestfulMethodPath& path,
 }
 
 void RestfulMap::ClearMethods() {
-    _sorted_paths.clear();
+    _trie.clear();
     for (DedupMap::iterator it = _dedup_map.begin();
          it != _dedup_map.end(); ++it) {
         if (it->second.own_method_status) {
@@ -334,43 +334,49 @@ struct CompareItemInPathList {
 };
 
 void RestfulMap::PrepareForFinding() {
-    _sorted_paths.clear();
-    _sorted_paths.reserve(_dedup_map.size());
+    _trie.clear();
+    _trie.resize(1);
     for (DedupMap::iterator it = _dedup_map.begin(); it != _dedup_map.end();
          ++it) {
-        _sorted_paths.push_back(&it->second);
+        const std::string& prefix = it->second.path.prefix;
+        size_t index = 0;
+        butil::StringSplitter sp(prefix.data(), prefix.data() + prefix.size(), '/');
+        for (; sp; ++sp) {
+            const std::string component(sp.field(), sp.length());
+            std::vector<std::pair<std::string, size_t> >& children =
+                _trie[index].children;
+            size_t i = 0;
+            for (; i < children.size() && children[i].first != component; ++i) {}
+            if (i == children.size()) {
+                children.push_back(std::make_pair(component, _trie.size()));
+                // `children' is invalidated after resizing _trie.
+                _trie.resize(_trie.size() + 1);
+            }
+            index = _trie[index].children[i].second;
+        }
+        _trie[index].paths.push_back(&it->second);
+    }
+    for (size_t i = 0; i < _trie.size(); ++i) {
+        TrieNode& node = _trie[i];
+        std::sort(node.children.begin(), node.children.end());
+        // /A/B is tried before /A/*/B, and /A/*/B/C before /A/*/C.
+        std::sort(node.paths.begin(), node.paths.end(),
+                  CompareItemInPathList());
+        std::reverse(node.paths.begin(), node.paths.end());
     }
-    std::sort(_sorted_paths.begin(), _sorted_paths.end(),
-              CompareItemInPathList());
     if (VLOG_IS_ON(RPC_VLOG_LEVEL + 1)) {
         std::ostringstream os;
-        os << "_sorted_paths(" << _service_name << "):";
-        for (PathList::const_iterator it = _sorted_paths.begin();
-             it != _sorted_paths.end(); ++it) {
-            os << ' ' << (*it)->path;
+        os << "_trie(" << _service_name << "):";
+        for (size_t i = 0; i < _trie.size(); ++i) {
+            for (PathList::const_iterator it = _trie[i].paths.begin();
+                 it != _trie[i].paths.end(); ++it) {
+                os << ' ' << (*it)->path;
+            }
         }
         VLOG(RPC_VLOG_LEVEL + 1) << os.str();
     }
 }
 
-// Remove last component from the (normalized) path:
-// Say /A/B/C/ -> /A/B/
-// Notice that /A/ is modified to / and returns true.
-static bool RemoveLastComponent(butil::StringPiece* path) {
-    if (path->empty()) {
-        return false;
-    }
-    if (path->back() == '/') {
-        path->remove_suffix(1);
-    }
-    size_t slash_pos = path->rfind('/');
-    if (slash_pos == std::string::npos) {
-        return false;
-    }
-    path->remove_suffix(path->size() - slash_pos - 1); // keep the slash
-    return true;
-}
-
 // Normalized as /A/B/C/
 static std::string NormalizeSlashes(const butil::StringPiece& path) {
     std::string out_path;
@@ -385,122 +391,104 @@ static std::string NormalizeSlashes(const butil::StringPiece& path) {
 }
 
 size_t RestfulMap::RemoveByPathString(const std::string& path) {
-    // removal only happens when server stops, clear _sorted_paths to make
+    // removal only happens when server stops, clear _trie to make
     // sure wild pointers do not exist.
-    if (!_sorted_paths.empty()) {
-        _sorted_paths.clear();
-    }
+    _trie.clear();
     return _dedup_map.erase(path);
 }
 
-struct PrefixLess {
-    bool operator()(const butil::StringPiece& path,
-                    const RestfulMethodProperty* p) const {
-        return path < p->path.prefix;
+// Match `full_path' with `rpath' whose prefix is known to be a sub path of
+// `full_path'.
+static bool MatchPostfix(const RestfulMethodPath& rpath,
+                         const std::string& full_path,
+                         std::string* unresolved_path) {
+    bool remove_heading_slash_from_unresolved = false;
+    butil::StringPiece left = full_path;
+    // Remove matched prefix from `left'.
+    if (!rpath.prefix.empty()) {
+        // make sure `left' is still starting with /
+        size_t removal = rpath.prefix.size();
+        if (rpath.prefix[removal - 1] == '/') {
+            --removal;
+            remove_heading_slash_from_unresolved = true;
+        }
+        left.remove_prefix(removal);
+    }
+    // Match postfix.
+    if (!left.ends_with(rpath.postfix)) {
+        return false;
+    }
+    left.remove_suffix(rpath.postfix.size());
+    if (!left.empty() && !rpath.has_wildcard) {
+        VLOG(RPC_VLOG_LEVEL + 1)
+            << "Unmatched extra=" << left << " full_path=" << full_path
+            << " candidate=" << DebugPrinter(rpath);
+        return false;
+    }
+    VLOG(RPC_VLOG_LEVEL + 1) << "Matched full_path=" << full_path
+                             << " with restful_path=" << DebugPrinter(rpath);
+    if (unresolved_path) {
+        if (!left.empty()) {
+            if (remove_heading_slash_from_unresolved && left[0] == '/') {
+                unresolved_path->assign(left.data() + 1, left.size() - 1);
+            } else {
+                unresolved_path->assign(left.data(), left.size());
+            }
+        } else {
+            unresolved_path->clear();
+        }
+    }
+    return true;
+}
+
+struct ChildLess {
+    bool operator()(const std::pair<std::string, size_t>& child,
+                    const butil::StringPiece& component) const {
+        return butil::StringPiece(child.first) < component;
     }
 };
 
+// Components of `full_path' before `pos' have been matched with the prefix
+// of node _trie[index]. Paths in deeper nodes are tried first so that the
+// longest prefix wins.
+const Server::MethodProperty*
+RestfulMap::FindInTrie(size_t index, const std::string& full_path, size_t pos,
+                       std::string* unresolved_path) const {
+    const TrieNode& node = _trie[index];
+    if (!node.children.empty() && pos < full_path.size()) {
+        const size_t slash_pos = full_path.find('/', pos);
+        const butil::StringPiece component(full_path.data() + pos,
+                                           slash_pos - pos);
+        std::vector<std::pair<std::string, size_t> >::const_iterator it =
+            std::lower_bound(node.children.begin(), node.children.end(),
+                             component, ChildLess());
+        if (it != node.children.end() && it->first == component) {
+            const Server::MethodProperty* mp = FindInTrie(
+                it->second, full_path, slash_pos + 1, unresolved_path);
+            if (mp != NULL) {
+                return mp;
+            }
+        }
+    }
+    for (PathList::const_iterator it = node.paths.begin();
+         it != node.paths.end(); ++it) {
+        if (MatchPostfix((*it)->path, full_path, unresolved_path)) {
+            return *it;
+        }
+    }
+    return NULL;
+}
+
 const Server::MethodProperty*
 RestfulMap::FindMethodProperty(const butil::StringPiece& method_path,
                                std::string* unresolved_path) const {
-    if (_sorted_paths.empty()) {
-        LOG(ERROR) << "_sorted_paths is empty, method_path=" << method_path;
+    if (_trie.empty()) {
+        LOG(ERROR) << "_trie is empty, method_path=" << method_path;
         return NULL;
     }
+    // Starting with / to match patterns like "*.flv => M" whose prefix is /
     const std::string full_path = NormalizeSlashes(method_path);
-    butil::StringPiece sub_path = full_path;
-    PathList::const_iterator last_find_pos = _sorted_paths.end();
-    do {
-        if (last_find_pos == _sorted_paths.begin()) {
-            return NULL;
-        }
-        // Note: stop trying places that we already visited or skipped.
-        PathList::const_iterator it =
-            std::upper_bound(_sorted_paths.begin(), last_find_pos/*note*/,
-                             sub_path, PrefixLess());
-        if (it != _sorted_paths.begin()) {
-            --it;
-        }
-        
-        bool matched = false;
-        bool remove_heading_slash_from_unresolved = false;
-        butil::StringPiece left;
-        do {
-            const RestfulMethodPath& rpath = (*it)->path;
-            if (!sub_path.starts_with(rpath.prefix)) {
-                VLOG(RPC_VLOG_LEVEL + 1)
-                    << "sub_path=" << sub_path << " does not match prefix="
-                    << rpath.prefix << " full_path=" << full_path
-                    << " candidate=" << DebugPrinter(rpath);
-                // NOTE: We can stop trying patterns before *it because pattern
-                // "/A*B => M" is disabled which makes prefixes of all restful
-                // paths end with /. If `full_path' matches with a prefix, the
-                // prefix must be a sub path of the full_path, which makes 
-                // prefix matching runs at most #components-of-path times.
-                // Otherwise we have to match all "/A*B" patterns before *it,
-                // which is more complicated but rarely needed by users.
-                break;
-            }
-            left = full_path;
-            // Remove matched prefix from `left'.
-            if (!rpath.prefix.empty()) {
-                // make sure `left' is still starting with /
-                size_t removal = rpath.prefix.size();
-                if (rpath.prefix[removal - 1] == '/') {
-                    --removal;
-                    remove_heading_slash_from_unresolved = true;
-                }
-                left.remove_prefix(removal);
-            }
-            // Match postfix.
-            if (left.ends_with(rpath.postfix)) {
-                left.remove_suffix(rpath.postfix.size());
-                if (!left.empty() && !rpath.has_wildcard) {
-                    VLOG(RPC_VLOG_LEVEL + 1)
-                        << "Unmatched extra=" << left
-                        << " sub_path=" << sub_path
-                        << " full_path=" << full_path
-                        << " candidate=" << DebugPrinter(rpath);
-                } else {
-                    matched = true;
-                    VLOG(RPC_VLOG_LEVEL + 1)
-                        << "Matched sub_path=" << sub_path
-                        << " full_path=" << full_path
-                        << " with restful_path=" << DebugPrinter(rpath);
-                    break;
-                }
-            }
-            if (it == _sorted_paths.begin()) {
-                VLOG(RPC_VLOG_LEVEL + 1)
-                    << "Hit beginning, sub_path=" << sub_path
-                    << " full_path=" << full_path
-                    << " candidate=" << DebugPrinter(rpath);
-                return NULL;
-            }
-            // Matched with prefix but postfix or wildcard, moving forward
-            --it;
-        } while (true);
-        last_find_pos = it;
-        
-        if (!matched) {
-            continue;
-        }
-        if (unresolved_path) {
-            if (!left.empty()) {
-                if (remove_heading_slash_from_unresolved && left[0] == '/') {
-                    unresolved_path->assign(left.data() + 1, left.size() - 1);
-                } else {
-                    unresolved_path->assign(left.data(), left.size());
-                }
-            } else {
-                unresolved_path->clear();
-            }
-        }
-        return *it;
-    } while (RemoveLastComponent(&sub_path));
-    //                            ^^^^^^^^
-    // sub_path can be / to match patterns like "*.flv => M" whose prefix is /
-    return NULL;
+    return FindInTrie(0, full_path, 1, unresolved_path);
 }
 
 } // namespace brpc
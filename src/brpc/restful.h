@@ -83,11 +83,15 @@ public:
     // Remove all methods.
     void ClearMethods();
 
-    // Called after by Server at starting moment, to refresh _sorted_paths
+    // Called after by Server at starting moment, to compile paths into
+    // the trie for finding.
     void PrepareForFinding();
     
-    // Find the method by path.
-    // Time complexity in worst-case is #slashes-in-input * log(#paths-stored)
+    // Find the method by path. The longest prefix wins, and methods with
+    // the same prefix are tried from exact ones to wildcard ones with longer
+    // postfixes.
+    // Time complexity is #slashes-in-input * log(#children-of-a-component)
+    // plus #paths-sharing-a-matched-prefix, independent of #paths-stored.
     const Server::MethodProperty*
     FindMethodProperty(const butil::StringPiece& method_path,
                        std::string* unresolved_path) const;
@@ -99,10 +103,24 @@ public:
     
 private:
     DISALLOW_COPY_AND_ASSIGN(RestfulMap);
-    
+
+    // A node of the trie of prefixes split by slashes. The root is the
+    // prefix "/".
+    struct TrieNode {
+        // Sorted by component.
+        std::vector<std::pair<std::string, size_t> > children;
+        // Paths with the prefix ending at this node, in the order of trying.
+        PathList paths;
+    };
+
+    const Server::MethodProperty*
+    FindInTrie(size_t index, const std::string& full_path, size_t pos,
+               std::string* unresolved_path) const;
+
     std::string _service_name;
-    // refreshed each time 
-    PathList _sorted_paths;
+    // Nodes of the trie, _trie[0] is the root. Refreshed each time
+    // PrepareForFinding() is called.
+    std::vector<TrieNode> _trie;
     DedupMap _dedup_map;
 };
 
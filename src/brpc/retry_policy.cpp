@@ -18,6 +18,8 @@
 
 #include "brpc/retry_policy.h"
 #include "butil/fast_rand.h"
+#include "butil/time.h"
+#include "bvar/reducer.h"
 
 
 namespace brpc {
@@ -75,4 +77,79 @@ int32_t RpcRetryPolicyWithJitteredBackoff::GetBackoffTimeMs(
                                _max_backoff_time_ms);
 }
 
+static bvar::Adder<int64_t>* g_retry_budget_exhausted = NULL;
+static pthread_once_t g_retry_budget_exhausted_once = PTHREAD_ONCE_INIT;
+
+static void CreateRetryBudgetExhausted() {
+    g_retry_budget_exhausted =
+        new bvar::Adder<int64_t>("rpc_client_retry_budget_exhausted_count");
+}
+
+const int RetryBudget::WINDOW_SECONDS;
+
+RetryBudget::RetryBudget(double ratio, int min_retries_per_second)
+    : _deposit_per_request((int64_t)(std::max(ratio, 0.0) * 1000))
+    , _deposit_per_second(std::max(min_retries_per_second, 0) * 1000L)
+    , _balance(std::max(_deposit_per_second * WINDOW_SECONDS, 1000L))
+    , _last_refill_us(butil::gettimeofday_us()) {
+    for (int i = 0; i < WINDOW_SECONDS; ++i) {
+        _window_seconds[i].store(-1, butil::memory_order_relaxed);
+        _window_requests[i].store(0, butil::memory_order_relaxed);
+    }
+    pthread_once(&g_retry_budget_exhausted_once, CreateRetryBudgetExhausted);
+}
+
+void RetryBudget::OnRequest(int64_t now_us) {
+    const int64_t now_s = now_us / 1000000L;
+    const int i = now_s % WINDOW_SECONDS;
+    int64_t s = _window_seconds[i].load(butil::memory_order_relaxed);
+    if (s != now_s && _window_seconds[i].compare_exchange_strong(
+            s, now_s, butil::memory_order_relaxed)) {
+        // Racing with other requests may lose a few counts, which is fine.
+        _window_requests[i].store(0, butil::memory_order_relaxed);
+    }
+    _window_requests[i].fetch_add(1, butil::memory_order_relaxed);
+    // The balance is capped when being withdrawn.
+    _balance.fetch_add(_deposit_per_request, butil::memory_order_relaxed);
+}
+
+int64_t RetryBudget::MaxBalance(int64_t now_s) const {
+    int64_t nreq = 0;
+    for (int i = 0; i < WINDOW_SECONDS; ++i) {
+        const int64_t s = _window_seconds[i].load(butil::memory_order_relaxed);
+        if (s > now_s - WINDOW_SECONDS && s <= now_s) {
+            nreq += _window_requests[i].load(butil::memory_order_relaxed);
+        }
+    }
+    return std::max(_deposit_per_request * nreq +
+                    _deposit_per_second * WINDOW_SECONDS, 1000L);
+}
+
+bool RetryBudget::TryRetry(int64_t now_us) {
+    if (_deposit_per_second > 0) {
+        int64_t last_us = _last_refill_us.load(butil::memory_order_relaxed);
+        // Refill in units of milliseconds.
+        const int64_t elapsed_ms = (now_us - last_us) / 1000;
+        if (elapsed_ms > 0 && _last_refill_us.compare_exchange_strong(
+                last_us, last_us + elapsed_ms * 1000,
+                butil::memory_order_relaxed)) {
+            const int64_t deposit = _deposit_per_second * elapsed_ms / 1000;
+            _balance.fetch_add(deposit, butil::memory_order_relaxed);
+        }
+    }
+    const int64_t max_balance = MaxBalance(now_us / 1000000L);
+    int64_t balance = _balance.load(butil::memory_order_relaxed);
+    while (balance >= 1000) {
+        // Drop tokens out of the window. Racing with deposits may lose a
+        // few tokens, which is fine.
+        if (_balance.compare_exchange_weak(
+                balance, std::min(balance, max_balance) - 1000,
+                butil::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    *g_retry_budget_exhausted << 1;
+    return false;
+}
+
 } // namespace brpc
@@ -19,6 +19,8 @@
 #ifndef BRPC_RETRY_POLICY_H
 #define BRPC_RETRY_POLICY_H
 
+#include "butil/atomicops.h"
+#include "butil/time.h"
 #include "brpc/controller.h"
 
 
@@ -133,6 +135,45 @@ private:
     bool _retry_backoff_in_pthread;
 };
 
+// Limit retries to `ratio' of requests plus `min_retries_per_second', so
+// that retries don't multiply load on servers which are already degraded.
+// Every request deposits `ratio' tokens, time deposits
+// `min_retries_per_second' tokens per second, and every retry withdraws one.
+// Unused tokens are capped to what requests and time of the last
+// WINDOW_SECONDS deposited (at least one token), so that retries can't burst
+// after a busy period or being idle.
+// Retries rejected by the budget are counted in bvar
+// rpc_client_retry_budget_exhausted_count.
+class RetryBudget {
+public:
+    static const int WINDOW_SECONDS = 10;
+
+    RetryBudget(double ratio, int min_retries_per_second);
+
+    // Called for every request.
+    void OnRequest() { OnRequest(butil::gettimeofday_us()); }
+
+    // Returns true if a retry is allowed and withdraw the token.
+    bool TryRetry() { return TryRetry(butil::gettimeofday_us()); }
+
+private:
+    void OnRequest(int64_t now_us);
+    bool TryRetry(int64_t now_us);
+
+    // Most tokens that can be saved at `now_s'.
+    int64_t MaxBalance(int64_t now_s) const;
+
+    // Tokens are in thousandths.
+    int64_t _deposit_per_request;
+    int64_t _deposit_per_second;
+    butil::atomic<int64_t> _balance;
+    butil::atomic<int64_t> _last_refill_us;
+    // Requests of each second in the window, indexed by second modulo
+    // WINDOW_SECONDS.
+    butil::atomic<int64_t> _window_seconds[WINDOW_SECONDS];
+    butil::atomic<int64_t> _window_requests[WINDOW_SECONDS];
+};
+
 } // namespace brpc
 
 
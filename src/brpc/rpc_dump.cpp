@@ -18,16 +18,28 @@
 
 #include <gflags/gflags.h>
 #include <fcntl.h>                    // O_CREAT
+#include <pthread.h>
+#include <sys/mman.h>                 // mmap
+#include <sys/stat.h>                 // fstat
+#include <algorithm>
+#include <functional>
+#include <map>
 #include "butil/file_util.h"
 #include "butil/raw_pack.h"
 #include "butil/unique_ptr.h"
 #include "butil/fast_rand.h"
+#include "butil/fd_guard.h"
+#include "butil/string_splitter.h"
 #include "butil/files/file_enumerator.h"
 #include "bvar/bvar.h"
 #include "brpc/log.h"
 #include "brpc/reloadable_flags.h"
 #include "brpc/rpc_dump.h"
 #include "brpc/protocol.h"
+#include "brpc/policy/gzip_compress.h"
+#include "brpc/policy/snappy_compress.h"
+#include "brpc/policy/zstd_compress.h"
+#include "brpc/policy/lz4_compress.h"
 
 namespace bvar {
 std::string read_command_name();
@@ -44,6 +56,10 @@ DECLARE_uint64(max_body_size);
 // <rpc_dump_dir>/<DUMPED_FILE_PREFIX>.yyyymmdd_hhmmss_uuuuus
 // ...
 // <rpc_dump_dir>/<DUMPED_FILE_PREFIX>.yyyymmdd_hhmmss_uuuuus
+//
+// A file is a sequence of records, each is "PRPC" + body_size(4) +
+// meta_size(4) + meta + request, or a compressed chunk of records, which is
+// "CRPC" + chunk_size(4) + compress_type(4) + compressed records.
 
 DEFINE_bool(rpc_dump, false,
             "Dump requests into files so that they can replayed "
@@ -58,10 +74,118 @@ DEFINE_int32(rpc_dump_max_files, 32,
 DEFINE_int32(rpc_dump_max_requests_in_one_file, 1000,
              "Max number of requests in one dumped file");
 
+DEFINE_double(rpc_dump_rate, 0, "Dump so much ratio of requests, e.g. 0.01 "
+              "for 1%, instead of limiting dumped requests per second by "
+              "-bvar_collector_expected_per_second. 0 means the limit");
+DEFINE_string(rpc_dump_method_rates, "", "Dump ratios of requests to some "
+              "services or methods, overriding -rpc_dump_rate, in form of "
+              "\"example.EchoService=0.01,example.FooService.Bar=0.05\"");
+DEFINE_string(rpc_dump_compress_type, "", "Compress dumped requests in "
+              "chunks with this algorithm, which is gzip, snappy, zstd or lz4 "
+              "(the latter two are available only if brpc is built with "
+              "them). Empty means no compression");
+
 BRPC_VALIDATE_GFLAG(rpc_dump, PassValidate);
 BRPC_VALIDATE_GFLAG(rpc_dump_max_requests_in_one_file, PositiveInteger);
 BRPC_VALIDATE_GFLAG(rpc_dump_max_files, PositiveInteger);
 
+static bool validate_rpc_dump_rate(const char*, double val) {
+    return val >= 0 && val <= 1;
+}
+BRPC_VALIDATE_GFLAG(rpc_dump_rate, validate_rpc_dump_rate);
+
+// Parsed -rpc_dump_method_rates, which is not reloadable.
+typedef std::map<std::string, double> DumpRateMap;
+static DumpRateMap* g_dump_rates = NULL;
+static pthread_once_t g_dump_rates_once = PTHREAD_ONCE_INIT;
+
+static void ParseDumpRates() {
+    DumpRateMap* rates = new DumpRateMap;
+    const std::string& val = FLAGS_rpc_dump_method_rates;
+    for (butil::StringSplitter sp(val.c_str(), ','); sp; ++sp) {
+        const butil::StringPiece kv(sp.field(), sp.length());
+        const size_t eq = kv.find('=');
+        char* endptr = NULL;
+        const std::string rate_str = (eq == butil::StringPiece::npos ?
+                                      std::string() : kv.substr(eq + 1).as_string());
+        const double rate = strtod(rate_str.c_str(), &endptr);
+        if (eq == 0 || rate_str.empty() || *endptr != '\0' ||
+            rate < 0 || rate > 1) {
+            LOG(ERROR) << "Invalid rate in -rpc_dump_method_rates: "
+                       << kv.as_string();
+            continue;
+        }
+        (*rates)[kv.substr(0, eq).as_string()] = rate;
+    }
+    if (!rates->empty()) {
+        g_dump_rates = rates;
+    } else {
+        delete rates;
+    }
+}
+
+// Returns false if `name' is not a supported algorithm.
+static bool ParseDumpCompressType(const std::string& name, CompressType* type) {
+    if (name.empty()) {
+        *type = COMPRESS_TYPE_NONE;
+    } else if (name == "gzip") {
+        *type = COMPRESS_TYPE_GZIP;
+    } else if (name == "snappy") {
+        *type = COMPRESS_TYPE_SNAPPY;
+#if BRPC_WITH_ZSTD
+    } else if (name == "zstd") {
+        *type = COMPRESS_TYPE_ZSTD;
+#endif
+#if BRPC_WITH_LZ4
+    } else if (name == "lz4") {
+        *type = COMPRESS_TYPE_LZ4;
+#endif
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool CompressChunk(CompressType type, const butil::IOBuf& in,
+                          butil::IOBuf* out) {
+    switch (type) {
+    case COMPRESS_TYPE_GZIP:
+        return policy::GzipCompress(in, out, NULL);
+    case COMPRESS_TYPE_SNAPPY:
+        return policy::SnappyCompress(in, out);
+#if BRPC_WITH_ZSTD
+    case COMPRESS_TYPE_ZSTD:
+        return policy::ZstdCompress(in, out);
+#endif
+#if BRPC_WITH_LZ4
+    case COMPRESS_TYPE_LZ4:
+        return policy::Lz4Compress(in, out);
+#endif
+    default:
+        return false;
+    }
+}
+
+static bool DecompressChunk(CompressType type, const butil::IOBuf& in,
+                            butil::IOBuf* out) {
+    switch (type) {
+    case COMPRESS_TYPE_GZIP:
+        return policy::GzipDecompress(in, out);
+    case COMPRESS_TYPE_SNAPPY:
+        return policy::SnappyDecompress(in, out);
+#if BRPC_WITH_ZSTD
+    case COMPRESS_TYPE_ZSTD:
+        return policy::ZstdDecompress(in, out);
+#endif
+#if BRPC_WITH_LZ4
+    case COMPRESS_TYPE_LZ4:
+        return policy::Lz4Decompress(in, out);
+#endif
+    default:
+        return false;
+    }
+}
+
 static const size_t UNWRITTEN_BUFSIZE = 1024 * 1024;
 static const int64_t FLUSH_TIMEOUT = 2000000L; // 2s
 
@@ -81,6 +205,7 @@ public:
         , _last_round(0)
         , _max_requests_in_one_file(0)
         , _max_files(0)
+        , _compress_type(COMPRESS_TYPE_NONE)
         , _sched_write_time(butil::gettimeofday_us() + FLUSH_TIMEOUT)
         , _last_file_time(0)
     {
@@ -104,6 +229,7 @@ private:
     // save gflags which could be reloaded at anytime.
     int _max_requests_in_one_file;
     int _max_files;
+    CompressType _compress_type;
     int64_t _sched_write_time;     // duetime of last write
     int64_t _last_file_time;  // time for the postfix of last file
     // the queue for remembering oldest file to remove.
@@ -118,6 +244,40 @@ private:
 bvar::CollectorSpeedLimit g_rpc_dump_sl = BVAR_COLLECTOR_SPEED_LIMIT_INITIALIZER;
 static RpcDumpContext* g_rpc_dump_ctx = NULL;
 
+inline bool SampleByRate(double rate) {
+    return rate >= 1 || (rate > 0 && butil::fast_rand_double() < rate);
+}
+
+bool ShouldDumpRequest(const butil::StringPiece& service_name,
+                       const butil::StringPiece& method_name) {
+    pthread_once(&g_dump_rates_once, ParseDumpRates);
+    const DumpRateMap* rates = g_dump_rates;
+    if (rates != NULL && !(service_name.empty() && method_name.empty())) {
+        std::string full_name;
+        if (service_name.empty()) {
+            method_name.CopyToString(&full_name);
+        } else {
+            full_name.reserve(service_name.size() + 1 + method_name.size());
+            service_name.AppendToString(&full_name);
+            full_name.push_back('.');
+            method_name.AppendToString(&full_name);
+        }
+        DumpRateMap::const_iterator it = rates->find(full_name);
+        if (it == rates->end() && !service_name.empty()) {
+            it = rates->find(service_name.as_string());
+        }
+        if (it != rates->end()) {
+            return SampleByRate(it->second);
+        }
+    }
+    const double rate = FLAGS_rpc_dump_rate;
+    if (rate <= 0) {
+        // Dumped requests per second are limited by the collector.
+        return bvar::is_collectable(&g_rpc_dump_sl);
+    }
+    return SampleByRate(rate);
+}
+
 void SampledRequest::dump_and_destroy(size_t round) {
     static bvar::DisplaySamplingRatio sampling_ratio_var(
         "rpc_dump_sampling_ratio", &g_rpc_dump_sl);
@@ -149,6 +309,11 @@ void RpcDumpContext::SaveFlags() {
 
     _max_requests_in_one_file = FLAGS_rpc_dump_max_requests_in_one_file;
     _max_files = FLAGS_rpc_dump_max_files;
+    if (!ParseDumpCompressType(FLAGS_rpc_dump_compress_type, &_compress_type)) {
+        LOG_FIRST_N(ERROR, 1) << "Unsupported -rpc_dump_compress_type="
+                              << FLAGS_rpc_dump_compress_type;
+        _compress_type = COMPRESS_TYPE_NONE;
+    }
 }
 
 // Dump a request.
@@ -210,6 +375,22 @@ void RpcDumpContext::Dump(size_t round, SampledRequest* sample) {
         _last_file_time = cur_file_time;
         _filenames.push_back(_cur_filename);
     }
+    if (_compress_type != COMPRESS_TYPE_NONE) {
+        butil::IOBuf compressed;
+        if (CompressChunk(_compress_type, _unwritten_buf, &compressed)) {
+            char chunk_header[12];
+            memcpy(chunk_header, "CRPC", 4);
+            butil::RawPacker(chunk_header + 4)
+                .pack32(compressed.size())
+                .pack32(_compress_type);
+            _unwritten_buf.clear();
+            _unwritten_buf.append(chunk_header, sizeof(chunk_header));
+            _unwritten_buf.append(compressed);
+        } else {
+            // Readers understand uncompressed records as well.
+            LOG_EVERY_SECOND(WARNING) << "Fail to compress dumped requests";
+        }
+    }
     // Write all data in _unwritten_buf. This is different from writing
     // into a socket: local file should always be writable unless error occurs
     bool fail_to_write = false;
@@ -257,66 +438,91 @@ bool RpcDumpContext::Serialize(butil::IOBuf& buf, SampledRequest* sample) {
     return true;
 }
 
-SampleIterator::SampleIterator(const butil::StringPiece& dir)
-    : _cur_fd(-1)
-    , _enum(NULL)
-    , _dir(std::string(dir.data(), dir.size())) {
+SampleIterator::SampleIterator(const butil::StringPiece& dir,
+                               int shard_index, int shard_count)
+    : _listed(false)
+    , _file_index(0)
+    , _dir(std::string(dir.data(), dir.size()))
+    , _shard_index(shard_index)
+    , _shard_count(std::max(shard_count, 1)) {
 }
 
 SampleIterator::~SampleIterator() {
-    if (_cur_fd) {
-        ::close(_cur_fd);
-        _cur_fd = -1;
-    }
-    delete _enum;
-    _enum = NULL;
 }
 
 SampledRequest* SampleIterator::Next() {
-    if (!_cur_buf.empty()) {
-        bool error = false;
-        SampledRequest* r = Pop(_cur_buf, &error);
-        if (r) {
-            return r;
-        }
-        if (error) {
-            _cur_buf.clear();
-            if (_cur_fd >= 0) {
-                ::close(_cur_fd);
-                _cur_fd = -1;
+    while (1) {
+        if (!_cur_buf.empty()) {
+            bool error = false;
+            SampledRequest* r = Pop(_cur_buf, &error);
+            if (r) {
+                return r;
             }
+            // The whole file is in _cur_buf, remaining bytes are either
+            // malformed or a partially written record.
+            if (!error) {
+                LOG(WARNING) << "Ignore incomplete record of "
+                             << _cur_buf.size() << " bytes";
+            }
+            _cur_buf.clear();
+        }
+        if (!MapNextFile()) {
+            return NULL;
         }
     }
-    while (1) {
-        while (_cur_fd >= 0) {
-            ssize_t nr = _cur_buf.append_from_file_descriptor(_cur_fd, 524288);
-            if (nr < 0) {
-                if (errno != EAGAIN && errno != EINTR) {
-                    PLOG(ERROR) << "Fail to read fd=" << _cur_fd;
-                    break;
-                }
-            } else if (nr == 0) {  // EOF
-                break;
-            } else {
-                return Next();  // tailr
-            }
+}
+
+static void UnmapFile(void* data, size_t size) {
+    munmap(data, size);
+}
+
+bool SampleIterator::MapNextFile() {
+    if (!_listed) {
+        _listed = true;
+        butil::FileEnumerator e(_dir, false, butil::FileEnumerator::FILES);
+        std::vector<butil::FilePath> files;
+        for (butil::FilePath name = e.Next(); !name.empty(); name = e.Next()) {
+            files.push_back(name);
         }
-        _cur_buf.clear();
-        if (_cur_fd >= 0) {
-            ::close(_cur_fd);
-            _cur_fd = -1;
+        // Names of dumped files end with their creating time.
+        std::sort(files.begin(), files.end());
+        for (size_t i = _shard_index; i < files.size(); i += _shard_count) {
+            _files.push_back(files[i]);
+        }
+    }
+    while (_file_index < _files.size()) {
+        const std::string& filename = _files[_file_index++].value();
+        butil::fd_guard fd(open(filename.c_str(), O_RDONLY));
+        if (fd < 0) {
+            PLOG(ERROR) << "Fail to open " << filename;
+            continue;
         }
-        
-        if (_enum == NULL) {
-            _enum = new butil::FileEnumerator(
-                _dir, false, butil::FileEnumerator::FILES);
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            PLOG(ERROR) << "Fail to stat " << filename;
+            continue;
         }
-        butil::FilePath filename = _enum->Next();
-        if (filename.empty()) {
-            return NULL;
+        const size_t size = st.st_size;
+        if (size == 0) {
+            continue;
         }
-        _cur_fd = open(filename.value().c_str(), O_RDONLY);
+        void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            PLOG(ERROR) << "Fail to map " << filename;
+            continue;
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+        // Samples reference the mapped pages, which are unmapped after all
+        // samples of the file are destroyed.
+        if (_cur_buf.append_user_data(
+                data, size, std::bind(UnmapFile, std::placeholders::_1,
+                                      size)) != 0) {
+            munmap(data, size);
+            continue;
+        }
+        return true;
     }
+    return false;
 }
 
 SampledRequest* SampleIterator::Pop(butil::IOBuf& buf, bool* format_error) {
@@ -325,6 +531,32 @@ SampledRequest* SampleIterator::Pop(butil::IOBuf& buf, bool* format_error) {
     if (NULL == p) {  // buf.length() < sizeof(backing_buf)
         return NULL;
     }
+    if (*(const uint32_t*)p == *(const uint32_t*)"CRPC") {
+        uint32_t chunk_size;
+        uint32_t compress_type;
+        butil::RawUnpacker(p + 4).unpack32(chunk_size).unpack32(compress_type);
+        if (chunk_size > FLAGS_max_body_size) {
+            LOG(ERROR) << "Too big chunk=" << chunk_size;
+            *format_error = true;
+            return NULL;
+        } else if (buf.length() < sizeof(backing_buf) + chunk_size) {
+            return NULL;
+        }
+        buf.pop_front(sizeof(backing_buf));
+        butil::IOBuf chunk;
+        buf.cutn(&chunk, chunk_size);
+        butil::IOBuf records;
+        if (!DecompressChunk((CompressType)compress_type, chunk, &records)) {
+            LOG(ERROR) << "Fail to decompress chunk with compress_type="
+                       << compress_type;
+            *format_error = true;
+            return NULL;
+        }
+        // Put records in the chunk before remaining data.
+        records.append(buf);
+        buf.swap(records);
+        return Pop(buf, format_error);
+    }
     if (*(const uint32_t*)p != *(const uint32_t*)"PRPC") {
         LOG(ERROR) << "Unmatched magic string";
         *format_error = true;
@@ -19,16 +19,14 @@
 #ifndef BRPC_RPC_DUMP_H
 #define BRPC_RPC_DUMP_H
 
+#include <vector>
 #include <gflags/gflags_declare.h>
 #include "butil/iobuf.h"                            // IOBuf
+#include "butil/time.h"                             // gettimeofday_us
 #include "butil/files/file_path.h"                  // FilePath
 #include "bvar/collector.h"
 #include "brpc/rpc_dump.pb.h"                       // RpcDumpMeta
 
-namespace butil {
-class FileEnumerator;
-}
-
 namespace brpc {
 
 DECLARE_bool(rpc_dump);
@@ -61,15 +59,28 @@ public:
     }
 };
 
+// Returns true if a request to the method should be dumped, according to
+// -rpc_dump_method_rates, -rpc_dump_rate, or the speed limit of the
+// collector when neither rate is set. `service_name' is the full name of the
+// service, `method_name' is the name of the method, or the full name of the
+// method when `service_name' is empty. Both can be empty if unknown.
+bool ShouldDumpRequest(const butil::StringPiece& service_name,
+                       const butil::StringPiece& method_name);
+
 // If this function returns non-NULL, the caller must fill the returned
 // object and submit it for later dumping by calling SubmitSample(). If
 // the caller ignores non-NULL return value, the object is leaked.
-inline SampledRequest* AskToBeSampled() {
-    extern bvar::CollectorSpeedLimit g_rpc_dump_sl;
-    if (!FLAGS_rpc_dump || !bvar::is_collectable(&g_rpc_dump_sl)) {
+inline SampledRequest* AskToBeSampled(
+    const butil::StringPiece& service_name = butil::StringPiece(),
+    const butil::StringPiece& method_name = butil::StringPiece()) {
+    if (!FLAGS_rpc_dump || !ShouldDumpRequest(service_name, method_name)) {
         return NULL;
     }
-    return new (std::nothrow) SampledRequest;
+    SampledRequest* sample = new (std::nothrow) SampledRequest;
+    if (sample) {
+        sample->meta.set_received_us(butil::gettimeofday_us());
+    }
+    return sample;
 }
 
 // Read samples from dumped files in a directory.
@@ -78,9 +89,16 @@ inline SampledRequest* AskToBeSampled() {
 //   for (SampledRequest* req = it->Next(); req != NULL; req = it->Next()) {
 //     ...
 //   }
+// Files are read in the order of their names, which is the order that they
+// were created. Files are mapped into memory and samples reference the
+// mapped pages without copying.
+// When `shard_count' is greater than 1, only the files whose indexes modulo
+// `shard_count' equal to `shard_index' are read, so that several iterators
+// can read the directory in parallel.
 class SampleIterator {
 public:
-    explicit SampleIterator(const butil::StringPiece& dir);
+    explicit SampleIterator(const butil::StringPiece& dir,
+                            int shard_index = 0, int shard_count = 1);
     ~SampleIterator();
 
     // Read a sample. Order of samples are not guaranteed to be same with
@@ -91,13 +109,20 @@ public:
 
 private:
     // Parse on request from the buf. Set `format_error' to true when
-    // the buf does not match the format.
+    // the buf does not match the format. Compressed chunks at front of
+    // `buf' are decompressed in place.
     static SampledRequest* Pop(butil::IOBuf& buf, bool* format_error);
+
+    // Map next file into _cur_buf. Returns false when all files are read.
+    bool MapNextFile();
     
-    butil::IOPortal _cur_buf;
-    int _cur_fd;
-    butil::FileEnumerator* _enum;
+    butil::IOBuf _cur_buf;
+    bool _listed;
+    size_t _file_index;
+    std::vector<butil::FilePath> _files;
     butil::FilePath _dir;
+    int _shard_index;
+    int _shard_count;
 };
 
 } // namespace brpc
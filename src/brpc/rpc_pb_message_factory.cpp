@@ -15,6 +15,9 @@
 // specific language governing permissions and limitations
 // under the License.
 
+#include <stdlib.h>
+#include <algorithm>
+#include <type_traits>
 #include "brpc/rpc_pb_message_factory.h"
 
 namespace brpc {
@@ -47,4 +50,101 @@ void DefaultRpcPBMessageFactory::Return(RpcPBMessages* messages) {
     butil::return_object(default_messages);
 }
 
+struct AdaptiveArenaRpcPBMessages : public RpcPBMessages {
+    AdaptiveArenaRpcPBMessages()
+        : arena(NULL), block(NULL), block_size(0)
+        , slot(0), request(NULL), response(NULL) {}
+    ~AdaptiveArenaRpcPBMessages() { free(block); }
+    ::google::protobuf::Message* Request() override { return request; }
+    ::google::protobuf::Message* Response() override { return response; }
+
+    // Constructed in `arena_storage' for each call, the initial block
+    // owned by us is not freed when the arena is destroyed.
+    ::google::protobuf::Arena* arena;
+    std::aligned_storage<sizeof(::google::protobuf::Arena),
+                                  alignof(::google::protobuf::Arena)>::type
+    arena_storage;
+    char* block;
+    size_t block_size;
+    size_t slot;
+    ::google::protobuf::Message* request;
+    ::google::protobuf::Message* response;
+};
+
+// Blocks smaller than this are not worthy of the effort.
+static const size_t MIN_INITIAL_BLOCK_SIZE = 256;
+
+AdaptiveArenaRpcPBMessageFactory::AdaptiveArenaRpcPBMessageFactory(
+    size_t max_initial_block_size)
+    : _max_initial_block_size(
+        std::max(max_initial_block_size, MIN_INITIAL_BLOCK_SIZE)) {
+    for (size_t i = 0; i < SPACE_USED_SLOTS; ++i) {
+        _space_used[i].store(0, butil::memory_order_relaxed);
+    }
+}
+
+size_t AdaptiveArenaRpcPBMessageFactory::SlotOf(
+    const ::google::protobuf::MethodDescriptor& method) {
+    return (reinterpret_cast<uintptr_t>(&method) >> 4) % SPACE_USED_SLOTS;
+}
+
+size_t AdaptiveArenaRpcPBMessageFactory::InitialBlockSizeOf(
+    const ::google::protobuf::MethodDescriptor& method) const {
+    const size_t used = _space_used[SlotOf(method)].load(
+        butil::memory_order_relaxed);
+    // Round up to power of 2 so that sizes of pooled blocks are stable.
+    size_t size = MIN_INITIAL_BLOCK_SIZE;
+    while (size < used && size < _max_initial_block_size) {
+        size <<= 1;
+    }
+    return std::min(size, _max_initial_block_size);
+}
+
+RpcPBMessages* AdaptiveArenaRpcPBMessageFactory::Get(
+        const ::google::protobuf::Service& service,
+        const ::google::protobuf::MethodDescriptor& method) {
+    auto messages = butil::get_object<AdaptiveArenaRpcPBMessages>();
+    const size_t block_size = InitialBlockSizeOf(method);
+    // Pooled messages were probably used by other methods, reallocate the
+    // block if it's too small, or too large to be kept.
+    if (messages->block_size < block_size ||
+        messages->block_size > block_size * 4) {
+        free(messages->block);
+        messages->block = static_cast<char*>(malloc(block_size));
+        messages->block_size = (messages->block ? block_size : 0);
+    }
+    ::google::protobuf::ArenaOptions options;
+    if (messages->block != NULL) {
+        options.initial_block = messages->block;
+        options.initial_block_size = messages->block_size;
+    }
+    options.start_block_size = std::max(options.start_block_size, block_size);
+    options.max_block_size =
+        std::max(options.max_block_size, _max_initial_block_size);
+    messages->arena =
+        new (&messages->arena_storage) ::google::protobuf::Arena(options);
+    messages->slot = SlotOf(method);
+    messages->request = service.GetRequestPrototype(&method).New(messages->arena);
+    messages->response = service.GetResponsePrototype(&method).New(messages->arena);
+    return messages;
+}
+
+void AdaptiveArenaRpcPBMessageFactory::Return(RpcPBMessages* messages) {
+    auto arena_messages = static_cast<AdaptiveArenaRpcPBMessages*>(messages);
+    // Moving average with weight 1/8 for the newest call. Races between
+    // concurrent calls only lose a few samples.
+    const size_t used = arena_messages->arena->SpaceUsed();
+    butil::atomic<size_t>& avg = _space_used[arena_messages->slot];
+    const size_t old_avg = avg.load(butil::memory_order_relaxed);
+    avg.store(old_avg == 0 ? used : old_avg - old_avg / 8 + used / 8,
+              butil::memory_order_relaxed);
+
+    arena_messages->request = NULL;
+    arena_messages->response = NULL;
+    // All messages and extra blocks are freed in one shot.
+    arena_messages->arena->~Arena();
+    arena_messages->arena = NULL;
+    butil::return_object(arena_messages);
+}
+
 } // namespace brpc
\ No newline at end of file
@@ -22,6 +22,7 @@
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/message.h>
 #include <google/protobuf/arena.h>
+#include "butil/atomicops.h"
 #include "butil/object_pool.h"
 
 namespace brpc {
@@ -58,6 +59,37 @@ public:
     void Return(RpcPBMessages* messages) override;
 };
 
+// Allocate protobuf messages from an arena whose initial block is sized
+// from the arena space used by recent calls of the same method. Most calls
+// then allocate the request, the response and all their sub-messages and
+// strings from the initial block, which is reused by later calls, and free
+// them in one shot after the response is sent.
+// Created by server when `ServerOptions.use_arena_for_rpc_pb_messages' is
+// true and `ServerOptions.rpc_pb_message_factory' is not set.
+class AdaptiveArenaRpcPBMessageFactory : public RpcPBMessageFactory {
+public:
+    // Initial blocks are never larger than `max_initial_block_size', more
+    // blocks are allocated by the arena on demand as usual.
+    explicit AdaptiveArenaRpcPBMessageFactory(
+        size_t max_initial_block_size = 64 * 1024);
+
+    RpcPBMessages* Get(const ::google::protobuf::Service& service,
+                       const ::google::protobuf::MethodDescriptor& method) override;
+    void Return(RpcPBMessages* messages) override;
+
+    // Size of the initial block for next call to `method'.
+    size_t InitialBlockSizeOf(const ::google::protobuf::MethodDescriptor& method) const;
+
+private:
+    // Methods are hashed into slots, collisions only make sizes less accurate.
+    static const size_t SPACE_USED_SLOTS = 256;
+    static size_t SlotOf(const ::google::protobuf::MethodDescriptor& method);
+
+    size_t _max_initial_block_size;
+    // Moving average of arena space used by calls in each slot.
+    butil::atomic<size_t> _space_used[SPACE_USED_SLOTS];
+};
+
 namespace internal {
 
 // Allocate protobuf message from arena.
@@ -133,6 +165,10 @@ BUTIL_FORCE_INLINE RpcPBMessageFactory* GetArenaRpcPBMessageFactory() {
     return GetArenaRpcPBMessageFactory<256, 8192>();
 }
 
+inline RpcPBMessageFactory* GetAdaptiveArenaRpcPBMessageFactory() {
+    return new AdaptiveArenaRpcPBMessageFactory;
+}
+
 } // namespace brpc
 
 #endif // BRPC_RPC_PB_MESSAGE_FACTORY_H
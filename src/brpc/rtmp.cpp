@@ -1329,6 +1329,17 @@ int RtmpStreamBase::SendSharedObjectMessage(const RtmpSharedObjectMessage&) {
     return -1;
 }
 
+static char MakeAudioHead(const RtmpAudioMessage& msg) {
+    return ((msg.codec & 0xF) << 4)
+        | ((msg.rate & 0x3) << 2)
+        | ((msg.bits & 0x1) << 1)
+        | (msg.type & 0x1);
+}
+
+static char MakeVideoHead(const RtmpVideoMessage& msg) {
+    return ((msg.frame_type & 0xF) << 4) | (msg.codec & 0xF);
+}
+
 int RtmpStreamBase::SendAudioMessage(const RtmpAudioMessage& msg) {
     if (_rtmpsock == NULL) {
         errno = EPERM;
@@ -1349,13 +1360,7 @@ int RtmpStreamBase::SendAudioMessage(const RtmpAudioMessage& msg) {
     msg2->header.message_type = policy::RTMP_MESSAGE_AUDIO;
     msg2->header.stream_id = _message_stream_id;
     msg2->chunk_stream_id = _chunk_stream_id;
-    // Make audio header.
-    const char audio_head =
-        ((msg.codec & 0xF) << 4)
-        | ((msg.rate & 0x3) << 2)
-        | ((msg.bits & 0x1) << 1)
-        | (msg.type & 0x1);
-    msg2->body.push_back(audio_head);
+    msg2->body.push_back(MakeAudioHead(msg));
     msg2->body.append(msg.data);
     return _rtmpsock->Write(msg2);
 }
@@ -1423,9 +1428,7 @@ int RtmpStreamBase::SendVideoMessage(const RtmpVideoMessage& msg) {
     msg2->header.message_type = policy::RTMP_MESSAGE_VIDEO;
     msg2->header.stream_id = _message_stream_id;
     msg2->chunk_stream_id = _chunk_stream_id;
-    // Make video header
-    const char video_head = ((msg.frame_type & 0xF) << 4) | (msg.codec & 0xF);
-    msg2->body.push_back(video_head);
+    msg2->body.push_back(MakeVideoHead(msg));
     msg2->body.append(msg.data);
     return _rtmpsock->Write(msg2);
 }
@@ -1464,6 +1467,152 @@ int RtmpStreamBase::SendAVCMessage(const RtmpAVCMessage& msg) {
     return _rtmpsock->Write(msg2);
 }
 
+int RtmpStreamBase::SendEncodedMessage(const RtmpEncodedMessage& msg) {
+    if (_paused && !msg.is_metadata()) {
+        errno = EPERM;
+        return -1;
+    }
+    // The body is shared with other streams by reference. Chunking happens
+    // per connection because chunk headers depend on previous messages
+    // sent on the chunk stream.
+    return SendMessage(msg.timestamp, msg.message_type, msg.body);
+}
+
+int RtmpEncodedMessage::Encode(const RtmpAudioMessage& msg) {
+    timestamp = msg.timestamp;
+    message_type = policy::RTMP_MESSAGE_AUDIO;
+    body.clear();
+    body.push_back(MakeAudioHead(msg));
+    body.append(msg.data);
+    return 0;
+}
+
+int RtmpEncodedMessage::Encode(const RtmpVideoMessage& msg) {
+    if (!policy::is_video_frame_type_valid(msg.frame_type)) {
+        LOG(WARNING) << "Invalid frame_type=" << (int)msg.frame_type;
+    }
+    if (!policy::is_video_codec_valid(msg.codec)) {
+        LOG(WARNING) << "Invalid codec=" << (int)msg.codec;
+    }
+    timestamp = msg.timestamp;
+    message_type = policy::RTMP_MESSAGE_VIDEO;
+    body.clear();
+    body.push_back(MakeVideoHead(msg));
+    body.append(msg.data);
+    return 0;
+}
+
+int RtmpEncodedMessage::Encode(const RtmpMetaData& msg,
+                               const butil::StringPiece& name) {
+    timestamp = msg.timestamp;
+    message_type = policy::RTMP_MESSAGE_DATA_AMF0;
+    body.clear();
+    butil::IOBufAsZeroCopyOutputStream zc_stream(&body);
+    AMFOutputStream ostream(&zc_stream);
+    WriteAMFString(name, &ostream);
+    WriteAMFObject(msg.data, &ostream);
+    if (!ostream.good()) {
+        LOG(ERROR) << "Fail to serialize metadata";
+        return -1;
+    }
+    return 0;
+}
+
+bool RtmpEncodedMessage::is_audio() const {
+    return message_type == policy::RTMP_MESSAGE_AUDIO;
+}
+
+bool RtmpEncodedMessage::is_video() const {
+    return message_type == policy::RTMP_MESSAGE_VIDEO;
+}
+
+bool RtmpEncodedMessage::is_metadata() const {
+    return message_type == policy::RTMP_MESSAGE_DATA_AMF0;
+}
+
+bool RtmpEncodedMessage::IsKeyFrame() const {
+    const uint8_t* p = (const uint8_t*)body.fetch1();
+    return is_video() && p != NULL &&
+        ((*p >> 4) & 0xF) == FLV_VIDEO_FRAME_KEYFRAME;
+}
+
+bool RtmpEncodedMessage::IsSequenceHeader() const {
+    uint8_t head[2];
+    const uint8_t* p = (const uint8_t*)body.fetch(head, sizeof(head));
+    if (p == NULL) {
+        return false;
+    }
+    if (is_audio()) {
+        return ((p[0] >> 4) & 0xF) == FLV_AUDIO_AAC &&
+            p[1] == FLV_AAC_PACKET_SEQUENCE_HEADER;
+    }
+    if (is_video()) {
+        const int codec = (p[0] & 0xF);
+        // HEVC in FLV uses the same packet types as AVC.
+        return (codec == FLV_VIDEO_AVC || codec == FLV_VIDEO_HEVC) &&
+            ((p[0] >> 4) & 0xF) == FLV_VIDEO_FRAME_KEYFRAME &&
+            p[1] == FLV_AVC_PACKET_SEQUENCE_HEADER;
+    }
+    return false;
+}
+
+RtmpGopCache::RtmpGopCache(size_t max_gop_messages)
+    : _max_gop_messages(max_gop_messages) {}
+
+void RtmpGopCache::Add(const RtmpEncodedMessage& msg) {
+    const bool is_header = msg.is_metadata() || msg.IsSequenceHeader();
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (is_header) {
+        // Keep at most one metadata, one audio and one video header.
+        for (size_t i = 0; i < _headers.size(); ++i) {
+            if (_headers[i].message_type == msg.message_type) {
+                _headers[i] = msg;
+                return;
+            }
+        }
+        _headers.push_back(msg);
+        return;
+    }
+    if (msg.IsKeyFrame()) {
+        _gop.clear();
+    } else if (_gop.size() >= _max_gop_messages) {
+        _gop.clear();
+        return;
+    } else if (_gop.empty() && msg.is_video()) {
+        // Players can't decode inter frames before a keyframe.
+        return;
+    }
+    _gop.push_back(msg);
+}
+
+int RtmpGopCache::SendTo(RtmpStreamBase* stream) const {
+    // Copying messages only references the bodies.
+    std::vector<RtmpEncodedMessage> msgs;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        msgs.reserve(_headers.size() + _gop.size());
+        msgs.insert(msgs.end(), _headers.begin(), _headers.end());
+        msgs.insert(msgs.end(), _gop.begin(), _gop.end());
+    }
+    for (size_t i = 0; i < msgs.size(); ++i) {
+        if (stream->SendEncodedMessage(msgs[i]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void RtmpGopCache::Clear() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    _headers.clear();
+    _gop.clear();
+}
+
+size_t RtmpGopCache::gop_size() const {
+    BAIDU_SCOPED_LOCK(_mutex);
+    return _gop.size();
+}
+
 int RtmpStreamBase::SendStopMessage(const butil::StringPiece&) {
     return -1;
 }
@@ -2511,6 +2660,14 @@ int RtmpRetryingClientStream::SendAACMessage(const RtmpAACMessage& msg) {
     return ptr->SendAACMessage(msg);
 }
 
+int RtmpRetryingClientStream::SendEncodedMessage(const RtmpEncodedMessage& msg) {
+    butil::intrusive_ptr<RtmpStreamBase> ptr;
+    if (AcquireStreamToSend(&ptr) != 0) {
+        return -1;
+    }
+    return ptr->SendEncodedMessage(msg);
+}
+
 int RtmpRetryingClientStream::SendVideoMessage(const RtmpVideoMessage& msg) {
     butil::intrusive_ptr<RtmpStreamBase> ptr;
     if (AcquireStreamToSend(&ptr) != 0) {
@@ -514,6 +514,32 @@ enum RtmpLimitType {
     RTMP_LIMIT_DYNAMIC = 2
 };
 
+// A media message encoded into the body of a RTMP message for once. Sending
+// it to streams shares the body by reference, so that fanning a published
+// message out to many players neither encodes nor copies the payload again.
+struct RtmpEncodedMessage {
+    RtmpEncodedMessage() : timestamp(0), message_type(0) {}
+
+    // Encode `msg' into this message.
+    // Returns 0 on success, -1 otherwise.
+    int Encode(const RtmpAudioMessage& msg);
+    int Encode(const RtmpVideoMessage& msg);
+    int Encode(const RtmpMetaData& msg,
+               const butil::StringPiece& name = "onMetaData");
+
+    bool is_audio() const;
+    bool is_video() const;
+    bool is_metadata() const;
+    // True iff this message is a video keyframe.
+    bool IsKeyFrame() const;
+    // True iff this message is a sequence header of AAC, AVC or HEVC.
+    bool IsSequenceHeader() const;
+
+    uint32_t timestamp;
+    uint8_t message_type;
+    butil::IOBuf body;
+};
+
 // The common part of RtmpClientStream and RtmpServerStream.
 class RtmpStreamBase : public SharedObject 
                      , public Destroyable {
@@ -560,6 +586,8 @@ public:
     virtual int SendAACMessage(const RtmpAACMessage& msg);
     virtual int SendVideoMessage(const RtmpVideoMessage& msg);
     virtual int SendAVCMessage(const RtmpAVCMessage& msg);
+    // Send a pre-encoded message. The body is referenced rather than copied.
+    virtual int SendEncodedMessage(const RtmpEncodedMessage& msg);
     // msg is owned by the caller of this function
     virtual int SendUserMessage(void* msg);
 
@@ -650,6 +678,49 @@ friend class policy::OnServerStreamCreated;
     butil::atomic<bool> _is_server_accepted;
 };
 
+// Cache of a published stream for players to start at once: the latest
+// metadata, the latest sequence headers and messages since the latest video
+// keyframe(the current GOP). Messages are cached in encoded form and shared
+// by all players. Methods are thread-safe.
+// Example:
+//   // In OnXXXMessage of the publishing stream
+//   brpc::RtmpEncodedMessage encoded;
+//   encoded.Encode(*msg);
+//   gop_cache.Add(encoded);
+//   for (each player) { player->SendEncodedMessage(encoded); }
+//   // When a new player comes
+//   gop_cache.SendTo(new_player);
+class RtmpGopCache {
+public:
+    // Messages of the current GOP are dropped when there're more than
+    // `max_gop_messages' of them, in which case new players wait for the
+    // next keyframe.
+    explicit RtmpGopCache(size_t max_gop_messages = 4096);
+
+    // Cache `msg'. Metadata and sequence headers replace previous ones, a
+    // video keyframe starts a new GOP.
+    void Add(const RtmpEncodedMessage& msg);
+
+    // Send cached messages to `stream' in the order of metadata, sequence
+    // headers and the current GOP.
+    // Returns 0 on success, -1 otherwise.
+    int SendTo(RtmpStreamBase* stream) const;
+
+    // Remove all cached messages, e.g. when the publisher is restarted.
+    void Clear();
+
+    // Number of messages in the current GOP.
+    size_t gop_size() const;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(RtmpGopCache);
+
+    size_t _max_gop_messages;
+    mutable butil::Mutex _mutex;
+    std::vector<RtmpEncodedMessage> _headers;
+    std::vector<RtmpEncodedMessage> _gop;
+};
+
 struct RtmpClientOptions {
     // Constructed with default options.
     RtmpClientOptions();
@@ -978,6 +1049,7 @@ public:
     int SendAACMessage(const RtmpAACMessage& msg);
     int SendVideoMessage(const RtmpVideoMessage& msg);
     int SendAVCMessage(const RtmpAVCMessage& msg);
+    int SendEncodedMessage(const RtmpEncodedMessage& msg);
     butil::EndPoint remote_side() const;
     butil::EndPoint local_side() const;
 
@@ -22,6 +22,8 @@
 #include "brpc/socket.h"                             // SocketUser
 #include "brpc/load_balancer.h"                      // LoadBalancer
 #include "brpc/details/controller_private_accessor.h"        // RPCSender
+#include "brpc/details/serialized_request_cache.h"
+#include "brpc/details/outlier_detector.h"
 #include "brpc/selective_channel.h"
 #include "brpc/global.h"
 
@@ -151,6 +153,8 @@ private:
     Resource _free_resources[2];
     Resource _alloc_resources[2];
     SubDone _sub_done0;
+    // Retries and backup requests share the serialized request.
+    SerializedRequestCache _request_cache;
 };
 
 // ===============================================
@@ -299,14 +303,27 @@ Sender::Sender(Controller* cntl,
 
 int Sender::IssueRPC(int64_t start_realtime_us) {
     _main_cntl->_current_call.need_feedback = false;
+    // Sub channels ejected for the method are avoided unless all sub
+    // channels are excluded.
+    ExcludedServers* ejected = NULL;
+    if (_main_cntl->_outlier_detector != NULL) {
+        ejected = _main_cntl->_outlier_detector->ExcludeEjected(
+            _main_cntl->_method, _main_cntl->_accessed);
+    }
     LoadBalancer::SelectIn sel_in = { start_realtime_us,
                                       true,
                                       _main_cntl->has_request_code(),
                                       _main_cntl->_request_code,
+                                      ejected != NULL ? ejected :
                                       _main_cntl->_accessed };
     ChannelBalancer::SelectOut sel_out;
-    const int rc = static_cast<ChannelBalancer*>(_main_cntl->_lb.get())
-        ->SelectChannel(sel_in, &sel_out);
+    ChannelBalancer* lb = static_cast<ChannelBalancer*>(_main_cntl->_lb.get());
+    int rc = lb->SelectChannel(sel_in, &sel_out);
+    if (rc != 0 && ejected != NULL) {
+        sel_in.excluded = _main_cntl->_accessed;
+        rc = lb->SelectChannel(sel_in, &sel_out);
+    }
+    ExcludedServers::Destroy(ejected);
     if (rc != 0) {
         _main_cntl->SetFailed(rc, "Fail to select channel, %s", berror(rc));
         return -1;
@@ -340,6 +357,7 @@ int Sender::IssueRPC(int64_t start_realtime_us) {
     // Forward request attachment to the subcall
     sub_cntl->request_attachment().append(_main_cntl->request_attachment());
     sub_cntl->http_request() = _main_cntl->http_request();
+    sub_cntl->_request_cache = &_request_cache;
 
     sel_out.channel()->CallMethod(_main_cntl->_method,
                                   &r.sub_done->_cntl,
@@ -525,6 +543,9 @@ int SelectiveChannel::Init(const char* lb_name, const ChannelOptions* options) {
         _chan._options.auth = NULL;
     }
     _chan._options.protocol = PROTOCOL_UNKNOWN;
+    if (_chan._options.enable_outlier_detection) {
+        _chan._outlier_detector = std::make_shared<OutlierDetector>();
+    }
     return 0;
 }
 
@@ -0,0 +1,109 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <limits.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include "brpc/serialized_field.h"
+
+namespace brpc {
+
+typedef google::protobuf::internal::WireFormatLite WireFormatLite;
+
+int FindSerializedFields(const butil::IOBuf& buf,
+                         SerializedField* fields, size_t nfield) {
+    for (size_t i = 0; i < nfield; ++i) {
+        fields[i].wire_type = -1;
+        fields[i].value = 0;
+        fields[i].bytes.clear();
+    }
+    butil::IOBufAsZeroCopyInputStream stream(buf);
+    google::protobuf::io::CodedInputStream decoder(&stream);
+#if GOOGLE_PROTOBUF_VERSION >= 3006000
+    decoder.SetTotalBytesLimit(INT_MAX);
+#else
+    decoder.SetTotalBytesLimit(INT_MAX, -1);
+#endif
+    size_t nfound = 0;
+    while (nfound < nfield) {
+        const uint32_t tag = decoder.ReadTag();
+        if (tag == 0) {
+            // End of the message.
+            return decoder.ConsumedEntireMessage() ? 0 : -1;
+        }
+        const int number = WireFormatLite::GetTagFieldNumber(tag);
+        const int wire_type = WireFormatLite::GetTagWireType(tag);
+        SerializedField* field = NULL;
+        for (size_t i = 0; i < nfield; ++i) {
+            if (fields[i].number == number && fields[i].wire_type < 0) {
+                field = &fields[i];
+                break;
+            }
+        }
+        uint64_t value = 0;
+        uint32_t value32 = 0;
+        uint32_t length = 0;
+        switch (wire_type) {
+        case WireFormatLite::WIRETYPE_VARINT:
+            if (!decoder.ReadVarint64(&value)) {
+                return -1;
+            }
+            break;
+        case WireFormatLite::WIRETYPE_FIXED64:
+            if (!decoder.ReadLittleEndian64(&value)) {
+                return -1;
+            }
+            break;
+        case WireFormatLite::WIRETYPE_FIXED32:
+            if (!decoder.ReadLittleEndian32(&value32)) {
+                return -1;
+            }
+            value = value32;
+            break;
+        case WireFormatLite::WIRETYPE_LENGTH_DELIMITED: {
+            if (!decoder.ReadVarint32(&length)) {
+                return -1;
+            }
+            const size_t offset = decoder.CurrentPosition();
+            if (!decoder.Skip(length)) {
+                return -1;
+            }
+            if (field != NULL) {
+                buf.append_to(&field->bytes, length, offset);
+            }
+            break;
+        }
+        case WireFormatLite::WIRETYPE_START_GROUP:
+            // Deprecated groups are skipped along with their nested fields.
+            if (!WireFormatLite::SkipField(&decoder, tag)) {
+                return -1;
+            }
+            break;
+        default:
+            return -1;
+        }
+        if (field != NULL) {
+            field->wire_type = wire_type;
+            field->value = value;
+            ++nfound;
+        }
+    }
+    return 0;
+}
+
+} // namespace brpc
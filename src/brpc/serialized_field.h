@@ -0,0 +1,68 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_SERIALIZED_FIELD_H
+#define BRPC_SERIALIZED_FIELD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "butil/iobuf.h"
+
+namespace brpc {
+
+// A field to find in a serialized protobuf message.
+struct SerializedField {
+    explicit SerializedField(int number2 = 0)
+        : number(number2), wire_type(-1), value(0) {}
+
+    // [Input] Number of the field in the .proto.
+    int number;
+
+    // [Output] Wire type(WireFormatLite::WireType) of the field, -1 when
+    // the field is not found.
+    int wire_type;
+    // Value of varint(int32/int64/uint32/uint64/bool/enum, sint* are
+    // zigzag-encoded), fixed32(fixed32/sfixed32/float) and
+    // fixed64(fixed64/sfixed64/double) fields.
+    uint64_t value;
+    // Content of length-delimited(string/bytes/sub-message/packed repeated)
+    // fields, referencing memory of the message without copying.
+    butil::IOBuf bytes;
+};
+
+// Find fields of `fields[0..nfield)' in serialized protobuf message `buf'
+// without parsing the whole message, to route requests kept in
+// SerializedRequest (BaiduMasterService) which can be forwarded to other
+// servers without re-serialization.
+// Values of sub-messages are skipped without being decoded, scanning stops
+// as soon as all fields are found. Notice that the first occurrence of a
+// field is taken, which is the same as parsing unless the field is written
+// more than once (e.g. messages are concatenated).
+// Returns 0 on success, -1 when `buf' is not a valid protobuf message.
+// Example:
+//   brpc::SerializedField fields[2] = { brpc::SerializedField(1),
+//                                       brpc::SerializedField(5) };
+//   if (brpc::FindSerializedFields(request->serialized_data(), fields, 2) != 0
+//       || fields[0].wire_type < 0) { ... }
+//   const std::string user = fields[0].bytes.to_string();
+int FindSerializedFields(const butil::IOBuf& buf,
+                         SerializedField* fields, size_t nfield);
+
+} // namespace brpc
+
+#endif  // BRPC_SERIALIZED_FIELD_H
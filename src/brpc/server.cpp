@@ -17,6 +17,7 @@
 
 
 #include <iomanip>
+#include <set>
 #include <arpa/inet.h>                              // inet_aton
 #include <fcntl.h>                                  // O_CREAT
 #include <sys/stat.h>                               // mkdir
@@ -26,15 +27,21 @@
 #include "bthread/unstable.h"                       // bthread_keytable_pool_init
 #include "butil/macros.h"                           // ARRAY_SIZE
 #include "butil/fd_guard.h"                         // fd_guard
+#include "butil/fd_utility.h"                       // make_non_blocking
+#include "butil/unix_socket.h"                      // unix_socket_listen
 #include "butil/logging.h"                          // CHECK
 #include "butil/time.h"
 #include "butil/class_name.h"
 #include "butil/string_printf.h"
+#include "butil/strings/string_util.h"
 #include "butil/debug/leak_annotations.h"
 #include "brpc/log.h"
 #include "brpc/compress.h"
 #include "brpc/checksum.h"
 #include "brpc/policy/nova_pbrpc_protocol.h"
+#include "brpc/policy/priority_concurrency_limiter.h"
+#include "brpc/policy/constant_concurrency_limiter.h"
+#include "brpc/details/codel_admission.h"
 #include "brpc/global.h"
 #include "brpc/socket_map.h"                   // SocketMapList
 #include "brpc/acceptor.h"                     // Acceptor
@@ -69,6 +76,7 @@
 #include "brpc/builtin/prometheus_metrics_service.h"
 #include "brpc/builtin/memory_service.h"
 #include "brpc/details/method_status.h"
+#include "brpc/details/response_cache.h"
 #include "brpc/load_balancer.h"
 #include "brpc/naming_service.h"
 #include "brpc/simple_data_pool.h"
@@ -78,6 +86,9 @@
 #include "brpc/rtmp.h"
 #include "brpc/builtin/common.h"               // GetProgramName
 #include "brpc/details/tcmalloc_extension.h"
+#include "brpc/details/listen_fd_handoff.h"
+#include "brpc/details/udp_listener.h"
+#include "brpc/shm/shm_endpoint.h"
 #include "brpc/rdma/rdma_helper.h"
 #include "brpc/baidu_master_service.h"
 
@@ -93,6 +104,7 @@ void* bthread_get_assigned_data();
 }
 
 DECLARE_int32(task_group_ntags);
+DECLARE_bool(reuse_port);
 
 namespace brpc {
 
@@ -135,6 +147,7 @@ ServerOptions::ServerOptions()
     , server_owns_interceptor(false)
     , num_threads(8)
     , max_concurrency(0)
+    , shed_load_by_priority(false)
     , session_local_data_factory(NULL)
     , reserved_session_local_data(0)
     , thread_local_data_factory(NULL)
@@ -146,14 +159,21 @@ ServerOptions::ServerOptions()
     , has_builtin_services(true)
     , force_ssl(false)
     , use_rdma(false)
+    , use_shm(false)
     , baidu_master_service(NULL)
     , http_master_service(NULL)
     , health_reporter(NULL)
     , rtmp_service(NULL)
     , redis_service(NULL)
+    , memcache_service(NULL)
     , bthread_tag(BTHREAD_TAG_DEFAULT)
+    , num_reuse_port_listeners(1)
+    , udp_port(-1)
     , rpc_pb_message_factory(NULL)
-    , ignore_eovercrowded(false) {
+    , use_arena_for_rpc_pb_messages(false)
+    , ignore_eovercrowded(false)
+    , codel_target_ms(0)
+    , codel_interval_ms(100) {
     if (s_ncore > 0) {
         num_threads = s_ncore + 1;
     }
@@ -181,7 +201,9 @@ Server::MethodProperty::MethodProperty()
     , service(NULL)
     , method(NULL)
     , status(NULL)
-    , ignore_eovercrowded(false) {
+    , ignore_eovercrowded(false)
+    , response_cache(NULL)
+    , bthread_tag(BTHREAD_TAG_INVALID) {
 }
 
 static timeval GetUptime(void* arg/*start_time*/) {
@@ -324,6 +346,10 @@ void* Server::UpdateDerivedVars(void* arg) {
 
     server->_concurrency_bvar.expose_as(prefix, "concurrency");
 
+    if (server->_priority_cl) {
+        server->_priority_cl->Expose(prefix);
+    }
+
     bvar::PassiveStatus<timeval> uptime_st(
         prefix, "uptime", GetUptime, (void*)(intptr_t)start_us);
 
@@ -430,16 +456,22 @@ Server::Server(ProfilerLinker)
     , _failed_to_set_ignore_eovercrowded(false)
     , _am(NULL)
     , _internal_am(NULL)
+    , _udp_listener(NULL)
+    , _udp_port(-1)
     , _first_service(NULL)
     , _tab_info_list(NULL)
     , _global_restful_map(NULL)
     , _last_start_time(0)
     , _derivative_thread(INVALID_BTHREAD)
+    , _handoff_fd(-1)
+    , _handoff_thread(INVALID_BTHREAD)
     , _keytable_pool(NULL)
     , _eps_bvar(&_nerror_bvar)
     , _concurrency(0)
     , _concurrency_bvar(cast_no_barrier_int, &_concurrency)
-    , _has_progressive_read_method(false) {
+    , _has_progressive_read_method(false)
+    , _codel(NULL)
+    , _priority_cl(NULL) {
     BAIDU_CASSERT(offsetof(Server, _concurrency) % 64 == 0,
                   Server_concurrency_must_be_aligned_by_cacheline);
 }
@@ -473,6 +505,8 @@ Server::~Server() {
     _am = NULL;
     delete _internal_am;
     _internal_am = NULL;
+    delete _udp_listener;
+    _udp_listener = NULL;
 
     delete _tab_info_list;
     _tab_info_list = NULL;
@@ -480,6 +514,12 @@ Server::~Server() {
     delete _global_restful_map;
     _global_restful_map = NULL;
 
+    delete _codel;
+    _codel = NULL;
+
+    delete _priority_cl;
+    _priority_cl = NULL;
+
     if (!_options.pid_file.empty()) {
         unlink(_options.pid_file.c_str());
     }
@@ -494,9 +534,21 @@ Server::~Server() {
 
     delete _options.redis_service;
     _options.redis_service = NULL;
+
+    delete _options.memcache_service;
+    _options.memcache_service = NULL;
 }
 
 int Server::AddBuiltinServices() {
+    // Builtin services have about 50 methods, size the maps at once rather
+    // than growing them a few times.
+    if (_method_map.bucket_count() < 128) {
+        _method_map.resize(128);
+    }
+    if (_fullname_service_map.bucket_count() < 64) {
+        _fullname_service_map.resize(64);
+        _service_map.resize(64);
+    }
     // Firstly add services shown in tabs.
     if (AddBuiltinService(new (std::nothrow) StatusService)) {
         LOG(ERROR) << "Fail to add StatusService";
@@ -829,6 +881,8 @@ inline void copy_and_fill_server_options(ServerOptions& dst, const ServerOptions
 
         FREE_PTR_IF_NOT_REUSED(redis_service);
 
+        FREE_PTR_IF_NOT_REUSED(memcache_service);
+
         // copy data members directly
         dst = src;
     }
@@ -838,7 +892,11 @@ inline void copy_and_fill_server_options(ServerOptions& dst, const ServerOptions
     //   1. `dst` copied from user and user forgot to create
     //   2. `dst` created by our
     if (!dst.rpc_pb_message_factory) {
-        dst.rpc_pb_message_factory = new DefaultRpcPBMessageFactory();
+        if (dst.use_arena_for_rpc_pb_messages) {
+            dst.rpc_pb_message_factory = GetAdaptiveArenaRpcPBMessageFactory();
+        } else {
+            dst.rpc_pb_message_factory = new DefaultRpcPBMessageFactory();
+        }
     }
 }
 
@@ -888,6 +946,18 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
                    << FLAGS_task_group_ntags << ")";
         return -1;
     }
+    for (MethodMap::const_iterator it = _method_map.begin();
+         it != _method_map.end(); ++it) {
+        const bthread_tag_t tag = it->second.bthread_tag;
+        if (tag != BTHREAD_TAG_INVALID &&
+            (tag < BTHREAD_TAG_DEFAULT || tag >= FLAGS_task_group_ntags)) {
+            LOG(ERROR) << "Fail to set tag " << tag << " of method="
+                       << it->first << ", tag range is ["
+                       << BTHREAD_TAG_DEFAULT << ":"
+                       << FLAGS_task_group_ntags << ")";
+            return -1;
+        }
+    }
 
     if (_options.use_rdma) {
 #if BRPC_WITH_RDMA
@@ -1087,6 +1157,11 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
     if (_global_restful_map) {
         _global_restful_map->PrepareForFinding();
     }
+    if (FreezeServiceMaps() != 0) {
+        // Not fatal, lookups fall back to the FlatMaps.
+        LOG(WARNING) << "Fail to freeze maps of services";
+        UnfreezeServiceMaps();
+    }
 
     if (_options.num_threads > 0) {
         if (FLAGS_usercode_in_pthread) {
@@ -1098,6 +1173,28 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
         bthread_setconcurrency_by_tag(_options.num_threads, _options.bthread_tag);
     }
 
+    if (!policy::PriorityConcurrencyLimiter::ValidateMaxRatios(
+            _options.priority_max_concurrency_ratios)) {
+        LOG(ERROR) << "Invalid ServerOptions.priority_max_concurrency_ratios";
+        return -1;
+    }
+    delete _priority_cl;
+    _priority_cl = NULL;
+    if (_options.shed_load_by_priority) {
+        _priority_cl = new policy::PriorityConcurrencyLimiter(
+            new policy::ConstantConcurrencyLimiter(
+                std::max(_options.max_concurrency, 0)),
+            _options.priority_max_concurrency_ratios);
+    }
+
+    delete _codel;
+    _codel = NULL;
+    if (_options.codel_target_ms > 0) {
+        _codel = new CodelAdmission(
+            _options.codel_target_ms * 1000L,
+            std::max(_options.codel_interval_ms, _options.codel_target_ms) * 1000L);
+    }
+
     for (MethodMap::iterator it = _method_map.begin();
         it != _method_map.end(); ++it) {
         if (it->second.is_builtin_service) {
@@ -1112,6 +1209,10 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
                 LOG(ERROR) << "Fail to create ConcurrencyLimiter for method";
                 return -1;
             }
+            if (cl != NULL && _options.shed_load_by_priority) {
+                cl = new policy::PriorityConcurrencyLimiter(
+                    cl, _options.priority_max_concurrency_ratios);
+            }
             it->second.status->SetConcurrencyLimiter(cl);
             it->second.max_concurrency.SetConcurrencyLimiter(cl);
         }
@@ -1137,10 +1238,40 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
         LOG(ERROR) << "Only IPv4 address supports port range feature";
         return -1;
     }
+    const int nlisteners = std::max(_options.num_reuse_port_listeners, 1);
+    if (nlisteners > 1 && butil::get_endpoint_type(endpoint) == AF_UNIX) {
+        LOG(ERROR) << "ServerOptions.num_reuse_port_listeners="
+                   << nlisteners << " is not supported by unix domain socket";
+        return -1;
+    }
+    const bool reuse_port = (FLAGS_reuse_port || nlisteners > 1);
+    // Listening fds taken over from the old server.
+    std::vector<int> handoff_fds;
+    int handoff_internal_fd = -1;
+    if (!_options.handoff_path.empty()) {
+        if (butil::get_endpoint_type(endpoint) == AF_UNIX || _options.use_shm) {
+            LOG(ERROR) << "ServerOptions.handoff_path is not supported by "
+                "unix domain socket or use_shm";
+            return -1;
+        }
+        if (ReceiveListenFds(_options.handoff_path, &handoff_fds,
+                             &handoff_internal_fd) == 0) {
+            LOG(INFO) << "Took over " << handoff_fds.size()
+                      << " listening fds from " << _options.handoff_path;
+        }
+    }
     _listen_addr = endpoint;
     for (int port = port_range.min_port; port <= port_range.max_port; ++port) {
         _listen_addr.port = port;
-        butil::fd_guard sockfd(tcp_listen(_listen_addr));
+        int first_fd = -1;
+        if (!handoff_fds.empty()) {
+            first_fd = handoff_fds[0];
+            // Use the port of the fd.
+            _listen_addr.port = 0;
+        } else {
+            first_fd = tcp_listen(_listen_addr, reuse_port);
+        }
+        butil::fd_guard sockfd(first_fd);
         if (sockfd < 0) {
             if (port != port_range.max_port) { // not the last port, try next
                 continue;
@@ -1163,15 +1294,59 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
                 return -1;
             }
         }
+        // Other listeners share the port of the first one.
+        std::vector<int> listened_fds;
+        listened_fds.push_back(sockfd.release());
+        for (size_t i = nlisteners; i < handoff_fds.size(); ++i) {
+            close(handoff_fds[i]);
+        }
+        for (int i = 1; i < nlisteners; ++i) {
+            const int fd = ((size_t)i < handoff_fds.size() ? handoff_fds[i] :
+                            tcp_listen(_listen_addr, true));
+            if (fd < 0) {
+                PLOG(ERROR) << "Fail to listen " << _listen_addr
+                            << " with SO_REUSEPORT";
+                for (size_t j = 0; j < listened_fds.size(); ++j) {
+                    close(listened_fds[j]);
+                }
+                return -1;
+            }
+            listened_fds.push_back(fd);
+        }
+        int shm_listened_fd = -1;
+        if (_options.use_shm) {
+            shm_listened_fd = shm::ShmListen(_listen_addr.port);
+            if (shm_listened_fd < 0) {
+                PLOG(ERROR) << "Fail to listen "
+                            << shm::ShmSocketPath(_listen_addr.port);
+                for (size_t j = 0; j < listened_fds.size(); ++j) {
+                    close(listened_fds[j]);
+                }
+                return -1;
+            }
+            listened_fds.push_back(shm_listened_fd);
+        }
         if (_am == NULL) {
             _am = BuildAcceptor();
             if (NULL == _am) {
                 LOG(ERROR) << "Fail to build acceptor";
+                for (size_t j = 0; j < listened_fds.size(); ++j) {
+                    close(listened_fds[j]);
+                }
                 return -1;
             }
             _am->_use_rdma = _options.use_rdma;
             _am->_bthread_tag = _options.bthread_tag;
         }
+        if (_am->PinProtocol(_options.pinned_protocol.c_str()) != 0) {
+            LOG(ERROR) << "ServerOptions.pinned_protocol="
+                       << _options.pinned_protocol << " is not enabled";
+            for (size_t j = 0; j < listened_fds.size(); ++j) {
+                close(listened_fds[j]);
+            }
+            return -1;
+        }
+        _am->_shm_listened_fd = shm_listened_fd;
         // Set `_status' to RUNNING before accepting connections
         // to prevent requests being rejected as ELOGOFF
         _status = RUNNING;
@@ -1179,14 +1354,13 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
         GenerateVersionIfNeeded();
         g_running_server_count.fetch_add(1, butil::memory_order_relaxed);
 
-        // Pass ownership of `sockfd' to `_am'
-        if (_am->StartAccept(sockfd, _options.idle_timeout_sec,
+        // Pass ownership of `listened_fds' to `_am'
+        if (_am->StartAccept(listened_fds, _options.idle_timeout_sec,
                              _default_ssl_ctx,
                              _options.force_ssl) != 0) {
             LOG(ERROR) << "Fail to start acceptor";
             return -1;
         }
-        sockfd.release();
         break; // stop trying
     }
     if (_options.internal_port >= 0 && _options.has_builtin_services) {
@@ -1208,7 +1382,9 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
 
         butil::EndPoint internal_point = _listen_addr;
         internal_point.port = _options.internal_port;
-        butil::fd_guard sockfd(tcp_listen(internal_point));
+        butil::fd_guard sockfd(handoff_internal_fd >= 0 ? handoff_internal_fd :
+                               tcp_listen(internal_point));
+        handoff_internal_fd = -1;
         if (sockfd < 0) {
             LOG(ERROR) << "Fail to listen " << internal_point << " (internal)";
             return -1;
@@ -1229,9 +1405,32 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
         }
         sockfd.release();
     }
+    if (handoff_internal_fd >= 0) {
+        close(handoff_internal_fd);
+    }
+    if (_options.udp_port >= 0) {
+        if (butil::is_endpoint_extended(_listen_addr)) {
+            LOG(ERROR) << "udp_port is not supported for " << _listen_addr;
+            return -1;
+        }
+        butil::EndPoint udp_point = _listen_addr;
+        udp_point.port = _options.udp_port;
+        _udp_listener = new UdpListener(this);
+        if (_udp_listener->Start(udp_point, nlisteners, FLAGS_reuse_port,
+                                 _options.bthread_tag, &_udp_port) != 0) {
+            LOG(ERROR) << "Fail to receive datagrams on " << udp_point;
+            delete _udp_listener;
+            _udp_listener = NULL;
+            return -1;
+        }
+    }
 
     PutPidFileIfNeeded();
 
+    if (!_options.handoff_path.empty() && StartHandoff() != 0) {
+        return -1;
+    }
+
     // Launch _derivative_thread.
     CHECK_EQ(INVALID_BTHREAD, _derivative_thread);
     bthread_attr_t tmp = BTHREAD_ATTR_NORMAL;
@@ -1326,6 +1525,9 @@ int Server::Stop(int timeout_ms) {
         // TODO: calculate timeout?
         _internal_am->StopAccept(timeout_ms);
     }
+    if (_udp_listener) {
+        _udp_listener->Stop();
+    }
     return 0;
 }
 
@@ -1340,6 +1542,15 @@ int Server::Join() {
     if (_internal_am) {
         _internal_am->Join();
     }
+    if (_udp_listener) {
+        _udp_listener->Join();
+        delete _udp_listener;
+        _udp_listener = NULL;
+        _udp_port = -1;
+    }
+    if (_options.use_shm) {
+        shm::RemoveShmSocket(_listen_addr.port);
+    }
 
     if (_session_local_data_pool) {
         // We can't delete the pool right here because there's a bvar watching
@@ -1375,11 +1586,95 @@ int Server::Join() {
         _derivative_thread = INVALID_BTHREAD;
     }
 
+    if (_handoff_thread != INVALID_BTHREAD) {
+        bthread_stop(_handoff_thread);
+        bthread_join(_handoff_thread, NULL);
+        _handoff_thread = INVALID_BTHREAD;
+    }
+    if (_handoff_fd >= 0) {
+        // Not unlink the path which may be served by the new server.
+        close(_handoff_fd);
+        _handoff_fd = -1;
+    }
+
     g_running_server_count.fetch_sub(1, butil::memory_order_relaxed);
     _status = READY;
     return 0;
 }
 
+int Server::StartHandoff() {
+    // Replace the path served by the old server, whose listening fds have
+    // been taken over (or it does not exist).
+    _handoff_fd = butil::unix_socket_listen(_options.handoff_path.c_str(), true);
+    if (_handoff_fd < 0) {
+        PLOG(ERROR) << "Fail to listen " << _options.handoff_path;
+        return -1;
+    }
+    butil::make_non_blocking(_handoff_fd);
+    butil::make_close_on_exec(_handoff_fd);
+    bthread_attr_t tmp = BTHREAD_ATTR_NORMAL;
+    tmp.tag = _options.bthread_tag;
+    if (bthread_start_background(&_handoff_thread, &tmp, RunHandoff, this) != 0) {
+        LOG(ERROR) << "Fail to create _handoff_thread";
+        return -1;
+    }
+    return 0;
+}
+
+void Server::CollectListenFds(std::vector<int>* fds, int* internal_fd) const {
+    fds->clear();
+    *internal_fd = -1;
+    if (_am) {
+        for (size_t i = 0; i < _am->_acception_ids.size(); ++i) {
+            SocketUniquePtr ptr;
+            if (Socket::Address(_am->_acception_ids[i], &ptr) == 0 &&
+                ptr->fd() != _am->_shm_listened_fd) {
+                fds->push_back(ptr->fd());
+            }
+        }
+    }
+    if (_internal_am) {
+        *internal_fd = _internal_am->listened_fd();
+    }
+}
+
+void* Server::RunHandoff(void* arg) {
+    Server* server = static_cast<Server*>(arg);
+    while (!bthread_stopped(bthread_self())) {
+        const timespec abstime = butil::seconds_from_now(1);
+        if (bthread_fd_timedwait(server->_handoff_fd, EPOLLIN, &abstime) != 0 &&
+            errno != ETIMEDOUT) {
+            if (errno == ESTOP || errno == EINTR) {
+                continue;
+            }
+            PLOG(ERROR) << "Fail to wait " << server->_options.handoff_path;
+            return NULL;
+        }
+        butil::fd_guard conn(accept(server->_handoff_fd, NULL, NULL));
+        if (conn < 0) {
+            continue;
+        }
+        butil::make_blocking(conn);
+        if (!server->IsRunning()) {
+            // Listening fds are closed, the new server should listen.
+            continue;
+        }
+        std::vector<int> fds;
+        int internal_fd = -1;
+        server->CollectListenFds(&fds, &internal_fd);
+        if (SendListenFds(conn, fds, internal_fd) != 0) {
+            continue;
+        }
+        LOG(INFO) << "Listening fds of Server[" << server->version()
+                  << "] were taken over through "
+                  << server->_options.handoff_path << ", stop it";
+        server->Stop(0);
+        AskToQuit();
+        return NULL;
+    }
+    return NULL;
+}
+
 int Server::AddServiceInternal(google::protobuf::Service* service,
                                bool is_builtin_service,
                                const ServiceOptions& svc_opt) {
@@ -1403,6 +1698,7 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
                    << version() << "] which is " << status_str(status());
         return -1;
     }
+    UnfreezeServiceMaps();
 
     if (_fullname_service_map.seek(sd->full_name()) != NULL) {
         LOG(ERROR) << "service=" << sd->full_name() << " already exists";
@@ -1420,6 +1716,37 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
     // defined `option (idl_support) = true' or not.
     const bool is_idl_support = sd->file()->options().GetExtension(idl_support);
 
+    std::set<std::string> cached_methods;
+    for (butil::StringSplitter sp(svc_opt.response_cache_methods.c_str(), ',');
+         sp; ++sp) {
+        std::string name(sp.field(), sp.length());
+        butil::TrimWhitespaceASCII(name, butil::TRIM_ALL, &name);
+        if (name.empty()) {
+            continue;
+        }
+        if (sd->FindMethodByName(name) == NULL) {
+            LOG(ERROR) << "No method=" << name << " in service="
+                       << sd->full_name() << " to cache responses";
+            return -1;
+        }
+        cached_methods.insert(name);
+    }
+    if (!cached_methods.empty() && (svc_opt.response_cache_ttl_ms <= 0 ||
+                                    svc_opt.response_cache_max_bytes <= 0)) {
+        LOG(ERROR) << "response_cache_ttl_ms and response_cache_max_bytes of"
+            " service=" << sd->full_name() << " must be positive";
+        return -1;
+    }
+    std::vector<std::string> cache_user_fields;
+    for (butil::StringSplitter sp(svc_opt.response_cache_user_fields.c_str(), ',');
+         sp; ++sp) {
+        std::string name(sp.field(), sp.length());
+        butil::TrimWhitespaceASCII(name, butil::TRIM_ALL, &name);
+        if (!name.empty()) {
+            cache_user_fields.push_back(name);
+        }
+    }
+
     Tabbed* tabbed = dynamic_cast<Tabbed*>(service);
     for (int i = 0; i < sd->method_count(); ++i) {
         const google::protobuf::MethodDescriptor* md = sd->method(i);
@@ -1437,7 +1764,13 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
         }
         mp.service = service;
         mp.method = md;
+        mp.bthread_tag = svc_opt.bthread_tag;
         mp.status = new MethodStatus;
+        if (cached_methods.count(md->name())) {
+            mp.response_cache = new ResponseCache(
+                md->full_name(), svc_opt.response_cache_ttl_ms,
+                svc_opt.response_cache_max_bytes, cache_user_fields);
+        }
         _method_map[md->full_name()] = mp;
         if (is_idl_support && sd->name() != sd->full_name()/*has ns*/) {
             MethodProperty mp2 = mp;
@@ -1623,6 +1956,9 @@ ServiceOptions::ServiceOptions()
 #endif
     , pb_single_repeated_to_array(false)
     , enable_progressive_read(false)
+    , response_cache_ttl_ms(1000)
+    , response_cache_max_bytes(64 * 1024 * 1024)
+    , bthread_tag(BTHREAD_TAG_INVALID)
     {}
 
 int Server::AddService(google::protobuf::Service* service,
@@ -1711,6 +2047,7 @@ void Server::RemoveMethodsOf(google::protobuf::Service* service) {
 
         if (mp->own_method_status) {
             delete mp->status;
+            delete mp->response_cache;
         }
         _method_map.erase(md->full_name());
     }
@@ -1734,6 +2071,7 @@ int Server::RemoveService(google::protobuf::Service* service) {
         RPC_VLOG << "Fail to find service=" << sd->full_name().c_str();
         return -1;
     }
+    UnfreezeServiceMaps();
     RemoveMethodsOf(service);
     if (ss->ownership == SERVER_OWNS_SERVICE) {
         delete ss->service;
@@ -1760,6 +2098,7 @@ void Server::ClearServices() {
             << "] which is " << status_str(status());
         return;
     }
+    UnfreezeServiceMaps();
     for (ServiceMap::const_iterator it = _fullname_service_map.begin();
          it != _fullname_service_map.end(); ++it) {
         if (it->second.ownership == SERVER_OWNS_SERVICE) {
@@ -1771,6 +2110,7 @@ void Server::ClearServices() {
          it != _method_map.end(); ++it) {
         if (it->second.own_method_status) {
             delete it->second.status;
+            delete it->second.response_cache;
         }
         delete it->second.http_url;
     }
@@ -1825,7 +2165,8 @@ void Server::GenerateVersionIfNeeded() {
         return;
     }
     int extra_count = !!_options.nshead_service + !!_options.rtmp_service +
-        !!_options.thrift_service + !!_options.redis_service;
+        !!_options.thrift_service + !!_options.redis_service +
+        !!_options.memcache_service;
     _version.reserve((extra_count + service_count()) * 20);
     for (ServiceMap::const_iterator it = _fullname_service_map.begin();
          it != _fullname_service_map.end(); ++it) {
@@ -1865,6 +2206,13 @@ void Server::GenerateVersionIfNeeded() {
         }
         _version.append(butil::class_name_str(*_options.redis_service));
     }
+
+    if (_options.memcache_service) {
+        if (!_version.empty()) {
+            _version.push_back('+');
+        }
+        _version.append(butil::class_name_str(*_options.memcache_service));
+    }
 }
 
 void Server::PutPidFileIfNeeded() {
@@ -1989,8 +2337,57 @@ bool IsDummyServerRunning() {
     return g_dummy_server != NULL;
 }
 
+int Server::FreezeServiceMaps() {
+    std::vector<std::pair<std::string, const MethodProperty*> > methods;
+    methods.reserve(_method_map.size());
+    for (MethodMap::const_iterator it = _method_map.begin();
+         it != _method_map.end(); ++it) {
+        methods.push_back(std::make_pair(it->first, &it->second));
+    }
+    if (_frozen_method_map.init(methods) != 0) {
+        return -1;
+    }
+    const ServiceMap* const maps[] = { &_fullname_service_map, &_service_map };
+    FrozenNameMap<FrozenService>* const frozen_maps[] =
+        { &_frozen_fullname_service_map, &_frozen_service_map };
+    for (size_t i = 0; i < arraysize(maps); ++i) {
+        std::vector<std::pair<std::string, FrozenService> > services;
+        services.reserve(maps[i]->size());
+        for (ServiceMap::const_iterator it = maps[i]->begin();
+             it != maps[i]->end(); ++it) {
+            services.push_back(std::make_pair(it->first, FrozenService()));
+            FrozenService& fs = services.back().second;
+            fs.service = &it->second;
+            if (it->second.service == NULL) {
+                // Virtual services of restful mappings.
+                continue;
+            }
+            const google::protobuf::ServiceDescriptor* sd =
+                it->second.service->GetDescriptor();
+            fs.methods.resize(sd->method_count());
+            for (int j = 0; j < sd->method_count(); ++j) {
+                fs.methods[j] = _method_map.seek(sd->method(j)->full_name());
+            }
+        }
+        if (frozen_maps[i]->init(services) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void Server::UnfreezeServiceMaps() {
+    _frozen_method_map.clear();
+    _frozen_fullname_service_map.clear();
+    _frozen_service_map.clear();
+}
+
 const Server::MethodProperty*
 Server::FindMethodPropertyByFullName(const butil::StringPiece& fullname) const  {
+    if (_frozen_method_map.initialized()) {
+        const MethodProperty* const* mp = _frozen_method_map.seek(fullname);
+        return mp ? *mp : NULL;
+    }
     return _method_map.seek(fullname);
 }
 
@@ -2018,6 +2415,14 @@ Server::FindMethodPropertyByFullName(const butil::StringPiece& service_name/*ful
 const Server::MethodProperty*
 Server::FindMethodPropertyByNameAndIndex(const butil::StringPiece& service_name,
                                          int method_index) const {
+    if (_frozen_service_map.initialized()) {
+        const FrozenService* fs = _frozen_service_map.seek(service_name);
+        if (fs == NULL || method_index < 0 ||
+            (size_t)method_index >= fs->methods.size()) {
+            return NULL;
+        }
+        return fs->methods[method_index];
+    }
     const Server::ServiceProperty* sp = FindServicePropertyByName(service_name);
     if (NULL == sp) {
         return NULL;
@@ -2030,13 +2435,45 @@ Server::FindMethodPropertyByNameAndIndex(const butil::StringPiece& service_name,
     return FindMethodPropertyByFullName(method->full_name());
 }
 
+const Server::MethodProperty*
+Server::FindMethodPropertyByIndexHint(const butil::StringPiece& service_name,
+                                      const butil::StringPiece& method_name,
+                                      int method_index) const {
+    if (method_index < 0) {
+        return NULL;
+    }
+    // Service names without dots are short ones, the same as
+    // FindServicePropertyAdaptively().
+    const FrozenService* fs =
+        (service_name.find('.') == butil::StringPiece::npos ?
+         _frozen_service_map.seek(service_name) :
+         _frozen_fullname_service_map.seek(service_name));
+    if (fs == NULL || (size_t)method_index >= fs->methods.size()) {
+        return NULL;
+    }
+    const MethodProperty* mp = fs->methods[method_index];
+    // Peers may be built with different versions of the proto.
+    if (mp == NULL || mp->method->name() != method_name) {
+        return NULL;
+    }
+    return mp;
+}
+
 const Server::ServiceProperty*
 Server::FindServicePropertyByFullName(const butil::StringPiece& fullname) const {
+    if (_frozen_fullname_service_map.initialized()) {
+        const FrozenService* fs = _frozen_fullname_service_map.seek(fullname);
+        return fs ? fs->service : NULL;
+    }
     return _fullname_service_map.seek(fullname);
 }
 
 const Server::ServiceProperty*
 Server::FindServicePropertyByName(const butil::StringPiece& name) const {
+    if (_frozen_service_map.initialized()) {
+        const FrozenService* fs = _frozen_service_map.seek(name);
+        return fs ? fs->service : NULL;
+    }
     return _service_map.seek(name);
 }
 
@@ -2234,6 +2671,10 @@ int Server::ResetMaxConcurrency(int max_concurrency) {
         LOG(WARNING) << "ResetMaxConcurrency is only allowed for a Running Server";
         return -1;
     }
+    if (_priority_cl != NULL) {
+        _priority_cl->ResetMaxConcurrency(
+            AdaptiveMaxConcurrency(std::max(max_concurrency, 0)));
+    }
     // Assume that modifying int32 is atomical in X86
     _options.max_concurrency = max_concurrency;
     return 0;
@@ -2357,6 +2798,72 @@ bool Server::IgnoreEovercrowdedOf(const butil::StringPiece& full_method_name) co
     return mp->ignore_eovercrowded;
 }
 
+int Server::AliasRequestFieldsOf(const butil::StringPiece& full_method_name,
+                                 const std::vector<int>& field_numbers) {
+    MethodProperty* mp = _method_map.seek(full_method_name);
+    if (mp == NULL) {
+        LOG(ERROR) << "Fail to find method=" << full_method_name;
+        return -1;
+    }
+    if (IsRunning()) {
+        LOG(ERROR) << "AliasRequestFieldsOf is only allowed before Server started";
+        return -1;
+    }
+    const google::protobuf::Descriptor* req_desc = mp->method->input_type();
+    for (size_t i = 0; i < field_numbers.size(); ++i) {
+        const google::protobuf::FieldDescriptor* field =
+            req_desc->FindFieldByNumber(field_numbers[i]);
+        if (field == NULL) {
+            LOG(ERROR) << req_desc->full_name() << " does not have field="
+                       << field_numbers[i];
+            return -1;
+        }
+        if (field->is_repeated() ||
+            field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_STRING) {
+            LOG(ERROR) << "Field=" << field->full_name()
+                       << " is not a singular bytes/string field";
+            return -1;
+        }
+    }
+    mp->aliased_request_fields = field_numbers;
+    return 0;
+}
+
+int Server::SetCompressPolicyOf(const butil::StringPiece& full_method_name,
+                                CompressPolicy* policy) {
+    std::unique_ptr<CompressPolicy> policy_guard(policy);
+    MethodProperty* mp = _method_map.seek(full_method_name);
+    if (mp == NULL) {
+        LOG(ERROR) << "Fail to find method=" << full_method_name;
+        return -1;
+    }
+    if (IsRunning()) {
+        LOG(ERROR) << "SetCompressPolicyOf is only allowed before Server started";
+        return -1;
+    }
+    if (mp->status == NULL) {
+        LOG(ERROR) << "method=" << full_method_name << " does not have status";
+        return -1;
+    }
+    mp->status->SetCompressPolicy(policy_guard.release());
+    return 0;
+}
+
+int Server::SetBthreadTagOf(const butil::StringPiece& full_method_name,
+                            bthread_tag_t tag) {
+    MethodProperty* mp = _method_map.seek(full_method_name);
+    if (mp == NULL) {
+        LOG(ERROR) << "Fail to find method=" << full_method_name;
+        return -1;
+    }
+    if (IsRunning()) {
+        LOG(ERROR) << "SetBthreadTagOf is only allowed before Server started";
+        return -1;
+    }
+    mp->bthread_tag = tag;
+    return 0;
+}
+
 bool Server::AcceptRequest(Controller* cntl) const {
     const Interceptor* interceptor = _options.interceptor;
     if (!interceptor) {
@@ -37,10 +37,12 @@
 #include "brpc/data_factory.h"                 // DataFactory
 #include "brpc/builtin/tabbed.h"
 #include "brpc/details/profiler_linker.h"
+#include "brpc/details/frozen_name_map.h"
 #include "brpc/health_reporter.h"
 #include "brpc/adaptive_max_concurrency.h"
 #include "brpc/http2.h"
 #include "brpc/redis.h"
+#include "brpc/memcache.h"
 #include "brpc/interceptor.h"
 #include "brpc/concurrency_limiter.h"
 #include "brpc/baidu_master_service.h"
@@ -49,7 +51,9 @@
 namespace brpc {
 
 class Acceptor;
+class UdpListener;
 class MethodStatus;
+class CompressPolicy;
 class NsheadService;
 class ThriftService;
 class SimpleDataPool;
@@ -57,6 +61,8 @@ class MongoServiceAdaptor;
 class RestfulMap;
 class RtmpService;
 class RedisService;
+class ResponseCache;
+class CodelAdmission;
 struct SocketSSLContext;
 
 struct ServerOptions {
@@ -135,6 +141,25 @@ struct ServerOptions {
     // Overridable by Server.MaxConcurrencyOf().
     AdaptiveMaxConcurrency method_max_concurrency;
 
+    // Reserve part of max_concurrency of the server and of each method for
+    // requests of higher priorities (Controller.set_request_priority), so
+    // that requests of lower priorities are rejected first when the server
+    // or the method is overloaded. Each priority reserves
+    // -priority_cl_reserved_ratio of max_concurrency for the ones above it,
+    // unless `priority_max_concurrency_ratios' is set. Accepted and rejected
+    // requests of each priority are shown in /status for methods and exposed
+    // as bvars rpc_server_<port>_priority_<name>_accepted|rejected for the
+    // server.
+    // Default: false
+    bool shed_load_by_priority;
+
+    // Ratios of max_concurrency that requests of each priority can take when
+    // `shed_load_by_priority' is true, indexed by RequestPriority, e.g.
+    // {0.5, 0.8, 0.9, 1} limits sheddable requests to half of max_concurrency.
+    // Ratios must be in (0, 1] and not decrease with priorities.
+    // Default: empty (decided by -priority_cl_reserved_ratio)
+    std::vector<double> priority_max_concurrency_ratios;
+
     // -------------------------------------------------------
     // Differences between session-local and thread-local data
     // -------------------------------------------------------
@@ -227,6 +252,12 @@ struct ServerOptions {
     // Default: false
     bool use_rdma;
 
+    // Also accept shared-memory connections from clients on the same host
+    // (ChannelOptions.use_shm) through the unix socket of
+    // brpc::shm::ShmSocketPath(port). Not available to `internal_port'.
+    // Default: false
+    bool use_shm;
+
     // [CAUTION] This option is for implementing specialized baidu-std proxies,
     // most users don't need it. Don't change this option unless you fully
     // understand the description below.
@@ -262,6 +293,15 @@ struct ServerOptions {
     // Default: empty (all protocols)
     std::string enabled_protocols;
 
+    // Parse all connections to the port given to Start() with this protocol
+    // only, skipping detection of protocols on new connections, which saves
+    // CPU on short connections and rejects garbage quickly. Connections
+    // sending other protocols are closed, including http to builtin
+    // services, use internal_port for them. Must be enabled. internal_port
+    // is not affected.
+    // Default: empty (detect protocols)
+    std::string pinned_protocol;
+
     // Customize parameters of HTTP2, defined in http2.h
     H2Settings h2_settings;
 
@@ -270,6 +310,12 @@ struct ServerOptions {
     // Default: NULL (disabled)
     RedisService* redis_service;
 
+    // For processing memcache binary protocol. Read src/brpc/memcache.h
+    // for details.
+    // Owned by Server and deleted in server's destructor.
+    // Default: NULL (disabled)
+    MemcacheService* memcache_service;
+
     // Optional info name for composing server bvar prefix. Read ServerPrefix() method for details;
     // Default: ""
     std::string server_info_name;
@@ -278,6 +324,42 @@ struct ServerOptions {
     // Default: BTHREAD_TAG_DEFAULT
     bthread_tag_t bthread_tag;
 
+    // If this option > 1, server listens to the port with so many sockets
+    // bound with SO_REUSEPORT and the kernel spreads incoming connections
+    // over them. The i-th listener and all connections accepted from it are
+    // handled by the i-th EventDispatcher of `bthread_tag' (modulo
+    // -event_dispatcher_num), which removes the contention on a single
+    // accept queue and keeps each connection on the dispatcher accepting it.
+    // Set -event_dispatcher_num to the same value for best results.
+    // Not supported for unix domain sockets, and does not apply to
+    // `internal_port'.
+    // Default: 1
+    int num_reuse_port_listeners;
+
+    // If this option is non-negative, server also receives one-way baidu_std
+    // requests sent by UdpChannel in UDP datagrams on this port (of the same
+    // ip), 0 for a port chosen by kernel. No responses are sent, requests
+    // that fail are dropped silently. Datagrams are spread over
+    // `num_reuse_port_listeners' sockets bound with SO_REUSEPORT as well.
+    // Not supported for unix domain sockets.
+    // Default: -1 (disabled)
+    int udp_port;
+
+    // Path of an unix domain socket for restarting the server without
+    // closing the port. When the server is started, it first tries to take
+    // over listening fds (including the one of `internal_port') from the
+    // server serving this path (mostly the old process), instead of
+    // listening the port again. After starting, the server serves this path
+    // itself: once another server took over the fds, this server stops
+    // accepting, calls Stop() to let existing connections be closed after
+    // in-flight requests are done, and calls AskToQuit() so that
+    // RunUntilAskedToQuit() or loops checking IsAskedToQuit() return.
+    // Idle established connections are not handed over, clients reconnect
+    // to the new server after they're closed.
+    // Not supported for unix domain sockets or use_shm.
+    // Default: "" (disabled)
+    std::string handoff_path;
+
     // [CAUTION] This option is for implementing specialized rpc protobuf
     // message factory, most users don't need it. Don't change this option
     // unless you fully understand the description below.
@@ -287,11 +369,34 @@ struct ServerOptions {
     // Owned by Server and deleted in server's destructor.
     RpcPBMessageFactory* rpc_pb_message_factory;
 
+    // If this option is true and `rpc_pb_message_factory' is not set,
+    // request and response messages of baidu_std, http and h2/grpc are
+    // allocated from a protobuf Arena of each call, whose initial block is
+    // sized from recent calls of the method. The arena is freed in one shot
+    // after the response is sent, before session-local data of the call is
+    // returned. Handlers must not keep pointers into the messages (or
+    // arena-allocated objects created from them) beyond the call.
+    // See AdaptiveArenaRpcPBMessageFactory for details.
+    // Default: false
+    bool use_arena_for_rpc_pb_messages;
+
     // Ignore eovercrowded error on server side, i.e. , if eovercrowded is reported when server is processing a rpc request,
     // server will keep processing this request, it is expected to be used by some light-weight control-frame rpcs.
     // [CUATION] You should not enabling this option if your rpc is heavy-loaded.
     bool ignore_eovercrowded;
 
+    // If positive, requests of baidu_std and http are dropped with ELIMIT
+    // before being processed by the adaptive CoDel: when the minimum queueing
+    // time of requests stays above `codel_target_ms' for `codel_interval_ms',
+    // the server is overloaded and requests queued longer than
+    // `codel_target_ms' are dropped, otherwise the ones queued longer than
+    // `codel_interval_ms' are dropped. Dropped requests are counted in bvar
+    // rpc_server_codel_dropped_count.
+    // Default: 0 (disabled)
+    int codel_target_ms;
+    // Default: 100
+    int codel_interval_ms;
+
 private:
     // SSLOptions is large and not often used, allocate it on heap to
     // prevent ServerOptions from being bloated in most cases.
@@ -356,6 +461,39 @@ struct ServiceOptions {
     // enable server end progressive reading, mainly for http server
     // Default: false.
     bool enable_progressive_read;
+
+    // Comma-separated names of methods(without the service name) whose
+    // responses are cached by serialized requests, e.g. "Get,List". A
+    // request identical to a cached one is answered with the cached
+    // response directly without calling the method. Only methods returning
+    // the same response to the same request for `response_cache_ttl_ms'
+    // should be listed. Only baidu_std requests without attachments and
+    // checksums are cached.
+    // Default: empty
+    std::string response_cache_methods;
+
+    // Cached responses expire after so many milliseconds.
+    // Default: 1000
+    int64_t response_cache_ttl_ms;
+
+    // Least recently used responses are evicted when cached requests and
+    // responses of a method take more bytes than this.
+    // Default: 64MB
+    int64_t response_cache_max_bytes;
+
+    // Comma-separated names of request user fields which are parts of
+    // cache keys as well, e.g. the user field selecting a tenant.
+    // Default: empty
+    std::string response_cache_user_fields;
+
+    // Methods of the service run in bthreads of this tag instead of the
+    // tag of the server (ServerOptions.bthread_tag), so that expensive
+    // methods do not starve cheap ones of workers. Requests are still read
+    // and parsed in bthreads of the server. Only baidu_std and http(h2)
+    // requests are switched to the tag, and not when -usercode_in_pthread
+    // is on. Overridable by Server.SetBthreadTagOf().
+    // Default: BTHREAD_TAG_INVALID (same as the server)
+    bthread_tag_t bthread_tag;
 };
 
 // Represent ports inside [min_port, max_port]
@@ -423,6 +561,14 @@ public:
         // while other methods(ignore_eovercrowded=false) keep returning eovercrowded.
         // currently only valid for baidu_master_service, baidu_rpc, http_rpc, hulu_pbrpc and sofa_pbrpc protocols 
         bool ignore_eovercrowded;
+        // Numbers of request fields set by AliasRequestFieldsOf().
+        std::vector<int> aliased_request_fields;
+        // Set if the method is listed in ServiceOptions.response_cache_methods.
+        // Owned along with `status'.
+        ResponseCache* response_cache;
+        // Tag of bthreads running the method, BTHREAD_TAG_INVALID to run in
+        // the bthread processing the request.
+        bthread_tag_t bthread_tag;
 
         MethodProperty();
     };
@@ -563,6 +709,10 @@ public:
     // Return the address this server is listening
     butil::EndPoint listen_address() const { return _listen_addr; }
 
+    // Return the port receiving datagrams, -1 if ServerOptions.udp_port
+    // is not set.
+    int udp_port() const { return _udp_port; }
+
     // Last time that Start() was successfully called. 0 if Start() was
     // never called
     time_t last_start_time() const { return _last_start_time; }
@@ -604,6 +754,34 @@ public:
     bool& IgnoreEovercrowdedOf(const butil::StringPiece& full_method_name);
     bool IgnoreEovercrowdedOf(const butil::StringPiece& full_method_name) const;
 
+    // Make top-level bytes/string fields `field_numbers' of the request of
+    // the method not copied into the request message when it's parsed from
+    // baidu_std or http/h2 (without compression). The values reference
+    // blocks of the received buffer and can be read by
+    // Controller::aliased_request_field() until the controller is destroyed,
+    // while the fields in the request message are left unset.
+    // Suitable for methods with large bytes fields which are only read.
+    // Not applied to methods mapped by restful paths.
+    // Returns 0 on success, -1 otherwise.
+    // Note: This interface can ONLY be called before the server is started.
+    int AliasRequestFieldsOf(const butil::StringPiece& full_method_name,
+                             const std::vector<int>& field_numbers);
+
+    // Choose CompressType of baidu_std responses of the method by `policy'
+    // (e.g. AdaptiveCompressPolicy) instead of using the one set in the
+    // controller, which is passed to the policy as a preference.
+    // Ownership of `policy' is transferred to the server even on failure.
+    // Returns 0 on success, -1 otherwise.
+    // Note: This interface can ONLY be called before the server is started.
+    int SetCompressPolicyOf(const butil::StringPiece& full_method_name,
+                            CompressPolicy* policy);
+
+    // Run the method in bthreads of `tag', see ServiceOptions.bthread_tag.
+    // Returns 0 on success, -1 otherwise.
+    // Note: This interface can ONLY be called before the server is started.
+    int SetBthreadTagOf(const butil::StringPiece& full_method_name,
+                        bthread_tag_t tag);
+
     int Concurrency() const {
         return butil::subtle::NoBarrier_Load(&_concurrency);
     };
@@ -663,6 +841,11 @@ friend class Controller;
     void GenerateVersionIfNeeded();
     void PutPidFileIfNeeded();
 
+    // Serve ServerOptions.handoff_path.
+    int StartHandoff();
+    static void* RunHandoff(void*);
+    void CollectListenFds(std::vector<int>* fds, int* internal_fd) const;
+
     const MethodProperty*
     FindMethodPropertyByFullName(const butil::StringPiece& fullname) const;
 
@@ -680,6 +863,22 @@ friend class Controller;
     const ServiceProperty*
     FindServicePropertyByName(const butil::StringPiece& name) const;
 
+    // Same as FindMethodPropertyByFullName(service_name, method_name), but
+    // tries the method at `method_index' of the service first, which is
+    // checked by name. `service_name' is either full or short.
+    // Returns NULL if the hint is unusable, caller should fall back to
+    // other methods.
+    const MethodProperty*
+    FindMethodPropertyByIndexHint(const butil::StringPiece& service_name,
+                                  const butil::StringPiece& method_name,
+                                  int method_index) const;
+
+    // Build perfect-hashed copies of the maps of services and methods which
+    // are unchanged after Start(), lookups on them are faster than on the
+    // FlatMaps. Copies are dropped before any change of services.
+    int FreezeServiceMaps();
+    void UnfreezeServiceMaps();
+
     std::string ServerPrefix() const;
 
     // Mapping from hostname to corresponding SSL_CTX
@@ -743,6 +942,8 @@ friend class Controller;
     bool _failed_to_set_ignore_eovercrowded;
     Acceptor* _am;
     Acceptor* _internal_am;
+    UdpListener* _udp_listener;
+    int _udp_port;
 
     // Use method->full_name() as key
     MethodMap _method_map;
@@ -754,6 +955,18 @@ friend class Controller;
     // uses service->name() to designate an RPC service
     ServiceMap _service_map;
 
+    // Frozen copies of maps above, valid between Start() and the next
+    // change of services.
+    struct FrozenService {
+        FrozenService() : service(NULL) {}
+        const ServiceProperty* service;
+        // Indexed by MethodDescriptor::index().
+        std::vector<const MethodProperty*> methods;
+    };
+    FrozenNameMap<const MethodProperty*> _frozen_method_map;
+    FrozenNameMap<FrozenService> _frozen_fullname_service_map;
+    FrozenNameMap<FrozenService> _frozen_service_map;
+
     // The only non-builtin service in _service_map, otherwise NULL.
     google::protobuf::Service* _first_service;
 
@@ -784,6 +997,8 @@ friend class Controller;
     std::string _version;
     time_t _last_start_time;
     bthread_t _derivative_thread;
+    int _handoff_fd;
+    bthread_t _handoff_thread;
 
     bthread_keytable_pool_t* _keytable_pool;
 
@@ -794,6 +1009,13 @@ friend class Controller;
     bvar::PassiveStatus<int32_t> _concurrency_bvar;
 
     bool _has_progressive_read_method;
+
+    // Non-NULL if ServerOptions.codel_target_ms is positive.
+    CodelAdmission* _codel;
+
+    // Limits max_concurrency of the server by priorities, non-NULL if
+    // ServerOptions.shed_load_by_priority is true.
+    ConcurrencyLimiter* _priority_cl;
 };
 
 // Get the data attached to current searching thread. The data is created by
@@ -0,0 +1,454 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <gflags/gflags.h>
+#include "butil/atomicops.h"
+#include "butil/fd_guard.h"
+#include "butil/logging.h"
+#include "butil/string_printf.h"
+#include "bthread/butex.h"
+#include "brpc/errno.pb.h"
+#include "brpc/input_messenger.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/shm/shm_endpoint.h"
+
+namespace brpc {
+namespace shm {
+
+DEFINE_int32(shm_ring_size, 1024 * 1024,
+             "Bytes of the ring in each direction of a shm connection, "
+             "rounded up to power of 2");
+DEFINE_string(shm_socket_dir, "/tmp",
+              "Directory of unix sockets accepting shm connections");
+
+static bool PassValidateRingSize(const char*, int32_t val) {
+    return val >= 4096;
+}
+BRPC_VALIDATE_GFLAG(shm_ring_size, PassValidateRingSize);
+
+static const char SHM_MAGIC[4] = { 'S', 'H', 'M', '1' };
+static const size_t SHM_HEADER_SIZE = 4096;
+
+// One direction of the shared memory. `head' and `tail' are monotonic
+// byte offsets, written by the reader and the writer respectively.
+struct ShmRing {
+    butil::atomic<uint64_t> head;
+    char pad1[BAIDU_CACHELINE_SIZE - sizeof(butil::atomic<uint64_t>)];
+    butil::atomic<uint64_t> tail;
+    // Set by the writer when the ring is full, cleared by the reader who
+    // notifies the writer after consuming data.
+    butil::atomic<uint32_t> writer_waiting;
+    char pad2[BAIDU_CACHELINE_SIZE - sizeof(butil::atomic<uint64_t>)
+              - sizeof(butil::atomic<uint32_t>)];
+};
+
+// Placed at the beginning of the shared memory, followed by data of the
+// rings from client to server and from server to client.
+struct ShmHeader {
+    char magic[4];
+    uint32_t ring_size;
+    char pad[BAIDU_CACHELINE_SIZE - 8];
+    ShmRing rings[2];
+};
+BAIDU_CASSERT(sizeof(ShmHeader) <= SHM_HEADER_SIZE, too_big_shm_header);
+
+// Sent along with the memfd by the client.
+struct ShmHello {
+    char magic[4];
+    uint32_t ring_size;
+};
+
+std::string ShmSocketPath(int port) {
+    return butil::string_printf("%s/brpc_shm_%d.sock",
+                                FLAGS_shm_socket_dir.c_str(), port);
+}
+
+// Remove the socket at `path'. Returns 0 if `path' is removed or does not
+// exist, -1 if it's not a socket or can't be removed.
+static int RemoveSocketFile(const std::string& path) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        LOG(ERROR) << path << " exists and is not a socket";
+        errno = EEXIST;
+        return -1;
+    }
+    if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+        return -1;
+    }
+    return 0;
+}
+
+int ShmListen(int port) {
+    const std::string path = ShmSocketPath(port);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOG(ERROR) << "Too long path=" << path;
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    if (RemoveSocketFile(path) != 0) {
+        return -1;
+    }
+    butil::fd_guard fd(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (fd < 0) {
+        return -1;
+    }
+    // Mode of the socket file is taken from the socket on Linux, chmod()
+    // after bind() covers other systems. Nobody can connect before listen().
+    if (fchmod(fd, S_IRUSR | S_IWUSR) != 0 ||
+        bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        return -1;
+    }
+    if (chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0 ||
+        listen(fd, 65535) != 0) {
+        const int saved_errno = errno;
+        unlink(path.c_str());
+        errno = saved_errno;
+        return -1;
+    }
+    return fd.release();
+}
+
+void RemoveShmSocket(int port) {
+    RemoveSocketFile(ShmSocketPath(port));
+}
+
+int ToShmEndPoint(const butil::EndPoint& point, butil::EndPoint* out) {
+    if (butil::is_endpoint_extended(point)) {
+        return -1;
+    }
+    const in_addr_t ip = ntohl(butil::ip2int(point.ip));
+    if ((ip >> 24) != 127 && point.ip != butil::my_ip() &&
+        point.ip != butil::IP_ANY) {
+        return -1;
+    }
+    const std::string path = "unix:" + ShmSocketPath(point.port);
+    return butil::str2endpoint(path.c_str(), out);
+}
+
+void ShmConnect::StartConnect(const Socket* socket,
+                              void (*done)(int err, void* data),
+                              void* data) {
+    SocketUniquePtr s;
+    if (Socket::Address(socket->id(), &s) != 0) {
+        return;
+    }
+    ShmEndpoint* ep = ShmEndpoint::CreateAndSend(s.get(), s->fd());
+    if (ep == NULL) {
+        const int saved_errno = errno;
+        PLOG(WARNING) << "Fail to create shm rings of " << *s;
+        done(saved_errno ? saved_errno : EINVAL, data);
+        return;
+    }
+    delete s->_shm_ep;
+    s->_shm_ep = ep;
+    done(0, data);
+}
+
+ShmEndpoint::ShmEndpoint(Socket* s, int fd, void* mem, size_t mem_size,
+                         bool server_side)
+    : _socket(s)
+    , _fd(fd)
+    , _mem(mem)
+    , _mem_size(mem_size)
+    , _writer_blocked(false) {
+    ShmHeader* h = static_cast<ShmHeader*>(mem);
+    _ring_size = h->ring_size;
+    char* data = static_cast<char*>(mem) + SHM_HEADER_SIZE;
+    const int tx = server_side ? 1 : 0;
+    _tx = &h->rings[tx];
+    _tx_data = data + tx * _ring_size;
+    _rx = &h->rings[1 - tx];
+    _rx_data = data + (1 - tx) * _ring_size;
+}
+
+ShmEndpoint::~ShmEndpoint() {
+    munmap(_mem, _mem_size);
+}
+
+ShmEndpoint* ShmEndpoint::CreateAndSend(Socket* s, int fd) {
+#if defined(OS_LINUX)
+    size_t ring_size = 4096;
+    while (ring_size < (size_t)FLAGS_shm_ring_size) {
+        ring_size <<= 1;
+    }
+    const size_t mem_size = SHM_HEADER_SIZE + 2 * ring_size;
+    butil::fd_guard memfd(syscall(SYS_memfd_create, "brpc_shm", 0));
+    if (memfd < 0) {
+        return NULL;
+    }
+    if (ftruncate(memfd, mem_size) != 0) {
+        return NULL;
+    }
+    void* mem = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, memfd, 0);
+    if (mem == MAP_FAILED) {
+        return NULL;
+    }
+    // Pages of a new memfd are zeroed.
+    ShmHeader* h = new (mem) ShmHeader;
+    memcpy(h->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+    h->ring_size = ring_size;
+
+    ShmHello hello;
+    memcpy(hello.magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+    hello.ring_size = ring_size;
+    iovec iov = { &hello, sizeof(hello) };
+    char ctrl[CMSG_SPACE(sizeof(int))];
+    memset(ctrl, 0, sizeof(ctrl));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    const int sent_fd = memfd;
+    memcpy(CMSG_DATA(cmsg), &sent_fd, sizeof(int));
+    // The socket is just connected, the hello always fits in its buffer.
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(hello)) {
+        munmap(mem, mem_size);
+        return NULL;
+    }
+    return new ShmEndpoint(s, fd, mem, mem_size, false);
+#else
+    (void)s;
+    (void)fd;
+    errno = ENOTSUP;
+    return NULL;
+#endif
+}
+
+ShmEndpoint* ShmEndpoint::Receive(Socket* s, int fd) {
+    ShmHello hello;
+    iovec iov = { &hello, sizeof(hello) };
+    char ctrl[CMSG_SPACE(sizeof(int))];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    const ssize_t nr = recvmsg(fd, &msg, MSG_DONTWAIT);
+    if (nr < 0) {
+        return NULL;
+    }
+    if (nr == 0) {
+        errno = ECONNRESET;
+        return NULL;
+    }
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS) {
+        LOG(WARNING) << "No memfd from fd=" << fd;
+        errno = EPROTO;
+        return NULL;
+    }
+    int received_fd = -1;
+    memcpy(&received_fd, CMSG_DATA(cmsg), sizeof(int));
+    butil::fd_guard memfd(received_fd);
+    if (nr != (ssize_t)sizeof(hello) ||
+        memcmp(hello.magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0 ||
+        hello.ring_size < 4096 ||
+        (hello.ring_size & (hello.ring_size - 1)) != 0) {
+        LOG(WARNING) << "Invalid shm hello from fd=" << fd;
+        errno = EPROTO;
+        return NULL;
+    }
+    const size_t mem_size = SHM_HEADER_SIZE + 2 * (size_t)hello.ring_size;
+    struct stat st;
+    if (fstat(memfd, &st) != 0 || (size_t)st.st_size != mem_size) {
+        LOG(WARNING) << "Unmatched size of memfd from fd=" << fd;
+        errno = EPROTO;
+        return NULL;
+    }
+    void* mem = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, memfd, 0);
+    if (mem == MAP_FAILED) {
+        return NULL;
+    }
+    const ShmHeader* h = static_cast<const ShmHeader*>(mem);
+    if (memcmp(h->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0 ||
+        h->ring_size != hello.ring_size) {
+        LOG(WARNING) << "Invalid shm header from fd=" << fd;
+        munmap(mem, mem_size);
+        errno = EPROTO;
+        return NULL;
+    }
+    return new ShmEndpoint(s, fd, mem, mem_size, true);
+}
+
+void ShmEndpoint::Notify() {
+    const char c = 0;
+    // EAGAIN means that there're notifications not read by the peer yet,
+    // failures of the connection are found by the reading side.
+    butil::ignore_result(send(_fd, &c, 1, MSG_DONTWAIT | MSG_NOSIGNAL));
+}
+
+ssize_t ShmEndpoint::CutFromIOBufList(butil::IOBuf** data, size_t ndata) {
+    const uint64_t tail = _tx->tail.load(butil::memory_order_relaxed);
+    size_t space = _ring_size -
+        (tail - _tx->head.load(butil::memory_order_acquire));
+    if (space == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    uint64_t pos = tail;
+    for (size_t i = 0; i < ndata && space > 0; ++i) {
+        butil::IOBuf* buf = data[i];
+        while (!buf->empty() && space > 0) {
+            const size_t offset = pos & (_ring_size - 1);
+            const size_t n = buf->cutn(_tx_data + offset,
+                                       std::min(space, _ring_size - offset));
+            pos += n;
+            space -= n;
+        }
+    }
+    if (pos == tail) {
+        return 0;
+    }
+    _tx->tail.store(pos, butil::memory_order_seq_cst);
+    // The reader only sleeps after seeing the ring empty, in which case it
+    // has consumed everything before `tail'. Pairs with Read().
+    if (_tx->head.load(butil::memory_order_seq_cst) == tail) {
+        Notify();
+    }
+    return pos - tail;
+}
+
+bool ShmEndpoint::IsWritable() {
+    if (_tx->tail.load(butil::memory_order_relaxed) -
+        _tx->head.load(butil::memory_order_acquire) < _ring_size) {
+        return true;
+    }
+    _writer_blocked.store(true, butil::memory_order_seq_cst);
+    _tx->writer_waiting.store(1, butil::memory_order_seq_cst);
+    return _tx->tail.load(butil::memory_order_relaxed) -
+        _tx->head.load(butil::memory_order_seq_cst) < _ring_size;
+}
+
+ssize_t ShmEndpoint::Read(butil::IOPortal* portal, size_t size_hint) {
+    // Drain notifications so that the edge-triggered fd is re-armed.
+    bool notified = false;
+    bool eof = false;
+    char buf[64];
+    while (true) {
+        const ssize_t nr = recv(_fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (nr > 0) {
+            notified = true;
+            if (nr < (ssize_t)sizeof(buf)) {
+                break;
+            }
+        } else if (nr == 0) {
+            eof = true;
+            break;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN) {
+            break;
+        } else {
+            return -1;
+        }
+    }
+    if (notified && _writer_blocked.load(butil::memory_order_seq_cst) &&
+        _tx->writer_waiting.load(butil::memory_order_seq_cst) == 0) {
+        // The peer consumed data, wake up the writer in KeepWrite.
+        _writer_blocked.store(false, butil::memory_order_relaxed);
+        _socket->_epollout_butex->fetch_add(1, butil::memory_order_release);
+        bthread::butex_wake_all(_socket->_epollout_butex);
+    }
+
+    const uint64_t head = _rx->head.load(butil::memory_order_relaxed);
+    const size_t avail =
+        _rx->tail.load(butil::memory_order_seq_cst) - head;
+    if (avail == 0) {
+        // Data written before the peer closed has been consumed.
+        if (eof) {
+            return 0;
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+    const size_t n = (size_hint > 0 ? std::min(avail, size_hint) : avail);
+    const size_t offset = head & (_ring_size - 1);
+    const size_t first = std::min(n, _ring_size - offset);
+    portal->append(_rx_data + offset, first);
+    if (n > first) {
+        portal->append(_rx_data, n - first);
+    }
+    _rx->head.store(head + n, butil::memory_order_seq_cst);
+    // Pairs with IsWritable().
+    if (_rx->writer_waiting.load(butil::memory_order_seq_cst) != 0 &&
+        _rx->writer_waiting.exchange(0, butil::memory_order_seq_cst) != 0) {
+        Notify();
+    }
+    return n;
+}
+
+void ShmEndpoint::DebugInfo(std::ostream& os) const {
+    os << "\nshm_ring_size=" << _ring_size
+       << "\nshm_tx_pending="
+       << _tx->tail.load(butil::memory_order_relaxed) -
+          _tx->head.load(butil::memory_order_relaxed)
+       << "\nshm_rx_pending="
+       << _rx->tail.load(butil::memory_order_relaxed) -
+          _rx->head.load(butil::memory_order_relaxed);
+}
+
+void ShmEndpoint::OnNewDataFromUnix(Socket* m) {
+    if (m->_shm_ep == NULL) {
+        int progress = Socket::PROGRESS_INIT;
+        while (true) {
+            ShmEndpoint* ep = Receive(m, m->fd());
+            if (ep != NULL) {
+                m->_shm_ep = ep;
+                break;
+            }
+            if (errno != EAGAIN) {
+                const int saved_errno = errno;
+                PLOG(WARNING) << "Fail to receive shm rings of " << *m;
+                m->SetFailed(saved_errno, "Fail to receive shm rings of %s: %s",
+                             m->description().c_str(), berror(saved_errno));
+                return;
+            }
+            if (!m->MoreReadEvents(&progress)) {
+                return;
+            }
+        }
+    }
+    InputMessenger::OnNewMessages(m);
+}
+
+} // namespace shm
+} // namespace brpc
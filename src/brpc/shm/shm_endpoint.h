@@ -0,0 +1,131 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_SHM_ENDPOINT_H
+#define BRPC_SHM_ENDPOINT_H
+
+#include <ostream>
+#include <string>
+#include <gflags/gflags_declare.h>
+#include "butil/atomicops.h"
+#include "butil/endpoint.h"
+#include "butil/iobuf.h"
+#include "butil/macros.h"
+#include "brpc/socket.h"
+
+namespace brpc {
+namespace shm {
+
+DECLARE_int32(shm_ring_size);
+DECLARE_string(shm_socket_dir);
+
+// Shared-memory transport for clients and servers on the same host.
+//
+// A client connects to the unix socket of the server (see ShmSocketPath)
+// and sends a memfd holding two byte rings, one for each direction. Data
+// is then copied into/out of the rings directly, bypassing the TCP stack.
+// The unix socket is kept for notifications only: a single byte is sent
+// when the reader may be sleeping on an empty ring or the writer is waiting
+// for space, and EOF of the socket tells that the peer is gone. So the
+// socket is still watched by EventDispatcher and the protocol layer is not
+// aware of the transport.
+
+// Path of the unix socket accepting shm connections to `port'.
+std::string ShmSocketPath(int port);
+
+// Listen on ShmSocketPath(port), which is accessible to the owner only.
+// A stale socket left by a previous process is replaced, while a file of
+// other types at the path fails this function.
+// Returns the listened fd on success, -1 otherwise.
+int ShmListen(int port);
+
+// Remove ShmSocketPath(port) if it's a socket.
+void RemoveShmSocket(int port);
+
+// Convert a loopback `point' into the unix endpoint of ShmSocketPath.
+// Returns 0 on success, -1 if `point' is not loopback.
+int ToShmEndPoint(const butil::EndPoint& point, butil::EndPoint* out);
+
+class ShmConnect : public AppConnect {
+public:
+    void StartConnect(const Socket* socket,
+                      void (*done)(int err, void* data),
+                      void* data) override;
+    void StopConnect(Socket*) override {}
+};
+
+struct ShmRing;
+
+class ShmEndpoint {
+public:
+    ~ShmEndpoint();
+
+    // Allocate rings and send them to the server through unix socket `fd'.
+    // Returns NULL on error and errno is set.
+    static ShmEndpoint* CreateAndSend(Socket* s, int fd);
+
+    // Receive rings sent by CreateAndSend from unix socket `fd'.
+    // Returns NULL on error, and errno is EAGAIN if the rings have not
+    // arrived yet.
+    static ShmEndpoint* Receive(Socket* s, int fd);
+
+    // Copy data from the given IOBuf list into the ring to the peer.
+    // Return bytes written, -1 if failed and errno set(EAGAIN when the ring
+    // is full)
+    ssize_t CutFromIOBufList(butil::IOBuf** data, size_t ndata);
+
+    // Append at most `size_hint' bytes in the ring from the peer to
+    // `portal'. Returns bytes read, 0 on EOF, -1 otherwise and errno is set.
+    ssize_t Read(butil::IOPortal* portal, size_t size_hint);
+
+    // Whether the ring to the peer has space. If not, the peer is asked to
+    // notify when it consumes data so that the writer waiting on
+    // _epollout_butex of the socket is woken up.
+    bool IsWritable();
+
+    // For debug
+    void DebugInfo(std::ostream& os) const;
+
+    // Callback of accepted unix sockets, which receives rings at first.
+    static void OnNewDataFromUnix(Socket* m);
+
+private:
+    ShmEndpoint(Socket* s, int fd, void* mem, size_t mem_size,
+                bool server_side);
+    DISALLOW_COPY_AND_ASSIGN(ShmEndpoint);
+
+    void Notify();
+
+    Socket* _socket;
+    // The unix socket to notify the peer, owned by _socket.
+    int _fd;
+    void* _mem;
+    size_t _mem_size;
+    size_t _ring_size;
+    ShmRing* _tx;
+    char* _tx_data;
+    ShmRing* _rx;
+    char* _rx_data;
+    // True if IsWritable() found the ring full and the peer has not
+    // notified about consumption yet.
+    butil::atomic<bool> _writer_blocked;
+};
+
+} // namespace shm
+} // namespace brpc
+
+#endif // BRPC_SHM_ENDPOINT_H
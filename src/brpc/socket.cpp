@@ -26,6 +26,11 @@
 #include <mesalink/openssl/x509.h>
 #endif
 #include <netinet/tcp.h>                         // getsockopt
+#if defined(OS_LINUX)
+#include <linux/errqueue.h>                      // sock_extended_err
+#endif
+#include <cmath>                                  // std::ceil
+#include <limits>
 #include <gflags/gflags.h>
 #include "bthread/unstable.h"                    // bthread_timer_del
 #include "butil/fd_utility.h"                     // make_non_blocking
@@ -50,16 +55,25 @@
 #include "brpc/policy/rtmp_protocol.h"  // FIXME
 #include "brpc/periodic_task.h"
 #include "brpc/details/health_check.h"
+#include "brpc/details/http_response_queue.h"
+#include "brpc/details/stream_write_scheduler.h"
+#include "brpc/details/ssl_session_cache.h"
 #include "brpc/rdma/rdma_endpoint.h"
 #include "brpc/rdma/rdma_helper.h"
+#include "brpc/shm/shm_endpoint.h"
 #if defined(OS_MACOSX)
 #include <sys/event.h>
 #endif
+#if defined(OS_LINUX)
+#include <sys/sendfile.h>
+#endif
 
 namespace bthread {
 size_t BAIDU_WEAK get_sizes(const bthread_id_list_t* list, size_t* cnt, size_t n);
 }
 
+DECLARE_int32(task_group_ntags);
+
 
 namespace brpc {
 
@@ -80,12 +94,47 @@ DEFINE_int32(socket_recv_buffer_size, -1,
 DEFINE_int32(socket_send_buffer_size, -1, 
             "Set send buffer size of sockets if this value is positive");
 
+DEFINE_int32(socket_notsent_lowat, 0,
+             "Set TCP_NOTSENT_LOWAT of TCP sockets if this value is positive. "
+             "Writes get EAGAIN once so many bytes are not sent yet and wait "
+             "for EPOLLOUT, which keeps send buffers of the kernel shallow "
+             "and leaves pending data in user space. Linux only");
+
 DEFINE_int32(ssl_bio_buffer_size, 16*1024, "Set buffer size for SSL read/write");
 
+DEFINE_bool(ssl_ktls, false, "Offload encryption and decryption of SSL "
+            "connections to kernel (kTLS) after handshakes if both OpenSSL "
+            "and kernel support it. Data is written into fds directly "
+            "(so that zero-copy writes work) and decrypted by kernel when "
+            "being read");
+
+DEFINE_int32(ssl_handshake_bthread_tag, BTHREAD_TAG_INVALID,
+             "Run SSL handshakes in bthreads of this tag so that their "
+             "crypto computations do not delay bthreads of established "
+             "connections. Workers of the tag limit concurrency of the "
+             "handshakes. -1 to run handshakes in the calling bthread");
+BRPC_VALIDATE_GFLAG(ssl_handshake_bthread_tag, PassValidate);
+
+DEFINE_bool(ssl_async_handshake, false, "Run SSL handshakes in async mode "
+            "of OpenSSL, in which crypto operations offloaded to an async "
+            "engine (see -ssl_engine) are waited without blocking workers");
+BRPC_VALIDATE_GFLAG(ssl_async_handshake, PassValidate);
+
 DEFINE_int64(socket_max_unwritten_bytes, 64 * 1024 * 1024,
              "Max unwritten bytes in each socket, if the limit is reached,"
              " Socket.Write fails with EOVERCROWDED");
 
+DEFINE_int64(socket_zerocopy_threshold, 0,
+             "Write pending data with MSG_ZEROCOPY when there are at least "
+             "so many bytes, 0 disables zero-copy writes. Only large writes "
+             "benefit since completions are notified asynchronously");
+
+DEFINE_int32(socket_coalesce_write_threshold, 0,
+             "Bytes of pending writes smaller than this value are copied into "
+             "one buffer before being written together, so that a batch of "
+             "small messages is written with a few iovecs. 0 disables it");
+BRPC_VALIDATE_GFLAG(socket_coalesce_write_threshold, NonNegativeInteger);
+
 DEFINE_int64(socket_max_streams_unconsumed_bytes, 0,
              "Max stream receivers' unconsumed bytes in one socket,"
              " it used in stream for receiver buffer control.");
@@ -109,6 +158,14 @@ BRPC_VALIDATE_GFLAG(connect_timeout_as_unreachable,
 
 const int WAIT_EPOLLOUT_TIMEOUT_MS = 50;
 
+// Blocks written by one sendmsg(MSG_ZEROCOPY), identified by the per-socket
+// sequence number which the kernel reports in completions.
+struct Socket::ZeroCopyChunk {
+    uint32_t seq;
+    bool done;
+    butil::IOBuf data;
+};
+
 class BAIDU_CACHELINE_ALIGNMENT SocketPool {
 friend class Socket;
 public:
@@ -125,6 +182,17 @@ public:
     
     // Get all pooled sockets inside.
     void ListSockets(std::vector<SocketId>* list, size_t max_count);
+
+    // Connect sockets synchronously and put them into the pool until there
+    // are at least `n' sockets. Called in the bthread started by
+    // Socket::SetupSocketPool().
+    void WarmUp(int n, int connect_timeout_ms);
+
+    // Max number of free sockets in the pool.
+    int max_free() const {
+        const int max_free = _max_free.load(butil::memory_order_relaxed);
+        return max_free > 0 ? max_free : FLAGS_max_connection_pool_size;
+    }
     
 private:
     // options used to create this instance
@@ -134,6 +202,10 @@ private:
     butil::EndPoint _remote_side;
     butil::atomic<int> _numfree; // #free sockets in all sub pools.
     butil::atomic<int> _numinflight; // #inflight sockets in all sub pools.
+    // Set by Socket::SetupSocketPool().
+    butil::atomic<int> _max_free;
+    butil::atomic<int> _min_warm;
+    butil::atomic<bool> _warming_up;
 };
 
 // NOTE: sizeof of this class is 1200 bytes. If we have 10K sockets, total
@@ -194,6 +266,11 @@ public:
 
     butil::atomic<uint64_t> recent_error_count;
 
+    // See SocketCallStat.
+    butil::atomic<int64_t> ninflight_calls;
+    butil::atomic<int64_t> ewma_latency_us;
+    butil::atomic<uint64_t> latency_buckets[SocketCallStat::NBUCKET];
+
     explicit SharedPart(SocketId creator_socket_id);
     ~SharedPart();
 
@@ -210,7 +287,12 @@ Socket::SharedPart::SharedPart(SocketId creator_socket_id2)
     , out_size(0)
     , out_num_messages(0)
     , extended_stat(NULL)
-    , recent_error_count(0) {
+    , recent_error_count(0)
+    , ninflight_calls(0)
+    , ewma_latency_us(0) {
+    for (int i = 0; i < SocketCallStat::NBUCKET; ++i) {
+        latency_buckets[i].store(0, butil::memory_order_relaxed);
+    }
 }
 
 Socket::SharedPart::~SharedPart() {
@@ -450,7 +532,6 @@ Socket::Socket(Forbidden f)
     // must be even because Address() relies on evenness of version
     : VersionedRefWithId<Socket>(f)
     , _shared_part(NULL)
-    , _nevent(0)
     , _keytable_pool(NULL)
     , _fd(-1)
     , _tos(0)
@@ -458,46 +539,57 @@ Socket::Socket(Forbidden f)
     , _on_edge_triggered_events(NULL)
     , _user(NULL)
     , _conn(NULL)
-    , _preferred_index(-1)
     , _hc_count(0)
-    , _last_msg_size(0)
-    , _avg_msg_size(0)
-    , _last_readtime_us(0)
-    , _parsing_context(NULL)
     , _correlation_id(0)
     , _health_check_interval_s(-1)
     , _is_hc_related_ref_held(false)
-    , _ninprocess(1)
     , _auth_flag_error(0)
     , _auth_id(INVALID_BTHREAD_ID)
     , _auth_context(NULL)
     , _ssl_state(SSL_UNKNOWN)
     , _ssl_session(NULL)
+    , _ssl_ktls_send(false)
     , _rdma_ep(NULL)
     , _rdma_state(RDMA_OFF)
+    , _shm_ep(NULL)
     , _connection_type_for_progressive_read(CONNECTION_TYPE_UNKNOWN)
     , _controller_released_socket(false)
-    , _overcrowded(false)
     , _fail_me_at_server_stop(false)
     , _logoff_flag(false)
     , _error_code(0)
     , _pipeline_q(NULL)
-    , _last_writetime_us(0)
-    , _unwritten_bytes(0)
-    , _epollout_butex(NULL)
-    , _write_head(NULL)
-    , _is_write_shutdown(false)
+    , _zerocopy_chunks(NULL)
+    , _zerocopy_next_seq(0)
+    , _zerocopy_state(0)
     , _stream_set(NULL)
+    , _stream_write_scheduler(NULL)
     , _total_streams_unconsumed_size(0)
     , _ninflight_app_health_check(0)
     , _tcp_user_timeout_ms(-1)
-    , _http_request_method(HTTP_METHOD_GET) {
+    , _http_request_method(HTTP_METHOD_GET)
+    , _http_response_q(NULL)
+    , _nevent(0)
+    , _preferred_index(-1)
+    , _last_msg_size(0)
+    , _avg_msg_size(0)
+    , _read_size_guess(0)
+    , _read_shrink_count(0)
+    , _last_readtime_us(0)
+    , _parsing_context(NULL)
+    , _write_head(NULL)
+    , _unwritten_bytes(0)
+    , _last_writetime_us(0)
+    , _epollout_butex(NULL)
+    , _overcrowded(false)
+    , _is_write_shutdown(false)
+    , _ninprocess(1) {
     CreateVarsOnce();
     pthread_mutex_init(&_id_wait_list_mutex, NULL);
     _epollout_butex = bthread::butex_create_checked<butil::atomic<int> >();
 }
 
 Socket::~Socket() {
+    delete _zerocopy_chunks;
     pthread_mutex_destroy(&_id_wait_list_mutex);
     bthread::butex_destroy(_epollout_butex);
 }
@@ -570,6 +662,8 @@ int Socket::ResetFileDescriptor(int fd) {
     // Reset message sizes when fd is changed.
     _last_msg_size = 0;
     _avg_msg_size = 0;
+    _read_size_guess = 0;
+    _read_shrink_count = 0;
     // MUST store `_fd' before adding itself into epoll device to avoid
     // race conditions with the callback function inside epoll
     _fd.store(fd, butil::memory_order_release);
@@ -634,6 +728,19 @@ void Socket::SetSocketOptions(int fd) {
         }
     }
 
+#if defined(OS_LINUX) && defined(TCP_NOTSENT_LOWAT)
+    if (FLAGS_socket_notsent_lowat > 0) {
+        int lowat = FLAGS_socket_notsent_lowat;
+        // OK to fail, namely unix domain socket does not support this.
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                       &lowat, sizeof(lowat)) != 0 &&
+            errno != EOPNOTSUPP && errno != ENOPROTOOPT) {
+            PLOG(ERROR) << "Fail to set TCP_NOTSENT_LOWAT of fd=" << fd
+                        << " to " << lowat;
+        }
+    }
+#endif
+
 #if defined(OS_LINUX)
     if (_tcp_user_timeout_ms > 0) {
         if (setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT,
@@ -718,6 +825,7 @@ int Socket::OnCreated(const SocketOptions& options) {
         return -1;
     }
     _io_event.set_bthread_tag(options.bthread_tag);
+    _io_event.set_event_dispatcher_index(options.event_dispatcher_index);
     auto guard = butil::MakeScopeGuard([this] {
         _io_event.Reset();
     });
@@ -755,6 +863,7 @@ int Socket::OnCreated(const SocketOptions& options) {
     // Disable SSL check if there is no SSL context
     _ssl_state = (options.initial_ssl_ctx == NULL ? SSL_OFF : SSL_UNKNOWN);
     _ssl_session = NULL;
+    _ssl_ktls_send = false;
     _ssl_ctx = options.initial_ssl_ctx;
 #if BRPC_WITH_RDMA
     CHECK(_rdma_ep == NULL);
@@ -854,6 +963,7 @@ void Socket::BeforeRecycled() {
         if (_on_edge_triggered_events != NULL) {
             _io_event.RemoveConsumer(prev_fd);
         }
+        ResetZeroCopy(prev_fd);
         close(prev_fd);
         if (create_by_connect) {
             g_vars->channel_conn << -1;
@@ -867,6 +977,8 @@ void Socket::BeforeRecycled() {
         _rdma_state = RDMA_UNKNOWN;
     }
 #endif
+    delete _shm_ep;
+    _shm_ep = NULL;
 
     reset_parsing_context(NULL);
     _read_buf.clear();
@@ -886,12 +998,18 @@ void Socket::BeforeRecycled() {
     delete _pipeline_q;
     _pipeline_q = NULL;
 
+    delete _http_response_q;
+    _http_response_q = NULL;
+
     delete _auth_context;
     _auth_context = NULL;
 
     delete _stream_set;
     _stream_set = NULL;
 
+    delete _stream_write_scheduler;
+    _stream_write_scheduler = NULL;
+
     const SocketId asid = _agent_socket_id.load(butil::memory_order_relaxed);
     if (asid != INVALID_SOCKET_ID) {
         SocketUniquePtr ptr;
@@ -902,6 +1020,13 @@ void Socket::BeforeRecycled() {
     g_vars->nsocket << -1;
 }
 
+HttpResponseQueue* Socket::GetOrNewHttpResponseQueue() {
+    if (_http_response_q == NULL) {
+        _http_response_q = new HttpResponseQueue;
+    }
+    return _http_response_q;
+}
+
 void Socket::OnFailed(int error_code, const std::string& error_text) {
     // Update _error_text
     pthread_mutex_lock(&_id_wait_list_mutex);
@@ -1015,12 +1140,16 @@ int Socket::WaitAndReset(int32_t expected_nref) {
         if (_on_edge_triggered_events != NULL) {
             _io_event.RemoveConsumer(prev_fd);
         }
+        ResetZeroCopy(prev_fd);
         close(prev_fd);
         if (CreatedByConnect()) {
             g_vars->channel_conn << -1;
         }
     }
 
+    // Rings are created again by ShmConnect after reconnecting.
+    delete _shm_ep;
+    _shm_ep = NULL;
 #if BRPC_WITH_RDMA
     if (_rdma_ep) {
         _rdma_ep->Reset();
@@ -1033,6 +1162,7 @@ int Socket::WaitAndReset(int32_t expected_nref) {
         SSL_free(_ssl_session);
         _ssl_session = NULL;
     }        
+    _ssl_ktls_send = false;
     _ssl_state = SSL_UNKNOWN;
     _nevent.store(0, butil::memory_order_relaxed);
     // parsing_context is very likely to be associated with the fd,
@@ -1100,6 +1230,71 @@ void Socket::FeedbackCircuitBreaker(int error_code, int64_t latency_us) {
     }
 }
 
+const int64_t SocketCallStat::BUCKET_UPPER_US[SocketCallStat::NBUCKET] = {
+    1000, 5000, 10000, 50000, 100000, 500000, 1000000,
+    std::numeric_limits<int64_t>::max()
+};
+
+int64_t SocketCallStat::latency_percentile_us(double ratio) const {
+    uint64_t total = 0;
+    for (int i = 0; i < NBUCKET; ++i) {
+        total += latency_buckets[i];
+    }
+    if (total == 0) {
+        return -1;
+    }
+    const uint64_t target = (uint64_t)std::ceil(total * ratio);
+    uint64_t n = 0;
+    for (int i = 0; i < NBUCKET; ++i) {
+        n += latency_buckets[i];
+        if (n >= target) {
+            return BUCKET_UPPER_US[i];
+        }
+    }
+    return BUCKET_UPPER_US[NBUCKET - 1];
+}
+
+void Socket::OnCallBegin() {
+    GetOrNewSharedPart()->ninflight_calls.fetch_add(
+        1, butil::memory_order_relaxed);
+}
+
+void Socket::OnCallEnd(int64_t latency_us) {
+    SharedPart* sp = GetSharedPart();
+    if (sp == NULL) {
+        return;
+    }
+    sp->ninflight_calls.fetch_sub(1, butil::memory_order_relaxed);
+    if (latency_us < 0) {
+        return;
+    }
+    int i = 0;
+    while (latency_us >= SocketCallStat::BUCKET_UPPER_US[i]) {
+        ++i;
+    }
+    sp->latency_buckets[i].fetch_add(1, butil::memory_order_relaxed);
+    // Same weight as srtt of TCP. Concurrent updates may lose a few
+    // latencies, which is fine for an average.
+    const int64_t ewma = sp->ewma_latency_us.load(butil::memory_order_relaxed);
+    sp->ewma_latency_us.store(
+        ewma == 0 ? latency_us : ewma + (latency_us - ewma) / 8,
+        butil::memory_order_relaxed);
+}
+
+void Socket::GetCallStat(SocketCallStat* out) const {
+    SharedPart* sp = GetSharedPart();
+    if (sp == NULL) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    out->ninflight = sp->ninflight_calls.load(butil::memory_order_relaxed);
+    out->ewma_latency_us = sp->ewma_latency_us.load(butil::memory_order_relaxed);
+    for (int i = 0; i < SocketCallStat::NBUCKET; ++i) {
+        out->latency_buckets[i] =
+            sp->latency_buckets[i].load(butil::memory_order_relaxed);
+    }
+}
+
 int Socket::ReleaseReferenceIfIdle(int idle_seconds) {
     const int64_t last_active_us = last_active_time_us();
     if (butil::cpuwide_time_us() - last_active_us <= idle_seconds * 1000000L) {
@@ -1428,7 +1623,7 @@ void Socket::WakeAsEpollOut() {
     bthread::butex_wake_except(_epollout_butex, 0);
 }
 
-int Socket::OnOutputEvent(void* user_data, uint32_t,
+int Socket::OnOutputEvent(void* user_data, uint32_t events,
                           const bthread_attr_t&) {
     auto id = reinterpret_cast<SocketId>(user_data);
     SocketUniquePtr s;
@@ -1440,6 +1635,15 @@ int Socket::OnOutputEvent(void* user_data, uint32_t,
         // Ignore recycled sockets
         return -1;
     }
+#if defined(OS_LINUX)
+    // Completions of MSG_ZEROCOPY are queued in the error queue which
+    // raises EPOLLERR even if EPOLLOUT is not watched.
+    if ((events & EPOLLERR) &&
+        s->_zerocopy_state.load(butil::memory_order_relaxed) > 0) {
+        BAIDU_SCOPED_LOCK(s->_zerocopy_mutex);
+        s->ReapZeroCopyCompletions(s->fd());
+    }
+#endif
 
     EpollOutRequest* req = dynamic_cast<EpollOutRequest*>(s->user());
     if (req != NULL) {
@@ -1755,7 +1959,8 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
 #else
         {
 #endif
-            nw = req->data.cut_into_file_descriptor(fd());
+            butil::IOBuf* data_arr[1] = { &req->data };
+            nw = CutIntoFileDescriptor(data_arr, 1);
         }
     }
     if (nw < 0) {
@@ -1797,6 +2002,54 @@ FAIL_TO_WRITE:
 
 static const size_t DATA_LIST_MAX = 256;
 
+// Append bytes of `src' to `dst' by copying.
+static void AppendByCopying(butil::IOBuf* dst, const butil::IOBuf& src) {
+    const size_t nblock = src.backing_block_num();
+    for (size_t i = 0; i < nblock; ++i) {
+        const butil::StringPiece blk = src.backing_block(i);
+        dst->append(blk.data(), blk.size());
+    }
+}
+
+// Copy each run of consecutive small IOBufs in `data_list' into the first
+// IOBuf of the run and clear the others. The merged bytes are in a few
+// blocks, thus written with a few iovecs. Cleared WriteRequests are not
+// returned before the first one of the run is fully written, because
+// KeepWrite() returns requests in order, so their completions are still
+// notified after their bytes are written.
+// Returns number of IOBufs cleared.
+static size_t CoalesceSmallWrites(butil::IOBuf* const* data_list, size_t ndata,
+                                  size_t threshold) {
+    size_t ncleared = 0;
+    butil::IOBuf* target = NULL;
+    bool target_copied = false;
+    for (size_t i = 0; i < ndata; ++i) {
+        butil::IOBuf* data = data_list[i];
+        if (data->empty()) {
+            continue;
+        }
+        if (data->size() >= threshold) {
+            target = NULL;
+            continue;
+        }
+        if (target == NULL) {
+            target = data;
+            target_copied = false;
+            continue;
+        }
+        if (!target_copied) {
+            butil::IOBuf copied;
+            AppendByCopying(&copied, *target);
+            target->swap(copied);
+            target_copied = true;
+        }
+        AppendByCopying(target, *data);
+        data->clear();
+        ++ncleared;
+    }
+    return ncleared;
+}
+
 void* Socket::KeepWrite(void* void_arg) {
     g_vars->nkeepwrite << 1;
     WriteRequest* req = static_cast<WriteRequest*>(void_arg);
@@ -1859,6 +2112,27 @@ void* Socket::KeepWrite(void* void_arg) {
             // growing infinitely.
             const timespec duetime =
                 butil::milliseconds_from_now(WAIT_EPOLLOUT_TIMEOUT_MS);
+            if (s->_shm_ep != NULL) {
+                // The unix socket is always writable, wait for the peer
+                // to consume the ring instead.
+                const int expected_val = s->_epollout_butex
+                    ->load(butil::memory_order_acquire);
+                if (!s->_shm_ep->IsWritable()) {
+                    g_vars->nwaitepollout << 1;
+                    if (bthread::butex_wait(s->_epollout_butex,
+                            expected_val, &duetime) < 0 &&
+                        errno != EAGAIN && errno != ETIMEDOUT &&
+                        errno != EINTR) {
+                        const int saved_errno = errno;
+                        PLOG(WARNING) << "Fail to wait shm ring of " << *s;
+                        s->SetFailed(saved_errno, "Fail to wait shm ring of %s: %s",
+                                s->description().c_str(), berror(saved_errno));
+                    }
+                }
+                if (s->Failed()) {
+                    break;
+                }
+            } else
 #if BRPC_WITH_RDMA
             if (s->_rdma_state == RDMA_ON) {
                 const int expected_val = s->_epollout_butex
@@ -1931,6 +2205,31 @@ ssize_t Socket::DoWrite(WriteRequest* req) {
         }
     }
 
+    const int coalesce_threshold = FLAGS_socket_coalesce_write_threshold;
+    if (ndata > 1 && coalesce_threshold > 0 && _conn == NULL &&
+        _shm_ep == NULL
+#if BRPC_WITH_RDMA
+        && (!_rdma_ep || _rdma_state == RDMA_OFF)
+#endif
+        ) {
+        const size_t ncleared =
+            CoalesceSmallWrites(data_list, ndata, coalesce_threshold);
+        if (ncleared) {
+            g_vars->ncoalesced_writes << ncleared;
+        }
+    }
+
+#if BRPC_WITH_RDMA
+    if (!_rdma_ep || _rdma_state == RDMA_OFF) {
+        // Device memory is only accessible to RDMA, copy it to host memory
+        for (size_t i = 0; i < ndata; ++i) {
+            if (rdma::StageDeviceMemory(data_list[i]) != 0) {
+                return -1;
+            }
+        }
+    }
+#endif
+
     if (ssl_state() == SSL_OFF) {
         // Write IOBuf in the batch array into the fd.
         if (_conn) {
@@ -1941,12 +2240,15 @@ ssize_t Socket::DoWrite(WriteRequest* req) {
                 return _rdma_ep->CutFromIOBufList(data_list, ndata);
             }
 #endif
-            return butil::IOBuf::cut_multiple_into_file_descriptor(
-                fd(), data_list, ndata);
+            return CutIntoFileDescriptor(data_list, ndata);
         }
     }
 
     CHECK_EQ(SSL_CONNECTED, ssl_state());
+    if (_ssl_ktls_send && !_conn) {
+        // Records are sealed by kernel, write plain data into fd.
+        return CutIntoFileDescriptor(data_list, ndata);
+    }
     if (_conn) {
         // TODO: Separate SSL stuff from SocketConnection
         BAIDU_SCOPED_LOCK(_ssl_session_mutex);
@@ -1987,7 +2289,297 @@ ssize_t Socket::DoWrite(WriteRequest* req) {
     return nw;
 }
 
+ssize_t Socket::CutIntoFileDescriptor(butil::IOBuf* const* data_list,
+                                      size_t ndata) {
+    if (_shm_ep) {
+        return _shm_ep->CutFromIOBufList(const_cast<butil::IOBuf**>(data_list),
+                                         ndata);
+    }
+#if defined(OS_LINUX)
+    // Checking the global count first keeps the common path cheap.
+    if (butil::IOBuf::file_region_count() != 0) {
+        const ssize_t nw = CutFileRegionsIntoFileDescriptor(data_list, ndata);
+        if (nw >= 0 || errno != ENOTSUP) {
+            return nw;
+        }
+    }
+    if (FLAGS_socket_zerocopy_threshold > 0 &&
+        _zerocopy_state.load(butil::memory_order_relaxed) >= 0) {
+        size_t nbytes = 0;
+        for (size_t i = 0; i < ndata; ++i) {
+            nbytes += data_list[i]->size();
+        }
+        if ((int64_t)nbytes >= FLAGS_socket_zerocopy_threshold) {
+            const ssize_t nw = ZeroCopyWrite(data_list, ndata);
+            if (nw >= 0 || errno != ENOTSUP) {
+                return nw;
+            }
+            g_vars->nzerocopy_fallback << 1;
+        }
+    }
+#endif
+    // Same as IOBUF_IOV_MAX in iobuf.cpp
+    const size_t IOV_PER_WRITE_MAX = 256;
+    size_t niov = 0;
+    for (size_t i = 0; i < ndata && niov < IOV_PER_WRITE_MAX; ++i) {
+        niov += data_list[i]->backing_block_num();
+    }
+    g_vars->niov_per_write << (int64_t)std::min(niov, IOV_PER_WRITE_MAX);
+    return butil::IOBuf::cut_multiple_into_file_descriptor(
+        fd(), data_list, ndata);
+}
+
+#if defined(OS_LINUX)
+
+ssize_t Socket::CutFileRegionsIntoFileDescriptor(
+    butil::IOBuf* const* data_list, size_t ndata) {
+    for (size_t i = 0; i < ndata; ++i) {
+        butil::IOBuf* data = data_list[i];
+        const size_t n = data->bytes_before_file_region();
+        if (n == data->size()) {
+            continue;
+        }
+        if (i == 0 && n == 0) {
+            int file_fd = -1;
+            off_t offset = 0;
+            size_t len = 0;
+            CHECK(data->get_first_file_region(&file_fd, &offset, &len));
+            const ssize_t nw = sendfile(fd(), file_fd, &offset, len);
+            if (nw < 0) {
+                if (errno == EINVAL || errno == ENOSYS) {
+                    // The fd does not support sendfile, e.g. it's not a
+                    // socket of kernel.
+                    errno = ENOTSUP;
+                }
+                return -1;
+            }
+            data->pop_front(nw);
+            g_vars->nsendfile_bytes << nw;
+            return nw;
+        }
+        // Write IOBufs before the region and bytes of data_list[i] before
+        // the region, so that the region starts next write.
+        butil::IOBuf* pieces[DATA_LIST_MAX];
+        std::copy(data_list, data_list + i, pieces);
+        size_t npieces = i;
+        butil::IOBuf head;
+        if (n > 0) {
+            data->cutn(&head, n);
+            pieces[npieces++] = &head;
+        }
+        const ssize_t nw = butil::IOBuf::cut_multiple_into_file_descriptor(
+            fd(), pieces, npieces);
+        if (!head.empty()) {
+            // Put back bytes not written.
+            head.append(butil::IOBuf::Movable(*data));
+            data->swap(head);
+        }
+        return nw;
+    }
+    errno = ENOTSUP;
+    return -1;
+}
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+// Seconds to keep unacknowledged chunks of closed fds referenced.
+static const int ZEROCOPY_LINGER_S = 10;
+
+ssize_t Socket::ZeroCopyWrite(butil::IOBuf* const* data_list, size_t ndata) {
+    const int fd = this->fd();
+    BAIDU_SCOPED_LOCK(_zerocopy_mutex);
+    int state = _zerocopy_state.load(butil::memory_order_relaxed);
+    if (state == 0) {
+        int on = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) != 0) {
+            // Unix domain sockets and kernels older than 4.14
+            _zerocopy_state.store(-1, butil::memory_order_relaxed);
+            errno = ENOTSUP;
+            return -1;
+        }
+        if (_zerocopy_chunks == NULL) {
+            _zerocopy_chunks = new std::deque<ZeroCopyChunk>;
+        }
+        state = 1;
+        _zerocopy_state.store(state, butil::memory_order_relaxed);
+    }
+    if (state < 0) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    // Release acknowledged blocks as early as possible.
+    ReapZeroCopyCompletions(fd);
+
+    struct iovec vec[256];
+    size_t nvec = 0;
+    for (size_t i = 0; i < ndata && nvec < arraysize(vec); ++i) {
+        const butil::IOBuf* p = data_list[i];
+        const size_t nref = p->backing_block_num();
+        for (size_t j = 0; j < nref && nvec < arraysize(vec); ++j, ++nvec) {
+            const butil::StringPiece blk = p->backing_block(j);
+            vec[nvec].iov_base = const_cast<char*>(blk.data());
+            vec[nvec].iov_len = blk.size();
+        }
+    }
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = vec;
+    msg.msg_iovlen = nvec;
+    const ssize_t nw = sendmsg(fd, &msg, MSG_ZEROCOPY);
+    if (nw < 0) {
+        if (errno == ENOBUFS) {
+            // Exceeded optmem limit for pinned pages, copy this time.
+            errno = ENOTSUP;
+        }
+        return -1;
+    }
+    _zerocopy_chunks->push_back(ZeroCopyChunk());
+    ZeroCopyChunk& chunk = _zerocopy_chunks->back();
+    chunk.seq = _zerocopy_next_seq++;
+    chunk.done = false;
+    // Move written blocks into the chunk without copying.
+    size_t left = nw;
+    for (size_t i = 0; i < ndata && left > 0; ++i) {
+        left -= data_list[i]->cutn(&chunk.data, left);
+    }
+    g_vars->nzerocopy << 1;
+    return nw;
+}
+
+void Socket::ReapZeroCopyCompletions(int fd) {
+    if (_zerocopy_chunks == NULL || _zerocopy_chunks->empty()) {
+        return;
+    }
+    while (true) {
+        char control[128];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            // EAGAIN when the error queue is empty.
+            break;
+        }
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+             cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            const sock_extended_err* serr = (const sock_extended_err*)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // Chunks in [ee_info, ee_data] are not referenced by kernel.
+            const uint32_t lo = serr->ee_info;
+            const uint32_t range = serr->ee_data - lo;
+            for (size_t i = 0; i < _zerocopy_chunks->size(); ++i) {
+                ZeroCopyChunk& c = (*_zerocopy_chunks)[i];
+                if (!c.done && c.seq - lo <= range) {
+                    c.done = true;
+                    c.data.clear();
+                }
+            }
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                // Kernel copied the data anyway, pinning pages is pure
+                // overhead for this connection.
+                _zerocopy_state.store(-1, butil::memory_order_relaxed);
+                g_vars->nzerocopy_fallback << (int64_t)range + 1;
+            }
+        }
+    }
+    while (!_zerocopy_chunks->empty() && _zerocopy_chunks->front().done) {
+        _zerocopy_chunks->pop_front();
+    }
+}
+
+void Socket::DeleteZeroCopyChunks(void* arg) {
+    delete static_cast<std::deque<ZeroCopyChunk>*>(arg);
+}
+
+void Socket::ResetZeroCopy(int fd) {
+    BAIDU_SCOPED_LOCK(_zerocopy_mutex);
+    ReapZeroCopyCompletions(fd);
+    if (_zerocopy_chunks != NULL && !_zerocopy_chunks->empty()) {
+        // Data may still be in the send queue after close(), whose
+        // completions can not be received anymore.
+        bthread_timer_t timer;
+        if (bthread_timer_add(&timer, butil::seconds_from_now(ZEROCOPY_LINGER_S),
+                              DeleteZeroCopyChunks, _zerocopy_chunks) == 0) {
+            _zerocopy_chunks = NULL;
+        } else {
+            _zerocopy_chunks->clear();
+        }
+    }
+    _zerocopy_next_seq = 0;
+    _zerocopy_state.store(0, butil::memory_order_relaxed);
+}
+
+#else
+
+ssize_t Socket::ZeroCopyWrite(butil::IOBuf* const*, size_t) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+void Socket::ReapZeroCopyCompletions(int) {}
+
+void Socket::ResetZeroCopy(int) {}
+
+#endif // OS_LINUX
+
+struct SSLHandshakeArgs {
+    Socket* socket;
+    int fd;
+    bool server_mode;
+    int rc;
+    int error_code;
+};
+
+void* Socket::RunSSLHandshake(void* arg) {
+    SSLHandshakeArgs* args = static_cast<SSLHandshakeArgs*>(arg);
+    args->rc = args->socket->DoSSLHandshake(args->fd, args->server_mode);
+    args->error_code = errno;
+    return NULL;
+}
+
 int Socket::SSLHandshake(int fd, bool server_mode) {
+    const bthread_tag_t tag = FLAGS_ssl_handshake_bthread_tag;
+    if (_ssl_ctx == NULL || tag == BTHREAD_TAG_INVALID ||
+        tag == bthread_self_tag()) {
+        return DoSSLHandshake(fd, server_mode);
+    }
+    if (tag < BTHREAD_TAG_DEFAULT || tag >= FLAGS_task_group_ntags) {
+        LOG_EVERY_SECOND(ERROR) << "Invalid -ssl_handshake_bthread_tag="
+                                << tag << ", expected [0, "
+                                << FLAGS_task_group_ntags << ")";
+        return DoSSLHandshake(fd, server_mode);
+    }
+    SSLHandshakeArgs args = { this, fd, server_mode, -1, 0 };
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+    attr.tag = tag;
+    bthread_t th;
+    if (bthread_start_background(&th, &attr, RunSSLHandshake, &args) != 0) {
+        LOG(WARNING) << "Fail to start bthread to do SSL handshake";
+        return DoSSLHandshake(fd, server_mode);
+    }
+    bthread_join(th, NULL);
+    errno = args.error_code;
+    return args.rc;
+}
+
+int Socket::DoSSLHandshake(int fd, bool server_mode) {
     if (_ssl_ctx == NULL) {
         if (server_mode) {
             LOG(ERROR) << "Lack SSL configuration to handle SSL request";
@@ -1996,7 +2588,6 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
         return 0;
     }
 
-    // TODO: Reuse ssl session id for client
     if (_ssl_session) {
         // Free the last session, which may be deprecated when socket failed
         SSL_free(_ssl_session);
@@ -2006,11 +2597,24 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
         LOG(ERROR) << "Fail to CreateSSLSession";
         return -1;
     }
+    _ssl_ktls_send = false;
+    if (FLAGS_ssl_ktls && !EnableKTLS(_ssl_session)) {
+        LOG_ONCE(WARNING) << "-ssl_ktls is on but kTLS is not supported by "
+                             "the SSL library";
+    }
 #if defined(SSL_CTRL_SET_TLSEXT_HOSTNAME) || defined(USE_MESALINK)
     if (!_ssl_ctx->sni_name.empty()) {
         SSL_set_tlsext_host_name(_ssl_session, _ssl_ctx->sni_name.c_str());
     }
 #endif
+    if (!server_mode) {
+        ApplyCachedClientSession(_ssl_session, _remote_side,
+                                 _ssl_ctx->sni_name);
+    }
+    if (FLAGS_ssl_async_handshake && !SetSSLAsyncMode(_ssl_session, true)) {
+        LOG_ONCE(WARNING) << "-ssl_async_handshake is on but async mode is "
+                             "not supported by the SSL library";
+    }
 
     _ssl_state = SSL_CONNECTING;
 
@@ -2048,6 +2652,11 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
                 }
             }
 
+            // Reads and writes are not prepared for SSL_ERROR_WANT_ASYNC.
+            SetSSLAsyncMode(_ssl_session, false);
+            // Set before SSL_CONNECTED is visible to writers.
+            _ssl_ktls_send = IsKTLSSendEnabled(_ssl_session);
+            OnSSLHandshakeDone(_ssl_session, server_mode);
             _ssl_state = SSL_CONNECTED;
             // Adding a BIO layer requires calling BIO_flush manually after SSL_write,
             // which could trigger EAGAIN for large packets. However, it's very tedious
@@ -2079,8 +2688,30 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
                 return -1;
             }
             break;
+
+#ifdef SSL_ERROR_WANT_ASYNC
+        case SSL_ERROR_WANT_ASYNC:
+        case SSL_ERROR_WANT_ASYNC_JOB: {
+            // Wait for the engine to finish the paused crypto operation, or
+            // for a free async job.
+            const int async_fd = GetSSLAsyncFd(_ssl_session);
+            if (async_fd < 0 || ssl_error == SSL_ERROR_WANT_ASYNC_JOB) {
+                bthread_usleep(100);
+#if defined(OS_LINUX)
+            } else if (bthread_fd_wait(async_fd, EPOLLIN) != 0) {
+#elif defined(OS_MACOSX)
+            } else if (bthread_fd_wait(async_fd, EVFILT_READ) != 0) {
+#endif
+                return -1;
+            }
+            break;
+        }
+#endif  // SSL_ERROR_WANT_ASYNC
  
         default: {
+            if (!server_mode) {
+                RemoveCachedClientSession(_remote_side, _ssl_ctx->sni_name);
+            }
             const unsigned long e = ERR_get_error();
             if (ssl_error == SSL_ERROR_ZERO_RETURN || e == 0) {
                 errno = ECONNRESET;
@@ -2098,6 +2729,10 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
 }
 
 ssize_t Socket::DoRead(size_t size_hint) {
+    if (_shm_ep) {
+        butil::IOBufOwnerScope owner_scope(butil::IOBuf::OWNER_SOCKET_READ);
+        return _shm_ep->Read(&_read_buf, size_hint);
+    }
     if (ssl_state() == SSL_UNKNOWN) {
         int error_code = 0;
         _ssl_state = DetectSSLState(fd(), &error_code);
@@ -2132,7 +2767,17 @@ ssize_t Socket::DoRead(size_t size_hint) {
             return -1;
         }
         CHECK(_rdma_state == RDMA_OFF);
-        return _read_buf.append_from_file_descriptor(fd(), size_hint);
+        // One read fills at most 64 blocks, use blocks of larger size
+        // classes for large reads(see -socket_adaptive_read) to save
+        // syscalls and BlockRefs.
+        size_t block_size = 0;
+        if (size_hint > 64 * butil::IOBuf::LARGE_BLOCK_SIZE) {
+            block_size = butil::IOBuf::HUGE_BLOCK_SIZE;
+        } else if (size_hint > 64 * butil::IOBuf::DEFAULT_BLOCK_SIZE) {
+            block_size = butil::IOBuf::LARGE_BLOCK_SIZE;
+        }
+        butil::IOBufOwnerScope owner_scope(butil::IOBuf::OWNER_SOCKET_READ);
+        return _read_buf.append_from_file_descriptor(fd(), size_hint, block_size);
     }
 
     CHECK_EQ(SSL_CONNECTED, ssl_state());
@@ -2140,6 +2785,7 @@ ssize_t Socket::DoRead(size_t size_hint) {
     ssize_t nr = 0;
     {
         BAIDU_SCOPED_LOCK(_ssl_session_mutex);
+        butil::IOBufOwnerScope owner_scope(butil::IOBuf::OWNER_SOCKET_READ);
         nr = _read_buf.append_from_SSL_channel(_ssl_session, &ssl_error, size_hint);
     }
     switch (ssl_error) {
@@ -2229,8 +2875,10 @@ AuthContext* Socket::mutable_auth_context() {
 int Socket::OnInputEvent(void* user_data, uint32_t events,
                          const bthread_attr_t& thread_attr) {
     auto id = reinterpret_cast<SocketId>(user_data);
-    SocketUniquePtr s;
-    if (Address(id, &s) < 0) {
+    // Most events are merged into the running ProcessEvent() by the
+    // counter below, borrow the socket to not touch its reference count.
+    SocketBorrowedPtr s;
+    if (Borrow(id, &s) < 0) {
         return -1;
     }
     if (NULL == s->_on_edge_triggered_events) {
@@ -2259,9 +2907,16 @@ int Socket::OnInputEvent(void* user_data, uint32_t events,
         // is just 1500~1700/s
         g_vars->neventthread << 1;
 
+        // The socket may be recycled once the borrow ends, address it
+        // with version checks instead of ReAddress().
+        s.reset();
+        SocketUniquePtr ptr;
+        if (AddressFailedAsWell(id, &ptr) < 0) {
+            return -1;
+        }
         bthread_t tid;
-        // transfer ownership as well, don't use s anymore!
-        Socket* const p = s.release();
+        // transfer ownership as well, don't use ptr anymore!
+        Socket* const p = ptr.release();
 
         bthread_attr_t attr = thread_attr;
         attr.keytable_pool = p->_keytable_pool;
@@ -2376,7 +3031,16 @@ void Socket::DebugSocket(std::ostream& os, SocketId id) {
            << "\n  in_num_messages=" << sp->in_num_messages.load(butil::memory_order_relaxed)
            << "\n  out_size=" << sp->out_size.load(butil::memory_order_relaxed)
            << "\n  out_num_messages=" << sp->out_num_messages.load(butil::memory_order_relaxed)
-           << "\n}";
+           << "\n  ninflight_calls=" << sp->ninflight_calls.load(butil::memory_order_relaxed)
+           << "\n  ewma_latency_us=" << sp->ewma_latency_us.load(butil::memory_order_relaxed)
+           << "\n  latency_buckets=[";
+        for (int i = 0; i < SocketCallStat::NBUCKET; ++i) {
+            if (i) {
+                os << ' ';
+            }
+            os << sp->latency_buckets[i].load(butil::memory_order_relaxed);
+        }
+        os << "]\n}";
     }
     const int fd = ptr->_fd.load(butil::memory_order_relaxed);
     os << "\nnref=" << NRefOfVRef(vref) - 1
@@ -2399,9 +3063,11 @@ void Socket::DebugSocket(std::ostream& os, SocketId id) {
     const int64_t cpuwide_now = butil::cpuwide_time_us();
     os << "\nhc_count=" << ptr->_hc_count
        << "\navg_input_msg_size=" << ptr->_avg_msg_size
+       << "\nread_size_guess=" << ptr->_read_size_guess
         // NOTE: We're assuming that butil::IOBuf.size() is thread-safe, it is now
         // however it's not guaranteed.
        << "\nread_buf=" << ptr->_read_buf.size()
+       << "\nunwritten_bytes=" << ptr->_unwritten_bytes.load(butil::memory_order_relaxed)
        << "\nlast_read_to_now=" << cpuwide_now - ptr->_last_readtime_us << "us"
        << "\nlast_write_to_now=" << cpuwide_now - ptr->_last_writetime_us << "us"
        << "\novercrowded=" << ptr->_overcrowded;
@@ -2449,7 +3115,8 @@ void Socket::DebugSocket(std::ostream& os, SocketId id) {
     }
     os << "\ncid=" << ptr->_correlation_id
        << "\nwrite_head=" << ptr->_write_head.load(butil::memory_order_relaxed)
-       << "\nssl_state=" << SSLStateToString(ssl_state);
+       << "\nssl_state=" << SSLStateToString(ssl_state)
+       << "\nssl_ktls_send=" << ptr->_ssl_ktls_send;
     const SocketSSLContext* ssl_ctx = ptr->_ssl_ctx.get();
     if (ssl_ctx) {
         os << "\ninitial_ssl_ctx=" << ssl_ctx->raw_ctx;
@@ -2586,6 +3253,9 @@ void Socket::DebugSocket(std::ostream& os, SocketId id) {
         ptr->_rdma_ep->DebugInfo(os);
     }
 #endif
+    if (ptr->_shm_ep) {
+        ptr->_shm_ep->DebugInfo(os);
+    }
     { os << "\nbthread_tag=" << ptr->_io_event.bthread_tag(); }
 }
 
@@ -2629,6 +3299,14 @@ int Socket::RemoveStream(StreamId stream_id) {
     return 0;
 }
 
+StreamWriteScheduler* Socket::GetOrNewStreamWriteScheduler() {
+    BAIDU_SCOPED_LOCK(_stream_mutex);
+    if (_stream_write_scheduler == NULL) {
+        _stream_write_scheduler = new StreamWriteScheduler;
+    }
+    return _stream_write_scheduler;
+}
+
 void Socket::ResetAllStreams(int error_code, const std::string& error_text) {
     DCHECK(Failed());
     std::set<StreamId> saved_stream_set;
@@ -2660,7 +3338,10 @@ inline SocketPool::SocketPool(const SocketOptions& opt)
     : _options(opt)
     , _remote_side(opt.remote_side)
     , _numfree(0)
-    , _numinflight(0) {
+    , _numinflight(0)
+    , _max_free(0)
+    , _min_warm(0)
+    , _warming_up(false) {
 }
 
 inline SocketPool::~SocketPool() {
@@ -2674,7 +3355,7 @@ inline SocketPool::~SocketPool() {
 }
 
 inline int SocketPool::GetSocket(SocketUniquePtr* ptr) {
-    const int connection_pool_size = FLAGS_max_connection_pool_size;
+    const int connection_pool_size = max_free();
 
     // In prev rev, SocketPool could be sharded into multiple SubSocketPools to
     // reduce thread contentions. The sharding key is mixed from pthread-id so
@@ -2723,7 +3404,7 @@ inline int SocketPool::GetSocket(SocketUniquePtr* ptr) {
 
 inline void SocketPool::ReturnSocket(Socket* sock) {
     // NOTE: save the gflag which may be reloaded at any time.
-    const int connection_pool_size = FLAGS_max_connection_pool_size;
+    const int connection_pool_size = max_free();
 
     // Check if the pool is full.
     if (_numfree.fetch_add(1, butil::memory_order_relaxed) <
@@ -2763,6 +3444,40 @@ inline void SocketPool::ListSockets(std::vector<SocketId>* out, size_t max_count
     _mutex.unlock();
 }
 
+void SocketPool::WarmUp(int n, int connect_timeout_ms) {
+    const int64_t start_us = butil::gettimeofday_us();
+    // Sockets returned beyond max_free() are closed, the pool never holds
+    // more than that.
+    n = std::min(n, max_free());
+    int nconnected = 0;
+    while (_numfree.load(butil::memory_order_relaxed) +
+           _numinflight.load(butil::memory_order_relaxed) < n) {
+        const timespec abstime = butil::milliseconds_from_now(connect_timeout_ms);
+        SocketOptions opt = _options;
+        opt.health_check_interval_s = -1;
+        opt.connect_on_create = true;
+        opt.connect_abstime = &abstime;
+        SocketId sid;
+        SocketUniquePtr ptr;
+        if (get_client_side_messenger()->Create(opt, &sid) != 0 ||
+            Socket::Address(sid, &ptr) != 0) {
+            // Error was logged in Create().
+            break;
+        }
+        _numinflight.fetch_add(1, butil::memory_order_relaxed);
+        ReturnSocket(ptr.get());
+        if (ptr->Failed()) {
+            // Closed for the pool being full, e.g. max_free() was reloaded.
+            break;
+        }
+        ++nconnected;
+    }
+    _warming_up.store(false, butil::memory_order_release);
+    RPC_VLOG << "Connected " << nconnected << " pooled sockets to "
+             << _remote_side << " in "
+             << butil::gettimeofday_us() - start_us << "us";
+}
+
 Socket::SharedPart* Socket::GetOrNewSharedPartSlower() {
     // Create _shared_part optimistically.
     SharedPart* shared_part = GetSharedPart();
@@ -2790,15 +3505,11 @@ void Socket::ShareStats(Socket* main_socket) {
     }
 }
 
-int Socket::GetPooledSocket(SocketUniquePtr* pooled_socket) {
-    if (pooled_socket == NULL) {
-        LOG(ERROR) << "pooled_socket is NULL";
-        return -1;
-    }
+SocketPool* Socket::GetOrNewSocketPool() {
     SharedPart* main_sp = GetOrNewSharedPart();
     if (main_sp == NULL) {
         LOG(ERROR) << "_shared_part is NULL";
-        return -1;
+        return NULL;
     }
     // Create socket_pool optimistically.
     SocketPool* socket_pool = main_sp->socket_pool.load(butil::memory_order_consume);
@@ -2820,6 +3531,18 @@ int Socket::GetPooledSocket(SocketUniquePtr* pooled_socket) {
             socket_pool = expected;
         }
     }
+    return socket_pool;
+}
+
+int Socket::GetPooledSocket(SocketUniquePtr* pooled_socket) {
+    if (pooled_socket == NULL) {
+        LOG(ERROR) << "pooled_socket is NULL";
+        return -1;
+    }
+    SocketPool* socket_pool = GetOrNewSocketPool();
+    if (socket_pool == NULL) {
+        return -1;
+    }
     if (socket_pool->GetSocket(pooled_socket) != 0) {
         return -1;
     }
@@ -2863,6 +3586,68 @@ int Socket::ReturnToPool() {
     return 0;
 }
 
+struct WarmUpSocketPoolArg {
+    SocketUniquePtr main_socket;
+    SocketPool* pool;
+    int min_warm;
+    int connect_timeout_ms;
+};
+
+static void* WarmUpSocketPool(void* void_arg) {
+    std::unique_ptr<WarmUpSocketPoolArg> arg(
+        static_cast<WarmUpSocketPoolArg*>(void_arg));
+    arg->pool->WarmUp(arg->min_warm, arg->connect_timeout_ms);
+    return NULL;
+}
+
+int Socket::SetupSocketPool(int min_warm, int max_free,
+                            int connect_timeout_ms) {
+    SocketPool* pool = GetOrNewSocketPool();
+    if (pool == NULL) {
+        return -1;
+    }
+    pool->_max_free.store(max_free, butil::memory_order_relaxed);
+    pool->_min_warm.store(min_warm, butil::memory_order_relaxed);
+    if (min_warm <= 0) {
+        return 0;
+    }
+    if (_app_connect) {
+        // Sockets connected on creation skip AppConnect.
+        LOG(WARNING) << "Can't warm up pooled sockets of " << *this
+                     << " which connect with AppConnect";
+        return 0;
+    }
+    if (pool->_warming_up.exchange(true, butil::memory_order_acquire)) {
+        return 0;
+    }
+    WarmUpSocketPoolArg* arg = new WarmUpSocketPoolArg;
+    ReAddress(&arg->main_socket);
+    arg->pool = pool;
+    arg->min_warm = min_warm;
+    arg->connect_timeout_ms = connect_timeout_ms;
+    bthread_t th;
+    if (bthread_start_background(&th, &BTHREAD_ATTR_NORMAL,
+                                 WarmUpSocketPool, arg) != 0) {
+        LOG(ERROR) << "Fail to start bthread to warm up pooled sockets";
+        pool->_warming_up.store(false, butil::memory_order_relaxed);
+        delete arg;
+        return -1;
+    }
+    return 0;
+}
+
+int Socket::WarmPooledSocketCount() const {
+    SharedPart* sp = GetSharedPart();
+    if (sp == NULL) {
+        return 0;
+    }
+    SocketPool* pool = sp->socket_pool.load(butil::memory_order_consume);
+    if (pool == NULL) {
+        return 0;
+    }
+    return pool->_min_warm.load(butil::memory_order_relaxed);
+}
+
 bool Socket::HasSocketPool() const {
     SharedPart* sp = GetSharedPart();
     if (sp != NULL) {
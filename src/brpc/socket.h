@@ -56,11 +56,18 @@ namespace rdma {
 class RdmaEndpoint;
 class RdmaConnect;
 }
+namespace shm {
+class ShmEndpoint;
+class ShmConnect;
+}
 
 class Socket;
+class SocketPool;
 class AuthContext;
 class EventDispatcher;
 class Stream;
+class StreamWriteScheduler;
+class HttpResponseQueue;
 
 // A special closure for processing the about-to-recycle socket. Socket does
 // not delete SocketUser, if you want, `delete this' at the end of
@@ -135,6 +142,24 @@ struct SocketStat {
     uint32_t out_num_messages_m;
 };
 
+// Stats of calls sent through a socket (and its pooled or short sockets),
+// maintained when the calls end.
+struct SocketCallStat {
+    // Latencies are counted into buckets of [0, 1ms), [1ms, 5ms), ...,
+    // [1s, +inf).
+    static const int NBUCKET = 8;
+    static const int64_t BUCKET_UPPER_US[NBUCKET];
+
+    int64_t ninflight;
+    // Exponentially weighted moving average of latencies.
+    int64_t ewma_latency_us;
+    uint64_t latency_buckets[NBUCKET];
+
+    // Upper bound of the bucket where `ratio' of latencies are below,
+    // -1 when no latencies are counted.
+    int64_t latency_percentile_us(double ratio) const;
+};
+
 struct SocketVarsCollector {
     SocketVarsCollector()
         : nsocket("rpc_socket_count")
@@ -144,6 +169,11 @@ struct SocketVarsCollector {
         , nkeepwrite_second("rpc_keepwrite_second", &nkeepwrite)
         , nwaitepollout("rpc_waitepollout_count")
         , nwaitepollout_second("rpc_waitepollout_second", &nwaitepollout)
+        , nzerocopy("rpc_socket_zerocopy_count")
+        , nzerocopy_fallback("rpc_socket_zerocopy_fallback_count")
+        , nsendfile_bytes("rpc_socket_sendfile_bytes")
+        , ncoalesced_writes("rpc_socket_coalesced_write_count")
+        , niov_per_write("rpc_socket_iovecs_per_write")
     {}
 
     bvar::Adder<int64_t> nsocket;
@@ -155,6 +185,16 @@ struct SocketVarsCollector {
     bvar::PerSecond<bvar::Adder<int64_t> > nkeepwrite_second;
     bvar::Adder<int64_t> nwaitepollout;
     bvar::PerSecond<bvar::Adder<int64_t> > nwaitepollout_second;
+    // Writes sent with MSG_ZEROCOPY / writes that fell back to copying.
+    bvar::Adder<int64_t> nzerocopy;
+    bvar::Adder<int64_t> nzerocopy_fallback;
+    // Bytes of file regions sent with sendfile(2).
+    bvar::Adder<int64_t> nsendfile_bytes;
+    // Small writes copied into a previous write, see
+    // -socket_coalesce_write_threshold.
+    bvar::Adder<int64_t> ncoalesced_writes;
+    // Number of iovecs passed to each writev(2).
+    bvar::IntRecorder niov_per_write;
 };
 
 struct PipelinedInfo {
@@ -271,6 +311,9 @@ struct SocketOptions {
     bool force_ssl{false};
     std::shared_ptr<SocketSSLContext> initial_ssl_ctx;
     bool use_rdma{false};
+    // Exchange data with the peer through shared memory after connecting
+    // to its unix socket, see brpc/shm/shm_endpoint.h
+    bool use_shm{false};
     bthread_keytable_pool_t* keytable_pool{NULL};
     SocketConnection* conn{NULL};
     std::shared_ptr<AppConnect> app_connect;
@@ -286,6 +329,9 @@ struct SocketOptions {
     int tcp_user_timeout_ms{ -1};
     // Tag of this socket
     bthread_tag_t bthread_tag{bthread_self_tag()};
+    // Index of the EventDispatcher(of `bthread_tag') watching this socket.
+    // Negative means choosing one by hashing the fd.
+    int event_dispatcher_index{-1};
     HealthCheckOption hc_option;
 };
 
@@ -298,12 +344,15 @@ friend class Acceptor;
 friend class ConnectionsService;
 friend class SocketUser;
 friend class Stream;
+friend class StreamWriteScheduler;
 friend class Controller;
 friend class policy::ConsistentHashingLoadBalancer;
 friend class policy::RtmpContext;
 friend class schan::ChannelBalancer;
 friend class rdma::RdmaEndpoint;
 friend class rdma::RdmaConnect;
+friend class shm::ShmEndpoint;
+friend class shm::ShmConnect;
 friend class HealthCheckTask;
 friend class OnAppHealthCheckDone;
 friend class HealthCheckManager;
@@ -479,6 +528,13 @@ public:
 
     void FeedbackCircuitBreaker(int error_code, int64_t latency_us);
 
+    // Called when a call is sent through this socket and when it ends.
+    // `latency_us' is negative if the call ended without a response.
+    void OnCallBegin();
+    void OnCallEnd(int64_t latency_us);
+    // Copy stats of calls into `out'.
+    void GetCallStat(SocketCallStat* out) const;
+
     // Notify `id' object (by calling bthread_id_error) when this Socket
     // has been `SetFailed'. If it already has, notify `id' immediately
     void NotifyOnFailed(bthread_id_t id);
@@ -574,6 +630,15 @@ public:
     // main_socket's pool.
     int ReturnToPool();
 
+    // Limit free sockets in the SocketPool of this socket to `max_free'
+    // (-max_connection_pool_size if non-positive) and connect pooled
+    // sockets in background until there are `min_warm' of them, each
+    // within `connect_timeout_ms'. Returns 0 on success.
+    int SetupSocketPool(int min_warm, int max_free, int connect_timeout_ms);
+
+    // Number of pooled sockets that should be kept even if idle.
+    int WarmPooledSocketCount() const;
+
     // True if this socket has SocketPool
     bool HasSocketPool() const;
 
@@ -645,6 +710,11 @@ public:
     void set_http_request_method(const HttpMethod& method) { _http_request_method = method; }
     HttpMethod http_request_method() const { return _http_request_method; }
 
+    // [Server-side http/1.x] Keeps responses of pipelined requests in order.
+    HttpResponseQueue* http_response_queue() const { return _http_response_q; }
+    // Called by the parsing thread only.
+    HttpResponseQueue* GetOrNewHttpResponseQueue();
+
 private:
     DISALLOW_COPY_AND_ASSIGN(Socket);
 
@@ -682,8 +752,12 @@ private:
     // Create SSL session inside and block (in bthread) until handshake
     // has completed. Application layer I/O is forbidden during this
     // process to avoid concurrent I/O on the underlying fd
+    // The handshake runs in a bthread of -ssl_handshake_bthread_tag if the
+    // flag is set.
     // Returns 0 on success, -1 otherwise
     int SSLHandshake(int fd, bool server_mode);
+    int DoSSLHandshake(int fd, bool server_mode);
+    static void* RunSSLHandshake(void* arg);
 
     // Based upon whether the underlying channel is using SSL (if
     // SSLState is SSL_UNKNOWN, try to detect at first), read data
@@ -696,6 +770,32 @@ private:
     // success, -1 otherwise and errno is set
     ssize_t DoWrite(WriteRequest* req);
 
+    // Write `data_list' into the fd without SSL. Data larger than
+    // -socket_zerocopy_threshold is sent with MSG_ZEROCOPY if possible.
+    // Returns written bytes on success, -1 otherwise and errno is set
+    ssize_t CutIntoFileDescriptor(butil::IOBuf* const* data_list, size_t ndata);
+
+    // Write `data_list' in which some IOBufs reference file regions (see
+    // IOBuf::append_file_region). Bytes before the first region are written
+    // as usual, the region itself is sent with sendfile(2) when it's at
+    // front. Returns -1 with errno=ENOTSUP when the caller should write the
+    // mapped bytes instead.
+    ssize_t CutFileRegionsIntoFileDescriptor(butil::IOBuf* const* data_list,
+                                             size_t ndata);
+
+    struct ZeroCopyChunk;
+    // Send `data_list' with MSG_ZEROCOPY and keep written blocks referenced
+    // until the kernel acknowledges them. Returns -1 with errno=ENOTSUP
+    // when the caller should write by copying instead.
+    ssize_t ZeroCopyWrite(butil::IOBuf* const* data_list, size_t ndata);
+    // Release chunks acknowledged in the error queue of `fd'.
+    // Caller must hold _zerocopy_mutex.
+    void ReapZeroCopyCompletions(int fd);
+    // Called before `fd' is closed, chunks not acknowledged yet are
+    // released after a delay since kernel may still be sending them.
+    void ResetZeroCopy(int fd);
+    static void DeleteZeroCopyChunks(void* arg);
+
     // [Not thread-safe] Wait for EPOLLOUT event on `fd'. If `pollin' is
     // true, EPOLLIN event will also be included and EPOLL_CTL_MOD will
     // be used instead of EPOLL_CTL_ADD. Note that spurious wakeups may
@@ -748,7 +848,7 @@ private:
     void WakeAsEpollOut();
 
     // Generic callback for Socket to handle output event.
-    static int OnOutputEvent(void* user_data, uint32_t,
+    static int OnOutputEvent(void* user_data, uint32_t events,
                              const bthread_attr_t&);
 
     class EpollOutRequest;
@@ -776,6 +876,7 @@ private:
     // broken socket.
     int AddStream(StreamId stream_id);
     int RemoveStream(StreamId stream_id);
+    StreamWriteScheduler* GetOrNewStreamWriteScheduler();
     void ResetAllStreams(int error_code, const std::string& error_text);
 
     bool ValidFileDescriptor(int fd);
@@ -790,6 +891,8 @@ private:
     SharedPart* GetOrNewSharedPart();
     SharedPart* GetOrNewSharedPartSlower();
 
+    SocketPool* GetOrNewSocketPool();
+
     void CheckEOFInternal();
 
     // _error_code is set after a socket becomes failed, during the time
@@ -810,11 +913,6 @@ private:
     // locking and relies on atomic CAS. We manage references manually.
     butil::atomic<SharedPart*> _shared_part;
 
-    // [ Set in dispatcher ]
-    // To keep the callback in at most one bthread at any time. Read comments
-    // about ProcessEvent in socket.cpp to understand the tricks.
-    butil::atomic<int> _nevent;
-
     // May be set by Acceptor to share keytables between reading threads
     // on sockets created by the Acceptor.
     bthread_keytable_pool_t* _keytable_pool;
@@ -848,28 +946,10 @@ private:
 
     IOEvent<Socket> _io_event;
 
-    // last chosen index of the protocol as a heuristic value to avoid
-    // iterating all protocol handlers each time.
-    int _preferred_index;
-
     // Number of HC since the last SetFailed() was called. Set to 0 when the
     // socket is revived. Only set in HealthCheckTask::OnTriggeringTask()
     int _hc_count;
 
-    // Size of current incomplete message, set to 0 on complete.
-    uint32_t _last_msg_size;
-    // Average message size of last #MSG_SIZE_WINDOW messages (roughly)
-    uint32_t _avg_msg_size;
-
-    // Storing data read from `_fd' but cut-off yet.
-    butil::IOPortal _read_buf;
-
-    // Set with cpuwide_time_us() at last read operation
-    butil::atomic<int64_t> _last_readtime_us;
-
-    // Saved context for parsing, reset before trying other protocols.
-    butil::atomic<Destroyable*> _parsing_context;
-
     // Saving the correlation_id of RPC on protocols that cannot put
     // correlation_id on-wire and do not send multiple requests on one
     // connection simultaneously.
@@ -883,13 +963,6 @@ private:
     // synchronized via _versioned_ref atomic variable.
     bool _is_hc_related_ref_held;
 
-    // +-1 bit-+---31 bit---+
-    // |  flag |   counter  |
-    // +-------+------------+
-    // 1-bit flag to ensure `SetEOF' to be called only once
-    // 31-bit counter of requests that are currently being processed
-    butil::atomic<uint32_t> _ninprocess;
-
     // +---32 bit---+---32 bit---+
     // |  auth flag | auth error |
     // +------------+------------+
@@ -911,6 +984,9 @@ private:
     // Use mutex to protect SSL objects when ssl_state is SSL_CONNECTED.
     mutable butil::Mutex _ssl_session_mutex;
     SSL* _ssl_session;               // owner
+    // True when encryption of written data is offloaded to kernel by kTLS,
+    // in which case data is written into fd directly without SSL_write.
+    bool _ssl_ktls_send;
     std::shared_ptr<SocketSSLContext> _ssl_ctx;
 
     // The RdmaEndpoint
@@ -918,13 +994,13 @@ private:
     // Should use RDMA or not
     RdmaState _rdma_state;
 
+    // Non-NULL when data is exchanged through shared memory.
+    shm::ShmEndpoint* _shm_ep;
+
     // Pass from controller, for progressive reading.
     ConnectionType _connection_type_for_progressive_read;
     butil::atomic<bool> _controller_released_socket;
 
-    // True if the socket is too full to write.
-    volatile bool _overcrowded;
-
     bool _fail_me_at_server_stop;
 
     // Set by SetLogOff
@@ -945,21 +1021,20 @@ private:
     pthread_mutex_t _id_wait_list_mutex;
     bthread_id_list_t _id_wait_list;
 
-    // Set with cpuwide_time_us() at last write operation
-    butil::atomic<int64_t> _last_writetime_us;
-    // Queued but written
-    butil::atomic<int64_t> _unwritten_bytes;
-
-    // Butex to wait for EPOLLOUT event
-    butil::atomic<int>* _epollout_butex;
-
-    // Storing data that are not flushed into `fd' yet.
-    butil::atomic<WriteRequest*> _write_head;
-
-    bool _is_write_shutdown;
+    // Data sent with MSG_ZEROCOPY but not acknowledged by the kernel yet.
+    // _zerocopy_state: 0 - not tried, 1 - on, -1 - not supported or the
+    // kernel keeps copying for this connection (loopback, old NIC).
+    // _zerocopy_state is modified with _zerocopy_mutex held and checked
+    // without the lock by the write path and EPOLLERR handling.
+    butil::Mutex _zerocopy_mutex;
+    std::deque<ZeroCopyChunk>* _zerocopy_chunks;
+    uint32_t _zerocopy_next_seq;
+    butil::atomic<int> _zerocopy_state;
 
     butil::Mutex _stream_mutex;
     std::set<StreamId> *_stream_set;
+    // Created on first use, see StreamWriteScheduler.
+    StreamWriteScheduler* _stream_write_scheduler;
     butil::atomic<int64_t> _total_streams_unconsumed_size;
 
     butil::atomic<int64_t> _ninflight_app_health_check;
@@ -979,7 +1054,68 @@ private:
     int _tcp_user_timeout_ms;
 
     HttpMethod _http_request_method;
+    HttpResponseQueue* _http_response_q;
     HealthCheckOption _hc_option;
+
+    // Fields above are mostly set at creation and read afterwards. Fields
+    // below are modified for every message and grouped by the threads
+    // modifying them, each group starts at a new cacheline so that the
+    // reading bthread, writing threads and threads processing messages
+    // do not invalidate cachelines of each other. The Socket itself is
+    // cacheline-aligned, the last group does not share its cachelines.
+
+    // [ Read side: dispatcher and the bthread reading `_fd' ]
+    // To keep the callback in at most one bthread at any time. Read comments
+    // about ProcessEvent in socket.cpp to understand the tricks.
+    butil::atomic<int> _nevent BAIDU_CACHELINE_ALIGNMENT;
+
+    // last chosen index of the protocol as a heuristic value to avoid
+    // iterating all protocol handlers each time.
+    int _preferred_index;
+
+    // Size of current incomplete message, set to 0 on complete.
+    uint32_t _last_msg_size;
+    // Average message size of last #MSG_SIZE_WINDOW messages (roughly)
+    uint32_t _avg_msg_size;
+    // Bytes to read next time guessed from recent reads, 0 means unknown.
+    // Only used when -socket_adaptive_read is on.
+    uint32_t _read_size_guess;
+    // Number of consecutive reads using less than half of _read_size_guess.
+    uint8_t _read_shrink_count;
+
+    // Set with cpuwide_time_us() at last read operation
+    butil::atomic<int64_t> _last_readtime_us;
+
+    // Saved context for parsing, reset before trying other protocols.
+    butil::atomic<Destroyable*> _parsing_context;
+
+    // Storing data read from `_fd' but cut-off yet.
+    butil::IOPortal _read_buf;
+
+    // [ Write side: writing threads and KeepWrite ]
+    // Storing data that are not flushed into `fd' yet.
+    butil::atomic<WriteRequest*> _write_head BAIDU_CACHELINE_ALIGNMENT;
+
+    // Queued but written
+    butil::atomic<int64_t> _unwritten_bytes;
+    // Set with cpuwide_time_us() at last write operation
+    butil::atomic<int64_t> _last_writetime_us;
+
+    // Butex to wait for EPOLLOUT event
+    butil::atomic<int>* _epollout_butex;
+
+    // True if the socket is too full to write.
+    volatile bool _overcrowded;
+
+    bool _is_write_shutdown;
+
+    // [ Counters modified by both sides ]
+    // +-1 bit-+---31 bit---+
+    // |  flag |   counter  |
+    // +-------+------------+
+    // 1-bit flag to ensure `SetEOF' to be called only once
+    // 31-bit counter of requests that are currently being processed
+    butil::atomic<uint32_t> _ninprocess BAIDU_CACHELINE_ALIGNMENT;
 };
 
 } // namespace brpc
@@ -49,6 +49,9 @@ struct VersionedRefWithIdDeleter<Socket> {
 
 typedef VersionedRefWithIdUniquePtr<Socket> SocketUniquePtr;
 
+// Result of Socket::Borrow().
+typedef VersionedRefWithIdBorrowedPtr<Socket> SocketBorrowedPtr;
+
 
 } // namespace brpc
 
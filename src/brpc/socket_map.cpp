@@ -17,11 +17,14 @@
 
 
 #include <gflags/gflags.h>
+#include <algorithm>
 #include <map>
 #include "bthread/bthread.h"
 #include "butil/time.h"
 #include "butil/scoped_lock.h"
 #include "butil/logging.h"
+#include "butil/third_party/murmurhash3/murmurhash3.h" // fmix64
+#include "bvar/bvar.h"
 #include "brpc/log.h"
 #include "brpc/protocol.h"
 #include "brpc/input_messenger.h"
@@ -53,6 +56,23 @@ BRPC_VALIDATE_GFLAG(show_socketmap_in_vars, PassValidate);
 DEFINE_bool(reserve_one_idle_socket, false,
             "Reserve one idle socket for pooled connections when idle_timeout_second > 0");
 
+// Times of waiting for locks of SocketMaps held by others.
+static bvar::Adder<int64_t>* g_socket_map_contention = NULL;
+static pthread_once_t s_create_vars_once = PTHREAD_ONCE_INIT;
+
+static void CreateVars() {
+    g_socket_map_contention =
+        new bvar::Adder<int64_t>("rpc_socketmap_lock_contention_count");
+}
+
+// Lock `m', and count the contention if it's held by others.
+static void LockAndCountContention(butil::Mutex& m) {
+    if (!m.try_lock()) {
+        *g_socket_map_contention << 1;
+        m.lock();
+    }
+}
+
 static pthread_once_t g_socket_map_init = PTHREAD_ONCE_INIT;
 static butil::static_atomic<SocketMap*> g_socket_map = BUTIL_STATIC_ATOMIC_INIT(NULL);
 
@@ -92,8 +112,10 @@ SocketMap* get_or_new_client_side_socket_map() {
 int SocketMapInsert(const SocketMapKey& key, SocketId* id,
                     const std::shared_ptr<SocketSSLContext>& ssl_ctx,
                     bool use_rdma,
-                    const HealthCheckOption& hc_option) {
-    return get_or_new_client_side_socket_map()->Insert(key, id, ssl_ctx, use_rdma, hc_option);
+                    const HealthCheckOption& hc_option,
+                    bool use_shm) {
+    return get_or_new_client_side_socket_map()->Insert(
+        key, id, ssl_ctx, use_rdma, hc_option, use_shm);
 }    
 
 int SocketMapFind(const SocketMapKey& key, SocketId* id) {
@@ -129,6 +151,7 @@ void SocketMapList(std::vector<SocketId>* ids) {
 SocketMapOptions::SocketMapOptions()
     : socket_creator(NULL)
     , suggested_map_size(1024)
+    , shard_num(32)
     , idle_timeout_second_dynamic(NULL)
     , idle_timeout_second(0)
     , defer_close_second_dynamic(NULL)
@@ -136,7 +159,8 @@ SocketMapOptions::SocketMapOptions()
 }
 
 SocketMap::SocketMap()
-    : _exposed_in_bvar(false)
+    : _shards(NULL)
+    , _exposed_in_bvar(false)
     , _this_map_bvar(NULL)
     , _has_close_idle_thread(false) {
 }
@@ -147,10 +171,11 @@ SocketMap::~SocketMap() {
         bthread_stop(_close_idle_thread);
         bthread_join(_close_idle_thread, NULL);
     }
-    if (!_map.empty()) {
-        std::ostringstream err;
-        int nleft = 0;
-        for (Map::iterator it = _map.begin(); it != _map.end(); ++it) {
+    std::ostringstream err;
+    int nleft = 0;
+    for (size_t i = 0; _shards != NULL && i < _options.shard_num; ++i) {
+        Map& map = _shards[i].map;
+        for (Map::iterator it = map.begin(); it != map.end(); ++it) {
             SingleConnection* sc = &it->second;
             if ((!sc->socket->Failed() ||
                  sc->socket->HCEnabled()) &&
@@ -162,10 +187,12 @@ SocketMap::~SocketMap() {
                 err << ' ' << *sc->socket;
             }
         }
-        if (nleft) {
-            LOG(ERROR) << err.str();
-        }
     }
+    if (nleft) {
+        LOG(ERROR) << err.str();
+    }
+    delete [] _shards;
+    _shards = NULL;
 
     delete _this_map_bvar;
     _this_map_bvar = NULL;
@@ -184,10 +211,20 @@ int SocketMap::Init(const SocketMapOptions& options) {
         LOG(ERROR) << "SocketOptions.socket_creator must be set";
         return -1;
     }
-    if (_map.init(_options.suggested_map_size, 70) != 0) {
-        LOG(ERROR) << "Fail to init _map";
+    if (_options.shard_num == 0) {
+        LOG(ERROR) << "SocketOptions.shard_num must be positive";
         return -1;
     }
+    CHECK_EQ(0, pthread_once(&s_create_vars_once, CreateVars));
+    _shards = new Shard[_options.shard_num];
+    const size_t shard_map_size = std::max(
+        _options.suggested_map_size / _options.shard_num, (size_t)16);
+    for (size_t i = 0; i < _options.shard_num; ++i) {
+        if (_shards[i].map.init(shard_map_size, 70) != 0) {
+            LOG(ERROR) << "Fail to init map of shard " << i;
+            return -1;
+        }
+    }
     if (_options.idle_timeout_second_dynamic != NULL ||
         _options.idle_timeout_second > 0) {
         if (bthread_start_background(&_close_idle_thread, NULL,
@@ -203,9 +240,9 @@ int SocketMap::Init(const SocketMapOptions& options) {
 void SocketMap::Print(std::ostream& os) {
     // TODO: Elaborate.
     size_t count = 0;
-    {
-        std::unique_lock<butil::Mutex> mu(_mutex);
-        count = _map.size();
+    for (size_t i = 0; i < _options.shard_num; ++i) {
+        BAIDU_SCOPED_LOCK(_shards[i].mutex);
+        count += _shards[i].map.size();
     }
     os << "count=" << count;
 }
@@ -227,11 +264,14 @@ void SocketMap::ShowSocketMapInBvarIfNeed() {
 int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
                       const std::shared_ptr<SocketSSLContext>& ssl_ctx,
                       bool use_rdma,
-                      const HealthCheckOption& hc_option) {
+                      const HealthCheckOption& hc_option,
+                      bool use_shm) {
     ShowSocketMapInBvarIfNeed();
 
-    std::unique_lock<butil::Mutex> mu(_mutex);
-    SingleConnection* sc = _map.seek(key);
+    Shard& shard = GetShard(key);
+    LockAndCountContention(shard.mutex);
+    std::unique_lock<butil::Mutex> mu(shard.mutex, std::adopt_lock);
+    SingleConnection* sc = shard.map.seek(key);
     if (sc) {
         if (!sc->socket->Failed() || sc->socket->HCEnabled()) {
             ++sc->ref_count;
@@ -240,7 +280,7 @@ int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
         }
         // A socket w/o HC is failed (permanently), replace it.
         ReleaseReference(sc->socket);
-        _map.erase(key); // in principle, we can override the entry in map w/o
+        shard.map.erase(key); // in principle, we can override the entry in map w/o
         // removing and inserting it again. But this would make error branches
         // below have to remove the entry before returning, which is
         // error-prone. We prefer code maintainability here.
@@ -251,6 +291,7 @@ int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
     opt.remote_side = key.peer.addr;
     opt.initial_ssl_ctx = ssl_ctx;
     opt.use_rdma = use_rdma;
+    opt.use_shm = use_shm;
     opt.hc_option = hc_option;
     if (_options.socket_creator->CreateSocket(opt, &tmp_id) != 0) {
         PLOG(FATAL) << "Fail to create socket to " << key.peer;
@@ -272,7 +313,7 @@ int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
     // is hold in Socket::Create.
     // If health check is disabled, hold a reference in SocketMap.
     SingleConnection new_sc = { 1, ptr->HCEnabled() ? ptr.get() : ptr.release(), 0 };
-    _map[key] = new_sc;
+    shard.map[key] = new_sc;
     *id = tmp_id;
     mu.unlock();
     return 0;
@@ -287,8 +328,10 @@ void SocketMap::RemoveInternal(const SocketMapKey& key,
                                bool remove_orphan) {
     ShowSocketMapInBvarIfNeed();
 
-    std::unique_lock<butil::Mutex> mu(_mutex);
-    SingleConnection* sc = _map.seek(key);
+    Shard& shard = GetShard(key);
+    LockAndCountContention(shard.mutex);
+    std::unique_lock<butil::Mutex> mu(shard.mutex, std::adopt_lock);
+    SingleConnection* sc = shard.map.seek(key);
     if (!sc) {
         return;
     }
@@ -306,7 +349,7 @@ void SocketMap::RemoveInternal(const SocketMapKey& key,
             sc->no_ref_us = butil::cpuwide_time_us();
         } else {
             Socket* const s = sc->socket;
-            _map.erase(key);
+            shard.map.erase(key);
             mu.unlock();
             s->ReleaseAdditionalReference(); // release extra ref
             ReleaseReference(s);
@@ -323,9 +366,18 @@ void SocketMap::ReleaseReference(Socket* s) {
     }
 }
 
+SocketMap::Shard& SocketMap::GetShard(const SocketMapKey& key) {
+    // Mix the hash so that keys in one shard still spread over buckets of
+    // the map inside.
+    const uint64_t h = butil::fmix64(SocketMapKeyHasher()(key));
+    return _shards[h % _options.shard_num];
+}
+
 int SocketMap::Find(const SocketMapKey& key, SocketId* id) {
-    BAIDU_SCOPED_LOCK(_mutex);
-    SingleConnection* sc = _map.seek(key);
+    Shard& shard = GetShard(key);
+    LockAndCountContention(shard.mutex);
+    std::unique_lock<butil::Mutex> mu(shard.mutex, std::adopt_lock);
+    SingleConnection* sc = shard.map.seek(key);
     if (sc) {
         *id = sc->socket->id();
         return 0;
@@ -335,28 +387,37 @@ int SocketMap::Find(const SocketMapKey& key, SocketId* id) {
 
 void SocketMap::List(std::vector<SocketId>* ids) {
     ids->clear();
-    BAIDU_SCOPED_LOCK(_mutex);
-    for (Map::iterator it = _map.begin(); it != _map.end(); ++it) {
-        ids->push_back(it->second.socket->id());
+    for (size_t i = 0; i < _options.shard_num; ++i) {
+        BAIDU_SCOPED_LOCK(_shards[i].mutex);
+        Map& map = _shards[i].map;
+        for (Map::iterator it = map.begin(); it != map.end(); ++it) {
+            ids->push_back(it->second.socket->id());
+        }
     }
 }
 
 void SocketMap::List(std::vector<butil::EndPoint>* pts) {
     pts->clear();
-    BAIDU_SCOPED_LOCK(_mutex);
-    for (Map::iterator it = _map.begin(); it != _map.end(); ++it) {
-        pts->push_back(it->second.socket->remote_side());
+    for (size_t i = 0; i < _options.shard_num; ++i) {
+        BAIDU_SCOPED_LOCK(_shards[i].mutex);
+        Map& map = _shards[i].map;
+        for (Map::iterator it = map.begin(); it != map.end(); ++it) {
+            pts->push_back(it->second.socket->remote_side());
+        }
     }
 }
 
 void SocketMap::ListOrphans(int64_t defer_us, std::vector<SocketMapKey>* out) {
     out->clear();
     const int64_t now = butil::cpuwide_time_us();
-    BAIDU_SCOPED_LOCK(_mutex);
-    for (Map::iterator it = _map.begin(); it != _map.end(); ++it) {
-        SingleConnection& sc = it->second;
-        if (sc.ref_count == 0 && now - sc.no_ref_us >= defer_us) {
-            out->push_back(it->first);
+    for (size_t i = 0; i < _options.shard_num; ++i) {
+        BAIDU_SCOPED_LOCK(_shards[i].mutex);
+        Map& map = _shards[i].map;
+        for (Map::iterator it = map.begin(); it != map.end(); ++it) {
+            SingleConnection& sc = it->second;
+            if (sc.ref_count == 0 && now - sc.no_ref_us >= defer_us) {
+                out->push_back(it->first);
+            }
         }
     }
 }
@@ -383,7 +444,11 @@ void SocketMap::WatchConnections() {
                 SocketUniquePtr s;
                 if (Socket::Address(main_socket, &s) == 0) {
                     s->ListPooledSockets(&pooled_sockets);
-                    for (size_t i = FLAGS_reserve_one_idle_socket ? 1 : 0;
+                    // Warm sockets are kept(see Socket::SetupSocketPool).
+                    const size_t nreserved = std::max(
+                        FLAGS_reserve_one_idle_socket ? 1 : 0,
+                        s->WarmPooledSocketCount());
+                    for (size_t i = nreserved;
                          i < pooled_sockets.size(); ++i) {
                         SocketUniquePtr s2;
                         if (Socket::Address(pooled_sockets[i], &s2) == 0) {
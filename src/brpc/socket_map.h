@@ -79,10 +79,12 @@ struct SocketMapKeyHasher {
 // The corresponding SocketId is written to `*id'. If this function returns
 // successfully, SocketMapRemove() MUST be called when the Socket is not needed.
 // Return 0 on success, -1 otherwise.
+// Sockets are created with SocketOptions.use_shm=`use_shm'.
 int SocketMapInsert(const SocketMapKey& key, SocketId* id,
                     const std::shared_ptr<SocketSSLContext>& ssl_ctx,
                     bool use_rdma,
-                    const HealthCheckOption& hc_option);
+                    const HealthCheckOption& hc_option,
+                    bool use_shm = false);
 
 inline int SocketMapInsert(const SocketMapKey& key, SocketId* id,
                     const std::shared_ptr<SocketSSLContext>& ssl_ctx) {
@@ -128,6 +130,12 @@ struct SocketMapOptions {
     // Initial size of the map (proper size reduces number of resizes)
     // Default: 1024
     size_t suggested_map_size;
+
+    // The map is split into so many shards by hash of keys, each of which
+    // has its own lock, so that channels to different endpoints do not
+    // contend with each other.
+    // Default: 32
+    size_t shard_num;
   
     // Pooled connections without data transmission for so many seconds will
     // be closed. No effect for non-positive values.
@@ -155,7 +163,8 @@ public:
     int Insert(const SocketMapKey& key, SocketId* id,
                const std::shared_ptr<SocketSSLContext>& ssl_ctx,
                bool use_rdma,
-               const HealthCheckOption& hc_option);
+               const HealthCheckOption& hc_option,
+               bool use_shm = false);
 
     int Insert(const SocketMapKey& key, SocketId* id,
                const std::shared_ptr<SocketSSLContext>& ssl_ctx) {
@@ -192,13 +201,16 @@ private:
         int64_t no_ref_us;
     };
 
-    // TODO: When RpcChannels connecting to one EndPoint are frequently created
-    //       and destroyed, a single map+mutex may become hot-spots.
     typedef butil::FlatMap<SocketMapKey, SingleConnection,
                            SocketMapKeyHasher> Map;
+    struct Shard {
+        butil::Mutex mutex;
+        Map map;
+    };
+    Shard& GetShard(const SocketMapKey& key);
+
     SocketMapOptions _options;
-    butil::Mutex _mutex;
-    Map _map;
+    Shard* _shards;
     butil::atomic<bool> _exposed_in_bvar;
     bvar::PassiveStatus<std::string>* _this_map_bvar;
     bool _has_close_idle_thread;
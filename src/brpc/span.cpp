@@ -18,6 +18,7 @@
 
 #include <netinet/in.h>
 #include <functional>
+#include <map>
 #include <gflags/gflags.h>
 #include <leveldb/db.h>
 #include <leveldb/comparator.h>
@@ -31,9 +32,13 @@
 #include "butil/fast_rand.h"
 #include "butil/file_util.h"
 #include "butil/files/file_enumerator.h"
+#include "butil/containers/doubly_buffered_data.h"
+#include "bvar/latency_recorder.h"
 #include "brpc/shared_object.h"
 #include "brpc/reloadable_flags.h"
 #include "brpc/span.h"
+#include "brpc/span_exporter.h"
+#include "brpc/details/span_ring.h"
 
 #define BRPC_SPAN_INFO_SEP "\1"
 
@@ -64,6 +69,28 @@ DEFINE_bool(rpcz_keep_span_db, false, "Don't remove DB of rpcz at program's exit
 DEFINE_int64(rpcz_save_span_min_latency_us, 0, "The minimum latency microseconds of span saved");
 BRPC_VALIDATE_GFLAG(rpcz_save_span_min_latency_us, NonNegativeInteger);
 
+DEFINE_bool(rpcz_save_error_span, false, "Save spans with errors even if "
+            "they're faster than -rpcz_save_span_min_latency_us");
+BRPC_VALIDATE_GFLAG(rpcz_save_error_span, PassValidate);
+
+DEFINE_bool(rpcz_adaptive_sampling, false, "Trace all requests and decide "
+            "which spans to keep when they end: spans of traces sampled "
+            "by the speed limit of rpcz, failed spans and spans slower than "
+            "p99 latency of their methods are all kept, other spans are "
+            "kept at -rpcz_adaptive_sampling_per_method per second");
+BRPC_VALIDATE_GFLAG(rpcz_adaptive_sampling, PassValidate);
+
+DEFINE_int32(rpcz_adaptive_sampling_per_method, 10, "Keep so many spans "
+             "which are neither sampled, failed nor slow of each method "
+             "per second when -rpcz_adaptive_sampling is on");
+BRPC_VALIDATE_GFLAG(rpcz_adaptive_sampling_per_method, NonNegativeInteger);
+
+DEFINE_int32(rpcz_memory_store_mb, 0, "Store spans in an in-memory ring of "
+             "so many megabytes instead of leveldb, 0 means leveldb");
+
+DEFINE_string(rpcz_memory_store_file, "", "Map the in-memory ring of rpcz "
+              "from this file so that spans survive crashes");
+
 struct IdGen {
     bool init;
     uint16_t seq;
@@ -104,6 +131,13 @@ inline uint64_t GenerateTraceId() {
     return (g->current_random & 0xFFFFFFFFFFFF0000ULL) | g->seq++;
 }
 
+// Whether a new trace is sampled. With -rpcz_adaptive_sampling, traces not
+// sampled are still traced, but only failed or slow spans of them are kept.
+inline bool SampleNewTrace() {
+    extern bvar::CollectorSpeedLimit g_span_sl;
+    return !FLAGS_rpcz_adaptive_sampling || bvar::is_collectable(&g_span_sl);
+}
+
 Span* Span::CreateClientSpan(const std::string& full_method_name,
                              int64_t base_real_us) {
     Span* span = butil::get_object<Span>(Forbidden());
@@ -133,14 +167,18 @@ Span* Span::CreateClientSpan(const std::string& full_method_name,
     Span* parent = static_cast<Span*>(bthread::tls_bls.rpcz_parent_span);
     if (parent) {
         span->_trace_id = parent->trace_id();
+        span->_trace_id_high = parent->trace_id_high();
         span->_parent_span_id = parent->span_id();
         span->_local_parent = parent;
         span->_next_client = parent->_client_list;
         parent->_client_list = span;
+        span->_sampled = parent->_sampled;
     } else {
         span->_trace_id = GenerateTraceId();
+        span->_trace_id_high = 0;
         span->_parent_span_id = 0;
         span->_local_parent = NULL;
+        span->_sampled = SampleNewTrace();
     }
     span->_span_id = GenerateSpanId();
     return span;
@@ -178,10 +216,12 @@ Span* Span::CreateBthreadSpan(const std::string& full_method_name,
     span->_info.clear();
 
     span->_trace_id = parent->trace_id();
+    span->_trace_id_high = parent->trace_id_high();
     span->_parent_span_id = parent->span_id();
     span->_local_parent = parent;
     span->_next_client = parent->_client_list;
     parent->_client_list = span;
+    span->_sampled = parent->_sampled;
 
     span->_span_id = GenerateSpanId();
     return span;
@@ -202,8 +242,11 @@ Span* Span::CreateServerSpan(
         return NULL;
     }
     span->_trace_id = (trace_id ? trace_id : GenerateTraceId());
+    span->_trace_id_high = 0;
     span->_span_id = (span_id ? span_id : GenerateSpanId());
     span->_parent_span_id = parent_span_id;
+    // Traces from upstream are sampled unless the protocol tells otherwise.
+    span->_sampled = (trace_id != 0 || SampleNewTrace());
     span->_log_id = 0;
     span->_base_cid = INVALID_BTHREAD_ID;
     span->_ending_cid = INVALID_BTHREAD_ID;
@@ -356,6 +399,61 @@ void AnnotateSpan(const char* fmt, ...) {
     va_end(ap);
 }
 
+static bool ParseHex64(const char* s, size_t len, uint64_t* out) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; ++i) {
+        const char c = s[i];
+        int d;
+        if (c >= '0' && c <= '9') {
+            d = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            d = c - 'a' + 10;
+        } else {
+            // Uppercase is not allowed by the spec.
+            return false;
+        }
+        v = (v << 4) | d;
+    }
+    *out = v;
+    return true;
+}
+
+int ParseTraceParent(const butil::StringPiece& header, TraceParent* tp) {
+    // version(2)-trace-id(32)-parent-id(16)-trace-flags(2), later versions
+    // may append more fields after another '-'.
+    const size_t LEN = 55;
+    const char* s = header.data();
+    if (header.size() < LEN || s[2] != '-' || s[35] != '-' || s[52] != '-' ||
+        (header.size() > LEN && s[LEN] != '-')) {
+        return -1;
+    }
+    uint64_t version = 0;
+    uint64_t flags = 0;
+    if (!ParseHex64(s, 2, &version) || version == 0xff ||
+        (version == 0 && header.size() != LEN) ||
+        !ParseHex64(s + 3, 16, &tp->trace_id_high) ||
+        !ParseHex64(s + 19, 16, &tp->trace_id) ||
+        !ParseHex64(s + 36, 16, &tp->parent_span_id) ||
+        !ParseHex64(s + 53, 2, &flags)) {
+        return -1;
+    }
+    if ((tp->trace_id_high == 0 && tp->trace_id == 0) ||
+        tp->parent_span_id == 0) {
+        return -1;
+    }
+    tp->sampled = (flags & 1);
+    return 0;
+}
+
+std::string FormatTraceParent(uint64_t trace_id_high, uint64_t trace_id,
+                              uint64_t span_id, bool sampled) {
+    return butil::string_printf("00-%016llx%016llx-%016llx-%s",
+                                (unsigned long long)trace_id_high,
+                                (unsigned long long)trace_id,
+                                (unsigned long long)span_id,
+                                sampled ? "01" : "00");
+}
+
 class SpanDB : public SharedObject {
 public:
     leveldb::DB* id_db;
@@ -367,6 +465,8 @@ public:
     static SpanDB* Open();
     leveldb::Status Index(const Span* span, std::string* value_buf);
     leveldb::Status RemoveSpansBefore(int64_t tm);
+    // Convert `span' along with its client spans, also used by SpanRing.
+    static void ToRpczSpan(const Span* span, RpczSpan* out);
 
 private:
     static void Swap(SpanDB& db1, SpanDB& db2) {
@@ -399,7 +499,12 @@ static pthread_mutex_t g_span_db_mutex = PTHREAD_MUTEX_INITIALIZER;
 static bool g_span_ending = false;  // don't open span again if this var is true.
 // Can't use intrusive_ptr which has ctor/dtor issues.
 static SpanDB* g_span_db = NULL;
-bool has_span_db() { return !!g_span_db; }
+// Used instead of g_span_db when -rpcz_memory_store_mb is positive. Never
+// deleted once created.
+static butil::atomic<SpanRing*> g_span_ring(NULL);
+bool has_span_db() {
+    return g_span_db || g_span_ring.load(butil::memory_order_acquire);
+}
 bvar::CollectorSpeedLimit g_span_sl = BVAR_COLLECTOR_SPEED_LIMIT_INITIALIZER;
 static bvar::DisplaySamplingRatio s_display_sampling_ratio(
     "rpcz_sampling_ratio", &g_span_sl);
@@ -471,14 +576,112 @@ inline int GetSpanDB(butil::intrusive_ptr<SpanDB>* db) {
     return -1;
 }
 
+// Per-method states of -rpcz_adaptive_sampling.
+struct MethodSampling {
+    bvar::LatencyRecorder latency;
+    // p99 of `latency', updated at most once per second.
+    butil::atomic<int64_t> p99_us;
+    butil::atomic<int64_t> p99_update_s;
+    // Number of spans kept by rate in second `rate_s'.
+    butil::atomic<int64_t> rate_s;
+    butil::atomic<int> nkept;
+
+    MethodSampling() : p99_us(0), p99_update_s(0), rate_s(0), nkept(0) {}
+};
+
+typedef std::map<std::string, MethodSampling*> MethodSamplingMap;
+// Methods are never removed, stop adding new methods beyond this.
+static const size_t MAX_SAMPLING_METHODS = 1024;
+static butil::DoublyBufferedData<MethodSamplingMap>* g_method_sampling = NULL;
+static pthread_once_t g_method_sampling_once = PTHREAD_ONCE_INIT;
+
+static void InitMethodSampling() {
+    g_method_sampling = new butil::DoublyBufferedData<MethodSamplingMap>;
+}
+
+static size_t AddMethodSampling(MethodSamplingMap& bg, const std::string& name,
+                                MethodSampling** m) {
+    MethodSampling*& slot = bg[name];
+    if (slot == NULL) {
+        if (*m == NULL) {
+            *m = new MethodSampling;
+        }
+        slot = *m;
+    } else {
+        *m = slot;
+    }
+    return 1;
+}
+
+static MethodSampling* GetMethodSampling(const std::string& name) {
+    pthread_once(&g_method_sampling_once, InitMethodSampling);
+    size_t nmethod = 0;
+    {
+        butil::DoublyBufferedData<MethodSamplingMap>::ScopedPtr s;
+        if (g_method_sampling->Read(&s) != 0) {
+            return NULL;
+        }
+        MethodSamplingMap::const_iterator it = s->find(name);
+        if (it != s->end()) {
+            return it->second;
+        }
+        nmethod = s->size();
+    }
+    if (nmethod >= MAX_SAMPLING_METHODS) {
+        return NULL;
+    }
+    MethodSampling* m = NULL;
+    g_method_sampling->Modify(AddMethodSampling, name, &m);
+    return m;
+}
+
+bool AdaptivelySample(const Span* span) {
+    const int64_t latency_us =
+        span->GetEndRealTimeUs() - span->GetStartRealTimeUs();
+    bool keep = span->sampled() || span->error_code() != 0;
+    MethodSampling* m = GetMethodSampling(span->full_method_name());
+    if (m == NULL) {
+        return keep;
+    }
+    const int64_t now_s = butil::gettimeofday_s();
+    if (!keep) {
+        const int64_t p99_us = m->p99_us.load(butil::memory_order_relaxed);
+        keep = (p99_us > 0 && latency_us >= p99_us);
+    }
+    if (!keep) {
+        if (m->rate_s.load(butil::memory_order_relaxed) != now_s) {
+            // Racing resets just keep a few more spans.
+            m->rate_s.store(now_s, butil::memory_order_relaxed);
+            m->nkept.store(0, butil::memory_order_relaxed);
+        }
+        keep = (m->nkept.fetch_add(1, butil::memory_order_relaxed) <
+                FLAGS_rpcz_adaptive_sampling_per_method);
+    }
+    m->latency << latency_us;
+    int64_t update_s = m->p99_update_s.load(butil::memory_order_relaxed);
+    if (update_s != now_s && m->p99_update_s.compare_exchange_strong(
+            update_s, now_s, butil::memory_order_relaxed)) {
+        m->p99_us.store(m->latency.latency_percentile(0.99),
+                        butil::memory_order_relaxed);
+    }
+    return keep;
+}
+
 void Span::Submit(Span* span, int64_t cpuwide_time_us) {
     if (span->local_parent() == NULL) {
+        if (FLAGS_rpcz_adaptive_sampling && !AdaptivelySample(span)) {
+            span->destroy();
+            return;
+        }
         span->submit(cpuwide_time_us);
     }
 }
 
 static void Span2Proto(const Span* span, RpczSpan* out) {
     out->set_trace_id(span->trace_id());
+    if (span->trace_id_high()) {
+        out->set_trace_id_high(span->trace_id_high());
+    }
     out->set_span_id(span->span_id());
     out->set_parent_span_id(span->parent_span_id());
     out->set_log_id(span->log_id());
@@ -501,6 +704,46 @@ static void Span2Proto(const Span* span, RpczSpan* out) {
     out->set_error_code(span->error_code());
 }
 
+// Spans faster than -rpcz_save_span_min_latency_us are not saved unless
+// they fail and -rpcz_save_error_span is on.
+static bool ShouldSaveSpan(const Span* span) {
+    const int64_t latency_us =
+        span->GetEndRealTimeUs() - span->GetStartRealTimeUs();
+    return latency_us >= FLAGS_rpcz_save_span_min_latency_us ||
+        (FLAGS_rpcz_save_error_span && span->error_code() != 0);
+}
+
+static void Span2Brief(const Span* span, BriefSpan* brief) {
+    const int64_t start_time = span->GetStartRealTimeUs();
+    brief->set_trace_id(span->trace_id());
+    brief->set_span_id(span->span_id());
+    brief->set_log_id(span->log_id());
+    brief->set_type(span->type());
+    brief->set_error_code(span->error_code());
+    brief->set_request_size(span->request_size());
+    brief->set_response_size(span->response_size());
+    brief->set_start_real_us(start_time);
+    brief->set_latency_us(span->GetEndRealTimeUs() - start_time);
+    brief->set_full_method_name(span->full_method_name());
+}
+
+void SpanDB::ToRpczSpan(const Span* span, RpczSpan* out) {
+    Span2Proto(span, out);
+    // client spans should be reversed.
+    size_t client_span_count = span->CountClientSpans();
+    for (size_t i = 0; i < client_span_count; ++i) {
+        out->add_client_spans();
+    }
+    size_t i = 0;
+    span->traversal(const_cast<Span*>(span), [&](Span* p) {
+        if (span == p) {
+            return;
+        }
+        Span2Proto(p, out->mutable_client_spans(client_span_count - i - 1));
+        ++i;
+    });
+}
+
 inline void ToBigEndian(uint64_t n, uint32_t* buf) {
     buf[0] = htonl(n >> 32);
     buf[1] = htonl(n & 0xFFFFFFFFUL);
@@ -581,23 +824,12 @@ leveldb::Status SpanDB::Index(const Span* span, std::string* value_buf) {
     // fails, the entry in time_db will be finally removed when it's out
     // of time window.
 
-    const int64_t start_time = span->GetStartRealTimeUs();
-    const int64_t latency_us = span->GetEndRealTimeUs() - start_time;
-    // if latency_us < FLAGS_rpcz_save_span_min_latency_us, don't save this span
-    if (latency_us < FLAGS_rpcz_save_span_min_latency_us) {
+    if (!ShouldSaveSpan(span)) {
         return leveldb::Status::OK();
     }
+    const int64_t start_time = span->GetStartRealTimeUs();
     BriefSpan brief;
-    brief.set_trace_id(span->trace_id());
-    brief.set_span_id(span->span_id());
-    brief.set_log_id(span->log_id());
-    brief.set_type(span->type());
-    brief.set_error_code(span->error_code());
-    brief.set_request_size(span->request_size());
-    brief.set_response_size(span->response_size());
-    brief.set_start_real_us(start_time);
-    brief.set_latency_us(latency_us);
-    brief.set_full_method_name(span->full_method_name());
+    Span2Brief(span, &brief);
     if (!brief.SerializeToString(value_buf)) {
         return leveldb::Status::InvalidArgument(
             leveldb::Slice("Fail to serialize BriefSpan"));
@@ -637,20 +869,7 @@ leveldb::Status SpanDB::Index(const Span* span, std::string* value_buf) {
     ToBigEndian(span->span_id(), key_data + 2);
     leveldb::Slice key((char*)key_data, sizeof(key_data));
     RpczSpan value_proto;
-    Span2Proto(span, &value_proto);
-    // client spans should be reversed.
-    size_t client_span_count = span->CountClientSpans();
-    for (size_t i = 0; i < client_span_count; ++i) {
-        value_proto.add_client_spans();
-    }
-    size_t i = 0;
-    span->traversal(const_cast<Span*>(span), [&](Span* p) {
-        if (span == p) {
-            return;
-        }
-        Span2Proto(p, value_proto.mutable_client_spans(client_span_count - i - 1));
-        ++i;
-    });
+    ToRpczSpan(span, &value_proto);
     if (!value_proto.SerializeToString(value_buf)) {
         return leveldb::Status::InvalidArgument(
             leveldb::Slice("Fail to serialize RpczSpan"));
@@ -703,10 +922,59 @@ leveldb::Status SpanDB::RemoveSpansBefore(int64_t tm) {
     return rc;
 }
 
+// Write span into the in-memory ring. Called by the dumping thread only.
+static void DumpIntoSpanRing(const Span* span) {
+    SpanRing* ring = g_span_ring.load(butil::memory_order_relaxed);
+    if (ring == NULL) {
+        ring = SpanRing::Open(FLAGS_rpcz_memory_store_mb * 1024L * 1024L,
+                              FLAGS_rpcz_memory_store_file);
+        if (ring == NULL) {
+            return;
+        }
+        g_span_ring.store(ring, butil::memory_order_release);
+    }
+    if (!ShouldSaveSpan(span)) {
+        return;
+    }
+    BriefSpan brief;
+    Span2Brief(span, &brief);
+    RpczSpan full;
+    SpanDB::ToRpczSpan(span, &full);
+    std::string brief_buf;
+    std::string full_buf;
+    if (!brief.SerializeToString(&brief_buf) ||
+        !full.SerializeToString(&full_buf)) {
+        LOG(WARNING) << "Fail to serialize span";
+        return;
+    }
+    ring->Append(brief.start_real_us(), span->trace_id(), span->span_id(),
+                 brief_buf, full_buf);
+}
+
+// Spans older than -rpcz_keep_span_seconds are invisible in the ring.
+inline int64_t OldestSpanTimeInRing() {
+    return butil::gettimeofday_us() - FLAGS_rpcz_keep_span_seconds * 1000000L;
+}
+
 // Write span into leveldb.
 void Span::dump_and_destroy(size_t /*round*/) {
     StartIndexingIfNeeded();
 
+    if (!FLAGS_rpcz_otlp_url.empty() && !g_span_ending) {
+        RpczSpan exported;
+        SpanDB::ToRpczSpan(this, &exported);
+        ExportSpan(exported);
+    }
+
+    if (FLAGS_rpcz_memory_store_mb > 0 ||
+        g_span_ring.load(butil::memory_order_relaxed)) {
+        if (!g_span_ending) {
+            DumpIntoSpanRing(this);
+        }
+        destroy();
+        return;
+    }
+
     std::string value_buf;
 
     butil::intrusive_ptr<SpanDB> db;
@@ -752,6 +1020,26 @@ void Span::dump_and_destroy(size_t /*round*/) {
 }
 
 int FindSpan(uint64_t trace_id, uint64_t span_id, RpczSpan* response) {
+    SpanRing* ring = g_span_ring.load(butil::memory_order_acquire);
+    if (ring) {
+        const int64_t oldest = OldestSpanTimeInRing();
+        int rc = -1;
+        std::string value;
+        ring->Traverse([&](const SpanRing::Entry& e) {
+            if (e.time_key < oldest) {
+                return false;
+            }
+            if (e.trace_id != trace_id || e.span_id != span_id) {
+                return true;
+            }
+            if (ring->Read(e, NULL, &value) &&
+                response->ParseFromString(value)) {
+                rc = 0;
+            }
+            return false;
+        });
+        return rc;
+    }
     butil::intrusive_ptr<SpanDB> db;
     if (GetSpanDB(&db) != 0) {
         return -1;
@@ -774,6 +1062,24 @@ int FindSpan(uint64_t trace_id, uint64_t span_id, RpczSpan* response) {
 
 void FindSpans(uint64_t trace_id, std::deque<RpczSpan>* out) {
     out->clear();
+    SpanRing* ring = g_span_ring.load(butil::memory_order_acquire);
+    if (ring) {
+        const int64_t oldest = OldestSpanTimeInRing();
+        std::string value;
+        ring->Traverse([&](const SpanRing::Entry& e) {
+            if (e.time_key < oldest) {
+                return false;
+            }
+            if (e.trace_id == trace_id && ring->Read(e, NULL, &value)) {
+                out->push_back(RpczSpan());
+                if (!out->back().ParseFromString(value)) {
+                    out->pop_back();
+                }
+            }
+            return true;
+        });
+        return;
+    }
     butil::intrusive_ptr<SpanDB> db;
     if (GetSpanDB(&db) != 0) {
         return;
@@ -806,6 +1112,30 @@ void FindSpans(uint64_t trace_id, std::deque<RpczSpan>* out) {
 void ListSpans(int64_t starting_realtime, size_t max_scan,
                std::deque<BriefSpan>* out, SpanFilter* filter) {
     out->clear();
+    SpanRing* ring = g_span_ring.load(butil::memory_order_acquire);
+    if (ring) {
+        const int64_t oldest = OldestSpanTimeInRing();
+        std::string value;
+        BriefSpan brief;
+        size_t nscan = 0;
+        ring->Traverse([&](const SpanRing::Entry& e) {
+            if (e.time_key < oldest || nscan >= max_scan) {
+                return false;
+            }
+            if (e.time_key > starting_realtime) {
+                return true;
+            }
+            brief.Clear();
+            if (ring->Read(e, &value, NULL) && brief.ParseFromString(value)) {
+                if (NULL == filter || filter->Keep(brief)) {
+                    out->push_back(brief);
+                }
+                ++nscan;
+            }
+            return true;
+        });
+        return;
+    }
     butil::intrusive_ptr<SpanDB> db;
     if (GetSpanDB(&db) != 0) {
         return;
@@ -843,6 +1173,11 @@ void ListSpans(int64_t starting_realtime, size_t max_scan,
 }
 
 void DescribeSpanDB(std::ostream& os) {
+    SpanRing* ring = g_span_ring.load(butil::memory_order_acquire);
+    if (ring) {
+        ring->Describe(os);
+        return;
+    }
     butil::intrusive_ptr<SpanDB> db;
     if (GetSpanDB(&db) != 0) {
         return;
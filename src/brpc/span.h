@@ -41,6 +41,7 @@ extern __thread bthread::LocalStorage tls_bls;
 namespace brpc {
 
 DECLARE_bool(enable_rpcz);
+DECLARE_bool(rpcz_adaptive_sampling);
 
 // Collect information required by /rpcz and tracing system whose idea is
 // described in http://static.googleusercontent.com/media/research.google.com/en//pubs/archive/36356.pdf
@@ -102,6 +103,8 @@ public:
     void set_request_size(int size) { _request_size = size; }
     void set_response_size(int size) { _response_size = size; }
     void set_async(bool async) { _async = async; }
+    void set_sampled(bool sampled) { _sampled = sampled; }
+    void set_trace_id_high(uint64_t id) { _trace_id_high = id; }
     
     void set_base_real_us(int64_t tm) { _base_real_us = tm; }
     void set_received_us(int64_t tm)
@@ -121,6 +124,9 @@ public:
     }
 
     uint64_t trace_id() const { return _trace_id; }
+    // Higher 64 bits of the trace id, non-zero only for traces started by
+    // W3C trace context (traceparent) whose ids are 128-bit.
+    uint64_t trace_id_high() const { return _trace_id_high; }
     uint64_t parent_span_id() const { return _parent_span_id; }
     uint64_t span_id() const { return _span_id; }
     uint64_t log_id() const { return _log_id; }
@@ -138,6 +144,8 @@ public:
     int64_t start_send_real_us() const { return _start_send_real_us; }
     int64_t sent_real_us() const { return _sent_real_us; }
     bool async() const { return _async; }
+    // False if the span is kept only when it fails or is slow.
+    bool sampled() const { return _sampled; }
     const std::string& full_method_name() const { return _full_method_name; }
     const std::string& info() const { return _info; }
     
@@ -157,6 +165,7 @@ private:
     }
 
     uint64_t _trace_id;
+    uint64_t _trace_id_high;
     uint64_t _span_id;
     uint64_t _parent_span_id;
     uint64_t _log_id;
@@ -165,6 +174,7 @@ private:
     butil::EndPoint _remote_side;
     SpanType _type;
     bool _async;
+    bool _sampled;
     ProtocolType _protocol;
     int _error_code;
     int  _request_size;
@@ -198,6 +208,10 @@ private:
     butil::StringSplitter _sp;
 };
 
+// Returns true if the ending root `span' should be kept under
+// -rpcz_adaptive_sampling. Exposed for testing.
+bool AdaptivelySample(const Span* span);
+
 // These two functions can be used for composing TRACEPRINT as well as hiding
 // span implementations.
 bool CanAnnotateSpan();
@@ -234,12 +248,31 @@ void ListSpans(SpanDB* db, int64_t before_this_time, size_t max_scan,
 
 // Check this function first before creating a span.
 // If rpcz of upstream is enabled, local rpcz is enabled automatically.
+// With -rpcz_adaptive_sampling, all requests are traced and Span::Submit()
+// decides which spans to keep.
 inline bool IsTraceable(bool is_upstream_traced) {
     extern bvar::CollectorSpeedLimit g_span_sl;
     return is_upstream_traced ||
-        (FLAGS_enable_rpcz && bvar::is_collectable(&g_span_sl));
+        (FLAGS_enable_rpcz && (FLAGS_rpcz_adaptive_sampling ||
+                               bvar::is_collectable(&g_span_sl)));
 }
 
+// Ids in the `traceparent' header of W3C trace context, see
+// https://www.w3.org/TR/trace-context/
+struct TraceParent {
+    uint64_t trace_id_high;
+    uint64_t trace_id;
+    uint64_t parent_span_id;
+    bool sampled;
+};
+
+// Returns 0 on success, -1 if `header' is malformed or has invalid ids.
+int ParseTraceParent(const butil::StringPiece& header, TraceParent* tp);
+
+// Format a traceparent header for a request sent by span `span_id'.
+std::string FormatTraceParent(uint64_t trace_id_high, uint64_t trace_id,
+                              uint64_t span_id, bool sampled);
+
 inline void* CreateBthreadSpan() {
     const int64_t received_us = butil::cpuwide_time_us();
     const int64_t base_realtime = butil::gettimeofday_us() - received_us;
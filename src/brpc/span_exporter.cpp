@@ -0,0 +1,299 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <pthread.h>
+#include <unistd.h>                          // gethostname
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <gflags/gflags.h>
+#include "butil/errno.h"
+#include "butil/endpoint.h"
+#include "butil/process_util.h"              // ReadCommandLine
+#include "butil/synchronization/lock.h"
+#include "bthread/bthread.h"
+#include "bvar/reducer.h"
+#include "brpc/log.h"
+#include "brpc/channel.h"
+#include "brpc/controller.h"
+#include "brpc/adaptive_protocol_type.h"     // ProtocolTypeToString
+#include "brpc/reloadable_flags.h"
+#include "brpc/span.h"
+#include "brpc/policy/gzip_compress.h"
+#include "brpc/opentelemetry_trace.pb.h"
+#include "brpc/span_exporter.h"
+
+namespace brpc {
+
+DEFINE_string(rpcz_otlp_url, "",
+              "Export spans of rpcz to this OpenTelemetry collector in "
+              "OTLP/HTTP, e.g. http://127.0.0.1:4318/v1/traces. Empty "
+              "disables exporting");
+DEFINE_string(rpcz_otlp_service_name, "",
+              "service.name of exported spans, name of the program if empty");
+DEFINE_int32(rpcz_otlp_interval_ms, 1000, "Export queued spans every so "
+             "many milliseconds");
+BRPC_VALIDATE_GFLAG(rpcz_otlp_interval_ms, PositiveInteger);
+DEFINE_int32(rpcz_otlp_batch_size, 512, "Max number of spans in one export "
+             "request");
+BRPC_VALIDATE_GFLAG(rpcz_otlp_batch_size, PositiveInteger);
+DEFINE_int32(rpcz_otlp_max_queue_size, 8192, "Drop spans when so many spans "
+             "are waiting to be exported");
+BRPC_VALIDATE_GFLAG(rpcz_otlp_max_queue_size, PositiveInteger);
+DEFINE_int32(rpcz_otlp_timeout_ms, 3000, "Timeout of export requests");
+
+static pthread_once_t s_exporter_once = PTHREAD_ONCE_INIT;
+static butil::Mutex* s_queue_mutex = NULL;
+// Spans waiting to be exported.
+static std::vector<OtlpSpan*>* s_queue = NULL;
+static bvar::Adder<int64_t>* s_exported_spans = NULL;
+static bvar::Adder<int64_t>* s_dropped_spans = NULL;
+
+inline std::string ToBigEndianBytes(uint64_t v) {
+    char buf[8];
+    for (int i = 0; i < 8; ++i) {
+        buf[i] = (char)(v >> (56 - 8 * i));
+    }
+    return std::string(buf, sizeof(buf));
+}
+
+static void AddAttribute(OtlpSpan* span, const char* key,
+                         const std::string& value) {
+    OtlpKeyValue* kv = span->add_attributes();
+    kv->set_key(key);
+    kv->mutable_value()->set_string_value(value);
+}
+
+static void AddAttribute(OtlpSpan* span, const char* key, int64_t value) {
+    OtlpKeyValue* kv = span->add_attributes();
+    kv->set_key(key);
+    kv->mutable_value()->set_int_value(value);
+}
+
+void RpczSpan2Otlp(const RpczSpan& span, OtlpSpan* out) {
+    out->set_trace_id(ToBigEndianBytes(span.trace_id_high()) +
+                      ToBigEndianBytes(span.trace_id()));
+    out->set_span_id(ToBigEndianBytes(span.span_id()));
+    if (span.parent_span_id()) {
+        out->set_parent_span_id(ToBigEndianBytes(span.parent_span_id()));
+    }
+    out->set_name(span.full_method_name());
+    switch (span.type()) {
+    case SPAN_TYPE_SERVER:
+        out->set_kind(OTLP_SPAN_KIND_SERVER);
+        break;
+    case SPAN_TYPE_CLIENT:
+        out->set_kind(OTLP_SPAN_KIND_CLIENT);
+        break;
+    default:
+        out->set_kind(OTLP_SPAN_KIND_INTERNAL);
+        break;
+    }
+    // Same as Span::GetStartRealTimeUs() and Span::GetEndRealTimeUs().
+    int64_t start_us = (span.type() == SPAN_TYPE_SERVER ?
+                        span.received_real_us() : span.start_send_real_us());
+    int64_t end_us = std::max(span.received_real_us(),
+                              span.start_parse_real_us());
+    end_us = std::max(end_us, span.start_callback_real_us());
+    end_us = std::max(end_us, span.start_send_real_us());
+    end_us = std::max(end_us, span.sent_real_us());
+    if (start_us == 0) {
+        // Client spans failed before sending.
+        start_us = end_us;
+    }
+    out->set_start_time_unix_nano(start_us * 1000L);
+    out->set_end_time_unix_nano(end_us * 1000L);
+
+    AddAttribute(out, "rpc.system", std::string("brpc"));
+    if (span.type() != SPAN_TYPE_BTHREAD) {
+        const std::string& name = span.full_method_name();
+        const size_t dot = name.find_last_of('.');
+        if (dot != std::string::npos) {
+            AddAttribute(out, "rpc.service", name.substr(0, dot));
+            AddAttribute(out, "rpc.method", name.substr(dot + 1));
+        } else {
+            AddAttribute(out, "rpc.method", name);
+        }
+        AddAttribute(out, "network.protocol.name",
+                     std::string(ProtocolTypeToString(span.protocol())));
+    }
+    if (span.remote_ip()) {
+        AddAttribute(out, "network.peer.address", std::string(
+                         butil::ip2str(butil::int2ip(span.remote_ip())).c_str()));
+        AddAttribute(out, "network.peer.port", (int64_t)span.remote_port());
+    }
+    if (span.log_id()) {
+        AddAttribute(out, "brpc.log_id", (int64_t)span.log_id());
+    }
+    AddAttribute(out, "brpc.request_size", (int64_t)span.request_size());
+    AddAttribute(out, "brpc.response_size", (int64_t)span.response_size());
+    if (span.error_code() != 0) {
+        AddAttribute(out, "brpc.error_code", (int64_t)span.error_code());
+        out->mutable_status()->set_code(OTLP_STATUS_CODE_ERROR);
+        out->mutable_status()->set_message(berror(span.error_code()));
+    }
+
+    SpanInfoExtractor extractor(span.info().c_str());
+    int64_t anno_time = 0;
+    std::string anno;
+    while (extractor.PopAnnotation(std::numeric_limits<int64_t>::max(),
+                                   &anno_time, &anno)) {
+        OtlpSpanEvent* event = out->add_events();
+        event->set_time_unix_nano(anno_time * 1000L);
+        event->set_name(anno);
+    }
+}
+
+static std::string GetServiceName() {
+    if (!FLAGS_rpcz_otlp_service_name.empty()) {
+        return FLAGS_rpcz_otlp_service_name;
+    }
+    char buf[256];
+    const ssize_t nr = butil::ReadCommandLine(buf, sizeof(buf), false);
+    if (nr <= 0) {
+        return "brpc";
+    }
+    const std::string path(buf, nr);
+    const size_t slash = path.find_last_of('/');
+    return (slash == std::string::npos ? path : path.substr(slash + 1));
+}
+
+static void FillResource(OtlpResource* res) {
+    OtlpKeyValue* kv = res->add_attributes();
+    kv->set_key("service.name");
+    kv->mutable_value()->set_string_value(GetServiceName());
+    char host[256];
+    if (gethostname(host, sizeof(host)) == 0) {
+        host[sizeof(host) - 1] = '\0';
+        kv = res->add_attributes();
+        kv->set_key("host.name");
+        kv->mutable_value()->set_string_value(host);
+    }
+}
+
+// Send spans[0, n) and delete them.
+static void SendSpans(Channel* chan, OtlpSpan** spans, size_t n) {
+    OtlpExportTraceServiceRequest req;
+    OtlpResourceSpans* rs = req.add_resource_spans();
+    FillResource(rs->mutable_resource());
+    OtlpScopeSpans* ss = rs->add_scope_spans();
+    ss->mutable_scope()->set_name("brpc");
+    for (size_t i = 0; i < n; ++i) {
+        ss->mutable_spans()->AddAllocated(spans[i]);
+    }
+    Controller cntl;
+    cntl.http_request().uri() = FLAGS_rpcz_otlp_url;
+    cntl.http_request().set_method(HTTP_METHOD_POST);
+    cntl.http_request().set_content_type("application/x-protobuf");
+    cntl.http_request().SetHeader("Content-Encoding", "gzip");
+    if (!policy::GzipCompress(req, &cntl.request_attachment())) {
+        LOG(WARNING) << "Fail to compress spans";
+        return;
+    }
+    chan->CallMethod(NULL, &cntl, NULL, NULL, NULL);
+    if (cntl.Failed()) {
+        LOG_EVERY_SECOND(WARNING) << "Fail to export spans to "
+                                  << FLAGS_rpcz_otlp_url << ", "
+                                  << cntl.ErrorText();
+        *s_dropped_spans << n;
+        return;
+    }
+    *s_exported_spans << n;
+}
+
+static void* RunSpanExporter(void*) {
+    Channel* chan = NULL;
+    std::string chan_url;
+    std::vector<OtlpSpan*> spans;
+    while (true) {
+        bthread_usleep(FLAGS_rpcz_otlp_interval_ms * 1000L);
+        spans.clear();
+        {
+            BAIDU_SCOPED_LOCK(*s_queue_mutex);
+            spans.swap(*s_queue);
+        }
+        if (spans.empty()) {
+            continue;
+        }
+        const std::string url = FLAGS_rpcz_otlp_url;
+        if (!url.empty() && (chan == NULL || chan_url != url)) {
+            // Requests are synchronous, no one is using the old channel.
+            delete chan;
+            chan = new Channel;
+            ChannelOptions opt;
+            opt.protocol = PROTOCOL_HTTP;
+            opt.timeout_ms = FLAGS_rpcz_otlp_timeout_ms;
+            if (chan->Init(url.c_str(), "", &opt) != 0) {
+                LOG(WARNING) << "Fail to connect to " << url;
+                delete chan;
+                chan = NULL;
+            }
+            chan_url = url;
+        }
+        if (chan == NULL || url.empty()) {
+            for (size_t i = 0; i < spans.size(); ++i) {
+                delete spans[i];
+            }
+            *s_dropped_spans << spans.size();
+            continue;
+        }
+        const size_t batch = FLAGS_rpcz_otlp_batch_size;
+        for (size_t i = 0; i < spans.size(); i += batch) {
+            SendSpans(chan, &spans[i], std::min(batch, spans.size() - i));
+        }
+    }
+    return NULL;
+}
+
+static void StartSpanExporter() {
+    s_queue_mutex = new butil::Mutex;
+    s_queue = new std::vector<OtlpSpan*>;
+    s_exported_spans = new bvar::Adder<int64_t>("rpcz_otlp_exported_spans");
+    s_dropped_spans = new bvar::Adder<int64_t>("rpcz_otlp_dropped_spans");
+    bthread_t tid;
+    if (bthread_start_background(&tid, NULL, RunSpanExporter, NULL) != 0) {
+        LOG(ERROR) << "Fail to start the span exporter";
+    }
+}
+
+void ExportSpan(const RpczSpan& span) {
+    pthread_once(&s_exporter_once, StartSpanExporter);
+    std::vector<OtlpSpan*> spans;
+    spans.reserve(span.client_spans_size() + 1);
+    spans.push_back(new OtlpSpan);
+    RpczSpan2Otlp(span, spans.back());
+    for (int i = 0; i < span.client_spans_size(); ++i) {
+        spans.push_back(new OtlpSpan);
+        RpczSpan2Otlp(span.client_spans(i), spans.back());
+    }
+    {
+        BAIDU_SCOPED_LOCK(*s_queue_mutex);
+        if (s_queue->size() + spans.size() <=
+            (size_t)FLAGS_rpcz_otlp_max_queue_size) {
+            s_queue->insert(s_queue->end(), spans.begin(), spans.end());
+            return;
+        }
+    }
+    // The collector is slow or unreachable.
+    for (size_t i = 0; i < spans.size(); ++i) {
+        delete spans[i];
+    }
+    *s_dropped_spans << spans.size();
+}
+
+} // namespace brpc
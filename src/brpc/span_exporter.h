@@ -0,0 +1,44 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_SPAN_EXPORTER_H
+#define BRPC_SPAN_EXPORTER_H
+
+// [Internal] RPC users are not supposed to call functions below.
+
+#include <gflags/gflags_declare.h>
+
+namespace brpc {
+
+DECLARE_string(rpcz_otlp_url);
+
+class RpczSpan;
+class OtlpSpan;
+
+// Queue `span' along with its client spans to be exported to
+// -rpcz_otlp_url in OTLP/HTTP. Queued spans are batched, gzip-compressed and
+// sent by a background bthread every -rpcz_otlp_interval_ms milliseconds.
+// Called by the dumping thread of bvar::Collector.
+void ExportSpan(const RpczSpan& span);
+
+// Convert `span' without its client spans into `out'.
+void RpczSpan2Otlp(const RpczSpan& span, OtlpSpan* out);
+
+} // namespace brpc
+
+
+#endif // BRPC_SPAN_EXPORTER_H
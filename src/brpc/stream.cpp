@@ -29,6 +29,8 @@
 #include "brpc/input_messenger.h"
 #include "brpc/policy/streaming_rpc_protocol.h"
 #include "brpc/policy/baidu_rpc_protocol.h"
+#include "brpc/policy/http2_rpc_protocol.h"
+#include "brpc/details/stream_write_scheduler.h"
 #include "brpc/stream_impl.h"
 
 
@@ -36,11 +38,14 @@ namespace brpc {
 
 DECLARE_bool(usercode_in_pthread);
 DECLARE_int64(socket_max_streams_unconsumed_bytes);
+DECLARE_int32(stream_write_quantum);
 DEFINE_uint64(stream_write_max_segment_size, 512 * 1024 * 1024,
               "Stream message exceeding this size will be automatically split into smaller segments");
 BRPC_VALIDATE_GFLAG(stream_write_max_segment_size, PositiveInteger);
 
 const static butil::IOBuf *TIMEOUT_TASK = (butil::IOBuf*)-1L;
+const static butil::IOBuf *HALF_CLOSE_TASK = (butil::IOBuf*)-2L;
+const static butil::IOBuf *FLUSH_TASK = (butil::IOBuf*)-3L;
 
 Stream::Stream() 
     : _host_socket(NULL)
@@ -51,11 +56,15 @@ Stream::Stream()
     , _produced(0)
     , _remote_consumed(0)
     , _cur_buf_size(0)
+    , _remote_window(0)
     , _local_consumed(0)
     , _parse_rpc_response(false)
+    , _h2_stream_id(0)
     , _pending_buf(NULL)
     , _start_idle_timer_us(0)
     , _idle_timer(0)
+    , _batch_timer_pending(false)
+    , _write_scheduler(NULL)
 {
     _connect_meta.on_connect = NULL;
     CHECK_EQ(0, bthread_mutex_init(&_connect_mutex, NULL));
@@ -68,6 +77,9 @@ Stream::~Stream() {
         delete _pending_buf;
         _pending_buf = NULL;
     }
+    for (size_t i = 0; i < _held_messages.size(); ++i) {
+        delete _held_messages[i];
+    }
     CHECK(_host_socket == NULL);
     bthread_mutex_destroy(&_connect_mutex);
     bthread_mutex_destroy(&_congestion_control_mutex);
@@ -128,12 +140,26 @@ int Stream::Create(const StreamOptions &options,
 void Stream::BeforeRecycle(Socket *) {
     // No one holds reference now, so we don't need lock here
     bthread_id_list_reset(&_writable_wait_list, ECONNRESET);
-    if (_connected) {
+    if (_connected && _h2_stream_id != 0) {
+        policy::CloseH2GrpcStream(_host_socket, _h2_stream_id,
+                                  _error_code, _error_text);
+    } else if (_connected) {
         // Send CLOSE frame
         RPC_VLOG << "Send close frame";
         CHECK(_host_socket != NULL);
-        policy::SendStreamClose(_host_socket,
-                                _remote_settings.stream_id(), id());
+        if (_write_scheduler != NULL) {
+            // Behind data frames held by the scheduler.
+            StreamFrameMeta fm;
+            fm.set_stream_id(_remote_settings.stream_id());
+            fm.set_source_stream_id(id());
+            fm.set_frame_type(FRAME_TYPE_CLOSE);
+            butil::IOBuf out;
+            policy::PackStreamMessage(&out, fm, NULL);
+            WriteToHostSocket(&out);
+        } else {
+            policy::SendStreamClose(_host_socket,
+                                    _remote_settings.stream_id(), id());
+        }
     }
 
     if (_host_socket) {
@@ -160,6 +186,24 @@ ssize_t Stream::CutMessageIntoFileDescriptor(int /*fd*/,
         errno = EBADF;
         return -1;
     }
+    std::vector<butil::IOBuf> batched_msgs;
+    std::vector<butil::IOBuf*> msg_list;
+    if (!_batches.empty()) {
+        SplitBatches(data_list, size, &batched_msgs, &msg_list);
+        data_list = msg_list.data();
+        size = msg_list.size();
+    }
+    if (_h2_stream_id != 0) {
+        return policy::WriteH2GrpcStream(_host_socket, _h2_stream_id,
+                                         data_list, size);
+    }
+    // Messages are written in chunks of at most max_chunk_size bytes, which
+    // are also the units to take turns with other streams.
+    size_t max_chunk_size = FLAGS_stream_write_max_segment_size;
+    if (_write_scheduler != NULL) {
+        max_chunk_size = std::min(
+            max_chunk_size, (size_t)std::max(FLAGS_stream_write_quantum, 1));
+    }
     butil::IOBuf out;
     ssize_t len = 0;
     ssize_t unwritten_data_size = 0;
@@ -190,7 +234,7 @@ ssize_t Stream::CutMessageIntoFileDescriptor(int /*fd*/,
                 out.clear();
             }
         } else {
-            if (unwritten_data_size + length > FLAGS_stream_write_max_segment_size) {
+            if (unwritten_data_size && unwritten_data_size + length > max_chunk_size) {
                 WriteToHostSocket(&out);
                 unwritten_data_size = 0;
                 out.clear();
@@ -213,7 +257,48 @@ ssize_t Stream::CutMessageIntoFileDescriptor(int /*fd*/,
     return len;
 }
 
+void Stream::SplitBatches(butil::IOBuf** data_list, size_t size,
+                          std::vector<butil::IOBuf>* msgs,
+                          std::vector<butil::IOBuf*>* msg_list) {
+    std::vector<const std::vector<size_t>*> lengths(size, NULL);
+    size_t nmsg = 0;
+    for (size_t i = 0; i < size; ++i) {
+        for (size_t j = 0; j < _batches.size(); ++j) {
+            if (_batches[j].first == data_list[i]) {
+                lengths[i] = &_batches[j].second;
+                nmsg += lengths[i]->size();
+                break;
+            }
+        }
+    }
+    // Pointers to elements of `msgs' are taken, don't reallocate.
+    msgs->reserve(nmsg);
+    for (size_t i = 0; i < size; ++i) {
+        if (lengths[i] == NULL) {
+            msg_list->push_back(data_list[i]);
+            continue;
+        }
+        for (size_t j = 0; j < lengths[i]->size(); ++j) {
+            msgs->push_back(butil::IOBuf());
+            data_list[i]->cutn(&msgs->back(), (*lengths[i])[j]);
+            msg_list->push_back(&msgs->back());
+        }
+    }
+    for (size_t j = 0; j < _batches.size();) {
+        if (_batches[j].first->empty()) {
+            _batches[j] = _batches.back();
+            _batches.pop_back();
+        } else {
+            ++j;
+        }
+    }
+}
+
 void Stream::WriteToHostSocket(butil::IOBuf* b) {
+    if (_write_scheduler != NULL) {
+        return _write_scheduler->Write(_host_socket, id(),
+                                       _options.write_weight, b);
+    }
     BRPC_HANDLE_EOVERCROWDED(_host_socket->Write(b));
 }
 
@@ -284,6 +369,10 @@ void Stream::SetConnected(const StreamSettings* remote_settings) {
     } else {
         CHECK(_remote_settings.IsInitialized());
     }
+    if (_remote_settings.window_size() > 0) {
+        BAIDU_SCOPED_LOCK(_congestion_control_mutex);
+        SetRemoteWindow(_remote_settings.window_size());
+    }
     CHECK(_host_socket != NULL);
     RPC_VLOG << "stream=" << id() << " is connected to stream_id=" 
              << _remote_settings.stream_id() << " at host_socket=" << *_host_socket;
@@ -298,6 +387,42 @@ void Stream::SetConnected(const StreamSettings* remote_settings) {
     }
 }
 
+void Stream::SetH2Connected(Socket* host_socket, int h2_stream_id) {
+    _h2_stream_id = h2_stream_id;
+    // The rpc response is carried by the http2 stream itself.
+    _parse_rpc_response = false;
+    SetHostSocket(host_socket);
+    if (_remote_settings.IsInitialized()) {
+        // Server-side, settings were set by StreamAccept.
+        return SetConnected();
+    }
+    StreamSettings settings;
+    settings.set_stream_id(h2_stream_id);
+    settings.set_writable(true);
+    SetConnected(&settings);
+}
+
+int Stream::OnH2Message(bthread::ExecutionQueueId<butil::IOBuf*> queue,
+                        butil::IOBuf* message) {
+    butil::IOBuf* tmp = new butil::IOBuf;
+    tmp->swap(*message);
+    const int rc = bthread::execution_queue_execute(queue, tmp);
+    if (rc != 0) {
+        delete tmp;
+    }
+    return rc;
+}
+
+void Stream::OnH2HalfClosed(bthread::ExecutionQueueId<butil::IOBuf*> queue) {
+    bthread::execution_queue_execute(queue, (butil::IOBuf*)HALF_CLOSE_TASK);
+}
+
+void Stream::OnH2Sent(size_t consumed) {
+    if (_cur_buf_size > 0) {
+        SetRemoteConsumed(consumed, 0);
+    }
+}
+
 void Stream::TriggerOnConnectIfNeed() {
     if (_connect_meta.on_connect != NULL) {
         ConnectMeta* meta = new ConnectMeta;
@@ -315,8 +440,7 @@ void Stream::TriggerOnConnectIfNeed() {
     bthread_mutex_unlock(&_connect_mutex);
 }
 
-int Stream::AppendIfNotFull(const butil::IOBuf &data,
-                            const StreamWriteOptions* options) {
+bool Stream::Produce(size_t length) {
     if (_cur_buf_size > 0) {
         std::unique_lock<bthread_mutex_t> lck(_congestion_control_mutex);
         if (_produced >= _remote_consumed + _cur_buf_size) {
@@ -328,9 +452,17 @@ int Stream::AppendIfNotFull(const butil::IOBuf &data,
                      << " _remote_consumed=" << saved_remote_consumed
                      << " gap=" << saved_produced - saved_remote_consumed
                      << " max_buf_size=" << _cur_buf_size;
-            return 1;
+            return false;
         }
-        _produced += data.length();
+        _produced += length;
+    }
+    return true;
+}
+
+int Stream::AppendIfNotFull(const butil::IOBuf &data,
+                            const StreamWriteOptions* options) {
+    if (!Produce(data.length())) {
+        return 1;
     }
 
     size_t data_length = data.length();
@@ -351,7 +483,64 @@ int Stream::AppendIfNotFull(const butil::IOBuf &data,
     return 0;
 }
 
-void Stream::SetRemoteConsumed(size_t new_remote_consumed) {
+// Messages of a StreamWritev written as one request of the fake socket,
+// which are split again in CutMessageIntoFileDescriptor.
+class StreamBatchMessage : public SocketMessage {
+public:
+    butil::Status AppendAndDestroySelf(butil::IOBuf* out, Socket* sock) override {
+        std::unique_ptr<StreamBatchMessage> destroy_self(this);
+        if (sock == NULL) {
+            return butil::Status::OK();
+        }
+        out->swap(data);
+        Stream* s = (Stream*)sock->conn();
+        s->_batches.push_back(std::make_pair(out, std::vector<size_t>()));
+        s->_batches.back().second.swap(lengths);
+        return butil::Status::OK();
+    }
+
+    size_t EstimatedByteSize() override { return data.size(); }
+
+    butil::IOBuf data;
+    std::vector<size_t> lengths;
+};
+
+int Stream::AppendIfNotFull(butil::IOBuf* const msgs[], size_t n,
+                            const StreamWriteOptions* options) {
+    SocketMessagePtr<StreamBatchMessage> batch(new StreamBatchMessage);
+    batch->lengths.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        batch->data.append(*msgs[i]);
+        batch->lengths.push_back(msgs[i]->length());
+    }
+    const size_t data_length = batch->data.length();
+    if (!Produce(data_length)) {
+        return 1;
+    }
+    Socket::WriteOptions wopt;
+    wopt.write_in_background = options != NULL && options->write_in_background;
+    const int rc = _fake_socket_weak_ref->Write(batch, &wopt);
+    if (rc != 0) {
+        LOG(WARNING) << "Fail to write to _fake_socket, " << berror();
+        BAIDU_SCOPED_LOCK(_congestion_control_mutex);
+        _produced -= data_length;
+        return -1;
+    }
+    if (FLAGS_socket_max_streams_unconsumed_bytes > 0) {
+        _host_socket->_total_streams_unconsumed_size += data_length;
+    }
+    return 0;
+}
+
+void Stream::SetRemoteWindow(int64_t remote_window) {
+    _remote_window = remote_window;
+    if (_options.max_buf_size <= 0 || _cur_buf_size > _remote_window) {
+        _cur_buf_size = _remote_window;
+    }
+}
+
+void Stream::SetRemoteConsumed(size_t new_remote_consumed,
+                               int64_t remote_window) {
     CHECK(_cur_buf_size > 0);
     bthread_id_list_t tmplist;
     bthread_id_list_init(&tmplist, 0, 0);
@@ -361,6 +550,9 @@ void Stream::SetRemoteConsumed(size_t new_remote_consumed) {
         return;
     }
     const bool was_full = _produced >= _remote_consumed + _cur_buf_size;
+    if (remote_window > 0) {
+        SetRemoteWindow(remote_window);
+    }
 
     if (FLAGS_socket_max_streams_unconsumed_bytes > 0) {
         _host_socket->_total_streams_unconsumed_size -= new_remote_consumed - _remote_consumed;
@@ -377,6 +569,9 @@ void Stream::SetRemoteConsumed(size_t new_remote_consumed) {
             } else {
                 _cur_buf_size *= 2;
             }
+            if (_remote_window > 0 && _cur_buf_size > _remote_window) {
+                _cur_buf_size = _remote_window;
+            }
         }
     }
 
@@ -496,7 +691,8 @@ int Stream::OnReceived(const StreamFrameMeta& fm, butil::IOBuf *buf, Socket* soc
     }
     switch (fm.frame_type()) {
     case FRAME_TYPE_FEEDBACK:
-        SetRemoteConsumed(fm.feedback().consumed_size());
+        SetRemoteConsumed(fm.feedback().consumed_size(),
+                          fm.feedback().window_size());
         CHECK(buf->empty());
         break;
     case FRAME_TYPE_DATA:
@@ -555,13 +751,22 @@ public:
         _size = 0;
     }
     void push(butil::IOBuf* buf) {
+        push_held(buf);
+        _total_length += buf->length();
+    }
+    // Push a message held by previous Consume, which was counted already.
+    void push_held(butil::IOBuf* buf) {
         if (_size == _cap) {
             flush();
         }
         _storage[_size++] = buf;
-        _total_length += buf->length();
-
     }
+    // Move messages not flushed yet into `held'.
+    void hold(std::vector<butil::IOBuf*>* held) {
+        held->insert(held->end(), _storage, _storage + _size);
+        _size = 0;
+    }
+    size_t size() const { return _size; }
     size_t total_length() const { return _total_length; }
 private:
     butil::IOBuf** _storage;
@@ -589,6 +794,14 @@ int Stream::Consume(void *meta, bthread::TaskIterator<butil::IOBuf*>& iter) {
                 error_code = s->_error_code;
                 error_text = s->_error_text;
             }
+            if (!s->_held_messages.empty()) {
+                s->_options.handler->on_received_messages(
+                    s->id(), s->_held_messages.data(), s->_held_messages.size());
+                for (size_t i = 0; i < s->_held_messages.size(); ++i) {
+                    delete s->_held_messages[i];
+                }
+                s->_held_messages.clear();
+            }
             if (error_code != 0) {
                 // The stream is closed abnormally.
                 s->_options.handler->on_failed(s->id(), error_code, error_text);
@@ -599,12 +812,27 @@ int Stream::Consume(void *meta, bthread::TaskIterator<butil::IOBuf*>& iter) {
     }
     DEFINE_SMALL_ARRAY(butil::IOBuf*, buf_list, s->_options.messages_in_batch, 256);
     MessageBatcher mb(buf_list, s->_options.messages_in_batch, s);
+    for (size_t i = 0; i < s->_held_messages.size(); ++i) {
+        mb.push_held(s->_held_messages[i]);
+    }
+    s->_held_messages.clear();
     bool has_timeout_task = false;
+    bool has_flush_task = false;
+    size_t nmessage = 0;
     for (; iter; ++iter) {
         butil::IOBuf* t= *iter;
         if (t == TIMEOUT_TASK) {
             has_timeout_task = true;
+        } else if (t == FLUSH_TASK) {
+            has_flush_task = true;
+            s->_batch_timer_pending = false;
+        } else if (t == HALF_CLOSE_TASK) {
+            mb.flush();
+            if (s->_options.handler != NULL) {
+                s->_options.handler->on_half_closed(s->id());
+            }
         } else {
+            ++nmessage;
             if (s->_parse_rpc_response) {
                 s->_parse_rpc_response = false;
                 s->HandleRpcResponse(t);
@@ -618,9 +846,25 @@ int Stream::Consume(void *meta, bthread::TaskIterator<butil::IOBuf*>& iter) {
             s->_options.handler->on_idle_timeout(s->id());
         }
     }
+    if (s->_options.max_batch_delay_us > 0 && !has_flush_task &&
+        mb.size() > 0 && mb.size() < s->_options.messages_in_batch) {
+        // Wait a while for more messages.
+        mb.hold(&s->_held_messages);
+        s->StartBatchTimer();
+    }
     mb.flush();
 
-    if (s->_remote_settings.need_feedback() && mb.total_length() > 0) {
+    if (s->_h2_stream_id != 0) {
+        if (nmessage > 0) {
+            // Give back the window occupied by the consumed messages.
+            policy::ReturnH2GrpcStreamWindow(
+                s->_host_socket, s->_h2_stream_id,
+                mb.total_length() + nmessage * policy::GRPC_MESSAGE_PREFIX_SIZE);
+        }
+    } else if ((s->_remote_settings.need_feedback() ||
+                (s->_options.receive_buf_size > 0 &&
+                 s->_remote_settings.accept_window())) &&
+               mb.total_length() > 0) {
         s->_local_consumed += mb.total_length();
         s->SendFeedback();
     }
@@ -634,9 +878,13 @@ void Stream::SendFeedback() {
     fm.set_stream_id(_remote_settings.stream_id());
     fm.set_source_stream_id(id());
     fm.mutable_feedback()->set_consumed_size(_local_consumed);
+    if (_options.receive_buf_size > 0) {
+        fm.mutable_feedback()->set_window_size(_options.receive_buf_size);
+    }
     butil::IOBuf out;
     policy::PackStreamMessage(&out, fm, NULL);
-    WriteToHostSocket(&out);
+    // Not held by the scheduler, which delays the remote side.
+    BRPC_HANDLE_EOVERCROWDED(_host_socket->Write(&out));
 }
 
 int Stream::SetHostSocket(Socket *host_socket) {
@@ -649,6 +897,9 @@ int Stream::SetHostSocket(Socket *host_socket) {
             return;
         }
         _host_socket = ptr.release();
+        if (FLAGS_stream_write_quantum > 0 && _h2_stream_id == 0) {
+            _write_scheduler = _host_socket->GetOrNewStreamWriteScheduler();
+        }
     });
     return 0;
 }
@@ -656,6 +907,10 @@ int Stream::SetHostSocket(Socket *host_socket) {
 void Stream::FillSettings(StreamSettings *settings) {
     settings->set_stream_id(id());
     settings->set_need_feedback(_cur_buf_size > 0);
+    settings->set_accept_window(true);
+    if (_options.receive_buf_size > 0) {
+        settings->set_window_size(_options.receive_buf_size);
+    }
     settings->set_writable(_options.handler != NULL);
 }
 
@@ -664,6 +919,28 @@ void OnIdleTimeout(void *arg) {
     bthread::execution_queue_execute(q, (butil::IOBuf*)TIMEOUT_TASK);
 }
 
+static void OnBatchTimeout(void *arg) {
+    bthread::ExecutionQueueId<butil::IOBuf*> q = { (uint64_t)arg };
+    bthread::execution_queue_execute(q, (butil::IOBuf*)FLUSH_TASK);
+}
+
+void Stream::StartBatchTimer() {
+    if (_batch_timer_pending) {
+        // Messages are flushed no later than the pending timer.
+        return;
+    }
+    bthread_timer_t timer;
+    const int rc = bthread_timer_add(
+        &timer, butil::microseconds_from_now(_options.max_batch_delay_us),
+        OnBatchTimeout, (void*)(_consumer_queue.value));
+    if (rc != 0) {
+        LOG(WARNING) << "Fail to add timer";
+        // Don't hold the messages forever.
+        bthread::execution_queue_execute(_consumer_queue, (butil::IOBuf*)FLUSH_TASK);
+    }
+    _batch_timer_pending = true;
+}
+
 void Stream::StartIdleTimer() {
     if (_options.idle_timeout_ms < 0) {
         return;
@@ -771,6 +1048,23 @@ int StreamWrite(StreamId stream_id, const butil::IOBuf &message,
     return (rc == 1) ? EAGAIN : errno;
 }
 
+int StreamWritev(StreamId stream_id, butil::IOBuf* const messages[], size_t n,
+                 const StreamWriteOptions* options) {
+    SocketUniquePtr ptr;
+    if (Socket::Address(stream_id, &ptr) != 0) {
+        return EINVAL;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    Stream* s = (Stream*)ptr->conn();
+    const int rc = s->AppendIfNotFull(messages, n, options);
+    if (rc == 0) {
+        return 0;
+    }
+    return (rc == 1) ? EAGAIN : errno;
+}
+
 void StreamWait(StreamId stream_id, const timespec *due_time,
                 void (*on_writable)(StreamId, void*, int), void *arg) {
     SocketUniquePtr ptr;
@@ -50,6 +50,10 @@ public:
     // when the stream is closed abnormally.
     virtual void on_failed(StreamId id, int error_code,
                            const std::string& error_text) {}
+    // Called when the remote side finished sending but still accepts
+    // messages, only happens to gRPC streams over http2 when the client
+    // half-closes the call. Messages received before were all delivered.
+    virtual void on_half_closed(StreamId id) {}
 };
 
 struct StreamOptions {
@@ -58,6 +62,9 @@ struct StreamOptions {
         , max_buf_size(2 * 1024 * 1024)
         , idle_timeout_ms(-1)
         , messages_in_batch(128)
+        , max_batch_delay_us(0)
+        , receive_buf_size(-1)
+        , write_weight(1)
         , handler(NULL)
     {}
 
@@ -81,6 +88,26 @@ struct StreamOptions {
     // default: 128
     size_t messages_in_batch;
 
+    // When positive, received messages fewer than |messages_in_batch| are
+    // held for at most |max_batch_delay_us| microseconds waiting for more,
+    // so that handler->on_received_messages gets larger batches when small
+    // messages keep arriving. 0 means messages are passed to the handler
+    // as soon as they're received.
+    // default: 0
+    int64_t max_batch_delay_us;
+
+    // When positive, the remote side is granted to send at most
+    // |receive_buf_size| bytes that are not consumed by the handler yet,
+    // no matter how its |max_buf_size| is set. The grant is renewed when
+    // messages are consumed.
+    // default: -1
+    int64_t receive_buf_size;
+
+    // Share of this stream when streams on the same connection take turns
+    // to write, see -stream_write_quantum.
+    // default: 1
+    int write_weight;
+
     // Handle input message, if handler is NULL, the remote side is not allowed to
     // write any message, who will get EBADF on writting
     // default: NULL
@@ -137,6 +164,13 @@ int StreamAccept(StreamIds& response_stream, Controller& cntl,
 int StreamWrite(StreamId stream_id, const butil::IOBuf &message,
                 const StreamWriteOptions* options = NULL);
 
+// Write |n| messages into |stream_id| at once. All messages are written in
+// a single write of the underlying connection instead of one write for each
+// StreamWrite. Either all the messages are written or none of them is.
+// Returns 0 on success, errno otherwise, see StreamWrite for the errno.
+int StreamWritev(StreamId stream_id, butil::IOBuf* const messages[], size_t n,
+                 const StreamWriteOptions* options = NULL);
+
 // Write util the pending buffer size is less than |max_buf_size| or orrur
 // occurs
 // Returns 0 on success, errno otherwise
@@ -157,6 +191,9 @@ void StreamWait(StreamId stream_id, const timespec *due_time,
 //  - Both sides |on_closed| would be notifed after all the pending buffers have
 //    been received
 // This function could be called multiple times without side-effects
+// For gRPC streams over http2, closing the client side half-closes the call
+// and closing the server side sends the trailers with the status of the
+// call, after the pending messages were sent.
 int StreamClose(StreamId stream_id);
 
 namespace detail {
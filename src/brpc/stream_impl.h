@@ -45,6 +45,8 @@ public:
 
     int AppendIfNotFull(const butil::IOBuf& msg,
                         const StreamWriteOptions* options = NULL);
+    int AppendIfNotFull(butil::IOBuf* const msgs[], size_t n,
+                        const StreamWriteOptions* options = NULL);
     static int Create(const StreamOptions& options,
                       const StreamSettings *remote_settings,
                       StreamId *id, bool parse_rpc_response = true);
@@ -69,19 +71,44 @@ public:
     void Close(int error_code, const char* reason_fmt, ...)
         __attribute__ ((__format__ (__printf__, 3, 4)));
 
+    // Carry the stream by gRPC messages of http2 stream `h2_stream_id'
+    // instead of streaming frames, see policy/http2_rpc_protocol.cpp
+    void SetH2Connected(Socket* host_socket, int h2_stream_id);
+    // Called by the http2 connection when `consumed' bytes of messages
+    // were sent.
+    void OnH2Sent(size_t consumed);
+    // Received gRPC messages and half-close of the remote side are pushed
+    // into the consumer queue directly, which is still safe to call after
+    // the stream was recycled.
+    bthread::ExecutionQueueId<butil::IOBuf*> consumer_queue() const
+    { return _consumer_queue; }
+    static int OnH2Message(bthread::ExecutionQueueId<butil::IOBuf*> queue,
+                           butil::IOBuf* message);
+    static void OnH2HalfClosed(bthread::ExecutionQueueId<butil::IOBuf*> queue);
+
 private:
 friend void StreamWait(StreamId stream_id, const timespec *due_time,
                        void (*on_writable)(StreamId, void*, int), void *arg);
 friend class MessageBatcher;
+friend class StreamBatchMessage;
 friend struct butil::DefaultDeleter<Stream>;
     Stream();
     ~Stream();
     int Init(const StreamOptions options);
-    void SetRemoteConsumed(size_t _remote_consumed);
+    void SetRemoteConsumed(size_t _remote_consumed, int64_t remote_window);
+    void SetRemoteWindow(int64_t remote_window);
     void TriggerOnConnectIfNeed();
     void Wait(void (*on_writable)(StreamId, void*, int), void* arg, 
               const timespec* due_time, bool new_thread, bthread_id_t *join_id);
+    // Add `length' bytes to be produced, returns false if the stream is
+    // full.
+    bool Produce(size_t length);
+    // Split buffers written by StreamWritev in `data_list' into messages.
+    void SplitBatches(butil::IOBuf** data_list, size_t size,
+                      std::vector<butil::IOBuf>* msgs,
+                      std::vector<butil::IOBuf*>* msg_list);
     void SendFeedback();
+    void StartBatchTimer();
     void StartIdleTimer();
     void StopIdleTimer();
     void HandleRpcResponse(butil::IOBuf* response_buffer);
@@ -124,17 +151,30 @@ friend struct butil::DefaultDeleter<Stream>;
     size_t _produced;
     size_t _remote_consumed;
     size_t _cur_buf_size;
+    // Bytes granted by the remote side, 0 if not granted.
+    size_t _remote_window;
     bthread_id_list_t _writable_wait_list;
 
     int64_t _local_consumed;
     StreamSettings _remote_settings;   
 
     bool _parse_rpc_response;
+    // Non-zero when the stream is carried by a http2 stream.
+    int _h2_stream_id;
     bthread::ExecutionQueueId<butil::IOBuf*> _consumer_queue;
     butil::IOBuf *_pending_buf;
     int64_t _start_idle_timer_us;
     bthread_timer_t _idle_timer;
+    // Received messages held for at most _options.max_batch_delay_us.
+    std::vector<butil::IOBuf*> _held_messages;
+    bool _batch_timer_pending;
+    // Buffers of write requests from StreamWritev => lengths of messages in
+    // them. Only accessed in the exclusive write path of the fake socket.
+    std::vector<std::pair<const butil::IOBuf*, std::vector<size_t> > > _batches;
     std::once_flag _set_host_socket_flag;
+    // Not NULL if frames are written into _host_socket in turns with other
+    // streams on it.
+    StreamWriteScheduler* _write_scheduler;
 };
 
 } // namespace brpc
@@ -1078,6 +1078,20 @@ TsWriter::TsWriter(butil::IOBuf* outbuf)
     , _discontinuity_counter(0) {
 }
 
+TsWriter::TsWriter(ProgressiveAttachment* pa)
+    : _outbuf(&_pa_buf)
+    , _pa(pa)
+    , _nalu_format(AVC_NALU_FORMAT_UNKNOWN)
+    , _has_avc_seq_header(false)
+    , _has_aac_seq_header(false)
+    , _encoded_pat_pmt(false)
+    , _last_video_stream(TS_STREAM_VIDEO_H264)
+    , _last_video_pid(TS_PID_VIDEO_AVC)
+    , _last_audio_stream(TS_STREAM_AUDIO_AAC)
+    , _last_audio_pid(TS_PID_AUDIO_AAC)
+    , _discontinuity_counter(0) {
+}
+
 TsWriter::~TsWriter() {
 }
 
@@ -1397,8 +1411,16 @@ butil::Status TsWriter::Encode(TsMessage* msg, TsStream stream, TsPid pid) {
             return st;
         }
     }
-    return EncodePES(msg, stream, pid,
-                     (_last_video_stream == TS_STREAM_RESERVED));
+    butil::Status st = EncodePES(msg, stream, pid,
+                                 (_last_video_stream == TS_STREAM_RESERVED));
+    if (st.ok() && _pa != NULL && !_pa_buf.empty()) {
+        if (_pa->Write(_pa_buf) != 0) {
+            st.set_error(errno, "Fail to write into ProgressiveAttachment: %s",
+                         berror());
+        }
+        _pa_buf.clear();
+    }
+    return st;
 }
 
 butil::Status TsWriter::EncodePES(TsMessage* msg, TsStream sid, TsPid pid,
@@ -1418,8 +1440,31 @@ butil::Status TsWriter::EncodePES(TsMessage* msg, TsStream sid, TsPid pid,
         return butil::Status(EINVAL, "Fail to get channel on pid=%d", (int)pid);
     }
 
+    // Packets after the first one are mostly full of payload, which have no
+    // adaptation field and differ only in continuity counters. Their
+    // headers are encoded once and their payloads are referenced from
+    // msg->payload rather than copied.
+    char cont_header[4];
+    bool has_cont_header = false;
     bool first_msg = true;
     while (!msg->payload.empty()) {
+        if (!first_msg &&
+            msg->payload.size() >= TS_PACKET_SIZE - sizeof(cont_header)) {
+            if (!has_cont_header) {
+                TsPacket pkt(&_tschan_group);
+                pkt.CreateAsPESContinue(pid, 0);
+                CHECK_EQ(sizeof(cont_header), pkt.ByteSize());
+                if (pkt.Encode(cont_header) != 0) {
+                    return butil::Status(EINVAL, "Fail to encode PES");
+                }
+                has_cont_header = true;
+            }
+            cont_header[3] = (cont_header[3] & 0xF0) |
+                (channel->continuity_counter++ & 0x0F);
+            _outbuf->append(cont_header, sizeof(cont_header));
+            msg->payload.cutn(_outbuf, TS_PACKET_SIZE - sizeof(cont_header));
+            continue;
+        }
         TsPacket pkt(&_tschan_group);
         if (first_msg) {
             first_msg = false;
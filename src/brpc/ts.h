@@ -43,6 +43,7 @@
 #include <stdint.h>
 #include "butil/iobuf.h"
 #include "brpc/rtmp.h"
+#include "brpc/progressive_attachment.h"
 
 
 namespace brpc {
@@ -1225,9 +1226,14 @@ public:
 class TsWriter {
 public:
     explicit TsWriter(butil::IOBuf* outbuf);
+    // Write ts packets of each message into `pa' as soon as the message is
+    // encoded, so that players start downloading the segment before it is
+    // complete.
+    explicit TsWriter(ProgressiveAttachment* pa);
     ~TsWriter();
 
-    // Append a video/audio message into the output buffer.
+    // Append a video/audio message into the output buffer, or write it
+    // into the ProgressiveAttachment.
     butil::Status Write(const RtmpVideoMessage&);
     butil::Status Write(const RtmpAudioMessage&);
 
@@ -1242,6 +1248,8 @@ private:
     butil::Status EncodePES(TsMessage* msg, TsStream sid, TsPid pid, bool pure_audio);
 
     butil::IOBuf* _outbuf;
+    butil::IOBuf _pa_buf;
+    butil::intrusive_ptr<ProgressiveAttachment> _pa;
     AVCNaluFormat _nalu_format;
     bool _has_avc_seq_header;
     bool _has_aac_seq_header;
@@ -0,0 +1,224 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <sys/socket.h>
+#include <gflags/gflags.h>
+#include "butil/build_config.h"                  // OS_LINUX
+#include "butil/fd_guard.h"
+#include "butil/fd_utility.h"                    // make_non_blocking
+#include "bvar/bvar.h"
+#include "brpc/controller.h"
+#include "brpc/closure_guard.h"
+#include "brpc/policy/baidu_rpc_protocol.h"
+#include "brpc/details/controller_private_accessor.h"
+#include "brpc/udp_channel.h"
+
+
+namespace brpc {
+
+DECLARE_int32(udp_batch_size);
+DECLARE_int32(udp_max_datagram_size);
+
+static bvar::Adder<int64_t>* g_udp_dropped = NULL;
+static pthread_once_t g_udp_dropped_once = PTHREAD_ONCE_INIT;
+
+static void CreateUdpDropped() {
+    g_udp_dropped = new bvar::Adder<int64_t>("rpc_udp_channel_dropped_count");
+}
+
+// Send `datagrams' in batches of -udp_batch_size and return number of
+// datagrams that were not sent.
+static size_t SendDatagrams(int fd, const std::vector<butil::IOBuf>& datagrams) {
+    size_t ndropped = 0;
+    const size_t batch_size = FLAGS_udp_batch_size;
+    std::vector<struct iovec> iovs;
+    std::vector<struct msghdr> hdrs;
+#if defined(OS_LINUX)
+    std::vector<struct mmsghdr> msgs;
+#endif
+    for (size_t begin = 0; begin < datagrams.size();) {
+        const size_t end = std::min(begin + batch_size, datagrams.size());
+        iovs.clear();
+        for (size_t i = begin; i < end; ++i) {
+            for (size_t j = 0; j < datagrams[i].backing_block_num(); ++j) {
+                const butil::StringPiece blk = datagrams[i].backing_block(j);
+                struct iovec iov = { (void*)blk.data(), blk.size() };
+                iovs.push_back(iov);
+            }
+        }
+        hdrs.assign(end - begin, msghdr());
+        for (size_t i = begin, k = 0; i < end; ++i) {
+            hdrs[i - begin].msg_iov = &iovs[k];
+            hdrs[i - begin].msg_iovlen = datagrams[i].backing_block_num();
+            k += datagrams[i].backing_block_num();
+        }
+        int nw = 0;
+#if defined(OS_LINUX)
+        msgs.assign(end - begin, mmsghdr());
+        for (size_t i = 0; i < hdrs.size(); ++i) {
+            msgs[i].msg_hdr = hdrs[i];
+        }
+        nw = sendmmsg(fd, &msgs[0], msgs.size(), MSG_DONTWAIT);
+#else
+        nw = (sendmsg(fd, &hdrs[0], MSG_DONTWAIT) >= 0 ? 1 : -1);
+#endif
+        if (nw > 0) {
+            begin += nw;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        PLOG_EVERY_SECOND(WARNING) << "Fail to send datagrams through fd=" << fd;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // The send buffer is full, drop the batch.
+            ndropped += end - begin;
+            begin = end;
+        } else {
+            // Skip the datagram that can't be sent, errors of previous
+            // datagrams (e.g. ECONNREFUSED) may be reported as well.
+            ++ndropped;
+            ++begin;
+        }
+    }
+    return ndropped;
+}
+
+UdpChannelOptions::UdpChannelOptions()
+    : auth(NULL) {}
+
+UdpChannel::UdpChannel()
+    : _fd(-1)
+    , _flushing(false) {}
+
+UdpChannel::~UdpChannel() {
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+}
+
+int UdpChannel::Init(const char* server_addr_and_port,
+                     const UdpChannelOptions* options) {
+    butil::EndPoint point;
+    if (butil::str2endpoint(server_addr_and_port, &point) != 0 &&
+        butil::hostname2endpoint(server_addr_and_port, &point) != 0) {
+        LOG(ERROR) << "Invalid address=`" << server_addr_and_port << '\'';
+        return -1;
+    }
+    return Init(point, options);
+}
+
+int UdpChannel::Init(butil::EndPoint server_addr,
+                     const UdpChannelOptions* options) {
+    pthread_once(&g_udp_dropped_once, CreateUdpDropped);
+    if (_fd >= 0) {
+        LOG(ERROR) << "UdpChannel is already initialized";
+        return -1;
+    }
+    struct sockaddr_storage addr;
+    socklen_t addr_len = 0;
+    if (butil::is_endpoint_extended(server_addr) ||
+        butil::endpoint2sockaddr(server_addr, &addr, &addr_len) != 0) {
+        LOG(ERROR) << "Invalid udp address=" << server_addr;
+        return -1;
+    }
+    butil::fd_guard sockfd(socket(addr.ss_family, SOCK_DGRAM, 0));
+    if (sockfd < 0) {
+        PLOG(ERROR) << "Fail to create udp socket";
+        return -1;
+    }
+    // Connect so that datagrams are sent without addresses and routes are
+    // not looked up for each of them.
+    if (connect(sockfd, (struct sockaddr*)&addr, addr_len) != 0) {
+        PLOG(ERROR) << "Fail to connect udp socket to " << server_addr;
+        return -1;
+    }
+    if (butil::make_non_blocking(sockfd) != 0 ||
+        butil::make_close_on_exec(sockfd) != 0) {
+        PLOG(ERROR) << "Fail to set flags of fd=" << sockfd;
+        return -1;
+    }
+    if (options) {
+        _options = *options;
+    }
+    _server_address = server_addr;
+    _fd = sockfd.release();
+    return 0;
+}
+
+void UdpChannel::CallMethod(const google::protobuf::MethodDescriptor* method,
+                            google::protobuf::RpcController* controller_base,
+                            const google::protobuf::Message* request,
+                            google::protobuf::Message* /*response*/,
+                            google::protobuf::Closure* done) {
+    Controller* cntl = static_cast<Controller*>(controller_base);
+    ClosureGuard done_guard(done);
+    if (_fd < 0) {
+        cntl->SetFailed(EINVAL, "UdpChannel=%p is not initialized", this);
+        return;
+    }
+    ControllerPrivateAccessor(cntl).set_remote_side(_server_address);
+    butil::IOBuf request_body;
+    policy::SerializeRpcRequest(&request_body, cntl, request);
+    if (cntl->Failed()) {
+        return;
+    }
+    butil::IOBuf datagram;
+    policy::PackRpcRequest(&datagram, NULL, 0, method, cntl, request_body,
+                           _options.auth);
+    if (cntl->Failed()) {
+        return;
+    }
+    if (datagram.size() > (size_t)FLAGS_udp_max_datagram_size) {
+        cntl->SetFailed(EREQUEST, "Datagram of %zu bytes is larger than"
+                        " -udp_max_datagram_size=%d", datagram.size(),
+                        FLAGS_udp_max_datagram_size);
+        return;
+    }
+    std::unique_lock<butil::Mutex> mu(_mutex);
+    _pending.push_back(butil::IOBuf());
+    _pending.back().swap(datagram);
+    if (_flushing) {
+        // Sent by the caller which is flushing.
+        return;
+    }
+    _flushing = true;
+    FlushPending(mu);
+}
+
+void UdpChannel::FlushPending(std::unique_lock<butil::Mutex>& mu) {
+    std::vector<butil::IOBuf> sending;
+    while (!_pending.empty()) {
+        sending.clear();
+        sending.swap(_pending);
+        mu.unlock();
+        const size_t ndropped = SendDatagrams(_fd, sending);
+        if (ndropped) {
+            *g_udp_dropped << ndropped;
+        }
+        mu.lock();
+    }
+    _flushing = false;
+}
+
+void UdpChannel::Describe(std::ostream& os, const DescribeOptions&) const {
+    os << "UdpChannel[" << _server_address << ']';
+}
+
+} // namespace brpc
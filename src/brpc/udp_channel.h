@@ -0,0 +1,91 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_UDP_CHANNEL_H
+#define BRPC_UDP_CHANNEL_H
+
+#include <mutex>
+#include <vector>
+#include "butil/endpoint.h"
+#include "butil/iobuf.h"
+#include "butil/synchronization/lock.h"
+#include "brpc/channel_base.h"
+
+
+namespace brpc {
+
+class Authenticator;
+
+struct UdpChannelOptions {
+    // Constructed with default options.
+    UdpChannelOptions();
+
+    // Generate credentials put in every datagram, which are verified by
+    // ServerOptions.auth of the server.
+    // Default: NULL
+    const Authenticator* auth;
+};
+
+// Send one-way requests in baidu_std format to ServerOptions.udp_port of a
+// server, one datagram per request, for RPCs where losing a request is
+// acceptable (metrics, telemetry) and keeping TCP connections to a lot of
+// servers is costly. CallMethod() returns (and runs `done') as soon as the
+// request is queued: the response is never filled, and requests lost in the
+// network or failed in the server are not reported. Requests queued by
+// concurrent callers are sent together by one sendmmsg().
+// Requests larger than -udp_max_datagram_size fail with EREQUEST. Streams,
+// timeouts, retries and backup requests are not applicable.
+class UdpChannel : public ChannelBase {
+public:
+    UdpChannel();
+    ~UdpChannel();
+
+    // Send requests to `server_addr_and_port' ("ip:port" or "host:port").
+    // Returns 0 on success, -1 otherwise.
+    int Init(const char* server_addr_and_port, const UdpChannelOptions* options);
+    int Init(butil::EndPoint server_addr, const UdpChannelOptions* options);
+
+    void CallMethod(const google::protobuf::MethodDescriptor* method,
+                    google::protobuf::RpcController* controller,
+                    const google::protobuf::Message* request,
+                    google::protobuf::Message* response,
+                    google::protobuf::Closure* done) override;
+
+    void Describe(std::ostream& os, const DescribeOptions&) const override;
+
+    int CheckHealth() override { return _fd >= 0 ? 0 : -1; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(UdpChannel);
+
+    // Send `_pending' until it's empty, called with `_mutex' locked by the
+    // caller that finds no one else is sending.
+    void FlushPending(std::unique_lock<butil::Mutex>& mu);
+
+    butil::EndPoint _server_address;
+    UdpChannelOptions _options;
+    int _fd;
+    butil::Mutex _mutex;
+    bool _flushing;
+    std::vector<butil::IOBuf> _pending;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_UDP_CHANNEL_H
@@ -18,7 +18,7 @@
 
 #include <ctype.h>                         // isalnum
 
-#include <unordered_set>
+#include <string.h>                        // strcspn
 
 #include "brpc/log.h"
 #include "brpc/details/http_parser.h"      // http_parser_parse_url
@@ -104,14 +104,22 @@ inline const char* SplitHostAndPort(const char* host_begin,
 // https://datatracker.ietf.org/doc/html/rfc3986#section-2.3
 // https://datatracker.ietf.org/doc/html/rfc3986#section-2.4
 // space is not allowed by rfc3986, but allowed by brpc
-static bool is_valid_char(char c) {
-    static const std::unordered_set<char> other_valid_char = {
-        ':', '/', '?', '#', '[', ']', '@', '!', '$', '&',
-        '\'', '(', ')', '*', '+', ',', ';', '=', '-', '.',
-        '_', '~', '%', ' '
-    };
+struct ValidCharTable {
+    bool valid[256];
+    ValidCharTable() {
+        static const char other_valid_char[] = ":/?#[]@!$&'()*+,;=-._~% ";
+        for (int c = 0; c < 256; ++c) {
+            valid[c] = isalnum(c);
+        }
+        for (const char* p = other_valid_char; *p; ++p) {
+            valid[(unsigned char)*p] = true;
+        }
+    }
+};
+static const ValidCharTable g_valid_char_table;
 
-    return (isalnum(c) || other_valid_char.count(c));
+static bool is_valid_char(char c) {
+    return g_valid_char_table.valid[(unsigned char)c];
 }
 
 static bool is_all_spaces(const char* p) {
@@ -204,39 +212,33 @@ int URI::SetHttpURL(const char* url) {
     if (*p == '/') {
         start = p; //slash pointed by p is counted into _path
         ++p;
-        for (; *p && *p != '?' && *p != '#'; ++p) {
-            if (*p == ' ') {
-                if (!is_all_spaces(p + 1)) {
-                    _st.set_error(EINVAL, "Invalid space in path");
-                    return -1;
-                }
-                break;
+        p += strcspn(p, "?# ");
+        if (*p == ' ') {
+            if (!is_all_spaces(p + 1)) {
+                _st.set_error(EINVAL, "Invalid space in path");
+                return -1;
             }
         }
         _path.assign(start, p - start);
     }
     if (*p == '?') {
         start = ++p;
-        for (; *p && *p != '#'; ++p) {
-            if (*p == ' ') {
-                if (!is_all_spaces(p + 1)) {
-                    _st.set_error(EINVAL, "Invalid space in query");
-                    return -1;
-                }
-                break;
+        p += strcspn(p, "# ");
+        if (*p == ' ') {
+            if (!is_all_spaces(p + 1)) {
+                _st.set_error(EINVAL, "Invalid space in query");
+                return -1;
             }
         }
         _query.assign(start, p - start);
     }
     if (*p == '#') {
         start = ++p;
-        for (; *p; ++p) {
-            if (*p == ' ') {
-                if (!is_all_spaces(p + 1)) {
-                    _st.set_error(EINVAL, "Invalid space in fragment");
-                    return -1;
-                }
-                break;
+        p += strcspn(p, " ");
+        if (*p == ' ') {
+            if (!is_all_spaces(p + 1)) {
+                _st.set_error(EINVAL, "Invalid space in fragment");
+                return -1;
             }
         }
         _fragment.assign(start, p - start);
@@ -410,17 +412,16 @@ void URI::SetH2Path(const char* h2_path) {
 
     const char* p = h2_path;
     const char* start = p;
-    for (; *p && *p != '?' && *p != '#'; ++p) {}
+    p += strcspn(p, "?#");
     _path.assign(start, p - start);
     if (*p == '?') {
         start = ++p;
-        for (; *p && *p != '#'; ++p) {}
+        p += strcspn(p, "#");
         _query.assign(start, p - start);
     }
     if (*p == '#') {
         start = ++p;
-        for (; *p; ++p) {}
-        _fragment.assign(start, p - start);
+        _fragment.assign(start);
     }
 }
 
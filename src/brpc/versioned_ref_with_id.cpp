@@ -0,0 +1,153 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+#include "butil/thread_local.h"
+#include "bthread/processor.h"
+#include "brpc/versioned_ref_with_id.h"
+
+namespace brpc {
+
+// Max number of objects borrowed by a thread at the same time.
+static const size_t VREF_BORROW_SLOTS_PER_THREAD = 4;
+
+// Slots of a thread in a separate cacheline so that borrowing in different
+// threads does not contend.
+struct BAIDU_CACHELINE_ALIGNMENT VRefBorrowSlots {
+    VRefBorrowSlot slots[VREF_BORROW_SLOTS_PER_THREAD];
+    VRefBorrowSlots* next;
+};
+
+// All slots ever created, never freed since recyclers scan them anytime.
+static butil::atomic<VRefBorrowSlots*> g_borrow_slots_head(NULL);
+// Slots of quitted threads, reused by new threads.
+static pthread_mutex_t g_free_borrow_slots_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<VRefBorrowSlots*>* g_free_borrow_slots = NULL;
+
+static __thread VRefBorrowSlots* tls_borrow_slots = NULL;
+
+// Borrows are short, spin a while before yielding the cpu and then sleep
+// for at most so many microseconds between checks.
+static const int VREF_BORROW_SPINS = 64;
+static const int VREF_BORROW_YIELDS = 64;
+static const useconds_t VREF_BORROW_MAX_SLEEP_US = 1000;
+
+static void ReturnBorrowSlots(void* arg) {
+    tls_borrow_slots = NULL;
+    pthread_mutex_lock(&g_free_borrow_slots_mutex);
+    if (g_free_borrow_slots == NULL) {
+        g_free_borrow_slots = new std::vector<VRefBorrowSlots*>;
+    }
+    g_free_borrow_slots->push_back(static_cast<VRefBorrowSlots*>(arg));
+    pthread_mutex_unlock(&g_free_borrow_slots_mutex);
+}
+
+static VRefBorrowSlots* GetBorrowSlots() {
+    VRefBorrowSlots* s = tls_borrow_slots;
+    if (s != NULL) {
+        return s;
+    }
+    pthread_mutex_lock(&g_free_borrow_slots_mutex);
+    if (g_free_borrow_slots != NULL && !g_free_borrow_slots->empty()) {
+        s = g_free_borrow_slots->back();
+        g_free_borrow_slots->pop_back();
+    }
+    pthread_mutex_unlock(&g_free_borrow_slots_mutex);
+    if (s == NULL) {
+        void* mem = NULL;
+        if (posix_memalign(&mem, BAIDU_CACHELINE_SIZE,
+                           sizeof(VRefBorrowSlots)) != 0) {
+            return NULL;
+        }
+        s = new (mem) VRefBorrowSlots;
+        for (size_t i = 0; i < VREF_BORROW_SLOTS_PER_THREAD; ++i) {
+            s->slots[i].store(NULL, butil::memory_order_relaxed);
+        }
+        VRefBorrowSlots* head =
+            g_borrow_slots_head.load(butil::memory_order_relaxed);
+        do {
+            s->next = head;
+        } while (!g_borrow_slots_head.compare_exchange_weak(
+                     head, s, butil::memory_order_release,
+                     butil::memory_order_relaxed));
+    }
+    if (butil::thread_atexit(ReturnBorrowSlots, s) != 0) {
+        ReturnBorrowSlots(s);
+        return NULL;
+    }
+    tls_borrow_slots = s;
+    return s;
+}
+
+VRefBorrowSlot* AcquireVRefBorrowSlot(const void* obj) {
+    VRefBorrowSlots* s = GetBorrowSlots();
+    if (s == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < VREF_BORROW_SLOTS_PER_THREAD; ++i) {
+        VRefBorrowSlot* slot = &s->slots[i];
+        // Slots are only filled by the owner thread, but may be cleared
+        // by others when a bthread borrowing the object was migrated.
+        if (slot->load(butil::memory_order_relaxed) == NULL) {
+            slot->store(obj, butil::memory_order_relaxed);
+            // Pairs with the fence in WaitForVRefBorrowers().
+            butil::atomic_thread_fence(butil::memory_order_seq_cst);
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+void WaitForVRefBorrowers(const void* obj) {
+    // Pairs with the fence in AcquireVRefBorrowSlot(): either the borrower
+    // sees the version changed before this function, or `obj' is seen in
+    // its slot here.
+    butil::atomic_thread_fence(butil::memory_order_seq_cst);
+    const VRefBorrowSlots* const self = tls_borrow_slots;
+    for (VRefBorrowSlots* s =
+             g_borrow_slots_head.load(butil::memory_order_acquire);
+         s != NULL; s = s->next) {
+        for (size_t i = 0; i < VREF_BORROW_SLOTS_PER_THREAD; ++i) {
+            // Waiting for ourselves never ends. Borrowers must not drop the
+            // last reference of what they borrow.
+            CHECK(s != self ||
+                  s->slots[i].load(butil::memory_order_relaxed) != obj)
+                << "Recycling an object borrowed by this thread";
+            useconds_t sleep_us = 1;
+            for (int n = 0;
+                 s->slots[i].load(butil::memory_order_acquire) == obj; ++n) {
+                if (n < VREF_BORROW_SPINS) {
+                    cpu_relax();
+                } else if (n < VREF_BORROW_SPINS + VREF_BORROW_YIELDS) {
+                    sched_yield();
+                } else {
+                    // The borrower may be preempted for long.
+                    usleep(sleep_us);
+                    sleep_us = std::min(sleep_us * 2, VREF_BORROW_MAX_SLEEP_US);
+                }
+            }
+        }
+    }
+}
+
+} // namespace brpc
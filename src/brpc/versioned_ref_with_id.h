@@ -20,6 +20,7 @@
 #define BRPC_VERSIONED_REF_WITH_ID_H
 
 #include <memory>
+#include "butil/atomicops.h"
 #include "butil/resource_pool.h"
 #include "butil/class_name.h"
 #include "butil/logging.h"
@@ -50,6 +51,51 @@ template<typename T>
 using VersionedRefWithIdUniquePtr =
     std::unique_ptr<T, VersionedRefWithIdDeleter<T>>;
 
+// A slot of a thread publishing the object it borrows.
+typedef butil::atomic<const void*> VRefBorrowSlot;
+
+// Publish `obj' in a free borrow slot of the calling thread and return the
+// slot, or NULL if all slots of the thread are in use.
+VRefBorrowSlot* AcquireVRefBorrowSlot(const void* obj);
+
+// Block until `obj' is not published in any borrow slot. It's a fatal error
+// if `obj' is borrowed by the calling thread.
+void WaitForVRefBorrowers(const void* obj);
+
+// Holds a T borrowed by VersionedRefWithId::Borrow(). The T is not recycled
+// until this pointer is reset or destructed.
+template<typename T>
+class VersionedRefWithIdBorrowedPtr {
+public:
+    VersionedRefWithIdBorrowedPtr() : _ptr(NULL), _slot(NULL) {}
+    ~VersionedRefWithIdBorrowedPtr() { reset(); }
+    DISALLOW_COPY_AND_ASSIGN(VersionedRefWithIdBorrowedPtr);
+
+    T* get() const { return _ptr; }
+    T* operator->() const { return _ptr; }
+    T& operator*() const { return *_ptr; }
+    explicit operator bool() const { return _ptr != NULL; }
+
+    void reset() {
+        if (_slot != NULL) {
+            // Pairs with the acquire load in WaitForVRefBorrowers() so
+            // that accesses to the T happen before the recycling.
+            _slot->store(NULL, butil::memory_order_release);
+            _slot = NULL;
+        } else if (_ptr != NULL) {
+            VersionedRefWithIdDeleter<T>()(_ptr);
+        }
+        _ptr = NULL;
+    }
+
+private:
+friend class VersionedRefWithId<T>;
+    T* _ptr;
+    // NULL when a reference is held instead, because all borrow slots of
+    // the thread were in use.
+    VRefBorrowSlot* _slot;
+};
+
 // Utility functions to combine and extract VRefId.
 template <typename T>
 BUTIL_FORCE_INLINE VRefId MakeVRefId(uint32_t version,
@@ -225,6 +271,15 @@ public:
     // Returns 0 on success, 1 on failed socket, -1 on recycled.
     static int AddressFailedAsWell(VRefId id, VersionedRefWithIdUniquePtr<T>* ptr);
 
+    // Like Address(), but the reference count is not modified. Instead the
+    // object is published in a slot of the calling thread and recycling of
+    // it waits until `ptr' is reset, so that threads addressing a hot
+    // object concurrently don't bounce the cacheline of its reference
+    // count. Don't block, SetFailed() or release the last reference of the
+    // object before resetting `ptr', call Address() to keep it longer.
+    // Returns 0 on success, -1 when the object was SetFailed().
+    static int Borrow(VRefId id, VersionedRefWithIdBorrowedPtr<T>* ptr);
+
     // Re-address current VersionedRefWithId into `ptr'.
     // Always succeed even if this socket is failed.
     void ReAddress(VersionedRefWithIdUniquePtr<T>* ptr);
@@ -433,6 +488,7 @@ int VersionedRefWithId<T>::AddressImpl(
                                           decltype(&T::BeforeRecycled), T>::value),
                                       "T::BeforeRecycled must accept Args params"
                                       " and return void");
+                        WaitForVRefBorrowers(t);
                         t->BeforeRecycled();
                         return_resource(slot);
                     }
@@ -450,6 +506,38 @@ int VersionedRefWithId<T>::AddressImpl(
     return -1;
 }
 
+template<typename T>
+int VersionedRefWithId<T>::Borrow(
+    VRefId id, VersionedRefWithIdBorrowedPtr<T>* ptr) {
+    ptr->reset();
+    T* const t = address_resource(SlotOfVRefId<T>(id));
+    if (__builtin_expect(t == NULL, 0)) {
+        return -1;
+    }
+    VRefBorrowSlot* const slot = AcquireVRefBorrowSlot(t);
+    if (__builtin_expect(slot == NULL, 0)) {
+        VersionedRefWithIdUniquePtr<T> tmp;
+        if (Address(id, &tmp) != 0) {
+            return -1;
+        }
+        ptr->_ptr = tmp.release();
+        return 0;
+    }
+    // Recycling changes the version before waiting for borrowers, either
+    // the change is seen here or the recycler sees `slot'. The acquire
+    // fence pairs with the release fences in Dereference() and Revive().
+    const VersionedRefWithId<T>* const vref_with_id = t;
+    const uint64_t vref =
+        vref_with_id->_versioned_ref.load(butil::memory_order_acquire);
+    if (VersionOfVRef(vref) != VersionOfVRefId(id)) {
+        slot->store(NULL, butil::memory_order_relaxed);
+        return -1;
+    }
+    ptr->_ptr = t;
+    ptr->_slot = slot;
+    return 0;
+}
+
 template<typename T>
 void VersionedRefWithId<T>::ReAddress(VersionedRefWithIdUniquePtr<T>* ptr) {
     _versioned_ref.fetch_add(1, butil::memory_order_acquire);
@@ -567,6 +655,7 @@ int VersionedRefWithId<T>::Dereference() {
                     expected_vref, MakeVRef(id_ver + 2, 0),
                     butil::memory_order_acquire,
                     butil::memory_order_relaxed)) {
+                WaitForVRefBorrowers(static_cast<T*>(this));
                 static_cast<T*>(this)->BeforeRecycled();
                 return_resource(SlotOfVRefId<T>(id));
                 return 1;
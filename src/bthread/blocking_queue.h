@@ -0,0 +1,164 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// bthread - An M:N threading library to make applications more concurrent.
+
+#ifndef BTHREAD_BLOCKING_QUEUE_H
+#define BTHREAD_BLOCKING_QUEUE_H
+
+#include <errno.h>
+#include "butil/atomicops.h"
+#include "butil/containers/mpmc_bounded_queue.h"
+#include "bthread/butex.h"
+
+namespace bthread {
+
+// A bounded MPMC queue on which push() blocks the calling bthread (or
+// pthread) when the queue is full, and pop() blocks when it's empty. The
+// queue itself is butil::MPMCBoundedQueue, butexes are touched only when
+// someone is waiting.
+//
+// Example:
+//   bthread::BlockingQueue<Request*> q;
+//   CHECK_EQ(0, q.init(1024));
+//   q.push(req);                     // in producers
+//   Request* reqs[32];
+//   size_t n = q.pop_batch(reqs, 32);  // in consumers
+template <typename T>
+class BlockingQueue {
+public:
+    BlockingQueue()
+        : _not_empty(butex_create_checked<butil::atomic<int> >())
+        , _not_full(butex_create_checked<butil::atomic<int> >())
+        , _nwait_not_empty(0)
+        , _nwait_not_full(0) {
+        _not_empty->store(0, butil::memory_order_relaxed);
+        _not_full->store(0, butil::memory_order_relaxed);
+    }
+
+    ~BlockingQueue() {
+        butex_destroy(_not_empty);
+        butex_destroy(_not_full);
+    }
+
+    // `capacity' must be power of 2.
+    // Returns 0 on success, -1 otherwise.
+    int init(size_t capacity) { return _queue.init(capacity); }
+
+    // Push `x' into the queue, wait until the queue is not full or
+    // `abstime' (if not NULL) is reached.
+    // Returns 0 on success, ETIMEDOUT otherwise.
+    int push(const T& x, const timespec* abstime = NULL) {
+        while (!_queue.push(x)) {
+            if (wait(_not_full, &_nwait_not_full, abstime, false) != 0) {
+                return ETIMEDOUT;
+            }
+        }
+        notify(_not_empty, &_nwait_not_empty, 1);
+        return 0;
+    }
+
+    // Pop an item into `x', wait until the queue is not empty or `abstime'
+    // (if not NULL) is reached.
+    // Returns 0 on success, ETIMEDOUT otherwise.
+    int pop(T* x, const timespec* abstime = NULL) {
+        return pop_batch(x, 1, abstime) == 1 ? 0 : ETIMEDOUT;
+    }
+
+    // Pop at most `n' items into `items', wait until the queue is not empty
+    // or `abstime' (if not NULL) is reached.
+    // Returns number of popped items, 0 on timeout.
+    size_t pop_batch(T* items, size_t n, const timespec* abstime = NULL) {
+        size_t npopped = 0;
+        while ((npopped = _queue.pop_batch(items, n)) == 0) {
+            if (wait(_not_empty, &_nwait_not_empty, abstime, true) != 0) {
+                return 0;
+            }
+        }
+        notify(_not_full, &_nwait_not_full, npopped);
+        return npopped;
+    }
+
+    // Push without blocking. Returns true on pushed.
+    bool try_push(const T& x) {
+        if (!_queue.push(x)) {
+            return false;
+        }
+        notify(_not_empty, &_nwait_not_empty, 1);
+        return true;
+    }
+
+    // Pop without blocking. Returns true on popped.
+    bool try_pop(T* x) {
+        if (!_queue.pop(x)) {
+            return false;
+        }
+        notify(_not_full, &_nwait_not_full, 1);
+        return true;
+    }
+
+    size_t size() const { return _queue.size(); }
+    size_t capacity() const { return _queue.capacity(); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(BlockingQueue);
+
+    // Wait on `butex' while the queue is empty(`for_pop') or full.
+    // Returns 0 when the caller should retry, -1 on timeout.
+    int wait(butil::atomic<int>* butex, butil::atomic<int>* nwait,
+             const timespec* abstime, bool for_pop) {
+        const int expected = butex->load(butil::memory_order_acquire);
+        // Pairs with the fence in notify(): either we see the change of
+        // the queue, or the notifier sees us waiting.
+        nwait->fetch_add(1, butil::memory_order_relaxed);
+        butil::atomic_thread_fence(butil::memory_order_seq_cst);
+        int rc = 0;
+        const size_t size = _queue.size();
+        const bool blocked = for_pop ? size == 0 : size >= _queue.capacity();
+        if (blocked &&
+            butex_wait(butex, expected, abstime) < 0 &&
+            errno == ETIMEDOUT) {
+            rc = -1;
+        }
+        nwait->fetch_sub(1, butil::memory_order_relaxed);
+        return rc;
+    }
+
+    void notify(butil::atomic<int>* butex, butil::atomic<int>* nwait,
+                size_t n) {
+        butil::atomic_thread_fence(butil::memory_order_seq_cst);
+        if (nwait->load(butil::memory_order_relaxed) == 0) {
+            return;
+        }
+        butex->fetch_add(1, butil::memory_order_release);
+        if (n == 1) {
+            butex_wake(butex);
+        } else {
+            butex_wake_all(butex);
+        }
+    }
+
+    butil::MPMCBoundedQueue<T> _queue;
+    butil::atomic<int>* _not_empty;
+    butil::atomic<int>* _not_full;
+    butil::atomic<int> _nwait_not_empty;
+    butil::atomic<int> _nwait_not_full;
+};
+
+}  // namespace bthread
+
+#endif  // BTHREAD_BLOCKING_QUEUE_H
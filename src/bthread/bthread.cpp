@@ -28,6 +28,7 @@
 #include "bthread/task_group.h"                // TaskGroup
 #include "bthread/task_control.h"              // TaskControl
 #include "bthread/timer_thread.h"
+#include "bthread/cpu_quota.h"                 // get_available_cpus
 #include "bthread/list_of_abafree_id.h"
 #include "bthread/bthread.h"
 
@@ -54,6 +55,11 @@ DEFINE_int32(bthread_min_concurrency, 0,
             " and workers will be created eagerly according to -bthread_concurrency and bthread_setconcurrency(). ");
 BUTIL_VALIDATE_GFLAG(bthread_min_concurrency, validate_bthread_min_concurrency);
 
+DEFINE_bool(bthread_concurrency_by_cpu_quota, false,
+            "Unless -bthread_concurrency is set, start as many workers as cpus "
+            "that this process can use, limited by cpu quota and cpuset of "
+            "the cgroup, plus epoll threads. Read at initialization");
+
 DEFINE_int32(bthread_current_tag, BTHREAD_TAG_INVALID, "Set bthread concurrency for this tag");
 BUTIL_VALIDATE_GFLAG(bthread_current_tag, validate_bthread_current_tag);
 
@@ -76,6 +82,11 @@ BUTIL_VALIDATE_GFLAG(bthread_parking_lot_of_each_tag, [](const char*, int32_t va
     return true;
 });
 
+DEFINE_int32(bthread_time_slice_us, 10000,
+             "bthread_should_yield() returns true after the calling bthread "
+             "runs so many microseconds without yielding");
+BUTIL_VALIDATE_GFLAG(bthread_time_slice_us, butil::PassValidate);
+
 static bool never_set_bthread_concurrency = true;
 
 BAIDU_CASSERT(sizeof(TaskControl*) == sizeof(butil::atomic<TaskControl*>), atomic_size_match);
@@ -90,6 +101,7 @@ extern BAIDU_THREAD_LOCAL TaskGroup* tls_task_group;
 EXTERN_BAIDU_VOLATILE_THREAD_LOCAL(TaskGroup*, tls_task_group);
 extern void (*g_worker_startfn)();
 extern void (*g_tagged_worker_startfn)(bthread_tag_t);
+extern bool (*g_worker_idlefn)();
 extern void* (*g_create_span_func)();
 
 inline TaskControl* get_task_control() {
@@ -111,6 +123,21 @@ inline TaskControl* get_or_new_task_control() {
     if (NULL == c) {
         return NULL;
     }
+    if (FLAGS_bthread_concurrency_by_cpu_quota &&
+        never_set_bthread_concurrency) {
+        const int ncpu = get_available_cpus();
+        if (ncpu > 0) {
+            // Every tag needs one worker at least.
+            FLAGS_bthread_concurrency = std::max(
+                std::max(ncpu + (int)BTHREAD_EPOLL_THREAD_NUM,
+                         FLAGS_task_group_ntags),
+                std::max(BTHREAD_MIN_CONCURRENCY,
+                         FLAGS_bthread_min_concurrency));
+            LOG(INFO) << "Set bthread_concurrency to "
+                      << FLAGS_bthread_concurrency << " according to "
+                      << ncpu << " available cpus";
+        }
+    }
     int concurrency = FLAGS_bthread_min_concurrency > 0 ?
         FLAGS_bthread_min_concurrency :
         FLAGS_bthread_concurrency;
@@ -214,6 +241,41 @@ void print_living_tasks(std::ostream& os, bool enable_trace) {
     }
 }
 
+// Print bthreads running for at least `threshold_ms' without yielding.
+void print_long_running_tasks(std::ostream& os, int64_t threshold_ms,
+                              bool enable_trace) {
+    TaskControl* c = get_task_control();
+    if (NULL == c) {
+        os << "TaskControl has not been created";
+        return;
+    }
+    auto tasks = c->get_long_running_bthreads(threshold_ms * 1000000L);
+    if (tasks.empty()) {
+        os << "No bthreads running longer than " << threshold_ms << "ms\n";
+        return;
+    }
+    for (auto& t : tasks) {
+        os << "bthread=" << t.first << " has been running for "
+           << t.second / 1000000.0 << "ms\n";
+        print_task(os, t.first, enable_trace, true);
+    }
+}
+
+// Print how idle periods of workers ended: during spinning or by sleeping.
+void print_parking_stats(std::ostream& os) {
+    TaskControl* c = get_task_control();
+    if (NULL == c) {
+        os << "TaskControl has not been created\n";
+        return;
+    }
+    const int64_t nspin_hit = c->get_cumulated_spin_hit_count();
+    const int64_t npark = c->get_cumulated_park_count();
+    os << "spin_hit: " << nspin_hit << "\npark: " << npark
+       << "\nspin_hit_ratio: "
+       << (nspin_hit + npark ? (double)nspin_hit / (nspin_hit + npark) : 0)
+       << '\n';
+}
+
 static int add_workers_for_each_tag(int num) {
     int added = 0;
     auto c = get_task_control();
@@ -266,15 +328,10 @@ static bool validate_bthread_concurrency_by_tag(const char*, int32_t val) {
 
 __thread TaskGroup* tls_task_group_nosignal = NULL;
 
-BUTIL_FORCE_INLINE int
-start_from_non_worker(bthread_t* __restrict tid,
-                      const bthread_attr_t* __restrict attr,
-                      void* (*fn)(void*),
-                      void* __restrict arg) {
-    TaskControl* c = get_or_new_task_control();
-    if (NULL == c) {
-        return ENOMEM;
-    }
+// Choose the TaskGroup to insert tasks created in non-worker.
+BUTIL_FORCE_INLINE TaskGroup*
+choose_group_from_non_worker(TaskControl* c,
+                             const bthread_attr_t* __restrict attr) {
     auto tag = BTHREAD_TAG_DEFAULT;
     if (attr != NULL && attr->tag != BTHREAD_TAG_INVALID) {
         tag = attr->tag;
@@ -289,9 +346,22 @@ start_from_non_worker(bthread_t* __restrict tid,
             g = c->choose_one_group(tag);
             tls_task_group_nosignal = g;
         }
-        return g->start_background<true>(tid, attr, fn, arg);
+        return g;
+    }
+    return c->choose_one_group(tag);
+}
+
+BUTIL_FORCE_INLINE int
+start_from_non_worker(bthread_t* __restrict tid,
+                      const bthread_attr_t* __restrict attr,
+                      void* (*fn)(void*),
+                      void* __restrict arg) {
+    TaskControl* c = get_or_new_task_control();
+    if (NULL == c) {
+        return ENOMEM;
     }
-    return c->choose_one_group(tag)->start_background<true>(tid, attr, fn, arg);
+    return choose_group_from_non_worker(c, attr)->start_background<true>(
+        tid, attr, fn, arg);
 }
 
 // Meet one of the three conditions, can run in thread local
@@ -356,6 +426,26 @@ int bthread_start_background(bthread_t* __restrict tid,
     return bthread::start_from_non_worker(tid, attr, fn, arg);
 }
 
+int bthread_start_batch(bthread_t* __restrict tids,
+                        size_t n,
+                        const bthread_attr_t* __restrict attr,
+                        void * (*fn)(void*),
+                        void* const* args) {
+    bthread::TaskGroup* g = bthread::tls_task_group;
+    if (g) {
+        // if attribute is null use thread local task group
+        if (bthread::can_run_thread_local(attr)) {
+            return g->start_background_batch<false>(tids, n, attr, fn, args);
+        }
+    }
+    bthread::TaskControl* c = bthread::get_or_new_task_control();
+    if (NULL == c) {
+        return ENOMEM;
+    }
+    return bthread::choose_group_from_non_worker(c, attr)
+        ->start_background_batch<true>(tids, n, attr, fn, args);
+}
+
 void bthread_flush() {
     bthread::TaskGroup* g = bthread::tls_task_group;
     if (g) {
@@ -536,10 +626,10 @@ int bthread_timer_add(bthread_timer_t* id, timespec abstime,
     if (c == NULL) {
         return ENOMEM;
     }
-    bthread::TimerThread* tt = bthread::get_or_create_global_timer_thread();
-    if (tt == NULL) {
+    if (bthread::get_or_create_global_timer_thread() == NULL) {
         return ENOMEM;
     }
+    bthread::TimerThread* tt = bthread::get_timer_thread(bthread_self_tag());
     bthread_timer_t tmp = tt->schedule(on_timer, arg, abstime);
     if (tmp != 0) {
         *id = tmp;
@@ -581,6 +671,15 @@ int bthread_yield(void) {
     return sched_yield();
 }
 
+int bthread_should_yield(void) {
+    bthread::TaskGroup* g = bthread::BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_task_group);
+    if (NULL == g || g->is_current_pthread_task() || g->rq_size() == 0) {
+        return 0;
+    }
+    return g->current_run_ns() >=
+        bthread::FLAGS_bthread_time_slice_us * 1000L;
+}
+
 int bthread_set_worker_startfn(void (*start_fn)()) {
     if (start_fn == NULL) {
         return EINVAL;
@@ -597,6 +696,14 @@ int bthread_set_tagged_worker_startfn(void (*start_fn)(bthread_tag_t)) {
     return 0;
 }
 
+int bthread_set_worker_idlefn(bool (*idle_fn)()) {
+    if (idle_fn == NULL) {
+        return EINVAL;
+    }
+    bthread::g_worker_idlefn = idle_fn;
+    return 0;
+}
+
 int bthread_set_create_span_func(void* (*func)()) {
     if (func == NULL) {
         return EINVAL;
@@ -668,4 +775,16 @@ uint64_t bthread_cpu_clock_ns(void) {
     return 0;
 }
 
+void bthread_set_thread_allocated_bytes_fn(uint64_t (*fn)(void)) {
+    bthread::set_thread_allocated_bytes_fn(fn);
+}
+
+uint64_t bthread_allocated_bytes(void) {
+    bthread::TaskGroup* g = bthread::tls_task_group;
+    if (g != NULL && !g->is_current_main_task()) {
+        return g->current_task_allocated_bytes();
+    }
+    return 0;
+}
+
 }  // extern "C"
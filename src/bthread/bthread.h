@@ -68,6 +68,20 @@ extern int bthread_start_background(bthread_t* __restrict tid,
                                     void * (*fn)(void*),
                                     void* __restrict args);
 
+// Create `n' bthreads `fn(args[i])' with attributes `attr' and put the
+// identifiers into `tids'. This function behaves like calling
+// bthread_start_background() `n' times, but all bthreads are queued in one
+// pass and workers are signalled once, which is cheaper for fan-outs.
+// `args' may be NULL, in which case every bthread gets NULL as argument.
+// If the creation fails halfway, bthreads created before the failure are
+// still scheduled and the remaining `tids' are set to INVALID_BTHREAD.
+// Return 0 on success, errno otherwise.
+extern int bthread_start_batch(bthread_t* __restrict tids,
+                               size_t n,
+                               const bthread_attr_t* __restrict attr,
+                               void * (*fn)(void*),
+                               void* const* args);
+
 // Wake up operations blocking the thread. Different functions may behave
 // differently:
 //   bthread_usleep(): returns -1 and sets errno to ESTOP if bthread_stop()
@@ -170,6 +184,13 @@ extern int bthread_setconcurrency_by_tag(int num, bthread_tag_t tag);
 // even if bthread_yield() is called, suspended threads may still starve.
 extern int bthread_yield(void);
 
+// Returns 1 if the calling bthread has run longer than -bthread_time_slice_us
+// since it was scheduled last time while other bthreads are queued on the
+// same worker, 0 otherwise. CPU-bound bthreads can check this in their loops
+// and call bthread_yield() to let the queued bthreads run.
+// Always returns 0 in pthreads.
+extern int bthread_should_yield(void);
+
 // Suspend current thread for at least `microseconds'
 // Interruptible by bthread_interrupt().
 extern int bthread_usleep(uint64_t microseconds);
@@ -398,6 +419,21 @@ extern int bthread_setspecific(bthread_key_t key, void* data);
 // If the key is invalid or deleted, return NULL.
 extern void* bthread_getspecific(bthread_key_t key);
 
+// Store `data' in the static slot `slot' of current bthread, which must be
+// in [0, BTHREAD_STATIC_LOCAL_SLOTS). Unlike bthread_key_t, slots are not
+// created at runtime: applications assign fixed indices to them, and the
+// slots are stored inside the bthread and accessed directly without
+// KeyTable lookups or allocations, which suits per-request contexts set in
+// every handler. Slots are cleared without calling any destructor when a
+// bthread starts, so the data must be owned by the code setting it. In
+// pthreads, slots are pthread-local.
+// Returns 0 on success, EINVAL if `slot' is out of range.
+extern int bthread_set_static_local(int slot, void* data);
+
+// Return data in the static slot `slot' of current bthread, NULL if the
+// slot is never set or out of range.
+extern void* bthread_get_static_local(int slot);
+
 // Return current bthread tag
 extern bthread_tag_t bthread_self_tag(void);
 
@@ -428,6 +464,12 @@ extern int bthread_once(bthread_once_t* once_control, void (*init_routine)());
  */
 extern uint64_t bthread_cpu_clock_ns(void);
 
+// Bytes allocated by the current bthread, accumulated across workers it ran
+// on like bthread_cpu_clock_ns(). Requires `bthread_enable_cpu_clock_stat'
+// and a counter set by bthread_set_thread_allocated_bytes_fn(), returns 0
+// otherwise.
+extern uint64_t bthread_allocated_bytes(void);
+
 __END_DECLS
 
 #endif  // BTHREAD_BTHREAD_H
@@ -29,6 +29,7 @@
 #endif
 #include "butil/logging.h"
 #include "butil/object_pool.h"
+#include "bvar/collector.h"                // is_sampling_range_valid
 #include "bthread/errno.h"                 // EWOULDBLOCK
 #include "bthread/sys_futex.h"             // futex_*
 #include "bthread/processor.h"             // cpu_relax
@@ -101,9 +102,12 @@ struct ButexBthreadWaiter : public ButexWaiter {
 };
 
 // pthread_task or main_task allocates this structure on stack and queue it
-// in Butex::waiters.
+// in Butex::waiters. butex_wait_async() allocates it on heap with non-NULL
+// `on_wake' which is called instead of waking up a pthread.
 struct ButexPthreadWaiter : public ButexWaiter {
     butil::atomic<int> sig;
+    void (*on_wake)(void*);
+    void* on_wake_arg;
 };
 
 typedef butil::LinkedList<ButexWaiter> ButexWaiterList;
@@ -134,6 +138,15 @@ struct ObjectPoolWithASanPoison<bthread::Butex> : false_type {};
 namespace bthread {
 
 static void wakeup_pthread(ButexPthreadWaiter* pw) {
+    if (pw->on_wake) {
+        // Asynchronous waiter, nobody else references `pw' after it's
+        // removed from the butex.
+        void (*on_wake)(void*) = pw->on_wake;
+        void* const on_wake_arg = pw->on_wake_arg;
+        delete pw;
+        on_wake(on_wake_arg);
+        return;
+    }
     // release fence makes wait_pthread see changes before wakeup.
     pw->sig.store(PTHREAD_SIGNALLED, butil::memory_order_release);
     // At this point, wait_pthread() possibly has woken up and destroyed `pw'.
@@ -190,6 +203,10 @@ int wait_pthread(ButexPthreadWaiter& pw, const timespec* abstime) {
 
 extern BAIDU_THREAD_LOCAL TaskGroup* tls_task_group;
 
+// Defined in mutex.cpp
+size_t wait_sampling_range();
+void submit_wait(const bthread_contention_site_t& csite, int64_t now_ns);
+
 // Returns 0 when no need to unschedule or successfully unscheduled,
 // -1 otherwise.
 inline int unsleep_if_necessary(ButexBthreadWaiter* w,
@@ -359,31 +376,39 @@ int butex_wake_n(void* arg, size_t n, bool nosignal) {
     if (bthread_waiters.empty()) {
         return nwakeup;
     }
-    butil::FlatMap<bthread_tag_t, TaskGroup*> nwakeups;
-    nwakeups.init(FLAGS_task_group_ntags);
     // We will exchange with first waiter in the end.
     ButexBthreadWaiter* next = static_cast<ButexBthreadWaiter*>(
         bthread_waiters.head()->value());
     next->RemoveFromList();
     unsleep_if_necessary(next, get_global_timer_thread());
     ++nwakeup;
-    while (!bthread_waiters.empty()) {
-        // pop reversely
-        ButexBthreadWaiter* w = static_cast<ButexBthreadWaiter*>(
-            bthread_waiters.tail()->value());
-        w->RemoveFromList();
-        unsleep_if_necessary(w, get_global_timer_thread());
-        auto g = get_task_group(w->control, w->tag);
-        g->ready_to_run_general(w->task_meta, true);
-        nwakeups[g->tag()] = g;
-        ++nwakeup;
-    }
-    for (auto it = nwakeups.begin(); it != nwakeups.end(); ++it) {
-        auto g = it->second;
-        if (!check_nosignal(nosignal, g->tag())) {
-            g->flush_nosignal_tasks_general();
+    // Mostly there's only one waiter, e.g. the caller joining a synchronous
+    // RPC which is woken by the bthread processing the response. Skip the
+    // map in this case, so that the handoff to the waiter costs no
+    // allocation.
+    if (!bthread_waiters.empty()) {
+        butil::FlatMap<bthread_tag_t, TaskGroup*> nwakeups;
+        nwakeups.init(FLAGS_task_group_ntags);
+        while (!bthread_waiters.empty()) {
+            // pop reversely
+            ButexBthreadWaiter* w = static_cast<ButexBthreadWaiter*>(
+                bthread_waiters.tail()->value());
+            w->RemoveFromList();
+            unsleep_if_necessary(w, get_global_timer_thread());
+            auto g = get_task_group(w->control, w->tag);
+            g->ready_to_run_general(w->task_meta, true);
+            nwakeups[g->tag()] = g;
+            ++nwakeup;
+        }
+        for (auto it = nwakeups.begin(); it != nwakeups.end(); ++it) {
+            auto g = it->second;
+            if (!check_nosignal(nosignal, g->tag())) {
+                g->flush_nosignal_tasks_general();
+            }
         }
     }
+    // Switch to the waiter directly if it's in the same tag, current bthread
+    // is put back into the runqueue.
     auto g = get_task_group(next->control, next->tag);
     if (g == tls_task_group) {
         run_in_local_task_group(g, next->task_meta, nosignal);
@@ -580,7 +605,7 @@ void wait_for_butex(void* arg) {
             bw->control->_task_tracer.set_status(TASK_STATUS_SUSPENDED, bw->task_meta);
 #endif // BRPC_BTHREAD_TRACER
             if (bw->abstime != NULL) {
-                bw->sleep_id = get_global_timer_thread()->schedule(
+                bw->sleep_id = get_timer_thread(bw->tag)->schedule(
                     erase_from_butex_and_wakeup, bw, *bw->abstime);
                 if (!bw->sleep_id) {  // TimerThread stopped.
                     errno = ESTOP;
@@ -615,6 +640,8 @@ static int butex_wait_from_pthread(TaskGroup* g, Butex* b, int expected_value,
     ButexPthreadWaiter pw;
     pw.tid = 0;
     pw.sig.store(PTHREAD_NOT_SIGNALLED, butil::memory_order_relaxed);
+    pw.on_wake = NULL;
+    pw.on_wake_arg = NULL;
     int rc = 0;
     
     if (g) {
@@ -708,6 +735,12 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime, bool prep
     num_waiters << 1;
 #endif
 
+    // Time from parking to being woken up is sampled by the wait profiler.
+    const size_t sampling_range = wait_sampling_range();
+    const int64_t wait_start_ns =
+        (bvar::is_sampling_range_valid(sampling_range) ?
+         butil::cpuwide_time_ns() : 0);
+
     // release fence matches with acquire fence in interrupt_and_consume_waiters
     // in task_group.cpp to guarantee visibility of `interrupted'.
     bbw.task_meta->current_waiter.store(&bbw, butil::memory_order_release);
@@ -728,6 +761,12 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime, bool prep
 #ifdef SHOW_BTHREAD_BUTEX_WAITER_COUNT_IN_VARS
     num_waiters << -1;
 #endif
+    if (wait_start_ns != 0) {
+        const int64_t now_ns = butil::cpuwide_time_ns();
+        const bthread_contention_site_t csite =
+            { now_ns - wait_start_ns, sampling_range };
+        submit_wait(csite, now_ns);
+    }
 
     bool is_interrupted = false;
     if (bbw.task_meta->interrupted) {
@@ -749,6 +788,37 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime, bool prep
     return 0;
 }
 
+int butex_wait_async(void* arg, int expected_value,
+                     void (*on_wake)(void*), void* on_wake_arg) {
+    Butex* b = container_of(static_cast<butil::atomic<int>*>(arg), Butex, value);
+    if (b->value.load(butil::memory_order_relaxed) != expected_value) {
+        errno = EWOULDBLOCK;
+        butil::atomic_thread_fence(butil::memory_order_acquire);
+        return -1;
+    }
+    ButexPthreadWaiter* pw = new (std::nothrow) ButexPthreadWaiter;
+    if (NULL == pw) {
+        errno = ENOMEM;
+        return -1;
+    }
+    pw->tid = 0;
+    pw->container.store(NULL, butil::memory_order_relaxed);
+    pw->sig.store(PTHREAD_NOT_SIGNALLED, butil::memory_order_relaxed);
+    pw->on_wake = on_wake;
+    pw->on_wake_arg = on_wake_arg;
+    {
+        BAIDU_SCOPED_LOCK(b->waiter_lock);
+        if (b->value.load(butil::memory_order_relaxed) == expected_value) {
+            b->waiters.Append(pw);
+            pw->container.store(b, butil::memory_order_relaxed);
+            return 0;
+        }
+    }
+    delete pw;
+    errno = EWOULDBLOCK;
+    return -1;
+}
+
 }  // namespace bthread
 
 namespace butil {
@@ -85,6 +85,15 @@ int butex_wait(void* butex, int expected_value,
                const timespec* abstime,
                bool prepend = false);
 
+// Like butex_wait() without blocking: if *butex equals |expected_value|,
+// queue a waiter and return 0, |on_wake|(|on_wake_arg|) will be called
+// once in the thread calling butex_wake*() on |butex|. Interruptions and
+// timeouts are not supported.
+// Returns -1 otherwise and errno is set(EWOULDBLOCK for unmatched value),
+// |on_wake| is not called in which case.
+int butex_wait_async(void* butex, int expected_value,
+                     void (*on_wake)(void*), void* on_wake_arg);
+
 }  // namespace bthread
 
 #endif  // BTHREAD_BUTEX_H
@@ -105,4 +105,53 @@ int CountdownEvent::timed_wait(const timespec& duetime) {
     }
 }
 
+struct CountdownAsyncWaiter {
+    void* butex;
+    void (*on_done)(void*);
+    void* arg;
+};
+
+// Returns true if the counter reaches 0, false if `w' is queued.
+static bool countdown_reached_or_wait_async(CountdownAsyncWaiter* w);
+
+static void on_countdown_async_woken(void* arg) {
+    CountdownAsyncWaiter* w = static_cast<CountdownAsyncWaiter*>(arg);
+    if (countdown_reached_or_wait_async(w)) {
+        void (*on_done)(void*) = w->on_done;
+        void* const on_done_arg = w->arg;
+        delete w;
+        on_done(on_done_arg);
+    }
+}
+
+static bool countdown_reached_or_wait_async(CountdownAsyncWaiter* w) {
+    for (;;) {
+        const int seen_counter =
+            ((butil::atomic<int>*)w->butex)->load(butil::memory_order_acquire);
+        if (seen_counter <= 0) {
+            return true;
+        }
+        if (butex_wait_async(w->butex, seen_counter,
+                             on_countdown_async_woken, w) == 0) {
+            return false;
+        }
+    }
+}
+
+int CountdownEvent::wait_async(void (*on_done)(void*), void* arg) {
+    _wait_was_invoked = true;
+    CountdownAsyncWaiter* w = new (std::nothrow) CountdownAsyncWaiter;
+    if (NULL == w) {
+        return ENOMEM;
+    }
+    w->butex = _butex;
+    w->on_done = on_done;
+    w->arg = arg;
+    if (countdown_reached_or_wait_async(w)) {
+        delete w;
+        on_done(arg);
+    }
+    return 0;
+}
+
 }  // namespace bthread
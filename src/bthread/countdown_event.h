@@ -52,6 +52,12 @@ public:
     // This method never returns EINTR.
     int timed_wait(const timespec& duetime);
 
+    // Call |on_done|(|arg|) once the counter reaches 0 without blocking
+    // current thread, either inside this function or in the thread calling
+    // the last signal(). *this must be valid until |on_done| is called.
+    // Returns 0 on success, error code otherwise and |on_done| is not called.
+    int wait_async(void (*on_done)(void*), void* arg);
+
 private:
     int *_butex;
     bool _wait_was_invoked;
@@ -0,0 +1,196 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// bthread - An M:N threading library to make applications more concurrent.
+
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "butil/build_config.h"
+#include "butil/macros.h"
+#include "butil/strings/string_split.h"
+#include "bthread/cpu_quota.h"
+
+namespace bthread {
+
+int get_allowed_cpus(std::vector<int>* cpus) {
+    cpus->clear();
+#if defined(OS_LINUX)
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    if (sched_getaffinity(0, sizeof(cs), &cs) != 0) {
+        return -1;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &cs)) {
+            cpus->push_back(cpu);
+        }
+    }
+    return cpus->empty() ? -1 : 0;
+#else
+    return -1;
+#endif
+}
+
+// Find path of the cgroup of this process in `proc_cgroup'. Lines are
+// in the form of "hierarchy-id:controllers:path", v2 has an empty
+// controller list, v1 has "cpu" in the comma-separated controller list.
+static bool FindCgroupPath(const std::string& proc_cgroup, bool v2,
+                           std::string* path) {
+    FILE* fp = fopen(proc_cgroup.c_str(), "r");
+    if (fp == NULL) {
+        return false;
+    }
+    bool found = false;
+    char line[1024];
+    while (!found && fgets(line, sizeof(line), fp) != NULL) {
+        char* controllers = strchr(line, ':');
+        if (controllers == NULL) {
+            continue;
+        }
+        ++controllers;
+        char* p = strchr(controllers, ':');
+        if (p == NULL) {
+            continue;
+        }
+        *p++ = '\0';
+        p[strcspn(p, "\n")] = '\0';
+        if (v2) {
+            found = (*controllers == '\0');
+        } else {
+            std::vector<std::string> names;
+            butil::SplitString(controllers, ',', &names);
+            for (size_t i = 0; i < names.size() && !found; ++i) {
+                found = (names[i] == "cpu");
+            }
+        }
+        if (found) {
+            path->assign(p);
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+// Returns the limit in cpus, 0 if unlimited, -1 if `dir' has no limit file.
+static double ReadQuota(const std::string& dir, bool v2) {
+    long long quota = -1;
+    long long period = 0;
+    if (v2) {
+        FILE* fp = fopen((dir + "/cpu.max").c_str(), "r");
+        if (fp == NULL) {
+            return -1;
+        }
+        char buf[32] = "";
+        // "max 100000" when unlimited.
+        const int n = fscanf(fp, "%31s %lld", buf, &period);
+        fclose(fp);
+        if (n != 2 || strcmp(buf, "max") == 0) {
+            return n == 2 ? 0 : -1;
+        }
+        quota = strtoll(buf, NULL, 10);
+    } else {
+        FILE* fp = fopen((dir + "/cpu.cfs_quota_us").c_str(), "r");
+        if (fp == NULL) {
+            return -1;
+        }
+        const int n = fscanf(fp, "%lld", &quota);
+        fclose(fp);
+        if (n != 1) {
+            return -1;
+        }
+        fp = fopen((dir + "/cpu.cfs_period_us").c_str(), "r");
+        if (fp == NULL) {
+            return -1;
+        }
+        if (fscanf(fp, "%lld", &period) != 1) {
+            period = 0;
+        }
+        fclose(fp);
+    }
+    // -1 in v1 means unlimited.
+    if (quota <= 0 || period <= 0) {
+        return 0;
+    }
+    return (double)quota / period;
+}
+
+// Walk from the cgroup of this process up to the root of `mount' and
+// return the smallest limit. The cgroup path is relative to the root of
+// the cgroup namespace, which is mounted at `mount' inside containers, in
+// which case only `mount' itself is readable.
+static double ReadQuotaInHierarchy(const std::string& mount,
+                                   const std::string& cgroup_path, bool v2) {
+    double min_quota = 0;
+    std::string path = cgroup_path;
+    while (true) {
+        const double q = ReadQuota(mount + path, v2);
+        if (q > 0 && (min_quota == 0 || q < min_quota)) {
+            min_quota = q;
+        }
+        const size_t slash = path.find_last_of('/');
+        if (path.empty() || slash == std::string::npos) {
+            break;
+        }
+        path.resize(slash);
+    }
+    return min_quota;
+}
+
+double get_cgroup_cpu_quota() {
+    return get_cgroup_cpu_quota("/proc/self/cgroup", "/sys/fs/cgroup");
+}
+
+double get_cgroup_cpu_quota(const std::string& proc_cgroup,
+                            const std::string& cgroup_root) {
+    std::string path;
+    if (FindCgroupPath(proc_cgroup, true, &path)) {
+        const double q = ReadQuotaInHierarchy(cgroup_root, path, true);
+        if (q > 0) {
+            return q;
+        }
+    }
+    if (FindCgroupPath(proc_cgroup, false, &path)) {
+        // cpu and cpuacct are often co-mounted.
+        const char* const mounts[] = { "/cpu,cpuacct", "/cpu", "/cpuacct,cpu" };
+        for (size_t i = 0; i < arraysize(mounts); ++i) {
+            const double q = ReadQuotaInHierarchy(
+                cgroup_root + mounts[i], path, false);
+            if (q > 0) {
+                return q;
+            }
+        }
+    }
+    return 0;
+}
+
+int get_available_cpus() {
+    std::vector<int> cpus;
+    int n = (get_allowed_cpus(&cpus) == 0 ? (int)cpus.size() : -1);
+    const double quota = get_cgroup_cpu_quota();
+    if (quota > 0) {
+        const int q = (int)ceil(quota);
+        if (n < 0 || q < n) {
+            n = q;
+        }
+    }
+    return n;
+}
+
+}  // namespace bthread
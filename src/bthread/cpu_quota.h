@@ -0,0 +1,51 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// bthread - An M:N threading library to make applications more concurrent.
+
+#ifndef BTHREAD_CPU_QUOTA_H
+#define BTHREAD_CPU_QUOTA_H
+
+#include <string>
+#include <vector>
+
+namespace bthread {
+
+// Cpus that this process is allowed to run on, which reflects the cpuset
+// of the container. Returns 0 on success, -1 otherwise.
+int get_allowed_cpus(std::vector<int>* cpus);
+
+// CPU bandwidth limit of the cgroup(v1 or v2) of this process in number
+// of cpus, e.g. 2.5 for a quota of 250ms per 100ms period. The smallest
+// limit along the hierarchy visible to this process is used.
+// Returns 0 when there's no limit or the limit is unknown.
+double get_cgroup_cpu_quota();
+
+// Same as above, but reads the cgroups of this process from `proc_cgroup'
+// and the cgroup filesystems mounted under `cgroup_root', which are
+// /proc/self/cgroup and /sys/fs/cgroup respectively in the above one.
+double get_cgroup_cpu_quota(const std::string& proc_cgroup,
+                            const std::string& cgroup_root);
+
+// Number of cpus that this process is able to use at the same time, namely
+// the rounded-up cgroup quota capped by the number of allowed cpus.
+// Returns -1 if neither is known.
+int get_available_cpus();
+
+}  // namespace bthread
+
+#endif  // BTHREAD_CPU_QUOTA_H
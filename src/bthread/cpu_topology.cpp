@@ -0,0 +1,159 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// bthread - An M:N threading library to make applications more concurrent.
+
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <set>
+#include "butil/logging.h"
+#include "bthread/cpu_topology.h"
+
+namespace bthread {
+
+// Upper bound of cpus and nodes, avoid huge vectors on corrupted inputs.
+static const int MAX_CPUS = 65536;
+static const int MAX_NODES = 1024;
+static const int MAX_CACHE_INDEXES = 16;
+
+// Parse cpulist like "0-3,8-11" in `path'.
+// Returns 0 on success, -1 otherwise.
+static int ReadCpuList(const char* path, std::vector<int>* cpus) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    int rc = 0;
+    int first = 0;
+    while (fscanf(fp, "%d", &first) == 1) {
+        int last = first;
+        int c = fgetc(fp);
+        if (c == '-') {
+            if (fscanf(fp, "%d", &last) != 1) {
+                rc = -1;
+                break;
+            }
+            c = fgetc(fp);
+        }
+        if (first < 0 || last < first || last >= MAX_CPUS) {
+            rc = -1;
+            break;
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus->push_back(cpu);
+        }
+        if (c != ',') {
+            break;
+        }
+    }
+    fclose(fp);
+    return rc;
+}
+
+static int ReadInt(const char* path, int* value) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    const int n = fscanf(fp, "%d", value);
+    fclose(fp);
+    return n == 1 ? 0 : -1;
+}
+
+int CpuTopology::init(const std::string& sysfs_dir, long ncpu) {
+    if (ncpu <= 0 || ncpu > MAX_CPUS) {
+        return -1;
+    }
+    _node.assign(ncpu, -1);
+    _l3.assign(ncpu, -1);
+    const char* const sys = sysfs_dir.c_str();
+    char path[PATH_MAX];
+    std::vector<int> cpus;
+    for (int node = 0; node < MAX_NODES; ++node) {
+        snprintf(path, sizeof(path),
+                 "%s/devices/system/node/node%d/cpulist", sys, node);
+        cpus.clear();
+        if (ReadCpuList(path, &cpus) != 0) {
+            break;
+        }
+        for (int cpu : cpus) {
+            if (cpu < ncpu) {
+                _node[cpu] = node;
+            }
+        }
+        _nnode = node + 1;
+    }
+    std::set<int> l3s;
+    for (int cpu = 0; cpu < ncpu; ++cpu) {
+        if (_node[cpu] < 0) {
+            // Kernels without NUMA support don't have /sys/devices/system/node.
+            _node[cpu] = 0;
+        }
+        for (int index = 0; index < MAX_CACHE_INDEXES; ++index) {
+            int level = 0;
+            snprintf(path, sizeof(path),
+                     "%s/devices/system/cpu/cpu%d/cache/index%d/level",
+                     sys, cpu, index);
+            if (ReadInt(path, &level) != 0) {
+                break;
+            }
+            if (level != 3) {
+                continue;
+            }
+            snprintf(path, sizeof(path),
+                     "%s/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list",
+                     sys, cpu, index);
+            cpus.clear();
+            if (ReadCpuList(path, &cpus) == 0 && !cpus.empty()) {
+                _l3[cpu] = cpus[0];
+            }
+            break;
+        }
+        if (_l3[cpu] < 0) {
+            // No L3 info, treat the node as one cache domain. Negative ids
+            // never collide with cpu numbers.
+            _l3[cpu] = -2 - _node[cpu];
+        }
+        l3s.insert(_l3[cpu]);
+    }
+    _nnode = std::max(_nnode, 1);
+    _nl3 = l3s.size();
+    return 0;
+}
+
+const CpuTopology* CpuTopology::instance() {
+    static const CpuTopology* s_topology = []() -> const CpuTopology* {
+        CpuTopology* t = new CpuTopology;
+        if (t->init("/sys", sysconf(_SC_NPROCESSORS_CONF)) != 0) {
+            LOG(WARNING) << "Fail to read cpu topology";
+            delete t;
+            return NULL;
+        }
+        LOG(INFO) << "Found " << t->nl3() << " L3 caches on "
+                  << t->nnode() << " NUMA nodes";
+        if (t->nl3() <= 1 && t->nnode() <= 1) {
+            delete t;
+            return NULL;
+        }
+        return t;
+    }();
+    return s_topology;
+}
+
+}  // namespace bthread
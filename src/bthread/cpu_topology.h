@@ -0,0 +1,63 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// bthread - An M:N threading library to make applications more concurrent.
+
+#ifndef BTHREAD_CPU_TOPOLOGY_H
+#define BTHREAD_CPU_TOPOLOGY_H
+
+#include <string>
+#include <vector>
+
+namespace bthread {
+
+// Last-level cache and NUMA node of each cpu, read from sysfs once.
+class CpuTopology {
+public:
+    // Returns NULL when the topology is unknown or flat(all cpus share
+    // one L3 on one node), in which case locality is meaningless.
+    static const CpuTopology* instance();
+
+    // Id of the L3 cache of `cpu', which is the smallest cpu sharing it.
+    // Returns -1 if `cpu' is unknown.
+    int l3_of(int cpu) const {
+        return (cpu >= 0 && (size_t)cpu < _l3.size()) ? _l3[cpu] : -1;
+    }
+
+    // NUMA node of `cpu', -1 if `cpu' is unknown.
+    int node_of(int cpu) const {
+        return (cpu >= 0 && (size_t)cpu < _node.size()) ? _node[cpu] : -1;
+    }
+
+    int nl3() const { return _nl3; }
+    int nnode() const { return _nnode; }
+
+private:
+    CpuTopology() : _nl3(0), _nnode(0) {}
+    // Read locations of `ncpu' cpus from sysfs mounted at `sysfs_dir'.
+    // Returns 0 on success, -1 otherwise.
+    int init(const std::string& sysfs_dir, long ncpu);
+
+    std::vector<int> _l3;
+    std::vector<int> _node;
+    int _nl3;
+    int _nnode;
+};
+
+}  // namespace bthread
+
+#endif  // BTHREAD_CPU_TOPOLOGY_H
@@ -154,6 +154,16 @@ void* ExecutionQueueBase::_execute_tasks(void* arg) {
             head = head->next;
             m->return_task_node(saved_head);
         }
+        if (m->_options.max_batch_delay_us > 0 &&
+            m->_options.min_batch_size > 1) {
+            m->_wait_for_batch();
+            if (cur_tail == NULL) {
+                for (cur_tail = head; cur_tail->next != NULL;
+                        cur_tail = cur_tail->next) {}
+            }
+            // Pull tasks arrived during waiting into this batch.
+            m->_more_tasks(cur_tail, &cur_tail, true);
+        }
         int rc = 0;
         if (m->_high_priority_tasks.load(butil::memory_order_relaxed) > 0) {
             int nexecuted = 0;
@@ -229,6 +239,92 @@ void* ExecutionQueueBase::_execute_tasks_pthread(void* arg) {
     return NULL;
 }
 
+bool ExecutionQueueBase::_is_full(int64_t ntask, int64_t nbytes) const {
+    if (_options.max_pending_tasks > 0 && ntask > _options.max_pending_tasks) {
+        return true;
+    }
+    // Always accept a task when nothing is pending, otherwise a task larger
+    // than max_pending_bytes would never be accepted.
+    return _options.max_pending_bytes > 0 && ntask > 1 &&
+        nbytes > _options.max_pending_bytes;
+}
+
+int ExecutionQueueBase::reserve_pending(int64_t bytes) {
+    for (;;) {
+        const int64_t ntask = _pending_tasks.fetch_add(1) + 1;
+        const int64_t nbytes = _pending_bytes.fetch_add(bytes) + bytes;
+        if (!_is_full(ntask, nbytes)) {
+            return 0;
+        }
+        // Undo without waking others up, which would make blocked producers
+        // wake each other endlessly. The queue is full so the consumer is
+        // running and will wake them up.
+        _pending_tasks.fetch_sub(1);
+        _pending_bytes.fetch_sub(bytes);
+        if (!_options.block_when_full) {
+            return EAGAIN;
+        }
+        _npending_waiters.fetch_add(1);
+        const int expected = _pending_butex->load(butil::memory_order_acquire);
+        if (_is_full(_pending_tasks.load() + 1,
+                     _pending_bytes.load() + bytes) && !stopped()) {
+            butex_wait(_pending_butex, expected, NULL);
+        }
+        _npending_waiters.fetch_sub(1);
+        if (stopped()) {
+            return EINVAL;
+        }
+    }
+}
+
+void ExecutionQueueBase::cancel_pending(int64_t bytes) {
+    _release_pending(1, bytes);
+}
+
+void ExecutionQueueBase::_release_pending(int64_t ntask, int64_t nbytes) {
+    _pending_tasks.fetch_sub(ntask);
+    if (nbytes != 0) {
+        _pending_bytes.fetch_sub(nbytes);
+    }
+    if (_npending_waiters.load() > 0) {
+        _pending_butex->fetch_add(1, butil::memory_order_release);
+        butex_wake(_pending_butex);
+    }
+}
+
+void ExecutionQueueBase::on_pending_pushed() {
+    if (_batch_waiting.load() &&
+        _pending_tasks.load(butil::memory_order_relaxed) >=
+        _options.min_batch_size &&
+        _batch_waiting.exchange(false)) {
+        _batch_butex->fetch_add(1, butil::memory_order_release);
+        butex_wake(_batch_butex);
+    }
+}
+
+void ExecutionQueueBase::_wait_for_batch() {
+    if (_pending_tasks.load(butil::memory_order_relaxed) >=
+        _options.min_batch_size) {
+        return;
+    }
+    const timespec abstime =
+        butil::microseconds_from_now(_options.max_batch_delay_us);
+    while (_pending_tasks.load() < _options.min_batch_size &&
+           _high_priority_tasks.load(butil::memory_order_relaxed) == 0 &&
+           !stopped()) {
+        const int expected = _batch_butex->load(butil::memory_order_acquire);
+        _batch_waiting.store(true);
+        if (_pending_tasks.load() >= _options.min_batch_size) {
+            break;
+        }
+        if (butex_wait(_batch_butex, expected, &abstime) < 0 &&
+            errno == ETIMEDOUT) {
+            break;
+        }
+    }
+    _batch_waiting.store(false, butil::memory_order_relaxed);
+}
+
 void ExecutionQueueBase::return_task_node(TaskNode* node) {
     node->clear_before_return(_clear_func);
     butil::return_object<TaskNode>(node);
@@ -385,6 +481,7 @@ ExecutionQueueBase::scoped_ptr_t ExecutionQueueBase::address(uint64_t id) {
 int ExecutionQueueBase::create(uint64_t* id, const ExecutionQueueOptions* options,
                                execute_func_t execute_func,
                                clear_task_mem clear_func,
+                               task_bytes_func bytes_func,
                                void* meta, void* type_specific_function) {
     if (execute_func == NULL || clear_func == NULL) {
         return EINVAL;
@@ -404,6 +501,13 @@ int ExecutionQueueBase::create(uint64_t* id, const ExecutionQueueOptions* option
             opt = *options;   
         }
         m->_options = opt;
+        m->_track_pending = (opt.max_pending_tasks > 0 ||
+                             opt.max_pending_bytes > 0 ||
+                             (opt.max_batch_delay_us > 0 &&
+                              opt.min_batch_size > 1));
+        m->_task_bytes_func = bytes_func;
+        CHECK_EQ(0, m->_pending_tasks.load(butil::memory_order_relaxed));
+        CHECK_EQ(0, m->_pending_bytes.load(butil::memory_order_relaxed));
         m->_stopped.store(false, butil::memory_order_relaxed);
         m->_this_id = make_id(
                 _version_of_vref(m->_versioned_ref.fetch_add(
@@ -439,6 +543,9 @@ void TaskIteratorBase::operator++() {
 
     while (_cur_node && !_cur_node->stop_task) {
         if (_high_priority == _cur_node->high_priority) {
+            if (!_cur_node->iterated) {
+                _q->_on_task_iterated(_cur_node);
+            }
             if (!_cur_node->iterated && _cur_node->peek_to_execute()) {
                 ++_num_iterated;
                 _cur_node->iterated = true;
@@ -153,6 +153,43 @@ struct ExecutionQueueOptions {
     // Note that TaskOptions.in_place_if_possible = false will not work, if implementation of
     // Executor is in-place(synchronous).
     Executor * executor;
+
+    // Maximum number of tasks which are not handed to |execute| yet, 0 means
+    // unlimited. default: 0
+    int64_t max_pending_tasks;
+
+    // Maximum bytes(see ExecutionQueueTaskBytes) of tasks which are not
+    // handed to |execute| yet, 0 means unlimited. A task is always accepted
+    // when no task is pending even if it's larger. default: 0
+    int64_t max_pending_bytes;
+
+    // When the queue is full, execution_queue_execute blocks the calling
+    // bthread(or pthread) until the queue has room if this field is true,
+    // returns EAGAIN otherwise.
+    // NOTE: Don't block in |execute| of the same queue, which deadlocks.
+    // default: false
+    bool block_when_full;
+
+    // The consumer waits for at most |max_batch_delay_us| microseconds until
+    // at least |min_batch_size| tasks are pending before calling |execute|,
+    // so that per-batch costs(e.g. fsync) are amortized over more tasks.
+    // Waiting is skipped when high-priority tasks are pending or the queue
+    // is stopped. 0 disables waiting. default: 0
+    int64_t min_batch_size;
+    int64_t max_batch_delay_us;
+};
+
+// Bytes of a task counted against ExecutionQueueOptions::max_pending_bytes,
+// which is sizeof(T) by default. Specialize it for tasks referencing memory
+// elsewhere, e.g.
+//   namespace bthread {
+//   template <> struct ExecutionQueueTaskBytes<LogEntry> {
+//       static size_t get(const LogEntry& e) { return e.data.size(); }
+//   };
+//   }
+template <typename T>
+struct ExecutionQueueTaskBytes {
+    static size_t get(const T&) { return sizeof(T); }
 };
 
 // Start an ExecutionQueue. If |options| is NULL, the queue will be created with
@@ -181,8 +218,10 @@ int execution_queue_stop(ExecutionQueueId<T> id);
 template <typename T>
 int execution_queue_join(ExecutionQueueId<T> id);
 
-// Thread-safe and Wait-free.
+// Thread-safe and Wait-free(unless the queue is bounded and
+// ExecutionQueueOptions.block_when_full is true).
 // Execute a task with default TaskOptions (normal task);
+// Returns EAGAIN if the queue is full and block_when_full is false.
 template <typename T>
 int execution_queue_execute(ExecutionQueueId<T> id, 
                             typename butil::add_const_reference<T>::type task);
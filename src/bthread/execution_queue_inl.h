@@ -42,6 +42,7 @@ struct ExecutionQueueId {
 struct TaskNode;
 class ExecutionQueueBase;
 typedef void (*clear_task_mem)(TaskNode*);
+typedef size_t (*task_bytes_func)(TaskNode*);
 
 struct BAIDU_CACHELINE_ALIGNMENT TaskNode {
     enum TaskStatus {
@@ -172,13 +173,25 @@ public:
         , _high_priority_tasks(0)
         , _pthread_started(false)
         , _cond(&_mutex)
-        , _current_head(NULL) {
+        , _current_head(NULL)
+        , _track_pending(false)
+        , _task_bytes_func(NULL)
+        , _pending_tasks(0)
+        , _pending_bytes(0)
+        , _npending_waiters(0)
+        , _batch_waiting(false) {
         _join_butex = butex_create_checked<butil::atomic<int> >();
         _join_butex->store(0, butil::memory_order_relaxed);
+        _pending_butex = butex_create_checked<butil::atomic<int> >();
+        _pending_butex->store(0, butil::memory_order_relaxed);
+        _batch_butex = butex_create_checked<butil::atomic<int> >();
+        _batch_butex->store(0, butil::memory_order_relaxed);
     }
 
     ~ExecutionQueueBase() {
         butex_destroy(_join_butex);
+        butex_destroy(_pending_butex);
+        butex_destroy(_batch_butex);
     }
 
     bool stopped() const { return _stopped.load(butil::memory_order_acquire); }
@@ -191,12 +204,22 @@ protected:
     static int create(uint64_t* id, const ExecutionQueueOptions* options,
                       execute_func_t execute_func,
                       clear_task_mem clear_func,
+                      task_bytes_func bytes_func,
                       void* meta, void* type_specific_function);
     static scoped_ptr_t address(uint64_t id) WARN_UNUSED_RESULT;
     void start_execute(TaskNode* node);
     TaskNode* allocate_node();
     void return_task_node(TaskNode* node);
 
+    bool track_pending() const { return _track_pending; }
+    // Count a new task of `bytes' as pending, wait or fail if the queue
+    // is full. Returns 0 on success, errno otherwise.
+    int reserve_pending(int64_t bytes);
+    // Undo reserve_pending() when the task can't be pushed.
+    void cancel_pending(int64_t bytes);
+    // Wake up the consumer waiting for a larger batch if necessary.
+    void on_pending_pushed();
+
 private:
 
     bool _more_tasks(TaskNode* old_head, TaskNode** new_tail,
@@ -206,6 +229,16 @@ private:
     }
     void _on_recycle();
     int _execute(TaskNode* head, bool high_priority, int* niterated);
+    bool _is_full(int64_t ntask, int64_t nbytes) const;
+    void _release_pending(int64_t ntask, int64_t nbytes);
+    // Called when `node' is handed to |execute| or skipped as cancelled.
+    void _on_task_iterated(TaskNode* node) {
+        if (_track_pending) {
+            _release_pending(1, (_options.max_pending_bytes > 0 ?
+                                 (int64_t)_task_bytes_func(node) : 0));
+        }
+    }
+    void _wait_for_batch();
     static void* _execute_tasks(void* arg);
     static void* _execute_tasks_pthread(void* arg);
 
@@ -246,6 +279,16 @@ private:
     butil::Mutex _mutex;
     butil::ConditionVariable _cond;
     TaskNode* _current_head; // Current task head of each execution.
+
+    // For bounded capacity and batching.
+    bool _track_pending;
+    task_bytes_func _task_bytes_func;
+    butil::atomic<int64_t> _pending_tasks;
+    butil::atomic<int64_t> _pending_bytes;
+    butil::atomic<int> _npending_waiters;
+    butil::atomic<int>* _pending_butex;
+    butil::atomic<bool> _batch_waiting;
+    butil::atomic<int>* _batch_butex;
 };
 
 template <typename T>
@@ -277,6 +320,11 @@ public:
         allocator::deallocate(node);
     }
 
+    static size_t task_bytes(TaskNode* node) {
+        return ExecutionQueueTaskBytes<T>::get(
+            *(const T*)allocator::get_allocated_mem(node));
+    }
+
     static int execute_task(void* meta, void* specific_function,
                             TaskIteratorBase& it) {
         execute_func_t f = (execute_func_t)specific_function;
@@ -286,7 +334,8 @@ public:
     inline static int create(id_t* id, const ExecutionQueueOptions* options,
                              execute_func_t execute_func, void* meta) {
         return Base::create(&id->value, options, execute_task, 
-                            clear_task_mem, meta, (void*)execute_func);
+                            clear_task_mem, task_bytes, meta,
+                            (void*)execute_func);
     }
 
     inline static scoped_ptr_t address(id_t id) WARN_UNUSED_RESULT {
@@ -315,13 +364,27 @@ public:
         if (stopped()) {
             return EINVAL;
         }
+        int64_t bytes = 0;
+        if (track_pending()) {
+            bytes = ExecutionQueueTaskBytes<T>::get(task);
+            const int rc = reserve_pending(bytes);
+            if (rc != 0) {
+                return rc;
+            }
+        }
         TaskNode* node = allocate_node();
         if (BAIDU_UNLIKELY(node == NULL)) {
+            if (track_pending()) {
+                cancel_pending(bytes);
+            }
             return ENOMEM;
         }
         void* const mem = allocator::allocate(node);
         if (BAIDU_UNLIKELY(!mem)) {
             return_task_node(node);
+            if (track_pending()) {
+                cancel_pending(bytes);
+            }
             return ENOMEM;
         }
         new (mem) T(std::forward<T>(task));
@@ -337,6 +400,9 @@ public:
             handle->version = node->version;
         }
         start_execute(node);
+        if (track_pending()) {
+            on_pending_pushed();
+        }
         return 0;
     }
 };
@@ -345,6 +411,11 @@ inline ExecutionQueueOptions::ExecutionQueueOptions()
     : use_pthread(false)
     , bthread_attr(BTHREAD_ATTR_NORMAL)
     , executor(NULL)
+    , max_pending_tasks(0)
+    , max_pending_bytes(0)
+    , block_when_full(false)
+    , min_batch_size(0)
+    , max_batch_delay_us(0)
 {}
 
 template <typename T>
@@ -0,0 +1,201 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// bthread - An M:N threading library to make applications more concurrent.
+
+#include <errno.h>
+#include <unistd.h>                      // pread, pwrite, fsync
+#include <pthread.h>
+#include <deque>
+#include <gflags/gflags.h>
+#include "butil/atomicops.h"
+#include "butil/logging.h"
+#include "butil/threading/platform_thread.h"
+#include "bthread/butex.h"
+#include "bthread/bthread.h"
+#include "bthread/file.h"
+
+namespace bthread {
+
+DEFINE_int32(bthread_file_io_threads, 4,
+             "Number of pthreads doing file io for bthread::file, created at "
+             "the first call. <= 0 makes the calls block the worker instead");
+
+namespace {
+
+enum FileOp {
+    FILE_OP_PREAD,
+    FILE_OP_PWRITE,
+    FILE_OP_FSYNC,
+};
+
+// On the stack of the calling bthread, which waits on `butex' until the
+// io thread sets it to 1.
+struct FileRequest {
+    FileOp op;
+    int fd;
+    void* buf;
+    size_t count;
+    off_t offset;
+    ssize_t result;
+    int error_code;
+    butil::atomic<int>* butex;
+};
+
+class FileIOPool {
+public:
+    FileIOPool() {
+        pthread_mutex_init(&_mutex, NULL);
+        pthread_cond_init(&_cond, NULL);
+    }
+
+    // Returns false if no io thread can be created.
+    bool start(int nthreads) {
+        int nstarted = 0;
+        for (int i = 0; i < nthreads; ++i) {
+            pthread_t th;
+            if (pthread_create(&th, NULL, run_io_thread, this) != 0) {
+                PLOG(ERROR) << "Fail to create file io thread";
+                continue;
+            }
+            pthread_detach(th);
+            ++nstarted;
+        }
+        return nstarted > 0;
+    }
+
+    void submit(FileRequest* req) {
+        pthread_mutex_lock(&_mutex);
+        _requests.push_back(req);
+        pthread_mutex_unlock(&_mutex);
+        pthread_cond_signal(&_cond);
+    }
+
+private:
+    static void* run_io_thread(void* arg) {
+        butil::PlatformThread::SetName("bthread_file_io");
+        FileIOPool* p = static_cast<FileIOPool*>(arg);
+        while (true) {
+            pthread_mutex_lock(&p->_mutex);
+            while (p->_requests.empty()) {
+                pthread_cond_wait(&p->_cond, &p->_mutex);
+            }
+            FileRequest* req = p->_requests.front();
+            p->_requests.pop_front();
+            pthread_mutex_unlock(&p->_mutex);
+            run(req);
+        }
+        return NULL;
+    }
+
+    static void run(FileRequest* req) {
+        ssize_t rc = -1;
+        switch (req->op) {
+        case FILE_OP_PREAD:
+            rc = ::pread(req->fd, req->buf, req->count, req->offset);
+            break;
+        case FILE_OP_PWRITE:
+            rc = ::pwrite(req->fd, req->buf, req->count, req->offset);
+            break;
+        case FILE_OP_FSYNC:
+            rc = ::fsync(req->fd);
+            break;
+        }
+        req->result = rc;
+        req->error_code = (rc < 0 ? errno : 0);
+        // `req' may be gone once butex is set. Butexes are never freed, so
+        // waking a destroyed one is at most a spurious wakeup.
+        butil::atomic<int>* butex = req->butex;
+        butex->store(1, butil::memory_order_release);
+        butex_wake(butex);
+    }
+
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+    std::deque<FileRequest*> _requests;
+};
+
+FileIOPool* g_file_io_pool = NULL;
+pthread_once_t g_file_io_pool_once = PTHREAD_ONCE_INIT;
+
+void create_file_io_pool() {
+    const int nthreads = FLAGS_bthread_file_io_threads;
+    if (nthreads <= 0) {
+        return;
+    }
+    FileIOPool* p = new FileIOPool;
+    if (!p->start(nthreads)) {
+        delete p;
+        return;
+    }
+    g_file_io_pool = p;
+}
+
+// Run `req' in the pool and wait for it. Returns false if `req' should be
+// run directly by the caller.
+bool run_in_pool(FileRequest* req) {
+    if (bthread_self() == INVALID_BTHREAD) {
+        return false;
+    }
+    pthread_once(&g_file_io_pool_once, create_file_io_pool);
+    if (g_file_io_pool == NULL) {
+        return false;
+    }
+    butil::atomic<int>* butex = butex_create_checked<butil::atomic<int> >();
+    butex->store(0, butil::memory_order_relaxed);
+    req->butex = butex;
+    g_file_io_pool->submit(req);
+    while (butex->load(butil::memory_order_acquire) == 0) {
+        // Keep waiting when interrupted since the io thread still uses `req'.
+        butex_wait(butex, 0, NULL);
+    }
+    butex_destroy(butex);
+    errno = req->error_code;
+    return true;
+}
+
+}  // namespace
+
+namespace file {
+
+ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+    FileRequest req = { FILE_OP_PREAD, fd, buf, count, offset, -1, 0, NULL };
+    if (!run_in_pool(&req)) {
+        return ::pread(fd, buf, count, offset);
+    }
+    return req.result;
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    FileRequest req = { FILE_OP_PWRITE, fd, const_cast<void*>(buf),
+                        count, offset, -1, 0, NULL };
+    if (!run_in_pool(&req)) {
+        return ::pwrite(fd, buf, count, offset);
+    }
+    return req.result;
+}
+
+int fsync(int fd) {
+    FileRequest req = { FILE_OP_FSYNC, fd, NULL, 0, 0, -1, 0, NULL };
+    if (!run_in_pool(&req)) {
+        return ::fsync(fd);
+    }
+    return static_cast<int>(req.result);
+}
+
+}  // namespace file
+}  // namespace bthread
@@ -0,0 +1,40 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// bthread - An M:N threading library to make applications more concurrent.
+
+#ifndef BTHREAD_FILE_H
+#define BTHREAD_FILE_H
+
+#include <sys/types.h>                   // ssize_t, off_t
+
+namespace bthread {
+namespace file {
+
+// Blocking file operations which don't block the worker running the
+// calling bthread: the syscall is done by one of -bthread_file_io_threads
+// pthreads while only the calling bthread is suspended. Called outside
+// bthreads or when the pool is disabled, the syscall is done directly.
+// Return values and errno are same with the corresponding syscalls.
+ssize_t pread(int fd, void* buf, size_t count, off_t offset);
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset);
+int fsync(int fd);
+
+}  // namespace file
+}  // namespace bthread
+
+#endif  // BTHREAD_FILE_H
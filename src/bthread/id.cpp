@@ -167,6 +167,43 @@ inline uint32_t get_version(bthread_id_t id) {
     return (uint32_t)(id.value & 0xFFFFFFFFul);
 }
 
+inline butil::atomic<uint32_t>* butex_atomic(uint32_t* butex) {
+    return (butil::atomic<uint32_t>*)butex;
+}
+
+// Lock an unlocked id without touching meta->mutex, which is the common case
+// of RPC: the id of a call is locked by responses, timeouts and retries one
+// after another rather than at the same time.
+// first_ver and locked_ver are read without the mutex, which is safe since
+// the butex is compared-and-swapped from first_ver: a successful exchange
+// means that the id was unlocked in the incarnation of `first_ver', in which
+// first_ver does not change and locked_ver only grows, so `id_ver' is still
+// valid. The butex may be set to a stale locked_ver if the range was reset
+// in the meantime, which is still a locked version.
+// Writers of the butex must compare-and-swap as well when the id is
+// unlocked, other changes are done by the lock owner.
+inline bool id_lock_fast(Id* meta, uint32_t id_ver) {
+    const uint32_t first_ver = meta->first_ver;
+    const uint32_t locked_ver = meta->locked_ver;
+    if (id_ver < first_ver || id_ver >= locked_ver) {
+        return false;
+    }
+    uint32_t expected = first_ver;
+    return butex_atomic(meta->butex)->compare_exchange_strong(
+        expected, locked_ver, butil::memory_order_acquire,
+        butil::memory_order_relaxed);
+}
+
+// Set the butex of an unlocked id to `locked_butex' when meta->mutex is
+// held. Returns false if the id is locked, possibly by id_lock_fast()
+// concurrently.
+inline bool id_lock_locked(Id* meta, uint32_t locked_butex) {
+    uint32_t expected = meta->first_ver;
+    return butex_atomic(meta->butex)->compare_exchange_strong(
+        expected, locked_butex, butil::memory_order_acquire,
+        butil::memory_order_relaxed);
+}
+
 inline bool id_exists_with_true_negatives(bthread_id_t id) {
     Id* const meta = address_resource(get_slot(id));
     if (meta == NULL) {
@@ -409,13 +446,19 @@ int bthread_id_lock_and_reset_range_verbose(
         return EINVAL;
     }
     const uint32_t id_ver = bthread::get_version(id);
+    if (range == 0 && bthread::id_lock_fast(meta, id_ver)) {
+        meta->lock_location = location;
+        if (pdata) {
+            *pdata = meta->data;
+        }
+        return 0;
+    }
     uint32_t* butex = meta->butex;
     bool ever_contended = false;
     meta->mutex.lock();
     while (meta->has_version(id_ver)) {
         if (*butex == meta->first_ver) {
-            // contended locker always wakes up the butex at unlock.
-            meta->lock_location = location;
+            uint32_t locked_ver = meta->locked_ver;
             if (range == 0) {
                 // fast path
             } else if (range < 0 ||
@@ -427,9 +470,15 @@ int bthread_id_lock_and_reset_range_verbose(
                     << "max range is " << bthread::ID_MAX_RANGE
                     << ", actually " << range;
             } else {
-                meta->locked_ver = meta->first_ver + range;
+                locked_ver = meta->first_ver + range;
+            }
+            // contended locker always wakes up the butex at unlock.
+            if (!bthread::id_lock_locked(
+                    meta, (ever_contended ? locked_ver + 1 : locked_ver))) {
+                continue;
             }
-            *butex = (ever_contended ? meta->contended_ver() : meta->locked_ver);
+            meta->locked_ver = locked_ver;
+            meta->lock_location = location;
             meta->mutex.unlock();
             if (pdata) {
                 *pdata = meta->data;
@@ -491,20 +540,19 @@ int bthread_id_cancel(bthread_id_t id) {
     if (!meta) {
         return EINVAL;
     }
-    uint32_t* butex = meta->butex;
     const uint32_t id_ver = bthread::get_version(id);
     meta->mutex.lock();
     if (!meta->has_version(id_ver)) {
         meta->mutex.unlock();
         return EINVAL;
     }
-    if (*butex != meta->first_ver) {
+    const uint32_t next_ver = meta->end_ver();
+    if (!bthread::id_lock_locked(meta, next_ver)) {
         meta->mutex.unlock();
         return EPERM;
-    }       
-    *butex = meta->end_ver();
-    meta->first_ver = *butex;
-    meta->locked_ver = *butex;
+    }
+    meta->first_ver = next_ver;
+    meta->locked_ver = next_ver;
     meta->mutex.unlock();
     return_resource(bthread::get_slot(id));
     return 0;
@@ -540,19 +588,19 @@ int bthread_id_trylock(bthread_id_t id, void** pdata) {
     if (!meta) {
         return EINVAL;
     }
-    uint32_t* butex = meta->butex;
     const uint32_t id_ver = bthread::get_version(id);
-    meta->mutex.lock();
-    if (!meta->has_version(id_ver)) {
-        meta->mutex.unlock();
-        return EINVAL;
-    }
-    if (*butex != meta->first_ver) {
+    if (!bthread::id_lock_fast(meta, id_ver)) {
+        meta->mutex.lock();
+        if (!meta->has_version(id_ver)) {
+            meta->mutex.unlock();
+            return EINVAL;
+        }
+        if (!bthread::id_lock_locked(meta, meta->locked_ver)) {
+            meta->mutex.unlock();
+            return EBUSY;
+        }
         meta->mutex.unlock();
-        return EBUSY;
     }
-    *butex = meta->locked_ver;
-    meta->mutex.unlock();
     if (pdata != NULL) {
         *pdata = meta->data;
     }
@@ -596,7 +644,9 @@ int bthread_id_unlock(bthread_id_t id) {
         }
     } else {
         const bool contended = (*butex == meta->contended_ver());
-        *butex = meta->first_ver;
+        // Release changes made in the critical section to id_lock_fast().
+        bthread::butex_atomic(butex)->store(meta->first_ver,
+                                            butil::memory_order_release);
         meta->mutex.unlock();
         if (contended) {
             // We may wake up already-reused id, but that's OK.
@@ -714,14 +764,12 @@ int bthread_id_error2_verbose(bthread_id_t id, int error_code,
         return EINVAL;
     }
     const uint32_t id_ver = bthread::get_version(id);
-    uint32_t* butex = meta->butex;
     meta->mutex.lock();
     if (!meta->has_version(id_ver)) {
         meta->mutex.unlock();
         return EINVAL;
     }
-    if (*butex == meta->first_ver) {
-        *butex = meta->locked_ver;
+    if (bthread::id_lock_locked(meta, meta->locked_ver)) {
         meta->lock_location = location;
         meta->mutex.unlock();
         if (meta->on_error) {
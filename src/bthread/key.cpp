@@ -20,6 +20,8 @@
 // Date: Sun Aug  3 12:46:15 CST 2014
 
 #include <pthread.h>
+#include <sched.h>
+#include <vector>
 #include <gflags/gflags.h>
 
 #include "bthread/errno.h"       // EAGAIN
@@ -51,6 +53,8 @@ class KeyTable;
 // defined in task_group.cpp
 extern __thread LocalStorage tls_bls;
 static __thread bool tls_ever_created_keytable = false;
+// Static slots of pthreads, bthreads have theirs in TaskMeta.
+static __thread void* tls_static_locals[BTHREAD_STATIC_LOCAL_SLOTS] = {};
 
 // We keep thread specific data in a two-level array. The top-level array
 // contains at most KEY_1STLEVEL_SIZE pointers to dynamically allocated
@@ -151,7 +155,7 @@ private:
 // Align with cacheline to avoid false sharing.
 class BAIDU_CACHELINE_ALIGNMENT KeyTable {
 public:
-    KeyTable() : next(NULL) {
+    KeyTable() : next(NULL), next_batch(NULL), batch_length(0) {
         memset(_subs, 0, sizeof(_subs));
         nkeytable.fetch_add(1, butil::memory_order_relaxed);
     }
@@ -215,16 +219,32 @@ public:
 
 public:
     KeyTable* next;
+    // Valid in the first KeyTable of a batch in the global free list.
+    KeyTable* next_batch;
+    uint32_t batch_length;
 private:
     SubKeyTable* _subs[KEY_1STLEVEL_SIZE];
 };
 
+// Free KeyTables of a pool cached by one thread. The mutex is only locked by
+// the owner thread and bthread_keytable_pool_destroy, thus never contended
+// in practice.
 class BAIDU_CACHELINE_ALIGNMENT KeyTableList {
 public:
     KeyTableList() :
-        _head(NULL), _tail(NULL), _length(0) {}
+        _head(NULL), _tail(NULL), _length(0) {
+        pthread_mutex_init(&_mutex, NULL);
+    }
 
     ~KeyTableList() {
+        clear();
+        pthread_mutex_destroy(&_mutex);
+    }
+
+    pthread_mutex_t& mutex() { return _mutex; }
+
+    // Delete all KeyTables.
+    void clear() {
         TaskGroup* g = BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_task_group);
         KeyTable* old_kt = tls_bls.keytable;
         KeyTable* keytable = _head;
@@ -245,6 +265,8 @@ public:
         if (g) {
             g->current_task()->local_storage.keytable = old_kt;
         }
+        _head = _tail = NULL;
+        _length = 0;
     }
 
     void append(KeyTable* keytable) {
@@ -319,53 +341,212 @@ public:
         return count == _length;
     }
 
+    // Detach first `size' KeyTables as a chain, NULL if there're not so
+    // many KeyTables.
+    KeyTable* remove_first_n(uint32_t size) {
+        KeyTable* first = NULL;
+        if (move_first_n_to_target(&first, size) == 0) {
+            return NULL;
+        }
+        return first;
+    }
+
 private:
+    pthread_mutex_t _mutex;
     KeyTable* _head;
     KeyTable* _tail;
     uint32_t _length;
 };
 
-KeyTable* borrow_keytable(bthread_keytable_pool_t* pool) {
-    if (pool != NULL && (pool->list || pool->free_keytables)) {
-        KeyTable* p;
-        pthread_rwlock_rdlock(&pool->rwlock);
-        auto list = (butil::ThreadLocal<bthread::KeyTableList>*)pool->list;
-        if (list) {
-            p = list->get()->remove_front();
-            if (p) {
-                pthread_rwlock_unlock(&pool->rwlock);
-                return p;
-            }
+// Fields of bthread_keytable_pool_t are modified concurrently without locks.
+inline butil::atomic<KeyTable*>* free_batches(bthread_keytable_pool_t* pool) {
+    return reinterpret_cast<butil::atomic<KeyTable*>*>(&pool->free_keytables);
+}
+inline butil::atomic<size_t>* free_size(bthread_keytable_pool_t* pool) {
+    return reinterpret_cast<butil::atomic<size_t>*>(&pool->size);
+}
+inline bool is_destroyed(bthread_keytable_pool_t* pool) {
+    return reinterpret_cast<butil::atomic<int>*>(&pool->destroyed)->load(
+        butil::memory_order_acquire);
+}
+
+// The global free list of a pool is a lock-free stack of batches, each batch
+// is a chain of KeyTables linked by `next'.
+static void push_batch(bthread_keytable_pool_t* pool, KeyTable* first,
+                       uint32_t n) {
+    first->batch_length = n;
+    // Count before pushing so that the size never underflows.
+    free_size(pool)->fetch_add(n, butil::memory_order_relaxed);
+    butil::atomic<KeyTable*>* head = free_batches(pool);
+    KeyTable* old_head = head->load(butil::memory_order_relaxed);
+    do {
+        first->next_batch = old_head;
+    } while (!head->compare_exchange_weak(old_head, first,
+                                          butil::memory_order_release,
+                                          butil::memory_order_relaxed));
+}
+
+// All batches are taken at once and the rest are pushed back, popping
+// the head only is subject to ABA problem.
+static KeyTable* pop_batch(bthread_keytable_pool_t* pool) {
+    butil::atomic<KeyTable*>* head = free_batches(pool);
+    if (head->load(butil::memory_order_relaxed) == NULL) {
+        return NULL;
+    }
+    KeyTable* first = head->exchange(NULL, butil::memory_order_acquire);
+    if (first == NULL) {
+        return NULL;
+    }
+    KeyTable* rest = first->next_batch;
+    first->next_batch = NULL;
+    if (rest != NULL) {
+        KeyTable* last = rest;
+        while (last->next_batch != NULL) {
+            last = last->next_batch;
         }
-        pthread_rwlock_unlock(&pool->rwlock);
-        if (pool->free_keytables) {
-            pthread_rwlock_wrlock(&pool->rwlock);
-            p = (KeyTable*)pool->free_keytables;
-            if (list) {
-                for (uint32_t i = 0; i < FLAGS_borrow_from_globle_size; ++i) {
-                    if (p) {
-                        pool->free_keytables = p->next;
-                        list->get()->append(p);
-                        p = (KeyTable*)pool->free_keytables;
-                        --pool->size;
-                    } else {
-                        break;
-                    }
-                }
-                KeyTable* result = list->get()->remove_front();
-                pthread_rwlock_unlock(&pool->rwlock);
-                return result;
-            } else {
-                if (p) {
-                    pool->free_keytables = p->next;
-                    pthread_rwlock_unlock(&pool->rwlock);
-                    return p;
-                }
-            }
-            pthread_rwlock_unlock(&pool->rwlock);
+        KeyTable* old_head = NULL;
+        while (!head->compare_exchange_weak(old_head, rest,
+                                            butil::memory_order_release,
+                                            butil::memory_order_relaxed)) {
+            last->next_batch = old_head;
         }
     }
-    return NULL;
+    free_size(pool)->fetch_sub(first->batch_length,
+                               butil::memory_order_relaxed);
+    return first;
+}
+
+inline KeyTableList* get_keytable_list(bthread_keytable_pool_t* pool) {
+    auto list = (butil::ThreadLocal<bthread::KeyTableList>*)pool->list;
+    return list ? list->get() : NULL;
+}
+
+// Every thread announces the pool whose KeyTableList it is using in a slot
+// written by itself only, so that bthread_keytable_pool_destroy can wait for
+// the users before deleting the lists without making borrowing and returning
+// contend on anything shared.
+struct BAIDU_CACHELINE_ALIGNMENT PoolUser {
+    butil::atomic<bthread_keytable_pool_t*> pool;
+};
+static pthread_mutex_t s_pool_users_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Slots are reused after their threads quit and never deleted.
+static std::vector<PoolUser*>* s_pool_users = NULL;
+static std::vector<PoolUser*>* s_free_pool_users = NULL;
+static __thread PoolUser* tls_pool_user = NULL;
+
+static void release_pool_user() {
+    BAIDU_SCOPED_LOCK(s_pool_users_mutex);
+    s_free_pool_users->push_back(tls_pool_user);
+    tls_pool_user = NULL;
+}
+
+static PoolUser* get_pool_user() {
+    if (tls_pool_user != NULL) {
+        return tls_pool_user;
+    }
+    PoolUser* user = NULL;
+    {
+        BAIDU_SCOPED_LOCK(s_pool_users_mutex);
+        if (s_pool_users == NULL) {
+            s_pool_users = new std::vector<PoolUser*>;
+            s_free_pool_users = new std::vector<PoolUser*>;
+        }
+        if (!s_free_pool_users->empty()) {
+            user = s_free_pool_users->back();
+            s_free_pool_users->pop_back();
+        } else {
+            user = new PoolUser;
+            user->pool.store(NULL, butil::memory_order_relaxed);
+            s_pool_users->push_back(user);
+        }
+    }
+    tls_pool_user = user;
+    butil::thread_atexit(release_pool_user);
+    return user;
+}
+
+static void wait_for_pool_users(bthread_keytable_pool_t* pool) {
+    std::vector<PoolUser*> users;
+    {
+        BAIDU_SCOPED_LOCK(s_pool_users_mutex);
+        if (s_pool_users == NULL) {
+            return;
+        }
+        users = *s_pool_users;
+    }
+    for (size_t i = 0; i < users.size(); ++i) {
+        while (users[i]->pool.load(butil::memory_order_seq_cst) == pool) {
+            sched_yield();
+        }
+    }
+}
+
+// Get KeyTableList of `pool' in this thread, which is not deleted before
+// the guard is destructed. NULL if the pool is destroyed.
+class KeyTableListGuard {
+public:
+    explicit KeyTableListGuard(bthread_keytable_pool_t* pool)
+        : _user(get_pool_user()), _list(NULL) {
+        _user->pool.store(pool, butil::memory_order_seq_cst);
+        // Pairs with the store in bthread_keytable_pool_destroy: either the
+        // destroyer sees this user or this user sees the destruction.
+        if (!reinterpret_cast<butil::atomic<int>*>(&pool->destroyed)->load(
+                butil::memory_order_seq_cst)) {
+            _list = get_keytable_list(pool);
+        }
+    }
+
+    ~KeyTableListGuard() {
+        _user->pool.store(NULL, butil::memory_order_release);
+    }
+
+    KeyTableList* list() const { return _list; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(KeyTableListGuard);
+    PoolUser* _user;
+    KeyTableList* _list;
+};
+
+// Free KeyTables are cached in thread-local lists of the pool and moved
+// from/to the global free list in batches, neither of which needs a global
+// lock.
+KeyTable* borrow_keytable(bthread_keytable_pool_t* pool) {
+    if (pool == NULL) {
+        return NULL;
+    }
+    KeyTableListGuard guard(pool);
+    KeyTableList* list = guard.list();
+    if (list == NULL) {
+        return NULL;
+    }
+    BAIDU_SCOPED_LOCK(list->mutex());
+    if (is_destroyed(pool)) {
+        return NULL;
+    }
+    KeyTable* p = list->remove_front();
+    if (p) {
+        return p;
+    }
+    p = pop_batch(pool);
+    if (p == NULL) {
+        return NULL;
+    }
+    KeyTable* result = p;
+    uint32_t n = p->batch_length - 1;
+    p = p->next;
+    result->next = NULL;
+    // Cache part of the batch in this thread and return the rest.
+    for (uint32_t i = 0; p != NULL && i < FLAGS_borrow_from_globle_size;
+         ++i, --n) {
+        KeyTable* next = p->next;
+        list->append(p);
+        p = next;
+    }
+    if (p != NULL) {
+        push_batch(pool, p, n);
+    }
+    return result;
 }
 
 // Referenced in task_group.cpp, must be extern.
@@ -374,29 +555,26 @@ void return_keytable(bthread_keytable_pool_t* pool, KeyTable* kt) {
     if (NULL == kt) {
         return;
     }
-    if (pool == NULL) {
-        delete kt;
-        return;
-    }
-    pthread_rwlock_rdlock(&pool->rwlock);
-    if (pool->destroyed) {
-        pthread_rwlock_unlock(&pool->rwlock);
-        delete kt;
-        return;
+    if (pool != NULL) {
+        KeyTableListGuard guard(pool);
+        KeyTableList* list = guard.list();
+        if (list != NULL) {
+            BAIDU_SCOPED_LOCK(list->mutex());
+            if (!is_destroyed(pool)) {
+                list->append(kt);
+                if (list->get_length() > FLAGS_key_table_list_size) {
+                    const uint32_t n = FLAGS_key_table_list_size / 2;
+                    KeyTable* batch = list->remove_first_n(n);
+                    if (batch != NULL) {
+                        push_batch(pool, batch, n);
+                    }
+                }
+                return;
+            }
+        }
     }
-    auto list = (butil::ThreadLocal<bthread::KeyTableList>*)pool->list;
-    list->get()->append(kt);
-    if (list->get()->get_length() > FLAGS_key_table_list_size) {
-        pthread_rwlock_unlock(&pool->rwlock);
-        pthread_rwlock_wrlock(&pool->rwlock);
-        if (!pool->destroyed) {
-            int out = list->get()->move_first_n_to_target(
-                (KeyTable**)(&pool->free_keytables),
-                FLAGS_key_table_list_size / 2);
-            pool->size += out;
-        }
-    }
-    pthread_rwlock_unlock(&pool->rwlock);
+    // Destructors of data in the KeyTable may use the list.
+    delete kt;
 }
 
 static void cleanup_pthread(void* arg) {
@@ -442,7 +620,6 @@ int bthread_keytable_pool_init(bthread_keytable_pool_t* pool) {
         LOG(ERROR) << "Param[pool] is NULL";
         return EINVAL;
     }
-    pthread_rwlock_init(&pool->rwlock, NULL);
     pool->list = new butil::ThreadLocal<bthread::KeyTableList>();
     pool->free_keytables = NULL;
     pool->size = 0;
@@ -450,42 +627,54 @@ int bthread_keytable_pool_init(bthread_keytable_pool_t* pool) {
     return 0;
 }
 
-int bthread_keytable_pool_destroy(bthread_keytable_pool_t* pool) {
-    if (pool == NULL) {
-        LOG(ERROR) << "Param[pool] is NULL";
-        return EINVAL;
-    }
-    bthread::KeyTable* saved_free_keytables = NULL;
-    pthread_rwlock_wrlock(&pool->rwlock);
-    pool->destroyed = 1;
-    pool->size = 0;
-    delete (butil::ThreadLocal<bthread::KeyTableList>*)pool->list;
-    saved_free_keytables = (bthread::KeyTable*)pool->free_keytables;
-    pool->list = NULL;
-    pool->free_keytables = NULL;
-    pthread_rwlock_unlock(&pool->rwlock);
-
+static void delete_keytables(bthread::KeyTable* batches) {
     // Cheat get/setspecific and destroy the keytables.
     bthread::TaskGroup* g =
         bthread::BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_task_group);
     bthread::KeyTable* old_kt = bthread::tls_bls.keytable;
-    while (saved_free_keytables) {
-        bthread::KeyTable* kt = saved_free_keytables;
-        saved_free_keytables = kt->next;
-        bthread::tls_bls.keytable = kt;
-        if (g) {
-            g->current_task()->local_storage.keytable = kt;
+    while (batches) {
+        bthread::KeyTable* kt = batches;
+        batches = kt->next_batch;
+        while (kt) {
+            bthread::KeyTable* next = kt->next;
+            bthread::tls_bls.keytable = kt;
+            if (g) {
+                g->current_task()->local_storage.keytable = kt;
+            }
+            delete kt;
+            g = bthread::BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_task_group);
+            kt = next;
         }
-        delete kt;
-        g = bthread::BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_task_group);
     }
     bthread::tls_bls.keytable = old_kt;
     if (g) {
         g->current_task()->local_storage.keytable = old_kt;
     }
-    // TODO: return_keytable may race with this function, we don't destroy
-    // the mutex right now.
-    // pthread_mutex_destroy(&pool->mutex);
+}
+
+int bthread_keytable_pool_destroy(bthread_keytable_pool_t* pool) {
+    if (pool == NULL) {
+        LOG(ERROR) << "Param[pool] is NULL";
+        return EINVAL;
+    }
+    reinterpret_cast<butil::atomic<int>*>(&pool->destroyed)->store(
+        1, butil::memory_order_seq_cst);
+    // Threads see `destroyed' after their lists are cleared.
+    auto list = (butil::ThreadLocal<bthread::KeyTableList>*)pool->list;
+    if (list) {
+        list->for_each([](bthread::KeyTableList* l) {
+            BAIDU_SCOPED_LOCK(l->mutex());
+            l->clear();
+        });
+        // Other threads may be using the lists right now.
+        bthread::wait_for_pool_users(pool);
+        pool->list = NULL;
+        delete list;
+    }
+    // No more KeyTables are pushed after the lists are cleared.
+    delete_keytables(bthread::free_batches(pool)->exchange(
+        NULL, butil::memory_order_acquire));
+    bthread::free_size(pool)->store(0, butil::memory_order_relaxed);
     return 0;
 }
 
@@ -495,9 +684,7 @@ int bthread_keytable_pool_getstat(bthread_keytable_pool_t* pool,
         LOG(ERROR) << "Param[pool] or Param[stat] is NULL";
         return EINVAL;
     }
-    pthread_rwlock_wrlock(&pool->rwlock);
-    stat->nfree = pool->size;
-    pthread_rwlock_unlock(&pool->rwlock);
+    stat->nfree = bthread::free_size(pool)->load(butil::memory_order_relaxed);
     return 0;
 }
 
@@ -506,21 +693,19 @@ int get_thread_local_keytable_list_length(bthread_keytable_pool_t* pool) {
         LOG(ERROR) << "Param[pool] is NULL";
         return EINVAL;
     }
-    int length = 0;
-    pthread_rwlock_rdlock(&pool->rwlock);
-    if (pool->destroyed) {
-        pthread_rwlock_unlock(&pool->rwlock);
-        return length;
+    bthread::KeyTableListGuard guard(pool);
+    bthread::KeyTableList* list = guard.list();
+    if (list == NULL) {
+        return 0;
     }
-    auto list = (butil::ThreadLocal<bthread::KeyTableList>*)pool->list;
-    if (list) {
-        length = (int)(list->get()->get_length());
-        if (!list->get()->check_length()) {
-            LOG(ERROR) << "Length is not equal";
-        }
+    BAIDU_SCOPED_LOCK(list->mutex());
+    if (bthread::is_destroyed(pool)) {
+        return 0;
+    }
+    if (!list->check_length()) {
+        LOG(ERROR) << "Length is not equal";
     }
-    pthread_rwlock_unlock(&pool->rwlock);
-    return length;
+    return (int)list->get_length();
 }
 
 // TODO: this is not strict `reserve' because we only check #free.
@@ -550,16 +735,11 @@ void bthread_keytable_pool_reserve(bthread_keytable_pool_t* pool,
             kt->set_data(key, data);
         }  // else append kt w/o data.
 
-        pthread_rwlock_wrlock(&pool->rwlock);
-        if (pool->destroyed) {
-            pthread_rwlock_unlock(&pool->rwlock);
+        if (bthread::is_destroyed(pool)) {
             delete kt;
             break;
         }
-        kt->next = (bthread::KeyTable*)pool->free_keytables;
-        pool->free_keytables = kt;
-        ++pool->size;
-        pthread_rwlock_unlock(&pool->rwlock);
+        bthread::push_batch(pool, kt, 1);
         if (data == NULL) {
             break;
         }
@@ -664,6 +844,32 @@ void* bthread_getspecific(bthread_key_t key) {
     return NULL;
 }
 
+int bthread_set_static_local(int slot, void* data) {
+    if (slot < 0 || slot >= BTHREAD_STATIC_LOCAL_SLOTS) {
+        return EINVAL;
+    }
+    bthread::TaskGroup* const g =
+        bthread::BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_task_group);
+    if (g) {
+        g->current_task()->static_locals[slot] = data;
+    } else {
+        bthread::tls_static_locals[slot] = data;
+    }
+    return 0;
+}
+
+void* bthread_get_static_local(int slot) {
+    if (slot < 0 || slot >= BTHREAD_STATIC_LOCAL_SLOTS) {
+        return NULL;
+    }
+    bthread::TaskGroup* const g =
+        bthread::BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_task_group);
+    if (g) {
+        return g->current_task()->static_locals[slot];
+    }
+    return bthread::tls_static_locals[slot];
+}
+
 void bthread_assign_data(void* data) {
     bthread::tls_bls.assigned_data = data;
 }
@@ -23,6 +23,8 @@
 #include <pthread.h>
 #include <dlfcn.h>                               // dlsym
 #include <fcntl.h>                               // O_RDONLY
+#include <algorithm>                             // std::min
+#include <gflags/gflags.h>
 #include "butil/atomicops.h"
 #include "bvar/bvar.h"
 #include "bvar/collector.h"
@@ -38,6 +40,7 @@
 #include "butil/third_party/murmurhash3/murmurhash3.h"
 #include "butil/third_party/symbolize/symbolize.h"
 #include "butil/logging.h"
+#include "butil/reloadable_flags.h"
 #include "butil/object_pool.h"
 #include "butil/debug/stack_trace.h"
 #include "butil/thread_local.h"
@@ -90,7 +93,7 @@ struct SampledContention : public bvar::Collected {
         }
         return _hash_code;
     }
-private:
+protected:
 friend butil::ObjectPool<SampledContention>;
     SampledContention()
         : duration_ns(0), count(0), stack{NULL}, nframes(0), _hash_code(0) {}
@@ -101,6 +104,25 @@ friend butil::ObjectPool<SampledContention>;
 
 BAIDU_CASSERT(sizeof(SampledContention) == 256, be_friendly_to_allocator);
 
+// For controlling waits collected per second.
+bvar::CollectorSpeedLimit g_wp_sl = BVAR_COLLECTOR_SPEED_LIMIT_INITIALIZER;
+
+// Time that a bthread is blocked in butex_wait(), from parking to being
+// woken up, sampled by the wait profiler. Written in the same format as
+// contentions.
+struct SampledWait : public SampledContention {
+    // Implement bvar::Collected
+    void dump_and_destroy(size_t round) override;
+    void destroy() override;
+    bvar::CollectorSpeedLimit* speed_limit() override { return &g_wp_sl; }
+private:
+friend butil::ObjectPool<SampledWait>;
+    SampledWait() = default;
+    ~SampledWait() override = default;
+};
+
+BAIDU_CASSERT(sizeof(SampledWait) == 256, be_friendly_to_allocator);
+
 // Functor to compare contentions.
 struct ContentionEqual {
     bool operator()(const SampledContention* c1,
@@ -315,6 +337,28 @@ void SampledContention::destroy() {
     butil::return_object(this);
 }
 
+// If wait profiler is on, this variable will be set with a valid instance.
+// NULL otherwise.
+BAIDU_CACHELINE_ALIGNMENT ContentionProfiler* g_wp = NULL;
+// Protecting accesses to g_wp.
+static pthread_mutex_t g_wp_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void SampledWait::dump_and_destroy(size_t /*round*/) {
+    if (g_wp) {
+        BAIDU_SCOPED_LOCK(g_wp_mutex);
+        if (g_wp) {
+            g_wp->dump_and_destroy(this);
+            return;
+        }
+    }
+    destroy();
+}
+
+void SampledWait::destroy() {
+    _hash_code = 0;
+    butil::return_object(this);
+}
+
 // Remember the conflict hashes for troubleshooting, should be 0 at most of time.
 static butil::static_atomic<int64_t> g_nconflicthash = BUTIL_STATIC_ATOMIC_INIT(0);
 static int64_t get_nconflicthash(void*) {
@@ -372,6 +416,46 @@ void ContentionProfilerStop() {
     LOG(ERROR) << "Contention profiler is not started!";
 }
 
+// Start profiling time that bthreads are blocked in butex_wait().
+bool WaitProfilerStart(const char* filename) {
+    if (filename == NULL) {
+        LOG(ERROR) << "Parameter [filename] is NULL";
+        return false;
+    }
+    if (g_wp) {
+        return false;
+    }
+    static bvar::DisplaySamplingRatio g_sampling_ratio_var(
+        "wait_profiler_sampling_ratio", &g_wp_sl);
+
+    std::unique_ptr<ContentionProfiler> ctx(new ContentionProfiler(filename));
+    {
+        BAIDU_SCOPED_LOCK(g_wp_mutex);
+        if (g_wp) {
+            return false;
+        }
+        g_wp = ctx.release();
+    }
+    return true;
+}
+
+// Stop wait profiler.
+void WaitProfilerStop() {
+    ContentionProfiler* ctx = NULL;
+    if (g_wp) {
+        std::unique_lock<pthread_mutex_t> mu(g_wp_mutex);
+        if (g_wp) {
+            ctx = g_wp;
+            g_wp = NULL;
+            mu.unlock();
+            ctx->init_if_needed();
+            delete ctx;
+            return;
+        }
+    }
+    LOG(ERROR) << "Wait profiler is not started!";
+}
+
 bool is_contention_site_valid(const bthread_contention_site_t& cs) {
     return bvar::is_sampling_range_valid(cs.sampling_range);
 }
@@ -624,7 +708,11 @@ inline bool remove_pthread_contention_site(const Mutex* mutex,
 }
 
 // Submit the contention along with the callsite('s stacktrace)
-void submit_contention(const bthread_contention_site_t& csite, int64_t now_ns) {
+// Inlined so that frames skipped by ContentionProfiler are the same for
+// all kinds of samples: the function submitting the sample and its caller.
+template <typename Sample>
+BUTIL_FORCE_INLINE void submit_sample(const bthread_contention_site_t& csite,
+                                      int64_t now_ns) {
     tls_inside_lock = true;
     BRPC_SCOPE_EXIT {
         tls_inside_lock = false;
@@ -639,14 +727,14 @@ void submit_contention(const bthread_contention_site_t& csite, int64_t now_ns) {
     // 1. Warn up some singleton objects used in `submit_contention'
     // to avoid deadlock in malloc call stack.
     // 2. LocalPool is empty, GlobalPool may allocate memory by malloc.
-    if (!tls_warn_up || butil::local_pool_free_empty<SampledContention>()) {
+    if (!tls_warn_up || butil::local_pool_free_empty<Sample>()) {
         // In malloc call stack, can not submit contention.
         if (stack.FindSymbol((void*)malloc)) {
             return;
         }
     }
 
-    auto sc = butil::get_object<SampledContention>();
+    auto sc = butil::get_object<Sample>();
     // Normalize duration_us and count so that they're addable in later
     // processings. Notice that sampling_range is adjusted periodically by
     // collecting thread.
@@ -659,6 +747,24 @@ void submit_contention(const bthread_contention_site_t& csite, int64_t now_ns) {
     tls_warn_up = true;
 }
 
+void submit_contention(const bthread_contention_site_t& csite, int64_t now_ns) {
+    submit_sample<SampledContention>(csite, now_ns);
+}
+
+// Called by butex_wait() before parking, returns an invalid sampling range
+// if the wait should not be sampled.
+size_t wait_sampling_range() {
+    if (!g_wp || tls_inside_lock) {
+        return bvar::INVALID_SAMPLING_RANGE;
+    }
+    return bvar::is_collectable(&g_wp_sl);
+}
+
+// Called by butex_wait() after being woken up.
+void submit_wait(const bthread_contention_site_t& csite, int64_t now_ns) {
+    submit_sample<SampledWait>(csite, now_ns);
+}
+
 #if BRPC_DEBUG_LOCK
 #define MUTEX_RESET_OWNER_COMMON(owner)                                              \
     ((butil::atomic<bool>*)&(owner).hold)                                            \
@@ -1049,6 +1155,45 @@ inline int mutex_trylock_impl(bthread_mutex_t* m) {
 
 const int MAX_SPIN_ITER = 4;
 
+DEFINE_int32(bthread_mutex_max_spin, 0,
+             "Maximum times of adaptive spinning before a contended "
+             "bthread_mutex_t sleeps, 0 disables adaptive spinning");
+BUTIL_VALIDATE_GFLAG(bthread_mutex_max_spin, butil::PassValidate);
+
+static bvar::Adder<int64_t> g_mutex_spin_hit("bthread_mutex_spin_hit");
+static bvar::Adder<int64_t> g_mutex_spin_miss("bthread_mutex_spin_miss");
+
+// Spin to acquire `m' like adaptive mutexes of glibc: at most
+// min(max_spin, 2 * spin_count + 10) tries where spin_count follows the
+// tries needed recently, so that mutexes held shortly spin long enough while
+// others give up quickly.
+// Returns true if the mutex is acquired.
+inline bool mutex_spin_lock(bthread_mutex_t* m, int max_spin) {
+    MutexInternal* split = (MutexInternal*)m->butex;
+    butil::atomic<int>* spin_count = (butil::atomic<int>*)&m->spin_count;
+    const int spins = spin_count->load(butil::memory_order_relaxed);
+    const int max_cnt = std::min(max_spin, spins * 2 + 10);
+    int cnt = 0;
+    bool locked = false;
+    while (cnt < max_cnt) {
+        ++cnt;
+        cpu_relax();
+        if (!split->locked.load(butil::memory_order_relaxed) &&
+            !split->locked.exchange(1, butil::memory_order_acquire)) {
+            locked = true;
+            break;
+        }
+    }
+    // Racy updates lose some samples only.
+    spin_count->store(spins + (cnt - spins) / 8, butil::memory_order_relaxed);
+    if (locked) {
+        g_mutex_spin_hit << 1;
+    } else {
+        g_mutex_spin_miss << 1;
+    }
+    return locked;
+}
+
 inline int mutex_lock_contended_impl(bthread_mutex_t* __restrict m,
                                      const struct timespec* __restrict abstime) {
     BTHREAD_MUTEX_CHECK_OWNER;
@@ -1056,8 +1201,18 @@ inline int mutex_lock_contended_impl(bthread_mutex_t* __restrict m,
     // Spin only few times and only if local `rq' is empty.
     TaskGroup* g = BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_task_group);
     if (BAIDU_UNLIKELY(NULL == g || g->rq_size() == 0)) {
-        for (int i = 0; i < MAX_SPIN_ITER; ++i) {
-            cpu_relax();
+        const int max_spin = FLAGS_bthread_mutex_max_spin;
+        if (max_spin > 0) {
+            // The time spent here is counted into the sampled contention,
+            // so the benefit of spinning shows up in /contention.
+            if (mutex_spin_lock(m, max_spin)) {
+                BTHREAD_MUTEX_SET_OWNER;
+                return 0;
+            }
+        } else {
+            for (int i = 0; i < MAX_SPIN_ITER; ++i) {
+                cpu_relax();
+            }
         }
     }
 
@@ -1088,6 +1243,60 @@ inline int mutex_lock_contended_impl(bthread_mutex_t* __restrict m,
     return 0;
 }
 
+struct MutexAsyncWaiter {
+    bthread_mutex_t* m;
+    void (*on_locked)(void*);
+    void* arg;
+};
+
+// Grab the mutex or queue `w' on the butex again.
+// Returns true if the mutex is locked, false if `w' is queued.
+static bool mutex_lock_or_wait_async(MutexAsyncWaiter* w);
+
+static void on_mutex_async_woken(void* arg) {
+    MutexAsyncWaiter* w = static_cast<MutexAsyncWaiter*>(arg);
+    if (mutex_lock_or_wait_async(w)) {
+        void (*on_locked)(void*) = w->on_locked;
+        void* const on_locked_arg = w->arg;
+        delete w;
+        on_locked(on_locked_arg);
+    }
+}
+
+static bool mutex_lock_or_wait_async(MutexAsyncWaiter* w) {
+    auto whole = (butil::atomic<unsigned>*)w->m->butex;
+    while (whole->exchange(BTHREAD_MUTEX_CONTENDED) & BTHREAD_MUTEX_LOCKED) {
+        if (butex_wait_async(whole, BTHREAD_MUTEX_CONTENDED,
+                             on_mutex_async_woken, w) == 0) {
+            return false;
+        }
+        if (errno != EWOULDBLOCK) {
+            // Out of memory, retry until the mutex is unlocked.
+            cpu_relax();
+        }
+    }
+    return true;
+}
+
+int mutex_lock_async(bthread_mutex_t* m, void (*on_locked)(void*), void* arg) {
+    if (0 == mutex_trylock_impl(m)) {
+        on_locked(arg);
+        return 0;
+    }
+    MutexAsyncWaiter* w = new (std::nothrow) MutexAsyncWaiter;
+    if (NULL == w) {
+        return ENOMEM;
+    }
+    w->m = m;
+    w->on_locked = on_locked;
+    w->arg = arg;
+    if (mutex_lock_or_wait_async(w)) {
+        delete w;
+        on_locked(arg);
+    }
+    return 0;
+}
+
 #ifdef BTHREAD_USE_FAST_PTHREAD_MUTEX
 namespace internal {
 
@@ -1194,6 +1403,7 @@ int bthread_mutex_init(bthread_mutex_t* __restrict m,
     }
     *m->butex = 0;
     m->enable_csite = NULL == attr ? true : attr->enable_csite;
+    m->spin_count = 0;
     return 0;
 }
 
@@ -40,6 +40,13 @@ __END_DECLS
 
 namespace bthread {
 
+// Lock |mutex| without blocking the calling thread: |on_locked|(|arg|) is
+// called with |mutex| held, either inside this function if the mutex is
+// free, or later in the thread unlocking it. Used by stackless coroutines
+// which can't suspend a bthread.
+// Returns 0 on success, ENOMEM otherwise and |on_locked| is not called.
+int mutex_lock_async(bthread_mutex_t* mutex, void (*on_locked)(void*), void* arg);
+
 // The C++ Wrapper of bthread_mutex
 
 // NOTE: Not aligned to cacheline as the container of Mutex is practically aligned
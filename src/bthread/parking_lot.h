@@ -62,6 +62,12 @@ public:
         return _pending_signal.load(butil::memory_order_acquire);
     }
 
+    // Returns true if signal() or stop() was called after `expected_state'
+    // was got, in which case wait() finishes directly.
+    bool changed(const State& expected_state) {
+        return get_state().val != expected_state.val;
+    }
+
     // Wait for tasks.
     // If the `expected_state' does not match, wait() may finish directly.
     void wait(const State& expected_state) {
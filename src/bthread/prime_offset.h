@@ -24,7 +24,7 @@
 namespace bthread {
 // Prime number offset for hash function.
 inline size_t prime_offset(size_t seed) {
-    uint32_t offsets[] = {
+    static const uint32_t offsets[] = {
         #include "bthread/offset_inl.list"
     };
     return offsets[seed % ARRAY_SIZE(offsets)];
@@ -22,60 +22,103 @@
 #ifndef BTHREAD_REMOTE_TASK_QUEUE_H
 #define BTHREAD_REMOTE_TASK_QUEUE_H
 
-#include "butil/containers/bounded_queue.h"
+#include <stdint.h>
+#include <new>                              // std::nothrow
+#include "butil/atomicops.h"
 #include "butil/macros.h"
+#include "bthread/types.h"
 
 namespace bthread {
 
 class TaskGroup;
 
-// A queue for storing bthreads created by non-workers. Since non-workers
-// randomly choose a TaskGroup to push which distributes the contentions,
-// this queue is simply implemented as a queue protected with a lock.
+// A queue for storing bthreads created by non-workers. Non-workers push
+// into a randomly chosen TaskGroup, the owner and stealing workers pop.
+// Implemented as a bounded MPMC ring (by Dmitry Vyukov) so that neither
+// side takes a lock: each cell carries a sequence number telling whether
+// it's ready for the push or the pop at a position, pushers and poppers
+// claim positions by CAS on _tail and _head respectively.
 // The function names should be self-explanatory.
 class RemoteTaskQueue {
 public:
-    RemoteTaskQueue() {}
+    RemoteTaskQueue() : _cells(NULL), _mask(0), _tail(0), _head(0) {}
+    ~RemoteTaskQueue() { delete [] _cells; }
 
+    // Capacity is rounded up to power of 2.
     int init(size_t cap) {
-        const size_t memsize = sizeof(bthread_t) * cap;
-        void* q_mem = malloc(memsize);
-        if (q_mem == NULL) {
+        size_t n = 1;
+        while (n < cap) {
+            n <<= 1;
+        }
+        Cell* cells = new (std::nothrow) Cell[n];
+        if (cells == NULL) {
             return -1;
         }
-        butil::BoundedQueue<bthread_t> q(q_mem, memsize, butil::OWNS_STORAGE);
-        _tasks.swap(q);
+        for (size_t i = 0; i < n; ++i) {
+            cells[i].seq.store(i, butil::memory_order_relaxed);
+        }
+        delete [] _cells;
+        _cells = cells;
+        _mask = n - 1;
         return 0;
     }
 
+    // A task being pushed concurrently may be invisible to pop() until
+    // the push returns.
     bool pop(bthread_t* task) {
-        if (_tasks.empty()) {
-            return false;
+        size_t pos = _head.load(butil::memory_order_relaxed);
+        while (true) {
+            Cell& c = _cells[pos & _mask];
+            const size_t seq = c.seq.load(butil::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (_head.compare_exchange_weak(
+                        pos, pos + 1, butil::memory_order_relaxed)) {
+                    *task = c.task;
+                    c.seq.store(pos + _mask + 1, butil::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // empty
+            } else {
+                pos = _head.load(butil::memory_order_relaxed);
+            }
         }
-        _mutex.lock();
-        const bool result = _tasks.pop(task);
-        _mutex.unlock();
-        return result;
     }
 
     bool push(bthread_t task) {
-        _mutex.lock();
-        const bool res = push_locked(task);
-        _mutex.unlock();
-        return res;
+        size_t pos = _tail.load(butil::memory_order_relaxed);
+        while (true) {
+            Cell& c = _cells[pos & _mask];
+            const size_t seq = c.seq.load(butil::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (_tail.compare_exchange_weak(
+                        pos, pos + 1, butil::memory_order_relaxed)) {
+                    c.task = task;
+                    c.seq.store(pos + 1, butil::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // full
+            } else {
+                pos = _tail.load(butil::memory_order_relaxed);
+            }
+        }
     }
 
-    bool push_locked(bthread_t task) {
-        return _tasks.push(task);
-    }
+    size_t capacity() const { return _mask + 1; }
 
-    size_t capacity() const { return _tasks.capacity(); }
-    
 private:
-friend class TaskGroup;
     DISALLOW_COPY_AND_ASSIGN(RemoteTaskQueue);
-    butil::BoundedQueue<bthread_t> _tasks;
-    butil::Mutex _mutex;
+    struct Cell {
+        butil::atomic<size_t> seq;
+        bthread_t task;
+    };
+    Cell* _cells;
+    size_t _mask;
+    butil::atomic<size_t> BAIDU_CACHELINE_ALIGNMENT _tail;
+    butil::atomic<size_t> BAIDU_CACHELINE_ALIGNMENT _head;
 };
 
 }  // namespace bthread
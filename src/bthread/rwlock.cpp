@@ -15,6 +15,8 @@
 // specific language governing permissions and limitations
 // under the License.
 
+#include <stdlib.h>
+#include "butil/thread_local.h"
 #include "bvar/collector.h"
 #include "bthread/rwlock.h"
 #include "bthread/butex.h"
@@ -290,6 +292,161 @@ static inline int rwlock_unlock(bthread_rwlock_t* rwlock) {
     }
 }
 
+// Number of reader slots of DistributedRWLock. Pthreads beyond this number
+// share slots, which is still correct since only the sum matters.
+static const int DISTRIBUTED_RWLOCK_SLOTS = 64;
+
+struct BAIDU_CACHELINE_ALIGNMENT DistributedRWLock::Slot {
+    butil::atomic<int64_t> readers;
+};
+
+static butil::static_atomic<int> g_next_rwlock_slot = BUTIL_STATIC_ATOMIC_INIT(0);
+static BAIDU_THREAD_LOCAL int tls_rwlock_slot = -1;
+
+// Slots are assigned to pthreads rather than bthreads: a bthread may be
+// stolen by another worker, yet counters are only touched by one core at a
+// time if pthreads don't share slots.
+static inline int rwlock_slot_index() {
+    int index = tls_rwlock_slot;
+    if (BAIDU_UNLIKELY(index < 0)) {
+        index = g_next_rwlock_slot.fetch_add(1, butil::memory_order_relaxed)
+            % DISTRIBUTED_RWLOCK_SLOTS;
+        tls_rwlock_slot = index;
+    }
+    return index;
+}
+
+DistributedRWLock::DistributedRWLock()
+    : _slots(NULL)
+    , _writer(false)
+    , _wlocked(false)
+    , _reader_butex(butex_create_checked<butil::atomic<int> >())
+    , _writer_butex(butex_create_checked<butil::atomic<int> >()) {
+    void* mem = NULL;
+    const int rc = posix_memalign(&mem, BAIDU_CACHELINE_SIZE,
+                                  sizeof(Slot) * DISTRIBUTED_RWLOCK_SLOTS);
+    if (rc) {
+        throw std::system_error(std::error_code(rc, std::system_category()),
+                                "DistributedRWLock constructor failed");
+    }
+    _slots = (Slot*)mem;
+    for (int i = 0; i < DISTRIBUTED_RWLOCK_SLOTS; ++i) {
+        _slots[i].readers.store(0, butil::memory_order_relaxed);
+    }
+    _reader_butex->store(0, butil::memory_order_relaxed);
+    _writer_butex->store(0, butil::memory_order_relaxed);
+    bthread_mutex_init(&_write_mutex, NULL);
+}
+
+DistributedRWLock::~DistributedRWLock() {
+    bthread_mutex_destroy(&_write_mutex);
+    butex_destroy(_writer_butex);
+    butex_destroy(_reader_butex);
+    free(_slots);
+}
+
+int64_t DistributedRWLock::reader_count() const {
+    int64_t n = 0;
+    for (int i = 0; i < DISTRIBUTED_RWLOCK_SLOTS; ++i) {
+        n += _slots[i].readers.load(butil::memory_order_seq_cst);
+    }
+    return n;
+}
+
+// Readers and the writer follow a store-then-load protocol: a reader
+// increases its counter and then checks _writer, while the writer sets
+// _writer and then sums counters, so that at least one of them sees the
+// other with sequentially consistent ordering.
+int DistributedRWLock::rdlock_impl(const struct timespec* abstime) {
+    butil::atomic<int64_t>& readers = _slots[rwlock_slot_index()].readers;
+    while (true) {
+        readers.fetch_add(1, butil::memory_order_seq_cst);
+        if (BAIDU_LIKELY(!_writer.load(butil::memory_order_seq_cst))) {
+            return 0;
+        }
+        // Back off for the writer which may be waiting for this counter.
+        unrdlock();
+        const int expected = _reader_butex->load(butil::memory_order_acquire);
+        if (!_writer.load(butil::memory_order_seq_cst)) {
+            continue;
+        }
+        if (butex_wait(_reader_butex, expected, abstime) < 0 &&
+            errno == ETIMEDOUT) {
+            return ETIMEDOUT;
+        }
+    }
+}
+
+bool DistributedRWLock::try_rdlock() {
+    _slots[rwlock_slot_index()].readers.fetch_add(1, butil::memory_order_seq_cst);
+    if (BAIDU_LIKELY(!_writer.load(butil::memory_order_seq_cst))) {
+        return true;
+    }
+    unrdlock();
+    return false;
+}
+
+// The counter decreased may be in a different slot from the one increased
+// when the bthread was stolen by another worker in the critical section.
+void DistributedRWLock::unrdlock() {
+    _slots[rwlock_slot_index()].readers.fetch_sub(1, butil::memory_order_seq_cst);
+    if (_writer.load(butil::memory_order_seq_cst)) {
+        _writer_butex->fetch_add(1, butil::memory_order_release);
+        butex_wake(_writer_butex);
+    }
+}
+
+int DistributedRWLock::wrlock_impl(const struct timespec* abstime) {
+    const int rc = abstime ? bthread_mutex_timedlock(&_write_mutex, abstime)
+                           : bthread_mutex_lock(&_write_mutex);
+    if (rc) {
+        return rc;
+    }
+    _writer.store(true, butil::memory_order_seq_cst);
+    while (true) {
+        const int expected = _writer_butex->load(butil::memory_order_acquire);
+        if (reader_count() == 0) {
+            break;
+        }
+        if (butex_wait(_writer_butex, expected, abstime) < 0 &&
+            errno == ETIMEDOUT) {
+            unwrlock();
+            return ETIMEDOUT;
+        }
+    }
+    _wlocked.store(true, butil::memory_order_relaxed);
+    return 0;
+}
+
+bool DistributedRWLock::try_wrlock() {
+    if (bthread_mutex_trylock(&_write_mutex) != 0) {
+        return false;
+    }
+    _writer.store(true, butil::memory_order_seq_cst);
+    if (reader_count() != 0) {
+        unwrlock();
+        return false;
+    }
+    _wlocked.store(true, butil::memory_order_relaxed);
+    return true;
+}
+
+void DistributedRWLock::unwrlock() {
+    _wlocked.store(false, butil::memory_order_relaxed);
+    _writer.store(false, butil::memory_order_seq_cst);
+    _reader_butex->fetch_add(1, butil::memory_order_release);
+    butex_wake_all(_reader_butex);
+    bthread_mutex_unlock(&_write_mutex);
+}
+
+void DistributedRWLock::unlock() {
+    if (_wlocked.load(butil::memory_order_relaxed)) {
+        unwrlock();
+    } else {
+        unrdlock();
+    }
+}
+
 } // namespace bthread
 
 __BEGIN_DECLS
@@ -21,6 +21,7 @@
 #include "bthread/types.h"
 #include "bthread/bthread.h"
 #include "butil/scoped_lock.h"
+#include "butil/atomicops.h"
 
 namespace bthread {
 
@@ -156,6 +157,56 @@ private:
     bthread_rwlock_t* _rwlock;
 };
 
+// A rwlock for data which is read far more often than written, e.g. routing
+// tables or configurations read by every request. All readers of RWLock
+// modify the same counter which bounces between cores under heavy reading,
+// while a reader of DistributedRWLock only modifies the counter in the slot
+// of its pthread and reads a flag which is rarely written. In return,
+// writers are much more expensive: a writer sets the flag to hold off new
+// readers and waits until counters in all slots drain. Pending writers are
+// preferred over new readers. Not reentrant.
+class DistributedRWLock {
+public:
+    DistributedRWLock();
+    ~DistributedRWLock();
+    DISALLOW_COPY_AND_ASSIGN(DistributedRWLock);
+
+    void rdlock() { rdlock_impl(NULL); }
+    bool try_rdlock();
+    bool timed_rdlock(const struct timespec* abstime) {
+        return 0 == rdlock_impl(abstime);
+    }
+
+    void wrlock() { wrlock_impl(NULL); }
+    bool try_wrlock();
+    bool timed_wrlock(const struct timespec* abstime) {
+        return 0 == wrlock_impl(abstime);
+    }
+
+    // Release the read or write lock held by the caller.
+    void unlock();
+
+private:
+    struct Slot;
+
+    int rdlock_impl(const struct timespec* abstime);
+    int wrlock_impl(const struct timespec* abstime);
+    void unrdlock();
+    void unwrlock();
+    int64_t reader_count() const;
+
+    Slot* _slots;
+    // Set when a writer is waiting for readers or holding the lock.
+    butil::atomic<bool> _writer;
+    butil::atomic<bool> _wlocked;
+    // Bumped when the writer releases the lock, waited by readers.
+    butil::atomic<int>* _reader_butex;
+    // Bumped when a reader leaves while _writer is set, waited by the writer.
+    butil::atomic<int>* _writer_butex;
+    // Serializes writers.
+    bthread_mutex_t _write_mutex;
+};
+
 } // namespace bthread
 
 namespace std {
@@ -214,6 +265,26 @@ private:
     std::lock_guard<bthread_rwlock_t> _rwlock_guard;
 };
 
+template <>
+class lock_guard<bthread::DistributedRWLock> {
+public:
+    lock_guard(bthread::DistributedRWLock& rwlock, bool read)
+        : _rwlock(&rwlock) {
+        if (read) {
+            _rwlock->rdlock();
+        } else {
+            _rwlock->wrlock();
+        }
+    }
+
+    ~lock_guard() { _rwlock->unlock(); }
+
+    DISALLOW_COPY_AND_ASSIGN(lock_guard);
+
+private:
+    bthread::DistributedRWLock* _rwlock;
+};
+
 } // namespace std
 
 #endif  //BTHREAD_RWLOCK_H
@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// bthread - An M:N threading library to make applications more concurrent.
+
+#include "bthread/sharded_execution_queue.h"
+
+namespace bthread {
+
+FixedBthreadExecutor::FixedBthreadExecutor() : _stop(false) {}
+
+FixedBthreadExecutor::~FixedBthreadExecutor() {
+    stop_and_join();
+}
+
+int FixedBthreadExecutor::start(size_t nthreads, const bthread_attr_t* attr) {
+    if (nthreads == 0) {
+        return EINVAL;
+    }
+    std::unique_lock<bthread::Mutex> lck(_mutex);
+    if (!_workers.empty() || _stop) {
+        return EINVAL;
+    }
+    _workers.reserve(nthreads);
+    for (size_t i = 0; i < nthreads; ++i) {
+        bthread_t tid;
+        const int rc = bthread_start_background(&tid, attr, run_worker, this);
+        if (rc != 0) {
+            lck.unlock();
+            stop_and_join();
+            return rc;
+        }
+        _workers.push_back(tid);
+    }
+    return 0;
+}
+
+int FixedBthreadExecutor::submit(void * (*fn)(void*), void* args) {
+    std::unique_lock<bthread::Mutex> lck(_mutex);
+    if (_stop || _workers.empty()) {
+        return -1;
+    }
+    Task task = { fn, args };
+    _tasks.push_back(task);
+    lck.unlock();
+    _cond.notify_one();
+    return 0;
+}
+
+void FixedBthreadExecutor::stop_and_join() {
+    std::vector<bthread_t> workers;
+    {
+        std::unique_lock<bthread::Mutex> lck(_mutex);
+        _stop = true;
+        workers.swap(_workers);
+    }
+    _cond.notify_all();
+    for (size_t i = 0; i < workers.size(); ++i) {
+        bthread_join(workers[i], NULL);
+    }
+}
+
+void* FixedBthreadExecutor::run_worker(void* arg) {
+    FixedBthreadExecutor* e = static_cast<FixedBthreadExecutor*>(arg);
+    std::unique_lock<bthread::Mutex> lck(e->_mutex);
+    while (true) {
+        while (e->_tasks.empty() && !e->_stop) {
+            e->_cond.wait(lck);
+        }
+        if (e->_tasks.empty()) {
+            // Stopped and no more tasks.
+            break;
+        }
+        const Task task = e->_tasks.front();
+        e->_tasks.pop_front();
+        lck.unlock();
+        task.fn(task.args);
+        lck.lock();
+    }
+    return NULL;
+}
+
+}  // namespace bthread
@@ -0,0 +1,224 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// bthread - An M:N threading library to make applications more concurrent.
+
+#ifndef BTHREAD_SHARDED_EXECUTION_QUEUE_H
+#define BTHREAD_SHARDED_EXECUTION_QUEUE_H
+
+#include <deque>
+#include <vector>
+#include "bthread/execution_queue.h"
+#include "bthread/mutex.h"
+#include "bthread/condition_variable.h"
+#include "butil/third_party/murmurhash3/murmurhash3.h"   // fmix64
+
+namespace bthread {
+
+// Executor running submitted functions on a fixed number of bthreads.
+// Functions are taken in FIFO order by whichever bthread is idle.
+class FixedBthreadExecutor : public Executor {
+public:
+    FixedBthreadExecutor();
+    ~FixedBthreadExecutor();
+
+    // Start `nthreads' bthreads with attributes `attr'(NULL means default).
+    // Returns 0 on success, errno otherwise.
+    int start(size_t nthreads, const bthread_attr_t* attr);
+
+    // Returns 0 on success, -1 if the executor is not started or stopped.
+    int submit(void * (*fn)(void*), void* args) override;
+
+    // Run all submitted functions, then quit and join the bthreads.
+    void stop_and_join();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(FixedBthreadExecutor);
+    struct Task {
+        void * (*fn)(void*);
+        void* args;
+    };
+    static void* run_worker(void* arg);
+
+    bthread::Mutex _mutex;
+    bthread::ConditionVariable _cond;
+    std::deque<Task> _tasks;
+    bool _stop;
+    std::vector<bthread_t> _workers;
+};
+
+// ShardedExecutionQueue keeps tasks of the same key in order while running
+// tasks of different keys in parallel. Keys are hashed to one of N lanes,
+// each lane is an ExecutionQueue. Instead of a consumer bthread per lane,
+// lanes with tasks are run by a fixed pool of consumer bthreads, an idle
+// consumer runs any ready lane.
+//
+// Example:
+//   bthread::ShardedExecutionQueue<Update> q;
+//   q.start(1024/*nlanes*/, 8/*nconsumers*/, NULL, apply_updates, &db);
+//   q.execute(user_id, update);
+//   ...
+//   q.stop();
+//   q.join();
+//
+// NOTE: |execute| is called with TaskIterator::is_queue_stopped() being true
+// once for each lane, release |meta| after join() instead.
+template <typename T>
+class ShardedExecutionQueue {
+public:
+    typedef int (*execute_func_t)(void* meta, TaskIterator<T>& iter);
+
+    ShardedExecutionQueue() : _joined(false) {}
+    // Stop and join the queue if it's not joined yet.
+    ~ShardedExecutionQueue();
+
+    // Start `nlanes' lanes run by `nconsumers' bthreads. Options other than
+    // |executor| and |use_pthread| apply to each lane, and |bthread_attr| is
+    // also used by the consumers.
+    // Returns 0 on success, errno otherwise.
+    int start(size_t nlanes, size_t nconsumers,
+              const ExecutionQueueOptions* options,
+              execute_func_t execute, void* meta);
+
+    // Execute `task' in the lane of `key', see execution_queue_execute().
+    int execute(uint64_t key,
+                typename butil::add_const_reference<T>::type task,
+                const TaskOptions* options = NULL,
+                TaskHandle* handle = NULL);
+    int execute(uint64_t key, T&& task,
+                const TaskOptions* options = NULL,
+                TaskHandle* handle = NULL);
+
+    // Stop all lanes, see execution_queue_stop().
+    int stop();
+
+    // Wait until all lanes are stopped and consumers quit.
+    int join();
+
+    size_t lane_count() const { return _lanes.size(); }
+    size_t lane_of(uint64_t key) const { return butil::fmix64(key) % _lanes.size(); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ShardedExecutionQueue);
+
+    std::vector<ExecutionQueueId<T> > _lanes;
+    FixedBthreadExecutor _executor;
+    bool _joined;
+};
+
+template <typename T>
+ShardedExecutionQueue<T>::~ShardedExecutionQueue() {
+    if (!_lanes.empty() && !_joined) {
+        stop();
+        join();
+    }
+}
+
+template <typename T>
+int ShardedExecutionQueue<T>::start(size_t nlanes, size_t nconsumers,
+                                    const ExecutionQueueOptions* options,
+                                    execute_func_t execute, void* meta) {
+    if (nlanes == 0 || nconsumers == 0 || execute == NULL || !_lanes.empty()) {
+        return EINVAL;
+    }
+    ExecutionQueueOptions opt;
+    if (options != NULL) {
+        if (options->executor != NULL || options->use_pthread) {
+            return EINVAL;
+        }
+        opt = *options;
+    }
+    const int rc = _executor.start(nconsumers, &opt.bthread_attr);
+    if (rc != 0) {
+        return rc;
+    }
+    opt.executor = &_executor;
+    _lanes.resize(nlanes);
+    for (size_t i = 0; i < nlanes; ++i) {
+        const int rc2 = execution_queue_start(&_lanes[i], &opt, execute, meta);
+        if (rc2 != 0) {
+            for (size_t j = 0; j < i; ++j) {
+                execution_queue_stop(_lanes[j]);
+                execution_queue_join(_lanes[j]);
+            }
+            _lanes.clear();
+            _executor.stop_and_join();
+            return rc2;
+        }
+    }
+    return 0;
+}
+
+template <typename T>
+int ShardedExecutionQueue<T>::execute(
+        uint64_t key, typename butil::add_const_reference<T>::type task,
+        const TaskOptions* options, TaskHandle* handle) {
+    if (_lanes.empty()) {
+        return EINVAL;
+    }
+    return execution_queue_execute(_lanes[lane_of(key)], task, options, handle);
+}
+
+template <typename T>
+int ShardedExecutionQueue<T>::execute(uint64_t key, T&& task,
+                                      const TaskOptions* options,
+                                      TaskHandle* handle) {
+    if (_lanes.empty()) {
+        return EINVAL;
+    }
+    return execution_queue_execute(_lanes[lane_of(key)], std::forward<T>(task),
+                                   options, handle);
+}
+
+template <typename T>
+int ShardedExecutionQueue<T>::stop() {
+    if (_lanes.empty()) {
+        return EINVAL;
+    }
+    int rc = 0;
+    for (size_t i = 0; i < _lanes.size(); ++i) {
+        const int rc2 = execution_queue_stop(_lanes[i]);
+        if (rc2 != 0) {
+            rc = rc2;
+        }
+    }
+    return rc;
+}
+
+template <typename T>
+int ShardedExecutionQueue<T>::join() {
+    if (_lanes.empty()) {
+        return EINVAL;
+    }
+    if (_joined) {
+        return 0;
+    }
+    int rc = 0;
+    for (size_t i = 0; i < _lanes.size(); ++i) {
+        const int rc2 = execution_queue_join(_lanes[i]);
+        if (rc2 != 0) {
+            rc = rc2;
+        }
+    }
+    _executor.stop_and_join();
+    _joined = true;
+    return rc;
+}
+
+}  // namespace bthread
+
+#endif  // BTHREAD_SHARDED_EXECUTION_QUEUE_H
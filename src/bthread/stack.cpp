@@ -23,11 +23,14 @@
 #include <sys/mman.h>                             // mmap, munmap, mprotect
 #include <algorithm>                              // std::max
 #include <stdlib.h>                               // posix_memalign
+#include "butil/build_config.h"                    // OS_MACOSX
 #include "butil/macros.h"                          // BAIDU_CASSERT
 #include "butil/memory/singleton_on_pthread_once.h"
 #include "butil/third_party/dynamic_annotations/dynamic_annotations.h" // RunningOnValgrind
 #include "butil/third_party/valgrind/valgrind.h"   // VALGRIND_STACK_REGISTER
+#include "butil/reloadable_flags.h"
 #include "bvar/passive_status.h"
+#include "bvar/reducer.h"
 #include "bthread/types.h"                        // BTHREAD_STACKTYPE_*
 #include "bthread/stack.h"
 
@@ -37,6 +40,10 @@ DEFINE_int32(stack_size_large, 8388608, "size of large stacks");
 DEFINE_int32(guard_page_size, 4096, "size of guard page, allocate stacks by malloc if it's 0(not recommended)");
 DEFINE_int32(tc_stack_small, 32, "maximum small stacks cached by each thread");
 DEFINE_int32(tc_stack_normal, 8, "maximum normal stacks cached by each thread");
+DEFINE_int32(stack_trim_watermark, 0, "When a stack returned to the pool "
+             "was used deeper than so many bytes, release its pages beyond "
+             "that depth with madvise. 0 disables trimming");
+BUTIL_VALIDATE_GFLAG(stack_trim_watermark, butil::PassValidate);
 
 namespace bthread {
 
@@ -53,6 +60,16 @@ static int64_t get_stack_count(void*) {
 static bvar::PassiveStatus<int64_t> bvar_stack_count(
     "bthread_stack_count", get_stack_count, NULL);
 
+// Bytes released from pooled stacks of each type by trim_stack_storage().
+static bvar::Adder<int64_t> bvar_small_stack_released_rss(
+    "bthread_small_stack_released_rss");
+static bvar::Adder<int64_t> bvar_normal_stack_released_rss(
+    "bthread_normal_stack_released_rss");
+static bvar::Adder<int64_t> bvar_large_stack_released_rss(
+    "bthread_large_stack_released_rss");
+// Times of trimming pooled stacks.
+static bvar::Adder<int64_t> bvar_stack_trim_count("bthread_stack_trim_count");
+
 int allocate_stack_storage(StackStorage* s, int stacksize_in, int guardsize_in) {
     const static int PAGESIZE = getpagesize();
     const int PAGESIZE_M1 = PAGESIZE - 1;
@@ -146,6 +163,81 @@ void deallocate_stack_storage(StackStorage* s) {
     }
 }
 
+// Value of the word at the watermark of a stack which is not used deeper
+// than the watermark since last marking.
+static const uint64_t STACK_WATERMARK_CANARY = 0x5ca1ab1edeadbeefULL;
+
+// Returns address of the canary word of `s', NULL when trimming is disabled
+// or not applicable to `s'.
+static uint64_t* stack_watermark(const StackStorage* s) {
+    const int watermark_in = FLAGS_stack_trim_watermark;
+    // Only stacks allocated by mmap can be released page by page.
+    if (watermark_in <= 0 || s->guardsize == 0 || s->bottom == NULL) {
+        return NULL;
+    }
+    const static int PAGESIZE = getpagesize();
+    const int PAGESIZE_M1 = PAGESIZE - 1;
+    const unsigned watermark = (watermark_in + PAGESIZE_M1) & ~PAGESIZE_M1;
+    if (watermark >= s->stacksize) {
+        return NULL;
+    }
+    // The lowest word above the watermark. Stacks grow downwards, the word
+    // is overwritten once the stack reaches the watermark.
+    return (uint64_t*)((char*)s->bottom - watermark);
+}
+
+void mark_stack_watermark(StackStorage* s) {
+    uint64_t* canary = stack_watermark(s);
+    if (canary != NULL) {
+        *canary = STACK_WATERMARK_CANARY;
+    }
+}
+
+void trim_stack_storage(StackStorage* s, int stacktype) {
+    uint64_t* canary = stack_watermark(s);
+    if (canary == NULL || *canary == STACK_WATERMARK_CANARY) {
+        return;
+    }
+    const static int PAGESIZE = getpagesize();
+    char* const begin = (char*)s->bottom - s->stacksize;
+    const size_t len = (char*)canary - begin;
+    // Count resident pages to be released, in chunks to bound the vector.
+    int64_t nresident = 0;
+#if defined(OS_MACOSX)
+    char vec[256];
+#else
+    unsigned char vec[256];
+#endif
+    const size_t CHUNK = sizeof(vec) * PAGESIZE;
+    for (size_t off = 0; off < len; off += CHUNK) {
+        const size_t n = std::min(CHUNK, len - off);
+        if (mincore(begin + off, n, vec) != 0) {
+            break;
+        }
+        for (size_t i = 0; i < (n + PAGESIZE - 1) / PAGESIZE; ++i) {
+            nresident += (vec[i] & 1);
+        }
+    }
+    if (madvise(begin, len, MADV_DONTNEED) != 0) {
+        PLOG_EVERY_SECOND(ERROR) << "Fail to madvise " << (void*)begin
+                                 << " length=" << len;
+        return;
+    }
+    *canary = STACK_WATERMARK_CANARY;
+    bvar_stack_trim_count << 1;
+    switch (stacktype) {
+    case STACK_TYPE_SMALL:
+        bvar_small_stack_released_rss << nresident * PAGESIZE;
+        break;
+    case STACK_TYPE_NORMAL:
+        bvar_normal_stack_released_rss << nresident * PAGESIZE;
+        break;
+    case STACK_TYPE_LARGE:
+        bvar_large_stack_released_rss << nresident * PAGESIZE;
+        break;
+    }
+}
+
 int* SmallStackClass::stack_size_flag = &FLAGS_stack_size_small;
 int* NormalStackClass::stack_size_flag = &FLAGS_stack_size_normal;
 int* LargeStackClass::stack_size_flag = &FLAGS_stack_size_large;
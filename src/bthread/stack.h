@@ -52,6 +52,13 @@ int allocate_stack_storage(StackStorage* s, int stacksize, int guardsize);
 // Deallocate a piece of stack. Parameters MUST be returned or set by the
 // corresponding allocate_stack_storage() otherwise behavior is undefined.
 void deallocate_stack_storage(StackStorage* s);
+// Write the canary at the watermark(-stack_trim_watermark) of a piece of
+// stack allocated by allocate_stack_storage(). No-op if trimming is disabled.
+void mark_stack_watermark(StackStorage* s);
+// Release pages of a piece of stack beyond the watermark if the canary was
+// overwritten, namely the stack was used deeper than the watermark. The
+// stack MUST not be in use.
+void trim_stack_storage(StackStorage* s, int stacktype);
 
 enum StackType {
     STACK_TYPE_MAIN = 0,
@@ -132,6 +132,7 @@ template <typename StackClass> struct StackFactory {
             }
             context = bthread_make_fcontext(storage.bottom, storage.stacksize, entry);
             stacktype = (StackType)StackClass::stacktype;
+            mark_stack_watermark(&storage);
             // It's poisoned prior to use.
             BTHREAD_ASAN_POISON_MEMORY_REGION(storage);
         }
@@ -154,6 +155,8 @@ template <typename StackClass> struct StackFactory {
     }
     
     static void return_stack(ContextualStack* cs) {
+        // Release pages touched by deep calls before pooling the stack.
+        trim_stack_storage(&cs->storage, StackClass::stacktype);
         // Marks stack as unaddressable.
         BTHREAD_ASAN_POISON_MEMORY_REGION(cs->storage);
         butil::return_object(static_cast<Wrapper*>(cs));
@@ -20,6 +20,8 @@
 // Date: Tue Jul 10 17:40:58 CST 2012
 
 #include <pthread.h>
+#include <algorithm>                       // std::find
+#include <sched.h>                         // sched_getcpu
 #include <set>
 #include <regex>
 #include <sys/syscall.h>                   // SYS_gettid
@@ -33,6 +35,8 @@
 #include "bthread/processor.h"            // cpu_relax
 #include "bthread/task_group.h"           // TaskGroup
 #include "bthread/task_control.h"
+#include "bthread/cpu_topology.h"         // CpuTopology
+#include "bthread/cpu_quota.h"            // get_allowed_cpus
 #include "bthread/timer_thread.h"         // global_timer_thread
 #include <gflags/gflags.h>
 #include "bthread/log.h"
@@ -57,6 +61,22 @@ DEFINE_bool(parking_lot_no_signal_when_no_waiter, false,
             "ParkingLot doesn't signal when there is no waiter. "
             "In busy worker scenarios, signal overhead can be reduced.");
 DEFINE_bool(enable_bthread_priority_queue, false, "Whether to enable priority queue");
+DEFINE_bool(bthread_steal_by_topology, false,
+            "Steal tasks from workers sharing L3 cache first, then workers in "
+            "the same NUMA node, then workers in other nodes, read at "
+            "initialization");
+DEFINE_int32(bthread_worker_budget, 0,
+             "Max active workers of all tags, workers are moved between tags "
+             "according to their load and the idle ones are parked. "
+             "<= 0 disables moving, read at initialization");
+DEFINE_int32(bthread_worker_scaling_interval_ms, 500,
+             "Interval of checking load of tags for moving workers");
+DEFINE_double(bthread_worker_busy_utilization, 0.8,
+              "A tag with tasks queued or stolen is given more workers when "
+              "its workers are busier than this ratio of time");
+DEFINE_double(bthread_worker_idle_utilization, 0.3,
+              "A tag without tasks queued gives up workers when its workers "
+              "are busy less than this ratio of time");
 
 DECLARE_int32(bthread_concurrency);
 DECLARE_int32(bthread_min_concurrency);
@@ -66,6 +86,7 @@ extern pthread_mutex_t g_task_control_mutex;
 extern BAIDU_THREAD_LOCAL TaskGroup* tls_task_group;
 void (*g_worker_startfn)() = NULL;
 void (*g_tagged_worker_startfn)(bthread_tag_t) = NULL;
+bool (*g_worker_idlefn)() = NULL;
 
 // May be called in other modules to run startfn in non-worker pthreads.
 void run_worker_startfn() {
@@ -112,6 +133,7 @@ void* TaskControl::worker_thread(void* arg) {
     if (!c->_cpus.empty()) {
         bind_thread_to_cpu(pthread_self(), c->_cpus[worker_id % c->_cpus.size()]);
     }
+    c->update_group_location(g);
     if (FLAGS_task_group_set_worker_name) {
         std::string worker_thread_name = butil::string_printf(
             "brpc_wkr:%d-%d", g->tag(), worker_id);
@@ -184,10 +206,20 @@ static int64_t get_cumulated_signal_count_from_this(void *arg) {
     return static_cast<TaskControl*>(arg)->get_cumulated_signal_count();
 }
 
+static int64_t get_cumulated_spin_hit_count_from_this(void *arg) {
+    return static_cast<TaskControl*>(arg)->get_cumulated_spin_hit_count();
+}
+
+static int64_t get_cumulated_park_count_from_this(void *arg) {
+    return static_cast<TaskControl*>(arg)->get_cumulated_park_count();
+}
+
 TaskControl::TaskControl()
     // NOTE: all fileds must be initialized before the vars.
     : _tagged_ngroup(FLAGS_task_group_ntags)
     , _tagged_groups(FLAGS_task_group_ntags)
+    , _tagged_parked(FLAGS_task_group_ntags)
+    , _tagged_nparked(FLAGS_task_group_ntags)
     , _init(false)
     , _stop(false)
     , _concurrency(0)
@@ -202,8 +234,16 @@ TaskControl::TaskControl()
     , _switch_per_second(&_cumulated_switch_count)
     , _cumulated_signal_count(get_cumulated_signal_count_from_this, this)
     , _signal_per_second(&_cumulated_signal_count)
+    , _cumulated_spin_hit_count(get_cumulated_spin_hit_count_from_this, this)
+    , _spin_hit_per_second(&_cumulated_spin_hit_count)
+    , _cumulated_park_count(get_cumulated_park_count_from_this, this)
+    , _park_per_second(&_cumulated_park_count)
     , _status(print_rq_sizes_in_the_tc, this)
     , _nbthreads("bthread_count")
+    , _topology(NULL)
+    , _scaling_tid()
+    , _scaling_started(false)
+    , _scaling_stop(0)
     , _enable_priority_queue(FLAGS_enable_bthread_priority_queue)
     , _priority_queues(FLAGS_task_group_ntags)
     , _pl_num_of_each_tag(FLAGS_bthread_parking_lot_of_each_tag)
@@ -226,6 +266,26 @@ int TaskControl::init(int concurrency) {
             LOG(ERROR) << "invalid cpuset=" << FLAGS_cpu_set;
             return -1;
         }
+        // Binding to cpus outside the cpuset of the container fails.
+        std::vector<int> allowed;
+        if (get_allowed_cpus(&allowed) == 0) {
+            std::vector<unsigned> cpus;
+            for (size_t i = 0; i < _cpus.size(); ++i) {
+                if (std::binary_search(allowed.begin(), allowed.end(),
+                                       (int)_cpus[i])) {
+                    cpus.push_back(_cpus[i]);
+                } else {
+                    LOG(WARNING) << "Ignore cpu " << _cpus[i]
+                                 << " in cpu_set which is not allowed";
+                }
+            }
+            if (cpus.empty()) {
+                LOG(ERROR) << "None of cpuset=" << FLAGS_cpu_set
+                           << " is allowed";
+                return -1;
+            }
+            _cpus.swap(cpus);
+        }
     }
 
     // task group group by tags
@@ -238,12 +298,28 @@ int TaskControl::init(int concurrency) {
         _tagged_worker_usage_second.push_back(new bvar::PerSecond<bvar::PassiveStatus<double>>(
             "bthread_worker_usage", tag_str, _tagged_cumulated_worker_time[i], 1));
         _tagged_nbthreads.push_back(new bvar::Adder<int64_t>("bthread_count", tag_str));
+        _tagged_sched_latency.push_back(new SchedLatency(tag_str));
+        _tagged_nparked[i].store(0, butil::memory_order_relaxed);
+        _tagged_nparked_workers.push_back(
+            new bvar::Adder<int64_t>("bthread_worker_parked_count", tag_str));
         if (_priority_queues[i].init(BTHREAD_MAX_CONCURRENCY) != 0) {
             LOG(ERROR) << "Fail to init _priority_q";
             return -1;
         }
     }
 
+#if defined(OS_LINUX)
+    if (FLAGS_bthread_steal_by_topology) {
+        // NULL on hosts with only one L3 cache, where locality is meaningless.
+        _topology = CpuTopology::instance();
+        if (_topology) {
+            _nsteal_same_l3.expose("bthread_steal_same_l3_count");
+            _nsteal_same_node.expose("bthread_steal_same_node_count");
+            _nsteal_cross_node.expose("bthread_steal_cross_node_count");
+        }
+    }
+#endif
+
     // Make sure TimerThread is ready.
     if (get_or_create_global_timer_thread() == NULL) {
         LOG(ERROR) << "Fail to get global_timer_thread";
@@ -270,6 +346,8 @@ int TaskControl::init(int concurrency) {
     _worker_usage_second.expose("bthread_worker_usage");
     _switch_per_second.expose("bthread_switch_second");
     _signal_per_second.expose("bthread_signal_second");
+    _spin_hit_per_second.expose("bthread_spin_hit_second");
+    _park_per_second.expose("bthread_park_second");
     _status.expose("bthread_group_status");
 
     // Wait for at least one group is added so that choose_one_group()
@@ -285,6 +363,15 @@ int TaskControl::init(int concurrency) {
 
     _init.store(true, butil::memory_order_release);
 
+    if (FLAGS_bthread_worker_budget > 0) {
+        const int rc = pthread_create(&_scaling_tid, NULL, scaling_thread, this);
+        if (rc) {
+            LOG(ERROR) << "Fail to create scaling thread: " << berror(rc);
+            return -1;
+        }
+        _scaling_started = true;
+    }
+
     return 0;
 }
 
@@ -409,6 +496,13 @@ void TaskControl::stop_and_join() {
     // which cannot be woken up by signal_task below)
     CHECK_EQ(0, stop_and_join_epoll_threads());
 
+    if (_scaling_started) {
+        _scaling_stop.store(1, butil::memory_order_release);
+        futex_wake_private(&_scaling_stop, 1);
+        pthread_join(_scaling_tid, NULL);
+        _scaling_started = false;
+    }
+
     // Stop workers
     {
         BAIDU_SCOPED_LOCK(_modify_group_mutex);
@@ -416,6 +510,14 @@ void TaskControl::stop_and_join() {
         std::for_each(
             _tagged_ngroup.begin(), _tagged_ngroup.end(),
             [](butil::atomic<size_t>& index) { index.store(0, butil::memory_order_relaxed); });
+        // Wake up parked workers, which see _stop and quit.
+        for (auto& parked : _tagged_parked) {
+            for (TaskGroup* g : parked) {
+                g->_park_requested.store(false, butil::memory_order_relaxed);
+                g->_park_futex.fetch_add(1, butil::memory_order_release);
+                futex_wake_private(&g->_park_futex, 1);
+            }
+        }
     }
     for (int i = 0; i < FLAGS_task_group_ntags; ++i) {
         for (auto& pl : _tagged_pl[i]) {
@@ -444,6 +546,8 @@ TaskControl::~TaskControl() {
     _worker_usage_second.hide();
     _switch_per_second.hide();
     _signal_per_second.hide();
+    _spin_hit_per_second.hide();
+    _park_per_second.hide();
     _status.hide();
     
     stop_and_join();
@@ -525,6 +629,62 @@ int TaskControl::_destroy_group(TaskGroup* g) {
     return 0;
 }
 
+void TaskControl::update_group_location(TaskGroup* g) {
+#if defined(OS_LINUX)
+    if (_topology == NULL) {
+        return;
+    }
+    const int cpu = sched_getcpu();
+    g->_l3_id.store(_topology->l3_of(cpu), butil::memory_order_relaxed);
+    g->_numa_node.store(_topology->node_of(cpu), butil::memory_order_relaxed);
+#endif
+}
+
+bool TaskControl::steal_task_by_topology(bthread_t* tid, size_t* seed,
+                                         size_t offset, TaskGroup* self,
+                                         size_t ngroup) {
+    // Workers are not always bound to cpus, refresh the location.
+    update_group_location(self);
+    const int l3 = self->_l3_id.load(butil::memory_order_relaxed);
+    const int node = self->_numa_node.load(butil::memory_order_relaxed);
+    bvar::Adder<int64_t>* const nstolen[] = {
+        &_nsteal_same_l3, &_nsteal_same_node, &_nsteal_cross_node };
+    auto& groups = tag_group(self->tag());
+    // level 0: same L3, 1: same node but different L3, 2: other nodes.
+    // Groups with unknown location are treated as remote. Other nodes are
+    // always swept before giving up, since the caller parks on failure and
+    // tasks there would wait until their own workers get to them.
+    for (int level = 0; level < 3; ++level) {
+        size_t s = *seed;
+        for (size_t i = 0; i < ngroup; ++i, s += offset) {
+            TaskGroup* g = groups[s % ngroup];
+            // g is possibly NULL because of concurrent _destroy_group
+            if (g == NULL) {
+                continue;
+            }
+            int glevel = 2;
+            if (l3 != -1 && g->_l3_id.load(butil::memory_order_relaxed) == l3) {
+                glevel = 0;
+            } else if (node != -1 &&
+                       g->_numa_node.load(butil::memory_order_relaxed) == node) {
+                glevel = 1;
+            }
+            if (glevel != level) {
+                continue;
+            }
+            if (g->_rq.steal(tid) || g->_remote_rq.pop(tid)) {
+                *seed = s;
+                *nstolen[level] << 1;
+                return true;
+            }
+        }
+        if (level == 0) {
+            *seed = s;
+        }
+    }
+    return false;
+}
+
 bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset) {
     auto tag = tls_task_group->tag();
 
@@ -538,6 +698,9 @@ bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset) {
     if (0 == ngroup) {
         return false;
     }
+    if (_topology != NULL) {
+        return steal_task_by_topology(tid, seed, offset, tls_task_group, ngroup);
+    }
 
     // NOTE: Don't return inside `for' iteration since we need to update |seed|
     bool stolen = false;
@@ -561,6 +724,202 @@ bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset) {
     return stolen;
 }
 
+bool TaskControl::park_group(TaskGroup* g, bthread_t* tid) {
+    const bthread_tag_t tag = g->tag();
+    if (!g->_parked) {
+        BAIDU_SCOPED_LOCK(_modify_group_mutex);
+        auto& groups = tag_group(tag);
+        const size_t ngroup = tag_ngroup(tag).load(butil::memory_order_relaxed);
+        size_t i = 0;
+        for (; i < ngroup && groups[i] != g; ++i) {}
+        // unpark_one_worker() may have withdrawn the request after the
+        // caller saw it and before we got the lock. Parking now would leave
+        // nobody to wake this group.
+        if (!g->_park_requested.load(butil::memory_order_relaxed)) {
+            return false;
+        }
+        // Keep at least one active worker so that choose_one_group() never
+        // returns NULL.
+        if (_stop || i == ngroup || ngroup <= 1) {
+            g->_park_requested.store(false, butil::memory_order_relaxed);
+            return false;
+        }
+        // Same as _destroy_group.
+        groups[i] = groups[ngroup - 1];
+        tag_ngroup(tag).store(ngroup - 1, butil::memory_order_release);
+        _tagged_parked[tag].push_back(g);
+        _tagged_nparked[tag].fetch_add(1, butil::memory_order_relaxed);
+        *_tagged_nparked_workers[tag] << 1;
+        g->_parked = true;
+    }
+    const int64_t parked_us = butil::monotonic_time_us();
+    while (true) {
+        // Read the futex before checking the request: unpark_one_worker()
+        // clears the request before bumping the futex, so either we see the
+        // request cleared or futex_wait() returns at once.
+        const int expected = g->_park_futex.load(butil::memory_order_acquire);
+        // Callers of choose_one_group() may push tasks into g->_remote_rq
+        // after g was removed from the tag. Run them before sleeping.
+        if (g->_remote_rq.pop(tid)) {
+            return true;
+        }
+        if (!g->_park_requested.load(butil::memory_order_relaxed)) {
+            break;
+        }
+        // Check _remote_rq periodically until nobody could be holding g, the
+        // delay is the same as deleting TaskGroups.
+        timespec check_interval = butil::milliseconds_to_timespec(10);
+        const bool settled = (butil::monotonic_time_us() - parked_us >=
+                              FLAGS_task_group_delete_delay * 1000000L);
+        futex_wait_private(&g->_park_futex, expected,
+                           settled ? NULL : &check_interval);
+    }
+    std::unique_lock<butil::Mutex> mu(_modify_group_mutex);
+    auto& parked = _tagged_parked[tag];
+    parked.erase(std::find(parked.begin(), parked.end(), g));
+    _tagged_nparked[tag].fetch_sub(1, butil::memory_order_relaxed);
+    *_tagged_nparked_workers[tag] << -1;
+    g->_parked = false;
+    if (_stop) {
+        return false;
+    }
+    const size_t ngroup = _tagged_ngroup[tag].load(butil::memory_order_relaxed);
+    _tagged_groups[tag][ngroup] = g;
+    _tagged_ngroup[tag].store(ngroup + 1, butil::memory_order_release);
+    return false;
+}
+
+void* TaskControl::scaling_thread(void* arg) {
+    butil::PlatformThread::SetNameSimple("brpc_wkr_scaler");
+    static_cast<TaskControl*>(arg)->run_scaling();
+    return NULL;
+}
+
+bool TaskControl::park_one_worker(bthread_tag_t tag) {
+    BAIDU_SCOPED_LOCK(_modify_group_mutex);
+    auto& groups = tag_group(tag);
+    const size_t ngroup = tag_ngroup(tag).load(butil::memory_order_relaxed);
+    TaskGroup* victim = NULL;
+    size_t nactive = 0;
+    for (size_t i = 0; i < ngroup; ++i) {
+        if (!groups[i]->_park_requested.load(butil::memory_order_relaxed)) {
+            victim = groups[i];
+            ++nactive;
+        }
+    }
+    if (nactive <= 1) {
+        return false;
+    }
+    // The worker parks itself when it runs out of tasks. If it's sleeping
+    // in ParkingLot, it uses no cpu before being parked anyway.
+    victim->_park_requested.store(true, butil::memory_order_relaxed);
+    return true;
+}
+
+bool TaskControl::unpark_one_worker(bthread_tag_t tag) {
+    {
+        BAIDU_SCOPED_LOCK(_modify_group_mutex);
+        auto& groups = tag_group(tag);
+        const size_t ngroup = tag_ngroup(tag).load(butil::memory_order_relaxed);
+        for (size_t i = 0; i < ngroup; ++i) {
+            if (groups[i]->_park_requested.exchange(
+                    false, butil::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        for (TaskGroup* g : _tagged_parked[tag]) {
+            if (g->_park_requested.exchange(false, butil::memory_order_relaxed)) {
+                g->_park_futex.fetch_add(1, butil::memory_order_release);
+                futex_wake_private(&g->_park_futex, 1);
+                return true;
+            }
+        }
+    }
+    BAIDU_SCOPED_LOCK(g_task_control_mutex);
+    const int added = add_workers(1, tag);
+    FLAGS_bthread_concurrency += added;
+    return added == 1;
+}
+
+void TaskControl::run_scaling() {
+    const int ntags = FLAGS_task_group_ntags;
+    std::vector<int64_t> last_cputime_ns(ntags, 0);
+    std::vector<int64_t> last_nsteal(ntags, 0);
+    std::vector<double> utilization(ntags, 0);
+    std::vector<bool> has_pending(ntags, false);
+    std::vector<int> nactive(ntags, 0);
+    int64_t last_ns = 0;
+    while (!_scaling_stop.load(butil::memory_order_acquire)) {
+        const int64_t now_ns = butil::monotonic_time_ns();
+        int total_active = 0;
+        {
+            BAIDU_SCOPED_LOCK(_modify_group_mutex);
+            for (int tag = 0; tag < ntags; ++tag) {
+                int64_t cputime_ns = 0;
+                int64_t nsteal = 0;
+                int64_t nqueued = 0;
+                int n = 0;
+                auto& groups = tag_group(tag);
+                const size_t ngroup =
+                    tag_ngroup(tag).load(butil::memory_order_relaxed);
+                for (size_t i = 0; i < ngroup; ++i) {
+                    TaskGroup* g = groups[i];
+                    cputime_ns += g->cumulated_cputime_ns();
+                    nsteal += g->_nsteal;
+                    nqueued += g->_rq.volatile_size();
+                    n += !g->_park_requested.load(butil::memory_order_relaxed);
+                }
+                for (TaskGroup* g : _tagged_parked[tag]) {
+                    cputime_ns += g->cumulated_cputime_ns();
+                    nsteal += g->_nsteal;
+                }
+                if (last_ns != 0 && ngroup != 0) {
+                    utilization[tag] = (double)(cputime_ns - last_cputime_ns[tag]) /
+                        (now_ns - last_ns) / ngroup;
+                }
+                has_pending[tag] = (nqueued > 0 || nsteal != last_nsteal[tag]);
+                last_cputime_ns[tag] = cputime_ns;
+                last_nsteal[tag] = nsteal;
+                nactive[tag] = n;
+                total_active += n;
+            }
+        }
+        if (last_ns != 0) {
+            // The busiest tag with pending tasks and the idlest tag.
+            int hot = -1;
+            int cold = -1;
+            for (int tag = 0; tag < ntags; ++tag) {
+                if (has_pending[tag] &&
+                    utilization[tag] >= FLAGS_bthread_worker_busy_utilization &&
+                    (hot < 0 || utilization[tag] > utilization[hot])) {
+                    hot = tag;
+                }
+                if (nactive[tag] > 1 &&
+                    (cold < 0 || utilization[tag] < utilization[cold])) {
+                    cold = tag;
+                }
+            }
+            if (total_active > FLAGS_bthread_worker_budget) {
+                if (cold >= 0) {
+                    park_one_worker(cold);
+                }
+            } else if (hot >= 0) {
+                if (total_active < FLAGS_bthread_worker_budget) {
+                    unpark_one_worker(hot);
+                } else if (cold >= 0 && cold != hot && !has_pending[cold] &&
+                           utilization[cold] <= FLAGS_bthread_worker_idle_utilization &&
+                           park_one_worker(cold)) {
+                    unpark_one_worker(hot);
+                }
+            }
+        }
+        last_ns = now_ns;
+        timespec interval = butil::milliseconds_to_timespec(
+            std::max(FLAGS_bthread_worker_scaling_interval_ms, 1));
+        futex_wait_private(&_scaling_stop, 0, &interval);
+    }
+}
+
 void TaskControl::signal_task(int num_task, bthread_tag_t tag) {
     if (num_task <= 0) {
         return;
@@ -615,9 +974,11 @@ void TaskControl::print_rq_sizes(std::ostream& os) {
 double TaskControl::get_cumulated_worker_time() {
     int64_t cputime_ns = 0;
     BAIDU_SCOPED_LOCK(_modify_group_mutex);
-    for_each_task_group([&](TaskGroup* g) {
+    auto add_cputime = [&](TaskGroup* g) {
         cputime_ns += g->cumulated_cputime_ns();
-    });
+    };
+    for_each_task_group(add_cputime);
+    for_each_parked_task_group(add_cputime);
     return cputime_ns / 1000000000.0;
 }
 
@@ -629,28 +990,62 @@ double TaskControl::get_cumulated_worker_time(bthread_tag_t tag) {
     for (size_t i = 0; i < ngroup; ++i) {
         cputime_ns += groups[i]->cumulated_cputime_ns();
     }
+    for (TaskGroup* g : _tagged_parked[tag]) {
+        cputime_ns += g->cumulated_cputime_ns();
+    }
     return cputime_ns / 1000000000.0;
 }
 
 int64_t TaskControl::get_cumulated_switch_count() {
     int64_t c = 0;
     BAIDU_SCOPED_LOCK(_modify_group_mutex);
-    for_each_task_group([&](TaskGroup* g) {
+    auto add_nswitch = [&](TaskGroup* g) {
         if (g) {
             c += g->_nswitch;
         }
-    });
+    };
+    for_each_task_group(add_nswitch);
+    for_each_parked_task_group(add_nswitch);
     return c;
 }
 
 int64_t TaskControl::get_cumulated_signal_count() {
     int64_t c = 0;
     BAIDU_SCOPED_LOCK(_modify_group_mutex);
-    for_each_task_group([&](TaskGroup* g) {
+    auto add_nsignaled = [&](TaskGroup* g) {
         if (g) {
-            c += g->_nsignaled + g->_remote_nsignaled;
+            c += g->_nsignaled +
+                g->_remote_nsignaled.load(butil::memory_order_relaxed);
         }
-    });
+    };
+    for_each_task_group(add_nsignaled);
+    for_each_parked_task_group(add_nsignaled);
+    return c;
+}
+
+int64_t TaskControl::get_cumulated_spin_hit_count() {
+    int64_t c = 0;
+    BAIDU_SCOPED_LOCK(_modify_group_mutex);
+    auto add_nspin_hit = [&](TaskGroup* g) {
+        if (g) {
+            c += g->_nspin_hit;
+        }
+    };
+    for_each_task_group(add_nspin_hit);
+    for_each_parked_task_group(add_nspin_hit);
+    return c;
+}
+
+int64_t TaskControl::get_cumulated_park_count() {
+    int64_t c = 0;
+    BAIDU_SCOPED_LOCK(_modify_group_mutex);
+    auto add_npark = [&](TaskGroup* g) {
+        if (g) {
+            c += g->_npark;
+        }
+    };
+    for_each_task_group(add_npark);
+    for_each_parked_task_group(add_npark);
     return c;
 }
 
@@ -689,4 +1084,24 @@ std::vector<bthread_t> TaskControl::get_living_bthreads() {
     return living_bthread_ids;
 }
 
+std::vector<std::pair<bthread_t, int64_t> >
+TaskControl::get_long_running_bthreads(int64_t threshold_ns) {
+    std::vector<std::pair<bthread_t, int64_t> > result;
+    BAIDU_SCOPED_LOCK(_modify_group_mutex);
+    const int64_t now = butil::cpuwide_time_ns();
+    for_each_task_group([&](TaskGroup* g) {
+        const TaskGroup::CPUTimeStat stat = g->_cpu_time_stat.load();
+        if (stat.is_main_task()) {
+            return;
+        }
+        const int64_t run_ns = now - stat.last_run_ns();
+        if (run_ns >= threshold_ns) {
+            // _cur_meta may be changing, the tid is just a hint which is
+            // checked again when the task is printed.
+            result.push_back(std::make_pair(g->_cur_meta->tid, run_ns));
+        }
+    });
+    return result;
+}
+
 }  // namespace bthread
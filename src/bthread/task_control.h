@@ -41,6 +41,7 @@ DECLARE_int32(task_group_ntags);
 namespace bthread {
 
 class TaskGroup;
+class CpuTopology;
 
 // Control all task groups
 class TaskControl {
@@ -73,8 +74,11 @@ public:
     int concurrency() const 
     { return _concurrency.load(butil::memory_order_acquire); }
 
-    int concurrency(bthread_tag_t tag) const 
-    { return _tagged_ngroup[tag].load(butil::memory_order_acquire); }
+    // Parked workers of the tag are counted.
+    int concurrency(bthread_tag_t tag) const {
+        return _tagged_ngroup[tag].load(butil::memory_order_acquire) +
+            _tagged_nparked[tag].load(butil::memory_order_relaxed);
+    }
 
     void print_rq_sizes(std::ostream& os);
 
@@ -82,6 +86,8 @@ public:
     double get_cumulated_worker_time(bthread_tag_t tag);
     int64_t get_cumulated_switch_count();
     int64_t get_cumulated_signal_count();
+    int64_t get_cumulated_spin_hit_count();
+    int64_t get_cumulated_park_count();
 
     // [Not thread safe] Add more worker threads.
     // Return the number of workers actually added, which may be less than |num|
@@ -106,6 +112,11 @@ public:
     }
 
     std::vector<bthread_t> get_living_bthreads();
+
+    // Bthreads running for at least `threshold_ns' without yielding, paired
+    // with their running time in nanoseconds.
+    std::vector<std::pair<bthread_t, int64_t> >
+    get_long_running_bthreads(int64_t threshold_ns);
 private:
     typedef std::array<TaskGroup*, BTHREAD_MAX_CONCURRENCY> TaggedGroups;
     typedef std::array<ParkingLot, BTHREAD_MAX_PARKINGLOT> TaggedParkingLot;
@@ -125,19 +136,71 @@ private:
 
     static void delete_task_group(void* arg);
 
+    // Refresh L3 cache and NUMA node of `g' with the cpu running the caller.
+    void update_group_location(TaskGroup* g);
+
+    // Steal from groups sharing L3 cache with the caller first, then groups
+    // in the same NUMA node, then groups in other nodes.
+    bool steal_task_by_topology(bthread_t* tid, size_t* seed, size_t offset,
+                                TaskGroup* self, size_t ngroup);
+
+    // Called by the worker of `g' in wait_task() when g->_park_requested is
+    // set or `g' is still parked. Removes `g' from its tag and sleeps until it's unparked or the
+    // control is stopped. Returns true when a task is put in `tid', which
+    // may be pushed into g->_remote_rq just before `g' was removed.
+    bool park_group(TaskGroup* g, bthread_t* tid);
+
+    // Move workers between tags according to their load, within a budget
+    // of active workers specified by -bthread_worker_budget.
+    static void* scaling_thread(void* task_control);
+    void run_scaling();
+    // Request parking an active worker of `tag'.
+    // Returns true on success, false if `tag' has only one active worker.
+    bool park_one_worker(bthread_tag_t tag);
+    // Cancel a parking request, unpark or create a worker of `tag'.
+    // Returns true on success.
+    bool unpark_one_worker(bthread_tag_t tag);
+
     static void* worker_thread(void* task_control);
 
     template <typename F>
     void for_each_task_group(F const& f);
 
+    // Groups parked by worker scaling, which still own cumulated stats.
+    template <typename F>
+    void for_each_parked_task_group(F const& f);
+
     bvar::LatencyRecorder& exposed_pending_time();
     bvar::LatencyRecorder* create_exposed_pending_time();
     bvar::Adder<int64_t>& tag_nworkers(bthread_tag_t tag);
     bvar::Adder<int64_t>& tag_nbthreads(bthread_tag_t tag);
 
+    // Delays from being queued to running of sampled bthreads, in
+    // microseconds. `local' and `stolen' split `all' by whether the task
+    // ran in the group it was queued to.
+    struct SchedLatency {
+        SchedLatency(const std::string& tag_str)
+            : all("bthread_sched", tag_str)
+            , local("bthread_sched_local", tag_str)
+            , stolen("bthread_sched_stolen", tag_str)
+            , remote("bthread_sched_remote", tag_str) {}
+        bvar::LatencyRecorder all;
+        bvar::LatencyRecorder local;
+        bvar::LatencyRecorder stolen;
+        // Tasks queued by non-workers, overlapping `local' and `stolen'.
+        bvar::LatencyRecorder remote;
+    };
+    SchedLatency* tag_sched_latency(bthread_tag_t tag) {
+        return _tagged_sched_latency[tag];
+    }
+
     std::vector<butil::atomic<size_t>> _tagged_ngroup;
     std::vector<TaggedGroups> _tagged_groups;
     butil::Mutex _modify_group_mutex;
+    // Parked workers of each tag, protected by _modify_group_mutex. They
+    // are read by the vars below, so they must be initialized before them.
+    std::vector<std::vector<TaskGroup*>> _tagged_parked;
+    std::vector<butil::atomic<int>> _tagged_nparked;
 
     butil::atomic<bool> _init;  // if not init, bvar will case coredump
     bool _stop;
@@ -155,6 +218,10 @@ private:
     bvar::PerSecond<bvar::PassiveStatus<int64_t> > _switch_per_second;
     bvar::PassiveStatus<int64_t> _cumulated_signal_count;
     bvar::PerSecond<bvar::PassiveStatus<int64_t> > _signal_per_second;
+    bvar::PassiveStatus<int64_t> _cumulated_spin_hit_count;
+    bvar::PerSecond<bvar::PassiveStatus<int64_t> > _spin_hit_per_second;
+    bvar::PassiveStatus<int64_t> _cumulated_park_count;
+    bvar::PerSecond<bvar::PassiveStatus<int64_t> > _park_per_second;
     bvar::PassiveStatus<std::string> _status;
     bvar::Adder<int64_t> _nbthreads;
 
@@ -162,6 +229,21 @@ private:
     std::vector<bvar::PassiveStatus<double>*> _tagged_cumulated_worker_time;
     std::vector<bvar::PerSecond<bvar::PassiveStatus<double>>*> _tagged_worker_usage_second;
     std::vector<bvar::Adder<int64_t>*> _tagged_nbthreads;
+    std::vector<SchedLatency*> _tagged_sched_latency;
+
+    // Not NULL when stealing by topology is enabled.
+    const CpuTopology* _topology;
+    // Stolen tasks from groups of the same L3, the same NUMA node (but
+    // other L3) and other NUMA nodes respectively.
+    bvar::Adder<int64_t> _nsteal_same_l3;
+    bvar::Adder<int64_t> _nsteal_same_node;
+    bvar::Adder<int64_t> _nsteal_cross_node;
+
+    std::vector<bvar::Adder<int64_t>*> _tagged_nparked_workers;
+    pthread_t _scaling_tid;
+    bool _scaling_started;
+    // Non-zero to stop the scaling thread, which sleeps on it.
+    butil::atomic<int> _scaling_stop;
 
     bool _enable_priority_queue;
     std::vector<WorkStealingQueue<bthread_t>> _priority_queues;
@@ -205,6 +287,15 @@ inline void TaskControl::for_each_task_group(F const& f) {
     }
 }
 
+template <typename F>
+inline void TaskControl::for_each_parked_task_group(F const& f) {
+    for (auto& parked : _tagged_parked) {
+        for (TaskGroup* g : parked) {
+            f(g);
+        }
+    }
+}
+
 }  // namespace bthread
 
 #endif  // BTHREAD_TASK_CONTROL_H
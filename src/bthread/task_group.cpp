@@ -21,6 +21,7 @@
 
 #include <sys/types.h>
 #include <stddef.h>                         // size_t
+#include <algorithm>                        // std::min
 #include <gflags/gflags.h>
 #include "butil/compat.h"                   // OS_MACOSX
 #include "butil/macros.h"                   // ARRAY_SIZE
@@ -63,6 +64,17 @@ DEFINE_bool(bthread_enable_cpu_clock_stat, false,
             "Enable CPU clock statistics for bthread");
 BUTIL_VALIDATE_GFLAG(bthread_enable_cpu_clock_stat, butil::PassValidate);
 
+DEFINE_int32(bthread_max_spin_us, 0,
+             "Idle workers spin at most so many microseconds before sleeping "
+             "when recent idle periods were short enough. <= 0 disables");
+BUTIL_VALIDATE_GFLAG(bthread_max_spin_us, butil::PassValidate);
+
+DEFINE_int32(bthread_sched_latency_sample_ratio, 64,
+             "Record the delay from being queued to running of one in so many "
+             "queued bthreads into /vars/bthread_sched_<tag>_latency*. "
+             "<= 0 disables");
+BUTIL_VALIDATE_GFLAG(bthread_sched_latency_sample_ratio, butil::PassValidate);
+
 BAIDU_VOLATILE_THREAD_LOCAL(TaskGroup*, tls_task_group, NULL);
 // Sync with TaskMeta::local_storage when a bthread is created or destroyed.
 // During running, the two fields may be inconsistent, use tls_bls as the
@@ -71,12 +83,38 @@ BAIDU_VOLATILE_THREAD_LOCAL(LocalStorage, tls_bls, BTHREAD_LOCAL_STORAGE_INITIAL
 
 // defined in bthread/key.cpp
 extern void return_keytable(bthread_keytable_pool_t*, KeyTable*);
+// Defined in task_control.cpp
+extern bool (*g_worker_idlefn)();
 
 // [Hacky] This is a special TLS set by bthread-rpc privately... to save
 // overhead of creation keytable, may be removed later.
 BAIDU_VOLATILE_THREAD_LOCAL(void*, tls_unique_user_ptr, NULL);
 
-const TaskStatistics EMPTY_STAT = { 0, 0, 0 };
+const TaskStatistics EMPTY_STAT = { 0, 0, 0, 0 };
+
+// Set by bthread_set_thread_allocated_bytes_fn(). Switching it while
+// bthreads are running makes allocated bytes of them meaningless.
+static butil::atomic<uint64_t (*)()> g_thread_allocated_bytes_fn(NULL);
+
+uint64_t (*get_thread_allocated_bytes_fn())() {
+    return g_thread_allocated_bytes_fn.load(butil::memory_order_relaxed);
+}
+
+void set_thread_allocated_bytes_fn(uint64_t (*fn)()) {
+    g_thread_allocated_bytes_fn.store(fn, butil::memory_order_relaxed);
+}
+
+// Called before `m' is queued to `g' (NULL for the priority queue). Sampling
+// keeps the overhead to a random number in most cases.
+static inline void mark_ready(TaskMeta* m, TaskGroup* g,
+                              bool remote = false) {
+    const int ratio = FLAGS_bthread_sched_latency_sample_ratio;
+    if (ratio > 0 && butil::fast_rand_less_than(ratio) == 0) {
+        m->ready_ns = butil::cpuwide_time_ns();
+        m->ready_group = g;
+        m->ready_remote = remote;
+    }
+}
 
 void* (*g_create_span_func)() = NULL;
 
@@ -161,11 +199,18 @@ bool TaskGroup::is_stopped(bthread_t tid) {
 
 bool TaskGroup::wait_task(bthread_t* tid) {
     do {
+        // A parked group may return here to run a task from _remote_rq and
+        // be unparked meanwhile, it must still go through park_group() to
+        // rejoin the tag.
+        if ((_parked || _park_requested.load(butil::memory_order_relaxed)) &&
+            _control->park_group(this, tid)) {
+            return true;
+        }
 #ifndef BTHREAD_DONT_SAVE_PARKING_STATE
         if (_last_pl_state.stopped()) {
             return false;
         }
-        _pl->wait(_last_pl_state);
+        park(_last_pl_state);
         if (steal_task(tid)) {
             return true;
         }
@@ -177,11 +222,46 @@ bool TaskGroup::wait_task(bthread_t* tid) {
         if (steal_task(tid)) {
             return true;
         }
-        _pl->wait(st);
+        park(st);
 #endif
     } while (true);
 }
 
+void TaskGroup::park(const ParkingLot::State& st) {
+    const int64_t max_spin_us = FLAGS_bthread_max_spin_us;
+    const int64_t begin_us = butil::cpuwide_time_us();
+    int64_t now_us = begin_us;
+    bool spin_hit = false;
+    // Spinning is likely to be wasted when idle periods are longer than
+    // the max spinning time, sleep directly.
+    if (max_spin_us > 0 && _avg_idle_us <= max_spin_us) {
+        const int64_t deadline_us =
+            begin_us + std::min(max_spin_us, 2 * _avg_idle_us + 1);
+        do {
+            if (_pl->changed(st)) {
+                spin_hit = true;
+                break;
+            }
+            for (int i = 0; i < 32; ++i) {
+                cpu_relax();
+            }
+            now_us = butil::cpuwide_time_us();
+        } while (now_us < deadline_us);
+    }
+    if (spin_hit) {
+        ++_nspin_hit;
+    } else if (g_worker_idlefn != NULL && g_worker_idlefn()) {
+        // Bthreads were possibly created, look for them again.
+    } else {
+        ++_npark;
+        _pl->wait(st);
+    }
+    if (max_spin_us > 0) {
+        const int64_t idle_us = butil::cpuwide_time_us() - begin_us;
+        _avg_idle_us += (idle_us - _avg_idle_us) / 8;
+    }
+}
+
 static double get_cumulated_cputime_from_this(void* arg) {
     return static_cast<TaskGroup*>(arg)->cumulated_cputime_ns() / 1000000000.0;
 }
@@ -306,6 +386,7 @@ int TaskGroup::init(size_t runqueue_capacity) {
     m->fn = NULL;
     m->arg = NULL;
     m->local_storage = LOCAL_STORAGE_INIT;
+    memset(m->static_locals, 0, sizeof(m->static_locals));
     m->cpuwide_start_ns = butil::cpuwide_time_ns();
     m->stat = EMPTY_STAT;
     m->attr = BTHREAD_ATTR_TASKGROUP;
@@ -492,11 +573,13 @@ int TaskGroup::start_foreground(TaskGroup** pg,
     CHECK(m->stack == NULL);
     m->attr = using_attr;
     m->local_storage = LOCAL_STORAGE_INIT;
+    memset(m->static_locals, 0, sizeof(m->static_locals));
     if (using_attr.flags & BTHREAD_INHERIT_SPAN) {
         m->local_storage.rpcz_parent_span = run_create_span_func();
     }
     m->cpuwide_start_ns = start_ns;
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
     m->tid = make_tid(*m->version_butex, slot);
     *th = m->tid;
     if (using_attr.flags & BTHREAD_LOG_START_AND_FINISH) {
@@ -532,20 +615,14 @@ int TaskGroup::start_foreground(TaskGroup** pg,
     return 0;
 }
 
-template <bool REMOTE>
-int TaskGroup::start_background(bthread_t* __restrict th,
-                                const bthread_attr_t* __restrict attr,
-                                void * (*fn)(void*),
-                                void* __restrict arg) {
-    if (__builtin_expect(!fn, 0)) {
-        return EINVAL;
-    }
-    const int64_t start_ns = butil::cpuwide_time_ns();
-    const bthread_attr_t using_attr = (attr ? *attr : BTHREAD_ATTR_NORMAL);
+TaskMeta* TaskGroup::new_task_meta(const bthread_attr_t& using_attr,
+                                   void * (*fn)(void*),
+                                   void* __restrict arg,
+                                   int64_t start_ns) {
     butil::ResourceId<TaskMeta> slot;
     TaskMeta* m = butil::get_resource(&slot);
     if (BAIDU_UNLIKELY(NULL == m)) {
-        return ENOMEM;
+        return NULL;
     }
     CHECK(m->current_waiter.load(butil::memory_order_relaxed) == NULL);
     m->sleep_failed = false;
@@ -557,13 +634,14 @@ int TaskGroup::start_background(bthread_t* __restrict th,
     CHECK(m->stack == NULL);
     m->attr = using_attr;
     m->local_storage = LOCAL_STORAGE_INIT;
+    memset(m->static_locals, 0, sizeof(m->static_locals));
     if (using_attr.flags & BTHREAD_INHERIT_SPAN) {
         m->local_storage.rpcz_parent_span = run_create_span_func();
     }
     m->cpuwide_start_ns = start_ns;
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
     m->tid = make_tid(*m->version_butex, slot);
-    *th = m->tid;
     if (using_attr.flags & BTHREAD_LOG_START_AND_FINISH) {
         LOG(INFO) << "Started bthread " << m->tid;
     }
@@ -572,6 +650,24 @@ int TaskGroup::start_background(bthread_t* __restrict th,
 #ifdef BRPC_BTHREAD_TRACER
     _control->_task_tracer.set_status(TASK_STATUS_CREATED, m);
 #endif // BRPC_BTHREAD_TRACER
+    return m;
+}
+
+template <bool REMOTE>
+int TaskGroup::start_background(bthread_t* __restrict th,
+                                const bthread_attr_t* __restrict attr,
+                                void * (*fn)(void*),
+                                void* __restrict arg) {
+    if (__builtin_expect(!fn, 0)) {
+        return EINVAL;
+    }
+    const int64_t start_ns = butil::cpuwide_time_ns();
+    const bthread_attr_t using_attr = (attr ? *attr : BTHREAD_ATTR_NORMAL);
+    TaskMeta* m = new_task_meta(using_attr, fn, arg, start_ns);
+    if (BAIDU_UNLIKELY(NULL == m)) {
+        return ENOMEM;
+    }
+    *th = m->tid;
     if (REMOTE) {
         ready_to_run_remote(m, (using_attr.flags & BTHREAD_NOSIGNAL));
     } else {
@@ -580,6 +676,73 @@ int TaskGroup::start_background(bthread_t* __restrict th,
     return 0;
 }
 
+template <bool REMOTE>
+int TaskGroup::start_background_batch(bthread_t* __restrict tids,
+                                      size_t n,
+                                      const bthread_attr_t* __restrict attr,
+                                      void * (*fn)(void*),
+                                      void* const* args) {
+    if (__builtin_expect(!fn || (n != 0 && !tids), 0)) {
+        return EINVAL;
+    }
+    const int64_t start_ns = butil::cpuwide_time_ns();
+    const bthread_attr_t using_attr = (attr ? *attr : BTHREAD_ATTR_NORMAL);
+    int rc = 0;
+    // Create all metas before touching the runqueue, so that the tasks are
+    // queued in one short pass.
+    size_t ncreated = 0;
+    for (; ncreated < n; ++ncreated) {
+        TaskMeta* m = new_task_meta(using_attr, fn,
+                                    (args ? args[ncreated] : NULL), start_ns);
+        if (BAIDU_UNLIKELY(NULL == m)) {
+            rc = ENOMEM;
+            break;
+        }
+        tids[ncreated] = m->tid;
+    }
+    for (size_t i = ncreated; i < n; ++i) {
+        tids[i] = INVALID_BTHREAD;
+    }
+    if (ncreated == 0) {
+        return rc;
+    }
+    // Tasks are counted as nosignal ones so that a full runqueue flushes
+    // them as usual, the rest are signalled together at the end.
+    if (REMOTE) {
+        for (size_t i = 0; i < ncreated; ++i) {
+#ifdef BRPC_BTHREAD_TRACER
+            _control->_task_tracer.set_status(
+                TASK_STATUS_READY, address_meta(tids[i]));
+#endif // BRPC_BTHREAD_TRACER
+            mark_ready(address_meta(tids[i]), this, true);
+            while (!_remote_rq.push(tids[i])) {
+                flush_nosignal_tasks_remote();
+                LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
+                                        << _remote_rq.capacity();
+                ::usleep(1000);
+            }
+            _remote_num_nosignal.fetch_add(1, butil::memory_order_relaxed);
+        }
+        if (!(using_attr.flags & BTHREAD_NOSIGNAL)) {
+            flush_nosignal_tasks_remote();
+        }
+    } else {
+        for (size_t i = 0; i < ncreated; ++i) {
+#ifdef BRPC_BTHREAD_TRACER
+            _control->_task_tracer.set_status(
+                TASK_STATUS_READY, address_meta(tids[i]));
+#endif // BRPC_BTHREAD_TRACER
+            mark_ready(address_meta(tids[i]), this);
+            push_rq(tids[i]);
+            ++_num_nosignal;
+        }
+        if (!(using_attr.flags & BTHREAD_NOSIGNAL)) {
+            flush_nosignal_tasks();
+        }
+    }
+    return rc;
+}
+
 // Explicit instantiations.
 template int
 TaskGroup::start_background<true>(bthread_t* __restrict th,
@@ -591,6 +754,18 @@ TaskGroup::start_background<false>(bthread_t* __restrict th,
                                    const bthread_attr_t* __restrict attr,
                                    void * (*fn)(void*),
                                    void* __restrict arg);
+template int
+TaskGroup::start_background_batch<true>(bthread_t* __restrict tids,
+                                        size_t n,
+                                        const bthread_attr_t* __restrict attr,
+                                        void * (*fn)(void*),
+                                        void* const* args);
+template int
+TaskGroup::start_background_batch<false>(bthread_t* __restrict tids,
+                                         size_t n,
+                                         const bthread_attr_t* __restrict attr,
+                                         void * (*fn)(void*),
+                                         void* const* args);
 
 int TaskGroup::join(bthread_t tid, void** return_value) {
     if (__builtin_expect(!tid, 0)) {  // tid of bthread is never 0.
@@ -722,12 +897,33 @@ void TaskGroup::sched_to(TaskGroup** pg, TaskMeta* next_meta) {
     cpu_time_stat.add_cumulated_cputime_ns(elp_ns, is_main_task(g, cur_meta->tid));
     g->_cpu_time_stat.store(cpu_time_stat);
 
+    if (next_meta->ready_ns != 0) {
+        TaskControl::SchedLatency* sl = g->_control->tag_sched_latency(g->_tag);
+        const int64_t latency_us = (now - next_meta->ready_ns) / 1000;
+        sl->all << latency_us;
+        if (next_meta->ready_group == g) {
+            sl->local << latency_us;
+        } else if (next_meta->ready_group != NULL) {
+            sl->stolen << latency_us;
+        }
+        if (next_meta->ready_remote) {
+            sl->remote << latency_us;
+        }
+        next_meta->ready_ns = 0;
+    }
+
     if (FLAGS_bthread_enable_cpu_clock_stat) {
         const int64_t cpu_thread_time = butil::cputhread_time_ns();
+        // Bytes allocated by the worker are attributed to bthreads in the
+        // same way as its cpu clock.
+        uint64_t (*allocated_fn)() = get_thread_allocated_bytes_fn();
+        const uint64_t allocated = allocated_fn ? allocated_fn() : 0;
         if (g->_last_cpu_clock_ns != 0) {
             cur_meta->stat.cpu_usage_ns += cpu_thread_time - g->_last_cpu_clock_ns;
+            cur_meta->stat.allocated_bytes += allocated - g->_last_allocated_bytes;
         }
         g->_last_cpu_clock_ns = cpu_thread_time;
+        g->_last_allocated_bytes = allocated;
     } else {
         g->_last_cpu_clock_ns = 0;
     }
@@ -816,6 +1012,7 @@ void TaskGroup::ready_to_run(TaskMeta* meta, bool nosignal) {
 #ifdef BRPC_BTHREAD_TRACER
     _control->_task_tracer.set_status(TASK_STATUS_READY, meta);
 #endif // BRPC_BTHREAD_TRACER
+    mark_ready(meta, this);
     push_rq(meta->tid);
     if (nosignal) {
         ++_num_nosignal;
@@ -840,38 +1037,25 @@ void TaskGroup::ready_to_run_remote(TaskMeta* meta, bool nosignal) {
 #ifdef BRPC_BTHREAD_TRACER
     _control->_task_tracer.set_status(TASK_STATUS_READY, meta);
 #endif // BRPC_BTHREAD_TRACER
-    _remote_rq._mutex.lock();
-    while (!_remote_rq.push_locked(meta->tid)) {
-        flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
+    mark_ready(meta, this, true);
+    while (!_remote_rq.push(meta->tid)) {
+        flush_nosignal_tasks_remote();
         LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
                                 << _remote_rq.capacity();
         ::usleep(1000);
-        _remote_rq._mutex.lock();
     }
     if (nosignal) {
-        ++_remote_num_nosignal;
-        _remote_rq._mutex.unlock();
+        _remote_num_nosignal.fetch_add(1, butil::memory_order_relaxed);
     } else {
-        const int additional_signal = _remote_num_nosignal;
-        _remote_num_nosignal = 0;
-        _remote_nsignaled += 1 + additional_signal;
-        _remote_rq._mutex.unlock();
+        // Signal the nosignal tasks pushed before together.
+        const int additional_signal = _remote_num_nosignal.exchange(
+            0, butil::memory_order_relaxed);
+        _remote_nsignaled.fetch_add(1 + additional_signal,
+                                    butil::memory_order_relaxed);
         _control->signal_task(1 + additional_signal, _tag);
     }
 }
 
-void TaskGroup::flush_nosignal_tasks_remote_locked(butil::Mutex& locked_mutex) {
-    const int val = _remote_num_nosignal;
-    if (!val) {
-        locked_mutex.unlock();
-        return;
-    }
-    _remote_num_nosignal = 0;
-    _remote_nsignaled += val;
-    locked_mutex.unlock();
-    _control->signal_task(val, _tag);
-}
-
 void TaskGroup::ready_to_run_general(TaskMeta* meta, bool nosignal) {
     if (tls_task_group == this) {
         return ready_to_run(meta, nosignal);
@@ -897,6 +1081,7 @@ void TaskGroup::ready_to_run_in_worker_ignoresignal(void* args_in) {
     tls_task_group->_control->_task_tracer.set_status(
         TASK_STATUS_READY, args->meta);
 #endif // BRPC_BTHREAD_TRACER
+    mark_ready(args->meta, tls_task_group);
     return tls_task_group->push_rq(args->meta->tid);
 }
 
@@ -906,6 +1091,7 @@ void TaskGroup::priority_to_run(void* args_in) {
     tls_task_group->_control->_task_tracer.set_status(
         TASK_STATUS_READY, args->meta);
 #endif // BRPC_BTHREAD_TRACER
+    mark_ready(args->meta, NULL);
     return tls_task_group->control()->push_priority_queue(args->tag, args->meta->tid);
 }
 
@@ -935,7 +1121,7 @@ void TaskGroup::_add_sleep_event(void* void_args) {
 #endif // BRPC_BTHREAD_TRACER
 
     TimerThread::TaskId sleep_id;
-    sleep_id = get_global_timer_thread()->schedule(
+    sleep_id = get_timer_thread(g->tag())->schedule(
         ready_to_run_from_timer_thread, void_args,
         butil::microseconds_from_now(e.timeout_us));
 
@@ -1106,7 +1292,7 @@ void print_task(std::ostream& os, bthread_t tid, bool enable_trace,
     bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
     bool has_tls = false;
     int64_t cpuwide_start_ns = 0;
-    TaskStatistics stat = {0, 0, 0};
+    TaskStatistics stat = EMPTY_STAT;
     TaskStatus status = TASK_STATUS_UNKNOWN;
     bool traced = false;
     pthread_t worker_tid{};
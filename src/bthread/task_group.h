@@ -77,6 +77,10 @@ private:
     FastPthreadMutex _mutex;
 };
 
+// Function returning bytes allocated by the calling pthread, NULL if not set.
+uint64_t (*get_thread_allocated_bytes_fn())();
+void set_thread_allocated_bytes_fn(uint64_t (*fn)());
+
 // Thread-local group of tasks.
 // Notice that most methods involving context switching are static otherwise
 // pointer `this' may change after wakeup. The **pg parameters in following
@@ -104,6 +108,18 @@ public:
                          void * (*fn)(void*),
                          void* __restrict arg);
 
+    // Create `n' tasks `fn(args[i])' with attributes `attr' in this TaskGroup
+    // like start_background, but queue them in one pass and signal workers
+    // once. On ENOMEM, tasks created before the failure are still scheduled
+    // and the remaining `tids' are set to INVALID_BTHREAD.
+    // Return 0 on success, errno otherwise.
+    template <bool REMOTE>
+    int start_background_batch(bthread_t* __restrict tids,
+                               size_t n,
+                               const bthread_attr_t* __restrict attr,
+                               void * (*fn)(void*),
+                               void* const* args);
+
     // Suspend caller and run next bthread in TaskGroup *pg.
     static void sched(TaskGroup** pg);
     static void ending_sched(TaskGroup** pg);
@@ -170,6 +186,10 @@ public:
     // Uptime of current task in nanoseconds.
     int64_t current_uptime_ns() const
     { return butil::cpuwide_time_ns() - _cur_meta->cpuwide_start_ns; }
+    // Nanoseconds that current task has been running since it was
+    // scheduled onto this worker last time. Only called in this worker.
+    int64_t current_run_ns() const
+    { return butil::cpuwide_time_ns() - _cpu_time_stat.load_unsafe().last_run_ns(); }
 
     // True iff current task is the one running run_main_task()
     bool is_current_main_task() const { return current_tid() == _main_tid; }
@@ -187,7 +207,6 @@ public:
 
     // Push a bthread into the runqueue from another non-worker thread.
     void ready_to_run_remote(TaskMeta* meta, bool nosignal = false);
-    void flush_nosignal_tasks_remote_locked(butil::Mutex& locked_mutex);
     void flush_nosignal_tasks_remote();
 
     // Automatically decide the caller is remote or local, and call
@@ -230,6 +249,16 @@ public:
         return total_ns;
     }
 
+    int64_t current_task_allocated_bytes() {
+        uint64_t (*allocated_fn)() = get_thread_allocated_bytes_fn();
+        if (_last_cpu_clock_ns == 0 || allocated_fn == NULL) {
+            return 0;
+        }
+        int64_t total = _cur_meta->stat.allocated_bytes;
+        total += allocated_fn() - _last_allocated_bytes;
+        return total;
+    }
+
 private:
 friend class TaskControl;
 
@@ -306,6 +335,13 @@ friend class TaskControl;
     // of groups are postponed to avoid race.
     ~TaskGroup();
 
+    // Allocate and initialize the meta of a new task `fn(arg)'.
+    // Returns NULL when out of memory.
+    TaskMeta* new_task_meta(const bthread_attr_t& using_attr,
+                            void * (*fn)(void*),
+                            void* __restrict arg,
+                            int64_t start_ns);
+
 #ifdef BUTIL_USE_ASAN
     static void asan_task_runner(intptr_t);
 #endif // BUTIL_USE_ASAN
@@ -328,6 +364,10 @@ friend class TaskControl;
     // loop calling this function should end.
     bool wait_task(bthread_t* tid);
 
+    // Wait on _pl until `st' is changed. Spin for a while before sleeping
+    // if recent idle periods were short, see -bthread_max_spin_us.
+    void park(const ParkingLot::State& st);
+
     bool steal_task(bthread_t* tid) {
         if (_remote_rq.pop(tid)) {
             return true;
@@ -335,7 +375,11 @@ friend class TaskControl;
 #ifndef BTHREAD_DONT_SAVE_PARKING_STATE
         _last_pl_state = _pl->get_state();
 #endif
-        return _control->steal_task(tid, &_steal_seed, _steal_offset);
+        if (_control->steal_task(tid, &_steal_seed, _steal_offset)) {
+            ++_nsteal;
+            return true;
+        }
+        return false;
     }
 
     void set_tag(bthread_tag_t tag) { _tag = tag; }
@@ -355,8 +399,16 @@ friend class TaskControl;
     AtomicCPUTimeStat _cpu_time_stat;
     // last thread cpu clock
     int64_t _last_cpu_clock_ns{0};
+    // bytes allocated by this worker when _last_cpu_clock_ns was taken
+    uint64_t _last_allocated_bytes{0};
 
     size_t _nswitch{0};
+    size_t _nsteal{0};
+    // Idle periods ended during spinning and by sleeping in _pl.
+    size_t _nspin_hit{0};
+    size_t _npark{0};
+    // Moving average of recent idle periods in microseconds.
+    int64_t _avg_idle_us{0};
     RemainedFn _last_context_remained{NULL};
     void* _last_context_remained_arg{NULL};
 
@@ -366,12 +418,24 @@ friend class TaskControl;
 #endif
     size_t _steal_seed{butil::fast_rand()};
     size_t _steal_offset{prime_offset(_steal_seed)};
+    // L3 cache and NUMA node of the cpu running this worker, refreshed when
+    // it starts and steals. -1 if unknown. Read by thieves in other workers.
+    butil::atomic<int> _l3_id{-1};
+    butil::atomic<int> _numa_node{-1};
+    // Set by TaskControl to move this worker out of(true) or back into
+    // (false) its tag, see TaskControl::park_group().
+    butil::atomic<bool> _park_requested{false};
+    // Parked worker sleeps on this futex.
+    butil::atomic<int> _park_futex{0};
+    // Whether this group was removed from its tag by park_group().
+    bool _parked{false};
     ContextualStack* _main_stack{NULL};
     bthread_t _main_tid{INVALID_BTHREAD};
     WorkStealingQueue<bthread_t> _rq;
     RemoteTaskQueue _remote_rq;
-    int _remote_num_nosignal{0};
-    int _remote_nsignaled{0};
+    // Modified by non-workers concurrently.
+    butil::atomic<int> _remote_num_nosignal{0};
+    butil::atomic<int> _remote_nsignaled{0};
 
     int _sched_recursive_guard{0};
     // tag of this taskgroup
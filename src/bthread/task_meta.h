@@ -35,9 +35,11 @@ struct TaskStatistics {
     int64_t cputime_ns;
     int64_t nswitch;
     int64_t cpu_usage_ns;
+    int64_t allocated_bytes;
 };
 
 class KeyTable;
+class TaskGroup;
 struct ButexWaiter;
 
 struct LocalStorage {
@@ -102,11 +104,23 @@ struct TaskMeta {
     int64_t cpuwide_start_ns{0};
     TaskStatistics stat{};
 
+    // When the sampled task was queued last time and the group it was queued
+    // to, only set when -bthread_sched_latency_sample_ratio picks the task.
+    // Reset after the task is scheduled. ready_group is NULL for tasks in the
+    // global priority queue. ready_remote is true for tasks queued by
+    // non-workers.
+    int64_t ready_ns{0};
+    TaskGroup* ready_group{NULL};
+    bool ready_remote{false};
+
     // bthread local storage, sync with tls_bls (defined in task_group.cpp)
     // when the bthread is created or destroyed.
     // DO NOT use this field directly, use tls_bls instead.
     LocalStorage local_storage{};
 
+    // Slots of bthread_set_static_local(), cleared when the bthread starts.
+    void* static_locals[BTHREAD_STATIC_LOCAL_SLOTS]{};
+
     // Only used when TaskTracer is enabled.
     // Bthread status.
     TaskStatus status{TASK_STATUS_UNKNOWN};
@@ -30,9 +30,17 @@
 #include "bthread/timer_thread.h"
 #include "bthread/log.h"
 
+DECLARE_int32(task_group_ntags);
+
 namespace bthread {
 
 DEFINE_uint32(brpc_timer_num_buckets, 13, "brpc timer num buckets");
+DEFINE_int32(brpc_timer_wheel_tick_us, 0,
+             "Keep tasks of brpc timer in a hierarchical timing wheel with "
+             "ticks of so many microseconds instead of heaps, <= 0 disables");
+DEFINE_bool(bthread_timer_thread_per_tag, false,
+            "Run timers scheduled by bthreads of non-default tags in a timer "
+            "thread of the tag, so that timers of one tag can't delay others");
 
 // Defined in task_control.cpp
 void run_worker_startfn();
@@ -40,7 +48,8 @@ void run_worker_startfn();
 const TimerThread::TaskId TimerThread::INVALID_TASK_ID = 0;
 
 TimerThreadOptions::TimerThreadOptions()
-    : num_buckets(13) {
+    : num_buckets(13)
+    , wheel_tick_us(0) {
 }
 
 // A task contains the necessary information for running fn(arg).
@@ -75,7 +84,8 @@ class BAIDU_CACHELINE_ALIGNMENT TimerThread::Bucket {
 public:
     Bucket()
         : _nearest_run_time(std::numeric_limits<int64_t>::max())
-        , _task_head(NULL) {
+        , _task_head(NULL)
+        , _pushed_head(NULL) {
     }
 
     ~Bucket() {}
@@ -94,10 +104,52 @@ public:
     // This function is called in timer thread.
     Task* consume_tasks();
 
+    // Push a task without locking, used with the timing wheel.
+    void push(Task* task);
+
+    // Pull all pushed tasks.
+    // This function is called in timer thread.
+    Task* consume_pushed_tasks() { return _pushed_head.exchange(NULL); }
+
 private:
     FastPthreadMutex _mutex;
     int64_t _nearest_run_time;
     Task* _task_head;
+    // Tasks pushed by push(), in a different cacheline from _mutex.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<Task*> _pushed_head;
+};
+
+// Hierarchical timing wheel. Tasks are linked by Task::next in slots and
+// moved to lower levels when the wheel turns to them.
+// Only accessed by the timer thread.
+class TimerThread::Wheel {
+public:
+    Wheel(int64_t tick_us, int64_t now_us);
+
+    // Add `task' into the wheel.
+    // Returns false if the task is due and not added.
+    bool add(Task* task);
+
+    // Turn the wheel to `now_us', tasks due are appended to `due'.
+    void advance(int64_t now_us, std::vector<Task*>* due);
+
+    // Realtime of the nearest tick which has due tasks or needs to move
+    // tasks from higher levels, max of int64_t if the wheel is empty.
+    int64_t next_run_time() const;
+
+private:
+    static const int BITS = 8;
+    static const int NSLOT = 1 << BITS;
+    static const int NLEVEL = 4;
+
+    // Re-add tasks in the slot of `level' and delete unscheduled ones.
+    void cascade(int level, int slot, std::vector<Task*>* due);
+
+    int64_t _tick_us;
+    // The next tick to process.
+    int64_t _next_tick;
+    size_t _count[NLEVEL];
+    Task* _slots[NLEVEL][NSLOT];
 };
 
 // Utilies for making and extracting TaskId.
@@ -131,6 +183,7 @@ TimerThread::TimerThread()
     , _stop(false)
     , _buckets(NULL)
     , _nearest_run_time(std::numeric_limits<int64_t>::max())
+    , _wheel_wakeup_time(0)
     , _nsignals(0)
     , _thread(0) {
 }
@@ -185,14 +238,13 @@ TimerThread::Task* TimerThread::Bucket::consume_tasks() {
     return head;
 }
 
-TimerThread::Bucket::ScheduleResult
-TimerThread::Bucket::schedule(void (*fn)(void*), void* arg,
-                              const timespec& abstime) {
-    butil::ResourceId<Task> slot_id;
-    Task* task = butil::get_resource<Task>(&slot_id);
+// Returns NULL on error.
+static TimerThread::Task* create_task(void (*fn)(void*), void* arg,
+                                      const timespec& abstime) {
+    butil::ResourceId<TimerThread::Task> slot_id;
+    TimerThread::Task* task = butil::get_resource<TimerThread::Task>(&slot_id);
     if (task == NULL) {
-        ScheduleResult result = { INVALID_TASK_ID, false };
-        return result;
+        return NULL;
     }
     task->next = NULL;
     task->fn = fn;
@@ -203,8 +255,19 @@ TimerThread::Bucket::schedule(void (*fn)(void*), void* arg,
         task->version.fetch_add(2, butil::memory_order_relaxed);
         version = 2;
     }
-    const TaskId id = make_task_id(slot_id, version);
-    task->task_id = id;
+    task->task_id = make_task_id(slot_id, version);
+    return task;
+}
+
+TimerThread::Bucket::ScheduleResult
+TimerThread::Bucket::schedule(void (*fn)(void*), void* arg,
+                              const timespec& abstime) {
+    Task* task = create_task(fn, arg, abstime);
+    if (task == NULL) {
+        ScheduleResult result = { INVALID_TASK_ID, false };
+        return result;
+    }
+    const TaskId id = task->task_id;
     bool earlier = false;
     {
         BAIDU_SCOPED_LOCK(_mutex);
@@ -219,12 +282,139 @@ TimerThread::Bucket::schedule(void (*fn)(void*), void* arg,
     return result;
 }
 
+void TimerThread::Bucket::push(Task* task) {
+    Task* head = _pushed_head.load(butil::memory_order_relaxed);
+    do {
+        task->next = head;
+    } while (!_pushed_head.compare_exchange_weak(head, task));
+}
+
+TimerThread::Wheel::Wheel(int64_t tick_us, int64_t now_us)
+    : _tick_us(tick_us)
+    , _next_tick(now_us / tick_us + 1) {
+    memset(_count, 0, sizeof(_count));
+    memset(_slots, 0, sizeof(_slots));
+}
+
+bool TimerThread::Wheel::add(Task* task) {
+    // Run the task at the first tick not earlier than its run_time.
+    int64_t tick = (task->run_time + _tick_us - 1) / _tick_us;
+    if (tick < _next_tick) {
+        return false;
+    }
+    int64_t delta = tick - _next_tick;
+    int level = 0;
+    while (level < NLEVEL - 1 && delta >= ((int64_t)1 << (BITS * (level + 1)))) {
+        ++level;
+    }
+    if (delta >= ((int64_t)1 << (BITS * NLEVEL))) {
+        // Too far away, put it at the farthest slot and re-add it later.
+        tick = _next_tick + ((int64_t)1 << (BITS * NLEVEL)) - 1;
+    }
+    Task*& head = _slots[level][(tick >> (BITS * level)) & (NSLOT - 1)];
+    task->next = head;
+    head = task;
+    ++_count[level];
+    return true;
+}
+
+void TimerThread::Wheel::cascade(int level, int slot, std::vector<Task*>* due) {
+    Task* p = _slots[level][slot];
+    _slots[level][slot] = NULL;
+    while (p != NULL) {
+        Task* next_task = p->next;
+        --_count[level];
+        // Free unscheduled tasks early.
+        if (!p->try_delete() && !add(p)) {
+            due->push_back(p);
+        }
+        p = next_task;
+    }
+}
+
+void TimerThread::Wheel::advance(int64_t now_us, std::vector<Task*>* due) {
+    const int64_t now_tick = now_us / _tick_us;
+    size_t total = 0;
+    for (int i = 0; i < NLEVEL; ++i) {
+        total += _count[i];
+    }
+    if (total == 0) {
+        // Skip empty ticks.
+        _next_tick = std::max(_next_tick, now_tick + 1);
+        return;
+    }
+    while (_next_tick <= now_tick) {
+        const int slot = _next_tick & (NSLOT - 1);
+        // Move tasks from higher levels when lower levels wrap around.
+        for (int level = 1; level < NLEVEL; ++level) {
+            const int64_t prev_bits = BITS * level;
+            if ((_next_tick & (((int64_t)1 << prev_bits) - 1)) != 0) {
+                break;
+            }
+            cascade(level, (_next_tick >> prev_bits) & (NSLOT - 1), due);
+        }
+        for (Task* p = _slots[0][slot]; p != NULL; p = p->next) {
+            due->push_back(p);
+            --_count[0];
+        }
+        _slots[0][slot] = NULL;
+        ++_next_tick;
+    }
+}
+
+int64_t TimerThread::Wheel::next_run_time() const {
+    const bool has_higher = (_count[1] + _count[2] + _count[3] != 0);
+    if (_count[0] == 0 && !has_higher) {
+        return std::numeric_limits<int64_t>::max();
+    }
+    // All tasks in level 0 are within NSLOT ticks.
+    for (int64_t tick = _next_tick; tick < _next_tick + NSLOT; ++tick) {
+        if (_slots[0][tick & (NSLOT - 1)] != NULL ||
+            (has_higher && (tick & (NSLOT - 1)) == 0)) {
+            return tick * _tick_us;
+        }
+    }
+    return std::numeric_limits<int64_t>::max();
+}
+
+TimerThread::TaskId TimerThread::schedule_to_wheel(
+    void (*fn)(void*), void* arg, const timespec& abstime) {
+    Task* task = create_task(fn, arg, abstime);
+    if (task == NULL) {
+        return INVALID_TASK_ID;
+    }
+    const TaskId id = task->task_id;
+    // The task runs at the end of its tick.
+    const int64_t tick_us = _options.wheel_tick_us;
+    const int64_t run_time = (task->run_time + tick_us - 1) / tick_us * tick_us;
+    _buckets[butil::fmix64(pthread_numeric_id()) % _options.num_buckets]
+        .push(task);
+    // Paired with run_wheel() which sets _wheel_wakeup_time before pulling
+    // tasks for the last time: either the task is pulled or we see the new
+    // wakeup time here. The task can't be touched after push().
+    int64_t wakeup_time = _wheel_wakeup_time.load();
+    while (run_time < wakeup_time) {
+        if (_wheel_wakeup_time.compare_exchange_weak(wakeup_time, run_time)) {
+            {
+                BAIDU_SCOPED_LOCK(_mutex);
+                ++_nsignals;
+            }
+            futex_wake_private(&_nsignals, 1);
+            break;
+        }
+    }
+    return id;
+}
+
 TimerThread::TaskId TimerThread::schedule(
     void (*fn)(void*), void* arg, const timespec& abstime) {
     if (_stop.load(butil::memory_order_relaxed) || !_started) {
         // Not add tasks when TimerThread is about to stop.
         return INVALID_TASK_ID;
     }
+    if (_options.wheel_tick_us > 0) {
+        return schedule_to_wheel(fn, arg, abstime);
+    }
     // Hashing by pthread id is better for cache locality.
     const Bucket::ScheduleResult result = 
         _buckets[butil::fmix64(pthread_numeric_id()) % _options.num_buckets]
@@ -343,6 +533,11 @@ void TimerThread::run() {
         ntriggered_second.expose_as(_options.bvar_prefix, "triggered_second");
         busy_seconds_second.expose_as(_options.bvar_prefix, "usage");
     }
+    if (_options.wheel_tick_us > 0) {
+        run_wheel(&nscheduled, &ntriggered, &busy_seconds);
+        BT_VLOG << "Ended TimerThread=" << pthread_self();
+        return;
+    }
     
     while (!_stop.load(butil::memory_order_relaxed)) {
         // Clear _nearest_run_time before consuming tasks from buckets.
@@ -444,6 +639,70 @@ void TimerThread::run() {
     BT_VLOG << "Ended TimerThread=" << pthread_self();
 }
 
+void TimerThread::run_wheel(size_t* nscheduled, size_t* ntriggered,
+                            double* busy_seconds) {
+    int64_t last_sleep_time = butil::gettimeofday_us();
+    Wheel wheel(_options.wheel_tick_us, last_sleep_time);
+    std::vector<Task*> due;
+    due.reserve(1024);
+    // Pull tasks from buckets into the wheel or `due'.
+    // Returns the earliest run_time of the pulled tasks.
+    auto pull_tasks = [&]() -> int64_t {
+        int64_t earliest = std::numeric_limits<int64_t>::max();
+        for (size_t i = 0; i < _options.num_buckets; ++i) {
+            Task* p = _buckets[i].consume_pushed_tasks();
+            while (p != NULL) {
+                Task* next_task = p->next;
+                ++*nscheduled;
+                if (!p->try_delete()) {
+                    earliest = std::min(earliest, p->run_time);
+                    if (!wheel.add(p)) {
+                        due.push_back(p);
+                    }
+                }
+                p = next_task;
+            }
+        }
+        return earliest;
+    };
+    while (true) {
+        int expected_nsignals = 0;
+        {
+            BAIDU_SCOPED_LOCK(_mutex);
+            if (_stop.load(butil::memory_order_relaxed)) {
+                break;
+            }
+            expected_nsignals = _nsignals;
+        }
+        pull_tasks();
+        wheel.advance(butil::gettimeofday_us(), &due);
+        for (size_t i = 0; i < due.size(); ++i) {
+            if (due[i]->run_and_delete()) {
+                ++*ntriggered;
+            }
+        }
+        due.clear();
+
+        const int64_t next_run_time = wheel.next_run_time();
+        _wheel_wakeup_time.store(next_run_time);
+        // Tasks scheduled before setting _wheel_wakeup_time did not signal.
+        if (pull_tasks() < next_run_time || !due.empty()) {
+            continue;
+        }
+        timespec* ptimeout = NULL;
+        timespec next_timeout = { 0, 0 };
+        const int64_t now = butil::gettimeofday_us();
+        if (next_run_time != std::numeric_limits<int64_t>::max()) {
+            next_timeout = butil::microseconds_to_timespec(
+                std::max(next_run_time - now, (int64_t)0));
+            ptimeout = &next_timeout;
+        }
+        *busy_seconds += (now - last_sleep_time) / 1000000.0;
+        futex_wait_private(&_nsignals, expected_nsignals, ptimeout);
+        last_sleep_time = butil::gettimeofday_us();
+    }
+}
+
 void TimerThread::stop_and_join() {
     _stop.store(true, butil::memory_order_relaxed);
     if (_started) {
@@ -464,22 +723,44 @@ void TimerThread::stop_and_join() {
 
 static pthread_once_t g_timer_thread_once = PTHREAD_ONCE_INIT;
 static TimerThread* g_timer_thread = NULL;
-static void init_global_timer_thread() {
-    g_timer_thread = new (std::nothrow) TimerThread;
-    if (g_timer_thread == NULL) {
-        LOG(FATAL) << "Fail to new g_timer_thread";
-        return;
+// Timer threads of non-default tags, empty if -bthread_timer_thread_per_tag
+// is off.
+static std::vector<TimerThread*> g_tagged_timer_threads;
+
+static TimerThread* create_timer_thread(const std::string& bvar_prefix) {
+    TimerThread* tt = new (std::nothrow) TimerThread;
+    if (tt == NULL) {
+        LOG(FATAL) << "Fail to new TimerThread";
+        return NULL;
     }
     TimerThreadOptions options;
-    options.bvar_prefix = "bthread_timer";
+    options.bvar_prefix = bvar_prefix;
     options.num_buckets = FLAGS_brpc_timer_num_buckets;
-    const int rc = g_timer_thread->start(&options);
+    options.wheel_tick_us = FLAGS_brpc_timer_wheel_tick_us;
+    const int rc = tt->start(&options);
     if (rc != 0) {
         LOG(FATAL) << "Fail to start timer_thread, " << berror(rc);
-        delete g_timer_thread;
-        g_timer_thread = NULL;
+        delete tt;
+        return NULL;
+    }
+    return tt;
+}
+
+static void init_global_timer_thread() {
+    g_timer_thread = create_timer_thread("bthread_timer");
+    if (g_timer_thread == NULL || !FLAGS_bthread_timer_thread_per_tag) {
         return;
     }
+    std::vector<TimerThread*> tagged(FLAGS_task_group_ntags, g_timer_thread);
+    for (int tag = BTHREAD_TAG_DEFAULT + 1; tag < FLAGS_task_group_ntags; ++tag) {
+        char prefix[32];
+        snprintf(prefix, sizeof(prefix), "bthread_timer_tag%d", tag);
+        TimerThread* tt = create_timer_thread(prefix);
+        if (tt != NULL) {
+            tagged[tag] = tt;
+        }
+    }
+    g_tagged_timer_threads.swap(tagged);
 }
 TimerThread* get_or_create_global_timer_thread() {
     pthread_once(&g_timer_thread_once, init_global_timer_thread);
@@ -488,5 +769,11 @@ TimerThread* get_or_create_global_timer_thread() {
 TimerThread* get_global_timer_thread() {
     return g_timer_thread;
 }
+TimerThread* get_timer_thread(bthread_tag_t tag) {
+    if (tag >= 0 && (size_t)tag < g_tagged_timer_threads.size()) {
+        return g_tagged_timer_threads[tag];
+    }
+    return g_timer_thread;
+}
 
 }  // end namespace bthread
@@ -26,6 +26,7 @@
 #include "butil/atomicops.h" 
 #include "butil/time.h"                // time utilities
 #include "bthread/mutex.h"
+#include "bthread/types.h"            // bthread_tag_t
 
 namespace bthread {
 
@@ -43,6 +44,14 @@ struct TimerThreadOptions {
     // Default: ""
     std::string bvar_prefix;
 
+    // If this field is positive, scheduled tasks are kept in a hierarchical
+    // timing wheel with ticks of so many microseconds instead of a heap.
+    // Scheduling and running a task are O(1) and tasks are pushed into
+    // buckets without locking, but tasks may run at most one tick later
+    // than scheduled.
+    // Default: 0
+    int64_t wheel_tick_us;
+
     // Constructed with default options.
     TimerThreadOptions();
 };
@@ -54,6 +63,7 @@ class TimerThread {
 public:
     struct Task;
     class Bucket;
+    class Wheel;
 
     typedef uint64_t TaskId;
     const static TaskId INVALID_TASK_ID;
@@ -89,6 +99,11 @@ private:
     // the timer thread will run this method.
     void run();
     static void* run_this(void* arg);
+    // run() with the timing wheel.
+    void run_wheel(size_t* nscheduled, size_t* ntriggered,
+                   double* busy_seconds);
+    TaskId schedule_to_wheel(void (*fn)(void*), void* arg,
+                             const timespec& abstime);
 
     bool _started;            // whether the timer thread was started successfully.
     butil::atomic<bool> _stop;
@@ -97,6 +112,8 @@ private:
     Bucket* _buckets;        // list of tasks to be run
     FastPthreadMutex _mutex;    // protect _nearest_run_time
     int64_t _nearest_run_time;
+    // Realtime that the timer thread using the wheel will wake up at.
+    butil::atomic<int64_t> _wheel_wakeup_time;
     // the futex for wake up timer thread. can't use _nearest_run_time because
     // it's 64-bit.
     int _nsignals;
@@ -107,6 +124,13 @@ private:
 TimerThread* get_or_create_global_timer_thread();
 TimerThread* get_global_timer_thread();
 
+// Get the TimerThread to schedule timers of bthreads in `tag', which is the
+// global one unless -bthread_timer_thread_per_tag is on. Created along with
+// the global TimerThread.
+// NOTE: TaskIds are unique among all TimerThreads, a task can be unscheduled
+// by any TimerThread.
+TimerThread* get_timer_thread(bthread_tag_t tag);
+
 }   // end namespace bthread
 
 #endif  // BTHREAD_TIMER_THREAD_H
@@ -63,6 +63,9 @@ typedef struct {
 
 static const bthread_key_t INVALID_BTHREAD_KEY = { 0, 0 };
 
+// Number of static bthread-local slots, see bthread_set_static_local().
+#define BTHREAD_STATIC_LOCAL_SLOTS 4
+
 #if defined(__cplusplus)
 // Overload operators for bthread_key_t
 inline bool operator==(bthread_key_t key1, bthread_key_t key2)
@@ -86,7 +89,7 @@ inline std::ostream& operator<<(std::ostream& os, bthread_key_t key) {
 #endif  // __cplusplus
 
 typedef struct {
-    pthread_rwlock_t rwlock;
+    pthread_rwlock_t rwlock;  // Not used anymore.
     void* list;
     void* free_keytables;
     size_t size;
@@ -180,7 +183,8 @@ typedef struct bthread_mutex_t {
     bthread_mutex_t()
         : butex(NULL), csite{}
         , enable_csite(false)
-        , owner{false, 0} {}
+        , owner{false, 0}
+        , spin_count(0) {}
 
     DISALLOW_COPY_AND_ASSIGN(bthread_mutex_t);
 #endif
@@ -191,6 +195,8 @@ typedef struct bthread_mutex_t {
     // slowdown of about 50%, so it is only used for debugging and is
     // only available when the macro `BRPC_DEBUG_LOCK' = 1.
     mutex_owner_t owner;
+    // Estimated spins to acquire the mutex, used by adaptive spinning.
+    int spin_count;
 } bthread_mutex_t;
 
 typedef struct {
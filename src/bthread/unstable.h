@@ -92,6 +92,13 @@ extern int bthread_set_worker_startfn(void (*start_fn)());
 // Add a startup function with tag
 extern int bthread_set_tagged_worker_startfn(void (*start_fn)(bthread_tag_t));
 
+// Add a function that each pthread worker runs before sleeping when there is
+// no bthread to run, e.g. to poll events by itself. The worker looks for
+// bthreads again instead of sleeping if the function returns true, which
+// means that it may have created bthreads.
+// Returns 0 on success, error code otherwise.
+extern int bthread_set_worker_idlefn(bool (*idle_fn)());
+
 // Add a create span function
 extern int bthread_set_create_span_func(void* (*func)());
 
@@ -140,6 +147,12 @@ extern void bthread_keytable_pool_reserve(
     bthread_keytable_pool_t* pool, size_t nfree,
     bthread_key_t key, void* ctor(const void* args), const void* args);
 
+// Set the function returning bytes allocated by the calling pthread so far,
+// which is generally provided by the malloc implementation (e.g.
+// "thread.allocated" of jemalloc). Workers read it at each context switch
+// to make bthread_allocated_bytes() work. `fn' should be cheap.
+extern void bthread_set_thread_allocated_bytes_fn(uint64_t (*fn)(void));
+
 __END_DECLS
 
 #endif  // BTHREAD_UNSTABLE_H
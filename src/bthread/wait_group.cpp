@@ -0,0 +1,121 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// bthread - An M:N threading library to make applications more concurrent.
+
+#include <new>                    // std::nothrow
+#include "bthread/butex.h"
+#include "bthread/wait_group.h"
+
+namespace bthread {
+
+struct WaitGroup::Child {
+    WaitGroup* wg;
+    void* (*fn)(void*);
+    void* arg;
+    int shard;
+};
+
+WaitGroup::WaitGroup()
+    : _nactive(1)
+    , _butex(butex_create_checked<int>())
+    , _nstarted(0) {
+    for (int i = 0; i < NSHARD; ++i) {
+        _shards[i].nrunning.store(0, butil::memory_order_relaxed);
+    }
+    *_butex = 0;
+}
+
+WaitGroup::~WaitGroup() {
+    if (_nstarted != 0) {
+        wait();
+    }
+    butex_destroy(_butex);
+}
+
+void* WaitGroup::run_child(void* arg) {
+    Child* c = static_cast<Child*>(arg);
+    c->fn(c->arg);
+    WaitGroup* wg = c->wg;
+    const int shard = c->shard;
+    delete c;
+    wg->on_child_end(shard);
+    return NULL;
+}
+
+void WaitGroup::on_child_end(int shard) {
+    if (_shards[shard].nrunning.fetch_sub(1, butil::memory_order_acq_rel) != 1) {
+        return;
+    }
+    if (_nactive.fetch_sub(1, butil::memory_order_acq_rel) != 1) {
+        return;
+    }
+    // The waiter may return and destroy *this once it sees the butex
+    // changed, save it. Butexes are never freed.
+    butil::atomic<int>* const butex = (butil::atomic<int>*)_butex;
+    butex->store(1, butil::memory_order_release);
+    // DON'T touch *this ever after.
+    // Don't signal other workers: the waiter is put into the runqueue of
+    // current worker and runs right after this bthread quits.
+    butex_wake(butex, true);
+}
+
+int WaitGroup::start(void* (*fn)(void*), void* arg,
+                     const bthread_attr_t* attr) {
+    Child* c = new (std::nothrow) Child;
+    if (c == NULL) {
+        return ENOMEM;
+    }
+    c->wg = this;
+    c->fn = fn;
+    c->arg = arg;
+    c->shard = _nstarted++ % NSHARD;
+    // Only the bthread being started can finish the shard if it was empty,
+    // activating the shard after counting the bthread is safe.
+    if (_shards[c->shard].nrunning.fetch_add(
+            1, butil::memory_order_relaxed) == 0) {
+        _nactive.fetch_add(1, butil::memory_order_relaxed);
+    }
+    bthread_t tid;
+    const int rc = bthread_start_background(&tid, attr, run_child, c);
+    if (rc != 0) {
+        const int shard = c->shard;
+        delete c;
+        // Never reaches 0 since the WaitGroup holds one.
+        on_child_end(shard);
+    }
+    return rc;
+}
+
+int WaitGroup::wait() {
+    _nstarted = 0;
+    if (_nactive.fetch_sub(1, butil::memory_order_acq_rel) != 1) {
+        butil::atomic<int>* const butex = (butil::atomic<int>*)_butex;
+        while (butex->load(butil::memory_order_acquire) == 0) {
+            if (butex_wait(butex, 0, NULL) < 0 &&
+                errno != EWOULDBLOCK && errno != EINTR) {
+                return errno;
+            }
+        }
+    }
+    // Ready for next round.
+    *_butex = 0;
+    _nactive.store(1, butil::memory_order_relaxed);
+    return 0;
+}
+
+}  // namespace bthread
@@ -0,0 +1,85 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// bthread - An M:N threading library to make applications more concurrent.
+
+#ifndef BTHREAD_WAIT_GROUP_H
+#define BTHREAD_WAIT_GROUP_H
+
+#include "butil/atomicops.h"
+#include "butil/macros.h"
+#include "bthread/bthread.h"
+
+namespace bthread {
+
+// Start bthreads and wait for all of them to finish, cheaper than calling
+// bthread_join() on each of them or signaling a CountdownEvent at the end
+// of each of them:
+//  - Finished bthreads are counted in several cacheline-separated shards,
+//    only the one finishing a shard touches the shared counter.
+//  - The waiter parks at most once and is woken only by the last finished
+//    bthread, which puts the waiter in the runqueue of its own worker
+//    without signaling other workers, so that the waiter runs right after
+//    the last bthread quits.
+// Example:
+//   bthread::WaitGroup wg;
+//   for (int i = 0; i < 100; ++i) {
+//       wg.start(fetch_shard, &shards[i]);
+//   }
+//   wg.wait();
+// start() and wait() should be called by one thread. The WaitGroup can be
+// reused after wait() returns.
+class WaitGroup {
+public:
+    WaitGroup();
+    // Wait for unfinished bthreads.
+    ~WaitGroup();
+
+    // Start a bthread in background to run fn(arg) with `attr' (NULL means
+    // BTHREAD_ATTR_NORMAL). Return value of `fn' is ignored.
+    // Returns 0 on success, error code otherwise.
+    int start(void* (*fn)(void*), void* arg,
+              const bthread_attr_t* attr = NULL);
+
+    // Block until all bthreads started since last wait() finish.
+    // Returns 0 on success, error code otherwise.
+    int wait();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(WaitGroup);
+
+    static const int NSHARD = 8;
+    struct BAIDU_CACHELINE_ALIGNMENT Shard {
+        butil::atomic<int> nrunning;
+    };
+    struct Child;
+    static void* run_child(void* arg);
+    void on_child_end(int shard);
+
+    Shard _shards[NSHARD];
+    // Number of shards with running bthreads, plus one held by the
+    // WaitGroup until wait() is called.
+    butil::atomic<int> _nactive BAIDU_CACHELINE_ALIGNMENT;
+    // Set to 1 by the last finished bthread.
+    int* _butex;
+    // Number of bthreads started since last wait().
+    int _nstarted;
+};
+
+}  // namespace bthread
+
+#endif  // BTHREAD_WAIT_GROUP_H
@@ -18,6 +18,7 @@
 // Date: Fri Jun  5 18:25:40 CST 2015
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <algorithm>
 #include "butil/arena.h"
 
@@ -26,25 +27,29 @@ namespace butil {
 ArenaOptions::ArenaOptions()
     : initial_block_size(64)
     , max_block_size(8192)
+    , max_reserved_size(65536)
 {}
 
 Arena::Arena(const ArenaOptions& options)
     : _cur_block(NULL)
     , _isolated_blocks(NULL)
     , _block_size(options.initial_block_size)
+    , _high_water(0)
     , _options(options) {
 }
 
 Arena::~Arena() {
-    while (_cur_block != NULL) {
-        Block* const saved_next = _cur_block->next;
-        free(_cur_block);
-        _cur_block = saved_next;
-    }
-    while (_isolated_blocks != NULL) {
-        Block* const saved_next = _isolated_blocks->next;
-        free(_isolated_blocks);
-        _isolated_blocks = saved_next;
+    free_blocks(_cur_block, NULL);
+    free_blocks(_isolated_blocks, NULL);
+}
+
+void Arena::free_blocks(Block* head, Block* except) {
+    while (head != NULL) {
+        Block* const saved_next = head->next;
+        if (head != except) {
+            free(head);
+        }
+        head = saved_next;
     }
 }
 
@@ -52,15 +57,76 @@ void Arena::swap(Arena& other) {
     std::swap(_cur_block, other._cur_block);
     std::swap(_isolated_blocks, other._isolated_blocks);
     std::swap(_block_size, other._block_size);
+    std::swap(_high_water, other._high_water);
     const ArenaOptions tmp = _options;
     _options = other._options;
     other._options = tmp;
 }
 
 void Arena::clear() {
-    // TODO(gejun): Reuse memory
-    Arena a;
-    swap(a);
+    free_blocks(_cur_block, NULL);
+    free_blocks(_isolated_blocks, NULL);
+    _cur_block = NULL;
+    _isolated_blocks = NULL;
+    _block_size = _options.initial_block_size;
+    _high_water = 0;
+}
+
+void Arena::reset() {
+    size_t used = 0;
+    Block* largest = NULL;
+    Block* const lists[2] = { _cur_block, _isolated_blocks };
+    for (size_t i = 0; i < arraysize(lists); ++i) {
+        for (Block* b = lists[i]; b != NULL; b = b->next) {
+            used += b->alloc_size;
+            if (largest == NULL || b->size > largest->size) {
+                largest = b;
+            }
+        }
+    }
+    _high_water = std::max(_high_water, used);
+    const size_t reserved = std::min(_high_water, _options.max_reserved_size);
+    Block* kept = NULL;
+    if (largest != NULL && largest->size >= reserved &&
+        largest->size <= _options.max_reserved_size) {
+        kept = largest;
+    }
+    free_blocks(_cur_block, kept);
+    free_blocks(_isolated_blocks, kept);
+    if (kept == NULL && reserved != 0) {
+        // Replace blocks of last use with one block holding all of them.
+        kept = (Block*)malloc(offsetof(Block, data) + reserved);
+        if (kept != NULL) {
+            kept->size = reserved;
+        }
+    }
+    if (kept != NULL) {
+        kept->next = NULL;
+        kept->alloc_size = 0;
+    }
+    _cur_block = kept;
+    _isolated_blocks = NULL;
+    _block_size = std::max<size_t>(kept ? kept->size : 0,
+                                   _options.initial_block_size);
+}
+
+void* Arena::allocate_aligned(size_t n, size_t alignment) {
+    if (_cur_block != NULL) {
+        const uintptr_t p =
+            (uintptr_t)(_cur_block->data + _cur_block->alloc_size);
+        const size_t pad = (-p) & (alignment - 1);
+        if (_cur_block->left_space() >= pad + n) {
+            _cur_block->alloc_size += pad + n;
+            return (void*)(p + pad);
+        }
+    }
+    // Data of new blocks are aligned by malloc which may be less than
+    // `alignment', allocate more to align the address.
+    char* p = (char*)allocate_in_other_blocks(n + alignment - 1);
+    if (p == NULL) {
+        return NULL;
+    }
+    return (void*)(((uintptr_t)p + alignment - 1) & ~(uintptr_t)(alignment - 1));
 }
 
 void* Arena::allocate_new_block(size_t n) {
@@ -30,6 +30,8 @@ namespace butil {
 struct ArenaOptions {
     size_t initial_block_size;
     size_t max_block_size;
+    // reset() keeps a block no larger than this to serve next use.
+    size_t max_reserved_size;
 
     // Constructed with default options.
     ArenaOptions();
@@ -42,8 +44,16 @@ public:
     ~Arena();
     void swap(Arena&);
     void* allocate(size_t n);
-    void* allocate_aligned(size_t n);  // not implemented.
+    // Allocate `n' bytes aligned to `alignment', which must be power of 2.
+    void* allocate_aligned(size_t n, size_t alignment);
+    // Aligned to 16 bytes, enough for all fundamental types.
+    void* allocate_aligned(size_t n) { return allocate_aligned(n, 16); }
+    // Free all blocks.
     void clear();
+    // Invalidate all allocated memory but keep one block sized by the
+    // largest usage so far(capped by max_reserved_size), so that memory of
+    // the next use is probably allocated from the block without malloc.
+    void reset();
 
 private:
     DISALLOW_COPY_AND_ASSIGN(Arena);
@@ -59,6 +69,8 @@ private:
 
     void* allocate_in_other_blocks(size_t n);
     void* allocate_new_block(size_t n);
+    // Free blocks in the list of `head' except `except'.
+    static void free_blocks(Block* head, Block* except);
     Block* pop_block(Block* & head) {
         Block* saved_head = head;
         head = head->next;
@@ -68,6 +80,8 @@ private:
     Block* _cur_block;
     Block* _isolated_blocks;
     size_t _block_size;
+    // Max bytes allocated between two reset().
+    size_t _high_water;
     ArenaOptions _options;
 };
 
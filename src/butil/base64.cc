@@ -4,16 +4,364 @@
 
 #include "butil/base64.h"
 
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "butil/cpu.h"
+#include "butil/iobuf.h"
 #include "third_party/modp_b64/modp_b64.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BUTIL_BASE64_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BUTIL_BASE64_NEON 1
+#endif
+
 namespace butil {
 
+namespace {
+
+// SIMD kernels process the bulk of the input, modp_b64 processes the rest
+// (and the padding). Encoding kernels consume multiples of 3 bytes and
+// return the number of consumed bytes. Decoding kernels consume multiples
+// of 4 chars, always leave at least 4 chars (which may contain padding) to
+// modp_b64, and return the number of consumed chars or MODP_B64_ERROR on
+// invalid chars. Decoding kernels may write up to 32 bytes more than
+// decoded.
+typedef size_t (*EncodeKernel)(const uint8_t* src, size_t len, char* dst);
+typedef size_t (*DecodeKernel)(const char* src, size_t len, uint8_t* dst);
+
+const size_t kDecodeSlack = 32;
+
+size_t EncodeNone(const uint8_t*, size_t, char*) { return 0; }
+size_t DecodeNone(const char*, size_t, uint8_t*) { return 0; }
+
+#if defined(BUTIL_BASE64_X86)
+
+// The algorithms are from "Faster Base64 Encoding and Decoding using AVX2
+// Instructions" by Wojciech Mula and Daniel Lemire.
+
+__attribute__((target("ssse3")))
+inline __m128i EncodeLookup(__m128i indices) {
+  // Offsets added to indices in ranges [0,26), [26,52), [52,62), 62, 63.
+  __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+  const __m128i shift_lut = _mm_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+      '/' - 63, 'A', 0, 0);
+  result = _mm_shuffle_epi8(shift_lut, result);
+  return _mm_add_epi8(result, indices);
+}
+
+__attribute__((target("ssse3")))
+size_t EncodeSSSE3(const uint8_t* src, size_t len, char* dst) {
+  size_t i = 0;
+  // Loads 16 bytes and uses 12 of them.
+  for (; i + 16 <= len; i += 12) {
+    __m128i in = _mm_loadu_si128((const __m128i*)(src + i));
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    const __m128i out = EncodeLookup(_mm_or_si128(t1, t3));
+    _mm_storeu_si128((__m128i*)dst, out);
+    dst += 16;
+  }
+  return i;
+}
+
+// Translate chars into 6-bit values. Returns false on invalid chars.
+__attribute__((target("sse4.1")))
+inline bool DecodeLookup(__m128i* in) {
+  const __m128i higher_nibble =
+      _mm_and_si128(_mm_srli_epi32(*in, 4), _mm_set1_epi8(0x0f));
+  const __m128i lower_nibble = _mm_and_si128(*in, _mm_set1_epi8(0x0f));
+  const __m128i shift_lut = _mm_setr_epi8(
+      0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_lut = _mm_setr_epi8(
+      (char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+      (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+      (char)0xf0, 0x54, 0x50, 0x50, 0x50, 0x54);
+  const __m128i bitpos_lut = _mm_setr_epi8(
+      0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+      0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i sh = _mm_shuffle_epi8(shift_lut, higher_nibble);
+  const __m128i eq_2f = _mm_cmpeq_epi8(*in, _mm_set1_epi8(0x2f));
+  const __m128i shift = _mm_blendv_epi8(sh, _mm_set1_epi8(16), eq_2f);
+  const __m128i m = _mm_shuffle_epi8(mask_lut, lower_nibble);
+  const __m128i bit = _mm_shuffle_epi8(bitpos_lut, higher_nibble);
+  const __m128i non_match =
+      _mm_cmpeq_epi8(_mm_and_si128(m, bit), _mm_setzero_si128());
+  if (_mm_movemask_epi8(non_match)) {
+    return false;
+  }
+  *in = _mm_add_epi8(*in, shift);
+  return true;
+}
+
+// Pack 16 6-bit values into 12 bytes at the beginning of each lane.
+__attribute__((target("sse4.1")))
+inline __m128i DecodePack(__m128i values) {
+  const __m128i ab_bc =
+      _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  const __m128i out = _mm_madd_epi16(ab_bc, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(out, _mm_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("sse4.1")))
+size_t DecodeSSE41(const char* src, size_t len, uint8_t* dst) {
+  size_t i = 0;
+  for (; i + 16 + 4 <= len; i += 16) {
+    __m128i in = _mm_loadu_si128((const __m128i*)(src + i));
+    if (!DecodeLookup(&in)) {
+      return MODP_B64_ERROR;
+    }
+    _mm_storeu_si128((__m128i*)dst, DecodePack(in));
+    dst += 12;
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+size_t EncodeAVX2(const uint8_t* src, size_t len, char* dst) {
+  size_t i = 0;
+  // Loads [i, i + 16) and [i + 12, i + 28) into the two lanes.
+  for (; i + 28 <= len; i += 24) {
+    __m256i in = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src + i))),
+        _mm_loadu_si128((const __m128i*)(src + i + 12)), 1);
+    in = _mm256_shuffle_epi8(in, _mm256_set_epi8(
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    const __m256i indices = _mm256_or_si256(t1, t3);
+
+    __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    result = _mm256_or_si256(
+        result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    const __m256i shift_lut = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+    result = _mm256_shuffle_epi8(shift_lut, result);
+    _mm256_storeu_si256((__m256i*)dst, _mm256_add_epi8(result, indices));
+    dst += 32;
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+size_t DecodeAVX2(const char* src, size_t len, uint8_t* dst) {
+  const __m256i shift_lut = _mm256_setr_epi8(
+      0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_lut = _mm256_setr_epi8(
+      (char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+      (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+      (char)0xf0, 0x54, 0x50, 0x50, 0x50, 0x54,
+      (char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+      (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+      (char)0xf0, 0x54, 0x50, 0x50, 0x50, 0x54);
+  const __m256i bitpos_lut = _mm256_setr_epi8(
+      0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+      0, 0, 0, 0, 0, 0, 0, 0);
+  size_t i = 0;
+  for (; i + 32 + 4 <= len; i += 32) {
+    const __m256i in = _mm256_loadu_si256((const __m256i*)(src + i));
+    const __m256i higher_nibble =
+        _mm256_and_si256(_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0f));
+    const __m256i lower_nibble = _mm256_and_si256(in, _mm256_set1_epi8(0x0f));
+    const __m256i sh = _mm256_shuffle_epi8(shift_lut, higher_nibble);
+    const __m256i eq_2f = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(0x2f));
+    const __m256i shift =
+        _mm256_blendv_epi8(sh, _mm256_set1_epi8(16), eq_2f);
+    const __m256i m = _mm256_shuffle_epi8(mask_lut, lower_nibble);
+    const __m256i bit = _mm256_shuffle_epi8(bitpos_lut, higher_nibble);
+    const __m256i non_match =
+        _mm256_cmpeq_epi8(_mm256_and_si256(m, bit), _mm256_setzero_si256());
+    if (_mm256_movemask_epi8(non_match)) {
+      return MODP_B64_ERROR;
+    }
+    const __m256i values = _mm256_add_epi8(in, shift);
+    const __m256i ab_bc =
+        _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    __m256i out = _mm256_madd_epi16(ab_bc, _mm256_set1_epi32(0x00011000));
+    out = _mm256_shuffle_epi8(out, _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    // Move the 12 bytes of the high lane next to the ones of the low lane.
+    out = _mm256_permutevar8x32_epi32(
+        out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256((__m256i*)dst, out);
+    dst += 24;
+  }
+  return i;
+}
+
+#elif defined(BUTIL_BASE64_NEON)
+
+size_t EncodeNEON(const uint8_t* src, size_t len, char* dst) {
+  static const uint8_t kTable[64] = {
+      'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
+      'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
+      'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
+      'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
+      '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/'};
+  const uint8x16x4_t table = vld1q_u8_x4(kTable);
+  const uint8x16_t mask = vdupq_n_u8(0x3f);
+  size_t i = 0;
+  for (; i + 48 <= len; i += 48) {
+    // De-interleave 16 groups of 3 bytes.
+    const uint8x16x3_t in = vld3q_u8(src + i);
+    uint8x16x4_t out;
+    out.val[0] = vshrq_n_u8(in.val[0], 2);
+    out.val[1] = vandq_u8(
+        vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), mask);
+    out.val[2] = vandq_u8(
+        vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), mask);
+    out.val[3] = vandq_u8(in.val[2], mask);
+    out.val[0] = vqtbl4q_u8(table, out.val[0]);
+    out.val[1] = vqtbl4q_u8(table, out.val[1]);
+    out.val[2] = vqtbl4q_u8(table, out.val[2]);
+    out.val[3] = vqtbl4q_u8(table, out.val[3]);
+    vst4q_u8((uint8_t*)dst, out);
+    dst += 64;
+  }
+  return i;
+}
+
+size_t DecodeNEON(const char* src, size_t len, uint8_t* dst) {
+  // Values of chars in [0, 128), 0xff for invalid chars.
+  static const uint8_t kTable[128] = {
+      255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+      255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+      255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+      255, 255, 255, 255, 62,  255, 255, 255, 63,  52,  53,  54,  55,
+      56,  57,  58,  59,  60,  61,  255, 255, 255, 255, 255, 255, 255,
+      0,   1,   2,   3,   4,   5,   6,   7,   8,   9,   10,  11,  12,
+      13,  14,  15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25,
+      255, 255, 255, 255, 255, 255, 26,  27,  28,  29,  30,  31,  32,
+      33,  34,  35,  36,  37,  38,  39,  40,  41,  42,  43,  44,  45,
+      46,  47,  48,  49,  50,  51,  255, 255, 255, 255, 255};
+  const uint8x16x4_t table_lo = vld1q_u8_x4(kTable);
+  const uint8x16x4_t table_hi = vld1q_u8_x4(kTable + 64);
+  const uint8x16_t offset = vdupq_n_u8(64);
+  size_t i = 0;
+  for (; i + 64 + 4 <= len; i += 64) {
+    uint8x16x4_t in = vld4q_u8((const uint8_t*)src + i);
+    uint8x16_t invalid = vdupq_n_u8(0);
+    for (int j = 0; j < 4; ++j) {
+      // Out-of-range indices of vqtbl4q_u8 give 0. Chars >= 128 are
+      // out of range of both tables.
+      const uint8x16_t c = in.val[j];
+      const uint8x16_t v = vorrq_u8(vqtbl4q_u8(table_lo, c),
+                                    vqtbl4q_u8(table_hi, vsubq_u8(c, offset)));
+      invalid = vorrq_u8(invalid, vorrq_u8(vcgeq_u8(c, vdupq_n_u8(128)),
+                                           vcgtq_u8(v, vdupq_n_u8(63))));
+      in.val[j] = v;
+    }
+    if (vmaxvq_u8(invalid) != 0) {
+      return MODP_B64_ERROR;
+    }
+    uint8x16x3_t out;
+    out.val[0] = vorrq_u8(vshlq_n_u8(in.val[0], 2), vshrq_n_u8(in.val[1], 4));
+    out.val[1] = vorrq_u8(vshlq_n_u8(in.val[1], 4), vshrq_n_u8(in.val[2], 2));
+    out.val[2] = vorrq_u8(vshlq_n_u8(in.val[2], 6), in.val[3]);
+    vst3q_u8(dst, out);
+    dst += 48;
+  }
+  return i;
+}
+
+#endif  // BUTIL_BASE64_NEON
+
+struct Kernels {
+  EncodeKernel encode;
+  DecodeKernel decode;
+};
+
+Kernels ChooseKernels() {
+  Kernels k = { EncodeNone, DecodeNone };
+#if defined(BUTIL_BASE64_X86)
+  const CPU cpu;
+  if (cpu.has_avx2()) {
+    k.encode = EncodeAVX2;
+    k.decode = DecodeAVX2;
+  } else if (cpu.has_sse41()) {
+    k.encode = EncodeSSSE3;
+    k.decode = DecodeSSE41;
+  } else if (cpu.has_ssse3()) {
+    k.encode = EncodeSSSE3;
+  }
+#elif defined(BUTIL_BASE64_NEON)
+  k.encode = EncodeNEON;
+  k.decode = DecodeNEON;
+#endif
+  return k;
+}
+
+const Kernels& GetKernels() {
+  static const Kernels s_kernels = ChooseKernels();
+  return s_kernels;
+}
+
+// Encode `len' bytes into `dst' which has at least
+// modp_b64_encode_len(len) bytes. Returns number of chars.
+size_t EncodeRaw(const char* src, size_t len, char* dst) {
+  const size_t n = GetKernels().encode((const uint8_t*)src, len, dst);
+  return n / 3 * 4 + modp_b64_encode(dst + n / 3 * 4, src + n, len - n);
+}
+
+// Decode `len' chars into `dst' which has at least
+// modp_b64_decode_len(len) + kDecodeSlack bytes. Padding is only allowed
+// when `last' is true. Returns number of bytes or MODP_B64_ERROR.
+size_t DecodeRaw(const char* src, size_t len, char* dst, bool last) {
+  if (len == 0) {
+    return 0;
+  }
+  if (!last && (len % 4 != 0 || src[len - 1] == '=')) {
+    return MODP_B64_ERROR;
+  }
+  size_t n = 0;
+  if (len % 4 == 0) {
+    n = GetKernels().decode(src, len, (uint8_t*)dst);
+    if (n == MODP_B64_ERROR) {
+      return MODP_B64_ERROR;
+    }
+  }
+  const size_t m = modp_b64_decode(dst + n / 4 * 3, src + n, len - n);
+  if (m == MODP_B64_ERROR) {
+    return MODP_B64_ERROR;
+  }
+  return n / 4 * 3 + m;
+}
+
+}  // namespace
+
 void Base64Encode(const StringPiece& input, std::string* output) {
   std::string temp;
   temp.resize(modp_b64_encode_len(input.size()));  // makes room for null byte
 
   // modp_b64_encode_len() returns at least 1, so temp[0] is safe to use.
-  size_t output_size = modp_b64_encode(&(temp[0]), input.data(), input.size());
+  size_t output_size = EncodeRaw(input.data(), input.size(), &(temp[0]));
 
   temp.resize(output_size);  // strips off null byte
   output->swap(temp);
@@ -21,11 +369,10 @@ void Base64Encode(const StringPiece& input, std::string* output) {
 
 bool Base64Decode(const StringPiece& input, std::string* output) {
   std::string temp;
-  temp.resize(modp_b64_decode_len(input.size()));
+  temp.resize(modp_b64_decode_len(input.size()) + kDecodeSlack);
 
   // does not null terminate result since result is binary data!
-  size_t input_size = input.size();
-  size_t output_size = modp_b64_decode(&(temp[0]), input.data(), input_size);
+  size_t output_size = DecodeRaw(input.data(), input.size(), &(temp[0]), true);
   if (output_size == MODP_B64_ERROR)
     return false;
 
@@ -34,4 +381,86 @@ bool Base64Decode(const StringPiece& input, std::string* output) {
   return true;
 }
 
+void Base64Encode(const IOBuf& input, std::string* output) {
+  if (input.backing_block_num() <= 1) {
+    return Base64Encode(input.backing_block(0), output);
+  }
+  std::string temp;
+  temp.resize(modp_b64_encode_len(input.size()));
+  char* dst = &(temp[0]);
+  // Bytes at the end of previous blocks which do not fill a group of 3.
+  char carry[3];
+  size_t ncarry = 0;
+  for (size_t i = 0; i < input.backing_block_num(); ++i) {
+    StringPiece block = input.backing_block(i);
+    if (ncarry != 0) {
+      const size_t n = std::min(block.size(), 3 - ncarry);
+      memcpy(carry + ncarry, block.data(), n);
+      ncarry += n;
+      block.remove_prefix(n);
+      if (ncarry < 3) {
+        continue;
+      }
+      dst += EncodeRaw(carry, 3, dst);
+      ncarry = 0;
+    }
+    const size_t n = block.size() / 3 * 3;
+    dst += EncodeRaw(block.data(), n, dst);
+    ncarry = block.size() - n;
+    memcpy(carry, block.data() + n, ncarry);
+  }
+  dst += EncodeRaw(carry, ncarry, dst);
+  temp.resize(dst - &(temp[0]));
+  output->swap(temp);
+}
+
+bool Base64Decode(const IOBuf& input, std::string* output) {
+  if (input.backing_block_num() <= 1) {
+    return Base64Decode(input.backing_block(0), output);
+  }
+  std::string temp;
+  temp.resize(modp_b64_decode_len(input.size()) + kDecodeSlack);
+  char* dst = &(temp[0]);
+  // Chars at the end of previous blocks which do not fill a group of 4.
+  char carry[4];
+  size_t ncarry = 0;
+  size_t remaining = input.size();
+  for (size_t i = 0; i < input.backing_block_num(); ++i) {
+    StringPiece block = input.backing_block(i);
+    remaining -= block.size();
+    if (ncarry != 0) {
+      const size_t n = std::min(block.size(), 4 - ncarry);
+      memcpy(carry + ncarry, block.data(), n);
+      ncarry += n;
+      block.remove_prefix(n);
+      if (ncarry < 4) {
+        continue;
+      }
+      const size_t m = DecodeRaw(
+          carry, 4, dst, block.empty() && remaining == 0);
+      if (m == MODP_B64_ERROR) {
+        return false;
+      }
+      dst += m;
+      ncarry = 0;
+    }
+    const bool last = (remaining == 0);
+    const size_t n = last ? block.size() : block.size() / 4 * 4;
+    const size_t m = DecodeRaw(block.data(), n, dst, last);
+    if (m == MODP_B64_ERROR) {
+      return false;
+    }
+    dst += m;
+    ncarry = block.size() - n;
+    memcpy(carry, block.data() + n, ncarry);
+  }
+  if (ncarry != 0) {
+    // Not a multiple of 4.
+    return false;
+  }
+  temp.resize(dst - &(temp[0]));
+  output->swap(temp);
+  return true;
+}
+
 }  // namespace butil
@@ -12,6 +12,11 @@
 
 namespace butil {
 
+class IOBuf;
+
+// The codecs run SIMD kernels (AVX2/SSE4.1 on x86_64, NEON on aarch64)
+// selected at runtime on most of the input.
+
 // Encodes the input string in base64.
 BUTIL_EXPORT void Base64Encode(const StringPiece& input, std::string* output);
 
@@ -19,6 +24,10 @@ BUTIL_EXPORT void Base64Encode(const StringPiece& input, std::string* output);
 // otherwise.  The output string is only modified if successful.
 BUTIL_EXPORT bool Base64Decode(const StringPiece& input, std::string* output);
 
+// Same as above, with input in (possibly multiple) blocks of an IOBuf.
+BUTIL_EXPORT void Base64Encode(const IOBuf& input, std::string* output);
+BUTIL_EXPORT bool Base64Decode(const IOBuf& input, std::string* output);
+
 }  // namespace butil
 
 #endif  // BUTIL_BASE64_H__
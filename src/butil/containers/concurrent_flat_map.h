@@ -0,0 +1,405 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// A hash-map which can be read and modified by multiple threads at the same
+// time. Keys are hashed into shards, each shard is a chained hash table
+// whose nodes are immutable after being linked:
+//  * Readers never lock, they walk the chains inside an epoch, which delays
+//    freeing of nodes unlinked during the epoch.
+//  * Writers lock the shard of the key. Updating a value links a new node
+//    in place of the old one. Growing a shard builds a new table.
+//  * Unlinked nodes and tables are freed when all readers which could see
+//    them leave their epochs.
+//
+// Comparing to DoublyBufferedData<FlatMap>, writes don't wait for readers
+// of all threads and the map is not stored twice; comparing to FlatMap
+// protected by a mutex, reads never block. The cost is one allocation per
+// element and copying the value on every update.
+//
+// NOTE: Callbacks passed to read() and for_each() should not suspend the
+// calling bthread, which delays memory reclamation, see butil/epoch.h
+
+#ifndef BUTIL_CONCURRENT_FLAT_MAP_H
+#define BUTIL_CONCURRENT_FLAT_MAP_H
+
+#include <pthread.h>
+#include <algorithm>                              // std::sort
+#include <vector>
+#include "butil/macros.h"
+#include "butil/atomicops.h"
+#include "butil/epoch.h"
+#include "butil/containers/flat_map.h"            // DefaultHasher
+#include "butil/third_party/murmurhash3/murmurhash3.h"  // fmix64
+
+namespace butil {
+
+// Example:
+//   butil::ConcurrentFlatMap<uint64_t, std::string> m;
+//   m.insert(1, "a");                      // in any thread
+//   std::string v;
+//   if (m.seek(1, &v)) { ... }             // in any thread, never blocks
+//   m.erase(1);
+template <typename _K, typename _T,
+          // Compute hash code from key. The code is mixed again inside.
+          typename _Hash = DefaultHasher<_K>,
+          // Test equivalence between stored-key and passed-key.
+          typename _Equal = DefaultEqualTo<_K> >
+class ConcurrentFlatMap {
+public:
+    typedef _K key_type;
+    typedef _T mapped_type;
+    typedef _Hash hasher;
+    typedef _Equal key_equal;
+
+    // Insert `key' with `value', or erase `key' if `erase' is true.
+    struct Update {
+        Update() : erase(false) {}
+        key_type key;
+        mapped_type value;
+        bool erase;
+    };
+
+    static const size_t DEFAULT_NSHARD = 64;
+
+    // `nshard' is rounded up to power of 2.
+    explicit ConcurrentFlatMap(size_t nshard = DEFAULT_NSHARD,
+                               const hasher& hashfn = hasher(),
+                               const key_equal& eql = key_equal())
+        : _nshard(1), _hashfn(hashfn), _eql(eql) {
+        while (_nshard < nshard) {
+            _nshard *= 2;
+        }
+        _shards = new Shard[_nshard];
+    }
+
+    // No other threads should be accessing the map.
+    ~ConcurrentFlatMap() {
+        for (size_t i = 0; i < _nshard; ++i) {
+            delete_table(_shards[i].table.load(butil::memory_order_relaxed));
+        }
+        delete [] _shards;
+    }
+
+    // Copy the value associated with `key' into `value'.
+    // Returns true if `key' exists.
+    template <typename K2>
+    bool seek(const K2& key, mapped_type* value) const {
+        EpochGuard guard;
+        const Node* n = find(key);
+        if (n == NULL) {
+            return false;
+        }
+        *value = n->value;
+        return true;
+    }
+
+    // Call `fn(const mapped_type&)' with the value associated with `key'.
+    // Returns true if `key' exists.
+    template <typename K2, typename Fn>
+    bool read(const K2& key, Fn&& fn) const {
+        EpochGuard guard;
+        const Node* n = find(key);
+        if (n == NULL) {
+            return false;
+        }
+        fn(n->value);
+        return true;
+    }
+
+    // Insert a pair of `key' and `value', the value is replaced if `key'
+    // exists.
+    // Returns true if `key' is newly inserted.
+    bool insert(const key_type& key, const mapped_type& value) {
+        std::vector<EpochRetired> retired;
+        const size_t h = hash(key);
+        Shard& s = _shards[shard_index(h)];
+        pthread_mutex_lock(&s.mutex);
+        const bool inserted = insert_locked(s, h, key, value, &retired);
+        pthread_mutex_unlock(&s.mutex);
+        epoch_retire(retired);
+        return inserted;
+    }
+
+    // Remove `key' and the associated value.
+    // Returns 1 on erased, 0 otherwise.
+    size_t erase(const key_type& key) {
+        std::vector<EpochRetired> retired;
+        const size_t h = hash(key);
+        Shard& s = _shards[shard_index(h)];
+        pthread_mutex_lock(&s.mutex);
+        const size_t n = erase_locked(s, h, key, &retired);
+        pthread_mutex_unlock(&s.mutex);
+        epoch_retire(retired);
+        return n;
+    }
+
+    // Apply `updates' in order. Each involved shard is locked once and
+    // replaced nodes are reclaimed together, which is much faster than
+    // calling insert()/erase() one by one. Updates to different shards are
+    // not visible to readers atomically.
+    void bulk_apply(const std::vector<Update>& updates) {
+        std::vector<std::pair<size_t, size_t> > order;  // (shard, index)
+        std::vector<size_t> hashes(updates.size());
+        order.reserve(updates.size());
+        for (size_t i = 0; i < updates.size(); ++i) {
+            hashes[i] = hash(updates[i].key);
+            order.push_back(std::make_pair(shard_index(hashes[i]), i));
+        }
+        // Sorting by (shard, index) keeps updates to one key in order.
+        std::sort(order.begin(), order.end());
+        std::vector<EpochRetired> retired;
+        for (size_t i = 0; i < order.size();) {
+            Shard& s = _shards[order[i].first];
+            pthread_mutex_lock(&s.mutex);
+            const size_t shard = order[i].first;
+            for (; i < order.size() && order[i].first == shard; ++i) {
+                const Update& u = updates[order[i].second];
+                if (u.erase) {
+                    erase_locked(s, hashes[order[i].second], u.key, &retired);
+                } else {
+                    insert_locked(s, hashes[order[i].second], u.key,
+                                  u.value, &retired);
+                }
+            }
+            pthread_mutex_unlock(&s.mutex);
+        }
+        epoch_retire(retired);
+    }
+
+    // Call `fn(const key_type&, const mapped_type&)' with all elements,
+    // shard by shard. Elements modified during the call may or may not be
+    // visited.
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (size_t i = 0; i < _nshard; ++i) {
+            EpochGuard guard;
+            const Table* t = _shards[i].table.load(butil::memory_order_acquire);
+            if (t == NULL) {
+                continue;
+            }
+            for (size_t b = 0; b < t->nbucket; ++b) {
+                for (const Node* n = t->buckets[b].load(butil::memory_order_acquire);
+                     n != NULL; n = n->next.load(butil::memory_order_acquire)) {
+                    fn(n->key, n->value);
+                }
+            }
+        }
+    }
+
+    // Remove all elements.
+    void clear() {
+        std::vector<EpochRetired> retired;
+        for (size_t i = 0; i < _nshard; ++i) {
+            Shard& s = _shards[i];
+            pthread_mutex_lock(&s.mutex);
+            Table* t = s.table.exchange(NULL, butil::memory_order_acq_rel);
+            s.size.store(0, butil::memory_order_relaxed);
+            pthread_mutex_unlock(&s.mutex);
+            if (t != NULL) {
+                retire_table(t, &retired);
+            }
+        }
+        epoch_retire(retired);
+    }
+
+    // Number of elements, not synchronized with concurrent modifications.
+    size_t size() const {
+        size_t n = 0;
+        for (size_t i = 0; i < _nshard; ++i) {
+            n += _shards[i].size.load(butil::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    size_t shard_count() const { return _nshard; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ConcurrentFlatMap);
+
+    struct Node {
+        Node(const key_type& k, const mapped_type& v, Node* n)
+            : key(k), value(v), next(n) {}
+        const key_type key;
+        const mapped_type value;
+        butil::atomic<Node*> next;
+    };
+
+    struct Table {
+        size_t nbucket;
+        butil::atomic<Node*>* buckets;
+    };
+
+    struct BAIDU_CACHELINE_ALIGNMENT Shard {
+        Shard() : table(NULL), size(0) {
+            pthread_mutex_init(&mutex, NULL);
+        }
+        ~Shard() { pthread_mutex_destroy(&mutex); }
+
+        butil::atomic<Table*> table;
+        butil::atomic<size_t> size;
+        pthread_mutex_t mutex;
+    };
+
+    static const size_t INITIAL_NBUCKET = 16;
+
+    template <typename K2>
+    size_t hash(const K2& key) const {
+        return fmix64(_hashfn(key));
+    }
+    // Higher bits choose the shard, lower bits choose the bucket.
+    size_t shard_index(size_t h) const {
+        return (h >> 32) & (_nshard - 1);
+    }
+
+    template <typename K2>
+    const Node* find(const K2& key) const {
+        const size_t h = hash(key);
+        const Table* t =
+            _shards[shard_index(h)].table.load(butil::memory_order_acquire);
+        if (t == NULL) {
+            return NULL;
+        }
+        for (const Node* n = t->buckets[h & (t->nbucket - 1)].load(
+                 butil::memory_order_acquire);
+             n != NULL; n = n->next.load(butil::memory_order_acquire)) {
+            if (_eql(n->key, key)) {
+                return n;
+            }
+        }
+        return NULL;
+    }
+
+    static Table* new_table(size_t nbucket) {
+        Table* t = new Table;
+        t->nbucket = nbucket;
+        t->buckets = new butil::atomic<Node*>[nbucket];
+        for (size_t i = 0; i < nbucket; ++i) {
+            t->buckets[i].store(NULL, butil::memory_order_relaxed);
+        }
+        return t;
+    }
+
+    static void delete_table(Table* t) {
+        if (t == NULL) {
+            return;
+        }
+        for (size_t i = 0; i < t->nbucket; ++i) {
+            Node* n = t->buckets[i].load(butil::memory_order_relaxed);
+            while (n) {
+                Node* next = n->next.load(butil::memory_order_relaxed);
+                delete n;
+                n = next;
+            }
+        }
+        delete [] t->buckets;
+        delete t;
+    }
+
+    static void delete_table_void(void* t) { delete_table((Table*)t); }
+    static void delete_node_void(void* n) { delete (Node*)n; }
+
+    // Retire `t' and all nodes linked in it.
+    static void retire_table(Table* t, std::vector<EpochRetired>* retired) {
+        EpochRetired r = { t, delete_table_void };
+        retired->push_back(r);
+    }
+
+    bool insert_locked(Shard& s, size_t h, const key_type& key,
+                       const mapped_type& value,
+                       std::vector<EpochRetired>* retired) {
+        Table* t = s.table.load(butil::memory_order_relaxed);
+        if (t == NULL) {
+            t = new_table(INITIAL_NBUCKET);
+            s.table.store(t, butil::memory_order_release);
+        }
+        butil::atomic<Node*>* link = &t->buckets[h & (t->nbucket - 1)];
+        for (Node* n = link->load(butil::memory_order_relaxed); n != NULL;
+             n = link->load(butil::memory_order_relaxed)) {
+            if (_eql(n->key, key)) {
+                Node* new_node = new Node(
+                    key, value, n->next.load(butil::memory_order_relaxed));
+                link->store(new_node, butil::memory_order_release);
+                EpochRetired r = { n, delete_node_void };
+                retired->push_back(r);
+                return false;
+            }
+            link = &n->next;
+        }
+        butil::atomic<Node*>& head = t->buckets[h & (t->nbucket - 1)];
+        head.store(new Node(key, value, head.load(butil::memory_order_relaxed)),
+                   butil::memory_order_release);
+        const size_t size = s.size.load(butil::memory_order_relaxed) + 1;
+        s.size.store(size, butil::memory_order_relaxed);
+        if (size > t->nbucket) {
+            grow(s, t, retired);
+        }
+        return true;
+    }
+
+    size_t erase_locked(Shard& s, size_t h, const key_type& key,
+                        std::vector<EpochRetired>* retired) {
+        Table* t = s.table.load(butil::memory_order_relaxed);
+        if (t == NULL) {
+            return 0;
+        }
+        butil::atomic<Node*>* link = &t->buckets[h & (t->nbucket - 1)];
+        for (Node* n = link->load(butil::memory_order_relaxed); n != NULL;
+             n = link->load(butil::memory_order_relaxed)) {
+            if (_eql(n->key, key)) {
+                link->store(n->next.load(butil::memory_order_relaxed),
+                            butil::memory_order_release);
+                EpochRetired r = { n, delete_node_void };
+                retired->push_back(r);
+                s.size.store(s.size.load(butil::memory_order_relaxed) - 1,
+                             butil::memory_order_relaxed);
+                return 1;
+            }
+            link = &n->next;
+        }
+        return 0;
+    }
+
+    // Nodes of `t' may be being read, build a new table with copied nodes
+    // rather than relinking them.
+    void grow(Shard& s, Table* t,
+              std::vector<EpochRetired>* retired) {
+        Table* new_t = new_table(t->nbucket * 2);
+        for (size_t i = 0; i < t->nbucket; ++i) {
+            for (Node* n = t->buckets[i].load(butil::memory_order_relaxed);
+                 n != NULL; n = n->next.load(butil::memory_order_relaxed)) {
+                butil::atomic<Node*>& head =
+                    new_t->buckets[hash(n->key) & (new_t->nbucket - 1)];
+                head.store(new Node(n->key, n->value,
+                                    head.load(butil::memory_order_relaxed)),
+                           butil::memory_order_relaxed);
+            }
+        }
+        s.table.store(new_t, butil::memory_order_release);
+        retire_table(t, retired);
+    }
+
+    size_t _nshard;
+    Shard* _shards;
+    hasher _hashfn;
+    key_equal _eql;
+};
+
+}  // namespace butil
+
+#endif  // BUTIL_CONCURRENT_FLAT_MAP_H
@@ -24,6 +24,7 @@
 #include <vector>
 #include <memory>
 #include <pthread.h>
+#include <sched.h>
 #include "butil/scoped_lock.h"
 #include "butil/thread_local.h"
 #include "butil/logging.h"
@@ -77,13 +78,30 @@ namespace butil {
 // until thread-local reference counts which be protected by a thread-local
 // mutex become 0 to make sure all existing Read() finish and later Read()
 // see new foreground, then modify background(foreground before flip) again.
+//
+//
+// --- `VersionedRead=true' ---
+// It is not allowed to suspend bthread while reading, or to read the same
+// instance recursively, same as `AllowBthreadSuspended=false'.
+// Read() is wait-free: no mutex is locked and the thread-local wrapper is
+// not reference counted, which is much faster when Read() is called for
+// every RPC, e.g. by LoadBalancers.
+//
+// Read(): Increment thread-local version to an odd number, read the
+// foreground instance, then increment the version to an even number.
+//
+// Modify(): Modify background instance which is not used by any Read(), flip
+// foreground and background, wait until versions of all threads are even or
+// have changed, which means existing Read() finish and later Read() see new
+// foreground, then modify background(foreground before flip) again.
 
 class Void { };
 
 template <typename T> struct IsVoid : false_type { };
 template <> struct IsVoid<Void> : true_type { };
 
-template <typename T, typename TLS = Void, bool AllowBthreadSuspended = false>
+template <typename T, typename TLS = Void, bool AllowBthreadSuspended = false,
+          bool VersionedRead = false>
 class DoublyBufferedData {
     class Wrapper;
     class WrapperTLSGroup;
@@ -94,9 +112,13 @@ public:
     class ScopedPtr {
     friend class DoublyBufferedData;
     public:
-        ScopedPtr() : _data(NULL), _index(0), _w(NULL) {}
+        ScopedPtr() : _data(NULL), _index(0), _w(NULL), _versioned_w(NULL) {}
         ~ScopedPtr() {
-            if (_w) {
+            if (VersionedRead) {
+                if (_versioned_w) {
+                    _versioned_w->EndVersionedRead();
+                }
+            } else if (_w) {
                 if (AllowBthreadSuspended) {
                     _w->EndRead(_index);
                 } else {
@@ -107,14 +129,20 @@ public:
         const T* get() const { return _data; }
         const T& operator*() const { return *_data; }
         const T* operator->() const { return _data; }
-        TLS& tls() { return _w->user_tls(); }
-        
+        TLS& tls() {
+            return VersionedRead ? _versioned_w->user_tls() : _w->user_tls();
+        }
+
     private:
         DISALLOW_COPY_AND_ASSIGN(ScopedPtr);
         const T* _data;
         // Index of foreground instance used by ScopedPtr.
         int _index;
         WrapperSharedPtr _w;
+        // For `VersionedRead=true'. Owned by the thread-local block of the
+        // reading thread, which outlives the ScopedPtr since the bthread is
+        // never suspended while reading.
+        Wrapper* _versioned_w;
     };
     
     DoublyBufferedData();
@@ -156,6 +184,9 @@ private:
     }
 
     WrapperSharedPtr GetWrapper();
+    // For `VersionedRead=true'. Same as GetWrapper() without referencing
+    // the wrapper.
+    Wrapper* GetWrapperPtr();
 
     // Foreground and background void.
     T _data[2];
@@ -192,8 +223,8 @@ class DoublyBufferedDataWrapperBase<T, Void> {
 // WrapperTLSGroup can store Wrapper in thread local storage.
 // WrapperTLSGroup will destruct Wrapper data when thread exits,
 // other times only reset Wrapper inner structure.
-template <typename T, typename TLS, bool AllowBthreadSuspended>
-class DoublyBufferedData<T, TLS, AllowBthreadSuspended>::WrapperTLSGroup {
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
+class DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::WrapperTLSGroup {
 public:
     const static size_t RAW_BLOCK_SIZE = 4096;
     const static size_t ELEMENTS_PER_BLOCK =
@@ -201,7 +232,7 @@ public:
             RAW_BLOCK_SIZE / sizeof(WrapperSharedPtr) : 1;
 
     struct BAIDU_CACHELINE_ALIGNMENT ThreadBlock {
-        WrapperSharedPtr at(size_t offset) {
+        WrapperSharedPtr& at(size_t offset) {
             if (NULL == _data[offset]) {
                 _data[offset] = std::make_shared<Wrapper>();
             }
@@ -234,7 +265,7 @@ public:
         return 0;
     }
 
-    static WrapperSharedPtr get_or_create_tls_data(WrapperTLSId id) {
+    static WrapperSharedPtr* get_or_create_tls_data(WrapperTLSId id) {
         if (BAIDU_UNLIKELY(id < 0)) {
             CHECK(false) << "Invalid id=" << id;
             return NULL;
@@ -253,7 +284,7 @@ public:
             tb = new ThreadBlock;
             (*_s_tls_blocks)[block_id] = tb;
         }
-        return tb->at(id - block_id * ELEMENTS_PER_BLOCK);
+        return &tb->at(id - block_id * ELEMENTS_PER_BLOCK);
     }
 
 private:
@@ -283,23 +314,23 @@ private:
     static __thread std::vector<ThreadBlock*>* _s_tls_blocks;
 };
 
-template <typename T, typename TLS, bool AllowBthreadSuspended>
-pthread_mutex_t DoublyBufferedData<T, TLS, AllowBthreadSuspended>::WrapperTLSGroup::_s_mutex = PTHREAD_MUTEX_INITIALIZER;
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
+pthread_mutex_t DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::WrapperTLSGroup::_s_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-template <typename T, typename TLS, bool AllowBthreadSuspended>
-std::deque<typename DoublyBufferedData<T, TLS, AllowBthreadSuspended>::WrapperTLSId>*
-        DoublyBufferedData<T, TLS, AllowBthreadSuspended>::WrapperTLSGroup::_s_free_ids = NULL;
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
+std::deque<typename DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::WrapperTLSId>*
+        DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::WrapperTLSGroup::_s_free_ids = NULL;
 
-template <typename T, typename TLS, bool AllowBthreadSuspended>
-typename DoublyBufferedData<T, TLS, AllowBthreadSuspended>::WrapperTLSId
-        DoublyBufferedData<T, TLS, AllowBthreadSuspended>::WrapperTLSGroup::_s_id = 0;
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
+typename DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::WrapperTLSId
+        DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::WrapperTLSGroup::_s_id = 0;
 
-template <typename T, typename TLS, bool AllowBthreadSuspended>
-__thread std::vector<typename DoublyBufferedData<T, TLS, AllowBthreadSuspended>::WrapperTLSGroup::ThreadBlock*>*
-        DoublyBufferedData<T, TLS, AllowBthreadSuspended>::WrapperTLSGroup::_s_tls_blocks = NULL;
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
+__thread std::vector<typename DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::WrapperTLSGroup::ThreadBlock*>*
+        DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::WrapperTLSGroup::_s_tls_blocks = NULL;
 
-template <typename T, typename TLS, bool AllowBthreadSuspended>
-class BAIDU_CACHELINE_ALIGNMENT DoublyBufferedData<T, TLS, AllowBthreadSuspended>::Wrapper
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
+class BAIDU_CACHELINE_ALIGNMENT DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::Wrapper
     : public DoublyBufferedDataWrapperBase<T, TLS> {
 friend class DoublyBufferedData;
 public:
@@ -382,7 +413,35 @@ public:
     void SubRef(int index) {
         --_ref[index];
     }
-    
+
+    // For `VersionedRead=true'. Only the owner thread changes _version.
+    inline void BeginVersionedRead() {
+        _version.store(_version.load(butil::memory_order_relaxed) + 1,
+                       butil::memory_order_relaxed);
+        // Pairs with the fence in Modify(): either Modify() sees the odd
+        // version, or this Read() sees the flipped _index.
+        butil::atomic_thread_fence(butil::memory_order_seq_cst);
+    }
+
+    // For `VersionedRead=true'.
+    inline void EndVersionedRead() {
+        _version.store(_version.load(butil::memory_order_relaxed) + 1,
+                       butil::memory_order_release);
+    }
+
+    // For `VersionedRead=true'.
+    // Wait until the read in progress(if any) finishes. Reads are short and
+    // never suspended, spinning is cheaper than sleeping on a condition.
+    inline void WaitVersionedReadDone() {
+        const uint64_t version = _version.load(butil::memory_order_acquire);
+        if ((version & 1) == 0) {
+            return;
+        }
+        while (_version.load(butil::memory_order_acquire) == version) {
+            sched_yield();
+        }
+    }
+
 private:
     DoublyBufferedData* _control;
     pthread_mutex_t _mutex{};
@@ -396,16 +455,20 @@ private:
     // For `AllowBthreadSuspended=true'.
     // Whether there is a Modify() waiting for _ref0/_ref1.
     bool _modify_wait;
+    // For `VersionedRead=true'.
+    // Odd when the owner thread is reading.
+    butil::atomic<uint64_t> _version{0};
 };
 
 // Called when thread initializes thread-local wrapper.
-template <typename T, typename TLS, bool AllowBthreadSuspended>
-typename DoublyBufferedData<T, TLS, AllowBthreadSuspended>::WrapperSharedPtr
-DoublyBufferedData<T, TLS, AllowBthreadSuspended>::GetWrapper() {
-    WrapperSharedPtr w = WrapperTLSGroup::get_or_create_tls_data(_wrapper_key);
-    if (NULL == w) {
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
+typename DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::WrapperSharedPtr
+DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::GetWrapper() {
+    WrapperSharedPtr* pw = WrapperTLSGroup::get_or_create_tls_data(_wrapper_key);
+    if (NULL == pw) {
         return NULL;
     }
+    WrapperSharedPtr w = *pw;
     if (w->_control == this) {
         return w;
     }
@@ -430,12 +493,25 @@ DoublyBufferedData<T, TLS, AllowBthreadSuspended>::GetWrapper() {
     return w;
 }
 
-template <typename T, typename TLS, bool AllowBthreadSuspended>
-DoublyBufferedData<T, TLS, AllowBthreadSuspended>::DoublyBufferedData()
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
+typename DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::Wrapper*
+DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::GetWrapperPtr() {
+    WrapperSharedPtr* pw = WrapperTLSGroup::get_or_create_tls_data(_wrapper_key);
+    if (BAIDU_LIKELY(NULL != pw && (*pw)->_control == this)) {
+        return pw->get();
+    }
+    // Register the wrapper, which is still owned by the thread-local block.
+    return GetWrapper().get();
+}
+
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
+DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::DoublyBufferedData()
     : _index(0)
     , _wrapper_key(0) {
     BAIDU_CASSERT(!(AllowBthreadSuspended && !IsVoid<TLS>::value),
                   "Forbidden to allow bthread suspended with non-Void TLS");
+    BAIDU_CASSERT(!(AllowBthreadSuspended && VersionedRead),
+                  "Forbidden to allow bthread suspended with versioned read");
 
     _wrappers.reserve(64);
     pthread_mutex_init(&_modify_mutex, NULL);
@@ -450,8 +526,8 @@ DoublyBufferedData<T, TLS, AllowBthreadSuspended>::DoublyBufferedData()
     }
 }
 
-template <typename T, typename TLS, bool AllowBthreadSuspended>
-DoublyBufferedData<T, TLS, AllowBthreadSuspended>::~DoublyBufferedData() {
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
+DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::~DoublyBufferedData() {
     // User is responsible for synchronizations between Read()/Modify() and
     // this function.
     
@@ -471,9 +547,19 @@ DoublyBufferedData<T, TLS, AllowBthreadSuspended>::~DoublyBufferedData() {
     pthread_mutex_destroy(&_wrappers_mutex);
 }
 
-template <typename T, typename TLS, bool AllowBthreadSuspended>
-int DoublyBufferedData<T, TLS, AllowBthreadSuspended>::Read(
-    typename DoublyBufferedData<T, TLS, AllowBthreadSuspended>::ScopedPtr* ptr) {
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
+int DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::Read(
+    typename DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::ScopedPtr* ptr) {
+    if (VersionedRead) {
+        Wrapper* w = GetWrapperPtr();
+        if (BAIDU_UNLIKELY(w == NULL)) {
+            return -1;
+        }
+        w->BeginVersionedRead();
+        ptr->_data = UnsafeRead();
+        ptr->_versioned_w = w;
+        return 0;
+    }
     WrapperSharedPtr w = GetWrapper();
     if (BAIDU_UNLIKELY(w == NULL)) {
         return -1;
@@ -496,9 +582,9 @@ int DoublyBufferedData<T, TLS, AllowBthreadSuspended>::Read(
     return 0;
 }
 
-template <typename T, typename TLS, bool AllowBthreadSuspended>
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
 template <typename Fn>
-int DoublyBufferedData<T, TLS, AllowBthreadSuspended>::Read(Fn&& fn) {
+int DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::Read(Fn&& fn) {
     BAIDU_CASSERT((is_result_void<Fn, const T&>::value),
                   "Fn must accept `const T&' and return void");
     ScopedPtr ptr;
@@ -509,9 +595,9 @@ int DoublyBufferedData<T, TLS, AllowBthreadSuspended>::Read(Fn&& fn) {
     return 0;
 }
 
-template <typename T, typename TLS, bool AllowBthreadSuspended>
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
 template <typename Fn, typename... Args>
-size_t DoublyBufferedData<T, TLS, AllowBthreadSuspended>::Modify(Fn&& fn, Args&&... args) {
+size_t DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::Modify(Fn&& fn, Args&&... args) {
     // _modify_mutex sequences modifications. Using a separate mutex rather
     // than _wrappers_mutex is to avoid blocking threads calling
     // GetWrapper() too long. Most of the time, modifications
@@ -531,6 +617,10 @@ size_t DoublyBufferedData<T, TLS, AllowBthreadSuspended>::Modify(Fn&& fn, Args&&
     // all changes made in fn.
     _index.store(bg_index, butil::memory_order_release);
     bg_index = !bg_index;
+    if (VersionedRead) {
+        // Pairs with the fence in Wrapper::BeginVersionedRead().
+        butil::atomic_thread_fence(butil::memory_order_seq_cst);
+    }
     
     // Wait until all threads finishes current reading. When they begin next
     // read, they should see updated _index.
@@ -544,7 +634,9 @@ size_t DoublyBufferedData<T, TLS, AllowBthreadSuspended>::Modify(Fn&& fn, Args&&
                 bool expired = NULL == w;
                 if (!expired) {
                     // Notify all threads waiting for read done.
-                    if (AllowBthreadSuspended) {
+                    if (VersionedRead) {
+                        w->WaitVersionedReadDone();
+                    } else if (AllowBthreadSuspended) {
                         w->WaitReadDone(bg_index);
                     } else {
                         w->WaitReadDone();
@@ -561,9 +653,9 @@ size_t DoublyBufferedData<T, TLS, AllowBthreadSuspended>::Modify(Fn&& fn, Args&&
     return ret2;
 }
 
-template <typename T, typename TLS, bool AllowBthreadSuspended>
+template <typename T, typename TLS, bool AllowBthreadSuspended, bool VersionedRead>
 template <typename Fn, typename... Args>
-size_t DoublyBufferedData<T, TLS, AllowBthreadSuspended>::ModifyWithForeground(Fn&& fn, Args&&... args) {
+size_t DoublyBufferedData<T, TLS, AllowBthreadSuspended, VersionedRead>::ModifyWithForeground(Fn&& fn, Args&&... args) {
     return Modify([this, &fn](T& bg, Args&&... args) {
         return fn(bg, (const T&)_data[&bg == _data], std::forward<Args>(args)...);
     }, std::forward<Args>(args)...);
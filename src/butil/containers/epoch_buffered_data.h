@@ -0,0 +1,130 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BUTIL_EPOCH_BUFFERED_DATA_H
+#define BUTIL_EPOCH_BUFFERED_DATA_H
+
+#include <pthread.h>
+#include <utility>
+#include "butil/macros.h"
+#include "butil/atomicops.h"
+#include "butil/scoped_lock.h"
+#include "butil/type_traits.h"
+#include "butil/epoch.h"
+
+namespace butil {
+
+// An alternative to DoublyBufferedData<T> with the same Read()/Modify()
+// interface, built on epoch based reclamation(butil/epoch.h):
+//
+// Read(): Enter an epoch and load the current instance, no mutex is locked
+// and no other thread is waited. The bthread may be suspended while
+// reading, though a long read delays freeing of replaced instances.
+//
+// Modify(): Copy the current instance, call fn on the copy, publish it and
+// retire the replaced one, which is freed after all readers seeing it
+// finish. Modify() never waits for readers.
+//
+// Different from DoublyBufferedData, fn is called once on a copy rather
+// than twice on both instances, T must be copyable and there's no
+// thread-local data for users.
+template <typename T>
+class EpochBufferedData {
+public:
+    class ScopedPtr {
+    friend class EpochBufferedData;
+    public:
+        ScopedPtr() : _data(NULL) {}
+        const T* get() const { return _data; }
+        const T& operator*() const { return *_data; }
+        const T* operator->() const { return _data; }
+
+    private:
+        DISALLOW_COPY_AND_ASSIGN(ScopedPtr);
+        EpochGuard _guard;
+        const T* _data;
+    };
+
+    EpochBufferedData() : _data(new T) {
+        pthread_mutex_init(&_modify_mutex, NULL);
+    }
+
+    // No other threads should be reading.
+    ~EpochBufferedData() {
+        delete _data.load(butil::memory_order_relaxed);
+        pthread_mutex_destroy(&_modify_mutex);
+    }
+
+    // Put current instance into ptr. The instance will not be freed until
+    // ptr is destructed.
+    // Returns 0 on success, -1 otherwise.
+    int Read(ScopedPtr* ptr) {
+        ptr->_data = _data.load(butil::memory_order_acquire);
+        return 0;
+    }
+
+    // `fn(const T&)' will be called with current instance.
+    // Returns 0 on success, otherwise on error.
+    template <typename Fn>
+    int Read(Fn&& fn) {
+        BAIDU_CASSERT((is_result_void<Fn, const T&>::value),
+                      "Fn must accept `const T&' and return void");
+        ScopedPtr ptr;
+        if (Read(&ptr) != 0) {
+            return -1;
+        }
+        fn(*ptr);
+        return 0;
+    }
+
+    // Call fn(T&, ...) with a copy of current instance, which replaces
+    // current instance if fn returns non-zero. Modify() from different
+    // threads are exclusive from each other.
+    template <typename Fn, typename... Args>
+    size_t Modify(Fn&& fn, Args&&... args) {
+        return ModifyWithForeground([&fn](T& copy, const T&, Args&&... args) {
+            return fn(copy, std::forward<Args>(args)...);
+        }, std::forward<Args>(args)...);
+    }
+
+    // fn(T& copy, const T& current, ...) will be called.
+    template <typename Fn, typename... Args>
+    size_t ModifyWithForeground(Fn&& fn, Args&&... args) {
+        BAIDU_SCOPED_LOCK(_modify_mutex);
+        const T* old_data = _data.load(butil::memory_order_relaxed);
+        T* new_data = new T(*old_data);
+        const size_t ret = fn(*new_data, *old_data, std::forward<Args>(args)...);
+        if (!ret) {
+            delete new_data;
+            return 0;
+        }
+        _data.store(new_data, butil::memory_order_release);
+        epoch_delete(const_cast<T*>(old_data));
+        return ret;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(EpochBufferedData);
+
+    butil::atomic<const T*> _data;
+    pthread_mutex_t _modify_mutex;
+};
+
+}  // namespace butil
+
+#endif  // BUTIL_EPOCH_BUFFERED_DATA_H
@@ -0,0 +1,194 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// A lock-free bounded queue(ring buffer) which allows multiple threads to
+// push and multiple threads to pop at the same time. Based on the design of
+// Dmitry Vyukov: every cell has a sequence number telling whether it's
+// ready for the producer or the consumer at a position, so that producers
+// and consumers only contend on their own position counter.
+
+#ifndef BUTIL_MPMC_BOUNDED_QUEUE_H
+#define BUTIL_MPMC_BOUNDED_QUEUE_H
+
+#include <stdint.h>
+#include <new>
+#include "butil/macros.h"
+#include "butil/atomicops.h"
+#include "butil/logging.h"
+
+namespace butil {
+
+// [Example]
+//   butil::MPMCBoundedQueue<int> q;
+//   if (q.init(1024) != 0) {
+//     LOG(ERROR) << "Fail to init queue";
+//     return -1;
+//   }
+//   q.push(1);        // in any thread
+//   int x;
+//   q.pop(&x);        // in any thread
+template <typename T>
+class MPMCBoundedQueue {
+public:
+    MPMCBoundedQueue()
+        : _cells(NULL)
+        , _mask(0)
+        , _enqueue_pos(0)
+        , _dequeue_pos(0) {}
+
+    ~MPMCBoundedQueue() {
+        delete [] _cells;
+        _cells = NULL;
+    }
+
+    // `capacity' must be power of 2.
+    // Returns 0 on success, -1 otherwise.
+    int init(size_t capacity) {
+        if (_cells != NULL) {
+            LOG(ERROR) << "Already initialized";
+            return -1;
+        }
+        if (capacity < 2 || (capacity & (capacity - 1))) {
+            LOG(ERROR) << "Invalid capacity=" << capacity
+                       << " which must be power of 2 and at least 2";
+            return -1;
+        }
+        _cells = new (std::nothrow) Cell[capacity];
+        if (NULL == _cells) {
+            return -1;
+        }
+        for (size_t i = 0; i < capacity; ++i) {
+            _cells[i].seq.store(i, butil::memory_order_relaxed);
+        }
+        _mask = capacity - 1;
+        return 0;
+    }
+
+    // Push an item into the queue.
+    // Returns true on pushed, false if the queue is full.
+    bool push(const T& x) {
+        return push_batch(&x, 1) == 1;
+    }
+
+    // Pop an item from the queue.
+    // Returns true on popped, false if the queue is empty.
+    bool pop(T* x) {
+        return pop_batch(x, 1) == 1;
+    }
+
+    // Push at most `n' items from `items' with one atomic operation on the
+    // shared position in common cases. Items are consecutive in the queue.
+    // Returns number of pushed items, 0 if the queue is full.
+    size_t push_batch(const T* items, size_t n) {
+        size_t pos = _enqueue_pos.load(butil::memory_order_relaxed);
+        while (true) {
+            size_t k = 0;
+            for (; k < n && k <= _mask; ++k) {
+                const size_t seq = _cells[(pos + k) & _mask].seq.load(
+                    butil::memory_order_acquire);
+                if (seq != pos + k) {
+                    break;
+                }
+            }
+            if (k == 0) {
+                const size_t seq = _cells[pos & _mask].seq.load(
+                    butil::memory_order_acquire);
+                if ((intptr_t)(seq - pos) < 0) {
+                    // The cell is not popped since last round.
+                    return 0;
+                }
+                // Other producers took `pos'.
+                pos = _enqueue_pos.load(butil::memory_order_relaxed);
+                continue;
+            }
+            if (_enqueue_pos.compare_exchange_weak(
+                    pos, pos + k, butil::memory_order_relaxed)) {
+                for (size_t i = 0; i < k; ++i) {
+                    Cell& c = _cells[(pos + i) & _mask];
+                    c.data = items[i];
+                    c.seq.store(pos + i + 1, butil::memory_order_release);
+                }
+                return k;
+            }
+        }
+    }
+
+    // Pop at most `n' items into `items'.
+    // Returns number of popped items, 0 if the queue is empty.
+    size_t pop_batch(T* items, size_t n) {
+        size_t pos = _dequeue_pos.load(butil::memory_order_relaxed);
+        while (true) {
+            size_t k = 0;
+            for (; k < n && k <= _mask; ++k) {
+                const size_t seq = _cells[(pos + k) & _mask].seq.load(
+                    butil::memory_order_acquire);
+                if (seq != pos + k + 1) {
+                    break;
+                }
+            }
+            if (k == 0) {
+                const size_t seq = _cells[pos & _mask].seq.load(
+                    butil::memory_order_acquire);
+                if ((intptr_t)(seq - (pos + 1)) < 0) {
+                    // The cell is not pushed yet.
+                    return 0;
+                }
+                // Other consumers took `pos'.
+                pos = _dequeue_pos.load(butil::memory_order_relaxed);
+                continue;
+            }
+            if (_dequeue_pos.compare_exchange_weak(
+                    pos, pos + k, butil::memory_order_relaxed)) {
+                for (size_t i = 0; i < k; ++i) {
+                    Cell& c = _cells[(pos + i) & _mask];
+                    items[i] = c.data;
+                    c.seq.store(pos + i + _mask + 1, butil::memory_order_release);
+                }
+                return k;
+            }
+        }
+    }
+
+    // Approximate number of items, only for monitoring.
+    size_t size() const {
+        const size_t e = _enqueue_pos.load(butil::memory_order_relaxed);
+        const size_t d = _dequeue_pos.load(butil::memory_order_relaxed);
+        return e > d ? e - d : 0;
+    }
+
+    size_t capacity() const { return _mask + 1; }
+
+    bool initialized() const { return _cells != NULL; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MPMCBoundedQueue);
+
+    struct Cell {
+        butil::atomic<size_t> seq;
+        T data;
+    };
+
+    Cell* _cells;
+    size_t _mask;
+    // Producers and consumers modify different cachelines.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<size_t> _enqueue_pos;
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<size_t> _dequeue_pos;
+};
+
+}  // namespace butil
+
+#endif  // BUTIL_MPMC_BOUNDED_QUEUE_H
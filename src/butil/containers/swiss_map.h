@@ -0,0 +1,540 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// This open addressing hash-map stores elements in one flat array with a
+// parallel array of one-byte control words, similar to SwissTable in abseil.
+// A control word is either empty, deleted, or 7 bits of the hash code of
+// the element in the slot. Lookups compare 16 control words at once with
+// SSE2 (or NEON) and touch the slots only for matched words, so most
+// misses never read the elements. The map is resized when 7/8 of the slots
+// are used, which takes much less memory than FlatMap for big maps.
+//
+// SwissMap has the same seek/insert/erase/operator[] interfaces as FlatMap.
+// Use FlatMap for small maps or maps iterated while being modified, use
+// SwissMap for big read-mostly maps.
+//
+// NOTE: Objects stored in SwissMap MUST be copyable. Inserting or erasing
+// invalidates all iterators and addresses of values.
+
+#ifndef BUTIL_SWISS_MAP_H
+#define BUTIL_SWISS_MAP_H
+
+#include <stdint.h>
+#include <stdlib.h>                               // malloc, free
+#include <string.h>                               // memset, memcpy
+#include <new>
+#include <utility>                                // std::pair
+#include <iterator>
+#include "butil/macros.h"
+#include "butil/logging.h"
+#include "butil/containers/flat_map.h"            // DefaultHasher
+#include "butil/third_party/murmurhash3/murmurhash3.h"  // fmix64
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace butil {
+
+namespace swiss_map_internal {
+
+typedef int8_t ctrl_t;
+
+// Full slots store 7 bits of hash code, which are non-negative.
+const ctrl_t CTRL_EMPTY = -128;
+const ctrl_t CTRL_DELETED = -2;
+
+// Number of control words compared at once.
+const size_t GROUP_WIDTH = 16;
+
+#if defined(__SSE2__) || !defined(__ARM_NEON)
+// One bit per slot.
+const int BITMASK_SHIFT = 0;
+#else
+// 4 bits per slot, only the highest is kept.
+const int BITMASK_SHIFT = 2;
+#endif
+
+// Iterates indexes of matched slots in a group, from low to high.
+class BitMask {
+public:
+    explicit BitMask(uint64_t mask) : _mask(mask) {}
+    bool any() const { return _mask != 0; }
+    size_t lowest() const {
+        return __builtin_ctzll(_mask) >> BITMASK_SHIFT;
+    }
+    void clear_lowest() { _mask &= _mask - 1; }
+
+private:
+    uint64_t _mask;
+};
+
+// GROUP_WIDTH control words starting at any position.
+class Group {
+public:
+#if defined(__SSE2__)
+    explicit Group(const ctrl_t* pos)
+        : _ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pos))) {}
+
+    BitMask match(ctrl_t h2) const {
+        return BitMask((uint32_t)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_set1_epi8(h2), _ctrl)));
+    }
+    BitMask match_empty() const { return match(CTRL_EMPTY); }
+    // Empty and deleted words are negative.
+    BitMask match_empty_or_deleted() const {
+        return BitMask((uint32_t)_mm_movemask_epi8(_ctrl));
+    }
+
+private:
+    __m128i _ctrl;
+#elif defined(__ARM_NEON)
+    explicit Group(const ctrl_t* pos) : _ctrl(vld1q_s8(pos)) {}
+
+    BitMask match(ctrl_t h2) const {
+        return to_bitmask(vceqq_s8(_ctrl, vdupq_n_s8(h2)));
+    }
+    BitMask match_empty() const { return match(CTRL_EMPTY); }
+    BitMask match_empty_or_deleted() const {
+        return to_bitmask(vcltq_s8(_ctrl, vdupq_n_s8(0)));
+    }
+
+private:
+    // NEON has no movemask, narrow every byte of `eq' into 4 bits instead.
+    static BitMask to_bitmask(uint8x16_t eq) {
+        const uint8x8_t narrowed =
+            vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+        return BitMask(vget_lane_u64(vreinterpret_u64_u8(narrowed), 0) &
+                       0x8888888888888888ULL);
+    }
+
+    int8x16_t _ctrl;
+#else
+    explicit Group(const ctrl_t* pos) { memcpy(_ctrl, pos, sizeof(_ctrl)); }
+
+    BitMask match(ctrl_t h2) const {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < GROUP_WIDTH; ++i) {
+            mask |= (uint64_t)(_ctrl[i] == h2) << i;
+        }
+        return BitMask(mask);
+    }
+    BitMask match_empty() const { return match(CTRL_EMPTY); }
+    BitMask match_empty_or_deleted() const {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < GROUP_WIDTH; ++i) {
+            mask |= (uint64_t)(_ctrl[i] < 0) << i;
+        }
+        return BitMask(mask);
+    }
+
+private:
+    ctrl_t _ctrl[GROUP_WIDTH];
+#endif
+};
+
+// Slots of a group are probed one group after another at triangular
+// offsets, which visits every group when the capacity is power of 2.
+class ProbeSeq {
+public:
+    ProbeSeq(size_t hash, size_t mask)
+        : _mask(mask), _offset(hash & mask), _index(0) {}
+    size_t offset() const { return _offset; }
+    size_t offset(size_t i) const { return (_offset + i) & _mask; }
+    void next() {
+        _index += GROUP_WIDTH;
+        _offset = (_offset + _index) & _mask;
+    }
+
+private:
+    size_t _mask;
+    size_t _offset;
+    size_t _index;
+};
+
+}  // namespace swiss_map_internal
+
+template <typename _Map, typename _Value> class SwissMapIterator;
+
+template <typename _K, typename _T,
+          // Compute hash code from key. The code is mixed again inside, so
+          // identity hash of integers (the default) works fine.
+          typename _Hash = DefaultHasher<_K>,
+          // Test equivalence between stored-key and passed-key.
+          // stored-key is always on LHS, passed-key is always on RHS.
+          typename _Equal = DefaultEqualTo<_K> >
+class SwissMap {
+public:
+    typedef _K key_type;
+    typedef _T mapped_type;
+    typedef std::pair<const _K, _T> value_type;
+    typedef SwissMapIterator<SwissMap, value_type> iterator;
+    typedef SwissMapIterator<SwissMap, const value_type> const_iterator;
+    typedef _Hash hasher;
+    typedef _Equal key_equal;
+
+    explicit SwissMap(const hasher& hashfn = hasher(),
+                      const key_equal& eql = key_equal())
+        : _ctrl(NULL), _slots(NULL), _capacity(0), _size(0), _growth_left(0)
+        , _hashfn(hashfn), _eql(eql) {}
+
+    SwissMap(const SwissMap& rhs)
+        : _ctrl(NULL), _slots(NULL), _capacity(0), _size(0), _growth_left(0)
+        , _hashfn(rhs._hashfn), _eql(rhs._eql) {
+        copy_from(rhs);
+    }
+
+    ~SwissMap() {
+        clear();
+        free(_ctrl);
+        free(_slots);
+    }
+
+    SwissMap& operator=(const SwissMap& rhs) {
+        if (this != &rhs) {
+            clear();
+            _hashfn = rhs._hashfn;
+            _eql = rhs._eql;
+            copy_from(rhs);
+        }
+        return *this;
+    }
+
+    void swap(SwissMap& rhs) {
+        std::swap(_ctrl, rhs._ctrl);
+        std::swap(_slots, rhs._slots);
+        std::swap(_capacity, rhs._capacity);
+        std::swap(_size, rhs._size);
+        std::swap(_growth_left, rhs._growth_left);
+        std::swap(_hashfn, rhs._hashfn);
+        std::swap(_eql, rhs._eql);
+    }
+
+    // Make room for `n' elements so that inserting them does not resize.
+    // Optional, the map grows automatically.
+    // Returns 0 on success, -1 on error.
+    int init(size_t n) {
+        size_t cap = swiss_map_internal::GROUP_WIDTH;
+        while (max_load(cap) < n) {
+            cap *= 2;
+        }
+        if (cap <= _capacity) {
+            return 0;
+        }
+        return resize(cap) ? 0 : -1;
+    }
+
+    // Insert a pair of |key| and |value|, the value is overwritten if |key|
+    // exists.
+    // Returns address of the inserted value, NULL on error.
+    mapped_type* insert(const key_type& key, const mapped_type& value) {
+        value_type* p = find_or_prepare_insert(key);
+        if (p == NULL) {
+            return NULL;
+        }
+        p->second = value;
+        return &p->second;
+    }
+
+    mapped_type* insert(const std::pair<key_type, mapped_type>& kv) {
+        return insert(kv.first, kv.second);
+    }
+
+    // Remove |key| and the associated value, which is copied into
+    // |old_value| if it's not NULL.
+    // Returns 1 on erased, 0 otherwise.
+    template <typename K2>
+    size_t erase(const K2& key, mapped_type* old_value = NULL) {
+        const size_t i = find(key);
+        if (i == NPOS) {
+            return 0;
+        }
+        if (old_value) {
+            *old_value = _slots[i].second;
+        }
+        _slots[i].~value_type();
+        set_ctrl(i, swiss_map_internal::CTRL_DELETED);
+        --_size;
+        return 1;
+    }
+
+    // Remove all items. Allocated spaces are kept.
+    void clear() {
+        if (_size != 0) {
+            for (size_t i = 0; i < _capacity; ++i) {
+                if (is_full(_ctrl[i])) {
+                    _slots[i].~value_type();
+                }
+            }
+        }
+        if (_ctrl != NULL) {
+            memset(_ctrl, swiss_map_internal::CTRL_EMPTY,
+                   _capacity + swiss_map_internal::GROUP_WIDTH);
+        }
+        _size = 0;
+        _growth_left = max_load(_capacity);
+    }
+
+    // Search for the value associated with |key|.
+    // Returns address of the value, NULL if |key| does not exist.
+    template <typename K2>
+    mapped_type* seek(const K2& key) const {
+        const size_t i = find(key);
+        return i == NPOS ? NULL : &_slots[i].second;
+    }
+
+    // Get the value associated with |key|. If |key| does not exist,
+    // insert with a default-constructed value.
+    mapped_type& operator[](const key_type& key) {
+        value_type* p = find_or_prepare_insert(key);
+        CHECK(p != NULL) << "Fail to allocate memory";
+        return p->second;
+    }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, _capacity); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, _capacity); }
+
+    bool empty() const { return _size == 0; }
+    size_t size() const { return _size; }
+    // Number of slots.
+    size_t capacity() const { return _capacity; }
+    // Bytes of the slot and control arrays.
+    size_t memory_usage() const {
+        return _capacity == 0 ? 0 :
+            _capacity * (sizeof(value_type) + 1) +
+            swiss_map_internal::GROUP_WIDTH;
+    }
+
+private:
+template <typename _Map, typename _Value> friend class SwissMapIterator;
+
+    static const size_t NPOS = (size_t)-1;
+
+    static bool is_full(swiss_map_internal::ctrl_t c) { return c >= 0; }
+
+    static size_t max_load(size_t capacity) {
+        return capacity - capacity / 8;
+    }
+
+    template <typename K2>
+    size_t hash(const K2& key) const {
+        return fmix64(_hashfn(key));
+    }
+    // Lower 7 bits are stored in the control word, the rest decide where
+    // the probing starts.
+    static size_t h1(size_t hash) { return hash >> 7; }
+    static swiss_map_internal::ctrl_t h2(size_t hash) {
+        return (swiss_map_internal::ctrl_t)(hash & 0x7F);
+    }
+
+    // The first GROUP_WIDTH control words are cloned after the last one so
+    // that groups starting at any slot can be loaded without wrapping.
+    void set_ctrl(size_t i, swiss_map_internal::ctrl_t c) {
+        _ctrl[i] = c;
+        if (i < swiss_map_internal::GROUP_WIDTH) {
+            _ctrl[_capacity + i] = c;
+        }
+    }
+
+    // Returns index of the slot storing `key', NPOS if not found.
+    template <typename K2>
+    size_t find(const K2& key) const {
+        if (_size == 0) {
+            return NPOS;
+        }
+        const size_t h = hash(key);
+        swiss_map_internal::ProbeSeq seq(h1(h), _capacity - 1);
+        while (true) {
+            swiss_map_internal::Group g(_ctrl + seq.offset());
+            for (swiss_map_internal::BitMask m = g.match(h2(h));
+                 m.any(); m.clear_lowest()) {
+                const size_t i = seq.offset(m.lowest());
+                if (_eql(_slots[i].first, key)) {
+                    return i;
+                }
+            }
+            if (g.match_empty().any()) {
+                return NPOS;
+            }
+            seq.next();
+        }
+    }
+
+    // Returns index of the first empty or deleted slot to put an element
+    // with hash code `h'.
+    size_t find_first_non_full(size_t h) const {
+        swiss_map_internal::ProbeSeq seq(h1(h), _capacity - 1);
+        while (true) {
+            swiss_map_internal::Group g(_ctrl + seq.offset());
+            swiss_map_internal::BitMask m = g.match_empty_or_deleted();
+            if (m.any()) {
+                return seq.offset(m.lowest());
+            }
+            seq.next();
+        }
+    }
+
+    // Returns the element of `key', which is inserted with a default
+    // value if it does not exist. NULL on error.
+    value_type* find_or_prepare_insert(const key_type& key) {
+        const size_t found = find(key);
+        if (found != NPOS) {
+            return &_slots[found];
+        }
+        const size_t h = hash(key);
+        size_t i = NPOS;
+        if (_capacity != 0) {
+            i = find_first_non_full(h);
+        }
+        // Reusing a deleted slot doesn't consume growth.
+        if (i == NPOS ||
+            (_growth_left == 0 && _ctrl[i] != swiss_map_internal::CTRL_DELETED)) {
+            if (!rehash_and_grow()) {
+                return NULL;
+            }
+            i = find_first_non_full(h);
+        }
+        if (_ctrl[i] == swiss_map_internal::CTRL_EMPTY) {
+            --_growth_left;
+        }
+        new (&_slots[i]) value_type(key, mapped_type());
+        set_ctrl(i, h2(h));
+        ++_size;
+        return &_slots[i];
+    }
+
+    // Make room for one more element, dropping deleted slots if they take
+    // much room, doubling the capacity otherwise.
+    bool rehash_and_grow() {
+        if (_capacity == 0) {
+            return resize(swiss_map_internal::GROUP_WIDTH);
+        }
+        if (_size * 2 <= max_load(_capacity)) {
+            return resize(_capacity);
+        }
+        return resize(_capacity * 2);
+    }
+
+    bool resize(size_t new_capacity) {
+        const size_t nctrl = new_capacity + swiss_map_internal::GROUP_WIDTH;
+        swiss_map_internal::ctrl_t* new_ctrl =
+            (swiss_map_internal::ctrl_t*)malloc(nctrl);
+        value_type* new_slots =
+            (value_type*)malloc(sizeof(value_type) * new_capacity);
+        if (new_ctrl == NULL || new_slots == NULL) {
+            LOG(ERROR) << "Fail to allocate " << new_capacity << " slots";
+            free(new_ctrl);
+            free(new_slots);
+            return false;
+        }
+        memset(new_ctrl, swiss_map_internal::CTRL_EMPTY, nctrl);
+        swiss_map_internal::ctrl_t* old_ctrl = _ctrl;
+        value_type* old_slots = _slots;
+        const size_t old_capacity = _capacity;
+        _ctrl = new_ctrl;
+        _slots = new_slots;
+        _capacity = new_capacity;
+        for (size_t i = 0; i < old_capacity; ++i) {
+            if (is_full(old_ctrl[i])) {
+                const size_t h = hash(old_slots[i].first);
+                const size_t j = find_first_non_full(h);
+                new (&_slots[j]) value_type(std::move(old_slots[i]));
+                set_ctrl(j, h2(h));
+                old_slots[i].~value_type();
+            }
+        }
+        _growth_left = max_load(_capacity) - _size;
+        free(old_ctrl);
+        free(old_slots);
+        return true;
+    }
+
+    void copy_from(const SwissMap& rhs) {
+        if (rhs._size == 0 || init(rhs._size) != 0) {
+            return;
+        }
+        for (const_iterator it = rhs.begin(); it != rhs.end(); ++it) {
+            insert(it->first, it->second);
+        }
+    }
+
+    swiss_map_internal::ctrl_t* _ctrl;
+    value_type* _slots;
+    size_t _capacity;
+    size_t _size;
+    // Number of empty slots which can be filled before resizing.
+    size_t _growth_left;
+    hasher _hashfn;
+    key_equal _eql;
+};
+
+template <typename _Map, typename _Value>
+class SwissMapIterator {
+public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef _Value value_type;
+    typedef _Value& reference;
+    typedef _Value* pointer;
+    typedef ptrdiff_t difference_type;
+
+    SwissMapIterator() : _map(NULL), _index(0) {}
+    SwissMapIterator(const _Map* map, size_t index)
+        : _map(map), _index(index) { skip_non_full(); }
+    // Converting iterator to const_iterator.
+    template <typename V2>
+    SwissMapIterator(const SwissMapIterator<_Map, V2>& rhs)
+        : _map(rhs._map), _index(rhs._index) {}
+
+    _Value& operator*() const { return _map->_slots[_index]; }
+    _Value* operator->() const { return &_map->_slots[_index]; }
+    SwissMapIterator& operator++() {
+        ++_index;
+        skip_non_full();
+        return *this;
+    }
+    SwissMapIterator operator++(int) {
+        SwissMapIterator tmp = *this;
+        ++*this;
+        return tmp;
+    }
+    bool operator==(const SwissMapIterator& rhs) const {
+        return _index == rhs._index;
+    }
+    bool operator!=(const SwissMapIterator& rhs) const {
+        return _index != rhs._index;
+    }
+
+private:
+template <typename _Map2, typename _Value2> friend class SwissMapIterator;
+
+    void skip_non_full() {
+        while (_index < _map->_capacity && !_Map::is_full(_map->_ctrl[_index])) {
+            ++_index;
+        }
+    }
+
+    const _Map* _map;
+    size_t _index;
+};
+
+}  // namespace butil
+
+#endif  // BUTIL_SWISS_MAP_H
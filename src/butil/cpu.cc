@@ -41,6 +41,7 @@ CPU::CPU()
     has_sse41_(false),
     has_sse42_(false),
     has_avx_(false),
+    has_avx2_(false),
     has_avx_hardware_(false),
     has_aesni_(false),
     has_non_stop_time_stamp_counter_(false),
@@ -61,7 +62,7 @@ void __cpuid(int cpu_info[4], int info_type) {
     "cpuid\n"
     "xchg %%edi, %%ebx\n"
     : "=a"(cpu_info[0]), "=D"(cpu_info[1]), "=c"(cpu_info[2]), "=d"(cpu_info[3])
-    : "a"(info_type)
+    : "a"(info_type), "c"(0)
   );
 }
 
@@ -71,7 +72,7 @@ void __cpuid(int cpu_info[4], int info_type) {
   __asm__ volatile (
     "cpuid \n\t"
     : "=a"(cpu_info[0]), "=b"(cpu_info[1]), "=c"(cpu_info[2]), "=d"(cpu_info[3])
-    : "a"(info_type)
+    : "a"(info_type), "c"(0)
   );
 }
 
@@ -168,6 +169,11 @@ void CPU::Initialize() {
 
   // Interpret CPU feature information.
   if (num_ids > 0) {
+    int cpu_info7[4] = {0};
+    if (num_ids >= 7) {
+      // Sub-leaf 0 of leaf 7 which is passed in ecx by __cpuid.
+      __cpuid(cpu_info7, 7);
+    }
     __cpuid(cpu_info, 1);
     signature_ = cpu_info[0];
     stepping_ = cpu_info[0] & 0xf;
@@ -201,6 +207,7 @@ void CPU::Initialize() {
         (cpu_info[2] & 0x08000000) != 0 /* OSXSAVE */ &&
         (_xgetbv(0) & 6) == 6 /* XSAVE enabled by kernel */;
     has_aesni_ = (cpu_info[2] & 0x02000000) != 0;
+    has_avx2_ = has_avx_ && (cpu_info7[1] & 0x00000020) != 0;
   }
 
   // Get the brand string of the cpu.
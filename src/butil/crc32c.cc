@@ -14,10 +14,36 @@
 
 #include <string.h>
 #include <stdint.h>
-#ifdef __SSE4_2__
-#include <nmmintrin.h>
-#endif
 #include "butil/build_config.h"
+#include "butil/iobuf.h"
+
+// Hardware kernels are compiled with function-level target attributes on
+// x86-64 so that they're available (after a runtime check) even if the
+// file is not built with -msse4.2. On aarch64 they need the CRC extension
+// being enabled at compile-time (e.g. -march=armv8-a+crc).
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(IOS_CROSS_COMPILE)
+#define BUTIL_CRC32C_X86_64 1
+#include <nmmintrin.h>              // _mm_crc32_u64
+#include <wmmintrin.h>              // _mm_clmulepi64_si128
+#define BUTIL_CRC32C_HW_TARGET __attribute__((target("sse4.2")))
+#define BUTIL_CRC32C_HW_3WAY_TARGET __attribute__((target("sse4.2,pclmul")))
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define BUTIL_CRC32C_ARM64 1
+#include <arm_acle.h>               // __crc32cd
+#include <sys/auxv.h>               // getauxval
+#if defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES)
+#define BUTIL_CRC32C_ARM64_PMULL 1
+#include <arm_neon.h>               // vmull_p64
+#endif
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#ifndef HWCAP_PMULL
+#define HWCAP_PMULL (1 << 4)
+#endif
+#define BUTIL_CRC32C_HW_TARGET
+#define BUTIL_CRC32C_HW_3WAY_TARGET
+#endif
 
 namespace butil {
 namespace crc32c {
@@ -322,13 +348,9 @@ static inline uint32_t LE_LOAD32(const uint8_t *p) {
   return DecodeFixed32(reinterpret_cast<const char*>(p));
 }
 
-#ifdef __SSE4_2__
-#ifdef __LP64__
 static inline uint64_t LE_LOAD64(const uint8_t *p) {
   return DecodeFixed64(reinterpret_cast<const char*>(p));
 }
-#endif
-#endif
 
 static inline void Slow_CRC32(uint64_t* l, uint8_t const **p) {
   uint32_t c = static_cast<uint32_t>(*l ^ LE_LOAD32(*p));
@@ -346,29 +368,6 @@ static inline void Slow_CRC32(uint64_t* l, uint8_t const **p) {
   table0_[c >> 24];
 }
 
-static inline void Fast_CRC32(uint64_t* l, uint8_t const **p) {
-#ifdef __SSE4_2__
-#ifdef __LP64__
-  *l = _mm_crc32_u64(*l, LE_LOAD64(*p));
-  *p += 8;
-#else
-  *l = _mm_crc32_u32(static_cast<unsigned int>(*l), LE_LOAD32(*p));
-  *p += 4;
-  *l = _mm_crc32_u32(static_cast<unsigned int>(*l), LE_LOAD32(*p));
-  *p += 4;
-#endif
-#else
-  Slow_CRC32(l, p);
-#endif
-}
-
-class FastCRC32Functor {
-public:
-  inline void operator()(uint64_t* l, uint8_t const **p) const {
-    return Fast_CRC32(l , p);
-  }
-};
-
 class SlowCRC32Functor {
 public:
   inline void operator()(uint64_t* l, uint8_t const **p) const {
@@ -421,36 +420,217 @@ uint32_t ExtendImpl(uint32_t crc, const char* buf, size_t size) {
   return static_cast<uint32_t>(l ^ 0xffffffffu);
 }
 
-// Detect if SS42 or not.
-static bool isSSE42() {
-#if defined(__GNUC__) && defined(__x86_64__) && !defined(IOS_CROSS_COMPILE)
-  uint32_t c_;
-  uint32_t d_;
-  __asm__("cpuid" : "=c"(c_), "=d"(d_) : "a"(1) : "ebx");
-  return c_ & (1U << 20);  // copied from CpuId.h in Folly.
+// Arithmetics in GF(2)[x] modulo the crc32c polynomial. Polynomials are
+// bit-reflected as crc values are: bit 31 is the coefficient of x^0.
+static const uint32_t kPoly = 0x82f63b78u;
+
+// Returns a*b mod P.
+static uint32_t MultModP(uint32_t a, uint32_t b) {
+  uint32_t p = 0;
+  for (uint32_t m = 1u << 31; m != 0; m >>= 1) {
+    if (a & m) {
+      p ^= b;
+    }
+    b = (b & 1) ? ((b >> 1) ^ kPoly) : (b >> 1);
+  }
+  return p;
+}
+
+// Returns x^(8*n) mod P, multiplying a crc register by which equals to
+// feeding the register with n zero bytes.
+static uint32_t XPow8NModP(uint64_t n) {
+  uint32_t p = 1u << 31;        // x^0
+  uint32_t x2k = 1u << 23;      // x^8, squared in each round
+  for (; n != 0; n >>= 1) {
+    if (n & 1) {
+      p = MultModP(x2k, p);
+    }
+    x2k = MultModP(x2k, x2k);
+  }
+  return p;
+}
+
+uint32_t Combine(uint32_t crc1, uint32_t crc2, size_t len2) {
+  return MultModP(XPow8NModP(len2), crc1) ^ crc2;
+}
+
+static uint32_t SlowExtend(uint32_t crc, const char* buf, size_t size) {
+  return ExtendImpl<SlowCRC32Functor>(crc, buf, size);
+}
+
+#if defined(BUTIL_CRC32C_X86_64) || defined(BUTIL_CRC32C_ARM64)
+
+#if defined(BUTIL_CRC32C_X86_64)
+BUTIL_CRC32C_HW_TARGET
+static inline uint64_t HwCrc8(uint64_t l, const uint8_t* p) {
+  return _mm_crc32_u64(l, LE_LOAD64(p));
+}
+
+BUTIL_CRC32C_HW_TARGET
+static inline uint64_t HwCrc1(uint64_t l, uint8_t b) {
+  return _mm_crc32_u8(static_cast<uint32_t>(l), b);
+}
+
+// Returns a*b mod P with a carry-less multiplication, reducing the 63-bit
+// product by the crc instruction.
+BUTIL_CRC32C_HW_3WAY_TARGET
+static inline uint32_t HwMultModP(uint32_t a, uint32_t b) {
+  const __m128i prod = _mm_clmulepi64_si128(
+      _mm_cvtsi32_si128(a), _mm_cvtsi32_si128(b), 0);
+  const uint64_t v = static_cast<uint64_t>(_mm_cvtsi128_si64(prod)) << 1;
+  return _mm_crc32_u32(0, static_cast<uint32_t>(v)) ^
+      static_cast<uint32_t>(v >> 32);
+}
 #else
-  return false;
+static inline uint64_t HwCrc8(uint64_t l, const uint8_t* p) {
+  return __crc32cd(static_cast<uint32_t>(l), LE_LOAD64(p));
+}
+
+static inline uint64_t HwCrc1(uint64_t l, uint8_t b) {
+  return __crc32cb(static_cast<uint32_t>(l), b);
+}
+
+#if defined(BUTIL_CRC32C_ARM64_PMULL)
+static inline uint32_t HwMultModP(uint32_t a, uint32_t b) {
+  const uint64_t v = vgetq_lane_u64(vreinterpretq_u64_p128(
+      vmull_p64(static_cast<poly64_t>(a), static_cast<poly64_t>(b))), 0) << 1;
+  return __crc32cw(0, static_cast<uint32_t>(v)) ^
+      static_cast<uint32_t>(v >> 32);
+}
+#endif  // BUTIL_CRC32C_ARM64_PMULL
 #endif
+
+// Feed bytes one by one until `p' is 8-byte aligned or reaches `e'.
+BUTIL_CRC32C_HW_TARGET
+static inline uint64_t HwCrcHead(uint64_t l, const uint8_t** p,
+                                 const uint8_t* e) {
+  while (*p != e && (reinterpret_cast<uintptr_t>(*p) & 7) != 0) {
+    l = HwCrc1(l, *(*p)++);
+  }
+  return l;
+}
+
+// Feed all remaining bytes in [p, e).
+BUTIL_CRC32C_HW_TARGET
+static inline uint64_t HwCrcTail(uint64_t l, const uint8_t* p,
+                                 const uint8_t* e) {
+  for (; e - p >= 8; p += 8) {
+    l = HwCrc8(l, p);
+  }
+  for (; p != e; ++p) {
+    l = HwCrc1(l, *p);
+  }
+  return l;
+}
+
+BUTIL_CRC32C_HW_TARGET
+static uint32_t HwExtend(uint32_t crc, const char* buf, size_t size) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(buf);
+  const uint8_t* const e = p + size;
+  uint64_t l = HwCrcHead(crc ^ 0xffffffffu, &p, e);
+  l = HwCrcTail(l, p, e);
+  return static_cast<uint32_t>(l ^ 0xffffffffu);
 }
 
+#if defined(BUTIL_CRC32C_X86_64) || defined(BUTIL_CRC32C_ARM64_PMULL)
+// A crc instruction has a latency of 3 cycles but can be issued every cycle,
+// feeding 3 independent streams at a time keeps the unit busy. Partial crc
+// of a stream is shifted over the following stream by multiplying it with
+// x^(8*stride) mod P and combined.
+static const size_t kLongStride = 2048;
+static const size_t kShortStride = 256;
+static uint32_t s_long_stride_shift = 0;    // x^(8*kLongStride) mod P
+static uint32_t s_short_stride_shift = 0;   // x^(8*kShortStride) mod P
+
+BUTIL_CRC32C_HW_3WAY_TARGET
+static inline uint64_t HwCrc3Way(uint64_t l, const uint8_t* p,
+                                 size_t stride, uint32_t shift) {
+  const uint8_t* p1 = p + stride;
+  const uint8_t* p2 = p1 + stride;
+  const uint8_t* const end = p1;
+  uint64_t l1 = 0;
+  uint64_t l2 = 0;
+  for (; p != end; p += 8, p1 += 8, p2 += 8) {
+    l = HwCrc8(l, p);
+    l1 = HwCrc8(l1, p1);
+    l2 = HwCrc8(l2, p2);
+  }
+  l = HwMultModP(shift, static_cast<uint32_t>(l)) ^ l1;
+  return HwMultModP(shift, static_cast<uint32_t>(l)) ^ l2;
+}
+
+BUTIL_CRC32C_HW_3WAY_TARGET
+static uint32_t HwExtend3Way(uint32_t crc, const char* buf, size_t size) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(buf);
+  const uint8_t* const e = p + size;
+  uint64_t l = HwCrcHead(crc ^ 0xffffffffu, &p, e);
+  for (; (size_t)(e - p) >= 3 * kLongStride; p += 3 * kLongStride) {
+    l = HwCrc3Way(l, p, kLongStride, s_long_stride_shift);
+  }
+  for (; (size_t)(e - p) >= 3 * kShortStride; p += 3 * kShortStride) {
+    l = HwCrc3Way(l, p, kShortStride, s_short_stride_shift);
+  }
+  l = HwCrcTail(l, p, e);
+  return static_cast<uint32_t>(l ^ 0xffffffffu);
+}
+#endif
+
+#endif  // BUTIL_CRC32C_X86_64 || BUTIL_CRC32C_ARM64
+
 typedef uint32_t (*Function)(uint32_t, const char*, size_t);
 
-static inline Function Choose_Extend() {
-  return isSSE42() ? (Function)ExtendImpl<FastCRC32Functor> : 
-                    (Function)ExtendImpl<SlowCRC32Functor>;
+static Function Choose_Extend() {
+#if defined(BUTIL_CRC32C_X86_64)
+  uint32_t c_;
+  uint32_t d_;
+  __asm__("cpuid" : "=c"(c_), "=d"(d_) : "a"(1) : "ebx");
+  const bool sse42 = (c_ & (1U << 20));  // copied from CpuId.h in Folly.
+  const bool pclmul = (c_ & (1U << 1));
+  if (sse42 && pclmul) {
+    s_long_stride_shift = XPow8NModP(kLongStride);
+    s_short_stride_shift = XPow8NModP(kShortStride);
+    return HwExtend3Way;
+  }
+  if (sse42) {
+    return HwExtend;
+  }
+#elif defined(BUTIL_CRC32C_ARM64)
+  const unsigned long hwcap = getauxval(AT_HWCAP);
+  if (hwcap & HWCAP_CRC32) {
+#if defined(BUTIL_CRC32C_ARM64_PMULL)
+    if (hwcap & HWCAP_PMULL) {
+      s_long_stride_shift = XPow8NModP(kLongStride);
+      s_short_stride_shift = XPow8NModP(kShortStride);
+      return HwExtend3Way;
+    }
+#endif
+    return HwExtend;
+  }
+#endif
+  return SlowExtend;
+}
+
+static Function ChosenExtend() {
+  static Function chosen_extend = Choose_Extend();
+  return chosen_extend;
 }
 
 bool IsFastCrc32Supported() {
-#ifdef __SSE4_2__
-  return isSSE42();
-#else
-  return false;
-#endif
+  return ChosenExtend() != SlowExtend;
 }
 
 uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
-  static Function ChosenExtend = Choose_Extend();
-  return ChosenExtend(crc, buf, size);
+  return ChosenExtend()(crc, buf, size);
+}
+
+uint32_t Extend(uint32_t crc, const IOBuf& buf) {
+  const Function extend = ChosenExtend();
+  const size_t n = buf.backing_block_num();
+  for (size_t i = 0; i < n; ++i) {
+    const StringPiece blk = buf.backing_block(i);
+    crc = extend(crc, blk.data(), blk.size());
+  }
+  return crc;
 }
 
 }  // namespace crc32c
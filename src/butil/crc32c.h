@@ -14,8 +14,13 @@
 #include <stdint.h>
 
 namespace butil {
+
+class IOBuf;
+
 namespace crc32c {
 
+// True if crc32c is computed by CPU instructions (SSE4.2 on x86-64, the CRC
+// extension on aarch64) which is chosen at runtime.
 extern bool IsFastCrc32Supported();
 
 // Return the crc32c of concat(A, data[0,n-1]) where init_crc is the
@@ -23,6 +28,13 @@ extern bool IsFastCrc32Supported();
 // crc32c of a stream of data.
 extern uint32_t Extend(uint32_t init_crc, const char* data, size_t n);
 
+// Extend `init_crc' with all bytes in `buf', block by block without copying.
+extern uint32_t Extend(uint32_t init_crc, const IOBuf& buf);
+
+// Return the crc32c of concat(A, B) where crc1 is the crc32c of A and crc2
+// is the crc32c of B which has len2 bytes.
+extern uint32_t Combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
 // Return the crc32c of data[0,n-1]
 inline uint32_t Value(const char* data, size_t n) {
   return Extend(0, data, n);
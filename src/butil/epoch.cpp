@@ -0,0 +1,177 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <deque>
+#include "butil/scoped_lock.h"
+#include "butil/thread_local.h"
+#include "butil/epoch.h"
+
+namespace butil {
+
+namespace epoch_internal {
+
+namespace {
+
+struct RetiredAt {
+    EpochRetired retired;
+    // Value of g_epoch when `retired' was retired.
+    uint64_t epoch;
+};
+
+// Epoch 0 means "not reading".
+butil::atomic<uint64_t> g_epoch(1);
+pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Records are reused by new threads after their threads quit, and never
+// freed since guards of suspended bthreads may still reference them.
+// Protected by g_mutex.
+std::vector<Record*>* g_records = NULL;
+// Ordered by epoch. Protected by g_mutex.
+std::deque<RetiredAt>* g_retired = NULL;
+butil::atomic<size_t> g_nretired(0);
+
+BAIDU_THREAD_LOCAL Record* tls_record = NULL;
+
+void release_record(void* arg) {
+    BAIDU_SCOPED_LOCK(g_mutex);
+    static_cast<Record*>(arg)->in_use = false;
+}
+
+Record* acquire_record() {
+    Record* rec = NULL;
+    {
+        BAIDU_SCOPED_LOCK(g_mutex);
+        if (g_records == NULL) {
+            g_records = new std::vector<Record*>;
+        }
+        for (size_t i = 0; i < g_records->size(); ++i) {
+            if (!(*g_records)[i]->in_use) {
+                rec = (*g_records)[i];
+                break;
+            }
+        }
+        if (rec == NULL) {
+            rec = new Record;
+            rec->state.store(0, butil::memory_order_relaxed);
+            g_records->push_back(rec);
+        }
+        rec->in_use = true;
+    }
+    butil::thread_atexit(release_record, rec);
+    return rec;
+}
+
+// Move retired objects which are not accessible into `freeable'.
+// Called with g_mutex held.
+void collect_freeable(std::vector<EpochRetired>* freeable) {
+    if (g_retired == NULL || g_retired->empty()) {
+        return;
+    }
+    // Pairs with the fence in EpochGuard.
+    butil::atomic_thread_fence(butil::memory_order_seq_cst);
+    uint64_t min_active = UINT64_MAX;
+    for (size_t i = 0; g_records != NULL && i < g_records->size(); ++i) {
+        const uint64_t s =
+            (*g_records)[i]->state.load(butil::memory_order_relaxed);
+        const uint64_t e = (s & (ONE_DEPTH - 1));
+        if (s != 0 && e < min_active) {
+            min_active = e;
+        }
+    }
+    // Objects retired at epoch `e' are not reachable by readers entering at
+    // epochs larger than `e'.
+    while (!g_retired->empty() && g_retired->front().epoch < min_active) {
+        freeable->push_back(g_retired->front().retired);
+        g_retired->pop_front();
+    }
+    g_nretired.fetch_sub(freeable->size(), butil::memory_order_relaxed);
+}
+
+void free_all(const std::vector<EpochRetired>& freeable) {
+    for (size_t i = 0; i < freeable.size(); ++i) {
+        freeable[i].deleter(freeable[i].ptr);
+    }
+}
+
+}  // namespace
+
+Record* get_record() {
+    Record* rec = tls_record;
+    if (BAIDU_UNLIKELY(rec == NULL)) {
+        rec = acquire_record();
+        tls_record = rec;
+    }
+    return rec;
+}
+
+uint64_t current_epoch() {
+    // Acquire pairs with the fetch_add in epoch_retire(), readers seeing the
+    // new epoch also see the objects unlinked before it.
+    return g_epoch.load(butil::memory_order_acquire);
+}
+
+}  // namespace epoch_internal
+
+using namespace epoch_internal;
+
+void epoch_retire(const std::vector<EpochRetired>& retired) {
+    if (retired.empty()) {
+        epoch_reclaim();
+        return;
+    }
+    std::vector<EpochRetired> freeable;
+    {
+        BAIDU_SCOPED_LOCK(g_mutex);
+        if (g_retired == NULL) {
+            g_retired = new std::deque<RetiredAt>;
+        }
+        // Readers entering after this see a larger epoch and can't reach
+        // the objects.
+        const uint64_t epoch =
+            g_epoch.fetch_add(1, butil::memory_order_acq_rel);
+        for (size_t i = 0; i < retired.size(); ++i) {
+            RetiredAt r = { retired[i], epoch };
+            g_retired->push_back(r);
+        }
+        g_nretired.fetch_add(retired.size(), butil::memory_order_relaxed);
+        collect_freeable(&freeable);
+    }
+    free_all(freeable);
+}
+
+void epoch_retire(void* ptr, void (*deleter)(void*)) {
+    EpochRetired r = { ptr, deleter };
+    epoch_retire(std::vector<EpochRetired>(1, r));
+}
+
+void epoch_reclaim() {
+    if (g_nretired.load(butil::memory_order_relaxed) == 0) {
+        return;
+    }
+    std::vector<EpochRetired> freeable;
+    {
+        BAIDU_SCOPED_LOCK(g_mutex);
+        collect_freeable(&freeable);
+    }
+    free_all(freeable);
+}
+
+size_t epoch_pending_count() {
+    return g_nretired.load(butil::memory_order_relaxed);
+}
+
+}  // namespace butil
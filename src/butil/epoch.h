@@ -0,0 +1,130 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Epoch based memory reclamation. Readers of a lock-free structure enter an
+// epoch with EpochGuard before touching shared objects; writers unlink
+// objects from the structure then hand them to epoch_retire(), which frees
+// them after every reader that may still see them leaves its epoch.
+//
+// Unlike DoublyBufferedData, readers only modify a thread-local word and
+// writers never wait for readers. A guard remembers the record it entered
+// with, so a bthread which is suspended inside the guard and resumed by
+// another worker leaves the correct record. Suspending inside a guard is
+// allowed but delays reclamation of all retired objects, keep it short.
+//
+// Example:
+//   // reader
+//   {
+//       butil::EpochGuard guard;
+//       const Foo* foo = g_foo.load(butil::memory_order_acquire);
+//       ... // `foo' is valid until guard is destructed.
+//   }
+//   // writer
+//   Foo* old = g_foo.exchange(new_foo, butil::memory_order_acq_rel);
+//   butil::epoch_delete(old);
+
+#ifndef BUTIL_EPOCH_H
+#define BUTIL_EPOCH_H
+
+#include <stdint.h>
+#include <vector>
+#include "butil/macros.h"
+#include "butil/atomicops.h"
+
+namespace butil {
+
+namespace epoch_internal {
+
+// Lower bits of `state' is the epoch when the readers of the record began
+// reading, higher bits is the number of readers inside guards.
+// State is 0 when no one is reading.
+static const int DEPTH_SHIFT = 48;
+static const uint64_t ONE_DEPTH = (1ULL << DEPTH_SHIFT);
+
+struct BAIDU_CACHELINE_ALIGNMENT Record {
+    butil::atomic<uint64_t> state;
+    bool in_use;
+};
+
+// Get record of the calling thread, created at the first call.
+Record* get_record();
+uint64_t current_epoch();
+
+}  // namespace epoch_internal
+
+// Readers are inside an EpochGuard when accessing shared objects. Nestable.
+class EpochGuard {
+public:
+    EpochGuard() : _rec(epoch_internal::get_record()) {
+        using namespace epoch_internal;
+        uint64_t s = _rec->state.load(butil::memory_order_relaxed);
+        uint64_t new_s;
+        do {
+            new_s = (s != 0 ? s + ONE_DEPTH : ONE_DEPTH | current_epoch());
+        } while (!_rec->state.compare_exchange_weak(
+                     s, new_s, butil::memory_order_relaxed));
+        if (s == 0) {
+            // Pairs with the fence in epoch_retire(): either the writer sees
+            // this reader, or this reader sees the unlinked objects.
+            butil::atomic_thread_fence(butil::memory_order_seq_cst);
+        }
+    }
+    ~EpochGuard() {
+        using namespace epoch_internal;
+        uint64_t s = _rec->state.load(butil::memory_order_relaxed);
+        uint64_t new_s;
+        do {
+            new_s = ((s >> DEPTH_SHIFT) == 1 ? 0 : s - ONE_DEPTH);
+        } while (!_rec->state.compare_exchange_weak(
+                     s, new_s, butil::memory_order_release,
+                     butil::memory_order_relaxed));
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(EpochGuard);
+    epoch_internal::Record* _rec;
+};
+
+struct EpochRetired {
+    void* ptr;
+    void (*deleter)(void*);
+};
+
+// Call deleters of `retired' when no reader can access them, which is
+// probably inside a later call to epoch_retire() or epoch_reclaim().
+// Objects must be unlinked from the structure before being retired.
+void epoch_retire(const std::vector<EpochRetired>& retired);
+void epoch_retire(void* ptr, void (*deleter)(void*));
+
+// `delete ptr' when no reader can access it.
+template <typename T>
+void epoch_delete(T* ptr) {
+    struct Deleter {
+        static void call(void* p) { delete static_cast<T*>(p); }
+    };
+    epoch_retire(ptr, Deleter::call);
+}
+
+// Free retired objects which are not accessible anymore.
+void epoch_reclaim();
+
+// Number of retired objects waiting to be freed.
+size_t epoch_pending_count();
+
+}  // namespace butil
+
+#endif  // BUTIL_EPOCH_H
@@ -17,8 +17,13 @@
 
 // Date: Thu Dec 31 13:35:39 CST 2015
 
+#include <algorithm>       // std::min
 #include <limits>          // numeric_limits
 #include <math.h>
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
 #include "butil/basictypes.h"
 #include "butil/macros.h"
 #include "butil/time.h"     // gettimeofday_us()
@@ -56,40 +61,130 @@ void init_fast_rand_seed(FastRandSeed* seed) {
     seed->s[1] = splitmix64_next(&seed4seed);
 }
 
-inline uint64_t fast_rand_impl(uint64_t range, FastRandSeed* seed) {
+// Thread-local randoms are generated in batches by 4 interleaved
+// xorshift128+ generators which are updated together with SIMD, and
+// consumed one by one. Refilling costs ~1ns per value, much cheaper than
+// stepping a single generator per call whose steps depend on each other.
+static const size_t RAND_LANES = 4;
+static const size_t RAND_BATCH = 64;
+
+struct FastRandBatch {
+    uint64_t s0[RAND_LANES];
+    uint64_t s1[RAND_LANES];
+    uint64_t values[RAND_BATCH];
+    size_t pos;
+};
+
+// Seeds for different threads are stored separately in thread-local storage.
+// `pos' starts at RAND_BATCH so that the first call refills the batch.
+static __thread FastRandBatch _tls_batch = {
+    { 0, 0, 0, 0 }, { 0, 0, 0, 0 }, { 0 }, RAND_BATCH };
+
+// Generate `n' (multiple of RAND_LANES) values into `out' by stepping
+// every lane n / RAND_LANES times.
+static void fill_randoms(FastRandBatch* b, uint64_t* out, size_t n) {
+#if defined(__x86_64__) && defined(__GNUC__)
+    __m128i a0 = _mm_loadu_si128((const __m128i*)b->s0);
+    __m128i a1 = _mm_loadu_si128((const __m128i*)(b->s0 + 2));
+    __m128i c0 = _mm_loadu_si128((const __m128i*)b->s1);
+    __m128i c1 = _mm_loadu_si128((const __m128i*)(b->s1 + 2));
+#define BUTIL_XORSHIFT128_STEP(a, c, dst)                               \
+    do {                                                                \
+        __m128i x = _mm_xor_si128(a, _mm_slli_epi64(a, 23));            \
+        a = c;                                                          \
+        c = _mm_xor_si128(_mm_xor_si128(x, c),                          \
+                          _mm_xor_si128(_mm_srli_epi64(x, 18),          \
+                                        _mm_srli_epi64(c, 5)));         \
+        _mm_storeu_si128((__m128i*)(dst), _mm_add_epi64(c, a));         \
+    } while (0)
+    for (size_t i = 0; i < n; i += RAND_LANES) {
+        BUTIL_XORSHIFT128_STEP(a0, c0, out + i);
+        BUTIL_XORSHIFT128_STEP(a1, c1, out + i + 2);
+    }
+#undef BUTIL_XORSHIFT128_STEP
+    _mm_storeu_si128((__m128i*)b->s0, a0);
+    _mm_storeu_si128((__m128i*)(b->s0 + 2), a1);
+    _mm_storeu_si128((__m128i*)b->s1, c0);
+    _mm_storeu_si128((__m128i*)(b->s1 + 2), c1);
+#else
+    for (size_t i = 0; i < n; i += RAND_LANES) {
+        for (size_t j = 0; j < RAND_LANES; ++j) {
+            FastRandSeed seed = { { b->s0[j], b->s1[j] } };
+            out[i + j] = xorshift128_next(&seed);
+            b->s0[j] = seed.s[0];
+            b->s1[j] = seed.s[1];
+        }
+    }
+#endif
+}
+
+static void init_batch(FastRandBatch* b) {
+    SplitMix64Seed seed4seed = butil::gettimeofday_us() ^
+        (uint64_t)(uintptr_t)b;  // differ between threads started together
+    for (size_t j = 0; j < RAND_LANES; ++j) {
+        b->s0[j] = splitmix64_next(&seed4seed);
+        b->s1[j] = splitmix64_next(&seed4seed);
+    }
+}
+
+// True if the seeds are (probably) uninitialized. There's definitely false
+// positive, but it's OK for us.
+inline bool need_init(const FastRandBatch& b) {
+    return b.s0[0] == 0 && b.s1[0] == 0;
+}
+
+static void refill_batch(FastRandBatch* b) {
+    if (need_init(*b)) {
+        init_batch(b);
+    }
+    fill_randoms(b, b->values, RAND_BATCH);
+    b->pos = 0;
+}
+
+inline uint64_t tls_rand() {
+    FastRandBatch* b = &_tls_batch;
+    if (BAIDU_UNLIKELY(b->pos >= RAND_BATCH)) {
+        refill_batch(b);
+    }
+    return b->values[b->pos++];
+}
+
+// Generate a random value in [0, range) without modulo bias.
+inline uint64_t fast_rand_impl(uint64_t range) {
+#if defined(__SIZEOF_INT128__)
+    // Lemire's multiply-shift: the high 64 bits of x * range are in
+    // [0, range). Values whose low 64 bits are less than 2^64 % range are
+    // rejected to remove the bias. The rejection threshold needs a division,
+    // but it's only computed when low bits are less than range, which is
+    // rare unless range is close to 2^64.
+    unsigned __int128 m = (unsigned __int128)tls_rand() * range;
+    uint64_t low = (uint64_t)m;
+    if (BAIDU_UNLIKELY(low < range)) {
+        const uint64_t threshold = (0 - range) % range;
+        while (low < threshold) {
+            m = (unsigned __int128)tls_rand() * range;
+            low = (uint64_t)m;
+        }
+    }
+    return (uint64_t)(m >> 64);
+#else
     // Separating uint64_t values into following intervals:
     //   [0,range-1][range,range*2-1] ... [uint64_max/range*range,uint64_max]
     // If the generated 64-bit random value falls into any interval except the
     // last one, the probability of taking any value inside [0, range-1] is
     // same. If the value falls into last interval, we retry the process until
-    // the value falls into other intervals. If min/max are limited to 32-bits,
-    // the retrying is rare. The amortized retrying count at maximum is 1 when 
-    // range equals 2^32. A corner case is that even if the range is power of
-    // 2(e.g. min=0 max=65535) in which case the retrying can be avoided, we
-    // still retry currently. The reason is just to keep the code simpler
-    // and faster for most cases.
+    // the value falls into other intervals.
     const uint64_t div = std::numeric_limits<uint64_t>::max() / range;
     uint64_t result;
     do {
-        result = xorshift128_next(seed) / div;
+        result = tls_rand() / div;
     } while (result >= range);
     return result;
-}
-
-// Seeds for different threads are stored separately in thread-local storage.
-static __thread FastRandSeed _tls_seed = { { 0, 0 } };
-
-// True if the seed is (probably) uninitialized. There's definitely false
-// positive, but it's OK for us.
-inline bool need_init(const FastRandSeed& seed) {
-    return seed.s[0] == 0 && seed.s[1] == 0;
+#endif
 }
 
 uint64_t fast_rand() {
-    if (need_init(_tls_seed)) {
-        init_fast_rand_seed(&_tls_seed);
-    }
-    return xorshift128_next(&_tls_seed);
+    return tls_rand();
 }
 
 uint64_t fast_rand(FastRandSeed* seed) {
@@ -100,16 +195,10 @@ uint64_t fast_rand_less_than(uint64_t range) {
     if (range == 0) {
         return 0;
     }
-    if (need_init(_tls_seed)) {
-        init_fast_rand_seed(&_tls_seed);
-    }
-    return fast_rand_impl(range, &_tls_seed);
+    return fast_rand_impl(range);
 }
 
 int64_t fast_rand_in_64(int64_t min, int64_t max) {
-    if (need_init(_tls_seed)) {
-        init_fast_rand_seed(&_tls_seed);
-    }
     if (min >= max) {
         if (min == max) {
             return min;
@@ -121,15 +210,12 @@ int64_t fast_rand_in_64(int64_t min, int64_t max) {
     int64_t range = max - min + 1;
     if (range == 0) {
         // max = INT64_MAX, min = INT64_MIN
-        return (int64_t)xorshift128_next(&_tls_seed);
+        return (int64_t)tls_rand();
     }
-    return min + (int64_t)fast_rand_impl(max - min + 1, &_tls_seed);
+    return min + (int64_t)fast_rand_impl(max - min + 1);
 }
 
 uint64_t fast_rand_in_u64(uint64_t min, uint64_t max) {
-    if (need_init(_tls_seed)) {
-        init_fast_rand_seed(&_tls_seed);
-    }
     if (min >= max) {
         if (min == max) {
             return min;
@@ -141,35 +227,46 @@ uint64_t fast_rand_in_u64(uint64_t min, uint64_t max) {
     uint64_t range = max - min + 1;
     if (range == 0) {
         // max = UINT64_MAX, min = UINT64_MIN
-        return xorshift128_next(&_tls_seed);
+        return tls_rand();
     }
-    return min + fast_rand_impl(range, &_tls_seed);
+    return min + fast_rand_impl(range);
 }
 
-inline double fast_rand_double(FastRandSeed* seed) {
+double fast_rand_double() {
     // Copied from rand_util.cc
     COMPILE_ASSERT(std::numeric_limits<double>::radix == 2, otherwise_use_scalbn);
     static const int kBits = std::numeric_limits<double>::digits;
-    uint64_t random_bits = xorshift128_next(seed) & ((UINT64_C(1) << kBits) - 1);
+    uint64_t random_bits = tls_rand() & ((UINT64_C(1) << kBits) - 1);
     double result = ldexp(static_cast<double>(random_bits), -1 * kBits);
     return result;
 }
 
-double fast_rand_double() {
-    if (need_init(_tls_seed)) {
-        init_fast_rand_seed(&_tls_seed);
-    }
-    return fast_rand_double(&_tls_seed);
-}
-
 void fast_rand_bytes(void* output, size_t output_length) {
-    const size_t n = output_length / 8;
+    size_t n = output_length / 8;
+    uint64_t* out = static_cast<uint64_t*>(output);
+    // Large outputs are generated in place without going through the
+    // thread-local batch.
+    const size_t ndirect = n / RAND_LANES * RAND_LANES;
+    if (ndirect >= RAND_BATCH) {
+        FastRandBatch* b = &_tls_batch;
+        if (need_init(*b)) {
+            init_batch(b);
+        }
+        uint64_t buf[RAND_BATCH];
+        for (size_t i = 0; i < ndirect; i += RAND_BATCH) {
+            const size_t len = std::min(ndirect - i, RAND_BATCH);
+            fill_randoms(b, buf, len);
+            memcpy(out + i, buf, len * 8);
+        }
+        out += ndirect;
+        n -= ndirect;
+    }
     for (size_t i = 0; i < n; ++i) {
-        static_cast<uint64_t*>(output)[i] = fast_rand();
+        out[i] = tls_rand();
     }
-    const size_t m = output_length - n * 8;
+    const size_t m = output_length % 8;
     if (m) {
-        uint8_t* p = static_cast<uint8_t*>(output) + n * 8;
+        uint8_t* p = reinterpret_cast<uint8_t*>(out + n);
         uint64_t r = fast_rand();
         for (size_t i = 0; i < m; ++i) {
             p[i] = (r & 0xFF);
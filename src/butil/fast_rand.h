@@ -37,14 +37,17 @@ struct FastRandSeed {
 void init_fast_rand_seed(FastRandSeed* seed);
 
 // Generate an unsigned 64-bit random number from thread-local or given seed.
-// Cost: ~5ns
+// Thread-local random numbers are generated in batches with SIMD.
+// Cost: ~2ns
 uint64_t fast_rand();
 uint64_t fast_rand(FastRandSeed*);
 
 // Generate an unsigned 64-bit random number inside [0, range) from
 // thread-local seed.
 // Returns 0 when range is 0.
-// Cost: ~30ns
+// Mapped into the range by multiplication instead of division, without
+// modulo bias.
+// Cost: ~3ns
 // Note that this can be used as an adapter for std::random_shuffle():
 //   std::random_shuffle(myvector.begin(), myvector.end(), butil::fast_rand_less_than);
 uint64_t fast_rand_less_than(uint64_t range);
@@ -52,7 +55,7 @@ uint64_t fast_rand_less_than(uint64_t range);
 // Generate a 64-bit random number inside [min, max] (inclusive!)
 // from thread-local seed.
 // NOTE: this function needs to be a template to be overloadable properly.
-// Cost: ~30ns
+// Cost: ~3ns
 template <typename T> T fast_rand_in(T min, T max) {
     extern int64_t fast_rand_in_64(int64_t min, int64_t max);
     extern uint64_t fast_rand_in_u64(uint64_t min, uint64_t max);
@@ -64,7 +67,7 @@ template <typename T> T fast_rand_in(T min, T max) {
 }
 
 // Generate a random double in [0, 1) from thread-local seed.
-// Cost: ~15ns
+// Cost: ~6ns
 double fast_rand_double();
 
 // Fills |output_length| bytes of |output| with random data.
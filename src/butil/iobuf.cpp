@@ -28,9 +28,12 @@
 #endif
 #include <sys/syscall.h>                   // syscall
 #include <fcntl.h>                         // O_RDONLY
+#include <sys/mman.h>                      // mmap
+#include <sys/stat.h>                      // fstat
 #include <errno.h>                         // errno
 #include <limits.h>                        // CHAR_BIT
 #include <stdexcept>                       // std::invalid_argument
+#include <type_traits>                     // std::aligned_storage
 #include <gflags/gflags.h>                 // gflags
 #include "butil/build_config.h"             // ARCH_CPU_X86_64
 #include "butil/atomicops.h"                // butil::atomic
@@ -38,6 +41,7 @@
 #include "butil/macros.h"                   // BAIDU_CASSERT
 #include "butil/logging.h"                  // CHECK, LOG
 #include "butil/fd_guard.h"                 // butil::fd_guard
+#include "butil/object_pool.h"              // butil::get_object
 #include "butil/iobuf.h"
 #include "butil/iobuf_profiler.h"
 
@@ -182,6 +186,7 @@ void reset_blockmem_allocate_and_deallocate() {
 butil::static_atomic<size_t> g_nblock = BUTIL_STATIC_ATOMIC_INIT(0);
 butil::static_atomic<size_t> g_blockmem = BUTIL_STATIC_ATOMIC_INIT(0);
 butil::static_atomic<size_t> g_newbigview = BUTIL_STATIC_ATOMIC_INIT(0);
+butil::static_atomic<size_t> g_nfileregion = BUTIL_STATIC_ATOMIC_INIT(0);
 
 void inc_g_nblock() {
     g_nblock.fetch_add(1, butil::memory_order_relaxed);
@@ -197,16 +202,88 @@ void dec_g_blockmem() {
     g_blockmem.fetch_sub(1, butil::memory_order_relaxed);
 }
 
+static butil::static_atomic<size_t> g_class_blockmem[IOBuf::BLOCK_SIZE_CLASS_NUM] = {
+    BUTIL_STATIC_ATOMIC_INIT(0), BUTIL_STATIC_ATOMIC_INIT(0),
+    BUTIL_STATIC_ATOMIC_INIT(0), BUTIL_STATIC_ATOMIC_INIT(0) };
+
+void inc_g_class_blockmem(int size_class) {
+    g_class_blockmem[size_class].fetch_add(
+        IOBuf::block_size_of_class((IOBuf::BlockSizeClass)size_class),
+        butil::memory_order_relaxed);
+}
+void dec_g_class_blockmem(int size_class) {
+    g_class_blockmem[size_class].fetch_sub(
+        IOBuf::block_size_of_class((IOBuf::BlockSizeClass)size_class),
+        butil::memory_order_relaxed);
+}
+
+static butil::static_atomic<size_t> g_owner_blockmem[IOBuf::BLOCK_OWNER_NUM] = {
+    BUTIL_STATIC_ATOMIC_INIT(0), BUTIL_STATIC_ATOMIC_INIT(0),
+    BUTIL_STATIC_ATOMIC_INIT(0), BUTIL_STATIC_ATOMIC_INIT(0) };
+
+static __thread IOBuf::BlockOwner tls_block_owner = IOBuf::OWNER_OTHER;
+
+IOBuf::BlockOwner current_block_owner() {
+    return tls_block_owner;
+}
+
+void inc_g_owner_blockmem(int owner, size_t cap) {
+    g_owner_blockmem[owner].fetch_add(cap, butil::memory_order_relaxed);
+}
+void dec_g_owner_blockmem(int owner, size_t cap) {
+    g_owner_blockmem[owner].fetch_sub(cap, butil::memory_order_relaxed);
+}
+
+struct PooledUserDataBlock {
+    std::aligned_storage<sizeof(IOBuf::Block) + sizeof(PooledUserDataExtension),
+                         alignof(IOBuf::Block)>::type mem;
+};
+
+void* get_pooled_user_data_block() {
+    return butil::get_object<PooledUserDataBlock>();
+}
+
+void return_pooled_user_data_block(void* mem) {
+    butil::return_object((PooledUserDataBlock*)mem);
+}
+
 }  // namespace iobuf
 
+IOBufOwnerScope::IOBufOwnerScope(IOBuf::BlockOwner owner)
+    : _saved_owner(iobuf::tls_block_owner) {
+    iobuf::tls_block_owner = owner;
+}
+
+IOBufOwnerScope::~IOBufOwnerScope() {
+    iobuf::tls_block_owner = _saved_owner;
+}
+
 size_t IOBuf::block_count() {
     return iobuf::g_nblock.load(butil::memory_order_relaxed);
 }
 
+size_t IOBuf::file_region_count() {
+    return iobuf::g_nfileregion.load(butil::memory_order_relaxed);
+}
+
 size_t IOBuf::block_memory() {
     return iobuf::g_blockmem.load(butil::memory_order_relaxed);
 }
 
+size_t IOBuf::block_memory(BlockSizeClass c) {
+    if ((int)c < 0 || c >= BLOCK_SIZE_CLASS_NUM) {
+        return 0;
+    }
+    return iobuf::g_class_blockmem[c].load(butil::memory_order_relaxed);
+}
+
+size_t IOBuf::block_memory_of_owner(BlockOwner owner) {
+    if ((int)owner < 0 || owner >= BLOCK_OWNER_NUM) {
+        return 0;
+    }
+    return iobuf::g_owner_blockmem[owner].load(butil::memory_order_relaxed);
+}
+
 size_t IOBuf::new_bigview_count() {
     return iobuf::g_newbigview.load(butil::memory_order_relaxed);
 }
@@ -248,9 +325,19 @@ inline IOBuf::Block* create_block_aligned(size_t block_size, size_t alignment) {
 // === Share TLS blocks between appending operations ===
 
 static __thread TLSData g_tls_data = { NULL, 0, false };
+// Blocks of non-default size classes, the slot of DEFAULT_BLOCK is unused.
+static __thread TLSData g_tls_class_data[IOBuf::BLOCK_SIZE_CLASS_NUM] = {
+    { NULL, 0, false }, { NULL, 0, false },
+    { NULL, 0, false }, { NULL, 0, false } };
 
 // Used in release_tls_block()
 TLSData* get_g_tls_data() { return &g_tls_data; }
+TLSData* get_tls_data(int size_class) {
+    if (size_class < 0 || size_class == IOBuf::DEFAULT_BLOCK) {
+        return &g_tls_data;
+    }
+    return &g_tls_class_data[size_class];
+}
 // Used in UT
 IOBuf::Block* get_tls_block_head() { return g_tls_data.block_head; }
 int get_tls_block_count() { return g_tls_data.num_blocks; }
@@ -268,9 +355,7 @@ void dec_g_num_hit_tls_threshold() {
     g_num_hit_tls_threshold.fetch_sub(1, butil::memory_order_relaxed);
 }
 
-// Called in UT.
-void remove_tls_block_chain() {
-    TLSData& tls_data = g_tls_data;
+static void remove_tls_block_chain(TLSData& tls_data) {
     IOBuf::Block* b = tls_data.block_head;
     if (!b) {
         return;
@@ -287,6 +372,14 @@ void remove_tls_block_chain() {
     tls_data.num_blocks = 0;
 }
 
+// Called in UT.
+void remove_tls_block_chain() {
+    remove_tls_block_chain(g_tls_data);
+    for (int i = 0; i < IOBuf::BLOCK_SIZE_CLASS_NUM; ++i) {
+        remove_tls_block_chain(g_tls_class_data[i]);
+    }
+}
+
 // Get a (non-full) block from TLS.
 // Notice that the block is not removed from TLS.
 IOBuf::Block* share_tls_block() {
@@ -377,6 +470,28 @@ IOBuf::Block* acquire_tls_block() {
     return b;
 }
 
+IOBuf::Block* acquire_tls_block(IOBuf::BlockSizeClass size_class) {
+    if (size_class == IOBuf::DEFAULT_BLOCK) {
+        return acquire_tls_block();
+    }
+    TLSData& tls_data = g_tls_class_data[size_class];
+    IOBuf::Block* b = tls_data.block_head;
+    while (b && b->full()) {
+        IOBuf::Block* const saved_next = b->u.portal_next;
+        b->dec_ref();
+        tls_data.block_head = saved_next;
+        --tls_data.num_blocks;
+        b = saved_next;
+    }
+    if (!b) {
+        return create_block(IOBuf::block_size_of_class(size_class));
+    }
+    tls_data.block_head = b->u.portal_next;
+    --tls_data.num_blocks;
+    b->u.portal_next = NULL;
+    return b;
+}
+
 inline IOBuf::BlockRef* acquire_blockref_array(size_t cap) {
     iobuf::g_newbigview.fetch_add(1, butil::memory_order_relaxed);
     return new IOBuf::BlockRef[cap];
@@ -763,63 +878,93 @@ size_t IOBuf::cutn(std::string* out, size_t n) {
 }
 
 int IOBuf::_cut_by_char(IOBuf* out, char d) {
+    const ssize_t n = find(d);
+    if (n < 0) {
+        return -1;
+    }
+    // There's no way cutn/pop_front fails
+    cutn(out, n);
+    pop_front(1);
+    return 0;
+}
+
+int IOBuf::_cut_by_delim(IOBuf* out, char const* dbegin, size_t ndelim) {
+    const ssize_t n = find(StringPiece(dbegin, ndelim));
+    if (n < 0) {
+        return -1;
+    }
+    // There's no way cutn/pop_front fails
+    cutn(out, n);
+    pop_front(ndelim);
+    return 0;
+}
+
+ssize_t IOBuf::find(char c, size_t pos) const {
     const size_t nref = _ref_num();
-    size_t n = 0;
-    
+    size_t offset = 0;  // offset of the first byte of current BlockRef
     for (size_t i = 0; i < nref; ++i) {
         IOBuf::BlockRef const& r = _ref_at(i);
-        char const* const s = r.block->data + r.offset;
-        for (uint32_t j = 0; j < r.length; ++j, ++n) {
-            if (s[j] == d) {
-                // There's no way cutn/pop_front fails
-                cutn(out, n);
-                pop_front(1);
-                return 0;
+        if (pos < offset + r.length) {
+            char const* const s = r.block->data + r.offset;
+            const size_t skip = (pos > offset ? pos - offset : 0);
+            const void* p = memchr(s + skip, c, r.length - skip);
+            if (p != NULL) {
+                return offset + ((char const*)p - s);
             }
         }
+        offset += r.length;
     }
-
     return -1;
 }
 
-int IOBuf::_cut_by_delim(IOBuf* out, char const* dbegin, size_t ndelim) {
-    typedef unsigned long SigType;
-    const size_t NMAX = sizeof(SigType);
-    
-    if (ndelim > NMAX || ndelim > length()) {
-        return -1;
+ssize_t IOBuf::find(const StringPiece& delim, size_t pos) const {
+    if (delim.size() <= 1) {
+        return delim.empty() ? -1 : find(delim[0], pos);
     }
-    
-    SigType dsig = 0;
-    for (size_t i = 0; i < ndelim; ++i) {
-        dsig = (dsig << CHAR_BIT) | static_cast<SigType>(dbegin[i]);
-    }
-    
-    const SigType SIGMASK =
-        (ndelim == NMAX ? (SigType)-1 : (((SigType)1 << (ndelim * CHAR_BIT)) - 1));
-
     const size_t nref = _ref_num();
-    SigType sig = 0;
-    size_t n = 0;
-
+    size_t offset = 0;  // offset of the first byte of current BlockRef
     for (size_t i = 0; i < nref; ++i) {
         IOBuf::BlockRef const& r = _ref_at(i);
         char const* const s = r.block->data + r.offset;
-        
-        for (uint32_t j = 0; j < r.length; ++j, ++n) {
-            sig = ((sig << CHAR_BIT) | static_cast<SigType>(s[j])) & SIGMASK;
-            if (sig == dsig) {
-                // There's no way cutn/pop_front fails
-                cutn(out, n + 1 - ndelim);
-                pop_front(ndelim);
-                return 0;
+        size_t j = (pos > offset ? pos - offset : 0);
+        while (j < r.length) {
+            // Skip to the candidates quickly and verify them.
+            char const* p = (char const*)memchr(s + j, delim[0], r.length - j);
+            if (p == NULL) {
+                break;
+            }
+            j = p - s;
+            const size_t left = r.length - j;
+            if (left >= delim.size()) {
+                if (memcmp(p, delim.data(), delim.size()) == 0) {
+                    return offset + j;
+                }
+            } else if (memcmp(p, delim.data(), left) == 0 &&
+                       _ref_starts_with(i + 1, delim.data() + left,
+                                        delim.size() - left)) {
+                return offset + j;
             }
+            ++j;
         }
+        offset += r.length;
     }
-
     return -1;
 }
 
+bool IOBuf::_ref_starts_with(size_t i, char const* data, size_t n) const {
+    const size_t nref = _ref_num();
+    for (; i < nref && n > 0; ++i) {
+        IOBuf::BlockRef const& r = _ref_at(i);
+        const size_t len = std::min((size_t)r.length, n);
+        if (memcmp(r.block->data + r.offset, data, len) != 0) {
+            return false;
+        }
+        data += len;
+        n -= len;
+    }
+    return n == 0;
+}
+
 // Since cut_into_file_descriptor() allocates iovec on stack, IOV_MAX=1024
 // is too large(in the worst case) for bthreads with small stacks.
 static const size_t IOBUF_IOV_MAX = 256;
@@ -1144,6 +1289,26 @@ int IOBuf::append_user_data_with_meta(void* data,
     return 0;
 }
 
+int IOBuf::append_user_data(void* data, size_t size,
+                            void (*deleter)(void* data, void* arg), void* arg) {
+    if (size > 0xFFFFFFFFULL - 100) {
+        LOG(FATAL) << "data_size=" << size << " is too large";
+        return -1;
+    }
+    if (!size) {
+        deleter(data, arg);
+        return 0;
+    }
+    void* mem = iobuf::get_pooled_user_data_block();
+    if (mem == NULL) {
+        return -1;
+    }
+    IOBuf::Block* b = new (mem) IOBuf::Block((char*)data, size, deleter, arg);
+    const IOBuf::BlockRef r = { 0, b->cap, b };
+    _move_back_ref(r);
+    return 0;
+}
+
 uint64_t IOBuf::get_first_data_meta() {
     if (_ref_num() == 0) {
         return 0;
@@ -1155,6 +1320,96 @@ uint64_t IOBuf::get_first_data_meta() {
     return r.block->u.data_meta;
 }
 
+// Mappings of file regions are split so that sizes of blocks fit in
+// uint32_t, and huge files do not need huge continuous address space.
+static const size_t MAX_FILE_REGION_BLOCK_SIZE = 256 * 1024 * 1024;
+
+int IOBuf::append_file_region(int fd, off_t offset, size_t length) {
+    if (fd < 0 || offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode) || (size_t)offset > (size_t)st.st_size ||
+        length > (size_t)st.st_size - offset) {
+        // Accessing pages beyond end of the file raises SIGBUS.
+        errno = EINVAL;
+        return -1;
+    }
+    static const size_t page_size = getpagesize();
+    IOBuf tmp;
+    while (length > 0) {
+        const size_t len = std::min(length, MAX_FILE_REGION_BLOCK_SIZE);
+        // Offset of mmap must be a multiple of page size.
+        const size_t skip = offset % page_size;
+        const size_t map_size = skip + len;
+        void* mem = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, offset - skip);
+        if (mem == MAP_FAILED) {
+            return -1;
+        }
+        const int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (dup_fd < 0) {
+            munmap(mem, map_size);
+            return -1;
+        }
+        char* raw = (char*)malloc(sizeof(IOBuf::Block) + sizeof(UserDataExtension)
+                                  + sizeof(FileRegionExtension));
+        if (raw == NULL) {
+            close(dup_fd);
+            munmap(mem, map_size);
+            return -1;
+        }
+        iobuf::g_nfileregion.fetch_add(1, butil::memory_order_relaxed);
+        IOBuf::Block* b = new (raw) IOBuf::Block(
+            (char*)mem + skip, len, [mem, map_size, dup_fd](void*) {
+                munmap(mem, map_size);
+                close(dup_fd);
+                iobuf::g_nfileregion.fetch_sub(1, butil::memory_order_relaxed);
+            });
+        b->flags |= IOBUF_BLOCK_FLAGS_FILE_REGION;
+        FileRegionExtension* ext = b->get_file_region_extension();
+        ext->fd = dup_fd;
+        ext->offset = offset;
+        const IOBuf::BlockRef r = { 0, b->cap, b };
+        tmp._move_back_ref(r);
+        offset += len;
+        length -= len;
+    }
+    append(butil::IOBuf::Movable(tmp));
+    return 0;
+}
+
+bool IOBuf::get_first_file_region(int* fd, off_t* offset, size_t* length) const {
+    if (_ref_num() == 0) {
+        return false;
+    }
+    IOBuf::BlockRef const& r = _ref_at(0);
+    if (!(r.block->flags & IOBUF_BLOCK_FLAGS_FILE_REGION)) {
+        return false;
+    }
+    const FileRegionExtension* ext = r.block->get_file_region_extension();
+    *fd = ext->fd;
+    *offset = ext->offset + r.offset;
+    *length = r.length;
+    return true;
+}
+
+size_t IOBuf::bytes_before_file_region() const {
+    size_t n = 0;
+    const size_t nref = _ref_num();
+    for (size_t i = 0; i < nref; ++i) {
+        IOBuf::BlockRef const& r = _ref_at(i);
+        if (r.block->flags & IOBUF_BLOCK_FLAGS_FILE_REGION) {
+            return n;
+        }
+        n += r.length;
+    }
+    return n;
+}
+
 int IOBuf::resize(size_t n, char c) {
     const size_t saved_len = length();
     if (n < saved_len) {
@@ -1479,7 +1734,7 @@ void IOPortal::clear() {
 const int MAX_APPEND_IOVEC = 64;
 
 ssize_t IOPortal::pappend_from_file_descriptor(
-    int fd, off_t offset, size_t max_count) {
+    int fd, off_t offset, size_t max_count, size_t block_size) {
     iovec vec[MAX_APPEND_IOVEC];
     int nvec = 0;
     size_t space = 0;
@@ -1488,7 +1743,14 @@ ssize_t IOPortal::pappend_from_file_descriptor(
     // Prepare at most MAX_APPEND_IOVEC blocks or space of blocks >= max_count
     do {
         if (p == NULL) {
-            p = iobuf::acquire_tls_block();
+            const int c = iobuf::block_size_class_of(block_size);
+            if (c >= 0) {
+                p = iobuf::acquire_tls_block((IOBuf::BlockSizeClass)c);
+            } else if (block_size > IOBuf::DEFAULT_BLOCK_SIZE) {
+                p = iobuf::create_block(block_size);
+            } else {
+                p = iobuf::acquire_tls_block();
+            }
             if (BAIDU_UNLIKELY(!p)) {
                 errno = ENOMEM;
                 return -1;
@@ -1642,7 +1904,34 @@ ssize_t IOPortal::append_from_SSL_channel(
 }
 
 void IOPortal::return_cached_blocks_impl(Block* b) {
-    iobuf::release_tls_block_chain(b);
+    // Blocks of other size classes are returned to TLS of their classes.
+    // Other blocks larger than default ones(see pappend_from_file_descriptor)
+    // are released directly to keep memory cached in TLS bounded.
+    const size_t default_cap = IOBuf::DEFAULT_BLOCK_SIZE - sizeof(Block);
+    Block* head = NULL;
+    Block* tail = NULL;
+    do {
+        Block* const saved_next = b->u.portal_next;
+        const int c = b->size_class();
+        if (c >= 0 && c != IOBuf::DEFAULT_BLOCK) {
+            b->u.portal_next = NULL;
+            iobuf::release_tls_block(b);
+        } else if (b->cap > default_cap) {
+            b->dec_ref();
+        } else {
+            b->u.portal_next = NULL;
+            if (tail) {
+                tail->u.portal_next = b;
+            } else {
+                head = b;
+            }
+            tail = b;
+        }
+        b = saved_next;
+    } while (b);
+    if (head) {
+        iobuf::release_tls_block_chain(head);
+    }
 }
 
 IOBuf::Area IOReserveAlignedBuf::reserve(size_t count) {
@@ -1867,7 +2156,8 @@ bool IOBufAsZeroCopyInputStream::Skip(int count) {
         _byte_count += left_bytes;
         cur_ref = _buf->_pref_at(++_ref_index);
     }
-    return false;
+    // Skipping to exactly the end is not a failure.
+    return count == 0;
 }
 
 int64_t IOBufAsZeroCopyInputStream::ByteCount() const {
@@ -1875,13 +2165,30 @@ int64_t IOBufAsZeroCopyInputStream::ByteCount() const {
 }
 
 IOBufAsZeroCopyOutputStream::IOBufAsZeroCopyOutputStream(IOBuf* buf)
-    : _buf(buf), _block_size(0), _cur_block(NULL), _byte_count(0) {
+    : _buf(buf)
+    , _block_size(0)
+    , _size_class(IOBuf::DEFAULT_BLOCK)
+    , _cur_block(NULL)
+    , _byte_count(0) {
+}
+
+IOBufAsZeroCopyOutputStream::IOBufAsZeroCopyOutputStream(
+    IOBuf* buf, IOBuf::BlockSizeClass size_class)
+    : _buf(buf)
+    , _block_size(0)
+    , _size_class(size_class)
+    , _cur_block(NULL)
+    , _byte_count(0) {
+    if ((int)_size_class < 0 || _size_class >= IOBuf::BLOCK_SIZE_CLASS_NUM) {
+        throw std::invalid_argument("invalid size_class");
+    }
 }
 
 IOBufAsZeroCopyOutputStream::IOBufAsZeroCopyOutputStream(
     IOBuf *buf, uint32_t block_size)
     : _buf(buf)
     , _block_size(block_size)
+    , _size_class(IOBuf::DEFAULT_BLOCK)
     , _cur_block(NULL)
     , _byte_count(0) {
     
@@ -1900,7 +2207,7 @@ bool IOBufAsZeroCopyOutputStream::Next(void** data, int* size) {
         if (_block_size > 0) {
             _cur_block = iobuf::create_block(_block_size);
         } else {
-            _cur_block = iobuf::acquire_tls_block();
+            _cur_block = iobuf::acquire_tls_block(_size_class);
         }
         if (_cur_block == NULL) {
             return false;
@@ -2067,6 +2374,12 @@ IOBufAppender::IOBufAppender()
     , _zc_stream(&_buf) {
 }
 
+IOBufAppender::IOBufAppender(size_t expected_size)
+    : _data(NULL)
+    , _data_end(NULL)
+    , _zc_stream(&_buf, IOBuf::block_size_class(expected_size)) {
+}
+
 size_t IOBufBytesIterator::append_and_forward(butil::IOBuf* buf, size_t n) {
     size_t nc = 0;
     while (nc < n && _bytes_left != 0) {
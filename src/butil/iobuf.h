@@ -68,6 +68,30 @@ friend class SingleIOBuf;
 
 public:
     static const size_t DEFAULT_BLOCK_SIZE = 8192;
+    // Blocks are cached in TLS separately for each size class. Small blocks
+    // hold short messages without wasting most of the memory, large and huge
+    // blocks reduce BlockRefs of long messages. Choose the class with
+    // block_size_class() when the size of data is known in advance.
+    static const size_t SMALL_BLOCK_SIZE = 1024;
+    static const size_t LARGE_BLOCK_SIZE = 65536;
+    static const size_t HUGE_BLOCK_SIZE = 262144;
+    enum BlockSizeClass {
+        SMALL_BLOCK = 0,
+        DEFAULT_BLOCK,
+        LARGE_BLOCK,
+        HUGE_BLOCK,
+        BLOCK_SIZE_CLASS_NUM
+    };
+    // Categories of owners of blocks for memory accounting. A block is
+    // accounted to the category set by IOBufOwnerScope on the thread
+    // creating it, until the block is destroyed.
+    enum BlockOwner {
+        OWNER_OTHER = 0,        // Not created in any IOBufOwnerScope
+        OWNER_SOCKET_READ,      // Reading from file descriptors
+        OWNER_PROTOCOL,         // Packing messages by protocols
+        OWNER_USER,             // Tagged by user code, e.g. attachments
+        BLOCK_OWNER_NUM
+    };
     static const size_t INITIAL_CAP = 32; // must be power of 2
 
     struct Block;
@@ -251,6 +275,13 @@ public:
     // deleted using the deleter func when no IOBuf references it anymore.
     int append_user_data(void* data, size_t size, std::function<void(void*)> deleter);
 
+    // Same as above, but the user-data is deleted by calling deleter(data, arg)
+    // and headers of the block are pooled, thus no memory is allocated.
+    // Prefer this version when user-data is appended at a high rate.
+    // `deleter' must not be NULL.
+    int append_user_data(void* data, size_t size,
+                         void (*deleter)(void* data, void* arg), void* arg);
+
     // Append the user-data to back side WITHOUT copying.
     // The meta is associated with this piece of user-data.
     int append_user_data_with_meta(void* data, size_t size, std::function<void(void*)> deleter, uint64_t meta);
@@ -260,6 +291,26 @@ public:
     // 0 means the meta is invalid.
     uint64_t get_first_data_meta();
 
+    // Append `length' bytes of file `fd' starting at `offset' to back side
+    // WITHOUT reading them. The region is mapped read-only so that the bytes
+    // are loaded from page cache only when they're accessed, and `fd' is
+    // duplicated so that writers of sockets (e.g. brpc::Socket) are able to
+    // send the region with sendfile(2) without touching the pages at all.
+    // The file must not be truncated before all references to the region
+    // are gone, otherwise accessing the bytes raises SIGBUS.
+    // Returns 0 on success, -1 otherwise.
+    int append_file_region(int fd, off_t offset, size_t length);
+
+    // If the first byte of this IOBuf is in a region appended by
+    // append_file_region(), get the fd, the offset in the file and number
+    // of contiguous bytes of the region from the first byte, and return
+    // true. Returns false otherwise.
+    bool get_first_file_region(int* fd, off_t* offset, size_t* length) const;
+
+    // Number of bytes before the first file region, length() if this IOBuf
+    // does not reference any file region.
+    size_t bytes_before_file_region() const;
+
     // Resizes the buf to a length of n characters.
     // If n is smaller than the current length, all bytes after n will be
     // truncated.
@@ -352,13 +403,34 @@ public:
     // Get number of Blocks in use. block_memory = block_count * BLOCK_SIZE
     static size_t block_count();
     static size_t block_memory();
+    // Bytes of blocks in size class `c'.
+    static size_t block_memory(BlockSizeClass c);
+    // Size class of blocks to hold `expected_size' bytes.
+    static BlockSizeClass block_size_class(size_t expected_size);
+    // Size of blocks in class `c', including the Block header.
+    static size_t block_size_of_class(BlockSizeClass c);
+    // Capacity in bytes of blocks created by owners in category `owner'.
+    static size_t block_memory_of_owner(BlockOwner owner);
     static size_t new_bigview_count();
     static size_t block_count_hit_tls_threshold();
+    // Number of blocks created by append_file_region() and still in use.
+    static size_t file_region_count();
 
     // Equal with a string/IOBuf or not.
     bool equals(const butil::StringPiece&) const;
     bool equals(const IOBuf& other) const;
 
+    // Find the first occurrence of `c' at or after offset `pos'.
+    // Blocks are scanned with memchr which is vectorized by libc.
+    // Returns offset of the character, -1 if not found.
+    ssize_t find(char c, size_t pos = 0) const;
+
+    // Find the first occurrence of `delim'(could be binary) at or after
+    // offset `pos', including occurrences crossing boundaries of blocks.
+    // Returns offset of the first character, -1 if not found or `delim'
+    // is empty.
+    ssize_t find(const butil::StringPiece& delim, size_t pos = 0) const;
+
     // Get the number of backing blocks
     size_t backing_block_num() const { return _ref_num(); }
 
@@ -372,6 +444,9 @@ protected:
     int _cut_by_char(IOBuf* out, char);
     int _cut_by_delim(IOBuf* out, char const* dbegin, size_t ndelim);
 
+    // True iff data starting from BlockRef #i begins with the `n' bytes.
+    bool _ref_starts_with(size_t i, char const* data, size_t n) const;
+
     // Returns: true iff this should be viewed as SmallView
     bool _small() const;
 
@@ -459,12 +534,18 @@ public:
 
     // Read at most `max_count' bytes from file descriptor `fd' and
     // append to self.
-    ssize_t append_from_file_descriptor(int fd, size_t max_count);
+    // If `block_size' is larger than DEFAULT_BLOCK_SIZE, blocks allocated
+    // for this read are of `block_size' bytes instead of being taken from
+    // TLS, so that large reads need less iovecs. Such blocks are not cached
+    // in TLS after being returned.
+    ssize_t append_from_file_descriptor(int fd, size_t max_count,
+                                        size_t block_size = 0);
  
     // Read at most `max_count' bytes from file descriptor `fd' at a given
     // offset and append to self. The file offset is not changed.
     // If `offset' is negative, does exactly what append_from_file_descriptor does.
-    ssize_t pappend_from_file_descriptor(int fd, off_t offset, size_t max_count);
+    ssize_t pappend_from_file_descriptor(int fd, off_t offset, size_t max_count,
+                                         size_t block_size = 0);
 
     // Read as many bytes as possible from SSL channel `ssl', and stop until `max_count'.
     // Returns total bytes read and the ssl error code will be filled into `ssl_error'
@@ -502,6 +583,25 @@ private:
     bool _reserved;
 };
 
+// Blocks created by the calling thread inside the scope are accounted to
+// `owner', see IOBuf::block_memory_of_owner(). Scopes can be nested.
+// Don't let the scope cover code which may switch bthreads, otherwise other
+// bthreads running on the same worker are accounted to `owner' as well.
+// Example:
+//   {
+//     butil::IOBufOwnerScope owner_scope(butil::IOBuf::OWNER_USER);
+//     cntl->response_attachment().append(data);
+//   }
+class IOBufOwnerScope {
+public:
+    explicit IOBufOwnerScope(IOBuf::BlockOwner owner);
+    ~IOBufOwnerScope();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(IOBufOwnerScope);
+    IOBuf::BlockOwner _saved_owner;
+};
+
 // Specialized utility to cut from IOBuf faster than using corresponding
 // methods in IOBuf.
 // Designed for efficiently parsing data from IOBuf.
@@ -586,11 +686,13 @@ private:
 // thread. If there are many manipulated streams at one time, there may be many
 // fragments. You can create a ZeroCopyOutputStream which has its own block by 
 // passing a positive `block_size' argument to avoid this problem.
+// Passing a BlockSizeClass makes the stream share TLS blocks of the class.
 class IOBufAsZeroCopyOutputStream
     : public google::protobuf::io::ZeroCopyOutputStream {
 public:
     explicit IOBufAsZeroCopyOutputStream(IOBuf*);
     IOBufAsZeroCopyOutputStream(IOBuf*, uint32_t block_size);
+    IOBufAsZeroCopyOutputStream(IOBuf*, IOBuf::BlockSizeClass size_class);
     ~IOBufAsZeroCopyOutputStream();
 
     bool Next(void** data, int* size) override;
@@ -602,6 +704,8 @@ private:
 
     IOBuf* _buf;
     uint32_t _block_size;
+    // Size class of TLS blocks, used when _block_size is 0.
+    IOBuf::BlockSizeClass _size_class;
     IOBuf::Block *_cur_block;
     int64_t _byte_count;
 };
@@ -684,6 +788,9 @@ public:
 class IOBufAppender {
 public:
     IOBufAppender();
+    // Appended data is expected to be about `expected_size' bytes, which
+    // chooses the size class of blocks.
+    explicit IOBufAppender(size_t expected_size);
     
     // Append `n' bytes starting from `data' to back side of the internal buffer
     // Costs 2/3 time of IOBuf.append for short data/strings on Intel(R) Xeon(R)
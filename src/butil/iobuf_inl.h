@@ -38,11 +38,36 @@ struct UserDataExtension {
     UserDataDeleter deleter;
 };
 
+// Put after Block instead of UserDataExtension in pooled user-data blocks.
+struct PooledUserDataExtension {
+    void (*deleter)(void* data, void* arg);
+    void* arg;
+};
+
+// Put after UserDataExtension in blocks of file regions.
+struct FileRegionExtension {
+    int fd;
+    // Offset in the file of the first byte of the block.
+    off_t offset;
+};
+
 bool IsIOBufProfilerSamplable();
 void SubmitIOBufSample(IOBuf::Block* block, int64_t ref);
 
 const uint16_t IOBUF_BLOCK_FLAGS_USER_DATA = 1 << 0;
 const uint16_t IOBUF_BLOCK_FLAGS_SAMPLED = 1 << 1;
+// Size class of the block plus 1, 0 if the block is not in any class.
+const int IOBUF_BLOCK_FLAGS_CLASS_SHIFT = 2;
+const uint16_t IOBUF_BLOCK_FLAGS_CLASS_MASK = 7 << IOBUF_BLOCK_FLAGS_CLASS_SHIFT;
+// IOBuf::BlockOwner of the block.
+const int IOBUF_BLOCK_FLAGS_OWNER_SHIFT = 5;
+const uint16_t IOBUF_BLOCK_FLAGS_OWNER_MASK = 7 << IOBUF_BLOCK_FLAGS_OWNER_SHIFT;
+// The user data is a read-only mapping of a file region, followed by
+// FileRegionExtension.
+const uint16_t IOBUF_BLOCK_FLAGS_FILE_REGION = 1 << 8;
+// The block along with PooledUserDataExtension is allocated from an
+// ObjectPool, set along with IOBUF_BLOCK_FLAGS_USER_DATA.
+const uint16_t IOBUF_BLOCK_FLAGS_POOLED = 1 << 9;
 
 inline ssize_t IOBuf::cut_into_file_descriptor(int fd, size_t size_hint) {
     return pcut_into_file_descriptor(fd, -1, size_hint);
@@ -57,8 +82,9 @@ inline int IOBuf::append_user_data(void* data, size_t size, std::function<void(v
     return append_user_data_with_meta(data, size, std::move(deleter), 0);
 }
 
-inline ssize_t IOPortal::append_from_file_descriptor(int fd, size_t max_count) {
-    return pappend_from_file_descriptor(fd, -1, max_count);
+inline ssize_t IOPortal::append_from_file_descriptor(
+    int fd, size_t max_count, size_t block_size) {
+    return pappend_from_file_descriptor(fd, -1, max_count, block_size);
 }
 
 inline void IOPortal::return_cached_blocks() {
@@ -454,6 +480,18 @@ void dec_g_blockmem();
 void inc_g_num_hit_tls_threshold();
 void dec_g_num_hit_tls_threshold();
 
+void inc_g_class_blockmem(int size_class);
+void dec_g_class_blockmem(int size_class);
+
+// Owner category of blocks created by this thread now.
+IOBuf::BlockOwner current_block_owner();
+void inc_g_owner_blockmem(int owner, size_t cap);
+void dec_g_owner_blockmem(int owner, size_t cap);
+
+// Allocate/return memory of pooled user-data blocks.
+void* get_pooled_user_data_block();
+void return_pooled_user_data_block(void* mem);
+
 // Function pointers to allocate or deallocate memory for a IOBuf::Block
 extern void* (*blockmem_allocate)(size_t);
 extern void  (*blockmem_deallocate)(void*);
@@ -487,6 +525,9 @@ struct IOBuf::Block {
         , data(data_in) {
         iobuf::inc_g_nblock();
         iobuf::inc_g_blockmem();
+        const IOBuf::BlockOwner o = iobuf::current_block_owner();
+        flags |= (o << IOBUF_BLOCK_FLAGS_OWNER_SHIFT);
+        iobuf::inc_g_owner_blockmem(o, cap);
         if (is_samplable()) {
             SubmitIOBufSample(this, 1);
         }
@@ -507,12 +548,41 @@ struct IOBuf::Block {
         }
     }
 
+    Block(char* data_in, uint32_t data_size,
+          void (*deleter)(void*, void*), void* arg)
+        : nshared(1)
+        , flags(IOBUF_BLOCK_FLAGS_USER_DATA | IOBUF_BLOCK_FLAGS_POOLED)
+        , abi_check(0)
+        , size(data_size)
+        , cap(data_size)
+        , u({0})
+        , data(data_in) {
+        PooledUserDataExtension* ext = get_pooled_user_data_extension();
+        ext->deleter = deleter;
+        ext->arg = arg;
+        if (is_samplable()) {
+            SubmitIOBufSample(this, 1);
+        }
+    }
+
+    // Undefined behavior when (flags & IOBUF_BLOCK_FLAGS_POOLED) is 0.
+    PooledUserDataExtension* get_pooled_user_data_extension() {
+        char* p = (char*)this;
+        return (PooledUserDataExtension*)(p + sizeof(Block));
+    }
+
     // Undefined behavior when (flags & IOBUF_BLOCK_FLAGS_USER_DATA) is 0.
     UserDataExtension* get_user_data_extension() {
         char* p = (char*)this;
         return (UserDataExtension*)(p + sizeof(Block));
     }
 
+    // Undefined behavior when (flags & IOBUF_BLOCK_FLAGS_FILE_REGION) is 0.
+    FileRegionExtension* get_file_region_extension() {
+        char* p = (char*)this;
+        return (FileRegionExtension*)(p + sizeof(Block) + sizeof(UserDataExtension));
+    }
+
     inline void check_abi() {
 #ifndef NDEBUG
     if (abi_check != 0) {
@@ -540,8 +610,18 @@ struct IOBuf::Block {
             if (!is_user_data()) {
                 iobuf::dec_g_nblock();
                 iobuf::dec_g_blockmem();
+                const int c = size_class();
+                if (c >= 0) {
+                    iobuf::dec_g_class_blockmem(c);
+                }
+                iobuf::dec_g_owner_blockmem(owner(), cap);
                 this->~Block();
                 iobuf::blockmem_deallocate(this);
+            } else if (flags & IOBUF_BLOCK_FLAGS_POOLED) {
+                PooledUserDataExtension* ext = get_pooled_user_data_extension();
+                ext->deleter(data, ext->arg);
+                this->~Block();
+                iobuf::return_pooled_user_data_block(this);
             } else if (flags & IOBUF_BLOCK_FLAGS_USER_DATA) {
                 auto ext = get_user_data_extension();
                 ext->deleter(data);
@@ -559,6 +639,21 @@ struct IOBuf::Block {
     bool full() const { return size >= cap; }
     size_t left_space() const { return cap - size; }
 
+    // IOBuf::BlockSizeClass of the block, -1 if the block is not in any.
+    int size_class() const {
+        return ((flags & IOBUF_BLOCK_FLAGS_CLASS_MASK)
+                >> IOBUF_BLOCK_FLAGS_CLASS_SHIFT) - 1;
+    }
+    void set_size_class(int c) {
+        flags = (flags & ~IOBUF_BLOCK_FLAGS_CLASS_MASK) |
+            ((c + 1) << IOBUF_BLOCK_FLAGS_CLASS_SHIFT);
+    }
+
+    // IOBuf::BlockOwner accounting the block.
+    int owner() const {
+        return (flags & IOBUF_BLOCK_FLAGS_OWNER_MASK) >> IOBUF_BLOCK_FLAGS_OWNER_SHIFT;
+    }
+
 private:
     bool is_samplable() {
         if (IsIOBufProfilerSamplable()) {
@@ -598,20 +693,41 @@ inline int max_blocks_per_thread() {
     return IsIOBufProfilerEnabled() ? 0 : MAX_BLOCKS_PER_THREAD;
 }
 
+// Keep memory cached in TLS bounded for each size class.
+inline int max_blocks_per_thread(int size_class) {
+    switch (size_class) {
+    case IOBuf::SMALL_BLOCK:
+        return max_blocks_per_thread() * 4;
+    case IOBuf::LARGE_BLOCK:
+        return max_blocks_per_thread() / 2;
+    case IOBuf::HUGE_BLOCK:
+        return max_blocks_per_thread() / 4;
+    default:
+        return max_blocks_per_thread();
+    }
+}
+
 TLSData* get_g_tls_data();
+// TLS blocks of `size_class', same as get_g_tls_data() for the default
+// class and blocks not in any class.
+TLSData* get_tls_data(int size_class);
 void remove_tls_block_chain();
 
 IOBuf::Block* acquire_tls_block();
+// Get and remove one (non-full) block of `size_class' from TLS. If TLS is
+// empty, create one.
+IOBuf::Block* acquire_tls_block(IOBuf::BlockSizeClass size_class);
 
 // Return one block to TLS.
 inline void release_tls_block(IOBuf::Block* b) {
     if (!b) {
         return;
     }
-    TLSData *tls_data = get_g_tls_data();
+    const int c = b->size_class();
+    TLSData *tls_data = get_tls_data(c);
     if (b->full()) {
         b->dec_ref();
-    } else if (tls_data->num_blocks >= max_blocks_per_thread()) {
+    } else if (tls_data->num_blocks >= max_blocks_per_thread(c)) {
         b->dec_ref();
         // g_num_hit_tls_threshold.fetch_add(1, butil::memory_order_relaxed);
         inc_g_num_hit_tls_threshold();
@@ -626,6 +742,22 @@ inline void release_tls_block(IOBuf::Block* b) {
     }
 }
 
+// Size class of blocks of `block_size' bytes, -1 if not in any class.
+inline int block_size_class_of(size_t block_size) {
+    switch (block_size) {
+    case IOBuf::SMALL_BLOCK_SIZE:
+        return IOBuf::SMALL_BLOCK;
+    case IOBuf::DEFAULT_BLOCK_SIZE:
+        return IOBuf::DEFAULT_BLOCK;
+    case IOBuf::LARGE_BLOCK_SIZE:
+        return IOBuf::LARGE_BLOCK;
+    case IOBuf::HUGE_BLOCK_SIZE:
+        return IOBuf::HUGE_BLOCK;
+    default:
+        return -1;
+    }
+}
+
 inline IOBuf::Block* create_block(const size_t block_size) {
     if (block_size > 0xFFFFFFFFULL) {
         LOG(FATAL) << "block_size=" << block_size << " is too large";
@@ -635,8 +767,14 @@ inline IOBuf::Block* create_block(const size_t block_size) {
     if (mem == NULL) {
         return NULL;
     }
-    return new (mem) IOBuf::Block(mem + sizeof(IOBuf::Block),
-                                  block_size - sizeof(IOBuf::Block));
+    IOBuf::Block* b = new (mem) IOBuf::Block(mem + sizeof(IOBuf::Block),
+                                             block_size - sizeof(IOBuf::Block));
+    const int c = block_size_class_of(block_size);
+    if (c >= 0) {
+        b->set_size_class(c);
+        inc_g_class_blockmem(c);
+    }
+    return b;
 }
 
 inline IOBuf::Block* create_block() {
@@ -647,6 +785,30 @@ void* cp(void *__restrict dest, const void *__restrict src, size_t n);
 
 };  // namespace iobuf;
 
+inline IOBuf::BlockSizeClass IOBuf::block_size_class(size_t expected_size) {
+    if (expected_size <= SMALL_BLOCK_SIZE / 2) {
+        return SMALL_BLOCK;
+    } else if (expected_size >= HUGE_BLOCK_SIZE * 4) {
+        return HUGE_BLOCK;
+    } else if (expected_size >= LARGE_BLOCK_SIZE * 4) {
+        return LARGE_BLOCK;
+    }
+    return DEFAULT_BLOCK;
+}
+
+inline size_t IOBuf::block_size_of_class(BlockSizeClass c) {
+    switch (c) {
+    case SMALL_BLOCK:
+        return SMALL_BLOCK_SIZE;
+    case LARGE_BLOCK:
+        return LARGE_BLOCK_SIZE;
+    case HUGE_BLOCK:
+        return HUGE_BLOCK_SIZE;
+    default:
+        return DEFAULT_BLOCK_SIZE;
+    }
+}
+
 }  // namespace butil
 
 #endif  // BUTIL_IOBUF_INL_H
\ No newline at end of file
@@ -48,6 +48,7 @@ typedef HANDLE MutexHandle;
 #endif
 #if defined(OS_POSIX)
 #include <errno.h>
+#include <inttypes.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -165,6 +166,14 @@ DEFINE_int32(max_async_log_queue_size, 100000, "Max async log size. "
              "If current log count of async log > max_async_log_size, "
              "Use sync log to protect process.");
 
+DEFINE_bool(async_log_drop_when_full, false, "Drop logs instead of writing "
+            "them synchronously when the queue of async log is full, so that "
+            "threads never block on the log file. Number of dropped logs is "
+            "written into the log file.");
+
+DEFINE_int32(async_log_batch_size, 65536, "Logs are written into the file "
+             "by async log thread in batches of at most so many bytes");
+
 DEFINE_int32(sleep_to_flush_async_log_s, 0,
              "If the value > 0, sleep before atexit to flush async log");
 
@@ -423,7 +432,7 @@ void CloseLogFileUnlocked() {
     log_file = NULL;
 }
 
-void Log2File(const std::string& log) {
+void Log2File(const butil::StringPiece& log) {
     // We can have multiple threads and/or processes, so try to prevent them
     // from clobbering each other's writes.
     // If the client app did not call InitLogging, and the lock has not
@@ -494,6 +503,8 @@ struct BAIDU_CACHELINE_ALIGNMENT LogRequest {
 
 LogRequest* const LogRequest::UNCONNECTED = (LogRequest*)(intptr_t)-1;
 
+static butil::atomic<int64_t> g_dropped_async_log_count(0);
+
 class AsyncLogger : public butil::SimpleThread {
 public:
     static AsyncLogger* GetInstance();
@@ -528,12 +539,20 @@ friend struct DefaultSingletonTraits<AsyncLogger>;
     void DoLog(LogRequest* req);
     void DoLog(const LogInfo& log_info);
 
+    // Append the log of `req' into _batch and write the batch when it's
+    // large enough.
+    void BatchLog(LogRequest* req);
+    void FlushBatch();
+
     butil::atomic<LogRequest*> _log_head;
     butil::Mutex _mutex;
     butil::ConditionVariable _cond;
     LogRequest* _current_log_request;
     butil::atomic<int32_t> _log_request_count;
     butil::atomic<bool> _stop;
+    // Following fields are only accessed by the thread running LogTask().
+    std::string _batch;
+    int64_t _reported_dropped_count;
 };
 
 AsyncLogger* AsyncLogger::GetInstance() {
@@ -546,7 +565,8 @@ AsyncLogger::AsyncLogger()
     , _log_head(NULL)
     , _cond(&_mutex)
     , _current_log_request(NULL)
-    , _stop(false) {
+    , _stop(false)
+    , _reported_dropped_count(0) {
     Start();
     // We need to stop async logger and
     // flush all async log before exit.
@@ -583,6 +603,12 @@ void AsyncLogger::Log(const LogInfo& log_info) {
     bool is_full = FLAGS_max_async_log_queue_size > 0 &&
         _log_request_count.fetch_add(1, butil::memory_order_relaxed) >
         FLAGS_max_async_log_queue_size;
+    if (is_full && FLAGS_async_log_drop_when_full &&
+        !_stop.load(butil::memory_order_relaxed)) {
+        _log_request_count.fetch_sub(1, butil::memory_order_relaxed);
+        g_dropped_async_log_count.fetch_add(1, butil::memory_order_relaxed);
+        return;
+    }
     if (is_full || _stop.load(butil::memory_order_relaxed)) {
         // Async logger is full or stopped, fallback to sync log.
         DoLog(log_info);
@@ -607,6 +633,12 @@ void AsyncLogger::Log(LogInfo&& log_info) {
     bool is_full = FLAGS_max_async_log_queue_size > 0 &&
         _log_request_count.fetch_add(1, butil::memory_order_relaxed) >
         FLAGS_max_async_log_queue_size;
+    if (is_full && FLAGS_async_log_drop_when_full &&
+        !_stop.load(butil::memory_order_relaxed)) {
+        _log_request_count.fetch_sub(1, butil::memory_order_relaxed);
+        g_dropped_async_log_count.fetch_add(1, butil::memory_order_relaxed);
+        return;
+    }
     if (is_full || _stop.load(butil::memory_order_relaxed)) {
         // Async logger is full or stopped, fallback to sync log.
         DoLog(log_info);
@@ -703,14 +735,15 @@ void AsyncLogger::LogTask(LogRequest* req) {
             LogRequest* const saved_req = req;
             req = req->next;
             if (!saved_req->log_info.content.empty()) {
-                DoLog(saved_req);
+                BatchLog(saved_req);
             }
             // Release LogRequests until last request.
             butil::return_object(saved_req);
         }
         if (!req->log_info.content.empty()) {
-            DoLog(req);
+            BatchLog(req);
         }
+        FlushBatch();
 
         // Return when there's no more LogRequests.
         if (IsLogComplete(req)) {
@@ -773,6 +806,40 @@ void AsyncLogger::DoLog(const LogInfo& log_info) {
     _log_request_count.fetch_sub(1, butil::memory_order_relaxed);
 }
 
+void AsyncLogger::BatchLog(LogRequest* req) {
+    LogInfo& log_info = req->log_info;
+    if (log_info.raw) {
+        _batch.append(LogInfo2LogStr(log_info));
+    } else {
+        _batch.append(log_info.content);
+    }
+    log_info.clear();
+    _log_request_count.fetch_sub(1, butil::memory_order_relaxed);
+    if (_batch.size() >= (size_t)FLAGS_async_log_batch_size) {
+        FlushBatch();
+    }
+}
+
+void AsyncLogger::FlushBatch() {
+    const int64_t dropped =
+        g_dropped_async_log_count.load(butil::memory_order_relaxed);
+    if (dropped != _reported_dropped_count) {
+        const std::string notice = butil::string_printf(
+            "Dropped %" PRId64 " logs because the queue of async log "
+            "was full\n", dropped - _reported_dropped_count);
+        _reported_dropped_count = dropped;
+        _batch.append(notice);
+    }
+    if (!_batch.empty()) {
+        Log2File(_batch);
+        _batch.clear();
+    }
+}
+
+int64_t GetDroppedAsyncLogCount() {
+    return g_dropped_async_log_count.load(butil::memory_order_relaxed);
+}
+
 LoggingSettings::LoggingSettings()
     : logging_dest(LOG_DEFAULT),
       log_file(NULL),
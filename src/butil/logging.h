@@ -317,6 +317,10 @@ BUTIL_EXPORT void SetShowErrorDialogs(bool enable_dialogs);
 typedef void (*LogAssertHandler)(const std::string& str);
 BUTIL_EXPORT void SetLogAssertHandler(LogAssertHandler handler);
 
+// Number of logs dropped because the queue of async log was full, which
+// happens only when -async_log_drop_when_full is on.
+BUTIL_EXPORT int64_t GetDroppedAsyncLogCount();
+
 class LogSink {
 public:
     LogSink() {}
@@ -0,0 +1,269 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Parse decimal numbers in [begin, end) which is not necessarily ended with
+// '\0', much faster than strtol/strtod which are locale-aware and have to
+// find the end of input first. Integers are parsed 8 digits at a time.
+// Decimal floats with at most 19 significant digits and small exponents
+// are converted with one exact multiplication or division (Clinger's fast
+// path, as in fast_float) which is correctly rounded, other forms (hex,
+// inf, nan, long mantissas...) fall back to strtod.
+
+#ifndef BUTIL_NUMBER_PARSING_H
+#define BUTIL_NUMBER_PARSING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+namespace butil {
+
+namespace detail {
+
+inline bool is_digit(char c) {
+    return (unsigned char)(c - '0') < 10;
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+inline uint64_t load_eight_chars(const char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline bool is_eight_digits(uint64_t v) {
+    return ((v & 0xF0F0F0F0F0F0F0F0ULL) |
+            (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+        0x3333333333333333ULL;
+}
+
+// Combine 8 digits pairwise in 3 multiplications.
+inline uint32_t parse_eight_digits(uint64_t v) {
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 100 + (1000000ULL << 32);
+    const uint64_t mul2 = 1 + (10000ULL << 32);
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    return (uint32_t)(((v & mask) * mul1 + ((v >> 16) & mask) * mul2) >> 32);
+}
+#endif
+
+// Accumulate digits from `*p' into `*v' until a non-digit or `end'.
+// Returns number of digits. `*v' overflows silently after 19 digits.
+inline size_t parse_digits(const char** p, const char* end, uint64_t* v) {
+    const char* s = *p;
+    uint64_t x = *v;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (end - s >= 8) {
+        const uint64_t chunk = load_eight_chars(s);
+        if (!is_eight_digits(chunk)) {
+            break;
+        }
+        x = x * 100000000 + parse_eight_digits(chunk);
+        s += 8;
+    }
+#endif
+    for (; s != end && is_digit(*s); ++s) {
+        x = x * 10 + (*s - '0');
+    }
+    const size_t n = s - *p;
+    *p = s;
+    *v = x;
+    return n;
+}
+
+// Parse the magnitude of an integer. Returns false on non-digits or
+// overflow.
+inline bool parse_magnitude(const char* p, const char* end, uint64_t* out) {
+    if (p == end) {
+        return false;
+    }
+    const char* digits = p;
+    uint64_t v = 0;
+    const size_t n = parse_digits(&p, end, &v);
+    if (p != end) {
+        return false;
+    }
+    if (n > 19) {
+        // Not fit in 19 digits, redo with overflow checks.
+        for (; digits != end && *digits == '0'; ++digits) {}
+        v = 0;
+        for (; digits != end; ++digits) {
+            const uint64_t d = *digits - '0';
+            if (v > (UINT64_MAX - d) / 10) {
+                return false;
+            }
+            v = v * 10 + d;
+        }
+    }
+    *out = v;
+    return true;
+}
+
+template <typename T>
+inline bool strto_fallback(const char* begin, const char* end, T* out,
+                           T (*fn)(const char*, char**)) {
+    // strtod needs a '\0'-ended string.
+    char buf[64];
+    std::string long_str;
+    const size_t len = end - begin;
+    const char* s = buf;
+    if (len < sizeof(buf)) {
+        memcpy(buf, begin, len);
+        buf[len] = '\0';
+    } else {
+        long_str.assign(begin, len);
+        s = long_str.c_str();
+    }
+    char* endptr = NULL;
+    *out = fn(s, &endptr);
+    return len != 0 && endptr == s + len;
+}
+
+// Parse a decimal float without exponent overflow. Returns false if it's
+// not in the form of [+-]digits[.digits][(e|E)[+-]digits] with at most 19
+// significant digits.
+inline bool parse_decimal(const char* p, const char* end, bool* negative,
+                          uint64_t* mantissa, int64_t* exp10) {
+    *negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+        *negative = (*p == '-');
+        ++p;
+    }
+    const char* start = p;
+    for (; p != end && *p == '0'; ++p) {}
+    uint64_t m = 0;
+    size_t ndigits = parse_digits(&p, end, &m);
+    int64_t e = 0;
+    bool has_digits = (p != start);
+    if (p != end && *p == '.') {
+        ++p;
+        const char* frac = p;
+        if (m == 0) {
+            // Leading zeros of the fraction are not significant.
+            for (; p != end && *p == '0'; ++p) {}
+        }
+        ndigits += parse_digits(&p, end, &m);
+        e -= p - frac;
+        has_digits = has_digits || (p != frac);
+    }
+    if (!has_digits || ndigits > 19) {
+        return false;
+    }
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool neg_exp = false;
+        if (p != end && (*p == '-' || *p == '+')) {
+            neg_exp = (*p == '-');
+            ++p;
+        }
+        uint64_t x = 0;
+        if (p == end || parse_digits(&p, end, &x) > 4) {
+            return false;
+        }
+        e += neg_exp ? -(int64_t)x : (int64_t)x;
+    }
+    if (p != end) {
+        return false;
+    }
+    *mantissa = m;
+    *exp10 = e;
+    return true;
+}
+
+}  // namespace detail
+
+// Parse [+]digits. Returns true on success, false on other characters or
+// overflow.
+inline bool ParseUint64(const char* begin, const char* end, uint64_t* out) {
+    if (begin != end && *begin == '+') {
+        ++begin;
+    }
+    return detail::parse_magnitude(begin, end, out);
+}
+
+// Parse [+-]digits. Returns true on success, false on other characters or
+// overflow.
+inline bool ParseInt64(const char* begin, const char* end, int64_t* out) {
+    bool negative = false;
+    if (begin != end && (*begin == '-' || *begin == '+')) {
+        negative = (*begin == '-');
+        ++begin;
+    }
+    uint64_t v = 0;
+    if (!detail::parse_magnitude(begin, end, &v)) {
+        return false;
+    }
+    if (negative) {
+        if (v > (uint64_t)INT64_MAX + 1) {
+            return false;
+        }
+        *out = (int64_t)(0 - v);
+    } else {
+        if (v > (uint64_t)INT64_MAX) {
+            return false;
+        }
+        *out = (int64_t)v;
+    }
+    return true;
+}
+
+// Parse a float number in any form accepted by strtod. Returns true if all
+// characters in [begin, end) are consumed.
+inline bool ParseDouble(const char* begin, const char* end, double* out) {
+    static const double kPow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    bool negative;
+    uint64_t m;
+    int64_t e;
+    if (detail::parse_decimal(begin, end, &negative, &m, &e) &&
+        m <= (1ULL << 53) && e >= -22 && e <= 22) {
+        // Both the mantissa and the power are exact in double, so is the
+        // rounded result of one multiplication or division.
+        double d = (double)m;
+        d = (e >= 0 ? d * kPow10[e] : d / kPow10[-e]);
+        *out = (negative ? -d : d);
+        return true;
+    }
+    return detail::strto_fallback(begin, end, out, strtod);
+}
+
+// Parse a float number in any form accepted by strtof. Returns true if all
+// characters in [begin, end) are consumed.
+inline bool ParseFloat(const char* begin, const char* end, float* out) {
+    static const float kPow10[] = {
+        1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+    };
+    bool negative;
+    uint64_t m;
+    int64_t e;
+    if (detail::parse_decimal(begin, end, &negative, &m, &e) &&
+        m <= (1ULL << 24) && e >= -10 && e <= 10) {
+        float f = (float)m;
+        f = (e >= 0 ? f * kPow10[e] : f / kPow10[-e]);
+        *out = (negative ? -f : f);
+        return true;
+    }
+    return detail::strto_fallback(begin, end, out, strtof);
+}
+
+}  // namespace butil
+
+#endif  // BUTIL_NUMBER_PARSING_H
@@ -102,6 +102,13 @@ template <typename T> inline void clear_objects() {
     ObjectPool<T>::singleton()->clear_objects();
 }
 
+// Free memory of objects which are idle in the global free list since last
+// call, see ObjectPool::shrink() for details.
+// Returns number of freed blocks.
+template <typename T> inline size_t shrink_objects() {
+    return ObjectPool<T>::singleton()->shrink();
+}
+
 // Get description of objects typed T.
 // This function is possibly slow because it iterates internal structures.
 // Don't use it frequently like a "getter" function.
@@ -202,7 +202,10 @@ public:
             }                                                           \
             /* It's poisoned prior to use. */                           \
             OBJECT_POOL_ASAN_POISON_MEMORY_REGION(obj);                 \
-            ++_cur_block->nitem;                                        \
+            if (++_cur_block->nitem == BLOCK_NITEM) {                   \
+                /* Full blocks may be freed by shrink(). */             \
+                _cur_block = NULL;                                      \
+            }                                                           \
             return obj;                                                 \
         }                                                               \
         /* Fetch a Block from global */                                 \
@@ -216,7 +219,10 @@ public:
             }                                                           \
             /* It's poisoned prior to use. */                           \
             OBJECT_POOL_ASAN_POISON_MEMORY_REGION(obj);                 \
-            ++_cur_block->nitem;                                        \
+            if (++_cur_block->nitem == BLOCK_NITEM) {                   \
+                /* Full blocks may be freed by shrink(). */             \
+                _cur_block = NULL;                                      \
+            }                                                           \
             return obj;                                                 \
         }                                                               \
         return NULL;                                                    \
@@ -306,6 +312,95 @@ public:
         return (n < FREE_CHUNK_NITEM ? n : FREE_CHUNK_NITEM);
     }
 
+    // Free blocks whose objects were all in the global free list in this
+    // call and the previous call, namely idle for a whole period between
+    // the two calls. Objects cached by threads are not counted.
+    // NOTE: Don't shrink pools whose objects may be accessed after being
+    // returned, e.g. bthread::Butex.
+    // Returns number of freed blocks.
+    size_t shrink() {
+        BAIDU_SCOPED_LOCK(_block_group_mutex);
+        std::vector<DynamicFreeChunk*> chunks;
+        {
+            BAIDU_SCOPED_LOCK(_free_chunks_mutex);
+            chunks.swap(_free_chunks);
+        }
+        // Blocks which are full and can't be allocated from, sorted by
+        // address to locate free objects.
+        std::vector<Block*> blocks;
+        for_each_block([&blocks](butil::atomic<Block*>& slot) {
+            Block* b = slot.load(butil::memory_order_relaxed);
+            if (b->nitem == BLOCK_NITEM) {
+                blocks.push_back(b);
+            }
+        });
+        std::sort(blocks.begin(), blocks.end());
+        std::vector<size_t> nfree(blocks.size(), 0);
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            for (size_t j = 0; j < chunks[i]->nfree; ++j) {
+                const size_t k = find_block(blocks, chunks[i]->ptrs[j]);
+                if (k < blocks.size()) {
+                    ++nfree[k];
+                }
+            }
+        }
+        std::vector<Block*> idle;
+        std::vector<Block*> freeing;
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            if (nfree[i] != BLOCK_NITEM) {
+                continue;
+            }
+            if (std::binary_search(_idle_blocks.begin(), _idle_blocks.end(),
+                                   blocks[i])) {
+                freeing.push_back(blocks[i]);
+            } else {
+                idle.push_back(blocks[i]);
+            }
+        }
+        _idle_blocks.swap(idle);
+        if (!freeing.empty()) {
+            // Remove objects of freed blocks from the free list.
+            size_t nchunk = 0;
+            for (size_t i = 0; i < chunks.size(); ++i) {
+                DynamicFreeChunk* c = chunks[i];
+                size_t n = 0;
+                for (size_t j = 0; j < c->nfree; ++j) {
+                    if (find_block(freeing, c->ptrs[j]) == freeing.size()) {
+                        c->ptrs[n++] = c->ptrs[j];
+                    }
+                }
+                c->nfree = n;
+                if (n == 0) {
+                    free(c);
+                } else {
+                    chunks[nchunk++] = c;
+                }
+            }
+            chunks.resize(nchunk);
+            for_each_block([&freeing](butil::atomic<Block*>& slot) {
+                Block* b = slot.load(butil::memory_order_relaxed);
+                if (std::binary_search(freeing.begin(), freeing.end(), b)) {
+                    slot.store(NULL, butil::memory_order_relaxed);
+                }
+            });
+            for (size_t i = 0; i < freeing.size(); ++i) {
+                T* const objs = (T*)freeing[i]->items;
+                for (size_t k = 0; k < BLOCK_NITEM; ++k) {
+                    OBJECT_POOL_ASAN_UNPOISON_MEMORY_REGION(objs + k);
+                    objs[k].~T();
+                }
+                delete freeing[i];
+            }
+#ifdef BUTIL_OBJECT_POOL_NEED_FREE_ITEM_NUM
+            _global_nfree.fetch_sub(freeing.size() * BLOCK_NITEM,
+                                    butil::memory_order_relaxed);
+#endif
+        }
+        BAIDU_SCOPED_LOCK(_free_chunks_mutex);
+        _free_chunks.insert(_free_chunks.end(), chunks.begin(), chunks.end());
+        return freeing.size();
+    }
+
     // Number of all allocated objects, including being used and free.
     ObjectPoolInfo describe_objects() const {
         ObjectPoolInfo info;
@@ -319,21 +414,12 @@ public:
         info.free_item_num = _global_nfree.load(butil::memory_order_relaxed);
 #endif
 
-        for (size_t i = 0; i < info.block_group_num; ++i) {
-            BlockGroup* bg = _block_groups[i].load(butil::memory_order_consume);
-            if (NULL == bg) {
-                break;
-            }
-            size_t nblock = std::min(bg->nblock.load(butil::memory_order_relaxed),
-                                     OP_GROUP_NBLOCK);
-            info.block_num += nblock;
-            for (size_t j = 0; j < nblock; ++j) {
-                Block* b = bg->blocks[j].load(butil::memory_order_consume);
-                if (NULL != b) {
-                    info.item_num += b->nitem;
-                }
-            }
-        }
+        // Blocks may be freed by shrink() concurrently.
+        BAIDU_SCOPED_LOCK(_block_group_mutex);
+        for_each_block([&info](butil::atomic<Block*>& slot) {
+            ++info.block_num;
+            info.item_num += slot.load(butil::memory_order_relaxed)->nitem;
+        });
         info.total_size = info.block_num * info.block_item_num * sizeof(T);
         return info;
     }
@@ -363,6 +449,40 @@ private:
         pthread_mutex_destroy(&_free_chunks_mutex);
     }
 
+    // Call fn(butil::atomic<Block*>&) with slots of all allocated blocks.
+    template <typename Fn>
+    static void for_each_block(const Fn& fn) {
+        const size_t ngroup = _ngroup.load(butil::memory_order_acquire);
+        for (size_t i = 0; i < ngroup; ++i) {
+            BlockGroup* bg = _block_groups[i].load(butil::memory_order_consume);
+            if (NULL == bg) {
+                break;
+            }
+            const size_t nblock = std::min(
+                bg->nblock.load(butil::memory_order_relaxed), OP_GROUP_NBLOCK);
+            for (size_t j = 0; j < nblock; ++j) {
+                if (bg->blocks[j].load(butil::memory_order_consume) != NULL) {
+                    fn(bg->blocks[j]);
+                }
+            }
+        }
+    }
+
+    // Index of the block containing `ptr' in `blocks' sorted by address,
+    // blocks.size() if not found.
+    static size_t find_block(const std::vector<Block*>& blocks, T* ptr) {
+        typename std::vector<Block*>::const_iterator it = std::upper_bound(
+            blocks.begin(), blocks.end(), (Block*)ptr);
+        if (it == blocks.begin()) {
+            return blocks.size();
+        }
+        --it;
+        if ((char*)ptr >= (char*)((*it)->items + BLOCK_NITEM)) {
+            return blocks.size();
+        }
+        return it - blocks.begin();
+    }
+
     // Create a Block and append it to right-most BlockGroup.
     static Block* add_block(size_t* index) {
         Block* const new_block = new(std::nothrow) Block;
@@ -533,6 +653,10 @@ private:
     std::vector<DynamicFreeChunk*> _free_chunks;
     pthread_mutex_t _free_chunks_mutex;
 
+    // Blocks found idle by last shrink(), sorted by address.
+    // Protected by _block_group_mutex.
+    std::vector<Block*> _idle_blocks;
+
 #ifdef BUTIL_OBJECT_POOL_NEED_FREE_ITEM_NUM
     static butil::static_atomic<size_t> _global_nfree;
 #endif
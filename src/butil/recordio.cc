@@ -15,10 +15,14 @@
 // specific language governing permissions and limitations
 // under the License.
 
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
 #include <gflags/gflags.h>
 #include "butil/logging.h"
 #include "butil/recordio.h"
 #include "butil/sys_byteorder.h"
+#include "butil/files/memory_mapped_file.h"
 
 namespace butil {
 
@@ -150,30 +154,116 @@ size_t Record::ByteSize() const {
     return n;
 }
 
+// True if a record with valid header starts at `pos' of `data' and is
+// followed by another magic or the end.
+static bool IsRecordBoundary(const uint8_t* data, size_t len, size_t pos) {
+    if (pos + 9 > len || memcmp(data + pos, BRPC_RECORDIO_MAGIC, 4) != 0) {
+        return false;
+    }
+    uint32_t tmp;
+    memcpy(&tmp, data + pos + 4, sizeof(tmp));
+    tmp = NetToHost32(tmp);
+    const size_t data_size = (tmp & 0x7FFFFFFF);
+    if (SizeChecksum(tmp) != data[pos + 8] ||
+        data_size > (size_t)FLAGS_recordio_max_record_size) {
+        return false;
+    }
+    const size_t next = pos + 9 + data_size;
+    return next == len ||
+        (next + 4 <= len &&
+         memcmp(data + next, BRPC_RECORDIO_MAGIC, 4) == 0);
+}
+
+// Returns offset of the first record boundary at or after `pos', `len' if
+// there's none.
+static size_t FindRecordBoundary(const uint8_t* data, size_t len, size_t pos) {
+    while (pos < len) {
+        const void* p = memmem(data + pos, len - pos, BRPC_RECORDIO_MAGIC, 4);
+        if (p == NULL) {
+            break;
+        }
+        pos = (const uint8_t*)p - data;
+        if (IsRecordBoundary(data, len, pos)) {
+            return pos;
+        }
+        ++pos;
+    }
+    return len;
+}
+
 RecordReader::RecordReader(IReader* reader)
     : _reader(reader)
     , _cutter(&_portal)
     , _ncut(0)
-    , _last_error(0) {
+    , _last_error(0)
+    , _mapped_pos(0)
+    , _end((size_t)-1) {
+}
+
+RecordReader::RecordReader(const std::shared_ptr<const MemoryMappedFile>& file,
+                           size_t begin, size_t end)
+    : _reader(NULL)
+    , _cutter(&_portal)
+    , _ncut(0)
+    , _last_error(0)
+    , _file(file)
+    , _mapped_pos(0)
+    , _end(std::min(end, file->length())) {
+    if (begin > 0) {
+        begin = FindRecordBoundary(file->data(), file->length(), begin);
+    }
+    _ncut = _mapped_pos = begin;
+}
+
+ssize_t RecordReader::ReadMore() {
+    if (_file == NULL) {
+        const size_t MAX_READ = 1024 * 1024;
+        return _portal.append_from_reader(_reader, MAX_READ);
+    }
+    const size_t MAX_MAPPED_READ = 16 * 1024 * 1024;
+    const size_t n = std::min(MAX_MAPPED_READ, _file->length() - _mapped_pos);
+    if (n == 0) {
+        return 0;
+    }
+    // Blocks referencing the mapped pages keep the mapping alive.
+    std::shared_ptr<const MemoryMappedFile> file = _file;
+    if (_portal.append_user_data((void*)(_file->data() + _mapped_pos), n,
+                                 [file](void*) {}) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    _mapped_pos += n;
+    // Read ahead pages of the next slice while this one is being parsed.
+    static const size_t page_size = getpagesize();
+    const size_t ra_begin = _mapped_pos / page_size * page_size;
+    const size_t ra_size =
+        std::min(MAX_MAPPED_READ, _file->length() - ra_begin);
+    if (ra_size > 0) {
+        madvise((void*)(_file->data() + ra_begin), ra_size, MADV_WILLNEED);
+    }
+    return n;
 }
 
 bool RecordReader::ReadNext(Record* out) {
-    const size_t MAX_READ = 1024 * 1024;
     do {
+        if (_ncut >= _end) {
+            _last_error = END_OF_READER;
+            return false;
+        }
         const int rc = CutRecord(out);
         if (rc > 0) {
             _last_error = 0;
             return true;
         } else if (rc < 0) {
             while (!CutUntilNextRecordCandidate()) {
-                const ssize_t nr = _portal.append_from_reader(_reader, MAX_READ);
+                const ssize_t nr = ReadMore();
                 if (nr <= 0) {
                     _last_error = (nr < 0 ? errno : END_OF_READER);
                     return false;
                 }
             }
         } else { // rc == 0, not enough data to parse
-            const ssize_t nr = _portal.append_from_reader(_reader, MAX_READ);
+            const ssize_t nr = ReadMore();
             if (nr <= 0) {
                 _last_error = (nr < 0 ? errno : END_OF_READER);
                 return false;
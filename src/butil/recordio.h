@@ -22,6 +22,8 @@
 
 namespace butil {
 
+class MemoryMappedFile;
+
 // 0-or-1 Payload + 0-or-multiple Metas.
 // Payload and metas are often serialized form of protobuf messages. As a
 // correspondence, the implementation is not optimized for very small blobs,
@@ -86,6 +88,16 @@ private:
 //    if (rd.last_error() != RecordReader::END_OF_READER) {
 //        LOG(FATAL) << "Critical error occurred";
 //    }
+//
+// A file can also be read through a memory mapping, in which case payloads
+// and metas of records reference the mapped pages instead of copying them,
+// and the file may be split into ranges scanned by different threads:
+//    std::shared_ptr<MemoryMappedFile> file(new MemoryMappedFile);
+//    CHECK(file->Initialize(FilePath(path)));
+//    const size_t step = file->length() / nthread + 1;
+//    // In i-th thread:
+//    RecordReader rd(file, i * step, (i + 1) * step);
+//    while (rd.ReadNext(&rec)) { ... }
 class RecordReader {
 public:
     // A special error code to mark end of input data.
@@ -93,6 +105,14 @@ public:
 
     explicit RecordReader(IReader* reader);
 
+    // Read records starting in [begin, end) of the mapped `file'. If `begin'
+    // is not 0, the reader skips to the first record boundary after it,
+    // which is a record with valid header followed by another record or end
+    // of the file. Readers with adjacent ranges read every record once.
+    // Records may hold references to `file' after the reader is destroyed.
+    RecordReader(const std::shared_ptr<const MemoryMappedFile>& file,
+                 size_t begin = 0, size_t end = (size_t)-1);
+
     // Returns true on success and |out| is overwritten by the record.
     // False otherwise and last_error() is the error which is treated as permanent.
     bool ReadNext(Record* out);
@@ -104,11 +124,13 @@ public:
     // Total bytes consumed.
     // NOTE: this value may not equal to read bytes from the IReader even if
     // the reader runs out, due to parsing errors.
+    // Reading a mapped file, this is the offset in the file.
     size_t offset() const { return _ncut; }
 
 private:
     bool CutUntilNextRecordCandidate();
     int CutRecord(Record* rec);
+    ssize_t ReadMore();
 
 private:
     IReader* _reader;
@@ -116,6 +138,11 @@ private:
     IOBufCutter _cutter;
     size_t _ncut;
     int _last_error;
+    std::shared_ptr<const MemoryMappedFile> _file;
+    // Offset of the file appended into _portal.
+    size_t _mapped_pos;
+    // Stop reading at records starting at or after this offset.
+    size_t _end;
 };
 
 // Write records into the IWriter.
@@ -26,6 +26,9 @@
 
 // Efficiently allocate fixed-size (small) objects addressable by identifiers
 // in multi-threaded environment.
+// Memory of resources is never freed, since identifiers of returned
+// resources may still be addressed(and versions inside them checked). Use
+// ObjectPool with shrink_objects() if memory needs to be given back.
 //
 // Comparison with new/delete(glibc 2.3.4) under high contention:
 //   -----------------------------
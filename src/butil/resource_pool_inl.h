@@ -24,6 +24,8 @@
 
 #include <iostream>                      // std::ostream
 #include <pthread.h>                     // pthread_mutex_t
+#include <stdlib.h>                      // posix_memalign
+#include <new>                           // std::nothrow_t
 #include <algorithm>                     // std::max, std::min
 #include "butil/atomicops.h"             // butil::atomic
 #include "butil/macros.h"                // BAIDU_CACHELINE_ALIGNMENT
@@ -87,7 +89,9 @@ struct ResourcePoolInfo {
 static const size_t RP_MAX_BLOCK_NGROUP = 65536;
 static const size_t RP_GROUP_NBLOCK_NBIT = 16;
 static const size_t RP_GROUP_NBLOCK = (1UL << RP_GROUP_NBLOCK_NBIT);
-static const size_t RP_INITIAL_FREE_LIST_SIZE = 1024;
+static const size_t RP_CHUNK_NODE_SLAB_NBIT = 6;
+static const size_t RP_CHUNK_NODE_SLAB_SIZE = (1UL << RP_CHUNK_NODE_SLAB_NBIT);
+static const size_t RP_MAX_CHUNK_NODE_SLAB = 65536;
 
 template <typename T>
 class ResourcePoolBlockItemNum {
@@ -108,7 +112,18 @@ public:
     // Free identifiers are batched in a FreeChunk before they're added to
     // global list(_free_chunks).
     typedef ResourcePoolFreeChunk<T, FREE_CHUNK_NITEM>      FreeChunk;
-    typedef ResourcePoolFreeChunk<T, 0> DynamicFreeChunk;
+
+    // FreeChunks in global lists are stored in ChunkNodes which are
+    // addressed by 32-bit indexes and never deallocated, so that a thread
+    // racing on popping a node always reads valid memory.
+    struct ChunkNode {
+        // 1 + index of next node in the list, 0 for end of the list.
+        butil::atomic<uint32_t> next;
+        FreeChunk chunk;
+    };
+    struct ChunkNodeSlab {
+        ChunkNode nodes[RP_CHUNK_NODE_SLAB_SIZE];
+    };
 
     typedef AlignedMemory<sizeof(T), __alignof__(T)> BlockItem;
     // When a thread needs memory, it allocates a Block. To improve locality,
@@ -119,6 +134,17 @@ public:
         size_t nitem;
 
         Block() : nitem(0) {}
+
+        // new before C++17 does not respect alignments larger than
+        // alignof(max_align_t), allocate aligned memory explicitly.
+        static void* operator new(size_t size, const std::nothrow_t&) throw() {
+            void* p = NULL;
+            if (posix_memalign(&p, __alignof__(Block), size) != 0) {
+                return NULL;
+            }
+            return p;
+        }
+        static void operator delete(void* p) { free(p); }
     };
 
     // A Resource addresses at most RP_MAX_BLOCK_NGROUP BlockGroups,
@@ -378,14 +404,9 @@ public:
     }
 
 private:
-    ResourcePool() {
-        _free_chunks.reserve(RP_INITIAL_FREE_LIST_SIZE);
-        pthread_mutex_init(&_free_chunks_mutex, NULL);
-    }
+    ResourcePool() : _free_chunks(0), _free_nodes(0) {}
 
-    ~ResourcePool() {
-        pthread_mutex_destroy(&_free_chunks_mutex);
-    }
+    ~ResourcePool() {}
 
     // Create a Block and append it to right-most BlockGroup.
     static Block* add_block(size_t* index) {
@@ -481,6 +502,15 @@ private:
         // Clear global free list.
         FreeChunk dummy;
         while (pop_free_chunk(dummy));
+        _free_nodes.store(0, butil::memory_order_relaxed);
+        const size_t nnode = std::min(
+            (size_t)_nchunk_node.exchange(0, butil::memory_order_relaxed),
+            RP_MAX_CHUNK_NODE_SLAB * RP_CHUNK_NODE_SLAB_SIZE);
+        for (size_t i = 0; i < nnode; i += RP_CHUNK_NODE_SLAB_SIZE) {
+            const size_t slab_index = (i >> RP_CHUNK_NODE_SLAB_NBIT);
+            delete _chunk_node_slabs[slab_index].exchange(
+                NULL, butil::memory_order_relaxed);
+        }
 
         // Delete all memory
         const size_t ngroup = _ngroup.exchange(0, butil::memory_order_relaxed);
@@ -510,37 +540,97 @@ private:
     }
 
 private:
+    // Global lists of ChunkNodes are lock-free stacks (Treiber stacks).
+    // The head is a 64-bit word combining a 32-bit version and 1 + index of
+    // the top node. The version is increased by each successful pop so that
+    // a stale head whose node was popped and pushed again (the ABA problem)
+    // fails the CAS.
+    static uint32_t head_index(uint64_t head) { return (uint32_t)head; }
+    static uint64_t make_head(uint64_t old_head, uint32_t index, bool pop) {
+        return ((old_head >> 32) + pop) << 32 | index;
+    }
+
+    static ChunkNode* address_chunk_node(uint32_t index) {
+        ChunkNodeSlab* slab = _chunk_node_slabs[index >> RP_CHUNK_NODE_SLAB_NBIT]
+            .load(butil::memory_order_consume);
+        return &slab->nodes[index & (RP_CHUNK_NODE_SLAB_SIZE - 1)];
+    }
+
+    // Returns 1 + index of the popped node, 0 if the stack is empty.
+    static uint32_t pop_node(butil::atomic<uint64_t>& stack) {
+        uint64_t head = stack.load(butil::memory_order_acquire);
+        while (head_index(head)) {
+            ChunkNode* node = address_chunk_node(head_index(head) - 1);
+            const uint32_t next = node->next.load(butil::memory_order_relaxed);
+            if (stack.compare_exchange_weak(head, make_head(head, next, true),
+                                            butil::memory_order_acquire,
+                                            butil::memory_order_acquire)) {
+                return head_index(head);
+            }
+        }
+        return 0;
+    }
+
+    static void push_node(butil::atomic<uint64_t>& stack, uint32_t index1) {
+        ChunkNode* node = address_chunk_node(index1 - 1);
+        uint64_t head = stack.load(butil::memory_order_relaxed);
+        do {
+            node->next.store(head_index(head), butil::memory_order_relaxed);
+        } while (!stack.compare_exchange_weak(head, make_head(head, index1, false),
+                                              butil::memory_order_release,
+                                              butil::memory_order_relaxed));
+    }
+
+    // Returns 1 + index of a new ChunkNode, 0 on failure.
+    static uint32_t new_chunk_node() {
+        const size_t index = _nchunk_node.fetch_add(1, butil::memory_order_relaxed);
+        const size_t slab_index = (index >> RP_CHUNK_NODE_SLAB_NBIT);
+        if (slab_index >= RP_MAX_CHUNK_NODE_SLAB) {
+            _nchunk_node.fetch_sub(1, butil::memory_order_relaxed);
+            return 0;
+        }
+        if (_chunk_node_slabs[slab_index].load(butil::memory_order_acquire) == NULL) {
+            // Called once per RP_CHUNK_NODE_SLAB_SIZE nodes, share the mutex
+            // with add_block_group() which is as infrequent.
+            BAIDU_SCOPED_LOCK(_block_group_mutex);
+            if (_chunk_node_slabs[slab_index].load(butil::memory_order_relaxed) == NULL) {
+                ChunkNodeSlab* slab = new (std::nothrow) ChunkNodeSlab;
+                if (NULL == slab) {
+                    // This index is dropped, later ones may retry allocating.
+                    return 0;
+                }
+                _chunk_node_slabs[slab_index].store(slab, butil::memory_order_release);
+            }
+        }
+        return index + 1;
+    }
+
     bool pop_free_chunk(FreeChunk& c) {
         // Critical for the case that most return_object are called in
         // different threads of get_object.
-        if (_free_chunks.empty()) {
-            return false;
-        }
-        pthread_mutex_lock(&_free_chunks_mutex);
-        if (_free_chunks.empty()) {
-            pthread_mutex_unlock(&_free_chunks_mutex);
+        const uint32_t index1 = pop_node(_free_chunks);
+        if (!index1) {
             return false;
         }
-        DynamicFreeChunk* p = _free_chunks.back();
-        _free_chunks.pop_back();
-        pthread_mutex_unlock(&_free_chunks_mutex);
-        c.nfree = p->nfree;
-        memcpy(c.ids, p->ids, sizeof(*p->ids) * p->nfree);
-        free(p);
+        const FreeChunk& src = address_chunk_node(index1 - 1)->chunk;
+        c.nfree = src.nfree;
+        memcpy(c.ids, src.ids, sizeof(*src.ids) * src.nfree);
+        push_node(_free_nodes, index1);
         return true;
     }
 
     bool push_free_chunk(const FreeChunk& c) {
-        DynamicFreeChunk* p = (DynamicFreeChunk*)malloc(
-            offsetof(DynamicFreeChunk, ids) + sizeof(*c.ids) * c.nfree);
-        if (!p) {
-            return false;
+        uint32_t index1 = pop_node(_free_nodes);
+        if (!index1) {
+            index1 = new_chunk_node();
+            if (!index1) {
+                return false;
+            }
         }
-        p->nfree = c.nfree;
-        memcpy(p->ids, c.ids, sizeof(*c.ids) * c.nfree);
-        pthread_mutex_lock(&_free_chunks_mutex);
-        _free_chunks.push_back(p);
-        pthread_mutex_unlock(&_free_chunks_mutex);
+        FreeChunk& dst = address_chunk_node(index1 - 1)->chunk;
+        dst.nfree = c.nfree;
+        memcpy(dst.ids, c.ids, sizeof(*c.ids) * c.nfree);
+        push_node(_free_chunks, index1);
         return true;
     }
     
@@ -553,8 +643,13 @@ private:
     static pthread_mutex_t _change_thread_mutex;
     static butil::static_atomic<BlockGroup*> _block_groups[RP_MAX_BLOCK_NGROUP];
 
-    std::vector<DynamicFreeChunk*> _free_chunks;
-    pthread_mutex_t _free_chunks_mutex;
+    static butil::static_atomic<size_t> _nchunk_node;
+    static butil::static_atomic<ChunkNodeSlab*> _chunk_node_slabs[RP_MAX_CHUNK_NODE_SLAB];
+
+    // Stack of ChunkNodes with free identifiers.
+    butil::atomic<uint64_t> _free_chunks;
+    // Stack of ChunkNodes not in use.
+    butil::atomic<uint64_t> _free_nodes;
 
 #ifdef BUTIL_RESOURCE_POOL_NEED_FREE_ITEM_NUM
     static butil::static_atomic<size_t> _global_nfree;
@@ -594,6 +689,13 @@ template <typename T>
 butil::static_atomic<typename ResourcePool<T>::BlockGroup*>
 ResourcePool<T>::_block_groups[RP_MAX_BLOCK_NGROUP] = {};
 
+template <typename T>
+butil::static_atomic<size_t> ResourcePool<T>::_nchunk_node = BUTIL_STATIC_ATOMIC_INIT(0);
+
+template <typename T>
+butil::static_atomic<typename ResourcePool<T>::ChunkNodeSlab*>
+ResourcePool<T>::_chunk_node_slabs[RP_MAX_CHUNK_NODE_SLAB] = {};
+
 #ifdef BUTIL_RESOURCE_POOL_NEED_FREE_ITEM_NUM
 template <typename T>
 butil::static_atomic<size_t> ResourcePool<T>::_global_nfree = BUTIL_STATIC_ATOMIC_INIT(0);
@@ -322,6 +322,11 @@ BRPC_INLINE int RSA_bits(const RSA *r) {
     return (BN_num_bits(r->n));
 }
 
+BRPC_INLINE int SSL_SESSION_up_ref(SSL_SESSION *ses) {
+    CRYPTO_add(&ses->references, 1, CRYPTO_LOCK_SSL_SESSION);
+    return 1;
+}
+
 #endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
 
 #if OPENSSL_VERSION_NUMBER < 0x0090801fL || defined (OPENSSL_IS_BORINGSSL)
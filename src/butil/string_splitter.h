@@ -102,6 +102,8 @@ public:
     
 private:
     inline bool not_end(const char* p) const;
+    // Find the first separator or end of the string from `p'.
+    inline const char* find_sep(const char* p) const;
     inline void init();
     
     const char* _head;
@@ -158,6 +160,7 @@ public:
 private:
     inline bool is_sep(char c) const;
     inline bool not_end(const char* p) const;
+    inline const char* find_sep(const char* p) const;
     inline void init();
     
     const char* _head;
@@ -165,6 +168,8 @@ private:
     const char* _str_tail;
     const char* const _seps;
     const EmptyFieldAction _empty_field_action;
+    // Bitmap of `_seps'.
+    uint64_t _sep_mask[4];
 };
 
 // Split query in the format according to the given delimiters.
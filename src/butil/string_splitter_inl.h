@@ -18,6 +18,8 @@
 // Date: Mon. Apr. 18 19:52:34 CST 2011
 
 #include <limits.h>
+#include <string.h>
+#include "butil/number_parsing.h"
 
 #ifndef BUTIL_STRING_SPLITTER_INL_H
 #define BUTIL_STRING_SPLITTER_INL_H
@@ -49,7 +51,7 @@ void StringSplitter::init() {
         if (_empty_field_action == SKIP_EMPTY_FIELD) {
             for (; not_end(_head) && *_head == _sep; ++_head) {}
         }
-        for (_tail = _head; not_end(_tail) && *_tail != _sep; ++_tail) {}
+        _tail = find_sep(_head);
     } else {
         _tail = NULL;
     }
@@ -64,7 +66,7 @@ StringSplitter& StringSplitter::operator++() {
             }
         }
         _head = _tail;
-        for (; not_end(_tail) && *_tail != _sep; ++_tail) {}
+        _tail = find_sep(_tail);
     }
     return *this;
 }
@@ -95,6 +97,20 @@ bool StringSplitter::not_end(const char* p) const {
     return (_str_tail == NULL) ? *p : (p != _str_tail);
 }
 
+const char* StringSplitter::find_sep(const char* p) const {
+    // memchr and strchrnul of glibc compare 16 or 32 bytes at a time.
+    if (_str_tail != NULL) {
+        const void* q = memchr(p, _sep, _str_tail - p);
+        return q ? (const char*)q : _str_tail;
+    }
+#if defined(__GLIBC__)
+    return strchrnul(p, _sep);
+#else
+    for (; *p && *p != _sep; ++p) {}
+    return p;
+#endif
+}
+
 int StringSplitter::to_int8(int8_t* pv) const {
     long v = 0;
     if (to_long(&v) == 0 && v >= -128 && v <= 127) {
@@ -132,36 +148,64 @@ int StringSplitter::to_uint(unsigned int* pv) const {
 }
 
 int StringSplitter::to_long(long* pv) const {
+    int64_t v = 0;
+    if (ParseInt64(field(), field() + length(), &v) &&
+        v >= LONG_MIN && v <= LONG_MAX) {
+        *pv = (long)v;
+        return 0;
+    }
+    // Fall back for leading spaces and saturation on overflow.
     char* endptr = NULL;
     *pv = strtol(field(), &endptr, 10);
     return (endptr == field() + length()) ? 0 : -1;
 }
 
 int StringSplitter::to_ulong(unsigned long* pv) const {
+    uint64_t v = 0;
+    if (ParseUint64(field(), field() + length(), &v) && v <= ULONG_MAX) {
+        *pv = (unsigned long)v;
+        return 0;
+    }
     char* endptr = NULL;
     *pv = strtoul(field(), &endptr, 10);
     return (endptr == field() + length()) ? 0 : -1;
 }
 
 int StringSplitter::to_longlong(long long* pv) const {
+    int64_t v = 0;
+    if (ParseInt64(field(), field() + length(), &v)) {
+        *pv = v;
+        return 0;
+    }
     char* endptr = NULL;
     *pv = strtoll(field(), &endptr, 10);
     return (endptr == field() + length()) ? 0 : -1;
 }
 
 int StringSplitter::to_ulonglong(unsigned long long* pv) const {
+    uint64_t v = 0;
+    if (ParseUint64(field(), field() + length(), &v)) {
+        *pv = v;
+        return 0;
+    }
     char* endptr = NULL;
     *pv = strtoull(field(), &endptr, 10);
     return (endptr == field() + length()) ? 0 : -1;
 }
 
 int StringSplitter::to_float(float* pv) const {
+    if (ParseFloat(field(), field() + length(), pv)) {
+        return 0;
+    }
     char* endptr = NULL;
     *pv = strtof(field(), &endptr);
     return (endptr == field() + length()) ? 0 : -1;
 }
 
 int StringSplitter::to_double(double* pv) const {
+    if (ParseDouble(field(), field() + length(), pv)) {
+        return 0;
+    }
     char* endptr = NULL;
     *pv = strtod(field(), &endptr);
     return (endptr == field() + length()) ? 0 : -1;
@@ -187,11 +231,16 @@ StringMultiSplitter::StringMultiSplitter (
 }
 
 void StringMultiSplitter::init() {
+    memset(_sep_mask, 0, sizeof(_sep_mask));
+    for (const char* p = _seps; *p != '\0'; ++p) {
+        const unsigned char c = *p;
+        _sep_mask[c >> 6] |= (1ULL << (c & 63));
+    }
     if (__builtin_expect(_head != NULL, 1)) {
         if (_empty_field_action == SKIP_EMPTY_FIELD) {
             for (; not_end(_head) && is_sep(*_head); ++_head) {}
         }
-        for (_tail = _head; not_end(_tail) && !is_sep(*_tail); ++_tail) {}
+        _tail = find_sep(_head);
     } else {
         _tail = NULL;
     }
@@ -206,7 +255,7 @@ StringMultiSplitter& StringMultiSplitter::operator++() {
             }
         }
         _head = _tail;
-        for (; not_end(_tail) && !is_sep(*_tail); ++_tail) {}
+        _tail = find_sep(_tail);
     }
     return *this;
 }
@@ -218,12 +267,17 @@ StringMultiSplitter StringMultiSplitter::operator++(int) {
 }
 
 bool StringMultiSplitter::is_sep(char c) const {
-    for (const char* p = _seps; *p != '\0'; ++p) {
-        if (c == *p) {
-            return true;
-        }
+    const unsigned char uc = c;
+    return (_sep_mask[uc >> 6] >> (uc & 63)) & 1;
+}
+
+const char* StringMultiSplitter::find_sep(const char* p) const {
+    if (_str_tail == NULL) {
+        // strcspn of glibc checks 16 bytes at a time with SSE4.2.
+        return p + strcspn(p, _seps);
     }
-    return false;
+    for (; p != _str_tail && !is_sep(*p); ++p) {}
+    return p;
 }
 
 StringMultiSplitter::operator const void*() const {
@@ -283,36 +337,64 @@ int StringMultiSplitter::to_uint(unsigned int* pv) const {
 }
 
 int StringMultiSplitter::to_long(long* pv) const {
+    int64_t v = 0;
+    if (ParseInt64(field(), field() + length(), &v) &&
+        v >= LONG_MIN && v <= LONG_MAX) {
+        *pv = (long)v;
+        return 0;
+    }
+    // Fall back for leading spaces and saturation on overflow.
     char* endptr = NULL;
     *pv = strtol(field(), &endptr, 10);
     return (endptr == field() + length()) ? 0 : -1;
 }
 
 int StringMultiSplitter::to_ulong(unsigned long* pv) const {
+    uint64_t v = 0;
+    if (ParseUint64(field(), field() + length(), &v) && v <= ULONG_MAX) {
+        *pv = (unsigned long)v;
+        return 0;
+    }
     char* endptr = NULL;
     *pv = strtoul(field(), &endptr, 10);
     return (endptr == field() + length()) ? 0 : -1;
 }
 
 int StringMultiSplitter::to_longlong(long long* pv) const {
+    int64_t v = 0;
+    if (ParseInt64(field(), field() + length(), &v)) {
+        *pv = v;
+        return 0;
+    }
     char* endptr = NULL;
     *pv = strtoll(field(), &endptr, 10);
     return (endptr == field() + length()) ? 0 : -1;
 }
 
 int StringMultiSplitter::to_ulonglong(unsigned long long* pv) const {
+    uint64_t v = 0;
+    if (ParseUint64(field(), field() + length(), &v)) {
+        *pv = v;
+        return 0;
+    }
     char* endptr = NULL;
     *pv = strtoull(field(), &endptr, 10);
     return (endptr == field() + length()) ? 0 : -1;
 }
 
 int StringMultiSplitter::to_float(float* pv) const {
+    if (ParseFloat(field(), field() + length(), pv)) {
+        return 0;
+    }
     char* endptr = NULL;
     *pv = strtof(field(), &endptr);
     return (endptr == field() + length()) ? 0 : -1;
 }
 
 int StringMultiSplitter::to_double(double* pv) const {
+    if (ParseDouble(field(), field() + length(), pv)) {
+        return 0;
+    }
     char* endptr = NULL;
     *pv = strtod(field(), &endptr);
     return (endptr == field() + length()) ? 0 : -1;
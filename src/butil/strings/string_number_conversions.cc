@@ -11,6 +11,12 @@
 
 #include <limits>
 
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "butil/logging.h"
 #include "butil/scoped_clear_errno.h"
 #include "butil/strings/utf_string_conversions.h"
@@ -494,7 +500,32 @@ std::string HexEncode(const void* bytes, size_t size) {
   // Each input byte creates two output hex characters.
   std::string ret(size * 2, '\0');
 
-  for (size_t i = 0; i < size; ++i) {
+  size_t i = 0;
+  // Look up chars of 16 nibbles at once.
+#if defined(__SSSE3__)
+  const __m128i table = _mm_loadu_si128((const __m128i*)kHexChars);
+  const __m128i mask = _mm_set1_epi8(0x0f);
+  for (; i + 16 <= size; i += 16) {
+    const __m128i in = _mm_loadu_si128(
+        (const __m128i*)(reinterpret_cast<const char*>(bytes) + i));
+    const __m128i hi = _mm_shuffle_epi8(
+        table, _mm_and_si128(_mm_srli_epi16(in, 4), mask));
+    const __m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(in, mask));
+    _mm_storeu_si128((__m128i*)&ret[i * 2], _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i*)&ret[i * 2 + 16], _mm_unpackhi_epi8(hi, lo));
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  const uint8x16_t table = vld1q_u8((const uint8_t*)kHexChars);
+  for (; i + 16 <= size; i += 16) {
+    const uint8x16_t in = vld1q_u8(
+        reinterpret_cast<const uint8_t*>(bytes) + i);
+    uint8x16x2_t out;
+    out.val[0] = vqtbl1q_u8(table, vshrq_n_u8(in, 4));
+    out.val[1] = vqtbl1q_u8(table, vandq_u8(in, vdupq_n_u8(0x0f)));
+    vst2q_u8((uint8_t*)&ret[i * 2], out);
+  }
+#endif
+  for (; i < size; ++i) {
     char b = reinterpret_cast<const char*>(bytes)[i];
     ret[(i * 2)] = kHexChars[(b >> 4) & 0xf];
     ret[(i * 2) + 1] = kHexChars[b & 0xf];
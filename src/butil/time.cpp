@@ -21,6 +21,8 @@
 #include <sys/types.h>                       // open
 #include <sys/stat.h>                        // ^
 #include <fcntl.h>                           // ^
+#include <sched.h>                           // sched_yield
+#include <algorithm>                         // std::min
 
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
@@ -153,6 +155,158 @@ int64_t read_invariant_cpu_frequency() {
 }
 
 int64_t invariant_cpu_freq = -1;
+
+TscClockParams tsc_clock_params;
+uint64_t tsc_clock_seq = 0;
+
+static const int64_t TSC_CLOCK_MIN_WINDOW_NS = 1000000L;       // 1ms
+static const int64_t TSC_CLOCK_RESYNC_NS = 1000000000L;        // 1s
+
+// True iff the cycle counter runs at a constant rate and is synchronized
+// between cores.
+static bool is_cycle_counter_usable() {
+#if defined(__x86_64__) || defined(__amd64__)
+    if (read_invariant_cpu_frequency() <= 0) {
+        return false;
+    }
+    // The kernel checks TSCs of cores on boot and switches the clocksource
+    // away from tsc when they're not in sync.
+    const int fd = open("/sys/devices/system/clocksource/clocksource0/"
+                        "current_clocksource", O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    char buf[16];
+    const ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+    return n >= 3 && memcmp(buf, "tsc", 3) == 0 && (n == 3 || buf[3] == '\n');
+#elif defined(__aarch64__)
+    // The generic timer of ARMv8 is system-wide and runs at a fixed
+    // frequency.
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Read cycles and monotonic time as close as possible.
+static void sample_clocks(uint64_t* cycles, int64_t* ns) {
+    int64_t min_gap = -1;
+    for (int i = 0; i < 3; ++i) {
+        const int64_t t1 = monotonic_time_ns();
+        const uint64_t c = clock_cycles();
+        const int64_t t2 = monotonic_time_ns();
+        if (min_gap < 0 || t2 - t1 < min_gap) {
+            min_gap = t2 - t1;
+            *cycles = c;
+            *ns = t1 + (t2 - t1) / 2;
+        }
+    }
+}
+
+// Time of the current params even if they're out of their window, -1 if
+// the params are not calibrated yet.
+static int64_t extrapolate_tsc_time_ns() {
+    while (true) {
+        const uint64_t seq = __atomic_load_n(&tsc_clock_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            // Being written, which is short.
+            sched_yield();
+            continue;
+        }
+        const uint64_t base_cycles = tsc_clock_params.base_cycles;
+        const int64_t base_ns = tsc_clock_params.base_ns;
+        const uint64_t mult = tsc_clock_params.mult;
+        const uint64_t resync_cycles = tsc_clock_params.resync_cycles;
+        const uint64_t cycles = clock_cycles();
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&tsc_clock_seq, __ATOMIC_RELAXED) != seq) {
+            continue;
+        }
+        if (resync_cycles == 0) {
+            return -1;
+        }
+        if (cycles <= base_cycles) {
+            return base_ns;
+        }
+        return base_ns + (int64_t)(
+            (double)(cycles - base_cycles) * mult / 4294967296.0);
+    }
+}
+
+int64_t tsc_time_ns_slow() {
+    // -1: not checked, 0: not usable, 1: usable.
+    static int s_usable = -1;
+    static uint64_t s_first_cycles = 0;
+    static int64_t s_first_ns = -1;
+    static int s_calibrating = 0;
+    if (__atomic_load_n(&s_usable, __ATOMIC_RELAXED) == 0) {
+        return monotonic_time_ns();
+    }
+    if (__atomic_exchange_n(&s_calibrating, 1, __ATOMIC_ACQUIRE) != 0) {
+        // The monotonic time may be behind the time which was given by the
+        // params, keep using them until the other thread publishes new ones.
+        const int64_t ns = extrapolate_tsc_time_ns();
+        return ns >= 0 ? ns : monotonic_time_ns();
+    }
+    if (s_usable < 0) {
+        __atomic_store_n(&s_usable, (int)is_cycle_counter_usable(),
+                         __ATOMIC_RELAXED);
+        if (!s_usable) {
+            __atomic_store_n(&s_calibrating, 0, __ATOMIC_RELEASE);
+            return monotonic_time_ns();
+        }
+    }
+    uint64_t cycles = 0;
+    int64_t now_ns = 0;
+    sample_clocks(&cycles, &now_ns);
+    if (s_first_ns < 0) {
+        s_first_cycles = cycles;
+        s_first_ns = now_ns;
+    }
+    const int64_t window_ns = now_ns - s_first_ns;
+    if (window_ns < TSC_CLOCK_MIN_WINDOW_NS || cycles <= s_first_cycles) {
+        __atomic_store_n(&s_calibrating, 0, __ATOMIC_RELEASE);
+        return now_ns;
+    }
+    // Measure the rate from the first sample, which gets more precise as
+    // time goes by. Resync more often before the window gets long.
+    const double ns_per_cycle =
+        (double)window_ns / (double)(cycles - s_first_cycles);
+    const int64_t period_ns = std::min(window_ns, TSC_CLOCK_RESYNC_NS);
+    TscClockParams next;
+    next.mult = (uint64_t)(ns_per_cycle * 4294967296.0);
+    next.resync_cycles = (uint64_t)(period_ns / ns_per_cycle);
+
+    const uint64_t seq = tsc_clock_seq;
+    __atomic_store_n(&tsc_clock_seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    // Readers stop using the previous params from now on, start the new
+    // params from where the previous ones have reached.
+    next.base_cycles = clock_cycles();
+    next.base_ns = now_ns + (int64_t)(
+        (double)(next.base_cycles - cycles) * ns_per_cycle);
+    const TscClockParams& cur = tsc_clock_params;
+    if (cur.resync_cycles != 0 && next.base_cycles >= cur.base_cycles) {
+        // Time given by the previous params may be ahead of the monotonic
+        // time. Never go backwards, but slew to the monotonic time in next
+        // period by running slower, at most at half of the rate.
+        const int64_t cur_ns = cur.base_ns + (int64_t)(
+            (double)(next.base_cycles - cur.base_cycles) * cur.mult
+            / 4294967296.0);
+        const int64_t ahead_ns = cur_ns - next.base_ns;
+        if (ahead_ns > 0) {
+            next.base_ns = cur_ns;
+            next.mult = (uint64_t)(
+                (double)(period_ns - std::min(ahead_ns, period_ns / 2))
+                * 4294967296.0 / (double)next.resync_cycles);
+        }
+    }
+    tsc_clock_params = next;
+    __atomic_store_n(&tsc_clock_seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&s_calibrating, 0, __ATOMIC_RELEASE);
+    return next.base_ns;
+}
 }  // namespace detail
 
 }  // namespace butil
@@ -263,8 +263,51 @@ extern int64_t read_invariant_cpu_frequency();
 // 1 Intel x86_64 CPU (multiple cores) supporting constant_tsc and
 // nonstop_tsc(check flags in /proc/cpuinfo)
 extern int64_t invariant_cpu_freq;
+
+// Parameters converting clock cycles after `base_cycles' into nanoseconds
+// of CLOCK_MONOTONIC: base_ns + ((cycles - base_cycles) * mult >> 32).
+// They're valid for `resync_cycles' which is 0 before calibration or when
+// the cycle counter is not usable.
+struct TscClockParams {
+    uint64_t base_cycles;
+    int64_t base_ns;
+    uint64_t mult;
+    uint64_t resync_cycles;
+};
+// Params are protected by a seqlock: `tsc_clock_seq' is odd while they're
+// being written.
+extern TscClockParams tsc_clock_params;
+extern uint64_t tsc_clock_seq;
+extern int64_t tsc_time_ns_slow();
 }  // namespace detail
 
+// ---------------------------------------------------------------
+// Get CLOCK_MONOTONIC time from the cycle counter(TSC on x86_64, CNTVCT on
+// aarch64), which is re-calibrated against CLOCK_MONOTONIC every second.
+// Adjustments are slewed so that the time does not go backwards.
+// On x86_64, TSC is used only when it's invariant and selected by the
+// kernel as the clocksource, which means TSCs of all cores are in sync.
+// Otherwise(or before the first calibration) monotonic_time_ns() is
+// returned.
+// Cost ~10ns vs ~25ns of clock_gettime() on x86_64 with vDSO.
+// ---------------------------------------------------------------
+inline int64_t tsc_time_ns() {
+    // GCC builtins rather than butil/atomicops.h to keep this header light.
+    const uint64_t seq = __atomic_load_n(&detail::tsc_clock_seq, __ATOMIC_ACQUIRE);
+    const detail::TscClockParams& p = detail::tsc_clock_params;
+    const uint64_t base_cycles = p.base_cycles;
+    const int64_t base_ns = p.base_ns;
+    const uint64_t mult = p.mult;
+    const uint64_t resync_cycles = p.resync_cycles;
+    const uint64_t delta = detail::clock_cycles() - base_cycles;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (delta < resync_cycles && !(seq & 1) &&
+        __atomic_load_n(&detail::tsc_clock_seq, __ATOMIC_RELAXED) == seq) {
+        return base_ns + (int64_t)((delta * mult) >> 32);
+    }
+    return detail::tsc_time_ns_slow();
+}
+
 // ---------------------------------------------------------------
 // Get cpu-wide (wall-) time.
 // Cost ~9ns on Intel(R) Xeon(R) CPU E5620 @ 2.40GHz
@@ -275,13 +318,11 @@ inline int64_t cpuwide_time_ns() {
 #if !defined(BAIDU_INTERNAL)
     // nearly impossible to get the correct invariant cpu frequency on
     // different CPU and machines. CPU-ID rarely works and frequencies
-    // in "model name" and "cpu Mhz" are both unreliable.
-    // Since clock_gettime() in newer glibc/kernel is much faster(~30ns)
-    // which is closer to the previous impl. of cpuwide_time(~10ns), we
-    // simply use the monotonic time to get rid of all related issues.
-    timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    return now.tv_sec * 1000000000L + now.tv_nsec;
+    // in "model name" and "cpu Mhz" are both unreliable. Instead of
+    // reading the frequency, tsc_time_ns() measures it against the
+    // monotonic time continuously and falls back to the monotonic time
+    // when the cycle counter is not reliable.
+    return tsc_time_ns();
 #else
     int64_t cpu_freq = detail::invariant_cpu_freq;
     if (cpu_freq > 0) {
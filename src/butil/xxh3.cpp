@@ -0,0 +1,556 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "butil/xxh3.h"
+#include "butil/cpu.h"
+#include "butil/iobuf.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BUTIL_XXH3_X86 1
+#endif
+
+namespace butil {
+
+namespace {
+
+const uint64_t PRIME32_1 = 0x9E3779B1U;
+const uint64_t PRIME32_2 = 0x85EBCA77U;
+const uint64_t PRIME32_3 = 0xC2B2AE3DU;
+const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+const uint64_t PRIME_MX1 = 0x165667919E3779F9ULL;
+const uint64_t PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+const size_t STRIPE_LEN = 64;
+const size_t SECRET_SIZE = 192;
+const size_t SECRET_CONSUME_RATE = 8;
+// Stripes accumulated between two scrambles.
+const size_t NSTRIPES_PER_BLOCK = (SECRET_SIZE - STRIPE_LEN) / SECRET_CONSUME_RATE;
+const size_t BLOCK_LEN = STRIPE_LEN * NSTRIPES_PER_BLOCK;
+const size_t MIDSIZE_MAX = 240;
+// Offsets into the secret, not aligned on 8 so that the secret differs from
+// the one used for accumulating.
+const size_t SECRET_LASTACC_START = 7;
+const size_t SECRET_MERGEACCS_START = 11;
+
+// Pseudorandom secret taken directly from FARSH.
+const unsigned char kSecret[SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+inline uint32_t ReadLE32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+inline uint64_t ReadLE64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+inline void WriteLE64(unsigned char* p, uint64_t v) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    memcpy(p, &v, sizeof(v));
+}
+
+inline uint64_t Rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Multiply into 128 bits and fold the halves with xor.
+inline uint64_t Mul128Fold64(uint64_t lhs, uint64_t rhs) {
+#if defined(__SIZEOF_INT128__)
+    const unsigned __int128 product = (unsigned __int128)lhs * rhs;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+    const uint64_t lo_lo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+    const uint64_t hi_lo = (lhs >> 32) * (rhs & 0xFFFFFFFF);
+    const uint64_t lo_hi = (lhs & 0xFFFFFFFF) * (rhs >> 32);
+    const uint64_t hi_hi = (lhs >> 32) * (rhs >> 32);
+    const uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    const uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    const uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return lower ^ upper;
+#endif
+}
+
+inline uint64_t XXH64Avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+inline uint64_t Avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= PRIME_MX1;
+    h ^= h >> 32;
+    return h;
+}
+
+inline uint64_t RRMXMX(uint64_t h, uint64_t len) {
+    h ^= Rotl64(h, 49) ^ Rotl64(h, 24);
+    h *= PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= PRIME_MX2;
+    return h ^ (h >> 28);
+}
+
+uint64_t Len1To3(const unsigned char* p, size_t len, uint64_t seed) {
+    const uint32_t combined = ((uint32_t)p[0] << 16) |
+        ((uint32_t)p[len >> 1] << 24) | (uint32_t)p[len - 1] |
+        ((uint32_t)len << 8);
+    const uint64_t bitflip =
+        (ReadLE32(kSecret) ^ ReadLE32(kSecret + 4)) + seed;
+    return XXH64Avalanche((uint64_t)combined ^ bitflip);
+}
+
+uint64_t Len4To8(const unsigned char* p, size_t len, uint64_t seed) {
+    seed ^= (uint64_t)__builtin_bswap32((uint32_t)seed) << 32;
+    const uint32_t in1 = ReadLE32(p);
+    const uint32_t in2 = ReadLE32(p + len - 4);
+    const uint64_t bitflip =
+        (ReadLE64(kSecret + 8) ^ ReadLE64(kSecret + 16)) - seed;
+    const uint64_t in64 = in2 + ((uint64_t)in1 << 32);
+    return RRMXMX(in64 ^ bitflip, len);
+}
+
+uint64_t Len9To16(const unsigned char* p, size_t len, uint64_t seed) {
+    const uint64_t bitflip1 =
+        (ReadLE64(kSecret + 24) ^ ReadLE64(kSecret + 32)) + seed;
+    const uint64_t bitflip2 =
+        (ReadLE64(kSecret + 40) ^ ReadLE64(kSecret + 48)) - seed;
+    const uint64_t lo = ReadLE64(p) ^ bitflip1;
+    const uint64_t hi = ReadLE64(p + len - 8) ^ bitflip2;
+    const uint64_t acc =
+        len + __builtin_bswap64(lo) + hi + Mul128Fold64(lo, hi);
+    return Avalanche(acc);
+}
+
+inline uint64_t Mix16B(const unsigned char* p, const unsigned char* secret,
+                       uint64_t seed) {
+    return Mul128Fold64(ReadLE64(p) ^ (ReadLE64(secret) + seed),
+                        ReadLE64(p + 8) ^ (ReadLE64(secret + 8) - seed));
+}
+
+uint64_t Len17To128(const unsigned char* p, size_t len, uint64_t seed) {
+    uint64_t acc = len * PRIME64_1;
+    if (len > 32) {
+        if (len > 64) {
+            if (len > 96) {
+                acc += Mix16B(p + 48, kSecret + 96, seed);
+                acc += Mix16B(p + len - 64, kSecret + 112, seed);
+            }
+            acc += Mix16B(p + 32, kSecret + 64, seed);
+            acc += Mix16B(p + len - 48, kSecret + 80, seed);
+        }
+        acc += Mix16B(p + 16, kSecret + 32, seed);
+        acc += Mix16B(p + len - 32, kSecret + 48, seed);
+    }
+    acc += Mix16B(p, kSecret, seed);
+    acc += Mix16B(p + len - 16, kSecret + 16, seed);
+    return Avalanche(acc);
+}
+
+uint64_t Len129To240(const unsigned char* p, size_t len, uint64_t seed) {
+    const size_t MIDSIZE_STARTOFFSET = 3;
+    const size_t MIDSIZE_LASTOFFSET = 17;
+    uint64_t acc = len * PRIME64_1;
+    for (size_t i = 0; i < 8; ++i) {
+        acc += Mix16B(p + 16 * i, kSecret + 16 * i, seed);
+    }
+    acc = Avalanche(acc);
+    uint64_t acc_end = Mix16B(
+        p + len - 16, kSecret + 136 - MIDSIZE_LASTOFFSET, seed);
+    const size_t nrounds = len / 16;
+    for (size_t i = 8; i < nrounds; ++i) {
+        acc_end += Mix16B(p + 16 * i,
+                          kSecret + 16 * (i - 8) + MIDSIZE_STARTOFFSET, seed);
+    }
+    return Avalanche(acc + acc_end);
+}
+
+uint64_t HashShort(const unsigned char* p, size_t len, uint64_t seed) {
+    if (len <= 16) {
+        if (len > 8) {
+            return Len9To16(p, len, seed);
+        }
+        if (len >= 4) {
+            return Len4To8(p, len, seed);
+        }
+        if (len) {
+            return Len1To3(p, len, seed);
+        }
+        return XXH64Avalanche(
+            seed ^ (ReadLE64(kSecret + 56) ^ ReadLE64(kSecret + 64)));
+    }
+    if (len <= 128) {
+        return Len17To128(p, len, seed);
+    }
+    return Len129To240(p, len, seed);
+}
+
+// Accumulate `nstripes' stripes of 64 bytes into 8 lanes of `acc', using
+// 8 more bytes of `secret' for each stripe.
+typedef void (*AccumulateFn)(uint64_t* acc, const unsigned char* input,
+                             const unsigned char* secret, size_t nstripes);
+// Scramble `acc' with 64 bytes of `secret' at the end of a block.
+typedef void (*ScrambleFn)(uint64_t* acc, const unsigned char* secret);
+
+void AccumulateScalar(uint64_t* acc, const unsigned char* input,
+                      const unsigned char* secret, size_t nstripes) {
+    for (size_t n = 0; n < nstripes; ++n) {
+        const unsigned char* in = input + n * STRIPE_LEN;
+        const unsigned char* key = secret + n * SECRET_CONSUME_RATE;
+        for (size_t i = 0; i < 8; ++i) {
+            const uint64_t data_val = ReadLE64(in + i * 8);
+            const uint64_t data_key = data_val ^ ReadLE64(key + i * 8);
+            acc[i ^ 1] += data_val;
+            acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+        }
+    }
+}
+
+void ScrambleScalar(uint64_t* acc, const unsigned char* secret) {
+    for (size_t i = 0; i < 8; ++i) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= ReadLE64(secret + i * 8);
+        a *= PRIME32_1;
+        acc[i] = a;
+    }
+}
+
+#if defined(BUTIL_XXH3_X86)
+
+// SSE2 is always available on x86-64.
+void AccumulateSSE2(uint64_t* acc, const unsigned char* input,
+                    const unsigned char* secret, size_t nstripes) {
+    __m128i a[4];
+    for (int i = 0; i < 4; ++i) {
+        a[i] = _mm_loadu_si128((const __m128i*)acc + i);
+    }
+    for (size_t n = 0; n < nstripes; ++n) {
+        const __m128i* in = (const __m128i*)(input + n * STRIPE_LEN);
+        const __m128i* key =
+            (const __m128i*)(secret + n * SECRET_CONSUME_RATE);
+        for (int i = 0; i < 4; ++i) {
+            const __m128i data_vec = _mm_loadu_si128(in + i);
+            const __m128i data_key =
+                _mm_xor_si128(data_vec, _mm_loadu_si128(key + i));
+            // Multiply low 32 bits of each lane with its high 32 bits.
+            const __m128i data_key_hi =
+                _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+            const __m128i product = _mm_mul_epu32(data_key, data_key_hi);
+            // Add input to the other lane.
+            const __m128i data_swap =
+                _mm_shuffle_epi32(data_vec, _MM_SHUFFLE(1, 0, 3, 2));
+            a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, data_swap));
+        }
+    }
+    for (int i = 0; i < 4; ++i) {
+        _mm_storeu_si128((__m128i*)acc + i, a[i]);
+    }
+}
+
+void ScrambleSSE2(uint64_t* acc, const unsigned char* secret) {
+    const __m128i prime32 = _mm_set1_epi32((int)PRIME32_1);
+    for (int i = 0; i < 4; ++i) {
+        __m128i a = _mm_loadu_si128((const __m128i*)acc + i);
+        a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+        a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*)secret + i));
+        // 64-bit multiplication by a 32-bit prime from 32-bit halves.
+        const __m128i a_hi = _mm_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1));
+        const __m128i prod_lo = _mm_mul_epu32(a, prime32);
+        const __m128i prod_hi = _mm_mul_epu32(a_hi, prime32);
+        _mm_storeu_si128((__m128i*)acc + i,
+                         _mm_add_epi64(prod_lo, _mm_slli_epi64(prod_hi, 32)));
+    }
+}
+
+__attribute__((target("avx2")))
+void AccumulateAVX2(uint64_t* acc, const unsigned char* input,
+                    const unsigned char* secret, size_t nstripes) {
+    __m256i a0 = _mm256_loadu_si256((const __m256i*)acc);
+    __m256i a1 = _mm256_loadu_si256((const __m256i*)acc + 1);
+    for (size_t n = 0; n < nstripes; ++n) {
+        const __m256i* in = (const __m256i*)(input + n * STRIPE_LEN);
+        const __m256i* key =
+            (const __m256i*)(secret + n * SECRET_CONSUME_RATE);
+        const __m256i d0 = _mm256_loadu_si256(in);
+        const __m256i d1 = _mm256_loadu_si256(in + 1);
+        const __m256i k0 = _mm256_xor_si256(d0, _mm256_loadu_si256(key));
+        const __m256i k1 = _mm256_xor_si256(d1, _mm256_loadu_si256(key + 1));
+        const __m256i p0 = _mm256_mul_epu32(
+            k0, _mm256_shuffle_epi32(k0, _MM_SHUFFLE(0, 3, 0, 1)));
+        const __m256i p1 = _mm256_mul_epu32(
+            k1, _mm256_shuffle_epi32(k1, _MM_SHUFFLE(0, 3, 0, 1)));
+        a0 = _mm256_add_epi64(a0, _mm256_add_epi64(
+            p0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2))));
+        a1 = _mm256_add_epi64(a1, _mm256_add_epi64(
+            p1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+    _mm256_storeu_si256((__m256i*)acc, a0);
+    _mm256_storeu_si256((__m256i*)acc + 1, a1);
+}
+
+__attribute__((target("avx2")))
+void ScrambleAVX2(uint64_t* acc, const unsigned char* secret) {
+    const __m256i prime32 = _mm256_set1_epi32((int)PRIME32_1);
+    for (int i = 0; i < 2; ++i) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)acc + i);
+        a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+        a = _mm256_xor_si256(
+            a, _mm256_loadu_si256((const __m256i*)secret + i));
+        const __m256i a_hi =
+            _mm256_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1));
+        const __m256i prod_lo = _mm256_mul_epu32(a, prime32);
+        const __m256i prod_hi = _mm256_mul_epu32(a_hi, prime32);
+        _mm256_storeu_si256(
+            (__m256i*)acc + i,
+            _mm256_add_epi64(prod_lo, _mm256_slli_epi64(prod_hi, 32)));
+    }
+}
+
+#endif  // BUTIL_XXH3_X86
+
+struct Kernels {
+    AccumulateFn accumulate;
+    ScrambleFn scramble;
+};
+
+Kernels ChooseKernels() {
+    Kernels k = { AccumulateScalar, ScrambleScalar };
+#if defined(BUTIL_XXH3_X86)
+    if (CPU().has_avx2()) {
+        k.accumulate = AccumulateAVX2;
+        k.scramble = ScrambleAVX2;
+    } else {
+        k.accumulate = AccumulateSSE2;
+        k.scramble = ScrambleSSE2;
+    }
+#endif
+    return k;
+}
+
+const Kernels& GetKernels() {
+    static const Kernels s_kernels = ChooseKernels();
+    return s_kernels;
+}
+
+inline void InitAcc(uint64_t* acc) {
+    acc[0] = PRIME32_3;
+    acc[1] = PRIME64_1;
+    acc[2] = PRIME64_2;
+    acc[3] = PRIME64_3;
+    acc[4] = PRIME64_4;
+    acc[5] = PRIME32_2;
+    acc[6] = PRIME64_5;
+    acc[7] = PRIME32_1;
+}
+
+// The secret of long inputs is derived from the seed.
+void InitSecret(unsigned char* secret, uint64_t seed) {
+    for (size_t i = 0; i < SECRET_SIZE / 16; ++i) {
+        WriteLE64(secret + 16 * i, ReadLE64(kSecret + 16 * i) + seed);
+        WriteLE64(secret + 16 * i + 8, ReadLE64(kSecret + 16 * i + 8) - seed);
+    }
+}
+
+uint64_t MergeAccs(const uint64_t* acc, const unsigned char* secret,
+                   uint64_t start) {
+    uint64_t result = start;
+    for (size_t i = 0; i < 4; ++i) {
+        result += Mul128Fold64(acc[2 * i] ^ ReadLE64(secret + 16 * i),
+                               acc[2 * i + 1] ^ ReadLE64(secret + 16 * i + 8));
+    }
+    return Avalanche(result);
+}
+
+// Accumulate `nstripes' stripes of `input' into `acc', scrambling at ends
+// of blocks. `*nstripes_in_block' is the number of stripes accumulated in
+// the current block before and after the call.
+void ConsumeStripes(const Kernels& k, uint64_t* acc,
+                    size_t* nstripes_in_block, const unsigned char* input,
+                    size_t nstripes, const unsigned char* secret) {
+    size_t n = NSTRIPES_PER_BLOCK - *nstripes_in_block;
+    while (nstripes >= n) {
+        k.accumulate(acc, input,
+                     secret + *nstripes_in_block * SECRET_CONSUME_RATE, n);
+        k.scramble(acc, secret + SECRET_SIZE - STRIPE_LEN);
+        input += n * STRIPE_LEN;
+        nstripes -= n;
+        *nstripes_in_block = 0;
+        n = NSTRIPES_PER_BLOCK;
+    }
+    if (nstripes > 0) {
+        k.accumulate(acc, input,
+                     secret + *nstripes_in_block * SECRET_CONSUME_RATE,
+                     nstripes);
+        *nstripes_in_block += nstripes;
+    }
+}
+
+uint64_t HashLong(const unsigned char* p, size_t len,
+                  const unsigned char* secret) {
+    const Kernels& k = GetKernels();
+    uint64_t acc[8];
+    InitAcc(acc);
+    size_t nstripes_in_block = 0;
+    // The last stripe is always processed separately, even if it's full.
+    ConsumeStripes(k, acc, &nstripes_in_block, p, (len - 1) / STRIPE_LEN,
+                   secret);
+    k.accumulate(acc, p + len - STRIPE_LEN,
+                 secret + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC_START, 1);
+    return MergeAccs(acc, secret + SECRET_MERGEACCS_START, len * PRIME64_1);
+}
+
+}  // namespace
+
+uint64_t XXH3Hash64(const void* data, size_t len, uint64_t seed) {
+    const unsigned char* p = (const unsigned char*)data;
+    if (len <= MIDSIZE_MAX) {
+        return HashShort(p, len, seed);
+    }
+    if (seed == 0) {
+        return HashLong(p, len, kSecret);
+    }
+    unsigned char secret[SECRET_SIZE];
+    InitSecret(secret, seed);
+    return HashLong(p, len, secret);
+}
+
+uint64_t XXH3Hash64(const IOBuf& buf, uint64_t seed) {
+    if (buf.backing_block_num() == 1) {
+        const StringPiece blk = buf.backing_block(0);
+        return XXH3Hash64(blk.data(), blk.size(), seed);
+    }
+    XXH3Stream h(seed);
+    h.Update(buf);
+    return h.Digest();
+}
+
+void XXH3Stream::Reset(uint64_t seed) {
+    InitAcc(_acc);
+    _seed = seed;
+    _total_len = 0;
+    _buffered = 0;
+    _nstripes_in_block = 0;
+    if (seed == 0) {
+        memcpy(_secret, kSecret, SECRET_SIZE);
+    } else {
+        InitSecret(_secret, seed);
+    }
+}
+
+void XXH3Stream::Update(const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* const end = p + len;
+    _total_len += len;
+    if (len <= BUFFER_SIZE - _buffered) {
+        memcpy(_buffer + _buffered, p, len);
+        _buffered += len;
+        return;
+    }
+    // Input does not fit in the buffer. The buffer is consumed only when
+    // more input is coming, so that the last stripe is always kept for
+    // Digest().
+    const Kernels& k = GetKernels();
+    if (_buffered) {
+        const size_t fill = BUFFER_SIZE - _buffered;
+        memcpy(_buffer + _buffered, p, fill);
+        p += fill;
+        ConsumeStripes(k, _acc, &_nstripes_in_block, _buffer,
+                       BUFFER_SIZE / STRIPE_LEN, _secret);
+        _buffered = 0;
+    }
+    if ((size_t)(end - p) > BUFFER_SIZE) {
+        const size_t nstripes = (size_t)(end - 1 - p) / STRIPE_LEN;
+        ConsumeStripes(k, _acc, &_nstripes_in_block, p, nstripes, _secret);
+        p += nstripes * STRIPE_LEN;
+        // Digest() may need bytes before the remaining input to form the
+        // last stripe.
+        memcpy(_buffer + BUFFER_SIZE - STRIPE_LEN, p - STRIPE_LEN,
+               STRIPE_LEN);
+    }
+    memcpy(_buffer, p, end - p);
+    _buffered = end - p;
+}
+
+void XXH3Stream::Update(const IOBuf& buf) {
+    const size_t n = buf.backing_block_num();
+    for (size_t i = 0; i < n; ++i) {
+        const StringPiece blk = buf.backing_block(i);
+        Update(blk.data(), blk.size());
+    }
+}
+
+uint64_t XXH3Stream::Digest() const {
+    if (_total_len <= MIDSIZE_MAX) {
+        return HashShort(_buffer, _total_len, _seed);
+    }
+    const Kernels& k = GetKernels();
+    uint64_t acc[8];
+    memcpy(acc, _acc, sizeof(acc));
+    const unsigned char* last_stripe = NULL;
+    unsigned char tmp[STRIPE_LEN];
+    if (_buffered >= STRIPE_LEN) {
+        size_t nstripes_in_block = _nstripes_in_block;
+        ConsumeStripes(k, acc, &nstripes_in_block, _buffer,
+                       (_buffered - 1) / STRIPE_LEN, _secret);
+        last_stripe = _buffer + _buffered - STRIPE_LEN;
+    } else {
+        // Complete the last stripe with tail of previously consumed input.
+        const size_t catchup = STRIPE_LEN - _buffered;
+        memcpy(tmp, _buffer + BUFFER_SIZE - catchup, catchup);
+        memcpy(tmp + catchup, _buffer, _buffered);
+        last_stripe = tmp;
+    }
+    k.accumulate(acc, last_stripe,
+                 _secret + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC_START, 1);
+    return MergeAccs(acc, _secret + SECRET_MERGEACCS_START,
+                     _total_len * PRIME64_1);
+}
+
+}  // namespace butil
@@ -0,0 +1,96 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// XXH3 (64-bit variant of xxHash 0.8, https://github.com/Cyan4973/xxHash),
+// a fast non-cryptographic hash. Results are identical with XXH3_64bits()
+// and XXH3_64bits_withSeed() of the reference implementation. Stripes of
+// long inputs are accumulated with AVX2 or SSE2 on x86-64, chosen at
+// runtime.
+//
+// WARNING: Do not use it for any cryptographic purpose.
+
+#ifndef BUTIL_XXH3_H
+#define BUTIL_XXH3_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include "butil/strings/string_piece.h"
+
+namespace butil {
+
+class IOBuf;
+
+// Hash `len' bytes starting from `data'.
+uint64_t XXH3Hash64(const void* data, size_t len, uint64_t seed = 0);
+
+// Hash all bytes in `buf' block by block without flattening it. Same as
+// hashing buf.to_string().
+uint64_t XXH3Hash64(const IOBuf& buf, uint64_t seed = 0);
+
+// Hash a stream of data which is fed piece by piece. The result only
+// depends on the concatenated data, not on how it's split.
+// Example:
+//   butil::XXH3Stream h;
+//   h.Update(header, header_len);
+//   h.Update(body_iobuf);
+//   uint64_t hash = h.Digest();
+class XXH3Stream {
+public:
+    explicit XXH3Stream(uint64_t seed = 0) { Reset(seed); }
+
+    // Discard fed data and start over with `seed'.
+    void Reset(uint64_t seed = 0);
+
+    void Update(const void* data, size_t len);
+    void Update(const IOBuf& buf);
+    void Update(const StringPiece& s) { Update(s.data(), s.size()); }
+
+    // Get hash of data fed so far. More data can be fed afterwards.
+    uint64_t Digest() const;
+
+private:
+    static const size_t STRIPE_LEN = 64;
+    static const size_t SECRET_SIZE = 192;
+    static const size_t BUFFER_SIZE = 256;
+
+    uint64_t _acc[8];
+    uint64_t _seed;
+    uint64_t _total_len;
+    size_t _buffered;
+    size_t _nstripes_in_block;
+    unsigned char _secret[SECRET_SIZE];
+    unsigned char _buffer[BUFFER_SIZE];
+};
+
+// Hasher of strings for butil::FlatMap and std::unordered_map, which
+// is much faster than DefaultHasher<std::string> on long keys and
+// distributes better. Example:
+//   butil::FlatMap<std::string, Value, butil::XXH3StringHasher> m;
+struct XXH3StringHasher {
+    size_t operator()(const StringPiece& s) const
+    { return XXH3Hash64(s.data(), s.size()); }
+    size_t operator()(const std::string& s) const
+    { return XXH3Hash64(s.data(), s.size()); }
+    size_t operator()(const char* s) const
+    { return XXH3Hash64(s, strlen(s)); }
+};
+
+}  // namespace butil
+
+#endif  // BUTIL_XXH3_H
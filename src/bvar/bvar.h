@@ -21,6 +21,7 @@
 #define  BVAR_BVAR_H
 
 #include "bvar/reducer.h"
+#include "bvar/percpu_reducer.h"
 #include "bvar/recorder.h"
 #include "bvar/status.h"
 #include "bvar/passive_status.h"
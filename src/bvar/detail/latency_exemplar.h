@@ -0,0 +1,116 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_DETAIL_LATENCY_EXEMPLAR_H
+#define  BVAR_DETAIL_LATENCY_EXEMPLAR_H
+
+#include <stdint.h>
+#include <ostream>
+#include "butil/atomicops.h"
+#include "bvar/reducer.h"               // Reducer
+#include "bvar/window.h"                // Window
+#include "bvar/detail/combiner.h"       // ElementContainer
+
+namespace bvar {
+namespace detail {
+
+// A recorded latency with the id of the trace (e.g. rpcz) which took it,
+// so that a slow percentile can be followed to an example request.
+struct LatencyExemplar {
+    LatencyExemplar() : latency(0), trace_id(0), timestamp_us(0) {}
+    LatencyExemplar(int64_t latency2, uint64_t trace_id2, int64_t timestamp_us2)
+        : latency(latency2), trace_id(trace_id2), timestamp_us(timestamp_us2) {}
+
+    int64_t latency;
+    // 0 means no exemplar.
+    uint64_t trace_id;
+    // Wall time when the exemplar was recorded.
+    int64_t timestamp_us;
+};
+
+// Printed as "<latency> trace=<hex trace_id>", or "0" if there's no exemplar.
+std::ostream& operator<<(std::ostream& os, const LatencyExemplar& e);
+
+// Keep the exemplar with the largest latency.
+struct MaxLatencyExemplar {
+    void operator()(LatencyExemplar& lhs, const LatencyExemplar& rhs) const {
+        if (rhs.latency > lhs.latency) {
+            lhs = rhs;
+        }
+    }
+};
+
+// Lock-free thread-local exemplar. Fields are separate atomics, so a reader
+// or a concurrent reset may pair a latency with the trace_id of another
+// request in rare cases, which is fine for an example.
+template <>
+class ElementContainer<LatencyExemplar> {
+public:
+    void load(LatencyExemplar* out) {
+        out->latency = _latency.load(butil::memory_order_relaxed);
+        out->trace_id = _trace_id.load(butil::memory_order_relaxed);
+        out->timestamp_us = _timestamp_us.load(butil::memory_order_relaxed);
+    }
+
+    void store(const LatencyExemplar& new_value) {
+        _trace_id.store(new_value.trace_id, butil::memory_order_relaxed);
+        _timestamp_us.store(new_value.timestamp_us, butil::memory_order_relaxed);
+        _latency.store(new_value.latency, butil::memory_order_relaxed);
+    }
+
+    void exchange(LatencyExemplar* prev, const LatencyExemplar& new_value) {
+        prev->latency = _latency.exchange(
+            new_value.latency, butil::memory_order_relaxed);
+        prev->trace_id = _trace_id.exchange(
+            new_value.trace_id, butil::memory_order_relaxed);
+        prev->timestamp_us = _timestamp_us.exchange(
+            new_value.timestamp_us, butil::memory_order_relaxed);
+    }
+
+    template <typename Op>
+    void modify(const Op&, const LatencyExemplar& value) {
+        // Most latencies are not the largest so far, which costs a load.
+        if (value.latency > _latency.load(butil::memory_order_relaxed)) {
+            store(value);
+        }
+    }
+
+private:
+    butil::atomic<int64_t> _latency;
+    butil::atomic<uint64_t> _trace_id;
+    butil::atomic<int64_t> _timestamp_us;
+};
+
+// Keeps the slowest exemplar, windows over it give the slowest exemplar
+// in recent seconds.
+class LatencyExemplarReducer
+    : public Reducer<LatencyExemplar, MaxLatencyExemplar> {
+public:
+    typedef Reducer<LatencyExemplar, MaxLatencyExemplar> Base;
+    typedef LatencyExemplar value_type;
+    typedef Base::sampler_type sampler_type;
+
+    LatencyExemplarReducer() {}
+    ~LatencyExemplarReducer() override { Variable::hide(); }
+};
+
+typedef Window<LatencyExemplarReducer, SERIES_IN_SECOND> LatencyExemplarWindow;
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  // BVAR_DETAIL_LATENCY_EXEMPLAR_H
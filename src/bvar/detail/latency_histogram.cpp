@@ -0,0 +1,98 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <math.h>                       // ceil
+#include "butil/logging.h"
+#include "bvar/detail/latency_histogram.h"
+
+namespace bvar {
+namespace detail {
+
+uint64_t LatencyBuckets::total() const {
+    uint64_t n = 0;
+    for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+        n += counts[i];
+    }
+    return n;
+}
+
+int64_t LatencyBuckets::get_number(double ratio) const {
+    const uint64_t n = total();
+    uint64_t rank = (uint64_t)ceil(ratio * n);
+    if (rank > n) {
+        rank = n;
+    } else if (rank == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+        if (rank <= counts[i]) {
+            // Middle of the bucket halves the worst error.
+            const int64_t lower = histogram_bucket_lower(i);
+            return lower + (histogram_bucket_upper(i) - lower) / 2;
+        }
+        rank -= counts[i];
+    }
+    CHECK(false) << "Can't reach here";
+    return histogram_bucket_upper(HISTOGRAM_NUM_BUCKETS - 1);
+}
+
+void LatencyBuckets::describe(std::ostream& os) const {
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        cumulative += counts[i];
+        os << histogram_bucket_upper(i) << ':' << cumulative << ' ';
+    }
+    os << "sum:" << sum;
+}
+
+LatencyHistogram::LatencyHistogram()
+    : _combiner(std::make_shared<combiner_type>())
+    , _sampler(NULL) {}
+
+LatencyHistogram::~LatencyHistogram() {
+    // Calling hide() manually is a MUST required by Variable.
+    hide();
+    if (_sampler) {
+        _sampler->destroy();
+        _sampler = NULL;
+    }
+}
+
+LatencyHistogram& LatencyHistogram::operator<<(int64_t latency) {
+    if (BAIDU_UNLIKELY(latency < 0)) {
+        LOG_EVERY_SECOND(WARNING) << "Input=" << latency << " to `" << name()
+                                  << "' is negative, drop";
+        return *this;
+    }
+    agent_type* agent = _combiner->get_or_create_tls_agent();
+    if (BAIDU_UNLIKELY(!agent)) {
+        LOG(FATAL) << "Fail to create agent";
+        return *this;
+    }
+    agent->element.modify(_combiner->op(), latency);
+    return *this;
+}
+
+void LatencyHistogram::describe(std::ostream& os, bool) const {
+    get_value().describe(os);
+}
+
+}  // namespace detail
+}  // namespace bvar
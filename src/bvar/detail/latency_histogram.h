@@ -0,0 +1,206 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_DETAIL_LATENCY_HISTOGRAM_H
+#define  BVAR_DETAIL_LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>                     // memset
+#include <ostream>
+#include "butil/macros.h"
+#include "bvar/variable.h"              // Variable
+#include "bvar/reducer.h"               // AddTo, MinusFrom
+#include "bvar/window.h"                // Window
+#include "bvar/detail/combiner.h"       // AgentCombiner
+#include "bvar/detail/sampler.h"        // ReducerSampler
+
+namespace bvar {
+namespace detail {
+
+// Log-linear (HDR-style) buckets: values less than 2^(SUB_BITS+1) have
+// their own buckets, a larger value shares its bucket with values having
+// the same highest SUB_BITS+1 bits, so the width of a bucket is at most
+// 1/2^SUB_BITS of the values inside.
+static const int HISTOGRAM_SUB_BITS = 5;
+static const int64_t HISTOGRAM_SUB_COUNT = 1L << HISTOGRAM_SUB_BITS;
+// Values not less than 2^32 go to the last bucket, as PercentileSamples
+// does with overflowed values.
+static const int HISTOGRAM_MAX_BITS = 32;
+static const size_t HISTOGRAM_NUM_BUCKETS =
+    (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS;
+
+inline size_t histogram_bucket_of(int64_t value) {
+    if (value < HISTOGRAM_SUB_COUNT) {
+        return value < 0 ? 0 : value;
+    }
+    if (value >> HISTOGRAM_MAX_BITS) {
+        return HISTOGRAM_NUM_BUCKETS - 1;
+    }
+    const int e = 63 - __builtin_clzll(value);
+    return ((size_t)(e - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) +
+        ((value >> (e - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_COUNT - 1));
+}
+
+// Smallest value in bucket `index'.
+inline int64_t histogram_bucket_lower(size_t index) {
+    if ((int64_t)index < HISTOGRAM_SUB_COUNT) {
+        return index;
+    }
+    const int shift = (int)(index >> HISTOGRAM_SUB_BITS) - 1;
+    return (HISTOGRAM_SUB_COUNT + (index & (HISTOGRAM_SUB_COUNT - 1))) << shift;
+}
+
+// Largest value in bucket `index'.
+inline int64_t histogram_bucket_upper(size_t index) {
+    return histogram_bucket_lower(index + 1) - 1;
+}
+
+// Counts of latencies in all buckets. Counts are accumulated since
+// creation of the histogram and never reset, a window is the difference
+// between two snapshots.
+struct LatencyBuckets {
+    LatencyBuckets() { memset(this, 0, sizeof(*this)); }
+
+    void operator+=(const LatencyBuckets& rhs) {
+        for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+            counts[i] += rhs.counts[i];
+        }
+        sum += rhs.sum;
+    }
+
+    void operator-=(const LatencyBuckets& rhs) {
+        for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+            counts[i] -= rhs.counts[i];
+        }
+        sum -= rhs.sum;
+    }
+
+    // Number of latencies in all buckets.
+    uint64_t total() const;
+
+    // Get the `ratio'-ile value. E.g. 0.99 means 99%-ile value.
+    // The error is bounded by width of the bucket containing the value.
+    int64_t get_number(double ratio) const;
+
+    // Print non-empty buckets as "upper:cumulative_count" separated by
+    // spaces, followed by "sum:<sum>". Used by Prometheus dumper.
+    void describe(std::ostream& os) const;
+
+    uint64_t counts[HISTOGRAM_NUM_BUCKETS];
+    // Sum of all latencies.
+    uint64_t sum;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const LatencyBuckets& b) {
+    b.describe(os);
+    return os;
+}
+
+// Lock-free thread-local buckets. Every thread writes its own buckets and
+// readers only load them, relaxed atomics are enough.
+template <>
+class ElementContainer<LatencyBuckets> {
+public:
+    void load(LatencyBuckets* out) {
+        for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+            out->counts[i] = _counts[i].load(butil::memory_order_relaxed);
+        }
+        out->sum = _sum.load(butil::memory_order_relaxed);
+    }
+
+    void store(const LatencyBuckets& new_value) {
+        for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+            _counts[i].store(new_value.counts[i], butil::memory_order_relaxed);
+        }
+        _sum.store(new_value.sum, butil::memory_order_relaxed);
+    }
+
+    void exchange(LatencyBuckets* prev, const LatencyBuckets& new_value) {
+        for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+            prev->counts[i] = _counts[i].exchange(
+                new_value.counts[i], butil::memory_order_relaxed);
+        }
+        prev->sum = _sum.exchange(new_value.sum, butil::memory_order_relaxed);
+    }
+
+    template <typename Op>
+    void modify(const Op&, int64_t latency) {
+        // fetch_add on an uncontended cacheline is cheap and keeps counts
+        // correct even if reset_all_agents() runs concurrently.
+        _counts[histogram_bucket_of(latency)].fetch_add(
+            1, butil::memory_order_relaxed);
+        _sum.fetch_add(latency, butil::memory_order_relaxed);
+    }
+
+private:
+    butil::atomic<uint64_t> _counts[HISTOGRAM_NUM_BUCKETS];
+    butil::atomic<uint64_t> _sum;
+};
+
+// A specialized reducer putting latencies into log-linear buckets, which
+// gives accurate high percentiles and merges cheaply. Each thread writing
+// it costs sizeof(LatencyBuckets) (about 7KB) of memory.
+// NOTE: DON'T use it directly, use LatencyRecorder instead.
+class LatencyHistogram : public Variable {
+public:
+    typedef LatencyBuckets value_type;
+    typedef AddTo<LatencyBuckets> Op;
+    typedef MinusFrom<LatencyBuckets> InvOp;
+    typedef ReducerSampler<LatencyHistogram, LatencyBuckets, Op, InvOp> sampler_type;
+    typedef AgentCombiner<LatencyBuckets, LatencyBuckets, Op> combiner_type;
+    typedef combiner_type::self_shared_type shared_combiner_type;
+    typedef combiner_type::Agent agent_type;
+
+    LatencyHistogram();
+    ~LatencyHistogram() override;
+
+    const Op& op() const { return _combiner->op(); }
+    InvOp inv_op() const { return InvOp(); }
+
+    // The sampler for windows over the histogram.
+    sampler_type* get_sampler() {
+        if (NULL == _sampler) {
+            _sampler = new sampler_type(this);
+            _sampler->schedule();
+        }
+        return _sampler;
+    }
+
+    value_type reset() { return _combiner->reset_all_agents(); }
+
+    value_type get_value() const { return _combiner->combine_agents(); }
+
+    // Negative latencies are dropped.
+    LatencyHistogram& operator<<(int64_t latency);
+
+    bool valid() const { return _combiner->valid(); }
+
+    void describe(std::ostream& os, bool quote_string) const override;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(LatencyHistogram);
+
+    shared_combiner_type _combiner;
+    sampler_type* _sampler;
+};
+
+typedef Window<LatencyHistogram, SERIES_IN_SECOND> LatencyHistogramWindow;
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  // BVAR_DETAIL_LATENCY_HISTOGRAM_H
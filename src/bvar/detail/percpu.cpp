@@ -0,0 +1,109 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <sched.h>                           // sched_getcpu
+#include <stdlib.h>                          // posix_memalign
+#include <string.h>                          // memset
+#include <unistd.h>                          // sysconf
+#include <new>                               // std::nothrow
+#include <vector>
+#include "butil/build_config.h"                // OS_LINUX
+#include "butil/scoped_lock.h"
+#include "butil/logging.h"
+#include "bvar/detail/percpu.h"
+
+namespace bvar {
+namespace detail {
+
+// Upper bound of cpus, avoid huge chunks on weird sysconf results.
+static const int MAX_PERCPU_NSLOT = 4096;
+
+int g_percpu_nslot = 0;
+
+int percpu_init_nslot() {
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    if (n <= 0) {
+        n = 1;
+    } else if (n > MAX_PERCPU_NSLOT) {
+        n = MAX_PERCPU_NSLOT;
+    }
+    // Racing initializations store the same value.
+    *(volatile int*)&g_percpu_nslot = (int)n;
+    return (int)n;
+}
+
+int percpu_current_slot_slow() {
+    const int n = percpu_nslot();
+#if defined(OS_LINUX)
+    const int cpu = sched_getcpu();
+    if (cpu >= 0) {
+        // cpus hot-plugged after the start may be out of range.
+        return cpu % n;
+    }
+#endif
+    // No cpu id available, spread threads instead.
+    static __thread int tls_slot = -1;
+    if (tls_slot < 0) {
+        static butil::static_atomic<int> s_next = BUTIL_STATIC_ATOMIC_INIT(0);
+        tls_slot = s_next.fetch_add(1, butil::memory_order_relaxed) % n;
+    }
+    return tls_slot;
+}
+
+static pthread_mutex_t s_percpu_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Cells not in use. Chunks are never returned to the system, which is what
+// AgentGroup does with its blocks as well.
+static std::vector<void*>* s_free_cells = NULL;
+
+void* percpu_alloc() {
+    BAIDU_SCOPED_LOCK(s_percpu_mutex);
+    if (s_free_cells == NULL) {
+        s_free_cells = new (std::nothrow) std::vector<void*>;
+        if (s_free_cells == NULL) {
+            return NULL;
+        }
+    }
+    if (s_free_cells->empty()) {
+        const size_t size = PERCPU_STRIDE * percpu_nslot();
+        void* chunk = NULL;
+        if (posix_memalign(&chunk, PERCPU_STRIDE, size) != 0) {
+            LOG(ERROR) << "Fail to allocate per-cpu chunk of " << size << " bytes";
+            return NULL;
+        }
+        memset(chunk, 0, size);
+        // Hand out low addresses first.
+        for (size_t off = PERCPU_STRIDE; off > 0; off -= sizeof(int64_t)) {
+            s_free_cells->push_back((char*)chunk + off - sizeof(int64_t));
+        }
+    }
+    void* cell = s_free_cells->back();
+    s_free_cells->pop_back();
+    return cell;
+}
+
+void percpu_free(void* cell) {
+    // Clear all copies so that the next owner starts from zero.
+    for (int i = 0; i < percpu_nslot(); ++i) {
+        memset(percpu_at(cell, i), 0, sizeof(int64_t));
+    }
+    BAIDU_SCOPED_LOCK(s_percpu_mutex);
+    s_free_cells->push_back(cell);
+}
+
+}  // namespace detail
+}  // namespace bvar
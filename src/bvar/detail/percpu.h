@@ -0,0 +1,168 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_DETAIL_PERCPU_H
+#define  BVAR_DETAIL_PERCPU_H
+
+#include <stddef.h>
+#include "butil/atomicops.h"                 // butil::atomic
+#include "butil/macros.h"                    // BAIDU_CASSERT
+#include "butil/type_traits.h"               // butil::is_integral
+
+#if defined(__linux__) && defined(__GLIBC__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>                        // __rseq_offset, struct rseq
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_thread_pointer)
+#define BVAR_HAS_RSEQ_CPU_ID 1
+#endif
+#endif
+#endif
+#endif
+
+namespace bvar {
+namespace detail {
+
+extern int g_percpu_nslot;
+int percpu_init_nslot();
+
+// Number of per-cpu copies, which covers all configured cpus.
+inline int percpu_nslot() {
+    const int n = *(volatile int*)&g_percpu_nslot;
+    return n > 0 ? n : percpu_init_nslot();
+}
+
+// Slow path of percpu_current_slot().
+int percpu_current_slot_slow();
+
+// Index of the cpu running the calling thread, in [0, percpu_nslot()).
+// The thread may be migrated right after the call, so the result is only a
+// hint for spreading writes and must never be used for exclusion.
+inline int percpu_current_slot() {
+#if BVAR_HAS_RSEQ_CPU_ID
+    // glibc >= 2.35 registers rseq for every thread, the kernel keeps
+    // cpu_id of the area up to date, reading it costs a tls load.
+    const struct rseq* rs = (const struct rseq*)(
+        (char*)__builtin_thread_pointer() + __rseq_offset);
+    const int cpu = (int)*(const volatile uint32_t*)&rs->cpu_id;
+    if (cpu >= 0 && cpu < percpu_nslot()) {
+        return cpu;
+    }
+#endif
+    return percpu_current_slot_slow();
+}
+
+// Allocate 8-byte cells which have one copy per cpu. Copies of different
+// cells for one cpu are packed together, so that a cell costs
+// 8 * percpu_nslot() bytes instead of a cacheline per thread. Packed cells
+// are mostly written by the same cpu, false sharing is rare.
+// Returns the copy of cpu 0, or NULL on failure. Copies are zeroed.
+void* percpu_alloc();
+// Return a cell from percpu_alloc() for reuse.
+void percpu_free(void* cell);
+
+// Distance in bytes between copies of one cell for adjacent cpus.
+static const size_t PERCPU_STRIDE = 4096;
+
+inline void* percpu_at(void* cell, int slot) {
+    return (char*)cell + PERCPU_STRIDE * slot;
+}
+
+// Default modification of PerCpuCounter: retry `op' with CAS.
+template <typename T, typename Op>
+struct PerCpuModify {
+    static void apply(butil::atomic<T>* p, const Op& op, T value) {
+        T old = p->load(butil::memory_order_relaxed);
+        while (true) {
+            T tmp = old;
+            op(tmp, value);
+            if (tmp == old) {
+                // e.g. Maxer receiving a value not larger than current.
+                return;
+            }
+            if (p->compare_exchange_weak(old, tmp, butil::memory_order_relaxed)) {
+                return;
+            }
+        }
+    }
+};
+
+// Per-cpu combination of integers with `Op'. Unlike AgentCombiner, memory
+// is proportional to number of cpus and reads walk cpus instead of threads.
+template <typename T, typename Op>
+class PerCpuCounter {
+    BAIDU_CASSERT(butil::is_integral<T>::value && sizeof(T) <= 8,
+                  PerCpuCounter_only_supports_integers);
+public:
+    explicit PerCpuCounter(T identity = T(), const Op& op = Op())
+        : _cell(percpu_alloc()), _identity(identity), _op(op) {
+        if (_cell != NULL && identity != T()) {
+            for (int i = 0; i < percpu_nslot(); ++i) {
+                at(i)->store(identity, butil::memory_order_relaxed);
+            }
+        }
+    }
+
+    ~PerCpuCounter() {
+        if (_cell != NULL) {
+            percpu_free(_cell);
+        }
+    }
+
+    bool valid() const { return _cell != NULL; }
+
+    // Caller should check valid() before.
+    void modify(T value) {
+        PerCpuModify<T, Op>::apply(at(percpu_current_slot()), _op, value);
+    }
+
+    T value() const {
+        T result = _identity;
+        for (int i = 0; _cell != NULL && i < percpu_nslot(); ++i) {
+            _op(result, at(i)->load(butil::memory_order_relaxed));
+        }
+        return result;
+    }
+
+    // Set all copies to identity and return combined value before.
+    // Values added concurrently go either into the result or the counter.
+    T reset() {
+        T result = _identity;
+        for (int i = 0; _cell != NULL && i < percpu_nslot(); ++i) {
+            _op(result, at(i)->exchange(_identity, butil::memory_order_relaxed));
+        }
+        return result;
+    }
+
+    const Op& op() const { return _op; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PerCpuCounter);
+
+    butil::atomic<T>* at(int slot) const {
+        return static_cast<butil::atomic<T>*>(percpu_at(_cell, slot));
+    }
+
+    void* _cell;
+    T _identity;
+    Op _op;
+};
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  // BVAR_DETAIL_PERCPU_H
@@ -19,6 +19,7 @@
 
 #include <gflags/gflags.h>
 #include "butil/threading/platform_thread.h"
+#include "butil/reloadable_flags.h"
 #include "butil/time.h"
 #include "butil/memory/singleton_on_pthread_once.h"
 #include "bvar/reducer.h"
@@ -30,6 +31,15 @@ namespace bvar {
 namespace detail {
 
 const int WARN_NOSLEEP_THRESHOLD = 2;
+const int MAX_SAMPLER_THREADS = 64;
+
+static bool validate_bvar_sampler_thread_num(const char*, int32_t v) {
+    return v >= 1 && v <= MAX_SAMPLER_THREADS;
+}
+DEFINE_int32(bvar_sampler_thread_num, 1,
+             "Number of threads calling take_sample() of samplers, raise it "
+             "if bvar_sampler_collector_cost_us is close to one second");
+BUTIL_VALIDATE_GFLAG(bvar_sampler_thread_num, validate_bvar_sampler_thread_num);
 
 // Combine two circular linked list into one.
 struct CombineSampler {
@@ -60,12 +70,25 @@ static bool registered_atfork = false;
 // list of Samplers. Waking through the list and call take_sample().
 // If a Sampler needs to be deleted, we just mark it as unused and the
 // deletion is taken place in the thread as well.
+// When there're too many samplers to walk in one second, samplers can be
+// spread into -bvar_sampler_thread_num shards, the dedicated thread samples
+// the first shard and wakes up other threads to sample the rest in parallel.
 class SamplerCollector : public bvar::Reducer<Sampler*, CombineSampler> {
 public:
     SamplerCollector()
         : _created(false)
         , _stop(false)
-        , _cumulated_time_us(0) {
+        , _cumulated_time_us(0)
+        , _last_cost_us(0)
+        , _last_lag_us(0)
+        , _nshard(1)
+        , _next_shard(0)
+        , _nworker(0)
+        , _round(0)
+        , _npending(0) {
+        pthread_mutex_init(&_round_mutex, NULL);
+        pthread_cond_init(&_round_cond, NULL);
+        pthread_cond_init(&_done_cond, NULL);
         create_sampling_thread();
     }
     ~SamplerCollector() {
@@ -74,6 +97,16 @@ public:
             pthread_join(_tid, NULL);
             _created = false;
         }
+        pthread_mutex_lock(&_round_mutex);
+        _stop = true;
+        pthread_cond_broadcast(&_round_cond);
+        pthread_mutex_unlock(&_round_mutex);
+        for (int i = 0; i < _nworker; ++i) {
+            pthread_join(_worker_tids[i], NULL);
+        }
+        pthread_cond_destroy(&_done_cond);
+        pthread_cond_destroy(&_round_cond);
+        pthread_mutex_destroy(&_round_mutex);
     }
 
 private:
@@ -102,32 +135,92 @@ private:
     }
 
     void after_forked_as_child() {
+        // Workers don't exist in the child and may hold the mutex while
+        // forking, they're re-created in the next round.
+        pthread_mutex_init(&_round_mutex, NULL);
+        pthread_cond_init(&_round_cond, NULL);
+        pthread_cond_init(&_done_cond, NULL);
+        _nworker = 0;
+        _npending = 0;
         _created = false;
         create_sampling_thread();
     }
 
     void run();
 
+    // Adjust shards and workers to -bvar_sampler_thread_num.
+    void update_shards();
+
+    // Put samplers in list `s' into shards.
+    void distribute(Sampler* s);
+
+    // Call take_sample() of samplers in the shard, delete unused ones.
+    void sample_shard(butil::LinkNode<Sampler>* root);
+
+    void run_worker(int index, int64_t round);
+
     static void* sampling_thread(void* arg) {
         butil::PlatformThread::SetNameSimple("bvar_sampler");
         static_cast<SamplerCollector*>(arg)->run();
         return NULL;
     }
 
+    struct WorkerArgs {
+        SamplerCollector* collector;
+        int index;
+        int64_t round;
+    };
+
+    static void* worker_thread(void* arg) {
+        butil::PlatformThread::SetNameSimple("bvar_sampler");
+        WorkerArgs* args = static_cast<WorkerArgs*>(arg);
+        args->collector->run_worker(args->index, args->round);
+        delete args;
+        return NULL;
+    }
+
     static double get_cumulated_time(void* arg) {
         return static_cast<SamplerCollector*>(arg)->_cumulated_time_us / 1000.0 / 1000.0;
     }
 
+    static int64_t get_last_cost(void* arg) {
+        return static_cast<SamplerCollector*>(arg)->_last_cost_us;
+    }
+
+    static int64_t get_last_lag(void* arg) {
+        return static_cast<SamplerCollector*>(arg)->_last_lag_us;
+    }
+
 private:
     bool _created;
     bool _stop;
     int64_t _cumulated_time_us;
+    // Wall time of the last round.
+    int64_t _last_cost_us;
+    // How late the last round started.
+    int64_t _last_lag_us;
     pthread_t _tid;
+
+    // Shard i is sampled by worker i-1, shard 0 by the sampling thread.
+    butil::LinkNode<Sampler> _shards[MAX_SAMPLER_THREADS];
+    int _nshard;
+    int _next_shard;
+    pthread_t _worker_tids[MAX_SAMPLER_THREADS - 1];
+    int _nworker;
+
+    // Sync rounds between the sampling thread and workers.
+    pthread_mutex_t _round_mutex;
+    pthread_cond_t _round_cond;
+    pthread_cond_t _done_cond;
+    int64_t _round;
+    int _npending;
 };
 
 #ifndef UNIT_TEST
 static PassiveStatus<double>* s_cumulated_time_bvar = NULL;
 static bvar::PerSecond<bvar::PassiveStatus<double> >* s_sampling_thread_usage_bvar = NULL;
+static PassiveStatus<int64_t>* s_sampling_cost_bvar = NULL;
+static PassiveStatus<int64_t>* s_sampling_lag_bvar = NULL;
 #endif
 
 DEFINE_int32(bvar_sampler_thread_start_delay_us, 10000, "bvar sampler thread start delay us");
@@ -150,34 +243,40 @@ void SamplerCollector::run() {
             new bvar::PerSecond<bvar::PassiveStatus<double> >(
                     "bvar_sampler_collector_usage", s_cumulated_time_bvar, 10);
     }
+    if (s_sampling_cost_bvar == NULL) {
+        s_sampling_cost_bvar = new PassiveStatus<int64_t>(
+            "bvar_sampler_collector_cost_us", get_last_cost, this);
+    }
+    if (s_sampling_lag_bvar == NULL) {
+        s_sampling_lag_bvar = new PassiveStatus<int64_t>(
+            "bvar_sampler_collector_lag_us", get_last_lag, this);
+    }
 #endif
 
-    butil::LinkNode<Sampler> root;
     int consecutive_nosleep = 0;
+    int64_t abstime = butil::gettimeofday_us();
     while (!_stop) {
-        int64_t abstime = butil::gettimeofday_us();
-        Sampler* s = this->reset();
-        if (s) {
-            s->InsertBeforeAsList(&root);
-        }
-        for (butil::LinkNode<Sampler>* p = root.next(); p != &root;) {
-            // We may remove p from the list, save next first.
-            butil::LinkNode<Sampler>* saved_next = p->next();
-            Sampler* s = p->value();
-            s->_mutex.lock();
-            if (!s->_used) {
-                s->_mutex.unlock();
-                p->RemoveFromList();
-                delete s;
-            } else {
-                s->take_sample();
-                s->_mutex.unlock();
-            }
-            p = saved_next;
+        const int64_t start_time = butil::gettimeofday_us();
+        _last_lag_us = start_time - abstime;
+        abstime = start_time;
+        update_shards();
+        distribute(this->reset());
+        pthread_mutex_lock(&_round_mutex);
+        _npending = _nworker;
+        ++_round;
+        pthread_cond_broadcast(&_round_cond);
+        pthread_mutex_unlock(&_round_mutex);
+        sample_shard(&_shards[0]);
+        pthread_mutex_lock(&_round_mutex);
+        while (_npending > 0) {
+            pthread_cond_wait(&_done_cond, &_round_mutex);
         }
+        pthread_mutex_unlock(&_round_mutex);
+
         bool slept = false;
         int64_t now = butil::gettimeofday_us();
-        _cumulated_time_us += now - abstime;
+        _last_cost_us = now - start_time;
+        _cumulated_time_us += now - start_time;
         abstime += 1000000L;
         while (abstime > now) {
             ::usleep(abstime - now);
@@ -196,6 +295,110 @@ void SamplerCollector::run() {
     }
 }
 
+void SamplerCollector::update_shards() {
+    const int nshard = FLAGS_bvar_sampler_thread_num;
+    while (_nworker < nshard - 1) {
+        WorkerArgs* args = new WorkerArgs;
+        args->collector = this;
+        args->index = _nworker + 1;
+        // Workers are created between rounds, start from current round.
+        args->round = _round;
+        const int rc = pthread_create(&_worker_tids[_nworker], NULL,
+                                      worker_thread, args);
+        if (rc != 0) {
+            LOG(ERROR) << "Fail to create bvar sampler worker, " << berror(rc);
+            delete args;
+            break;
+        }
+        ++_nworker;
+    }
+    const int new_nshard = std::min(nshard, _nworker + 1);
+    if (new_nshard == _nshard) {
+        return;
+    }
+    // Gather all samplers and spread them again.
+    butil::LinkNode<Sampler> all;
+    for (int i = 0; i < _nshard; ++i) {
+        butil::LinkNode<Sampler>* root = &_shards[i];
+        if (root->next() != root) {
+            butil::LinkNode<Sampler>* first = root->next();
+            root->RemoveFromList();
+            first->InsertBeforeAsList(&all);
+        }
+    }
+    _nshard = new_nshard;
+    _next_shard = 0;
+    if (all.next() != &all) {
+        Sampler* first = all.next()->value();
+        all.RemoveFromList();
+        distribute(first);
+    }
+}
+
+void SamplerCollector::distribute(Sampler* s) {
+    if (s == NULL) {
+        return;
+    }
+    if (_nshard == 1) {
+        s->InsertBeforeAsList(&_shards[0]);
+        return;
+    }
+    butil::LinkNode<Sampler>* p = s;
+    while (true) {
+        butil::LinkNode<Sampler>* next = p->next();
+        const bool last = (next == p);
+        p->RemoveFromList();
+        p->InsertBefore(&_shards[_next_shard]);
+        _next_shard = (_next_shard + 1) % _nshard;
+        if (last) {
+            break;
+        }
+        p = next;
+    }
+}
+
+void SamplerCollector::sample_shard(butil::LinkNode<Sampler>* root) {
+    for (butil::LinkNode<Sampler>* p = root->next(); p != root;) {
+        // We may remove p from the list, save next first.
+        butil::LinkNode<Sampler>* saved_next = p->next();
+        Sampler* s = p->value();
+        s->_mutex.lock();
+        if (!s->_used) {
+            s->_mutex.unlock();
+            p->RemoveFromList();
+            delete s;
+        } else {
+            s->take_sample();
+            s->_mutex.unlock();
+        }
+        p = saved_next;
+    }
+}
+
+void SamplerCollector::run_worker(int index, int64_t round) {
+    while (true) {
+        pthread_mutex_lock(&_round_mutex);
+        while (_round == round && !_stop) {
+            pthread_cond_wait(&_round_cond, &_round_mutex);
+        }
+        if (_stop) {
+            pthread_mutex_unlock(&_round_mutex);
+            break;
+        }
+        round = _round;
+        const bool has_shard = (index < _nshard);
+        pthread_mutex_unlock(&_round_mutex);
+        if (has_shard) {
+            sample_shard(&_shards[index]);
+        }
+        pthread_mutex_lock(&_round_mutex);
+        if (--_npending == 0) {
+            pthread_cond_signal(&_done_cond);
+        }
+        pthread_mutex_unlock(&_round_mutex);
+    }
+}
+
 Sampler::Sampler() : _used(true) {}
 
 Sampler::~Sampler() {}
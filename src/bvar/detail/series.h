@@ -21,6 +21,8 @@
 #define  BVAR_DETAIL_SERIES_H
 
 #include <math.h>                       // round
+#include <algorithm>                    // std::min
+#include <memory>                       // std::unique_ptr
 #include <ostream>
 #include "butil/scoped_lock.h"           // BAIDU_SCOPED_LOCK
 #include "butil/type_traits.h"
@@ -96,6 +98,31 @@ struct DivideOnAddition<Vector<T,N>, Op, typename butil::enable_if<
     }
 };
 
+// Tell if two values appended to a series are same. Values of types not
+// listed here are never considered same.
+template <typename T, typename Enabler = void>
+struct SameInSeries {
+    static bool check(const T&, const T&) { return false; }
+};
+
+template <typename T>
+struct SameInSeries<T, typename butil::enable_if<
+                           butil::is_integral<T>::value ||
+                           butil::is_floating_point<T>::value>::type> {
+    static bool check(const T& a, const T& b) { return a == b; }
+};
+
+template <typename T, size_t N>
+struct SameInSeries<Vector<T, N>, void> {
+    static bool check(const Vector<T, N>& a, const Vector<T, N>& b) {
+        return a == b;
+    }
+};
+
+// Most variables never change or change rarely (e.g. counters of errors),
+// so the history is not allocated until a value different from previous
+// ones is appended. Before that, the series is just the constant and number
+// of appended values, from which the history can be rebuilt.
 template <typename T, typename Op>
 class SeriesBase {
 public:
@@ -104,24 +131,58 @@ public:
         , _nsecond(0)
         , _nminute(0)
         , _nhour(0)
-        , _nday(0) {
+        , _nday(0)
+        , _data(NULL)
+        , _constant()
+        , _nconstant(0) {
         pthread_mutex_init(&_mutex, NULL);
     }
     ~SeriesBase() {
+        delete _data;
         pthread_mutex_destroy(&_mutex);
     }
 
     void append(const T& value) {
         BAIDU_SCOPED_LOCK(_mutex);
+        if (_data == NULL) {
+            if (_nconstant == 0 || SameInSeries<T>::check(value, _constant)) {
+                _constant = value;
+                ++_nconstant;
+                return;
+            }
+            _data = new Data;
+            expand_constant(_data, &_nsecond, &_nminute, &_nhour, &_nday);
+        }
         return append_second(value, _op);
     }
 
+    // True if the history is allocated.
+    bool allocated() const {
+        BAIDU_SCOPED_LOCK(_mutex);
+        return _data != NULL;
+    }
+
+protected:
+    struct Data;
+
+    // Get the history and positions of the oldest values. If the history is
+    // not allocated, it's rebuilt into `buf'.
+    const Data* get_data(std::unique_ptr<Data>* buf,
+                         int* second_begin, int* minute_begin,
+                         int* hour_begin, int* day_begin) const;
+
 private:
     void append_second(const T& value, const Op& op);
     void append_minute(const T& value, const Op& op);
     void append_hour(const T& value, const Op& op);
     void append_day(const T& value);
 
+    // Fill `data' and positions as if _constant was appended for _nconstant
+    // times.
+    void expand_constant(Data* data, char* nsecond, char* nminute,
+                         char* nhour, char* nday) const;
+
+protected:
     struct Data {
     public:
         Data() {
@@ -147,25 +208,100 @@ private:
         T _array[60 + 60 + 24 + 30];
     };
 
-protected:
     Op _op;
     mutable pthread_mutex_t _mutex;
     char _nsecond;
     char _nminute;
     char _nhour;
     char _nday;
-    Data _data;
+    Data* _data;
+    T _constant;
+    uint64_t _nconstant;
 };
 
+template <typename T, typename Op>
+void SeriesBase<T, Op>::expand_constant(
+    Data* data, char* nsecond, char* nminute, char* nhour, char* nday) const {
+    if (_nconstant == 0) {
+        return;
+    }
+    // Aggregated values of a minute, an hour and a day, computed in the
+    // same way as append_xxx().
+    T minute = _constant;
+    for (int i = 1; i < 60; ++i) {
+        call_op_returning_void(_op, minute, _constant);
+    }
+    DivideOnAddition<T, Op>::inplace_divide(minute, _op, 60);
+    T hour = minute;
+    for (int i = 1; i < 60; ++i) {
+        call_op_returning_void(_op, hour, minute);
+    }
+    DivideOnAddition<T, Op>::inplace_divide(hour, _op, 60);
+    T day = hour;
+    for (int i = 1; i < 24; ++i) {
+        call_op_returning_void(_op, day, hour);
+    }
+    DivideOnAddition<T, Op>::inplace_divide(day, _op, 24);
+
+    const uint64_t nseconds = _nconstant;
+    const uint64_t nminutes = nseconds / 60;
+    const uint64_t nhours = nminutes / 60;
+    const uint64_t ndays = nhours / 24;
+    for (uint64_t i = 0; i < std::min(nseconds, (uint64_t)60); ++i) {
+        data->second(i) = _constant;
+    }
+    for (uint64_t i = 0; i < std::min(nminutes, (uint64_t)60); ++i) {
+        data->minute(i) = minute;
+    }
+    for (uint64_t i = 0; i < std::min(nhours, (uint64_t)24); ++i) {
+        data->hour(i) = hour;
+    }
+    for (uint64_t i = 0; i < std::min(ndays, (uint64_t)30); ++i) {
+        data->day(i) = day;
+    }
+    *nsecond = nseconds % 60;
+    *nminute = nminutes % 60;
+    *nhour = nhours % 24;
+    *nday = ndays % 30;
+}
+
+template <typename T, typename Op>
+const typename SeriesBase<T, Op>::Data* SeriesBase<T, Op>::get_data(
+    std::unique_ptr<Data>* buf, int* second_begin, int* minute_begin,
+    int* hour_begin, int* day_begin) const {
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (_data != NULL) {
+        *second_begin = _nsecond;
+        *minute_begin = _nminute;
+        *hour_begin = _nhour;
+        *day_begin = _nday;
+        // NOTE: we don't save _data which may be inconsistent sometimes, but
+        // this output is generally for "peeking the trend" and does not need
+        // to exactly accurate.
+        return _data;
+    }
+    buf->reset(new Data);
+    char nsecond = 0;
+    char nminute = 0;
+    char nhour = 0;
+    char nday = 0;
+    expand_constant(buf->get(), &nsecond, &nminute, &nhour, &nday);
+    *second_begin = nsecond;
+    *minute_begin = nminute;
+    *hour_begin = nhour;
+    *day_begin = nday;
+    return buf->get();
+}
+
 template <typename T, typename Op>
 void SeriesBase<T, Op>::append_second(const T& value, const Op& op) {
-    _data.second(_nsecond) = value;
+    _data->second(_nsecond) = value;
     ++_nsecond;
     if (_nsecond >= 60) {
         _nsecond = 0;
-        T tmp = _data.second(0);
+        T tmp = _data->second(0);
         for (int i = 1; i < 60; ++i) {
-            call_op_returning_void(op, tmp, _data.second(i));
+            call_op_returning_void(op, tmp, _data->second(i));
         }
         DivideOnAddition<T, Op>::inplace_divide(tmp, op, 60);
         append_minute(tmp, op);
@@ -174,13 +310,13 @@ void SeriesBase<T, Op>::append_second(const T& value, const Op& op) {
 
 template <typename T, typename Op>
 void SeriesBase<T, Op>::append_minute(const T& value, const Op& op) {
-    _data.minute(_nminute) = value;
+    _data->minute(_nminute) = value;
     ++_nminute;
     if (_nminute >= 60) {
         _nminute = 0;
-        T tmp = _data.minute(0);
+        T tmp = _data->minute(0);
         for (int i = 1; i < 60; ++i) {
-            call_op_returning_void(op, tmp, _data.minute(i));
+            call_op_returning_void(op, tmp, _data->minute(i));
         }
         DivideOnAddition<T, Op>::inplace_divide(tmp, op, 60);
         append_hour(tmp, op);
@@ -189,13 +325,13 @@ void SeriesBase<T, Op>::append_minute(const T& value, const Op& op) {
 
 template <typename T, typename Op>
 void SeriesBase<T, Op>::append_hour(const T& value, const Op& op) {
-    _data.hour(_nhour) = value;
+    _data->hour(_nhour) = value;
     ++_nhour;
     if (_nhour >= 24) {
         _nhour = 0;
-        T tmp = _data.hour(0);
+        T tmp = _data->hour(0);
         for (int i = 1; i < 24; ++i) {
-            call_op_returning_void(op, tmp, _data.hour(i));
+            call_op_returning_void(op, tmp, _data->hour(i));
         }
         DivideOnAddition<T, Op>::inplace_divide(tmp, op, 24);
         append_day(tmp);
@@ -204,7 +340,7 @@ void SeriesBase<T, Op>::append_hour(const T& value, const Op& op) {
 
 template <typename T, typename Op>
 void SeriesBase<T, Op>::append_day(const T& value) {
-    _data.day(_nday) = value;
+    _data->day(_nday) = value;
     ++_nday;
     if (_nday >= 30) {
         _nday = 0;
@@ -231,40 +367,38 @@ template <typename T, typename Op>
 void Series<T, Op>::describe(std::ostream& os,
                              const std::string* vector_names) const {
     CHECK(vector_names == NULL);
-    pthread_mutex_lock(&this->_mutex);
-    const int second_begin = this->_nsecond;
-    const int minute_begin = this->_nminute;
-    const int hour_begin = this->_nhour;
-    const int day_begin = this->_nday;
-    // NOTE: we don't save _data which may be inconsistent sometimes, but
-    // this output is generally for "peeking the trend" and does not need
-    // to exactly accurate.
-    pthread_mutex_unlock(&this->_mutex);
+    std::unique_ptr<typename Base::Data> buf;
+    int second_begin = 0;
+    int minute_begin = 0;
+    int hour_begin = 0;
+    int day_begin = 0;
+    const typename Base::Data* data = this->get_data(
+        &buf, &second_begin, &minute_begin, &hour_begin, &day_begin);
     int c = 0;
     os << "{\"label\":\"trend\",\"data\":[";
     for (int i = 0; i < 30; ++i, ++c) {
         if (c) {
             os << ',';
         }
-        os << '[' << c << ',' << this->_data.day((i + day_begin) % 30) << ']';
+        os << '[' << c << ',' << data->day((i + day_begin) % 30) << ']';
     }
     for (int i = 0; i < 24; ++i, ++c) {
         if (c) {
             os << ',';
         }
-        os << '[' << c << ',' << this->_data.hour((i + hour_begin) % 24) << ']';
+        os << '[' << c << ',' << data->hour((i + hour_begin) % 24) << ']';
     }
     for (int i = 0; i < 60; ++i, ++c) {
         if (c) {
             os << ',';
         }
-        os << '[' << c << ',' << this->_data.minute((i + minute_begin) % 60) << ']';
+        os << '[' << c << ',' << data->minute((i + minute_begin) % 60) << ']';
     }
     for (int i = 0; i < 60; ++i, ++c) {
         if (c) {
             os << ',';
         }
-        os << '[' << c << ',' << this->_data.second((i + second_begin) % 60) << ']';
+        os << '[' << c << ',' << data->second((i + second_begin) % 60) << ']';
     }
     os << "]}";
 }
@@ -272,15 +406,13 @@ void Series<T, Op>::describe(std::ostream& os,
 template <typename T, size_t N, typename Op>
 void Series<Vector<T,N>, Op>::describe(std::ostream& os,
                                        const std::string* vector_names) const {
-    pthread_mutex_lock(&this->_mutex);
-    const int second_begin = this->_nsecond;
-    const int minute_begin = this->_nminute;
-    const int hour_begin = this->_nhour;
-    const int day_begin = this->_nday;
-    // NOTE: we don't save _data which may be inconsistent sometimes, but
-    // this output is generally for "peeking the trend" and does not need
-    // to exactly accurate.
-    pthread_mutex_unlock(&this->_mutex);
+    std::unique_ptr<typename Base::Data> buf;
+    int second_begin = 0;
+    int minute_begin = 0;
+    int hour_begin = 0;
+    int day_begin = 0;
+    const typename Base::Data* data = this->get_data(
+        &buf, &second_begin, &minute_begin, &hour_begin, &day_begin);
 
     butil::StringSplitter sp(vector_names ? vector_names->c_str() : "", ',');
     os << '[';
@@ -301,25 +433,25 @@ void Series<Vector<T,N>, Op>::describe(std::ostream& os,
             if (c) {
                 os << ',';
             }
-            os << '[' << c << ',' << this->_data.day((i + day_begin) % 30)[j] << ']';
+            os << '[' << c << ',' << data->day((i + day_begin) % 30)[j] << ']';
         }
         for (int i = 0; i < 24; ++i, ++c) {
             if (c) {
                 os << ',';
             }
-            os << '[' << c << ',' << this->_data.hour((i + hour_begin) % 24)[j] << ']';
+            os << '[' << c << ',' << data->hour((i + hour_begin) % 24)[j] << ']';
         }
         for (int i = 0; i < 60; ++i, ++c) {
             if (c) {
                 os << ',';
             }
-            os << '[' << c << ',' << this->_data.minute((i + minute_begin) % 60)[j] << ']';
+            os << '[' << c << ',' << data->minute((i + minute_begin) % 60)[j] << ']';
         }
         for (int i = 0; i < 60; ++i, ++c) {
             if (c) {
                 os << ',';
             }
-            os << '[' << c << ',' << this->_data.second((i + second_begin) % 60)[j] << ']';
+            os << '[' << c << ',' << data->second((i + second_begin) % 60)[j] << ']';
         }
         os << "]}";
     }
@@ -19,6 +19,7 @@
 
 #include <gflags/gflags.h>
 #include "butil/unique_ptr.h"
+#include "butil/time.h"
 #include "butil/reloadable_flags.h"
 #include "bvar/latency_recorder.h"
 
@@ -39,11 +40,16 @@ BUTIL_VALIDATE_GFLAG(bvar_latency_p2, valid_percentile);
 DEFINE_int32(bvar_latency_p3, 99, "Third latency percentile");
 BUTIL_VALIDATE_GFLAG(bvar_latency_p3, valid_percentile);
 
+DEFINE_bool(bvar_latency_histogram, false, "LatencyRecorders created "
+            "afterwards compute percentiles with log-linear histograms "
+            "instead of sampling, which is accurate for high percentiles "
+            "but costs about 7KB per recording thread for each recorder");
+
 namespace detail {
 
 typedef PercentileSamples<1022> CombinedPercentileSamples;
 
-CDF::CDF(PercentileWindow* w) : _w(w) {}
+CDF::CDF(PercentileWindow* w, LatencyHistogramWindow* hw) : _w(w), _hw(hw) {}
 
 CDF::~CDF() {
     hide();
@@ -53,30 +59,40 @@ void CDF::describe(std::ostream& os, bool) const {
     os << "\"click to view\"";
 }
 
-int CDF::describe_series(
-    std::ostream& os, const SeriesOptions& options) const {
-    if (_w == NULL) {
-        return 1;
-    }
-    if (options.test_only) {
-        return 0;
+Exemplar::~Exemplar() {
+    hide();
+}
+
+void Exemplar::describe(std::ostream& os, bool quote_string) const {
+    if (quote_string) {
+        os << '"' << _w->get_value() << '"';
+    } else {
+        os << _w->get_value();
     }
-    std::unique_ptr<CombinedPercentileSamples> cb(new CombinedPercentileSamples);
-    std::vector<GlobalPercentileSamples> buckets;
-    _w->get_samples(&buckets);
-    for (size_t i = 0; i < buckets.size(); ++i) {
-        cb->combine_of(buckets.begin(), buckets.end());
+}
+
+std::ostream& operator<<(std::ostream& os, const LatencyExemplar& e) {
+    if (e.trace_id == 0) {
+        return os << 0;
     }
-    std::pair<int, int> values[20];
+    const std::ios::fmtflags old_flags = os.flags();
+    os << e.latency << " trace=" << std::hex << e.trace_id;
+    os.flags(old_flags);
+    return os;
+}
+
+template <typename Samples>
+static void describe_cdf(std::ostream& os, Samples& s) {
+    std::pair<int, int64_t> values[20];
     size_t n = 0;
     for (int i = 1; i < 10; ++i) {
-        values[n++] = std::make_pair(i*10, cb->get_number(i * 0.1));
+        values[n++] = std::make_pair(i*10, (int64_t)s.get_number(i * 0.1));
     }
     for (int i = 91; i < 100; ++i) {
-        values[n++] = std::make_pair(i, cb->get_number(i * 0.01));
+        values[n++] = std::make_pair(i, (int64_t)s.get_number(i * 0.01));
     }
-    values[n++] = std::make_pair(100, cb->get_number(0.999));
-    values[n++] = std::make_pair(101, cb->get_number(0.9999));
+    values[n++] = std::make_pair(100, (int64_t)s.get_number(0.999));
+    values[n++] = std::make_pair(101, (int64_t)s.get_number(0.9999));
     CHECK_EQ(n, arraysize(values));
     os << "{\"label\":\"cdf\",\"data\":[";
     for (size_t i = 0; i < n; ++i) {
@@ -86,6 +102,28 @@ int CDF::describe_series(
         os << '[' << values[i].first << ',' << values[i].second << ']';
     }
     os << "]}";
+}
+
+int CDF::describe_series(
+    std::ostream& os, const SeriesOptions& options) const {
+    if (_w == NULL && _hw == NULL) {
+        return 1;
+    }
+    if (options.test_only) {
+        return 0;
+    }
+    if (_hw != NULL) {
+        const LatencyBuckets b = _hw->get_value();
+        describe_cdf(os, b);
+        return 0;
+    }
+    std::unique_ptr<CombinedPercentileSamples> cb(new CombinedPercentileSamples);
+    std::vector<GlobalPercentileSamples> buckets;
+    _w->get_samples(&buckets);
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        cb->combine_of(buckets.begin(), buckets.end());
+    }
+    describe_cdf(os, *cb);
     return 0;
 }
 
@@ -140,20 +178,32 @@ static int64_t get_p3(void* arg) {
     return lr->latency_percentile(FLAGS_bvar_latency_p3 / 100.0);
 }
 
-static Vector<int64_t, 4> get_latencies(void *arg) {
-    std::unique_ptr<CombinedPercentileSamples> cb(
-        combine((PercentileWindow*)arg));
+template <typename Samples>
+static Vector<int64_t, 4> get_latencies_of(Samples& s) {
     // NOTE: We don't show 99.99% since it's often significantly larger than
     // other values and make other curves on the plotted graph small and
     // hard to read.
     Vector<int64_t, 4> result;
-    result[0] = cb->get_number(FLAGS_bvar_latency_p1 / 100.0);
-    result[1] = cb->get_number(FLAGS_bvar_latency_p2 / 100.0);
-    result[2] = cb->get_number(FLAGS_bvar_latency_p3 / 100.0);
-    result[3] = cb->get_number(0.999);
+    result[0] = s.get_number(FLAGS_bvar_latency_p1 / 100.0);
+    result[1] = s.get_number(FLAGS_bvar_latency_p2 / 100.0);
+    result[2] = s.get_number(FLAGS_bvar_latency_p3 / 100.0);
+    result[3] = s.get_number(0.999);
     return result;
 }
 
+static Vector<int64_t, 4> get_latencies(void *arg) {
+    return static_cast<LatencyRecorder*>(arg)->latency_percentiles();
+}
+
+static LatencyHistogram* new_histogram_if_enabled() {
+    return FLAGS_bvar_latency_histogram ? new LatencyHistogram : NULL;
+}
+
+static LatencyHistogramWindow* new_histogram_window(
+    LatencyHistogram* h, time_t window_size) {
+    return h ? new LatencyHistogramWindow(h, window_size) : NULL;
+}
+
 LatencyRecorderBase::LatencyRecorderBase(time_t window_size)
     : _max_latency(0)
     , _latency_window(&_latency, window_size)
@@ -161,21 +211,31 @@ LatencyRecorderBase::LatencyRecorderBase(time_t window_size)
     , _count(get_recorder_count, &_latency)
     , _qps(get_window_recorder_qps, &_latency_window)
     , _latency_percentile_window(&_latency_percentile, window_size)
+    , _latency_histogram(new_histogram_if_enabled())
+    , _latency_histogram_window(
+        new_histogram_window(_latency_histogram.get(), window_size))
     , _latency_p1(get_p1, this)
     , _latency_p2(get_p2, this)
     , _latency_p3(get_p3, this)
     , _latency_999(get_percetile<999, 1000>, this)
     , _latency_9999(get_percetile<9999, 10000>, this)
-    , _latency_cdf(&_latency_percentile_window)
-    , _latency_percentiles(get_latencies, &_latency_percentile_window)
+    , _latency_cdf(&_latency_percentile_window, _latency_histogram_window.get())
+    , _latency_percentiles(get_latencies, this)
+    , _latency_exemplar_window(&_latency_exemplar, window_size)
+    , _latency_exemplar_var(&_latency_exemplar_window)
 {}
 
 }  // namespace detail
 
 Vector<int64_t, 4> LatencyRecorder::latency_percentiles() const {
+    if (_latency_histogram_window) {
+        const detail::LatencyBuckets b = _latency_histogram_window->get_value();
+        return detail::get_latencies_of(b);
+    }
     // const_cast here is just to adapt parameter type and safe.
-    return detail::get_latencies(
-        const_cast<detail::PercentileWindow*>(&_latency_percentile_window));
+    std::unique_ptr<detail::CombinedPercentileSamples> cb(
+        combine(const_cast<detail::PercentileWindow*>(&_latency_percentile_window)));
+    return detail::get_latencies_of(*cb);
 }
 
 int64_t LatencyRecorder::qps(time_t window_size) const {
@@ -253,6 +313,14 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
     if (_latency_percentiles.expose_as(prefix, "latency_percentiles", DISPLAY_ON_HTML) != 0) {
         return -1;
     }
+    if (_latency_histogram &&
+        _latency_histogram->expose_as(prefix, "latency_histogram",
+                                      DISPLAY_ON_PLAIN_TEXT) != 0) {
+        return -1;
+    }
+    if (_latency_exemplar_var.expose_as(prefix, "latency_exemplar") != 0) {
+        return -1;
+    }
     if (FLAGS_save_series) {
         snprintf(namebuf, sizeof(namebuf), "%d%%,%d%%,%d%%,99.9%%",
                  (int)FLAGS_bvar_latency_p1, (int)FLAGS_bvar_latency_p2,
@@ -263,6 +331,9 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
 }
 
 int64_t LatencyRecorder::latency_percentile(double ratio) const {
+    if (_latency_histogram_window) {
+        return _latency_histogram_window->get_value().get_number(ratio);
+    }
     std::unique_ptr<detail::CombinedPercentileSamples> cb(
         combine((detail::PercentileWindow*)&_latency_percentile_window));
     return cb->get_number(ratio);
@@ -280,15 +351,31 @@ void LatencyRecorder::hide() {
     _latency_9999.hide();
     _latency_cdf.hide();
     _latency_percentiles.hide();
+    _latency_exemplar_var.hide();
+    if (_latency_histogram) {
+        _latency_histogram->hide();
+    }
 }
 
 DEFINE_uint64(latency_scale_factor, 1, "latency scale factor, used by method status, etc., latency_us = latency * latency_scale_factor");
 
 LatencyRecorder& LatencyRecorder::operator<<(int64_t latency) {
+    return record(latency, 0);
+}
+
+LatencyRecorder& LatencyRecorder::record(int64_t latency, uint64_t trace_id) {
     latency = latency / FLAGS_latency_scale_factor;
     _latency << latency;
     _max_latency << latency;
-    _latency_percentile << latency;
+    if (_latency_histogram) {
+        *_latency_histogram << latency;
+    } else {
+        _latency_percentile << latency;
+    }
+    if (trace_id != 0) {
+        _latency_exemplar << detail::LatencyExemplar(
+            latency, trace_id, butil::gettimeofday_us());
+    }
     return *this;
 }
 
@@ -24,6 +24,9 @@
 #include "bvar/reducer.h"
 #include "bvar/passive_status.h"
 #include "bvar/detail/percentile.h"
+#include "bvar/detail/latency_histogram.h"
+#include "bvar/detail/latency_exemplar.h"
+#include "butil/unique_ptr.h"
 
 namespace bvar {
 namespace detail {
@@ -37,12 +40,24 @@ typedef Window<Percentile, SERIES_IN_SECOND> PercentileWindow;
 
 class CDF : public Variable {
 public:
-    explicit CDF(PercentileWindow* w);
+    // `hw' is used instead of `w' when it's not NULL.
+    explicit CDF(PercentileWindow* w, LatencyHistogramWindow* hw = NULL);
     ~CDF() override;
     void describe(std::ostream& os, bool quote_string) const override;
     int describe_series(std::ostream& os, const SeriesOptions& options) const override;
 private:
     PercentileWindow* _w; 
+    LatencyHistogramWindow* _hw;
+};
+
+// Shows the slowest traced latency in the window.
+class Exemplar : public Variable {
+public:
+    explicit Exemplar(LatencyExemplarWindow* w) : _w(w) {}
+    ~Exemplar() override;
+    void describe(std::ostream& os, bool quote_string) const override;
+private:
+    LatencyExemplarWindow* _w;
 };
 
 // For mimic constructor inheritance.
@@ -60,6 +75,10 @@ protected:
     PassiveStatus<int64_t> _count;
     PassiveStatus<int64_t> _qps;
     PercentileWindow _latency_percentile_window;
+    // Created when -bvar_latency_histogram is on, percentiles are computed
+    // from the histogram rather than _latency_percentile then.
+    std::unique_ptr<LatencyHistogram> _latency_histogram;
+    std::unique_ptr<LatencyHistogramWindow> _latency_histogram_window;
     PassiveStatus<int64_t> _latency_p1;
     PassiveStatus<int64_t> _latency_p2;
     PassiveStatus<int64_t> _latency_p3;
@@ -67,6 +86,9 @@ protected:
     PassiveStatus<int64_t> _latency_9999; // 99.99%
     CDF _latency_cdf;
     PassiveStatus<Vector<int64_t, 4> > _latency_percentiles;
+    LatencyExemplarReducer _latency_exemplar;
+    LatencyExemplarWindow _latency_exemplar_window;
+    Exemplar _latency_exemplar_var;
 };
 } // namespace detail
 
@@ -98,6 +120,11 @@ public:
 
     // Record the latency.
     LatencyRecorder& operator<<(int64_t latency);
+
+    // Record the latency taken by the request traced by `trace_id' (e.g.
+    // trace id of the rpcz span). The slowest traced request in the window
+    // is kept as the exemplar. Same as operator<< if `trace_id' is 0.
+    LatencyRecorder& record(int64_t latency, uint64_t trace_id);
         
     // Expose all internal variables using `prefix' as prefix.
     // Returns 0 on success, -1 otherwise.
@@ -111,6 +138,10 @@ public:
     //                                    // foo_bar_read_max_latency
     //                                    // foo_bar_read_count
     //                                    // foo_bar_read_qps
+    // With -bvar_latency_histogram, buckets of the histogram are exposed as
+    // foo_bar_read_latency_histogram as well, which is dumped as a histogram
+    // to Prometheus. Exemplar recorded by record() is exposed as
+    // foo_bar_read_latency_exemplar.
     int expose(const butil::StringPiece& prefix) {
         return expose(butil::StringPiece(), prefix);
     }
@@ -133,6 +164,11 @@ public:
     // Get the max latency in recent window_size-to-ctor seconds.
     int64_t max_latency() const { return _max_latency_window.get_value(); }
 
+    // Get the slowest traced latency in recent window_size-to-ctor seconds,
+    // trace_id of the result is 0 if no latency was recorded with a trace.
+    detail::LatencyExemplar latency_exemplar() const
+    { return _latency_exemplar_window.get_value(); }
+
     // Get the total number of recorded latencies.
     int64_t count() const { return _latency.get_value().num; }
 
@@ -153,6 +189,8 @@ public:
     const std::string& latency_cdf_name() const { return _latency_cdf.name(); }
     const std::string& max_latency_name() const
     { return _max_latency_window.name(); }
+    const std::string& latency_exemplar_name() const
+    { return _latency_exemplar_var.name(); }
     const std::string& count_name() const { return _count.name(); }
     const std::string& qps_name() const { return _qps.name(); }
 };
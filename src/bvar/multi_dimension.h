@@ -22,6 +22,8 @@
 
 #include <memory>
 #include <type_traits>
+#include "butil/atomicops.h"                         // butil::atomic
+#include "butil/compiler_specific.h"                 // BAIDU_LIKELY
 #include "butil/logging.h"                           // LOG
 #include "butil/macros.h"                            // BAIDU_CASSERT
 #include "butil/scoped_lock.h"                       // BAIDU_SCOPE_LOCK
@@ -81,9 +83,45 @@ public:
     typedef butil::FlatMap<key_type, op_value_type, KeyHash, KeyEqualTo> MetricMap;
 
     typedef typename MetricMap::const_iterator MetricMapConstIterator;
-    typedef butil::DoublyBufferedData<MetricMap> MetricMapDBD;
+    // Lookups are far more frequent than insertions, read the map in
+    // versioned mode so that readers never lock.
+    typedef butil::DoublyBufferedData<MetricMap, butil::Void, false, true> MetricMapDBD;
     typedef typename MetricMapDBD::ScopedPtr MetricMapScopedPtr;
     
+    // A label tuple resolved once by get_handle(), e.g. per method or per
+    // peer. get() returns the stats with one atomic load while no stats of
+    // the MultiDimension were deleted since resolution, and looks the labels
+    // up again otherwise (call get_handle() again to make it fast again).
+    // A handle is immutable and can be shared by threads, but it must not
+    // outlive the MultiDimension.
+    class Handle {
+    public:
+        Handle() : _owner(NULL), _generation(0), _stats() {}
+
+        // NULL if the handle is not resolved or the stats can't be created.
+        value_ptr_type get() const {
+            if (BAIDU_UNLIKELY(_owner == NULL)) {
+                return value_ptr_type();
+            }
+            if (BAIDU_LIKELY(_generation ==
+                             _owner->_generation.load(butil::memory_order_acquire))) {
+                return _stats;
+            }
+            return _owner->get_stats(_labels);
+        }
+
+        // The handle must be resolved successfully.
+        value_ptr_type operator->() const { return get(); }
+        T& operator*() const { return *get(); }
+
+    private:
+    friend class MultiDimension;
+        MultiDimension* _owner;
+        key_type _labels;
+        uint64_t _generation;
+        value_ptr_type _stats;
+    };
+
     explicit MultiDimension(const key_type& labels);
     
     MultiDimension(const butil::StringPiece& name,
@@ -113,11 +151,18 @@ public:
     // 3. K::value_type must be able to compare with std::string.
     //
     // Returns a shared_ptr if `Shared' is true, otherwise returns a raw pointer.
+    // Lookups with K = std::array<butil::StringPiece, N> don't allocate
+    // memory unless the stats are created.
     template <typename K = key_type>
     value_ptr_type get_stats(const K& labels_value) {
         return get_stats_impl(labels_value, READ_OR_INSERT);
     }
 
+    // Resolve `labels_value' into a Handle, creating the stats if needed.
+    // Requirements of K are same with get_stats().
+    template <typename K = key_type>
+    Handle get_handle(const K& labels_value);
+
     // `delete_stats' and `clear_stats' are thread safe
     // if `Shared' is true, otherwise not.
     // Remove stat so those not count and dump
@@ -226,6 +271,8 @@ private:
 
     size_t _max_stats_count;
     MetricMapDBD _metric_map;
+    // Increased before any stats is deleted, which invalidates Handles.
+    butil::atomic<uint64_t> _generation;
 };
 
 } // namespace bvar
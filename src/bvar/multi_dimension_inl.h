@@ -38,7 +38,8 @@ static const std::string ALLOW_UNUSED METRIC_TYPE_GAUGE = "gauge";
 template <typename T, typename KeyType, bool Shared>
 MultiDimension<T, KeyType, Shared>::MultiDimension(const key_type& labels)
     : Base(labels)
-    , _max_stats_count(FLAGS_max_multi_dimension_stats_count) {
+    , _max_stats_count(FLAGS_max_multi_dimension_stats_count)
+    , _generation(0) {
     _metric_map.Modify(init_flatmap);
 }
 
@@ -89,7 +90,9 @@ void MultiDimension<T, KeyType, Shared>::delete_stats(const K& labels_value) {
         // second copy into tmp_metric, which can prevent the bvar object
         // from being deleted twice.
         op_value_type tmp_metric = NULL;
-        auto erase_fn = [&labels_value, &tmp_metric](MetricMap& bg) {
+        auto erase_fn = [this, &labels_value, &tmp_metric](MetricMap& bg) {
+            // Invalidate handles before the stats is deleted.
+            _generation.fetch_add(1, butil::memory_order_release);
             return bg.erase(labels_value, &tmp_metric);
         };
         _metric_map.Modify(erase_fn);
@@ -107,7 +110,8 @@ void MultiDimension<T, KeyType, Shared>::delete_stats() {
     // which can prevent the bvar object from being deleted twice.
     MetricMap tmp_map;
     CHECK_EQ(0, tmp_map.init(8192, 80));
-    auto clear_fn = [&tmp_map](MetricMap& map) -> size_t {
+    auto clear_fn = [this, &tmp_map](MetricMap& map) -> size_t {
+        _generation.fetch_add(1, butil::memory_order_release);
         if (!tmp_map.empty()) {
             tmp_map.clear();
         }
@@ -211,6 +215,23 @@ MultiDimension<T, KeyType, Shared>::get_stats_impl(
     return cache_metric;
 }
 
+template <typename T, typename KeyType, bool Shared>
+template <typename K>
+typename MultiDimension<T, KeyType, Shared>::Handle
+MultiDimension<T, KeyType, Shared>::get_handle(const K& labels_value) {
+    Handle h;
+    // Read generation before the lookup, so that stats deleted during the
+    // lookup are noticed by Handle::get().
+    h._generation = _generation.load(butil::memory_order_acquire);
+    h._stats = get_stats_impl(labels_value, READ_OR_INSERT);
+    if (NULL == h._stats) {
+        return Handle();
+    }
+    h._owner = this;
+    h._labels = key_type(labels_value.cbegin(), labels_value.cend());
+    return h;
+}
+
 template <typename T, typename KeyType, bool Shared>
 void MultiDimension<T, KeyType, Shared>::clear_stats() {
     delete_stats();
@@ -27,6 +27,7 @@
 #include "butil/reloadable_flags.h"
 #include "bvar/variable.h"
 #include "bvar/mvariable.h"
+#include "bvar/detail/wildcard_matcher.h"
 
 namespace bvar {
 
@@ -249,10 +250,19 @@ size_t MVariableBase::dump_exposed(Dumper* dumper, const DumpOptions* options) {
     if (options) {
         opt = *options;
     }
+    // Filter by names of mvars, so that stats of skipped mvars are never
+    // described.
+    detail::WildcardMatcher black_matcher(opt.black_wildcards,
+                                          opt.question_mark, false);
+    detail::WildcardMatcher white_matcher(opt.white_wildcards,
+                                          opt.question_mark, true);
     std::vector<std::string> mvars;
     list_exposed(&mvars);
     size_t n = 0;
     for (auto& mvar : mvars) {
+        if (!white_matcher.match(mvar) || black_matcher.match(mvar)) {
+            continue;
+        }
         MVarMapWithLock& m = get_mvar_map();
         BAIDU_SCOPED_LOCK(m.mutex);
         MVarEntry* entry = m.seek(mvar);
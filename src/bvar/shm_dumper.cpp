@@ -0,0 +1,317 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <fcntl.h>                              // O_CREAT
+#include <sys/mman.h>                           // shm_open
+#include <sys/stat.h>                           // fstat
+#include <unistd.h>                             // ftruncate
+#include <pthread.h>
+#include <gflags/gflags.h>
+#include "butil/atomicops.h"
+#include "butil/errno.h"                         // berror
+#include "butil/logging.h"
+#include "butil/time.h"
+#include "butil/threading/platform_thread.h"
+#include "butil/reloadable_flags.h"
+#include "bvar/shm_dumper.h"
+
+namespace bvar {
+
+DEFINE_bool(bvar_dump_shm, false,
+            "Create a background thread writing all bvar into shared memory "
+            "-bvar_dump_shm_name periodically");
+DEFINE_string(bvar_dump_shm_name, "/bvar.<app>.<pid>",
+              "Name of the shared memory(as in shm_open) that bvar are "
+              "written into, <app> and <pid> are replaced with the program "
+              "name and the process id");
+DEFINE_int32(bvar_dump_shm_interval_ms, 1000,
+             "Milliseconds between consecutive writes into shared memory");
+DEFINE_int32(bvar_dump_shm_max_vars, 8192,
+             "Max number of bvar in the shared memory, read when the shared "
+             "memory is created");
+BUTIL_VALIDATE_GFLAG(bvar_dump_shm_interval_ms, butil::PositiveInteger);
+BUTIL_VALIDATE_GFLAG(bvar_dump_shm_max_vars, butil::PositiveInteger);
+
+static const char SHM_MAGIC[8] = "BVARSHM";
+
+// Defined in variable.cpp
+std::string read_command_name();
+
+inline butil::atomic<uint32_t>* as_atomic(uint32_t* p) {
+    return reinterpret_cast<butil::atomic<uint32_t>*>(p);
+}
+
+inline butil::atomic<int32_t>* as_atomic(int32_t* p) {
+    return reinterpret_cast<butil::atomic<int32_t>*>(p);
+}
+
+ShmDumper::ShmDumper()
+    : _header(NULL)
+    , _entries(NULL)
+    , _mapped_size(0) {}
+
+ShmDumper::~ShmDumper() {
+    close();
+}
+
+void ShmDumper::close() {
+    if (_header != NULL) {
+        munmap(_header, _mapped_size);
+        shm_unlink(_shm_name.c_str());
+        _header = NULL;
+        _entries = NULL;
+        _mapped_size = 0;
+    }
+    _index.clear();
+    _dumped.clear();
+}
+
+int ShmDumper::open(const std::string& shm_name, uint32_t capacity) {
+    close();
+    if (_index.init(capacity) != 0) {
+        LOG(ERROR) << "Fail to init index";
+        return -1;
+    }
+    const size_t size = sizeof(ShmHeader) + sizeof(ShmEntry) * capacity;
+    // Remove the segment left by a previous process with the same pid, or
+    // a reader may see a mix of both.
+    shm_unlink(shm_name.c_str());
+    const int fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        PLOG(ERROR) << "Fail to create shared memory " << shm_name;
+        return -1;
+    }
+    if (ftruncate(fd, size) != 0) {
+        PLOG(ERROR) << "Fail to resize shared memory " << shm_name;
+        ::close(fd);
+        shm_unlink(shm_name.c_str());
+        return -1;
+    }
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        PLOG(ERROR) << "Fail to map shared memory " << shm_name;
+        shm_unlink(shm_name.c_str());
+        return -1;
+    }
+    // The memory is zeroed by ftruncate.
+    _shm_name = shm_name;
+    _header = static_cast<ShmHeader*>(mem);
+    _entries = reinterpret_cast<ShmEntry*>(_header + 1);
+    _mapped_size = size;
+    memcpy(_header->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+    _header->version = BVAR_SHM_VERSION;
+    _header->header_size = sizeof(ShmHeader);
+    _header->entry_size = sizeof(ShmEntry);
+    _header->capacity = capacity;
+    _header->pid = getpid();
+    return 0;
+}
+
+void ShmDumper::begin() {
+    _dumped.assign(_dumped.size(), false);
+}
+
+void ShmDumper::end() {
+    for (size_t i = 0; i < _dumped.size(); ++i) {
+        if (!_dumped[i] && _entries[i].value_size >= 0) {
+            write_value(&_entries[i], NULL, -1);
+        }
+    }
+    if (_header != NULL) {
+        _header->update_time_us = butil::gettimeofday_us();
+    }
+}
+
+void ShmDumper::write_value(ShmEntry* e, const char* data, int32_t size) {
+    butil::atomic<uint32_t>* seq = as_atomic(&e->seq);
+    const uint32_t s = seq->load(butil::memory_order_relaxed);
+    seq->store(s + 1, butil::memory_order_relaxed);
+    butil::atomic_thread_fence(butil::memory_order_release);
+    if (size > 0) {
+        memcpy(e->value, data, size);
+    }
+    as_atomic(&e->value_size)->store(size, butil::memory_order_relaxed);
+    seq->store(s + 2, butil::memory_order_release);
+}
+
+bool ShmDumper::dump(const std::string& name,
+                     const butil::StringPiece& description) {
+    if (_header == NULL || name.size() >= BVAR_SHM_NAME_SIZE) {
+        return true;
+    }
+    uint32_t* pindex = _index.seek(name);
+    uint32_t index = 0;
+    if (pindex != NULL) {
+        index = *pindex;
+    } else {
+        if (_dumped.size() >= _header->capacity) {
+            LOG_EVERY_SECOND(WARNING) << "Shared memory " << _shm_name
+                                      << " is full, capacity="
+                                      << _header->capacity;
+            return true;
+        }
+        index = _dumped.size();
+        ShmEntry* e = &_entries[index];
+        e->value_size = -1;
+        memcpy(e->name, name.c_str(), name.size() + 1);
+        // Publish the name.
+        as_atomic(&_header->nentry)->store(index + 1,
+                                           butil::memory_order_release);
+        _index[name] = index;
+        _dumped.push_back(false);
+    }
+    _dumped[index] = true;
+    const size_t size = std::min(description.size(), BVAR_SHM_VALUE_SIZE);
+    write_value(&_entries[index], description.data(), size);
+    return true;
+}
+
+int read_shm_vars(const std::string& shm_name,
+                  std::vector<std::pair<std::string, std::string> >* vars) {
+    vars->clear();
+    const int fd = shm_open(shm_name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmHeader)) {
+        ::close(fd);
+        return -1;
+    }
+    const size_t size = st.st_size;
+    void* mem = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        return -1;
+    }
+    const ShmHeader* h = static_cast<const ShmHeader*>(mem);
+    if (memcmp(h->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0 ||
+        h->version != BVAR_SHM_VERSION ||
+        h->header_size != sizeof(ShmHeader) ||
+        h->entry_size != sizeof(ShmEntry) ||
+        size < sizeof(ShmHeader) + sizeof(ShmEntry) * h->capacity) {
+        munmap(mem, size);
+        return -1;
+    }
+    const uint32_t n = std::min(
+        as_atomic(const_cast<uint32_t*>(&h->nentry))->load(
+            butil::memory_order_acquire),
+        h->capacity);
+    const ShmEntry* entries = reinterpret_cast<const ShmEntry*>(h + 1);
+    char value[BVAR_SHM_VALUE_SIZE];
+    for (uint32_t i = 0; i < n; ++i) {
+        ShmEntry* e = const_cast<ShmEntry*>(&entries[i]);
+        butil::atomic<uint32_t>* seq = as_atomic(&e->seq);
+        int32_t value_size = -1;
+        while (true) {
+            const uint32_t s1 = seq->load(butil::memory_order_acquire);
+            if (s1 & 1) {
+                sched_yield();
+                continue;
+            }
+            value_size = as_atomic(&e->value_size)->load(
+                butil::memory_order_relaxed);
+            if (value_size > (int32_t)BVAR_SHM_VALUE_SIZE) {
+                value_size = -1;
+            }
+            if (value_size > 0) {
+                memcpy(value, e->value, value_size);
+            }
+            butil::atomic_thread_fence(butil::memory_order_acquire);
+            if (seq->load(butil::memory_order_relaxed) == s1) {
+                break;
+            }
+        }
+        if (value_size >= 0) {
+            vars->push_back(std::make_pair(
+                std::string(e->name, strnlen(e->name, BVAR_SHM_NAME_SIZE)),
+                std::string(value, value_size)));
+        }
+    }
+    munmap(mem, size);
+    return 0;
+}
+
+// The background thread writing all bvar into shared memory periodically.
+static void* shm_dumping_thread(void*) {
+    butil::PlatformThread::SetNameSimple("bvar_shm_dumper");
+    const std::string command_name = read_command_name();
+    char pid[16];
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    ShmDumper dumper;
+    std::string last_name;
+    while (true) {
+        if (FLAGS_bvar_dump_shm) {
+            // We can't access string flags directly because it's
+            // thread-unsafe.
+            std::string name;
+            if (!GFLAGS_NAMESPACE::GetCommandLineOption("bvar_dump_shm_name",
+                                                        &name)) {
+                LOG(ERROR) << "Fail to get gflag bvar_dump_shm_name";
+                return NULL;
+            }
+            size_t pos = name.find("<app>");
+            if (pos != std::string::npos) {
+                name.replace(pos, 5/*<app>*/, command_name);
+            }
+            pos = name.find("<pid>");
+            if (pos != std::string::npos) {
+                name.replace(pos, 5/*<pid>*/, pid);
+            }
+            if (name != last_name) {
+                last_name = name;
+                if (dumper.open(name, FLAGS_bvar_dump_shm_max_vars) == 0) {
+                    LOG(INFO) << "Write all bvar to shared memory " << name
+                              << " every " << FLAGS_bvar_dump_shm_interval_ms
+                              << " milliseconds.";
+                }
+            }
+            dumper.begin();
+            Variable::dump_exposed(&dumper, NULL);
+            dumper.end();
+        }
+        usleep(FLAGS_bvar_dump_shm_interval_ms * 1000L);
+    }
+    return NULL;
+}
+
+static pthread_once_t shm_dumping_thread_once = PTHREAD_ONCE_INIT;
+static bool created_shm_dumping_thread = false;
+
+static void launch_shm_dumping_thread() {
+    pthread_t thread_id;
+    const int rc = pthread_create(&thread_id, NULL, shm_dumping_thread, NULL);
+    if (rc != 0) {
+        LOG(FATAL) << "Fail to launch shm dumping thread: " << berror(rc);
+        return;
+    }
+    // Detach the thread because no one would join it.
+    CHECK_EQ(0, pthread_detach(thread_id));
+    created_shm_dumping_thread = true;
+}
+
+static bool validate_bvar_dump_shm(const char*, bool enabled) {
+    if (enabled) {
+        pthread_once(&shm_dumping_thread_once, launch_shm_dumping_thread);
+        return created_shm_dumping_thread;
+    }
+    return true;
+}
+BUTIL_VALIDATE_GFLAG(bvar_dump_shm, validate_bvar_dump_shm);
+
+}  // namespace bvar
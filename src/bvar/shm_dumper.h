@@ -0,0 +1,110 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BVAR_SHM_DUMPER_H
+#define BVAR_SHM_DUMPER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <utility>                     // std::pair
+#include "butil/macros.h"
+#include "butil/containers/flat_map.h"
+#include "bvar/variable.h"
+
+namespace bvar {
+
+// With -bvar_dump_shm, a background thread writes all exposed variables
+// into a POSIX shared memory segment every -bvar_dump_shm_interval_ms, so
+// that local agents can read them at any frequency without asking the
+// process to format /vars. The segment has a stable binary layout:
+//
+//   ShmHeader | ShmEntry[capacity]
+//
+// Entries in [0, ShmHeader.nentry) have names, which never change once
+// written. Values of the entries are protected by per-entry seqlocks:
+// `seq' is odd while the value is being written. Readers should retry
+// when `seq' is odd or changed after copying the value, as in
+// read_shm_vars(). All integers are in native byte order.
+
+static const uint32_t BVAR_SHM_VERSION = 1;
+static const size_t BVAR_SHM_NAME_SIZE = 128;
+static const size_t BVAR_SHM_VALUE_SIZE = 256;
+
+struct ShmHeader {
+    char magic[8];                  // "BVARSHM\0"
+    uint32_t version;               // BVAR_SHM_VERSION
+    uint32_t header_size;           // sizeof(ShmHeader)
+    uint32_t entry_size;            // sizeof(ShmEntry)
+    uint32_t capacity;              // Max number of entries
+    uint32_t nentry;                // Number of named entries
+    uint32_t reserved;
+    int64_t pid;                    // Process writing the segment
+    int64_t update_time_us;         // Wall time of last update
+};
+
+struct ShmEntry {
+    uint32_t seq;
+    // Length of `value', -1 if the variable is hidden currently.
+    int32_t value_size;
+    // '\0'-terminated, longer names are not written.
+    char name[BVAR_SHM_NAME_SIZE];
+    // Not '\0'-terminated, longer values are truncated.
+    char value[BVAR_SHM_VALUE_SIZE];
+};
+
+// Write variables into a shared memory segment.
+class ShmDumper : public Dumper {
+public:
+    ShmDumper();
+    ~ShmDumper();
+
+    // (Re)create shared memory `shm_name' (as in shm_open) with room for
+    // `capacity' variables. Returns 0 on success, -1 otherwise.
+    int open(const std::string& shm_name, uint32_t capacity);
+
+    // Call begin() and end() around Variable::dump_exposed(), variables
+    // not dumped in between are marked as hidden.
+    void begin();
+    void end();
+
+    bool dump(const std::string& name,
+              const butil::StringPiece& description);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ShmDumper);
+    void close();
+    void write_value(ShmEntry* e, const char* data, int32_t size);
+
+    std::string _shm_name;
+    ShmHeader* _header;
+    ShmEntry* _entries;
+    size_t _mapped_size;
+    // Index of entries by names.
+    butil::FlatMap<std::string, uint32_t> _index;
+    // Whether the entry is dumped since last begin().
+    std::vector<bool> _dumped;
+};
+
+// Read all visible variables from shared memory `shm_name'.
+// Returns 0 on success, -1 otherwise.
+int read_shm_vars(const std::string& shm_name,
+                  std::vector<std::pair<std::string, std::string> >* vars);
+
+}  // namespace bvar
+
+#endif  // BVAR_SHM_DUMPER_H
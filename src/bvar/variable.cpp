@@ -34,9 +34,12 @@
 #include "bvar/gflag.h"
 #include "bvar/variable.h"
 #include "bvar/mvariable.h"
+#include "bvar/detail/wildcard_matcher.h"
 
 namespace bvar {
 
+using detail::WildcardMatcher;
+
 DEFINE_bool(save_series, true,
             "Save values of last 60 seconds, last 60 minutes,"
             " last 24 hours and last 30 days for plotting");
@@ -367,94 +370,6 @@ void CharArrayStreamBuf::reset() {
 }
 
 
-// Written by Jack Handy
-// <A href="mailto:jakkhandy@hotmail.com">jakkhandy@hotmail.com</A>
-inline bool wildcmp(const char* wild, const char* str, char question_mark) {
-    const char* cp = NULL;
-    const char* mp = NULL;
-
-    while (*str && *wild != '*') {
-        if (*wild != *str && *wild != question_mark) {
-            return false;
-        }
-        ++wild;
-        ++str;
-    }
-
-    while (*str) {
-        if (*wild == '*') {
-            if (!*++wild) {
-                return true;
-            }
-            mp = wild;
-            cp = str+1;
-        } else if (*wild == *str || *wild == question_mark) {
-            ++wild;
-            ++str;
-        } else {
-            wild = mp;
-            str = cp++;
-        }
-    }
-
-    while (*wild == '*') {
-        ++wild;
-    }
-    return !*wild;
-}
-
-class WildcardMatcher {
-public:
-    WildcardMatcher(const std::string& wildcards,
-                    char question_mark,
-                    bool on_both_empty)
-        : _question_mark(question_mark)
-        , _on_both_empty(on_both_empty) {
-        if (wildcards.empty()) {
-            return;
-        }
-        std::string name;
-        const char wc_pattern[3] = { '*', question_mark, '\0' };
-        for (butil::StringMultiSplitter sp(wildcards.c_str(), ",;");
-             sp != NULL; ++sp) {
-            name.assign(sp.field(), sp.length());
-            if (name.find_first_of(wc_pattern) != std::string::npos) {
-                if (_wcs.empty()) {
-                    _wcs.reserve(8);
-                }
-                _wcs.push_back(name);
-            } else {
-                _exact.insert(name);
-            }
-        }
-    }
-    
-    bool match(const std::string& name) const {
-        if (!_exact.empty()) {
-            if (_exact.find(name) != _exact.end()) {
-                return true;
-            }
-        } else if (_wcs.empty()) {
-            return _on_both_empty;
-        }
-        for (size_t i = 0; i < _wcs.size(); ++i) {
-            if (wildcmp(_wcs[i].c_str(), name.c_str(), _question_mark)) {
-                return true;
-            }
-        }
-        return false;
-    }
-
-    const std::vector<std::string>& wildcards() const { return _wcs; }
-    const std::set<std::string>& exact_names() const { return _exact; }
-
-private:
-    char _question_mark;
-    bool _on_both_empty;
-    std::vector<std::string> _wcs;
-    std::set<std::string> _exact;
-};
-
 DumpOptions::DumpOptions()
     : quote_string(true)
     , question_mark('?')
@@ -833,7 +748,8 @@ static void* dumping_thread(void*) {
             } else if ("prometheus" == mbvar_format) {
                 dumper = new PrometheusFileDumper(mbvar_filename, mbvar_prefix);
             }
-            int nline = MVariableBase::dump_exposed(dumper, &options);
+            // -bvar_dump_include/exclude are for bvars only.
+            int nline = MVariableBase::dump_exposed(dumper, NULL);
             if (nline < 0) {
                 LOG(ERROR) << "Fail to dump mvars into " << filename;
             }
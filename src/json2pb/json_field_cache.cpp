@@ -0,0 +1,76 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#include <map>
+#include <unordered_map>
+#include "butil/scoped_lock.h"
+#include "butil/synchronization/lock.h"
+#include "butil/thread_local.h"
+#include "json2pb/encode_decode.h"
+#include "json2pb/protobuf_map.h"
+#include "json2pb/json_field_cache.h"
+
+namespace json2pb {
+
+static JsonFieldCache* NewJsonFieldCache(const google::protobuf::Descriptor* d) {
+    JsonFieldCache* cache = new JsonFieldCache;
+    if (cache->index.init(std::max(d->field_count() * 2, 8)) != 0) {
+        delete cache;
+        return NULL;
+    }
+    cache->names.resize(d->field_count());
+    cache->is_map.resize(d->field_count());
+    for (int i = 0; i < d->field_count(); ++i) {
+        const google::protobuf::FieldDescriptor* field = d->field(i);
+        if (!decode_name(field->name(), cache->names[i])) {
+            cache->names[i] = field->name();
+        }
+        cache->is_map[i] = IsProtobufMap(field);
+        if (cache->index.seek(cache->names[i]) == NULL) {
+            cache->index[cache->names[i]] = i;
+        }
+    }
+    return cache;
+}
+
+const JsonFieldCache* GetJsonFieldCache(const google::protobuf::Descriptor* d) {
+    if (d->file()->pool() != google::protobuf::DescriptorPool::generated_pool()) {
+        return NULL;
+    }
+    typedef std::unordered_map<const google::protobuf::Descriptor*,
+                               const JsonFieldCache*> LocalCaches;
+    LocalCaches* local = butil::get_thread_local<LocalCaches>();
+    LocalCaches::const_iterator it = local->find(d);
+    if (it != local->end()) {
+        return it->second;
+    }
+    static butil::Mutex* s_mutex = new butil::Mutex;
+    static std::map<const google::protobuf::Descriptor*, JsonFieldCache*>*
+        s_caches = new std::map<const google::protobuf::Descriptor*, JsonFieldCache*>;
+    JsonFieldCache* cache = NULL;
+    {
+        BAIDU_SCOPED_LOCK(*s_mutex);
+        JsonFieldCache*& slot = (*s_caches)[d];
+        if (slot == NULL) {
+            slot = NewJsonFieldCache(d);
+        }
+        cache = slot;
+    }
+    (*local)[d] = cache;
+    return cache;
+}
+
+} // namespace json2pb
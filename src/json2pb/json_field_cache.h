@@ -0,0 +1,45 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#ifndef BRPC_JSON2PB_JSON_FIELD_CACHE_H
+#define BRPC_JSON2PB_JSON_FIELD_CACHE_H
+
+#include <string>
+#include <vector>
+#include <google/protobuf/descriptor.h>
+#include "butil/containers/flat_map.h"
+
+namespace json2pb {
+
+// What json2pb needs to know about regular fields of a message type, built
+// once per descriptor instead of decoding names, searching json objects and
+// checking map types for every field of every message.
+struct JsonFieldCache {
+    // Name in json of descriptor->field(i).
+    std::vector<std::string> names;
+    // Whether descriptor->field(i) is a convertable map, see IsProtobufMap().
+    std::vector<bool> is_map;
+    // Name in json => index of the regular field.
+    butil::FlatMap<std::string, int> index;
+};
+
+// Get the cache of `d', built on first use. Returns NULL if `d' is not from
+// the generated pool: such descriptors may be destroyed, they're not cached.
+const JsonFieldCache* GetJsonFieldCache(const google::protobuf::Descriptor* d);
+
+} // namespace json2pb
+
+#endif // BRPC_JSON2PB_JSON_FIELD_CACHE_H
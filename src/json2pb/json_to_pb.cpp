@@ -16,7 +16,6 @@
 // under the License.
 
 #include <vector>
-#include <map>
 #include <string>
 #include <sstream>
 #include <sys/time.h>
@@ -34,6 +33,7 @@
 #include "json2pb/zero_copy_stream_reader.h"       // ZeroCopyStreamReader
 #include "json2pb/encode_decode.h"
 #include "json2pb/protobuf_map.h"
+#include "json2pb/json_field_cache.h"
 #include "json2pb/rapidjson.h"
 #include "json2pb/protobuf_type_resolver.h"
 #include "butil/base64.h"
@@ -530,6 +530,31 @@ bool JsonMapToProtoMap(const BUTIL_RAPIDJSON_NAMESPACE::Value& value,
     return true;
 }
 
+static const BUTIL_RAPIDJSON_NAMESPACE::Value*
+FindJsonMember(const BUTIL_RAPIDJSON_NAMESPACE::Value& json_value,
+               const google::protobuf::FieldDescriptor* field,
+               std::string* field_name_str_temp) {
+    const std::string& orig_name = field->name();
+    bool res = decode_name(orig_name, *field_name_str_temp); 
+    const std::string& field_name_str = (res ? *field_name_str_temp : orig_name);
+
+#ifndef RAPIDJSON_VERSION_0_1
+    BUTIL_RAPIDJSON_NAMESPACE::Value::ConstMemberIterator member =
+            json_value.FindMember(field_name_str.data());
+    if (member == json_value.MemberEnd()) {
+        return NULL;
+    }
+    return &(member->value);
+#else 
+    const BUTIL_RAPIDJSON_NAMESPACE::Value::Member* member =
+            json_value.FindMember(field_name_str.data());
+    if (member == NULL) {
+        return NULL;
+    }
+    return &(member->value);
+#endif
+}
+
 bool JsonValueToProtoMessage(const BUTIL_RAPIDJSON_NAMESPACE::Value& json_value,
                              google::protobuf::Message* message,
                              const Json2PbOptions& options,
@@ -579,40 +604,47 @@ bool JsonValueToProtoMessage(const BUTIL_RAPIDJSON_NAMESPACE::Value& json_value,
         return false;
     }
 
+    // Find values of regular fields in one pass over members. The first
+    // member wins if names are duplicated, as FindMember() does.
+    const JsonFieldCache* cache = GetJsonFieldCache(descriptor);
+    const size_t nextension = fields.size() - descriptor->field_count();
+    DEFINE_SMALL_ARRAY(const BUTIL_RAPIDJSON_NAMESPACE::Value*, values,
+                       descriptor->field_count(), 64);
+    if (cache != NULL) {
+        for (int i = 0; i < descriptor->field_count(); ++i) {
+            values[i] = NULL;
+        }
+        for (BUTIL_RAPIDJSON_NAMESPACE::Value::ConstMemberIterator it =
+                 json_value.MemberBegin(); it != json_value.MemberEnd(); ++it) {
+            const int* pi = cache->index.seek(butil::StringPiece(
+                it->name.GetString(), it->name.GetStringLength()));
+            if (pi != NULL && values[*pi] == NULL) {
+                values[*pi] = &it->value;
+            }
+        }
+    }
+
     std::string field_name_str_temp; 
     const BUTIL_RAPIDJSON_NAMESPACE::Value* value_ptr = NULL;
     for (size_t i = 0; i < fields.size(); ++i) {
         const google::protobuf::FieldDescriptor* field = fields[i];
-        
-        const std::string& orig_name = field->name();
-        bool res = decode_name(orig_name, field_name_str_temp); 
-        const std::string& field_name_str = (res ? field_name_str_temp : orig_name);
-
-#ifndef RAPIDJSON_VERSION_0_1
-        BUTIL_RAPIDJSON_NAMESPACE::Value::ConstMemberIterator member =
-                json_value.FindMember(field_name_str.data());
-        if (member == json_value.MemberEnd()) {
-            if (field->is_required()) {
-                J2PERROR(err, "Missing required field: %s", field->full_name().c_str());
-                return false;
-            }
-            continue; 
+        bool is_map = false;
+        if (cache != NULL && i >= nextension) {
+            value_ptr = values[i - nextension];
+            is_map = cache->is_map[i - nextension];
+        } else {
+            value_ptr = FindJsonMember(json_value, field, &field_name_str_temp);
+            is_map = IsProtobufMap(field);
         }
-        value_ptr = &(member->value);
-#else 
-        const BUTIL_RAPIDJSON_NAMESPACE::Value::Member* member =
-                json_value.FindMember(field_name_str.data());
-        if (member == NULL) {
+        if (value_ptr == NULL) {
             if (field->is_required()) {
                 J2PERROR(err, "Missing required field: %s", field->full_name().c_str());
                 return false;
             }
             continue; 
         }
-        value_ptr = &(member->value);
-#endif
 
-        if (IsProtobufMap(field) && value_ptr->IsObject()) {
+        if (is_map && value_ptr->IsObject()) {
             // Try to parse json like {"key":value, ...} into protobuf map
             if (!JsonMapToProtoMap(*value_ptr, field, message, options, err, depth)) {
                 return false;
@@ -27,6 +27,7 @@
 #include "json2pb/zero_copy_stream_writer.h"
 #include "json2pb/encode_decode.h"
 #include "json2pb/protobuf_map.h"
+#include "json2pb/json_field_cache.h"
 #include "json2pb/rapidjson.h"
 #include "json2pb/pb_to_json.h"
 #include "json2pb/protobuf_type_resolver.h"
@@ -99,6 +100,17 @@ Pb2JsonOptions::Pb2JsonOptions()
     , single_repeated_to_array(false) {
 }
 
+// Name of `field' in json, `tmp' may be used to hold the decoded name.
+static const std::string& JsonName(const JsonFieldCache* cache,
+                                   const google::protobuf::FieldDescriptor* field,
+                                   std::string* tmp) {
+    if (cache != NULL && !field->is_extension()) {
+        return cache->names[field->index()];
+    }
+    const std::string& orig_name = field->name();
+    return decode_name(orig_name, *tmp) ? *tmp : orig_name;
+}
+
 class PbToJsonConverter {
 public:
     explicit PbToJsonConverter(const Pb2JsonOptions& opt) : _option(opt) {}
@@ -147,10 +159,12 @@ bool PbToJsonConverter::Convert(const google::protobuf::Message& message, Handle
             }
         }
     }
+    const JsonFieldCache* cache = GetJsonFieldCache(descriptor);
     std::vector<const google::protobuf::FieldDescriptor*> map_fields;
     for (int i = 0; i < field_count; ++i) {
         const google::protobuf::FieldDescriptor* field = descriptor->field(i);
-        if (_option.enable_protobuf_map && json2pb::IsProtobufMap(field)) {
+        if (_option.enable_protobuf_map &&
+            (cache ? cache->is_map[i] : json2pb::IsProtobufMap(field))) {
             map_fields.push_back(field);
         } else {
             fields.push_back(field);
@@ -186,9 +200,7 @@ bool PbToJsonConverter::Convert(const google::protobuf::Message& message, Handle
             continue;
         }
 
-        const std::string& orig_name = field->name();
-        bool decoded = decode_name(orig_name, field_name_str); 
-        const std::string& name = decoded ? field_name_str : orig_name;
+        const std::string& name = JsonName(cache, field, &field_name_str);
         handler.Key(name.data(), name.size(), false);
         if (!_PbFieldToJson(message, field, handler, depth)) {
             return false;
@@ -205,9 +217,7 @@ bool PbToJsonConverter::Convert(const google::protobuf::Message& message, Handle
 
         // Write a json object corresponding to hold protobuf map
         // such as {"key": value, ...}
-        const std::string& orig_name = map_desc->name();
-        bool decoded = decode_name(orig_name, field_name_str);
-        const std::string& name = decoded ? field_name_str : orig_name;
+        const std::string& name = JsonName(cache, map_desc, &field_name_str);
         handler.Key(name.data(), name.size(), false);
         handler.StartObject();
         std::string entry_name;
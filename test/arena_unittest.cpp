@@ -0,0 +1,87 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string.h>
+#include "butil/arena.h"
+
+namespace {
+
+TEST(ArenaTest, allocate) {
+    butil::Arena arena;
+    char* p1 = (char*)arena.allocate(10);
+    char* p2 = (char*)arena.allocate(10);
+    ASSERT_TRUE(p1 != NULL);
+    ASSERT_EQ(p1 + 10, p2);
+    // Outliers are allocated on separate blocks.
+    char* p3 = (char*)arena.allocate(100000);
+    ASSERT_TRUE(p3 != NULL);
+    memset(p3, 0, 100000);
+    ASSERT_EQ(p2 + 10, (char*)arena.allocate(1));
+}
+
+TEST(ArenaTest, allocate_aligned) {
+    butil::Arena arena;
+    arena.allocate(1);
+    for (size_t alignment = 1; alignment <= 4096; alignment *= 2) {
+        for (size_t n = 1; n < 100; n += 33) {
+            void* p = arena.allocate_aligned(n, alignment);
+            ASSERT_TRUE(p != NULL);
+            ASSERT_EQ(0u, (uintptr_t)p % alignment) << alignment;
+            memset(p, 0, n);
+            arena.allocate(1);
+        }
+    }
+    ASSERT_EQ(0u, (uintptr_t)arena.allocate_aligned(3) % 16);
+}
+
+TEST(ArenaTest, reset_keeps_memory) {
+    butil::ArenaOptions options;
+    options.max_reserved_size = 4096;
+    butil::Arena arena(options);
+    char* first = NULL;
+    for (int i = 0; i < 100; ++i) {
+        char* p = (char*)arena.allocate(20);
+        if (first == NULL) {
+            first = p;
+        }
+    }
+    arena.reset();
+    // Memory of last use(2000 bytes) fits in one block now.
+    char* p = (char*)arena.allocate(20);
+    for (int i = 1; i < 100; ++i) {
+        ASSERT_EQ(p + 20 * i, (char*)arena.allocate(20));
+    }
+
+    // Usage beyond max_reserved_size is not kept.
+    for (int i = 0; i < 10; ++i) {
+        arena.allocate(1000);
+    }
+    arena.reset();
+    p = (char*)arena.allocate(1000);
+    for (int i = 1; i < 4; ++i) {
+        ASSERT_EQ(p + 1000 * i, (char*)arena.allocate(1000));
+    }
+    ASSERT_NE(p + 4000, (char*)arena.allocate(1000));
+
+    arena.clear();
+    ASSERT_TRUE(arena.allocate(10) != NULL);
+}
+
+}  // namespace
@@ -26,6 +26,7 @@
 #include "butil/time.h"
 #include "butil/macros.h"
 #include "butil/logging.h"
+#include "butil/atomicops.h"
 
 namespace {
 
@@ -80,6 +81,13 @@ TEST(BaiduTimeTest, cost_of_timer) {
     t1.stop();
     printf("cpuwide_time() takes %" PRId64 "ns\n", t1.n_elapsed() / N);
 
+    t1.start();
+    for (size_t i = 0; i < N; ++i) {
+        s += butil::tsc_time_ns();
+    }
+    t1.stop();
+    printf("tsc_time_ns() takes %" PRId64 "ns\n", t1.n_elapsed() / N);
+
     t1.start();
     for (size_t i = 0; i < N; ++i) {
         s += butil::gettimeofday_us();
@@ -125,6 +133,69 @@ TEST(BaiduTimeTest, cost_of_timer) {
     }
 }
 
+TEST(BaiduTimeTest, tsc_time) {
+    // Calibrate for a while.
+    const int64_t start_ns = butil::monotonic_time_ns();
+    int64_t last = butil::tsc_time_ns();
+    while (butil::monotonic_time_ns() < start_ns + 100000000L) {
+        const int64_t now = butil::tsc_time_ns();
+        ASSERT_LE(last, now);
+        last = now;
+    }
+    for (int i = 0; i < 10; ++i) {
+        const int64_t t1 = butil::monotonic_time_ns();
+        const int64_t t2 = butil::tsc_time_ns();
+        const int64_t t3 = butil::monotonic_time_ns();
+        LOG(INFO) << "tsc_time_ns - monotonic_time_ns = " << t2 - (t1 + t3) / 2;
+        ASSERT_LT(std::abs(t2 - (t1 + t3) / 2), 1000000L);
+        usleep(10000);
+    }
+}
+
+struct TscTimeArg {
+    butil::atomic<int64_t> max_ns;
+    butil::atomic<bool> stop;
+    butil::atomic<int> nbackwards;
+};
+
+static void* read_tsc_time(void* void_arg) {
+    TscTimeArg* arg = (TscTimeArg*)void_arg;
+    int64_t last = 0;
+    while (!arg->stop.load(butil::memory_order_relaxed)) {
+        // Any time returned before in any thread should not be larger.
+        const int64_t seen = arg->max_ns.load(butil::memory_order_acquire);
+        const int64_t now = butil::tsc_time_ns();
+        if (now < seen || now < last) {
+            arg->nbackwards.fetch_add(1, butil::memory_order_relaxed);
+        }
+        last = now;
+        int64_t expected = seen;
+        while (expected < now &&
+               !arg->max_ns.compare_exchange_weak(
+                   expected, now, butil::memory_order_release,
+                   butil::memory_order_acquire)) {}
+    }
+    return NULL;
+}
+
+TEST(BaiduTimeTest, tsc_time_monotonic_between_threads) {
+    TscTimeArg arg;
+    arg.max_ns.store(0);
+    arg.stop.store(false);
+    arg.nbackwards.store(0);
+    pthread_t th[4];
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, pthread_create(&th[i], NULL, read_tsc_time, &arg));
+    }
+    // Cover several periods of calibration.
+    sleep(2);
+    arg.stop.store(true);
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        pthread_join(th[i], NULL);
+    }
+    ASSERT_EQ(0, arg.nbackwards.load());
+}
+
 TEST(BaiduTimeTest, timespec) {
     timespec ts1 = { 0, -1 };
     butil::timespec_normalize(&ts1);
@@ -6,6 +6,10 @@
 
 #include <gtest/gtest.h>
 
+#include "butil/iobuf.h"
+#include "butil/rand_util.h"
+#include "butil/third_party/modp_b64/modp_b64.h"
+
 namespace butil {
 
 TEST(Base64Test, Basic) {
@@ -24,4 +28,74 @@ TEST(Base64Test, Basic) {
   EXPECT_EQ(kText, decoded);
 }
 
+// Results should be same as the scalar codec at any length and alignment
+// which are long enough to run the SIMD kernels.
+TEST(Base64Test, SameAsScalar) {
+  for (size_t len = 0; len < 300; ++len) {
+    const std::string input = RandBytesAsString(len + 1).substr(1);
+    std::string encoded;
+    Base64Encode(input, &encoded);
+    std::string expected = input;
+    EXPECT_EQ(modp_b64_encode(expected), encoded);
+    std::string decoded;
+    ASSERT_TRUE(Base64Decode(encoded, &decoded));
+    EXPECT_EQ(input, decoded);
+  }
+}
+
+TEST(Base64Test, InvalidChars) {
+  std::string encoded;
+  Base64Encode(std::string(200, 'x'), &encoded);
+  std::string decoded;
+  // The last 4 chars may contain padding.
+  for (size_t i = 0; i + 4 < encoded.size(); ++i) {
+    for (int c = 0; c < 256; ++c) {
+      std::string s = encoded;
+      s[i] = (char)c;
+      const bool valid = (isalnum(c) && c < 128) || c == '+' || c == '/';
+      EXPECT_EQ(valid, Base64Decode(s, &decoded)) << i << " " << c;
+    }
+  }
+  // Padding in the middle.
+  ASSERT_TRUE(Base64Decode("QQ==", &decoded));
+  EXPECT_EQ("A", decoded);
+  EXPECT_FALSE(Base64Decode("QQ==" + encoded, &decoded));
+  EXPECT_FALSE(Base64Decode(encoded + "QQ=", &decoded));
+}
+
+// Append `s' as a separate block.
+static void AppendBlock(IOBuf* buf, const std::string& s) {
+  void* data = malloc(s.size());
+  memcpy(data, s.data(), s.size());
+  buf->append_user_data(data, s.size(), NULL);
+}
+
+TEST(Base64Test, IOBuf) {
+  const std::string input = RandBytesAsString(1000);
+  std::string expected;
+  Base64Encode(input, &expected);
+  for (size_t step = 1; step < 20; ++step) {
+    // Make blocks of `step' bytes.
+    IOBuf buf;
+    IOBuf encoded_buf;
+    for (size_t i = 0; i < input.size(); i += step) {
+      AppendBlock(&buf, input.substr(i, step));
+    }
+    for (size_t i = 0; i < expected.size(); i += step) {
+      AppendBlock(&encoded_buf, expected.substr(i, step));
+    }
+    std::string encoded;
+    Base64Encode(buf, &encoded);
+    EXPECT_EQ(expected, encoded);
+    std::string decoded;
+    ASSERT_TRUE(Base64Decode(encoded_buf, &decoded)) << step;
+    EXPECT_EQ(input, decoded);
+
+    IOBuf bad_buf;
+    AppendBlock(&bad_buf, "QQ==");
+    bad_buf.append(encoded_buf);
+    EXPECT_FALSE(Base64Decode(bad_buf, &decoded));
+  }
+}
+
 }  // namespace butil
@@ -0,0 +1,145 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <benchmark/benchmark.h>
+#include "butil/atomicops.h"
+#include "bthread/bthread.h"
+#include "bthread/butex.h"
+
+namespace {
+
+void* do_nothing(void*) {
+    return NULL;
+}
+
+void BM_BthreadStartJoin(benchmark::State& state) {
+    for (auto _ : state) {
+        bthread_t th;
+        if (bthread_start_urgent(&th, NULL, do_nothing, NULL) != 0) {
+            state.SkipWithError("Fail to start bthread");
+            break;
+        }
+        bthread_join(th, NULL);
+    }
+}
+BENCHMARK(BM_BthreadStartJoin)->UseRealTime();
+
+void BM_BthreadStartBackgroundJoin(benchmark::State& state) {
+    for (auto _ : state) {
+        bthread_t th;
+        if (bthread_start_background(&th, NULL, do_nothing, NULL) != 0) {
+            state.SkipWithError("Fail to start bthread");
+            break;
+        }
+        bthread_join(th, NULL);
+    }
+}
+BENCHMARK(BM_BthreadStartBackgroundJoin)->UseRealTime();
+
+void BM_PthreadCreateJoin(benchmark::State& state) {
+    for (auto _ : state) {
+        pthread_t th;
+        if (pthread_create(&th, NULL, do_nothing, NULL) != 0) {
+            state.SkipWithError("Fail to create pthread");
+            break;
+        }
+        pthread_join(th, NULL);
+    }
+}
+BENCHMARK(BM_PthreadCreateJoin)->UseRealTime();
+
+// Two bthreads waking each other through a pair of butexes.
+struct PingPongArg {
+    butil::atomic<int>* ping;
+    butil::atomic<int>* pong;
+    int64_t rounds;
+};
+
+void* pong_thread(void* void_arg) {
+    PingPongArg* arg = static_cast<PingPongArg*>(void_arg);
+    for (int64_t i = 1; i <= arg->rounds; ++i) {
+        while (arg->ping->load(butil::memory_order_acquire) < i) {
+            bthread::butex_wait(arg->ping, i - 1, NULL);
+        }
+        arg->pong->store(i, butil::memory_order_release);
+        bthread::butex_wake(arg->pong);
+    }
+    return NULL;
+}
+
+void BM_ButexPingPong(benchmark::State& state) {
+    butil::atomic<int>* ping = bthread::butex_create_checked<butil::atomic<int> >();
+    butil::atomic<int>* pong = bthread::butex_create_checked<butil::atomic<int> >();
+    ping->store(0, butil::memory_order_relaxed);
+    pong->store(0, butil::memory_order_relaxed);
+    PingPongArg arg = { ping, pong, (int64_t)state.max_iterations };
+    bthread_t th;
+    if (bthread_start_background(&th, NULL, pong_thread, &arg) != 0) {
+        state.SkipWithError("Fail to start bthread");
+        return;
+    }
+    int i = 0;
+    for (auto _ : state) {
+        ++i;
+        ping->store(i, butil::memory_order_release);
+        bthread::butex_wake(ping);
+        while (pong->load(butil::memory_order_acquire) < i) {
+            bthread::butex_wait(pong, i - 1, NULL);
+        }
+    }
+    bthread_join(th, NULL);
+    bthread::butex_destroy(ping);
+    bthread::butex_destroy(pong);
+}
+BENCHMARK(BM_ButexPingPong)->UseRealTime()->Iterations(100000);
+
+// Lifetime of the correlation id of a RPC without errors.
+void BM_BthreadIdCreateLockDestroy(benchmark::State& state) {
+    for (auto _ : state) {
+        bthread_id_t id;
+        if (bthread_id_create(&id, NULL, NULL) != 0) {
+            state.SkipWithError("Fail to create bthread_id");
+            break;
+        }
+        bthread_id_lock(id, NULL);
+        bthread_id_unlock(id);
+        bthread_id_lock(id, NULL);
+        bthread_id_unlock_and_destroy(id);
+    }
+}
+BENCHMARK(BM_BthreadIdCreateLockDestroy)->ThreadRange(1, 8)->UseRealTime();
+
+// Threads lock the same id, like sub calls of a ParallelChannel.
+bthread_id_t g_shared_id = INVALID_BTHREAD_ID;
+
+void BM_BthreadIdLockUnlock(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        bthread_id_create(&g_shared_id, NULL, NULL);
+    }
+    for (auto _ : state) {
+        bthread_id_lock(g_shared_id, NULL);
+        bthread_id_unlock(g_shared_id);
+    }
+    if (state.thread_index() == 0) {
+        bthread_id_lock(g_shared_id, NULL);
+        bthread_id_unlock_and_destroy(g_shared_id);
+    }
+}
+BENCHMARK(BM_BthreadIdLockUnlock)->ThreadRange(1, 8)->UseRealTime();
+
+} // namespace
@@ -0,0 +1,67 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <benchmark/benchmark.h>
+#include "bvar/bvar.h"
+
+namespace {
+
+bvar::Adder<int64_t> g_adder;
+bvar::Maxer<int64_t> g_maxer;
+bvar::IntRecorder g_int_recorder;
+bvar::LatencyRecorder g_latency_recorder;
+
+void BM_BvarAdder(benchmark::State& state) {
+    for (auto _ : state) {
+        g_adder << 1;
+    }
+}
+BENCHMARK(BM_BvarAdder)->ThreadRange(1, 8);
+
+void BM_BvarAdderGetValue(benchmark::State& state) {
+    g_adder << 1;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(g_adder.get_value());
+    }
+}
+BENCHMARK(BM_BvarAdderGetValue);
+
+void BM_BvarMaxer(benchmark::State& state) {
+    int64_t i = 0;
+    for (auto _ : state) {
+        g_maxer << ++i;
+    }
+}
+BENCHMARK(BM_BvarMaxer)->ThreadRange(1, 8);
+
+void BM_BvarIntRecorder(benchmark::State& state) {
+    int64_t i = 0;
+    for (auto _ : state) {
+        g_int_recorder << (++i & 1023);
+    }
+}
+BENCHMARK(BM_BvarIntRecorder)->ThreadRange(1, 8);
+
+void BM_BvarLatencyRecorder(benchmark::State& state) {
+    int64_t i = 0;
+    for (auto _ : state) {
+        g_latency_recorder << (++i & 1023);
+    }
+}
+BENCHMARK(BM_BvarLatencyRecorder)->ThreadRange(1, 8);
+
+} // namespace
@@ -0,0 +1,134 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "butil/containers/flat_map.h"
+#include "butil/resource_pool.h"
+#include "butil/object_pool.h"
+
+namespace {
+
+const size_t NKEY = 1024;
+
+std::vector<uint64_t> make_keys() {
+    std::vector<uint64_t> keys;
+    for (size_t i = 0; i < NKEY; ++i) {
+        keys.push_back(i * 2654435761UL);
+    }
+    return keys;
+}
+
+void BM_FlatMapInsertErase(benchmark::State& state) {
+    const std::vector<uint64_t> keys = make_keys();
+    butil::FlatMap<uint64_t, uint64_t> m;
+    m.init(NKEY * 2);
+    size_t i = 0;
+    for (auto _ : state) {
+        const uint64_t k = keys[i++ % NKEY];
+        m.insert(k, k);
+        m.erase(k);
+    }
+}
+BENCHMARK(BM_FlatMapInsertErase);
+
+void BM_FlatMapSeek(benchmark::State& state) {
+    const std::vector<uint64_t> keys = make_keys();
+    butil::FlatMap<uint64_t, uint64_t> m;
+    m.init(NKEY * 2);
+    for (size_t i = 0; i < NKEY; ++i) {
+        m.insert(keys[i], i);
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(m.seek(keys[i++ % NKEY]));
+    }
+}
+BENCHMARK(BM_FlatMapSeek);
+
+// Baselines of FlatMap.
+void BM_StdUnorderedMapSeek(benchmark::State& state) {
+    const std::vector<uint64_t> keys = make_keys();
+    std::unordered_map<uint64_t, uint64_t> m;
+    for (size_t i = 0; i < NKEY; ++i) {
+        m[keys[i]] = i;
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(m.find(keys[i++ % NKEY]));
+    }
+}
+BENCHMARK(BM_StdUnorderedMapSeek);
+
+void BM_StdMapSeek(benchmark::State& state) {
+    const std::vector<uint64_t> keys = make_keys();
+    std::map<uint64_t, uint64_t> m;
+    for (size_t i = 0; i < NKEY; ++i) {
+        m[keys[i]] = i;
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(m.find(keys[i++ % NKEY]));
+    }
+}
+BENCHMARK(BM_StdMapSeek);
+
+struct PooledObject {
+    char data[64];
+};
+
+void BM_ResourcePoolGetReturn(benchmark::State& state) {
+    for (auto _ : state) {
+        butil::ResourceId<PooledObject> id;
+        PooledObject* p = butil::get_resource(&id);
+        benchmark::DoNotOptimize(p);
+        butil::return_resource(id);
+    }
+}
+BENCHMARK(BM_ResourcePoolGetReturn)->ThreadRange(1, 8);
+
+void BM_ResourcePoolAddress(benchmark::State& state) {
+    butil::ResourceId<PooledObject> id;
+    butil::get_resource(&id);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(butil::address_resource(id));
+    }
+    butil::return_resource(id);
+}
+BENCHMARK(BM_ResourcePoolAddress);
+
+void BM_ObjectPoolGetReturn(benchmark::State& state) {
+    for (auto _ : state) {
+        PooledObject* p = butil::get_object<PooledObject>();
+        benchmark::DoNotOptimize(p);
+        butil::return_object(p);
+    }
+}
+BENCHMARK(BM_ObjectPoolGetReturn)->ThreadRange(1, 8);
+
+void BM_NewDelete(benchmark::State& state) {
+    for (auto _ : state) {
+        PooledObject* p = new PooledObject;
+        benchmark::DoNotOptimize(p);
+        delete p;
+    }
+}
+BENCHMARK(BM_NewDelete)->ThreadRange(1, 8);
+
+} // namespace
@@ -0,0 +1,105 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <string.h>
+#include <benchmark/benchmark.h>
+#include "butil/iobuf.h"
+
+namespace {
+
+void BM_IOBufAppend(benchmark::State& state) {
+    const std::string data(state.range(0), 'a');
+    butil::IOBuf buf;
+    for (auto _ : state) {
+        buf.append(data);
+        if (buf.size() >= 1024 * 1024) {
+            buf.clear();
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_IOBufAppend)->Arg(16)->Arg(256)->Arg(4096)->Arg(65536);
+
+void BM_IOBufAppender(benchmark::State& state) {
+    const std::string data(state.range(0), 'a');
+    butil::IOBufAppender appender;
+    butil::IOBuf buf;
+    for (auto _ : state) {
+        appender.append(data.data(), data.size());
+        if (appender.buf().size() >= 1024 * 1024) {
+            appender.move_to(buf);
+            buf.clear();
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_IOBufAppender)->Arg(16)->Arg(256)->Arg(4096);
+
+void BM_IOBufCutn(benchmark::State& state) {
+    const size_t n = state.range(0);
+    butil::IOBuf src;
+    butil::IOBuf dst;
+    const std::string data(1024 * 1024, 'a');
+    for (auto _ : state) {
+        if (src.size() < n) {
+            state.PauseTiming();
+            src.append(data);
+            state.ResumeTiming();
+        }
+        src.cutn(&dst, n);
+        dst.clear();
+    }
+    state.SetBytesProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_IOBufCutn)->Arg(16)->Arg(256)->Arg(4096)->Arg(65536);
+
+void BM_IOBufCopyTo(benchmark::State& state) {
+    const size_t n = state.range(0);
+    butil::IOBuf src;
+    src.append(std::string(n, 'a'));
+    std::string dst(n, '\0');
+    for (auto _ : state) {
+        src.copy_to(&dst[0], n);
+        benchmark::DoNotOptimize(dst.data());
+    }
+    state.SetBytesProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_IOBufCopyTo)->Arg(16)->Arg(4096)->Arg(65536);
+
+char g_user_data[4096];
+
+void NoopDeleter(void*, void*) {}
+
+// Arg 0: deleter in std::function capturing 32 bytes, 1: function pointer.
+void BM_IOBufAppendUserData(benchmark::State& state) {
+    const bool function_pointer = state.range(0);
+    const char ctx[32] = {};
+    butil::IOBuf buf;
+    for (auto _ : state) {
+        if (function_pointer) {
+            buf.append_user_data(g_user_data, sizeof(g_user_data),
+                                 NoopDeleter, (void*)ctx);
+        } else {
+            buf.append_user_data(g_user_data, sizeof(g_user_data),
+                                 [ctx](void*) { benchmark::DoNotOptimize(ctx); });
+        }
+        buf.clear();
+    }
+}
+BENCHMARK(BM_IOBufAppendUserData)->Arg(0)->Arg(1);
+
+} // namespace
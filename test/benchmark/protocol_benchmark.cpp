@@ -0,0 +1,96 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <benchmark/benchmark.h>
+#include "butil/iobuf.h"
+#include "butil/raw_pack.h"
+#include "brpc/policy/baidu_rpc_meta.pb.h"
+#include "brpc/policy/baidu_rpc_protocol.h"
+#include "brpc/policy/most_common_message.h"
+#include "brpc/details/http_message.h"
+#include "brpc/protocol.h"
+
+namespace {
+
+// Make a baidu_std message with a payload of `payload_size' bytes.
+void make_baidu_std_message(size_t payload_size, butil::IOBuf* out) {
+    brpc::policy::RpcMeta meta;
+    brpc::policy::RpcRequestMeta* req_meta = meta.mutable_request();
+    req_meta->set_service_name("example.EchoService");
+    req_meta->set_method_name("Echo");
+    req_meta->set_log_id(1234);
+    meta.set_correlation_id(5678);
+    const std::string meta_str = meta.SerializeAsString();
+    char header[12];
+    butil::RawPacker(header + 4)
+        .pack32(meta_str.size() + payload_size)
+        .pack32(meta_str.size());
+    memcpy(header, "PRPC", 4);
+    out->append(header, sizeof(header));
+    out->append(meta_str);
+    out->append(std::string(payload_size, 'a'));
+}
+
+void BM_BaiduStdParse(benchmark::State& state) {
+    butil::IOBuf msg;
+    make_baidu_std_message(state.range(0), &msg);
+    for (auto _ : state) {
+        butil::IOBuf source(msg);
+        brpc::ParseResult r =
+            brpc::policy::ParseRpcMessage(&source, NULL, false, NULL);
+        if (!r.is_ok()) {
+            state.SkipWithError("Fail to parse baidu_std message");
+            break;
+        }
+        brpc::policy::MostCommonMessage* m =
+            static_cast<brpc::policy::MostCommonMessage*>(r.message());
+        brpc::policy::RpcMeta meta;
+        if (!brpc::ParsePbFromIOBuf(&meta, m->meta)) {
+            state.SkipWithError("Fail to parse RpcMeta");
+        }
+        m->Destroy();
+    }
+    state.SetBytesProcessed(state.iterations() * msg.size());
+}
+BENCHMARK(BM_BaiduStdParse)->Arg(64)->Arg(4096);
+
+void BM_HttpParse(benchmark::State& state) {
+    std::string req =
+        "POST /example.EchoService/Echo HTTP/1.1\r\n"
+        "Host: 127.0.0.1:8002\r\n"
+        "User-Agent: brpc\r\n"
+        "Accept: */*\r\n"
+        "Content-Type: application/json\r\n"
+        "X-Request-Id: 0123456789abcdef\r\n";
+    const std::string body(state.range(0), 'a');
+    req.append("Content-Length: ").append(std::to_string(body.size()))
+        .append("\r\n\r\n").append(body);
+    butil::IOBuf buf;
+    buf.append(req);
+    for (auto _ : state) {
+        brpc::HttpMessage http_message;
+        if (http_message.ParseFromIOBuf(buf) < 0 ||
+            !http_message.Completed()) {
+            state.SkipWithError("Fail to parse http message");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * req.size());
+}
+BENCHMARK(BM_HttpParse)->Arg(64)->Arg(4096);
+
+} // namespace
@@ -0,0 +1,42 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <benchmark/benchmark.h>
+#include "butil/endpoint.h"
+#include "brpc/server.h"
+
+namespace {
+
+// Start a server on a random port and stop it. range(0) tells whether
+// builtin services are added.
+void BM_ServerStartStop(benchmark::State& state) {
+    brpc::ServerOptions options;
+    options.has_builtin_services = state.range(0);
+    for (auto _ : state) {
+        brpc::Server server;
+        if (server.Start(butil::EndPoint(butil::IP_ANY, 0), &options) != 0) {
+            state.SkipWithError("Fail to start server");
+            break;
+        }
+        server.Stop(0);
+        server.Join();
+    }
+}
+BENCHMARK(BM_ServerStartStop)->Arg(0)->Arg(1)->UseRealTime();
+
+} // namespace
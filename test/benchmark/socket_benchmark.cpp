@@ -0,0 +1,154 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <benchmark/benchmark.h>
+#include "butil/atomicops.h"
+#include "butil/endpoint.h"
+#include "butil/fd_guard.h"
+#include "butil/iobuf.h"
+#include "bthread/bthread.h"
+#include "brpc/errno.pb.h"
+#include "brpc/socket.h"
+
+namespace {
+
+struct Drainer {
+    int fd;
+    butil::atomic<int64_t> nread;
+};
+
+void* drain_thread(void* arg) {
+    Drainer* d = static_cast<Drainer*>(arg);
+    char buf[65536];
+    while (true) {
+        const ssize_t n = read(d->fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        d->nread.fetch_add(n, butil::memory_order_release);
+    }
+    return NULL;
+}
+
+// Write messages of range(0) bytes into a TCP connection over loopback
+// which is drained by another thread.
+void BM_SocketWriteLoopback(benchmark::State& state) {
+    butil::EndPoint listen_point(butil::IP_ANY, 0);
+    butil::fd_guard listen_fd(butil::tcp_listen(listen_point));
+    butil::EndPoint local;
+    if (listen_fd < 0 || butil::get_local_side(listen_fd, &local) != 0) {
+        state.SkipWithError("Fail to listen");
+        return;
+    }
+    butil::EndPoint server;
+    butil::str2endpoint("127.0.0.1", local.port, &server);
+    const int client_fd = butil::tcp_connect(server, NULL);
+    if (client_fd < 0) {
+        state.SkipWithError("Fail to connect");
+        return;
+    }
+    Drainer drainer;
+    drainer.fd = accept(listen_fd, NULL, NULL);
+    drainer.nread.store(0, butil::memory_order_relaxed);
+    butil::fd_guard server_fd(drainer.fd);
+    pthread_t th;
+    pthread_create(&th, NULL, drain_thread, &drainer);
+
+    brpc::SocketOptions options;
+    options.fd = client_fd;
+    options.remote_side = server;
+    brpc::SocketId id;
+    if (brpc::Socket::Create(options, &id) != 0) {
+        state.SkipWithError("Fail to create Socket");
+        return;
+    }
+    brpc::SocketUniquePtr s;
+    brpc::Socket::Address(id, &s);
+    const std::string data(state.range(0), 'a');
+    int64_t nwritten = 0;
+    for (auto _ : state) {
+        butil::IOBuf msg;
+        msg.append(data);
+        // Wait for the drainer when too much data is not written yet.
+        while (s->Write(&msg) != 0) {
+            if (errno != brpc::EOVERCROWDED) {
+                state.SkipWithError("Fail to write");
+                break;
+            }
+            bthread_usleep(100);
+        }
+        nwritten += data.size();
+    }
+    while (drainer.nread.load(butil::memory_order_acquire) < nwritten) {
+        bthread_usleep(100);
+    }
+    state.SetBytesProcessed(nwritten);
+    s->SetFailed();
+    s.reset();
+    pthread_join(th, NULL);
+}
+BENCHMARK(BM_SocketWriteLoopback)->Arg(64)->Arg(4096)->Arg(65536)->UseRealTime();
+
+// Threads address the same socket, like events and calls of a hot
+// connection.
+brpc::SocketId g_socket_id = brpc::INVALID_SOCKET_ID;
+
+void CreateSharedSocket(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        brpc::SocketOptions options;
+        brpc::Socket::Create(options, &g_socket_id);
+    }
+}
+
+void DestroySharedSocket(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        brpc::Socket::SetFailed(g_socket_id);
+    }
+}
+
+void BM_SocketAddress(benchmark::State& state) {
+    CreateSharedSocket(state);
+    for (auto _ : state) {
+        brpc::SocketUniquePtr ptr;
+        if (brpc::Socket::Address(g_socket_id, &ptr) != 0) {
+            state.SkipWithError("Fail to address socket");
+            break;
+        }
+        benchmark::DoNotOptimize(ptr->fd());
+    }
+    DestroySharedSocket(state);
+}
+BENCHMARK(BM_SocketAddress)->ThreadRange(1, 64)->UseRealTime();
+
+void BM_SocketBorrow(benchmark::State& state) {
+    CreateSharedSocket(state);
+    for (auto _ : state) {
+        brpc::SocketBorrowedPtr ptr;
+        if (brpc::Socket::Borrow(g_socket_id, &ptr) != 0) {
+            state.SkipWithError("Fail to borrow socket");
+            break;
+        }
+        benchmark::DoNotOptimize(ptr->fd());
+    }
+    DestroySharedSocket(state);
+}
+BENCHMARK(BM_SocketBorrow)->ThreadRange(1, 64)->UseRealTime();
+
+} // namespace
@@ -23,6 +23,8 @@
 #include "brpc/adaptive_max_concurrency.h"
 #include "brpc/adaptive_protocol_type.h"
 #include "brpc/adaptive_connection_type.h"
+#include "brpc/adaptive_compress_policy.h"
+#include "brpc/global.h"
 
 const std::string kAutoCL = "aUto";
 const std::string kHttp = "hTTp";
@@ -73,3 +75,52 @@ TEST(AdaptiveConnectionTypeTest, ShouldConvertCorrectly) {
     EXPECT_NE(act, brpc::ConnectionType::CONNECTION_TYPE_SINGLE);
 }
 
+
+class FixedCpuCompressPolicy : public brpc::AdaptiveCompressPolicy {
+public:
+    explicit FixedCpuCompressPolicy(const brpc::AdaptiveCompressOptions& opt)
+        : brpc::AdaptiveCompressPolicy(opt), cpu(0) {}
+    double CpuUtilization() const override { return cpu; }
+    double cpu;
+};
+
+TEST(AdaptiveCompressPolicyTest, ShouldSelectBySizeRatioAndCpu) {
+    brpc::GlobalInitializeOrDie();
+    brpc::AdaptiveCompressOptions opt;
+    opt.min_size = 100;
+    opt.explore_interval = 0;
+    FixedCpuCompressPolicy p(opt);
+    // Only the preferred type is a candidate without `candidates'.
+    EXPECT_EQ(brpc::COMPRESS_TYPE_NONE, p.Select(99, brpc::COMPRESS_TYPE_GZIP));
+    EXPECT_EQ(brpc::COMPRESS_TYPE_GZIP, p.Select(100, brpc::COMPRESS_TYPE_GZIP));
+    EXPECT_EQ(brpc::COMPRESS_TYPE_NONE, p.Select(100, brpc::COMPRESS_TYPE_NONE));
+    // Little gain, stop compressing.
+    p.OnCompressed(brpc::COMPRESS_TYPE_GZIP, 1000, 950, 10);
+    EXPECT_EQ(brpc::COMPRESS_TYPE_NONE, p.Select(1000, brpc::COMPRESS_TYPE_GZIP));
+
+    opt.candidates.push_back(brpc::COMPRESS_TYPE_GZIP);
+    opt.candidates.push_back(brpc::COMPRESS_TYPE_SNAPPY);
+    FixedCpuCompressPolicy p2(opt);
+    // Untried candidates are chosen first.
+    EXPECT_EQ(brpc::COMPRESS_TYPE_GZIP, p2.Select(1000, brpc::COMPRESS_TYPE_NONE));
+    p2.OnCompressed(brpc::COMPRESS_TYPE_GZIP, 1000, 200, 20);
+    EXPECT_EQ(brpc::COMPRESS_TYPE_SNAPPY, p2.Select(1000, brpc::COMPRESS_TYPE_NONE));
+    p2.OnCompressed(brpc::COMPRESS_TYPE_SNAPPY, 1000, 400, 2);
+    EXPECT_DOUBLE_EQ(0.2, p2.RatioOf(brpc::COMPRESS_TYPE_GZIP));
+    EXPECT_DOUBLE_EQ(2.0, p2.CostOf(brpc::COMPRESS_TYPE_SNAPPY));
+    // Best ratio when CPU is idle, cheapest when busy, none when overloaded.
+    EXPECT_EQ(brpc::COMPRESS_TYPE_GZIP, p2.Select(1000, brpc::COMPRESS_TYPE_NONE));
+    p2.cpu = 0.8;
+    EXPECT_EQ(brpc::COMPRESS_TYPE_SNAPPY, p2.Select(1000, brpc::COMPRESS_TYPE_NONE));
+    p2.cpu = 0.95;
+    EXPECT_EQ(brpc::COMPRESS_TYPE_NONE, p2.Select(1000, brpc::COMPRESS_TYPE_NONE));
+
+    // Exploring keeps trying candidates in turn.
+    opt.explore_interval = 2;
+    FixedCpuCompressPolicy p3(opt);
+    p3.OnCompressed(brpc::COMPRESS_TYPE_GZIP, 1000, 990, 20);
+    p3.OnCompressed(brpc::COMPRESS_TYPE_SNAPPY, 1000, 990, 2);
+    EXPECT_EQ(brpc::COMPRESS_TYPE_GZIP, p3.Select(1000, brpc::COMPRESS_TYPE_NONE));
+    EXPECT_EQ(brpc::COMPRESS_TYPE_NONE, p3.Select(1000, brpc::COMPRESS_TYPE_NONE));
+    EXPECT_EQ(brpc::COMPRESS_TYPE_SNAPPY, p3.Select(1000, brpc::COMPRESS_TYPE_NONE));
+}
@@ -0,0 +1,152 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include "brpc/policy/baidu_rpc_meta.pb.h"
+#include "brpc/policy/baidu_rpc_meta_codec.h"
+
+namespace {
+
+using brpc::policy::RpcMeta;
+using brpc::policy::RpcMetaFields;
+
+void FillMeta(RpcMeta* meta) {
+    brpc::policy::RpcRequestMeta* req = meta->mutable_request();
+    req->set_service_name("example.EchoService");
+    req->set_method_name("Echo");
+    req->set_log_id(123456789012345LL);
+    req->set_trace_id(-1);
+    req->set_span_id(42);
+    req->set_parent_span_id(0);
+    req->set_request_id("req-1");
+    req->set_timeout_ms(500);
+    req->set_method_index(0);
+    req->set_priority(-2);
+    req->set_sampled(false);
+    meta->mutable_response()->set_error_code(-1);
+    meta->mutable_response()->set_error_text(std::string(300, 'e'));
+    meta->mutable_response()->set_server_load(700);
+    meta->set_compress_type(2);
+    meta->set_correlation_id(0x123456789LL);
+    meta->set_attachment_size(100);
+    meta->set_authentication_data(std::string("a\0b", 3));
+    meta->set_content_type(brpc::CONTENT_TYPE_JSON);
+    meta->set_checksum_type(1);
+    meta->set_checksum_value("");
+}
+
+TEST(BaiduRpcMetaCodecTest, same_as_protobuf) {
+    RpcMeta meta;
+    FillMeta(&meta);
+    std::string pb;
+    ASSERT_TRUE(meta.SerializeToString(&pb));
+
+    RpcMetaFields fields;
+    ASSERT_TRUE(brpc::policy::ParseRpcMetaFields(pb.data(), pb.size(), &fields));
+    ASSERT_TRUE(fields.has_request);
+    ASSERT_EQ("example.EchoService", fields.request.service_name);
+    ASSERT_EQ("Echo", fields.request.method_name);
+    ASSERT_EQ(123456789012345LL, fields.request.log_id);
+    ASSERT_EQ(-1, fields.request.trace_id);
+    ASSERT_TRUE(fields.request.has_parent_span_id);
+    ASSERT_EQ("req-1", fields.request.request_id);
+    ASSERT_EQ(500, fields.request.timeout_ms);
+    ASSERT_TRUE(fields.request.has_method_index);
+    ASSERT_EQ(-2, fields.request.priority);
+    ASSERT_FALSE(fields.request.sampled);
+    ASSERT_EQ(-1, fields.response.error_code);
+    ASSERT_EQ(300u, fields.response.error_text.size());
+    ASSERT_EQ(700, fields.response.server_load);
+    ASSERT_EQ(2, fields.compress_type);
+    ASSERT_EQ(0x123456789LL, fields.correlation_id);
+    ASSERT_EQ(100, fields.attachment_size);
+    ASSERT_EQ(std::string("a\0b", 3), fields.authentication_data);
+    ASSERT_EQ(brpc::CONTENT_TYPE_JSON, fields.content_type);
+    ASSERT_TRUE(fields.has_checksum_value);
+    ASSERT_TRUE(fields.checksum_value.empty());
+
+    ASSERT_EQ(pb.size(), brpc::policy::RpcMetaFieldsByteSize(fields));
+    std::string out(pb.size(), '\0');
+    ASSERT_EQ(&out[0] + out.size(),
+              brpc::policy::SerializeRpcMetaFieldsToArray(fields, &out[0]));
+    ASSERT_EQ(pb, out);
+
+    RpcMeta meta2;
+    brpc::policy::RpcMetaFieldsToPb(fields, &meta2);
+    ASSERT_EQ(pb, meta2.SerializeAsString());
+    RpcMetaFields fields2;
+    brpc::policy::RpcMetaToFields(meta2, &fields2);
+    out.assign(pb.size(), '\0');
+    brpc::policy::SerializeRpcMetaFieldsToArray(fields2, &out[0]);
+    ASSERT_EQ(pb, out);
+}
+
+TEST(BaiduRpcMetaCodecTest, unset_fields) {
+    RpcMeta meta;
+    meta.set_correlation_id(1);
+    meta.mutable_response();
+    std::string pb;
+    ASSERT_TRUE(meta.SerializeToString(&pb));
+    RpcMetaFields fields;
+    ASSERT_TRUE(brpc::policy::ParseRpcMetaFields(pb.data(), pb.size(), &fields));
+    ASSERT_FALSE(fields.has_request);
+    ASSERT_TRUE(fields.has_response);
+    ASSERT_FALSE(fields.response.has_error_code);
+    ASSERT_FALSE(fields.has_attachment_size);
+    ASSERT_TRUE(fields.request.sampled);
+    ASSERT_EQ(pb.size(), brpc::policy::RpcMetaFieldsByteSize(fields));
+
+    RpcMetaFields empty;
+    ASSERT_TRUE(brpc::policy::ParseRpcMetaFields(NULL, 0, &empty));
+    ASSERT_EQ(0u, brpc::policy::RpcMetaFieldsByteSize(empty));
+}
+
+TEST(BaiduRpcMetaCodecTest, fallback_to_protobuf) {
+    RpcMetaFields fields;
+    RpcMeta meta;
+    FillMeta(&meta);
+    std::string pb;
+
+    // Fields not in RpcMetaFields.
+    RpcMeta with_user_fields = meta;
+    (*with_user_fields.mutable_user_fields())["key"] = "value";
+    ASSERT_TRUE(with_user_fields.SerializeToString(&pb));
+    ASSERT_FALSE(brpc::policy::ParseRpcMetaFields(pb.data(), pb.size(), &fields));
+
+    RpcMeta with_stream = meta;
+    with_stream.mutable_stream_settings()->set_stream_id(1);
+    ASSERT_TRUE(with_stream.SerializeToString(&pb));
+    ASSERT_FALSE(brpc::policy::ParseRpcMetaFields(pb.data(), pb.size(), &fields));
+
+    // Truncated, which is malformed unless it's cut at a field boundary.
+    ASSERT_TRUE(meta.SerializeToString(&pb));
+    for (size_t len = 0; len < pb.size(); ++len) {
+        RpcMetaFields f;
+        RpcMeta m;
+        ASSERT_EQ(m.ParseFromArray(pb.data(), len),
+                  brpc::policy::ParseRpcMetaFields(pb.data(), len, &f)) << len;
+    }
+
+    // Missing required fields.
+    RpcMeta partial;
+    partial.mutable_request()->set_service_name("EchoService");
+    ASSERT_TRUE(partial.SerializePartialToString(&pb));
+    RpcMetaFields partial_fields;
+    ASSERT_FALSE(brpc::policy::ParseRpcMetaFields(pb.data(), pb.size(), &partial_fields));
+}
+
+} // namespace
@@ -0,0 +1,181 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include "butil/atomicops.h"
+#include "butil/synchronization/lock.h"
+#include "bthread/bthread.h"
+#include "bvar/variable.h"
+#include "brpc/controller.h"
+#include "brpc/callback.h"
+#include "brpc/batched_method.h"
+#include "echo.pb.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+class BatchedMethodTest : public ::testing::Test {
+public:
+    BatchedMethodTest() : _ndone(0) {}
+
+    void OnBatch(std::vector<brpc::BatchedMethod::Call>* batch) {
+        {
+            BAIDU_SCOPED_LOCK(_mutex);
+            _batch_sizes.push_back(batch->size());
+        }
+        for (size_t i = 0; i < batch->size(); ++i) {
+            const brpc::BatchedMethod::Call& c = (*batch)[i];
+            static_cast<test::EchoResponse*>(c.response)->set_message(
+                static_cast<const test::EchoRequest*>(c.request)->message());
+            c.done->Run();
+        }
+    }
+
+    void OnDone() { _ndone.fetch_add(1); }
+
+    butil::Mutex _mutex;
+    std::vector<size_t> _batch_sizes;
+    butil::atomic<int> _ndone;
+};
+
+struct CallArg {
+    BatchedMethodTest* test;
+    brpc::BatchedMethod* batcher;
+    brpc::Controller cntl;
+    test::EchoRequest req;
+    test::EchoResponse res;
+};
+
+TEST_F(BatchedMethodTest, full_batches) {
+    brpc::BatchedMethod batcher;
+    brpc::BatchedMethodOptions options;
+    options.max_batch_size = 4;
+    options.max_delay_us = 10 * 1000 * 1000;
+    ASSERT_EQ(0, batcher.Init(
+        "batched_method_test_full",
+        std::bind(&BatchedMethodTest::OnBatch, this, std::placeholders::_1),
+        &options));
+    ASSERT_EQ(-1, batcher.Init(
+        "batched_method_test_full",
+        std::bind(&BatchedMethodTest::OnBatch, this, std::placeholders::_1),
+        &options));
+    CallArg args[8];
+    for (size_t i = 0; i < arraysize(args); ++i) {
+        args[i].req.set_message(std::to_string(i));
+        batcher.Add(&args[i].cntl, &args[i].req, &args[i].res,
+                    brpc::NewCallback(this, &BatchedMethodTest::OnDone));
+    }
+    // Run without waiting for the delay.
+    ASSERT_EQ(8, _ndone.load());
+    ASSERT_EQ(2UL, _batch_sizes.size());
+    ASSERT_EQ(4UL, _batch_sizes[0]);
+    ASSERT_EQ(4UL, _batch_sizes[1]);
+    for (size_t i = 0; i < arraysize(args); ++i) {
+        ASSERT_EQ(args[i].req.message(), args[i].res.message());
+    }
+    ASSERT_EQ("2", bvar::Variable::describe_exposed(
+                  "batched_method_test_full_batch_count"));
+}
+
+TEST_F(BatchedMethodTest, run_after_delay) {
+    brpc::BatchedMethod batcher;
+    brpc::BatchedMethodOptions options;
+    options.max_batch_size = 100;
+    options.max_delay_us = 20000;
+    ASSERT_EQ(0, batcher.Init(
+        "", std::bind(&BatchedMethodTest::OnBatch, this, std::placeholders::_1),
+        &options));
+    CallArg args[3];
+    for (size_t i = 0; i < arraysize(args); ++i) {
+        batcher.Add(&args[i].cntl, &args[i].req, &args[i].res,
+                    brpc::NewCallback(this, &BatchedMethodTest::OnDone));
+    }
+    ASSERT_EQ(0, _ndone.load());
+    for (int i = 0; i < 100 && _ndone.load() != 3; ++i) {
+        bthread_usleep(10000);
+    }
+    ASSERT_EQ(3, _ndone.load());
+    ASSERT_EQ(1UL, _batch_sizes.size());
+    ASSERT_EQ(3UL, _batch_sizes[0]);
+
+    // Flushed explicitly.
+    batcher.Add(&args[0].cntl, &args[0].req, &args[0].res,
+                brpc::NewCallback(this, &BatchedMethodTest::OnDone));
+    batcher.Flush();
+    ASSERT_EQ(4, _ndone.load());
+    // The timer of the flushed batch does nothing.
+    bthread_usleep(50000);
+    ASSERT_EQ(2UL, _batch_sizes.size());
+}
+
+TEST_F(BatchedMethodTest, flush_on_destruction) {
+    CallArg arg;
+    {
+        brpc::BatchedMethod batcher;
+        ASSERT_EQ(0, batcher.Init(
+            "", std::bind(&BatchedMethodTest::OnBatch, this, std::placeholders::_1),
+            NULL));
+        batcher.Add(&arg.cntl, &arg.req, &arg.res,
+                    brpc::NewCallback(this, &BatchedMethodTest::OnDone));
+        ASSERT_EQ(0, _ndone.load());
+    }
+    ASSERT_EQ(1, _ndone.load());
+}
+
+static void* AddCall(void* void_arg) {
+    CallArg* arg = static_cast<CallArg*>(void_arg);
+    arg->batcher->Add(&arg->cntl, &arg->req, &arg->res,
+                      brpc::NewCallback(arg->test, &BatchedMethodTest::OnDone));
+    return NULL;
+}
+
+TEST_F(BatchedMethodTest, concurrent_calls) {
+    brpc::BatchedMethod batcher;
+    brpc::BatchedMethodOptions options;
+    options.max_batch_size = 8;
+    options.max_delay_us = 1000;
+    ASSERT_EQ(0, batcher.Init(
+        "", std::bind(&BatchedMethodTest::OnBatch, this, std::placeholders::_1),
+        &options));
+    const int N = 100;
+    std::vector<CallArg> args(N);
+    std::vector<bthread_t> tids(N);
+    for (int i = 0; i < N; ++i) {
+        args[i].test = this;
+        args[i].batcher = &batcher;
+        ASSERT_EQ(0, bthread_start_background(&tids[i], NULL, AddCall, &args[i]));
+    }
+    for (int i = 0; i < N; ++i) {
+        bthread_join(tids[i], NULL);
+    }
+    for (int i = 0; i < 100 && _ndone.load() != N; ++i) {
+        bthread_usleep(10000);
+    }
+    ASSERT_EQ(N, _ndone.load());
+    size_t total = 0;
+    for (size_t i = 0; i < _batch_sizes.size(); ++i) {
+        ASSERT_LE(_batch_sizes[i], 8UL);
+        total += _batch_sizes[i];
+    }
+    ASSERT_EQ((size_t)N, total);
+}
+
+} // namespace
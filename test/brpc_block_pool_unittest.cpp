@@ -85,6 +85,15 @@ TEST_F(BlockPoolTest, single_thread) {
         DeallocBlock(buf[i]);
         buf[i] = NULL;
     }
+    for (size_t i = 0; i < num; ++i) {
+        buf[i] = AllocBlock(GetBlockSize(1) + 1);
+        EXPECT_TRUE(buf[i] != NULL);
+        EXPECT_EQ(3, GetBlockType(buf[i]));
+    }
+    for (int i = num - 1; i >= 0; --i) {
+        DeallocBlock(buf[i]);
+        buf[i] = NULL;
+    }
 
     DestroyBlockPool();
 }
@@ -136,7 +145,7 @@ TEST_F(BlockPoolTest, extend) {
     size_t num = 15 * 64 * 1024 * 1024 / GetBlockSize(2);
     void* buf[num];
     for (size_t i = 0; i < num; ++i) {
-        buf[i] = AllocBlock(65537);
+        buf[i] = AllocBlock(GetBlockSize(2));
         EXPECT_TRUE(buf[i] != NULL);
     }
     EXPECT_EQ(16, GetRegionNum());
@@ -159,7 +168,7 @@ TEST_F(BlockPoolTest, memory_not_enough) {
     size_t num = 64 * 1024 * 1024 / GetBlockSize(2);
     void* buf[num];
     for (size_t i = 0; i < num; ++i) {
-        buf[i] = AllocBlock(65537);
+        buf[i] = AllocBlock(GetBlockSize(2));
         EXPECT_TRUE(buf[i] != NULL);
     }
     EXPECT_EQ(2, GetRegionNum());
@@ -26,6 +26,7 @@
 #include <google/protobuf/descriptor.h>
 #include "butil/time.h"
 #include "butil/macros.h"
+#include "butil/atomicops.h"
 #include "butil/logging.h"
 #include "butil/files/temp_file.h"
 #include "brpc/socket.h"
@@ -36,6 +37,7 @@
 #include "brpc/policy/most_common_message.h"
 #include "brpc/channel.h"
 #include "brpc/details/load_balancer_with_naming.h"
+#include "brpc/details/adaptive_throttler.h"
 #include "brpc/parallel_channel.h"
 #include "brpc/selective_channel.h"
 #include "brpc/socket_map.h"
@@ -48,6 +50,9 @@ DECLARE_int32(idle_timeout_second);
 DECLARE_int32(max_connection_pool_size);
 class Server;
 class MethodStatus;
+int RampUpPartitionWeight(int w, int64_t ramp_up_us,
+                          butil::atomic<int64_t>* ready_since_us,
+                          int64_t now_us);
 namespace policy {
 void SendRpcResponse(int64_t correlation_id,
                      Controller* cntl,
@@ -587,6 +592,40 @@ protected:
         size_t _index{0};
     };
 
+    // Sub calls except the first `nfast' ones sleep for a while.
+    class SlowTailCallMapper : public brpc::CallMapper {
+    public:
+        explicit SlowTailCallMapper(int nfast) : _nfast(nfast) {}
+        brpc::SubCall Map(int channel_index,
+                          const google::protobuf::MethodDescriptor* method,
+                          const google::protobuf::Message* req_base,
+                          google::protobuf::Message* response) override {
+            auto req = brpc::Clone<test::EchoRequest>(req_base);
+            req->set_code(channel_index + 1/*non-zero*/);
+            if (channel_index >= _nfast) {
+                req->set_sleep_us(100 * 1000);
+            }
+            return brpc::SubCall(method, req, response->New(),
+                                 brpc::DELETE_REQUEST | brpc::DELETE_RESPONSE);
+        }
+    private:
+        int _nfast;
+    };
+
+    // Finish the RPC after merging `nmerge' responses.
+    class FinishAfterN : public brpc::ResponseMerger {
+    public:
+        explicit FinishAfterN(int nmerge) : _nmerge(nmerge), _merged(0) {}
+        Result Merge(google::protobuf::Message* response,
+                     const google::protobuf::Message* sub_response) override {
+            response->MergeFrom(*sub_response);
+            return ++_merged >= _nmerge ? FINISH : MERGED;
+        }
+    private:
+        int _nmerge;
+        int _merged;
+    };
+
     class MergeNothing : public brpc::ResponseMerger {
         Result Merge(google::protobuf::Message* /*response*/,
                      const google::protobuf::Message* /*sub_response*/) {
@@ -898,6 +937,60 @@ protected:
         StopAndJoin();
     }
 
+    void TestIncrementalMergeParallel(bool single_server, bool async,
+                                      bool short_connection) {
+        std::cout << " *** single=" << single_server
+                  << " async=" << async
+                  << " short=" << short_connection << std::endl;
+
+        ASSERT_EQ(0, StartAccept(_ep));
+        const int NCHANS = 8;
+        const int NFAST = 3;
+        brpc::Channel subchans[NCHANS];
+        brpc::ParallelChannel channel;
+        brpc::ParallelChannelOptions options;
+        options.incremental_merge = true;
+        channel.Init(&options);
+        butil::intrusive_ptr<brpc::CallMapper> call_mapper(
+            new SlowTailCallMapper(NFAST));
+        // Merger is called one by one and does not need to be thread-safe.
+        butil::intrusive_ptr<brpc::ResponseMerger> merger(new FinishAfterN(NFAST));
+        for (int i = 0; i < NCHANS; ++i) {
+            SetUpChannel(&subchans[i], single_server, short_connection);
+            ASSERT_EQ(0, channel.AddChannel(
+                &subchans[i], brpc::DOESNT_OWN_CHANNEL, call_mapper, merger));
+        }
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(__FUNCTION__);
+        req.set_code(23);
+        const int64_t start_time = butil::gettimeofday_us();
+        CallMethod(&channel, &cntl, &req, &res, async);
+        // Not waiting for slow sub calls.
+        EXPECT_LT(butil::gettimeofday_us(), start_time + 50000L);
+
+        EXPECT_EQ(0, cntl.ErrorCode()) << cntl.ErrorText();
+        EXPECT_EQ(NCHANS, cntl.sub_count());
+        for (int i = 0; i < cntl.sub_count(); ++i) {
+            ASSERT_TRUE(cntl.sub(i)) << "i=" << i;
+            // Responses are deleted after merging.
+            EXPECT_TRUE(cntl.sub(i)->response() == NULL) << "i=" << i;
+            if (i < NFAST) {
+                EXPECT_FALSE(cntl.sub(i)->Failed()) << "i=" << i;
+            } else {
+                EXPECT_EQ(brpc::EPCHANFINISH, cntl.sub(i)->ErrorCode()) << "i=" << i;
+            }
+        }
+        ASSERT_EQ(NFAST, res.code_list_size());
+        std::vector<int> codes(res.code_list().begin(), res.code_list().end());
+        std::sort(codes.begin(), codes.end());
+        for (int i = 0; i < NFAST; ++i) {
+            EXPECT_EQ(i + 1, codes[i]);
+        }
+        StopAndJoin();
+    }
+
     struct CancelerArg {
         int64_t sleep_before_cancel_us;
         brpc::CallId cid;
@@ -2330,6 +2423,29 @@ TEST_F(ChannelTest, connection_failed) {
     }
 }
 
+TEST_F(ChannelTest, inherited_deadline) {
+    brpc::Channel channel;
+    SetUpChannel(&channel, true, false);
+    test::EchoRequest req;
+    test::EchoResponse res;
+    req.set_message(__FUNCTION__);
+
+    brpc::Controller::Inheritable ctx;
+    ctx.deadline_us = butil::gettimeofday_us() - 1000;
+    brpc::Controller cntl(ctx);
+    CallMethod(&channel, &cntl, &req, &res, false);
+    EXPECT_EQ(brpc::ERPCTIMEDOUT, cntl.ErrorCode()) << cntl.ErrorText();
+
+    // The timeout is truncated to the time left.
+    ctx.deadline_us = butil::gettimeofday_us() + 500000;
+    brpc::Controller cntl2(ctx);
+    cntl2.set_timeout_ms(10000);
+    CallMethod(&channel, &cntl2, &req, &res, false);
+    EXPECT_EQ(ECONNREFUSED, cntl2.ErrorCode()) << cntl2.ErrorText();
+    EXPECT_LE(cntl2.timeout_ms(), 500);
+    EXPECT_GT(cntl2.timeout_ms(), 0);
+}
+
 TEST_F(ChannelTest, empty_parallel_channel) {
     brpc::ParallelChannel channel;
 
@@ -2452,6 +2568,34 @@ TEST_F(ChannelTest, success_parallel) {
     }
 }
 
+TEST_F(ChannelTest, parallel_shares_serialized_request) {
+    ASSERT_EQ(0, StartAccept(_ep));
+    const size_t NCHANS = 4;
+    brpc::Channel subchans[NCHANS];
+    brpc::ParallelChannel channel;
+    for (size_t i = 0; i < NCHANS; ++i) {
+        SetUpChannel(&subchans[i], true, false);
+        ASSERT_EQ(0, channel.AddChannel(
+                      &subchans[i], brpc::DOESNT_OWN_CHANNEL, NULL, NULL));
+    }
+    brpc::Controller cntl;
+    test::EchoRequest req;
+    test::EchoResponse res;
+    req.set_message(__FUNCTION__);
+    CallMethod(&channel, &cntl, &req, &res, false);
+    ASSERT_EQ(0, cntl.ErrorCode()) << cntl.ErrorText();
+    ASSERT_EQ((int)NCHANS, cntl.sub_count());
+    // Sub calls share blocks of the request serialized once.
+    const butil::IOBuf& buf0 = cntl.sub(0)->_request_buf;
+    ASSERT_FALSE(buf0.empty());
+    for (int i = 1; i < cntl.sub_count(); ++i) {
+        const butil::IOBuf& buf = cntl.sub(i)->_request_buf;
+        ASSERT_EQ(buf0, buf);
+        ASSERT_EQ(buf0.backing_block(0).data(), buf.backing_block(0).data());
+    }
+    StopAndJoin();
+}
+
 TEST_F(ChannelTest, success_duplicated_parallel) {
     for (int i = 0; i <= 1; ++i) { // Flag SingleServer
         for (int j = 0; j <= 1; ++j) { // Flag Asynchronous
@@ -2502,6 +2646,16 @@ TEST_F(ChannelTest, success_limit_parallel) {
     }
 }
 
+TEST_F(ChannelTest, incremental_merge_parallel) {
+    for (int i = 0; i <= 1; ++i) { // Flag SingleServer
+        for (int j = 0; j <= 1; ++j) { // Flag Asynchronous
+            for (int k = 0; k <=1; ++k) { // Flag ShortConnection
+                TestIncrementalMergeParallel(i, j, k);
+            }
+        }
+    }
+}
+
 TEST_F(ChannelTest, cancel_before_callmethod) {
     for (int i = 0; i <= 1; ++i) { // Flag SingleServer 
         for (int j = 0; j <= 1; ++j) { // Flag Asynchronous
@@ -2803,6 +2957,190 @@ TEST_F(ChannelTest, backup_request_policy) {
     }
 }
 
+TEST_F(ChannelTest, adaptive_backup_request_policy) {
+    brpc::AdaptiveBackupRequestPolicy policy(0.9, 0.05, 100);
+    // Not enough samples.
+    ASSERT_EQ(100, policy.GetBackupRequestMs(NULL));
+    // 95% of RPCs finish in 2ms.
+    for (int i = 0; i < 1000; ++i) {
+        brpc::Controller cntl;
+        cntl._begin_time_us = 0;
+        cntl._end_time_us = (i % 20 == 0 ? 50000 : 2000);
+        policy.OnRPCEnd(&cntl);
+    }
+    // Wait for the window of the latency recorder to be sampled.
+    int32_t backup_ms = 100;
+    for (int i = 0; i < 30 && backup_ms == 100; ++i) {
+        bthread_usleep(200000);
+        backup_ms = policy.GetBackupRequestMs(NULL);
+    }
+    ASSERT_LE(backup_ms, 10);
+    ASSERT_GE(backup_ms, 1);
+
+    // The bucket is full after so many RPCs, and drained by a burst of
+    // backup requests.
+    int nbackup = 0;
+    for (int i = 0; i < 100; ++i) {
+        nbackup += policy.DoBackup(NULL);
+    }
+    ASSERT_EQ(10, nbackup);
+    // Refilled by 5% of following RPCs.
+    for (int i = 0; i < 100; ++i) {
+        brpc::Controller cntl;
+        cntl._begin_time_us = 0;
+        cntl._end_time_us = 2000;
+        policy.OnRPCEnd(&cntl);
+    }
+    nbackup = 0;
+    for (int i = 0; i < 100; ++i) {
+        nbackup += policy.DoBackup(NULL);
+    }
+    ASSERT_EQ(5, nbackup);
+}
+
+TEST_F(ChannelTest, retry_budget) {
+    brpc::RetryBudget budget(0.1, 0);
+    // One token at least is saved.
+    ASSERT_TRUE(budget.TryRetry());
+    ASSERT_FALSE(budget.TryRetry());
+    int nretry = 0;
+    for (int i = 0; i < 100; ++i) {
+        budget.OnRequest();
+        nretry += budget.TryRetry();
+    }
+    ASSERT_EQ(10, nretry);
+    ASSERT_NE("", bvar::Variable::describe_exposed(
+                      "rpc_client_retry_budget_exhausted_count"));
+
+    // Tokens of 10 seconds are saved, and refilled over time.
+    brpc::RetryBudget budget2(0, 100);
+    nretry = 0;
+    while (budget2.TryRetry()) {
+        ++nretry;
+    }
+    ASSERT_GE(nretry, 1000);
+    ASSERT_LE(nretry, 1010);
+    bthread_usleep(100000);
+    nretry = 0;
+    while (budget2.TryRetry()) {
+        ++nretry;
+    }
+    ASSERT_GE(nretry, 5);
+    ASSERT_LE(nretry, 20);
+}
+
+TEST_F(ChannelTest, retry_budget_burst) {
+    const int64_t window_us = brpc::RetryBudget::WINDOW_SECONDS * 1000000L;
+    brpc::RetryBudget budget(0.1, 0);
+    int64_t now_us = butil::gettimeofday_us();
+    ASSERT_TRUE(budget.TryRetry(now_us));
+    // Tokens deposited by requests in the window can be withdrawn in a burst.
+    for (int i = 0; i < 1000; ++i) {
+        budget.OnRequest(now_us + i * 1000);
+    }
+    now_us += 1000000;
+    int nretry = 0;
+    while (budget.TryRetry(now_us)) {
+        ++nretry;
+    }
+    ASSERT_EQ(100, nretry);
+
+    // Tokens saved by requests out of the window are dropped, no matter how
+    // many requests were sent before.
+    for (int i = 0; i < 100000; ++i) {
+        budget.OnRequest(now_us);
+    }
+    for (int i = 0; i < 100; ++i) {
+        budget.OnRequest(now_us + window_us);
+    }
+    nretry = 0;
+    while (budget.TryRetry(now_us + window_us)) {
+        ++nretry;
+    }
+    ASSERT_EQ(10, nretry);
+    // Only one token is saved after being idle for a window.
+    for (int i = 0; i < 100000; ++i) {
+        budget.OnRequest(now_us + 2 * window_us);
+    }
+    ASSERT_TRUE(budget.TryRetry(now_us + 4 * window_us));
+    ASSERT_FALSE(budget.TryRetry(now_us + 4 * window_us));
+
+    // The minimum rate is saved for a window at most.
+    brpc::RetryBudget budget2(0.1, 10);
+    now_us = butil::gettimeofday_us();
+    for (int i = 0; i < 100; ++i) {
+        budget2.OnRequest(now_us);
+    }
+    nretry = 0;
+    while (budget2.TryRetry(now_us + 5 * window_us)) {
+        ++nretry;
+    }
+    ASSERT_EQ(10 * brpc::RetryBudget::WINDOW_SECONDS, nretry);
+}
+
+TEST_F(ChannelTest, adaptive_throttler) {
+    brpc::AdaptiveThrottler throttler(2);
+    ASSERT_EQ(0, throttler.RejectProbability());
+    // Nothing is rejected while servers accept requests.
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_FALSE(throttler.OnRequest());
+        throttler.OnResponse(i % 2 ? 0 : brpc::ERPCTIMEDOUT);
+    }
+    ASSERT_EQ(0, throttler.RejectProbability());
+    // Requests are not throttled either when servers reject half of them,
+    // as long as accepts are more than 1/k of requests.
+    for (int i = 0; i < 1000; ++i) {
+        if (!throttler.OnRequest()) {
+            throttler.OnResponse(i % 2 ? 0 : brpc::ELIMIT);
+        }
+    }
+    ASSERT_EQ(0, throttler.RejectProbability());
+    // Requests are throttled when servers reject all of them.
+    int nrejected = 0;
+    for (int i = 0; i < 20000; ++i) {
+        if (throttler.OnRequest()) {
+            ++nrejected;
+        } else {
+            throttler.OnResponse(brpc::EOVERCROWDED);
+        }
+    }
+    // Requests are rejected after reaching k times of the 1500 accepts.
+    ASSERT_GT(nrejected, 10000);
+    ASSERT_GT(throttler.RejectProbability(), 0.8);
+    ASSERT_NE("", bvar::Variable::describe_exposed(
+                      "rpc_client_throttled_count"));
+}
+
+TEST_F(ChannelTest, adaptive_throttling) {
+    ASSERT_EQ(0, StartAccept(_ep));
+    brpc::Channel channel;
+    brpc::ChannelOptions opt;
+    opt.adaptive_throttling_k = 1.1;
+    ASSERT_EQ(0, channel.Init(_ep, &opt));
+    ASSERT_TRUE(channel._throttler != NULL);
+    // Make the throttler reject almost all requests.
+    for (int i = 0; i < 1000; ++i) {
+        channel._throttler->OnRequest();
+    }
+    ASSERT_GT(channel._throttler->RejectProbability(), 0.9);
+    int nrejected = 0;
+    for (int i = 0; i < 10; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(__FUNCTION__);
+        CallMethod(&channel, &cntl, &req, &res, false);
+        if (cntl.ErrorCode() == brpc::ELIMIT) {
+            ++nrejected;
+            ASSERT_EQ(0, cntl.retried_count());
+        } else {
+            ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        }
+    }
+    ASSERT_GE(nrejected, 5);
+    StopAndJoin();
+}
+
 TEST_F(ChannelTest, multiple_threads_single_channel) {
     srand(time(NULL));
     ASSERT_EQ(0, StartAccept(_ep));
@@ -3017,4 +3355,44 @@ TEST_F(ChannelTest, adaptive_protocol_type) {
     ASSERT_EQ("", ptype.param());
 }
 
+TEST_F(ChannelTest, partition_weight_ramp_up) {
+    const int64_t ramp_up_us = 1000000;
+    const int64_t t0 = 5000000;
+    butil::atomic<int64_t> since(0);
+    // Ramping starts from the first selection, at least 1 so that the
+    // partitioning method can be selected.
+    ASSERT_EQ(1, brpc::RampUpPartitionWeight(10, ramp_up_us, &since, t0));
+    ASSERT_EQ(t0, since.load());
+    // Grows linearly to the full weight which is scaled by 256.
+    for (int i = 1; i <= 10; ++i) {
+        ASSERT_EQ(2560 * i / 10, brpc::RampUpPartitionWeight(
+                      10, ramp_up_us, &since, t0 + ramp_up_us * i / 10));
+    }
+    ASSERT_EQ(1280, brpc::RampUpPartitionWeight(
+                  5, ramp_up_us, &since, t0 + ramp_up_us * 2));
+    ASSERT_EQ(t0, since.load());
+
+    // A partition has no servers, ramp up again when it comes back.
+    const int64_t t1 = t0 + ramp_up_us * 3;
+    ASSERT_EQ(0, brpc::RampUpPartitionWeight(0, ramp_up_us, &since, t1));
+    ASSERT_EQ(0, since.load());
+    ASSERT_EQ(0, brpc::RampUpPartitionWeight(0, ramp_up_us, &since, t1 + 10));
+    const int64_t t2 = t1 + ramp_up_us;
+    ASSERT_EQ(1, brpc::RampUpPartitionWeight(10, ramp_up_us, &since, t2));
+    ASSERT_EQ(t2, since.load());
+    ASSERT_EQ(1280, brpc::RampUpPartitionWeight(
+                  10, ramp_up_us, &since, t2 + ramp_up_us / 2));
+    ASSERT_EQ(2560, brpc::RampUpPartitionWeight(
+                  10, ramp_up_us, &since, t2 + ramp_up_us));
+
+    // No ramping, weights are not scaled.
+    butil::atomic<int64_t> since2(0);
+    const int weights[] = { 0, 1, 7, 100 };
+    for (size_t i = 0; i < ARRAY_SIZE(weights); ++i) {
+        ASSERT_EQ(weights[i], brpc::RampUpPartitionWeight(
+                      weights[i], 0, &since2, t0 + i));
+    }
+    ASSERT_EQ(0, since2.load());
+}
+
 } //namespace
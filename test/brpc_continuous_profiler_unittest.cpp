@@ -0,0 +1,103 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <gtest/gtest.h>
+#include "butil/atomicops.h"
+#include "butil/time.h"
+#include "brpc/details/continuous_profiler.h"
+
+namespace {
+
+butil::atomic<bool> g_stop(false);
+
+// Not inlined to be seen in stacks.
+__attribute__((noinline)) uint64_t ContinuousProfilerBusyLoop() {
+    volatile uint64_t x = 0;
+    while (!g_stop.load(butil::memory_order_relaxed)) {
+        for (int i = 0; i < 10000; ++i) {
+            x = x + i;
+        }
+    }
+    return x;
+}
+
+void* RunBusyLoop(void*) {
+    ContinuousProfilerBusyLoop();
+    return NULL;
+}
+
+TEST(ContinuousProfilerTest, sample_busy_thread) {
+#if defined(OS_LINUX)
+    brpc::FLAGS_continuous_profiling_hz = 99;
+    pthread_t th;
+    ASSERT_EQ(0, pthread_create(&th, NULL, RunBusyLoop, NULL));
+    usleep(10000);
+    // Timers of threads are created when they're scanned.
+    brpc::UpdateContinuousProfiler();
+    ASSERT_TRUE(brpc::IsContinuousProfilerRunning());
+    // This thread sleeps and should not be sampled.
+    usleep(1000000);
+    g_stop.store(true, butil::memory_order_relaxed);
+    ASSERT_EQ(0, pthread_join(th, NULL));
+    brpc::UpdateContinuousProfiler();
+
+    const int64_t now_s = butil::gettimeofday_s();
+    butil::IOBuf out;
+    const int64_t nsample =
+        brpc::DumpContinuousProfile(now_s - 60, now_s + 60, false, &out);
+    // 99 samples are expected, leave a margin for slow machines.
+    ASSERT_GE(nsample, 30) << out;
+
+    // Check leaf frames in the pprof format which are not symbolized.
+    out.clear();
+    ASSERT_EQ(nsample,
+              brpc::DumpContinuousProfile(now_s - 60, now_s + 60, true, &out));
+    const std::string prof = out.to_string();
+    const uintptr_t* p = (const uintptr_t*)prof.data();
+    const uintptr_t* const end = p + prof.size() / sizeof(uintptr_t);
+    // Skip the header.
+    ASSERT_EQ(0u, p[0]);
+    ASSERT_EQ(3u, p[1]);
+    p += 5;
+    const uintptr_t busy_begin = (uintptr_t)ContinuousProfilerBusyLoop;
+    int64_t ntotal = 0;
+    int64_t nbusy = 0;
+    while (p + 2 <= end && p[0] != 0) {
+        const uintptr_t count = p[0];
+        const uintptr_t nframes = p[1];
+        ASSERT_GT(nframes, 0u);
+        ASSERT_LE(p + 2 + nframes, end);
+        // The loop is a few instructions from the beginning.
+        if (p[2] >= busy_begin && p[2] < busy_begin + 256) {
+            nbusy += count;
+        }
+        ntotal += count;
+        p += 2 + nframes;
+    }
+    ASSERT_EQ(nsample, ntotal);
+    // Samples are taken from the thread consuming cpu rather than the
+    // sleeping one.
+    ASSERT_GE(nbusy * 10, nsample * 9);
+
+    brpc::FLAGS_continuous_profiling_hz = 0;
+    brpc::UpdateContinuousProfiler();
+    ASSERT_FALSE(brpc::IsContinuousProfilerRunning());
+#endif
+}
+
+} // namespace
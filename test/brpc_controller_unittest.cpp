@@ -74,6 +74,25 @@ TEST_F(ControllerTest, notify_on_destruction) {
     ASSERT_TRUE(cancel);
 }
 
+TEST_F(ControllerTest, pooled_allocation) {
+    brpc::Controller* cntl = new brpc::Controller;
+    delete cntl;
+    // Memory of the deleted Controller is reused in the same thread.
+    brpc::Controller* cntl2 = new (std::nothrow) brpc::Controller;
+    ASSERT_EQ(cntl, cntl2);
+    delete cntl2;
+
+    const int N = 100000;
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < N; ++i) {
+        delete new brpc::Controller;
+    }
+    tm.stop();
+    LOG(INFO) << "sizeof(Controller)=" << sizeof(brpc::Controller)
+              << " new+delete takes " << tm.n_elapsed() / N << "ns";
+}
+
 #if ! BRPC_WITH_GLOG
 
 static bool endsWith(const std::string& s1, const butil::StringPiece& s2)  {
@@ -175,6 +175,37 @@ Awaitable<void> func(brpc::Channel& channel, int* out) {
     *out = 456;
 }
 
+Awaitable<void> lock_func(bthread::Mutex& mutex, int* counter,
+                          bthread::CountdownEvent& event) {
+    int rc = co_await Coroutine::lock(mutex);
+    EXPECT_EQ(0, rc);
+    ++*counter;
+    mutex.unlock();
+    event.signal();
+}
+
+Awaitable<int> wait_func(bthread::CountdownEvent& event) {
+    int rc = co_await Coroutine::wait(event);
+    co_return rc;
+}
+
+TEST_F(CoroutineTest, lock_and_wait) {
+    const int N = 8;
+    bthread::Mutex mutex;
+    bthread::CountdownEvent event(N);
+    int counter = 0;
+    Coroutine waiter(wait_func(event));
+    mutex.lock();
+    for (int i = 0; i < N; ++i) {
+        // Suspended at co_await since the mutex is held.
+        Coroutine(lock_func(mutex, &counter, event), true);
+    }
+    ASSERT_EQ(0, counter);
+    mutex.unlock();
+    ASSERT_EQ(0, waiter.join<int>());
+    ASSERT_EQ(N, counter);
+}
+
 TEST_F(CoroutineTest, coroutine) {
     butil::EndPoint ep;
     ASSERT_EQ(0, str2endpoint("127.0.0.1:8613", &ep));
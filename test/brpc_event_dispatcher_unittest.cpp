@@ -29,6 +29,7 @@
 #include "butil/fd_utility.h"
 #include "butil/memory/scope_guard.h"
 #include "bthread/bthread.h"
+#include "bvar/variable.h"
 #include "brpc/event_dispatcher.h"
 #include "brpc/socket.h"
 #include "brpc/details/has_epollrdhup.h"
@@ -515,3 +516,152 @@ TEST_F(EventDispatcherTest, customize_dispatch_task) {
     ASSERT_EQ(nullptr, ptr);
     ASSERT_NE(0, EventPipe::Address(id, &ptr));
 }
+
+namespace brpc {
+DECLARE_bool(event_dispatcher_io_uring);
+}
+
+static butil::atomic<int> g_io_uring_input_count(0);
+
+static int OnIoUringInput(void* user_data, uint32_t, const bthread_attr_t&) {
+    const int fd = (int)(intptr_t)user_data;
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+        g_io_uring_input_count.fetch_add(1, butil::memory_order_relaxed);
+    }
+    return 0;
+}
+
+static int OnIoUringOutput(void*, uint32_t, const bthread_attr_t&) {
+    return 0;
+}
+
+TEST_F(EventDispatcherTest, io_uring_backend) {
+    // Make sure bvars of dispatchers are created.
+    brpc::GetGlobalEventDispatcher(0, BTHREAD_TAG_DEFAULT);
+    brpc::FLAGS_event_dispatcher_io_uring = true;
+    brpc::EventDispatcher* edisp = new brpc::EventDispatcher;
+    brpc::FLAGS_event_dispatcher_io_uring = false;
+    ASSERT_EQ(0, edisp->Start(NULL));
+
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    butil::make_non_blocking(fds[0]);
+    brpc::IOEventDataId id;
+    brpc::IOEventDataOptions options{
+        OnIoUringInput, OnIoUringOutput, (void*)(intptr_t)fds[0] };
+    ASSERT_EQ(0, brpc::IOEventData::Create(&id, options));
+    ASSERT_EQ(0, edisp->AddConsumer(id, fds[0]));
+    ASSERT_EQ(-1, edisp->AddConsumer(id, fds[0]));
+
+    const int N = 100;
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(1, write(fds[1], "x", 1));
+        usleep(1000);
+    }
+    usleep(50 * 1000);
+    ASSERT_GT(g_io_uring_input_count.load(), 0);
+    ASSERT_EQ(0, edisp->RemoveConsumer(fds[0]));
+    ASSERT_EQ(-1, edisp->RemoveConsumer(fds[0]));
+
+    brpc::IOEventData::SetFailedById(id);
+    edisp->Stop();
+    edisp->Join();
+    delete edisp;
+    close(fds[0]);
+    close(fds[1]);
+}
+
+namespace brpc {
+DECLARE_int32(event_dispatcher_busy_poll_us);
+}
+
+TEST_F(EventDispatcherTest, busy_poll) {
+    // Make sure bvars of dispatchers are created.
+    brpc::GetGlobalEventDispatcher(0, BTHREAD_TAG_DEFAULT);
+    brpc::FLAGS_event_dispatcher_busy_poll_us = 1000;
+    brpc::EventDispatcher* edisp = new brpc::EventDispatcher;
+    ASSERT_EQ(0, edisp->Start(NULL));
+
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    butil::make_non_blocking(fds[0]);
+    brpc::IOEventDataId id;
+    brpc::IOEventDataOptions options{
+        OnIoUringInput, OnIoUringOutput, (void*)(intptr_t)fds[0] };
+    ASSERT_EQ(0, brpc::IOEventData::Create(&id, options));
+    ASSERT_EQ(0, edisp->AddConsumer(id, fds[0]));
+
+    const int before = g_io_uring_input_count.load();
+    const int N = 100;
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(1, write(fds[1], "x", 1));
+        usleep(100);
+    }
+    usleep(50 * 1000);
+    ASSERT_GT(g_io_uring_input_count.load(), before);
+    const std::string spin_count =
+        bvar::Variable::describe_exposed("event_dispatcher_spin_count");
+    LOG(INFO) << "spin_count=" << spin_count;
+    ASSERT_FALSE(spin_count.empty());
+    ASSERT_NE("0", spin_count);
+    brpc::FLAGS_event_dispatcher_busy_poll_us = 0;
+
+    ASSERT_EQ(0, edisp->RemoveConsumer(fds[0]));
+    brpc::IOEventData::SetFailedById(id);
+    edisp->Stop();
+    edisp->Join();
+    delete edisp;
+    close(fds[0]);
+    close(fds[1]);
+}
+
+namespace brpc {
+DECLARE_bool(event_dispatcher_load_aware);
+DECLARE_int32(event_dispatcher_num);
+}
+
+TEST_F(EventDispatcherTest, event_and_consumer_count) {
+    brpc::EventDispatcher* edisp = new brpc::EventDispatcher;
+    ASSERT_EQ(0, edisp->Start(NULL));
+    ASSERT_EQ(0, edisp->consumer_count());
+
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    butil::make_non_blocking(fds[0]);
+    brpc::IOEventDataId id;
+    brpc::IOEventDataOptions options{
+        OnIoUringInput, OnIoUringOutput, (void*)(intptr_t)fds[0] };
+    ASSERT_EQ(0, brpc::IOEventData::Create(&id, options));
+    ASSERT_EQ(0, edisp->AddConsumer(id, fds[0]));
+    ASSERT_EQ(1, edisp->consumer_count());
+
+    const int64_t before = edisp->event_count();
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(1, write(fds[1], "x", 1));
+        usleep(1000);
+    }
+    usleep(50 * 1000);
+    ASSERT_GT(edisp->event_count(), before);
+
+    ASSERT_EQ(0, edisp->RemoveConsumer(fds[0]));
+    ASSERT_EQ(0, edisp->consumer_count());
+    brpc::IOEventData::SetFailedById(id);
+    edisp->Stop();
+    edisp->Join();
+    delete edisp;
+    close(fds[0]);
+    close(fds[1]);
+
+    // Fds are hashed when the flag is off or there's only one dispatcher.
+    ASSERT_EQ(-1, brpc::PickEventDispatcherIndex(BTHREAD_TAG_DEFAULT));
+    brpc::FLAGS_event_dispatcher_load_aware = true;
+    if (brpc::FLAGS_event_dispatcher_num == 1) {
+        ASSERT_EQ(-1, brpc::PickEventDispatcherIndex(BTHREAD_TAG_DEFAULT));
+    } else {
+        const int index = brpc::PickEventDispatcherIndex(BTHREAD_TAG_DEFAULT);
+        ASSERT_GE(index, 0);
+        ASSERT_LT(index, brpc::FLAGS_event_dispatcher_num);
+    }
+    brpc::FLAGS_event_dispatcher_load_aware = false;
+}
@@ -0,0 +1,95 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "brpc/policy/gradient_concurrency_limiter.h"
+#include "brpc/concurrency_limiter.h"
+#include "brpc/global.h"
+#include "butil/time.h"
+#include <gtest/gtest.h>
+
+namespace brpc {
+namespace policy {
+DECLARE_int32(gradient_cl_initial_max_concurrency);
+DECLARE_int32(gradient_cl_sample_window_size_ms);
+DECLARE_int32(gradient_cl_min_sample_count);
+}  // namespace policy
+}  // namespace brpc
+
+// Submit a sample window of `count' requests with `latency_us' each at
+// `*now_us' with `inflight' requests in flight, and move `*now_us' to the
+// next window.
+static void SubmitWindow(brpc::policy::GradientConcurrencyLimiter* limiter,
+                         int inflight, int64_t latency_us, int64_t* now_us) {
+    ASSERT_TRUE(limiter->OnRequested(inflight, NULL));
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_FALSE(limiter->AddSample(0, latency_us, *now_us + i));
+    }
+    *now_us += brpc::policy::FLAGS_gradient_cl_sample_window_size_ms * 1000;
+    ASSERT_TRUE(limiter->AddSample(0, latency_us, *now_us));
+}
+
+TEST(GradientConcurrencyLimiterTest, AddSample) {
+    brpc::policy::FLAGS_gradient_cl_sample_window_size_ms = 10;
+    brpc::policy::FLAGS_gradient_cl_min_sample_count = 5;
+    brpc::policy::FLAGS_gradient_cl_initial_max_concurrency = 40;
+    brpc::policy::GradientConcurrencyLimiter limiter;
+    int64_t now_us = butil::gettimeofday_us();
+
+    // Windows with insufficient samples are discarded.
+    ASSERT_FALSE(limiter.AddSample(0, 100, now_us));
+    ASSERT_FALSE(limiter.AddSample(0, 100, now_us + 10 * 1000));
+    ASSERT_EQ(0, limiter._sw.succ_count);
+    ASSERT_EQ(0, limiter._long_rtt_count);
+    now_us += 10 * 1000;
+
+    // The limit grows by the queue size while latency is stable.
+    for (int i = 0; i < 20; ++i) {
+        const int limit = limiter.MaxConcurrency();
+        SubmitWindow(&limiter, limit, 100, &now_us);
+        ASSERT_GT(limiter.MaxConcurrency(), limit);
+    }
+    ASSERT_EQ(100, (int)limiter._long_rtt_us);
+    ASSERT_FALSE(limiter.OnRequested(limiter.MaxConcurrency() + 1, NULL));
+
+    // The limit is not grown when the traffic doesn't reach it.
+    int limit = limiter.MaxConcurrency();
+    SubmitWindow(&limiter, limit / 4, 100, &now_us);
+    ASSERT_EQ(limit, limiter.MaxConcurrency());
+
+    // The limit shrinks when the latency goes up.
+    for (int i = 0; i < 10; ++i) {
+        limit = limiter.MaxConcurrency();
+        SubmitWindow(&limiter, limit, 1000, &now_us);
+        ASSERT_LT(limiter.MaxConcurrency(), limit);
+    }
+    ASSERT_EQ(1000, limiter._short_rtt_bvar.get_value());
+    ASSERT_GE(limiter.MaxConcurrency(), 20);
+}
+
+TEST(GradientConcurrencyLimiterTest, Registered) {
+    brpc::GlobalInitializeOrDie();
+    brpc::AdaptiveMaxConcurrency amc("gradient");
+    ASSERT_EQ("gradient", amc.type());
+    const brpc::ConcurrencyLimiter* cl =
+        brpc::ConcurrencyLimiterExtension()->Find("gradient");
+    ASSERT_TRUE(cl != NULL);
+    std::unique_ptr<brpc::ConcurrencyLimiter> limiter(cl->New(amc));
+    ASSERT_EQ(40, limiter->MaxConcurrency());
+    ASSERT_EQ(0, limiter->Expose("gradient_cl_unittest"));
+    ASSERT_NE("", bvar::Variable::describe_exposed(
+                      "gradient_cl_unittest_cl_limit"));
+}
@@ -22,6 +22,7 @@
 #include "brpc/server.h"
 #include "brpc/channel.h"
 #include "brpc/grpc.h"
+#include "brpc/stream.h"
 #include "butil/time.h"
 #include "grpc.pb.h"
 
@@ -47,6 +48,61 @@ const std::string g_req = "wyt";
 const int64_t g_timeout_ms = 1000;
 const std::string g_protocol = "h2:grpc";
 
+// Echo messages of the stream until the client half-closes.
+class EchoStreamHandler : public brpc::StreamInputHandler {
+public:
+    EchoStreamHandler() : half_closed(false), closed(false) {}
+
+    int on_received_messages(brpc::StreamId id,
+                             butil::IOBuf *const messages[],
+                             size_t size) override {
+        for (size_t i = 0; i < size; ++i) {
+            EXPECT_EQ(0, brpc::StreamWrite(id, *messages[i]));
+        }
+        return 0;
+    }
+
+    void on_idle_timeout(brpc::StreamId) override {}
+
+    void on_half_closed(brpc::StreamId id) override {
+        half_closed = true;
+        brpc::StreamClose(id);
+    }
+
+    void on_closed(brpc::StreamId) override { closed = true; }
+
+    butil::atomic<bool> half_closed;
+    butil::atomic<bool> closed;
+};
+
+class CollectStreamHandler : public brpc::StreamInputHandler {
+public:
+    CollectStreamHandler() : closed(false) {}
+
+    int on_received_messages(brpc::StreamId,
+                             butil::IOBuf *const messages[],
+                             size_t size) override {
+        BAIDU_SCOPED_LOCK(mutex);
+        for (size_t i = 0; i < size; ++i) {
+            received.push_back(messages[i]->to_string());
+        }
+        return 0;
+    }
+
+    void on_idle_timeout(brpc::StreamId) override {}
+
+    void on_closed(brpc::StreamId) override { closed = true; }
+
+    size_t received_count() {
+        BAIDU_SCOPED_LOCK(mutex);
+        return received.size();
+    }
+
+    butil::Mutex mutex;
+    std::vector<std::string> received;
+    butil::atomic<bool> closed;
+};
+
 class MyGrpcService : public ::test::GrpcService {
 public:
     void Method(::google::protobuf::RpcController* cntl_base,
@@ -86,6 +142,21 @@ public:
         res->set_message(g_prefix + req->message());
         return;
     }
+
+    void BidiStream(::google::protobuf::RpcController* cntl_base,
+                    const ::test::GrpcRequest* req,
+                    ::test::GrpcResponse* res,
+                    ::google::protobuf::Closure* done) {
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        brpc::ClosureGuard done_guard(done);
+        brpc::StreamOptions opt;
+        opt.handler = &stream_handler;
+        brpc::StreamId sid;
+        EXPECT_EQ(0, brpc::StreamAccept(&sid, *cntl, &opt));
+        res->set_message(g_prefix + req->message());
+    }
+
+    EchoStreamHandler stream_handler;
 };
 
 class GrpcTest : public ::testing::Test {
@@ -272,4 +343,44 @@ TEST_F(GrpcTest, GrpcTimeOut) {
     }
 }
 
+TEST_F(GrpcTest, bidi_stream) {
+    CollectStreamHandler handler;
+    brpc::StreamOptions opt;
+    opt.handler = &handler;
+    brpc::Controller cntl;
+    brpc::StreamId sid;
+    ASSERT_EQ(0, brpc::StreamCreate(&sid, cntl, &opt));
+    test::GrpcRequest req;
+    test::GrpcResponse res;
+    req.set_message(g_req);
+    req.set_gzip(false);
+    req.set_return_error(false);
+    test::GrpcService_Stub stub(&_channel);
+    stub.BidiStream(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(g_prefix + g_req, res.message());
+
+    const int N = 100;
+    for (int i = 0; i < N; ++i) {
+        butil::IOBuf msg;
+        msg.append(butil::string_printf("message-%d", i));
+        ASSERT_EQ(0, brpc::StreamWrite(sid, msg));
+    }
+    for (int i = 0; i < 1000 && handler.received_count() < (size_t)N; ++i) {
+        bthread_usleep(1000);
+    }
+    ASSERT_EQ((size_t)N, handler.received_count());
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(butil::string_printf("message-%d", i), handler.received[i]);
+    }
+    // Half-close the call, the server closes its side on that.
+    ASSERT_EQ(0, brpc::StreamClose(sid));
+    for (int i = 0; i < 1000 && !_svc.stream_handler.closed; ++i) {
+        bthread_usleep(1000);
+    }
+    ASSERT_TRUE(_svc.stream_handler.half_closed);
+    ASSERT_TRUE(_svc.stream_handler.closed);
+    ASSERT_TRUE(handler.closed);
+}
+
 } // namespace 
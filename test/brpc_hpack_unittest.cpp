@@ -22,6 +22,7 @@
 #include <gtest/gtest.h>
 #include "brpc/details/hpack.h"
 #include "butil/logging.h"
+#include "butil/time.h"
 
 class HPackTest : public testing::Test {
 };
@@ -548,3 +549,106 @@ TEST_F(HPackTest, responses_with_huffman) {
     }
     ASSERT_TRUE(buf.buf().empty());
 }
+
+TEST_F(HPackTest, huffman_all_bytes) {
+    brpc::HPacker p1;
+    ASSERT_EQ(0, p1.Init(4096));
+    brpc::HPacker p2;
+    ASSERT_EQ(0, p2.Init(4096));
+    brpc::HPackOptions options;
+    options.encode_name = true;
+    options.encode_value = true;
+    options.index_policy = brpc::HPACK_NEVER_INDEX_HEADER;
+    // Values of all lengths cover all paddings.
+    std::string value;
+    for (int i = 0; i < 600; ++i) {
+        value.push_back((char)((i * 131) & 0xFF));
+        brpc::HPacker::Header h("x-all-bytes", value);
+        butil::IOBufAppender buf;
+        p1.Encode(&buf, h, options);
+        brpc::HPacker::Header h2;
+        ASSERT_GT(p2.Decode(&buf.buf(), &h2), 0);
+        ASSERT_EQ(h.name, h2.name);
+        ASSERT_EQ(h.value, h2.value) << i;
+        ASSERT_TRUE(buf.buf().empty());
+    }
+}
+
+TEST_F(HPackTest, huffman_malformed) {
+    brpc::HPacker p;
+    ASSERT_EQ(0, p.Init(4096));
+    // Literal never indexed with indexed name `:authority'
+    const uint8_t prefix[] = { 0x11 };
+    struct {
+        uint8_t data[8];
+        size_t size;
+        bool valid;
+    } cases[] = {
+        // "a" is 00011, padded with 111
+        { { 0x81, 0x1f }, 2, true },
+        // Padding with 0s
+        { { 0x81, 0x18 }, 2, false },
+        // Padding of 8 bits
+        { { 0x82, 0x1f, 0xff }, 3, false },
+        // EOS, 30 1s
+        { { 0x84, 0xff, 0xff, 0xff, 0xfc }, 5, false },
+        // Incomplete code of 8 bits, a prefix of "!"
+        { { 0x81, 0xfe }, 2, false },
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(cases); ++i) {
+        butil::IOBuf buf;
+        buf.append(prefix, sizeof(prefix));
+        buf.append(cases[i].data, cases[i].size);
+        brpc::HPacker::Header h;
+        const ssize_t rc = p.Decode(&buf, &h);
+        if (cases[i].valid) {
+            ASSERT_EQ((ssize_t)(cases[i].size + 1), rc) << i;
+            ASSERT_EQ(":authority", h.name);
+            ASSERT_EQ("a", h.value);
+        } else {
+            ASSERT_EQ(-1, rc) << i;
+        }
+    }
+}
+
+TEST_F(HPackTest, huffman_perf) {
+    brpc::HPacker p1;
+    ASSERT_EQ(0, p1.Init(4096));
+    brpc::HPacker p2;
+    ASSERT_EQ(0, p2.Init(4096));
+    brpc::HPackOptions options;
+    options.encode_value = true;
+    options.index_policy = brpc::HPACK_NEVER_INDEX_HEADER;
+    // Like a bearer token or a tracing header.
+    std::string value = "Bearer ";
+    for (int i = 0; value.size() < 1024; ++i) {
+        value.push_back("ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                        "abcdefghijklmnopqrstuvwxyz0123456789-_."[i * 7 % 65]);
+    }
+    brpc::HPacker::Header h("authorization", value);
+    const int N = 20000;
+    butil::IOBufAppender buf;
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < N; ++i) {
+        p1.Encode(&buf, h, options);
+    }
+    tm.stop();
+    const size_t encoded_size = buf.buf().size();
+    LOG(INFO) << "Huffman encode " << value.size() << " bytes: "
+              << tm.n_elapsed() / N << "ns, "
+              << value.size() * N * 1000.0 / tm.n_elapsed() << "MB/s";
+    butil::IOBuf source;
+    buf.move_to(source);
+    brpc::HPacker::Header h2;
+    tm.start();
+    for (int i = 0; i < N; ++i) {
+        ASSERT_GT(p2.Decode(&source, &h2), 0);
+    }
+    tm.stop();
+    ASSERT_TRUE(source.empty());
+    ASSERT_EQ(value, h2.value);
+    LOG(INFO) << "Huffman decode " << encoded_size / N << " bytes: "
+              << tm.n_elapsed() / N << "ns, "
+              << value.size() * N * 1000.0 / tm.n_elapsed() << "MB/s";
+}
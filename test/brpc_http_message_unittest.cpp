@@ -29,6 +29,7 @@ namespace brpc {
 
 DECLARE_bool(allow_chunked_length);
 DECLARE_bool(allow_http_1_1_request_without_host);
+DECLARE_bool(http_response_date);
 
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
@@ -703,6 +704,57 @@ TEST(HttpMessageTest, serialize_http_response) {
         << butil::ToPrintable(response);
 }
 
+TEST(HttpMessageTest, serialize_http_response_with_header_set) {
+    std::shared_ptr<brpc::HttpHeaderSet> header_set =
+        std::make_shared<brpc::HttpHeaderSet>();
+    header_set->AddHeader("Content-Type", "application/json");
+    header_set->AddHeader("Access-Control-Allow-Origin", "*");
+    ASSERT_TRUE(header_set->has_content_type());
+    ASSERT_EQ(2u, header_set->headers().size());
+
+    brpc::HttpHeader header;
+    header.SetHeader("Foo", "Bar");
+    header.set_content_type("text/plain");
+    header.set_header_set(header_set);
+    butil::IOBuf response;
+    butil::IOBuf content;
+    content.append("{}");
+    MakeRawHttpResponse(&response, &header, &content);
+    // Content-Type in the set replaces content_type().
+    ASSERT_EQ("HTTP/1.1 200 OK\r\nContent-Length: 2\r\nFoo: Bar\r\n"
+              "Content-Type: application/json\r\n"
+              "Access-Control-Allow-Origin: *\r\n\r\n{}", response)
+        << butil::ToPrintable(response);
+
+    brpc::HttpHeader header2;
+    header2.Swap(header);
+    ASSERT_EQ(header_set, header2.header_set());
+    ASSERT_FALSE(header.header_set());
+    header2.Clear();
+    ASSERT_FALSE(header2.header_set());
+}
+
+TEST(HttpMessageTest, serialize_http_response_date) {
+    brpc::FLAGS_http_response_date = true;
+    const std::string date = brpc::CachedHttpDate().as_string();
+    // e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+    ASSERT_EQ(29u, date.size()) << date;
+    ASSERT_EQ(" GMT", date.substr(25));
+
+    brpc::HttpHeader header;
+    butil::IOBuf response;
+    MakeRawHttpResponse(&response, &header, NULL);
+    const std::string str = response.to_string();
+    ASSERT_EQ(0u, str.find("HTTP/1.1 200 OK\r\nDate: ")) << str;
+
+    // Date set by user is kept.
+    header.SetHeader("Date", "Sun, 06 Nov 1994 08:49:37 GMT");
+    MakeRawHttpResponse(&response, &header, NULL);
+    ASSERT_EQ("HTTP/1.1 200 OK\r\nDate: Sun, 06 Nov 1994 08:49:37 GMT\r\n\r\n",
+              response) << butil::ToPrintable(response);
+    brpc::FLAGS_http_response_date = false;
+}
+
 TEST(HttpMessageTest, http_1_1_request_without_host) {
     brpc::FLAGS_allow_http_1_1_request_without_host = false;
     {
@@ -52,6 +52,7 @@
 #include "json2pb/pb_to_json.h"
 #include "json2pb/json_to_pb.h"
 #include "brpc/details/method_status.h"
+#include "brpc/details/http_response_queue.h"
 #include "brpc/rpc_dump.h"
 #include "bthread/unstable.h"
 
@@ -1285,6 +1286,70 @@ TEST_F(HttpTest, http2_ping) {
     ASSERT_FALSE(cntl.Failed());
 }
 
+TEST_F(HttpTest, http2_ping_ack) {
+    // Payload of acked PINGs must be skipped before parsing next frames.
+    char buf[(9 /*FRAME_HEAD_SIZE*/ + 8 /*Opaque Data*/) * 2];
+    brpc::policy::SerializeFrameHead(buf, 8, brpc::policy::H2_FRAME_PING,
+                                     0x01 /* H2_FLAGS_ACK */, 0);
+    memset(buf + 9, 0xFF, 8);
+    brpc::policy::SerializeFrameHead(buf + 17, 8, brpc::policy::H2_FRAME_PING,
+                                     0x01 /* H2_FLAGS_ACK */, 0);
+    memset(buf + 26, 0xFF, 8);
+    butil::IOBuf ping_buf;
+    ping_buf.append(buf, sizeof(buf));
+
+    brpc::policy::H2Context* ctx = new brpc::policy::H2Context(_socket.get(), NULL);
+    CHECK_EQ(ctx->Init(), 0);
+    _socket->initialize_parsing_context(&ctx);
+    ctx->_conn_state = brpc::policy::H2_CONNECTION_READY;
+    brpc::ParseResult pr =
+        brpc::policy::ParseH2Message(&ping_buf, _socket.get(), false, NULL);
+    ASSERT_EQ(brpc::PARSE_ERROR_NOT_ENOUGH_DATA, pr.error());
+    ASSERT_TRUE(ping_buf.empty());
+}
+
+TEST_F(HttpTest, http2_bdp_estimator) {
+    const int64_t max_window = 1024 * 1024;
+    brpc::policy::H2BdpEstimator est(65535);
+    int64_t now_us = 1000000;
+    // Samples smaller than 2/3 of the window don't grow it.
+    ASSERT_TRUE(est.OnData(1000, now_us, max_window));
+    ASSERT_FALSE(est.OnData(1000, now_us, max_window));
+    ASSERT_EQ(0, est.OnPingAck(now_us + 10000, max_window));
+    ASSERT_EQ(65535, est.bdp());
+    ASSERT_EQ(10000, est.rtt_us());
+    // Window is used up within a rtt, double the sample.
+    now_us += 20000;
+    ASSERT_TRUE(est.OnData(16384, now_us, max_window));
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_FALSE(est.OnData(16384, now_us, max_window));
+    }
+    ASSERT_EQ(65536 * 2, est.OnPingAck(now_us + 10000, max_window));
+    ASSERT_EQ(65536 * 2, est.bdp());
+    // Acks without a sample are ignored.
+    ASSERT_EQ(0, est.OnPingAck(now_us + 10000, max_window));
+    // Grow up to the max window and stop probing.
+    for (int i = 0; i < 10 && est.bdp() < max_window; ++i) {
+        now_us += 20000;
+        ASSERT_TRUE(est.OnData(est.bdp(), now_us, max_window));
+        ASSERT_LT(0, est.OnPingAck(now_us + 10000, max_window));
+    }
+    ASSERT_EQ(max_window, est.bdp());
+    ASSERT_FALSE(est.OnData(65536, now_us, max_window));
+    est.Reset(65535);
+    ASSERT_EQ(65535, est.bdp());
+    ASSERT_TRUE(est.OnData(65536, now_us, max_window));
+
+    // Same sample with a longer rtt means less bandwidth.
+    brpc::policy::H2BdpEstimator est2(65535);
+    ASSERT_TRUE(est2.OnData(65536, now_us, max_window));
+    ASSERT_EQ(65536 * 2, est2.OnPingAck(now_us + 10000, max_window));
+    now_us += 20000;
+    ASSERT_TRUE(est2.OnData(65536 * 2, now_us, max_window));
+    ASSERT_EQ(0, est2.OnPingAck(now_us + 100000, max_window));
+    ASSERT_EQ(65536 * 2, est2.bdp());
+}
+
 inline void SaveUint32(void* out, uint32_t v) {
     uint8_t* p = (uint8_t*)out;
     p[0] = (v >> 24) & 0xFF;
@@ -2229,4 +2294,79 @@ TEST_F(HttpTest, http10_auth_failed_response) {
   _server._options.auth = original_auth;
 }
 
+TEST_F(HttpTest, pipelined_responses_in_order) {
+    brpc::HttpResponseQueue* q = _socket->GetOrNewHttpResponseQueue();
+    const uint64_t seq1 = q->AddRequest();
+    const uint64_t seq2 = q->AddRequest();
+    const uint64_t seq3 = q->AddRequest();
+    ASSERT_EQ(2u, q->npending_before(seq3));
+    // Responses finished in reversed order, the 3rd one is progressive.
+    butil::IOBuf buf;
+    buf.append("3a");
+    ASSERT_EQ(0, q->Write(_socket.get(), seq3, &buf, NULL, false));
+    buf.append("2");
+    ASSERT_EQ(0, q->Write(_socket.get(), seq2, &buf, NULL, true));
+    buf.append("1");
+    ASSERT_EQ(0, q->Write(_socket.get(), seq1, &buf, NULL, true));
+    ASSERT_EQ(0u, q->npending_before(seq3));
+    buf.append("3b");
+    ASSERT_EQ(0, q->Write(_socket.get(), seq3, &buf, NULL, true));
+    // Dropped since the response was finished.
+    buf.append("3c");
+    ASSERT_EQ(0, q->Write(_socket.get(), seq3, &buf, NULL, true));
+
+    const std::string expected = "123a3b";
+    std::string received;
+    char tmp[16];
+    while (received.size() < expected.size()) {
+        const ssize_t nr = read(_pipe_fds[0], tmp, sizeof(tmp));
+        ASSERT_GT(nr, 0);
+        received.append(tmp, nr);
+    }
+    ASSERT_EQ(expected, received);
+}
+
+TEST_F(HttpTest, http_context_memory_is_recycled) {
+    // Memory of a destroyed HttpContext is reused by the next one created
+    // in the same thread.
+    brpc::policy::HttpContext* ctx1 = new brpc::policy::HttpContext(false);
+    ctx1->header().uri().set_path("/EchoService/Echo");
+    void* const addr = ctx1;
+    ctx1->Destroy();
+    brpc::policy::HttpContext* ctx2 = new brpc::policy::HttpContext(true);
+    ASSERT_EQ(addr, (void*)ctx2);
+    // The object is constructed freshly on the recycled memory.
+    ASSERT_TRUE(ctx2->header().uri().path().empty());
+    ASSERT_FALSE(ctx2->is_stage2());
+    ASSERT_EQ(0u, ctx2->response_seq());
+
+    // Stage2 holds one more ref, memory is recycled after both are gone.
+    ctx2->AddOneRefForStage2();
+    ctx2->Destroy();
+    brpc::policy::HttpContext* ctx3 = new brpc::policy::HttpContext(false);
+    ASSERT_NE(addr, (void*)ctx3);
+    ctx2->RemoveOneRefForStage2();
+    ctx3->Destroy();
+
+    // Derived classes with a different size don't take memory of
+    // HttpContext from the pool.
+    brpc::policy::HttpContext* ctx4 = new brpc::policy::HttpContext(false);
+    void* const addr4 = ctx4;
+    ctx4->Destroy();
+    brpc::policy::H2StreamContext* h2_ctx =
+        new brpc::policy::H2StreamContext(false);
+    ASSERT_NE(addr4, (void*)h2_ctx);
+    h2_ctx->Destroy();
+    brpc::policy::HttpContext* ctx5 = new brpc::policy::HttpContext(false);
+    ASSERT_EQ(addr4, (void*)ctx5);
+    ctx5->Destroy();
+
+    // Placement of the nothrow version is recycled as well.
+    brpc::policy::HttpContext* ctx6 =
+        new (std::nothrow) brpc::policy::HttpContext(false);
+    ASSERT_TRUE(ctx6 != NULL);
+    ASSERT_EQ(addr4, (void*)ctx6);
+    ctx6->Destroy();
+}
+
 } //namespace
@@ -0,0 +1,125 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <vector>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/iobuf.h"
+#include "bvar/variable.h"
+#include "brpc/details/iobuf_hugepage.h"
+
+namespace brpc {
+DECLARE_int32(iobuf_hugepage_max_gb);
+DECLARE_int32(iobuf_hugepage_idle_arenas);
+DECLARE_bool(iobuf_hugepage_numa);
+}
+
+namespace {
+
+int64_t GetBvar(const std::string& name) {
+    const std::string value = bvar::Variable::describe_exposed(name);
+    if (value.empty()) {
+        return -1;
+    }
+    return strtoll(value.c_str(), NULL, 10);
+}
+
+class IOBufHugepageTest : public ::testing::Test {
+protected:
+    void SetUp() {
+        brpc::FLAGS_iobuf_hugepage_max_gb = 1;
+        // Ignored on machines with only one node.
+        brpc::FLAGS_iobuf_hugepage_numa = true;
+        ASSERT_EQ(0, brpc::InitIOBufHugepageAllocator());
+    }
+};
+
+// Blocks are cached in TLS, run in separate threads so that all blocks
+// are returned to arenas after join. `arg' should be a multiple of the
+// batch(32) refilling the TLS cache, so that no block is left in the cache
+// after allocating.
+void* AllocateAndFree(void* arg) {
+    const size_t n = (size_t)(intptr_t)arg;
+    std::vector<void*> blocks;
+    for (size_t i = 0; i < n; ++i) {
+        void* p = butil::iobuf::blockmem_allocate(
+            butil::IOBuf::DEFAULT_BLOCK_SIZE);
+        EXPECT_TRUE(p != NULL);
+        memset(p, i, butil::IOBuf::DEFAULT_BLOCK_SIZE);
+        blocks.push_back(p);
+    }
+    EXPECT_EQ((int64_t)n, GetBvar("iobuf_hugepage_block_count"));
+    for (size_t i = 0; i < n; ++i) {
+        EXPECT_EQ((char)i, *(char*)blocks[i]);
+        butil::iobuf::blockmem_deallocate(blocks[i]);
+    }
+    return NULL;
+}
+
+void* UseIOBuf(void*) {
+    butil::IOBuf buf;
+    std::string data(1024 * 1024, 'x');
+    for (int i = 0; i < 16; ++i) {
+        buf.append(data);
+    }
+    EXPECT_EQ(16 * data.size(), buf.size());
+    EXPECT_GT(GetBvar("iobuf_hugepage_block_count"), 0);
+    std::string out;
+    buf.cutn(&out, data.size());
+    EXPECT_EQ(data, out);
+    return NULL;
+}
+
+TEST_F(IOBufHugepageTest, allocate_and_free) {
+    ASSERT_EQ(butil::iobuf::blockmem_allocate, brpc::AllocateHugepageBlock);
+    pthread_t th;
+    // More than one 2MB arena.
+    ASSERT_EQ(0, pthread_create(&th, NULL, AllocateAndFree, (void*)1024));
+    pthread_join(th, NULL);
+    ASSERT_EQ(0, GetBvar("iobuf_hugepage_block_count"));
+    ASSERT_GE(GetBvar("iobuf_hugepage_arena_count"), 1);
+    ASSERT_EQ(GetBvar("iobuf_hugepage_arena_count") * 2 * 1024 * 1024,
+              GetBvar("iobuf_hugepage_arena_memory"));
+
+    ASSERT_EQ(0, pthread_create(&th, NULL, UseIOBuf, NULL));
+    pthread_join(th, NULL);
+    ASSERT_EQ(0, GetBvar("iobuf_hugepage_block_count"));
+    ASSERT_GE(GetBvar("iobuf_hugepage_cross_node_release_count"), 0);
+}
+
+TEST_F(IOBufHugepageTest, other_sizes_fallback) {
+    void* p = brpc::AllocateHugepageBlock(100);
+    ASSERT_TRUE(p != NULL);
+    memset(p, 0, 100);
+    ASSERT_EQ(0, GetBvar("iobuf_hugepage_block_count"));
+    brpc::DeallocateHugepageBlock(p);
+}
+
+TEST_F(IOBufHugepageTest, release_idle_arenas) {
+    const int32_t saved_idle = brpc::FLAGS_iobuf_hugepage_idle_arenas;
+    brpc::FLAGS_iobuf_hugepage_idle_arenas = 0;
+    pthread_t th;
+    ASSERT_EQ(0, pthread_create(&th, NULL, AllocateAndFree, (void*)2048));
+    pthread_join(th, NULL);
+    ASSERT_EQ(0, GetBvar("iobuf_hugepage_block_count"));
+    ASSERT_EQ(0, GetBvar("iobuf_hugepage_arena_count"));
+    ASSERT_EQ(0, GetBvar("iobuf_hugepage_arena_memory"));
+    brpc::FLAGS_iobuf_hugepage_idle_arenas = saved_idle;
+}
+
+} // namespace
@@ -0,0 +1,92 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include "brpc/details/jemalloc_profiler.h"
+
+namespace {
+
+const char* const BASE_PROFILE =
+    "heap_v2/524288\n"
+    "  t*: 3: 3145728 [0: 0]\n"
+    "  t0: 3: 3145728 [0: 0]\n"
+    "@ 0x1 0x2 0x3\n"
+    "  t*: 2: 2097152 [0: 0]\n"
+    "  t0: 2: 2097152 [0: 0]\n"
+    "@ 0x4 0x5\n"
+    "  t*: 1: 1048576 [0: 0]\n"
+    "  t0: 1: 1048576 [0: 0]\n"
+    "\n"
+    "MAPPED_LIBRARIES:\n"
+    "00400000-00401000 r-xp 00000000 08:01 1 /bin/foo\n";
+
+const char* const CUR_PROFILE =
+    "heap_v2/524288\n"
+    "  t*: 7: 7340032 [0: 0]\n"
+    "@ 0x1 0x2 0x3\n"
+    "  t*: 5: 5242880 [0: 0]\n"
+    "@ 0x4 0x5\n"
+    "  t*: 1: 524288 [0: 0]\n"
+    "@ 0x6\n"
+    "  t*: 1: 1572864 [0: 0]\n"
+    "\n"
+    "MAPPED_LIBRARIES:\n"
+    "00400000-00401000 r-xp 00000000 08:01 1 /bin/bar\n";
+
+TEST(JemallocProfilerTest, parse_heap_profile) {
+    brpc::JeHeapProfile profile;
+    ASSERT_EQ(0, brpc::ParseJeHeapProfile(BASE_PROFILE, &profile));
+    ASSERT_EQ("heap_v2/524288", profile.header);
+    ASSERT_EQ(2u, profile.stacks.size());
+    ASSERT_EQ(2, profile.stacks["@ 0x1 0x2 0x3"].objects);
+    ASSERT_EQ(2097152, profile.stacks["@ 0x1 0x2 0x3"].bytes);
+    ASSERT_EQ(1, profile.stacks["@ 0x4 0x5"].objects);
+    ASSERT_EQ(1048576, profile.stacks["@ 0x4 0x5"].bytes);
+    ASSERT_EQ("MAPPED_LIBRARIES:\n"
+              "00400000-00401000 r-xp 00000000 08:01 1 /bin/foo\n",
+              profile.mapped_libraries);
+
+    ASSERT_EQ(-1, brpc::ParseJeHeapProfile("heap/1\n", &profile));
+    ASSERT_EQ(-1, brpc::ParseJeHeapProfile("", &profile));
+}
+
+TEST(JemallocProfilerTest, diff_heap_profiles) {
+    brpc::JeHeapProfile base;
+    brpc::JeHeapProfile cur;
+    ASSERT_EQ(0, brpc::ParseJeHeapProfile(BASE_PROFILE, &base));
+    ASSERT_EQ(0, brpc::ParseJeHeapProfile(CUR_PROFILE, &cur));
+    std::string out;
+    brpc::DiffJeHeapProfiles(base, cur, &out);
+    // The shrunk stack is dropped.
+    ASSERT_EQ("heap_v2/524288\n"
+              "  t*: 4: 4718592 [0: 0]\n"
+              "@ 0x1 0x2 0x3\n"
+              "  t*: 3: 3145728 [0: 0]\n"
+              "@ 0x6\n"
+              "  t*: 1: 1572864 [0: 0]\n"
+              "\n"
+              "MAPPED_LIBRARIES:\n"
+              "00400000-00401000 r-xp 00000000 08:01 1 /bin/bar\n", out);
+
+    // The diff is a valid profile as well.
+    brpc::JeHeapProfile growth;
+    ASSERT_EQ(0, brpc::ParseJeHeapProfile(out, &growth));
+    ASSERT_EQ(2u, growth.stacks.size());
+    ASSERT_EQ(3145728, growth.stacks["@ 0x1 0x2 0x3"].bytes);
+}
+
+} // namespace
@@ -31,13 +31,18 @@
 #include "brpc/socket_map.h"
 #include "brpc/global.h"
 #include "brpc/details/load_balancer_with_naming.h"
+#include "brpc/details/outlier_detector.h"
+#include "brpc/excluded_servers.h"
 #include "butil/strings/string_number_conversions.h"
 #include "brpc/policy/weighted_round_robin_load_balancer.h"
 #include "brpc/policy/round_robin_load_balancer.h"
 #include "brpc/policy/weighted_randomized_load_balancer.h"
 #include "brpc/policy/randomized_load_balancer.h"
 #include "brpc/policy/locality_aware_load_balancer.h"
+#include "brpc/policy/p2c_load_balancer.h"
 #include "brpc/policy/consistent_hashing_load_balancer.h"
+#include "brpc/policy/maglev_load_balancer.h"
+#include "brpc/policy/zone_aware_load_balancer.h"
 #include "brpc/policy/hasher.h"
 #include "echo.pb.h"
 #include "brpc/channel.h"
@@ -46,6 +51,8 @@
 namespace brpc {
 DECLARE_int32(health_check_interval);
 DECLARE_int64(detect_available_server_interval_ms);
+DECLARE_int32(outlier_detection_interval_ms);
+DECLARE_int32(outlier_detection_base_ejection_ms);
 namespace policy {
 extern uint32_t CRCHash32(const char *key, size_t len);
 extern const char* GetHashName(uint32_t (*hasher)(const void* key, size_t len));
@@ -140,6 +147,8 @@ TEST_F(LoadBalancerTest, doubly_buffered_data) {
     test_doubly_buffered_data<butil::DoublyBufferedData<Foo, butil::Void, false>>();
     test_doubly_buffered_data<butil::DoublyBufferedData<Foo, UserTLS, false>>();
     test_doubly_buffered_data<butil::DoublyBufferedData<Foo, butil::Void, true>>();
+    test_doubly_buffered_data<butil::DoublyBufferedData<Foo, butil::Void, false, true>>();
+    test_doubly_buffered_data<butil::DoublyBufferedData<Foo, UserTLS, false, true>>();
 }
 
 bool exitFlag = false;
@@ -309,24 +318,32 @@ TEST_F(LoadBalancerTest, dbd_performance) {
     PerfTest<butil::DoublyBufferedData<PerfMap>>(thread_num, true);
     PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, true>>(thread_num, false);
     PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, true>>(thread_num, true);
+    PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, false, true>>(thread_num, false);
+    PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, false, true>>(thread_num, true);
 
     thread_num = 4;
     PerfTest<butil::DoublyBufferedData<PerfMap>>(thread_num, false);
     PerfTest<butil::DoublyBufferedData<PerfMap>>(thread_num, true);
     PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, true>>(thread_num, false);
     PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, true>>(thread_num, true);
+    PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, false, true>>(thread_num, false);
+    PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, false, true>>(thread_num, true);
 
     thread_num = 8;
     PerfTest<butil::DoublyBufferedData<PerfMap>>(thread_num, false);
     PerfTest<butil::DoublyBufferedData<PerfMap>>(thread_num, true);
     PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, true>>(thread_num, false);
     PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, true>>(thread_num, true);
+    PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, false, true>>(thread_num, false);
+    PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, false, true>>(thread_num, true);
 
     thread_num = 16;
     PerfTest<butil::DoublyBufferedData<PerfMap>>(thread_num, false);
     PerfTest<butil::DoublyBufferedData<PerfMap>>(thread_num, true);
     PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, true>>(thread_num, false);
     PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, true>>(thread_num, true);
+    PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, false, true>>(thread_num, false);
+    PerfTest<butil::DoublyBufferedData<PerfMap, butil::Void, false, true>>(thread_num, true);
 }
 
 
@@ -745,14 +762,16 @@ TEST_F(LoadBalancerTest, consistent_hashing) {
     ::brpc::policy::HashFunc hashs[::brpc::policy::CONS_HASH_LB_LAST] = {
             ::brpc::policy::MurmurHash32, 
             ::brpc::policy::MD5Hash32,
-            ::brpc::policy::MD5Hash32
+            ::brpc::policy::MD5Hash32,
+            ::brpc::policy::XXH3Hash32
             // ::brpc::policy::CRCHash32 crc is a bad hash function in test
     };
 
     ::brpc::policy::ConsistentHashingLoadBalancerType hash_type[::brpc::policy::CONS_HASH_LB_LAST] = {
         ::brpc::policy::CONS_HASH_LB_MURMUR3,
         ::brpc::policy::CONS_HASH_LB_MD5,
-        ::brpc::policy::CONS_HASH_LB_KETAMA
+        ::brpc::policy::CONS_HASH_LB_KETAMA,
+        ::brpc::policy::CONS_HASH_LB_XXH3
     };
 
     const char* servers[] = { 
@@ -825,6 +844,224 @@ TEST_F(LoadBalancerTest, consistent_hashing) {
     }
 }
 
+TEST_F(LoadBalancerTest, consistent_hashing_with_bounded_load) {
+    brpc::policy::ConsistentHashingLoadBalancer proto(
+        brpc::policy::CONS_HASH_LB_MURMUR3);
+    ASSERT_TRUE(proto.New("bounded_load=-1") == NULL);
+    brpc::LoadBalancer* lb = proto.New("bounded_load=0.25");
+    ASSERT_TRUE(lb != NULL);
+    const int N = 4;
+    brpc::SocketId ids[N];
+    for (int i = 0; i < N; ++i) {
+        butil::EndPoint ep(butil::my_ip(), 9100 + i);
+        brpc::SocketOptions options;
+        options.remote_side = ep;
+        options.user = new SaveRecycle;
+        ASSERT_EQ(0, brpc::Socket::Create(options, &ids[i]));
+        ASSERT_TRUE(lb->AddServer(brpc::ServerId(ids[i])));
+    }
+    brpc::LoadBalancer::SelectIn in = { 0, false, true, 12345u, NULL };
+    brpc::SocketId hot_server = brpc::INVALID_SOCKET_ID;
+    {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ASSERT_TRUE(out.need_feedback);
+        hot_server = ptr->id();
+        brpc::LoadBalancer::CallInfo info = { 0, hot_server, 0, NULL };
+        lb->Feedback(info);
+    }
+    // A hot key spreads to following servers on the ring when the first
+    // one is overloaded.
+    const int M = 100;
+    std::map<brpc::SocketId, int> inflight;
+    for (int i = 0; i < M; ++i) {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ++inflight[ptr->id()];
+    }
+    ASSERT_EQ((size_t)N, inflight.size());
+    for (auto it = inflight.begin(); it != inflight.end(); ++it) {
+        ASSERT_LE(it->second, (int)ceil(1.25 * M / N));
+    }
+    for (auto it = inflight.begin(); it != inflight.end(); ++it) {
+        for (int i = 0; i < it->second; ++i) {
+            brpc::LoadBalancer::CallInfo info = { 0, it->first, 0, NULL };
+            lb->Feedback(info);
+        }
+    }
+    // Back to the original server after loads are gone.
+    {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ASSERT_EQ(hot_server, ptr->id());
+    }
+    for (int i = 0; i < N; ++i) {
+        brpc::Socket::SetFailed(ids[i]);
+    }
+    lb->Destroy();
+}
+
+TEST_F(LoadBalancerTest, maglev) {
+    brpc::policy::MaglevLoadBalancer proto;
+    ASSERT_TRUE(proto.New("table_size=65536") == NULL);
+    brpc::LoadBalancer* lb = proto.New("table_size=65537");
+    ASSERT_TRUE(lb != NULL);
+    brpc::policy::MaglevLoadBalancer* mlb =
+        static_cast<brpc::policy::MaglevLoadBalancer*>(lb);
+    const int N = 10;
+    const size_t M = 65537;
+    brpc::SocketId ids[N];
+    std::vector<brpc::ServerId> servers;
+    for (int i = 0; i < N; ++i) {
+        butil::EndPoint ep(butil::my_ip(), 9200 + i);
+        brpc::SocketOptions options;
+        options.remote_side = ep;
+        options.user = new SaveRecycle;
+        ASSERT_EQ(0, brpc::Socket::Create(options, &ids[i]));
+        servers.push_back(brpc::ServerId(ids[i]));
+    }
+    ASSERT_EQ((size_t)N, lb->AddServersInBatch(servers));
+    ASSERT_FALSE(lb->AddServer(servers[0]));
+    std::cout << *lb;
+
+    // Every server owns M/N slots exactly.
+    std::map<butil::EndPoint, double> load_map;
+    mlb->GetLoads(&load_map);
+    ASSERT_EQ((size_t)N, load_map.size());
+    for (auto it = load_map.begin(); it != load_map.end(); ++it) {
+        ASSERT_LE(std::abs(it->second * M - (double)M / N), 1.0);
+    }
+
+    const size_t K = 10000;
+    std::vector<brpc::SocketId> before(K);
+    brpc::LoadBalancer::SelectIn in = { 0, false, true, 0u, NULL };
+    for (size_t i = 0; i < K; ++i) {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        in.request_code = brpc::policy::MurmurHash32(&i, sizeof(i));
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        before[i] = ptr->id();
+    }
+
+    // Removing a server rarely moves requests on other servers.
+    ASSERT_TRUE(lb->RemoveServer(servers[N - 1]));
+    size_t nkept = 0;
+    size_t nother = 0;
+    for (size_t i = 0; i < K; ++i) {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        in.request_code = brpc::policy::MurmurHash32(&i, sizeof(i));
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ASSERT_NE(ids[N - 1], ptr->id());
+        if (before[i] != ids[N - 1]) {
+            ++nother;
+            nkept += (before[i] == ptr->id());
+        }
+    }
+    LOG(INFO) << "kept " << nkept << " of " << nother;
+    ASSERT_GT(nkept, nother * 95 / 100);
+
+    // Adding it back restores the same table.
+    ASSERT_TRUE(lb->AddServer(servers[N - 1]));
+    for (size_t i = 0; i < K; ++i) {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        in.request_code = brpc::policy::MurmurHash32(&i, sizeof(i));
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ASSERT_EQ(before[i], ptr->id());
+    }
+
+    // Requests to failed servers go to the others.
+    for (int i = 0; i < N - 1; ++i) {
+        brpc::Socket::SetFailed(ids[i]);
+    }
+    for (size_t i = 0; i < 100; ++i) {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        in.request_code = i;
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ASSERT_EQ(ids[N - 1], ptr->id());
+    }
+    in.has_request_code = false;
+    {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        ASSERT_EQ(EINVAL, lb->SelectServer(in, &out));
+    }
+    ASSERT_EQ((size_t)N, lb->RemoveServersInBatch(servers));
+    brpc::Socket::SetFailed(ids[N - 1]);
+    lb->Destroy();
+}
+
+TEST_F(LoadBalancerTest, zone_aware) {
+    brpc::GlobalInitializeOrDie();
+    brpc::policy::ZoneAwareLoadBalancer proto;
+    ASSERT_TRUE(proto.New("lb=zone") == NULL);
+    ASSERT_TRUE(proto.New("lb=not_exist") == NULL);
+    ASSERT_TRUE(proto.New("min_healthy_ratio=0") == NULL);
+    brpc::policy::ZoneAwareLoadBalancer* lb =
+        proto.New("lb=rr local_zone=z1 min_healthy_ratio=0.5");
+    ASSERT_TRUE(lb != NULL);
+    const int NLOCAL = 4;
+    const int NREMOTE = 2;
+    std::vector<brpc::ServerId> servers;
+    for (int i = 0; i < NLOCAL + NREMOTE; ++i) {
+        butil::EndPoint ep(butil::my_ip(), 9400 + i);
+        brpc::SocketOptions options;
+        options.remote_side = ep;
+        options.user = new SaveRecycle;
+        brpc::SocketId id;
+        ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+        servers.push_back(brpc::ServerId(id, i < NLOCAL ? "z1" : "z2"));
+    }
+    ASSERT_EQ(servers.size(), lb->AddServersInBatch(servers));
+    auto count_local = [&](int n) {
+        int nlocal = 0;
+        for (int i = 0; i < n; ++i) {
+            brpc::SocketUniquePtr ptr;
+            brpc::LoadBalancer::SelectIn in = { 0, false, false, 0u, NULL };
+            brpc::LoadBalancer::SelectOut out(&ptr);
+            EXPECT_EQ(0, lb->SelectServer(in, &out));
+            for (int j = 0; j < NLOCAL; ++j) {
+                nlocal += (ptr && ptr->id() == servers[j].id);
+            }
+        }
+        return nlocal;
+    };
+    // All traffic stays in the local zone.
+    ASSERT_EQ(100, count_local(100));
+
+    // 1/4 healthy is half of min_healthy_ratio, half of the traffic
+    // spills over.
+    for (int i = 0; i < NLOCAL - 1; ++i) {
+        brpc::Socket::SetFailed(servers[i].id);
+    }
+    lb->_last_update_us.store(0);
+    const int nlocal = count_local(1000);
+    LOG(INFO) << "local=" << nlocal;
+    ASSERT_GT(nlocal, 350);
+    ASSERT_LT(nlocal, 650);
+
+    // No local server, all traffic goes to other zones.
+    brpc::Socket::SetFailed(servers[NLOCAL - 1].id);
+    lb->_last_update_us.store(0);
+    ASSERT_EQ(0, count_local(100));
+
+    std::ostringstream os;
+    brpc::DescribeOptions opt;
+    opt.verbose = true;
+    lb->Describe(os, opt);
+    LOG(INFO) << os.str();
+    ASSERT_EQ(servers.size(), lb->RemoveServersInBatch(servers));
+    for (int i = NLOCAL; i < NLOCAL + NREMOTE; ++i) {
+        brpc::Socket::SetFailed(servers[i].id);
+    }
+    lb->Destroy();
+}
+
 TEST_F(LoadBalancerTest, weighted_round_robin) {
     const char* servers[] = { 
             "10.92.115.19:8831", 
@@ -1024,6 +1261,82 @@ TEST_F(LoadBalancerTest, weighted_randomized) {
     }
 }
 
+TEST_F(LoadBalancerTest, p2c) {
+    brpc::policy::P2CLoadBalancer lb;
+    const int N = 4;
+    brpc::SocketId ids[N];
+    for (int i = 0; i < N; ++i) {
+        butil::EndPoint ep(butil::my_ip(), 9000 + i);
+        brpc::SocketOptions options;
+        options.remote_side = ep;
+        options.user = new SaveRecycle;
+        ASSERT_EQ(0, brpc::Socket::Create(options, &ids[i]));
+        ASSERT_TRUE(lb.AddServer(brpc::ServerId(ids[i])));
+    }
+    // Duplicated ids with different tags are counted once.
+    ASSERT_TRUE(lb.AddServer(brpc::ServerId(ids[0], "tag")));
+    ASSERT_TRUE(lb.RemoveServer(brpc::ServerId(ids[0], "tag")));
+
+    // The last server is 100 times slower than others.
+    brpc::Controller cntl;
+    for (int round = 0; round < 10; ++round) {
+        for (int i = 0; i < N; ++i) {
+            brpc::SocketUniquePtr ptr;
+            brpc::LoadBalancer::SelectIn in = { 0, false, false, 0u, NULL };
+            brpc::LoadBalancer::SelectOut out(&ptr);
+            ASSERT_EQ(0, lb.SelectServer(in, &out));
+            ASSERT_TRUE(out.need_feedback);
+            const int64_t latency_us = (ptr->id() == ids[N - 1] ? 100000 : 1000);
+            brpc::LoadBalancer::CallInfo info = {
+                butil::gettimeofday_us() - latency_us, ptr->id(), 0, &cntl };
+            lb.Feedback(info);
+        }
+    }
+    std::map<brpc::SocketId, int> nselected;
+    const int M = 10000;
+    for (int i = 0; i < M; ++i) {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectIn in = { 0, false, false, 0u, NULL };
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        ASSERT_EQ(0, lb.SelectServer(in, &out));
+        ++nselected[ptr->id()];
+        brpc::LoadBalancer::CallInfo info = {
+            butil::gettimeofday_us() - 1000, ptr->id(), 0, &cntl };
+        lb.Feedback(info);
+    }
+    std::ostringstream os;
+    lb.Describe(os, brpc::DescribeOptions());
+    LOG(INFO) << os.str() << " selected slow server " << nselected[ids[N - 1]];
+    // The slow server loses whenever it's sampled with another server.
+    ASSERT_LT(nselected[ids[N - 1]], M / 10);
+
+    for (int i = 0; i < N - 1; ++i) {
+        brpc::Socket::SetFailed(ids[i]);
+    }
+    for (int i = 0; i < 100; ++i) {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectIn in = { 0, false, false, 0u, NULL };
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        ASSERT_EQ(0, lb.SelectServer(in, &out));
+        ASSERT_EQ(ids[N - 1], ptr->id());
+    }
+    brpc::Socket::SetFailed(ids[N - 1]);
+}
+
+TEST_F(LoadBalancerTest, adjust_latency_by_server_load) {
+    brpc::Controller cntl;
+    ASSERT_EQ(1000, brpc::LoadBalancer::AdjustLatencyByServerLoad(1000, NULL));
+    ASSERT_EQ(1000, brpc::LoadBalancer::AdjustLatencyByServerLoad(1000, &cntl));
+    cntl.set_server_load(500);
+    ASSERT_EQ(1000, brpc::LoadBalancer::AdjustLatencyByServerLoad(1000, &cntl));
+    cntl.set_server_load(750);
+    ASSERT_EQ(2000, brpc::LoadBalancer::AdjustLatencyByServerLoad(1000, &cntl));
+    cntl.set_server_load(900);
+    ASSERT_EQ(5000, brpc::LoadBalancer::AdjustLatencyByServerLoad(1000, &cntl));
+    cntl.set_server_load(1000);
+    ASSERT_EQ(10000, brpc::LoadBalancer::AdjustLatencyByServerLoad(1000, &cntl));
+}
+
 TEST_F(LoadBalancerTest, health_check_no_valid_server) {
     const char* servers[] = { 
             "10.92.115.19:8832", 
@@ -1319,4 +1632,161 @@ TEST_F(LoadBalancerTest, la_selection_too_long) {
     ASSERT_EQ(EHOSTDOWN, lb.SelectServer(in, &out));
 }
 
+TEST_F(LoadBalancerTest, subset) {
+    brpc::GlobalInitializeOrDie();
+    const int N = 10;
+    const size_t K = 3;
+    std::vector<brpc::ServerId> servers;
+    for (int i = 0; i < N; ++i) {
+        butil::EndPoint ep(butil::my_ip(), 9300 + i);
+        brpc::SocketOptions options;
+        options.remote_side = ep;
+        options.user = new SaveRecycle;
+        brpc::SocketId id;
+        ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+        servers.push_back(brpc::ServerId(id));
+    }
+    // Subsets of clients are spread evenly over all servers.
+    std::map<brpc::SocketId, int> nclients;
+    const int C = 1000;
+    for (int c = 0; c < C; ++c) {
+        brpc::LoadBalancerWithNaming lb;
+        lb.SetSubset(K, "client-" + std::to_string(c));
+        ASSERT_EQ(0, lb.SharedLoadBalancer::Init("rr"));
+        lb.OnAddedServers(servers);
+        ASSERT_EQ(K, lb._subset.size());
+        for (size_t i = 0; i < K; ++i) {
+            ++nclients[lb._subset[i].id];
+        }
+    }
+    ASSERT_EQ((size_t)N, nclients.size());
+    const int expected = C * K / N;
+    for (std::map<brpc::SocketId, int>::const_iterator
+             it = nclients.begin(); it != nclients.end(); ++it) {
+        ASSERT_GE(it->second, expected * 7 / 10) << it->first;
+        ASSERT_LE(it->second, expected * 13 / 10) << it->first;
+    }
+
+    brpc::LoadBalancerWithNaming lb;
+    lb.SetSubset(K, "client");
+    ASSERT_EQ(0, lb.SharedLoadBalancer::Init("rr"));
+    lb.OnAddedServers(servers);
+    const std::vector<brpc::ServerId> subset = lb._subset;
+    ASSERT_EQ(K, subset.size());
+    for (int i = 0; i < 100; ++i) {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectIn in = { 0, false, false, 0u, NULL };
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        ASSERT_EQ(0, lb.SelectServer(in, &out));
+        ASSERT_TRUE(std::binary_search(subset.begin(), subset.end(),
+                                       brpc::ServerId(ptr->id())));
+    }
+    // Removing a server out of the subset changes nothing.
+    std::vector<brpc::ServerId> removed;
+    for (int i = 0; i < N && removed.empty(); ++i) {
+        if (!std::binary_search(subset.begin(), subset.end(), servers[i])) {
+            removed.push_back(servers[i]);
+        }
+    }
+    lb.OnRemovedServers(removed);
+    ASSERT_EQ(subset, lb._subset);
+    // Removing a server of the subset replaces it only.
+    removed.assign(1, subset[0]);
+    lb.OnRemovedServers(removed);
+    ASSERT_EQ(K, lb._subset.size());
+    ASSERT_FALSE(std::binary_search(lb._subset.begin(), lb._subset.end(),
+                                    subset[0]));
+    for (size_t i = 1; i < K; ++i) {
+        ASSERT_TRUE(std::binary_search(lb._subset.begin(), lb._subset.end(),
+                                       subset[i]));
+    }
+    // Adding it back restores the subset.
+    lb.OnAddedServers(removed);
+    ASSERT_EQ(subset, lb._subset);
+    for (int i = 0; i < N; ++i) {
+        brpc::Socket::SetFailed(servers[i].id);
+    }
+}
+
+TEST_F(LoadBalancerTest, shared_lb_with_naming) {
+    const char* url = "list://127.0.0.1:7101,127.0.0.1:7102";
+    butil::intrusive_ptr<brpc::LoadBalancerWithNaming> lb1;
+    butil::intrusive_ptr<brpc::LoadBalancerWithNaming> lb2;
+    butil::intrusive_ptr<brpc::LoadBalancerWithNaming> lb3;
+    ASSERT_EQ(0, brpc::GetSharedLoadBalancerWithNaming(
+                  &lb1, url, "rr", NULL, NULL, 0, ""));
+    ASSERT_EQ(0, brpc::GetSharedLoadBalancerWithNaming(
+                  &lb2, url, "rr", NULL, NULL, 0, ""));
+    ASSERT_EQ(lb1.get(), lb2.get());
+    ASSERT_EQ(2, lb1->Weight());
+    // Different load balancer or subset is not shared.
+    ASSERT_EQ(0, brpc::GetSharedLoadBalancerWithNaming(
+                  &lb3, url, "random", NULL, NULL, 0, ""));
+    ASSERT_NE(lb1.get(), lb3.get());
+    ASSERT_EQ(0, brpc::GetSharedLoadBalancerWithNaming(
+                  &lb3, url, "rr", NULL, NULL, 1, ""));
+    ASSERT_NE(lb1.get(), lb3.get());
+    ASSERT_EQ(1, lb3->Weight());
+
+    // Destroyed instance is removed from the global map.
+    lb1.reset();
+    lb2.reset();
+    ASSERT_EQ(0, brpc::GetSharedLoadBalancerWithNaming(
+                  &lb1, url, "rr", NULL, NULL, 0, ""));
+    ASSERT_EQ(2, lb1->Weight());
+}
+
+TEST_F(LoadBalancerTest, outlier_detection) {
+    const int32_t saved_interval = brpc::FLAGS_outlier_detection_interval_ms;
+    const int32_t saved_ejection = brpc::FLAGS_outlier_detection_base_ejection_ms;
+    brpc::FLAGS_outlier_detection_interval_ms = 0;
+    brpc::FLAGS_outlier_detection_base_ejection_ms = 100;
+    const google::protobuf::MethodDescriptor* echo =
+        test::EchoService::descriptor()->method(0);
+    const google::protobuf::MethodDescriptor* other = NULL;
+    brpc::OutlierDetector detector;
+    // Server 7 fails half of calls of `echo' and is slow on `other'.
+    for (int i = 0; i < 200; ++i) {
+        for (brpc::SocketId id = 1; id <= 8; ++id) {
+            const int error = (id == 7 && i % 2 == 0 ? brpc::ERPCTIMEDOUT : 0);
+            detector.OnCallEnd(id, echo, error, 1000 + i % 10);
+            detector.OnCallEnd(id, other, 0, (id == 7 ? 20000 : 1000));
+        }
+    }
+    for (brpc::SocketId id = 1; id <= 8; ++id) {
+        ASSERT_EQ(id == 7, detector.IsEjected(id, echo)) << id;
+        ASSERT_EQ(id == 7, detector.IsEjected(id, other)) << id;
+    }
+
+    // Ejected servers are merged with the given excluded servers.
+    brpc::ExcludedServers* accessed = brpc::ExcludedServers::Create(2);
+    accessed->Add(3);
+    brpc::ExcludedServers* ejected = detector.ExcludeEjected(echo, accessed);
+    ASSERT_TRUE(ejected != NULL);
+    ASSERT_EQ(2u, ejected->size());
+    ASSERT_TRUE(ejected->IsExcluded(3));
+    ASSERT_TRUE(ejected->IsExcluded(7));
+    brpc::ExcludedServers::Destroy(ejected);
+    brpc::ExcludedServers::Destroy(accessed);
+    const google::protobuf::MethodDescriptor* unused =
+        test::EchoService::descriptor()->method(1);
+    ASSERT_TRUE(detector.ExcludeEjected(unused, NULL) == NULL);
+
+    // Only one server can be ejected with 8 servers, by default.
+    for (int i = 0; i < 200; ++i) {
+        detector.OnCallEnd(5, echo, EHOSTDOWN, -1);
+    }
+    ASSERT_FALSE(detector.IsEjected(5, echo));
+
+    // The ejection expires.
+    bthread_usleep(150000);
+    detector.OnCallEnd(1, echo, 0, 1000);
+    ASSERT_FALSE(detector.IsEjected(7, echo));
+    // Server 5 which kept failing is ejected instead.
+    ASSERT_TRUE(detector.IsEjected(5, echo));
+
+    brpc::FLAGS_outlier_detection_interval_ms = saved_interval;
+    brpc::FLAGS_outlier_detection_base_ejection_ms = saved_ejection;
+}
+
 } //namespace
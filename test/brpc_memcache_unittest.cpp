@@ -20,6 +20,7 @@
 #include "butil/logging.h"
 #include <brpc/memcache.h>
 #include <brpc/channel.h>
+#include <brpc/server.h>
 #include <gtest/gtest.h>
 
 namespace brpc {
@@ -222,4 +223,92 @@ TEST_F(MemcacheTest, version) {
     ASSERT_TRUE(response.PopVersion(&version)) << response.LastError();
     std::cout << "version=" << version << std::endl;
 }
+
+class MapMemcacheService : public brpc::MemcacheService {
+public:
+    MapMemcacheService() : _nmultiget(0), _max_keys(0), _next_cas(1) {}
+
+    void MultiGet(const std::vector<butil::IOBuf>& keys,
+                  std::vector<Status>* statuses,
+                  std::vector<brpc::MemcacheItem>* items) override {
+        ++_nmultiget;
+        _max_keys = std::max(_max_keys, keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            auto it = _items.find(keys[i].to_string());
+            if (it != _items.end()) {
+                (*statuses)[i] = brpc::MemcacheResponse::STATUS_SUCCESS;
+                (*items)[i] = it->second;
+            }
+        }
+    }
+
+    Status Store(StoreMode mode, const butil::IOBuf& key, uint32_t,
+                 brpc::MemcacheItem* item) override {
+        auto it = _items.find(key.to_string());
+        if (mode == STORE_ADD && it != _items.end()) {
+            return brpc::MemcacheResponse::STATUS_KEY_EEXISTS;
+        }
+        if (item->cas_value != 0 &&
+            (it == _items.end() || it->second.cas_value != item->cas_value)) {
+            return brpc::MemcacheResponse::STATUS_KEY_EEXISTS;
+        }
+        item->cas_value = _next_cas++;
+        _items[key.to_string()] = *item;
+        return brpc::MemcacheResponse::STATUS_SUCCESS;
+    }
+
+    int _nmultiget;
+    size_t _max_keys;
+    uint64_t _next_cas;
+    std::map<std::string, brpc::MemcacheItem> _items;
+};
+
+TEST_F(MemcacheTest, server_multiget) {
+    brpc::Server server;
+    brpc::ServerOptions server_options;
+    MapMemcacheService* service = new MapMemcacheService;
+    server_options.memcache_service = service;
+    brpc::PortRange pr(8081, 8900);
+    ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_MEMCACHE;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+    brpc::MemcacheRequest request;
+    brpc::MemcacheResponse response;
+    brpc::Controller cntl;
+    request.Set("k1", "v1", 0xdeadbeef, 10, 0);
+    request.Set("k2", "v2", 1, 10, 0);
+    request.Get("k1");
+    request.Get("k2");
+    request.Get("k3");
+    request.Add("k1", "v3", 0, 10, 0);
+    request.Version();
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    uint64_t cas_value = 0;
+    ASSERT_TRUE(response.PopSet(&cas_value)) << response.LastError();
+    ASSERT_EQ(1u, cas_value);
+    ASSERT_TRUE(response.PopSet(&cas_value)) << response.LastError();
+    std::string value;
+    uint32_t flags = 0;
+    ASSERT_TRUE(response.PopGet(&value, &flags, &cas_value)) << response.LastError();
+    ASSERT_EQ("v1", value);
+    ASSERT_EQ(0xdeadbeef, flags);
+    ASSERT_EQ(1u, cas_value);
+    ASSERT_TRUE(response.PopGet(&value, &flags, &cas_value)) << response.LastError();
+    ASSERT_EQ("v2", value);
+    ASSERT_FALSE(response.PopGet(&value, &flags, &cas_value));
+    ASSERT_FALSE(response.PopAdd(&cas_value));
+    std::string version;
+    ASSERT_TRUE(response.PopVersion(&version)) << response.LastError();
+    ASSERT_EQ("brpc", version);
+    // The 3 consecutive GETs are looked up together.
+    ASSERT_EQ(1, service->_nmultiget);
+    ASSERT_EQ(3u, service->_max_keys);
+    server.Stop(0);
+    server.Join();
+}
+
 } //namespace
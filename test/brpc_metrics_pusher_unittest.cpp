@@ -0,0 +1,74 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include "brpc/metrics_pusher.h"
+#include "brpc/prometheus_remote_write.pb.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+class MetricsPusherTest : public ::testing::Test {};
+
+TEST_F(MetricsPusherTest, parse_series) {
+    brpc::PushedSeries s;
+    ASSERT_EQ(0, brpc::ParsePushedSeries("process_fd_count", "12", &s));
+    ASSERT_EQ("process_fd_count", s.name);
+    ASSERT_TRUE(s.labels.empty());
+    ASSERT_EQ(12, s.value);
+
+    ASSERT_EQ(0, brpc::ParsePushedSeries(
+                  "request_count{idc=\"hz\",method=\"get,set\"}", "1.5", &s));
+    ASSERT_EQ("request_count", s.name);
+    ASSERT_EQ(2UL, s.labels.size());
+    ASSERT_EQ("idc", s.labels[0].first);
+    ASSERT_EQ("hz", s.labels[0].second);
+    ASSERT_EQ("method", s.labels[1].first);
+    ASSERT_EQ("get,set", s.labels[1].second);
+    ASSERT_EQ(1.5, s.value);
+
+    // Not numbers.
+    ASSERT_EQ(-1, brpc::ParsePushedSeries("version", "\"1.0\"", &s));
+    ASSERT_EQ(-1, brpc::ParsePushedSeries("percentiles", "[1,2,3]", &s));
+    ASSERT_EQ(-1, brpc::ParsePushedSeries("empty", "", &s));
+    // Malformed labels.
+    ASSERT_EQ(-1, brpc::ParsePushedSeries("foo{idc=\"hz\"", "1", &s));
+    ASSERT_EQ(-1, brpc::ParsePushedSeries("foo{idc}", "1", &s));
+}
+
+TEST_F(MetricsPusherTest, append_series) {
+    brpc::PushedSeries s;
+    ASSERT_EQ(0, brpc::ParsePushedSeries("qps{zone=\"a\"}", "100", &s));
+    std::vector<std::pair<std::string, std::string> > extra;
+    extra.emplace_back("instance", "10.0.0.1:8000");
+    brpc::RemoteWriteRequest req;
+    brpc::AppendRemoteWriteSeries(s, extra, 123456, &req);
+    ASSERT_EQ(1, req.timeseries_size());
+    const brpc::RemoteWriteTimeSeries& ts = req.timeseries(0);
+    ASSERT_EQ(3, ts.labels_size());
+    // Sorted by names.
+    ASSERT_EQ("__name__", ts.labels(0).name());
+    ASSERT_EQ("qps", ts.labels(0).value());
+    ASSERT_EQ("instance", ts.labels(1).name());
+    ASSERT_EQ("zone", ts.labels(2).name());
+    ASSERT_EQ("a", ts.labels(2).value());
+    ASSERT_EQ(1, ts.samples_size());
+    ASSERT_EQ(100, ts.samples(0).value());
+    ASSERT_EQ(123456, ts.samples(0).timestamp());
+}
@@ -34,8 +34,10 @@
 #include "brpc/policy/most_common_message.h"
 #include "brpc/controller.h"
 #include "brpc/mongo_head.h"
+#include "brpc/mongo_message.h"
 #include "brpc/mongo_service_adaptor.h"
 #include "brpc/policy/mongo.pb.h"
+#include "brpc/policy/snappy_compress.h"
 
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
@@ -49,12 +51,21 @@ static const std::string EXP_REQUEST = "hello";
 static const std::string EXP_RESPONSE = "world";
 
 class MyEchoService : public ::brpc::policy::MongoService {
-    void default_method(::google::protobuf::RpcController*,
+    void default_method(::google::protobuf::RpcController* cntl_base,
                         const ::brpc::policy::MongoRequest* req,
                         ::brpc::policy::MongoResponse* res,
                         ::google::protobuf::Closure* done) {
         brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
 
+        if (req->header().op_code() == brpc::policy::DB_OP_MSG) {
+            // Echo documents of the OP_MSG.
+            brpc::MongoMsg msg;
+            EXPECT_EQ(0, brpc::ParseMongoMsg(cntl->request_attachment(), &msg));
+            res->mutable_header()->set_op_code(brpc::policy::DB_OP_MSG);
+            brpc::SerializeMongoMsg(msg, &cntl->response_attachment());
+            return;
+        }
         EXPECT_EQ(EXP_REQUEST, req->message());
 
         res->mutable_header()->set_message_length(
@@ -232,4 +243,139 @@ TEST_F(MongoTest, complete_flow) {
     ASSERT_FALSE(cntl.Failed());
     ASSERT_STREQ(EXP_RESPONSE.c_str(), msg_buf);
 }
+
+// A BSON document with an int32 field named `key'.
+static void AppendBsonDocument(const std::string& key, int32_t value,
+                               butil::IOBuf* out) {
+    const int32_t len = sizeof(int32_t) + 1 + key.size() + 1 +
+        sizeof(int32_t) + 1;
+    out->append(&len, sizeof(len));
+    out->push_back(0x10);
+    out->append(key.c_str(), key.size() + 1);
+    out->append(&value, sizeof(value));
+    out->push_back(0);
+}
+
+static brpc::MongoMsg MakeMongoMsg() {
+    brpc::MongoMsg msg;
+    AppendBsonDocument("insert", 1, &msg.body);
+    msg.sequences.resize(1);
+    msg.sequences[0].identifier = "documents";
+    AppendBsonDocument("a", 1, &msg.sequences[0].documents);
+    AppendBsonDocument("b", 2, &msg.sequences[0].documents);
+    return msg;
+}
+
+static void ExpectSameMongoMsg(const brpc::MongoMsg& m1,
+                               const brpc::MongoMsg& m2) {
+    EXPECT_EQ(m1.flag_bits, m2.flag_bits);
+    EXPECT_EQ(m1.body, m2.body);
+    ASSERT_EQ(m1.sequences.size(), m2.sequences.size());
+    for (size_t i = 0; i < m1.sequences.size(); ++i) {
+        EXPECT_EQ(m1.sequences[i].identifier, m2.sequences[i].identifier);
+        EXPECT_EQ(m1.sequences[i].documents, m2.sequences[i].documents);
+    }
+}
+
+TEST_F(MongoTest, op_msg_sections) {
+    brpc::MongoMsg msg = MakeMongoMsg();
+    butil::IOBuf buf;
+    brpc::SerializeMongoMsg(msg, &buf);
+
+    brpc::MongoMsg msg2;
+    ASSERT_EQ(0, brpc::ParseMongoMsg(buf, &msg2));
+    ExpectSameMongoMsg(msg, msg2);
+
+    butil::IOBuf docs = msg2.sequences[0].documents;
+    butil::IOBuf doc;
+    ASSERT_EQ(0, brpc::CutBsonDocument(&docs, &doc));
+    butil::IOBuf expected;
+    AppendBsonDocument("a", 1, &expected);
+    ASSERT_EQ(expected, doc);
+    ASSERT_EQ(0, brpc::CutBsonDocument(&docs, &doc));
+    ASSERT_TRUE(docs.empty());
+    ASSERT_EQ(-1, brpc::CutBsonDocument(&docs, &doc));
+
+    // The checksum is skipped.
+    const uint32_t checksum = 0x12345678;
+    buf.append(&checksum, sizeof(checksum));
+    uint32_t flag_bits = brpc::MONGO_MSG_CHECKSUM_PRESENT;
+    buf.cutn(&doc, sizeof(flag_bits));
+    doc.clear();
+    doc.append(&flag_bits, sizeof(flag_bits));
+    doc.append(buf);
+    ASSERT_EQ(0, brpc::ParseMongoMsg(doc, &msg2));
+    ExpectSameMongoMsg(msg, msg2);
+
+    // Truncated.
+    doc.pop_back(sizeof(checksum) + 1);
+    ASSERT_EQ(-1, brpc::ParseMongoMsg(doc, &msg2));
+}
+
+TEST_F(MongoTest, compressed_op_msg) {
+    brpc::MongoMsg msg = MakeMongoMsg();
+    butil::IOBuf body;
+    brpc::SerializeMongoMsg(msg, &body);
+    butil::IOBuf compressed;
+    ASSERT_TRUE(brpc::policy::SnappyCompress(body, &compressed));
+
+    const int32_t original_opcode = brpc::MONGO_OPCODE_OP_MSG;
+    const int32_t uncompressed_size = body.size();
+    brpc::mongo_head_t header = { 0, 0, 0, 0 };
+    header.request_id = 10;
+    header.op_code = brpc::MONGO_OPCODE_COMPRESSED;
+    header.message_length = sizeof(header) + sizeof(original_opcode) +
+        sizeof(uncompressed_size) + 1 + compressed.size();
+    butil::IOBuf total_buf;
+    total_buf.append(static_cast<const void*>(&header), sizeof(header));
+    total_buf.append(&original_opcode, sizeof(original_opcode));
+    total_buf.append(&uncompressed_size, sizeof(uncompressed_size));
+    total_buf.push_back(brpc::MONGO_COMPRESSOR_SNAPPY);
+    total_buf.append(compressed);
+    brpc::ParseResult req_pr = brpc::policy::ParseMongoMessage(
+        &total_buf, _socket.get(), false, &_server);
+    ASSERT_EQ(brpc::PARSE_OK, req_pr.error());
+    ProcessMessage(brpc::policy::ProcessMongoRequest, req_pr.message(), false);
+
+    // The reply is compressed with the same compressor.
+    butil::IOPortal response_buf;
+    response_buf.append_from_file_descriptor(_pipe_fds[0], 1024);
+    ASSERT_EQ(sizeof(header), response_buf.cutn(&header, sizeof(header)));
+    ASSERT_EQ(brpc::MONGO_OPCODE_COMPRESSED, header.op_code);
+    ASSERT_EQ(10, header.response_to);
+    ASSERT_EQ((size_t)header.message_length,
+              sizeof(header) + response_buf.size());
+    int32_t res_opcode = 0;
+    int32_t res_size = 0;
+    uint8_t compressor_id = 0;
+    response_buf.cutn(&res_opcode, sizeof(res_opcode));
+    response_buf.cutn(&res_size, sizeof(res_size));
+    response_buf.cut1(&compressor_id);
+    ASSERT_EQ(brpc::MONGO_OPCODE_OP_MSG, res_opcode);
+    ASSERT_EQ(brpc::MONGO_COMPRESSOR_SNAPPY, compressor_id);
+    butil::IOBuf res_body;
+    ASSERT_TRUE(brpc::policy::SnappyDecompress(response_buf, &res_body));
+    ASSERT_EQ((size_t)res_size, res_body.size());
+    brpc::MongoMsg res_msg;
+    ASSERT_EQ(0, brpc::ParseMongoMsg(res_body, &res_msg));
+    ExpectSameMongoMsg(msg, res_msg);
+}
+
+TEST_F(MongoTest, op_msg_more_to_come) {
+    brpc::MongoMsg msg = MakeMongoMsg();
+    msg.flag_bits = brpc::MONGO_MSG_MORE_TO_COME;
+    butil::IOBuf body;
+    brpc::SerializeMongoMsg(msg, &body);
+    brpc::mongo_head_t header = { 0, 0, 0, 0 };
+    header.op_code = brpc::MONGO_OPCODE_OP_MSG;
+    header.message_length = sizeof(header) + body.size();
+    butil::IOBuf total_buf;
+    total_buf.append(static_cast<const void*>(&header), sizeof(header));
+    total_buf.append(body);
+    brpc::ParseResult req_pr = brpc::policy::ParseMongoMessage(
+        &total_buf, _socket.get(), false, &_server);
+    ASSERT_EQ(brpc::PARSE_OK, req_pr.error());
+    ProcessMessage(brpc::policy::ProcessMongoRequest, req_pr.message(), false);
+    CheckEmptyResponse();
+}
 } //namespace
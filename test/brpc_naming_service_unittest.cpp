@@ -33,6 +33,8 @@
 #include "brpc/policy/remote_file_naming_service.h"
 #include "brpc/policy/discovery_naming_service.h"
 #include "brpc/policy/nacos_naming_service.h"
+#include "brpc/details/naming_service_thread.h"
+#include "brpc/details/dns_cache.h"
 #include "echo.pb.h"
 #include "brpc/server.h"
 
@@ -166,6 +168,38 @@ TEST(NamingServiceTest, invalid_port) {
     ASSERT_EQ(-1, dns.GetServers("baidu.com:99999", &servers));
 }
 
+static int64_t GetDnsCacheHit() {
+    const std::string value =
+        bvar::Variable::describe_exposed("rpc_dns_cache_hit");
+    return strtoll(value.c_str(), NULL, 10);
+}
+
+TEST(NamingServiceTest, dns_cache) {
+    std::vector<butil::EndPoint> addrs;
+    ASSERT_EQ(0, brpc::ResolveHost("localhost", AF_INET, 1234, &addrs));
+    ASSERT_FALSE(addrs.empty());
+    ASSERT_STREQ("127.0.0.1:1234", butil::endpoint2str(addrs[0]).c_str());
+    const int64_t nhit = GetDnsCacheHit();
+    ASSERT_EQ(0, brpc::ResolveHost("localhost", AF_INET, 80, &addrs));
+    ASSERT_STREQ("127.0.0.1:80", butil::endpoint2str(addrs[0]).c_str());
+    ASSERT_EQ(nhit + 1, GetDnsCacheHit());
+
+    butil::EndPoint point;
+    ASSERT_EQ(0, brpc::CachedHostname2Endpoint("localhost:8080", &point));
+    ASSERT_STREQ("127.0.0.1:8080", butil::endpoint2str(point).c_str());
+    ASSERT_EQ(0, brpc::CachedHostname2Endpoint(" localhost", 8081, &point));
+    ASSERT_STREQ("127.0.0.1:8081", butil::endpoint2str(point).c_str());
+    ASSERT_EQ(-1, brpc::CachedHostname2Endpoint("localhost:", &point));
+    ASSERT_EQ(-1, brpc::CachedHostname2Endpoint("localhost:80a", &point));
+    ASSERT_EQ(-1, brpc::CachedHostname2Endpoint("localhost", 99999, &point));
+
+    // Failures are cached as well.
+    ASSERT_EQ(-1, brpc::ResolveHost("brpc-no-such-host.invalid", AF_INET, 80, &addrs));
+    const int64_t nhit2 = GetDnsCacheHit();
+    ASSERT_EQ(-1, brpc::ResolveHost("brpc-no-such-host.invalid", AF_INET, 80, &addrs));
+    ASSERT_EQ(nhit2 + 1, GetDnsCacheHit());
+}
+
 TEST(NamingServiceTest, wrong_name) {
     std::vector<brpc::ServerNode> servers;
 
@@ -847,4 +881,61 @@ TEST(NamingServiceTest, nacos) {
     }
 }
 
+class SetWatcher : public brpc::NamingServiceWatcher {
+public:
+    void OnAddedServers(const std::vector<brpc::ServerId>& servers) override {
+        for (size_t i = 0; i < servers.size(); ++i) {
+            ids.insert(servers[i].id);
+        }
+    }
+    void OnRemovedServers(const std::vector<brpc::ServerId>& servers) override {
+        for (size_t i = 0; i < servers.size(); ++i) {
+            ids.erase(servers[i].id);
+        }
+    }
+    std::set<brpc::SocketId> ids;
+};
+
+TEST(NamingServiceTest, add_and_remove_servers) {
+    butil::intrusive_ptr<brpc::NamingServiceThread> nsthread(
+        new brpc::NamingServiceThread);
+    ASSERT_EQ(0, nsthread->Start(new brpc::policy::ListNamingService, "list",
+                                 "127.0.0.1:8000", NULL));
+    SetWatcher watcher;
+    ASSERT_EQ(0, nsthread->AddWatcher(&watcher));
+    ASSERT_EQ(1u, watcher.ids.size());
+
+    butil::EndPoint ep0;
+    butil::EndPoint ep1;
+    butil::EndPoint ep2;
+    ASSERT_EQ(0, butil::str2endpoint("127.0.0.1:8000", &ep0));
+    ASSERT_EQ(0, butil::str2endpoint("127.0.0.1:8001", &ep1));
+    ASSERT_EQ(0, butil::str2endpoint("127.0.0.1:8002", &ep2));
+    std::vector<brpc::ServerNode> servers;
+    servers.push_back(brpc::ServerNode(ep1));
+    servers.push_back(brpc::ServerNode(ep0));  // existing
+    servers.push_back(brpc::ServerNode(ep1));  // duplicated
+    nsthread->_actions.AddServers(servers);
+    ASSERT_EQ(2u, watcher.ids.size());
+    ASSERT_EQ(2u, nsthread->_actions._last_servers.size());
+
+    servers.clear();
+    servers.push_back(brpc::ServerNode(ep0));
+    servers.push_back(brpc::ServerNode(ep2));  // not existing
+    nsthread->_actions.RemoveServers(servers);
+    ASSERT_EQ(1u, watcher.ids.size());
+    ASSERT_EQ(1u, nsthread->_actions._last_servers.size());
+    ASSERT_EQ(brpc::ServerNode(ep1), nsthread->_actions._last_servers[0]);
+
+    servers.clear();
+    servers.push_back(brpc::ServerNode(ep1));
+    servers.push_back(brpc::ServerNode(ep2));
+    nsthread->_actions.ResetServers(servers);
+    ASSERT_EQ(2u, watcher.ids.size());
+    // Same list again, nothing changes.
+    nsthread->_actions.ResetServers(servers);
+    ASSERT_EQ(2u, watcher.ids.size());
+    ASSERT_EQ(0, nsthread->RemoveWatcher(&watcher));
+}
+
 } //namespace
@@ -0,0 +1,109 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "brpc/policy/priority_concurrency_limiter.h"
+#include "brpc/policy/constant_concurrency_limiter.h"
+#include "brpc/controller.h"
+#include <gtest/gtest.h>
+
+TEST(PriorityConcurrencyLimiterTest, ShedLowerPrioritiesFirst) {
+    ASSERT_EQ(0.1, brpc::policy::FLAGS_priority_cl_reserved_ratio);
+    brpc::policy::PriorityConcurrencyLimiter limiter(
+        new brpc::policy::ConstantConcurrencyLimiter(100));
+    ASSERT_EQ(100, limiter.MaxConcurrency());
+
+    brpc::Controller cntl;
+    ASSERT_EQ(brpc::REQUEST_PRIORITY_DEFAULT, cntl.request_priority());
+    // Requests of default priority take up to 80%.
+    ASSERT_TRUE(limiter.OnRequested(80, &cntl));
+    ASSERT_FALSE(limiter.OnRequested(81, &cntl));
+    ASSERT_TRUE(limiter.OnRequested(80, NULL));
+    ASSERT_FALSE(limiter.OnRequested(81, NULL));
+
+    cntl.set_request_priority(brpc::REQUEST_PRIORITY_SHEDDABLE);
+    ASSERT_TRUE(limiter.OnRequested(70, &cntl));
+    ASSERT_FALSE(limiter.OnRequested(71, &cntl));
+
+    cntl.set_request_priority(brpc::REQUEST_PRIORITY_CRITICAL);
+    ASSERT_TRUE(limiter.OnRequested(90, &cntl));
+    ASSERT_FALSE(limiter.OnRequested(91, &cntl));
+
+    // The most important requests are limited by the wrapped limiter only.
+    cntl.set_request_priority(brpc::REQUEST_PRIORITY_CRITICAL_PLUS);
+    ASSERT_TRUE(limiter.OnRequested(100, &cntl));
+    ASSERT_FALSE(limiter.OnRequested(101, &cntl));
+
+    ASSERT_EQ(2, limiter._accepted[brpc::REQUEST_PRIORITY_DEFAULT].get_value());
+    ASSERT_EQ(2, limiter._rejected[brpc::REQUEST_PRIORITY_DEFAULT].get_value());
+    ASSERT_EQ(1, limiter._accepted[brpc::REQUEST_PRIORITY_SHEDDABLE].get_value());
+    ASSERT_EQ(1, limiter._rejected[brpc::REQUEST_PRIORITY_CRITICAL_PLUS].get_value());
+
+    // Resetting max_concurrency goes to the wrapped limiter.
+    ASSERT_EQ(0, limiter.ResetMaxConcurrency(brpc::AdaptiveMaxConcurrency(10)));
+    ASSERT_EQ(10, limiter.MaxConcurrency());
+    cntl.set_request_priority(brpc::REQUEST_PRIORITY_SHEDDABLE);
+    ASSERT_FALSE(limiter.OnRequested(8, &cntl));
+
+    ASSERT_EQ(0, limiter.Expose("priority_cl_unittest"));
+    ASSERT_NE("", bvar::Variable::describe_exposed(
+                      "priority_cl_unittest_priority_sheddable_rejected"));
+    std::ostringstream os;
+    limiter.Describe(os, brpc::DescribeOptions());
+    ASSERT_NE(std::string::npos,
+              os.str().find("priority_critical_plus: accepted=1 rejected=1"));
+}
+
+TEST(PriorityConcurrencyLimiterTest, MaxRatiosOfPriorities) {
+    using brpc::policy::PriorityConcurrencyLimiter;
+    ASSERT_TRUE(PriorityConcurrencyLimiter::ValidateMaxRatios({}));
+    ASSERT_TRUE(PriorityConcurrencyLimiter::ValidateMaxRatios({0.5, 0.5, 0.9, 1}));
+    ASSERT_FALSE(PriorityConcurrencyLimiter::ValidateMaxRatios({0.5, 0.9, 1}));
+    ASSERT_FALSE(PriorityConcurrencyLimiter::ValidateMaxRatios({0, 0.5, 0.9, 1}));
+    ASSERT_FALSE(PriorityConcurrencyLimiter::ValidateMaxRatios({0.5, 0.4, 0.9, 1}));
+    ASSERT_FALSE(PriorityConcurrencyLimiter::ValidateMaxRatios({0.5, 0.8, 0.9, 1.1}));
+
+    PriorityConcurrencyLimiter limiter(
+        new brpc::policy::ConstantConcurrencyLimiter(100), {0.5, 0.6, 0.6, 0.9});
+    brpc::Controller cntl;
+    cntl.set_request_priority(brpc::REQUEST_PRIORITY_SHEDDABLE);
+    ASSERT_TRUE(limiter.OnRequested(50, &cntl));
+    ASSERT_FALSE(limiter.OnRequested(51, &cntl));
+    cntl.set_request_priority(brpc::REQUEST_PRIORITY_DEFAULT);
+    ASSERT_TRUE(limiter.OnRequested(60, &cntl));
+    ASSERT_FALSE(limiter.OnRequested(61, &cntl));
+    cntl.set_request_priority(brpc::REQUEST_PRIORITY_CRITICAL);
+    ASSERT_FALSE(limiter.OnRequested(61, &cntl));
+    cntl.set_request_priority(brpc::REQUEST_PRIORITY_CRITICAL_PLUS);
+    ASSERT_TRUE(limiter.OnRequested(90, &cntl));
+    ASSERT_FALSE(limiter.OnRequested(91, &cntl));
+
+    // Limiters created from the prototype keep the ratios.
+    std::unique_ptr<PriorityConcurrencyLimiter> limiter2(
+        limiter.New(brpc::AdaptiveMaxConcurrency(10)));
+    cntl.set_request_priority(brpc::REQUEST_PRIORITY_SHEDDABLE);
+    ASSERT_TRUE(limiter2->OnRequested(5, &cntl));
+    ASSERT_FALSE(limiter2->OnRequested(6, &cntl));
+}
+
+TEST(PriorityConcurrencyLimiterTest, PriorityIsInherited) {
+    brpc::Controller server_cntl;
+    server_cntl.set_request_priority(brpc::REQUEST_PRIORITY_CRITICAL);
+    brpc::Controller cntl(server_cntl.inheritable());
+    ASSERT_EQ(brpc::REQUEST_PRIORITY_CRITICAL, cntl.request_priority());
+    cntl.Reset();
+    ASSERT_EQ(brpc::REQUEST_PRIORITY_DEFAULT, cntl.request_priority());
+}
@@ -17,7 +17,12 @@
 
 // brpc - A framework to host and access services throughout Baidu.
 
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <gtest/gtest.h>
+#include <gflags/gflags.h>
 #include "brpc/server.h"
 #include "brpc/channel.h"
 #include "brpc/controller.h"
@@ -25,6 +30,12 @@
 #include "echo.pb.h"
 #include "bvar/multi_dimension.h"
 
+namespace brpc {
+DECLARE_int32(prometheus_metrics_chunk_size);
+DECLARE_int32(socket_send_buffer_size);
+DECLARE_int64(socket_max_unwritten_bytes);
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -195,3 +206,117 @@ TEST(PrometheusMetrics, sanity) {
     ASSERT_EQ(0, server.Stop(0));
     ASSERT_EQ(0, server.Join());
 }
+
+// Send a raw HTTP/1.1 request of /brpc_metrics, with `rcvbuf' as receive
+// buffer size of the client if it's positive.
+static int RequestMetrics(int port, int rcvbuf) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (rcvbuf > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    const std::string req = "GET /brpc_metrics HTTP/1.1\r\n"
+        "Host: 127.0.0.1\r\n\r\n";
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+        write(fd, req.data(), req.size()) != (ssize_t)req.size()) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Read from `fd' until the chunked response ends, the connection is closed
+// or nothing arrives in `timeout_ms'.
+static std::string ReadResponse(int fd, int timeout_ms, bool* closed) {
+    std::string res;
+    *closed = false;
+    char buf[4096];
+    pollfd pfd = { fd, POLLIN, 0 };
+    while (!butil::StringPiece(res).ends_with("\r\n0\r\n\r\n") &&
+           poll(&pfd, 1, timeout_ms) > 0) {
+        const ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            *closed = true;
+            break;
+        }
+        res.append(buf, n);
+    }
+    return res;
+}
+
+class PrometheusMetricsStreamingTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        _saved_chunk_size = brpc::FLAGS_prometheus_metrics_chunk_size;
+        _saved_send_buffer_size = brpc::FLAGS_socket_send_buffer_size;
+        _saved_max_unwritten_bytes = brpc::FLAGS_socket_max_unwritten_bytes;
+        brpc::FLAGS_prometheus_metrics_chunk_size = 1024;
+        // Make the output much longer than the buffers in between.
+        char name[64];
+        for (size_t i = 0; i < arraysize(_adders); ++i) {
+            snprintf(name, sizeof(name), "prometheus_streaming_test_%zu", i);
+            ASSERT_EQ(0, _adders[i].expose(name));
+        }
+    }
+
+    void TearDown() override {
+        brpc::FLAGS_prometheus_metrics_chunk_size = _saved_chunk_size;
+        brpc::FLAGS_socket_send_buffer_size = _saved_send_buffer_size;
+        brpc::FLAGS_socket_max_unwritten_bytes = _saved_max_unwritten_bytes;
+    }
+
+    bvar::Adder<int> _adders[3000];
+    int32_t _saved_chunk_size;
+    int32_t _saved_send_buffer_size;
+    int64_t _saved_max_unwritten_bytes;
+};
+
+TEST_F(PrometheusMetricsStreamingTest, write_in_chunks) {
+    brpc::Server server;
+    ASSERT_EQ(0, server.Start("127.0.0.1:8615", NULL));
+    const int fd = RequestMetrics(8615, 0);
+    ASSERT_GE(fd, 0);
+    bool closed = false;
+    const std::string res = ReadResponse(fd, 5000, &closed);
+    close(fd);
+    ASSERT_FALSE(closed);
+    ASSERT_NE(std::string::npos, res.find("Transfer-Encoding: chunked"));
+    ASSERT_NE(std::string::npos,
+              res.find("prometheus_streaming_test_2999 0\n"));
+    ASSERT_TRUE(butil::StringPiece(res).ends_with("\r\n0\r\n\r\n"));
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+TEST_F(PrometheusMetricsStreamingTest, slow_reader_gets_broken_response) {
+    // Bytes queued behind a blocked writer are not counted as unwritten
+    // until the writer picks them up, make any left bytes overcrowd the
+    // connection as soon as the kernel buffers are full.
+    brpc::FLAGS_socket_send_buffer_size = 4096;
+    brpc::FLAGS_socket_max_unwritten_bytes = 1;
+    brpc::Server server;
+    ASSERT_EQ(0, server.Start("127.0.0.1:8616", NULL));
+    const int fd = RequestMetrics(8616, 4096);
+    ASSERT_GE(fd, 0);
+    // Don't read until the server gives up writing.
+    usleep(500000);
+    bool closed = false;
+    const std::string res = ReadResponse(fd, 5000, &closed);
+    close(fd);
+    ASSERT_NE(std::string::npos, res.find("Transfer-Encoding: chunked"));
+    // The connection is closed without the last chunk, the client can't
+    // take the truncated output as a complete one.
+    ASSERT_TRUE(closed);
+    ASSERT_FALSE(butil::StringPiece(res).ends_with("\r\n0\r\n\r\n"));
+    ASSERT_EQ(std::string::npos,
+              res.find("prometheus_streaming_test_2999 0\n"));
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
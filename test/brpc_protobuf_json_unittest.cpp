@@ -20,7 +20,10 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <memory>
 #include <google/protobuf/text_format.h>
+#include <google/protobuf/descriptor.pb.h>
+#include <google/protobuf/dynamic_message.h>
 #include "butil/iobuf.h"
 #include "butil/string_printf.h"
 #include "butil/strings/string_util.h"
@@ -32,6 +35,7 @@
 #include "json2pb/json_to_pb.h"
 #include "json2pb/encode_decode.h"
 #include "json2pb/zero_copy_stream_reader.h"
+#include "json2pb/json_field_cache.h"
 #include "message.pb.h"
 #include "addressbook1.pb.h"
 #include "addressbook.pb.h"
@@ -1890,4 +1894,107 @@ TEST_F(ProtobufJsonTest, pb_to_proto_json) {
     ASSERT_NE(json2.find(R"("office":"Shanghai")"), std::string::npos);
 }
 
+// Copy the file defining `generated' into `pool' and return the message type
+// with the same name, which is not from the generated pool.
+static const google::protobuf::Descriptor* CopyToDynamicPool(
+    const google::protobuf::Descriptor* generated,
+    google::protobuf::DescriptorPool* pool) {
+    google::protobuf::FileDescriptorProto file_proto;
+    generated->file()->CopyTo(&file_proto);
+    if (pool->BuildFile(file_proto) == NULL) {
+        return NULL;
+    }
+    return pool->FindMessageTypeByName(generated->full_name());
+}
+
+TEST_F(ProtobufJsonTest, json_to_pb_encoded_names) {
+    const json2pb::JsonFieldCache* cache =
+        json2pb::GetJsonFieldCache(JsonContextBodyEncDec::descriptor());
+    ASSERT_TRUE(cache != NULL);
+    ASSERT_TRUE(cache->index.seek("@Content_Test%@") != NULL);
+    ASSERT_TRUE(cache->index.seek("data:array") != NULL);
+    ASSERT_TRUE(cache->index.seek("_Z064_Content_Test_Z037__Z064_") == NULL);
+
+    const std::string json = R"({"judge":true,"data:array":[1,2],)"
+        R"("@Content_Test%@":[{"uid*":"u1","Distance_info_":1.5,)"
+        R"("_ext%T_":{"Aa_ge(":7,"enum--type":2}}]})";
+    std::string err;
+    JsonContextBodyEncDec body;
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(json, &body, &err)) << err;
+    ASSERT_TRUE(body.judge());
+    ASSERT_EQ(2, body.data_z058_array_size());
+    ASSERT_EQ(2, body.data_z058_array(1));
+    ASSERT_EQ(1, body._z064_content_test_z037__z064__size());
+    const ContentEncDec& content = body._z064_content_test_z037__z064_(0);
+    ASSERT_EQ("u1", content.uid_z042_());
+    ASSERT_EQ(1.5, content.distance_info_());
+    ASSERT_EQ(7u, content._ext_z037_t_().aa_ge_z040_());
+    ASSERT_EQ(ExtEncDec::WORK, content._ext_z037_t_().enum_z045__z045_type());
+
+    // Messages from other pools are not cached and go through FindMember()
+    // with decoded names, which gives the same message.
+    google::protobuf::DescriptorPool pool;
+    const google::protobuf::Descriptor* dyn_desc =
+        CopyToDynamicPool(JsonContextBodyEncDec::descriptor(), &pool);
+    ASSERT_TRUE(dyn_desc != NULL);
+    ASSERT_TRUE(json2pb::GetJsonFieldCache(dyn_desc) == NULL);
+    google::protobuf::DynamicMessageFactory factory(&pool);
+    std::unique_ptr<google::protobuf::Message> dyn(
+        factory.GetPrototype(dyn_desc)->New());
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(json, dyn.get(), &err)) << err;
+    ASSERT_EQ(body.SerializeAsString(), dyn->SerializeAsString());
+
+    // Encoded names are not names in json.
+    const std::string encoded_json = R"({"judge":true,)"
+        R"("_Z064_Content_Test_Z037__Z064_":[{"Distance_info_":1.5}]})";
+    body.Clear();
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(encoded_json, &body, &err)) << err;
+    ASSERT_EQ(0, body._z064_content_test_z037__z064__size());
+    dyn->Clear();
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(encoded_json, dyn.get(), &err)) << err;
+    ASSERT_EQ(body.SerializeAsString(), dyn->SerializeAsString());
+}
+
+TEST_F(ProtobufJsonTest, json_to_pb_duplicate_and_unknown_members) {
+    // The first member wins if names are duplicated, as FindMember() does.
+    // Unknown members are skipped.
+    const std::string json = R"({"name":"first","id":1,"datadouble":2.5,)"
+        R"("name":"second","id":2,"unknown":3,"unknown_obj":{"a":[1,2]},)"
+        R"("hobby":"coding","hobby":"reading"})";
+    const std::string expected =
+        R"({"hobby":"coding","name":"first","id":1,"datadouble":2.5})";
+    std::string err;
+    Person person;
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(json, &person, &err)) << err;
+    ASSERT_EQ("first", person.name());
+    ASSERT_EQ(1, person.id());
+    ASSERT_EQ("coding", person.GetExtension(addressbook::hobby));
+    std::string output;
+    ASSERT_TRUE(json2pb::ProtoMessageToJson(person, &output, &err)) << err;
+    ASSERT_EQ(expected, output);
+
+    // Same for messages converted without the cached index.
+    google::protobuf::DescriptorPool pool;
+    const google::protobuf::Descriptor* dyn_desc =
+        CopyToDynamicPool(Person::descriptor(), &pool);
+    ASSERT_TRUE(dyn_desc != NULL);
+    google::protobuf::DynamicMessageFactory factory(&pool);
+    std::unique_ptr<google::protobuf::Message> dyn(
+        factory.GetPrototype(dyn_desc)->New());
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(json, dyn.get(), &err)) << err;
+    output.clear();
+    ASSERT_TRUE(json2pb::ProtoMessageToJson(*dyn, &output, &err)) << err;
+    ASSERT_EQ(expected, output);
+
+    // Unknown members don't satisfy required fields, and the converted
+    // value of a known member is still checked.
+    person.Clear();
+    ASSERT_FALSE(json2pb::JsonToProtoMessage(
+        R"({"Name":"x","id":1,"datadouble":2.5})", &person, &err));
+    ASSERT_NE(std::string::npos, err.find("addressbook.Person.name")) << err;
+    person.Clear();
+    ASSERT_FALSE(json2pb::JsonToProtoMessage(
+        R"({"name":"x","id":"abc","datadouble":2.5,"unknown":1})", &person, &err));
+}
+
 } // namespace
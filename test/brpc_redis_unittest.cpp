@@ -658,6 +658,73 @@ TEST_F(RedisTest, command_parser) {
     }
 }
 
+TEST_F(RedisTest, inline_command_parser) {
+    brpc::RedisCommandParser parser;
+    std::vector<butil::StringPiece> command_out;
+    butil::Arena arena;
+    {
+        // Leading space or empty line is rejected at once rather than
+        // waiting for the end of line.
+        butil::IOBuf buf;
+        buf.append(" get abc");
+        ASSERT_NE(brpc::PARSE_OK, parser.Consume(buf, &command_out, &arena));
+        ASSERT_NE(brpc::PARSE_ERROR_NOT_ENOUGH_DATA,
+                  parser.Consume(buf, &command_out, &arena));
+        parser.Reset();
+        buf.clear();
+        buf.append("\r\nget abc\r\n");
+        ASSERT_NE(brpc::PARSE_OK, parser.Consume(buf, &command_out, &arena));
+        ASSERT_NE(brpc::PARSE_ERROR_NOT_ENOUGH_DATA,
+                  parser.Consume(buf, &command_out, &arena));
+        parser.Reset();
+    }
+    {
+        // Wait for the end of line.
+        butil::IOBuf buf;
+        buf.append("GET");
+        ASSERT_EQ(brpc::PARSE_ERROR_NOT_ENOUGH_DATA,
+                  parser.Consume(buf, &command_out, &arena));
+        buf.append("\r");
+        ASSERT_EQ(brpc::PARSE_ERROR_NOT_ENOUGH_DATA,
+                  parser.Consume(buf, &command_out, &arena));
+        buf.append("\n");
+        ASSERT_EQ(brpc::PARSE_OK, parser.Consume(buf, &command_out, &arena));
+        ASSERT_TRUE(buf.empty());
+        ASSERT_EQ(1u, command_out.size());
+        ASSERT_EQ("get", command_out[0]);
+    }
+    {
+        // Only the first line is consumed, spaces separate arguments.
+        butil::IOBuf buf;
+        buf.append("set a  b\r\nget a\r\n");
+        ASSERT_EQ(brpc::PARSE_OK, parser.Consume(buf, &command_out, &arena));
+        ASSERT_EQ("set a  b", GetCompleteCommand(command_out));
+        ASSERT_EQ(brpc::PARSE_OK, parser.Consume(buf, &command_out, &arena));
+        ASSERT_EQ("get a", GetCompleteCommand(command_out));
+        ASSERT_TRUE(buf.empty());
+    }
+    {
+        // The line spans blocks of IOBuf.
+        butil::IOBuf buf;
+        const std::string value(100000, 'x');
+        const std::string line = "set k " + value;
+        for (size_t i = 0; i < line.size(); i += 1000) {
+            butil::IOBuf piece;
+            piece.append(line.data() + i, std::min((size_t)1000, line.size() - i));
+            buf.append(piece);
+        }
+        ASSERT_EQ(brpc::PARSE_ERROR_NOT_ENOUGH_DATA,
+                  parser.Consume(buf, &command_out, &arena));
+        buf.append("\r\n");
+        ASSERT_EQ(brpc::PARSE_OK, parser.Consume(buf, &command_out, &arena));
+        ASSERT_EQ(3u, command_out.size());
+        ASSERT_EQ("set", command_out[0]);
+        ASSERT_EQ("k", command_out[1]);
+        ASSERT_EQ(value, command_out[2]);
+        ASSERT_TRUE(buf.empty());
+    }
+}
+
 TEST_F(RedisTest, redis_reply_codec) {
     butil::Arena arena;
     // status
@@ -1352,6 +1419,98 @@ TEST_F(RedisTest, server_handle_pipeline) {
     ASSERT_STREQ(response.reply(7).c_str(), "world");
 }
 
+class KVBatchCommandHandler : public brpc::RedisBatchCommandHandler {
+public:
+    KVBatchCommandHandler() : _nrun(0), _max_batch_size(0) {}
+
+    void Run(brpc::RedisConnContext*,
+             const std::vector<std::vector<butil::StringPiece> >& commands,
+             brpc::RedisReply* output) override {
+        ++_nrun;
+        _max_batch_size = std::max(_max_batch_size, commands.size());
+        for (size_t i = 0; i < commands.size(); ++i) {
+            const std::vector<butil::StringPiece>& args = commands[i];
+            if (args[0] == "set" && args.size() == 3) {
+                _kv[args[1].as_string()] = args[2].as_string();
+                (*output)[i].SetStatus("OK");
+            } else if (args[0] == "get" && args.size() == 2) {
+                auto it = _kv.find(args[1].as_string());
+                if (it != _kv.end()) {
+                    (*output)[i].SetString(it->second);
+                }
+            } else {
+                (*output)[i].SetError("ERR unknown command");
+            }
+        }
+    }
+
+    int _nrun;
+    size_t _max_batch_size;
+    std::unordered_map<std::string, std::string> _kv;
+};
+
+TEST_F(RedisTest, server_batch_command_handler) {
+    brpc::Server server;
+    brpc::ServerOptions server_options;
+    brpc::RedisService* rs = new brpc::RedisService;
+    KVBatchCommandHandler bh;
+    ASSERT_TRUE(rs->SetBatchCommandHandler(&bh));
+    ASSERT_FALSE(rs->SetBatchCommandHandler(&bh));
+    rs->set_zero_copy_args(true);
+    server_options.redis_service = rs;
+    brpc::PortRange pr(8081, 8900);
+    ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_REDIS;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+
+    brpc::RedisRequest request;
+    brpc::RedisResponse response;
+    brpc::Controller cntl;
+    ASSERT_TRUE(request.AddCommand("set key1 value1"));
+    ASSERT_TRUE(request.AddCommand("set key2 value2"));
+    ASSERT_TRUE(request.AddCommand("get key1"));
+    ASSERT_TRUE(request.AddCommand("get key2"));
+    ASSERT_TRUE(request.AddCommand("get key3"));
+    ASSERT_TRUE(request.AddCommand("incr key1"));
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(6, response.reply_size());
+    ASSERT_STREQ("OK", response.reply(0).c_str());
+    ASSERT_STREQ("OK", response.reply(1).c_str());
+    ASSERT_STREQ("value1", response.reply(2).c_str());
+    ASSERT_STREQ("value2", response.reply(3).c_str());
+    ASSERT_TRUE(response.reply(4).is_nil());
+    ASSERT_TRUE(response.reply(5).is_error());
+    // Pipelined commands of one read are run together.
+    ASSERT_GT(bh._max_batch_size, 1UL);
+    ASSERT_LE(bh._nrun, 6);
+    server.Stop(0);
+    server.Join();
+}
+
+TEST_F(RedisTest, command_parser_zero_copy) {
+    brpc::RedisCommandParser parser;
+    butil::IOBuf buf;
+    butil::IOBuf arg_blocks;
+    std::vector<butil::StringPiece> command_out;
+    butil::Arena arena;
+    buf.append("*3\r\n$3\r\nSET\r\n$3\r\nabc\r\n$5\r\nvalue\r\n");
+    const char* begin = static_cast<const char*>(buf.fetch1());
+    const char* end = begin + buf.size();
+    ASSERT_EQ(brpc::PARSE_OK, parser.Consume(buf, &command_out, &arena, &arg_blocks));
+    ASSERT_TRUE(buf.empty());
+    ASSERT_EQ("set abc value", GetCompleteCommand(command_out));
+    // The command name is lowercased in arena, other args reference blocks.
+    ASSERT_FALSE(command_out[0].data() >= begin && command_out[0].data() < end);
+    for (size_t i = 1; i < command_out.size(); ++i) {
+        ASSERT_TRUE(command_out[i].data() >= begin && command_out[i].data() < end);
+    }
+    ASSERT_EQ("abcvalue", arg_blocks.to_string());
+}
+
 TEST_F(RedisTest, memory_allocation_limits) {
     int32_t original_limit = brpc::FLAGS_redis_max_allocation_size;
     brpc::FLAGS_redis_max_allocation_size = 1024;
@@ -523,6 +523,117 @@ TEST(RtmpTest, amf) {
     ASSERT_EQ("heheda", info3.description());
 }
 
+class RecordingStream : public brpc::RtmpStreamBase {
+public:
+    RecordingStream() : brpc::RtmpStreamBase(false) {}
+    int SendEncodedMessage(const brpc::RtmpEncodedMessage& msg) {
+        sent.push_back(msg);
+        return 0;
+    }
+    std::vector<brpc::RtmpEncodedMessage> sent;
+};
+
+static brpc::RtmpEncodedMessage MakeVideo(uint32_t timestamp,
+                                          brpc::FlvVideoFrameType frame_type,
+                                          char packet_type) {
+    brpc::RtmpVideoMessage msg;
+    msg.timestamp = timestamp;
+    msg.frame_type = frame_type;
+    msg.codec = brpc::FLV_VIDEO_AVC;
+    msg.data.push_back(packet_type);
+    msg.data.append("frame");
+    brpc::RtmpEncodedMessage encoded;
+    EXPECT_EQ(0, encoded.Encode(msg));
+    return encoded;
+}
+
+TEST(RtmpTest, encoded_message) {
+    brpc::RtmpAudioMessage audio;
+    audio.timestamp = 10;
+    audio.codec = brpc::FLV_AUDIO_AAC;
+    audio.rate = brpc::FLV_SOUND_RATE_44100HZ;
+    audio.bits = brpc::FLV_SOUND_16BIT;
+    audio.type = brpc::FLV_SOUND_STEREO;
+    audio.data.push_back((char)brpc::FLV_AAC_PACKET_SEQUENCE_HEADER);
+    audio.data.append("config");
+    brpc::RtmpEncodedMessage encoded;
+    ASSERT_EQ(0, encoded.Encode(audio));
+    ASSERT_TRUE(encoded.is_audio());
+    ASSERT_EQ(10u, encoded.timestamp);
+    ASSERT_EQ(audio.size(), encoded.body.size());
+    ASSERT_EQ((char)0xAF, encoded.body.to_string()[0]);
+    ASSERT_TRUE(encoded.IsSequenceHeader());
+    ASSERT_FALSE(encoded.IsKeyFrame());
+
+    brpc::RtmpEncodedMessage key =
+        MakeVideo(20, brpc::FLV_VIDEO_FRAME_KEYFRAME, brpc::FLV_AVC_PACKET_NALU);
+    ASSERT_TRUE(key.is_video());
+    ASSERT_TRUE(key.IsKeyFrame());
+    ASSERT_FALSE(key.IsSequenceHeader());
+    ASSERT_EQ(std::string("\x17\x01" "frame", 7), key.body.to_string());
+
+    brpc::RtmpMetaData metadata;
+    metadata.timestamp = 0;
+    metadata.data.SetNumber("width", 1280);
+    ASSERT_EQ(0, encoded.Encode(metadata));
+    ASSERT_TRUE(encoded.is_metadata());
+    ASSERT_FALSE(encoded.IsSequenceHeader());
+}
+
+TEST(RtmpTest, gop_cache) {
+    brpc::RtmpGopCache cache(3);
+    brpc::RtmpMetaData metadata;
+    metadata.timestamp = 0;
+    metadata.data.SetNumber("width", 1280);
+    brpc::RtmpEncodedMessage encoded;
+    ASSERT_EQ(0, encoded.Encode(metadata));
+    cache.Add(encoded);
+    // Inter frames before any keyframe are not cached.
+    cache.Add(MakeVideo(1, brpc::FLV_VIDEO_FRAME_INTERFRAME,
+                        brpc::FLV_AVC_PACKET_NALU));
+    ASSERT_EQ(0u, cache.gop_size());
+    cache.Add(MakeVideo(2, brpc::FLV_VIDEO_FRAME_KEYFRAME,
+                        brpc::FLV_AVC_PACKET_SEQUENCE_HEADER));
+    cache.Add(MakeVideo(3, brpc::FLV_VIDEO_FRAME_KEYFRAME,
+                        brpc::FLV_AVC_PACKET_NALU));
+    cache.Add(MakeVideo(4, brpc::FLV_VIDEO_FRAME_INTERFRAME,
+                        brpc::FLV_AVC_PACKET_NALU));
+    // A new sequence header replaces the old one.
+    cache.Add(MakeVideo(5, brpc::FLV_VIDEO_FRAME_KEYFRAME,
+                        brpc::FLV_AVC_PACKET_SEQUENCE_HEADER));
+    cache.Add(MakeVideo(6, brpc::FLV_VIDEO_FRAME_KEYFRAME,
+                        brpc::FLV_AVC_PACKET_NALU));
+    cache.Add(MakeVideo(7, brpc::FLV_VIDEO_FRAME_INTERFRAME,
+                        brpc::FLV_AVC_PACKET_NALU));
+    ASSERT_EQ(2u, cache.gop_size());
+
+    butil::intrusive_ptr<RecordingStream> player(new RecordingStream);
+    ASSERT_EQ(0, cache.SendTo(player.get()));
+    ASSERT_EQ(4u, player->sent.size());
+    ASSERT_TRUE(player->sent[0].is_metadata());
+    const uint32_t expected_ts[] = { 0, 5, 6, 7 };
+    for (size_t i = 0; i < player->sent.size(); ++i) {
+        ASSERT_EQ(expected_ts[i], player->sent[i].timestamp);
+    }
+    // Players share blocks of the cached bodies.
+    butil::intrusive_ptr<RecordingStream> player2(new RecordingStream);
+    ASSERT_EQ(0, cache.SendTo(player2.get()));
+    ASSERT_EQ(4u, player2->sent.size());
+    ASSERT_EQ(player->sent[2].body.backing_block(0).data(),
+              player2->sent[2].body.backing_block(0).data());
+
+    // A GOP exceeding the limit is dropped until the next keyframe.
+    cache.Add(MakeVideo(8, brpc::FLV_VIDEO_FRAME_INTERFRAME,
+                        brpc::FLV_AVC_PACKET_NALU));
+    cache.Add(MakeVideo(9, brpc::FLV_VIDEO_FRAME_INTERFRAME,
+                        brpc::FLV_AVC_PACKET_NALU));
+    ASSERT_EQ(0u, cache.gop_size());
+    cache.Clear();
+    player->sent.clear();
+    ASSERT_EQ(0, cache.SendTo(player.get()));
+    ASSERT_TRUE(player->sent.empty());
+}
+
 TEST(RtmpTest, successfully_play_streams) {
     PlayingDummyService rtmp_service;
     brpc::Server server;
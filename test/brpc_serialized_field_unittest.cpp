@@ -0,0 +1,89 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include "butil/iobuf.h"
+#include "brpc/serialized_field.h"
+#include "echo.pb.h"
+
+namespace {
+
+TEST(SerializedFieldTest, find_fields) {
+    test::EchoRequest req;
+    req.set_message("hello");
+    req.set_code(-3);
+    req.set_close_fd(true);
+    req.set_server_fail(7);
+    butil::IOBuf buf;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&buf);
+    ASSERT_TRUE(req.SerializeToZeroCopyStream(&wrapper));
+
+    brpc::SerializedField fields[4] = {
+        brpc::SerializedField(5), brpc::SerializedField(1),
+        brpc::SerializedField(2), brpc::SerializedField(4) };
+    ASSERT_EQ(0, brpc::FindSerializedFields(buf, fields, 4));
+    ASSERT_EQ(0, fields[0].wire_type);
+    ASSERT_EQ(7u, fields[0].value);
+    ASSERT_EQ(2, fields[1].wire_type);
+    ASSERT_EQ("hello", fields[1].bytes.to_string());
+    ASSERT_EQ(0, fields[2].wire_type);
+    ASSERT_EQ(-3, (int32_t)fields[2].value);
+    // Not set.
+    ASSERT_EQ(-1, fields[3].wire_type);
+
+    // Truncated.
+    butil::IOBuf truncated;
+    buf.append_to(&truncated, 3);
+    ASSERT_EQ(-1, brpc::FindSerializedFields(truncated, fields, 4));
+}
+
+TEST(SerializedFieldTest, sub_messages_referencing_original_bytes) {
+    test::ComboResponse res;
+    for (int i = 0; i < 3; ++i) {
+        test::EchoResponse* sub = res.add_responses();
+        sub->set_message(std::string(10000, 'a' + i));
+        sub->add_code_list(i);
+        sub->set_receiving_socket_id(0xFFFFFFFFFFULL + i);
+    }
+    butil::IOBuf buf;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&buf);
+    ASSERT_TRUE(res.SerializeToZeroCopyStream(&wrapper));
+    ASSERT_GT(buf.backing_block_num(), 1u);
+
+    // The first occurrence of repeated fields.
+    brpc::SerializedField field(1);
+    ASSERT_EQ(0, brpc::FindSerializedFields(buf, &field, 1));
+    ASSERT_EQ(2, field.wire_type);
+    test::EchoResponse sub;
+    butil::IOBufAsZeroCopyInputStream sub_stream(field.bytes);
+    ASSERT_TRUE(sub.ParseFromZeroCopyStream(&sub_stream));
+    ASSERT_EQ(res.responses(0).message(), sub.message());
+
+    // Scan the sub-message again for its fields.
+    brpc::SerializedField sub_fields[2] = {
+        brpc::SerializedField(3), brpc::SerializedField(2) };
+    ASSERT_EQ(0, brpc::FindSerializedFields(field.bytes, sub_fields, 2));
+    ASSERT_EQ(0xFFFFFFFFFFULL, sub_fields[0].value);
+    ASSERT_EQ(0u, sub_fields[1].value);
+
+    // Unknown numbers are not found after scanning the whole message.
+    brpc::SerializedField absent(9);
+    ASSERT_EQ(0, brpc::FindSerializedFields(buf, &absent, 1));
+    ASSERT_EQ(-1, absent.wire_type);
+}
+
+} // namespace
@@ -19,14 +19,17 @@
 
 // Date: Sun Jul 13 15:04:18 CST 2014
 
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <fstream>
 #include <gtest/gtest.h>
 #include <google/protobuf/descriptor.h>
 #include "butil/time.h"
 #include "butil/macros.h"
 #include "butil/fd_guard.h"
+#include "butil/sys_byteorder.h"
 #include "butil/files/scoped_file.h"
 #include "brpc/socket.h"
 #include "butil/object_pool.h"
@@ -48,11 +51,20 @@
 #include "brpc/builtin/sockets_service.h"      // SocketsService
 #include "brpc/builtin/bad_method_service.h"
 #include "brpc/server.h"
+#include "brpc/details/server_private_accessor.h"
+#include "brpc/details/codel_admission.h"
+#include "brpc/details/usercode_backup_pool.h"
+#include "brpc/acceptor.h"
+#include "brpc/shm/shm_endpoint.h"
 #include "brpc/restful.h"
 #include "brpc/channel.h"
 #include "brpc/socket_map.h"
 #include "brpc/controller.h"
 #include "brpc/compress.h"
+#include "brpc/adaptive_compress_policy.h"
+#include "brpc/policy/priority_concurrency_limiter.h"
+#include "brpc/policy/baidu_rpc_protocol.h"
+#include "brpc/policy/baidu_rpc_meta.pb.h"
 #include "echo.pb.h"
 #include "v1.pb.h"
 #include "v2.pb.h"
@@ -67,9 +79,16 @@ int main(int argc, char* argv[]) {
 namespace brpc {
 DECLARE_bool(enable_threads_service);
 DECLARE_bool(enable_dir_service);
+DECLARE_bool(rpc_phase_stats);
+DECLARE_int32(usercode_backup_max_threads);
+DECLARE_int32(usercode_backup_grow_wait_us);
+DECLARE_int32(usercode_backup_idle_s);
 
 namespace policy {
 DECLARE_bool(use_http_error_code);
+DECLARE_bool(report_server_load);
+DECLARE_bool(baidu_std_protocol_deliver_timeout_ms);
+DECLARE_bool(baidu_std_fail_expired_requests);
 
 extern bool SerializeRpcMessage(const google::protobuf::Message& serializer,
                                 Controller& cntl, ContentType content_type,
@@ -446,6 +465,45 @@ TEST_F(ServerTest, only_allow_protocols_in_enabled_protocols) {
     ASSERT_EQ(0, server.Join());
 }
 
+TEST_F(ServerTest, pinned_protocol) {
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8613", &ep));
+    brpc::Server server;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(
+                  &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions opt;
+    opt.enabled_protocols = "baidu_std";
+    opt.pinned_protocol = "hulu_pbrpc";
+    ASSERT_EQ(-1, server.Start(ep, &opt));
+    opt.pinned_protocol = "baidu_std";
+    ASSERT_EQ(0, server.Start(ep, &opt));
+
+    brpc::ChannelOptions copt;
+    brpc::Controller cntl;
+    test::EchoRequest req;
+    test::EchoResponse res;
+    req.set_message(EXP_REQUEST);
+
+    brpc::Channel chan;
+    copt.protocol = "baidu_std";
+    ASSERT_EQ(0, chan.Init(ep, &copt));
+    test::EchoService_Stub stub(&chan);
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+
+    // Even http is not detected.
+    brpc::Channel http_channel;
+    copt.protocol = "http";
+    ASSERT_EQ(0, http_channel.Init(ep, &copt));
+    cntl.Reset();
+    http_channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+    ASSERT_TRUE(cntl.Failed());
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
 TEST_F(ServerTest, services_in_different_ns) {
     const int port = 9200;
     brpc::Server server1;
@@ -1127,6 +1185,47 @@ TEST_F(ServerTest, http_error_code) {
     brpc::policy::FLAGS_use_http_error_code = false;
 }
 
+TEST_F(ServerTest, restful_map_with_many_paths) {
+    EchoServiceV1 service_v1;
+    brpc::RestfulMap m("api");
+    const brpc::Server::MethodProperty::OpaqueParams params;
+    for (int i = 0; i < 800; ++i) {
+        brpc::RestfulMethodPath path;
+        ASSERT_TRUE(brpc::ParseRestfulPath(
+            butil::string_printf("/api/v%d/r%d/*", i % 8, i), &path));
+        ASSERT_TRUE(m.AddMethod(path, &service_v1, params, "Echo", NULL));
+        ASSERT_TRUE(brpc::ParseRestfulPath(
+            butil::string_printf("/api/v%d/r%d/item", i % 8, i), &path));
+        ASSERT_TRUE(m.AddMethod(path, &service_v1, params, "Echo2", NULL));
+    }
+    brpc::RestfulMethodPath path;
+    ASSERT_TRUE(brpc::ParseRestfulPath("/api/v1/*.json", &path));
+    ASSERT_TRUE(m.AddMethod(path, &service_v1, params, "Echo3", NULL));
+    ASSERT_EQ(1601u, m.size());
+    m.PrepareForFinding();
+
+    std::string unresolved;
+    const brpc::Server::MethodProperty* mp =
+        m.FindMethodProperty("/v3/r123/a/b", &unresolved);
+    ASSERT_TRUE(mp);
+    ASSERT_EQ("Echo", mp->method->name());
+    ASSERT_EQ("a/b", unresolved);
+    mp = m.FindMethodProperty("/v3/r123/item", &unresolved);
+    ASSERT_TRUE(mp);
+    ASSERT_EQ("Echo2", mp->method->name());
+    ASSERT_EQ("", unresolved);
+    // The longest prefix wins.
+    mp = m.FindMethodProperty("/v1/r9/x.json", &unresolved);
+    ASSERT_TRUE(mp);
+    ASSERT_EQ("Echo", mp->method->name());
+    mp = m.FindMethodProperty("/v1/r8/x.json", &unresolved);
+    ASSERT_TRUE(mp);
+    ASSERT_EQ("Echo3", mp->method->name());
+    ASSERT_EQ("r8/x", unresolved);
+    ASSERT_FALSE(m.FindMethodProperty("/v3/r124", &unresolved));
+    ASSERT_FALSE(m.FindMethodProperty("/v8", &unresolved));
+}
+
 TEST_F(ServerTest, conflict_name_between_restful_mapping_and_builtin) {
     const int port = 9200;
     EchoServiceV1 service_v1;
@@ -1247,6 +1346,85 @@ TEST_F(ServerTest, add_remove_service) {
     ASSERT_EQ(0ul, server.service_count());
 }
 
+TEST_F(ServerTest, frozen_method_lookup) {
+    brpc::Server server;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(
+        &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    const google::protobuf::ServiceDescriptor* sd =
+        test::EchoService::descriptor();
+    const google::protobuf::MethodDescriptor* md = sd->FindMethodByName("Echo");
+    brpc::ServerPrivateAccessor accessor(&server);
+    // Not started yet.
+    ASSERT_TRUE(NULL == accessor.FindMethodPropertyByIndexHint(
+        sd->full_name(), md->name(), md->index()));
+    ASSERT_TRUE(accessor.FindMethodPropertyByFullName(md->full_name()) != NULL);
+
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8613", &ep));
+    ASSERT_EQ(0, server.Start(ep, NULL));
+    const brpc::Server::MethodProperty* mp =
+        accessor.FindMethodPropertyByFullName(md->full_name());
+    ASSERT_TRUE(mp != NULL);
+    ASSERT_EQ(md, mp->method);
+    ASSERT_EQ(mp, accessor.FindMethodPropertyByFullName(
+                  sd->full_name(), md->name()));
+    ASSERT_EQ(mp, accessor.FindMethodPropertyByNameAndIndex(
+                  sd->name(), md->index()));
+    ASSERT_EQ(mp, accessor.FindMethodPropertyByIndexHint(
+                  sd->full_name(), md->name(), md->index()));
+    ASSERT_EQ(mp, accessor.FindMethodPropertyByIndexHint(
+                  sd->name(), md->name(), md->index()));
+    // The hint is checked by name.
+    ASSERT_TRUE(NULL == accessor.FindMethodPropertyByIndexHint(
+        sd->full_name(), "ComboEcho", md->index()));
+    ASSERT_TRUE(NULL == accessor.FindMethodPropertyByIndexHint(
+        sd->full_name(), md->name(), sd->method_count()));
+    ASSERT_TRUE(NULL == accessor.FindMethodPropertyByFullName("test.EchoService.NotExist"));
+    ASSERT_TRUE(server.FindServiceByName(sd->name()) == &echo_svc);
+    ASSERT_TRUE(server.FindServiceByFullName(sd->full_name()) == &echo_svc);
+    ASSERT_TRUE(NULL == server.FindServiceByFullName(sd->name()));
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+    ASSERT_EQ(0, server.RemoveService(&echo_svc));
+    ASSERT_TRUE(NULL == accessor.FindMethodPropertyByFullName(md->full_name()));
+    ASSERT_TRUE(NULL == accessor.FindMethodPropertyByIndexHint(
+        sd->full_name(), md->name(), md->index()));
+}
+
+TEST_F(ServerTest, frozen_name_map_with_many_names) {
+    brpc::FrozenNameMap<int> m;
+    std::vector<std::pair<std::string, int> > items;
+    ASSERT_EQ(0, m.init(items));
+    ASSERT_TRUE(NULL == m.seek("a"));
+    const int N = 20000;
+    for (int i = 0; i < N; ++i) {
+        char name[64];
+        snprintf(name, sizeof(name), "test.EchoService%d.Method%d", i / 10, i);
+        items.push_back(std::make_pair(std::string(name), i));
+    }
+    ASSERT_EQ(0, m.init(items));
+    ASSERT_TRUE(m.initialized());
+    // Slots are bounded by a small factor of the names.
+    ASSERT_LE(m._slots.size(), (size_t)N * 4);
+    for (int i = 0; i < N; ++i) {
+        const int* v = m.seek(items[i].first);
+        ASSERT_TRUE(v != NULL) << items[i].first;
+        ASSERT_EQ(i, *v);
+    }
+    for (int i = N; i < 2 * N; ++i) {
+        char name[64];
+        snprintf(name, sizeof(name), "test.EchoService%d.Method%d", i / 10, i);
+        ASSERT_TRUE(NULL == m.seek(name)) << name;
+    }
+    // Duplicated names are rejected.
+    items.push_back(items[N / 2]);
+    ASSERT_EQ(-1, m.init(items));
+    ASSERT_FALSE(m.initialized());
+    ASSERT_TRUE(NULL == m.seek(items[0].first));
+}
+
 void SendSleepRPC(butil::EndPoint ep, int sleep_ms, bool succ) {
     brpc::Channel channel;
     ASSERT_EQ(0, channel.Init(ep, NULL));
@@ -1268,6 +1446,132 @@ void SendSleepRPC(butil::EndPoint ep, int sleep_ms, bool succ) {
     }
 }
 
+TEST_F(ServerTest, coalesce_identical_calls) {
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8613", &ep));
+    brpc::Server server;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(
+                  &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(ep, NULL));
+
+    brpc::Channel chan;
+    brpc::ChannelOptions copt;
+    copt.coalesce_identical_calls = true;
+    ASSERT_EQ(0, chan.Init(ep, &copt));
+    test::EchoService_Stub stub(&chan);
+
+    const int N = 10;
+    brpc::Controller cntls[N];
+    test::EchoRequest req;
+    test::EchoResponse res[N];
+    req.set_message(EXP_REQUEST);
+    req.set_sleep_us(200000);
+    for (int i = 0; i < N; ++i) {
+        stub.Echo(&cntls[i], &req, &res[i], brpc::DoNothing());
+    }
+    // A follower ends at its own deadline.
+    brpc::Controller timedout_cntl;
+    test::EchoResponse timedout_res;
+    timedout_cntl.set_timeout_ms(50);
+    stub.Echo(&timedout_cntl, &req, &timedout_res, NULL);
+    ASSERT_EQ(brpc::ERPCTIMEDOUT, timedout_cntl.ErrorCode());
+
+    for (int i = 0; i < N; ++i) {
+        brpc::Join(cntls[i].call_id());
+        ASSERT_FALSE(cntls[i].Failed()) << cntls[i].ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res[i].message());
+    }
+    ASSERT_EQ(1, echo_svc.count.load());
+
+    // Not in flight anymore.
+    brpc::Controller cntl;
+    req.set_sleep_us(0);
+    stub.Echo(&cntl, &req, &res[0], NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(2, echo_svc.count.load());
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+TEST_F(ServerTest, coalesced_calls_outlive_leader) {
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8614", &ep));
+    brpc::Server server;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(
+                  &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(ep, NULL));
+
+    brpc::Channel chan;
+    brpc::ChannelOptions copt;
+    copt.coalesce_identical_calls = true;
+    copt.max_retry = 0;
+    ASSERT_EQ(0, chan.Init(ep, &copt));
+    test::EchoService_Stub stub(&chan);
+
+    test::EchoRequest req;
+    req.set_message(EXP_REQUEST);
+    req.set_sleep_us(200000);
+
+    // The leader times out before its response comes back, followers with
+    // longer deadlines are sent again instead of failing with it.
+    brpc::Controller leader_cntl;
+    test::EchoResponse leader_res;
+    leader_cntl.set_timeout_ms(100);
+    stub.Echo(&leader_cntl, &req, &leader_res, brpc::DoNothing());
+    const int N = 5;
+    brpc::Controller cntls[N];
+    test::EchoResponse res[N];
+    for (int i = 0; i < N; ++i) {
+        cntls[i].set_timeout_ms(2000);
+        stub.Echo(&cntls[i], &req, &res[i], brpc::DoNothing());
+    }
+    brpc::Join(leader_cntl.call_id());
+    ASSERT_EQ(brpc::ERPCTIMEDOUT, leader_cntl.ErrorCode());
+    for (int i = 0; i < N; ++i) {
+        brpc::Join(cntls[i].call_id());
+        ASSERT_FALSE(cntls[i].Failed()) << cntls[i].ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res[i].message());
+    }
+    // Sent by the leader and the promoted follower.
+    ASSERT_EQ(2, echo_svc.count.load());
+
+    // Same for a canceled leader.
+    brpc::Controller canceled_cntl;
+    test::EchoResponse canceled_res;
+    stub.Echo(&canceled_cntl, &req, &canceled_res, brpc::DoNothing());
+    for (int i = 0; i < N; ++i) {
+        cntls[i].Reset();
+        res[i].Clear();
+        stub.Echo(&cntls[i], &req, &res[i], brpc::DoNothing());
+    }
+    brpc::StartCancel(canceled_cntl.call_id());
+    brpc::Join(canceled_cntl.call_id());
+    ASSERT_EQ(ECANCELED, canceled_cntl.ErrorCode());
+    for (int i = 0; i < N; ++i) {
+        brpc::Join(cntls[i].call_id());
+        ASSERT_FALSE(cntls[i].Failed()) << cntls[i].ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res[i].message());
+    }
+    ASSERT_EQ(4, echo_svc.count.load());
+
+    // Errors from the server are still shared.
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+    brpc::Controller failed_cntls[N];
+    for (int i = 0; i < N; ++i) {
+        res[i].Clear();
+        stub.Echo(&failed_cntls[i], &req, &res[i], brpc::DoNothing());
+    }
+    for (int i = 0; i < N; ++i) {
+        brpc::Join(failed_cntls[i].call_id());
+        ASSERT_TRUE(failed_cntls[i].Failed());
+        ASSERT_NE(brpc::ERPCTIMEDOUT, failed_cntls[i].ErrorCode());
+    }
+}
+
 TEST_F(ServerTest, close_idle_connections) {
     butil::EndPoint ep;
     brpc::Server server;
@@ -1458,6 +1762,241 @@ TEST_F(ServerTest, range_start) {
     EXPECT_EQ(END_PORT, server.listen_address().port);
 }
 
+TEST_F(ServerTest, reuse_port_listeners) {
+    const int port = 8720;
+    brpc::Server server;
+    EchoServiceImpl service;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions opt;
+    opt.num_reuse_port_listeners = 4;
+    for (int round = 0; round < 2; ++round) {
+        ASSERT_EQ(0, server.Start(port, &opt));
+        ASSERT_EQ(4u, server._am->listener_count());
+
+        // Short connections are spread over all listeners by the kernel.
+        brpc::ChannelOptions copt;
+        copt.connection_type = brpc::CONNECTION_TYPE_SHORT;
+        brpc::Channel chan;
+        ASSERT_EQ(0, chan.Init("127.0.0.1", port, &copt));
+        test::EchoService_Stub stub(&chan);
+        for (int i = 0; i < 16; ++i) {
+            brpc::Controller cntl;
+            test::EchoRequest req;
+            test::EchoResponse res;
+            req.set_message(EXP_REQUEST);
+            stub.Echo(&cntl, &req, &res, NULL);
+            ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+            ASSERT_EQ(EXP_RESPONSE, res.message());
+        }
+        ASSERT_EQ(0, server.Stop(0));
+        ASSERT_EQ(0, server.Join());
+        ASSERT_EQ(-1, server._am->listened_fd());
+    }
+    ASSERT_EQ(32, service.count.load());
+}
+
+TEST_F(ServerTest, handoff_listen_fds) {
+    const int port = 8723;
+    const char* path = "brpc_server_unittest_handoff.sock";
+    unlink(path);
+    EchoServiceImpl service;
+    brpc::ServerOptions opt;
+    opt.handoff_path = path;
+    brpc::Server old_server;
+    ASSERT_EQ(0, old_server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, old_server.Start(port, &opt));
+    const int old_fd = old_server._am->listened_fd();
+
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init("127.0.0.1", port, NULL));
+    test::EchoService_Stub stub(&chan);
+    brpc::Controller cntl;
+    test::EchoRequest req;
+    test::EchoResponse res;
+    req.set_message(EXP_REQUEST);
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+
+    // The new server takes over the port without listening it again, and
+    // the old one stops.
+    brpc::Server new_server;
+    ASSERT_EQ(0, new_server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, new_server.Start(port, &opt));
+    ASSERT_NE(old_fd, new_server._am->listened_fd());
+    for (int i = 0; i < 100 && old_server.IsRunning(); ++i) {
+        bthread_usleep(10000);
+    }
+    ASSERT_FALSE(old_server.IsRunning());
+    ASSERT_TRUE(brpc::IsAskedToQuit());
+    ASSERT_EQ(0, old_server.Join());
+
+    brpc::Channel chan2;
+    ASSERT_EQ(0, chan2.Init("127.0.0.1", port, NULL));
+    test::EchoService_Stub stub2(&chan2);
+    cntl.Reset();
+    stub2.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(0, new_server.Stop(0));
+    ASSERT_EQ(0, new_server.Join());
+    unlink(path);
+}
+
+TEST_F(ServerTest, bthread_tag_of_method) {
+    const int port = 8724;
+    EchoServiceImpl service;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(-1, server.SetBthreadTagOf("test.EchoService.NoSuchMethod", 0));
+    // Only one tag exists in this test.
+    ASSERT_EQ(0, server.SetBthreadTagOf("test.EchoService.Echo", 1));
+    ASSERT_EQ(-1, server.Start(port, NULL));
+    ASSERT_EQ(0, server.SetBthreadTagOf("test.EchoService.Echo",
+                                        BTHREAD_TAG_DEFAULT));
+    ASSERT_EQ(0, server.Start(port, NULL));
+    ASSERT_EQ(-1, server.SetBthreadTagOf("test.EchoService.Echo",
+                                         BTHREAD_TAG_DEFAULT));
+
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init("127.0.0.1", port, NULL));
+    test::EchoService_Stub stub(&chan);
+    brpc::Controller cntl;
+    test::EchoRequest req;
+    test::EchoResponse res;
+    req.set_message(EXP_REQUEST);
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(EXP_RESPONSE, res.message());
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+TEST_F(ServerTest, shm_transport) {
+    const int port = 8721;
+    brpc::Server server;
+    EchoServiceImpl service;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions opt;
+    opt.use_shm = true;
+    ASSERT_EQ(0, server.Start(port, &opt));
+    const std::string path = brpc::shm::ShmSocketPath(port);
+    struct stat st;
+    ASSERT_EQ(0, lstat(path.c_str(), &st));
+    ASSERT_TRUE(S_ISSOCK(st.st_mode));
+    ASSERT_EQ((mode_t)(S_IRUSR | S_IWUSR), st.st_mode & 0777);
+
+    brpc::ChannelOptions copt;
+    copt.use_shm = true;
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init("127.0.0.1", port, &copt));
+    test::EchoService_Stub stub(&chan);
+    // Attachments larger than the ring make the writer wait for space.
+    const std::string big(brpc::shm::FLAGS_shm_ring_size * 3 + 17, 'x');
+    for (int i = 0; i < 8; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+        if (i % 2) {
+            cntl.request_attachment().append(big);
+        }
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res.message());
+    }
+    ASSERT_EQ(8, service.count.load());
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+    ASSERT_NE(0, access(path.c_str(), F_OK));
+}
+
+TEST_F(ServerTest, shm_socket_path_taken_by_other_file) {
+    const int port = 8726;
+    const std::string path = brpc::shm::ShmSocketPath(port);
+    unlink(path.c_str());
+    {
+        butil::fd_guard fd(open(path.c_str(), O_CREAT | O_WRONLY, 0600));
+        ASSERT_GE(fd, 0);
+    }
+    brpc::Server server;
+    EchoServiceImpl service;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions opt;
+    opt.use_shm = true;
+    ASSERT_EQ(-1, server.Start(port, &opt));
+    // The file is not removed.
+    struct stat st;
+    ASSERT_EQ(0, lstat(path.c_str(), &st));
+    ASSERT_TRUE(S_ISREG(st.st_mode));
+    ASSERT_EQ(0, unlink(path.c_str()));
+
+    ASSERT_EQ(0, server.Start(port, &opt));
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+TEST_F(ServerTest, warm_pooled_connections) {
+    const int port = 8722;
+    brpc::Server server;
+    EchoServiceImpl service;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(port, NULL));
+
+    brpc::ChannelOptions copt;
+    copt.connection_type = brpc::CONNECTION_TYPE_POOLED;
+    copt.min_pooled_connections = 3;
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init("127.0.0.1", port, &copt));
+    // Connections are made in background before any RPC.
+    for (int i = 0; i < 100 && server._am->ConnectionCount() < 3; ++i) {
+        bthread_usleep(10000);
+    }
+    ASSERT_EQ(3u, server._am->ConnectionCount());
+
+    test::EchoService_Stub stub(&chan);
+    brpc::Controller cntl;
+    test::EchoRequest req;
+    test::EchoResponse res;
+    req.set_message(EXP_REQUEST);
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(3u, server._am->ConnectionCount());
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+TEST_F(ServerTest, warm_pooled_connections_more_than_max) {
+    const int port = 8725;
+    brpc::Server server;
+    EchoServiceImpl service;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(port, NULL));
+
+    brpc::ChannelOptions copt;
+    copt.connection_type = brpc::CONNECTION_TYPE_POOLED;
+    copt.min_pooled_connections = 5;
+    copt.max_pooled_connections = 2;
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init("127.0.0.1", port, &copt));
+    for (int i = 0; i < 100 && server._am->ConnectionCount() < 2; ++i) {
+        bthread_usleep(10000);
+    }
+    // Warming up stops at max_pooled_connections instead of connecting
+    // and closing sockets forever.
+    bthread_usleep(200000);
+    ASSERT_EQ(2u, server._am->ConnectionCount());
+
+    test::EchoService_Stub stub(&chan);
+    brpc::Controller cntl;
+    test::EchoRequest req;
+    test::EchoResponse res;
+    req.set_message(EXP_REQUEST);
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(2u, server._am->ConnectionCount());
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
 TEST_F(ServerTest, add_builtin_service) {
     TestAddBuiltinService(brpc::IndexService::descriptor());
     TestAddBuiltinService(brpc::VersionService::descriptor());
@@ -1517,6 +2056,99 @@ TEST_F(ServerTest, base64_to_string) {
     }
 }
 
+class AliasingEchoServiceImpl : public test::EchoService {
+public:
+    virtual void BytesEcho1(google::protobuf::RpcController* cntl_base,
+                            const test::BytesRequest* request,
+                            test::BytesResponse* response,
+                            google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = (brpc::Controller*)cntl_base;
+        EXPECT_FALSE(request->has_databytes());
+        const butil::IOBuf* databytes = cntl->aliased_request_field(1);
+        ASSERT_TRUE(databytes != NULL);
+        response->set_databytes(databytes->to_string());
+    }
+};
+
+TEST_F(ServerTest, alias_request_fields) {
+    brpc::Server server;
+    AliasingEchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(&echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    // Not a bytes field.
+    ASSERT_EQ(-1, server.AliasRequestFieldsOf("test.EchoService.Echo",
+                                              std::vector<int>(1, 2)));
+    ASSERT_EQ(-1, server.AliasRequestFieldsOf("test.EchoService.BytesEcho1",
+                                              std::vector<int>(1, 2)));
+    ASSERT_EQ(0, server.AliasRequestFieldsOf("test.EchoService.BytesEcho1",
+                                             std::vector<int>(1, 1)));
+    ASSERT_EQ(0, server.Start(8613, NULL));
+    ASSERT_EQ(-1, server.AliasRequestFieldsOf("test.EchoService.BytesEcho1",
+                                              std::vector<int>(1, 1)));
+
+    const std::string data(256 * 1024, 'a');
+    const brpc::ProtocolType protocols[] = {
+        brpc::PROTOCOL_BAIDU_STD, brpc::PROTOCOL_HTTP };
+    for (size_t i = 0; i < arraysize(protocols); ++i) {
+        brpc::Channel chan;
+        brpc::ChannelOptions opt;
+        opt.protocol = protocols[i];
+        ASSERT_EQ(0, chan.Init("localhost:8613", &opt));
+        brpc::Controller cntl;
+        if (protocols[i] == brpc::PROTOCOL_HTTP) {
+            cntl.http_request().set_content_type("application/proto");
+        }
+        test::EchoService_Stub stub(&chan);
+        test::BytesRequest req;
+        test::BytesResponse res;
+        req.set_databytes(data);
+        stub.BytesEcho1(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(data, res.databytes());
+    }
+    server.Stop(0);
+    server.Join();
+}
+
+TEST_F(ServerTest, compress_policy) {
+    brpc::Server server;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(&echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::AdaptiveCompressOptions opt;
+    opt.min_size = 1024;
+    opt.candidates.push_back(brpc::COMPRESS_TYPE_GZIP);
+    ASSERT_EQ(-1, server.SetCompressPolicyOf("test.EchoService.NotExist",
+                                             new brpc::AdaptiveCompressPolicy(opt)));
+    brpc::AdaptiveCompressPolicy* policy = new brpc::AdaptiveCompressPolicy(opt);
+    ASSERT_EQ(0, server.SetCompressPolicyOf("test.EchoService.ComboEcho", policy));
+    ASSERT_EQ(0, server.Start(8613, NULL));
+    ASSERT_EQ(-1, server.SetCompressPolicyOf("test.EchoService.ComboEcho",
+                                             new brpc::AdaptiveCompressPolicy(opt)));
+
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init("localhost:8613", NULL));
+    test::EchoService_Stub stub(&chan);
+    const int nums[] = { 1, 500 };
+    for (size_t i = 0; i < arraysize(nums); ++i) {
+        brpc::Controller cntl;
+        test::ComboRequest req;
+        test::ComboResponse res;
+        for (int j = 0; j < nums[i]; ++j) {
+            req.add_requests()->set_message("hello world");
+        }
+        stub.ComboEcho(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(nums[i], res.responses_size());
+        // Small responses are not compressed.
+        ASSERT_EQ(i == 0 ? brpc::COMPRESS_TYPE_NONE : brpc::COMPRESS_TYPE_GZIP,
+                  cntl.response_compress_type());
+    }
+    ASSERT_GT(policy->RatioOf(brpc::COMPRESS_TYPE_GZIP), 0);
+    ASSERT_LT(policy->RatioOf(brpc::COMPRESS_TYPE_GZIP), 0.5);
+    server.Stop(0);
+    server.Join();
+}
+
 TEST_F(ServerTest, single_repeated_to_array) {
     for (int i = 0; i < 2; ++i) {
         brpc::Server server;
@@ -1662,6 +2294,236 @@ TEST_F(ServerTest, max_concurrency) {
     ASSERT_FALSE(cntl4.Failed()) << cntl4.ErrorText();
 }
 
+TEST_F(ServerTest, max_concurrency_by_priority) {
+    const int port = 9201;
+    brpc::Server server;
+    EchoServiceImpl service;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions options;
+    options.max_concurrency = 4;
+    options.shed_load_by_priority = true;
+    // Ratios must not decrease with priorities.
+    options.priority_max_concurrency_ratios = { 0.5, 0.25, 0.75, 1 };
+    ASSERT_EQ(-1, server.Start(port, &options));
+    options.priority_max_concurrency_ratios = { 0.25, 0.5, 0.75, 1 };
+    ASSERT_EQ(0, server.Start(port, &options));
+
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("0.0.0.0", port, NULL));
+    test::EchoService_Stub stub(&channel);
+    test::EchoRequest req;
+    req.set_message("hello");
+    req.set_sleep_us(200000);
+    // Two requests of default priority take its share of the server.
+    brpc::Controller sleep_cntl[2];
+    test::EchoResponse sleep_res[2];
+    for (int i = 0; i < 2; ++i) {
+        stub.Echo(&sleep_cntl[i], &req, &sleep_res[i], brpc::DoNothing());
+    }
+    bthread_usleep(50000);
+    req.clear_sleep_us();
+    const brpc::RequestPriority priorities[] = {
+        brpc::REQUEST_PRIORITY_SHEDDABLE, brpc::REQUEST_PRIORITY_DEFAULT,
+        brpc::REQUEST_PRIORITY_CRITICAL, brpc::REQUEST_PRIORITY_CRITICAL_PLUS
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(priorities); ++i) {
+        // Concurrency of a rejected request is removed after the response.
+        while (server.Concurrency() != 2) {
+            bthread_usleep(1000);
+        }
+        brpc::Controller cntl;
+        cntl.set_request_priority(priorities[i]);
+        // ELIMIT is retried by default.
+        cntl.set_max_retry(0);
+        test::EchoResponse res;
+        stub.Echo(&cntl, &req, &res, NULL);
+        if (priorities[i] < brpc::REQUEST_PRIORITY_CRITICAL) {
+            ASSERT_EQ(brpc::ELIMIT, cntl.ErrorCode()) << priorities[i];
+        } else {
+            ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        brpc::Join(sleep_cntl[i].call_id());
+        ASSERT_FALSE(sleep_cntl[i].Failed()) << sleep_cntl[i].ErrorText();
+    }
+    brpc::policy::PriorityConcurrencyLimiter* cl =
+        static_cast<brpc::policy::PriorityConcurrencyLimiter*>(
+            server._priority_cl);
+    ASSERT_EQ(1, cl->_rejected[brpc::REQUEST_PRIORITY_SHEDDABLE].get_value());
+    ASSERT_EQ(1, cl->_rejected[brpc::REQUEST_PRIORITY_DEFAULT].get_value());
+    ASSERT_EQ(2, cl->_accepted[brpc::REQUEST_PRIORITY_DEFAULT].get_value());
+    ASSERT_EQ(1, cl->_accepted[brpc::REQUEST_PRIORITY_CRITICAL].get_value());
+
+    // All requests are accepted when the server is idle.
+    while (server.Concurrency() != 0) {
+        bthread_usleep(1000);
+    }
+    brpc::Controller cntl;
+    cntl.set_request_priority(brpc::REQUEST_PRIORITY_SHEDDABLE);
+    test::EchoResponse res;
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    // Resetting max_concurrency of the server changes shares of priorities.
+    ASSERT_EQ(0, server.ResetMaxConcurrency(8));
+    ASSERT_EQ(8, cl->MaxConcurrency());
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+static int64_t GetPhaseVar(const brpc::MethodStatus* status, int phase,
+                           const char* name) {
+    const std::string var = status->_expose_prefix + "_phase_" +
+        brpc::ServerPhaseToString((brpc::ServerPhase)phase) + "_" + name;
+    return atoll(bvar::Variable::describe_exposed(var).c_str());
+}
+
+TEST_F(ServerTest, phase_latencies) {
+    const int port = 9202;
+    brpc::Server server;
+    EchoServiceImpl service;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(port, NULL));
+    brpc::ServerPrivateAccessor accessor(&server);
+    const brpc::Server::MethodProperty* mp =
+        accessor.FindMethodPropertyByFullName("test.EchoService.Echo");
+    ASSERT_TRUE(mp != NULL);
+    const brpc::MethodStatus* status = mp->status;
+
+    const char* protocols[] = { "baidu_std", "http" };
+    for (size_t i = 0; i < ARRAY_SIZE(protocols); ++i) {
+        brpc::ChannelOptions options;
+        options.protocol = protocols[i];
+        brpc::Channel channel;
+        ASSERT_EQ(0, channel.Init("0.0.0.0", port, &options));
+        test::EchoService_Stub stub(&channel);
+        test::EchoRequest req;
+        req.set_message(EXP_REQUEST);
+        req.set_sleep_us(20000);
+        brpc::Controller cntl;
+        test::EchoResponse res;
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    }
+    // Phases are recorded after the response is written.
+    for (int i = 0; i < 1000 && server.Concurrency() != 0; ++i) {
+        bthread_usleep(1000);
+    }
+    for (int i = 0; i < brpc::SERVER_PHASE_NUM; ++i) {
+        ASSERT_EQ(2, GetPhaseVar(status, i, "count"))
+            << brpc::ServerPhaseToString((brpc::ServerPhase)i);
+    }
+    // The handler sleeps, and other phases don't.
+    for (int i = 0; i < 30 && GetPhaseVar(
+             status, brpc::SERVER_PHASE_HANDLER, "max_latency") == 0; ++i) {
+        bthread_usleep(100000);
+    }
+    ASSERT_GE(GetPhaseVar(status, brpc::SERVER_PHASE_HANDLER, "max_latency"),
+              20000);
+    for (int i = 0; i < brpc::SERVER_PHASE_NUM; ++i) {
+        if (i != brpc::SERVER_PHASE_HANDLER) {
+            ASSERT_LT(GetPhaseVar(status, i, "max_latency"), 20000)
+                << brpc::ServerPhaseToString((brpc::ServerPhase)i);
+        }
+    }
+
+    // Not recorded when turned off.
+    brpc::FLAGS_rpc_phase_stats = false;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("0.0.0.0", port, NULL));
+    test::EchoService_Stub stub(&channel);
+    test::EchoRequest req;
+    req.set_message(EXP_REQUEST);
+    brpc::Controller cntl;
+    test::EchoResponse res;
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    for (int i = 0; i < 1000 && server.Concurrency() != 0; ++i) {
+        bthread_usleep(1000);
+    }
+    brpc::FLAGS_rpc_phase_stats = true;
+    ASSERT_EQ(2, GetPhaseVar(status, brpc::SERVER_PHASE_HANDLER, "count"));
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+TEST_F(ServerTest, fail_expired_baidu_std_requests) {
+    brpc::Server server;
+    EchoServiceImpl service;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(8615, NULL));
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    butil::fd_guard read_fd(fds[0]);
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    brpc::SocketId id;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    brpc::SocketUniquePtr sock;
+    ASSERT_EQ(0, brpc::Socket::Address(id, &sock));
+
+    const bool saved_deliver_timeout =
+        brpc::policy::FLAGS_baidu_std_protocol_deliver_timeout_ms;
+    const bool saved_fail_expired =
+        brpc::policy::FLAGS_baidu_std_fail_expired_requests;
+    brpc::policy::FLAGS_baidu_std_protocol_deliver_timeout_ms = true;
+    brpc::policy::FLAGS_baidu_std_fail_expired_requests = true;
+    const google::protobuf::MethodDescriptor* md =
+        test::EchoService::descriptor()->FindMethodByName("Echo");
+    for (int expired = 0; expired < 2; ++expired) {
+        brpc::Controller cntl;
+        cntl.set_timeout_ms(100);
+        cntl._real_timeout_ms = 100;
+        test::EchoRequest req;
+        req.set_message(EXP_REQUEST);
+        butil::IOBuf body;
+        butil::IOBufAsZeroCopyOutputStream stream(&body);
+        ASSERT_TRUE(req.SerializeToZeroCopyStream(&stream));
+        butil::IOBuf buf;
+        brpc::policy::PackRpcRequest(&buf, NULL, 1, md, &cntl, body, NULL);
+        brpc::ParseResult pr =
+            brpc::policy::ParseRpcMessage(&buf, sock.get(), false, NULL);
+        ASSERT_TRUE(pr.is_ok());
+        brpc::InputMessageBase* msg = pr.message();
+        // The request was received 200ms ago when it expires.
+        msg->_received_us = butil::cpuwide_time_us() - expired * 200000;
+        msg->_base_real_us = butil::gettimeofday_us() - butil::cpuwide_time_us();
+        sock->ReAddress(&msg->_socket);
+        msg->_arg = &server;
+        const int64_t ncalled = service.count.load();
+        brpc::policy::ProcessRpcRequest(msg);
+
+        char header[12];
+        ASSERT_EQ((ssize_t)sizeof(header), read(fds[0], header, sizeof(header)));
+        ASSERT_EQ(0, memcmp(header, "PRPC", 4));
+        const uint32_t body_size = butil::NetToHost32(*(uint32_t*)(header + 4));
+        const uint32_t meta_size = butil::NetToHost32(*(uint32_t*)(header + 8));
+        std::string res(body_size, '\0');
+        for (size_t n = 0; n < body_size;) {
+            const ssize_t nr = read(fds[0], &res[n], body_size - n);
+            ASSERT_GT(nr, 0);
+            n += nr;
+        }
+        brpc::policy::RpcMeta meta;
+        ASSERT_TRUE(meta.ParseFromArray(res.data(), meta_size));
+        if (expired) {
+            ASSERT_EQ(brpc::ERPCTIMEDOUT, meta.response().error_code());
+            // User code is not run.
+            ASSERT_EQ(ncalled, service.count.load());
+        } else {
+            ASSERT_EQ(0, meta.response().error_code())
+                << meta.response().error_text();
+            ASSERT_EQ(ncalled + 1, service.count.load());
+        }
+    }
+    brpc::policy::FLAGS_baidu_std_protocol_deliver_timeout_ms =
+        saved_deliver_timeout;
+    brpc::policy::FLAGS_baidu_std_fail_expired_requests = saved_fail_expired;
+    sock->SetFailed();
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
 TEST_F(ServerTest, user_fields) {
     const int port = 9200;
     brpc::Server server;
@@ -2001,6 +2863,61 @@ TEST_F(ServerTest, arena_rpc_pb_message_factory) {
     ASSERT_EQ(0, server.Join());
 }
 
+TEST_F(ServerTest, adaptive_arena_rpc_pb_message_factory) {
+    EchoServiceImpl echo_svc;
+    const google::protobuf::MethodDescriptor* method =
+        echo_svc.GetDescriptor()->FindMethodByName("ComboEcho");
+    ASSERT_TRUE(method != NULL);
+    brpc::AdaptiveArenaRpcPBMessageFactory factory(64 * 1024);
+    const size_t init_size = factory.InitialBlockSizeOf(*method);
+    for (int i = 0; i < 100; ++i) {
+        brpc::RpcPBMessages* messages = factory.Get(echo_svc, *method);
+        ASSERT_TRUE(messages->Request()->GetArena() != NULL);
+        // Sub-messages are allocated from the arena as well.
+        test::ComboRequest* req =
+            static_cast<test::ComboRequest*>(messages->Request());
+        for (int j = 0; j < 200; ++j) {
+            req->add_requests()->set_code(j);
+        }
+        factory.Return(messages);
+    }
+    // Grows with the space used by calls.
+    ASSERT_LT(init_size, factory.InitialBlockSizeOf(*method));
+    ASSERT_LE(factory.InitialBlockSizeOf(*method), 64u * 1024);
+
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8613", &ep));
+    brpc::Server server;
+    EchoServiceV3 service;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions opt;
+    opt.use_arena_for_rpc_pb_messages = true;
+    ASSERT_EQ(0, server.Start(ep, &opt));
+    ASSERT_TRUE(dynamic_cast<brpc::AdaptiveArenaRpcPBMessageFactory*>(
+                    server.options().rpc_pb_message_factory) != NULL);
+
+    const char* const protocols[] = { "baidu_std", "http" };
+    for (size_t i = 0; i < arraysize(protocols); ++i) {
+        brpc::Channel chan;
+        brpc::ChannelOptions copt;
+        copt.protocol = protocols[i];
+        ASSERT_EQ(0, chan.Init(ep, &copt));
+        for (int j = 0; j < 100; ++j) {
+            brpc::Controller cntl;
+            v3::EchoRequest req;
+            v3::EchoResponse res;
+            req.set_message(EXP_REQUEST);
+            v3::EchoService_Stub stub(&chan);
+            stub.Echo(&cntl, &req, &res, NULL);
+            ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+            ASSERT_EQ(EXP_RESPONSE, res.message());
+        }
+    }
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
 void TestBaiduStdAuth(const butil::EndPoint& ep,
     brpc::Controller& cntl,
     int error_code, bool failed) {
@@ -2070,4 +2987,212 @@ TEST_F(ServerTest, auth) {
     ASSERT_EQ(0, server.Join());
 }
 
+TEST_F(ServerTest, response_cache) {
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8613", &ep));
+    brpc::Server server;
+    EchoServiceImpl service;
+    brpc::ServiceOptions svc_opt;
+    svc_opt.response_cache_methods = "Echo, NoSuchMethod";
+    ASSERT_EQ(-1, server.AddService(&service, svc_opt));
+    svc_opt.response_cache_methods = "Echo";
+    svc_opt.response_cache_ttl_ms = 200;
+    ASSERT_EQ(0, server.AddService(&service, svc_opt));
+    ASSERT_EQ(0, server.Start(ep, NULL));
+
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init(ep, NULL));
+    test::EchoService_Stub stub(&chan);
+    test::EchoRequest req;
+    req.set_message(EXP_REQUEST);
+    for (int i = 0; i < 3; ++i) {
+        brpc::Controller cntl;
+        test::EchoResponse res;
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res.message());
+    }
+    // Answered by the cache except the first one.
+    ASSERT_EQ(1, service.count.load());
+
+    // Requests with attachments are not cached.
+    for (int i = 0; i < 2; ++i) {
+        brpc::Controller cntl;
+        cntl.request_attachment().append("attachment");
+        test::EchoResponse res;
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    }
+    ASSERT_EQ(3, service.count.load());
+
+    // Cached responses expire.
+    bthread_usleep(300000);
+    {
+        brpc::Controller cntl;
+        test::EchoResponse res;
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res.message());
+    }
+    ASSERT_EQ(4, service.count.load());
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+TEST_F(ServerTest, codel_admission) {
+    brpc::CodelAdmission codel(5000, 100000);
+    // Requests queued shorter than the interval are admitted normally.
+    ASSERT_TRUE(codel.Admit(50000));
+    ASSERT_FALSE(codel.Admit(150000));
+    ASSERT_FALSE(codel.overloaded());
+    // Minimum queueing time of the last interval is above the target, the
+    // ones queued longer than the target are dropped.
+    bthread_usleep(110000);
+    ASSERT_FALSE(codel.Admit(6000));
+    ASSERT_TRUE(codel.overloaded());
+    ASSERT_TRUE(codel.Admit(1000));
+    // Back to normal after an interval with short queueing.
+    bthread_usleep(110000);
+    ASSERT_TRUE(codel.Admit(6000));
+    ASSERT_FALSE(codel.overloaded());
+    ASSERT_NE("", bvar::Variable::describe_exposed(
+                      "rpc_server_codel_dropped_count"));
+
+    // Requests are admitted by servers with codel enabled normally.
+    brpc::Server server;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(&echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions opt;
+    opt.codel_target_ms = 5;
+    ASSERT_EQ(0, server.Start(8613, &opt));
+    ASSERT_TRUE(server._codel != NULL);
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init("127.0.0.1:8613", NULL));
+    test::EchoService_Stub stub(&chan);
+    for (int i = 0; i < 10; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    }
+    server.Stop(0);
+    server.Join();
+}
+
+TEST_F(ServerTest, report_server_load) {
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8614", &ep));
+    brpc::Server server;
+    EchoServiceImpl service;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    server.MaxConcurrencyOf("test.EchoService.Echo") = 4;
+    ASSERT_EQ(0, server.Start(ep, NULL));
+
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init(ep, NULL));
+    test::EchoService_Stub stub(&chan);
+    test::EchoRequest req;
+    req.set_message(EXP_REQUEST);
+    {
+        brpc::Controller cntl;
+        test::EchoResponse res;
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(-1, cntl.server_load());
+    }
+    brpc::policy::FLAGS_report_server_load = true;
+    {
+        brpc::Controller cntl;
+        test::EchoResponse res;
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        // The call itself is 1 of 4.
+        ASSERT_EQ(250, cntl.server_load());
+    }
+    brpc::policy::FLAGS_report_server_load = false;
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+static int64_t GetExposedInt(const char* name) {
+    return atoll(bvar::Variable::describe_exposed(name).c_str());
+}
+
+static butil::atomic<bool> g_release_usercode(false);
+static butil::atomic<int> g_usercode_done(0);
+
+static void BlockingUserCode(void*) {
+    while (!g_release_usercode.load(butil::memory_order_acquire)) {
+        usleep(1000);
+    }
+    g_usercode_done.fetch_add(1, butil::memory_order_relaxed);
+}
+
+TEST_F(ServerTest, usercode_backup_pool_grows_and_shrinks) {
+    const int saved_max_threads = brpc::FLAGS_usercode_backup_max_threads;
+    const int saved_grow_wait_us = brpc::FLAGS_usercode_backup_grow_wait_us;
+    const int saved_idle_s = brpc::FLAGS_usercode_backup_idle_s;
+    const int max_threads = brpc::FLAGS_usercode_backup_threads + 3;
+    brpc::FLAGS_usercode_backup_max_threads = max_threads;
+    brpc::FLAGS_usercode_backup_grow_wait_us = 1000;
+    brpc::FLAGS_usercode_backup_idle_s = 1;
+    brpc::InitUserCodeBackupPoolOnceOrDie();
+    ASSERT_EQ(brpc::FLAGS_usercode_backup_threads,
+              GetExposedInt("rpc_usercode_backup_threads"));
+    const int64_t waits_before =
+        GetExposedInt("rpc_usercode_backup_queue_wait_count");
+
+    g_release_usercode.store(false);
+    g_usercode_done.store(0);
+    // Occupy all initial threads and leave more user code in the queue.
+    const int N = max_threads + 2;
+    for (int i = 0; i < N; ++i) {
+        brpc::BeginRunningUserCode();
+        brpc::EndRunningUserCodeInPool(BlockingUserCode, NULL);
+    }
+    // No thread is added before queued user code waits long enough.
+    ASSERT_EQ(brpc::FLAGS_usercode_backup_threads,
+              GetExposedInt("rpc_usercode_backup_threads"));
+    usleep(10000);
+    // Growth is checked on enqueue, and cascades on dequeue of each new
+    // thread until all threads are busy or the limit is reached.
+    brpc::BeginRunningUserCode();
+    brpc::EndRunningUserCodeInPool(BlockingUserCode, NULL);
+    for (int i = 0; i < 200 &&
+             GetExposedInt("rpc_usercode_backup_threads") < max_threads; ++i) {
+        usleep(10000);
+    }
+    ASSERT_EQ(max_threads, GetExposedInt("rpc_usercode_backup_threads"));
+    usleep(20000);
+    ASSERT_EQ(max_threads, GetExposedInt("rpc_usercode_backup_threads"));
+    ASSERT_EQ(0, GetExposedInt("rpc_usercode_backup_idle_threads"));
+    ASSERT_EQ(0, g_usercode_done.load());
+
+    g_release_usercode.store(true, butil::memory_order_release);
+    for (int i = 0; i < 200 && g_usercode_done.load() < N + 1; ++i) {
+        usleep(10000);
+    }
+    ASSERT_EQ(N + 1, g_usercode_done.load());
+    ASSERT_EQ(waits_before + N + 1,
+              GetExposedInt("rpc_usercode_backup_queue_wait_count"));
+
+    // Added threads quit after being idle for -usercode_backup_idle_s.
+    for (int i = 0; i < 400 && GetExposedInt("rpc_usercode_backup_threads") >
+             brpc::FLAGS_usercode_backup_threads; ++i) {
+        usleep(10000);
+    }
+    ASSERT_EQ(brpc::FLAGS_usercode_backup_threads,
+              GetExposedInt("rpc_usercode_backup_threads"));
+    ASSERT_EQ(brpc::FLAGS_usercode_backup_threads,
+              GetExposedInt("rpc_usercode_backup_idle_threads"));
+
+    brpc::FLAGS_usercode_backup_max_threads = saved_max_threads;
+    brpc::FLAGS_usercode_backup_grow_wait_us = saved_grow_wait_us;
+    brpc::FLAGS_usercode_backup_idle_s = saved_idle_s;
+}
+
 } //namespace
@@ -28,6 +28,12 @@
 #include "snappy_message.pb.h"
 #include "brpc/policy/snappy_compress.h"
 #include "brpc/policy/gzip_compress.h"
+#include "brpc/policy/zstd_compress.h"
+#include "brpc/policy/lz4_compress.h"
+#include <zlib.h>
+#if BRPC_WITH_ZSTD
+#include <zdict.h>
+#endif
 
 typedef bool (*Compress)(const google::protobuf::Message&, butil::IOBuf*);
 typedef bool (*Decompress)(const butil::IOBuf&, google::protobuf::Message*);
@@ -194,6 +200,16 @@ TEST_F(test_compress_method, throughput_compare) {
         CompressMessage("Zlib", k, old_msg, len, 
                          brpc::policy::ZlibCompress, 
                          brpc::policy::ZlibDecompress);
+#if BRPC_WITH_ZSTD
+        CompressMessage("Zstd", k, old_msg, len,
+                         brpc::policy::ZstdCompress,
+                         brpc::policy::ZstdDecompress);
+#endif
+#if BRPC_WITH_LZ4
+        CompressMessage("Lz4", k, old_msg, len,
+                         brpc::policy::Lz4Compress,
+                         brpc::policy::Lz4Decompress);
+#endif
         printf("\n");
         delete [] text;
     }
@@ -228,6 +244,16 @@ TEST_F(test_compress_method, throughput_compare_complete_random) {
         CompressMessage("Zlib", k, old_msg, len, 
                          brpc::policy::ZlibCompress, 
                          brpc::policy::ZlibDecompress);
+#if BRPC_WITH_ZSTD
+        CompressMessage("Zstd", k, old_msg, len,
+                         brpc::policy::ZstdCompress,
+                         brpc::policy::ZstdDecompress);
+#endif
+#if BRPC_WITH_LZ4
+        CompressMessage("Lz4", k, old_msg, len,
+                         brpc::policy::Lz4Compress,
+                         brpc::policy::Lz4Decompress);
+#endif
         printf("\n");
         delete [] text;
     }
@@ -253,3 +279,212 @@ TEST_F(test_compress_method, mass_snappy_iobuf) {
     ASSERT_TRUE(strcmp(check_str.c_str(), text) == 0);
     delete [] text;
 }
+
+// Build an IOBuf whose content spreads over many small blocks.
+static std::string MakeFragmentedText(butil::IOBuf* buf, size_t len) {
+    std::string text;
+    while (text.size() < len) {
+        char piece[64];
+        const int n = snprintf(piece, sizeof(piece), "%d:%d;",
+                               (int)text.size(), rand() % 100);
+        text.append(piece, n);
+        butil::IOBuf tmp;
+        tmp.append(piece, n);
+        buf->append(tmp);
+    }
+    return text;
+}
+
+// Compress and decompress with zlib directly, which brpc must interoperate
+// with whichever implementation gzip_compress.cpp is built with.
+static bool ZlibDeflate(const std::string& in, bool gzip, std::string* out) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     gzip ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    out->resize(deflateBound(&zs, in.size()));
+    zs.next_in = (Bytef*)in.data();
+    zs.avail_in = in.size();
+    zs.next_out = (Bytef*)&(*out)[0];
+    zs.avail_out = out->size();
+    const int rc = deflate(&zs, Z_FINISH);
+    out->resize(zs.total_out);
+    deflateEnd(&zs);
+    return rc == Z_STREAM_END;
+}
+
+static bool ZlibInflate(const std::string& in, bool gzip, std::string* out) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, gzip ? 15 + 16 : 15) != Z_OK) {
+        return false;
+    }
+    zs.next_in = (Bytef*)in.data();
+    zs.avail_in = in.size();
+    out->clear();
+    int rc = Z_OK;
+    while (rc == Z_OK) {
+        char buf[4096];
+        zs.next_out = (Bytef*)buf;
+        zs.avail_out = sizeof(buf);
+        rc = inflate(&zs, Z_NO_FLUSH);
+        out->append(buf, sizeof(buf) - zs.avail_out);
+    }
+    inflateEnd(&zs);
+    return rc == Z_STREAM_END && zs.avail_in == 0;
+}
+
+TEST_F(test_compress_method, gzip_interoperate_with_zlib) {
+    const size_t lens[] = { 0, 17, 8192, 300000 };
+    for (int gzip = 0; gzip < 2; ++gzip) {
+        brpc::policy::GzipCompressOptions options;
+        options.format = (gzip ? google::protobuf::io::GzipOutputStream::GZIP
+                          : google::protobuf::io::GzipOutputStream::ZLIB);
+        for (size_t i = 0; i < ARRAY_SIZE(lens); ++i) {
+            butil::IOBuf buf, output_buf, check_buf;
+            const std::string text = MakeFragmentedText(&buf, lens[i]);
+            ASSERT_TRUE(brpc::policy::GzipCompress(buf, &output_buf, &options));
+            std::string check_str;
+            ASSERT_TRUE(ZlibInflate(output_buf.to_string(), gzip, &check_str));
+            ASSERT_EQ(text, check_str);
+
+            std::string deflated;
+            ASSERT_TRUE(ZlibDeflate(text, gzip, &deflated));
+            output_buf.clear();
+            output_buf.append(deflated);
+            if (gzip) {
+                ASSERT_TRUE(brpc::policy::GzipDecompress(output_buf, &check_buf));
+            } else {
+                ASSERT_TRUE(brpc::policy::ZlibDecompress(output_buf, &check_buf));
+            }
+            ASSERT_EQ(text, check_buf.to_string());
+        }
+
+        // Messages larger than buffers used for serializing.
+        snappy_message::SnappyMessageProto old_msg;
+        butil::IOBuf text_buf;
+        old_msg.set_text(MakeFragmentedText(&text_buf, 100000));
+        old_msg.add_numbers(45);
+        butil::IOBuf buf;
+        if (gzip) {
+            ASSERT_TRUE(brpc::policy::GzipCompress(old_msg, &buf));
+        } else {
+            ASSERT_TRUE(brpc::policy::ZlibCompress(old_msg, &buf));
+        }
+        std::string serialized;
+        ASSERT_TRUE(ZlibInflate(buf.to_string(), gzip, &serialized));
+        snappy_message::SnappyMessageProto new_msg;
+        ASSERT_TRUE(new_msg.ParseFromString(serialized));
+        ASSERT_EQ(old_msg.text(), new_msg.text());
+        ASSERT_EQ(45, new_msg.numbers(0));
+
+        std::string deflated;
+        ASSERT_TRUE(ZlibDeflate(old_msg.SerializeAsString(), gzip, &deflated));
+        buf.clear();
+        buf.append(deflated);
+        new_msg.Clear();
+        if (gzip) {
+            ASSERT_TRUE(brpc::policy::GzipDecompress(buf, &new_msg));
+        } else {
+            ASSERT_TRUE(brpc::policy::ZlibDecompress(buf, &new_msg));
+        }
+        ASSERT_EQ(old_msg.text(), new_msg.text());
+    }
+}
+
+#if BRPC_WITH_ZSTD
+TEST_F(test_compress_method, zstd_iobuf) {
+    const size_t lens[] = { 0, 17, 8192, 300000 };
+    for (size_t i = 0; i < ARRAY_SIZE(lens); ++i) {
+        butil::IOBuf buf, output_buf, check_buf;
+        const std::string text = MakeFragmentedText(&buf, lens[i]);
+        ASSERT_TRUE(brpc::policy::ZstdCompress(buf, &output_buf));
+        ASSERT_LT(output_buf.size(), text.size() / 2 + 32);
+        ASSERT_TRUE(brpc::policy::ZstdDecompress(output_buf, &check_buf));
+        ASSERT_EQ(text, check_buf.to_string());
+        // Truncated frames are errors.
+        if (!text.empty()) {
+            butil::IOBuf truncated;
+            output_buf.cutn(&truncated, output_buf.size() - 1);
+            check_buf.clear();
+            ASSERT_FALSE(brpc::policy::ZstdDecompress(truncated, &check_buf));
+        }
+    }
+}
+
+TEST_F(test_compress_method, zstd_dictionary) {
+    // Train a dictionary from samples alike the messages.
+    std::string samples;
+    std::vector<size_t> sample_sizes;
+    for (int i = 0; i < 2000; ++i) {
+        snappy_message::SnappyMessageProto msg;
+        char text[128];
+        snprintf(text, sizeof(text), "user=%d&region=cn-north-%d&"
+                 "status=active&plan=enterprise&seq=%d", rand(), i % 7, i);
+        msg.set_text(text);
+        msg.add_numbers(i);
+        const std::string s = msg.SerializeAsString();
+        samples.append(s);
+        sample_sizes.push_back(s.size());
+    }
+    std::string dict(4096, '\0');
+    const size_t dict_size = ZDICT_trainFromBuffer(
+        &dict[0], dict.size(), samples.data(), sample_sizes.data(),
+        sample_sizes.size());
+    ASSERT_FALSE(ZDICT_isError(dict_size)) << ZDICT_getErrorName(dict_size);
+    dict.resize(dict_size);
+
+    snappy_message::SnappyMessageProto msg;
+    msg.set_text("user=12345&region=cn-north-3&status=active&"
+                 "plan=enterprise&seq=99999");
+    msg.add_numbers(99999);
+    butil::IOBuf plain;
+    ASSERT_TRUE(brpc::policy::ZstdCompress(msg, &plain));
+
+    ASSERT_EQ(-1, brpc::policy::RegisterZstdDictionary("x", "not a dict"));
+    ASSERT_EQ(0, brpc::policy::RegisterZstdDictionary(
+                  msg.GetDescriptor()->full_name(), dict));
+    ASSERT_EQ(-1, brpc::policy::RegisterZstdDictionary(
+                  msg.GetDescriptor()->full_name(), dict));
+    butil::IOBuf with_dict;
+    ASSERT_TRUE(brpc::policy::ZstdCompress(msg, &with_dict));
+    ASSERT_LT(with_dict.size(), plain.size());
+    snappy_message::SnappyMessageProto new_msg;
+    ASSERT_TRUE(brpc::policy::ZstdDecompress(with_dict, &new_msg));
+    ASSERT_EQ(msg.text(), new_msg.text());
+    // Frames compressed without dictionary are still decodable.
+    new_msg.Clear();
+    ASSERT_TRUE(brpc::policy::ZstdDecompress(plain, &new_msg));
+    ASSERT_EQ(msg.text(), new_msg.text());
+}
+#endif  // BRPC_WITH_ZSTD
+
+#if BRPC_WITH_LZ4
+TEST_F(test_compress_method, lz4_iobuf) {
+    const size_t lens[] = { 0, 17, 8192, 300000 };
+    for (size_t i = 0; i < ARRAY_SIZE(lens); ++i) {
+        butil::IOBuf buf, output_buf, check_buf;
+        const std::string text = MakeFragmentedText(&buf, lens[i]);
+        ASSERT_TRUE(brpc::policy::Lz4Compress(buf, &output_buf));
+        ASSERT_TRUE(brpc::policy::Lz4Decompress(output_buf, &check_buf));
+        ASSERT_EQ(text, check_buf.to_string());
+        if (!text.empty()) {
+            butil::IOBuf truncated;
+            output_buf.cutn(&truncated, output_buf.size() - 1);
+            check_buf.clear();
+            ASSERT_FALSE(brpc::policy::Lz4Decompress(truncated, &check_buf));
+        }
+    }
+    snappy_message::SnappyMessageProto old_msg;
+    old_msg.set_text("Hello World!");
+    old_msg.add_numbers(45);
+    butil::IOBuf buf;
+    ASSERT_TRUE(brpc::policy::Lz4Compress(old_msg, &buf));
+    snappy_message::SnappyMessageProto new_msg;
+    ASSERT_TRUE(brpc::policy::Lz4Decompress(buf, &new_msg));
+    ASSERT_EQ(old_msg.text(), new_msg.text());
+    ASSERT_EQ(45, new_msg.numbers(0));
+}
+#endif  // BRPC_WITH_LZ4
@@ -24,6 +24,7 @@
 #include "brpc/socket.h"
 #include "brpc/socket_map.h"
 #include "brpc/reloadable_flags.h"
+#include "bvar/variable.h"
 
 namespace brpc {
 DECLARE_int32(health_check_interval);
@@ -85,6 +86,30 @@ TEST_F(SocketMapTest, disable_health_check) {
     brpc::FLAGS_health_check_interval = old_interval;
 }
 
+TEST_F(SocketMapTest, many_endpoints) {
+    const int N = 200;
+    std::vector<brpc::SocketMapKey> keys;
+    std::vector<brpc::SocketId> ids(N);
+    for (int i = 0; i < N; ++i) {
+        butil::EndPoint pt;
+        ASSERT_EQ(0, butil::str2endpoint("127.0.0.1", 20000 + i, &pt));
+        keys.push_back(brpc::SocketMapKey(pt));
+        ASSERT_EQ(0, brpc::SocketMapInsert(keys.back(), &ids[i]));
+    }
+    std::vector<brpc::SocketId> all;
+    brpc::SocketMapList(&all);
+    ASSERT_LE((size_t)N, all.size());
+    for (int i = 0; i < N; ++i) {
+        brpc::SocketId id;
+        ASSERT_EQ(0, brpc::SocketMapFind(keys[i], &id));
+        ASSERT_EQ(ids[i], id);
+        brpc::SocketMapRemove(keys[i]);
+        ASSERT_EQ(-1, brpc::SocketMapFind(keys[i], &id));
+    }
+    ASSERT_FALSE(bvar::Variable::describe_exposed(
+                     "rpc_socketmap_lock_contention_count").empty());
+}
+
 TEST_F(SocketMapTest, idle_timeout) {
     const int TIMEOUT = 1;
     const int NTHREAD = 10;
@@ -41,6 +41,7 @@
 #include "brpc/server.h"
 #include "brpc/channel.h"
 #include "brpc/controller.h"
+#include "brpc/details/health_check.h"
 #include "health_check.pb.h"
 #if defined(OS_MACOSX)
 #include <sys/event.h>
@@ -55,11 +56,17 @@ extern TaskControl* g_task_control;
 
 namespace brpc {
 DECLARE_int32(health_check_interval);
+DECLARE_double(health_check_jitter_ratio);
+DECLARE_int32(health_check_max_interval_s);
 DECLARE_bool(socket_keepalive);
 DECLARE_int32(socket_keepalive_idle_s);
 DECLARE_int32(socket_keepalive_interval_s);
 DECLARE_int32(socket_keepalive_count);
 DECLARE_int32(socket_tcp_user_timeout_ms);
+DECLARE_int64(socket_zerocopy_threshold);
+DECLARE_int32(socket_notsent_lowat);
+DECLARE_int32(socket_coalesce_write_threshold);
+extern SocketVarsCollector* g_vars;
 }
 
 void EchoProcessHuluRequest(brpc::InputMessageBase* msg_base);
@@ -145,6 +152,41 @@ TEST_F(SocketTest, not_recycle_until_zero_nref) {
     ASSERT_EQ(-1, brpc::Socket::Address(id, &ptr));
 }
 
+void* set_failed_thread(void* arg) {
+    brpc::Socket::SetFailed(*(brpc::SocketId*)arg);
+    return NULL;
+}
+
+TEST_F(SocketTest, not_recycle_until_borrow_ends) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    brpc::SocketId id = 8888;
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    options.user = new CheckRecycle;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    pthread_t th;
+    {
+        brpc::SocketBorrowedPtr s;
+        ASSERT_EQ(0, brpc::Socket::Borrow(id, &s));
+        global_sock = s.get();
+        ASSERT_EQ(fds[1], s->fd());
+        ASSERT_EQ(id, s->id());
+        // Borrowing does not add reference.
+        ASSERT_EQ(1, s->nref());
+        ASSERT_EQ(0, pthread_create(&th, NULL, set_failed_thread, &id));
+        usleep(50000);
+        // Releasing the last reference waits for the borrow.
+        ASSERT_EQ(s.get(), global_sock);
+        brpc::SocketBorrowedPtr s2;
+        ASSERT_EQ(-1, brpc::Socket::Borrow(id, &s2));
+        ASSERT_FALSE(s2);
+    }
+    pthread_join(th, NULL);
+    ASSERT_EQ((brpc::Socket*)NULL, global_sock);
+    close(fds[0]);
+}
+
 butil::atomic<int> winner_count(0);
 const int AUTH_ERR = -9;
 
@@ -809,6 +851,105 @@ TEST_F(SocketTest, health_check) {
     ASSERT_EQ(-1, brpc::Socket::Address(id, &ptr));
 }
 
+TEST_F(SocketTest, health_check_jitter) {
+    const double old_ratio = brpc::FLAGS_health_check_jitter_ratio;
+    const int64_t delay_us = 1000000;
+    brpc::FLAGS_health_check_jitter_ratio = 0;
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(delay_us, brpc::HealthCheckJitterDelay(delay_us));
+    }
+    brpc::FLAGS_health_check_jitter_ratio = 0.1;
+    int64_t min_delay = delay_us;
+    int64_t max_delay = delay_us;
+    for (int i = 0; i < 10000; ++i) {
+        const int64_t d = brpc::HealthCheckJitterDelay(delay_us);
+        ASSERT_GE(d, delay_us * 9 / 10);
+        ASSERT_LE(d, delay_us * 11 / 10);
+        min_delay = std::min(min_delay, d);
+        max_delay = std::max(max_delay, d);
+    }
+    // Delays are spread over the range rather than being constant.
+    ASSERT_LT(min_delay, delay_us * 95 / 100);
+    ASSERT_GT(max_delay, delay_us * 105 / 100);
+    // Ratio is capped at 1, the delay is never negative.
+    brpc::FLAGS_health_check_jitter_ratio = 5;
+    for (int i = 0; i < 10000; ++i) {
+        const int64_t d = brpc::HealthCheckJitterDelay(delay_us);
+        ASSERT_GE(d, 0);
+        ASSERT_LE(d, 2 * delay_us);
+    }
+    brpc::FLAGS_health_check_jitter_ratio = old_ratio;
+}
+
+TEST_F(SocketTest, health_check_backoff) {
+    const double old_ratio = brpc::FLAGS_health_check_jitter_ratio;
+    const int old_max_interval = brpc::FLAGS_health_check_max_interval_s;
+    brpc::FLAGS_health_check_jitter_ratio = 0;
+
+    // No backoff by default.
+    brpc::FLAGS_health_check_max_interval_s = 0;
+    for (int hc_count = 1; hc_count < 10; ++hc_count) {
+        ASSERT_EQ(3000000L, brpc::NextHealthCheckDelayUs(3, hc_count));
+    }
+
+    brpc::FLAGS_health_check_max_interval_s = 20;
+    const int64_t expected_s[] = { 3, 6, 12, 20, 20, 20 };
+    for (size_t i = 0; i < arraysize(expected_s); ++i) {
+        ASSERT_EQ(expected_s[i] * 1000000L,
+                  brpc::NextHealthCheckDelayUs(3, i + 1)) << "hc_count=" << i + 1;
+    }
+    // Not overflow after many failures.
+    ASSERT_EQ(20000000L, brpc::NextHealthCheckDelayUs(3, 100000));
+    // A max interval not larger than the interval disables backoff.
+    brpc::FLAGS_health_check_max_interval_s = 3;
+    ASSERT_EQ(3000000L, brpc::NextHealthCheckDelayUs(3, 5));
+
+    // Backoff is jittered as well.
+    brpc::FLAGS_health_check_jitter_ratio = 0.1;
+    brpc::FLAGS_health_check_max_interval_s = 20;
+    for (int i = 0; i < 1000; ++i) {
+        const int64_t d = brpc::NextHealthCheckDelayUs(3, 3);
+        ASSERT_GE(d, 12000000L * 9 / 10);
+        ASSERT_LE(d, 12000000L * 11 / 10);
+    }
+    brpc::FLAGS_health_check_jitter_ratio = old_ratio;
+    brpc::FLAGS_health_check_max_interval_s = old_max_interval;
+}
+
+TEST_F(SocketTest, health_check_share_probes) {
+    butil::EndPoint pt;
+    ASSERT_EQ(0, butil::str2endpoint("127.0.0.1:7879", &pt));
+    butil::EndPoint other_pt;
+    ASSERT_EQ(0, butil::str2endpoint("127.0.0.1:7880", &other_pt));
+    const brpc::SocketId id1 = 1001;
+    const brpc::SocketId id2 = 1002;
+    const int64_t interval_us = 1000000;
+
+    ASSERT_FALSE(brpc::OtherSocketFailedToProbe(pt, id1, interval_us));
+    ASSERT_FALSE(brpc::OtherSocketFailedToProbe(pt, id2, interval_us));
+
+    brpc::UpdateProbeBoard(pt, id1, false);
+    // A socket does not skip because of its own failure.
+    ASSERT_FALSE(brpc::OtherSocketFailedToProbe(pt, id1, interval_us));
+    // But other sockets to the endpoint do.
+    ASSERT_TRUE(brpc::OtherSocketFailedToProbe(pt, id2, interval_us));
+    // Sockets to other endpoints are not affected.
+    ASSERT_FALSE(brpc::OtherSocketFailedToProbe(other_pt, id2, interval_us));
+    // The failure expires after the interval.
+    bthread_usleep(20000);
+    ASSERT_FALSE(brpc::OtherSocketFailedToProbe(pt, id2, 10000));
+
+    // The latest failure replaces the previous one.
+    brpc::UpdateProbeBoard(pt, id2, false);
+    ASSERT_TRUE(brpc::OtherSocketFailedToProbe(pt, id1, interval_us));
+    ASSERT_FALSE(brpc::OtherSocketFailedToProbe(pt, id2, interval_us));
+
+    // Success clears the failure.
+    brpc::UpdateProbeBoard(pt, id1, true);
+    ASSERT_FALSE(brpc::OtherSocketFailedToProbe(pt, id1, interval_us));
+    ASSERT_FALSE(brpc::OtherSocketFailedToProbe(pt, id2, interval_us));
+}
+
 void* Writer(void* void_arg) {
     WriterArg* arg = static_cast<WriterArg*>(void_arg);
     brpc::SocketUniquePtr sock;
@@ -1493,6 +1634,55 @@ TEST_F(SocketTest, tcp_user_timeout) {
     ASSERT_EQ(-1, fcntl(listening_fd, F_GETFD));
     ASSERT_EQ(EBADF, errno);
 }
+
+#if defined(TCP_NOTSENT_LOWAT)
+TEST_F(SocketTest, notsent_lowat) {
+    int listening_fd = -1;
+    butil::EndPoint point(butil::IP_ANY, 7978);
+    for (int i = 0; i < 100; ++i) {
+        point.port += i;
+        listening_fd = tcp_listen(point);
+        if (listening_fd >= 0) {
+            break;
+        }
+    }
+    ASSERT_GT(listening_fd, 0) << berror();
+    butil::fd_guard listening_guard(listening_fd);
+
+    const int32_t saved_lowat = brpc::FLAGS_socket_notsent_lowat;
+    brpc::FLAGS_socket_notsent_lowat = 16384;
+    brpc::SocketOptions options;
+    options.remote_side = point;
+    options.connect_on_create = true;
+    brpc::SocketId id = brpc::INVALID_SOCKET_ID;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    brpc::FLAGS_socket_notsent_lowat = saved_lowat;
+    brpc::SocketUniquePtr ptr;
+    ASSERT_EQ(0, brpc::Socket::Address(id, &ptr)) << "id=" << id;
+    int lowat = 0;
+    socklen_t len = sizeof(lowat);
+    ASSERT_EQ(0, getsockopt(ptr->fd(), IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                            &lowat, &len));
+    ASSERT_EQ(16384, lowat);
+
+    // Writes beyond the low watermark are paced by EPOLLOUT.
+    butil::fd_guard peer(accept(listening_fd, NULL, NULL));
+    ASSERT_GE(peer, 0) << berror();
+    const size_t total = 4 * 1024 * 1024;
+    butil::IOBuf src;
+    src.append(std::string(total, 'a'));
+    ASSERT_EQ(0, ptr->Write(&src));
+    size_t nread = 0;
+    char buf[65536];
+    while (nread < total) {
+        const ssize_t nr = read(peer, buf, sizeof(buf));
+        ASSERT_GT(nr, 0) << berror();
+        nread += nr;
+    }
+    ASSERT_EQ(total, nread);
+    ASSERT_EQ(0, ptr->SetFailed());
+}
+#endif // TCP_NOTSENT_LOWAT
 #endif
 
 int HandleSocketSuccessWrite(bthread_id_t id, void* data, int error_code,
@@ -1708,3 +1898,161 @@ TEST_F(SocketTest, packed_ptr) {
     ASSERT_EQ(nullptr, ptr.get());
     ASSERT_EQ(0, ptr.extra());
 }
+
+TEST_F(SocketTest, zerocopy_write) {
+    butil::EndPoint point(butil::IP_ANY, 7979);
+    int listening_fd = -1;
+    for (int i = 0; i < 100; ++i, ++point.port) {
+        listening_fd = tcp_listen(point);
+        if (listening_fd >= 0) {
+            break;
+        }
+    }
+    ASSERT_GT(listening_fd, 0) << berror();
+    butil::fd_guard listen_guard(listening_fd);
+
+    const int64_t old_threshold = brpc::FLAGS_socket_zerocopy_threshold;
+    brpc::FLAGS_socket_zerocopy_threshold = 64 * 1024;
+    const int64_t old_nzerocopy = brpc::g_vars->nzerocopy.get_value();
+
+    brpc::SocketOptions options;
+    ASSERT_EQ(0, butil::str2endpoint("127.0.0.1", point.port, &options.remote_side));
+    brpc::SocketId id;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    brpc::SocketUniquePtr s;
+    ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+
+    const size_t N = 4 * 1024 * 1024;
+    std::string payload(N, 0);
+    for (size_t i = 0; i < N; ++i) {
+        payload[i] = (char)(i * 7);
+    }
+    butil::IOBuf src;
+    src.append(payload);
+    ASSERT_EQ(0, s->Write(&src));
+
+    butil::fd_guard peer(accept(listening_fd, NULL, NULL));
+    ASSERT_GE(peer, 0);
+    std::string received;
+    char buf[65536];
+    while (received.size() < N) {
+        const ssize_t nr = read(peer, buf, sizeof(buf));
+        ASSERT_GT(nr, 0) << berror();
+        received.append(buf, nr);
+    }
+    ASSERT_TRUE(received == payload);
+    ASSERT_LT(old_nzerocopy, brpc::g_vars->nzerocopy.get_value());
+
+    ASSERT_EQ(0, s->SetFailed());
+    brpc::FLAGS_socket_zerocopy_threshold = old_threshold;
+}
+
+TEST_F(SocketTest, coalesce_small_writes) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    butil::fd_guard peer(fds[0]);
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    brpc::SocketId id;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    brpc::SocketUniquePtr s;
+    ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+    const int64_t old_ncoalesced = brpc::g_vars->ncoalesced_writes.get_value();
+    const int saved_threshold = brpc::FLAGS_socket_coalesce_write_threshold;
+    brpc::FLAGS_socket_coalesce_write_threshold = 512;
+
+    // The large write fills the socket buffer, so that following small
+    // writes are queued and written in one batch.
+    std::string expected(1024 * 1024, 'x');
+    butil::IOBuf src;
+    src.append(expected);
+    ASSERT_EQ(0, s->Write(&src));
+    bthread_id_t ids[100];
+    for (int i = 0; i < 100; ++i) {
+        char buf[32];
+        const int len = snprintf(buf, sizeof(buf), "msg%d;", i);
+        expected.append(buf, len);
+        src.append(buf, len);
+        if (i % 10 == 0) {
+            // Large writes are not copied.
+            src.append(std::string(4096, 'y'));
+            expected.append(4096, 'y');
+        }
+        ASSERT_EQ(0, bthread_id_create(&ids[i], NULL, NULL));
+        brpc::Socket::WriteOptions wopt;
+        wopt.id_wait = ids[i];
+        wopt.notify_on_success = true;
+        ASSERT_EQ(0, s->Write(&src, &wopt));
+    }
+
+    std::string received;
+    char buf[65536];
+    while (received.size() < expected.size()) {
+        const ssize_t nr = read(peer, buf, sizeof(buf));
+        ASSERT_GT(nr, 0) << berror();
+        received.append(buf, nr);
+    }
+    ASSERT_TRUE(received == expected);
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(0, bthread_id_join(ids[i]));
+    }
+    ASSERT_LT(old_ncoalesced, brpc::g_vars->ncoalesced_writes.get_value());
+    brpc::FLAGS_socket_coalesce_write_threshold = saved_threshold;
+    ASSERT_EQ(0, s->SetFailed());
+}
+
+TEST_F(SocketTest, call_stat) {
+    brpc::SocketOptions options;
+    brpc::SocketId id;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    brpc::SocketUniquePtr s;
+    ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+
+    brpc::SocketCallStat stat;
+    s->GetCallStat(&stat);
+    ASSERT_EQ(0, stat.ninflight);
+    ASSERT_EQ(-1, stat.latency_percentile_us(0.99));
+
+    for (int i = 0; i < 100; ++i) {
+        s->OnCallBegin();
+    }
+    s->GetCallStat(&stat);
+    ASSERT_EQ(100, stat.ninflight);
+    for (int i = 0; i < 98; ++i) {
+        s->OnCallEnd(800);
+    }
+    s->OnCallEnd(30000);
+    // Ended without response.
+    s->OnCallEnd(-1);
+    s->GetCallStat(&stat);
+    ASSERT_EQ(0, stat.ninflight);
+    ASSERT_EQ(98UL, stat.latency_buckets[0]);
+    ASSERT_EQ(1UL, stat.latency_buckets[3]);
+    ASSERT_EQ(1000, stat.latency_percentile_us(0.5));
+    ASSERT_EQ(50000, stat.latency_percentile_us(0.999));
+    // 800 + (30000 - 800) / 8
+    ASSERT_EQ(4450, stat.ewma_latency_us);
+    ASSERT_EQ(0, s->SetFailed());
+}
+
+TEST_F(SocketTest, hot_fields_in_separate_cachelines) {
+    brpc::SocketId id;
+    brpc::SocketOptions options;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    brpc::SocketUniquePtr s;
+    ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+    const uintptr_t read_side = (uintptr_t)&s->_nevent;
+    const uintptr_t write_side = (uintptr_t)&s->_write_head;
+    const uintptr_t counters = (uintptr_t)&s->_ninprocess;
+    ASSERT_EQ(0UL, (uintptr_t)s.get() % BAIDU_CACHELINE_SIZE);
+    ASSERT_EQ(0UL, read_side % BAIDU_CACHELINE_SIZE);
+    ASSERT_EQ(0UL, write_side % BAIDU_CACHELINE_SIZE);
+    ASSERT_EQ(0UL, counters % BAIDU_CACHELINE_SIZE);
+    ASSERT_LT((uintptr_t)&s->_read_buf, write_side);
+    ASSERT_LT((uintptr_t)&s->_is_write_shutdown, counters);
+    // Versioned reference modified by every Address() is not on the
+    // hot cachelines.
+    ASSERT_LT((uintptr_t)s.get() + sizeof(brpc::VersionedRefWithId<brpc::Socket>),
+              read_side);
+    ASSERT_EQ(0, s->SetFailed());
+}
@@ -0,0 +1,180 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/time.h"
+#include "brpc/span.h"
+#include "brpc/span_exporter.h"
+#include "brpc/opentelemetry_trace.pb.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace brpc {
+DECLARE_int32(rpcz_adaptive_sampling_per_method);
+}
+
+class SpanExporterTest : public ::testing::Test {};
+
+TEST_F(SpanExporterTest, traceparent) {
+    brpc::TraceParent tp;
+    ASSERT_EQ(0, brpc::ParseTraceParent(
+                  "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01",
+                  &tp));
+    ASSERT_EQ(0x4bf92f3577b34da6ULL, tp.trace_id_high);
+    ASSERT_EQ(0xa3ce929d0e0e4736ULL, tp.trace_id);
+    ASSERT_EQ(0x00f067aa0ba902b7ULL, tp.parent_span_id);
+    ASSERT_TRUE(tp.sampled);
+    ASSERT_EQ("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01",
+              brpc::FormatTraceParent(tp.trace_id_high, tp.trace_id,
+                                      tp.parent_span_id, tp.sampled));
+    ASSERT_EQ("00-00000000000000000000000000000001-0000000000000002-00",
+              brpc::FormatTraceParent(0, 1, 2, false));
+
+    // Later versions may have more fields.
+    ASSERT_EQ(0, brpc::ParseTraceParent(
+                  "01-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-00-xx",
+                  &tp));
+    ASSERT_FALSE(tp.sampled);
+    // Version 00 has no more fields.
+    ASSERT_EQ(-1, brpc::ParseTraceParent(
+                  "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01-xx",
+                  &tp));
+    // Uppercase.
+    ASSERT_EQ(-1, brpc::ParseTraceParent(
+                  "00-4BF92F3577B34DA6A3CE929D0E0E4736-00f067aa0ba902b7-01",
+                  &tp));
+    // All-zero ids.
+    ASSERT_EQ(-1, brpc::ParseTraceParent(
+                  "00-00000000000000000000000000000000-00f067aa0ba902b7-01",
+                  &tp));
+    ASSERT_EQ(-1, brpc::ParseTraceParent(
+                  "00-4bf92f3577b34da6a3ce929d0e0e4736-0000000000000000-01",
+                  &tp));
+    ASSERT_EQ(-1, brpc::ParseTraceParent(
+                  "ff-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01",
+                  &tp));
+    ASSERT_EQ(-1, brpc::ParseTraceParent("00-4bf92f35", &tp));
+}
+
+TEST_F(SpanExporterTest, rpcz_span_to_otlp) {
+    brpc::RpczSpan span;
+    span.set_trace_id(0x0102030405060708ULL);
+    span.set_trace_id_high(1);
+    span.set_span_id(2);
+    span.set_parent_span_id(3);
+    span.set_type(brpc::SPAN_TYPE_SERVER);
+    span.set_protocol(brpc::PROTOCOL_HTTP);
+    span.set_full_method_name("example.EchoService.Echo");
+    span.set_received_real_us(1000);
+    span.set_start_parse_real_us(1100);
+    span.set_start_callback_real_us(1200);
+    span.set_sent_real_us(1500);
+    span.set_error_code(1008);
+    span.set_info("\1" "1300 hello");
+
+    brpc::OtlpSpan out;
+    brpc::RpczSpan2Otlp(span, &out);
+    ASSERT_EQ(std::string("\0\0\0\0\0\0\0\1\1\2\3\4\5\6\7\10", 16),
+              out.trace_id());
+    ASSERT_EQ(std::string("\0\0\0\0\0\0\0\2", 8), out.span_id());
+    ASSERT_EQ(std::string("\0\0\0\0\0\0\0\3", 8), out.parent_span_id());
+    ASSERT_EQ("example.EchoService.Echo", out.name());
+    ASSERT_EQ(brpc::OTLP_SPAN_KIND_SERVER, out.kind());
+    ASSERT_EQ(1000000UL, out.start_time_unix_nano());
+    ASSERT_EQ(1500000UL, out.end_time_unix_nano());
+    ASSERT_EQ(brpc::OTLP_STATUS_CODE_ERROR, out.status().code());
+    ASSERT_EQ(1, out.events_size());
+    ASSERT_EQ(1300000UL, out.events(0).time_unix_nano());
+    ASSERT_EQ("hello", out.events(0).name());
+    bool found_service = false;
+    for (int i = 0; i < out.attributes_size(); ++i) {
+        if (out.attributes(i).key() == "rpc.service") {
+            ASSERT_EQ("example.EchoService",
+                      out.attributes(i).value().string_value());
+            found_service = true;
+        }
+    }
+    ASSERT_TRUE(found_service);
+}
+
+// Returns true if a root server span of `method' is kept.
+static bool KeepServerSpan(const char* method, int64_t latency_us,
+                           bool sampled, int error_code) {
+    brpc::Span* span = brpc::Span::CreateServerSpan(
+        method, 0, 0, 0, butil::gettimeofday_us());
+    span->set_received_us(0);
+    span->set_sent_us(latency_us);
+    span->set_sampled(sampled);
+    span->set_error_code(error_code);
+    const bool keep = brpc::AdaptivelySample(span);
+    span->destroy();
+    return keep;
+}
+
+TEST_F(SpanExporterTest, adaptive_sampling) {
+    const int saved_per_method = brpc::FLAGS_rpcz_adaptive_sampling_per_method;
+    brpc::FLAGS_rpcz_adaptive_sampling_per_method = 2;
+    // Spans kept by rate are counted per second, retry if the second
+    // changes in the middle.
+    for (int i = 0; i < 10; ++i) {
+        const int64_t start_s = butil::gettimeofday_s();
+        const bool kept1 = KeepServerSpan("test.A.Rate", 100, false, 0);
+        const bool kept2 = KeepServerSpan("test.A.Rate", 100, false, 0);
+        const bool kept3 = KeepServerSpan("test.A.Rate", 100, false, 0);
+        // Sampled or failed spans are kept regardless of the rate.
+        const bool kept_sampled = KeepServerSpan("test.A.Rate", 100, true, 0);
+        const bool kept_failed = KeepServerSpan("test.A.Rate", 100, false, 1);
+        // Other methods have their own rates.
+        const bool kept_other = KeepServerSpan("test.B.Rate", 100, false, 0);
+        if (butil::gettimeofday_s() != start_s) {
+            continue;
+        }
+        ASSERT_TRUE(kept1);
+        ASSERT_TRUE(kept2);
+        ASSERT_FALSE(kept3);
+        ASSERT_TRUE(kept_sampled);
+        ASSERT_TRUE(kept_failed);
+        ASSERT_TRUE(kept_other);
+        break;
+    }
+
+    // Make p99 of the method about 1ms, which is refreshed once per second.
+    for (int i = 0; i < 1000; ++i) {
+        KeepServerSpan("test.A.Slow", 1000, false, 0);
+    }
+    for (int i = 0; i < 30; ++i) {
+        usleep(100000);
+        KeepServerSpan("test.A.Slow", 1000, false, 0);
+    }
+    for (int i = 0; i < 10; ++i) {
+        const int64_t start_s = butil::gettimeofday_s();
+        // Use up the rate.
+        while (KeepServerSpan("test.A.Slow", 10, false, 0)) {}
+        const bool kept_slow = KeepServerSpan("test.A.Slow", 5000, false, 0);
+        const bool kept_fast = KeepServerSpan("test.A.Slow", 10, false, 0);
+        if (butil::gettimeofday_s() != start_s) {
+            continue;
+        }
+        ASSERT_TRUE(kept_slow);
+        ASSERT_FALSE(kept_fast);
+        break;
+    }
+    brpc::FLAGS_rpcz_adaptive_sampling_per_method = saved_per_method;
+}
@@ -0,0 +1,236 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include <gtest/gtest.h>
+#include "butil/files/scoped_temp_dir.h"
+#include "butil/string_printf.h"
+#include "brpc/details/span_ring.h"
+
+namespace {
+
+// Layout of the head of the file, see SpanRingMeta.
+const off_t END_OFFSET = 16;
+const off_t LAST_OFFSET = 24;
+const size_t META_SIZE = 64;
+const size_t CAPACITY = 4096;
+
+std::string MakeBrief(int i) {
+    return butil::string_printf("brief-%d", i);
+}
+
+std::string MakeSpan(int i) {
+    return butil::string_printf("span-%d-", i) + std::string(i % 50, 'x');
+}
+
+void AppendRecords(brpc::SpanRing* ring, int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+        ring->Append(i, i + 1000, i + 2000, MakeBrief(i), MakeSpan(i));
+    }
+}
+
+// Returns indexes of records from the newest to the oldest, checking that
+// their contents match the indexes.
+std::vector<int> ReadRecords(const brpc::SpanRing* ring) {
+    std::vector<int> result;
+    ring->Traverse([&](const brpc::SpanRing::Entry& e) {
+        const int i = (int)e.time_key;
+        EXPECT_EQ(i + 1000u, e.trace_id);
+        EXPECT_EQ(i + 2000u, e.span_id);
+        std::string brief;
+        std::string span;
+        EXPECT_TRUE(ring->Read(e, &brief, &span));
+        EXPECT_EQ(MakeBrief(i), brief);
+        EXPECT_EQ(MakeSpan(i), span);
+        result.push_back(i);
+        return true;
+    });
+    return result;
+}
+
+void ExpectConsecutive(const std::vector<int>& indexes, int newest) {
+    ASSERT_FALSE(indexes.empty());
+    for (size_t i = 0; i < indexes.size(); ++i) {
+        ASSERT_EQ(newest - (int)i, indexes[i]);
+    }
+}
+
+uint64_t ReadU64(const std::string& path, off_t offset) {
+    uint64_t v = 0;
+    const int fd = open(path.c_str(), O_RDONLY);
+    EXPECT_EQ((ssize_t)sizeof(v), pread(fd, &v, sizeof(v), offset));
+    close(fd);
+    return v;
+}
+
+void Overwrite(const std::string& path, off_t offset,
+               const void* data, size_t size) {
+    const int fd = open(path.c_str(), O_WRONLY);
+    EXPECT_EQ((ssize_t)size, pwrite(fd, data, size, offset));
+    close(fd);
+}
+
+class SpanRingTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_TRUE(_dir.CreateUniqueTempDir());
+        _path = _dir.path().Append("rpcz.ring").value();
+    }
+
+    butil::ScopedTempDir _dir;
+    std::string _path;
+};
+
+TEST_F(SpanRingTest, append_and_traverse) {
+    std::unique_ptr<brpc::SpanRing> ring(brpc::SpanRing::Open(CAPACITY, ""));
+    ASSERT_TRUE(ring);
+    ASSERT_TRUE(ReadRecords(ring.get()).empty());
+    AppendRecords(ring.get(), 0, 3);
+    const std::vector<int> indexes = ReadRecords(ring.get());
+    ASSERT_EQ(3u, indexes.size());
+    ExpectConsecutive(indexes, 2);
+}
+
+TEST_F(SpanRingTest, wraparound) {
+    std::unique_ptr<brpc::SpanRing> ring(brpc::SpanRing::Open(CAPACITY, ""));
+    ASSERT_TRUE(ring);
+    // Wrap around the ring many times.
+    AppendRecords(ring.get(), 0, 1000);
+    const std::vector<int> indexes = ReadRecords(ring.get());
+    ASSERT_GT(indexes.size(), 10u);
+    ASSERT_LT(indexes.size(), 100u);
+    ExpectConsecutive(indexes, 999);
+    // Records too large for the ring are dropped.
+    ring->Append(1000, 2000, 3000, "", std::string(CAPACITY / 2, 'y'));
+    ExpectConsecutive(ReadRecords(ring.get()), 999);
+}
+
+TEST_F(SpanRingTest, reopen) {
+    std::unique_ptr<brpc::SpanRing> ring(brpc::SpanRing::Open(CAPACITY, _path));
+    ASSERT_TRUE(ring);
+    AppendRecords(ring.get(), 0, 500);
+    const std::vector<int> before = ReadRecords(ring.get());
+    ring.reset();
+
+    ring.reset(brpc::SpanRing::Open(CAPACITY, _path));
+    ASSERT_TRUE(ring);
+    ASSERT_EQ(before, ReadRecords(ring.get()));
+    AppendRecords(ring.get(), 500, 510);
+    ExpectConsecutive(ReadRecords(ring.get()), 509);
+    ring.reset();
+
+    // Records are dropped when the capacity changes.
+    ring.reset(brpc::SpanRing::Open(CAPACITY * 2, _path));
+    ASSERT_TRUE(ring);
+    ASSERT_TRUE(ReadRecords(ring.get()).empty());
+}
+
+TEST_F(SpanRingTest, reopen_after_crash_in_append) {
+    std::unique_ptr<brpc::SpanRing> ring(brpc::SpanRing::Open(CAPACITY, _path));
+    ASSERT_TRUE(ring);
+    AppendRecords(ring.get(), 0, 500);
+    ring.reset();
+    // Crash while writing a record after the newest one: `end' is advanced
+    // and the oldest records are partially overwritten, but `last' still
+    // points to the newest complete record.
+    const uint64_t end = ReadU64(_path, END_OFFSET);
+    const size_t partial = 512;
+    const uint64_t new_end = end + partial;
+    Overwrite(_path, END_OFFSET, &new_end, sizeof(new_end));
+    const std::string garbage(partial, '\xff');
+    const uint64_t begin = end % CAPACITY;
+    const size_t n = std::min(partial, (size_t)(CAPACITY - begin));
+    Overwrite(_path, META_SIZE + begin, garbage.data(), n);
+    Overwrite(_path, META_SIZE, garbage.data(), partial - n);
+
+    ring.reset(brpc::SpanRing::Open(CAPACITY, _path));
+    ASSERT_TRUE(ring);
+    // Overwritten records are invisible, the others are intact.
+    ExpectConsecutive(ReadRecords(ring.get()), 499);
+    ASSERT_EQ(new_end, ReadU64(_path, END_OFFSET));
+    AppendRecords(ring.get(), 500, 600);
+    ExpectConsecutive(ReadRecords(ring.get()), 599);
+}
+
+TEST_F(SpanRingTest, corrupted_file) {
+    std::unique_ptr<brpc::SpanRing> ring(brpc::SpanRing::Open(CAPACITY, _path));
+    ASSERT_TRUE(ring);
+    AppendRecords(ring.get(), 0, 500);
+    ring.reset();
+    // Sizes of the newest record are corrupted.
+    const uint64_t last = ReadU64(_path, LAST_OFFSET);
+    const uint32_t huge_size = 0x7fffffff;
+    Overwrite(_path, META_SIZE + last % CAPACITY, &huge_size,
+              sizeof(huge_size));
+    ring.reset(brpc::SpanRing::Open(CAPACITY, _path));
+    ASSERT_TRUE(ring);
+    ASSERT_TRUE(ReadRecords(ring.get()).empty());
+    AppendRecords(ring.get(), 0, 10);
+    ExpectConsecutive(ReadRecords(ring.get()), 9);
+    ring.reset();
+
+    // `last' points out of the written range.
+    const uint64_t bad_last = ReadU64(_path, END_OFFSET) + 8;
+    Overwrite(_path, LAST_OFFSET, &bad_last, sizeof(bad_last));
+    ring.reset(brpc::SpanRing::Open(CAPACITY, _path));
+    ASSERT_TRUE(ring);
+    ASSERT_TRUE(ReadRecords(ring.get()).empty());
+}
+
+TEST_F(SpanRingTest, corrupted_record_in_the_middle) {
+    std::unique_ptr<brpc::SpanRing> ring(brpc::SpanRing::Open(CAPACITY, ""));
+    ASSERT_TRUE(ring);
+    AppendRecords(ring.get(), 0, 10);
+    int64_t corrupted_pos = -1;
+    ring->Traverse([&](const brpc::SpanRing::Entry& e) {
+        if (e.time_key == 5) {
+            corrupted_pos = e.pos;
+        }
+        return true;
+    });
+    ASSERT_GE(corrupted_pos, 0);
+    const uint32_t huge_size = 0x7fffffff;
+    memcpy(ring->_data + corrupted_pos % CAPACITY + sizeof(uint32_t),
+           &huge_size, sizeof(huge_size));
+    // Traversing stops at the corrupted record.
+    ExpectConsecutive(ReadRecords(ring.get()), 9);
+    ASSERT_EQ(4u, ReadRecords(ring.get()).size());
+
+    brpc::SpanRing::Entry e;
+    e.pos = 0;
+    e.brief_size = 0;
+    e.span_size = CAPACITY;
+    std::string span;
+    ASSERT_FALSE(ring->Read(e, NULL, &span));
+}
+
+TEST_F(SpanRingTest, truncated_file) {
+    std::unique_ptr<brpc::SpanRing> ring(brpc::SpanRing::Open(CAPACITY, _path));
+    ASSERT_TRUE(ring);
+    AppendRecords(ring.get(), 0, 500);
+    ring.reset();
+    ASSERT_EQ(0, truncate(_path.c_str(), META_SIZE + CAPACITY / 2));
+    ring.reset(brpc::SpanRing::Open(CAPACITY, _path));
+    ASSERT_TRUE(ring);
+    ASSERT_TRUE(ReadRecords(ring.get()).empty());
+    AppendRecords(ring.get(), 0, 500);
+    ExpectConsecutive(ReadRecords(ring.get()), 499);
+}
+
+} // namespace
@@ -35,10 +35,14 @@
 #include "brpc/channel.h"
 #include "brpc/socket_map.h"
 #include "brpc/controller.h"
+#include "bvar/variable.h"
 #include "echo.pb.h"
 
 namespace brpc {
 
+DECLARE_bool(ssl_ktls);
+DECLARE_int32(ssl_handshake_bthread_tag);
+DECLARE_bool(ssl_async_handshake);
 void ExtractHostnames(X509* x, std::vector<std::string>* hostnames);
 } // namespace brpc
 
@@ -377,6 +381,122 @@ TEST_F(SSLTest, ssl_sni) {
     server.Join();
 }
 
+TEST_F(SSLTest, ktls) {
+    // kTLS is used only if both OpenSSL and kernel support it, RPC
+    // should work either way.
+    brpc::FLAGS_ssl_ktls = true;
+    const int port = 8613;
+    brpc::Server server;
+    brpc::ServerOptions options;
+    brpc::CertInfo cert;
+    cert.certificate = "cert1.crt";
+    cert.private_key = "cert1.key";
+    options.mutable_ssl_options()->default_cert = cert;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(
+        &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(port, &options));
+
+    brpc::Channel channel;
+    brpc::ChannelOptions coptions;
+    coptions.mutable_ssl_options()->sni_name = "localhost";
+    ASSERT_EQ(0, channel.Init("127.0.0.1", port, &coptions));
+    test::EchoService_Stub stub(&channel);
+    for (int i = 0; i < 100; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+        cntl.request_attachment().resize(i * 1024, 'a');
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res.message());
+    }
+    brpc::FLAGS_ssl_ktls = false;
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+static int64_t GetExposedCount(const std::string& name) {
+    return strtoll(bvar::Variable::describe_exposed(name).c_str(), NULL, 10);
+}
+
+TEST_F(SSLTest, session_resumption) {
+    const int port = 8613;
+    brpc::Server server;
+    brpc::ServerOptions options;
+    brpc::CertInfo cert;
+    cert.certificate = "cert1.crt";
+    cert.private_key = "cert1.key";
+    options.mutable_ssl_options()->default_cert = cert;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(
+        &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(port, &options));
+
+    // Every RPC is over a new connection, all of which except the first
+    // one resume the session.
+    brpc::Channel channel;
+    brpc::ChannelOptions coptions;
+    coptions.connection_type = brpc::CONNECTION_TYPE_SHORT;
+    coptions.mutable_ssl_options()->sni_name = "localhost";
+    ASSERT_EQ(0, channel.Init("127.0.0.1", port, &coptions));
+    test::EchoService_Stub stub(&channel);
+    const int N = 5;
+    for (int i = 0; i < N; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    }
+    ASSERT_LE(1, GetExposedCount("rpc_ssl_client_session_cache_size"));
+    ASSERT_LE(N - 1, GetExposedCount("rpc_ssl_client_resumed_handshake_count"));
+    ASSERT_LE(N - 1, GetExposedCount("rpc_ssl_server_resumed_handshake_count"));
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+TEST_F(SSLTest, offloaded_handshake) {
+    // There's only one bthread tag in this test, handshakes run in the
+    // calling bthreads as usual. Async mode of OpenSSL does not change
+    // anything without an async engine.
+    brpc::FLAGS_ssl_handshake_bthread_tag = BTHREAD_TAG_DEFAULT;
+    brpc::FLAGS_ssl_async_handshake = true;
+    const int port = 8613;
+    brpc::Server server;
+    brpc::ServerOptions options;
+    brpc::CertInfo cert;
+    cert.certificate = "cert1.crt";
+    cert.private_key = "cert1.key";
+    options.mutable_ssl_options()->default_cert = cert;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(
+        &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(port, &options));
+
+    brpc::Channel channel;
+    brpc::ChannelOptions coptions;
+    coptions.connection_type = brpc::CONNECTION_TYPE_SHORT;
+    coptions.mutable_ssl_options()->sni_name = "localhost";
+    ASSERT_EQ(0, channel.Init("127.0.0.1", port, &coptions));
+    test::EchoService_Stub stub(&channel);
+    for (int i = 0; i < 5; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res.message());
+    }
+    brpc::FLAGS_ssl_handshake_bthread_tag = BTHREAD_TAG_INVALID;
+    brpc::FLAGS_ssl_async_handshake = false;
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
 TEST_F(SSLTest, ssl_reload) {
     const int port = 8613;
     brpc::Server server;
@@ -19,13 +19,19 @@
 
 // Date: 2015/10/22 16:28:44
 
+#include <map>
 #include <gtest/gtest.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include "butil/atomicops.h"
+#include "butil/synchronization/lock.h"
 #include "brpc/server.h"
 
 #include "brpc/controller.h"
 #include "brpc/channel.h"
 #include "brpc/socket.h"
 #include "brpc/stream_impl.h"
+#include "brpc/protobuf_stream.h"
 #include "brpc/policy/streaming_rpc_protocol.h"
 #include "echo.pb.h"
 
@@ -109,6 +115,7 @@ class OrderedInputHandler : public brpc::StreamInputHandler {
 public:
     explicit OrderedInputHandler(HandlerControl *cntl = NULL)
         : _expected_next_value(0)
+        , _nbatch(0)
         , _failed(false)
         , _stopped(false)
         , _idle_times(0)
@@ -123,6 +130,7 @@ public:
                 usleep(100);
             }
         }
+        ++_nbatch;
         for (size_t i = 0; i < size; ++i) {
             CHECK(messages[i]->length() == sizeof(int));
             int network = 0;
@@ -153,6 +161,7 @@ public:
     int idle_times() const { return _idle_times; }
 private:
     int _expected_next_value;
+    int _nbatch;
     bool _failed;
     bool _stopped;
     int _idle_times;
@@ -197,6 +206,223 @@ TEST_F(StreamingRpcTest, received_in_order) {
     ASSERT_EQ(N, handler._expected_next_value);
 }
 
+TEST_F(StreamingRpcTest, writev_received_in_order) {
+    OrderedInputHandler handler;
+    brpc::StreamOptions opt;
+    opt.handler = &handler;
+    opt.messages_in_batch = 100;
+    brpc::Server server;
+    MyServiceWithStream service(opt);
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(9007, NULL));
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1:9007", NULL));
+    brpc::Controller cntl;
+    brpc::StreamId request_stream;
+    brpc::StreamOptions request_stream_options;
+    request_stream_options.max_buf_size = 0;
+    ASSERT_EQ(0, StreamCreate(&request_stream, cntl, &request_stream_options));
+    brpc::ScopedStream stream_guard(request_stream);
+    test::EchoService_Stub stub(&channel);
+    stub.Echo(&cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText() << " request_stream=" << request_stream;
+    const int N = 10000;
+    const int M = 16;
+    butil::IOBuf bufs[M];
+    butil::IOBuf* msgs[M];
+    for (int i = 0; i < N;) {
+        if (i % (M + 1) == 0) {
+            // Interleaved with StreamWrite.
+            int network = htonl(i++);
+            butil::IOBuf out;
+            out.append(&network, sizeof(network));
+            ASSERT_EQ(0, brpc::StreamWrite(request_stream, out)) << "i=" << i;
+            continue;
+        }
+        int n = 0;
+        for (; n < M && i < N; ++n) {
+            int network = htonl(i++);
+            bufs[n].clear();
+            bufs[n].append(&network, sizeof(network));
+            msgs[n] = &bufs[n];
+        }
+        ASSERT_EQ(0, brpc::StreamWritev(request_stream, msgs, n)) << "i=" << i;
+        ASSERT_EQ(sizeof(int), bufs[0].size());
+    }
+    ASSERT_EQ(0, brpc::StreamClose(request_stream));
+    server.Stop(0);
+    server.Join();
+    while (!handler.stopped()) {
+        usleep(100);
+    }
+    ASSERT_FALSE(handler.failed());
+    ASSERT_EQ(0, handler.idle_times());
+    ASSERT_EQ(N, handler._expected_next_value);
+}
+
+TEST_F(StreamingRpcTest, max_batch_delay) {
+    OrderedInputHandler handler;
+    brpc::StreamOptions opt;
+    opt.handler = &handler;
+    opt.messages_in_batch = 100;
+    opt.max_batch_delay_us = 500000;
+    brpc::Server server;
+    MyServiceWithStream service(opt);
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(9007, NULL));
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1:9007", NULL));
+    brpc::Controller cntl;
+    brpc::StreamId request_stream;
+    ASSERT_EQ(0, StreamCreate(&request_stream, cntl, NULL));
+    brpc::ScopedStream stream_guard(request_stream);
+    test::EchoService_Stub stub(&channel);
+    stub.Echo(&cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText() << " request_stream=" << request_stream;
+    const int N = 10;
+    for (int i = 0; i < N; ++i) {
+        int network = htonl(i);
+        butil::IOBuf out;
+        out.append(&network, sizeof(network));
+        ASSERT_EQ(0, brpc::StreamWrite(request_stream, out)) << "i=" << i;
+        usleep(1000);
+    }
+    while (handler._expected_next_value != N) {
+        usleep(100);
+    }
+    // Held until the delay expired and passed to the handler together.
+    ASSERT_EQ(1, handler._nbatch);
+    ASSERT_EQ(0, brpc::StreamClose(request_stream));
+    server.Stop(0);
+    server.Join();
+    while (!handler.stopped()) {
+        usleep(100);
+    }
+    ASSERT_FALSE(handler.failed());
+}
+
+TEST_F(StreamingRpcTest, receiver_granted_window) {
+    HandlerControl hc;
+    hc.block = true;
+    OrderedInputHandler handler(&hc);
+    brpc::StreamOptions opt;
+    opt.handler = &handler;
+    opt.receive_buf_size = 4 * sizeof(int);
+    brpc::Server server;
+    MyServiceWithStream service(opt);
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(9007, NULL));
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1:9007", NULL));
+    brpc::Controller cntl;
+    brpc::StreamId request_stream;
+    brpc::StreamOptions request_stream_options;
+    // No limit from the sender itself.
+    request_stream_options.max_buf_size = 0;
+    ASSERT_EQ(0, StreamCreate(&request_stream, cntl, &request_stream_options));
+    brpc::ScopedStream stream_guard(request_stream);
+    test::EchoService_Stub stub(&channel);
+    stub.Echo(&cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText() << " request_stream=" << request_stream;
+    for (int i = 0; i < 4; ++i) {
+        int network = htonl(i);
+        butil::IOBuf out;
+        out.append(&network, sizeof(network));
+        ASSERT_EQ(0, brpc::StreamWrite(request_stream, out)) << "i=" << i;
+    }
+    int network = htonl(4);
+    butil::IOBuf out;
+    out.append(&network, sizeof(network));
+    ASSERT_EQ(EAGAIN, brpc::StreamWrite(request_stream, out));
+    hc.block = false;
+    ASSERT_EQ(0, brpc::StreamWait(request_stream, NULL));
+    ASSERT_EQ(0, brpc::StreamWrite(request_stream, out));
+    ASSERT_EQ(0, brpc::StreamClose(request_stream));
+    server.Stop(0);
+    server.Join();
+    while (!handler.stopped()) {
+        usleep(100);
+    }
+    ASSERT_FALSE(handler.failed());
+    ASSERT_EQ(5, handler._expected_next_value);
+}
+
+class PerStreamOrderedHandler : public brpc::StreamInputHandler {
+public:
+    PerStreamOrderedHandler() : _nclosed(0) {}
+
+    int on_received_messages(brpc::StreamId id,
+                             butil::IOBuf *const messages[],
+                             size_t size) override {
+        BAIDU_SCOPED_LOCK(_mutex);
+        int& next_value = _next_values[id];
+        for (size_t i = 0; i < size; ++i) {
+            int network = 0;
+            messages[i]->cutn(&network, sizeof(int));
+            EXPECT_EQ((int)ntohl(network), next_value++);
+        }
+        return 0;
+    }
+
+    void on_idle_timeout(brpc::StreamId) override {}
+
+    void on_closed(brpc::StreamId) override { _nclosed.fetch_add(1); }
+
+    butil::Mutex _mutex;
+    std::map<brpc::StreamId, int> _next_values;
+    butil::atomic<int> _nclosed;
+};
+
+TEST_F(StreamingRpcTest, write_in_turns) {
+    GFLAGS_NAMESPACE::SetCommandLineOption("stream_write_quantum", "64");
+    PerStreamOrderedHandler handler;
+    brpc::StreamOptions opt;
+    opt.handler = &handler;
+    brpc::Server server;
+    MyServiceWithStream service(opt);
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(9007, NULL));
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1:9007", NULL));
+    brpc::StreamId request_streams[2];
+    for (int k = 0; k < 2; ++k) {
+        brpc::Controller cntl;
+        brpc::StreamOptions request_stream_options;
+        request_stream_options.max_buf_size = 0;
+        request_stream_options.write_weight = k + 1;
+        ASSERT_EQ(0, StreamCreate(&request_streams[k], cntl,
+                                  &request_stream_options));
+        test::EchoService_Stub stub(&channel);
+        stub.Echo(&cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    }
+    const int N = 1000;
+    for (int i = 0; i < N; ++i) {
+        for (int k = 0; k < 2; ++k) {
+            int network = htonl(i);
+            butil::IOBuf out;
+            out.append(&network, sizeof(network));
+            ASSERT_EQ(0, brpc::StreamWrite(request_streams[k], out));
+        }
+    }
+    for (int k = 0; k < 2; ++k) {
+        ASSERT_EQ(0, brpc::StreamClose(request_streams[k]));
+    }
+    // CLOSE frames are behind all data frames of the streams.
+    while (handler._nclosed.load() != 2) {
+        usleep(100);
+    }
+    ASSERT_EQ(2UL, handler._next_values.size());
+    for (std::map<brpc::StreamId, int>::const_iterator
+             it = handler._next_values.begin();
+         it != handler._next_values.end(); ++it) {
+        ASSERT_EQ(N, it->second);
+    }
+    server.Stop(0);
+    server.Join();
+    GFLAGS_NAMESPACE::SetCommandLineOption("stream_write_quantum", "0");
+}
+
 void on_writable(brpc::StreamId, void* arg, int error_code) {
     std::pair<bool, int>* p = (std::pair<bool, int>*)arg;
     p->first = true;
@@ -628,3 +854,119 @@ TEST_F(StreamingRpcTest, segment_stream_data_automatically) {
     ASSERT_EQ(N, handler._expected_next_value);
     GFLAGS_NAMESPACE::SetCommandLineOption("stream_write_max_segment_size", "536870912");
 }
+
+class SaveStreamAfterAccept : public AfterAcceptStream {
+public:
+    SaveStreamAfterAccept() : stream(brpc::INVALID_STREAM_ID) {}
+    void action(brpc::StreamId s) override { stream = s; }
+    brpc::StreamId stream;
+};
+
+class EchoResponseHandler
+    : public brpc::ProtobufStreamHandler<test::EchoResponse> {
+public:
+    EchoResponseHandler() : nmsg(0), closed(false) {}
+    int OnMessage(brpc::StreamId, const test::EchoResponse& res) override {
+        EXPECT_EQ(std::to_string(nmsg.load()), res.message());
+        nmsg.fetch_add(1);
+        return 0;
+    }
+    void on_idle_timeout(brpc::StreamId) override {}
+    void on_closed(brpc::StreamId) override { closed = true; }
+
+    butil::atomic<int> nmsg;
+    butil::atomic<bool> closed;
+};
+
+TEST_F(StreamingRpcTest, protobuf_stream) {
+    const int N = 1000;
+    SaveStreamAfterAccept after_accept;
+    brpc::StreamOptions opt;
+    // Make the writer wait for the client frequently.
+    opt.max_buf_size = 1024;
+    brpc::Server server;
+    MyServiceWithStream service(opt, &after_accept);
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(9007, NULL));
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1:9007", NULL));
+    EchoResponseHandler handler;
+    brpc::StreamOptions request_stream_options;
+    request_stream_options.handler = &handler;
+    brpc::StreamId request_stream;
+    brpc::Controller cntl;
+    ASSERT_EQ(0, StreamCreate(&request_stream, cntl, &request_stream_options));
+    brpc::ScopedStream stream_guard(request_stream);
+    test::EchoService_Stub stub(&channel);
+    stub.Echo(&cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+
+    brpc::ProtobufStreamWriter writer(after_accept.stream);
+    for (int i = 0; i < N; ++i) {
+        test::EchoResponse res;
+        res.set_message(std::to_string(i));
+        ASSERT_EQ(0, writer.Write(res)) << "i=" << i;
+    }
+    ASSERT_EQ(0, brpc::StreamClose(after_accept.stream));
+    while (!handler.closed) {
+        usleep(100);
+    }
+    ASSERT_EQ(N, handler.nmsg.load());
+    server.Stop(0);
+    server.Join();
+}
+
+class EchoResponseReader
+    : public brpc::ProtobufProgressiveReader<test::EchoResponse> {
+public:
+    EchoResponseReader() : ended(false) {}
+    butil::Status OnMessage(const test::EchoResponse& res) override {
+        messages.push_back(res.message());
+        return butil::Status::OK();
+    }
+    void OnEnd(const butil::Status& st) override {
+        ended = true;
+        status = st;
+    }
+
+    std::vector<std::string> messages;
+    bool ended;
+    butil::Status status;
+};
+
+TEST_F(StreamingRpcTest, protobuf_progressive_reader) {
+    // Delimited messages as written by ProtobufStreamWriter into a
+    // ProgressiveAttachment.
+    std::string data;
+    {
+        google::protobuf::io::StringOutputStream output(&data);
+        google::protobuf::io::CodedOutputStream coded(&output);
+        for (int i = 0; i < 100; ++i) {
+            test::EchoResponse res;
+            res.set_message(std::string(i * 3, 'a' + i % 26));
+            coded.WriteVarint32(res.ByteSizeLong());
+            res.SerializeWithCachedSizes(&coded);
+        }
+    }
+    // Feed in pieces of different sizes.
+    for (size_t piece = 1; piece < 20; piece += 3) {
+        EchoResponseReader reader;
+        for (size_t i = 0; i < data.size(); i += piece) {
+            ASSERT_TRUE(reader.OnReadOnePart(
+                data.data() + i, std::min(piece, data.size() - i)).ok());
+        }
+        reader.OnEndOfMessage(butil::Status::OK());
+        ASSERT_TRUE(reader.ended);
+        ASSERT_TRUE(reader.status.ok()) << reader.status;
+        ASSERT_EQ(100u, reader.messages.size());
+        for (int i = 0; i < 100; ++i) {
+            ASSERT_EQ(std::string(i * 3, 'a' + i % 26), reader.messages[i]);
+        }
+    }
+    // Truncated.
+    EchoResponseReader reader;
+    ASSERT_TRUE(reader.OnReadOnePart(data.data(), data.size() - 1).ok());
+    reader.OnEndOfMessage(butil::Status::OK());
+    ASSERT_FALSE(reader.status.ok());
+    ASSERT_EQ(99u, reader.messages.size());
+}
@@ -0,0 +1,188 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifdef ENABLE_THRIFT_FRAMED_PROTOCOL
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <gtest/gtest.h>
+#include "butil/iobuf.h"
+#include "brpc/policy/thrift_iobuf_transport.h"
+
+namespace {
+
+using apache::thrift::transport::TTransportException;
+using brpc::policy::ThriftIOBufInputTransport;
+using brpc::policy::ThriftIOBufOutputTransport;
+using brpc::policy::ThriftIOBufInputProtocol;
+using brpc::policy::ThriftIOBufOutputProtocol;
+
+// Append `data' to `out' in separate blocks of at most `block_size' bytes.
+void AppendInBlocks(const std::string& data, size_t block_size,
+                    butil::IOBuf* out) {
+    for (size_t i = 0; i < data.size(); i += block_size) {
+        const size_t n = std::min(block_size, data.size() - i);
+        void* p = malloc(n);
+        memcpy(p, data.data() + i, n);
+        out->append_user_data(p, n, free);
+    }
+}
+
+TEST(ThriftIOBufTransportTest, round_trip_multi_block) {
+    std::string big(3 * butil::IOBuf::DEFAULT_BLOCK_SIZE + 17, 'x');
+    for (size_t i = 0; i < big.size(); ++i) {
+        big[i] = 'a' + i % 26;
+    }
+    auto out_trans = THRIFT_STDCXX::make_shared<ThriftIOBufOutputTransport>();
+    ThriftIOBufOutputProtocol oprot(out_trans);
+    oprot.writeStructBegin("S");
+    oprot.writeFieldBegin("big", apache::thrift::protocol::T_STRING, 1);
+    oprot.writeString(big);
+    oprot.writeFieldEnd();
+    oprot.writeFieldBegin("small", apache::thrift::protocol::T_STRING, 2);
+    oprot.writeString("hello");
+    oprot.writeFieldEnd();
+    oprot.writeFieldBegin("num", apache::thrift::protocol::T_I32, 3);
+    oprot.writeI32(123456789);
+    oprot.writeFieldEnd();
+    oprot.writeFieldStop();
+    oprot.writeStructEnd();
+
+    butil::IOBuf framed;
+    out_trans->AppendFramedTo(&framed);
+    ASSERT_GT(framed.backing_block_num(), 1u);
+    uint32_t body_len = 0;
+    ASSERT_EQ(sizeof(body_len), framed.cutn(&body_len, sizeof(body_len)));
+    ASSERT_EQ(framed.size(), ntohl(body_len));
+
+    // Read from the written blocks and from small blocks where every value
+    // crosses block boundaries.
+    for (int round = 0; round < 2; ++round) {
+        butil::IOBuf body;
+        if (round == 0) {
+            body = framed;
+        } else {
+            AppendInBlocks(framed.to_string(), 7, &body);
+        }
+        ThriftIOBufInputProtocol iprot(
+            THRIFT_STDCXX::make_shared<ThriftIOBufInputTransport>(body));
+        std::string name;
+        apache::thrift::protocol::TType ftype;
+        int16_t fid = 0;
+        iprot.readStructBegin(name);
+        iprot.readFieldBegin(name, ftype, fid);
+        ASSERT_EQ(apache::thrift::protocol::T_STRING, ftype);
+        ASSERT_EQ(1, fid);
+        std::string s;
+        iprot.readString(s);
+        ASSERT_TRUE(s == big);
+        iprot.readFieldEnd();
+        iprot.readFieldBegin(name, ftype, fid);
+        ASSERT_EQ(2, fid);
+        iprot.readString(s);
+        ASSERT_EQ("hello", s);
+        iprot.readFieldEnd();
+        iprot.readFieldBegin(name, ftype, fid);
+        ASSERT_EQ(apache::thrift::protocol::T_I32, ftype);
+        ASSERT_EQ(3, fid);
+        int32_t num = 0;
+        iprot.readI32(num);
+        ASSERT_EQ(123456789, num);
+        iprot.readFieldEnd();
+        iprot.readFieldBegin(name, ftype, fid);
+        ASSERT_EQ(apache::thrift::protocol::T_STOP, ftype);
+        iprot.readStructEnd();
+    }
+}
+
+TEST(ThriftIOBufTransportTest, borrow_across_blocks) {
+    butil::IOBuf buf;
+    AppendInBlocks("abcdefgh", 3, &buf);
+    ThriftIOBufInputTransport trans(buf);
+    // Borrowing is limited to the first block.
+    uint32_t len = 2;
+    const uint8_t* p = trans.borrow(NULL, &len);
+    ASSERT_TRUE(p != NULL);
+    ASSERT_EQ(3u, len);
+    ASSERT_EQ(0, memcmp(p, "abc", 3));
+    len = 4;
+    ASSERT_TRUE(trans.borrow(NULL, &len) == NULL);
+    ASSERT_EQ(4u, len);
+
+    trans.consume(2);
+    len = 1;
+    p = trans.borrow(NULL, &len);
+    ASSERT_TRUE(p != NULL);
+    ASSERT_EQ(1u, len);
+    ASSERT_EQ('c', *p);
+    len = 2;
+    ASSERT_TRUE(trans.borrow(NULL, &len) == NULL);
+
+    // Bytes across blocks are copied.
+    uint8_t out[4];
+    ASSERT_EQ(4u, trans.readAll(out, 4));
+    ASSERT_EQ(0, memcmp(out, "cdef", 4));
+    len = 2;
+    p = trans.borrow(NULL, &len);
+    ASSERT_TRUE(p != NULL);
+    ASSERT_EQ(2u, len);
+    ASSERT_EQ(0, memcmp(p, "gh", 2));
+    trans.consume(2);
+    len = 1;
+    ASSERT_TRUE(trans.borrow(NULL, &len) == NULL);
+}
+
+TEST(ThriftIOBufTransportTest, short_read) {
+    butil::IOBuf buf;
+    AppendInBlocks("abcde", 2, &buf);
+    {
+        ThriftIOBufInputTransport trans(buf);
+        uint8_t out[8];
+        ASSERT_EQ(5u, trans.read(out, sizeof(out)));
+        ASSERT_EQ(0u, trans.read(out, sizeof(out)));
+    }
+    {
+        ThriftIOBufInputTransport trans(buf);
+        uint8_t out[8];
+        try {
+            trans.readAll(out, 6);
+            FAIL() << "readAll should throw";
+        } catch (const TTransportException& e) {
+            ASSERT_EQ(TTransportException::END_OF_FILE, e.getType());
+        }
+    }
+    {
+        // Truncated integer.
+        ThriftIOBufInputProtocol iprot(
+            THRIFT_STDCXX::make_shared<ThriftIOBufInputTransport>(buf));
+        int32_t num = 0;
+        iprot.readI32(num);
+        try {
+            iprot.readI32(num);
+            FAIL() << "readI32 should throw";
+        } catch (const TTransportException& e) {
+            ASSERT_EQ(TTransportException::END_OF_FILE, e.getType());
+        }
+    }
+    // The input IOBuf is not modified.
+    ASSERT_EQ("abcde", buf.to_string());
+}
+
+} // namespace
+
+#endif // ENABLE_THRIFT_FRAMED_PROTOCOL
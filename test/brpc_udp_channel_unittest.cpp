@@ -0,0 +1,154 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gtest/gtest.h>
+#include "butil/atomicops.h"
+#include "butil/time.h"
+#include "bthread/bthread.h"
+#include "brpc/closure_guard.h"
+#include "brpc/controller.h"
+#include "brpc/server.h"
+#include "brpc/udp_channel.h"
+#include "echo.pb.h"
+
+namespace {
+
+class OnewayEchoService : public test::EchoService {
+public:
+    OnewayEchoService() : _count(0), _bytes(0) {}
+
+    void Echo(google::protobuf::RpcController* cntl_base,
+              const test::EchoRequest* request,
+              test::EchoResponse* response,
+              google::protobuf::Closure* done) override {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        EXPECT_EQ(brpc::PROTOCOL_BAIDU_STD, cntl->request_protocol());
+        EXPECT_EQ(12345u, cntl->log_id());
+        response->set_message(request->message());
+        _bytes.fetch_add(request->message().size() +
+                         cntl->request_attachment().size());
+        _count.fetch_add(1);
+    }
+
+    butil::atomic<int> _count;
+    butil::atomic<size_t> _bytes;
+};
+
+bool WaitForCount(const OnewayEchoService& service, int expected) {
+    const int64_t deadline_us = butil::gettimeofday_us() + 5000000L;
+    while (service._count.load() < expected) {
+        if (butil::gettimeofday_us() > deadline_us) {
+            return false;
+        }
+        bthread_usleep(1000);
+    }
+    return true;
+}
+
+class UdpChannelTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(0, _server.AddService(&_service,
+                                        brpc::SERVER_DOESNT_OWN_SERVICE));
+        brpc::ServerOptions options;
+        options.udp_port = 0;
+        ASSERT_EQ(0, _server.Start("127.0.0.1:0", &options));
+        ASSERT_GT(_server.udp_port(), 0);
+        butil::EndPoint point;
+        ASSERT_EQ(0, butil::str2endpoint("127.0.0.1", _server.udp_port(), &point));
+        ASSERT_EQ(0, _chan.Init(point, NULL));
+    }
+
+    void TearDown() override {
+        _server.Stop(0);
+        _server.Join();
+    }
+
+    OnewayEchoService _service;
+    brpc::Server _server;
+    brpc::UdpChannel _chan;
+};
+
+TEST_F(UdpChannelTest, send_oneway_requests) {
+    test::EchoService_Stub stub(&_chan);
+    const int N = 100;
+    for (int i = 0; i < N; ++i) {
+        brpc::Controller cntl;
+        cntl.set_log_id(12345);
+        cntl.request_attachment().append("attachment");
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello");
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        // Responses are never filled.
+        ASSERT_FALSE(res.has_message());
+    }
+    ASSERT_TRUE(WaitForCount(_service, N));
+    ASSERT_EQ(N * (5u + 10u), _service._bytes.load());
+}
+
+static void* SendRequests(void* arg) {
+    test::EchoService_Stub stub(static_cast<brpc::UdpChannel*>(arg));
+    for (int i = 0; i < 50; ++i) {
+        brpc::Controller cntl;
+        cntl.set_log_id(12345);
+        test::EchoRequest req;
+        req.set_message("concurrent");
+        stub.Echo(&cntl, &req, NULL, NULL);
+        EXPECT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    }
+    return NULL;
+}
+
+TEST_F(UdpChannelTest, send_concurrently) {
+    bthread_t th[8];
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, bthread_start_background(&th[i], NULL, SendRequests, &_chan));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        bthread_join(th[i], NULL);
+    }
+    // Loopback drops datagrams only when the receive buffer is full, which
+    // does not happen for so few requests.
+    ASSERT_TRUE(WaitForCount(_service, 50 * ARRAY_SIZE(th)));
+}
+
+TEST_F(UdpChannelTest, too_large_request) {
+    test::EchoService_Stub stub(&_chan);
+    brpc::Controller cntl;
+    test::EchoRequest req;
+    req.set_message(std::string(70000, 'a'));
+    stub.Echo(&cntl, &req, NULL, NULL);
+    ASSERT_TRUE(cntl.Failed());
+    ASSERT_EQ(brpc::EREQUEST, cntl.ErrorCode());
+}
+
+TEST_F(UdpChannelTest, not_initialized) {
+    brpc::UdpChannel chan;
+    test::EchoService_Stub stub(&chan);
+    brpc::Controller cntl;
+    test::EchoRequest req;
+    req.set_message("hello");
+    stub.Echo(&cntl, &req, NULL, NULL);
+    ASSERT_TRUE(cntl.Failed());
+    ASSERT_EQ(EINVAL, cntl.ErrorCode());
+}
+
+} // namespace
@@ -0,0 +1,110 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include "butil/time.h"
+#include "bthread/bthread.h"
+#include "bthread/blocking_queue.h"
+
+namespace {
+
+const int NPRODUCER = 4;
+const int NCONSUMER = 4;
+const int64_t COUNT_PER_PRODUCER = 50000;
+
+struct QueueArg {
+    bthread::BlockingQueue<int64_t>* q;
+    butil::atomic<int64_t> sum;
+    butil::atomic<int64_t> npopped;
+};
+
+void* producer(void* void_arg) {
+    QueueArg* arg = static_cast<QueueArg*>(void_arg);
+    for (int64_t i = 1; i <= COUNT_PER_PRODUCER; ++i) {
+        EXPECT_EQ(0, arg->q->push(i));
+    }
+    return NULL;
+}
+
+void* consumer(void* void_arg) {
+    QueueArg* arg = static_cast<QueueArg*>(void_arg);
+    int64_t items[8];
+    int64_t sum = 0;
+    while (true) {
+        // Quit when nothing comes in 100ms, which means all are popped.
+        const timespec abstime = butil::milliseconds_from_now(100);
+        const size_t n = arg->q->pop_batch(items, 8, &abstime);
+        if (n == 0) {
+            break;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            sum += items[i];
+        }
+        arg->npopped.fetch_add(n, butil::memory_order_relaxed);
+    }
+    arg->sum.fetch_add(sum, butil::memory_order_relaxed);
+    return NULL;
+}
+
+TEST(BlockingQueueTest, producers_and_consumers) {
+    bthread::BlockingQueue<int64_t> q;
+    // Small capacity so that both sides have to wait.
+    ASSERT_EQ(0, q.init(16));
+    QueueArg arg;
+    arg.q = &q;
+    arg.sum = 0;
+    arg.npopped = 0;
+    bthread_t th[NPRODUCER + NCONSUMER];
+    for (int i = 0; i < NCONSUMER; ++i) {
+        ASSERT_EQ(0, bthread_start_background(&th[i], NULL, consumer, &arg));
+    }
+    for (int i = 0; i < NPRODUCER; ++i) {
+        ASSERT_EQ(0, bthread_start_background(
+                      &th[NCONSUMER + i], NULL, producer, &arg));
+    }
+    for (int i = 0; i < NPRODUCER + NCONSUMER; ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+    }
+    ASSERT_EQ(NPRODUCER * COUNT_PER_PRODUCER, arg.npopped.load());
+    ASSERT_EQ(NPRODUCER * COUNT_PER_PRODUCER * (COUNT_PER_PRODUCER + 1) / 2,
+              arg.sum.load());
+}
+
+TEST(BlockingQueueTest, timeout) {
+    bthread::BlockingQueue<int> q;
+    ASSERT_EQ(0, q.init(2));
+    int x = 0;
+    ASSERT_FALSE(q.try_pop(&x));
+    timespec abstime = butil::milliseconds_from_now(10);
+    butil::Timer tm;
+    tm.start();
+    ASSERT_EQ(ETIMEDOUT, q.pop(&x, &abstime));
+    tm.stop();
+    ASSERT_GE(tm.m_elapsed(), 5);
+
+    ASSERT_TRUE(q.try_push(1));
+    ASSERT_EQ(0, q.push(2));
+    ASSERT_FALSE(q.try_push(3));
+    abstime = butil::milliseconds_from_now(10);
+    ASSERT_EQ(ETIMEDOUT, q.push(3, &abstime));
+    ASSERT_EQ(0, q.pop(&x));
+    ASSERT_EQ(1, x);
+    ASSERT_TRUE(q.try_pop(&x));
+    ASSERT_EQ(2, x);
+}
+
+}  // namespace
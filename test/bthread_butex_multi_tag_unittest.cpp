@@ -21,11 +21,18 @@
 #include "bthread/condition_variable.h"
 #include "bthread/countdown_event.h"
 #include "bthread/mutex.h"
+#include "bthread/butex.h"
+#include "bthread/timer_thread.h"
+#include "bthread/unstable.h"
 
 DECLARE_int32(task_group_ntags);
+namespace bthread {
+DECLARE_bool(bthread_timer_thread_per_tag);
+}
 
 int main(int argc, char* argv[]) {
     FLAGS_task_group_ntags = 3;
+    bthread::FLAGS_bthread_timer_thread_per_tag = true;
     testing::InitGoogleTest(&argc, argv);
     GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
     return RUN_ALL_TESTS();
@@ -168,4 +175,44 @@ TEST(BthreadButexMultiTest, butex_requeue) {
     ASSERT_EQ(butex_wake_all_return2[0], butex_wake_all_return2[1]);
 }
 
+void on_timer(void* arg) {
+    static_cast<bthread::CountdownEvent*>(arg)->signal();
+}
+
+void* timer_func(void*) {
+    EXPECT_EQ(0, bthread_usleep(1000));
+    int* butex = bthread::butex_create_checked<int>();
+    *butex = 0;
+    const timespec abstime = butil::milliseconds_from_now(5);
+    EXPECT_EQ(-1, bthread::butex_wait(butex, 0, &abstime));
+    EXPECT_EQ(ETIMEDOUT, errno);
+    bthread::butex_destroy(butex);
+
+    bthread::CountdownEvent ev(1);
+    bthread_timer_t timer;
+    EXPECT_EQ(0, bthread_timer_add(&timer, butil::milliseconds_from_now(1),
+                                   on_timer, &ev));
+    EXPECT_EQ(0, ev.wait());
+    EXPECT_EQ(0, bthread_timer_add(&timer, butil::seconds_from_now(10),
+                                   on_timer, &ev));
+    EXPECT_EQ(0, bthread_timer_del(timer));
+    return nullptr;
+}
+
+TEST(BthreadButexMultiTest, timer_thread_per_tag) {
+    bthread_t tid;
+    ASSERT_EQ(0, bthread_start_background(&tid, nullptr, timer_func, nullptr));
+    ASSERT_EQ(0, bthread_join(tid, nullptr));
+    ASSERT_NE(bthread::get_global_timer_thread(), bthread::get_timer_thread(1));
+    ASSERT_NE(bthread::get_timer_thread(1), bthread::get_timer_thread(2));
+    ASSERT_EQ(bthread::get_global_timer_thread(),
+              bthread::get_timer_thread(BTHREAD_TAG_DEFAULT));
+    for (bthread_tag_t tag = 1; tag < 3; ++tag) {
+        bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+        attr.tag = tag;
+        ASSERT_EQ(0, bthread_start_background(&tid, &attr, timer_func, nullptr));
+        ASSERT_EQ(0, bthread_join(tid, nullptr));
+    }
+}
+
 }  // namespace
@@ -26,12 +26,16 @@
 #include "bthread/bthread.h"
 #include "bthread/unstable.h"
 #include "bthread/interrupt_pthread.h"
+#include "bvar/collector.h"
 
 namespace bthread {
 extern butil::atomic<TaskControl*> g_task_control;
 inline TaskControl* get_task_control() {
     return g_task_control.load(butil::memory_order_consume);
 }
+bool WaitProfilerStart(const char* filename);
+void WaitProfilerStop();
+size_t wait_sampling_range();
 } // namespace bthread
 
 namespace {
@@ -443,4 +447,88 @@ TEST(ButexTest, wait_with_signal_triggered) {
     bthread::butex_destroy(butex);
 }
 
+static void on_butex_woken(void* arg) {
+    static_cast<butil::atomic<int>*>(arg)->fetch_add(1);
+}
+
+TEST(ButexTest, wait_async) {
+    butil::atomic<int>* butex =
+        bthread::butex_create_checked<butil::atomic<int> >();
+    ASSERT_TRUE(butex);
+    *butex = 1;
+    butil::atomic<int> nwoken(0);
+    ASSERT_EQ(-1, bthread::butex_wait_async(butex, 0, on_butex_woken, &nwoken));
+    ASSERT_EQ(EWOULDBLOCK, errno);
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(0, bthread::butex_wait_async(butex, 1, on_butex_woken, &nwoken));
+    }
+    ASSERT_EQ(0, nwoken);
+    ASSERT_EQ(1, bthread::butex_wake(butex));
+    ASSERT_EQ(1, nwoken);
+    ASSERT_EQ(2, bthread::butex_wake_all(butex));
+    ASSERT_EQ(3, nwoken);
+    ASSERT_EQ(0, bthread::butex_wake_all(butex));
+    bthread::butex_destroy(butex);
+}
+
+void* wait_on_butex(void* arg) {
+    timespec abstime = butil::milliseconds_from_now(20);
+    if (bthread::butex_wait(arg, 0, &abstime) != -1 || errno != ETIMEDOUT) {
+        return (void*)1;
+    }
+    return NULL;
+}
+
+TEST(ButexTest, wait_profiler) {
+    ASSERT_FALSE(bvar::is_sampling_range_valid(bthread::wait_sampling_range()));
+    const char* const prof_name = "butex_wait_profiler.prof";
+    unlink(prof_name);
+    ASSERT_TRUE(bthread::WaitProfilerStart(prof_name));
+    ASSERT_FALSE(bthread::WaitProfilerStart(prof_name));
+    ASSERT_TRUE(bvar::is_sampling_range_valid(bthread::wait_sampling_range()));
+
+    int* butex = bthread::butex_create_checked<int>();
+    *butex = 0;
+    bthread_t th[8];
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, bthread_start_background(&th[i], NULL, wait_on_butex, butex));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        void* ret = (void*)1;
+        ASSERT_EQ(0, bthread_join(th[i], &ret));
+        ASSERT_EQ(NULL, ret);
+    }
+    bthread::butex_destroy(butex);
+    // Samples are dumped by the collecting thread.
+    usleep(1500000);
+    bthread::WaitProfilerStop();
+    ASSERT_FALSE(bvar::is_sampling_range_valid(bthread::wait_sampling_range()));
+
+    // Each line is "<duration_ns> <count> @ <stack>".
+    FILE* fp = fopen(prof_name, "r");
+    ASSERT_TRUE(fp != NULL);
+    char line[4096];
+    ASSERT_TRUE(fgets(line, sizeof(line), fp) != NULL);
+    ASSERT_STREQ("--- contention\n", line);
+    ASSERT_TRUE(fgets(line, sizeof(line), fp) != NULL);
+    ASSERT_STREQ("cycles/second=1000000000\n", line);
+    int64_t total_ns = 0;
+    int64_t total_count = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        long long ns = 0;
+        long long count = 0;
+        if (sscanf(line, "%lld %lld @", &ns, &count) == 2 &&
+            strstr(line, " @ ") != NULL) {
+            total_ns += ns;
+            total_count += count;
+        }
+    }
+    fclose(fp);
+    unlink(prof_name);
+    // Waits are sampled while the profiler is on, every one of them lasts
+    // for 20ms.
+    ASSERT_GT(total_count, 0);
+    ASSERT_GE(total_ns, total_count * 15000000L);
+}
+
 } // namespace
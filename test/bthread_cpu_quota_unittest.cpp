@@ -0,0 +1,128 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include "butil/files/file_path.h"
+#include "butil/file_util.h"
+#include "butil/files/scoped_temp_dir.h"
+#include "bthread/cpu_quota.h"
+
+namespace bthread {
+namespace {
+
+class CpuQuotaTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_TRUE(_dir.CreateUniqueTempDir());
+    }
+
+    void Write(const std::string& relative_path, const std::string& content) {
+        const butil::FilePath path = _dir.path().Append(relative_path);
+        ASSERT_TRUE(butil::CreateDirectory(path.DirName()));
+        ASSERT_EQ((int)content.size(),
+                  butil::WriteFile(path, content.data(), content.size()));
+    }
+
+    double Quota() const {
+        return get_cgroup_cpu_quota(
+            _dir.path().Append("proc_self_cgroup").value(),
+            _dir.path().Append("cgroup").value());
+    }
+
+    butil::ScopedTempDir _dir;
+};
+
+TEST_F(CpuQuotaTest, v1_quota_and_period) {
+    Write("proc_self_cgroup",
+          "5:memory:/pod\n4:cpuacct,cpu:/pod/c1\n3:cpuset:/pod\n");
+    Write("cgroup/cpuacct,cpu/pod/c1/cpu.cfs_quota_us", "250000\n");
+    Write("cgroup/cpuacct,cpu/pod/c1/cpu.cfs_period_us", "100000\n");
+    ASSERT_DOUBLE_EQ(2.5, Quota());
+}
+
+TEST_F(CpuQuotaTest, v1_unlimited) {
+    Write("proc_self_cgroup", "4:cpu,cpuacct:/pod/c1\n");
+    Write("cgroup/cpu,cpuacct/pod/c1/cpu.cfs_quota_us", "-1\n");
+    Write("cgroup/cpu,cpuacct/pod/c1/cpu.cfs_period_us", "100000\n");
+    ASSERT_EQ(0, Quota());
+}
+
+TEST_F(CpuQuotaTest, v1_minimum_of_hierarchy) {
+    Write("proc_self_cgroup", "4:cpu:/pod/c1\n");
+    Write("cgroup/cpu/cpu.cfs_quota_us", "-1\n");
+    Write("cgroup/cpu/cpu.cfs_period_us", "100000\n");
+    Write("cgroup/cpu/pod/cpu.cfs_quota_us", "150000\n");
+    Write("cgroup/cpu/pod/cpu.cfs_period_us", "100000\n");
+    Write("cgroup/cpu/pod/c1/cpu.cfs_quota_us", "400000\n");
+    Write("cgroup/cpu/pod/c1/cpu.cfs_period_us", "100000\n");
+    ASSERT_DOUBLE_EQ(1.5, Quota());
+}
+
+TEST_F(CpuQuotaTest, v2_cpu_max) {
+    Write("proc_self_cgroup", "0::/pod/c1\n");
+    Write("cgroup/pod/c1/cpu.max", "50000 20000\n");
+    ASSERT_DOUBLE_EQ(2.5, Quota());
+}
+
+TEST_F(CpuQuotaTest, v2_max_is_unlimited) {
+    Write("proc_self_cgroup", "0::/pod/c1\n");
+    Write("cgroup/pod/c1/cpu.max", "max 100000\n");
+    Write("cgroup/pod/cpu.max", "max 100000\n");
+    ASSERT_EQ(0, Quota());
+    // Limited by the parent.
+    Write("cgroup/pod/cpu.max", "300000 100000\n");
+    ASSERT_DOUBLE_EQ(3, Quota());
+}
+
+TEST_F(CpuQuotaTest, v2_minimum_of_hierarchy) {
+    Write("proc_self_cgroup", "0::/pod/c1/c2\n");
+    Write("cgroup/pod/cpu.max", "200000 100000\n");
+    Write("cgroup/pod/c1/cpu.max", "50000 100000\n");
+    Write("cgroup/pod/c1/c2/cpu.max", "max 100000\n");
+    ASSERT_DOUBLE_EQ(0.5, Quota());
+}
+
+TEST_F(CpuQuotaTest, only_namespace_root_readable) {
+    // Inside containers, the cgroup path is relative to the host and only
+    // the root of the mount is the cgroup of this process.
+    Write("proc_self_cgroup", "0::/kubepods/pod/c1\n");
+    Write("cgroup/cpu.max", "150000 100000\n");
+    ASSERT_DOUBLE_EQ(1.5, Quota());
+}
+
+TEST_F(CpuQuotaTest, v2_preferred_and_fallback_to_v1) {
+    Write("proc_self_cgroup", "4:cpu:/c1\n0::/c1\n");
+    Write("cgroup/c1/cpu.max", "100000 100000\n");
+    Write("cgroup/cpu/c1/cpu.cfs_quota_us", "300000\n");
+    Write("cgroup/cpu/c1/cpu.cfs_period_us", "100000\n");
+    ASSERT_DOUBLE_EQ(1, Quota());
+    Write("cgroup/c1/cpu.max", "max 100000\n");
+    ASSERT_DOUBLE_EQ(3, Quota());
+}
+
+TEST_F(CpuQuotaTest, missing_or_corrupted_files) {
+    ASSERT_EQ(0, Quota());
+    Write("proc_self_cgroup", "garbage\n0::/c1\n");
+    ASSERT_EQ(0, Quota());
+    Write("cgroup/c1/cpu.max", "abc\n");
+    ASSERT_EQ(0, Quota());
+    Write("cgroup/c1/cpu.max", "0 100000\n");
+    ASSERT_EQ(0, Quota());
+}
+
+} // namespace
+} // namespace bthread
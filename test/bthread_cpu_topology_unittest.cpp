@@ -0,0 +1,196 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <algorithm>
+#include <vector>
+#include <gtest/gtest.h>
+#include "butil/files/file_path.h"
+#include "butil/file_util.h"
+#include "butil/files/scoped_temp_dir.h"
+#include "butil/string_printf.h"
+#include "bthread/cpu_topology.h"
+#include "bthread/task_control.h"
+#include "bthread/task_group.h"
+
+namespace bthread {
+namespace {
+
+class CpuTopologyTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_TRUE(_dir.CreateUniqueTempDir());
+    }
+
+    void Write(const std::string& relative_path, const std::string& content) {
+        const butil::FilePath path = _dir.path().Append(relative_path);
+        ASSERT_TRUE(butil::CreateDirectory(path.DirName()));
+        ASSERT_EQ((int)content.size(),
+                  butil::WriteFile(path, content.data(), content.size()));
+    }
+
+    void WriteCache(int cpu, int index, int level,
+                    const std::string& shared_cpu_list) {
+        const std::string dir = butil::string_printf(
+            "devices/system/cpu/cpu%d/cache/index%d/", cpu, index);
+        Write(dir + "level", butil::string_printf("%d\n", level));
+        Write(dir + "shared_cpu_list", shared_cpu_list + "\n");
+    }
+
+    std::string sysfs_dir() const { return _dir.path().value(); }
+
+    butil::ScopedTempDir _dir;
+};
+
+TEST_F(CpuTopologyTest, read_nodes_and_l3) {
+    // 2 nodes with 4 cpus each, cpu 0-1, 2-3 and 4-7 share L3 respectively.
+    Write("devices/system/node/node0/cpulist", "0-3\n");
+    Write("devices/system/node/node1/cpulist", "4-7\n");
+    for (int cpu = 0; cpu < 8; ++cpu) {
+        WriteCache(cpu, 0, 1, butil::string_printf("%d", cpu));
+        WriteCache(cpu, 1, 2, butil::string_printf("%d", cpu));
+        WriteCache(cpu, 2, 3, cpu < 2 ? "0-1" : (cpu < 4 ? "2-3" : "4-7"));
+    }
+    CpuTopology t;
+    ASSERT_EQ(0, t.init(sysfs_dir(), 8));
+    ASSERT_EQ(2, t.nnode());
+    ASSERT_EQ(3, t.nl3());
+    const int expected_node[] = { 0, 0, 0, 0, 1, 1, 1, 1 };
+    const int expected_l3[] = { 0, 0, 2, 2, 4, 4, 4, 4 };
+    for (int cpu = 0; cpu < 8; ++cpu) {
+        EXPECT_EQ(expected_node[cpu], t.node_of(cpu)) << cpu;
+        EXPECT_EQ(expected_l3[cpu], t.l3_of(cpu)) << cpu;
+    }
+    ASSERT_EQ(-1, t.node_of(8));
+    ASSERT_EQ(-1, t.l3_of(8));
+    ASSERT_EQ(-1, t.node_of(-1));
+    ASSERT_EQ(-1, t.l3_of(-1));
+}
+
+TEST_F(CpuTopologyTest, cpulist_with_discrete_ranges) {
+    Write("devices/system/node/node0/cpulist", "0-1,4-5\n");
+    Write("devices/system/node/node1/cpulist", "2-3,6-7\n");
+    CpuTopology t;
+    ASSERT_EQ(0, t.init(sysfs_dir(), 8));
+    ASSERT_EQ(2, t.nnode());
+    const int expected_node[] = { 0, 0, 1, 1, 0, 0, 1, 1 };
+    for (int cpu = 0; cpu < 8; ++cpu) {
+        EXPECT_EQ(expected_node[cpu], t.node_of(cpu)) << cpu;
+    }
+}
+
+TEST_F(CpuTopologyTest, missing_nodes_and_caches) {
+    // Without NUMA support and L3 info, all cpus are in node 0 and share
+    // one cache domain.
+    CpuTopology t;
+    ASSERT_EQ(0, t.init(sysfs_dir(), 4));
+    ASSERT_EQ(1, t.nnode());
+    ASSERT_EQ(1, t.nl3());
+    for (int cpu = 0; cpu < 4; ++cpu) {
+        EXPECT_EQ(0, t.node_of(cpu));
+        EXPECT_EQ(-2, t.l3_of(cpu));
+    }
+}
+
+TEST_F(CpuTopologyTest, l3_missing_in_one_node) {
+    Write("devices/system/node/node0/cpulist", "0-1\n");
+    Write("devices/system/node/node1/cpulist", "2-3\n");
+    WriteCache(0, 0, 3, "0-1");
+    WriteCache(1, 0, 3, "0-1");
+    CpuTopology t;
+    ASSERT_EQ(0, t.init(sysfs_dir(), 4));
+    ASSERT_EQ(0, t.l3_of(1));
+    // Node 1 without L3 info is one cache domain not colliding with cpus.
+    ASSERT_EQ(-3, t.l3_of(2));
+    ASSERT_EQ(-3, t.l3_of(3));
+    ASSERT_EQ(2, t.nl3());
+}
+
+TEST_F(CpuTopologyTest, corrupted_inputs) {
+    // Reversed range stops reading nodes.
+    Write("devices/system/node/node0/cpulist", "0-1\n");
+    Write("devices/system/node/node1/cpulist", "3-2\n");
+    WriteCache(0, 0, 3, "abc");
+    CpuTopology t;
+    ASSERT_EQ(0, t.init(sysfs_dir(), 4));
+    ASSERT_EQ(1, t.nnode());
+    ASSERT_EQ(0, t.node_of(3));
+    ASSERT_EQ(-2, t.l3_of(0));
+
+    CpuTopology t2;
+    ASSERT_EQ(-1, t2.init(sysfs_dir(), 0));
+    ASSERT_EQ(-1, t2.init(sysfs_dir(), 1L << 20));
+}
+
+TaskGroup* new_group(TaskControl* c, int l3, int node) {
+    TaskGroup* g = new TaskGroup(c);
+    EXPECT_EQ(0, g->_rq.init(4));
+    EXPECT_EQ(0, g->_remote_rq.init(4));
+    g->_l3_id.store(l3, butil::memory_order_relaxed);
+    g->_numa_node.store(node, butil::memory_order_relaxed);
+    return g;
+}
+
+TEST(StealByTopologyTest, steal_nearer_groups_first) {
+    TaskControl* c = new TaskControl;
+    TaskGroup* self = new_group(c, 0, 0);
+    TaskGroup* same_l3 = new_group(c, 0, 0);
+    TaskGroup* same_node = new_group(c, 2, 0);
+    TaskGroup* remote = new_group(c, 4, 1);
+    TaskGroup* unknown = new_group(c, -1, -1);
+    ASSERT_TRUE(same_l3->_rq.push(1));
+    ASSERT_TRUE(same_node->_rq.push(2));
+    ASSERT_TRUE(remote->_remote_rq.push(3));
+    ASSERT_TRUE(unknown->_rq.push(4));
+    // The farthest groups are met first in the sweeping order.
+    TaskGroup* groups[] = { remote, unknown, same_node, same_l3, self };
+    const size_t ngroup = ARRAY_SIZE(groups);
+    for (size_t i = 0; i < ngroup; ++i) {
+        c->tag_group(BTHREAD_TAG_DEFAULT)[i] = groups[i];
+    }
+    c->tag_ngroup(BTHREAD_TAG_DEFAULT).store(ngroup);
+
+    size_t seed = 0;
+    bthread_t tid = 0;
+    ASSERT_TRUE(c->steal_task_by_topology(&tid, &seed, 1, self, ngroup));
+    ASSERT_EQ(1u, tid);
+    ASSERT_TRUE(c->steal_task_by_topology(&tid, &seed, 1, self, ngroup));
+    ASSERT_EQ(2u, tid);
+    // Groups in other nodes or with unknown location are stolen from by
+    // every sweep, no local failures are required.
+    std::vector<bthread_t> tids;
+    ASSERT_TRUE(c->steal_task_by_topology(&tid, &seed, 1, self, ngroup));
+    tids.push_back(tid);
+    ASSERT_TRUE(c->steal_task_by_topology(&tid, &seed, 1, self, ngroup));
+    tids.push_back(tid);
+    std::sort(tids.begin(), tids.end());
+    ASSERT_EQ(3u, tids[0]);
+    ASSERT_EQ(4u, tids[1]);
+    ASSERT_FALSE(c->steal_task_by_topology(&tid, &seed, 1, self, ngroup));
+
+    ASSERT_EQ(1, c->_nsteal_same_l3.get_value());
+    ASSERT_EQ(1, c->_nsteal_same_node.get_value());
+    ASSERT_EQ(2, c->_nsteal_cross_node.get_value());
+
+    c->tag_ngroup(BTHREAD_TAG_DEFAULT).store(0);
+    for (size_t i = 0; i < ngroup; ++i) {
+        delete groups[i];
+    }
+    delete c;
+}
+
+} // namespace
+} // namespace bthread
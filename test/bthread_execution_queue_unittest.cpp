@@ -18,6 +18,7 @@
 #include <gtest/gtest.h>
 
 #include <bthread/execution_queue.h>
+#include <bthread/sharded_execution_queue.h>
 #include <bthread/sys_futex.h>
 #include <bthread/countdown_event.h>
 #include "butil/time.h"
@@ -917,4 +918,199 @@ TEST_F(ExecutionQueueTest, cancel_unexecuted_high_priority_task) {
         test_cancel_unexecuted_high_priority_task(i);
     }
 }
+volatile bool g_gate_closed = false;
+volatile bool g_consumer_waiting = false;
+int g_nbatch = 0;
+
+int add_behind_gate(void* meta, bthread::TaskIterator<LongIntTask> &iter) {
+    stopped = iter.is_queue_stopped();
+    ++g_nbatch;
+    while (g_gate_closed) {
+        g_consumer_waiting = true;
+        bthread_usleep(100);
+    }
+    int64_t* result = (int64_t*)meta;
+    for (; iter; ++iter) {
+        *result += iter->value;
+    }
+    return 0;
+}
+
+void test_max_pending_tasks(bool use_pthread) {
+    bthread::ExecutionQueueId<LongIntTask> queue_id;
+    bthread::ExecutionQueueOptions options;
+    options.use_pthread = use_pthread;
+    options.max_pending_tasks = 10;
+    int64_t result = 0;
+    int64_t expected_result = 0;
+    g_gate_closed = true;
+    g_consumer_waiting = false;
+    ASSERT_EQ(0, bthread::execution_queue_start(&queue_id, &options,
+                                                add_behind_gate, &result));
+    // The first task is handed to the consumer which waits at the gate.
+    ASSERT_EQ(0, bthread::execution_queue_execute(queue_id, 1));
+    expected_result += 1;
+    while (!g_consumer_waiting) {
+        usleep(100);
+    }
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(0, bthread::execution_queue_execute(queue_id, i));
+        expected_result += i;
+    }
+    ASSERT_EQ(EAGAIN, bthread::execution_queue_execute(queue_id, 100));
+    g_gate_closed = false;
+    ASSERT_EQ(0, bthread::execution_queue_stop(queue_id));
+    ASSERT_EQ(0, bthread::execution_queue_join(queue_id));
+    ASSERT_EQ(expected_result, result);
+}
+
+TEST_F(ExecutionQueueTest, max_pending_tasks) {
+    for (int i = 0; i < 2; ++i) {
+        test_max_pending_tasks(i);
+    }
+}
+
+struct ProducerArgs {
+    bthread::ExecutionQueueId<LongIntTask> queue_id;
+    int ntask;
+};
+
+void* produce_tasks(void* arg) {
+    ProducerArgs* args = (ProducerArgs*)arg;
+    for (int i = 0; i < args->ntask; ++i) {
+        EXPECT_EQ(0, bthread::execution_queue_execute(args->queue_id, i));
+    }
+    return NULL;
+}
+
+TEST_F(ExecutionQueueTest, block_when_full) {
+    bthread::ExecutionQueueOptions options;
+    options.max_pending_tasks = 4;
+    options.max_pending_bytes = 4 * sizeof(LongIntTask);
+    options.block_when_full = true;
+    int64_t result = 0;
+    g_gate_closed = true;
+    ProducerArgs args;
+    args.ntask = 1000;
+    ASSERT_EQ(0, bthread::execution_queue_start(&args.queue_id, &options,
+                                                add_behind_gate, &result));
+    bthread_t th[2];
+    ASSERT_EQ(0, bthread_start_background(&th[0], NULL, produce_tasks, &args));
+    pthread_t pth;
+    ASSERT_EQ(0, pthread_create(&pth, NULL, produce_tasks, &args));
+    usleep(10000);
+    // Producers are blocked.
+    ASSERT_EQ(0, result);
+    g_gate_closed = false;
+    ASSERT_EQ(0, bthread_join(th[0], NULL));
+    ASSERT_EQ(0, pthread_join(pth, NULL));
+    ASSERT_EQ(0, bthread::execution_queue_stop(args.queue_id));
+    ASSERT_EQ(0, bthread::execution_queue_join(args.queue_id));
+    ASSERT_EQ(2 * 999 * 1000 / 2, result);
+}
+
+TEST_F(ExecutionQueueTest, min_batch_size) {
+    bthread::ExecutionQueueId<LongIntTask> queue_id;
+    bthread::ExecutionQueueOptions options;
+    options.min_batch_size = 10;
+    options.max_batch_delay_us = 1000000;
+    int64_t result = 0;
+    int64_t expected_result = 0;
+    g_gate_closed = false;
+    g_nbatch = 0;
+    ASSERT_EQ(0, bthread::execution_queue_start(&queue_id, &options,
+                                                add_behind_gate, &result));
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(0, bthread::execution_queue_execute(queue_id, i));
+        expected_result += i;
+        usleep(1000);
+    }
+    ASSERT_EQ(0, bthread::execution_queue_stop(queue_id));
+    ASSERT_EQ(0, bthread::execution_queue_join(queue_id));
+    ASSERT_EQ(expected_result, result);
+    // One batch of 10 tasks and the stop task, in general.
+    ASSERT_LT(g_nbatch, 10);
+}
+
+struct KeyedTask {
+    uint64_t key;
+    int64_t seq;
+};
+
+struct KeyedResult {
+    static const int NKEY = 64;
+    int64_t last_seq[NKEY];
+    butil::atomic<int64_t> nexecuted;
+    butil::atomic<int> nstopped;
+    bool out_of_order;
+};
+
+int check_order(void* meta, bthread::TaskIterator<KeyedTask>& iter) {
+    KeyedResult* r = (KeyedResult*)meta;
+    if (iter.is_queue_stopped()) {
+        r->nstopped.fetch_add(1);
+        return 0;
+    }
+    for (; iter; ++iter) {
+        // Tasks of the same key are never run concurrently.
+        if (iter->seq != r->last_seq[iter->key] + 1) {
+            r->out_of_order = true;
+        }
+        r->last_seq[iter->key] = iter->seq;
+        r->nexecuted.fetch_add(1, butil::memory_order_relaxed);
+    }
+    return 0;
+}
+
+struct KeyedProducerArgs {
+    bthread::ShardedExecutionQueue<KeyedTask>* q;
+    uint64_t first_key;
+    int ntask;
+};
+
+void* produce_keyed_tasks(void* arg) {
+    KeyedProducerArgs* args = (KeyedProducerArgs*)arg;
+    // Each producer owns 16 keys so that seq of each key is increasing.
+    for (int i = 0; i < args->ntask; ++i) {
+        KeyedTask t = { args->first_key + i % 16, i / 16 };
+        EXPECT_EQ(0, args->q->execute(t.key, t));
+    }
+    return NULL;
+}
+
+TEST_F(ExecutionQueueTest, sharded_execution_queue) {
+    KeyedResult r;
+    for (int i = 0; i < KeyedResult::NKEY; ++i) {
+        r.last_seq[i] = -1;
+    }
+    r.nexecuted = 0;
+    r.nstopped = 0;
+    r.out_of_order = false;
+    bthread::ShardedExecutionQueue<KeyedTask> q;
+    KeyedTask t = { 0, 0 };
+    ASSERT_EQ(EINVAL, q.execute(0, t));
+    ASSERT_EQ(0, q.start(8, 3, NULL, check_order, &r));
+    ASSERT_EQ(8u, q.lane_count());
+    const int NPRODUCER = KeyedResult::NKEY / 16;
+    const int NTASK = 16 * 10000;
+    KeyedProducerArgs args[NPRODUCER];
+    bthread_t th[NPRODUCER];
+    for (int i = 0; i < NPRODUCER; ++i) {
+        args[i].q = &q;
+        args[i].first_key = i * 16;
+        args[i].ntask = NTASK;
+        ASSERT_EQ(0, bthread_start_background(
+                      &th[i], NULL, produce_keyed_tasks, &args[i]));
+    }
+    for (int i = 0; i < NPRODUCER; ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+    }
+    ASSERT_EQ(0, q.stop());
+    ASSERT_EQ(0, q.join());
+    ASSERT_NE(0, q.execute(0, t));
+    ASSERT_FALSE(r.out_of_order);
+    ASSERT_EQ(NPRODUCER * NTASK, r.nexecuted.load());
+    ASSERT_EQ(8, r.nstopped.load());
+}
+
 } // namespace
@@ -0,0 +1,99 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include "butil/files/temp_file.h"
+#include "bthread/bthread.h"
+#include "bthread/file.h"
+
+namespace {
+
+const size_t BLOCK_SIZE = 4096;
+const int NBTHREAD = 16;
+
+struct FileArg {
+    int fd;
+    int index;
+    int rc;
+};
+
+// Write a block filled with `index' at block `index', then read it back.
+void* write_and_read(void* void_arg) {
+    FileArg* arg = static_cast<FileArg*>(void_arg);
+    char buf[BLOCK_SIZE];
+    memset(buf, 'a' + arg->index, sizeof(buf));
+    const off_t offset = arg->index * BLOCK_SIZE;
+    if (bthread::file::pwrite(arg->fd, buf, sizeof(buf), offset)
+        != (ssize_t)sizeof(buf)) {
+        arg->rc = errno;
+        return NULL;
+    }
+    if (bthread::file::fsync(arg->fd) != 0) {
+        arg->rc = errno;
+        return NULL;
+    }
+    char buf2[BLOCK_SIZE];
+    if (bthread::file::pread(arg->fd, buf2, sizeof(buf2), offset)
+        != (ssize_t)sizeof(buf2)) {
+        arg->rc = errno;
+        return NULL;
+    }
+    arg->rc = (memcmp(buf, buf2, sizeof(buf)) == 0 ? 0 : -1);
+    return NULL;
+}
+
+TEST(BthreadFileTest, read_write_in_bthreads) {
+    butil::TempFile tmp;
+    const int fd = open(tmp.fname(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    FileArg args[NBTHREAD];
+    bthread_t th[NBTHREAD];
+    for (int i = 0; i < NBTHREAD; ++i) {
+        args[i].fd = fd;
+        args[i].index = i;
+        args[i].rc = -1;
+        ASSERT_EQ(0, bthread_start_background(&th[i], NULL, write_and_read, &args[i]));
+    }
+    for (int i = 0; i < NBTHREAD; ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+        ASSERT_EQ(0, args[i].rc) << "index=" << i;
+    }
+    // Called outside bthreads.
+    char buf[BLOCK_SIZE];
+    ASSERT_EQ((ssize_t)sizeof(buf),
+              bthread::file::pread(fd, buf, sizeof(buf), 3 * BLOCK_SIZE));
+    ASSERT_EQ('d', buf[0]);
+    close(fd);
+}
+
+void* read_bad_fd(void* arg) {
+    char buf[16];
+    const ssize_t rc = bthread::file::pread(-1, buf, sizeof(buf), 0);
+    *static_cast<int*>(arg) = (rc < 0 ? errno : 0);
+    return NULL;
+}
+
+TEST(BthreadFileTest, errno_is_kept) {
+    int err = 0;
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_background(&th, NULL, read_bad_fd, &err));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(EBADF, err);
+}
+
+}  // namespace
@@ -238,6 +238,65 @@ TEST(BthreadIdTest, id_lock) {
     }
 }
 
+struct CountingArg {
+    bthread_id_t id;
+    int64_t counter;  // modified with the id locked
+    butil::atomic<int64_t> nlocked;
+};
+
+// Mix bthread_id_lock, bthread_id_trylock and bthread_id_error, which lock
+// the id either without the mutex or with it.
+static void* counting_locker(void* void_arg) {
+    CountingArg* arg = (CountingArg*)void_arg;
+    for (int i = 0; i < 10000; ++i) {
+        void* data = NULL;
+        if (i % 3 == 0) {
+            if (bthread_id_trylock(arg->id, &data) != 0) {
+                continue;
+            }
+        } else {
+            EXPECT_EQ(0, bthread_id_lock(arg->id, &data));
+        }
+        EXPECT_EQ(arg, data);
+        ++arg->counter;
+        EXPECT_EQ(0, bthread_id_unlock(arg->id));
+        arg->nlocked.fetch_add(1, butil::memory_order_relaxed);
+    }
+    return NULL;
+}
+
+static int counting_on_error(bthread_id_t id, void* data, int) {
+    ++((CountingArg*)data)->counter;
+    return bthread_id_unlock(id);
+}
+
+TEST(BthreadIdTest, lock_without_mutex) {
+    CountingArg arg;
+    arg.counter = 0;
+    arg.nlocked.store(0, butil::memory_order_relaxed);
+    ASSERT_EQ(0, bthread_id_create(&arg.id, &arg, counting_on_error));
+    bthread_t th[8];
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, bthread_start_background(&th[i], NULL, counting_locker, &arg));
+    }
+    int64_t nerror = 0;
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQ(0, bthread_id_error(arg.id, EINVAL));
+        ++nerror;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+    }
+    void* data = NULL;
+    ASSERT_EQ(0, bthread_id_lock(arg.id, &data));
+    ASSERT_EQ(&arg, data);
+    ASSERT_EQ(nerror + arg.nlocked.load(butil::memory_order_relaxed),
+              arg.counter);
+    ASSERT_EQ(0, bthread_id_unlock_and_destroy(arg.id));
+    ASSERT_EQ(EINVAL, bthread_id_lock(arg.id, NULL));
+    ASSERT_EQ(EINVAL, bthread_id_trylock(arg.id, NULL));
+}
+
 static void* failed_locker(void* arg) {
     bthread_id_t id = { (uintptr_t)arg };
     int rc = bthread_id_lock(id, NULL);
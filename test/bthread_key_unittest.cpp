@@ -564,6 +564,72 @@ TEST(KeyTest, borrow_and_return_keytable_when_using_pool) {
     ASSERT_EQ(0, bthread_keytable_pool_destroy(&test_pool));
 }
 
+butil::atomic<int> ncycle_data_created(0);
+butil::atomic<int> ncycle_data_destroyed(0);
+
+struct CycleData {
+    bthread_key_t key;
+    bthread_attr_t attr;
+    butil::atomic<bool> stop;
+};
+
+static void cycle_dtor(void*) {
+    ncycle_data_destroyed.fetch_add(1, butil::memory_order_relaxed);
+}
+
+static void* set_key_thread(void* arg) {
+    ncycle_data_created.fetch_add(1, butil::memory_order_relaxed);
+    EXPECT_EQ(0, bthread_setspecific(*(bthread_key_t*)arg, (void*)1));
+    return NULL;
+}
+
+static void* spawn_thread(void* arg) {
+    CycleData* data = (CycleData*)arg;
+    while (!data->stop.load(butil::memory_order_relaxed)) {
+        // Borrows a KeyTable from the pool and returns it at exit.
+        bthread_t th;
+        if (bthread_start_urgent(&th, &data->attr, set_key_thread,
+                                 &data->key) == 0) {
+            bthread_join(th, NULL);
+        }
+    }
+    return NULL;
+}
+
+TEST(KeyTest, destroy_pools_being_used) {
+    bthread_key_t key;
+    ASSERT_EQ(0, bthread_key_create(&key, cycle_dtor));
+    for (int cycle = 0; cycle < 20; ++cycle) {
+        bthread_keytable_pool_t pool;
+        ASSERT_EQ(0, bthread_keytable_pool_init(&pool));
+        CycleData data;
+        data.key = key;
+        ASSERT_EQ(0, bthread_attr_init(&data.attr));
+        data.attr.keytable_pool = &pool;
+        data.stop.store(false);
+        bthread_t th[4];
+        for (size_t i = 0; i < arraysize(th); ++i) {
+            ASSERT_EQ(0, bthread_start_background(&th[i], NULL,
+                                                  spawn_thread, &data));
+        }
+        usleep(5000);
+        ASSERT_EQ(0, bthread_keytable_pool_destroy(&pool));
+        // Thread-local lists are deleted.
+        ASSERT_TRUE(pool.list == NULL);
+        ASSERT_EQ(0, bthread_keytable_pool_size(&pool));
+        // KeyTables are neither cached nor leaked after the destruction.
+        usleep(2000);
+        data.stop.store(true);
+        for (size_t i = 0; i < arraysize(th); ++i) {
+            ASSERT_EQ(0, bthread_join(th[i], NULL));
+        }
+        ASSERT_EQ(0, bthread_keytable_pool_size(&pool));
+    }
+    ASSERT_GT(ncycle_data_created.load(), 0);
+    ASSERT_EQ(ncycle_data_created.load(), ncycle_data_destroyed.load());
+    ASSERT_EQ(0, bthread_key_delete(key));
+}
+
 // NOTE: lid is short for 'lock in dtor'.
 butil::atomic<size_t> lid_seq(1);
 std::vector<size_t> lid_seqs;
@@ -617,4 +683,43 @@ TEST(KeyTest, use_bthread_mutex_in_dtor) {
     ASSERT_EQ(0, bthread_mutex_destroy(&mu));
 }
 
+static void* static_local_thread(void* arg) {
+    const intptr_t v = (intptr_t)arg;
+    // Slots of a new bthread are always clear.
+    for (int i = 0; i < BTHREAD_STATIC_LOCAL_SLOTS; ++i) {
+        EXPECT_TRUE(bthread_get_static_local(i) == NULL);
+    }
+    for (int i = 0; i < BTHREAD_STATIC_LOCAL_SLOTS; ++i) {
+        EXPECT_EQ(0, bthread_set_static_local(i, (void*)(v + i)));
+    }
+    bthread_usleep(1000);
+    for (int i = 0; i < BTHREAD_STATIC_LOCAL_SLOTS; ++i) {
+        EXPECT_EQ((void*)(v + i), bthread_get_static_local(i));
+    }
+    return NULL;
+}
+
+TEST(KeyTest, static_local_slots) {
+    ASSERT_EQ(EINVAL, bthread_set_static_local(-1, NULL));
+    ASSERT_EQ(EINVAL, bthread_set_static_local(BTHREAD_STATIC_LOCAL_SLOTS,
+                                               NULL));
+    ASSERT_TRUE(bthread_get_static_local(BTHREAD_STATIC_LOCAL_SLOTS) == NULL);
+    // pthread-local.
+    ASSERT_EQ(0, bthread_set_static_local(0, (void*)1));
+    ASSERT_EQ((void*)1, bthread_get_static_local(0));
+    for (int round = 0; round < 3; ++round) {
+        bthread_t th[16];
+        for (size_t i = 0; i < arraysize(th); ++i) {
+            ASSERT_EQ(0, bthread_start_background(
+                          &th[i], NULL, static_local_thread,
+                          (void*)(intptr_t)((i + 1) * 100)));
+        }
+        for (size_t i = 0; i < arraysize(th); ++i) {
+            ASSERT_EQ(0, bthread_join(th[i], NULL));
+        }
+    }
+    ASSERT_EQ((void*)1, bthread_get_static_local(0));
+    ASSERT_EQ(0, bthread_set_static_local(0, NULL));
+}
+
 }  // namespace
@@ -27,6 +27,10 @@
 #include "bthread/mutex.h"
 #include "gperftools_helper.h"
 
+namespace bthread {
+DECLARE_int32(bthread_mutex_max_spin);
+}
+
 namespace {
 inline unsigned* get_butex(bthread_mutex_t & m) {
     return m.butex;
@@ -240,6 +244,43 @@ TEST(MutexTest, performance) {
     PerfTest(&bth_mutex, (bthread_t*)NULL, thread_num, bthread_start_background, bthread_join);
 }
 
+struct SpinArgs {
+    bthread::Mutex* mutex;
+    int64_t* counter;
+};
+
+void* add_many_with_mutex(void* void_arg) {
+    SpinArgs* args = (SpinArgs*)void_arg;
+    for (int i = 0; i < 100000; ++i) {
+        BAIDU_SCOPED_LOCK(*args->mutex);
+        ++*args->counter;
+    }
+    return NULL;
+}
+
+TEST(MutexTest, adaptive_spin) {
+    const int32_t saved_max_spin = bthread::FLAGS_bthread_mutex_max_spin;
+    bthread::FLAGS_bthread_mutex_max_spin = 100;
+    bthread::Mutex m;
+    int64_t counter = 0;
+    SpinArgs args = { &m, &counter };
+    const int N = 8;
+    bthread_t th[N];
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_start_background(
+                      &th[i], NULL, add_many_with_mutex, &args));
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+    }
+    bthread::FLAGS_bthread_mutex_max_spin = saved_max_spin;
+    ASSERT_EQ(N * 100000L, counter);
+    LOG(INFO) << "spin_hit="
+              << bvar::Variable::describe_exposed("bthread_mutex_spin_hit")
+              << " spin_miss="
+              << bvar::Variable::describe_exposed("bthread_mutex_spin_miss");
+}
+
 template <typename Mutex>
 void* loop_until_stopped(void* arg) {
     auto m = (Mutex*)arg;
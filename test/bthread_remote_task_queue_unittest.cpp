@@ -0,0 +1,134 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <gtest/gtest.h>
+#include "butil/macros.h"
+#include "bthread/remote_task_queue.h"
+
+namespace {
+
+TEST(RemoteTaskQueueTest, full) {
+    bthread::RemoteTaskQueue q;
+    ASSERT_EQ(0, q.init(5));
+    ASSERT_EQ(8u, q.capacity());
+    bthread_t task;
+    ASSERT_FALSE(q.pop(&task));
+    for (bthread_t i = 0; i < 8; ++i) {
+        ASSERT_TRUE(q.push(i));
+    }
+    ASSERT_FALSE(q.push(8));
+    ASSERT_TRUE(q.pop(&task));
+    ASSERT_EQ(0u, task);
+    ASSERT_TRUE(q.push(8));
+    ASSERT_FALSE(q.push(9));
+    for (bthread_t i = 1; i <= 8; ++i) {
+        ASSERT_TRUE(q.pop(&task));
+        ASSERT_EQ(i, task);
+    }
+    ASSERT_FALSE(q.pop(&task));
+}
+
+TEST(RemoteTaskQueueTest, wraparound) {
+    bthread::RemoteTaskQueue q;
+    ASSERT_EQ(0, q.init(4));
+    bthread_t next_push = 0;
+    bthread_t next_pop = 0;
+    // Positions go around the ring many times with the queue partially
+    // filled, so that cells are reused at different offsets.
+    for (int round = 0; round < 10000; ++round) {
+        const int npush = round % 4 + 1;
+        for (int i = 0; i < npush; ++i) {
+            if (q.push(next_push)) {
+                ++next_push;
+            } else {
+                ASSERT_EQ(q.capacity(), next_push - next_pop);
+            }
+        }
+        const int npop = (round + 1) % 4 + 1;
+        for (int i = 0; i < npop; ++i) {
+            bthread_t task;
+            if (q.pop(&task)) {
+                ASSERT_EQ(next_pop, task);
+                ++next_pop;
+            } else {
+                ASSERT_EQ(next_push, next_pop);
+            }
+        }
+    }
+    bthread_t task;
+    while (q.pop(&task)) {
+        ASSERT_EQ(next_pop, task);
+        ++next_pop;
+    }
+    ASSERT_EQ(next_push, next_pop);
+    ASSERT_GT(next_pop, 10 * q.capacity());
+}
+
+const bthread_t NPUSH_PER_THREAD = 100000;
+
+struct PushArg {
+    bthread::RemoteTaskQueue* q;
+    bthread_t id;
+};
+
+void* push_thread(void* void_arg) {
+    PushArg* arg = (PushArg*)void_arg;
+    for (bthread_t i = 0; i < NPUSH_PER_THREAD; ) {
+        if (arg->q->push((arg->id << 32) | i)) {
+            ++i;
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+TEST(RemoteTaskQueueTest, many_producers_one_consumer) {
+    bthread::RemoteTaskQueue q;
+    ASSERT_EQ(0, q.init(64));
+    pthread_t th[8];
+    PushArg args[ARRAY_SIZE(th)];
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        args[i].q = &q;
+        args[i].id = i;
+        ASSERT_EQ(0, pthread_create(&th[i], NULL, push_thread, &args[i]));
+    }
+    // Tasks of one producer are popped in the order they were pushed.
+    bthread_t next[ARRAY_SIZE(th)] = {};
+    size_t npopped = 0;
+    while (npopped < ARRAY_SIZE(th) * NPUSH_PER_THREAD) {
+        bthread_t task;
+        if (!q.pop(&task)) {
+            sched_yield();
+            continue;
+        }
+        const bthread_t id = task >> 32;
+        ASSERT_LT(id, ARRAY_SIZE(th));
+        ASSERT_EQ(next[id], (task & 0xFFFFFFFF));
+        ++next[id];
+        ++npopped;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        pthread_join(th[i], NULL);
+        ASSERT_EQ(NPUSH_PER_THREAD, next[i]);
+    }
+    bthread_t task;
+    ASSERT_FALSE(q.pop(&task));
+}
+
+} // namespace
@@ -206,6 +206,99 @@ TEST(RWLockTest, cpp_wrapper) {
     }
 }
 
+TEST(RWLockTest, distributed_sanity) {
+    bthread::DistributedRWLock rw;
+    ASSERT_TRUE(rw.try_rdlock());
+    ASSERT_TRUE(rw.try_rdlock());
+    ASSERT_FALSE(rw.try_wrlock());
+    rw.unlock();
+    rw.unlock();
+    ASSERT_TRUE(rw.try_wrlock());
+    ASSERT_FALSE(rw.try_rdlock());
+    ASSERT_FALSE(rw.try_wrlock());
+    rw.unlock();
+    rw.rdlock();
+    rw.unlock();
+    rw.wrlock();
+    rw.unlock();
+
+    struct timespec t = { -2, 0 };
+    ASSERT_TRUE(rw.timed_rdlock(&t));
+    ASSERT_FALSE(rw.timed_wrlock(&t));
+    rw.unlock();
+    ASSERT_TRUE(rw.timed_wrlock(&t));
+    ASSERT_FALSE(rw.timed_rdlock(&t));
+    rw.unlock();
+    // A failed writer must not block readers.
+    ASSERT_TRUE(rw.try_rdlock());
+    rw.unlock();
+
+    {
+        std::lock_guard<bthread::DistributedRWLock> guard(rw, true);
+    }
+    {
+        std::lock_guard<bthread::DistributedRWLock> guard(rw, false);
+    }
+}
+
+struct DistributedArgs {
+    bthread::DistributedRWLock* rw;
+    int64_t* values;
+    bool* stop;
+    int64_t counter;
+};
+
+// Writers keep all values equal, which readers verify.
+void* distributed_reader(void* arg) {
+    DistributedArgs* a = (DistributedArgs*)arg;
+    while (!*a->stop) {
+        std::lock_guard<bthread::DistributedRWLock> guard(*a->rw, true);
+        EXPECT_EQ(a->values[0], a->values[1]);
+        ++a->counter;
+    }
+    return NULL;
+}
+
+void* distributed_writer(void* arg) {
+    DistributedArgs* a = (DistributedArgs*)arg;
+    while (!*a->stop) {
+        std::lock_guard<bthread::DistributedRWLock> guard(*a->rw, false);
+        ++a->values[0];
+        bthread_usleep(10);
+        ++a->values[1];
+        ++a->counter;
+    }
+    return NULL;
+}
+
+TEST(RWLockTest, distributed_readers_and_writers) {
+    bthread::DistributedRWLock rw;
+    int64_t values[2] = { 0, 0 };
+    bool stop = false;
+    const int N = 8;
+    bthread_t th[N];
+    DistributedArgs args[N];
+    for (int i = 0; i < N; ++i) {
+        args[i] = { &rw, values, &stop, 0 };
+        ASSERT_EQ(0, bthread_start_background(
+            &th[i], NULL, (i < 2 ? distributed_writer : distributed_reader),
+            &args[i]));
+    }
+    usleep(500 * 1000);
+    stop = true;
+    int64_t write_count = 0;
+    int64_t read_count = 0;
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+        (i < 2 ? write_count : read_count) += args[i].counter;
+    }
+    ASSERT_EQ(write_count, values[0]);
+    ASSERT_EQ(write_count, values[1]);
+    ASSERT_GT(write_count, 0);
+    ASSERT_GT(read_count, 0);
+    LOG(INFO) << "write_count=" << write_count << " read_count=" << read_count;
+}
+
 bool g_started = false;
 bool g_stopped = false;
 
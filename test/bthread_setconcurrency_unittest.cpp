@@ -29,6 +29,7 @@
 
 namespace bthread {
     extern TaskControl* g_task_control;
+    DECLARE_int32(bthread_max_spin_us);
 }
 
 namespace {
@@ -222,4 +223,103 @@ TEST(BthreadTest, concurrency_by_tag) {
     ASSERT_EQ(concurrency_by_tag(con + 1), true);
 }
 
+butil::atomic<int> g_nran(0);
+
+void* count_proc(void*) {
+    g_nran.fetch_add(1, butil::memory_order_relaxed);
+    return NULL;
+}
+
+const int NTASK_PER_PRODUCER = 20000;
+
+void* produce_from_pthread(void*) {
+    for (int i = 0; i < NTASK_PER_PRODUCER; ++i) {
+        bthread_t th;
+        EXPECT_EQ(0, bthread_start_background(&th, NULL, count_proc, NULL));
+        if (i % 100 == 0) {
+            usleep(100);
+        }
+    }
+    return NULL;
+}
+
+TEST(BthreadTest, park_and_unpark_workers_while_signaling) {
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, dummy, NULL));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    bthread::TaskControl* c = bthread::g_task_control;
+    const bthread_tag_t tag = BTHREAD_TAG_DEFAULT;
+    const int concurrency = c->concurrency(tag);
+    ASSERT_GT(concurrency, 1);
+
+    g_nran.store(0);
+    const int NPRODUCER = 4;
+    pthread_t producers[NPRODUCER];
+    for (int i = 0; i < NPRODUCER; ++i) {
+        ASSERT_EQ(0, pthread_create(&producers[i], NULL,
+                                    produce_from_pthread, NULL));
+    }
+    // Move workers out of and back into the tag while tasks are being
+    // signaled from outside of workers.
+    int nparked = 0;
+    unsigned int seed = 1;
+    for (int i = 0; i < 5000; ++i) {
+        if (nparked < concurrency - 1 && rand_r(&seed) % 2 == 0) {
+            nparked += c->park_one_worker(tag);
+        } else if (nparked > 0) {
+            ASSERT_TRUE(c->unpark_one_worker(tag));
+            --nparked;
+        }
+        usleep(50);
+    }
+    for (int i = 0; i < NPRODUCER; ++i) {
+        pthread_join(producers[i], NULL);
+    }
+    for (; nparked > 0; --nparked) {
+        ASSERT_TRUE(c->unpark_one_worker(tag));
+    }
+
+    const int ntask = NPRODUCER * NTASK_PER_PRODUCER;
+    for (int i = 0; i < 1000 && g_nran.load() != ntask; ++i) {
+        usleep(10000);
+    }
+    ASSERT_EQ(ntask, g_nran.load());
+    // Every parked worker rejoins the tag.
+    for (int i = 0; i < 1000 &&
+             c->_tagged_nparked[tag].load(butil::memory_order_relaxed) != 0;
+         ++i) {
+        usleep(10000);
+    }
+    ASSERT_EQ(0, c->_tagged_nparked[tag].load(butil::memory_order_relaxed));
+    ASSERT_GE((int)c->tag_ngroup(tag).load(butil::memory_order_relaxed),
+              concurrency);
+}
+
+TEST(BthreadTest, park_after_spinning_and_wake_by_remote_signal) {
+    const int32_t saved_max_spin_us = bthread::FLAGS_bthread_max_spin_us;
+    bthread::FLAGS_bthread_max_spin_us = 1000;
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, dummy, NULL));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    bthread::TaskControl* c = bthread::g_task_control;
+    for (int i = 0; i < 20; ++i) {
+        // Idle for much longer than the spinning budget, so that every
+        // worker sleeps.
+        usleep(20000);
+        const int64_t npark = c->get_cumulated_park_count();
+        // Signaled from outside of workers, a sleeping worker wakes up to
+        // run the task.
+        ASSERT_EQ(0, bthread_start_background(&th, NULL, dummy, NULL));
+        ASSERT_EQ(0, bthread_join(th, NULL));
+        // The woken worker spins no longer than the budget and sleeps again.
+        int64_t new_npark = npark;
+        for (int j = 0; j < 100 && new_npark == npark; ++j) {
+            usleep(1000);
+            new_npark = c->get_cumulated_park_count();
+        }
+        ASSERT_GT(new_npark, npark);
+    }
+    bthread::FLAGS_bthread_max_spin_us = saved_max_spin_us;
+}
+
 } // namespace
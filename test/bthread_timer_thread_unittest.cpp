@@ -254,4 +254,52 @@ TEST(TimerThreadTest, schedule_and_unschedule_in_task) {
     keeper5.expect_first_run();
 }
 
+void count_runs(void* arg) {
+    static_cast<butil::atomic<int>*>(arg)->fetch_add(1);
+}
+
+TEST(TimerThreadTest, run_tasks_with_wheel) {
+    bthread::TimerThread timer_thread;
+    bthread::TimerThreadOptions options;
+    options.wheel_tick_us = 1000;
+    ASSERT_EQ(0, timer_thread.start(&options));
+
+    timespec past_time = { 0, 0 };
+    timespec future_time = { std::numeric_limits<int>::max(), 0 };
+    // In different levels of the wheel.
+    TimeKeeper keeper1(butil::milliseconds_from_now(100), "keeper1");
+    TimeKeeper keeper2(butil::milliseconds_from_now(1200), "keeper2");
+    TimeKeeper keeper3(butil::milliseconds_from_now(1500), "keeper3");
+    TimeKeeper keeper4(future_time, "keeper4");
+    TimeKeeper keeper5(past_time, "keeper5");
+    keeper1.schedule(&timer_thread);
+    keeper2.schedule(&timer_thread);
+    keeper3.schedule(&timer_thread);
+    keeper4.schedule(&timer_thread);
+    keeper5.schedule(&timer_thread);
+    const timespec keeper5_addtime = butil::seconds_from_now(0);
+    ASSERT_EQ(0, timer_thread.unschedule(keeper3._task_id));
+
+    butil::atomic<int> nrun(0);
+    std::vector<bthread::TimerThread::TaskId> ids;
+    for (int i = 0; i < 1000; ++i) {
+        ids.push_back(timer_thread.schedule(
+            count_runs, &nrun, butil::milliseconds_from_now(i % 500)));
+    }
+    int nunscheduled = 0;
+    for (size_t i = 0; i < ids.size(); i += 2) {
+        nunscheduled += (timer_thread.unschedule(ids[i]) == 0);
+    }
+
+    sleep(2);
+    timer_thread.stop_and_join();
+
+    keeper1.expect_first_run();
+    keeper2.expect_first_run();
+    keeper3.expect_not_run();
+    keeper4.expect_not_run();
+    keeper5.expect_first_run(keeper5_addtime);
+    ASSERT_EQ(1000 - nunscheduled, nrun.load());
+}
+
 } // end namespace
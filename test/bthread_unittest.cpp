@@ -24,6 +24,7 @@
 #include "bthread/bthread.h"
 #include "bthread/unstable.h"
 #include "bthread/task_meta.h"
+#include "bvar/variable.h"
 
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
@@ -32,8 +33,15 @@ int main(int argc, char* argv[]) {
     return rc;
 }
 
+DECLARE_int32(stack_trim_watermark);
+
 namespace bthread {
 extern __thread bthread::LocalStorage tls_bls;
+DECLARE_int32(bthread_time_slice_us);
+DECLARE_int32(bthread_sched_latency_sample_ratio);
+DECLARE_bool(bthread_enable_cpu_clock_stat);
+extern void print_long_running_tasks(std::ostream& os, int64_t threshold_ms,
+                                     bool enable_trace);
 #ifdef BRPC_BTHREAD_TRACER
 extern std::string stack_trace(bthread_t tid);
 #endif // BRPC_BTHREAD_TRACER
@@ -616,6 +624,89 @@ TEST_F(BthreadTest, too_many_nosignal_threads) {
     }
 }
 
+void* add_one(void* arg) {
+    static_cast<butil::atomic<int>*>(arg)->fetch_add(1);
+    return NULL;
+}
+
+void* batch_starter(void* arg) {
+    butil::atomic<int>* counter = static_cast<butil::atomic<int>*>(arg);
+    const size_t N = 100;
+    bthread_t th[N];
+    void* args[N];
+    for (size_t i = 0; i < N; ++i) {
+        args[i] = counter;
+    }
+    EXPECT_EQ(0, bthread_start_batch(th, N, NULL, add_one, args));
+    for (size_t i = 0; i < N; ++i) {
+        EXPECT_EQ(0, bthread_join(th[i], NULL));
+    }
+    return NULL;
+}
+
+TEST_F(BthreadTest, start_batch) {
+    const size_t N = 100;
+    bthread_t th[N];
+    butil::atomic<int> counter(0);
+    void* args[N];
+    for (size_t i = 0; i < N; ++i) {
+        args[i] = &counter;
+    }
+    ASSERT_EQ(EINVAL, bthread_start_batch(th, N, NULL, NULL, args));
+    ASSERT_EQ(0, bthread_start_batch(th, 0, NULL, add_one, args));
+
+    // From non-worker.
+    ASSERT_EQ(0, bthread_start_batch(th, N, NULL, add_one, args));
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_NE(INVALID_BTHREAD, th[i]);
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+    }
+    ASSERT_EQ((int)N, counter.load());
+
+    // From worker.
+    bthread_t starter;
+    ASSERT_EQ(0, bthread_start_urgent(&starter, NULL, batch_starter, &counter));
+    ASSERT_EQ(0, bthread_join(starter, NULL));
+    ASSERT_EQ(2 * (int)N, counter.load());
+
+    // NOSIGNAL tasks run after bthread_flush().
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL | BTHREAD_NOSIGNAL;
+    ASSERT_EQ(0, bthread_start_batch(th, N, &attr, dummy_thread, NULL));
+    bthread_flush();
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+    }
+}
+
+void* use_deep_stack(void*) {
+    // Touch most of the normal stack(1MB by default).
+    char buf[512 * 1024];
+    memset(buf, 1, sizeof(buf));
+    asm volatile("" : : "r"(buf) : "memory");
+    return NULL;
+}
+
+TEST_F(BthreadTest, trim_deep_stack) {
+    const int32_t saved_watermark = FLAGS_stack_trim_watermark;
+    FLAGS_stack_trim_watermark = 64 * 1024;
+    std::string released;
+    for (int i = 0; i < 100 && released.empty(); ++i) {
+        bthread_t th;
+        ASSERT_EQ(0, bthread_start_background(&th, NULL, use_deep_stack, NULL));
+        ASSERT_EQ(0, bthread_join(th, NULL));
+        usleep(1000);
+        const std::string count =
+            bvar::Variable::describe_exposed("bthread_stack_trim_count");
+        if (count != "0") {
+            released = bvar::Variable::describe_exposed(
+                "bthread_normal_stack_released_rss");
+        }
+    }
+    FLAGS_stack_trim_watermark = saved_watermark;
+    ASSERT_FALSE(released.empty());
+    ASSERT_NE("0", released);
+}
+
 static void* yield_thread(void*) {
     bthread_yield();
     return NULL;
@@ -627,6 +718,119 @@ TEST_F(BthreadTest, yield_single_thread) {
     ASSERT_EQ(0, bthread_join(tid, NULL));
 }
 
+static void* spin_and_check_should_yield(void* arg) {
+    // Haven't run out of the time slice.
+    EXPECT_EQ(0, bthread_should_yield());
+    const int64_t start_us = butil::gettimeofday_us();
+    while (butil::gettimeofday_us() < start_us + 10000L) {}
+    // Queue a bthread on this worker without waking up other workers.
+    bthread_t th;
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL | BTHREAD_NOSIGNAL;
+    EXPECT_EQ(0, bthread_start_background(&th, &attr, dummy_thread, NULL));
+    *(int*)arg = bthread_should_yield();
+    bthread_flush();
+    EXPECT_EQ(0, bthread_yield());
+    EXPECT_EQ(0, bthread_join(th, NULL));
+    return NULL;
+}
+
+TEST_F(BthreadTest, should_yield) {
+    ASSERT_EQ(0, bthread_should_yield());
+    const int32_t saved_time_slice = bthread::FLAGS_bthread_time_slice_us;
+    bthread::FLAGS_bthread_time_slice_us = 5000;
+    int should_yield = 0;
+    // The queued bthread may be stolen by other workers, retry in which case.
+    for (int i = 0; i < 20 && !should_yield; ++i) {
+        bthread_t th;
+        ASSERT_EQ(0, bthread_start_urgent(&th, NULL, spin_and_check_should_yield,
+                                          &should_yield));
+        ASSERT_EQ(0, bthread_join(th, NULL));
+    }
+    bthread::FLAGS_bthread_time_slice_us = saved_time_slice;
+    ASSERT_EQ(1, should_yield);
+}
+
+static butil::atomic<bool> spin_started(false);
+static butil::atomic<bool> spin_stopped(false);
+
+static void* spin_until_stopped(void*) {
+    spin_started = true;
+    while (!spin_stopped) {}
+    return NULL;
+}
+
+TEST_F(BthreadTest, print_long_running_tasks) {
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_background(&th, NULL, spin_until_stopped, NULL));
+    while (!spin_started) {
+        usleep(1000);
+    }
+    usleep(20000);
+    std::ostringstream os;
+    bthread::print_long_running_tasks(os, 10, false);
+    spin_stopped = true;
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    std::ostringstream expected;
+    expected << "bthread=" << th << " has been running for ";
+    ASSERT_NE(std::string::npos, os.str().find(expected.str())) << os.str();
+}
+
+TEST_F(BthreadTest, sched_latency) {
+    const int saved_ratio = bthread::FLAGS_bthread_sched_latency_sample_ratio;
+    bthread::FLAGS_bthread_sched_latency_sample_ratio = 1;
+    for (int i = 0; i < 100; ++i) {
+        bthread_t th;
+        ASSERT_EQ(0, bthread_start_background(&th, NULL, do_nothing, NULL));
+        ASSERT_EQ(0, bthread_join(th, NULL));
+    }
+    bthread::FLAGS_bthread_sched_latency_sample_ratio = saved_ratio;
+    // Read the breakdown first since workers may still be scheduling.
+    const int64_t local = atoll(
+        bvar::Variable::describe_exposed("bthread_sched_local_0_count").c_str());
+    const int64_t stolen = atoll(
+        bvar::Variable::describe_exposed("bthread_sched_stolen_0_count").c_str());
+    const int64_t count = atoll(
+        bvar::Variable::describe_exposed("bthread_sched_0_count").c_str());
+    ASSERT_GE(local + stolen, 100);
+    ASSERT_GE(count, local + stolen);
+}
+
+static int64_t sched_remote_count() {
+    return atoll(bvar::Variable::describe_exposed(
+                     "bthread_sched_remote_0_count").c_str());
+}
+
+static void* start_local_bthreads(void*) {
+    for (int i = 0; i < 100; ++i) {
+        bthread_t th;
+        EXPECT_EQ(0, bthread_start_background(&th, NULL, do_nothing, NULL));
+        EXPECT_EQ(0, bthread_join(th, NULL));
+    }
+    return NULL;
+}
+
+TEST_F(BthreadTest, sched_remote_latency) {
+    const int saved_ratio = bthread::FLAGS_bthread_sched_latency_sample_ratio;
+    bthread::FLAGS_bthread_sched_latency_sample_ratio = 1;
+    // Bthreads started by this pthread are queued remotely.
+    const int64_t before_remote = sched_remote_count();
+    for (int i = 0; i < 100; ++i) {
+        bthread_t th;
+        ASSERT_EQ(0, bthread_start_background(&th, NULL, do_nothing, NULL));
+        ASSERT_EQ(0, bthread_join(th, NULL));
+    }
+    const int64_t after_remote = sched_remote_count();
+    ASSERT_EQ(100, after_remote - before_remote);
+
+    // Bthreads started by a worker are not, except the worker's one.
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_background(
+                  &th, NULL, start_local_bthreads, NULL));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    bthread::FLAGS_bthread_sched_latency_sample_ratio = saved_ratio;
+    ASSERT_EQ(1, sched_remote_count() - after_remote);
+}
+
 #ifdef BRPC_BTHREAD_TRACER
 void spin_and_log_trace() {
     bool ok = false;
@@ -692,4 +896,37 @@ TEST_F(BthreadTest, trace) {
 }
 #endif // BRPC_BTHREAD_TRACER
 
+static __thread uint64_t tls_fake_allocated_bytes = 0;
+
+static uint64_t fake_thread_allocated_bytes() {
+    return tls_fake_allocated_bytes;
+}
+
+static void* allocate_and_yield(void* arg) {
+    for (int i = 0; i < 100; ++i) {
+        tls_fake_allocated_bytes += 10;
+        // May be stolen by other workers.
+        bthread_yield();
+    }
+    *(uint64_t*)arg = bthread_allocated_bytes();
+    return NULL;
+}
+
+TEST_F(BthreadTest, allocated_bytes_follow_bthread) {
+    bthread::FLAGS_bthread_enable_cpu_clock_stat = true;
+    bthread_set_thread_allocated_bytes_fn(fake_thread_allocated_bytes);
+    bthread_t th[8];
+    uint64_t allocated[ARRAY_SIZE(th)];
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, bthread_start_background(
+                      &th[i], NULL, allocate_and_yield, &allocated[i]));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+        ASSERT_EQ(1000u, allocated[i]);
+    }
+    bthread_set_thread_allocated_bytes_fn(NULL);
+    bthread::FLAGS_bthread_enable_cpu_clock_stat = false;
+}
+
 } // namespace
@@ -0,0 +1,91 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <vector>
+#include <gtest/gtest.h>
+#include "butil/atomicops.h"
+#include "butil/time.h"
+#include "bthread/bthread.h"
+#include "bthread/wait_group.h"
+
+namespace {
+butil::atomic<int> g_nfinished(0);
+
+void* finish(void* arg) {
+    const int sleep_us = *(int*)arg;
+    if (sleep_us > 0) {
+        bthread_usleep(sleep_us);
+    }
+    g_nfinished.fetch_add(1, butil::memory_order_relaxed);
+    return NULL;
+}
+
+TEST(WaitGroupTest, sanity) {
+    bthread::WaitGroup wg;
+    int sleep_us = 0;
+    for (int n = 1; n < 50; ++n) {
+        g_nfinished.store(0, butil::memory_order_relaxed);
+        sleep_us = (n % 2 ? 0 : 1000);
+        for (int i = 0; i < n; ++i) {
+            ASSERT_EQ(0, wg.start(finish, &sleep_us));
+        }
+        ASSERT_EQ(0, wg.wait());
+        ASSERT_EQ(n, g_nfinished.load(butil::memory_order_relaxed));
+    }
+    // Nothing started.
+    ASSERT_EQ(0, wg.wait());
+}
+
+TEST(WaitGroupTest, wait_in_destructor) {
+    g_nfinished.store(0, butil::memory_order_relaxed);
+    int sleep_us = 10000;
+    {
+        bthread::WaitGroup wg;
+        for (int i = 0; i < 20; ++i) {
+            ASSERT_EQ(0, wg.start(finish, &sleep_us));
+        }
+    }
+    ASSERT_EQ(20, g_nfinished.load(butil::memory_order_relaxed));
+}
+
+void* fan_out(void* arg) {
+    const int n = *(int*)arg;
+    int sleep_us = 0;
+    for (int r = 0; r < 100; ++r) {
+        bthread::WaitGroup wg;
+        for (int i = 0; i < n; ++i) {
+            EXPECT_EQ(0, wg.start(finish, &sleep_us));
+        }
+        EXPECT_EQ(0, wg.wait());
+    }
+    return NULL;
+}
+
+TEST(WaitGroupTest, concurrent_fan_out) {
+    g_nfinished.store(0, butil::memory_order_relaxed);
+    int n = 32;
+    std::vector<bthread_t> tids(8);
+    for (size_t i = 0; i < tids.size(); ++i) {
+        ASSERT_EQ(0, bthread_start_background(&tids[i], NULL, fan_out, &n));
+    }
+    for (size_t i = 0; i < tids.size(); ++i) {
+        ASSERT_EQ(0, bthread_join(tids[i], NULL));
+    }
+    ASSERT_EQ(100 * n * (int)tids.size(),
+              g_nfinished.load(butil::memory_order_relaxed));
+}
+} // namespace
@@ -610,6 +610,55 @@ TEST_F(MultiDimensionTest, labels) {
     TestLabels<std::vector<std::string>, std::array<MyStringView, 3>>();
 }
 
+TEST_F(MultiDimensionTest, handle) {
+    bvar::MultiDimension<bvar::Adder<int> > my_madder("test_handle", labels);
+    bvar::MultiDimension<bvar::Adder<int> >::Handle empty;
+    ASSERT_EQ(nullptr, empty.get());
+
+    std::array<butil::StringPiece, 3> labels_value{"nj", "get", "200"};
+    auto h = my_madder.get_handle(labels_value);
+    bvar::Adder<int>* adder = my_madder.get_stats(labels_value);
+    ASSERT_NE(nullptr, adder);
+    ASSERT_EQ(adder, h.get());
+    *h << 1 << 2;
+    ASSERT_EQ(3, adder->get_value());
+
+    // Deleting any stats makes the handle look up again.
+    my_madder.delete_stats(labels_value);
+    ASSERT_FALSE(my_madder.has_stats(labels_value));
+    bvar::Adder<int>* adder2 = h.get();
+    ASSERT_NE(nullptr, adder2);
+    ASSERT_TRUE(my_madder.has_stats(labels_value));
+    ASSERT_EQ(adder2, my_madder.get_stats(labels_value));
+    ASSERT_EQ(0, adder2->get_value());
+
+    my_madder.clear_stats();
+    auto h2 = my_madder.get_handle({"nj", "get", "200"});
+    ASSERT_NE(nullptr, h2.get());
+    ASSERT_EQ(h2.get(), h.get());
+
+    // Wrong number of labels.
+    auto h3 = my_madder.get_handle(std::list<std::string>{"nj"});
+    ASSERT_EQ(nullptr, h3.get());
+
+    const int N = 1000000;
+    butil::Timer timer;
+    timer.start();
+    for (int i = 0; i < N; ++i) {
+        *my_madder.get_stats(labels_value) << 1;
+    }
+    timer.stop();
+    const int64_t lookup_ns = timer.n_elapsed() / N;
+    timer.start();
+    for (int i = 0; i < N; ++i) {
+        *h2 << 1;
+    }
+    timer.stop();
+    LOG(INFO) << "get_stats takes " << lookup_ns << "ns, handle takes "
+              << timer.n_elapsed() / N << "ns";
+    ASSERT_EQ(2 * N, h2->get_value());
+}
+
 std::array<const char*, 3> g_labels_value{"idc", "post", "200"};
 bool g_shared_stop = false;
 
@@ -199,3 +199,37 @@ TEST_F(MVariableTest, test_describe_exposed) {
     ASSERT_EQ(0, bvar::MVariableBase::describe_exposed(bvar_name, describe_oss));
     ASSERT_STREQ(describe_str.c_str(), describe_oss.str().c_str());
 }
+
+class NameCollector : public bvar::Dumper {
+public:
+    bool dump(const std::string&, const butil::StringPiece&) override {
+        return true;
+    }
+    bool dump_mvar(const std::string& name, const butil::StringPiece&) override {
+        names.push_back(name);
+        return true;
+    }
+    std::vector<std::string> names;
+};
+
+TEST_F(MVariableTest, dump_wildcards) {
+    std::list<std::string> one_label = {"idc"};
+    bvar::MultiDimension<bvar::Adder<int> > madder1("wc_foo_count", one_label);
+    bvar::MultiDimension<bvar::Adder<int> > madder2("wc_bar_count", one_label);
+    *madder1.get_stats({"a"}) << 1;
+    *madder2.get_stats({"b"}) << 2;
+
+    bvar::DumpOptions opts;
+    opts.white_wildcards = "wc_foo_*";
+    NameCollector c1;
+    ASSERT_EQ(1UL, bvar::MVariableBase::dump_exposed(&c1, &opts));
+    ASSERT_EQ(1UL, c1.names.size());
+    ASSERT_EQ("wc_foo_count{idc=\"a\"}", c1.names[0]);
+
+    opts.white_wildcards = "wc_*";
+    opts.black_wildcards = "wc_foo_count";
+    NameCollector c2;
+    ASSERT_EQ(1UL, bvar::MVariableBase::dump_exposed(&c2, &opts));
+    ASSERT_EQ(1UL, c2.names.size());
+    ASSERT_EQ("wc_bar_count{idc=\"b\"}", c2.names[0]);
+}
@@ -22,12 +22,17 @@
 #include <cstddef>
 #include <memory>
 #include <iostream>
+#include <thread>
 #include "butil/time.h"
 #include "butil/macros.h"
 #include "bvar/recorder.h"
 #include "bvar/latency_recorder.h"
 #include <gtest/gtest.h>
 
+namespace bvar {
+DECLARE_bool(bvar_latency_histogram);
+}
+
 namespace {
 #if !WITH_BABYLON_COUNTER
 TEST(RecorderTest, test_complement) {
@@ -255,4 +260,107 @@ TEST(RecorderTest, latency_recorder_qps_accuracy) {
     ASSERT_GT(0.1, read(lr4, 1/3.0, 3));
 }
 
+TEST(RecorderTest, histogram_buckets) {
+    using namespace bvar::detail;
+    ASSERT_EQ(896u, HISTOGRAM_NUM_BUCKETS);
+    for (int64_t v = 0; v < 64; ++v) {
+        ASSERT_EQ((size_t)v, histogram_bucket_of(v));
+    }
+    size_t last = 0;
+    for (int64_t v = 1; v < (1L << 33); v += v / 7 + 1) {
+        const size_t index = histogram_bucket_of(v);
+        ASSERT_LE(last, index);
+        last = index;
+        if (v < (1L << 32)) {
+            ASSERT_LE(histogram_bucket_lower(index), v);
+            ASSERT_GE(histogram_bucket_upper(index), v);
+            // Width of a bucket is at most 1/32 of its values.
+            ASSERT_LE((histogram_bucket_upper(index) -
+                       histogram_bucket_lower(index)) * 32, v);
+        } else {
+            ASSERT_EQ(HISTOGRAM_NUM_BUCKETS - 1, index);
+        }
+    }
+    for (size_t i = 0; i + 1 < HISTOGRAM_NUM_BUCKETS; ++i) {
+        ASSERT_EQ(histogram_bucket_upper(i) + 1, histogram_bucket_lower(i + 1));
+        ASSERT_EQ(i, histogram_bucket_of(histogram_bucket_lower(i)));
+        ASSERT_EQ(i, histogram_bucket_of(histogram_bucket_upper(i)));
+    }
+    ASSERT_EQ((1L << 32) - 1, histogram_bucket_upper(HISTOGRAM_NUM_BUCKETS - 1));
+}
+
+TEST(RecorderTest, latency_histogram) {
+    bvar::detail::LatencyHistogram h;
+    h << 3 << 3 << 100 << -1;
+    bvar::detail::LatencyBuckets b = h.get_value();
+    ASSERT_EQ(3u, b.total());
+    ASSERT_EQ(106u, b.sum);
+    ASSERT_EQ(3, b.get_number(0.5));
+    ASSERT_EQ(100, b.get_number(1));
+    std::ostringstream os;
+    os << b;
+    ASSERT_EQ("3:2 101:3 sum:106", os.str());
+
+    bvar::detail::LatencyBuckets b2 = b;
+    b2 += b;
+    ASSERT_EQ(6u, b2.total());
+    b2 -= b;
+    ASSERT_EQ(0, memcmp(&b, &b2, sizeof(b)));
+}
+
+TEST(RecorderTest, latency_recorder_histogram) {
+    const bool saved = bvar::FLAGS_bvar_latency_histogram;
+    bvar::FLAGS_bvar_latency_histogram = true;
+    bvar::LatencyRecorder lr(2);
+    bvar::FLAGS_bvar_latency_histogram = saved;
+    ASSERT_EQ(0, lr.expose("histogram_test"));
+    for (int64_t i = 1; i <= 100000; ++i) {
+        lr << i;
+    }
+    usleep(1100000);
+    ASSERT_EQ(100000, lr.count());
+    const double ratios[] = { 0.5, 0.9, 0.99, 0.999, 0.9999 };
+    for (size_t i = 0; i < ARRAY_SIZE(ratios); ++i) {
+        const double expected = ratios[i] * 100000;
+        const int64_t actual = lr.latency_percentile(ratios[i]);
+        // Error is bounded by half width of a bucket, within 1/64.
+        ASSERT_LE(fabs(actual - expected), expected / 64)
+            << "ratio=" << ratios[i] << " actual=" << actual;
+    }
+    bvar::Vector<int64_t, 4> p = lr.latency_percentiles();
+    ASSERT_EQ(lr.latency_percentile(0.999), p[3]);
+
+    std::string desc = bvar::Variable::describe_exposed(
+        "histogram_test_latency_histogram");
+    ASSERT_TRUE(butil::StringPiece(desc).ends_with(" sum:5000050000")) << desc;
+}
+
+TEST(RecorderTest, latency_exemplar) {
+    bvar::LatencyRecorder lr(2);
+    ASSERT_EQ(0, lr.expose("exemplar_test"));
+    ASSERT_EQ("0", bvar::Variable::describe_exposed(
+                  "exemplar_test_latency_exemplar"));
+    lr << 1000;
+    lr.record(30, 0xabc);
+    lr.record(50, 0xdef);
+    lr.record(40, 0x123);
+    usleep(1100000);
+    bvar::detail::LatencyExemplar e = lr.latency_exemplar();
+    ASSERT_EQ(50, e.latency);
+    ASSERT_EQ(0xdefu, e.trace_id);
+    ASSERT_GT(e.timestamp_us, 0);
+    ASSERT_EQ(4, lr.count());
+    ASSERT_EQ(1000, lr.max_latency());
+    ASSERT_EQ("50 trace=def", bvar::Variable::describe_exposed(
+                  "exemplar_test_latency_exemplar"));
+    // Exemplars of threads are combined.
+    std::thread t([&lr] { lr.record(60, 0x456); });
+    t.join();
+    usleep(1100000);
+    ASSERT_EQ(0x456u, lr.latency_exemplar().trace_id);
+    // Fade out with the window.
+    usleep(2100000);
+    ASSERT_EQ(0u, lr.latency_exemplar().trace_id);
+}
+
 } // namespace
@@ -18,6 +18,8 @@
 #include <limits>                           //std::numeric_limits
 
 #include "bvar/reducer.h"
+#include "bvar/percpu_reducer.h"
+#include "bvar/detail/series.h"
 
 #include "butil/time.h"
 #include "butil/macros.h"
@@ -184,6 +186,96 @@ TEST_F(ReducerTest, max) {
     ASSERT_EQ(std::numeric_limits<int>::max(), reducer2.get_value());
 }
 
+static void* percpu_add_thread(void* arg) {
+    bvar::PerCpuAdder<int64_t>* reducer = (bvar::PerCpuAdder<int64_t>*)arg;
+    butil::Timer timer;
+    timer.start();
+    for (size_t i = 0; i < OPS_PER_THREAD; ++i) {
+        (*reducer) << 2;
+    }
+    timer.stop();
+    return (void*)(timer.n_elapsed());
+}
+
+TEST_F(ReducerTest, percpu_adder) {
+    bvar::PerCpuAdder<int64_t> reducer;
+    ASSERT_TRUE(reducer.valid());
+    ASSERT_EQ(0, reducer.get_value());
+    reducer << 2 << 4 << -9;
+    ASSERT_EQ(-3, reducer.get_value());
+    ASSERT_EQ(-3, reducer.reset());
+    ASSERT_EQ(0, reducer.get_value());
+
+    const size_t num_thread = 8;
+    pthread_t threads[num_thread];
+    for (size_t i = 0; i < num_thread; ++i) {
+        pthread_create(&threads[i], NULL, percpu_add_thread, &reducer);
+    }
+    long total_time = 0;
+    for (size_t i = 0; i < num_thread; ++i) {
+        void* ret = NULL;
+        pthread_join(threads[i], &ret);
+        total_time += (long)ret;
+    }
+    ASSERT_EQ(2L * num_thread * OPS_PER_THREAD, reducer.get_value());
+    LOG(INFO) << "PerCpuAdder takes " << total_time / (OPS_PER_THREAD * num_thread)
+              << "ns per add, nslot=" << bvar::detail::percpu_nslot();
+
+    butil::Timer timer;
+    timer.start();
+    int64_t sum = 0;
+    for (int i = 0; i < 10000; ++i) {
+        sum += reducer.get_value();
+    }
+    timer.stop();
+    ASSERT_EQ(10000L * 2 * num_thread * OPS_PER_THREAD, sum);
+    LOG(INFO) << "PerCpuAdder::get_value takes " << timer.n_elapsed() / 10000 << "ns";
+}
+
+TEST_F(ReducerTest, percpu_maxer) {
+    bvar::PerCpuMaxer<int> reducer;
+    ASSERT_TRUE(reducer.valid());
+    ASSERT_EQ(std::numeric_limits<int>::min(), reducer.get_value());
+    reducer << 20 << 10;
+    ASSERT_EQ(20, reducer.get_value());
+    reducer << -5;
+    ASSERT_EQ(20, reducer.get_value());
+    ASSERT_EQ(20, reducer.reset());
+    ASSERT_EQ(std::numeric_limits<int>::min(), reducer.get_value());
+    reducer << std::numeric_limits<int>::max();
+    ASSERT_EQ(std::numeric_limits<int>::max(), reducer.get_value());
+}
+
+TEST_F(ReducerTest, percpu_cell_reuse) {
+    for (int i = 0; i < 1000; ++i) {
+        bvar::PerCpuAdder<int64_t> a;
+        bvar::PerCpuMaxer<int> m;
+        ASSERT_EQ(0, a.get_value());
+        ASSERT_EQ(std::numeric_limits<int>::min(), m.get_value());
+        a << i + 1;
+        m << i;
+    }
+}
+
+TEST_F(ReducerTest, percpu_window) {
+    bvar::PerCpuAdder<int> c1;
+    bvar::PerCpuMaxer<int> c2;
+    bvar::Window<bvar::PerCpuAdder<int> > w1(&c1, 2);
+    bvar::Window<bvar::PerCpuMaxer<int> > w2(&c2, 2);
+    bvar::PerSecond<bvar::PerCpuAdder<int> > s1(&c1, 2);
+    for (int i = 0; i < 10; ++i) {
+        c1 << 1;
+        c2 << 100 - i;
+        usleep(200000);
+    }
+    ASSERT_EQ(10, c1.get_value());
+    ASSERT_LE(w1.get_value(), 10);
+    ASSERT_GT(w1.get_value(), 0);
+    ASSERT_LE(w2.get_value(), 100);
+    ASSERT_GE(w2.get_value(), 91);
+    LOG(INFO) << "w1=" << w1 << " w2=" << w2 << " s1=" << s1;
+}
+
 bvar::Adder<long> g_a;
 
 TEST_F(ReducerTest, global) {
@@ -342,4 +434,58 @@ TEST_F(ReducerTest, simple_window) {
     const int64_t v = w.get_value();
     ASSERT_EQ(100, v) << "v=" << v;
 }
+
+// Print points like Series::describe() does.
+static std::string series_points(const std::vector<int64_t>& points) {
+    std::ostringstream os;
+    os << "{\"label\":\"trend\",\"data\":[";
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (i) {
+            os << ',';
+        }
+        os << '[' << i << ',' << points[i] << ']';
+    }
+    os << "]}";
+    return os.str();
+}
+
+TEST_F(ReducerTest, compact_series) {
+    typedef bvar::detail::Series<int64_t, bvar::detail::AddTo<int64_t> > Series;
+    Series series((bvar::detail::AddTo<int64_t>()));
+    // One hour and 100 seconds of the same value.
+    for (int i = 0; i < 3700; ++i) {
+        series.append(5);
+    }
+    ASSERT_FALSE(series.allocated());
+    std::vector<int64_t> points;
+    points.insert(points.end(), 30, 0);  // days
+    points.insert(points.end(), 23, 0);  // hours, the latest is at last.
+    points.push_back(5);
+    points.insert(points.end(), 60, 5);  // minutes
+    points.insert(points.end(), 60, 5);  // seconds
+    std::ostringstream os;
+    series.describe(os, NULL);
+    ASSERT_EQ(series_points(points), os.str());
+
+    // A different value allocates the history, which continues from the
+    // rebuilt one.
+    series.append(65);
+    ASSERT_TRUE(series.allocated());
+    points.erase(points.begin() + 54);
+    points.push_back(65);
+    os.str("");
+    series.describe(os, NULL);
+    ASSERT_EQ(series_points(points), os.str());
+    for (int i = 0; i < 59; ++i) {
+        series.append(65);
+    }
+    // The 62th minute has 40 seconds of 5 and 20 seconds of 65.
+    points.erase(points.begin() + 54);
+    points.insert(points.begin() + 113, 25);
+    points.erase(points.begin() + 114, points.end());
+    points.insert(points.end(), 60, 65);
+    os.str("");
+    series.describe(os, NULL);
+    ASSERT_EQ(series_points(points), os.str());
+}
 } // namespace
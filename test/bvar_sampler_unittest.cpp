@@ -16,11 +16,19 @@
 // under the License.
 
 #include <limits>                           //std::numeric_limits
+#include <gflags/gflags.h>
+#include "butil/atomicops.h"
 #include "bvar/detail/sampler.h"
 #include "butil/time.h"
 #include "butil/logging.h"
 #include <gtest/gtest.h>
 
+namespace bvar {
+namespace detail {
+DECLARE_int32(bvar_sampler_thread_num);
+}
+}
+
 namespace {
 
 TEST(SamplerTest, linked_list) {
@@ -136,4 +144,53 @@ TEST(SamplerTest, multi_threaded) {
     }
 #endif
 }
+
+class CountingSampler : public bvar::detail::Sampler {
+public:
+    CountingSampler() : _ncalled(0) {}
+    ~CountingSampler() {
+        s_ndestroy.fetch_add(1, butil::memory_order_relaxed);
+    }
+    void take_sample() override {
+        _ncalled.fetch_add(1, butil::memory_order_relaxed);
+    }
+    int called_count() const {
+        return _ncalled.load(butil::memory_order_relaxed);
+    }
+    static butil::atomic<int> s_ndestroy;
+private:
+    butil::atomic<int> _ncalled;
+};
+butil::atomic<int> CountingSampler::s_ndestroy(0);
+
+TEST(SamplerTest, sharded) {
+    const int old_thread_num = bvar::detail::FLAGS_bvar_sampler_thread_num;
+    bvar::detail::FLAGS_bvar_sampler_thread_num = 4;
+    const int N = 1000;
+    CountingSampler* s[N];
+    for (int i = 0; i < N; ++i) {
+        s[i] = new CountingSampler;
+        s[i]->schedule();
+    }
+    usleep(1010000);
+    for (int i = 0; i < N; ++i) {
+        ASSERT_LE(1, s[i]->called_count()) << "i=" << i;
+    }
+    // Shrinking shards keeps all samplers.
+    bvar::detail::FLAGS_bvar_sampler_thread_num = 2;
+    int before[N];
+    for (int i = 0; i < N; ++i) {
+        before[i] = s[i]->called_count();
+    }
+    usleep(1010000);
+    for (int i = 0; i < N; ++i) {
+        ASSERT_LT(before[i], s[i]->called_count()) << "i=" << i;
+    }
+    for (int i = 0; i < N; ++i) {
+        s[i]->destroy();
+    }
+    usleep(1010000);
+    EXPECT_EQ(N, CountingSampler::s_ndestroy.load());
+    bvar::detail::FLAGS_bvar_sampler_thread_num = old_thread_num;
+}
 } // namespace
@@ -0,0 +1,90 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <map>
+#include "butil/time.h"
+#include "bvar/reducer.h"
+#include "bvar/status.h"
+#include "bvar/shm_dumper.h"
+
+namespace {
+
+const char* const SHM_NAME = "/bvar_shm_dumper_unittest";
+
+void read_vars(std::map<std::string, std::string>* m) {
+    std::vector<std::pair<std::string, std::string> > vars;
+    ASSERT_EQ(0, bvar::read_shm_vars(SHM_NAME, &vars));
+    m->clear();
+    m->insert(vars.begin(), vars.end());
+}
+
+TEST(ShmDumperTest, write_and_read) {
+    bvar::Adder<int> a("shm_dumper_adder");
+    bvar::Status<std::string> s("shm_dumper_status", "hello");
+    a << 3;
+    bvar::ShmDumper dumper;
+    ASSERT_EQ(0, dumper.open(SHM_NAME, 1024));
+    dumper.begin();
+    ASSERT_GT(bvar::Variable::dump_exposed(&dumper, NULL), 0);
+    dumper.end();
+
+    std::map<std::string, std::string> m;
+    read_vars(&m);
+    ASSERT_EQ("3", m["shm_dumper_adder"]);
+    // Strings are quoted as in other dumpers.
+    ASSERT_EQ("\"hello\"", m["shm_dumper_status"]);
+
+    // Values are updated in place, hidden vars are not read.
+    a << 4;
+    s.hide();
+    dumper.begin();
+    bvar::Variable::dump_exposed(&dumper, NULL);
+    dumper.end();
+    read_vars(&m);
+    ASSERT_EQ("7", m["shm_dumper_adder"]);
+    ASSERT_EQ(0u, m.count("shm_dumper_status"));
+
+    // Long values are truncated.
+    s.set_value(std::string(1000, 'x'));
+    s.expose("shm_dumper_status");
+    dumper.begin();
+    bvar::Variable::dump_exposed(&dumper, NULL);
+    dumper.end();
+    read_vars(&m);
+    ASSERT_EQ(bvar::BVAR_SHM_VALUE_SIZE, m["shm_dumper_status"].size());
+}
+
+TEST(ShmDumperTest, capacity) {
+    bvar::Adder<int> a1("shm_dumper_a1");
+    bvar::Adder<int> a2("shm_dumper_a2");
+    bvar::ShmDumper dumper;
+    ASSERT_EQ(0, dumper.open(SHM_NAME, 1));
+    dumper.begin();
+    bvar::Variable::dump_exposed(&dumper, NULL);
+    dumper.end();
+    std::map<std::string, std::string> m;
+    read_vars(&m);
+    ASSERT_EQ(1u, m.size());
+}
+
+TEST(ShmDumperTest, nonexistent) {
+    std::vector<std::pair<std::string, std::string> > vars;
+    ASSERT_EQ(-1, bvar::read_shm_vars("/bvar_shm_dumper_nonexistent", &vars));
+}
+
+}  // namespace
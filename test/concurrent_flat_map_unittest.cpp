@@ -0,0 +1,202 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <sched.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "butil/time.h"
+#include "butil/atomicops.h"
+#include "butil/fast_rand.h"
+#include "butil/string_printf.h"
+#include "butil/containers/concurrent_flat_map.h"
+
+namespace {
+
+typedef butil::ConcurrentFlatMap<int, std::string> StringMap;
+
+TEST(ConcurrentFlatMapTest, sanity) {
+    StringMap m(3);
+    ASSERT_EQ(4u, m.shard_count());
+    ASSERT_TRUE(m.empty());
+    std::string v;
+    ASSERT_FALSE(m.seek(1, &v));
+    ASSERT_EQ(0u, m.erase(1));
+    ASSERT_TRUE(m.insert(1, "a"));
+    ASSERT_TRUE(m.insert(2, "b"));
+    ASSERT_EQ(2u, m.size());
+    ASSERT_TRUE(m.seek(1, &v));
+    ASSERT_EQ("a", v);
+    // Overwrite existing value.
+    ASSERT_FALSE(m.insert(1, "aa"));
+    ASSERT_EQ(2u, m.size());
+    size_t len = 0;
+    ASSERT_TRUE(m.read(1, [&len](const std::string& s) { len = s.size(); }));
+    ASSERT_EQ(2u, len);
+
+    ASSERT_EQ(1u, m.erase(1));
+    ASSERT_FALSE(m.seek(1, &v));
+    ASSERT_EQ(1u, m.size());
+
+    // Grow the shards.
+    std::map<int, std::string> ref;
+    for (int i = 0; i < 10000; ++i) {
+        const std::string s = butil::string_printf("%d", i * 7);
+        m.insert(i, s);
+        ref[i] = s;
+    }
+    ASSERT_EQ(ref.size(), m.size());
+    for (int i = 0; i < 10000; i += 2) {
+        ASSERT_EQ(1u, m.erase(i));
+        ref.erase(i);
+    }
+    ASSERT_EQ(ref.size(), m.size());
+    std::map<int, std::string> visited;
+    m.for_each([&visited](int k, const std::string& s) { visited[k] = s; });
+    ASSERT_EQ(ref, visited);
+
+    m.clear();
+    ASSERT_TRUE(m.empty());
+    ASSERT_FALSE(m.seek(3, &v));
+    ASSERT_TRUE(m.insert(3, "c"));
+    ASSERT_TRUE(m.seek(3, &v));
+    ASSERT_EQ("c", v);
+}
+
+TEST(ConcurrentFlatMapTest, bulk_apply) {
+    StringMap m;
+    m.insert(1, "a");
+    m.insert(2, "b");
+    std::vector<StringMap::Update> updates(4);
+    updates[0].key = 1;
+    updates[0].value = "x";
+    updates[1].key = 2;
+    updates[1].erase = true;
+    updates[2].key = 3;
+    updates[2].value = "c";
+    // Later updates to the same key win.
+    updates[3].key = 1;
+    updates[3].value = "y";
+    m.bulk_apply(updates);
+    std::string v;
+    ASSERT_EQ(2u, m.size());
+    ASSERT_TRUE(m.seek(1, &v));
+    ASSERT_EQ("y", v);
+    ASSERT_FALSE(m.seek(2, &v));
+    ASSERT_TRUE(m.seek(3, &v));
+    ASSERT_EQ("c", v);
+}
+
+const int NKEY = 4096;
+butil::atomic<bool> g_stop(false);
+
+// Values are always derived from keys, readers check them for torn or
+// freed nodes.
+std::string value_of(int key, int round) {
+    return butil::string_printf("%d-%d", key, round);
+}
+
+bool check_value(int key, const std::string& v) {
+    const std::string prefix = butil::string_printf("%d-", key);
+    return v.compare(0, prefix.size(), prefix) == 0;
+}
+
+void* read_thread(void* arg) {
+    StringMap* m = static_cast<StringMap*>(arg);
+    size_t nfound = 0;
+    size_t nbad = 0;
+    std::string v;
+    while (!g_stop.load(butil::memory_order_relaxed)) {
+        for (int i = 0; i < 1000; ++i) {
+            const int key = butil::fast_rand_less_than(NKEY);
+            if (m->seek(key, &v)) {
+                ++nfound;
+                nbad += !check_value(key, v);
+            }
+        }
+        sched_yield();
+    }
+    EXPECT_EQ(0u, nbad);
+    return (void*)nfound;
+}
+
+void* write_thread(void* arg) {
+    StringMap* m = static_cast<StringMap*>(arg);
+    for (int round = 0; !g_stop.load(butil::memory_order_relaxed); ++round) {
+        std::vector<StringMap::Update> updates;
+        for (int i = 0; i < 100; ++i) {
+            const int key = butil::fast_rand_less_than(NKEY);
+            switch (butil::fast_rand_less_than(3)) {
+            case 0:
+                m->insert(key, value_of(key, round));
+                break;
+            case 1:
+                m->erase(key);
+                break;
+            default: {
+                StringMap::Update u;
+                u.key = key;
+                u.value = value_of(key, round);
+                updates.push_back(u);
+                break;
+            }
+            }
+        }
+        m->bulk_apply(updates);
+        if (round % 64 == 63) {
+            m->clear();
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+TEST(ConcurrentFlatMapTest, read_while_writing) {
+    StringMap m(8);
+    g_stop.store(false);
+    pthread_t rth[4];
+    pthread_t wth[2];
+    for (size_t i = 0; i < ARRAY_SIZE(rth); ++i) {
+        ASSERT_EQ(0, pthread_create(&rth[i], NULL, read_thread, &m));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(wth); ++i) {
+        ASSERT_EQ(0, pthread_create(&wth[i], NULL, write_thread, &m));
+    }
+    usleep(1000000);
+    g_stop.store(true);
+    size_t nfound = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(rth); ++i) {
+        void* ret = NULL;
+        pthread_join(rth[i], &ret);
+        nfound += (size_t)ret;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(wth); ++i) {
+        pthread_join(wth[i], NULL);
+    }
+    LOG(INFO) << "Found " << nfound << " values, size=" << m.size();
+    ASSERT_GT(nfound, 0u);
+    size_t n = 0;
+    m.for_each([&n](int k, const std::string& v) {
+        ++n;
+        ASSERT_TRUE(check_value(k, v));
+    });
+    ASSERT_EQ(n, m.size());
+}
+
+}  // namespace
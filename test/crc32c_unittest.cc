@@ -9,6 +9,7 @@
 
 #include <gtest/gtest.h>
 #include "butil/crc32c.h"
+#include "butil/iobuf.h"
 
 namespace butil {
 namespace crc32c {
@@ -69,6 +70,66 @@ TEST_F(CRC, Mask) {
   ASSERT_EQ(crc, Unmask(Unmask(Mask(Mask(crc)))));
 }
 
+// Bit-by-bit crc32c as the reference of all optimized implementations.
+static uint32_t BitwiseValue(const char* data, size_t n) {
+  uint32_t crc = 0xffffffffu;
+  for (size_t i = 0; i < n; ++i) {
+    crc ^= static_cast<unsigned char>(data[i]);
+    for (int k = 0; k < 8; ++k) {
+      crc = (crc & 1) ? ((crc >> 1) ^ 0x82f63b78u) : (crc >> 1);
+    }
+  }
+  return crc ^ 0xffffffffu;
+}
+
+TEST_F(CRC, LongAndUnaligned) {
+  std::string buf(40000, '\0');
+  for (size_t i = 0; i < buf.size(); ++i) {
+    buf[i] = static_cast<char>(i * 2654435761u >> 13);
+  }
+  const size_t lengths[] = { 0, 1, 7, 8, 255, 767, 768, 769, 1000,
+                             6143, 6144, 6145, 6144 + 768 + 13, 30000 };
+  for (size_t offset = 0; offset < 9; ++offset) {
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+      const char* p = buf.data() + offset;
+      ASSERT_EQ(BitwiseValue(p, lengths[i]), Value(p, lengths[i]))
+          << "offset=" << offset << " length=" << lengths[i];
+    }
+  }
+}
+
+TEST_F(CRC, Combine) {
+  std::string buf(10000, 'x');
+  for (size_t i = 0; i < buf.size(); ++i) {
+    buf[i] = static_cast<char>(i * 131 + 7);
+  }
+  const uint32_t whole = Value(buf.data(), buf.size());
+  const size_t splits[] = { 0, 1, 100, 4096, 9999, 10000 };
+  for (size_t i = 0; i < sizeof(splits) / sizeof(splits[0]); ++i) {
+    const size_t n1 = splits[i];
+    ASSERT_EQ(whole, Combine(Value(buf.data(), n1),
+                             Value(buf.data() + n1, buf.size() - n1),
+                             buf.size() - n1)) << "n1=" << n1;
+  }
+}
+
+TEST_F(CRC, IOBuf) {
+  std::string str;
+  butil::IOBuf buf;
+  for (int i = 0; i < 3000; ++i) {
+    char piece[32];
+    const int len = snprintf(piece, sizeof(piece), "%d,", i);
+    str.append(piece, len);
+    butil::IOBuf tmp;
+    tmp.append(piece, len);
+    buf.append(tmp);    // referencing instead of copying, more blocks
+  }
+  ASSERT_EQ(str.size(), buf.size());
+  ASSERT_EQ(Value(str.data(), str.size()), Extend(0, buf));
+  ASSERT_EQ(Extend(Value("x", 1), str.data(), str.size()),
+            Extend(Value("x", 1), buf));
+}
+
 TEST_F(CRC, fast_is_on) {
   std::cout << "IsFastCrc32Supported=" << IsFastCrc32Supported() << std::endl;
 }
@@ -0,0 +1,184 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <sched.h>
+#include <vector>
+#include "butil/time.h"
+#include "butil/macros.h"
+#include "butil/atomicops.h"
+#include "butil/epoch.h"
+#include "butil/containers/doubly_buffered_data.h"
+#include "butil/containers/epoch_buffered_data.h"
+
+namespace {
+
+butil::atomic<int> g_nfreed(0);
+
+struct Counted {
+    ~Counted() { g_nfreed.fetch_add(1, butil::memory_order_relaxed); }
+};
+
+TEST(EpochTest, retire_after_readers_leave) {
+    g_nfreed.store(0);
+    butil::epoch_reclaim();
+    const size_t npending = butil::epoch_pending_count();
+    {
+        butil::EpochGuard guard;
+        {
+            // Nested
+            butil::EpochGuard guard2;
+        }
+        butil::epoch_delete(new Counted);
+        butil::epoch_reclaim();
+        ASSERT_EQ(0, g_nfreed.load());
+        ASSERT_EQ(npending + 1, butil::epoch_pending_count());
+    }
+    butil::epoch_reclaim();
+    ASSERT_EQ(1, g_nfreed.load());
+
+    // Freed at once without readers.
+    butil::epoch_delete(new Counted);
+    ASSERT_EQ(2, g_nfreed.load());
+}
+
+void* leave_guard(void* arg) {
+    delete static_cast<butil::EpochGuard*>(arg);
+    return NULL;
+}
+
+TEST(EpochTest, leave_in_another_thread) {
+    // Like a bthread suspended inside the guard and resumed by another
+    // worker.
+    g_nfreed.store(0);
+    butil::EpochGuard* guard = new butil::EpochGuard;
+    butil::epoch_delete(new Counted);
+    butil::epoch_reclaim();
+    ASSERT_EQ(0, g_nfreed.load());
+    {
+        // Readers in this thread are still counted.
+        butil::EpochGuard guard2;
+        pthread_t th;
+        ASSERT_EQ(0, pthread_create(&th, NULL, leave_guard, guard));
+        pthread_join(th, NULL);
+        butil::epoch_reclaim();
+        ASSERT_EQ(0, g_nfreed.load());
+    }
+    butil::epoch_reclaim();
+    ASSERT_EQ(1, g_nfreed.load());
+}
+
+struct Pair {
+    Pair() : a(0), b(0) {}
+    int a;
+    int b;
+};
+
+size_t set_pair(Pair& p, int v) {
+    p.a = v;
+    p.b = -v;
+    return 1;
+}
+
+size_t noop(Pair&) { return 0; }
+
+TEST(EpochTest, epoch_buffered_data_sanity) {
+    butil::EpochBufferedData<Pair> d;
+    {
+        butil::EpochBufferedData<Pair>::ScopedPtr ptr;
+        ASSERT_EQ(0, d.Read(&ptr));
+        ASSERT_EQ(0, ptr->a);
+        ASSERT_EQ(1u, d.Modify(set_pair, 10));
+        // ptr still sees the old instance.
+        ASSERT_EQ(0, ptr->a);
+    }
+    ASSERT_EQ(0u, d.Modify(noop));
+    ASSERT_EQ(1u, d.ModifyWithForeground([](Pair& p, const Pair& fg) {
+        p.a = fg.a + 1;
+        p.b = -p.a;
+        return (size_t)1;
+    }));
+    int a = 0;
+    ASSERT_EQ(0, d.Read([&a](const Pair& p) { a = p.a; }));
+    ASSERT_EQ(11, a);
+}
+
+butil::atomic<bool> g_stop(false);
+
+template <typename Data>
+void* read_pair(void* arg) {
+    Data* d = static_cast<Data*>(arg);
+    size_t nread = 0;
+    size_t nbad = 0;
+    while (!g_stop.load(butil::memory_order_relaxed)) {
+        for (int i = 0; i < 1000; ++i) {
+            typename Data::ScopedPtr ptr;
+            if (d->Read(&ptr) == 0) {
+                nbad += (ptr->a != -ptr->b);
+                ++nread;
+            }
+        }
+        sched_yield();
+    }
+    EXPECT_EQ(0u, nbad);
+    return (void*)nread;
+}
+
+template <typename Data>
+void* modify_pair(void* arg) {
+    Data* d = static_cast<Data*>(arg);
+    for (int i = 0; !g_stop.load(butil::memory_order_relaxed); ++i) {
+        d->Modify(set_pair, i);
+        usleep(100);
+    }
+    return NULL;
+}
+
+template <typename Data>
+void bench_read(const char* name) {
+    Data d;
+    g_stop.store(false);
+    pthread_t rth[4];
+    pthread_t wth;
+    for (size_t i = 0; i < ARRAY_SIZE(rth); ++i) {
+        ASSERT_EQ(0, pthread_create(&rth[i], NULL, read_pair<Data>, &d));
+    }
+    ASSERT_EQ(0, pthread_create(&wth, NULL, modify_pair<Data>, &d));
+    butil::Timer tm;
+    tm.start();
+    usleep(500000);
+    g_stop.store(true);
+    size_t nread = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(rth); ++i) {
+        void* ret = NULL;
+        pthread_join(rth[i], &ret);
+        nread += (size_t)ret;
+    }
+    pthread_join(wth, NULL);
+    tm.stop();
+    LOG(INFO) << name << ": " << nread * 1000 / tm.u_elapsed()
+              << " reads/ms while modifying";
+}
+
+TEST(EpochTest, read_performance) {
+    bench_read<butil::DoublyBufferedData<Pair> >("DoublyBufferedData");
+    bench_read<butil::EpochBufferedData<Pair> >("EpochBufferedData");
+}
+
+}  // namespace
@@ -702,6 +702,45 @@ TEST_F(IOBufTest, cut_by_multiple_text_delim) {
     ASSERT_EQ("", to_str(b));
 }
 
+static void append_as_block(butil::IOBuf* b, const std::string& s) {
+    void* data = malloc(s.size());
+    memcpy(data, s.data(), s.size());
+    ASSERT_EQ(0, b->append_user_data(data, s.size(), free));
+}
+
+TEST_F(IOBufTest, find_across_blocks) {
+    butil::IOBuf b;
+    append_as_block(&b, "GET / HTTP/1.1\r");
+    append_as_block(&b, "\nHost: x\r\n");
+    append_as_block(&b, "\r");
+    append_as_block(&b, "\n--boundary-of-");
+    append_as_block(&b, "many-blocks--");
+    ASSERT_EQ(5u, b.backing_block_num());
+    const std::string str = b.to_string();
+
+    ASSERT_EQ(0, b.find('G'));
+    ASSERT_EQ((ssize_t)str.find('\n'), b.find('\n'));
+    ASSERT_EQ((ssize_t)str.find('\n', 16), b.find('\n', 16));
+    ASSERT_EQ(-1, b.find('z'));
+    ASSERT_EQ(-1, b.find('G', 1));
+    ASSERT_EQ(-1, b.find('G', str.size() + 10));
+
+    ASSERT_EQ(-1, b.find(""));
+    ASSERT_EQ((ssize_t)str.find("\r\n"), b.find("\r\n"));
+    ASSERT_EQ((ssize_t)str.find("\r\n", 15), b.find("\r\n", 15));
+    ASSERT_EQ((ssize_t)str.find("\r\n\r\n"), b.find("\r\n\r\n"));
+    ASSERT_EQ((ssize_t)str.find("of-many"), b.find("of-many"));
+    ASSERT_EQ((ssize_t)str.find("blocks--"), b.find("blocks--"));
+    ASSERT_EQ(-1, b.find("blocks---"));
+    ASSERT_EQ(-1, b.find("\r\r"));
+
+    // Delimiters longer than 8 bytes are supported by cut_until as well.
+    butil::IOBuf p;
+    ASSERT_EQ(0, b.cut_until(&p, "\n--boundary-of-many-"));
+    ASSERT_EQ("GET / HTTP/1.1\r\nHost: x\r\n\r", p.to_string());
+    ASSERT_EQ("blocks--", b.to_string());
+}
+
 TEST_F(IOBufTest, append_a_lot_and_cut_them_all) {
     install_debug_allocator();
     
@@ -1109,6 +1148,30 @@ TEST_F(IOBufTest, conversion_with_protobuf) {
     ASSERT_FALSE(m2.has_optional_int32());
 }
 
+TEST_F(IOBufTest, skip_to_end_of_zero_copy_input_stream) {
+    butil::IOBuf buf;
+    ASSERT_EQ(0, buf.append_user_data(strdup("hello"), 5, free));
+    ASSERT_EQ(0, buf.append_user_data(strdup("world"), 5, free));
+    ASSERT_EQ(2u, buf.backing_block_num());
+    {
+        butil::IOBufAsZeroCopyInputStream wrapper(buf);
+        ASSERT_TRUE(wrapper.Skip(10));
+        ASSERT_EQ(10, wrapper.ByteCount());
+        ASSERT_TRUE(wrapper.Skip(0));
+        ASSERT_FALSE(wrapper.Skip(1));
+    }
+    {
+        butil::IOBufAsZeroCopyInputStream wrapper(buf);
+        ASSERT_TRUE(wrapper.Skip(5));
+        const void* data = NULL;
+        int size = 0;
+        ASSERT_TRUE(wrapper.Next(&data, &size));
+        ASSERT_EQ("world", std::string((const char*)data, size));
+        ASSERT_FALSE(wrapper.Skip(1));
+        ASSERT_EQ(10, wrapper.ByteCount());
+    }
+}
+
 TEST_F(IOBufTest, extended_backup) {
     for (int i = 0; i < 2; ++i) {
         std::cout << "i=" << i << std::endl;
@@ -1343,6 +1406,33 @@ TEST_F(IOBufTest, append_from_fd_with_offset) {
 
 }
 
+TEST_F(IOBufTest, append_from_fd_with_large_blocks) {
+    butil::TempFile file;
+    std::string data(1024 * 1024, 0);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = 'a' + i % 26;
+    }
+    ASSERT_EQ(0, file.save_bin(data.data(), data.size()));
+    butil::fd_guard fd(open(file.fname(), O_RDONLY));
+    ASSERT_TRUE(fd >= 0) << file.fname() << ' ' << berror();
+    {
+        butil::IOPortal buf;
+        // Default blocks can't hold 1MB with one read.
+        ASSERT_GT(data.size(), (size_t)buf.pappend_from_file_descriptor(
+                      fd, 0, data.size()));
+    }
+    const int tls_blocks = butil::iobuf::get_tls_block_count();
+    {
+        butil::IOPortal buf;
+        ASSERT_EQ(data.size(), (size_t)buf.pappend_from_file_descriptor(
+                      fd, 0, data.size(), 65536));
+        ASSERT_GE(17u, buf.backing_block_num());
+        ASSERT_EQ(data, buf.to_string());
+    }
+    // Large blocks are not cached in TLS of default blocks.
+    ASSERT_EQ(tls_blocks, butil::iobuf::get_tls_block_count());
+}
+
 static butil::atomic<int> s_nthread(0);
 static long number_per_thread = 1024;
 
@@ -1482,6 +1572,104 @@ TEST_F(IOBufTest, appender) {
     ASSERT_EQ(str, buf3);
 }
 
+static void* append_as_user(void* arg) {
+    butil::IOBuf* buf = (butil::IOBuf*)arg;
+    const std::string str(100 * 1024, 'a');
+    {
+        butil::IOBufOwnerScope owner_scope(butil::IOBuf::OWNER_USER);
+        {
+            butil::IOBufOwnerScope inner_scope(butil::IOBuf::OWNER_PROTOCOL);
+        }
+        buf->append(str);
+    }
+    return NULL;
+}
+
+TEST_F(IOBufTest, block_owner) {
+    const size_t user_mem =
+        butil::IOBuf::block_memory_of_owner(butil::IOBuf::OWNER_USER);
+    const size_t other_mem =
+        butil::IOBuf::block_memory_of_owner(butil::IOBuf::OWNER_OTHER);
+    butil::IOBuf buf;
+    pthread_t th;
+    ASSERT_EQ(0, pthread_create(&th, NULL, append_as_user, &buf));
+    ASSERT_EQ(0, pthread_join(th, NULL));
+    ASSERT_EQ(100u * 1024, buf.size());
+    // Blocks outlive the thread and the scope.
+    ASSERT_LE(user_mem + buf.size(),
+              butil::IOBuf::block_memory_of_owner(butil::IOBuf::OWNER_USER));
+    ASSERT_EQ(other_mem,
+              butil::IOBuf::block_memory_of_owner(butil::IOBuf::OWNER_OTHER));
+    buf.clear();
+    ASSERT_EQ(user_mem,
+              butil::IOBuf::block_memory_of_owner(butil::IOBuf::OWNER_USER));
+    ASSERT_EQ(0u, butil::IOBuf::block_memory_of_owner(
+                  butil::IOBuf::BLOCK_OWNER_NUM));
+}
+
+TEST_F(IOBufTest, block_size_classes) {
+    ASSERT_EQ(butil::IOBuf::SMALL_BLOCK, butil::IOBuf::block_size_class(200));
+    ASSERT_EQ(butil::IOBuf::DEFAULT_BLOCK,
+              butil::IOBuf::block_size_class(4096));
+    ASSERT_EQ(butil::IOBuf::LARGE_BLOCK,
+              butil::IOBuf::block_size_class(256 * 1024));
+    ASSERT_EQ(butil::IOBuf::HUGE_BLOCK,
+              butil::IOBuf::block_size_class(4 * 1024 * 1024));
+
+    const size_t small_mem =
+        butil::IOBuf::block_memory(butil::IOBuf::SMALL_BLOCK);
+    {
+        butil::IOBufAppender appender(200);
+        std::string str(200, 'a');
+        ASSERT_EQ(0, appender.append(str));
+        ASSERT_EQ(str, appender.buf());
+        ASSERT_EQ(butil::IOBuf::SMALL_BLOCK_SIZE - BLOCK_OVERHEAD,
+                  butil::iobuf::block_cap(appender.buf()._front_ref().block));
+        ASSERT_EQ(small_mem + butil::IOBuf::SMALL_BLOCK_SIZE,
+                  butil::IOBuf::block_memory(butil::IOBuf::SMALL_BLOCK));
+
+        // The rest of the small block is shared by the next appender.
+        butil::IOBufAppender appender2(200);
+        ASSERT_EQ(0, appender2.append(str));
+        ASSERT_EQ(appender.buf()._front_ref().block,
+                  appender2.buf()._front_ref().block);
+    }
+    // The small block is cached in TLS, not among default blocks.
+    ASSERT_EQ(small_mem + butil::IOBuf::SMALL_BLOCK_SIZE,
+              butil::IOBuf::block_memory(butil::IOBuf::SMALL_BLOCK));
+    butil::IOBuf::Block* head = butil::iobuf::get_tls_block_head();
+    for (; head != NULL; head = butil::iobuf::get_portal_next(head)) {
+        ASSERT_EQ(DEFAULT_PAYLOAD, butil::iobuf::block_cap(head));
+    }
+
+    const size_t huge_mem = butil::IOBuf::block_memory(butil::IOBuf::HUGE_BLOCK);
+    {
+        butil::IOBuf buf;
+        butil::IOBufAsZeroCopyOutputStream stream(
+            &buf, butil::IOBuf::HUGE_BLOCK);
+        std::string str(1024 * 1024, 'b');
+        size_t nc = 0;
+        while (nc < str.size()) {
+            void* data = NULL;
+            int size = 0;
+            ASSERT_TRUE(stream.Next(&data, &size));
+            const size_t n = std::min(str.size() - nc, (size_t)size);
+            memcpy(data, str.data() + nc, n);
+            nc += n;
+            if (n < (size_t)size) {
+                stream.BackUp(size - n);
+            }
+        }
+        ASSERT_EQ(str, buf.to_string());
+        ASSERT_EQ(5u, buf.backing_block_num());
+        ASSERT_EQ(huge_mem + 5 * butil::IOBuf::HUGE_BLOCK_SIZE,
+                  butil::IOBuf::block_memory(butil::IOBuf::HUGE_BLOCK));
+    }
+    // Blocks of the buf are released except the last one cached in TLS.
+    ASSERT_EQ(huge_mem + butil::IOBuf::HUGE_BLOCK_SIZE,
+              butil::IOBuf::block_memory(butil::IOBuf::HUGE_BLOCK));
+}
+
 TEST_F(IOBufTest, appender_perf) {
     const size_t N1 = 100000;
     butil::Timer tm1;
@@ -1620,6 +1808,32 @@ TEST_F(IOBufTest, append_user_data_and_consume) {
     }
 }
 
+static void pooled_free(void* data, void* arg) {
+    ++*(int*)arg;
+    free(data);
+}
+
+TEST_F(IOBufTest, append_user_data_with_function_pointer) {
+    int nfree = 0;
+    const size_t len = 256;
+    for (int i = 0; i < 16; ++i) {
+        butil::IOBuf b0;
+        char* data = (char*)malloc(len);
+        memset(data, 'a' + i, len);
+        ASSERT_EQ(0, b0.append_user_data(data, len, pooled_free, &nfree));
+        ASSERT_EQ(0, b0.append_user_data(malloc(1), 0, pooled_free, &nfree));
+        ASSERT_EQ(i * 2 + 1, nfree);
+        ASSERT_EQ(1UL, b0._ref_num());
+        butil::IOBuf b1;
+        ASSERT_EQ(len / 2, b0.cutn(&b1, len / 2));
+        ASSERT_EQ(std::string(len / 2, 'a' + i), b1.to_string());
+        b0.clear();
+        ASSERT_EQ(i * 2 + 1, nfree);
+        b1.clear();
+        ASSERT_EQ(i * 2 + 2, nfree);
+    }
+}
+
 TEST_F(IOBufTest, append_stateful_user_data) {
     butil::IOBuf b0;
     const int REP = 16;
@@ -1738,6 +1952,51 @@ TEST_F(IOBufTest, append_user_data_with_meta) {
     }
 }
 
+TEST_F(IOBufTest, append_file_region) {
+    std::string content;
+    for (int i = 0; i < 100000; ++i) {
+        content.push_back('a' + i % 26);
+    }
+    butil::TempFile f;
+    ASSERT_EQ(0, f.save_bin(content.data(), content.size()));
+    const size_t nregion0 = butil::IOBuf::file_region_count();
+    {
+        butil::IOBuf b;
+        b.append("head");
+        {
+            butil::fd_guard fd(open(f.fname(), O_RDONLY));
+            ASSERT_GE(fd, 0);
+            ASSERT_EQ(-1, b.append_file_region(fd, 5000, content.size()));
+            ASSERT_EQ(EINVAL, errno);
+            ASSERT_EQ(0, b.append_file_region(fd, 5000, 20000));
+        }
+        // The region is still accessible after the fd is closed.
+        ASSERT_EQ(nregion0 + 1, butil::IOBuf::file_region_count());
+        ASSERT_EQ(4u + 20000u, b.size());
+        ASSERT_EQ(4u, b.bytes_before_file_region());
+        ASSERT_EQ("head" + content.substr(5000, 20000), b.to_string());
+
+        int fd = -1;
+        off_t offset = 0;
+        size_t len = 0;
+        ASSERT_FALSE(b.get_first_file_region(&fd, &offset, &len));
+        b.pop_front(4 + 100);
+        ASSERT_EQ(0u, b.bytes_before_file_region());
+        ASSERT_TRUE(b.get_first_file_region(&fd, &offset, &len));
+        ASSERT_EQ(5100, offset);
+        ASSERT_EQ(19900u, len);
+        char buf[16];
+        ASSERT_EQ((ssize_t)sizeof(buf), pread(fd, buf, sizeof(buf), offset));
+        ASSERT_EQ(content.substr(5100, sizeof(buf)), std::string(buf, sizeof(buf)));
+
+        butil::IOBuf b2 = b;
+        b.clear();
+        ASSERT_EQ(nregion0 + 1, butil::IOBuf::file_region_count());
+        ASSERT_EQ(content.substr(5100, 19900), b2.to_string());
+    }
+    ASSERT_EQ(nregion0, butil::IOBuf::file_region_count());
+}
+
 TEST_F(IOBufTest, share_tls_block) {
     butil::iobuf::remove_tls_block_chain();
     butil::IOBuf::Block* b = butil::iobuf::acquire_tls_block();
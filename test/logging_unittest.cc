@@ -19,6 +19,7 @@ DECLARE_bool(log_func_name);
 DECLARE_bool(async_log);
 DECLARE_bool(async_log_in_background_always);
 DECLARE_int32(max_async_log_queue_size);
+DECLARE_bool(async_log_drop_when_full);
 
 namespace {
 
@@ -540,6 +541,47 @@ TEST_F(LoggingTest, async_log) {
     FLAGS_async_log = saved_async_log;
 }
 
+TEST_F(LoggingTest, async_log_drop_when_full) {
+    bool saved_async_log = FLAGS_async_log;
+    bool saved_background_always = FLAGS_async_log_in_background_always;
+    int32_t saved_queue_size = FLAGS_max_async_log_queue_size;
+    FLAGS_async_log = true;
+    FLAGS_async_log_in_background_always = true;
+    FLAGS_async_log_drop_when_full = true;
+    FLAGS_max_async_log_queue_size = 10;
+    butil::TempFile temp_file;
+    LoggingSettings settings;
+    settings.logging_dest = LOG_TO_FILE;
+    settings.log_file = temp_file.fname();
+    settings.delete_old = DELETE_OLD_LOG_FILE;
+    InitLogging(settings);
+
+    const int64_t dropped_before = GetDroppedAsyncLogCount();
+    const std::string log = "246813579";
+    const int64_t N = 10000;
+    for (int64_t i = 0; i < N; ++i) {
+        LOG(INFO) << log;
+    }
+    const int64_t dropped = GetDroppedAsyncLogCount() - dropped_before;
+    ASSERT_GT(dropped, 0);
+
+    int64_t log_count = 0;
+    for (int i = 0; i < 100 && log_count + dropped != N; ++i) {
+        usleep(100 * 1000);
+        std::ostringstream oss;
+        std::string cmd = butil::string_printf("grep -c %s %s",
+            log.c_str(), temp_file.fname());
+        ASSERT_LE(0, butil::read_command_output(oss, cmd.c_str()));
+        log_count = std::strtol(oss.str().c_str(), NULL, 10);
+    }
+    ASSERT_EQ(N, log_count + dropped);
+
+    FLAGS_async_log_drop_when_full = false;
+    FLAGS_max_async_log_queue_size = saved_queue_size;
+    FLAGS_async_log_in_background_always = saved_background_always;
+    FLAGS_async_log = saved_async_log;
+}
+
 #if defined(BRPC_ENABLE_CPU_PROFILER) || defined(BAIDU_RPC_ENABLE_CPU_PROFILER)
 struct BAIDU_CACHELINE_ALIGNMENT PerfArgs {
     const std::string* log;
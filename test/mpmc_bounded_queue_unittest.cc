@@ -0,0 +1,219 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <sched.h>
+#include "butil/atomicops.h"
+#include "butil/time.h"
+#include "butil/containers/bounded_queue.h"
+#include "butil/containers/mpmc_bounded_queue.h"
+
+namespace {
+
+const size_t CAPACITY = 1024;
+const int NTHREAD = 4;
+const int64_t COUNT_PER_THREAD = 100000;
+const size_t BATCH = 16;
+
+TEST(MPMCBoundedQueueTest, init) {
+    butil::MPMCBoundedQueue<int> q;
+    ASSERT_FALSE(q.initialized());
+    ASSERT_EQ(-1, q.init(0));
+    ASSERT_EQ(-1, q.init(100));
+    ASSERT_EQ(0, q.init(128));
+    ASSERT_EQ(-1, q.init(128));
+    ASSERT_TRUE(q.initialized());
+    ASSERT_EQ(128u, q.capacity());
+}
+
+TEST(MPMCBoundedQueueTest, single_thread) {
+    butil::MPMCBoundedQueue<int> q;
+    ASSERT_EQ(0, q.init(8));
+    int x = 0;
+    ASSERT_FALSE(q.pop(&x));
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 8; ++i) {
+            ASSERT_TRUE(q.push(i));
+        }
+        ASSERT_FALSE(q.push(8));
+        ASSERT_EQ(8u, q.size());
+        for (int i = 0; i < 8; ++i) {
+            ASSERT_TRUE(q.pop(&x));
+            ASSERT_EQ(i, x);
+        }
+        ASSERT_FALSE(q.pop(&x));
+    }
+}
+
+TEST(MPMCBoundedQueueTest, batch) {
+    butil::MPMCBoundedQueue<int> q;
+    ASSERT_EQ(0, q.init(8));
+    int in[10] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    int out[10];
+    ASSERT_EQ(5u, q.push_batch(in, 5));
+    ASSERT_EQ(3u, q.push_batch(in + 5, 5));
+    ASSERT_EQ(0u, q.push_batch(in, 1));
+    ASSERT_EQ(2u, q.pop_batch(out, 2));
+    ASSERT_EQ(2u, q.push_batch(in + 8, 2));
+    ASSERT_EQ(8u, q.pop_batch(out + 2, 10));
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(i, out[i]);
+    }
+    ASSERT_EQ(0u, q.pop_batch(out, 10));
+}
+
+struct MPMCArg {
+    butil::MPMCBoundedQueue<int64_t>* q;
+    bool batch;
+    butil::atomic<int64_t>* sum;
+};
+
+void* mpmc_producer(void* void_arg) {
+    MPMCArg* arg = static_cast<MPMCArg*>(void_arg);
+    int64_t items[BATCH];
+    for (int64_t i = 1; i <= COUNT_PER_THREAD;) {
+        if (arg->batch) {
+            size_t n = 0;
+            for (; n < BATCH && i + (int64_t)n <= COUNT_PER_THREAD; ++n) {
+                items[n] = i + n;
+            }
+            size_t pushed = 0;
+            while (pushed < n) {
+                const size_t rc = arg->q->push_batch(items + pushed, n - pushed);
+                if (rc == 0) {
+                    sched_yield();
+                }
+                pushed += rc;
+            }
+            i += n;
+        } else if (arg->q->push(i)) {
+            ++i;
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+void* mpmc_consumer(void* void_arg) {
+    MPMCArg* arg = static_cast<MPMCArg*>(void_arg);
+    int64_t items[BATCH];
+    int64_t sum = 0;
+    for (int64_t npopped = 0; npopped < COUNT_PER_THREAD;) {
+        const size_t max = std::min<int64_t>(
+            arg->batch ? BATCH : 1, COUNT_PER_THREAD - npopped);
+        const size_t n = arg->q->pop_batch(items, max);
+        if (n == 0) {
+            sched_yield();
+        }
+        for (size_t i = 0; i < n; ++i) {
+            sum += items[i];
+        }
+        npopped += n;
+    }
+    arg->sum->fetch_add(sum, butil::memory_order_relaxed);
+    return NULL;
+}
+
+struct MutexArg {
+    butil::BoundedQueue<int64_t>* q;
+    pthread_mutex_t* mutex;
+    butil::atomic<int64_t>* sum;
+};
+
+void* mutex_producer(void* void_arg) {
+    MutexArg* arg = static_cast<MutexArg*>(void_arg);
+    for (int64_t i = 1; i <= COUNT_PER_THREAD;) {
+        pthread_mutex_lock(arg->mutex);
+        const bool pushed = arg->q->push(i);
+        pthread_mutex_unlock(arg->mutex);
+        if (pushed) {
+            ++i;
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+void* mutex_consumer(void* void_arg) {
+    MutexArg* arg = static_cast<MutexArg*>(void_arg);
+    int64_t sum = 0;
+    for (int64_t npopped = 0; npopped < COUNT_PER_THREAD;) {
+        int64_t x = 0;
+        pthread_mutex_lock(arg->mutex);
+        const bool popped = arg->q->pop(&x);
+        pthread_mutex_unlock(arg->mutex);
+        if (popped) {
+            sum += x;
+            ++npopped;
+        } else {
+            sched_yield();
+        }
+    }
+    arg->sum->fetch_add(sum, butil::memory_order_relaxed);
+    return NULL;
+}
+
+const int64_t EXPECTED_SUM =
+    NTHREAD * COUNT_PER_THREAD * (COUNT_PER_THREAD + 1) / 2;
+
+void run_threads(void* (*producer)(void*), void* (*consumer)(void*),
+                 void* arg, const char* name) {
+    pthread_t th[NTHREAD * 2];
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < NTHREAD; ++i) {
+        ASSERT_EQ(0, pthread_create(&th[i], NULL, producer, arg));
+        ASSERT_EQ(0, pthread_create(&th[NTHREAD + i], NULL, consumer, arg));
+    }
+    for (int i = 0; i < NTHREAD * 2; ++i) {
+        pthread_join(th[i], NULL);
+    }
+    tm.stop();
+    LOG(INFO) << name << ": " << NTHREAD << " producers and " << NTHREAD
+              << " consumers, " << tm.n_elapsed() / (NTHREAD * COUNT_PER_THREAD)
+              << "ns per item";
+}
+
+TEST(MPMCBoundedQueueTest, multi_thread) {
+    for (int batch = 0; batch < 2; ++batch) {
+        butil::MPMCBoundedQueue<int64_t> q;
+        ASSERT_EQ(0, q.init(CAPACITY));
+        butil::atomic<int64_t> sum(0);
+        MPMCArg arg = { &q, batch != 0, &sum };
+        run_threads(mpmc_producer, mpmc_consumer, &arg,
+                    batch ? "MPMCBoundedQueue(batch)" : "MPMCBoundedQueue");
+        ASSERT_EQ(EXPECTED_SUM, sum.load());
+        ASSERT_EQ(0u, q.size());
+    }
+}
+
+TEST(MPMCBoundedQueueTest, compare_with_mutex) {
+    butil::BoundedQueue<int64_t> q(CAPACITY);
+    ASSERT_TRUE(q.initialized());
+    pthread_mutex_t mutex;
+    pthread_mutex_init(&mutex, NULL);
+    butil::atomic<int64_t> sum(0);
+    MutexArg arg = { &q, &mutex, &sum };
+    run_threads(mutex_producer, mutex_consumer, &arg, "Mutex+BoundedQueue");
+    ASSERT_EQ(EXPECTED_SUM, sum.load());
+    pthread_mutex_destroy(&mutex);
+}
+
+}  // namespace
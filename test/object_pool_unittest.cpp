@@ -35,9 +35,19 @@ struct Foo {
     }
     int x;
 };
+
+int nshrink_dtor = 0;
+struct ShrinkObj {
+    ~ShrinkObj() { ++nshrink_dtor; }
+    char dummy[32];
+};
 }
 
 namespace butil {
+template <> struct ObjectPoolBlockMaxItem<ShrinkObj> {
+    static const size_t value = 4;
+};
+
 template <> struct ObjectPoolBlockMaxSize<MyObject> {
     static const size_t value = 128;
 };
@@ -371,4 +381,39 @@ TEST_F(ObjectPoolTest, verify_get) {
 
     clear_objects<int>();
 }
+TEST_F(ObjectPoolTest, shrink) {
+    std::vector<ShrinkObj*> v;
+    for (int i = 0; i < 16; ++i) {
+        v.push_back(get_object<ShrinkObj>());
+    }
+    ASSERT_EQ(4u, describe_objects<ShrinkObj>().block_num);
+    // Objects of the first 3 blocks are pushed to global free list, the
+    // last block is cached by this thread.
+    for (size_t i = 0; i < v.size(); ++i) {
+        ASSERT_EQ(0, return_object(v[i]));
+    }
+    // Blocks are freed after being idle for a whole period.
+    ASSERT_EQ(0u, shrink_objects<ShrinkObj>());
+    ASSERT_EQ(0, nshrink_dtor);
+    ASSERT_EQ(3u, shrink_objects<ShrinkObj>());
+    ASSERT_EQ(12, nshrink_dtor);
+    ObjectPoolInfo info = describe_objects<ShrinkObj>();
+    ASSERT_EQ(1u, info.block_num);
+    ASSERT_EQ(4u, info.item_num);
+    ASSERT_EQ(0u, shrink_objects<ShrinkObj>());
+
+    // The pool still works.
+    v.clear();
+    for (int i = 0; i < 16; ++i) {
+        ShrinkObj* p = get_object<ShrinkObj>();
+        ASSERT_TRUE(p != NULL);
+        memset(p->dummy, 0, sizeof(p->dummy));
+        v.push_back(p);
+    }
+    ASSERT_EQ(4u, describe_objects<ShrinkObj>().block_num);
+    for (size_t i = 0; i < v.size(); ++i) {
+        ASSERT_EQ(0, return_object(v[i]));
+    }
+}
+
 } // namespace
@@ -216,3 +216,88 @@ TEST(RandUtilTest, fast_rand_perf) {
              ;
 #endif
 }
+
+TEST(RandUtilTest, fast_rand_less_than_bounds) {
+    const uint64_t ranges[] = {
+        1, 2, 3, 17, 1000, (1ULL << 32) + 1, (1ULL << 63) - 1, 1ULL << 63,
+        (1ULL << 63) + 1, std::numeric_limits<uint64_t>::max()
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(ranges); ++i) {
+        bool seen_upper_half = false;
+        for (int j = 0; j < 10000; ++j) {
+            const uint64_t r = butil::fast_rand_less_than(ranges[i]);
+            ASSERT_LT(r, ranges[i]);
+            seen_upper_half |= (r >= ranges[i] / 2);
+        }
+        ASSERT_TRUE(seen_upper_half || ranges[i] == 1) << ranges[i];
+    }
+}
+
+TEST(RandUtilTest, fast_rand_bytes_all_sizes) {
+    // Cover both the thread-local batch and generating in place.
+    char buf[4096 + 16];
+    for (size_t len = 0; len <= 4096; len = len * 2 + 7) {
+        memset(buf, 0, sizeof(buf));
+        butil::fast_rand_bytes(buf + 1, len);
+        ASSERT_EQ(0, buf[0]);
+        ASSERT_EQ(0, buf[len + 1]);
+        if (len >= 64) {
+            size_t nzero = 0;
+            for (size_t i = 1; i <= len; ++i) {
+                nzero += (buf[i] == 0);
+            }
+            ASSERT_LT(nzero, len / 16);
+        }
+    }
+}
+
+// Draw a random value like the load balancers do: from a single
+// xorshift128+ sequence and mapped into the range with divisions.
+static uint64_t rand_less_than_with_division(butil::FastRandSeed* seed,
+                                             uint64_t range) {
+    const uint64_t div = std::numeric_limits<uint64_t>::max() / range;
+    uint64_t result;
+    do {
+        result = butil::fast_rand(seed) / div;
+    } while (result >= range);
+    return result;
+}
+
+TEST(RandUtilTest, fast_rand_batch_perf) {
+    const int kTestIterations = 10000000;
+    const uint64_t kNumServers = 37;
+    uint64_t s = 0;
+    butil::FastRandSeed seed;
+    butil::init_fast_rand_seed(&seed);
+    butil::Timer tm;
+
+    tm.start();
+    for (int i = 0; i < kTestIterations; ++i) {
+        s += butil::fast_rand(&seed);
+    }
+    tm.stop();
+    const int64_t single = tm.n_elapsed();
+    tm.start();
+    for (int i = 0; i < kTestIterations; ++i) {
+        s += butil::fast_rand();
+    }
+    tm.stop();
+    LOG(INFO) << "fast_rand: single generator=" << single / (double)kTestIterations
+              << "ns batched=" << tm.n_elapsed() / (double)kTestIterations << "ns";
+
+    tm.start();
+    for (int i = 0; i < kTestIterations; ++i) {
+        s += rand_less_than_with_division(&seed, kNumServers);
+    }
+    tm.stop();
+    const int64_t with_div = tm.n_elapsed();
+    tm.start();
+    for (int i = 0; i < kTestIterations; ++i) {
+        s += butil::fast_rand_less_than(kNumServers);
+    }
+    tm.stop();
+    LOG(INFO) << "fast_rand_less_than(" << kNumServers << "): division="
+              << with_div / (double)kTestIterations << "ns multiply-shift="
+              << tm.n_elapsed() / (double)kTestIterations << "ns, s=" << s;
+}
+
@@ -21,6 +21,7 @@
 #include "butil/fast_rand.h"
 #include "butil/string_printf.h"
 #include "butil/file_util.h"
+#include "butil/files/memory_mapped_file.h"
 
 namespace {
 
@@ -321,4 +322,58 @@ TEST(RecordIOTest, write_read_random) {
     ASSERT_LE(str.size() - rr.offset(), 3u);
 }
 
+TEST(RecordIOTest, read_mapped_file_in_ranges) {
+    StringWriter sw;
+    butil::RecordWriter rw(&sw);
+    std::vector<std::string> payloads;
+    for (int i = 0; i < 2000; ++i) {
+        butil::Record src;
+        // Magic in payloads should not be taken as record boundaries.
+        std::string payload = rand_string(0, 300) + "RDIO" + rand_string(0, 30);
+        src.MutablePayload()->append(payload);
+        if (i % 3 == 0) {
+            src.MutableMeta("index")->append(butil::string_printf("%d", i));
+        }
+        ASSERT_EQ(0, rw.Write(src));
+        payloads.push_back(payload);
+    }
+    ASSERT_EQ(0, rw.Flush());
+    const butil::FilePath path("recordio_mapped.io");
+    ASSERT_EQ((int)sw.str().size(),
+              butil::WriteFile(path, sw.str().data(), sw.str().size()));
+    std::shared_ptr<butil::MemoryMappedFile> file(new butil::MemoryMappedFile);
+    ASSERT_TRUE(file->Initialize(path));
+    ASSERT_EQ(sw.str().size(), file->length());
+
+    const size_t nparts[] = { 1, 2, 3, 7, 64, 1000 };
+    for (size_t k = 0; k < arraysize(nparts); ++k) {
+        const size_t step = file->length() / nparts[k] + 1;
+        size_t j = 0;
+        for (size_t i = 0; i < nparts[k]; ++i) {
+            butil::RecordReader rr(file, i * step, (i + 1) * step);
+            butil::Record r;
+            for (; rr.ReadNext(&r); ++j) {
+                ASSERT_LT(j, payloads.size());
+                ASSERT_EQ(payloads[j], r.Payload()) << j;
+                ASSERT_EQ(j % 3 == 0 ? 1u : 0u, r.MetaCount());
+            }
+            ASSERT_EQ((int)butil::RecordReader::END_OF_READER,
+                      rr.last_error());
+        }
+        ASSERT_EQ(payloads.size(), j) << "nparts=" << nparts[k];
+    }
+
+    // Records reference the mapping which outlives the reader and `file'.
+    butil::Record last;
+    {
+        butil::RecordReader rr(file, file->length() - 400);
+        butil::Record r;
+        while (rr.ReadNext(&r)) {
+            last = r;
+        }
+    }
+    file.reset();
+    ASSERT_EQ(payloads.back(), last.Payload());
+}
+
 } // namespace
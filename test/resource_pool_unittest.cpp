@@ -401,6 +401,109 @@ TEST_F(ResourcePoolTest, get_and_return_int_multiple_threads) {
     ASSERT_EQ(0, memcmp(&info, &zero_info, sizeof(info)));
 }
 
+struct CrossThreadObj { int x; };
+
+const size_t CROSS_THREAD_MAX_LIVE = 20000;
+const size_t CROSS_THREAD_NGET = 200000;
+butil::atomic<int> g_cross_thread_in_use[CROSS_THREAD_NGET * 4];
+butil::atomic<int> g_cross_thread_errors(0);
+pthread_mutex_t g_cross_thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::vector<ResourceId<CrossThreadObj> > g_cross_thread_handoff;
+butil::atomic<int> g_cross_thread_ngetter(0);
+size_t g_cross_thread_max_id = 0;
+
+// Get resources and hand them over to other threads to return, like
+// dispatchers returning objects allocated by workers.
+void* get_and_hand_over(void*) {
+    std::vector<ResourceId<CrossThreadObj> > batch;
+    size_t max_id = 0;
+    for (size_t i = 0; i < CROSS_THREAD_NGET; ++i) {
+        ResourceId<CrossThreadObj> id;
+        if (get_resource(&id) == NULL ||
+            id.value >= ARRAY_SIZE(g_cross_thread_in_use) ||
+            g_cross_thread_in_use[id.value].exchange(1) != 0) {
+            g_cross_thread_errors.fetch_add(1);
+            continue;
+        }
+        max_id = std::max(max_id, (size_t)id.value);
+        batch.push_back(id);
+        if (batch.size() < 64) {
+            continue;
+        }
+        while (true) {
+            pthread_mutex_lock(&g_cross_thread_mutex);
+            if (g_cross_thread_handoff.size() < CROSS_THREAD_MAX_LIVE) {
+                g_cross_thread_handoff.insert(g_cross_thread_handoff.end(),
+                                              batch.begin(), batch.end());
+                pthread_mutex_unlock(&g_cross_thread_mutex);
+                break;
+            }
+            pthread_mutex_unlock(&g_cross_thread_mutex);
+            sched_yield();
+        }
+        batch.clear();
+    }
+    pthread_mutex_lock(&g_cross_thread_mutex);
+    g_cross_thread_handoff.insert(g_cross_thread_handoff.end(),
+                                  batch.begin(), batch.end());
+    g_cross_thread_max_id = std::max(g_cross_thread_max_id, max_id);
+    pthread_mutex_unlock(&g_cross_thread_mutex);
+    g_cross_thread_ngetter.fetch_sub(1);
+    return NULL;
+}
+
+void* return_handed_over(void*) {
+    std::vector<ResourceId<CrossThreadObj> > batch;
+    while (true) {
+        const bool getters_quit = (g_cross_thread_ngetter.load() == 0);
+        pthread_mutex_lock(&g_cross_thread_mutex);
+        batch.swap(g_cross_thread_handoff);
+        pthread_mutex_unlock(&g_cross_thread_mutex);
+        if (batch.empty()) {
+            if (getters_quit) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+            g_cross_thread_in_use[batch[i].value].store(0);
+            if (return_resource(batch[i]) != 0) {
+                g_cross_thread_errors.fetch_add(1);
+            }
+        }
+        batch.clear();
+    }
+    return NULL;
+}
+
+TEST_F(ResourcePoolTest, cross_thread_return) {
+    pthread_t getters[4];
+    pthread_t returners[4];
+    g_cross_thread_ngetter.store(ARRAY_SIZE(getters));
+    butil::Timer tm;
+    tm.start();
+    for (size_t i = 0; i < ARRAY_SIZE(getters); ++i) {
+        ASSERT_EQ(0, pthread_create(&getters[i], NULL, get_and_hand_over, NULL));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(returners); ++i) {
+        ASSERT_EQ(0, pthread_create(&returners[i], NULL, return_handed_over, NULL));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(getters); ++i) {
+        pthread_join(getters[i], NULL);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(returners); ++i) {
+        pthread_join(returners[i], NULL);
+    }
+    tm.stop();
+    ASSERT_EQ(0, g_cross_thread_errors.load());
+    ASSERT_TRUE(g_cross_thread_handoff.empty());
+    // Returned resources are reused by getters through global free chunks.
+    ASSERT_LT(g_cross_thread_max_id, CROSS_THREAD_NGET * ARRAY_SIZE(getters) / 2);
+    printf("get/return across threads took %.1fns each\n",
+           tm.n_elapsed() / (double)(CROSS_THREAD_NGET * ARRAY_SIZE(getters)));
+}
+
 TEST_F(ResourcePoolTest, verify_get) {
     clear_resources<int>();
     std::cout << describe_resources<int>() << std::endl;
@@ -421,4 +524,22 @@ TEST_F(ResourcePoolTest, verify_get) {
 
     clear_resources<int>();
 }
+
+struct BAIDU_CACHELINE_ALIGNMENT AlignedObj {
+    int val;
+};
+
+TEST_F(ResourcePoolTest, cacheline_aligned) {
+    std::vector<ResourceId<AlignedObj> > ids;
+    for (int i = 0; i < 1000; ++i) {
+        ResourceId<AlignedObj> id;
+        AlignedObj* p = get_resource(&id);
+        ASSERT_TRUE(p);
+        ASSERT_EQ(0UL, (uintptr_t)p % BAIDU_CACHELINE_SIZE);
+        ids.push_back(id);
+    }
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ASSERT_EQ(0, return_resource(ids[i]));
+    }
+}
 } // namespace
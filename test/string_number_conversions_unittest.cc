@@ -791,6 +791,15 @@ TEST(StringNumberConversionsTest, HexEncode) {
   unsigned char bytes[] = {0x01, 0xff, 0x02, 0xfe, 0x03, 0x80, 0x81};
   hex = HexEncode(bytes, sizeof(bytes));
   EXPECT_EQ(hex.compare("01FF02FE038081"), 0);
+
+  // Long enough to be encoded in vectors.
+  unsigned char long_bytes[37];
+  std::string expected;
+  for (size_t i = 0; i < sizeof(long_bytes); ++i) {
+    long_bytes[i] = i * 37;
+    expected += StringPrintf("%02X", long_bytes[i]);
+  }
+  EXPECT_EQ(expected, HexEncode(long_bytes, sizeof(long_bytes)));
 }
 
 }  // namespace butil
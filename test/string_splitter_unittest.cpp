@@ -17,7 +17,12 @@
 
 #include <gtest/gtest.h>
 #include "butil/string_splitter.h"
+#include <math.h>
 #include <stdlib.h>
+#include <string>
+#include <vector>
+#include "butil/number_parsing.h"
+#include "butil/fast_rand.h"
 
 namespace {
 class StringSplitterTest : public ::testing::Test{
@@ -448,4 +453,127 @@ TEST_F(StringSplitterTest, key_value_pairs_splitter_sanity) {
     }
 }
 
+TEST_F(StringSplitterTest, multi_separators_with_nul) {
+    const char str[] = "a,b;\0c d,;e";
+    std::vector<std::string> fields;
+    for (butil::StringMultiSplitter s(str, str + sizeof(str) - 1, ",; ",
+                                      butil::ALLOW_EMPTY_FIELD); s; ++s) {
+        fields.push_back(std::string(s.field(), s.length()));
+    }
+    ASSERT_EQ(6u, fields.size());
+    ASSERT_EQ("a", fields[0]);
+    ASSERT_EQ("b", fields[1]);
+    ASSERT_EQ(std::string("\0c", 2), fields[2]);
+    ASSERT_EQ("d", fields[3]);
+    ASSERT_EQ("", fields[4]);
+    ASSERT_EQ("e", fields[5]);
+
+    // Separators with the highest bit set.
+    const char str2[] = "x\xff" "y\x80z";
+    fields.clear();
+    for (butil::StringMultiSplitter s(str2, "\xff\x80"); s; ++s) {
+        fields.push_back(std::string(s.field(), s.length()));
+    }
+    ASSERT_EQ(3u, fields.size());
+    ASSERT_EQ("x", fields[0]);
+    ASSERT_EQ("y", fields[1]);
+    ASSERT_EQ("z", fields[2]);
+}
+
+TEST_F(StringSplitterTest, parse_integers) {
+    int64_t i = 0;
+    uint64_t u = 0;
+    const char* const good[] = {
+        "0", "-0", "+7", "12345678", "123456789", "-9223372036854775808",
+        "9223372036854775807", "0000000000000000000000000042"
+    };
+    for (size_t k = 0; k < sizeof(good) / sizeof(good[0]); ++k) {
+        const char* s = good[k];
+        ASSERT_TRUE(butil::ParseInt64(s, s + strlen(s), &i)) << s;
+        ASSERT_EQ(strtoll(s, NULL, 10), i) << s;
+    }
+    const char* const bad[] = {
+        "", "-", "+", " 1", "1 ", "12a", "9223372036854775808",
+        "-9223372036854775809", "1.0", "0x10"
+    };
+    for (size_t k = 0; k < sizeof(bad) / sizeof(bad[0]); ++k) {
+        const char* s = bad[k];
+        ASSERT_FALSE(butil::ParseInt64(s, s + strlen(s), &i)) << s;
+    }
+    const char* max_u64 = "18446744073709551615";
+    ASSERT_TRUE(butil::ParseUint64(max_u64, max_u64 + strlen(max_u64), &u));
+    ASSERT_EQ(UINT64_MAX, u);
+    const char* overflow = "18446744073709551616";
+    ASSERT_FALSE(butil::ParseUint64(overflow, overflow + strlen(overflow), &u));
+    const char* neg = "-1";
+    ASSERT_FALSE(butil::ParseUint64(neg, neg + 2, &u));
+
+    for (int k = 0; k < 100000; ++k) {
+        const int64_t v = (int64_t)butil::fast_rand() >>
+            butil::fast_rand_less_than(64);
+        const std::string s = std::to_string(v);
+        ASSERT_TRUE(butil::ParseInt64(s.data(), s.data() + s.size(), &i)) << s;
+        ASSERT_EQ(v, i);
+    }
+}
+
+TEST_F(StringSplitterTest, parse_floats) {
+    const char* const cases[] = {
+        "0", "-0", "1", "0.5", ".5", "5.", "3.1415926", "-2.5e-3", "1e22",
+        "1e23", "123456789012345678901234567890", "0.1", "1.7976931348623157e308",
+        "4.9e-324", "1e-400", "inf", "-nan", "0x1p3", "0.000000000000000000001"
+    };
+    double d = 0;
+    float f = 0;
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); ++k) {
+        const char* s = cases[k];
+        const char* end = s + strlen(s);
+        ASSERT_TRUE(butil::ParseDouble(s, end, &d)) << s;
+        const double expected_d = strtod(s, NULL);
+        ASSERT_TRUE(memcmp(&d, &expected_d, sizeof(d)) == 0 ||
+                    (d != d && expected_d != expected_d)) << s;
+        ASSERT_TRUE(butil::ParseFloat(s, end, &f)) << s;
+        const float expected_f = strtof(s, NULL);
+        ASSERT_TRUE(memcmp(&f, &expected_f, sizeof(f)) == 0 ||
+                    (f != f && expected_f != expected_f)) << s;
+    }
+    const char* const bad[] = { "", "-", ".", "1e", "1.2.3", "e5", "1 " };
+    for (size_t k = 0; k < sizeof(bad) / sizeof(bad[0]); ++k) {
+        const char* s = bad[k];
+        ASSERT_FALSE(butil::ParseDouble(s, s + strlen(s), &d)) << s;
+    }
+
+    char buf[64];
+    for (int k = 0; k < 100000; ++k) {
+        const int len = snprintf(
+            buf, sizeof(buf), "%.*g", (int)butil::fast_rand_less_than(18) + 1,
+            (butil::fast_rand_double() - 0.5) *
+            pow(10, (int)butil::fast_rand_less_than(40) - 20));
+        ASSERT_TRUE(butil::ParseDouble(buf, buf + len, &d)) << buf;
+        ASSERT_EQ(strtod(buf, NULL), d) << buf;
+        ASSERT_TRUE(butil::ParseFloat(buf, buf + len, &f)) << buf;
+        ASSERT_EQ(strtof(buf, NULL), f) << buf;
+    }
+}
+
+TEST_F(StringSplitterTest, fast_parsing_keeps_legacy_behavior) {
+    butil::StringSplitter s(" 12, 99999999999999999999,,1.5e3", ',',
+                            butil::ALLOW_EMPTY_FIELD);
+    long l = 0;
+    ASSERT_EQ(0, s.to_long(&l));
+    ASSERT_EQ(12, l);
+    ++s;
+    unsigned long long ull = 0;
+    ASSERT_EQ(0, s.to_ulonglong(&ull));
+    ASSERT_EQ(ULLONG_MAX, ull);
+    ++s;
+    // Empty fields are parsed as 0 by strtol.
+    ASSERT_EQ(0, s.to_long(&l));
+    ASSERT_EQ(0, l);
+    ++s;
+    double d = 0;
+    ASSERT_EQ(0, s.to_double(&d));
+    ASSERT_EQ(1500.0, d);
+}
+
 }
@@ -0,0 +1,243 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <malloc.h>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "butil/time.h"
+#include "butil/macros.h"
+#include "butil/fast_rand.h"
+#include "butil/string_printf.h"
+#include "butil/containers/flat_map.h"
+#include "butil/containers/swiss_map.h"
+
+namespace {
+
+TEST(SwissMapTest, sanity) {
+    butil::SwissMap<int, int> m;
+    ASSERT_TRUE(m.empty());
+    ASSERT_EQ(NULL, m.seek(1));
+    ASSERT_EQ(0u, m.erase(1));
+    ASSERT_EQ(10, *m.insert(1, 10));
+    ASSERT_EQ(20, *m.insert(std::make_pair(2, 20)));
+    ASSERT_EQ(2u, m.size());
+    ASSERT_EQ(10, *m.seek(1));
+    // Overwrite existing value.
+    ASSERT_EQ(11, *m.insert(1, 11));
+    ASSERT_EQ(2u, m.size());
+    m[3] = 30;
+    ASSERT_EQ(30, *m.seek(3));
+    ASSERT_EQ(0, m[4]);
+    ASSERT_EQ(4u, m.size());
+
+    int old_value = 0;
+    ASSERT_EQ(1u, m.erase(1, &old_value));
+    ASSERT_EQ(11, old_value);
+    ASSERT_EQ(NULL, m.seek(1));
+    ASSERT_EQ(3u, m.size());
+
+    int sum = 0;
+    size_t n = 0;
+    for (butil::SwissMap<int, int>::const_iterator it = m.begin();
+         it != m.end(); ++it, ++n) {
+        sum += it->second;
+    }
+    ASSERT_EQ(3u, n);
+    ASSERT_EQ(50, sum);
+
+    m.clear();
+    ASSERT_TRUE(m.empty());
+    ASSERT_EQ(m.begin(), m.end());
+    ASSERT_EQ(NULL, m.seek(2));
+}
+
+TEST(SwissMapTest, string_key) {
+    butil::SwissMap<std::string, std::string> m;
+    for (int i = 0; i < 1000; ++i) {
+        std::string key = butil::string_printf("key_%d", i);
+        ASSERT_TRUE(m.insert(key, key + "_value"));
+    }
+    ASSERT_EQ(1000u, m.size());
+    ASSERT_EQ("key_7_value", *m.seek("key_7"));
+    ASSERT_EQ("key_999_value", *m.seek(butil::StringPiece("key_999")));
+    ASSERT_EQ(NULL, m.seek(std::string("key_1000")));
+}
+
+TEST(SwissMapTest, init_and_copy) {
+    butil::SwissMap<int, int> m;
+    ASSERT_EQ(0, m.init(1000));
+    const size_t cap = m.capacity();
+    ASSERT_GE(cap * 7 / 8, 1000u);
+    for (int i = 0; i < 1000; ++i) {
+        m[i] = i * 2;
+    }
+    // No resize happened.
+    ASSERT_EQ(cap, m.capacity());
+
+    butil::SwissMap<int, int> m2(m);
+    butil::SwissMap<int, int> m3;
+    m3[-1] = -1;
+    m3 = m;
+    ASSERT_EQ(NULL, m3.seek(-1));
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQ(i * 2, *m2.seek(i));
+        ASSERT_EQ(i * 2, *m3.seek(i));
+    }
+    m2.swap(m3);
+    m3.clear();
+    ASSERT_EQ(1000u, m2.size());
+    ASSERT_TRUE(m3.empty());
+}
+
+TEST(SwissMapTest, random_insert_erase) {
+    butil::SwissMap<uint64_t, uint64_t> m;
+    std::map<uint64_t, uint64_t> ref;
+    for (int round = 0; round < 200000; ++round) {
+        const uint64_t key = butil::fast_rand_less_than(5000);
+        if (butil::fast_rand_less_than(3) == 0) {
+            ASSERT_EQ(ref.erase(key), m.erase(key));
+        } else {
+            ref[key] = round;
+            m[key] = round;
+        }
+        ASSERT_EQ(ref.size(), m.size());
+    }
+    for (std::map<uint64_t, uint64_t>::iterator it = ref.begin();
+         it != ref.end(); ++it) {
+        uint64_t* v = m.seek(it->first);
+        ASSERT_TRUE(v != NULL);
+        ASSERT_EQ(it->second, *v);
+    }
+    size_t n = 0;
+    for (butil::SwissMap<uint64_t, uint64_t>::iterator it = m.begin();
+         it != m.end(); ++it, ++n) {
+        ASSERT_EQ(ref[it->first], it->second);
+    }
+    ASSERT_EQ(ref.size(), n);
+    // Deleted slots are reused or dropped, so that the capacity is bounded
+    // by the number of living keys rather than insertions.
+    ASSERT_LE(m.capacity(), 16384u);
+}
+
+// Bytes allocated by malloc since `start', including mmap-ed big chunks.
+size_t malloc_bytes_since(size_t start) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    const struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd - start;
+#else
+    (void)start;
+    return 0;
+#endif
+}
+
+size_t malloc_bytes_now() {
+    return malloc_bytes_since(0);
+}
+
+template <typename Map>
+void fill_map(Map& m, const std::vector<uint64_t>& keys) {
+    for (size_t i = 0; i < keys.size(); ++i) {
+        m[keys[i]] = i;
+    }
+}
+
+template <typename Map>
+int64_t seek_ns(const Map& m, const std::vector<uint64_t>& keys) {
+    butil::Timer tm;
+    size_t nfound = 0;
+    tm.start();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        nfound += (m.seek(keys[i]) != NULL);
+    }
+    tm.stop();
+    EXPECT_EQ(keys.size() / 2, nfound);
+    return tm.n_elapsed() / keys.size();
+}
+
+template <typename Map>
+int64_t find_ns(const Map& m, const std::vector<uint64_t>& keys) {
+    butil::Timer tm;
+    size_t nfound = 0;
+    tm.start();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        nfound += (m.find(keys[i]) != m.end());
+    }
+    tm.stop();
+    EXPECT_EQ(keys.size() / 2, nfound);
+    return tm.n_elapsed() / keys.size();
+}
+
+TEST(SwissMapTest, perf_cmp_with_other_maps) {
+    const size_t nkeys[] = { 1000, 100000, 1000000 };
+    for (size_t pass = 0; pass < ARRAY_SIZE(nkeys); ++pass) {
+        std::vector<uint64_t> keys;
+        for (size_t i = 0; i < nkeys[pass]; ++i) {
+            keys.push_back(butil::fast_rand());
+        }
+        // Half of the seeked keys exist.
+        std::vector<uint64_t> seeked;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            seeked.push_back(i % 2 ? keys[butil::fast_rand_less_than(keys.size())]
+                                   : keys[i] ^ 0x1);
+        }
+
+        size_t start = malloc_bytes_now();
+        butil::SwissMap<uint64_t, uint64_t> swiss_map;
+        fill_map(swiss_map, keys);
+        const size_t swiss_mem = malloc_bytes_since(start);
+
+        start = malloc_bytes_now();
+        butil::FlatMap<uint64_t, uint64_t> flat_map;
+        fill_map(flat_map, keys);
+        const size_t flat_mem = malloc_bytes_since(start);
+
+        start = malloc_bytes_now();
+        std::unordered_map<uint64_t, uint64_t> unordered_map;
+        fill_map(unordered_map, keys);
+        const size_t unordered_mem = malloc_bytes_since(start);
+
+        start = malloc_bytes_now();
+        std::map<uint64_t, uint64_t> std_map;
+        fill_map(std_map, keys);
+        const size_t std_mem = malloc_bytes_since(start);
+
+        // Make sure half of `seeked' exist in all maps.
+        for (size_t i = 0; i < seeked.size(); i += 2) {
+            if (swiss_map.seek(seeked[i]) != NULL) {
+                seeked[i] = 0;
+                while (swiss_map.seek(seeked[i]) != NULL) {
+                    ++seeked[i];
+                }
+            }
+        }
+        const int64_t swiss_ns = seek_ns(swiss_map, seeked);
+        const int64_t flat_ns = seek_ns(flat_map, seeked);
+        const int64_t unordered_ns = find_ns(unordered_map, seeked);
+        const int64_t std_ns = find_ns(std_map, seeked);
+        LOG(INFO) << "Seeking " << keys.size()
+                  << " keys from SwissMap/FlatMap/std::unordered_map/std::map"
+                  << " takes " << swiss_ns << "/" << flat_ns << "/"
+                  << unordered_ns << "/" << std_ns << "ns per key, memory="
+                  << swiss_mem << "/" << flat_mem << "/" << unordered_mem
+                  << "/" << std_mem << " bytes";
+    }
+}
+
+}  // namespace
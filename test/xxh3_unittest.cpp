@@ -0,0 +1,126 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string>
+#include "butil/iobuf.h"
+#include "butil/xxh3.h"
+#include "butil/containers/flat_map.h"
+
+namespace {
+
+// Generated by XXH3_64bits() and XXH3_64bits_withSeed(seed=42) of
+// xxHash 0.8.
+const struct {
+    size_t len;
+    uint64_t hash;
+    uint64_t hash_seed42;
+} kVectors[] = {
+    { 0, 0x2d06800538d394c2ULL, 0xb029411ff43d84d2ULL },
+    { 3, 0x15f7093b173d005cULL, 0x0322c472f9dd3c8aULL },
+    { 8, 0xdec6a9a43575982eULL, 0xb18293e9a9982b58ULL },
+    { 16, 0x7e484c18d74895d0ULL, 0x0126fe5707ca8f2bULL },
+    { 100, 0x8c97158042fbf926ULL, 0x4ca5c3a331119e67ULL },
+    { 200, 0x12fdb864685f344dULL, 0x9b4d9e4b4078c30fULL },
+    { 1000, 0x989765d0ea7a5ecdULL, 0x210176ac002574adULL },
+    { 4096, 0xa3c19f8174cde0bbULL, 0x334b260cacb92ca4ULL },
+};
+
+std::string PatternData(size_t len) {
+    std::string s(len, '\0');
+    for (size_t i = 0; i < len; ++i) {
+        s[i] = (char)(i * 31 + 7);
+    }
+    return s;
+}
+
+TEST(XXH3Test, same_as_reference) {
+    const std::string data = PatternData(4096);
+    for (size_t i = 0; i < arraysize(kVectors); ++i) {
+        ASSERT_EQ(kVectors[i].hash,
+                  butil::XXH3Hash64(data.data(), kVectors[i].len))
+            << "len=" << kVectors[i].len;
+        ASSERT_EQ(kVectors[i].hash_seed42,
+                  butil::XXH3Hash64(data.data(), kVectors[i].len, 42))
+            << "len=" << kVectors[i].len;
+    }
+}
+
+TEST(XXH3Test, stream_in_random_pieces) {
+    srand(1234);
+    const std::string data = PatternData(8192);
+    for (size_t len = 0; len < data.size(); len += 1 + rand() % 97) {
+        for (uint64_t seed = 0; seed < 2; ++seed) {
+            const uint64_t expected = butil::XXH3Hash64(data.data(), len, seed);
+            butil::XXH3Stream h(seed);
+            for (size_t off = 0; off < len;) {
+                const size_t n = std::min<size_t>(1 + rand() % 600, len - off);
+                h.Update(data.data() + off, n);
+                off += n;
+            }
+            ASSERT_EQ(expected, h.Digest()) << "len=" << len;
+        }
+    }
+}
+
+TEST(XXH3Test, digest_does_not_change_state) {
+    const std::string data = PatternData(1000);
+    butil::XXH3Stream h;
+    h.Update(data.data(), 500);
+    ASSERT_EQ(butil::XXH3Hash64(data.data(), 500), h.Digest());
+    h.Update(data.data() + 500, 500);
+    ASSERT_EQ(butil::XXH3Hash64(data.data(), 1000), h.Digest());
+    h.Reset();
+    ASSERT_EQ(butil::XXH3Hash64(NULL, 0), h.Digest());
+}
+
+TEST(XXH3Test, iobuf) {
+    const std::string data = PatternData(100000);
+    butil::IOBuf buf;
+    // Pieces are appended by reference, making a multi-block IOBuf.
+    for (size_t off = 0; off < data.size();) {
+        const size_t n = std::min<size_t>(777, data.size() - off);
+        butil::IOBuf piece;
+        piece.append(data.data() + off, n);
+        buf.append(piece);
+        off += n;
+    }
+    ASSERT_GT(buf.backing_block_num(), 1UL);
+    ASSERT_EQ(butil::XXH3Hash64(data.data(), data.size()),
+              butil::XXH3Hash64(buf));
+    ASSERT_EQ(butil::XXH3Hash64(data.data(), data.size(), 7),
+              butil::XXH3Hash64(buf, 7));
+}
+
+TEST(XXH3Test, flatmap_hasher) {
+    butil::FlatMap<std::string, int, butil::XXH3StringHasher> m;
+    ASSERT_EQ(0, m.init(64));
+    for (int i = 0; i < 1000; ++i) {
+        m[PatternData(i)] = i;
+    }
+    ASSERT_EQ(1000UL, m.size());
+    for (int i = 0; i < 1000; ++i) {
+        const int* v = m.seek(PatternData(i));
+        ASSERT_TRUE(v != NULL);
+        ASSERT_EQ(i, *v);
+    }
+    ASSERT_EQ(butil::XXH3StringHasher()(std::string("hello")),
+              butil::XXH3StringHasher()("hello"));
+}
+
+} // namespace
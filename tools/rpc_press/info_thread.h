@@ -27,11 +27,15 @@ struct InfoThreadOptions {
     bvar::LatencyRecorder* latency_recorder;
     bvar::Adder<int64_t>* sent_count;
     bvar::Adder<int64_t>* error_count;
+    // Optional. Latencies measured from the time that requests were
+    // supposed to be sent, printed along with `latency_recorder'.
+    bvar::LatencyRecorder* corrected_latency_recorder;
 
     InfoThreadOptions()
         : latency_recorder(NULL)
         , sent_count(NULL)
-        , error_count(NULL) {}
+        , error_count(NULL)
+        , corrected_latency_recorder(NULL) {}
 };
 
 class InfoThread {
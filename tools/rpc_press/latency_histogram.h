@@ -0,0 +1,63 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef PBRPCPRESS_LATENCY_HISTOGRAM_H
+#define PBRPCPRESS_LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <butil/atomicops.h>
+#include <butil/macros.h>
+
+namespace pbrpcframework {
+
+// A log-linear histogram of latencies like HdrHistogram: values below 128
+// are counted exactly, larger values are counted in buckets whose widths
+// are 1/64 of their lower bounds, so percentiles have relative errors less
+// than 1.6%. Recording is lock-free and exact, unlike bvar::LatencyRecorder
+// which samples values and forgets them after a time window, so that
+// latencies of a whole step of pressure can be summarized.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(int64_t latency_us);
+
+    int64_t count() const;
+    int64_t max_latency() const;
+    int64_t latency() const;  // average
+    // The smallest latency that `ratio' of latencies are not greater than,
+    // rounded up to the upper bound of the bucket.
+    int64_t latency_percentile(double ratio) const;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(LatencyHistogram);
+
+    static const int SUB_BUCKET_BITS = 6;
+    static const int NBUCKET = (64 - SUB_BUCKET_BITS) << SUB_BUCKET_BITS;
+
+    static int bucket_of(int64_t value);
+    static int64_t upper_bound_of(int bucket);
+
+    butil::atomic<int64_t> _buckets[NBUCKET];
+    butil::atomic<int64_t> _count;
+    butil::atomic<int64_t> _sum;
+    butil::atomic<int64_t> _max;
+};
+
+} // namespace pbrpcframework
+
+#endif // PBRPCPRESS_LATENCY_HISTOGRAM_H
@@ -44,6 +44,18 @@ DEFINE_int32(attachment_size, 0, "Carry so many byte attachment along with reque
 DEFINE_int32(duration, 0, "how many seconds the press keep");
 DEFINE_int32(qps, 100 , "how many calls  per seconds");
 DEFINE_bool(pretty, true, "output pretty jsons");
+DEFINE_string(arrival, "constant", "Distribution of intervals between requests "
+              "when -qps is positive: constant, poisson");
+DEFINE_bool(open_loop, false, "Send requests at the scheduled time even if "
+            "sending is delayed by slow responses, instead of skipping "
+            "requests behind schedule");
+DEFINE_int32(max_qps, 0, "Increase qps from -qps to this value by -qps_step "
+             "every -step_duration seconds");
+DEFINE_int32(qps_step, 0, "Increment of qps in each step");
+DEFINE_int32(step_duration, 10, "Seconds of each step of qps");
+DEFINE_string(report, "", "The file to write latencies of each step of qps "
+              "in, stdout if empty");
+DEFINE_string(report_format, "csv", "Format of -report: csv, json");
 
 bool set_press_options(pbrpcframework::PressOptions* options){
     size_t dot_pos = FLAGS_method.find_last_of('.');
@@ -61,7 +73,7 @@ bool set_press_options(pbrpcframework::PressOptions* options){
         if (FLAGS_qps <= 0) { // unlimited qps
             options->test_thread_num = 50;
         } else {
-            options->test_thread_num = FLAGS_qps / 10000;
+            options->test_thread_num = std::max(FLAGS_qps, FLAGS_max_qps) / 10000;
             if (options->test_thread_num < 1) {
                 options->test_thread_num = 1;
             }
@@ -71,8 +83,28 @@ bool set_press_options(pbrpcframework::PressOptions* options){
         }
     }
 
+    if (FLAGS_arrival == "poisson") {
+        options->poisson_arrival = true;
+    } else if (FLAGS_arrival != "constant") {
+        LOG(ERROR) << "Unknown -arrival=" << FLAGS_arrival;
+        return false;
+    }
+    options->open_loop = FLAGS_open_loop;
+    if (FLAGS_max_qps > FLAGS_qps) {
+        if (FLAGS_qps <= 0 || FLAGS_qps_step <= 0 || FLAGS_step_duration <= 0) {
+            LOG(ERROR) << "-qps, -qps_step and -step_duration must be positive"
+                " when -max_qps is set";
+            return false;
+        }
+        options->max_req_rate = FLAGS_max_qps;
+        options->req_rate_step = FLAGS_qps_step;
+    }
+    options->report = FLAGS_report;
+    options->report_format = FLAGS_report_format;
+
     const int rate_limit_per_thread = 1000000;
-    double req_rate_per_thread = options->test_req_rate / options->test_thread_num;
+    double req_rate_per_thread =
+        std::max(options->test_req_rate, options->max_req_rate) / options->test_thread_num;
     if (req_rate_per_thread > rate_limit_per_thread) {
         LOG(ERROR) << "req_rate: " << (int64_t) req_rate_per_thread << " is too large in one thread. The rate limit is " 
                 <<  rate_limit_per_thread << " in one thread";
@@ -115,7 +147,13 @@ int main(int argc, char* argv[]) {
     }
 
     rpc_press->start();
-    if (FLAGS_duration <= 0) {
+    if (FLAGS_max_qps > FLAGS_qps) {
+        do {
+            for (int i = 0; i < FLAGS_step_duration && !brpc::IsAskedToQuit(); ++i) {
+                sleep(1);
+            }
+        } while (!brpc::IsAskedToQuit() && rpc_press->next_step());
+    } else if (FLAGS_duration <= 0) {
         while (!brpc::IsAskedToQuit()) {
             sleep(1);
         }
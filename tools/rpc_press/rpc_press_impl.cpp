@@ -22,9 +22,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <math.h>
 #include <bthread/bthread.h>
 #include <butil/file_util.h>                     // butil::FilePath
 #include <butil/time.h>
+#include <butil/fast_rand.h>
 #include <brpc/channel.h>
 #include <brpc/controller.h>
 #include <butil/logging.h>
@@ -92,7 +94,9 @@ void PressClient::call_method(brpc::Controller* cntl, Message* request,
 }
 
 RpcPress::RpcPress()
-    : _pbrpc_client(NULL)
+    : _inflight_count(0)
+    , _cur_step(0)
+    , _pbrpc_client(NULL)
     , _started(false)
     , _stop(false)
     , _output_json(NULL) {
@@ -103,6 +107,9 @@ RpcPress::~RpcPress() {
         fclose(_output_json);
         _output_json = NULL;
     }
+    for (size_t i = 0; i < _steps.size(); ++i) {
+        delete _steps[i];
+    }
     delete _importer;
 }
 
@@ -180,7 +187,19 @@ int RpcPress::init(const PressOptions* options) {
         return -1;
     }
     LOG(INFO) << "Loaded " << _msgs.size() << " requests";
+    if (_options.report_format != "csv" && _options.report_format != "json") {
+        LOG(ERROR) << "Unknown report format=" << _options.report_format;
+        return -1;
+    }
+    _steps.push_back(new PressStep(_options.test_req_rate));
+    if (_options.test_req_rate > 0 && _options.req_rate_step > 0) {
+        for (double rate = _options.test_req_rate + _options.req_rate_step;
+             rate <= _options.max_req_rate; rate += _options.req_rate_step) {
+            _steps.push_back(new PressStep(rate));
+        }
+    }
     _latency_recorder.expose("rpc_press");
+    _corrected_latency_recorder.expose("rpc_press_corrected");
     _error_count.expose("rpc_press_error_count");
     return 0;
 }
@@ -193,10 +212,15 @@ void* RpcPress::sync_call_thread(void* arg) {
 void RpcPress::handle_response(brpc::Controller* cntl, 
                                Message* request,
                                Message* response, 
-                               int64_t start_time){
+                               int64_t start_time,
+                               int64_t intended_time,
+                               PressStep* step){
     if (!cntl->Failed()){
-        int64_t rpc_call_time_us = butil::gettimeofday_us() - start_time;
+        const int64_t end_time = butil::monotonic_time_us();
+        int64_t rpc_call_time_us = end_time - start_time;
         _latency_recorder << rpc_call_time_us;
+        _corrected_latency_recorder << end_time - intended_time;
+        step->latency.record(end_time - intended_time);
 
         if (_output_json) {
             std::string response_json;
@@ -210,55 +234,69 @@ void RpcPress::handle_response(brpc::Controller* cntl,
         LOG(WARNING) << "error_code=" <<  cntl->ErrorCode() << ", "
                    << cntl->ErrorText();
         _error_count << 1;
+        step->error_count << 1;
     }
     delete response;
     delete cntl;
+    _inflight_count.fetch_sub(1, butil::memory_order_relaxed);
 }
 
 static butil::atomic<int> g_thread_count(0);
 
 void RpcPress::sync_client() {
-    double req_rate = _options.test_req_rate / _options.test_thread_num;
-    //max make up time is 5 s
     if (_msgs.empty()) {
         LOG(ERROR) << "nothing to send!";
         return;
     }
     const int thread_index = g_thread_count.fetch_add(1, butil::memory_order_relaxed);
     int msg_index = thread_index;
-    int64_t last_expected_time = butil::monotonic_time_ns();
-    const int64_t interval = (int64_t) (1000000000L / req_rate);
-    // the max tolerant delay between end_time and expected_time. 10ms or 10 intervals
-    int64_t max_tolerant_delay = std::max((int64_t) 10000000L, 10 * interval);    
+    // The time that next request is supposed to be sent.
+    int64_t expected_time = butil::monotonic_time_ns();
     while (!_stop) {
+        PressStep* step = _steps[_cur_step.load(butil::memory_order_relaxed)];
+        const double req_rate = step->req_rate / _options.test_thread_num;
+        const int64_t interval =
+            (req_rate > 0 ? (int64_t)(1000000000L / req_rate) : 0);
+        if (_options.test_req_rate > 0) {
+            const int64_t now = butil::monotonic_time_ns();
+            if (now < expected_time) {
+                usleep((expected_time - now) / 1000);
+            } else if (!_options.open_loop &&
+                       // the max tolerant delay. 10ms or 10 intervals
+                       now - expected_time > std::max((int64_t)10000000L, 10 * interval)) {
+                // Skip requests behind schedule, whose latencies are not
+                // counted. Specify -open_loop to keep them.
+                expected_time = now;
+            }
+        }
         brpc::Controller* cntl = new brpc::Controller;
         msg_index = (msg_index + _options.test_thread_num) % _msgs.size();
         Message* request = _msgs[msg_index];
         Message* response = _pbrpc_client->get_output_message();
-        const int64_t start_time = butil::gettimeofday_us();
+        const int64_t start_time = butil::monotonic_time_us();
+        const int64_t intended_time =
+            (_options.test_req_rate > 0 ? expected_time / 1000 : start_time);
         google::protobuf::Closure* done = brpc::NewCallback<
             RpcPress, 
             RpcPress*, 
             brpc::Controller*, 
             Message*, 
-            Message*, int64_t>
-            (this, &RpcPress::handle_response, cntl, request, response, start_time);
+            Message*, int64_t, int64_t, PressStep*>
+            (this, &RpcPress::handle_response, cntl, request, response,
+             start_time, intended_time, step);
         const brpc::CallId cid1 = cntl->call_id();
+        _inflight_count.fetch_add(1, butil::memory_order_relaxed);
         _pbrpc_client->call_method(cntl, request, response, done);
         _sent_count << 1;
+        step->sent_count << 1;
 
         if (_options.test_req_rate <= 0) { 
             brpc::Join(cid1);
+        } else if (_options.poisson_arrival) {
+            // Exponentially distributed intervals make a poisson process.
+            expected_time += (int64_t)(-log(1 - butil::fast_rand_double()) * interval);
         } else {
-            int64_t end_time = butil::monotonic_time_ns();
-            int64_t expected_time = last_expected_time + interval;
-            if (end_time < expected_time) {
-                usleep((expected_time - end_time)/1000);
-            }
-            if (end_time - expected_time > max_tolerant_delay) {
-                expected_time = end_time;
-            }            
-            last_expected_time = expected_time;
+            expected_time += interval;
         }
     }
 }
@@ -276,13 +314,29 @@ int RpcPress::start() {
     info_thr_opt.latency_recorder = &_latency_recorder;
     info_thr_opt.error_count = &_error_count;
     info_thr_opt.sent_count = &_sent_count;
+    info_thr_opt.corrected_latency_recorder = &_corrected_latency_recorder;
     if (!_info_thr.start(info_thr_opt)) {
         LOG(ERROR) << "Fail to create stats thread";
         return -1;
     }
+    _steps[0]->begin_us = butil::gettimeofday_us();
     _started = true;
     return 0;
 }
+
+bool RpcPress::next_step() {
+    const int cur = _cur_step.load(butil::memory_order_relaxed);
+    if (cur + 1 >= (int)_steps.size()) {
+        return false;
+    }
+    const int64_t now = butil::gettimeofday_us();
+    _steps[cur]->end_us = now;
+    _steps[cur + 1]->begin_us = now;
+    _cur_step.store(cur + 1, butil::memory_order_relaxed);
+    LOG(INFO) << "Increase qps to " << _steps[cur + 1]->req_rate;
+    return true;
+}
+
 int RpcPress::stop() {
     if (!_started) {
         return -1;
@@ -291,7 +345,82 @@ int RpcPress::stop() {
     for (size_t i = 0; i < _ttid.size(); i++) {
         pthread_join(_ttid[i], NULL);
     }
+    _steps[_cur_step.load(butil::memory_order_relaxed)]->end_us =
+        butil::gettimeofday_us();
+    // Wait for pending responses which are counted in the steps.
+    const int64_t deadline = butil::gettimeofday_us() +
+        (int64_t)_options.timeout_ms * (_options.max_retry + 1) * 1000L;
+    while (_inflight_count.load(butil::memory_order_relaxed) > 0 &&
+           butil::gettimeofday_us() < deadline) {
+        usleep(10000);
+    }
     _info_thr.stop();
+    if (!_options.report.empty() || _steps.size() > 1) {
+        write_report();
+    }
     return 0;
 }
+
+void RpcPress::write_report() {
+    FILE* fp = stdout;
+    if (!_options.report.empty()) {
+        fp = fopen(_options.report.c_str(), "w");
+        if (fp == NULL) {
+            PLOG(ERROR) << "Fail to open " << _options.report;
+            return;
+        }
+    }
+    const bool json = (_options.report_format == "json");
+    if (json) {
+        fprintf(fp, "[");
+    } else {
+        fprintf(fp, "qps,duration_s,sent,success,error,achieved_qps,avg_us,"
+                "p50_us,p90_us,p99_us,p999_us,p9999_us,max_us\n");
+    }
+    const int nstep = _cur_step.load(butil::memory_order_relaxed) + 1;
+    for (int i = 0; i < nstep; ++i) {
+        const PressStep* s = _steps[i];
+        const double duration_s = (s->end_us - s->begin_us) / 1000000.0;
+        const LatencyHistogram& h = s->latency;
+        const long long success = h.count();
+        const double achieved_qps = (duration_s > 0 ? success / duration_s : 0);
+        if (json) {
+            fprintf(fp, "%s\n  {\"qps\":%.0f,\"duration_s\":%.3f,\"sent\":%lld,"
+                    "\"success\":%lld,\"error\":%lld,\"achieved_qps\":%.1f,"
+                    "\"avg_us\":%lld,\"p50_us\":%lld,\"p90_us\":%lld,"
+                    "\"p99_us\":%lld,\"p999_us\":%lld,\"p9999_us\":%lld,"
+                    "\"max_us\":%lld}",
+                    (i ? "," : ""), s->req_rate, duration_s,
+                    (long long)s->sent_count.get_value(), success,
+                    (long long)s->error_count.get_value(), achieved_qps,
+                    (long long)h.latency(),
+                    (long long)h.latency_percentile(0.5),
+                    (long long)h.latency_percentile(0.9),
+                    (long long)h.latency_percentile(0.99),
+                    (long long)h.latency_percentile(0.999),
+                    (long long)h.latency_percentile(0.9999),
+                    (long long)h.max_latency());
+        } else {
+            fprintf(fp, "%.0f,%.3f,%lld,%lld,%lld,%.1f,%lld,%lld,%lld,%lld,%lld,%lld,%lld\n",
+                    s->req_rate, duration_s,
+                    (long long)s->sent_count.get_value(), success,
+                    (long long)s->error_count.get_value(), achieved_qps,
+                    (long long)h.latency(),
+                    (long long)h.latency_percentile(0.5),
+                    (long long)h.latency_percentile(0.9),
+                    (long long)h.latency_percentile(0.99),
+                    (long long)h.latency_percentile(0.999),
+                    (long long)h.latency_percentile(0.9999),
+                    (long long)h.max_latency());
+        }
+    }
+    if (json) {
+        fprintf(fp, "\n]\n");
+    }
+    if (fp != stdout) {
+        fclose(fp);
+    } else {
+        fflush(fp);
+    }
+}
 } //namespace
@@ -25,6 +25,7 @@
 #include <bvar/bvar.h>
 #include <brpc/channel.h>
 #include "info_thread.h"
+#include "latency_histogram.h"
 #include "pb_util.h"
 
 namespace pbrpcframework {
@@ -56,6 +57,12 @@ struct PressOptions {
     std::string lb_policy; // "rr", "Policy of load balance rr ||random"
     std::string proto_file;
     std::string proto_includes;
+    bool poisson_arrival; // Intervals between requests are exponentially distributed
+    bool open_loop; // Never skip requests behind schedule
+    double max_req_rate; // Increase test_req_rate to this rate step by step
+    double req_rate_step;
+    std::string report; // File of stats of steps, stdout if empty
+    std::string report_format; // csv or json
     
     PressOptions() :
         server_type(0),
@@ -67,10 +74,27 @@ struct PressOptions {
         request_compress_type(0),
         response_compress_type(0),
         attachment_size(0),
-        auth(false)
+        auth(false),
+        poisson_arrival(false),
+        open_loop(false),
+        max_req_rate(0),
+        req_rate_step(0)
     {}
 };
 
+// Stats of requests supposed to be sent in one step of pressure.
+struct PressStep {
+    double req_rate;
+    int64_t begin_us;
+    int64_t end_us;
+    bvar::Adder<int64_t> sent_count;
+    bvar::Adder<int64_t> error_count;
+    // Latencies from the time that requests were supposed to be sent.
+    LatencyHistogram latency;
+
+    explicit PressStep(double rate) : req_rate(rate), begin_us(0), end_us(0) {}
+};
+
 class PressClient {
 public:
     PressClient(const PressOptions* options,
@@ -109,6 +133,8 @@ public:
     ~RpcPress();
     int init(const PressOptions* options);
     int start();
+    // Move to next step of pressure. Returns false if there's no more steps.
+    bool next_step();
     int stop();
     const PressOptions* options() { return &_options; }
     
@@ -120,10 +146,17 @@ private:
     void handle_response(brpc::Controller* cntl,
                          google::protobuf::Message* request,
                          google::protobuf::Message* response,
-                         int64_t start_time_ns);
+                         int64_t start_time_us,
+                         int64_t intended_time_us,
+                         PressStep* step);
     static void* sync_call_thread(void* arg);
+    void write_report();
 
     bvar::LatencyRecorder _latency_recorder;
+    bvar::LatencyRecorder _corrected_latency_recorder;
+    butil::atomic<int64_t> _inflight_count;
+    std::vector<PressStep*> _steps;
+    butil::atomic<int> _cur_step;
     bvar::Adder<int64_t> _error_count;
     bvar::Adder<int64_t> _sent_count;
     std::deque<google::protobuf::Message*> _msgs;
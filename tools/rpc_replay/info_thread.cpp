@@ -31,6 +31,31 @@ InfoThread::~InfoThread() {
     pthread_cond_destroy(&_cond);
 }
 
+static void print_latency(const char* title, bvar::LatencyRecorder* lr) {
+    printf("%s\n"
+           "  avg     %10lld us\n"
+           "  50%%     %10lld us\n"
+           "  70%%     %10lld us\n"
+           "  90%%     %10lld us\n"
+           "  95%%     %10lld us\n"
+           "  97%%     %10lld us\n"
+           "  99%%     %10lld us\n"
+           "  99.9%%   %10lld us\n"
+           "  99.99%%  %10lld us\n"
+           "  max     %10lld us\n",
+           title,
+           (long long)lr->latency(),
+           (long long)lr->latency_percentile(0.5),
+           (long long)lr->latency_percentile(0.7),
+           (long long)lr->latency_percentile(0.9),
+           (long long)lr->latency_percentile(0.95),
+           (long long)lr->latency_percentile(0.97),
+           (long long)lr->latency_percentile(0.99),
+           (long long)lr->latency_percentile(0.999),
+           (long long)lr->latency_percentile(0.9999),
+           (long long)lr->max_latency());
+}
+
 void InfoThread::run() {
     int64_t i = 0;
     int64_t last_sent_count = 0;
@@ -69,27 +94,11 @@ void InfoThread::run() {
         last_error_count = cur_error_count;
 
         if (_stop || ++i % 10 == 0) {
-            printf("[Latency]\n"
-                   "  avg     %10lld us\n"
-                   "  50%%     %10lld us\n"
-                   "  70%%     %10lld us\n"
-                   "  90%%     %10lld us\n"
-                   "  95%%     %10lld us\n"
-                   "  97%%     %10lld us\n"
-                   "  99%%     %10lld us\n"
-                   "  99.9%%   %10lld us\n"
-                   "  99.99%%  %10lld us\n"
-                   "  max     %10lld us\n",
-                   (long long)_options.latency_recorder->latency(),
-                   (long long)_options.latency_recorder->latency_percentile(0.5),
-                   (long long)_options.latency_recorder->latency_percentile(0.7),
-                   (long long)_options.latency_recorder->latency_percentile(0.9),
-                   (long long)_options.latency_recorder->latency_percentile(0.95),
-                   (long long)_options.latency_recorder->latency_percentile(0.97),
-                   (long long)_options.latency_recorder->latency_percentile(0.99),
-                   (long long)_options.latency_recorder->latency_percentile(0.999),
-                   (long long)_options.latency_recorder->latency_percentile(0.9999),
-                   (long long)_options.latency_recorder->max_latency());
+            print_latency("[Latency]", _options.latency_recorder);
+            if (_options.corrected_latency_recorder) {
+                print_latency("[Corrected Latency]",
+                              _options.corrected_latency_recorder);
+            }
         }
     }
 }
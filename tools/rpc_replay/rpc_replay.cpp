@@ -23,6 +23,7 @@
 #include <butil/file_util.h>
 #include <bvar/bvar.h>
 #include <bthread/bthread.h>
+#include <bthread/countdown_event.h>
 #include <brpc/channel.h>
 #include <brpc/server.h>
 #include <brpc/rpc_dump.h>
@@ -45,8 +46,15 @@ DEFINE_int32(timeout_ms, 100, "RPC timeout in milliseconds");
 DEFINE_int32(max_retry, 3, "Maximum retry times");
 DEFINE_int32(dummy_port, 8899, "Port of dummy server(to monitor replaying)");
 DEFINE_string(http_host, "", "Host field for http protocol");
+DEFINE_double(time_scale, 0, "Replay requests at the recorded time with "
+              "intervals divided by this factor if this flag is positive, "
+              "e.g. 2 replays twice as fast as recorded. -qps is ignored");
 
 bvar::LatencyRecorder g_latency_recorder("rpc_replay");
+// Latency from the time that a request is supposed to be sent, which
+// includes the delay of sending caused by slow responses (coordinated
+// omission).
+bvar::LatencyRecorder g_corrected_latency_recorder("rpc_replay_corrected");
 bvar::Adder<int64_t> g_error_count("rpc_replay_error_count");
 bvar::Adder<int64_t> g_sent_count;
 
@@ -115,7 +123,7 @@ ChannelGroup::~ChannelGroup() {
 }
 
 static void handle_response(brpc::Controller* cntl, int64_t start_time,
-                            bool sleep_on_error/*note*/) {
+                            int64_t intended_time, bool sleep_on_error/*note*/) {
     // TODO(gejun): some bthreads are starved when new bthreads are created 
     // continuously, which happens when server is down and RPC keeps failing.
     // Sleep a while on error to avoid that now.
@@ -123,6 +131,7 @@ static void handle_response(brpc::Controller* cntl, int64_t start_time,
     const int64_t elp = end_time - start_time;
     if (!cntl->Failed()) {
         g_latency_recorder << elp;
+        g_corrected_latency_recorder << end_time - intended_time;
     } else {
         g_error_count << 1;
         if (sleep_on_error) {
@@ -134,6 +143,40 @@ static void handle_response(brpc::Controller* cntl, int64_t start_time,
 
 butil::atomic<int> g_thread_offset(0);
 
+// Fill request of `sample' into `cntl'. Ownership of `sample' is transferred
+// to `cntl'. Returns the request message to be passed to CallMethod().
+static google::protobuf::Message* fill_request(
+    brpc::SampledRequest* sample, brpc::Controller* cntl,
+    brpc::SerializedRequest* req, brpc::NsheadMessage* nshead_req) {
+    req->Clear();
+    google::protobuf::Message* req_ptr = req;
+    cntl->reset_sampled_request(sample);
+    if (sample->meta.protocol_type() == brpc::PROTOCOL_HTTP) {
+        brpc::HttpMessage http_message;
+        http_message.ParseFromIOBuf(sample->request);
+        cntl->http_request().Swap(http_message.header());
+        if (!FLAGS_http_host.empty()) {
+            // reset Host in header
+            cntl->http_request().SetHeader("Host", FLAGS_http_host);
+        }
+        cntl->request_attachment() = http_message.body().movable();
+        req_ptr = NULL;
+    } else if (sample->meta.protocol_type() == brpc::PROTOCOL_NSHEAD) {
+        nshead_req->Clear();
+        memcpy(&nshead_req->head, sample->meta.nshead().c_str(), sample->meta.nshead().length());
+        nshead_req->body = sample->request;
+        req_ptr = nshead_req;
+    } else if (sample->meta.attachment_size() > 0) {
+        sample->request.cutn(
+            &req->serialized_data(),
+            sample->request.size() - sample->meta.attachment_size());
+        cntl->request_attachment() = sample->request.movable();
+    } else {
+        req->serialized_data() = sample->request.movable();
+    }
+    return req_ptr;
+}
+
 static void* replay_thread(void* arg) {
     ChannelGroup* chan_group = static_cast<ChannelGroup*>(arg);
     const int thread_offset = g_thread_offset.fetch_add(1, butil::memory_order_relaxed);
@@ -162,42 +205,21 @@ static void* replay_thread(void* arg) {
             }
             
             brpc::Controller* cntl = new brpc::Controller;
-            req.Clear();
-            
-            google::protobuf::Message* req_ptr = &req;
-            cntl->reset_sampled_request(sample_guard.release());
-            if (sample->meta.protocol_type() == brpc::PROTOCOL_HTTP) {
-                brpc::HttpMessage http_message;
-                http_message.ParseFromIOBuf(sample->request);
-                cntl->http_request().Swap(http_message.header());
-                if (!FLAGS_http_host.empty()) {
-                    // reset Host in header
-                    cntl->http_request().SetHeader("Host", FLAGS_http_host);
-                }
-                cntl->request_attachment() = http_message.body().movable();
-                req_ptr = NULL;
-            } else if (sample->meta.protocol_type() == brpc::PROTOCOL_NSHEAD) {
-                nshead_req.Clear();
-                memcpy(&nshead_req.head, sample->meta.nshead().c_str(), sample->meta.nshead().length());
-                nshead_req.body = sample->request;
-                req_ptr = &nshead_req;
-            } else if (sample->meta.attachment_size() > 0) {
-                sample->request.cutn(
-                    &req.serialized_data(),
-                    sample->request.size() - sample->meta.attachment_size());
-                cntl->request_attachment() = sample->request.movable();
-            } else {
-                req.serialized_data() = sample->request.movable();
-            }
+            google::protobuf::Message* req_ptr = fill_request(
+                sample_guard.release(), cntl, &req, &nshead_req);
             g_sent_count << 1;
             const int64_t start_time = butil::gettimeofday_us();
             if (FLAGS_qps <= 0) {
                 chan->CallMethod(NULL/*use rpc_dump_context in cntl instead*/,
                         cntl, req_ptr, NULL/*ignore response*/, NULL);
-                handle_response(cntl, start_time, true);
+                handle_response(cntl, start_time, start_time, true);
             } else {
+                // Requests are supposed to be sent at a fixed interval.
+                const int64_t intended_time = start_time -
+                    (butil::monotonic_time_ns() - last_expected_time) / 1000;
                 google::protobuf::Closure* done =
-                    brpc::NewCallback(handle_response, cntl, start_time, false);
+                    brpc::NewCallback(handle_response, cntl, start_time,
+                                      intended_time, false);
                 chan->CallMethod(NULL/*use rpc_dump_context in cntl instead*/,
                         cntl, req_ptr, NULL/*ignore response*/, done);
                 int64_t end_time = butil::monotonic_time_ns();
@@ -215,6 +237,92 @@ static void* replay_thread(void* arg) {
     return NULL;
 }
 
+// Threads replaying with the recorded timing share the same clock in each
+// round: a sample recorded at `received_us' is sent at
+// start_us + (received_us - base_us) / FLAGS_time_scale.
+struct ReplayRound {
+    explicit ReplayRound(int nthread)
+        : ready(nthread), base_us(INT64_MAX), start_us(0) {}
+
+    // Signaled by each thread after reading its first sample.
+    bthread::CountdownEvent ready;
+    // Earliest time of first samples of all threads.
+    butil::atomic<int64_t> base_us;
+    butil::atomic<int64_t> start_us;
+};
+
+std::vector<ReplayRound*> g_rounds;
+
+static void* replay_thread_with_timing(void* arg) {
+    ChannelGroup* chan_group = static_cast<ChannelGroup*>(arg);
+    const int thread_offset = g_thread_offset.fetch_add(1, butil::memory_order_relaxed);
+    brpc::SerializedRequest req;
+    brpc::NsheadMessage nshead_req;
+    for (int i = 0; i < FLAGS_times; ++i) {
+        ReplayRound* round = g_rounds[i];
+        // Dumped files are sharded across threads, each of which sends
+        // samples in its files without waiting for responses.
+        brpc::SampleIterator it(FLAGS_dir, thread_offset, FLAGS_thread_num);
+        brpc::SampledRequest* first = it.Next();
+        if (first != NULL && first->meta.has_received_us()) {
+            const int64_t received_us = first->meta.received_us();
+            int64_t base_us = round->base_us.load(butil::memory_order_relaxed);
+            while (received_us < base_us &&
+                   !round->base_us.compare_exchange_weak(base_us, received_us)) {}
+        }
+        round->ready.signal();
+        round->ready.wait();
+        int64_t expected = 0;
+        round->start_us.compare_exchange_strong(expected, butil::gettimeofday_us());
+        const int64_t start_us = round->start_us.load(butil::memory_order_relaxed);
+        const int64_t base_us = round->base_us.load(butil::memory_order_relaxed);
+        for (brpc::SampledRequest* sample = first;
+             sample != NULL; sample = it.Next()) {
+            std::unique_ptr<brpc::SampledRequest> sample_guard(sample);
+            if (brpc::IsAskedToQuit()) {
+                break;
+            }
+            brpc::Channel* chan =
+                chan_group->channel(sample->meta.protocol_type());
+            if (chan == NULL) {
+                LOG(ERROR) << "No channel on protocol="
+                           << sample->meta.protocol_type();
+                continue;
+            }
+            int64_t intended_time = butil::gettimeofday_us();
+            if (sample->meta.has_received_us() && base_us != INT64_MAX) {
+                intended_time = start_us + (int64_t)(
+                    (sample->meta.received_us() - base_us) / FLAGS_time_scale);
+                const int64_t now = butil::gettimeofday_us();
+                if (now < intended_time) {
+                    bthread_usleep(intended_time - now);
+                }
+            } else {
+                LOG_FIRST_N(WARNING, 1) << "Samples without recorded time "
+                                           "are sent immediately";
+            }
+            brpc::Controller* cntl = new brpc::Controller;
+            google::protobuf::Message* req_ptr = fill_request(
+                sample_guard.release(), cntl, &req, &nshead_req);
+            g_sent_count << 1;
+            const int64_t start_time = butil::gettimeofday_us();
+            google::protobuf::Closure* done =
+                brpc::NewCallback(handle_response, cntl, start_time,
+                                  intended_time, false);
+            chan->CallMethod(NULL/*use rpc_dump_context in cntl instead*/,
+                             cntl, req_ptr, NULL/*ignore response*/, done);
+        }
+        if (brpc::IsAskedToQuit()) {
+            // Other threads have to pass the barriers of remaining rounds.
+            for (++i; i < FLAGS_times; ++i) {
+                g_rounds[i]->ready.signal();
+            }
+            break;
+        }
+    }
+    return NULL;
+}
+
 int main(int argc, char* argv[]) {
     // Parse gflags. We recommend you to use gflags as well.
     GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
@@ -236,7 +344,10 @@ int main(int argc, char* argv[]) {
     }
 
     if (FLAGS_thread_num <= 0) {
-        if (FLAGS_qps <= 0) { // unlimited qps
+        if (FLAGS_time_scale > 0) {
+            // Sending is open-loop, a few threads are enough.
+            FLAGS_thread_num = 8;
+        } else if (FLAGS_qps <= 0) { // unlimited qps
             FLAGS_thread_num = 50;
         } else {
             FLAGS_thread_num = FLAGS_qps / 10000;
@@ -251,18 +362,26 @@ int main(int argc, char* argv[]) {
 
     const int rate_limit_per_thread = 1000000;
     int req_rate_per_thread = FLAGS_qps / FLAGS_thread_num;
-    if (req_rate_per_thread > rate_limit_per_thread) {
+    if (FLAGS_time_scale <= 0 && req_rate_per_thread > rate_limit_per_thread) {
         LOG(ERROR) << "req_rate: " << (int64_t) req_rate_per_thread << " is too large in one thread. The rate limit is " 
                 <<  rate_limit_per_thread << " in one thread";
         return -1;
     }    
 
+    void* (*thread_fn)(void*) = replay_thread;
+    if (FLAGS_time_scale > 0) {
+        thread_fn = replay_thread_with_timing;
+        for (int i = 0; i < FLAGS_times; ++i) {
+            g_rounds.push_back(new ReplayRound(FLAGS_thread_num));
+        }
+    }
+
     std::vector<bthread_t> bids;
     std::vector<pthread_t> pids;
     if (!FLAGS_use_bthread) {
         pids.resize(FLAGS_thread_num);
         for (int i = 0; i < FLAGS_thread_num; ++i) {
-            if (pthread_create(&pids[i], NULL, replay_thread, &chan_group) != 0) {
+            if (pthread_create(&pids[i], NULL, thread_fn, &chan_group) != 0) {
                 LOG(ERROR) << "Fail to create pthread";
                 return -1;
             }
@@ -271,7 +390,7 @@ int main(int argc, char* argv[]) {
         bids.resize(FLAGS_thread_num);
         for (int i = 0; i < FLAGS_thread_num; ++i) {
             if (bthread_start_background(
-                    &bids[i], NULL, replay_thread, &chan_group) != 0) {
+                    &bids[i], NULL, thread_fn, &chan_group) != 0) {
                 LOG(ERROR) << "Fail to create bthread";
                 return -1;
             }
@@ -282,6 +401,7 @@ int main(int argc, char* argv[]) {
     info_thr_opt.latency_recorder = &g_latency_recorder;
     info_thr_opt.error_count = &g_error_count;
     info_thr_opt.sent_count = &g_sent_count;
+    info_thr_opt.corrected_latency_recorder = &g_corrected_latency_recorder;
     
     if (!info_thr.start(info_thr_opt)) {
         LOG(ERROR) << "Fail to create info_thread";
@@ -296,6 +416,10 @@ int main(int argc, char* argv[]) {
         }
     }
     info_thr.stop();
+    for (size_t i = 0; i < g_rounds.size(); ++i) {
+        delete g_rounds[i];
+    }
+    g_rounds.clear();
 
     return 0;
 }